@@ -45,10 +45,16 @@ CdInitializeGlobalData (
     _In_ PDEVICE_OBJECT FileSystemDeviceObject
     );
 
+ULONG
+CdQueryReadAheadDepth (
+    _In_ PUNICODE_STRING RegistryPath
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(PAGE, CdUnload)
 #pragma alloc_text(INIT, CdInitializeGlobalData)
+#pragma alloc_text(INIT, CdQueryReadAheadDepth)
 #endif
 
 
@@ -87,8 +93,6 @@ Return Value:
     PDEVICE_OBJECT CdfsFileSystemDeviceObject;
     FS_FILTER_CALLBACKS FilterCallbacks;
 
-    UNREFERENCED_PARAMETER( RegistryPath );
-
     //
     // Create the device object.
     //
@@ -177,6 +181,12 @@ Return Value:
         return Status;
     }
 
+    //
+    //  Pick up the read-ahead depth for sequential non-cached reads.
+    //
+
+    CdData.ReadAheadDepth = CdQueryReadAheadDepth( RegistryPath );
+
     //
     //  Register the file system as low priority with the I/O system.  This will cause
     //  CDFS to receive mount requests after a) other filesystems currently registered
@@ -376,3 +386,53 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+
+//
+//  Local support routine
+//
+
+ULONG
+CdQueryReadAheadDepth (
+    _In_ PUNICODE_STRING RegistryPath
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the ReadAheadDepth value from our service key.  This
+    is the number of chunks we read ahead of a sequential non-cached reader,
+    zero to turn read-ahead off.
+
+Arguments:
+
+    RegistryPath - Our service key, as passed to DriverEntry.
+
+Return Value:
+
+    ULONG - The read-ahead depth, the default if the value isn't present.
+
+--*/
+
+{
+    RTL_QUERY_REGISTRY_TABLE QueryTable[2];
+    ULONG Depth = CD_READ_AHEAD_DEFAULT_DEPTH;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( QueryTable, sizeof( QueryTable ));
+
+    QueryTable[0].Flags = RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK;
+    QueryTable[0].Name = L"ReadAheadDepth";
+    QueryTable[0].EntryContext = &Depth;
+    QueryTable[0].DefaultType = (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE;
+
+    (VOID) RtlQueryRegistryValues( RTL_REGISTRY_ABSOLUTE,
+                                   RegistryPath->Buffer,
+                                   QueryTable,
+                                   NULL,
+                                   NULL );
+
+    return Min( Depth, CD_READ_AHEAD_MAX_DEPTH );
+}
+
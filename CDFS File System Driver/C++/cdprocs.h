@@ -74,9 +74,11 @@ Abstract:
 #define TAG_IRP_CONTEXT         'cidC'      //  Irp Context
 #define TAG_IRP_CONTEXT_LITE    'lidC'      //  Irp Context lite
 #define TAG_MCB_ARRAY           'amdC'      //  Mcb array
+#define TAG_NAME_INDEX          'indC'      //  Name index for directory or path table
 #define TAG_PATH_ENTRY_NAME     'nPdC'      //  CdName in path entry
 #define TAG_PREFIX_ENTRY        'epdC'      //  Prefix Entry
 #define TAG_PREFIX_NAME         'npdC'      //  Prefix Entry name
+#define TAG_READ_AHEAD          'ardC'      //  Read-ahead state and buffers
 #define TAG_SPANNING_PATH_TABLE 'psdC'      //  Buffer for spanning path table
 #define TAG_UPCASE_NAME         'nudC'      //  Buffer for upcased name
 #define TAG_VOL_DESC            'dvdC'      //  Buffer for volume descriptor
@@ -277,6 +279,29 @@ CdNonCachedXARead (
     _In_ ULONG ByteCount
     );
 
+VOID
+CdStartReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount
+    );
+
+BOOLEAN
+CdCopyFromReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount
+    );
+
+VOID
+CdDeleteReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ __drv_freesMem(Mem) PCD_READ_AHEAD ReadAhead
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 NTSTATUS
 CdVolumeDasdWrite (
@@ -663,6 +688,12 @@ CdFullCompareNames (
     _In_ PUNICODE_STRING NameB
     );
 
+ULONG
+CdHashName (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PUNICODE_STRING Name
+    );
+
 
 //
 //  Filesystem control operations.  Implemented in Fsctrl.c
@@ -1158,6 +1189,53 @@ CdInitializeFcbFromFileContext (
     _In_ PFILE_ENUM_CONTEXT FileContext
     );
 
+BOOLEAN
+CdAddNameIndexEntry (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PCD_NAME_INDEX_BUILDER Builder,
+    _In_ ULONG NameHash,
+    _In_ ULONG ParentOrdinal,
+    _In_ ULONG Ordinal,
+    _In_ ULONG Offset
+    );
+
+PCD_NAME_INDEX
+CdCreateNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PCD_NAME_INDEX_BUILDER Builder
+    );
+
+VOID
+CdCleanupNameIndexBuilder (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PCD_NAME_INDEX_BUILDER Builder
+    );
+
+//
+//  Building a name index is only an optimization.  We will swallow the
+//  errors below while building one and fall back to a linear scan, which
+//  will raise them again if they really matter.
+//
+
+#define CdNameIndexExceptionFilter(S)                   \
+    ((((S) == STATUS_INSUFFICIENT_RESOURCES) ||         \
+      ((S) == STATUS_DISK_CORRUPT_ERROR) ||             \
+      ((S) == STATUS_FILE_CORRUPT_ERROR)) ?             \
+     EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+
+PCD_NAME_INDEX
+CdFindNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb
+    );
+
+PCD_NAME_INDEX
+CdInstallNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb,
+    _In_opt_ PCD_NAME_INDEX NameIndex
+    );
+
 PCCB
 CdCreateCcb (
     _In_ PIRP_CONTEXT IrpContext,
@@ -411,6 +411,13 @@ typedef struct _CD_DATA {
 
     PIO_WORKITEM CloseItem;
 
+    //
+    //  Number of chunks we will read ahead of a sequential non-cached
+    //  reader.  Zero disables read-ahead.
+    //
+
+    ULONG ReadAheadDepth;
+
 } CD_DATA;
 typedef CD_DATA *PCD_DATA;
 
@@ -626,6 +633,16 @@ typedef struct _VCB {
 
     RTL_GENERIC_TABLE FcbTable;
 
+    //
+    //  Name indexes built for large directories and the path table, and the
+    //  pool they use.  They live as long as the Vcb so that a directory Fcb
+    //  torn down between opens doesn't have to rebuild its index.
+    //  Synchronized with the Vcb fast mutex.
+    //
+
+    LIST_ENTRY NameIndexList;
+    ULONG NameIndexBytes;
+
     //
     //  Volume TOC.  Cache this information for quick lookup.
     //
@@ -766,6 +783,87 @@ typedef enum _FCB_CONDITION {
     FcbNeedsToBeVerified
 } FCB_CONDITION;
 
+//
+//  The following structures describe the read-ahead state for a data Fcb.
+//  Once a user handle issues a run of sequential non-cached reads we keep
+//  up to CdData.ReadAheadDepth chunk sized reads going ahead of it, each
+//  from a work item.  Later reads copy out of these buffers instead of
+//  waiting on the device.  The media is read only, so staged data can't go
+//  stale.
+//
+
+#define CD_READ_AHEAD_MAX_DEPTH         (8)
+#define CD_READ_AHEAD_DEFAULT_DEPTH     (4)
+#define CD_READ_AHEAD_CHUNK_SIZE        (0x10000)
+
+//
+//  Number of back to back sequential reads before we start reading ahead.
+//
+
+#define CD_READ_AHEAD_SEQUENTIAL_RUN    (2)
+
+typedef struct _CD_READ_AHEAD_BUFFER {
+
+    //
+    //  File offset of this chunk, or -1 if the buffer is free, and the
+    //  number of valid bytes once the read completes.
+    //
+
+    LONGLONG FileOffset;
+    ULONG ByteCount;
+
+    //
+    //  Result of the read.  This is STATUS_PENDING while the read is in
+    //  flight, and Event is signalled when it completes.
+    //
+
+    NTSTATUS Status;
+    KEVENT Event;
+
+    //
+    //  Number of readers waiting on or copying out of this buffer.  We
+    //  won't reuse the buffer while this is non-zero.
+    //
+
+    ULONG Readers;
+
+    //
+    //  Work item and referenced user file object for an in flight read.
+    //
+
+    PIO_WORKITEM WorkItem;
+    PFILE_OBJECT FileObject;
+
+    struct _CD_READ_AHEAD *ReadAhead;
+
+    PVOID Buffer;
+
+} CD_READ_AHEAD_BUFFER;
+typedef CD_READ_AHEAD_BUFFER *PCD_READ_AHEAD_BUFFER;
+
+typedef struct _CD_READ_AHEAD {
+
+    struct _FCB *Fcb;
+
+    //
+    //  Mutex protecting the buffer states below.
+    //
+
+    FAST_MUTEX Mutex;
+
+    //
+    //  Set when the read-ahead is being torn down.  Reads which haven't
+    //  started yet will give up.
+    //
+
+    BOOLEAN Closing;
+
+    ULONG Depth;
+    CD_READ_AHEAD_BUFFER Buffers[CD_READ_AHEAD_MAX_DEPTH];
+
+} CD_READ_AHEAD;
+typedef CD_READ_AHEAD *PCD_READ_AHEAD;
+
 typedef struct _FCB_DATA {
 
 #if (NTDDI_VERSION < NTDDI_WIN8)
@@ -785,9 +883,115 @@ typedef struct _FCB_DATA {
 
     PFILE_LOCK FileLock;
 
+    //
+    //  Sequential read detection for non-cached user reads.  This is only a
+    //  hint and is updated without synchronization.
+    //
+    //  ReadAheadNextOffset - Offset just past the last non-cached read.
+    //  ReadAheadRun - Number of back to back sequential reads.
+    //  ReadAhead - Read-ahead buffers, allocated once the reads look
+    //      sequential and freed with the last handle.
+    //
+
+    LONGLONG ReadAheadNextOffset;
+    ULONG ReadAheadRun;
+    PCD_READ_AHEAD ReadAhead;
+
 } FCB_DATA;
 typedef FCB_DATA *PFCB_DATA;
 
+//
+//  The following is a hash index from name to path table entry or dirent.
+//  It is built the first time a large path table or directory is searched
+//  by name.  The media is read only, so once built the index never changes
+//  and is shared by every reader without synchronization.
+//
+//  Entries in a bucket are kept in on-disk order so that lookups find the
+//  same entry a linear scan would.
+//
+//  We won't index more than CD_NAME_INDEX_MAX_ENTRIES names in a single
+//  directory or path table; anything larger is searched linearly.
+//
+//  Indexes belong to the Vcb and are found again by FileId when the Fcb is
+//  recreated.  Once a volume's indexes use CD_NAME_INDEX_VCB_POOL_LIMIT bytes
+//  of pool, further directories are searched linearly.
+//
+
+#define CD_NAME_INDEX_MAX_ENTRIES       (0x100000)
+#define CD_NAME_INDEX_VCB_POOL_LIMIT    (0x1000000)
+
+typedef struct _CD_NAME_INDEX_ENTRY {
+
+    //
+    //  One-based index of the next entry in this bucket, zero at the end.
+    //
+
+    ULONG Next;
+
+    //
+    //  Hash of the upcased name, mixed with the parent ordinal for path
+    //  table entries.
+    //
+
+    ULONG NameHash;
+
+    //
+    //  Parent ordinal and ordinal of a path table entry.  Zero for dirents.
+    //
+
+    ULONG ParentOrdinal;
+    ULONG Ordinal;
+
+    //
+    //  Offset of the path table entry, or of the initial dirent for a file,
+    //  in its stream.
+    //
+
+    ULONG Offset;
+
+} CD_NAME_INDEX_ENTRY;
+typedef CD_NAME_INDEX_ENTRY *PCD_NAME_INDEX_ENTRY;
+
+typedef struct _CD_NAME_INDEX {
+
+    //
+    //  Links on the Vcb NameIndexList, the FileId of the directory or path
+    //  table this indexes, and the size of this allocation.
+    //
+
+    LIST_ENTRY VcbLinks;
+    FILE_ID FileId;
+    ULONG AllocationSize;
+
+    ULONG EntryCount;
+
+    //
+    //  Number of buckets, always a power of two, and the bucket heads which
+    //  follow the entries in the same allocation.
+    //
+
+    ULONG BucketCount;
+    PULONG Buckets;
+
+    CD_NAME_INDEX_ENTRY Entries[1];
+
+} CD_NAME_INDEX;
+typedef CD_NAME_INDEX *PCD_NAME_INDEX;
+
+//
+//  Scratch list of entries gathered while scanning, before the index is
+//  sized and hashed.
+//
+
+typedef struct _CD_NAME_INDEX_BUILDER {
+
+    PCD_NAME_INDEX_ENTRY Entries;
+    ULONG EntryCount;
+    ULONG EntryLimit;
+
+} CD_NAME_INDEX_BUILDER;
+typedef CD_NAME_INDEX_BUILDER *PCD_NAME_INDEX_BUILDER;
+
 typedef struct _FCB_INDEX {
 
     //
@@ -835,6 +1039,17 @@ typedef struct _FCB_INDEX {
     PRTL_SPLAY_LINKS ExactCaseRoot;
     PRTL_SPLAY_LINKS IgnoreCaseRoot;
 
+    //
+    //  Name index for a large directory or path table, or NULL if it hasn't
+    //  been looked up yet.  This caches a pointer to the index owned by the
+    //  Vcb and is installed once with an interlocked exchange.  It is not
+    //  freed with the Fcb.  NameIndexFailed is set if we gave up on building
+    //  one, so that later searches don't try again.
+    //
+
+    PCD_NAME_INDEX NameIndex;
+    BOOLEAN NameIndexFailed;
+
 } FCB_INDEX;
 typedef FCB_INDEX *PFCB_INDEX;
 
@@ -89,6 +89,8 @@ Return Value:
     PFCB Fcb;
     PCCB Ccb;
 
+    PCD_READ_AHEAD ReadAhead = NULL;
+
     KIRQL SavedIrql;
 
     ASSERT_IRP_CONTEXT( IrpContext );
@@ -147,8 +149,30 @@ Return Value:
 
     SetFlag( FileObject->Flags, FO_CLEANUP_COMPLETE );
 
+    //
+    //  If this is the last handle on the file then take away its read-ahead
+    //  buffers.  No reader can be using them while we hold the file
+    //  exclusive.
+    //
+
+    if ((TypeOfOpen == UserFileOpen) && (Fcb->FcbCleanup == 1)) {
+
+        ReadAhead = Fcb->ReadAhead;
+        Fcb->ReadAhead = NULL;
+    }
+
     CdReleaseFile( IrpContext, Fcb);
 
+    //
+    //  Free them once we've dropped the file, since any reads still in
+    //  flight need to get at it before they finish.
+    //
+
+    if (ReadAhead != NULL) {
+
+        CdDeleteReadAhead( IrpContext, ReadAhead );
+    }
+
     if (TypeOfOpen == UserVolumeOpen) {
 
         //
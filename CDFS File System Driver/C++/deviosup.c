@@ -235,6 +235,22 @@ CdReadDirDataThroughCache (
     _In_ PIO_RUN Run
     );
 
+PCD_READ_AHEAD
+CdCreateReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ ULONG Depth
+    );
+
+//  Tell prefast this is a workitem routine
+IO_WORKITEM_ROUTINE CdReadAheadWorker;
+
+VOID
+CdReadAheadWorker (
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_opt_ PVOID Context
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, CdCreateUserMdl)
 #pragma alloc_text(PAGE, CdMultipleAsync)
@@ -255,6 +271,11 @@ CdReadDirDataThroughCache (
 #pragma alloc_text(PAGE, CdFreeDirCache)
 #pragma alloc_text(PAGE, CdLbnToMmSsFf)
 #pragma alloc_text(PAGE, CdHijackIrpAndFlushDevice)
+#pragma alloc_text(PAGE, CdStartReadAhead)
+#pragma alloc_text(PAGE, CdCopyFromReadAhead)
+#pragma alloc_text(PAGE, CdDeleteReadAhead)
+#pragma alloc_text(PAGE, CdCreateReadAhead)
+#pragma alloc_text(PAGE, CdReadAheadWorker)
 #endif
 
 
@@ -1030,6 +1051,737 @@ Return Value:
     return Status;
 }
 
+VOID
+CdStartReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called for each non-cached read on a user file handle.
+    It tracks whether the reads on this file are sequential, and once they
+    are, keeps the read-ahead buffers filled with the chunks following this
+    request.  Each chunk is read in its own work item, so up to
+    CdData.ReadAheadDepth reads are in flight at once.
+
+    The caller holds the Fcb shared.
+
+Arguments:
+
+    Fcb - Fcb for the file being read.
+
+    FileObject - User file object for this read.  We reference it for each
+        read we start, which keeps the Fcb around until the reads finish.
+
+    StartingOffset - Offset of this read in the file.
+
+    ByteCount - Number of bytes in this read, already trimmed to the end
+        of the file.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PCD_READ_AHEAD ReadAhead;
+    PCD_READ_AHEAD_BUFFER Buffer;
+    PIO_WORKITEM WorkItem;
+
+    LONGLONG ByteRange = StartingOffset + ByteCount;
+    LONGLONG WindowStart;
+    LONGLONG WindowEnd;
+    LONGLONG ChunkOffset;
+
+    ULONG Depth = Min( CdData.ReadAheadDepth, CD_READ_AHEAD_MAX_DEPTH );
+    ULONG Index;
+
+    PAGED_CODE();
+
+    //
+    //  Update the sequential read detection.
+    //
+
+    if (StartingOffset == Fcb->ReadAheadNextOffset) {
+
+        if (Fcb->ReadAheadRun < CD_READ_AHEAD_SEQUENTIAL_RUN) {
+
+            Fcb->ReadAheadRun += 1;
+        }
+
+    //
+    //  A request retried after being posted shouldn't break the run.
+    //
+
+    } else if (ByteRange != Fcb->ReadAheadNextOffset) {
+
+        Fcb->ReadAheadRun = 0;
+    }
+
+    Fcb->ReadAheadNextOffset = ByteRange;
+
+    //
+    //  Nothing to do unless the reads are sequential, there is more of the
+    //  file to read and the reads are small enough for the buffers to stay
+    //  ahead of them.
+    //
+
+    if ((Fcb->ReadAheadRun < CD_READ_AHEAD_SEQUENTIAL_RUN) ||
+        (ByteRange >= Fcb->FileSize.QuadPart) ||
+        (ByteCount > (Depth * CD_READ_AHEAD_CHUNK_SIZE) / 2)) {
+
+        return;
+    }
+
+    //
+    //  Create the read-ahead buffers if this is the first time.
+    //
+
+    ReadAhead = Fcb->ReadAhead;
+
+    if (ReadAhead == NULL) {
+
+        ReadAhead = CdCreateReadAhead( IrpContext, Fcb, Depth );
+
+        if (ReadAhead == NULL) {
+
+            return;
+        }
+
+        if (InterlockedCompareExchangePointer( (PVOID *) &Fcb->ReadAhead,
+                                               ReadAhead,
+                                               NULL ) != NULL) {
+
+            CdDeleteReadAhead( IrpContext, ReadAhead );
+            ReadAhead = Fcb->ReadAhead;
+        }
+    }
+
+    //
+    //  We want the chunks from the one holding the end of this request on
+    //  to be either staged or on their way.
+    //
+
+    WindowStart = ByteRange & ~((LONGLONG) CD_READ_AHEAD_CHUNK_SIZE - 1);
+    WindowEnd = WindowStart + (LONGLONG) ReadAhead->Depth * CD_READ_AHEAD_CHUNK_SIZE;
+
+    ExAcquireFastMutex( &ReadAhead->Mutex );
+
+    for (ChunkOffset = WindowStart;
+         (ChunkOffset < WindowEnd) && (ChunkOffset < Fcb->FileSize.QuadPart);
+         ChunkOffset += CD_READ_AHEAD_CHUNK_SIZE) {
+
+        //
+        //  Skip this chunk if we already have it or are reading it.
+        //
+
+        for (Index = 0; Index < ReadAhead->Depth; Index += 1) {
+
+            Buffer = &ReadAhead->Buffers[Index];
+
+            if ((Buffer->FileOffset == ChunkOffset) &&
+                ((Buffer->Status == STATUS_PENDING) || NT_SUCCESS( Buffer->Status ))) {
+
+                break;
+            }
+        }
+
+        if (Index < ReadAhead->Depth) {
+
+            continue;
+        }
+
+        //
+        //  Find an idle buffer which nobody is using and which doesn't hold
+        //  good data inside the window.
+        //
+
+        for (Index = 0; Index < ReadAhead->Depth; Index += 1) {
+
+            Buffer = &ReadAhead->Buffers[Index];
+
+            if ((Buffer->Status != STATUS_PENDING) &&
+                (Buffer->Readers == 0) &&
+                (!NT_SUCCESS( Buffer->Status ) ||
+                 (Buffer->FileOffset < WindowStart) ||
+                 (Buffer->FileOffset >= WindowEnd))) {
+
+                break;
+            }
+        }
+
+        if (Index == ReadAhead->Depth) {
+
+            break;
+        }
+
+        WorkItem = IoAllocateWorkItem( &CONTAINING_RECORD( Fcb->Vcb,
+                                                           VOLUME_DEVICE_OBJECT,
+                                                           Vcb )->DeviceObject );
+
+        if (WorkItem == NULL) {
+
+            break;
+        }
+
+        ObReferenceObject( FileObject );
+
+        Buffer->FileOffset = ChunkOffset;
+        Buffer->ByteCount = 0;
+        Buffer->Status = STATUS_PENDING;
+        Buffer->WorkItem = WorkItem;
+        Buffer->FileObject = FileObject;
+
+        KeClearEvent( &Buffer->Event );
+
+        IoQueueWorkItem( WorkItem, CdReadAheadWorker, DelayedWorkQueue, Buffer );
+    }
+
+    ExReleaseFastMutex( &ReadAhead->Mutex );
+
+    return;
+}
+
+
+BOOLEAN
+CdCopyFromReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tries to satisfy a non-cached read on a user file out of
+    the read-ahead buffers.  Every chunk covering the request must either
+    be staged or, if this request can wait, be in flight.  Otherwise we
+    leave the user's buffer alone and the caller reads from the device.
+
+    The caller holds the Fcb shared.
+
+Arguments:
+
+    Fcb - Fcb for the file being read.
+
+    StartingOffset - Offset of this read in the file.
+
+    ByteCount - Number of bytes to read, already trimmed to the end of the
+        file.
+
+Return Value:
+
+    BOOLEAN - TRUE if we copied the data into the user's buffer, FALSE if
+        the caller needs to read it from the device.
+
+--*/
+
+{
+    PCD_READ_AHEAD ReadAhead = Fcb->ReadAhead;
+    PCD_READ_AHEAD_BUFFER Chunks[CD_READ_AHEAD_MAX_DEPTH];
+    ULONG ChunkCount = 0;
+
+    PVOID UserBuffer;
+    LONGLONG ByteRange = StartingOffset + ByteCount;
+    LONGLONG ChunkOffset;
+    LONGLONG CurrentOffset = StartingOffset;
+    ULONG BufferOffset;
+    ULONG ThisByteCount;
+    ULONG Index;
+
+    BOOLEAN Wait = BooleanFlagOn( IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT );
+    BOOLEAN Result = FALSE;
+
+    PAGED_CODE();
+
+    if (ReadAhead == NULL) {
+
+        return FALSE;
+    }
+
+    //
+    //  Find the chunks covering this request and hold them so they can't be
+    //  reused while we copy.
+    //
+
+    ExAcquireFastMutex( &ReadAhead->Mutex );
+
+    for (ChunkOffset = StartingOffset & ~((LONGLONG) CD_READ_AHEAD_CHUNK_SIZE - 1);
+         ChunkOffset < ByteRange;
+         ChunkOffset += CD_READ_AHEAD_CHUNK_SIZE) {
+
+        if (ChunkCount == CD_READ_AHEAD_MAX_DEPTH) {
+
+            break;
+        }
+
+        for (Index = 0; Index < ReadAhead->Depth; Index += 1) {
+
+            //
+            //  STATUS_PENDING is a success code, so check for it first or
+            //  a request which can't wait would block on this chunk below.
+            //
+
+            if ((ReadAhead->Buffers[Index].FileOffset == ChunkOffset) &&
+                ((ReadAhead->Buffers[Index].Status == STATUS_PENDING) ?
+                 Wait :
+                 NT_SUCCESS( ReadAhead->Buffers[Index].Status ))) {
+
+                break;
+            }
+        }
+
+        if (Index == ReadAhead->Depth) {
+
+            break;
+        }
+
+        Chunks[ChunkCount] = &ReadAhead->Buffers[Index];
+        ChunkCount += 1;
+    }
+
+    if (ChunkOffset < ByteRange) {
+
+        ExReleaseFastMutex( &ReadAhead->Mutex );
+        return FALSE;
+    }
+
+    for (Index = 0; Index < ChunkCount; Index += 1) {
+
+        Chunks[Index]->Readers += 1;
+    }
+
+    ExReleaseFastMutex( &ReadAhead->Mutex );
+
+    try {
+
+        //
+        //  Wait for any chunks still being read and make sure they hold
+        //  everything we need.
+        //
+
+        for (Index = 0; Index < ChunkCount; Index += 1) {
+
+            (VOID)KeWaitForSingleObject( &Chunks[Index]->Event,
+                                         Executive,
+                                         KernelMode,
+                                         FALSE,
+                                         NULL );
+
+            if (!NT_SUCCESS( Chunks[Index]->Status ) ||
+                (Chunks[Index]->FileOffset + Chunks[Index]->ByteCount <
+                 Min( Chunks[Index]->FileOffset + CD_READ_AHEAD_CHUNK_SIZE, ByteRange ))) {
+
+                try_leave( NOTHING );
+            }
+        }
+
+        //
+        //  Lock and map the user's buffer and copy the data over.
+        //
+
+        if (IrpContext->Irp->MdlAddress == NULL) {
+
+            CdCreateUserMdl( IrpContext, ByteCount, TRUE, IoWriteAccess );
+        }
+
+        CdMapUserBuffer( IrpContext, &UserBuffer );
+
+        for (Index = 0; Index < ChunkCount; Index += 1) {
+
+            BufferOffset = (ULONG) (CurrentOffset - Chunks[Index]->FileOffset);
+            ThisByteCount = (ULONG) (Min( Chunks[Index]->FileOffset + Chunks[Index]->ByteCount,
+                                          ByteRange ) - CurrentOffset);
+
+            RtlCopyMemory( UserBuffer,
+                           Add2Ptr( Chunks[Index]->Buffer, BufferOffset, PVOID ),
+                           ThisByteCount );
+
+            UserBuffer = Add2Ptr( UserBuffer, ThisByteCount, PVOID );
+            CurrentOffset += ThisByteCount;
+        }
+
+        KeFlushIoBuffers( IrpContext->Irp->MdlAddress, TRUE, FALSE );
+
+        Result = TRUE;
+
+    } finally {
+
+        ExAcquireFastMutex( &ReadAhead->Mutex );
+
+        for (Index = 0; Index < ChunkCount; Index += 1) {
+
+            Chunks[Index]->Readers -= 1;
+        }
+
+        ExReleaseFastMutex( &ReadAhead->Mutex );
+    }
+
+    return Result;
+}
+
+
+VOID
+CdDeleteReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ __drv_freesMem(Mem) PCD_READ_AHEAD ReadAhead
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the read-ahead buffers for a file.  The caller has
+    already detached them from the Fcb, so no new reads will be started.
+    We wait for any reads still in flight.
+
+Arguments:
+
+    ReadAhead - Read-ahead state to free.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    ULONG Index;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    //
+    //  Tell any reads which haven't started yet not to bother.
+    //
+
+    ExAcquireFastMutex( &ReadAhead->Mutex );
+    ReadAhead->Closing = TRUE;
+    ExReleaseFastMutex( &ReadAhead->Mutex );
+
+    for (Index = 0; Index < ReadAhead->Depth; Index += 1) {
+
+        (VOID)KeWaitForSingleObject( &ReadAhead->Buffers[Index].Event,
+                                     Executive,
+                                     KernelMode,
+                                     FALSE,
+                                     NULL );
+
+        if (ReadAhead->Buffers[Index].Buffer != NULL) {
+
+            CdFreePool( &ReadAhead->Buffers[Index].Buffer );
+        }
+    }
+
+    CdFreePool( &ReadAhead );
+}
+
+
+//
+//  Local support routine
+//
+
+PCD_READ_AHEAD
+CdCreateReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ ULONG Depth
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the read-ahead state and buffers for a file.  We
+    don't raise on failure, the caller simply won't read ahead.
+
+Arguments:
+
+    Fcb - Fcb for the file being read.
+
+    Depth - Number of chunk buffers to allocate.
+
+Return Value:
+
+    PCD_READ_AHEAD - The new read-ahead state, or NULL if we couldn't get
+        the pool.
+
+--*/
+
+{
+    PCD_READ_AHEAD ReadAhead;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    ReadAhead = ExAllocatePoolWithTag( CdNonPagedPool,
+                                       sizeof( CD_READ_AHEAD ),
+                                       TAG_READ_AHEAD );
+
+    if (ReadAhead == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( ReadAhead, sizeof( CD_READ_AHEAD ));
+
+    ReadAhead->Fcb = Fcb;
+    ReadAhead->Depth = Depth;
+
+    ExInitializeFastMutex( &ReadAhead->Mutex );
+
+    //
+    //  Every buffer starts out idle, with its event signalled.
+    //
+
+    for (Index = 0; Index < Depth; Index += 1) {
+
+        ReadAhead->Buffers[Index].FileOffset = -1;
+        ReadAhead->Buffers[Index].Status = STATUS_SUCCESS;
+        ReadAhead->Buffers[Index].ReadAhead = ReadAhead;
+
+        KeInitializeEvent( &ReadAhead->Buffers[Index].Event, NotificationEvent, TRUE );
+    }
+
+    for (Index = 0; Index < Depth; Index += 1) {
+
+        ReadAhead->Buffers[Index].Buffer = ExAllocatePoolWithTag( CdNonPagedPool,
+                                                                  CD_READ_AHEAD_CHUNK_SIZE,
+                                                                  TAG_READ_AHEAD );
+
+        if (ReadAhead->Buffers[Index].Buffer == NULL) {
+
+            CdDeleteReadAhead( IrpContext, ReadAhead );
+            return NULL;
+        }
+    }
+
+    return ReadAhead;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+CdReadAheadWorker (
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_opt_ PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This is the work item routine which reads one chunk into a read-ahead
+    buffer.  We build a private non-cached read Irp for the chunk and pass
+    it through the same non-cached read path as a user request, so raw
+    XA and audio files are staged exactly as a user would see them.
+
+    We never block on the Fcb.  If it is held exclusive we just fail this
+    chunk and the reader will go to the device itself.
+
+Arguments:
+
+    DeviceObject - Our volume device object.
+
+    Context - The read-ahead buffer to fill.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PCD_READ_AHEAD_BUFFER Buffer = Context;
+    PCD_READ_AHEAD ReadAhead;
+    PFCB Fcb;
+    PFILE_OBJECT FileObject;
+    PIO_WORKITEM WorkItem;
+
+    PIRP Irp = NULL;
+    PIO_STACK_LOCATION IrpSp;
+    PIRP_CONTEXT IrpContext = NULL;
+    THREAD_CONTEXT ThreadContext = {0};
+    CD_IO_CONTEXT IoContext;
+
+    NTSTATUS Status = STATUS_INSUFFICIENT_RESOURCES;
+    ULONG ByteCount;
+    ULONG ReadByteCount;
+    BOOLEAN FcbAcquired = FALSE;
+
+    PAGED_CODE();
+
+    _Analysis_assume_(Context != NULL);
+
+    ReadAhead = Buffer->ReadAhead;
+    Fcb = ReadAhead->Fcb;
+    FileObject = Buffer->FileObject;
+    WorkItem = Buffer->WorkItem;
+
+    //
+    //  Trim the read to the end of the file.  The buffer is a whole number
+    //  of sectors so we can round the transfer up as the user path does.
+    //
+
+    ByteCount = (ULONG) Min( (LONGLONG) CD_READ_AHEAD_CHUNK_SIZE,
+                             Fcb->FileSize.QuadPart - Buffer->FileOffset );
+
+    ReadByteCount = BlockAlign( Fcb->Vcb, ByteCount );
+
+    if (ReadAhead->Closing) {
+
+        Status = STATUS_CANCELLED;
+
+    } else {
+
+        Irp = IoAllocateIrp( (CCHAR) (Fcb->Vcb->TargetDeviceObject->StackSize + 1), FALSE );
+    }
+
+    if ((Irp != NULL) &&
+        (IoAllocateMdl( Buffer->Buffer, ReadByteCount, FALSE, FALSE, Irp ) != NULL)) {
+
+        MmBuildMdlForNonPagedPool( Irp->MdlAddress );
+
+        //
+        //  Fill in our own stack location as the I/O system would for a
+        //  non-cached read.
+        //
+
+        IoSetNextIrpStackLocation( Irp );
+        IrpSp = IoGetCurrentIrpStackLocation( Irp );
+
+        IrpSp->MajorFunction = IRP_MJ_READ;
+        IrpSp->DeviceObject = DeviceObject;
+        IrpSp->FileObject = FileObject;
+        IrpSp->Parameters.Read.Length = ReadByteCount;
+        IrpSp->Parameters.Read.ByteOffset.QuadPart = Buffer->FileOffset;
+
+        Irp->Flags = IRP_NOCACHE | IRP_READ_OPERATION;
+        Irp->RequestorMode = KernelMode;
+        Irp->Tail.Overlay.Thread = PsGetCurrentThread();
+        Irp->Tail.Overlay.OriginalFileObject = FileObject;
+        Irp->IoStatus.Information = ReadByteCount;
+
+        FsRtlEnterFileSystem();
+
+        try {
+
+            try {
+
+                IrpContext = CdCreateIrpContext( Irp, TRUE );
+                CdSetThreadContext( IrpContext, &ThreadContext );
+
+                if (!CdAcquireResource( IrpContext, Fcb->Resource, TRUE, AcquireSharedStarveExclusive )) {
+
+                    try_leave( Status = STATUS_CANT_WAIT );
+                }
+
+                FcbAcquired = TRUE;
+
+                //
+                //  Give up quietly if the handle has been cleaned up or the
+                //  volume needs attention.  The reader will sort that out.
+                //
+
+                if (FlagOn( FileObject->Flags, FO_CLEANUP_COMPLETE ) ||
+                    !CdVerifyFcbOperation( NULL, Fcb )) {
+
+                    try_leave( Status = STATUS_FILE_INVALID );
+                }
+
+                RtlZeroMemory( &IoContext, sizeof( CD_IO_CONTEXT ));
+                KeInitializeEvent( &IoContext.SyncEvent, NotificationEvent, FALSE );
+                IrpContext->IoContext = &IoContext;
+
+                if (FlagOn( Fcb->FcbState, FCB_STATE_RAWSECTOR_MASK )) {
+
+                    Status = CdNonCachedXARead( IrpContext, Fcb, Buffer->FileOffset, ReadByteCount );
+
+                } else {
+
+                    Status = CdNonCachedRead( IrpContext, Fcb, Buffer->FileOffset, ReadByteCount );
+                }
+
+            } finally {
+
+                if (FcbAcquired) {
+
+                    CdReleaseFile( IrpContext, Fcb );
+                }
+
+                if (IrpContext != NULL) {
+
+                    CdCleanupIrpContext( IrpContext, FALSE );
+                }
+            }
+
+        } except( FsRtlIsNtstatusExpected( GetExceptionCode() ) ?
+                  EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH ) {
+
+            Status = GetExceptionCode();
+        }
+
+        FsRtlExitFileSystem();
+
+        //
+        //  Don't leave a verify request behind on this worker thread.
+        //
+
+        IoSetDeviceToVerify( PsGetCurrentThread(), NULL );
+    }
+
+    if (Irp != NULL) {
+
+        if (Irp->MdlAddress != NULL) {
+
+            IoFreeMdl( Irp->MdlAddress );
+        }
+
+        IoFreeIrp( Irp );
+    }
+
+    //
+    //  Publish the result.  Once the event is set the buffer may be freed,
+    //  so we are done with it.
+    //
+
+    ExAcquireFastMutex( &ReadAhead->Mutex );
+
+    if (NT_SUCCESS( Status )) {
+
+        Buffer->Status = STATUS_SUCCESS;
+        Buffer->ByteCount = ByteCount;
+
+    } else {
+
+        Buffer->Status = Status;
+    }
+
+    Buffer->WorkItem = NULL;
+    Buffer->FileObject = NULL;
+
+    ExReleaseFastMutex( &ReadAhead->Mutex );
+
+    KeSetEvent( &Buffer->Event, 0, FALSE );
+
+    ObDereferenceObject( FileObject );
+    IoFreeWorkItem( WorkItem );
+}
+
+
 _Requires_lock_held_(_Global_critical_region_)
 NTSTATUS
 CdVolumeDasdWrite (
@@ -3759,7 +4511,7 @@ Return Value:
     //  and finally, free the context record.
     //
 
-    CdFreeIoContext( (PCD_IO_CONTEXT) Context );
+    CdFreeIoContext( Context );
     return STATUS_SUCCESS;
 
     UNREFERENCED_PARAMETER( DeviceObject );
@@ -88,6 +88,13 @@ Abstract:
 #define CdRawDirent(IC,DC)                                      \
     Add2Ptr( (DC)->Sector, (DC)->SectorOffset, PRAW_DIRENT )
 
+//
+//  We only build a name index for directories big enough that a linear
+//  scan hurts.
+//
+
+#define CD_DIRENT_INDEX_MIN_SIZE        (0x10000)
+
 //
 //  Local support routines
 //
@@ -105,6 +112,23 @@ CdCheckForXAExtent (
     _Inout_ PDIRENT Dirent
     );
 
+PCD_NAME_INDEX
+CdGetDirentIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb
+    );
+
+BOOLEAN
+CdFindIndexedDirent (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ PCD_NAME_INDEX NameIndex,
+    _In_ PCD_NAME Name,
+    _In_ BOOLEAN IgnoreCase,
+    _In_ BOOLEAN FindDirectory,
+    _Inout_ PFILE_ENUM_CONTEXT FileContext
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, CdCheckForXAExtent)
 #pragma alloc_text(PAGE, CdCheckRawDirentBounds)
@@ -112,6 +136,8 @@ CdCheckForXAExtent (
 #pragma alloc_text(PAGE, CdFindFile)
 #pragma alloc_text(PAGE, CdFindDirectory)
 #pragma alloc_text(PAGE, CdFindFileByShortName)
+#pragma alloc_text(PAGE, CdFindIndexedDirent)
+#pragma alloc_text(PAGE, CdGetDirentIndex)
 #pragma alloc_text(PAGE, CdLookupDirent)
 #pragma alloc_text(PAGE, CdLookupLastFileDirent)
 #pragma alloc_text(PAGE, CdLookupNextDirent)
@@ -864,6 +890,7 @@ Return Value:
 {
     PDIRENT Dirent;
     ULONG ShortNameDirentOffset;
+    PCD_NAME_INDEX NameIndex = NULL;
 
     BOOLEAN Found = FALSE;
 
@@ -881,6 +908,36 @@ Return Value:
 
     ShortNameDirentOffset = CdShortNameDirentOffset( IrpContext, &Name->FileName );
 
+    //
+    //  If this can't be a short name and the directory is large, use the
+    //  name index.  Short names are generated from the dirent offset, so
+    //  those still need the full scan.
+    //
+
+    if (ShortNameDirentOffset == MAXULONG) {
+
+        NameIndex = CdGetDirentIndex( IrpContext, Fcb );
+    }
+
+    if (NameIndex != NULL) {
+
+        Found = CdFindIndexedDirent( IrpContext,
+                                     Fcb,
+                                     NameIndex,
+                                     Name,
+                                     IgnoreCase,
+                                     FALSE,
+                                     FileContext );
+
+        if (Found) {
+
+            *MatchingName = &FileContext->InitialDirent->Dirent.CdCaseFileName;
+            CdLookupLastFileDirent( IrpContext, Fcb, FileContext );
+        }
+
+        return Found;
+    }
+
     //
     //  Position ourselves at the first entry.
     //
@@ -1030,6 +1087,7 @@ Return Value:
 
 {
     PDIRENT Dirent;
+    PCD_NAME_INDEX NameIndex;
 
     BOOLEAN Found = FALSE;
 
@@ -1041,6 +1099,23 @@ Return Value:
 
     CdVerifyOrCreateDirStreamFile( IrpContext, Fcb);
 
+    //
+    //  Use the name index if this directory is large enough to have one.
+    //
+
+    NameIndex = CdGetDirentIndex( IrpContext, Fcb );
+
+    if (NameIndex != NULL) {
+
+        return CdFindIndexedDirent( IrpContext,
+                                    Fcb,
+                                    NameIndex,
+                                    Name,
+                                    IgnoreCase,
+                                    TRUE,
+                                    FileContext );
+    }
+
     //
     //  Position ourselves at the first entry.
     //
@@ -1867,4 +1942,226 @@ Return Value:
 }
 
 
+//
+//  Local support routine
+//
+
+PCD_NAME_INDEX
+CdGetDirentIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the name index for a directory, building it on
+    first use.  The index holds the offset of the initial dirent of every
+    file and directory, keyed on the upcased name without the version.
+    The index is kept on the Vcb and outlives the Fcb.  Small directories
+    don't get an index, nor do directories we failed to index once.
+
+Arguments:
+
+    Fcb - Directory to search.  The stream file has already been created.
+
+Return Value:
+
+    PCD_NAME_INDEX - The directory index, or NULL if the caller should
+        walk the directory itself.
+
+--*/
+
+{
+    PCD_NAME_INDEX NameIndex = Fcb->NameIndex;
+    CD_NAME_INDEX_BUILDER Builder;
+    FILE_ENUM_CONTEXT FileContext;
+    PDIRENT Dirent;
+    BOOLEAN Complete = TRUE;
+
+    PAGED_CODE();
+
+    if ((NameIndex != NULL) ||
+        Fcb->NameIndexFailed ||
+        (Fcb->FileSize.QuadPart < CD_DIRENT_INDEX_MIN_SIZE)) {
+
+        return NameIndex;
+    }
+
+    //
+    //  The directory may have been indexed for an earlier Fcb.
+    //
+
+    NameIndex = CdFindNameIndex( IrpContext, Fcb );
+
+    if ((NameIndex != NULL) || Fcb->NameIndexFailed) {
+
+        return NameIndex;
+    }
+
+    RtlZeroMemory( &Builder, sizeof( CD_NAME_INDEX_BUILDER ));
+    CdInitializeFileContext( IrpContext, &FileContext );
+
+    try {
+
+        try {
+
+            CdLookupInitialFileDirent( IrpContext, Fcb, &FileContext, Fcb->StreamOffset );
+
+            do {
+
+                Dirent = &FileContext.InitialDirent->Dirent;
+
+                //
+                //  The hash ignores case, so there is no need to upcase
+                //  the name here.
+                //
+
+                CdUpdateDirentName( IrpContext, Dirent, FALSE );
+
+                if (FlagOn( Dirent->Flags, DIRENT_FLAG_CONSTANT_ENTRY )) {
+
+                    continue;
+                }
+
+                if (!CdAddNameIndexEntry( IrpContext,
+                                          &Builder,
+                                          CdHashName( IrpContext, &Dirent->CdFileName.FileName ),
+                                          0,
+                                          0,
+                                          Dirent->DirentOffset )) {
+
+                    Complete = FALSE;
+                    break;
+                }
+
+            } while (CdLookupNextInitialFileDirent( IrpContext, Fcb, &FileContext ));
+
+            if (Complete) {
+
+                NameIndex = CdCreateNameIndex( IrpContext, &Builder );
+            }
+
+        } finally {
+
+            CdCleanupFileContext( IrpContext, &FileContext );
+            CdCleanupNameIndexBuilder( IrpContext, &Builder );
+        }
+
+    } except( CdNameIndexExceptionFilter( GetExceptionCode() )) {
+
+        IrpContext->ExceptionStatus = STATUS_SUCCESS;
+        NameIndex = NULL;
+    }
+
+    return CdInstallNameIndex( IrpContext, Fcb, NameIndex );
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+CdFindIndexedDirent (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ PCD_NAME_INDEX NameIndex,
+    _In_ PCD_NAME Name,
+    _In_ BOOLEAN IgnoreCase,
+    _In_ BOOLEAN FindDirectory,
+    _Inout_ PFILE_ENUM_CONTEXT FileContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a name using the directory's name index.  We only
+    visit the dirents whose name hashes the same as the search name, in
+    directory order, and apply the same checks as CdFindFile and
+    CdFindDirectory would.
+
+Arguments:
+
+    Fcb - Fcb for the directory being scanned.
+
+    NameIndex - Name index for this directory.
+
+    Name - Name to search for.
+
+    IgnoreCase - Indicates the case of the search.
+
+    FindDirectory - TRUE if we are looking for a directory, FALSE if we are
+        looking for a file.
+
+    FileContext - File context to use for the search.  On a match the
+        initial dirent is positioned at the matching entry.
+
+Return Value:
+
+    BOOLEAN - TRUE if matching entry is found, FALSE otherwise.
+
+--*/
+
+{
+    PDIRENT Dirent;
+    ULONG NameHash;
+    ULONG Entry;
+
+    PAGED_CODE();
+
+    NameHash = CdHashName( IrpContext, &Name->FileName );
+
+    for (Entry = NameIndex->Buckets[ NameHash & (NameIndex->BucketCount - 1) ];
+         Entry != 0;
+         Entry = NameIndex->Entries[ Entry - 1 ].Next) {
+
+        if (NameIndex->Entries[ Entry - 1 ].NameHash != NameHash) {
+
+            continue;
+        }
+
+        //
+        //  Drop the previous candidate and position at this one.
+        //
+
+        CdCleanupDirContext( IrpContext, &FileContext->InitialDirent->DirContext );
+
+        CdLookupInitialFileDirent( IrpContext,
+                                   Fcb,
+                                   FileContext,
+                                   NameIndex->Entries[ Entry - 1 ].Offset );
+
+        Dirent = &FileContext->InitialDirent->Dirent;
+
+        if (FindDirectory) {
+
+            if (!FlagOn( Dirent->DirentFlags, CD_ATTRIBUTE_DIRECTORY )) {
+
+                continue;
+            }
+
+        } else if (FlagOn( Dirent->DirentFlags, CD_ATTRIBUTE_ASSOC | CD_ATTRIBUTE_DIRECTORY )) {
+
+            continue;
+        }
+
+        CdUpdateDirentName( IrpContext, Dirent, IgnoreCase );
+
+        if (CdIsNameInExpression( IrpContext,
+                                  &Dirent->CdCaseFileName,
+                                  Name,
+                                  0,
+                                  TRUE )) {
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
 
@@ -0,0 +1,1308 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    IsoBench.c
+
+Abstract:
+
+    Host benchmark for the Cdfs name indexes.  Generates an ISO 9660 image
+    with a Joliet volume, mounts the Joliet volume and replays opens of
+    files deep in the tree, through the path table for the directories and
+    the directory itself for the file.  Every open is done both by linear
+    scans and through the name indexes, and the two must agree.
+
+    PathSup.c, DirSup.c, NameSup.c, PrefxSup.c and StrucSup.c are built
+    unchanged against the stand-ins in kernel/, and the volume is mounted
+    from the Joliet descriptor by CdUpdateVcbFromVolDescriptor.  Each open
+    walks the name as CdCommonCreate does: the prefix tables first, then
+    CdFindPathEntry for each component left, with a directory Fcb made for
+    it as CdOpenDirectoryFromPathEntry does, and CdFindFile for the last.
+    A linear run starts with the volume's name index pool used up, so that
+    every search scans.  The cost of an open is counted in the path table
+    and directory sectors it maps.
+
+    The generated files have one extent and no associated files or XA data,
+    and no names with a tilde, so short name searches don't come into it.
+    Opens stop once the file is found, as CdOpenFileFromFileContext would
+    only go on to make its Fcb.
+
+    usage: isobench --selftest
+           isobench [--top n] [--packages n] [--files n] [--hot n]
+                    [--opens n] [--seed n] [--save image.iso]
+
+    The default image has 20 projects of 200 packages of 40 files, 160000
+    files in 4000 directories, and an Objects directory at the root holding
+    50000 more.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "host.h"
+
+#include <strings.h>
+#include <time.h>
+
+#define MAX_NAME_CHARS                   (64)
+#define MAX_PATH_CHARS                   (3 * MAX_NAME_CHARS)
+
+static int Failures;
+
+#define CHECK(X) {                                                      \
+    if (!(X)) {                                                         \
+        printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #X ); \
+        Failures += 1;                                                  \
+    }                                                                   \
+}
+
+static const char *SavePath;
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static double
+Now (
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+//
+//  ISO 9660 fields are stored little endian, big endian or both.
+//
+
+static void
+Put16Both (
+    uint8_t *P,
+    uint32_t V
+    )
+{
+    P[0] = (uint8_t)V; P[1] = (uint8_t)(V >> 8);
+    P[2] = (uint8_t)(V >> 8); P[3] = (uint8_t)V;
+}
+
+static void
+Put32Le (
+    uint8_t *P,
+    uint32_t V
+    )
+{
+    P[0] = (uint8_t)V; P[1] = (uint8_t)(V >> 8); P[2] = (uint8_t)(V >> 16); P[3] = (uint8_t)(V >> 24);
+}
+
+static void
+Put32Be (
+    uint8_t *P,
+    uint32_t V
+    )
+{
+    P[0] = (uint8_t)(V >> 24); P[1] = (uint8_t)(V >> 16); P[2] = (uint8_t)(V >> 8); P[3] = (uint8_t)V;
+}
+
+static void
+Put32Both (
+    uint8_t *P,
+    uint32_t V
+    )
+{
+    Put32Le( P, V );
+    Put32Be( P + 4, V );
+}
+
+//
+//  The tree the image is generated from.  Directories are numbered in path
+//  table order (breadth first, children in name order), so the index of a
+//  directory is its ordinal less one.
+//
+
+typedef struct _TREE_ENTRY {
+    char Name[MAX_NAME_CHARS];
+    uint32_t Directory;             // index of the directory, or ~0 for a file
+    uint32_t JolietOffset;          // offset of the dirent in the Joliet directory
+} TREE_ENTRY;
+
+typedef struct _TREE_DIRECTORY {
+    char Name[MAX_NAME_CHARS];
+    uint32_t Parent;
+    TREE_ENTRY *Entries;            // children in name order
+    uint32_t EntryCount;
+    uint32_t FileCount;
+    uint32_t PrimaryExtent, PrimarySize;
+    uint32_t JolietExtent, JolietSize;
+    uint32_t JolietPathOffset;
+} TREE_DIRECTORY;
+
+typedef struct _ISO_TREE {
+    TREE_DIRECTORY *Dirs;
+    uint32_t DirCount;
+    uint32_t FileCount;
+    uint32_t HotDir;
+
+    uint8_t *Image;
+    uint32_t ImageSectors;
+} ISO_TREE;
+
+static int
+CompareEntries (
+    const void *A,
+    const void *B
+    )
+{
+    return strcmp( ((const TREE_ENTRY *)A)->Name, ((const TREE_ENTRY *)B)->Name );
+}
+
+static void
+AddEntry (
+    TREE_DIRECTORY *Dir,
+    const char *Name,
+    uint32_t Directory,
+    uint32_t Limit
+    )
+{
+    if (Dir->Entries == NULL) {
+        Dir->Entries = calloc( Limit, sizeof(TREE_ENTRY) );
+    }
+    snprintf( Dir->Entries[Dir->EntryCount].Name, MAX_NAME_CHARS, "%s", Name );
+    Dir->Entries[Dir->EntryCount].Directory = Directory;
+    Dir->EntryCount += 1;
+    if (Directory == ~0u) {
+        Dir->FileCount += 1;
+    }
+}
+
+static uint32_t
+AddDirectory (
+    ISO_TREE *Tree,
+    uint32_t Parent,
+    const char *Name,
+    uint32_t ChildLimit
+    )
+{
+    uint32_t Index = Tree->DirCount++;
+
+    snprintf( Tree->Dirs[Index].Name, MAX_NAME_CHARS, "%s", Name );
+    Tree->Dirs[Index].Parent = Parent;
+    if (Index != 0) {
+        AddEntry( &Tree->Dirs[Parent], Name, Index, ChildLimit );
+    }
+    return Index;
+}
+
+//
+//  Size of a directory record for an identifier of the given length, and
+//  the layout of a directory: records never cross a sector boundary.
+//
+
+static uint32_t
+RecordSize (
+    uint32_t IdLength
+    )
+{
+    return 33 + IdLength + ((IdLength % 2) == 0 ? 1 : 0);
+}
+
+static uint32_t
+PlaceRecord (
+    uint32_t *Offset,
+    uint32_t Size
+    )
+{
+    uint32_t Start;
+
+    if ((*Offset % SECTOR_SIZE) + Size > SECTOR_SIZE) {
+        *Offset += SECTOR_SIZE - (*Offset % SECTOR_SIZE);
+    }
+    Start = *Offset;
+    *Offset += Size;
+    return Start;
+}
+
+static uint32_t
+RoundToSector (
+    uint32_t Bytes
+    )
+{
+    return (Bytes + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+}
+
+static void
+PrimaryName (
+    const TREE_ENTRY *Entry,
+    uint32_t Position,
+    char *Buffer
+    )
+{
+    if (Entry->Directory != ~0u) {
+        sprintf( Buffer, "D%07u", Entry->Directory );
+    } else {
+        sprintf( Buffer, "F%07u.DAT;1", Position );
+    }
+}
+
+static uint32_t
+JolietIdLength (
+    const TREE_ENTRY *Entry
+    )
+{
+    return (uint32_t)(strlen( Entry->Name ) + ((Entry->Directory == ~0u) ? 2 : 0)) * 2;
+}
+
+static void
+WriteRecord (
+    uint8_t *P,
+    uint32_t Extent,
+    uint32_t Length,
+    uint8_t Flags,
+    const uint8_t *Id,
+    uint32_t IdLength
+    )
+{
+    memset( P, 0, RecordSize( IdLength ));
+    P[0] = (uint8_t)RecordSize( IdLength );
+    Put32Both( P + 2, Extent );
+    Put32Both( P + 10, Length );
+    P[18] = 126;                    // 2026
+    P[19] = 1;
+    P[20] = 1;
+    P[25] = Flags;
+    Put16Both( P + 28, 1 );
+    P[32] = (uint8_t)IdLength;
+    memcpy( P + 33, Id, IdLength );
+}
+
+static uint32_t
+ToJoliet (
+    const char *Name,
+    int Version,
+    uint8_t *Id
+    )
+{
+    uint32_t Length = 0;
+
+    for (; *Name != '\0'; Name++) {
+        Id[Length++] = 0;
+        Id[Length++] = (uint8_t)*Name;
+    }
+    if (Version) {
+        Id[Length++] = 0; Id[Length++] = ';';
+        Id[Length++] = 0; Id[Length++] = '1';
+    }
+    return Length;
+}
+
+static uint32_t
+WritePathTable (
+    ISO_TREE *Tree,
+    uint8_t *P,
+    int Joliet,
+    int BigEndian
+    )
+{
+    uint32_t Offset = 0;
+    uint32_t i;
+
+    for (i = 0; i < Tree->DirCount; i++) {
+
+        TREE_DIRECTORY *Dir = &Tree->Dirs[i];
+        uint8_t Id[2 * MAX_NAME_CHARS];
+        uint32_t IdLength;
+
+        if (i == 0) {
+            Id[0] = 0;
+            IdLength = 1;
+        } else if (Joliet) {
+            IdLength = ToJoliet( Dir->Name, 0, Id );
+        } else {
+            IdLength = (uint32_t)sprintf( (char *)Id, "D%07u", i );
+        }
+
+        if (P != NULL) {
+            P[Offset] = (uint8_t)IdLength;
+            P[Offset + 1] = 0;
+            if (BigEndian) {
+                Put32Be( P + Offset + 2, Joliet ? Dir->JolietExtent : Dir->PrimaryExtent );
+                P[Offset + 6] = (uint8_t)((Dir->Parent + 1) >> 8);
+                P[Offset + 7] = (uint8_t)(Dir->Parent + 1);
+            } else {
+                Put32Le( P + Offset + 2, Joliet ? Dir->JolietExtent : Dir->PrimaryExtent );
+                P[Offset + 6] = (uint8_t)(Dir->Parent + 1);
+                P[Offset + 7] = (uint8_t)((Dir->Parent + 1) >> 8);
+            }
+            memcpy( P + Offset + 8, Id, IdLength );
+        }
+        if (Joliet && !BigEndian) {
+            Dir->JolietPathOffset = Offset;
+        }
+
+        Offset += 8 + IdLength + (IdLength & 1);
+    }
+
+    return Offset;
+}
+
+static void
+WriteDescriptor (
+    ISO_TREE *Tree,
+    uint8_t *P,
+    int Joliet,
+    uint32_t PathTableSize,
+    uint32_t PathTableL,
+    uint32_t PathTableM
+    )
+{
+    TREE_DIRECTORY *Root = &Tree->Dirs[0];
+    uint8_t Self = 0;
+    int i;
+
+    P[0] = Joliet ? 2 : 1;
+    memcpy( P + 1, "CD001", 5 );
+    P[6] = 1;
+    memset( P + 8, ' ', 64 );
+    if (Joliet) {
+        for (i = 0; i < 16; i++) {
+            P[40 + 2 * i] = 0;
+            P[41 + 2 * i] = (uint8_t)(i < 8 ? "ISOBENCH"[i] : ' ');
+        }
+        memcpy( P + 88, "%/E", 3 );
+    } else {
+        memcpy( P + 40, "ISOBENCH", 8 );
+    }
+    Put32Both( P + 80, Tree->ImageSectors );
+    Put16Both( P + 120, 1 );
+    Put16Both( P + 124, 1 );
+    Put16Both( P + 128, SECTOR_SIZE );
+    Put32Both( P + 132, PathTableSize );
+    Put32Le( P + 140, PathTableL );
+    Put32Be( P + 148, PathTableM );
+    WriteRecord( P + 156,
+                 Joliet ? Root->JolietExtent : Root->PrimaryExtent,
+                 Joliet ? Root->JolietSize : Root->PrimarySize,
+                 CD_ATTRIBUTE_DIRECTORY, &Self, 1 );
+    memset( P + 190, ' ', 623 );
+    for (i = 0; i < 4; i++) {
+        memset( P + 813 + 17 * i, '0', 16 );
+    }
+    P[881] = 1;
+}
+
+//
+//  Generates the tree and lays it out as an image: volume descriptors,
+//  path tables, primary directories, Joliet directories and one sector of
+//  file data that every file shares.
+//
+
+static int
+GenerateImage (
+    ISO_TREE *Tree,
+    uint32_t Top,
+    uint32_t Packages,
+    uint32_t Files,
+    uint32_t Hot
+    )
+{
+    char Name[MAX_NAME_CHARS];
+    uint32_t PathSizes[2];
+    uint32_t PathSectors[2];
+    uint32_t Sector;
+    uint32_t DataSector;
+    uint32_t i, j;
+
+    memset( Tree, 0, sizeof(*Tree) );
+    Tree->Dirs = calloc( 2 + Top + (size_t)Top * Packages, sizeof(TREE_DIRECTORY) );
+    if (Tree->Dirs == NULL) {
+        return 0;
+    }
+
+    //
+    //  Breadth first, each directory's children in name order: the root,
+    //  Objects and the projects, then the packages of each project.
+    //
+
+    AddDirectory( Tree, 0, "", 0 );
+    if (Hot != 0) {
+        Tree->HotDir = AddDirectory( Tree, 0, "Objects", Top + 1 );
+    }
+    for (i = 0; i < Top; i++) {
+        snprintf( Name, sizeof(Name), "Project %04u", i );
+        AddDirectory( Tree, 0, Name, Top + 1 );
+    }
+    for (i = 0; i < Top; i++) {
+        for (j = 0; j < Packages; j++) {
+            snprintf( Name, sizeof(Name), "Package %06u", i * Packages + j );
+            AddDirectory( Tree, 1 + (Hot != 0) + i, Name, Packages );
+        }
+    }
+
+    for (i = 1 + Top + (Hot != 0); i < Tree->DirCount; i++) {
+        for (j = 0; j < Files; j++) {
+            snprintf( Name, sizeof(Name), "Source_%05u.cpp", j );
+            AddEntry( &Tree->Dirs[i], Name, ~0u, Files );
+        }
+    }
+
+    //
+    //  The build output directory also has two names that differ only in
+    //  case, so searches that ignore case must find the first of them.
+    //
+
+    if (Hot != 0) {
+        for (j = 0; j < Hot; j++) {
+            snprintf( Name, sizeof(Name), "obj_%06u.o", j );
+            AddEntry( &Tree->Dirs[Tree->HotDir], Name, ~0u, Hot + 2 );
+        }
+        AddEntry( &Tree->Dirs[Tree->HotDir], "ReadMe.txt", ~0u, Hot + 2 );
+        AddEntry( &Tree->Dirs[Tree->HotDir], "README.TXT", ~0u, Hot + 2 );
+        qsort( Tree->Dirs[Tree->HotDir].Entries, Tree->Dirs[Tree->HotDir].EntryCount,
+               sizeof(TREE_ENTRY), CompareEntries );
+    }
+
+    for (i = 0; i < Tree->DirCount; i++) {
+        Tree->FileCount += Tree->Dirs[i].FileCount;
+    }
+
+    //
+    //  Size everything, then assign extents.
+    //
+
+    PathSizes[0] = WritePathTable( Tree, NULL, 0, 0 );
+    PathSizes[1] = WritePathTable( Tree, NULL, 1, 0 );
+    PathSectors[0] = RoundToSector( PathSizes[0] ) / SECTOR_SIZE;
+    PathSectors[1] = RoundToSector( PathSizes[1] ) / SECTOR_SIZE;
+
+    Sector = 19 + 2 * PathSectors[0] + 2 * PathSectors[1];
+
+    for (i = 0; i < Tree->DirCount; i++) {
+
+        TREE_DIRECTORY *Dir = &Tree->Dirs[i];
+        uint32_t Primary = 2 * RecordSize( 1 );
+        uint32_t Joliet = 2 * RecordSize( 1 );
+        char Id[MAX_NAME_CHARS];
+
+        for (j = 0; j < Dir->EntryCount; j++) {
+            PrimaryName( &Dir->Entries[j], j, Id );
+            PlaceRecord( &Primary, RecordSize( (uint32_t)strlen( Id )));
+            Dir->Entries[j].JolietOffset = PlaceRecord( &Joliet, RecordSize( JolietIdLength( &Dir->Entries[j] )));
+        }
+
+        Dir->PrimarySize = RoundToSector( Primary );
+        Dir->JolietSize = RoundToSector( Joliet );
+        Dir->PrimaryExtent = Sector;
+        Sector += Dir->PrimarySize / SECTOR_SIZE;
+    }
+
+    for (i = 0; i < Tree->DirCount; i++) {
+        Tree->Dirs[i].JolietExtent = Sector;
+        Sector += Tree->Dirs[i].JolietSize / SECTOR_SIZE;
+    }
+
+    DataSector = Sector++;
+    Tree->ImageSectors = Sector;
+    Tree->Image = calloc( Sector, SECTOR_SIZE );
+    if (Tree->Image == NULL) {
+        return 0;
+    }
+
+    //
+    //  Now write it all out.
+    //
+
+    {
+        uint8_t *Image = Tree->Image;
+        uint32_t PathL[2], PathM[2];
+
+        PathL[0] = 19;
+        PathM[0] = PathL[0] + PathSectors[0];
+        PathL[1] = PathM[0] + PathSectors[0];
+        PathM[1] = PathL[1] + PathSectors[1];
+
+        WritePathTable( Tree, Image + (size_t)PathL[0] * SECTOR_SIZE, 0, 0 );
+        WritePathTable( Tree, Image + (size_t)PathM[0] * SECTOR_SIZE, 0, 1 );
+        WritePathTable( Tree, Image + (size_t)PathL[1] * SECTOR_SIZE, 1, 0 );
+        WritePathTable( Tree, Image + (size_t)PathM[1] * SECTOR_SIZE, 1, 1 );
+
+        WriteDescriptor( Tree, Image + 16 * SECTOR_SIZE, 0, PathSizes[0], PathL[0], PathM[0] );
+        WriteDescriptor( Tree, Image + 17 * SECTOR_SIZE, 1, PathSizes[1], PathL[1], PathM[1] );
+        Image[18 * SECTOR_SIZE] = 255;
+        memcpy( Image + 18 * SECTOR_SIZE + 1, "CD001", 5 );
+        Image[18 * SECTOR_SIZE + 6] = 1;
+
+        memcpy( Image + (size_t)DataSector * SECTOR_SIZE, "isobench\n", 9 );
+
+        for (i = 0; i < Tree->DirCount; i++) {
+
+            TREE_DIRECTORY *Dir = &Tree->Dirs[i];
+            TREE_DIRECTORY *Parent = &Tree->Dirs[Dir->Parent];
+            uint8_t *Primary = Image + (size_t)Dir->PrimaryExtent * SECTOR_SIZE;
+            uint8_t *Joliet = Image + (size_t)Dir->JolietExtent * SECTOR_SIZE;
+            uint32_t PrimaryOffset = 0, JolietOffset = 0;
+            uint8_t Id[2 * MAX_NAME_CHARS];
+            uint8_t Dot = 0, DotDot = 1;
+            uint32_t IdLength;
+            uint32_t Offset;
+
+            WriteRecord( Primary + PlaceRecord( &PrimaryOffset, RecordSize( 1 )),
+                         Dir->PrimaryExtent, Dir->PrimarySize, CD_ATTRIBUTE_DIRECTORY, &Dot, 1 );
+            WriteRecord( Primary + PlaceRecord( &PrimaryOffset, RecordSize( 1 )),
+                         Parent->PrimaryExtent, Parent->PrimarySize, CD_ATTRIBUTE_DIRECTORY, &DotDot, 1 );
+            WriteRecord( Joliet + PlaceRecord( &JolietOffset, RecordSize( 1 )),
+                         Dir->JolietExtent, Dir->JolietSize, CD_ATTRIBUTE_DIRECTORY, &Dot, 1 );
+            WriteRecord( Joliet + PlaceRecord( &JolietOffset, RecordSize( 1 )),
+                         Parent->JolietExtent, Parent->JolietSize, CD_ATTRIBUTE_DIRECTORY, &DotDot, 1 );
+
+            for (j = 0; j < Dir->EntryCount; j++) {
+
+                TREE_ENTRY *Entry = &Dir->Entries[j];
+                TREE_DIRECTORY *Child = (Entry->Directory != ~0u) ? &Tree->Dirs[Entry->Directory] : NULL;
+
+                PrimaryName( Entry, j, (char *)Id );
+                IdLength = (uint32_t)strlen( (char *)Id );
+                Offset = PlaceRecord( &PrimaryOffset, RecordSize( IdLength ));
+                WriteRecord( Primary + Offset,
+                             Child ? Child->PrimaryExtent : DataSector,
+                             Child ? Child->PrimarySize : 9,
+                             Child ? CD_ATTRIBUTE_DIRECTORY : 0,
+                             Id, IdLength );
+
+                IdLength = ToJoliet( Entry->Name, Child == NULL, Id );
+                Offset = PlaceRecord( &JolietOffset, RecordSize( IdLength ));
+                WriteRecord( Joliet + Offset,
+                             Child ? Child->JolietExtent : DataSector,
+                             Child ? Child->JolietSize : 9,
+                             Child ? CD_ATTRIBUTE_DIRECTORY : 0,
+                             Id, IdLength );
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void
+FreeImage (
+    ISO_TREE *Tree
+    )
+{
+    uint32_t i;
+
+    for (i = 0; i < Tree->DirCount; i++) {
+        free( Tree->Dirs[i].Entries );
+    }
+    free( Tree->Dirs );
+    free( Tree->Image );
+}
+
+//
+//  The target device reads straight out of the image being mounted.
+//
+
+static const ISO_TREE *MountedTree;
+
+NTSTATUS
+HostDeviceRead (
+    _In_ PDEVICE_OBJECT TargetDeviceObject,
+    _In_ LONGLONG StartingOffset,
+    _Out_writes_bytes_(ByteCount) PVOID Buffer,
+    _In_ ULONG ByteCount
+    )
+{
+    UNREFERENCED_PARAMETER( TargetDeviceObject );
+
+    if ((StartingOffset < 0) ||
+        ((uint64_t)StartingOffset + ByteCount > (uint64_t)MountedTree->ImageSectors * SECTOR_SIZE)) {
+
+        return STATUS_DEVICE_DATA_ERROR;
+    }
+
+    memcpy( Buffer, MountedTree->Image + StartingOffset, ByteCount );
+    return STATUS_SUCCESS;
+}
+
+//
+//  Pool still allocated, not counting the Irp contexts CdCleanupIrpContext
+//  keeps for reuse.
+//
+
+static LONGLONG
+PoolOutstanding (
+    void
+    )
+{
+    HOST_COUNTERS Counters;
+
+    HostGetCounters( &Counters );
+    return Counters.PoolBlocks - CdData.IrpContextDepth;
+}
+
+//
+//  Mounts the Joliet volume of the image.  NameIndexPool is the name index
+//  pool the volume starts with: none for a linear run, where every search
+//  scans.
+//
+
+static PVCB
+Mount (
+    const ISO_TREE *Tree,
+    ULONG NameIndexPool,
+    PDEVICE_OBJECT *TargetDeviceObject
+    )
+{
+    PVCB Vcb;
+
+    MountedTree = Tree;
+    *TargetDeviceObject = HostCreateTargetDevice();
+
+    Vcb = HostMountVolume( *TargetDeviceObject,
+                           (PCHAR)Tree->Image + 17 * SECTOR_SIZE,
+                           VCB_STATE_JOLIET );
+
+    Vcb->NameIndexBytes = CD_NAME_INDEX_VCB_POOL_LIMIT - NameIndexPool;
+    return Vcb;
+}
+
+static void
+Dismount (
+    PDEVICE_OBJECT TargetDeviceObject,
+    PVCB Vcb
+    )
+{
+    HostDismountVolume( Vcb );
+    HostDeleteTargetDevice( TargetDeviceObject );
+    MountedTree = NULL;
+}
+
+//
+//  The indexes the volume kept, and the pool they use.
+//
+
+static void
+QueryNameIndexes (
+    PVCB Vcb,
+    ULONG *Count,
+    ULONG *Bytes
+    )
+{
+    PLIST_ENTRY Links;
+
+    *Count = 0;
+    *Bytes = 0;
+
+    for (Links = Vcb->NameIndexList.Flink; Links != &Vcb->NameIndexList; Links = Links->Flink) {
+
+        *Count += 1;
+        *Bytes += CONTAINING_RECORD( Links, CD_NAME_INDEX, VcbLinks )->AllocationSize;
+    }
+}
+
+//
+//  A directory found in the path table on the way to the file, as
+//  CdOpenDirectoryFromPathEntry opens one when it isn't the target.  On
+//  entry the parent is held; on return the new Fcb is held instead.
+//
+
+static void
+OpenDirectoryFromPathEntry (
+    PIRP_CONTEXT IrpContext,
+    PVCB Vcb,
+    PFCB *CurrentFcb,
+    BOOLEAN IgnoreCase,
+    PPATH_ENTRY PathEntry
+    )
+{
+    FILE_ID FileId;
+    BOOLEAN FcbExisted;
+    PFCB NextFcb;
+    PFCB ParentFcb = *CurrentFcb;
+
+    FileId.QuadPart = 0;
+    CdSetFidPathTableOffset( FileId, PathEntry->PathTableOffset );
+    CdFidSetDirectory( FileId );
+
+    CdLockVcb( IrpContext, Vcb );
+
+    NextFcb = CdCreateFcb( IrpContext, FileId, CDFS_NTC_FCB_INDEX, &FcbExisted );
+
+    if (!FcbExisted) {
+
+        CdInitializeFcbFromPathEntry( IrpContext, NextFcb, ParentFcb, PathEntry );
+    }
+
+    CdUnlockVcb( IrpContext, Vcb );
+
+    CdAcquireFcbExclusive( IrpContext, NextFcb, FALSE );
+    *CurrentFcb = NextFcb;
+
+    CdInsertPrefix( IrpContext, NextFcb, &PathEntry->CdDirName, FALSE, FALSE, ParentFcb );
+
+    if (IgnoreCase) {
+
+        CdInsertPrefix( IrpContext, NextFcb, &PathEntry->CdCaseDirName, TRUE, FALSE, ParentFcb );
+    }
+
+    CdReleaseFcb( IrpContext, ParentFcb );
+}
+
+//
+//  Opens to replay.  Most are of sources in the packages, the rest of
+//  objects in the build output directory, and a few of names that aren't
+//  there.  Most ignore case and come in a random case, as from Win32; the
+//  name is then upcased, as CdNormalizeFileNames leaves it.
+//
+
+typedef struct _OPEN_QUERY {
+    WCHAR Name[MAX_PATH_CHARS];
+    USHORT Length;
+    BOOLEAN IgnoreCase;
+    int Expected;
+    ULONG ExpectedOrdinal;
+    ULONG ExpectedOffset;
+} OPEN_QUERY;
+
+//
+//  An open as CdCommonCreate does it, without the Irp.  Returns whether
+//  the file was found, and the ordinal of its directory and the offset of
+//  its dirent.  With Teardown the directory Fcbs are let go of as they are
+//  when the file is closed again.
+//
+
+static BOOLEAN
+OpenFile (
+    PVCB Vcb,
+    const OPEN_QUERY *Query,
+    BOOLEAN Teardown,
+    ULONG *Ordinal,
+    ULONG *DirentOffset
+    )
+{
+    IRP_CONTEXT IrpContext;
+    THREAD_CONTEXT ThreadContext = {0};
+    WCHAR Buffer[MAX_PATH_CHARS];
+    UNICODE_STRING RemainingName;
+    CD_NAME FinalName;
+    COMPOUND_PATH_ENTRY CompoundPathEntry;
+    FILE_ENUM_CONTEXT FileContext;
+    PCD_NAME MatchingName;
+    PFCB CurrentFcb;
+    BOOLEAN FoundEntry;
+    BOOLEAN RemovedFcb;
+    BOOLEAN IgnoreCase = Query->IgnoreCase;
+
+    HostInitializeIrpContext( &IrpContext, Vcb );
+    CdSetThreadContext( &IrpContext, &ThreadContext );
+
+    //
+    //  The prefix search writes the exact case of what it finds back into
+    //  the name, so each open works on a copy.
+    //
+
+    memcpy( Buffer, Query->Name, Query->Length );
+    RemainingName.Buffer = Buffer;
+    RemainingName.Length = Query->Length;
+    RemainingName.MaximumLength = sizeof(Buffer);
+
+    RtlZeroMemory( &FinalName, sizeof(FinalName) );
+
+    CdAcquireVcbShared( &IrpContext, Vcb, FALSE );
+
+    CurrentFcb = Vcb->RootIndexFcb;
+    CdAcquireFcbExclusive( &IrpContext, CurrentFcb, FALSE );
+
+    CdFindPrefix( &IrpContext, &CurrentFcb, &RemainingName, IgnoreCase );
+
+    while (TRUE) {
+
+        CdDissectName( &IrpContext, &RemainingName, &FinalName.FileName );
+
+        CdInitializeCompoundPathEntry( &IrpContext, &CompoundPathEntry );
+
+        FoundEntry = CdFindPathEntry( &IrpContext,
+                                      CurrentFcb,
+                                      &FinalName,
+                                      IgnoreCase,
+                                      &CompoundPathEntry );
+
+        if (FoundEntry) {
+
+            OpenDirectoryFromPathEntry( &IrpContext,
+                                        Vcb,
+                                        &CurrentFcb,
+                                        IgnoreCase,
+                                        &CompoundPathEntry.PathEntry );
+        }
+
+        CdCleanupCompoundPathEntry( &IrpContext, &CompoundPathEntry );
+
+        if (!FoundEntry || (RemainingName.Length == 0)) {
+
+            break;
+        }
+    }
+
+    //
+    //  The last component isn't a directory: look for it in the one we got
+    //  to.  A query never names a directory last, so finding one there is
+    //  reported as a dirent that can't be right.
+    //
+
+    if (RemainingName.Length != 0) {
+
+        FoundEntry = FALSE;
+
+    } else if (!FoundEntry) {
+
+        CdInitializeFileContext( &IrpContext, &FileContext );
+        CdConvertNameToCdName( &IrpContext, &FinalName );
+
+        FoundEntry = CdFindFile( &IrpContext,
+                                 CurrentFcb,
+                                 &FinalName,
+                                 IgnoreCase,
+                                 &FileContext,
+                                 &MatchingName );
+
+        if (FoundEntry) {
+
+            *Ordinal = CurrentFcb->Ordinal;
+            *DirentOffset = FileContext.InitialDirent->Dirent.DirentOffset;
+        }
+
+        CdCleanupFileContext( &IrpContext, &FileContext );
+
+    } else {
+
+        *Ordinal = CurrentFcb->Ordinal;
+        *DirentOffset = MAXULONG;
+    }
+
+    RemovedFcb = FALSE;
+
+    if (Teardown) {
+
+        CdTeardownStructures( &IrpContext, CurrentFcb, &RemovedFcb );
+    }
+
+    if (!RemovedFcb) {
+
+        CdReleaseFcb( &IrpContext, CurrentFcb );
+    }
+
+    CdReleaseVcb( &IrpContext, Vcb );
+    CdCleanupIrpContext( &IrpContext, FALSE );
+
+    return FoundEntry;
+}
+
+static void
+AddName (
+    OPEN_QUERY *Query,
+    const char *Text,
+    uint64_t *State
+    )
+{
+    if (Query->Length != 0) {
+        Query->Name[Query->Length / sizeof(WCHAR)] = L'\\';
+        Query->Length += sizeof(WCHAR);
+    }
+
+    for (; *Text != '\0'; Text++) {
+
+        WCHAR Char = (WCHAR)(uint8_t)*Text;
+
+        if (Query->IgnoreCase) {
+            if ((Random64( State ) & 1) && (Char >= 'A') && (Char <= 'Z')) {
+                Char += 'a' - 'A';
+            }
+            Char = RtlUpcaseUnicodeChar( Char );
+        }
+        Query->Name[Query->Length / sizeof(WCHAR)] = Char;
+        Query->Length += sizeof(WCHAR);
+    }
+}
+
+static OPEN_QUERY *
+BuildQueries (
+    const ISO_TREE *Tree,
+    uint32_t Count,
+    uint64_t Seed
+    )
+{
+    OPEN_QUERY *Queries = calloc( Count, sizeof(OPEN_QUERY) );
+    uint64_t State = Seed;
+    uint32_t FirstPackage = 1 + (Tree->HotDir != 0);
+    uint32_t i;
+
+    while ((FirstPackage < Tree->DirCount) && (Tree->Dirs[FirstPackage].Parent == 0)) {
+        FirstPackage++;
+    }
+
+    for (i = 0; i < Count; i++) {
+
+        OPEN_QUERY *Query = &Queries[i];
+        const TREE_DIRECTORY *Dir;
+        const TREE_ENTRY *Entry = NULL;
+        uint32_t Kind = (uint32_t)(Random64( &State ) % 100);
+        uint32_t DirIndex;
+        char Missing[MAX_NAME_CHARS];
+
+        Query->IgnoreCase = (Random64( &State ) % 10) != 0;
+
+        if (((Kind < 30) && (Tree->HotDir != 0)) || (FirstPackage >= Tree->DirCount)) {
+            DirIndex = Tree->HotDir;
+        } else {
+            DirIndex = FirstPackage + (uint32_t)(Random64( &State ) % (Tree->DirCount - FirstPackage));
+        }
+        Dir = &Tree->Dirs[DirIndex];
+
+        if ((Kind >= 95) || (Dir->FileCount == 0)) {
+            snprintf( Missing, sizeof(Missing), "missing_%u.tmp", i );
+        } else {
+            Entry = &Dir->Entries[Random64( &State ) % Dir->EntryCount];
+        }
+
+        //
+        //  The path, from the root.
+        //
+
+        if (Dir->Parent != 0) {
+            AddName( Query, Tree->Dirs[Dir->Parent].Name, &State );
+        }
+        AddName( Query, Dir->Name, &State );
+        AddName( Query, Entry ? Entry->Name : Missing, &State );
+
+        Query->ExpectedOrdinal = DirIndex + 1;
+
+        if (Entry != NULL) {
+
+            Query->Expected = 1;
+            Query->ExpectedOffset = Entry->JolietOffset;
+
+            //
+            //  Ignoring case, the first of two names that differ only in
+            //  case is the one found.
+            //
+
+            if (Query->IgnoreCase && (Entry > Dir->Entries) && (strcasecmp( Entry[-1].Name, Entry->Name ) == 0)) {
+                Query->ExpectedOffset = Entry[-1].JolietOffset;
+            }
+        }
+    }
+
+    return Queries;
+}
+
+static void
+SetQuery (
+    OPEN_QUERY *Query,
+    const char *Directory,
+    const char *File,
+    BOOLEAN IgnoreCase
+    )
+{
+    uint64_t State = 1;
+
+    memset( Query, 0, sizeof(*Query) );
+    Query->IgnoreCase = IgnoreCase;
+    AddName( Query, Directory, &State );
+    AddName( Query, File, &State );
+}
+
+typedef struct _RUN_RESULT {
+    double Seconds;
+    unsigned long long Mismatches;
+    LONGLONG PathTableSectors;
+    LONGLONG DirectorySectors;
+    LONGLONG IndexAllocations;
+    ULONG IndexesKept;
+    ULONG IndexBytes;
+    BOOLEAN PoolClosed;
+} RUN_RESULT;
+
+static void
+RunOpens (
+    const ISO_TREE *Tree,
+    const OPEN_QUERY *Queries,
+    uint32_t Count,
+    ULONG NameIndexPool,
+    BOOLEAN Teardown,
+    RUN_RESULT *Result
+    )
+{
+    PDEVICE_OBJECT TargetDeviceObject;
+    PVCB Vcb;
+    HOST_COUNTERS Before;
+    HOST_COUNTERS After;
+    double Start;
+    uint32_t i;
+
+    memset( Result, 0, sizeof(*Result) );
+
+    Vcb = Mount( Tree, NameIndexPool, &TargetDeviceObject );
+
+    HostGetCounters( &Before );
+    Start = Now();
+
+    for (i = 0; i < Count; i++) {
+
+        ULONG Ordinal = 0;
+        ULONG Offset = 0;
+        BOOLEAN Found = OpenFile( Vcb, &Queries[i], Teardown, &Ordinal, &Offset );
+
+        if ((Found != Queries[i].Expected) ||
+            (Found && ((Ordinal != Queries[i].ExpectedOrdinal) || (Offset != Queries[i].ExpectedOffset)))) {
+            Result->Mismatches += 1;
+        }
+    }
+
+    Result->Seconds = Now() - Start;
+    HostGetCounters( &After );
+
+    Result->PathTableSectors = After.PathTableSectors - Before.PathTableSectors;
+    Result->DirectorySectors = After.DirectorySectors - Before.DirectorySectors;
+    Result->IndexAllocations = After.NameIndexAllocations - Before.NameIndexAllocations;
+    Result->PoolClosed = (Vcb->NameIndexBytes == CD_NAME_INDEX_VCB_POOL_LIMIT);
+    QueryNameIndexes( Vcb, &Result->IndexesKept, &Result->IndexBytes );
+
+    Dismount( TargetDeviceObject, Vcb );
+}
+
+static void
+PrintResult (
+    const char *Label,
+    const RUN_RESULT *Result,
+    uint32_t Count
+    )
+{
+    printf( "%-22s %9.3fs %10.0f opens/s %8.2f path table sectors %8.2f directory sectors/open %3u indexes %7lu KB%s\n",
+            Label,
+            Result->Seconds,
+            Count / Result->Seconds,
+            (double)Result->PathTableSectors / Count,
+            (double)Result->DirectorySectors / Count,
+            Result->IndexesKept,
+            (unsigned long)Result->IndexBytes / 1024,
+            Result->Mismatches ? "  MISMATCHES" : "" );
+}
+
+static int
+SaveImage (
+    const ISO_TREE *Tree,
+    const char *Path
+    )
+{
+    FILE *File = fopen( Path, "wb" );
+    int Ok;
+
+    if (File == NULL) {
+        perror( Path );
+        return 0;
+    }
+    Ok = fwrite( Tree->Image, SECTOR_SIZE, Tree->ImageSectors, File ) == Tree->ImageSectors;
+    Ok = (fclose( File ) == 0) && Ok;
+    return Ok;
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    ISO_TREE Tree;
+    OPEN_QUERY *Queries;
+    RUN_RESULT Linear, Indexed;
+    PDEVICE_OBJECT TargetDeviceObject;
+    PVCB Vcb;
+    OPEN_QUERY Query;
+    ULONG Ordinal, Offset;
+
+    HostInitialize();
+
+    //
+    //  A small image: neither the path table nor any directory is large
+    //  enough to be indexed.
+    //
+
+    CHECK( GenerateImage( &Tree, 3, 10, 20, 500 ) );
+    Queries = BuildQueries( &Tree, 5000, 1 );
+    RunOpens( &Tree, Queries, 5000, CD_NAME_INDEX_VCB_POOL_LIMIT, TRUE, &Indexed );
+    PrintResult( "small", &Indexed, 5000 );
+    CHECK( Indexed.IndexAllocations == 0 );
+    CHECK( Indexed.Mismatches == 0 );
+    free( Queries );
+    FreeImage( &Tree );
+    CHECK( PoolOutstanding() == 0 );
+
+    //
+    //  A path table over 8 sectors and a 20000 file directory.  Every open
+    //  must find the same dirent through the indexes as by scanning, with
+    //  the Fcbs kept and torn down after every open.  The indexes outlive
+    //  the Fcbs, so each is built once either way.
+    //
+
+    CHECK( GenerateImage( &Tree, 6, 120, 10, 20000 ) );
+    Queries = BuildQueries( &Tree, 2000, 2 );
+    RunOpens( &Tree, Queries, 2000, 0, TRUE, &Linear );
+    PrintResult( "linear", &Linear, 2000 );
+    CHECK( Linear.Mismatches == 0 );
+    CHECK( Linear.IndexAllocations == 0 );
+    RunOpens( &Tree, Queries, 2000, CD_NAME_INDEX_VCB_POOL_LIMIT, TRUE, &Indexed );
+    PrintResult( "indexed", &Indexed, 2000 );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.IndexesKept == 2 );
+    CHECK( Indexed.DirectorySectors * 20 < Linear.DirectorySectors );
+    CHECK( Indexed.PathTableSectors * 5 < Linear.PathTableSectors );
+    RunOpens( &Tree, Queries, 2000, CD_NAME_INDEX_VCB_POOL_LIMIT, FALSE, &Indexed );
+    PrintResult( "indexed, Fcbs kept", &Indexed, 2000 );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.IndexesKept == 2 );
+    CHECK( PoolOutstanding() == 0 );
+
+    //
+    //  Pool for the path table index but not the hot directory's: the
+    //  directory index is built once, thrown away, and the pool closed, so
+    //  later Fcbs scan without building again.
+    //
+
+    RunOpens( &Tree, Queries, 2000, 0x10000, TRUE, &Indexed );
+    PrintResult( "indexed, 64K pool", &Indexed, 2000 );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.IndexesKept == 1 );
+    CHECK( Indexed.IndexAllocations > 2 );
+    CHECK( Indexed.PoolClosed );
+    CHECK( Indexed.PathTableSectors * 5 < Linear.PathTableSectors );
+    CHECK( PoolOutstanding() == 0 );
+
+    //
+    //  Names that differ only in case: ignoring case finds the first in
+    //  directory order, exact case finds each.
+    //
+
+    Vcb = Mount( &Tree, CD_NAME_INDEX_VCB_POOL_LIMIT, &TargetDeviceObject );
+    SetQuery( &Query, "Objects", "ReadMe.txt", FALSE );
+    CHECK( OpenFile( Vcb, &Query, FALSE, &Ordinal, &Offset ) );
+    CHECK( Offset == Tree.Dirs[Tree.HotDir].Entries[1].JolietOffset );
+    SetQuery( &Query, "Objects", "README.TXT", FALSE );
+    CHECK( OpenFile( Vcb, &Query, FALSE, &Ordinal, &Offset ) );
+    CHECK( Offset == Tree.Dirs[Tree.HotDir].Entries[0].JolietOffset );
+    SetQuery( &Query, "Objects", "Readme.Txt", FALSE );
+    CHECK( !OpenFile( Vcb, &Query, FALSE, &Ordinal, &Offset ) );
+    SetQuery( &Query, "objects", "readme.txt", TRUE );
+    CHECK( OpenFile( Vcb, &Query, FALSE, &Ordinal, &Offset ) );
+    CHECK( Offset == Tree.Dirs[Tree.HotDir].Entries[0].JolietOffset );
+    Dismount( TargetDeviceObject, Vcb );
+
+    free( Queries );
+    FreeImage( &Tree );
+    CHECK( PoolOutstanding() == 0 );
+
+    HostUninitialize();
+    CHECK( PoolOutstanding() == 0 );
+
+    printf( "%s\n", Failures ? "FAILED" : "passed" );
+    return Failures ? 1 : 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    uint32_t Top = 20;
+    uint32_t Packages = 200;
+    uint32_t Files = 40;
+    uint32_t Hot = 50000;
+    uint32_t Opens = 20000;
+    uint64_t Seed = 1;
+    ISO_TREE Tree;
+    OPEN_QUERY *Queries;
+    RUN_RESULT Linear, Indexed;
+    int Mismatched = 0;
+    int Teardown;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--top" ) == 0) && (i + 1 < argc)) {
+            Top = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--packages" ) == 0) && (i + 1 < argc)) {
+            Packages = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--files" ) == 0) && (i + 1 < argc)) {
+            Files = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--hot" ) == 0) && (i + 1 < argc)) {
+            Hot = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--opens" ) == 0) && (i + 1 < argc)) {
+            Opens = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--seed" ) == 0) && (i + 1 < argc)) {
+            Seed = strtoull( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--save" ) == 0) && (i + 1 < argc)) {
+            SavePath = argv[++i];
+        } else {
+            fprintf( stderr,
+                     "usage: isobench --selftest\n"
+                     "       isobench [--top n] [--packages n] [--files n] [--hot n]\n"
+                     "                [--opens n] [--seed n] [--save image.iso]\n" );
+            return 2;
+        }
+    }
+
+    if ((Opens == 0) || (Top + Hot == 0) || ((uint64_t)Top * Packages > 60000) || (Hot > 500000)) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    if (!GenerateImage( &Tree, Top, Packages, Files, Hot )) {
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+
+    printf( "%u directories, %u files, %u MB image, %u opens, seed %llu\n",
+            Tree.DirCount, Tree.FileCount, Tree.ImageSectors / 512, Opens, (unsigned long long)Seed );
+
+    if ((SavePath != NULL) && !SaveImage( &Tree, SavePath )) {
+        return 1;
+    }
+
+    HostInitialize();
+
+    Queries = BuildQueries( &Tree, Opens, Seed );
+
+    for (Teardown = 0; Teardown <= 1; Teardown++) {
+
+        printf( "%s\n", Teardown ? "directory Fcbs torn down after every open:" : "directory Fcbs kept:" );
+
+        RunOpens( &Tree, Queries, Opens, 0, (BOOLEAN)Teardown, &Linear );
+        RunOpens( &Tree, Queries, Opens, CD_NAME_INDEX_VCB_POOL_LIMIT, (BOOLEAN)Teardown, &Indexed );
+        PrintResult( "  linear", &Linear, Opens );
+        PrintResult( "  indexed", &Indexed, Opens );
+
+        printf( "  %.1fx fewer path table sectors, %.1fx fewer directory sectors, %.2fx faster\n",
+                (double)Linear.PathTableSectors / (double)(Indexed.PathTableSectors ? Indexed.PathTableSectors : 1),
+                (double)Linear.DirectorySectors / (double)(Indexed.DirectorySectors ? Indexed.DirectorySectors : 1),
+                Linear.Seconds / Indexed.Seconds );
+        Mismatched |= (Linear.Mismatches != 0) || (Indexed.Mismatches != 0);
+    }
+
+    free( Queries );
+    FreeImage( &Tree );
+    HostUninitialize();
+    return Mismatched ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+//
+//  The Cdfs sources include their headers in mixed case; the files are
+//  lower case.
+//
+
+#pragma once
+
+#include "cdstruc.h"
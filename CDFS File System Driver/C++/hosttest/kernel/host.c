@@ -0,0 +1,2197 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Host.c
+
+Abstract:
+
+    The kernel, I/O manager and cache manager routines the Cdfs sources
+    reach in the host programs, done in user mode.
+
+    Pool comes from malloc, counted so that the programs can check nothing
+    leaks.  Resources, fast mutexes and events are built on pthreads, and a
+    work item runs on a thread of its own.  Irps are passed down their stack
+    locations as in the I/O manager: the only device Cdfs calls is the
+    target device, whose reads the program serves through HostDeviceRead,
+    and completion runs the completion routines back up the stack.  The
+    cache manager maps data by reading it from the device into a buffer
+    freed again when it is unpinned, so every mapping is a cache miss and
+    is counted as one.  The last reference to a file object closes it as
+    CdCommonClose would, instead of going through the close queues.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#define _GNU_SOURCE
+
+#include "host.h"
+
+//
+//  Every pool block starts with a header recording its size and tag.
+//
+
+typedef union _HOST_POOL_HEADER {
+
+    struct {
+        SIZE_T NumberOfBytes;
+        ULONG Tag;
+    };
+
+    max_align_t Align;
+
+} HOST_POOL_HEADER, *PHOST_POOL_HEADER;
+
+//
+//  Each generic table element is preceded by its links, as in Rtl.
+//
+
+typedef struct _HOST_TABLE_ENTRY {
+
+    RTL_SPLAY_LINKS Links;
+    LIST_ENTRY ListEntry;
+    max_align_t UserData[];
+
+} HOST_TABLE_ENTRY, *PHOST_TABLE_ENTRY;
+
+//
+//  As in FilObSup.c.
+//
+
+#define TYPE_OF_OPEN_MASK               (0x00000007)
+
+#define HOST_TAG_DEVICE                 'veDH'
+#define HOST_TAG_VPB                    'bpVH'
+#define HOST_TAG_FILE                   'liFH'
+#define HOST_TAG_IRP                    'prIH'
+#define HOST_TAG_MDL                    'ldMH'
+#define HOST_TAG_WORK_ITEM              'krWH'
+#define HOST_TAG_CACHE                  'hcCH'
+#define HOST_TAG_NOTIFY                 'tNoH'
+
+//
+//  HostLock protects the counters and the count of running work items.
+//
+
+static pthread_mutex_t HostLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t HostWorkItemsDone = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t HostVpbLock = PTHREAD_MUTEX_INITIALIZER;
+static HOST_COUNTERS HostCounters;
+static LONG HostWorkItemsRunning;
+
+static DEVICE_OBJECT HostFileSystemDeviceObject;
+
+static _Thread_local KTHREAD HostThread;
+static _Thread_local PIRP HostTopLevelIrp;
+static _Thread_local ULONG HostWaits;
+
+static VOID
+HostCount (
+    PLONGLONG Counter,
+    LONGLONG Value
+    )
+{
+    pthread_mutex_lock( &HostLock );
+    *Counter += Value;
+    pthread_mutex_unlock( &HostLock );
+}
+
+VOID
+HostAssert (
+    int Condition,
+    const char *Text,
+    const char *File,
+    int Line
+    )
+{
+    if (!Condition) {
+
+        fprintf( stderr, "%s(%d): assertion failed: %s\n", File, Line, Text );
+        abort();
+    }
+}
+
+VOID
+KeBugCheckEx (
+    ULONG BugCheckCode,
+    ULONG_PTR P1,
+    ULONG_PTR P2,
+    ULONG_PTR P3,
+    ULONG_PTR P4
+    )
+{
+    fprintf( stderr,
+             "bug check %#x (%#llx, %#llx, %#llx, %#llx)\n",
+             BugCheckCode,
+             (unsigned long long) P1,
+             (unsigned long long) P2,
+             (unsigned long long) P3,
+             (unsigned long long) P4 );
+    abort();
+}
+
+//
+//  Nothing raised is ever handled on the host.
+//
+
+VOID
+ExRaiseStatus (
+    NTSTATUS Status
+    )
+{
+    fprintf( stderr, "status %#x raised\n", (ULONG) Status );
+    abort();
+}
+
+PVOID
+ExAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    PHOST_POOL_HEADER Header;
+
+    UNREFERENCED_PARAMETER( PoolType );
+
+    Header = malloc( sizeof( HOST_POOL_HEADER ) + NumberOfBytes );
+
+    if (Header == NULL) {
+
+        return NULL;
+    }
+
+    Header->NumberOfBytes = NumberOfBytes;
+    Header->Tag = Tag;
+
+    pthread_mutex_lock( &HostLock );
+    HostCounters.PoolBlocks += 1;
+    HostCounters.PoolBytes += NumberOfBytes;
+
+    if (Tag == TAG_NAME_INDEX) {
+
+        HostCounters.NameIndexAllocations += 1;
+    }
+
+    pthread_mutex_unlock( &HostLock );
+
+    return Header + 1;
+}
+
+PVOID
+FsRtlAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    PVOID P = ExAllocatePoolWithTag( PoolType, NumberOfBytes, Tag );
+
+    if (P == NULL) {
+
+        ExRaiseStatus( STATUS_INSUFFICIENT_RESOURCES );
+    }
+
+    return P;
+}
+
+VOID
+ExFreePool (
+    PVOID P
+    )
+{
+    PHOST_POOL_HEADER Header = (PHOST_POOL_HEADER) P - 1;
+
+    pthread_mutex_lock( &HostLock );
+    HostCounters.PoolBlocks -= 1;
+    HostCounters.PoolBytes -= Header->NumberOfBytes;
+    pthread_mutex_unlock( &HostLock );
+
+    free( Header );
+}
+
+//
+//  Resources.  A thread which owns a resource exclusive may acquire it
+//  again either way; one which owns it shared may acquire it shared again
+//  even with exclusive waiters, as in Ex.
+//
+
+static LONG
+HostFindOwner (
+    PERESOURCE Resource,
+    ERESOURCE_THREAD Thread
+    )
+{
+    LONG Index;
+
+    for (Index = 0; Index < HOST_RESOURCE_OWNERS; Index += 1) {
+
+        if (Resource->SharedOwners[Index].Thread == Thread) {
+
+            return Index;
+        }
+    }
+
+    return -1;
+}
+
+static BOOLEAN
+HostAcquireResource (
+    PERESOURCE Resource,
+    BOOLEAN Exclusive,
+    BOOLEAN StarveExclusive,
+    BOOLEAN Wait
+    )
+{
+    ERESOURCE_THREAD Thread = ExGetCurrentResourceThread();
+    BOOLEAN Acquired = FALSE;
+    LONG Owner;
+
+    pthread_mutex_lock( &Resource->Lock );
+
+    for (;;) {
+
+        if (Resource->ExclusiveOwner == Thread) {
+
+            Resource->ExclusiveCount += 1;
+            Acquired = TRUE;
+            break;
+        }
+
+        Owner = HostFindOwner( Resource, Thread );
+
+        if (Exclusive) {
+
+            if ((Resource->ExclusiveCount == 0) && (Resource->SharedCount == 0)) {
+
+                Resource->ExclusiveOwner = Thread;
+                Resource->ExclusiveCount = 1;
+                Acquired = TRUE;
+                break;
+            }
+
+        } else if (Owner >= 0) {
+
+            Resource->SharedOwners[Owner].Count += 1;
+            Resource->SharedCount += 1;
+            Acquired = TRUE;
+            break;
+
+        } else if ((Resource->ExclusiveCount == 0) &&
+                   (StarveExclusive || (Resource->ExclusiveWaiters == 0))) {
+
+            Owner = HostFindOwner( Resource, 0 );
+            NT_ASSERT( Owner >= 0 );
+
+            Resource->SharedOwners[Owner].Thread = Thread;
+            Resource->SharedOwners[Owner].Count = 1;
+            Resource->SharedCount += 1;
+            Acquired = TRUE;
+            break;
+        }
+
+        if (!Wait) {
+
+            break;
+        }
+
+        if (Exclusive) {
+
+            Resource->ExclusiveWaiters += 1;
+        }
+
+        HostWaits += 1;
+        pthread_cond_wait( &Resource->Released, &Resource->Lock );
+
+        if (Exclusive) {
+
+            Resource->ExclusiveWaiters -= 1;
+        }
+    }
+
+    pthread_mutex_unlock( &Resource->Lock );
+
+    return Acquired;
+}
+
+NTSTATUS
+ExInitializeResourceLite (
+    PERESOURCE Resource
+    )
+{
+    RtlZeroMemory( Resource, sizeof( ERESOURCE ));
+    pthread_mutex_init( &Resource->Lock, NULL );
+    pthread_cond_init( &Resource->Released, NULL );
+
+    return STATUS_SUCCESS;
+}
+
+//
+//  Cdfs deletes the resource of an Fcb or Vcb it is tearing down while it
+//  still holds it exclusive, as Ex allows, but nobody else may hold it.
+//
+
+NTSTATUS
+ExDeleteResourceLite (
+    PERESOURCE Resource
+    )
+{
+    NT_ASSERT( (Resource->SharedCount == 0) &&
+               ((Resource->ExclusiveCount == 0) ||
+                (Resource->ExclusiveOwner == ExGetCurrentResourceThread())) );
+
+    pthread_cond_destroy( &Resource->Released );
+    pthread_mutex_destroy( &Resource->Lock );
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+ExAcquireResourceExclusiveLite (
+    PERESOURCE Resource,
+    BOOLEAN Wait
+    )
+{
+    return HostAcquireResource( Resource, TRUE, FALSE, Wait );
+}
+
+BOOLEAN
+ExAcquireResourceSharedLite (
+    PERESOURCE Resource,
+    BOOLEAN Wait
+    )
+{
+    return HostAcquireResource( Resource, FALSE, FALSE, Wait );
+}
+
+BOOLEAN
+ExAcquireSharedStarveExclusive (
+    PERESOURCE Resource,
+    BOOLEAN Wait
+    )
+{
+    return HostAcquireResource( Resource, FALSE, TRUE, Wait );
+}
+
+VOID
+ExReleaseResourceForThreadLite (
+    PERESOURCE Resource,
+    ERESOURCE_THREAD ResourceThreadId
+    )
+{
+    LONG Owner;
+
+    pthread_mutex_lock( &Resource->Lock );
+
+    if (Resource->ExclusiveOwner == ResourceThreadId) {
+
+        Resource->ExclusiveCount -= 1;
+
+        if (Resource->ExclusiveCount == 0) {
+
+            Resource->ExclusiveOwner = 0;
+        }
+
+    } else {
+
+        Owner = HostFindOwner( Resource, ResourceThreadId );
+        NT_ASSERT( Owner >= 0 );
+
+        Resource->SharedOwners[Owner].Count -= 1;
+        Resource->SharedCount -= 1;
+
+        if (Resource->SharedOwners[Owner].Count == 0) {
+
+            Resource->SharedOwners[Owner].Thread = 0;
+        }
+    }
+
+    pthread_cond_broadcast( &Resource->Released );
+    pthread_mutex_unlock( &Resource->Lock );
+}
+
+VOID
+ExReleaseResourceLite (
+    PERESOURCE Resource
+    )
+{
+    ExReleaseResourceForThreadLite( Resource, ExGetCurrentResourceThread() );
+}
+
+VOID
+ExConvertExclusiveToSharedLite (
+    PERESOURCE Resource
+    )
+{
+    ERESOURCE_THREAD Thread = ExGetCurrentResourceThread();
+    LONG Owner;
+
+    pthread_mutex_lock( &Resource->Lock );
+
+    NT_ASSERT( Resource->ExclusiveOwner == Thread );
+
+    Owner = HostFindOwner( Resource, 0 );
+    NT_ASSERT( Owner >= 0 );
+
+    Resource->SharedOwners[Owner].Thread = Thread;
+    Resource->SharedOwners[Owner].Count = Resource->ExclusiveCount;
+    Resource->SharedCount += Resource->ExclusiveCount;
+    Resource->ExclusiveOwner = 0;
+    Resource->ExclusiveCount = 0;
+
+    pthread_cond_broadcast( &Resource->Released );
+    pthread_mutex_unlock( &Resource->Lock );
+}
+
+BOOLEAN
+ExIsResourceAcquiredExclusiveLite (
+    PERESOURCE Resource
+    )
+{
+    BOOLEAN Owned;
+
+    pthread_mutex_lock( &Resource->Lock );
+    Owned = (BOOLEAN) (Resource->ExclusiveOwner == ExGetCurrentResourceThread());
+    pthread_mutex_unlock( &Resource->Lock );
+
+    return Owned;
+}
+
+ULONG
+ExIsResourceAcquiredSharedLite (
+    PERESOURCE Resource
+    )
+{
+    ERESOURCE_THREAD Thread = ExGetCurrentResourceThread();
+    ULONG Count = 0;
+    LONG Owner;
+
+    pthread_mutex_lock( &Resource->Lock );
+
+    if (Resource->ExclusiveOwner == Thread) {
+
+        Count = Resource->ExclusiveCount;
+
+    } else {
+
+        Owner = HostFindOwner( Resource, Thread );
+
+        if (Owner >= 0) {
+
+            Count = Resource->SharedOwners[Owner].Count;
+        }
+    }
+
+    pthread_mutex_unlock( &Resource->Lock );
+
+    return Count;
+}
+
+VOID
+ExInitializeFastMutex (
+    PFAST_MUTEX FastMutex
+    )
+{
+    pthread_mutex_init( &FastMutex->Mutex, NULL );
+}
+
+VOID
+ExAcquireFastMutex (
+    PFAST_MUTEX FastMutex
+    )
+{
+    pthread_mutex_lock( &FastMutex->Mutex );
+}
+
+VOID
+ExReleaseFastMutex (
+    PFAST_MUTEX FastMutex
+    )
+{
+    pthread_mutex_unlock( &FastMutex->Mutex );
+}
+
+VOID
+KeInitializeEvent (
+    PKEVENT Event,
+    EVENT_TYPE Type,
+    BOOLEAN State
+    )
+{
+    pthread_mutex_init( &Event->Lock, NULL );
+    pthread_cond_init( &Event->Signalled, NULL );
+    Event->State = State;
+    Event->Type = Type;
+}
+
+LONG
+KeSetEvent (
+    PKEVENT Event,
+    LONG Increment,
+    BOOLEAN Wait
+    )
+{
+    LONG PreviousState;
+
+    UNREFERENCED_PARAMETER( Increment );
+    UNREFERENCED_PARAMETER( Wait );
+
+    pthread_mutex_lock( &Event->Lock );
+    PreviousState = Event->State;
+    Event->State = 1;
+    pthread_cond_broadcast( &Event->Signalled );
+    pthread_mutex_unlock( &Event->Lock );
+
+    return PreviousState;
+}
+
+VOID
+KeClearEvent (
+    PKEVENT Event
+    )
+{
+    pthread_mutex_lock( &Event->Lock );
+    Event->State = 0;
+    pthread_mutex_unlock( &Event->Lock );
+}
+
+//
+//  Cdfs only ever waits for events, and without a timeout.
+//
+
+NTSTATUS
+KeWaitForSingleObject (
+    PVOID Object,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout
+    )
+{
+    PKEVENT Event = Object;
+
+    UNREFERENCED_PARAMETER( WaitReason );
+    UNREFERENCED_PARAMETER( WaitMode );
+    UNREFERENCED_PARAMETER( Alertable );
+
+    NT_ASSERT( Timeout == NULL );
+
+    pthread_mutex_lock( &Event->Lock );
+
+    if (Event->State == 0) {
+
+        HostWaits += 1;
+
+        while (Event->State == 0) {
+
+            pthread_cond_wait( &Event->Signalled, &Event->Lock );
+        }
+    }
+
+    if (Event->Type == SynchronizationEvent) {
+
+        Event->State = 0;
+    }
+
+    pthread_mutex_unlock( &Event->Lock );
+
+    return STATUS_SUCCESS;
+}
+
+PKTHREAD
+PsGetCurrentThread (
+    VOID
+    )
+{
+    return &HostThread;
+}
+
+PIRP
+IoGetTopLevelIrp (
+    VOID
+    )
+{
+    return HostTopLevelIrp;
+}
+
+VOID
+IoSetTopLevelIrp (
+    PIRP Irp
+    )
+{
+    HostTopLevelIrp = Irp;
+}
+
+//
+//  Nothing on the host ever needs verifying.
+//
+
+VOID
+IoSetDeviceToVerify (
+    PKTHREAD Thread,
+    PDEVICE_OBJECT DeviceObject
+    )
+{
+    UNREFERENCED_PARAMETER( Thread );
+    UNREFERENCED_PARAMETER( DeviceObject );
+}
+
+BOOLEAN
+IoWithinStackLimits (
+    ULONG_PTR RegionStart,
+    SIZE_T RegionSize
+    )
+{
+    pthread_attr_t Attributes;
+    PVOID StackAddress;
+    size_t StackSize;
+
+    if (pthread_getattr_np( pthread_self(), &Attributes ) != 0) {
+
+        return FALSE;
+    }
+
+    pthread_attr_getstack( &Attributes, &StackAddress, &StackSize );
+    pthread_attr_destroy( &Attributes );
+
+    return (BOOLEAN) ((RegionStart >= (ULONG_PTR) StackAddress) &&
+                      (RegionStart + RegionSize <= (ULONG_PTR) StackAddress + StackSize));
+}
+
+VOID
+FsRtlEnterFileSystem (
+    VOID
+    )
+{
+}
+
+VOID
+FsRtlExitFileSystem (
+    VOID
+    )
+{
+}
+
+PIO_WORKITEM
+IoAllocateWorkItem (
+    PDEVICE_OBJECT DeviceObject
+    )
+{
+    PIO_WORKITEM WorkItem;
+
+    WorkItem = ExAllocatePoolWithTag( NonPagedPool, sizeof( IO_WORKITEM ), HOST_TAG_WORK_ITEM );
+
+    if (WorkItem != NULL) {
+
+        WorkItem->DeviceObject = DeviceObject;
+        WorkItem->Routine = NULL;
+        WorkItem->Context = NULL;
+    }
+
+    return WorkItem;
+}
+
+VOID
+IoFreeWorkItem (
+    PIO_WORKITEM IoWorkItem
+    )
+{
+    ExFreePool( IoWorkItem );
+}
+
+static void *
+HostWorkItemThread (
+    void *Parameter
+    )
+{
+    PIO_WORKITEM WorkItem = Parameter;
+    PDEVICE_OBJECT DeviceObject = WorkItem->DeviceObject;
+    IO_WORKITEM_ROUTINE *Routine = WorkItem->Routine;
+    PVOID Context = WorkItem->Context;
+
+    //
+    //  The routine may free the work item, so we are done with it now.
+    //
+
+    Routine( DeviceObject, Context );
+
+    pthread_mutex_lock( &HostLock );
+    HostWorkItemsRunning -= 1;
+
+    if (HostWorkItemsRunning == 0) {
+
+        pthread_cond_broadcast( &HostWorkItemsDone );
+    }
+
+    pthread_mutex_unlock( &HostLock );
+
+    return NULL;
+}
+
+VOID
+IoQueueWorkItem (
+    PIO_WORKITEM IoWorkItem,
+    IO_WORKITEM_ROUTINE *WorkerRoutine,
+    WORK_QUEUE_TYPE QueueType,
+    PVOID Context
+    )
+{
+    pthread_attr_t Attributes;
+    pthread_t Thread;
+
+    UNREFERENCED_PARAMETER( QueueType );
+
+    IoWorkItem->Routine = WorkerRoutine;
+    IoWorkItem->Context = Context;
+
+    pthread_mutex_lock( &HostLock );
+    HostWorkItemsRunning += 1;
+    HostCounters.WorkItemsQueued += 1;
+    pthread_mutex_unlock( &HostLock );
+
+    pthread_attr_init( &Attributes );
+    pthread_attr_setdetachstate( &Attributes, PTHREAD_CREATE_DETACHED );
+
+    if (pthread_create( &Thread, &Attributes, HostWorkItemThread, IoWorkItem ) != 0) {
+
+        fprintf( stderr, "can't start a work item thread\n" );
+        abort();
+    }
+
+    pthread_attr_destroy( &Attributes );
+}
+
+PIRP
+IoAllocateIrp (
+    CCHAR StackSize,
+    BOOLEAN ChargeQuota
+    )
+{
+    USHORT Size = (USHORT) (sizeof( IRP ) + StackSize * sizeof( IO_STACK_LOCATION ));
+    PIRP Irp;
+
+    UNREFERENCED_PARAMETER( ChargeQuota );
+
+    Irp = ExAllocatePoolWithTag( NonPagedPool, Size, HOST_TAG_IRP );
+
+    if (Irp == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( Irp, Size );
+
+    Irp->Type = IO_TYPE_IRP;
+    Irp->Size = Size;
+    Irp->StackCount = StackSize;
+    Irp->CurrentLocation = StackSize + 1;
+    Irp->Tail.Overlay.CurrentStackLocation = (PIO_STACK_LOCATION) (Irp + 1) + StackSize;
+
+    return Irp;
+}
+
+VOID
+IoFreeIrp (
+    PIRP Irp
+    )
+{
+    ExFreePool( Irp );
+}
+
+PIRP
+IoMakeAssociatedIrp (
+    PIRP Irp,
+    CCHAR StackSize
+    )
+{
+    PIRP AssociatedIrp = IoAllocateIrp( StackSize, FALSE );
+
+    if (AssociatedIrp != NULL) {
+
+        AssociatedIrp->Flags = IRP_ASSOCIATED_IRP;
+        AssociatedIrp->AssociatedIrp.MasterIrp = Irp;
+        AssociatedIrp->Tail.Overlay.Thread = Irp->Tail.Overlay.Thread;
+    }
+
+    return AssociatedIrp;
+}
+
+//
+//  The only device Cdfs calls is the target device, and only to read from
+//  it.  The read is served at once and the Irp completed.
+//
+
+NTSTATUS
+IoCallDriver (
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp
+    )
+{
+    PIO_STACK_LOCATION IrpSp;
+    PVOID Buffer;
+    NTSTATUS Status;
+
+    IoSetNextIrpStackLocation( Irp );
+
+    if (Irp->CurrentLocation <= 0) {
+
+        KeBugCheckEx( 0x35, (ULONG_PTR) Irp, 0, 0, 0 );
+    }
+
+    IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    IrpSp->DeviceObject = DeviceObject;
+
+    if (IrpSp->MajorFunction == IRP_MJ_READ) {
+
+        if (Irp->MdlAddress != NULL) {
+
+            Buffer = MmGetSystemAddressForMdlSafe( Irp->MdlAddress, NormalPagePriority );
+
+        } else {
+
+            Buffer = Irp->UserBuffer;
+        }
+
+        Status = HostDeviceRead( DeviceObject,
+                                 IrpSp->Parameters.Read.ByteOffset.QuadPart,
+                                 Buffer,
+                                 IrpSp->Parameters.Read.Length );
+
+        Irp->IoStatus.Information = NT_SUCCESS( Status ) ? IrpSp->Parameters.Read.Length : 0;
+
+    } else {
+
+        Status = STATUS_INVALID_DEVICE_REQUEST;
+        Irp->IoStatus.Information = 0;
+    }
+
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest( Irp, IO_NO_INCREMENT );
+
+    return Status;
+}
+
+//
+//  Completion runs each completion routine on the way back up the stack,
+//  stopping if one wants the Irp back.  An associated Irp is then freed,
+//  with its Mdls, and the last one completes its master.  The host
+//  programs free the Irps they build themselves.
+//
+
+VOID
+IoCompleteRequest (
+    PIRP Irp,
+    CCHAR PriorityBoost
+    )
+{
+    PIO_STACK_LOCATION IrpSp;
+    PIO_COMPLETION_ROUTINE CompletionRoutine;
+    PDEVICE_OBJECT DeviceObject;
+    PVOID Context;
+    PIRP MasterIrp;
+    PMDL Mdl;
+    PMDL NextMdl;
+
+    while (Irp->CurrentLocation <= Irp->StackCount) {
+
+        IrpSp = IoGetCurrentIrpStackLocation( Irp );
+        CompletionRoutine = IrpSp->CompletionRoutine;
+        Context = IrpSp->Context;
+        Irp->PendingReturned = BooleanFlagOn( IrpSp->Control, SL_PENDING_RETURNED );
+
+        Irp->CurrentLocation += 1;
+        Irp->Tail.Overlay.CurrentStackLocation += 1;
+
+        if (CompletionRoutine != NULL) {
+
+            DeviceObject = NULL;
+
+            if (Irp->CurrentLocation <= Irp->StackCount) {
+
+                DeviceObject = IoGetCurrentIrpStackLocation( Irp )->DeviceObject;
+            }
+
+            if (CompletionRoutine( DeviceObject, Irp, Context ) == STATUS_MORE_PROCESSING_REQUIRED) {
+
+                return;
+            }
+
+        } else if (Irp->PendingReturned && (Irp->CurrentLocation <= Irp->StackCount)) {
+
+            IoMarkIrpPending( Irp );
+        }
+    }
+
+    if (FlagOn( Irp->Flags, IRP_ASSOCIATED_IRP )) {
+
+        MasterIrp = Irp->AssociatedIrp.MasterIrp;
+
+        for (Mdl = Irp->MdlAddress; Mdl != NULL; Mdl = NextMdl) {
+
+            NextMdl = Mdl->Next;
+            IoFreeMdl( Mdl );
+        }
+
+        IoFreeIrp( Irp );
+
+        if (InterlockedDecrement( &MasterIrp->AssociatedIrp.IrpCount ) == 0) {
+
+            IoCompleteRequest( MasterIrp, PriorityBoost );
+        }
+
+    } else if (Irp->UserIosb != NULL) {
+
+        *Irp->UserIosb = Irp->IoStatus;
+    }
+}
+
+PMDL
+IoAllocateMdl (
+    PVOID VirtualAddress,
+    ULONG Length,
+    BOOLEAN SecondaryBuffer,
+    BOOLEAN ChargeQuota,
+    PIRP Irp
+    )
+{
+    PMDL Mdl;
+    PMDL LastMdl;
+
+    UNREFERENCED_PARAMETER( ChargeQuota );
+
+    Mdl = ExAllocatePoolWithTag( NonPagedPool, sizeof( MDL ), HOST_TAG_MDL );
+
+    if (Mdl == NULL) {
+
+        return NULL;
+    }
+
+    Mdl->Next = NULL;
+    Mdl->StartVa = VirtualAddress;
+    Mdl->ByteCount = Length;
+
+    if (Irp != NULL) {
+
+        if (!SecondaryBuffer) {
+
+            Irp->MdlAddress = Mdl;
+
+        } else {
+
+            for (LastMdl = Irp->MdlAddress; LastMdl->Next != NULL; LastMdl = LastMdl->Next) {
+
+                NOTHING;
+            }
+
+            LastMdl->Next = Mdl;
+        }
+    }
+
+    return Mdl;
+}
+
+VOID
+IoBuildPartialMdl (
+    PMDL SourceMdl,
+    PMDL TargetMdl,
+    PVOID VirtualAddress,
+    ULONG Length
+    )
+{
+    UNREFERENCED_PARAMETER( SourceMdl );
+
+    TargetMdl->StartVa = VirtualAddress;
+    TargetMdl->ByteCount = Length;
+}
+
+VOID
+IoFreeMdl (
+    PMDL Mdl
+    )
+{
+    ExFreePool( Mdl );
+}
+
+//
+//  Host memory never needs locking, mapping or flushing.
+//
+
+VOID
+MmBuildMdlForNonPagedPool (
+    PMDL Mdl
+    )
+{
+    UNREFERENCED_PARAMETER( Mdl );
+}
+
+VOID
+MmProbeAndLockPages (
+    PMDL Mdl,
+    KPROCESSOR_MODE AccessMode,
+    LOCK_OPERATION Operation
+    )
+{
+    UNREFERENCED_PARAMETER( Mdl );
+    UNREFERENCED_PARAMETER( AccessMode );
+    UNREFERENCED_PARAMETER( Operation );
+}
+
+VOID
+MmUnlockPages (
+    PMDL Mdl
+    )
+{
+    UNREFERENCED_PARAMETER( Mdl );
+}
+
+PVOID
+MmGetSystemAddressForMdlSafe (
+    PMDL Mdl,
+    ULONG Priority
+    )
+{
+    UNREFERENCED_PARAMETER( Priority );
+
+    return Mdl->StartVa;
+}
+
+VOID
+KeFlushIoBuffers (
+    PMDL Mdl,
+    BOOLEAN ReadOperation,
+    BOOLEAN DmaOperation
+    )
+{
+    UNREFERENCED_PARAMETER( Mdl );
+    UNREFERENCED_PARAMETER( ReadOperation );
+    UNREFERENCED_PARAMETER( DmaOperation );
+}
+
+VOID
+IoAcquireVpbSpinLock (
+    PKIRQL Irql
+    )
+{
+    pthread_mutex_lock( &HostVpbLock );
+    *Irql = 0;
+}
+
+VOID
+IoReleaseVpbSpinLock (
+    KIRQL Irql
+    )
+{
+    UNREFERENCED_PARAMETER( Irql );
+
+    pthread_mutex_unlock( &HostVpbLock );
+}
+
+VOID
+IoDeleteDevice (
+    PDEVICE_OBJECT DeviceObject
+    )
+{
+    ExFreePool( DeviceObject );
+}
+
+PFILE_OBJECT
+IoCreateStreamFileObjectLite (
+    PFILE_OBJECT FileObject,
+    PDEVICE_OBJECT DeviceObject
+    )
+{
+    PFILE_OBJECT StreamFile;
+
+    StreamFile = ExAllocatePoolWithTag( NonPagedPool, sizeof( FILE_OBJECT ), HOST_TAG_FILE );
+
+    if (StreamFile == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( StreamFile, sizeof( FILE_OBJECT ));
+    StreamFile->Type = IO_TYPE_FILE;
+    StreamFile->Size = sizeof( FILE_OBJECT );
+    StreamFile->DeviceObject = (DeviceObject != NULL) ? DeviceObject : FileObject->DeviceObject;
+    StreamFile->HostReferenceCount = 1;
+
+    return StreamFile;
+}
+
+//
+//  As in FilObSup.c, whose own copy sets the type of open with a cast used
+//  as an lvalue.
+//
+
+VOID
+CdSetFileObject (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFILE_OBJECT FileObject,
+    _In_ TYPE_OF_OPEN TypeOfOpen,
+    PFCB Fcb,
+    _In_opt_ PCCB Ccb
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (TypeOfOpen == UnopenedFileObject) {
+
+        FileObject->FsContext =
+        FileObject->FsContext2 = NULL;
+
+        return;
+    }
+
+    NT_ASSERT( !FlagOn( ((ULONG_PTR) Ccb), TYPE_OF_OPEN_MASK ));
+
+    FileObject->FsContext = Fcb;
+    FileObject->FsContext2 = (PVOID) ((ULONG_PTR) Ccb | TypeOfOpen);
+    FileObject->Vpb = Fcb->Vcb->Vpb;
+}
+
+//
+//  Closes happen as soon as the last reference to a file object goes, so
+//  there are never any queued.
+//
+
+VOID
+CdFspClose (
+    _In_opt_ PVCB Vcb
+    )
+{
+    UNREFERENCED_PARAMETER( Vcb );
+}
+
+//
+//  The close of the last reference to a file object, as CdCommonClose and
+//  CdCommonClosePrivate do it for a request which can wait.
+//
+
+static VOID
+HostCloseFileObject (
+    PFILE_OBJECT FileObject
+    )
+{
+    IRP_CONTEXT IrpContext;
+    IRP_CONTEXT_LITE IrpContextLite;
+    THREAD_CONTEXT ThreadContext = {0};
+    TYPE_OF_OPEN TypeOfOpen;
+    PFCB Fcb = FileObject->FsContext;
+    PCCB Ccb;
+    PVCB Vcb;
+    ULONG UserReference = 0;
+    BOOLEAN RemovedFcb;
+
+    TypeOfOpen = (TYPE_OF_OPEN) ((ULONG_PTR) FileObject->FsContext2 & TYPE_OF_OPEN_MASK);
+    Ccb = (PCCB) ((ULONG_PTR) FileObject->FsContext2 & ~(ULONG_PTR) TYPE_OF_OPEN_MASK);
+
+    if (TypeOfOpen != UnopenedFileObject) {
+
+        RtlZeroMemory( &IrpContextLite, sizeof( IRP_CONTEXT_LITE ));
+        IrpContextLite.Fcb = Fcb;
+        IrpContextLite.RealDevice = FileObject->DeviceObject;
+
+        CdInitializeStackIrpContext( &IrpContext, &IrpContextLite );
+
+        //
+        //  A close from inside a teardown, of a stream file the teardown
+        //  has let go of, finds the teardown's Irp context here and leaves
+        //  the Fcb to it.
+        //
+
+        CdSetThreadContext( &IrpContext, &ThreadContext );
+
+        Vcb = Fcb->Vcb;
+
+        if (Ccb != NULL) {
+
+            UserReference = 1;
+            CdDeleteCcb( &IrpContext, Ccb );
+        }
+
+        CdAcquireVcbShared( &IrpContext, Vcb, FALSE );
+        CdAcquireFcbExclusive( &IrpContext, Fcb, FALSE );
+
+        CdLockVcb( &IrpContext, Vcb );
+        CdDecrementReferenceCounts( &IrpContext, Fcb, 1, UserReference );
+        CdUnlockVcb( &IrpContext, Vcb );
+
+        CdTeardownStructures( &IrpContext, Fcb, &RemovedFcb );
+
+        if (!RemovedFcb) {
+
+            CdReleaseFcb( &IrpContext, Fcb );
+        }
+
+        CdReleaseVcb( &IrpContext, Vcb );
+
+        CdCleanupIrpContext( &IrpContext, FALSE );
+    }
+
+    ExFreePool( FileObject );
+}
+
+//
+//  Objects are only ever devices and file objects, which both start with
+//  their type.
+//
+
+VOID
+ObReferenceObject (
+    PVOID Object
+    )
+{
+    if (((PFILE_OBJECT) Object)->Type == IO_TYPE_FILE) {
+
+        InterlockedIncrement( &((PFILE_OBJECT) Object)->HostReferenceCount );
+
+    } else {
+
+        InterlockedIncrement( &((PDEVICE_OBJECT) Object)->HostReferenceCount );
+    }
+}
+
+VOID
+ObDereferenceObject (
+    PVOID Object
+    )
+{
+    if (((PFILE_OBJECT) Object)->Type == IO_TYPE_FILE) {
+
+        if (InterlockedDecrement( &((PFILE_OBJECT) Object)->HostReferenceCount ) == 0) {
+
+            HostCloseFileObject( Object );
+        }
+
+    } else {
+
+        InterlockedDecrement( &((PDEVICE_OBJECT) Object)->HostReferenceCount );
+    }
+}
+
+VOID
+CcInitializeCacheMap (
+    PFILE_OBJECT FileObject,
+    PCC_FILE_SIZES FileSizes,
+    BOOLEAN PinAccess,
+    PCACHE_MANAGER_CALLBACKS Callbacks,
+    PVOID LazyWriteContext
+    )
+{
+    UNREFERENCED_PARAMETER( FileSizes );
+    UNREFERENCED_PARAMETER( PinAccess );
+    UNREFERENCED_PARAMETER( Callbacks );
+    UNREFERENCED_PARAMETER( LazyWriteContext );
+
+    FileObject->PrivateCacheMap = FileObject;
+}
+
+BOOLEAN
+CcUninitializeCacheMap (
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER TruncateSize,
+    PVOID UninitializeEvent
+    )
+{
+    UNREFERENCED_PARAMETER( TruncateSize );
+    UNREFERENCED_PARAMETER( UninitializeEvent );
+
+    FileObject->PrivateCacheMap = NULL;
+
+    return TRUE;
+}
+
+VOID
+CcSetFileSizes (
+    PFILE_OBJECT FileObject,
+    PCC_FILE_SIZES FileSizes
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( FileSizes );
+}
+
+//
+//  Nothing stays cached, so there is never anything to purge or flush.
+//
+
+BOOLEAN
+CcPurgeCacheSection (
+    PSECTION_OBJECT_POINTERS SectionObjectPointer,
+    PLARGE_INTEGER FileOffset,
+    ULONG Length,
+    BOOLEAN UninitializeCacheMaps
+    )
+{
+    UNREFERENCED_PARAMETER( SectionObjectPointer );
+    UNREFERENCED_PARAMETER( FileOffset );
+    UNREFERENCED_PARAMETER( Length );
+    UNREFERENCED_PARAMETER( UninitializeCacheMaps );
+
+    return TRUE;
+}
+
+BOOLEAN
+MmFlushImageSection (
+    PSECTION_OBJECT_POINTERS SectionObjectPointer,
+    MMFLUSH_TYPE FlushType
+    )
+{
+    UNREFERENCED_PARAMETER( SectionObjectPointer );
+    UNREFERENCED_PARAMETER( FlushType );
+
+    return TRUE;
+}
+
+//
+//  Each mapping reads the range from the device through the stream's
+//  allocation, and the Bcb is the buffer it was read into.
+//
+
+BOOLEAN
+CcMapData (
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER FileOffset,
+    ULONG Length,
+    ULONG Flags,
+    PVOID *Bcb,
+    PVOID *Buffer
+    )
+{
+    IRP_CONTEXT IrpContext;
+    PFCB Fcb = FileObject->FsContext;
+    PUCHAR Data;
+    LONGLONG CurrentOffset = FileOffset->QuadPart;
+    LONGLONG DiskOffset;
+    ULONG ByteCount;
+    ULONG BytesRead = 0;
+    LONGLONG Sectors;
+    NTSTATUS Status;
+
+    UNREFERENCED_PARAMETER( Flags );
+
+    HostInitializeIrpContext( &IrpContext, Fcb->Vcb );
+
+    Data = FsRtlAllocatePoolWithTag( PagedPool, Length, HOST_TAG_CACHE );
+
+    while (BytesRead < Length) {
+
+        CdLookupAllocation( &IrpContext, Fcb, CurrentOffset, &DiskOffset, &ByteCount );
+
+        ByteCount = Min( ByteCount, Length - BytesRead );
+
+        Status = HostDeviceRead( Fcb->Vcb->TargetDeviceObject, DiskOffset, Data + BytesRead, ByteCount );
+
+        if (!NT_SUCCESS( Status )) {
+
+            ExRaiseStatus( Status );
+        }
+
+        BytesRead += ByteCount;
+        CurrentOffset += ByteCount;
+    }
+
+    Sectors = LlSectorsFromBytes( LlSectorAlign( SectorOffset( FileOffset->QuadPart ) + Length ));
+
+    if (SafeNodeType( Fcb ) == CDFS_NTC_FCB_PATH_TABLE) {
+
+        HostCount( &HostCounters.PathTableSectors, Sectors );
+
+    } else {
+
+        HostCount( &HostCounters.DirectorySectors, Sectors );
+    }
+
+    *Bcb = Data;
+    *Buffer = Data;
+
+    return TRUE;
+}
+
+VOID
+CcUnpinData (
+    PVOID Bcb
+    )
+{
+    ExFreePool( Bcb );
+}
+
+//
+//  Upcasing covers ASCII and Latin-1, which is all the host programs name
+//  files with.
+//
+
+WCHAR
+RtlUpcaseUnicodeChar (
+    WCHAR SourceCharacter
+    )
+{
+    if (((SourceCharacter >= L'a') && (SourceCharacter <= L'z')) ||
+        ((SourceCharacter >= 0xe0) && (SourceCharacter <= 0xfe) && (SourceCharacter != 0xf7))) {
+
+        return SourceCharacter - 0x20;
+    }
+
+    if (SourceCharacter == 0xff) {
+
+        return 0x178;
+    }
+
+    return SourceCharacter;
+}
+
+NTSTATUS
+RtlUpcaseUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCUNICODE_STRING SourceString,
+    BOOLEAN AllocateDestinationString
+    )
+{
+    ULONG Index;
+
+    NT_ASSERT( !AllocateDestinationString );
+
+    if (DestinationString->MaximumLength < SourceString->Length) {
+
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    for (Index = 0; Index < SourceString->Length / sizeof( WCHAR ); Index += 1) {
+
+        DestinationString->Buffer[Index] = RtlUpcaseUnicodeChar( SourceString->Buffer[Index] );
+    }
+
+    DestinationString->Length = SourceString->Length;
+
+    return STATUS_SUCCESS;
+}
+
+//
+//  Hpfs allows anything in a name but control characters, the separators
+//  and, unless asked, the wild cards.
+//
+
+BOOLEAN
+FsRtlIsAnsiCharacterLegalHpfs (
+    UCHAR Character,
+    BOOLEAN WildOk
+    )
+{
+    if ((Character < 0x20) || (strchr( "/:\\|", Character ) != NULL)) {
+
+        return FALSE;
+    }
+
+    if (strchr( "*?\"<>", Character ) != NULL) {
+
+        return WildOk;
+    }
+
+    return TRUE;
+}
+
+SIZE_T
+RtlCompareMemory (
+    const VOID *Source1,
+    const VOID *Source2,
+    SIZE_T Length
+    )
+{
+    const UCHAR *Bytes1 = Source1;
+    const UCHAR *Bytes2 = Source2;
+    SIZE_T Index;
+
+    for (Index = 0; (Index < Length) && (Bytes1[Index] == Bytes2[Index]); Index += 1) {
+
+        NOTHING;
+    }
+
+    return Index;
+}
+
+VOID
+RtlTimeFieldsToTime (
+    PTIME_FIELDS TimeFields,
+    PLARGE_INTEGER Time
+    )
+{
+    LONGLONG Year = TimeFields->Year - (TimeFields->Month <= 2);
+    LONGLONG Era = Year / 400;
+    LONGLONG YearOfEra = Year - Era * 400;
+    LONGLONG DayOfYear = (153 * (TimeFields->Month + (TimeFields->Month > 2 ? -3 : 9)) + 2) / 5 + TimeFields->Day - 1;
+    LONGLONG DayOfEra = YearOfEra * 365 + YearOfEra / 4 - YearOfEra / 100 + DayOfYear;
+    LONGLONG Days;
+
+    //
+    //  Days from 1 January 1970, counted from 1 March of year 0, and then
+    //  moved back to 1601.
+    //
+
+    Days = Era * 146097 + DayOfEra - 719468 + 134774;
+
+    Time->QuadPart = ((((Days * 24 + TimeFields->Hour) * 60 + TimeFields->Minute) * 60 +
+                       TimeFields->Second) * 1000 + TimeFields->Milliseconds) * 10000;
+}
+
+//
+//  Splay trees, as in Rtl: a root is its own parent.
+//
+
+static VOID
+HostRotate (
+    PRTL_SPLAY_LINKS Links
+    )
+{
+    PRTL_SPLAY_LINKS Parent = Links->Parent;
+    PRTL_SPLAY_LINKS GrandParent = Parent->Parent;
+    BOOLEAN ParentIsRoot = RtlIsRoot( Parent );
+
+    if (Parent->LeftChild == Links) {
+
+        Parent->LeftChild = Links->RightChild;
+
+        if (Links->RightChild != NULL) {
+
+            Links->RightChild->Parent = Parent;
+        }
+
+        Links->RightChild = Parent;
+
+    } else {
+
+        Parent->RightChild = Links->LeftChild;
+
+        if (Links->LeftChild != NULL) {
+
+            Links->LeftChild->Parent = Parent;
+        }
+
+        Links->LeftChild = Parent;
+    }
+
+    Parent->Parent = Links;
+
+    if (ParentIsRoot) {
+
+        Links->Parent = Links;
+
+    } else {
+
+        Links->Parent = GrandParent;
+
+        if (GrandParent->LeftChild == Parent) {
+
+            GrandParent->LeftChild = Links;
+
+        } else {
+
+            GrandParent->RightChild = Links;
+        }
+    }
+}
+
+PRTL_SPLAY_LINKS
+RtlSplay (
+    PRTL_SPLAY_LINKS Links
+    )
+{
+    PRTL_SPLAY_LINKS Parent;
+    PRTL_SPLAY_LINKS GrandParent;
+
+    while (!RtlIsRoot( Links )) {
+
+        Parent = Links->Parent;
+
+        if (RtlIsRoot( Parent )) {
+
+            HostRotate( Links );
+
+        } else {
+
+            GrandParent = Parent->Parent;
+
+            if ((GrandParent->LeftChild == Parent) == (Parent->LeftChild == Links)) {
+
+                HostRotate( Parent );
+                HostRotate( Links );
+
+            } else {
+
+                HostRotate( Links );
+                HostRotate( Links );
+            }
+        }
+    }
+
+    return Links;
+}
+
+PRTL_SPLAY_LINKS
+RtlDelete (
+    PRTL_SPLAY_LINKS Links
+    )
+{
+    PRTL_SPLAY_LINKS Left;
+    PRTL_SPLAY_LINKS Right;
+    PRTL_SPLAY_LINKS Predecessor;
+
+    RtlSplay( Links );
+
+    Left = Links->LeftChild;
+    Right = Links->RightChild;
+
+    if (Left == NULL) {
+
+        if (Right != NULL) {
+
+            Right->Parent = Right;
+        }
+
+        return Right;
+    }
+
+    Left->Parent = Left;
+
+    if (Right == NULL) {
+
+        return Left;
+    }
+
+    for (Predecessor = Left; Predecessor->RightChild != NULL; Predecessor = Predecessor->RightChild) {
+
+        NOTHING;
+    }
+
+    RtlSplay( Predecessor );
+    RtlInsertAsRightChild( Predecessor, Right );
+
+    return Predecessor;
+}
+
+VOID
+RtlInitializeGenericTable (
+    PRTL_GENERIC_TABLE Table,
+    PRTL_GENERIC_COMPARE_ROUTINE CompareRoutine,
+    PRTL_GENERIC_ALLOCATE_ROUTINE AllocateRoutine,
+    PRTL_GENERIC_FREE_ROUTINE FreeRoutine,
+    PVOID TableContext
+    )
+{
+    RtlZeroMemory( Table, sizeof( RTL_GENERIC_TABLE ));
+    InitializeListHead( &Table->InsertOrderList );
+    Table->OrderedPointer = &Table->InsertOrderList;
+    Table->CompareRoutine = CompareRoutine;
+    Table->AllocateRoutine = AllocateRoutine;
+    Table->FreeRoutine = FreeRoutine;
+    Table->TableContext = TableContext;
+}
+
+//
+//  Returns the element matching Buffer, or else the one it would hang off
+//  with the side in Result.
+//
+
+static PHOST_TABLE_ENTRY
+HostFindElement (
+    PRTL_GENERIC_TABLE Table,
+    PVOID Buffer,
+    RTL_GENERIC_COMPARE_RESULTS *Result
+    )
+{
+    PRTL_SPLAY_LINKS Links = Table->TableRoot;
+    PRTL_SPLAY_LINKS Child;
+    PHOST_TABLE_ENTRY Entry = NULL;
+
+    while (Links != NULL) {
+
+        Entry = CONTAINING_RECORD( Links, HOST_TABLE_ENTRY, Links );
+        *Result = Table->CompareRoutine( Table, Buffer, Entry->UserData );
+
+        if (*Result == GenericEqual) {
+
+            break;
+        }
+
+        Child = (*Result == GenericLessThan) ? Links->LeftChild : Links->RightChild;
+
+        if (Child == NULL) {
+
+            break;
+        }
+
+        Links = Child;
+    }
+
+    return Entry;
+}
+
+PVOID
+RtlLookupElementGenericTable (
+    PRTL_GENERIC_TABLE Table,
+    PVOID Buffer
+    )
+{
+    RTL_GENERIC_COMPARE_RESULTS Result;
+    PHOST_TABLE_ENTRY Entry = HostFindElement( Table, Buffer, &Result );
+
+    if (Entry == NULL) {
+
+        return NULL;
+    }
+
+    Table->TableRoot = RtlSplay( &Entry->Links );
+
+    return (Result == GenericEqual) ? Entry->UserData : NULL;
+}
+
+PVOID
+RtlInsertElementGenericTable (
+    PRTL_GENERIC_TABLE Table,
+    PVOID Buffer,
+    CLONG BufferSize,
+    PBOOLEAN NewElement
+    )
+{
+    RTL_GENERIC_COMPARE_RESULTS Result;
+    PHOST_TABLE_ENTRY Parent = HostFindElement( Table, Buffer, &Result );
+    PHOST_TABLE_ENTRY Entry;
+
+    if ((Parent != NULL) && (Result == GenericEqual)) {
+
+        Table->TableRoot = RtlSplay( &Parent->Links );
+
+        if (NewElement != NULL) {
+
+            *NewElement = FALSE;
+        }
+
+        return Parent->UserData;
+    }
+
+    Entry = Table->AllocateRoutine( Table, (CLONG) (offsetof( HOST_TABLE_ENTRY, UserData ) + BufferSize) );
+
+    if (Entry == NULL) {
+
+        return NULL;
+    }
+
+    RtlInitializeSplayLinks( &Entry->Links );
+    RtlCopyMemory( Entry->UserData, Buffer, BufferSize );
+    InsertTailList( &Table->InsertOrderList, &Entry->ListEntry );
+    Table->NumberGenericTableElements += 1;
+
+    if (Parent != NULL) {
+
+        if (Result == GenericLessThan) {
+
+            RtlInsertAsLeftChild( &Parent->Links, &Entry->Links );
+
+        } else {
+
+            RtlInsertAsRightChild( &Parent->Links, &Entry->Links );
+        }
+    }
+
+    Table->TableRoot = RtlSplay( &Entry->Links );
+
+    if (NewElement != NULL) {
+
+        *NewElement = TRUE;
+    }
+
+    return Entry->UserData;
+}
+
+BOOLEAN
+RtlDeleteElementGenericTable (
+    PRTL_GENERIC_TABLE Table,
+    PVOID Buffer
+    )
+{
+    RTL_GENERIC_COMPARE_RESULTS Result;
+    PHOST_TABLE_ENTRY Entry = HostFindElement( Table, Buffer, &Result );
+
+    if ((Entry == NULL) || (Result != GenericEqual)) {
+
+        return FALSE;
+    }
+
+    Table->TableRoot = RtlDelete( &Entry->Links );
+    RemoveEntryList( &Entry->ListEntry );
+    Table->NumberGenericTableElements -= 1;
+    Table->OrderedPointer = &Table->InsertOrderList;
+    Table->WhichOrderedElement = 0;
+
+    Table->FreeRoutine( Table, Entry );
+
+    return TRUE;
+}
+
+PVOID
+RtlEnumerateGenericTableWithoutSplaying (
+    PRTL_GENERIC_TABLE Table,
+    PVOID *RestartKey
+    )
+{
+    PRTL_SPLAY_LINKS Links;
+
+    if (*RestartKey == NULL) {
+
+        Links = Table->TableRoot;
+
+        if (Links == NULL) {
+
+            return NULL;
+        }
+
+        while (Links->LeftChild != NULL) {
+
+            Links = Links->LeftChild;
+        }
+
+    } else {
+
+        Links = &CONTAINING_RECORD( *RestartKey, HOST_TABLE_ENTRY, UserData )->Links;
+
+        if (Links->RightChild != NULL) {
+
+            for (Links = Links->RightChild; Links->LeftChild != NULL; Links = Links->LeftChild) {
+
+                NOTHING;
+            }
+
+        } else {
+
+            while (!RtlIsRoot( Links ) && (Links->Parent->RightChild == Links)) {
+
+                Links = Links->Parent;
+            }
+
+            if (RtlIsRoot( Links )) {
+
+                return NULL;
+            }
+
+            Links = Links->Parent;
+        }
+    }
+
+    *RestartKey = CONTAINING_RECORD( Links, HOST_TABLE_ENTRY, Links )->UserData;
+
+    return *RestartKey;
+}
+
+VOID
+FsRtlSetupAdvancedHeader (
+    PVOID AdvHdr,
+    PFAST_MUTEX FMutex
+    )
+{
+    FSRTL_ADVANCED_FCB_HEADER *Header = AdvHdr;
+
+    Header->FastMutex = FMutex;
+    InitializeListHead( &Header->FilterContexts );
+}
+
+VOID
+FsRtlTeardownPerStreamContexts (
+    FSRTL_ADVANCED_FCB_HEADER *AdvancedHeader
+    )
+{
+    UNREFERENCED_PARAMETER( AdvancedHeader );
+}
+
+VOID
+FsRtlInitializeOplock (
+    POPLOCK Oplock
+    )
+{
+    RtlZeroMemory( Oplock, sizeof( OPLOCK ));
+}
+
+VOID
+FsRtlUninitializeOplock (
+    POPLOCK Oplock
+    )
+{
+    UNREFERENCED_PARAMETER( Oplock );
+}
+
+VOID
+FsRtlNotifyInitializeSync (
+    PNOTIFY_SYNC *NotifySync
+    )
+{
+    *NotifySync = FsRtlAllocatePoolWithTag( NonPagedPool, sizeof( NOTIFY_SYNC ), HOST_TAG_NOTIFY );
+}
+
+VOID
+FsRtlNotifyUninitializeSync (
+    PNOTIFY_SYNC *NotifySync
+    )
+{
+    if (*NotifySync != NULL) {
+
+        ExFreePool( *NotifySync );
+        *NotifySync = NULL;
+    }
+}
+
+//
+//  The global data as CdInitializeGlobalData sets it up for a medium
+//  sized system, and torn down as CdUnload does.
+//
+
+VOID
+HostInitialize (
+    VOID
+    )
+{
+    HostFileSystemDeviceObject.Type = IO_TYPE_DEVICE;
+    HostFileSystemDeviceObject.Size = sizeof( DEVICE_OBJECT );
+
+    RtlZeroMemory( &CdData, sizeof( CD_DATA ));
+
+    CdData.NodeTypeCode = CDFS_NTC_DATA_HEADER;
+    CdData.NodeByteSize = sizeof( CD_DATA );
+    CdData.FileSystemDeviceObject = &HostFileSystemDeviceObject;
+
+    InitializeListHead( &CdData.VcbQueue );
+    ExInitializeResourceLite( &CdData.DataResource );
+    ExInitializeFastMutex( &CdData.CdDataMutex );
+    InitializeListHead( &CdData.AsyncCloseQueue );
+    InitializeListHead( &CdData.DelayedCloseQueue );
+
+    CdData.IrpContextMaxDepth = 8;
+    CdData.MaxDelayedCloseCount = 24;
+    CdData.MinDelayedCloseCount = 6;
+    CdData.ReadAheadDepth = CD_READ_AHEAD_DEFAULT_DEPTH;
+}
+
+VOID
+HostUninitialize (
+    VOID
+    )
+{
+    PIRP_CONTEXT IrpContext;
+
+    while (1) {
+
+        IrpContext = (PIRP_CONTEXT) PopEntryList( &CdData.IrpContextList );
+
+        if (IrpContext == NULL) {
+
+            break;
+        }
+
+        ExFreePool( IrpContext );
+    }
+
+    CdData.IrpContextDepth = 0;
+    ExDeleteResourceLite( &CdData.DataResource );
+}
+
+PDEVICE_OBJECT
+HostCreateTargetDevice (
+    VOID
+    )
+{
+    PDEVICE_OBJECT DeviceObject;
+
+    DeviceObject = FsRtlAllocatePoolWithTag( NonPagedPool, sizeof( DEVICE_OBJECT ), HOST_TAG_DEVICE );
+
+    RtlZeroMemory( DeviceObject, sizeof( DEVICE_OBJECT ));
+    DeviceObject->Type = IO_TYPE_DEVICE;
+    DeviceObject->Size = sizeof( DEVICE_OBJECT );
+    DeviceObject->Characteristics = FILE_REMOVABLE_MEDIA;
+    DeviceObject->StackSize = 1;
+    DeviceObject->SectorSize = SECTOR_SIZE;
+    DeviceObject->HostReferenceCount = 1;
+
+    return DeviceObject;
+}
+
+//
+//  The Vpb a dismount leaves on the device belongs to the I/O manager, and
+//  goes with the device.
+//
+
+VOID
+HostDeleteTargetDevice (
+    _In_ PDEVICE_OBJECT TargetDeviceObject
+    )
+{
+    if (TargetDeviceObject->Vpb != NULL) {
+
+        ExFreePool( TargetDeviceObject->Vpb );
+    }
+
+    ExFreePool( TargetDeviceObject );
+}
+
+//
+//  An Irp context on the caller's stack, for calling Cdfs routines outside
+//  of a request as its close and mount paths do.  A caller which may tear
+//  down structures makes it the top level one with CdSetThreadContext, and
+//  finishes with CdCleanupIrpContext.
+//
+
+VOID
+HostInitializeIrpContext (
+    _Out_ PIRP_CONTEXT IrpContext,
+    _In_opt_ PVCB Vcb
+    )
+{
+    RtlZeroMemory( IrpContext, sizeof( IRP_CONTEXT ));
+    IrpContext->NodeTypeCode = CDFS_NTC_IRP_CONTEXT;
+    IrpContext->NodeByteSize = sizeof( IRP_CONTEXT );
+    IrpContext->Vcb = Vcb;
+    IrpContext->Flags = IRP_CONTEXT_FLAG_WAIT | IRP_CONTEXT_FLAG_ON_STACK;
+}
+
+//
+//  Mounts a volume the way CdMountVolume does once it has found the volume
+//  descriptor to use.  RawIsoVd is the descriptor sector, or NULL for a
+//  volume whose Fcbs the program builds itself, and VcbState says whether
+//  it is an Iso or Joliet descriptor.
+//
+
+PVCB
+HostMountVolume (
+    _In_ PDEVICE_OBJECT TargetDeviceObject,
+    _In_reads_bytes_opt_(SECTOR_SIZE) PCHAR RawIsoVd,
+    _In_ ULONG VcbState
+    )
+{
+    IRP_CONTEXT IrpContext;
+    THREAD_CONTEXT ThreadContext = {0};
+    PVOLUME_DEVICE_OBJECT VolDo;
+    PVPB Vpb;
+    PVCB Vcb;
+
+    HostInitializeIrpContext( &IrpContext, NULL );
+    CdSetThreadContext( &IrpContext, &ThreadContext );
+
+    VolDo = FsRtlAllocatePoolWithTag( NonPagedPool, sizeof( VOLUME_DEVICE_OBJECT ), HOST_TAG_DEVICE );
+
+    RtlZeroMemory( VolDo, sizeof( VOLUME_DEVICE_OBJECT ));
+    VolDo->DeviceObject.Type = IO_TYPE_DEVICE;
+    VolDo->DeviceObject.Size = sizeof( VOLUME_DEVICE_OBJECT );
+    VolDo->DeviceObject.StackSize = TargetDeviceObject->StackSize + 1;
+    VolDo->DeviceObject.SectorSize = TargetDeviceObject->SectorSize;
+    VolDo->DeviceObject.HostReferenceCount = 1;
+
+    //
+    //  The Vpb comes from pool, since the dismount frees it along with the
+    //  Vcb when it has swapped in a fresh one for the real device.
+    //
+
+    Vpb = FsRtlAllocatePoolWithTag( NonPagedPool, sizeof( VPB ), HOST_TAG_VPB );
+
+    RtlZeroMemory( Vpb, sizeof( VPB ));
+    Vpb->Type = IO_TYPE_VPB;
+    Vpb->Size = sizeof( VPB );
+    Vpb->Flags = VPB_MOUNTED;
+    Vpb->DeviceObject = &VolDo->DeviceObject;
+    Vpb->RealDevice = TargetDeviceObject;
+    Vpb->ReferenceCount = 1;
+
+    TargetDeviceObject->Vpb = Vpb;
+
+    Vcb = &VolDo->Vcb;
+
+    CdAcquireCdData( &IrpContext );
+
+    CdInitializeVcb( &IrpContext, Vcb, TargetDeviceObject, Vpb, NULL, 0, 0, 0, 0, 0 );
+
+    IrpContext.Vcb = Vcb;
+    CdAcquireVcbExclusive( &IrpContext, Vcb, FALSE );
+
+    SetFlag( Vcb->VcbState, VcbState );
+
+    Vcb->MaximumTransferRawSectors = (64 * 1024) / RAW_SECTOR_SIZE;
+    Vcb->MaximumPhysicalPages = 16;
+
+    CdUpdateVcbFromVolDescriptor( &IrpContext, Vcb, RawIsoVd );
+
+    Vcb->VcbReference -= CDFS_RESIDUAL_REFERENCE;
+    CdUpdateVcbCondition( Vcb, VcbMounted );
+
+    CdReleaseVcb( &IrpContext, Vcb );
+    CdReleaseCdData( &IrpContext );
+
+    CdCleanupIrpContext( &IrpContext, FALSE );
+
+    return Vcb;
+}
+
+//
+//  Forces the volume off the device.  The host programs close all their
+//  files first, so the Vcb is deleted along with it.
+//
+
+VOID
+HostDismountVolume (
+    _Inout_ PVCB Vcb
+    )
+{
+    IRP_CONTEXT IrpContext;
+    THREAD_CONTEXT ThreadContext = {0};
+    BOOLEAN VcbPresent;
+
+    HostInitializeIrpContext( &IrpContext, Vcb );
+    CdSetThreadContext( &IrpContext, &ThreadContext );
+
+    CdAcquireCdData( &IrpContext );
+
+    VcbPresent = CdCheckForDismount( &IrpContext, Vcb, TRUE );
+
+    CdReleaseCdData( &IrpContext );
+
+    CdCleanupIrpContext( &IrpContext, FALSE );
+
+    NT_ASSERT( !VcbPresent );
+}
+
+VOID
+HostWaitForWorkItems (
+    VOID
+    )
+{
+    pthread_mutex_lock( &HostLock );
+
+    while (HostWorkItemsRunning != 0) {
+
+        pthread_cond_wait( &HostWorkItemsDone, &HostLock );
+    }
+
+    pthread_mutex_unlock( &HostLock );
+}
+
+VOID
+HostGetCounters (
+    _Out_ PHOST_COUNTERS Counters
+    )
+{
+    pthread_mutex_lock( &HostLock );
+    *Counters = HostCounters;
+    pthread_mutex_unlock( &HostLock );
+}
+
+//
+//  The number of times the calling thread has blocked on an event or a
+//  resource.
+//
+
+ULONG
+HostBlockedWaits (
+    VOID
+    )
+{
+    return HostWaits;
+}
@@ -0,0 +1,111 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Host.h
+
+Abstract:
+
+    The routines host.c adds for the programs built on the Cdfs sources:
+    setting up and tearing down the global data as DriverEntry and CdUnload
+    would, mounting a volume on a simulated target device and dismounting
+    it again, and the counters the programs report from.
+
+    Each program supplies HostDeviceRead, which serves the reads Cdfs sends
+    to the target device.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#pragma once
+
+#include "CdProcs.h"
+
+//
+//  Counters kept by host.c.  Pool is counted from the first allocation, the
+//  rest only go up.
+//
+//      PoolBlocks - Pool allocations not yet freed.
+//      PoolBytes - Bytes in them.
+//      NameIndexAllocations - Pool allocations with TAG_NAME_INDEX.
+//      WorkItemsQueued - Work items queued.
+//      PathTableSectors - Path table sectors mapped by CcMapData.
+//      DirectorySectors - Directory sectors mapped by CcMapData.
+//
+
+typedef struct _HOST_COUNTERS {
+
+    LONGLONG PoolBlocks;
+    LONGLONG PoolBytes;
+    LONGLONG NameIndexAllocations;
+    LONGLONG WorkItemsQueued;
+    LONGLONG PathTableSectors;
+    LONGLONG DirectorySectors;
+
+} HOST_COUNTERS, *PHOST_COUNTERS;
+
+NTSTATUS
+HostDeviceRead (
+    _In_ PDEVICE_OBJECT TargetDeviceObject,
+    _In_ LONGLONG StartingOffset,
+    _Out_writes_bytes_(ByteCount) PVOID Buffer,
+    _In_ ULONG ByteCount
+    );
+
+VOID
+HostInitialize (
+    VOID
+    );
+
+VOID
+HostUninitialize (
+    VOID
+    );
+
+VOID
+HostInitializeIrpContext (
+    _Out_ PIRP_CONTEXT IrpContext,
+    _In_opt_ PVCB Vcb
+    );
+
+PDEVICE_OBJECT
+HostCreateTargetDevice (
+    VOID
+    );
+
+VOID
+HostDeleteTargetDevice (
+    _In_ PDEVICE_OBJECT TargetDeviceObject
+    );
+
+PVCB
+HostMountVolume (
+    _In_ PDEVICE_OBJECT TargetDeviceObject,
+    _In_reads_bytes_opt_(SECTOR_SIZE) PCHAR RawIsoVd,
+    _In_ ULONG VcbState
+    );
+
+VOID
+HostDismountVolume (
+    _Inout_ PVCB Vcb
+    );
+
+VOID
+HostWaitForWorkItems (
+    VOID
+    );
+
+VOID
+HostGetCounters (
+    _Out_ PHOST_COUNTERS Counters
+    );
+
+ULONG
+HostBlockedWaits (
+    VOID
+    );
@@ -0,0 +1,68 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    ntddcdrm.h
+
+Abstract:
+
+    User mode stand-in for the CD-ROM device interface, with just the TOC
+    layouts and codes the Cdfs sources built here refer to.
+
+Environment:
+
+    Host (user mode), C11 with -fms-extensions.
+
+--*/
+
+#pragma once
+
+#define IOCTL_CDROM_READ_TOC            0x00024000
+#define IOCTL_CDROM_READ_TOC_EX         0x00024054
+#define IOCTL_CDROM_DISK_TYPE           0x00020040
+#define IOCTL_CDROM_CHECK_VERIFY        0x00024800
+
+#define CDROM_READ_TOC_EX_FORMAT_TOC    0x00
+#define CDROM_DISK_AUDIO_TRACK          0x00000001
+#define CDROM_DISK_DATA_TRACK           0x00000002
+
+typedef struct _TRACK_DATA {
+    UCHAR Reserved;
+    UCHAR Control : 4;
+    UCHAR Adr : 4;
+    UCHAR TrackNumber;
+    UCHAR Reserved1;
+    UCHAR Address[4];
+} TRACK_DATA, *PTRACK_DATA;
+
+typedef struct _CDROM_READ_TOC_EX {
+    UCHAR Format : 4;
+    UCHAR Reserved1 : 3;
+    UCHAR Msf : 1;
+    UCHAR SessionTrack;
+    UCHAR Reserved2;
+    UCHAR Reserved3;
+} CDROM_READ_TOC_EX, *PCDROM_READ_TOC_EX;
+
+typedef struct _CDROM_DISK_DATA {
+    ULONG DiskData;
+} CDROM_DISK_DATA, *PCDROM_DISK_DATA;
+
+typedef enum _TRACK_MODE_TYPE {
+    YellowMode2,
+    XAForm2,
+    CDDA,
+    RawWithC2AndSubCode,
+    RawWithC2,
+    RawWithSubCode
+} TRACK_MODE_TYPE, *PTRACK_MODE_TYPE;
+
+typedef struct _RAW_READ_INFO {
+    LARGE_INTEGER DiskOffset;
+    ULONG SectorCount;
+    TRACK_MODE_TYPE TrackMode;
+} RAW_READ_INFO, *PRAW_READ_INFO;
+
+#define IOCTL_CDROM_RAW_READ            0x0002403e
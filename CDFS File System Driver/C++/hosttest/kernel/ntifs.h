@@ -0,0 +1,932 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    ntifs.h
+
+Abstract:
+
+    User mode stand-in for the kernel headers the Cdfs sources include, so
+    that the driver's own CdProcs.h, CdStruc.h and friends, and with them
+    the path table, directory, name, structure, allocation, prefix, device
+    I/O and resource routines, compile unchanged on the host.
+
+    Kernel objects the Cdfs structures embed but the code built here never
+    looks inside are opaque blobs.  Resources, fast mutexes, events and work
+    items are real, built on pthreads, since the read-ahead runs its reads
+    on work item threads.  Structured exception handling is reduced to
+    straight line code: nothing raised is ever caught, a raise ends the
+    program, so try bodies run into their finally blocks and except blocks
+    are never entered.  A try body is a block with its own local label at
+    the end, which leave jumps to from anywhere in the body.  The routines
+    declared at the bottom are supplied by host.c, or by unused.c for those
+    the host programs never reach.
+
+Environment:
+
+    Host (user mode), C11 with -fms-extensions.
+
+--*/
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define UNALIGNED
+#define NOTHING
+
+#define NTDDI_WIN8                      0x06020000
+#define NTDDI_VERSION                   NTDDI_WIN8
+#define CONST                           const
+#define VOID                            void
+#define __inline                        static inline
+#define __volatile                      volatile
+#define FASTCALL
+#define DECLSPEC_NORETURN               __attribute__(( noreturn ))
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _Outptr_
+#define _Ret_valid_
+#define _Pre_notnull_
+#define _Post_invalid_
+#define _Post_null_
+#define _Post_notnull_
+#define _Unreferenced_parameter_
+#define _IRQL_requires_same_
+#define _IRQL_requires_max_(...)
+#define _Dispatch_type_(...)
+#define __drv_aliasesMem
+#define _Out_writes_(...)
+#define _Out_writes_bytes_(...)
+#define _Out_writes_bytes_opt_(...)
+#define _Out_writes_bytes_to_(...)
+#define _In_reads_opt_(...)
+#define _In_reads_bytes_(...)
+#define _In_reads_bytes_opt_(...)
+#define _Inout_updates_bytes_(...)
+#define _In_range_(...)
+#define _Field_range_(...)
+#define _Old_(...)
+#define _At_(...)
+#define _When_(...)
+#define _Success_(...)
+#define _Post_satisfies_(...)
+#define _Inexpressible_(...)
+#define _Function_class_(...)
+#define _Requires_lock_held_(...)
+#define _Acquires_shared_lock_(...)
+#define _Acquires_exclusive_lock_(...)
+#define _Releases_lock_(...)
+#define _Analysis_assume_(...)
+#define __analysis_assert(...)
+#define _Analysis_assume_lock_held_(...)
+#define _Analysis_assume_lock_not_held_(...)
+#define _IRQL_saves_global_(...)
+#define _IRQL_restores_global_(...)
+#define __drv_freesMem(...)
+
+typedef void                    *PVOID;
+typedef char                    CHAR, *PCHAR, CCHAR, KPROCESSOR_MODE;
+typedef unsigned char           UCHAR, *PUCHAR, BOOLEAN, *PBOOLEAN;
+typedef short                   SHORT, CSHORT;
+typedef unsigned short          USHORT, *PUSHORT;
+typedef uint16_t                WCHAR, *PWCHAR, *PWSTR;
+typedef const WCHAR             *PCWSTR;
+typedef int32_t                 LONG, *PLONG;
+typedef uint32_t                ULONG, *PULONG, ULONG32, CLONG, LOGICAL, ACCESS_MASK, *PACCESS_MASK;
+typedef int64_t                 LONGLONG, *PLONGLONG;
+typedef uint64_t                ULONGLONG, *PULONGLONG;
+typedef uintptr_t               ULONG_PTR, SIZE_T, KSPIN_LOCK, ERESOURCE_THREAD;
+typedef LONG                    NTSTATUS, *PNTSTATUS;
+typedef UCHAR                   KIRQL, *PKIRQL;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        ULONG HighPart;
+    };
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+typedef struct _STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PCHAR Buffer;
+} STRING, *PSTRING, OEM_STRING, *POEM_STRING, ANSI_STRING, *PANSI_STRING;
+
+typedef enum _POOL_TYPE { NonPagedPool, PagedPool, NonPagedPoolNx = 512 } POOL_TYPE;
+typedef enum _LOCK_OPERATION { IoReadAccess, IoWriteAccess, IoModifyAccess } LOCK_OPERATION;
+typedef enum _MODE { KernelMode, UserMode } MODE;
+typedef enum _MMFLUSH_TYPE { MmFlushForDelete, MmFlushForWrite } MMFLUSH_TYPE;
+typedef enum _KWAIT_REASON { Executive } KWAIT_REASON;
+typedef enum _EVENT_TYPE { NotificationEvent, SynchronizationEvent } EVENT_TYPE;
+typedef enum _WORK_QUEUE_TYPE { CriticalWorkQueue, DelayedWorkQueue } WORK_QUEUE_TYPE;
+typedef enum _MM_PAGE_PRIORITY { LowPagePriority, NormalPagePriority = 16, HighPagePriority = 32 } MM_PAGE_PRIORITY;
+
+#define HOST_OPAQUE(Name, Words)                                            \
+    typedef struct _##Name { ULONG_PTR Opaque[Words]; } Name, *P##Name
+
+HOST_OPAQUE( DRIVER_OBJECT, 8 );
+HOST_OPAQUE( EPROCESS, 1 );
+HOST_OPAQUE( KTHREAD, 1 );
+typedef KTHREAD ETHREAD, *PETHREAD;
+HOST_OPAQUE( CONTEXT, 1 );
+HOST_OPAQUE( WORK_QUEUE_ITEM, 4 );
+HOST_OPAQUE( CACHE_MANAGER_CALLBACKS, 4 );
+HOST_OPAQUE( FAST_IO_DISPATCH, 32 );
+HOST_OPAQUE( SHARE_ACCESS, 8 );
+HOST_OPAQUE( FILE_LOCK, 16 );
+HOST_OPAQUE( OPLOCK, 1 );
+HOST_OPAQUE( NOTIFY_SYNC, 1 );
+
+
+//
+//  An Mdl just records the virtual range it describes; nothing is ever
+//  really locked or mapped.
+//
+
+typedef struct _MDL {
+    struct _MDL *Next;
+    PVOID StartVa;
+    ULONG ByteCount;
+} MDL, *PMDL;
+
+typedef struct _IO_STATUS_BLOCK {
+    NTSTATUS Status;
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _DEVICE_OBJECT {
+    CSHORT Type;
+    USHORT Size;
+    struct _DRIVER_OBJECT *DriverObject;
+    struct _VPB *Vpb;
+    ULONG Flags;
+    ULONG Characteristics;
+    ULONG AlignmentRequirement;
+    CCHAR StackSize;
+    ULONG SectorSize;
+    LONG HostReferenceCount;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _VPB {
+    CSHORT Type;
+    CSHORT Size;
+    USHORT Flags;
+    USHORT VolumeLabelLength;
+    PDEVICE_OBJECT DeviceObject;
+    PDEVICE_OBJECT RealDevice;
+    ULONG SerialNumber;
+    ULONG ReferenceCount;
+    WCHAR VolumeLabel[32];
+} VPB, *PVPB;
+
+typedef PVOID PBCB;
+
+typedef struct _SINGLE_LIST_ENTRY {
+    struct _SINGLE_LIST_ENTRY *Next;
+} SINGLE_LIST_ENTRY, *PSINGLE_LIST_ENTRY;
+
+typedef struct _RTL_SPLAY_LINKS {
+    struct _RTL_SPLAY_LINKS *Parent;
+    struct _RTL_SPLAY_LINKS *LeftChild;
+    struct _RTL_SPLAY_LINKS *RightChild;
+} RTL_SPLAY_LINKS, *PRTL_SPLAY_LINKS;
+
+typedef enum _RTL_GENERIC_COMPARE_RESULTS { GenericLessThan, GenericGreaterThan, GenericEqual } RTL_GENERIC_COMPARE_RESULTS;
+typedef enum _FSRTL_COMPARISON_RESULT { LessThan = -1, EqualTo = 0, GreaterThan = 1 } FSRTL_COMPARISON_RESULT;
+
+struct _RTL_GENERIC_TABLE;
+typedef RTL_GENERIC_COMPARE_RESULTS RTL_GENERIC_COMPARE_ROUTINE( struct _RTL_GENERIC_TABLE *Table, PVOID FirstStruct, PVOID SecondStruct );
+typedef PVOID RTL_GENERIC_ALLOCATE_ROUTINE( struct _RTL_GENERIC_TABLE *Table, CLONG ByteSize );
+typedef VOID RTL_GENERIC_FREE_ROUTINE( struct _RTL_GENERIC_TABLE *Table, PVOID Buffer );
+typedef RTL_GENERIC_COMPARE_ROUTINE *PRTL_GENERIC_COMPARE_ROUTINE;
+typedef RTL_GENERIC_ALLOCATE_ROUTINE *PRTL_GENERIC_ALLOCATE_ROUTINE;
+typedef RTL_GENERIC_FREE_ROUTINE *PRTL_GENERIC_FREE_ROUTINE;
+
+typedef struct _RTL_GENERIC_TABLE {
+    PRTL_SPLAY_LINKS TableRoot;
+    LIST_ENTRY InsertOrderList;
+    PLIST_ENTRY OrderedPointer;
+    ULONG WhichOrderedElement;
+    ULONG NumberGenericTableElements;
+    PRTL_GENERIC_COMPARE_ROUTINE CompareRoutine;
+    PRTL_GENERIC_ALLOCATE_ROUTINE AllocateRoutine;
+    PRTL_GENERIC_FREE_ROUTINE FreeRoutine;
+    PVOID TableContext;
+} RTL_GENERIC_TABLE, *PRTL_GENERIC_TABLE;
+
+//
+//  A resource records which threads own it, and how often, so that a
+//  thread can acquire it recursively and the ExIsResourceAcquired routines
+//  answer for the calling thread.  The shared owner table only needs to be
+//  as large as the number of threads the host programs run.
+//
+
+#define HOST_RESOURCE_OWNERS            (32)
+
+typedef struct _ERESOURCE {
+    pthread_mutex_t Lock;
+    pthread_cond_t Released;
+    ERESOURCE_THREAD ExclusiveOwner;
+    LONG ExclusiveCount;
+    LONG SharedCount;
+    LONG ExclusiveWaiters;
+    struct {
+        ERESOURCE_THREAD Thread;
+        LONG Count;
+    } SharedOwners[HOST_RESOURCE_OWNERS];
+} ERESOURCE, *PERESOURCE;
+
+typedef struct _FAST_MUTEX {
+    pthread_mutex_t Mutex;
+} FAST_MUTEX, *PFAST_MUTEX;
+
+typedef struct _KEVENT {
+    pthread_mutex_t Lock;
+    pthread_cond_t Signalled;
+    LONG State;
+    EVENT_TYPE Type;
+} KEVENT, *PKEVENT;
+
+typedef struct _FSRTL_COMMON_FCB_HEADER {
+    CSHORT NodeTypeCode;
+    CSHORT NodeByteSize;
+    UCHAR Flags;
+    UCHAR IsFastIoPossible;
+    UCHAR Flags2;
+    UCHAR Reserved;
+    PERESOURCE Resource;
+    PERESOURCE PagingIoResource;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} FSRTL_COMMON_FCB_HEADER;
+
+typedef struct _FSRTL_ADVANCED_FCB_HEADER {
+    FSRTL_COMMON_FCB_HEADER;
+    PFAST_MUTEX FastMutex;
+    LIST_ENTRY FilterContexts;
+    PVOID PushLock;
+    PVOID *FileContextSupportPointer;
+    OPLOCK Oplock;
+} FSRTL_ADVANCED_FCB_HEADER;
+
+typedef struct _SECTION_OBJECT_POINTERS {
+    PVOID DataSectionObject;
+    PVOID SharedCacheMap;
+    PVOID ImageSectionObject;
+} SECTION_OBJECT_POINTERS, *PSECTION_OBJECT_POINTERS;
+
+typedef struct _FILE_OBJECT {
+    CSHORT Type;
+    CSHORT Size;
+    PDEVICE_OBJECT DeviceObject;
+    PVPB Vpb;
+    PVOID FsContext;
+    PVOID FsContext2;
+    PSECTION_OBJECT_POINTERS SectionObjectPointer;
+    BOOLEAN ReadAccess;
+    BOOLEAN WriteAccess;
+    BOOLEAN DeleteAccess;
+    PVOID PrivateCacheMap;
+    ULONG Flags;
+    UNICODE_STRING FileName;
+    struct _FILE_OBJECT *RelatedFileObject;
+    LONG HostReferenceCount;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _IRP {
+    CSHORT Type;
+    USHORT Size;
+    PMDL MdlAddress;
+    ULONG Flags;
+    union {
+        struct _IRP *MasterIrp;
+        LONG IrpCount;
+        PVOID SystemBuffer;
+    } AssociatedIrp;
+    IO_STATUS_BLOCK IoStatus;
+    PIO_STATUS_BLOCK UserIosb;
+    KPROCESSOR_MODE RequestorMode;
+    BOOLEAN PendingReturned;
+    CHAR StackCount;
+    CHAR CurrentLocation;
+    PVOID UserBuffer;
+    struct {
+        struct {
+            PKTHREAD Thread;
+            PFILE_OBJECT OriginalFileObject;
+            struct _IO_STACK_LOCATION *CurrentStackLocation;
+        } Overlay;
+    } Tail;
+} IRP, *PIRP;
+
+typedef struct _IO_STACK_LOCATION {
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    UCHAR Flags;
+    UCHAR Control;
+    union {
+        struct {
+            ULONG Length;
+            ULONG Key;
+            LARGE_INTEGER ByteOffset;
+        } Read;
+        struct {
+            ULONG OutputBufferLength;
+            ULONG InputBufferLength;
+            ULONG FsControlCode;
+            PVOID Type3InputBuffer;
+        } FileSystemControl;
+        struct {
+            ULONG OutputBufferLength;
+            ULONG InputBufferLength;
+            ULONG IoControlCode;
+            PVOID Type3InputBuffer;
+        } DeviceIoControl;
+    } Parameters;
+    PDEVICE_OBJECT DeviceObject;
+    PFILE_OBJECT FileObject;
+    NTSTATUS (*CompletionRoutine)( PDEVICE_OBJECT DeviceObject, struct _IRP *Irp, PVOID Context );
+    PVOID Context;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _TIME_FIELDS {
+    CSHORT Year;
+    CSHORT Month;
+    CSHORT Day;
+    CSHORT Hour;
+    CSHORT Minute;
+    CSHORT Second;
+    CSHORT Milliseconds;
+    CSHORT Weekday;
+} TIME_FIELDS, *PTIME_FIELDS;
+
+typedef struct _GENERATE_NAME_CONTEXT {
+    USHORT Checksum;
+    BOOLEAN ChecksumInserted;
+    UCHAR NameLength;
+    WCHAR NameBuffer[8];
+    ULONG ExtensionLength;
+    WCHAR ExtensionBuffer[4];
+    ULONG LastIndexValue;
+} GENERATE_NAME_CONTEXT, *PGENERATE_NAME_CONTEXT;
+
+typedef struct _EXCEPTION_RECORD {
+    NTSTATUS ExceptionCode;
+    ULONG ExceptionFlags;
+    struct _EXCEPTION_RECORD *ExceptionRecord;
+    PVOID ExceptionAddress;
+    ULONG NumberParameters;
+    ULONG_PTR ExceptionInformation[15];
+} EXCEPTION_RECORD, *PEXCEPTION_RECORD;
+
+typedef struct _EXCEPTION_POINTERS {
+    PEXCEPTION_RECORD ExceptionRecord;
+    PCONTEXT ContextRecord;
+} EXCEPTION_POINTERS, *PEXCEPTION_POINTERS;
+
+typedef enum _FS_FILTER_SECTION_SYNC_TYPE { SyncTypeOther, SyncTypeCreateSection } FS_FILTER_SECTION_SYNC_TYPE;
+
+typedef struct _FS_FILTER_CALLBACK_DATA {
+    ULONG SizeOfFsFilterCallbackData;
+    UCHAR Operation;
+    UCHAR Reserved;
+    PDEVICE_OBJECT DeviceObject;
+    PFILE_OBJECT FileObject;
+    union {
+        struct {
+            FS_FILTER_SECTION_SYNC_TYPE SyncType;
+            ULONG PageProtection;
+        } AcquireForSectionSynchronization;
+    } Parameters;
+} FS_FILTER_CALLBACK_DATA, *PFS_FILTER_CALLBACK_DATA;
+
+typedef struct _CC_FILE_SIZES {
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} CC_FILE_SIZES, *PCC_FILE_SIZES;
+
+//
+//  Dispatch and fast I/O routine types are only used to declare routines
+//  the host programs never call, so their parameters are left unspecified.
+//
+
+typedef NTSTATUS DRIVER_DISPATCH();
+typedef NTSTATUS IO_COMPLETION_ROUTINE( PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOID Context );
+typedef IO_COMPLETION_ROUTINE *PIO_COMPLETION_ROUTINE;
+typedef VOID IO_WORKITEM_ROUTINE( PDEVICE_OBJECT DeviceObject, PVOID Context );
+typedef BOOLEAN FAST_IO_CHECK_IF_POSSIBLE( PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length, BOOLEAN Wait, ULONG LockKey, BOOLEAN CheckForReadOperation, PIO_STATUS_BLOCK IoStatus, PDEVICE_OBJECT DeviceObject );
+typedef BOOLEAN FAST_IO_QUERY_BASIC_INFO();
+typedef BOOLEAN FAST_IO_QUERY_STANDARD_INFO();
+typedef BOOLEAN FAST_IO_QUERY_NETWORK_OPEN_INFO();
+typedef BOOLEAN FAST_IO_LOCK();
+typedef BOOLEAN FAST_IO_UNLOCK_SINGLE();
+typedef BOOLEAN FAST_IO_UNLOCK_ALL();
+typedef BOOLEAN FAST_IO_UNLOCK_ALL_BY_KEY();
+
+//
+//  A work item runs its routine on a thread of its own.
+//
+
+typedef struct _IO_WORKITEM {
+    PDEVICE_OBJECT DeviceObject;
+    IO_WORKITEM_ROUTINE *Routine;
+    PVOID Context;
+} IO_WORKITEM, *PIO_WORKITEM;
+
+typedef VOID WORKER_THREAD_ROUTINE( PVOID Parameter );
+
+#define TRUE                            1
+#define FALSE                           0
+#define MAXUSHORT                       0xffff
+#define MAXULONG                        0xffffffffu
+#define PAGE_SIZE                       0x1000
+#define VACB_MAPPING_GRANULARITY        0x40000
+
+#define FIELD_OFFSET(Type, Field)       ((LONG)offsetof( Type, Field ))
+#define CONTAINING_RECORD(A, Type, Field) ((Type *)((PCHAR)(A) - offsetof( Type, Field )))
+#define ARGUMENT_PRESENT(A)             ((A) != NULL)
+#define UNREFERENCED_PARAMETER(P)       ((void)(P))
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+#define NT_ERROR(Status)                ((ULONG)(Status) >> 30 == 3)
+
+//
+//  Sources whose assertions name locals declared only #if DBG are built
+//  with HOST_FREE_BUILD, which compiles NT_ASSERT out as a free build does.
+//
+
+#ifdef HOST_FREE_BUILD
+#define NT_ASSERT(E)                    ((void)0)
+#else
+#define NT_ASSERT(E)                    HostAssert( (E) ? 1 : 0, #E, __FILE__, __LINE__ )
+#endif
+#define PAGED_CODE()
+#define DbgPrint(...)                   fprintf( stderr, __VA_ARGS__ )
+#define ExGetCurrentResourceThread()    ((ERESOURCE_THREAD)PsGetCurrentThread())
+#define INLINE                          static inline
+
+#define ALIGN_DOWN_BY(Length, Alignment) ((ULONG_PTR)(Length) & ~((ULONG_PTR)(Alignment) - 1))
+#define ALIGN_UP_BY(Length, Alignment)  ALIGN_DOWN_BY( (ULONG_PTR)(Length) + (Alignment) - 1, (Alignment) )
+#define Int32x32To64(A, B)              ((LONGLONG)(LONG)(A) * (LONGLONG)(LONG)(B))
+#define Int64ShllMod32(A, B)            ((ULONGLONG)(A) << (B))
+#define Int64ShraMod32(A, B)            ((LONGLONG)(A) >> (B))
+#define ADDRESS_AND_SIZE_TO_SPAN_PAGES(Va, Size) \
+    ((ULONG)((((ULONG_PTR)(Va) & (PAGE_SIZE - 1)) + (Size) + (PAGE_SIZE - 1)) / PAGE_SIZE))
+#define UInt32x32To64(A, B)             ((ULONGLONG)(ULONG)(A) * (ULONGLONG)(ULONG)(B))
+
+#define FlagOn(F, SF)                   ((F) & (SF))
+#define BooleanFlagOn(F, SF)            ((BOOLEAN)(((F) & (SF)) != 0))
+#define SetFlag(F, SF)                  ((F) |= (SF))
+#define ClearFlag(F, SF)                ((F) &= ~(SF))
+
+#define RtlInitializeSplayLinks(L)      ((L)->Parent = (L), (L)->LeftChild = (L)->RightChild = NULL)
+#define RtlParent(L)                    ((L)->Parent)
+#define RtlLeftChild(L)                 ((L)->LeftChild)
+#define RtlRightChild(L)                ((L)->RightChild)
+#define RtlIsRoot(L)                    ((L)->Parent == (L))
+#define RtlInsertAsLeftChild(P, C)      ((P)->LeftChild = (C), (C)->Parent = (P))
+#define RtlInsertAsRightChild(P, C)     ((P)->RightChild = (C), (C)->Parent = (P))
+
+#define RtlZeroMemory(D, L)             memset( (D), 0, (L) )
+#define RtlFillMemory(D, L, F)          memset( (D), (F), (L) )
+#define RtlCopyMemory(D, S, L)          memcpy( (D), (S), (L) )
+#define RtlMoveMemory(D, S, L)          memmove( (D), (S), (L) )
+#define RtlEqualMemory(D, S, L)         (memcmp( (D), (S), (L) ) == 0)
+
+#define try                             { __label__ HostLeave;
+#define finally                         HostLeave: ; }
+#define except(Filter)                  HostLeave: ; } if (0)
+#define leave                           goto HostLeave
+#define AbnormalTermination()           FALSE
+#define GetExceptionCode()              STATUS_SUCCESS
+#define GetExceptionInformation()       NULL
+#define EXCEPTION_EXECUTE_HANDLER       1
+#define EXCEPTION_CONTINUE_SEARCH       0
+
+#define CDFS_FILE_SYSTEM                0x00000026
+
+#define IRP_MJ_CREATE                   0x00
+#define IRP_MJ_CLOSE                    0x02
+#define IRP_MJ_READ                     0x03
+#define IRP_MJ_WRITE                    0x04
+#define IRP_MJ_QUERY_INFORMATION        0x05
+#define IRP_MJ_SET_INFORMATION          0x06
+#define IRP_MJ_QUERY_VOLUME_INFORMATION 0x0a
+#define IRP_MJ_DIRECTORY_CONTROL        0x0c
+#define IRP_MJ_LOCK_CONTROL             0x11
+#define IRP_MJ_PNP                      0x1b
+#define IRP_MJ_FLUSH_BUFFERS            0x09
+#define IRP_MJ_FILE_SYSTEM_CONTROL      0x0d
+#define IRP_MJ_DEVICE_CONTROL           0x0e
+#define IRP_MJ_SHUTDOWN                 0x10
+#define IRP_MJ_CLEANUP                  0x12
+#define IRP_NOCACHE                     0x00000001
+#define IRP_PAGING_IO                   0x00000002
+#define IRP_ASSOCIATED_IRP              0x00000008
+#define IRP_INPUT_OPERATION             0x00000040
+#define IRP_READ_OPERATION              0x00000800
+#define IO_NO_INCREMENT                 0
+#define IO_CD_ROM_INCREMENT             1
+#define SL_OVERRIDE_VERIFY_VOLUME       0x02
+#define SL_PENDING_RETURNED             0x01
+#define FSCTL_INVALIDATE_VOLUMES        0x00090054
+#define FILE_REMOVABLE_MEDIA            0x00000001
+#define DO_VERIFY_VOLUME                0x00000002
+#define IO_TYPE_DEVICE                  0x00000003
+#define IO_TYPE_FILE                    0x00000005
+#define IO_TYPE_IRP                     0x00000006
+#define IO_TYPE_VPB                     0x00000010
+#define IO_REMOUNT                      0x00000001
+#define VPB_MOUNTED                     0x00000001
+#define VPB_LOCKED                      0x00000002
+#define VPB_REMOVE_PENDING              0x00000040
+#define IRP_MN_MOUNT_VOLUME             0x01
+#define IRP_MN_VERIFY_VOLUME            0x02
+#define IRP_MN_USER_FS_REQUEST          0x00
+#define IRP_MN_COMPLETE                 0x04
+#define FSRTL_CACHE_TOP_LEVEL_IRP       ((ULONG_PTR)0x02)
+#define FS_FILTER_ACQUIRE_FOR_SECTION_SYNCHRONIZATION ((UCHAR)-1)
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_REPARSE                  ((NTSTATUS)0x00000104L)
+#define STATUS_FSFILTER_OP_COMPLETED_SUCCESSFULLY ((NTSTATUS)0x00000126L)
+#define STATUS_FILE_LOCKED_WITH_ONLY_READERS ((NTSTATUS)0x0000012AL)
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_VERIFY_REQUIRED          ((NTSTATUS)0x80000016L)
+#define STATUS_CANT_WAIT                ((NTSTATUS)0xC00000D8L)
+#define STATUS_MORE_PROCESSING_REQUIRED ((NTSTATUS)0xC0000016L)
+#define STATUS_INVALID_USER_BUFFER      ((NTSTATUS)0xC00000E8L)
+#define STATUS_FILE_INVALID             ((NTSTATUS)0xC0000098L)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+#define STATUS_END_OF_FILE              ((NTSTATUS)0xC0000011L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_FILE_CORRUPT_ERROR       ((NTSTATUS)0xC0000102L)
+#define STATUS_UNEXPECTED_IO_ERROR      ((NTSTATUS)0xC00000E9L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST   ((NTSTATUS)0xC0000010L)
+#define STATUS_DISK_CORRUPT_ERROR       ((NTSTATUS)0xC0000032L)
+#define STATUS_IN_PAGE_ERROR            ((NTSTATUS)0xC0000006L)
+#define STATUS_WRONG_VOLUME             ((NTSTATUS)0xC0000012L)
+#define STATUS_NO_MEDIA_IN_DEVICE       ((NTSTATUS)0xC0000013L)
+#define STATUS_DEVICE_NOT_READY         ((NTSTATUS)0xC00000A3L)
+#define STATUS_FILE_CLOSED              ((NTSTATUS)0xC0000128L)
+#define STATUS_VOLUME_DISMOUNTED        ((NTSTATUS)0xC000026EL)
+#define STATUS_DEVICE_DATA_ERROR        ((NTSTATUS)0xC000009CL)
+#define STATUS_DRIVER_INTERNAL_ERROR    ((NTSTATUS)0xC0000183L)
+#define STATUS_UNABLE_TO_DELETE_SECTION ((NTSTATUS)0xC000001BL)
+
+#define FO_CLEANUP_COMPLETE             0x00004000
+
+#define FILE_ATTRIBUTE_READONLY         0x00000001
+#define FILE_ATTRIBUTE_HIDDEN           0x00000002
+#define FILE_ATTRIBUTE_DIRECTORY        0x00000010
+
+static inline LONG
+InterlockedExchangeAdd (
+    LONG volatile *Addend,
+    LONG Value
+    )
+{
+    return __atomic_fetch_add( Addend, Value, __ATOMIC_SEQ_CST );
+}
+
+static inline PVOID
+InterlockedCompareExchangePointer (
+    PVOID volatile *Destination,
+    PVOID Exchange,
+    PVOID Comparand
+    )
+{
+    __atomic_compare_exchange_n( Destination, &Comparand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+    return Comparand;
+}
+
+static inline VOID
+InitializeListHead (
+    PLIST_ENTRY ListHead
+    )
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+static inline BOOLEAN
+IsListEmpty (
+    const LIST_ENTRY *ListHead
+    )
+{
+    return (BOOLEAN)(ListHead->Flink == ListHead);
+}
+
+static inline BOOLEAN
+RemoveEntryList (
+    PLIST_ENTRY Entry
+    )
+{
+    PLIST_ENTRY Flink = Entry->Flink;
+    PLIST_ENTRY Blink = Entry->Blink;
+
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+    return (BOOLEAN)(Flink == Blink);
+}
+
+static inline PLIST_ENTRY
+RemoveHeadList (
+    PLIST_ENTRY ListHead
+    )
+{
+    PLIST_ENTRY Entry = ListHead->Flink;
+
+    RemoveEntryList( Entry );
+    return Entry;
+}
+
+static inline VOID
+InsertTailList (
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink = ListHead;
+    Entry->Blink = ListHead->Blink;
+    ListHead->Blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+static inline VOID
+InsertHeadList (
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink = ListHead->Flink;
+    Entry->Blink = ListHead;
+    ListHead->Flink->Blink = Entry;
+    ListHead->Flink = Entry;
+}
+
+static inline VOID
+PushEntryList (
+    PSINGLE_LIST_ENTRY ListHead,
+    PSINGLE_LIST_ENTRY Entry
+    )
+{
+    Entry->Next = ListHead->Next;
+    ListHead->Next = Entry;
+}
+
+static inline PSINGLE_LIST_ENTRY
+PopEntryList (
+    PSINGLE_LIST_ENTRY ListHead
+    )
+{
+    PSINGLE_LIST_ENTRY Entry = ListHead->Next;
+
+    if (Entry != NULL) {
+
+        ListHead->Next = Entry->Next;
+    }
+
+    return Entry;
+}
+
+static inline LONG
+InterlockedIncrement (
+    LONG volatile *Addend
+    )
+{
+    return __atomic_add_fetch( Addend, 1, __ATOMIC_SEQ_CST );
+}
+
+static inline LONG
+InterlockedDecrement (
+    LONG volatile *Addend
+    )
+{
+    return __atomic_sub_fetch( Addend, 1, __ATOMIC_SEQ_CST );
+}
+
+static inline LONG
+InterlockedExchange (
+    LONG volatile *Target,
+    LONG Value
+    )
+{
+    return __atomic_exchange_n( Target, Value, __ATOMIC_SEQ_CST );
+}
+
+//
+//  An Irp's stack locations follow it, and the current location moves
+//  down the array as the Irp is passed on, as in the I/O manager.
+//
+
+static inline PIO_STACK_LOCATION
+IoGetCurrentIrpStackLocation (
+    PIRP Irp
+    )
+{
+    return Irp->Tail.Overlay.CurrentStackLocation;
+}
+
+static inline PIO_STACK_LOCATION
+IoGetNextIrpStackLocation (
+    PIRP Irp
+    )
+{
+    return Irp->Tail.Overlay.CurrentStackLocation - 1;
+}
+
+static inline VOID
+IoSetNextIrpStackLocation (
+    PIRP Irp
+    )
+{
+    Irp->CurrentLocation -= 1;
+    Irp->Tail.Overlay.CurrentStackLocation -= 1;
+}
+
+static inline VOID
+IoCopyCurrentIrpStackLocationToNext (
+    PIRP Irp
+    )
+{
+    PIO_STACK_LOCATION Next = IoGetNextIrpStackLocation( Irp );
+
+    *Next = *IoGetCurrentIrpStackLocation( Irp );
+    Next->CompletionRoutine = NULL;
+    Next->Context = NULL;
+}
+
+static inline VOID
+IoSetCompletionRoutine (
+    PIRP Irp,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID Context,
+    BOOLEAN InvokeOnSuccess,
+    BOOLEAN InvokeOnError,
+    BOOLEAN InvokeOnCancel
+    )
+{
+    PIO_STACK_LOCATION Next = IoGetNextIrpStackLocation( Irp );
+
+    UNREFERENCED_PARAMETER( InvokeOnSuccess );
+    UNREFERENCED_PARAMETER( InvokeOnError );
+    UNREFERENCED_PARAMETER( InvokeOnCancel );
+
+    Next->CompletionRoutine = CompletionRoutine;
+    Next->Context = Context;
+}
+
+static inline VOID
+IoMarkIrpPending (
+    PIRP Irp
+    )
+{
+    IoGetCurrentIrpStackLocation( Irp )->Control |= SL_PENDING_RETURNED;
+}
+
+VOID HostAssert( int Condition, const char *Text, const char *File, int Line );
+
+PVOID ExAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+PVOID FsRtlAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+VOID ExFreePool( PVOID P );
+BOOLEAN ExAcquireResourceExclusiveLite( PERESOURCE Resource, BOOLEAN Wait );
+VOID ExReleaseResourceLite( PERESOURCE Resource );
+BOOLEAN ExIsResourceAcquiredExclusiveLite( PERESOURCE Resource );
+ULONG ExIsResourceAcquiredSharedLite( PERESOURCE Resource );
+BOOLEAN ExAcquireResourceSharedLite( PERESOURCE Resource, BOOLEAN Wait );
+DECLSPEC_NORETURN VOID ExRaiseStatus( NTSTATUS Status );
+VOID ExInitializeFastMutex( PFAST_MUTEX FastMutex );
+VOID ExAcquireFastMutex( PFAST_MUTEX FastMutex );
+VOID ExReleaseFastMutex( PFAST_MUTEX FastMutex );
+NTSTATUS ExInitializeResourceLite( PERESOURCE Resource );
+NTSTATUS ExDeleteResourceLite( PERESOURCE Resource );
+VOID ExConvertExclusiveToSharedLite( PERESOURCE Resource );
+VOID ExReleaseResourceForThreadLite( PERESOURCE Resource, ERESOURCE_THREAD ResourceThreadId );
+PKTHREAD PsGetCurrentThread( VOID );
+BOOLEAN ExAcquireSharedStarveExclusive( PERESOURCE Resource, BOOLEAN Wait );
+PIRP IoGetTopLevelIrp( VOID );
+PDEVICE_OBJECT IoGetDeviceToVerify( PKTHREAD Thread );
+BOOLEAN IoIsOperationSynchronous( PIRP Irp );
+BOOLEAN IoIsErrorUserInduced( NTSTATUS Status );
+BOOLEAN KeAreAllApcsDisabled( VOID );
+VOID IoRaiseHardError( PIRP Irp, PVPB Vpb, PDEVICE_OBJECT RealDeviceObject );
+VOID IoCompleteRequest( PIRP Irp, CCHAR PriorityBoost );
+PEPROCESS PsGetCurrentProcess( VOID );
+BOOLEAN IoWithinStackLimits( ULONG_PTR RegionStart, SIZE_T RegionSize );
+VOID KeInitializeEvent( PKEVENT Event, EVENT_TYPE Type, BOOLEAN State );
+LONG KeSetEvent( PKEVENT Event, LONG Increment, BOOLEAN Wait );
+VOID KeClearEvent( PKEVENT Event );
+NTSTATUS KeWaitForSingleObject( PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout );
+VOID KeFlushIoBuffers( PMDL Mdl, BOOLEAN ReadOperation, BOOLEAN DmaOperation );
+VOID ObReferenceObject( PVOID Object );
+VOID ObDereferenceObject( PVOID Object );
+PIRP IoAllocateIrp( CCHAR StackSize, BOOLEAN ChargeQuota );
+VOID IoFreeIrp( PIRP Irp );
+VOID IoReuseIrp( PIRP Irp, NTSTATUS Status );
+PIRP IoMakeAssociatedIrp( PIRP Irp, CCHAR StackSize );
+NTSTATUS IoCallDriver( PDEVICE_OBJECT DeviceObject, PIRP Irp );
+PIRP IoBuildDeviceIoControlRequest( ULONG IoControlCode, PDEVICE_OBJECT DeviceObject, PVOID InputBuffer, ULONG InputBufferLength, PVOID OutputBuffer, ULONG OutputBufferLength, BOOLEAN InternalDeviceIoControl, PKEVENT Event, PIO_STATUS_BLOCK IoStatusBlock );
+PIRP IoBuildSynchronousFsdRequest( ULONG MajorFunction, PDEVICE_OBJECT DeviceObject, PVOID Buffer, ULONG Length, PLARGE_INTEGER StartingOffset, PKEVENT Event, PIO_STATUS_BLOCK IoStatusBlock );
+PMDL IoAllocateMdl( PVOID VirtualAddress, ULONG Length, BOOLEAN SecondaryBuffer, BOOLEAN ChargeQuota, PIRP Irp );
+VOID IoBuildPartialMdl( PMDL SourceMdl, PMDL TargetMdl, PVOID VirtualAddress, ULONG Length );
+VOID IoFreeMdl( PMDL Mdl );
+PIO_WORKITEM IoAllocateWorkItem( PDEVICE_OBJECT DeviceObject );
+VOID IoQueueWorkItem( PIO_WORKITEM IoWorkItem, IO_WORKITEM_ROUTINE *WorkerRoutine, WORK_QUEUE_TYPE QueueType, PVOID Context );
+VOID IoFreeWorkItem( PIO_WORKITEM IoWorkItem );
+VOID IoDeleteDevice( PDEVICE_OBJECT DeviceObject );
+VOID IoSetTopLevelIrp( PIRP Irp );
+VOID IoSetDeviceToVerify( PKTHREAD Thread, PDEVICE_OBJECT DeviceObject );
+VOID IoSetHardErrorOrVerifyDevice( PIRP Irp, PDEVICE_OBJECT DeviceObject );
+NTSTATUS IoVerifyVolume( PDEVICE_OBJECT DeviceObject, BOOLEAN AllowRawMount );
+VOID IoAcquireVpbSpinLock( PKIRQL Irql );
+VOID IoReleaseVpbSpinLock( KIRQL Irql );
+VOID MmBuildMdlForNonPagedPool( PMDL Mdl );
+VOID MmProbeAndLockPages( PMDL Mdl, KPROCESSOR_MODE AccessMode, LOCK_OPERATION Operation );
+VOID MmUnlockPages( PMDL Mdl );
+PVOID MmGetSystemAddressForMdlSafe( PMDL Mdl, ULONG Priority );
+VOID KeBugCheckEx( ULONG BugCheckCode, ULONG_PTR P1, ULONG_PTR P2, ULONG_PTR P3, ULONG_PTR P4 );
+VOID CcUnpinData( PVOID Bcb );
+PFILE_OBJECT IoCreateStreamFileObjectLite( PFILE_OBJECT FileObject, PDEVICE_OBJECT DeviceObject );
+VOID CcInitializeCacheMap( PFILE_OBJECT FileObject, PCC_FILE_SIZES FileSizes, BOOLEAN PinAccess, PCACHE_MANAGER_CALLBACKS Callbacks, PVOID LazyWriteContext );
+BOOLEAN CcUninitializeCacheMap( PFILE_OBJECT FileObject, PLARGE_INTEGER TruncateSize, PVOID UninitializeEvent );
+BOOLEAN CcPurgeCacheSection( PSECTION_OBJECT_POINTERS SectionObjectPointer, PLARGE_INTEGER FileOffset, ULONG Length, BOOLEAN UninitializeCacheMaps );
+VOID CcMdlReadComplete( PFILE_OBJECT FileObject, PMDL MdlChain );
+BOOLEAN MmFlushImageSection( PSECTION_OBJECT_POINTERS SectionObjectPointer, MMFLUSH_TYPE FlushType );
+BOOLEAN CcMapData( PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length, ULONG Flags, PVOID *Bcb, PVOID *Buffer );
+VOID CcSetFileSizes( PFILE_OBJECT FileObject, PCC_FILE_SIZES FileSizes );
+
+WCHAR RtlUpcaseUnicodeChar( WCHAR SourceCharacter );
+NTSTATUS RtlUpcaseUnicodeString( PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+SIZE_T RtlCompareMemory( const VOID *Source1, const VOID *Source2, SIZE_T Length );
+VOID RtlTimeFieldsToTime( PTIME_FIELDS TimeFields, PLARGE_INTEGER Time );
+NTSTATUS RtlOemToUnicodeN( PWCHAR UnicodeString, ULONG MaxBytesInUnicodeString, PULONG BytesInUnicodeString, PCHAR OemString, ULONG BytesInOemString );
+NTSTATUS RtlUnicodeStringToOemString( POEM_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlUnicodeStringToCountedOemString( POEM_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+VOID RtlFreeOemString( POEM_STRING OemString );
+VOID RtlGenerate8dot3Name( PCUNICODE_STRING Name, BOOLEAN AllowExtendedCharacters, PGENERATE_NAME_CONTEXT Context, PUNICODE_STRING Name8dot3 );
+PRTL_SPLAY_LINKS RtlSplay( PRTL_SPLAY_LINKS Links );
+PRTL_SPLAY_LINKS RtlDelete( PRTL_SPLAY_LINKS Links );
+VOID RtlInitializeGenericTable( PRTL_GENERIC_TABLE Table, PRTL_GENERIC_COMPARE_ROUTINE CompareRoutine, PRTL_GENERIC_ALLOCATE_ROUTINE AllocateRoutine, PRTL_GENERIC_FREE_ROUTINE FreeRoutine, PVOID TableContext );
+PVOID RtlInsertElementGenericTable( PRTL_GENERIC_TABLE Table, PVOID Buffer, CLONG BufferSize, PBOOLEAN NewElement );
+BOOLEAN RtlDeleteElementGenericTable( PRTL_GENERIC_TABLE Table, PVOID Buffer );
+PVOID RtlLookupElementGenericTable( PRTL_GENERIC_TABLE Table, PVOID Buffer );
+PVOID RtlEnumerateGenericTableWithoutSplaying( PRTL_GENERIC_TABLE Table, PVOID *RestartKey );
+
+VOID FsRtlEnterFileSystem( VOID );
+VOID FsRtlExitFileSystem( VOID );
+BOOLEAN FsRtlIsFatDbcsLegal( ANSI_STRING DbcsName, BOOLEAN WildCardsPermissible, BOOLEAN PathNamePermissible, BOOLEAN LeadingBackslashPermissible );
+BOOLEAN FsRtlIsLeadDbcsCharacter( UCHAR DbcsCharacter );
+PFILE_LOCK FsRtlAllocateFileLock( PVOID CompleteLockIrpRoutine, PVOID UnlockRoutine );
+VOID FsRtlFreeFileLock( PFILE_LOCK FileLock );
+BOOLEAN FsRtlFastCheckLockForRead( PFILE_LOCK FileLock, PLARGE_INTEGER StartingByte, PLARGE_INTEGER Length, ULONG Key, PFILE_OBJECT FileObject, PVOID Process );
+VOID FsRtlInitializeOplock( POPLOCK Oplock );
+VOID FsRtlUninitializeOplock( POPLOCK Oplock );
+VOID FsRtlNotifyInitializeSync( PNOTIFY_SYNC *NotifySync );
+VOID FsRtlNotifyUninitializeSync( PNOTIFY_SYNC *NotifySync );
+VOID FsRtlSetupAdvancedHeader( PVOID AdvHdr, PFAST_MUTEX FMutex );
+VOID FsRtlTeardownPerStreamContexts( FSRTL_ADVANCED_FCB_HEADER *AdvancedHeader );
+BOOLEAN FsRtlIsNameInExpression( PUNICODE_STRING Expression, PUNICODE_STRING Name, BOOLEAN IgnoreCase, PWCHAR UpcaseTable );
+NTSTATUS FsRtlNormalizeNtstatus( NTSTATUS Exception, NTSTATUS GenericException );
+BOOLEAN FsRtlIsAnsiCharacterLegalHpfs( UCHAR Character, BOOLEAN WildOk );
+BOOLEAN FsRtlIsNtstatusExpected( NTSTATUS Exception );
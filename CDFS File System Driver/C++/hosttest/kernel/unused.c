@@ -0,0 +1,555 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Unused.c
+
+Abstract:
+
+    The routines the Cdfs sources built here refer to but which the host
+    programs never reach: the dispatch routines of the sources left out,
+    posting to the Fsp, hard errors and verification, the Irps built for
+    device controls and the sector cache, Oem names, file locks and the
+    exception filters.  Each one ends the program if it is called.
+
+Environment:
+
+    Host (user mode), C11.
+
+--*/
+
+#include "CdProcs.h"
+
+static VOID
+NotReached (
+    const char *Routine
+    )
+{
+    fprintf( stderr, "%s: not supported on the host\n", Routine );
+    abort();
+}
+
+#define NOT_REACHED() NotReached( __func__ )
+
+NTSTATUS
+CdCommonCleanup (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonClose (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonCreate (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonDevControl (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonDirControl (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonFsControl (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonLockControl (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonPnp (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonQueryInfo (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonQueryVolInfo (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonRead (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonSetInfo (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonShutdown (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdCommonWrite (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CdFsdPostRequest (
+    PIRP_CONTEXT IrpContext,
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+TYPE_OF_OPEN
+CdFastDecodeFileObject (
+    PFILE_OBJECT FileObject,
+    PFCB *Fcb
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( Fcb );
+    NOT_REACHED();
+    return UnopenedFileObject;
+}
+
+BOOLEAN
+IoIsOperationSynchronous (
+    PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+    NOT_REACHED();
+    return FALSE;
+}
+
+PDEVICE_OBJECT
+IoGetDeviceToVerify (
+    PKTHREAD Thread
+    )
+{
+    UNREFERENCED_PARAMETER( Thread );
+    NOT_REACHED();
+    return NULL;
+}
+
+BOOLEAN
+IoIsErrorUserInduced (
+    NTSTATUS Status
+    )
+{
+    UNREFERENCED_PARAMETER( Status );
+    NOT_REACHED();
+    return FALSE;
+}
+
+BOOLEAN
+KeAreAllApcsDisabled (
+    VOID
+    )
+{
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+IoRaiseHardError (
+    PIRP Irp,
+    PVPB Vpb,
+    PDEVICE_OBJECT RealDeviceObject
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+    UNREFERENCED_PARAMETER( Vpb );
+    UNREFERENCED_PARAMETER( RealDeviceObject );
+    NOT_REACHED();
+}
+
+VOID
+IoSetHardErrorOrVerifyDevice (
+    PIRP Irp,
+    PDEVICE_OBJECT DeviceObject
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+    UNREFERENCED_PARAMETER( DeviceObject );
+    NOT_REACHED();
+}
+
+NTSTATUS
+IoVerifyVolume (
+    PDEVICE_OBJECT DeviceObject,
+    BOOLEAN AllowRawMount
+    )
+{
+    UNREFERENCED_PARAMETER( DeviceObject );
+    UNREFERENCED_PARAMETER( AllowRawMount );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+PEPROCESS
+PsGetCurrentProcess (
+    VOID
+    )
+{
+    NOT_REACHED();
+    return NULL;
+}
+
+VOID
+IoReuseIrp (
+    PIRP Irp,
+    NTSTATUS Status
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+    UNREFERENCED_PARAMETER( Status );
+    NOT_REACHED();
+}
+
+PIRP
+IoBuildDeviceIoControlRequest (
+    ULONG IoControlCode,
+    PDEVICE_OBJECT DeviceObject,
+    PVOID InputBuffer,
+    ULONG InputBufferLength,
+    PVOID OutputBuffer,
+    ULONG OutputBufferLength,
+    BOOLEAN InternalDeviceIoControl,
+    PKEVENT Event,
+    PIO_STATUS_BLOCK IoStatusBlock
+    )
+{
+    UNREFERENCED_PARAMETER( IoControlCode );
+    UNREFERENCED_PARAMETER( DeviceObject );
+    UNREFERENCED_PARAMETER( InputBuffer );
+    UNREFERENCED_PARAMETER( InputBufferLength );
+    UNREFERENCED_PARAMETER( OutputBuffer );
+    UNREFERENCED_PARAMETER( OutputBufferLength );
+    UNREFERENCED_PARAMETER( InternalDeviceIoControl );
+    UNREFERENCED_PARAMETER( Event );
+    UNREFERENCED_PARAMETER( IoStatusBlock );
+    NOT_REACHED();
+    return NULL;
+}
+
+PIRP
+IoBuildSynchronousFsdRequest (
+    ULONG MajorFunction,
+    PDEVICE_OBJECT DeviceObject,
+    PVOID Buffer,
+    ULONG Length,
+    PLARGE_INTEGER StartingOffset,
+    PKEVENT Event,
+    PIO_STATUS_BLOCK IoStatusBlock
+    )
+{
+    UNREFERENCED_PARAMETER( MajorFunction );
+    UNREFERENCED_PARAMETER( DeviceObject );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( Length );
+    UNREFERENCED_PARAMETER( StartingOffset );
+    UNREFERENCED_PARAMETER( Event );
+    UNREFERENCED_PARAMETER( IoStatusBlock );
+    NOT_REACHED();
+    return NULL;
+}
+
+VOID
+CcMdlReadComplete (
+    PFILE_OBJECT FileObject,
+    PMDL MdlChain
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( MdlChain );
+    NOT_REACHED();
+}
+
+NTSTATUS
+RtlOemToUnicodeN (
+    PWCHAR UnicodeString,
+    ULONG MaxBytesInUnicodeString,
+    PULONG BytesInUnicodeString,
+    PCHAR OemString,
+    ULONG BytesInOemString
+    )
+{
+    UNREFERENCED_PARAMETER( UnicodeString );
+    UNREFERENCED_PARAMETER( MaxBytesInUnicodeString );
+    UNREFERENCED_PARAMETER( BytesInUnicodeString );
+    UNREFERENCED_PARAMETER( OemString );
+    UNREFERENCED_PARAMETER( BytesInOemString );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlUnicodeStringToOemString (
+    POEM_STRING DestinationString,
+    PCUNICODE_STRING SourceString,
+    BOOLEAN AllocateDestinationString
+    )
+{
+    UNREFERENCED_PARAMETER( DestinationString );
+    UNREFERENCED_PARAMETER( SourceString );
+    UNREFERENCED_PARAMETER( AllocateDestinationString );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlUnicodeStringToCountedOemString (
+    POEM_STRING DestinationString,
+    PCUNICODE_STRING SourceString,
+    BOOLEAN AllocateDestinationString
+    )
+{
+    UNREFERENCED_PARAMETER( DestinationString );
+    UNREFERENCED_PARAMETER( SourceString );
+    UNREFERENCED_PARAMETER( AllocateDestinationString );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+VOID
+RtlFreeOemString (
+    POEM_STRING OemString
+    )
+{
+    UNREFERENCED_PARAMETER( OemString );
+    NOT_REACHED();
+}
+
+VOID
+RtlGenerate8dot3Name (
+    PCUNICODE_STRING Name,
+    BOOLEAN AllowExtendedCharacters,
+    PGENERATE_NAME_CONTEXT Context,
+    PUNICODE_STRING Name8dot3
+    )
+{
+    UNREFERENCED_PARAMETER( Name );
+    UNREFERENCED_PARAMETER( AllowExtendedCharacters );
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( Name8dot3 );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FsRtlIsFatDbcsLegal (
+    ANSI_STRING DbcsName,
+    BOOLEAN WildCardsPermissible,
+    BOOLEAN PathNamePermissible,
+    BOOLEAN LeadingBackslashPermissible
+    )
+{
+    UNREFERENCED_PARAMETER( DbcsName );
+    UNREFERENCED_PARAMETER( WildCardsPermissible );
+    UNREFERENCED_PARAMETER( PathNamePermissible );
+    UNREFERENCED_PARAMETER( LeadingBackslashPermissible );
+    NOT_REACHED();
+    return FALSE;
+}
+
+BOOLEAN
+FsRtlIsLeadDbcsCharacter (
+    UCHAR DbcsCharacter
+    )
+{
+    UNREFERENCED_PARAMETER( DbcsCharacter );
+    NOT_REACHED();
+    return FALSE;
+}
+
+BOOLEAN
+FsRtlIsNameInExpression (
+    PUNICODE_STRING Expression,
+    PUNICODE_STRING Name,
+    BOOLEAN IgnoreCase,
+    PWCHAR UpcaseTable
+    )
+{
+    UNREFERENCED_PARAMETER( Expression );
+    UNREFERENCED_PARAMETER( Name );
+    UNREFERENCED_PARAMETER( IgnoreCase );
+    UNREFERENCED_PARAMETER( UpcaseTable );
+    NOT_REACHED();
+    return FALSE;
+}
+
+PFILE_LOCK
+FsRtlAllocateFileLock (
+    PVOID CompleteLockIrpRoutine,
+    PVOID UnlockRoutine
+    )
+{
+    UNREFERENCED_PARAMETER( CompleteLockIrpRoutine );
+    UNREFERENCED_PARAMETER( UnlockRoutine );
+    NOT_REACHED();
+    return NULL;
+}
+
+VOID
+FsRtlFreeFileLock (
+    PFILE_LOCK FileLock
+    )
+{
+    UNREFERENCED_PARAMETER( FileLock );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FsRtlFastCheckLockForRead (
+    PFILE_LOCK FileLock,
+    PLARGE_INTEGER StartingByte,
+    PLARGE_INTEGER Length,
+    ULONG Key,
+    PFILE_OBJECT FileObject,
+    PVOID Process
+    )
+{
+    UNREFERENCED_PARAMETER( FileLock );
+    UNREFERENCED_PARAMETER( StartingByte );
+    UNREFERENCED_PARAMETER( Length );
+    UNREFERENCED_PARAMETER( Key );
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( Process );
+    NOT_REACHED();
+    return FALSE;
+}
+
+NTSTATUS
+FsRtlNormalizeNtstatus (
+    NTSTATUS Exception,
+    NTSTATUS GenericException
+    )
+{
+    UNREFERENCED_PARAMETER( Exception );
+    UNREFERENCED_PARAMETER( GenericException );
+    NOT_REACHED();
+    return Exception;
+}
+
+BOOLEAN
+FsRtlIsNtstatusExpected (
+    NTSTATUS Exception
+    )
+{
+    UNREFERENCED_PARAMETER( Exception );
+    NOT_REACHED();
+    return FALSE;
+}
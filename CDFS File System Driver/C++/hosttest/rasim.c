@@ -0,0 +1,928 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    RaSim.c
+
+Abstract:
+
+    Host simulation of the Cdfs read-ahead for sequential non-cached reads
+    against an optical drive with real command latency.  Sequential readers
+    read a file in fixed size requests, going through CdCopyFromReadAhead,
+    CdStartReadAhead and, on a miss, CdNonCachedRead, and the throughput is
+    reported for each request size and read-ahead depth.
+
+    The read-ahead routines and the non-cached read path are the ones in
+    DevIoSup.c, built unchanged against the stand-ins in kernel/, so the
+    chunks are read by CdReadAheadWorker from work items each running on
+    a thread of its own.  Each run mounts a volume, opens a data Fcb and a
+    user file object for every reader as CdCompleteFcbOpen would, issues
+    each request as CdCommonRead does for a non-cached user read, and takes
+    the last handle away as CdCommonCleanup and CdCommonClose do.
+
+    The drive serves one command at a time, taking a fixed overhead per
+    command, a seek when the command doesn't follow the last one, and the
+    transfer at a fixed rate.  Every byte of the disc holds a pattern
+    derived from its offset so that readers can check what they get.
+
+    usage: rasim --selftest
+           rasim [--size mb] [--rate mb/s] [--overhead us] [--seek us]
+                 [--think us] [--readers n] [--no-wait] [requests...]
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "host.h"
+
+#include <sched.h>
+#include <time.h>
+
+#define MAX_READERS                      (16)
+#define MAX_REQUEST_SIZES                (16)
+
+static int Failures;
+
+#define CHECK(X) {                                                      \
+    if (!(X)) {                                                         \
+        printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #X ); \
+        Failures += 1;                                                  \
+    }                                                                   \
+}
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static double
+Now (
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void
+Sleep (
+    double Seconds
+    )
+{
+    struct timespec ts;
+    double Until = Now() + Seconds;
+
+    if (Seconds <= 0) {
+        return;
+    }
+
+    ts.tv_sec = (time_t)Seconds;
+    ts.tv_nsec = (long)((Seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep( &ts, NULL );
+
+    while (Now() < Until) {
+        sched_yield();
+    }
+}
+
+//
+//  The drive.  One command at a time.  Errors counts every failed command
+//  and ReadAheadErrors the ones sent from a work item.
+//
+
+typedef struct _DEVICE {
+    pthread_mutex_t Lock;
+    double Overhead;
+    double Seek;
+    double Rate;
+    uint64_t LastEnd;
+    uint64_t FailOffset;
+    int FailOnce;
+    unsigned long long Commands;
+    unsigned long long Seeks;
+    unsigned long long Bytes;
+    unsigned long long Errors;
+    unsigned long long ReadAheadErrors;
+} DEVICE;
+
+static DEVICE Drive;
+
+//
+//  Set on the threads issuing user reads, so that the drive can tell them
+//  from the work items.
+//
+
+static _Thread_local int UserThread;
+
+static uint8_t
+PatternByte (
+    uint64_t Offset
+    )
+{
+    return (uint8_t)((Offset >> 11) * 37 + Offset);
+}
+
+NTSTATUS
+HostDeviceRead (
+    _In_ PDEVICE_OBJECT TargetDeviceObject,
+    _In_ LONGLONG StartingOffset,
+    _Out_writes_bytes_(ByteCount) PVOID Buffer,
+    _In_ ULONG ByteCount
+    )
+{
+    DEVICE *Device = &Drive;
+    uint64_t Offset = (uint64_t)StartingOffset;
+    uint8_t *Bytes = Buffer;
+    NTSTATUS Status = STATUS_SUCCESS;
+    double Delay = Device->Overhead + (double)ByteCount / Device->Rate;
+    uint32_t i;
+
+    UNREFERENCED_PARAMETER( TargetDeviceObject );
+
+    pthread_mutex_lock( &Device->Lock );
+
+    if (Offset != Device->LastEnd) {
+        Delay += Device->Seek;
+        Device->Seeks += 1;
+    }
+
+    Sleep( Delay );
+
+    if (Device->FailOnce &&
+        (Device->FailOffset >= Offset) &&
+        (Device->FailOffset < Offset + ByteCount)) {
+
+        Device->FailOnce = 0;
+        Device->Errors += 1;
+
+        if (!UserThread) {
+            Device->ReadAheadErrors += 1;
+        }
+
+        Status = STATUS_DEVICE_DATA_ERROR;
+
+    } else {
+
+        for (i = 0; i < ByteCount; i++) {
+            Bytes[i] = PatternByte( Offset + i );
+        }
+    }
+
+    Device->LastEnd = Offset + ByteCount;
+    Device->Commands += 1;
+    Device->Bytes += ByteCount;
+
+    pthread_mutex_unlock( &Device->Lock );
+    return Status;
+}
+
+static void
+InitializeDevice (
+    DEVICE *Device,
+    double RateMb,
+    double OverheadUs,
+    double SeekUs
+    )
+{
+    memset( Device, 0, sizeof(*Device) );
+    pthread_mutex_init( &Device->Lock, NULL );
+    Device->Rate = RateMb * 1024 * 1024;
+    Device->Overhead = OverheadUs / 1e6;
+    Device->Seek = SeekUs / 1e6;
+}
+
+//
+//  Pool still allocated, not counting the Irp contexts CdCleanupIrpContext
+//  keeps for reuse.
+//
+
+static LONGLONG
+PoolOutstanding (
+    void
+    )
+{
+    HOST_COUNTERS Counters;
+
+    HostGetCounters( &Counters );
+    return Counters.PoolBlocks - CdData.IrpContextDepth;
+}
+
+typedef struct _STATS {
+    unsigned long long Requests;
+    unsigned long long Hits;
+    unsigned long long Misses;
+    unsigned long long ChunksStarted;
+    unsigned long long ChunksFailed;
+    unsigned long long NoWaitBlocked;
+    unsigned long long Corrupt;
+} STATS;
+
+//
+//  A user handle on a file laid out in one extent at DiskOffset.
+//
+
+typedef struct _HANDLE {
+    PFILE_OBJECT FileObject;
+    PFCB Fcb;
+    uint64_t DiskOffset;
+    STATS Stats;
+} HANDLE;
+
+//
+//  Creates the data Fcb and opens a handle on it, as CdCompleteFcbOpen
+//  does for a user file opened without intermediate buffering.
+//
+
+static void
+OpenFile (
+    HANDLE *Handle,
+    PVCB Vcb,
+    ULONG FileNumber,
+    uint64_t DiskOffset,
+    LONGLONG FileSize
+    )
+{
+    IRP_CONTEXT IrpContext;
+    FILE_ID FileId;
+    PFCB Fcb;
+    PCCB Ccb;
+    PCD_MCB_ENTRY McbEntry;
+    PFILE_OBJECT FileObject;
+
+    memset( Handle, 0, sizeof(*Handle) );
+    Handle->DiskOffset = DiskOffset;
+
+    HostInitializeIrpContext( &IrpContext, Vcb );
+
+    CdAcquireVcbExclusive( &IrpContext, Vcb, FALSE );
+
+    FileId.QuadPart = 0;
+    CdSetFidDirentOffset( FileId, FileNumber );
+
+    CdLockVcb( &IrpContext, Vcb );
+    Fcb = CdCreateFcb( &IrpContext, FileId, CDFS_NTC_FCB_DATA, NULL );
+    CdUnlockVcb( &IrpContext, Vcb );
+
+    CdLockFcb( &IrpContext, Fcb );
+
+    Fcb->Resource = &Vcb->FileResource;
+
+    Fcb->FileSize.QuadPart =
+    Fcb->ValidDataLength.QuadPart = FileSize;
+    Fcb->AllocationSize.QuadPart = LlBlockAlign( Vcb, FileSize );
+
+    SetFlag( Fcb->FileAttributes, FILE_ATTRIBUTE_READONLY );
+
+    //
+    //  Add the single extent by hand, as CdUpdateVcbFromVolDescriptor does
+    //  for the volume Fcb.
+    //
+
+    McbEntry = Fcb->Mcb.McbArray;
+
+    McbEntry->FileOffset = 0;
+    McbEntry->DiskOffset = (LONGLONG) DiskOffset;
+    McbEntry->ByteCount = Fcb->AllocationSize.QuadPart;
+
+    McbEntry->DataBlockByteCount =
+    McbEntry->TotalBlockByteCount = McbEntry->ByteCount;
+
+    Fcb->Mcb.CurrentEntryCount = 1;
+
+    //
+    //  Nothing looks the Fcb up by its file id, so it stays out of the Fcb
+    //  table.
+    //
+
+    SetFlag( Fcb->FcbState, FCB_STATE_INITIALIZED );
+
+    CdUnlockFcb( &IrpContext, Fcb );
+
+    FileObject = IoCreateStreamFileObjectLite( NULL, Vcb->Vpb->RealDevice );
+
+    Ccb = CdCreateCcb( &IrpContext, Fcb, 0 );
+    CdSetFileObject( &IrpContext, FileObject, UserFileOpen, Fcb, Ccb );
+
+    FileObject->SectionObjectPointer = &Fcb->FcbNonpaged->SegmentObject;
+
+    CdLockVcb( &IrpContext, Vcb );
+    CdIncrementCleanupCounts( &IrpContext, Fcb );
+    CdIncrementReferenceCounts( &IrpContext, Fcb, 1, 1 );
+    CdUnlockVcb( &IrpContext, Vcb );
+
+    CdReleaseVcb( &IrpContext, Vcb );
+
+    Handle->FileObject = FileObject;
+    Handle->Fcb = Fcb;
+}
+
+//
+//  Takes the handle away as CdCommonCleanup does, and drops our reference
+//  on the file object.  The close happens once the work items still
+//  reading ahead have dropped theirs.
+//
+
+static void
+CloseFile (
+    HANDLE *Handle
+    )
+{
+    IRP_CONTEXT IrpContext;
+    PFCB Fcb = Handle->Fcb;
+    PVCB Vcb = Fcb->Vcb;
+    PCD_READ_AHEAD ReadAhead = NULL;
+
+    HostInitializeIrpContext( &IrpContext, Vcb );
+
+    CdAcquireFileExclusive( &IrpContext, Fcb );
+
+    SetFlag( Handle->FileObject->Flags, FO_CLEANUP_COMPLETE );
+
+    if (Fcb->FcbCleanup == 1) {
+
+        ReadAhead = Fcb->ReadAhead;
+        Fcb->ReadAhead = NULL;
+    }
+
+    CdReleaseFile( &IrpContext, Fcb );
+
+    if (ReadAhead != NULL) {
+
+        CdDeleteReadAhead( &IrpContext, ReadAhead );
+    }
+
+    CdAcquireFcbExclusive( &IrpContext, Fcb, FALSE );
+
+    CdLockVcb( &IrpContext, Vcb );
+    CdDecrementCleanupCounts( &IrpContext, Fcb );
+    CdUnlockVcb( &IrpContext, Vcb );
+
+    CdReleaseFcb( &IrpContext, Fcb );
+
+    ObDereferenceObject( Handle->FileObject );
+
+    Handle->FileObject = NULL;
+    Handle->Fcb = NULL;
+}
+
+//
+//  One non-cached user read, as CdCommonRead does it for a user file.  The
+//  drive completes every command at once, so a miss is read synchronously
+//  even when the request can't wait, and a failed read is retried as the
+//  user would.
+//
+
+static void
+UserRead (
+    HANDLE *Handle,
+    LONGLONG StartingOffset,
+    ULONG ByteCount,
+    BOOLEAN Wait,
+    uint8_t *UserBuffer
+    )
+{
+    PFCB Fcb = Handle->Fcb;
+    PVCB Vcb = Fcb->Vcb;
+    PIRP Irp;
+    PIO_STACK_LOCATION IrpSp;
+    PIRP_CONTEXT IrpContext;
+    THREAD_CONTEXT ThreadContext = {0};
+    CD_IO_CONTEXT IoContext;
+    NTSTATUS Status;
+    BOOLEAN Hit;
+    ULONG BlockedWaits;
+    ULONG i;
+
+    ByteCount = (ULONG) Min( (LONGLONG) ByteCount, Fcb->FileSize.QuadPart - StartingOffset );
+
+    Irp = IoAllocateIrp( (CCHAR) (Vcb->TargetDeviceObject->StackSize + 1), FALSE );
+    NT_ASSERT( Irp != NULL );
+
+    IoSetNextIrpStackLocation( Irp );
+    IrpSp = IoGetCurrentIrpStackLocation( Irp );
+
+    IrpSp->MajorFunction = IRP_MJ_READ;
+    IrpSp->DeviceObject = Vcb->Vpb->DeviceObject;
+    IrpSp->FileObject = Handle->FileObject;
+    IrpSp->Parameters.Read.Length = ByteCount;
+    IrpSp->Parameters.Read.ByteOffset.QuadPart = StartingOffset;
+
+    Irp->Flags = IRP_NOCACHE | IRP_READ_OPERATION;
+    Irp->RequestorMode = KernelMode;
+    Irp->UserBuffer = UserBuffer;
+    Irp->Tail.Overlay.Thread = PsGetCurrentThread();
+    Irp->Tail.Overlay.OriginalFileObject = Handle->FileObject;
+
+    FsRtlEnterFileSystem();
+
+    IrpContext = CdCreateIrpContext( Irp, Wait );
+    CdSetThreadContext( IrpContext, &ThreadContext );
+
+    CdAcquireFileShared( IrpContext, Fcb );
+
+    BlockedWaits = HostBlockedWaits();
+
+    Hit = CdCopyFromReadAhead( IrpContext, Fcb, StartingOffset, ByteCount );
+
+    if (!Wait && (HostBlockedWaits() != BlockedWaits)) {
+        Handle->Stats.NoWaitBlocked += 1;
+    }
+
+    CdStartReadAhead( IrpContext, Fcb, Handle->FileObject, StartingOffset, ByteCount );
+
+    Handle->Stats.Requests += 1;
+
+    if (Hit) {
+
+        Handle->Stats.Hits += 1;
+        Irp->IoStatus.Information = ByteCount;
+        Status = STATUS_SUCCESS;
+
+    } else {
+
+        Handle->Stats.Misses += 1;
+
+        SetFlag( IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT );
+
+        do {
+
+            RtlZeroMemory( &IoContext, sizeof( CD_IO_CONTEXT ));
+            KeInitializeEvent( &IoContext.SyncEvent, NotificationEvent, FALSE );
+            IrpContext->IoContext = &IoContext;
+
+            Irp->IoStatus.Information = BlockAlign( Vcb, ByteCount );
+            Status = CdNonCachedRead( IrpContext, Fcb, StartingOffset, BlockAlign( Vcb, ByteCount ));
+
+        } while (!NT_SUCCESS( Status ));
+
+        IrpContext->IoContext = NULL;
+        Irp->IoStatus.Information = ByteCount;
+    }
+
+    CdReleaseFile( IrpContext, Fcb );
+
+    CdCompleteRequest( IrpContext, Irp, Status );
+
+    FsRtlExitFileSystem();
+
+    if (Irp->MdlAddress != NULL) {
+        IoFreeMdl( Irp->MdlAddress );
+    }
+
+    IoFreeIrp( Irp );
+
+    for (i = 0; i < ByteCount; i++) {
+        if (UserBuffer[i] != PatternByte( Handle->DiskOffset + (uint64_t)StartingOffset + i )) {
+            Handle->Stats.Corrupt += 1;
+            break;
+        }
+    }
+}
+
+//
+//  A run: every reader reads its own file from start to end.
+//
+
+typedef struct _READER {
+    HANDLE Handle;
+    LONGLONG FileSize;
+    uint32_t RequestSize;
+    double Think;
+    BOOLEAN Wait;
+    int Random;
+    uint64_t Seed;
+} READER;
+
+static void *
+ReaderThread (
+    void *Context
+    )
+{
+    READER *Reader = Context;
+    uint8_t *Buffer = malloc( Reader->RequestSize );
+    uint64_t State = Reader->Seed;
+    int64_t Offset;
+    int64_t Requests = (Reader->FileSize + Reader->RequestSize - 1) / Reader->RequestSize;
+    int64_t i;
+
+    if (Buffer == NULL) {
+        return NULL;
+    }
+
+    UserThread = 1;
+
+    for (i = 0; i < Requests; i++) {
+
+        Offset = Reader->Random ?
+                 (int64_t)(Random64( &State ) % (uint64_t)Requests) * Reader->RequestSize :
+                 i * Reader->RequestSize;
+
+        UserRead( &Reader->Handle, Offset, Reader->RequestSize, Reader->Wait, Buffer );
+        Sleep( Reader->Think );
+    }
+
+    free( Buffer );
+    return NULL;
+}
+
+typedef struct _RUN_RESULT {
+    double Seconds;
+    double Throughput;
+    STATS Stats;
+    DEVICE Device;
+} RUN_RESULT;
+
+static PVCB
+MountVolume (
+    PDEVICE_OBJECT *TargetDeviceObject
+    )
+{
+    *TargetDeviceObject = HostCreateTargetDevice();
+
+    return HostMountVolume( *TargetDeviceObject, NULL, 0 );
+}
+
+static void
+DismountVolume (
+    PDEVICE_OBJECT TargetDeviceObject,
+    PVCB Vcb
+    )
+{
+    HostDismountVolume( Vcb );
+    HostDeleteTargetDevice( TargetDeviceObject );
+}
+
+static void
+RunReaders (
+    uint32_t ReaderCount,
+    int64_t FileSize,
+    uint32_t RequestSize,
+    uint32_t Depth,
+    double Think,
+    BOOLEAN Wait,
+    int Random,
+    RUN_RESULT *Result
+    )
+{
+    READER Readers[MAX_READERS];
+    pthread_t Threads[MAX_READERS];
+    PDEVICE_OBJECT TargetDeviceObject;
+    PVCB Vcb;
+    HOST_COUNTERS Before;
+    HOST_COUNTERS After;
+    double Start;
+    uint32_t i;
+
+    CdData.ReadAheadDepth = Depth;
+
+    memset( Result, 0, sizeof(*Result) );
+
+    Vcb = MountVolume( &TargetDeviceObject );
+
+    for (i = 0; i < ReaderCount; i++) {
+
+        //
+        //  Files are laid out one after the other with a gap between.
+        //
+
+        OpenFile( &Readers[i].Handle, Vcb, i + 1, (uint64_t)i * (uint64_t)FileSize * 2, FileSize );
+        Readers[i].FileSize = FileSize;
+        Readers[i].RequestSize = RequestSize;
+        Readers[i].Think = Think;
+        Readers[i].Wait = Wait;
+        Readers[i].Random = Random;
+        Readers[i].Seed = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+
+    Drive.LastEnd = 0;
+    Drive.Commands = Drive.Seeks = Drive.Bytes = Drive.Errors = Drive.ReadAheadErrors = 0;
+
+    HostGetCounters( &Before );
+
+    Start = Now();
+
+    for (i = 0; i < ReaderCount; i++) {
+        pthread_create( &Threads[i], NULL, ReaderThread, &Readers[i] );
+    }
+
+    for (i = 0; i < ReaderCount; i++) {
+
+        pthread_join( Threads[i], NULL );
+        CloseFile( &Readers[i].Handle );
+
+        Result->Stats.Requests += Readers[i].Handle.Stats.Requests;
+        Result->Stats.Hits += Readers[i].Handle.Stats.Hits;
+        Result->Stats.Misses += Readers[i].Handle.Stats.Misses;
+        Result->Stats.NoWaitBlocked += Readers[i].Handle.Stats.NoWaitBlocked;
+        Result->Stats.Corrupt += Readers[i].Handle.Stats.Corrupt;
+    }
+
+    HostWaitForWorkItems();
+
+    Result->Seconds = Now() - Start;
+    Result->Throughput = (double)FileSize * ReaderCount / Result->Seconds / (1024 * 1024);
+
+    HostGetCounters( &After );
+
+    Result->Stats.ChunksStarted = (unsigned long long) (After.WorkItemsQueued - Before.WorkItemsQueued);
+    Result->Stats.ChunksFailed = Drive.ReadAheadErrors;
+    Result->Device = Drive;
+
+    DismountVolume( TargetDeviceObject, Vcb );
+}
+
+static void
+PrintHeader (
+    void
+    )
+{
+    printf( "%8s %6s %9s %8s %8s %9s %7s %9s %8s\n",
+            "request", "depth", "MB/s", "hits", "misses", "commands", "seeks", "device MB", "speedup" );
+}
+
+static void
+PrintResult (
+    uint32_t RequestSize,
+    uint32_t Depth,
+    const RUN_RESULT *Result,
+    double Baseline
+    )
+{
+    printf( "%8u %6u %9.2f %8llu %8llu %9llu %7llu %9.1f %7.2fx\n",
+            RequestSize,
+            Depth,
+            Result->Throughput,
+            Result->Stats.Hits,
+            Result->Stats.Misses,
+            Result->Device.Commands,
+            Result->Device.Seeks,
+            (double)Result->Device.Bytes / (1024 * 1024),
+            Result->Throughput / Baseline );
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    RUN_RESULT Off, On;
+    PDEVICE_OBJECT TargetDeviceObject;
+    PVCB Vcb;
+    HANDLE Handle;
+    HOST_COUNTERS Before;
+    HOST_COUNTERS After;
+    uint8_t *Buffer;
+    int64_t Offset;
+
+    //
+    //  A fast device so the tests don't take long, with enough overhead per
+    //  command that read-ahead is worth having.
+    //
+
+    InitializeDevice( &Drive, 200, 200, 500 );
+
+    //
+    //  Sequential 4K reads: with read-ahead every request after the first
+    //  two is a hit, the data is right, and it is quicker.
+    //
+
+    RunReaders( 1, 2 << 20, 4096, 0, 0, TRUE, 0, &Off );
+    CHECK( Off.Stats.Hits == 0 );
+    CHECK( Off.Stats.Corrupt == 0 );
+    CHECK( Off.Device.Commands == 512 );
+
+    RunReaders( 1, 2 << 20, 4096, 4, 0, TRUE, 0, &On );
+    PrintHeader();
+    PrintResult( 4096, 0, &Off, Off.Throughput );
+    PrintResult( 4096, 4, &On, Off.Throughput );
+    CHECK( On.Stats.Corrupt == 0 );
+    CHECK( On.Stats.Misses == 2 );
+    CHECK( On.Stats.ChunksFailed == 0 );
+    CHECK( On.Device.Commands < 40 );
+    CHECK( On.Device.Bytes < (2 << 20) + 8 * CD_READ_AHEAD_CHUNK_SIZE );
+    CHECK( On.Throughput > Off.Throughput );
+    CHECK( PoolOutstanding() == 0 );
+
+    //
+    //  Requests that don't divide the chunk size, and a file that doesn't
+    //  end on a chunk.
+    //
+
+    RunReaders( 1, (1 << 20) + 6144, 6144, 4, 0, TRUE, 0, &On );
+    PrintResult( 6144, 4, &On, Off.Throughput );
+    CHECK( On.Stats.Corrupt == 0 );
+    CHECK( On.Stats.Misses <= 3 );
+    CHECK( PoolOutstanding() == 0 );
+
+    //
+    //  Requests over half the window never start read-ahead.
+    //
+
+    RunReaders( 1, 1 << 20, 0x20000, 2, 0, TRUE, 0, &On );
+    CHECK( On.Stats.ChunksStarted == 0 );
+    CHECK( On.Stats.Corrupt == 0 );
+
+    //
+    //  Random reads never look sequential long enough to start read-ahead,
+    //  so the device reads nothing the user didn't ask for.
+    //
+
+    RunReaders( 1, 1 << 20, 4096, 4, 0, TRUE, 1, &On );
+    CHECK( On.Stats.Corrupt == 0 );
+    CHECK( On.Stats.ChunksStarted < 4 * 8 );
+    CHECK( On.Device.Bytes <= 256 * 4096 + 4 * 8 * CD_READ_AHEAD_CHUNK_SIZE );
+
+    //
+    //  Several sequential readers sharing the drive.
+    //
+
+    RunReaders( 3, 1 << 20, 4096, 4, 0, TRUE, 0, &On );
+    CHECK( On.Stats.Corrupt == 0 );
+    CHECK( On.Stats.Hits > 3 * 250 );
+    CHECK( PoolOutstanding() == 0 );
+
+    //
+    //  A request which can't wait must not block on a chunk still being
+    //  read, but go to the device.
+    //
+
+    RunReaders( 1, 2 << 20, 4096, 4, 0, FALSE, 0, &On );
+    PrintResult( 4096, 4, &On, Off.Throughput );
+    CHECK( On.Stats.Corrupt == 0 );
+    CHECK( On.Stats.NoWaitBlocked == 0 );
+    CHECK( On.Stats.Hits > 0 );
+
+    //
+    //  A chunk the device fails to read is either read again ahead of the
+    //  user or read by the user, and the user sees the right data.
+    //
+
+    Drive.FailOnce = 1;
+    Drive.FailOffset = 5 * CD_READ_AHEAD_CHUNK_SIZE + 100;
+    RunReaders( 1, 1 << 20, 4096, 4, 0, TRUE, 0, &On );
+    CHECK( On.Device.Errors == 1 );
+    CHECK( On.Stats.ChunksFailed == 1 );
+    CHECK( On.Stats.Corrupt == 0 );
+    Drive.FailOnce = 0;
+
+    //
+    //  The last handle going away with chunks in flight waits for them, and
+    //  the file is closed once the work items have let go of it.
+    //
+
+    Buffer = malloc( 4096 );
+    CHECK( Buffer != NULL );
+    if (Buffer != NULL) {
+        CdData.ReadAheadDepth = 8;
+        Vcb = MountVolume( &TargetDeviceObject );
+        OpenFile( &Handle, Vcb, 1, 0, 4 << 20 );
+        HostGetCounters( &Before );
+        UserThread = 1;
+        for (Offset = 0; Offset < 3 * 4096; Offset += 4096) {
+            UserRead( &Handle, Offset, 4096, TRUE, Buffer );
+        }
+        UserThread = 0;
+        HostGetCounters( &After );
+        CHECK( After.WorkItemsQueued - Before.WorkItemsQueued == 8 );
+        CHECK( Handle.Stats.Corrupt == 0 );
+        CloseFile( &Handle );
+        HostWaitForWorkItems();
+        CHECK( Vcb->VcbReference == 1 );
+        DismountVolume( TargetDeviceObject, Vcb );
+        free( Buffer );
+    }
+    CHECK( PoolOutstanding() == 0 );
+
+    HostUninitialize();
+    CHECK( PoolOutstanding() == 0 );
+
+    pthread_mutex_destroy( &Drive.Lock );
+
+    printf( "%s\n", Failures ? "FAILED" : "passed" );
+    return Failures ? 1 : 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    uint32_t Requests[MAX_REQUEST_SIZES];
+    uint32_t RequestCount = 0;
+    static const uint32_t Depths[] = { 0, 2, CD_READ_AHEAD_DEFAULT_DEPTH, CD_READ_AHEAD_MAX_DEPTH };
+    double SizeMb = 8;
+    double RateMb = 20;
+    double OverheadUs = 250;
+    double SeekUs = 1000;
+    double ThinkUs = 0;
+    uint32_t ReaderCount = 1;
+    BOOLEAN Wait = TRUE;
+    RUN_RESULT Result;
+    double Baseline;
+    int Corrupt = 0;
+    uint32_t r, d;
+    int i;
+
+    HostInitialize();
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--size" ) == 0) && (i + 1 < argc)) {
+            SizeMb = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--rate" ) == 0) && (i + 1 < argc)) {
+            RateMb = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--overhead" ) == 0) && (i + 1 < argc)) {
+            OverheadUs = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--seek" ) == 0) && (i + 1 < argc)) {
+            SeekUs = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--think" ) == 0) && (i + 1 < argc)) {
+            ThinkUs = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--readers" ) == 0) && (i + 1 < argc)) {
+            ReaderCount = (uint32_t)atoi( argv[++i] );
+        } else if (strcmp( argv[i], "--no-wait" ) == 0) {
+            Wait = FALSE;
+        } else if ((atoi( argv[i] ) > 0) && (RequestCount < MAX_REQUEST_SIZES)) {
+            Requests[RequestCount++] = (uint32_t)atoi( argv[i] );
+        } else {
+            fprintf( stderr,
+                     "usage: rasim --selftest\n"
+                     "       rasim [--size mb] [--rate mb/s] [--overhead us] [--seek us]\n"
+                     "             [--think us] [--readers n] [--no-wait] [requests...]\n" );
+            return 2;
+        }
+    }
+
+    if (RequestCount == 0) {
+        Requests[RequestCount++] = 4096;
+        Requests[RequestCount++] = 16384;
+        Requests[RequestCount++] = 65536;
+    }
+
+    if ((SizeMb <= 0) || (RateMb <= 0) || (OverheadUs < 0) || (SeekUs < 0) || (ThinkUs < 0) ||
+        (ReaderCount == 0) || (ReaderCount > MAX_READERS)) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    for (r = 0; r < RequestCount; r++) {
+        if ((Requests[r] % SECTOR_SIZE) != 0) {
+            fprintf( stderr, "requests must be a whole number of sectors\n" );
+            return 2;
+        }
+    }
+
+    InitializeDevice( &Drive, RateMb, OverheadUs, SeekUs );
+
+    printf( "%u reader(s) of %.1f MB each, %.0f MB/s drive, %.0fus per command, %.0fus seek, %.0fus think%s\n",
+            ReaderCount, SizeMb, RateMb, OverheadUs, SeekUs, ThinkUs, Wait ? "" : ", requests can't wait" );
+    PrintHeader();
+
+    for (r = 0; r < RequestCount; r++) {
+
+        Baseline = 0;
+
+        for (d = 0; d < sizeof(Depths) / sizeof(Depths[0]); d++) {
+
+            RunReaders( ReaderCount,
+                        (int64_t)(SizeMb * 1024 * 1024) & ~((int64_t)SECTOR_SIZE - 1),
+                        Requests[r],
+                        Depths[d],
+                        ThinkUs / 1e6,
+                        Wait,
+                        0,
+                        &Result );
+
+            if (d == 0) {
+                Baseline = Result.Throughput;
+            }
+
+            PrintResult( Requests[r], Depths[d], &Result, Baseline );
+            Corrupt |= (Result.Stats.Corrupt != 0);
+        }
+    }
+
+    HostUninitialize();
+    pthread_mutex_destroy( &Drive.Lock );
+
+    if (Corrupt) {
+        fprintf( stderr, "readers saw the wrong data\n" );
+        return 1;
+    }
+
+    return 0;
+}
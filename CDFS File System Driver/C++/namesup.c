@@ -27,6 +27,7 @@ Abstract:
 #pragma alloc_text(PAGE, CdDissectName)
 #pragma alloc_text(PAGE, CdGenerate8dot3Name)
 #pragma alloc_text(PAGE, CdFullCompareNames)
+#pragma alloc_text(PAGE, CdHashName)
 #pragma alloc_text(PAGE, CdIsLegalName)
 #pragma alloc_text(PAGE, CdIs8dot3Name)
 #pragma alloc_text(PAGE, CdIsNameInExpression)
@@ -1127,3 +1128,50 @@ Return Value:
 
 
 
+ULONG
+CdHashName (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PUNICODE_STRING Name
+    )
+
+/*++
+
+Routine Description:
+
+    This function computes the hash used by the name indexes.  Each character
+    is upcased before it is hashed, so all case variants of a name hash to
+    the same value and a single index serves both exact and ignore case
+    searches.  Callers still compare the names themselves.
+
+Arguments:
+
+    Name - Name to hash.  This should not include the version string.
+
+Return Value:
+
+    ULONG - FNV-1a hash of the upcased characters of the name.
+
+--*/
+
+{
+    ULONG Hash = 0x811c9dc5;
+    ULONG Count = Name->Length / sizeof( WCHAR );
+    PWCHAR NextChar = Name->Buffer;
+    WCHAR Upcased;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    while (Count--) {
+
+        Upcased = RtlUpcaseUnicodeChar( *NextChar );
+        NextChar += 1;
+
+        Hash = (Hash ^ (Upcased & 0xff)) * 0x01000193;
+        Hash = (Hash ^ (Upcased >> 8)) * 0x01000193;
+    }
+
+    return Hash;
+}
+
@@ -96,6 +96,27 @@ Abstract:
 #define CdRawPathEntry(IC, PC)      \
     Add2Ptr( (PC)->Data, (PC)->DataOffset, PRAW_PATH_ENTRY )
 
+//
+//  ULONG
+//  CdPathIndexHash (
+//      _In_ ULONG NameHash,
+//      _In_ ULONG ParentOrdinal
+//      );
+//
+//  Path table index entries are keyed on both the parent ordinal and the
+//  name, so mix the two together.
+//
+
+#define CdPathIndexHash(NH, PO)     \
+    ((NH) ^ ((PO) * 0x9e3779b1))
+
+//
+//  We only build a path table index once the path table is big enough that
+//  a linear scan hurts.
+//
+
+#define CD_PATH_INDEX_MIN_SIZE      (8 * SECTOR_SIZE)
+
 //
 //  Local support routines
 //
@@ -108,6 +129,12 @@ CdMapPathTableBlock (
     _Inout_ PPATH_ENUM_CONTEXT PathContext
     );
 
+PCD_NAME_INDEX
+CdGetPathTableIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PVCB Vcb
+    );
+
 _Success_(return != FALSE)
 BOOLEAN
 CdUpdatePathEntryFromRawPathEntry (
@@ -120,6 +147,7 @@ CdUpdatePathEntryFromRawPathEntry (
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, CdFindPathEntry)
+#pragma alloc_text(PAGE, CdGetPathTableIndex)
 #pragma alloc_text(PAGE, CdLookupPathEntry)
 #pragma alloc_text(PAGE, CdLookupNextPathEntry)
 #pragma alloc_text(PAGE, CdMapPathTableBlock)
@@ -341,6 +369,10 @@ Return Value:
     ULONG StartingOffset;
     ULONG StartingOrdinal;
 
+    PCD_NAME_INDEX NameIndex;
+    ULONG NameHash;
+    ULONG Entry;
+
     PAGED_CODE();
 
     //
@@ -367,6 +399,66 @@ Return Value:
 		CdRaiseStatus( IrpContext, STATUS_DISK_CORRUPT_ERROR );
 	}
 
+    //
+    //  If the path table is large enough to have an index, use it to go
+    //  straight to the candidate entries.  The index holds every child of
+    //  every directory, so a miss there is a miss.
+    //
+
+    NameIndex = CdGetPathTableIndex( IrpContext, ParentFcb->Vcb );
+
+    if (NameIndex != NULL) {
+
+        NameHash = CdPathIndexHash( CdHashName( IrpContext, &DirName->FileName ),
+                                    ParentFcb->Ordinal );
+
+        for (Entry = NameIndex->Buckets[ NameHash & (NameIndex->BucketCount - 1) ];
+             Entry != 0;
+             Entry = NameIndex->Entries[ Entry - 1 ].Next) {
+
+            PCD_NAME_INDEX_ENTRY IndexEntry = &NameIndex->Entries[ Entry - 1 ];
+
+            if ((IndexEntry->NameHash != NameHash) ||
+                (IndexEntry->ParentOrdinal != ParentFcb->Ordinal)) {
+
+                continue;
+            }
+
+            //
+            //  Drop any previous mapping before we reposition.
+            //
+
+            CdUnpinData( IrpContext, &CompoundPathEntry->PathContext.Bcb );
+
+            if (CompoundPathEntry->PathContext.AllocatedData) {
+
+                CdFreePool( &CompoundPathEntry->PathContext.Data );
+            }
+
+            RtlZeroMemory( &CompoundPathEntry->PathContext, sizeof( PATH_ENUM_CONTEXT ));
+
+            CdLookupPathEntry( IrpContext,
+                               IndexEntry->Offset,
+                               IndexEntry->Ordinal,
+                               FALSE,
+                               CompoundPathEntry );
+
+            CdUpdatePathEntryName( IrpContext, &CompoundPathEntry->PathEntry, IgnoreCase );
+
+            if (CdIsNameInExpression( IrpContext,
+                                      &CompoundPathEntry->PathEntry.CdCaseDirName,
+                                      DirName,
+                                      0,
+                                      FALSE )) {
+
+                Found = TRUE;
+                break;
+            }
+        }
+
+        return Found;
+    }
+
     CdLockFcb( IrpContext, ParentFcb );
 
     if (ParentFcb->ChildPathTableOffset != 0) {
@@ -999,3 +1091,117 @@ Return Value:
 }
 
 
+//
+//  Local support routine
+//
+
+PCD_NAME_INDEX
+CdGetPathTableIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the name index for the path table, building it on
+    first use.  The index holds one entry for every directory but the root,
+    keyed on the upcased name and the parent ordinal.  Small path tables
+    don't get an index, nor do path tables we failed to index once.
+
+Arguments:
+
+    Vcb - Volume whose path table we want to search.
+
+Return Value:
+
+    PCD_NAME_INDEX - The path table index, or NULL if the caller should
+        walk the path table itself.
+
+--*/
+
+{
+    PFCB PathTableFcb = Vcb->PathTableFcb;
+    PCD_NAME_INDEX NameIndex = PathTableFcb->NameIndex;
+    CD_NAME_INDEX_BUILDER Builder;
+    COMPOUND_PATH_ENTRY CompoundPathEntry;
+    BOOLEAN Complete = FALSE;
+
+    PAGED_CODE();
+
+    if ((NameIndex != NULL) ||
+        PathTableFcb->NameIndexFailed ||
+        (PathTableFcb->FileSize.QuadPart < CD_PATH_INDEX_MIN_SIZE)) {
+
+        return NameIndex;
+    }
+
+    NameIndex = CdFindNameIndex( IrpContext, PathTableFcb );
+
+    if ((NameIndex != NULL) || PathTableFcb->NameIndexFailed) {
+
+        return NameIndex;
+    }
+
+    RtlZeroMemory( &Builder, sizeof( CD_NAME_INDEX_BUILDER ));
+    CdInitializeCompoundPathEntry( IrpContext, &CompoundPathEntry );
+
+    try {
+
+        try {
+
+            //
+            //  Start at the root, which is always the first entry, and add
+            //  everything after it.
+            //
+
+            CdLookupPathEntry( IrpContext,
+                               CdQueryFidPathTableOffset( Vcb->RootIndexFcb->FileId ),
+                               Vcb->RootIndexFcb->Ordinal,
+                               FALSE,
+                               &CompoundPathEntry );
+
+            Complete = TRUE;
+
+            while (CdLookupNextPathEntry( IrpContext,
+                                          &CompoundPathEntry.PathContext,
+                                          &CompoundPathEntry.PathEntry )) {
+
+                CdUpdatePathEntryName( IrpContext, &CompoundPathEntry.PathEntry, TRUE );
+
+                if (!CdAddNameIndexEntry( IrpContext,
+                                          &Builder,
+                                          CdPathIndexHash( CdHashName( IrpContext,
+                                                                       &CompoundPathEntry.PathEntry.CdCaseDirName.FileName ),
+                                                           CompoundPathEntry.PathEntry.ParentOrdinal ),
+                                          CompoundPathEntry.PathEntry.ParentOrdinal,
+                                          CompoundPathEntry.PathEntry.Ordinal,
+                                          CompoundPathEntry.PathEntry.PathTableOffset )) {
+
+                    Complete = FALSE;
+                    break;
+                }
+            }
+
+            if (Complete) {
+
+                NameIndex = CdCreateNameIndex( IrpContext, &Builder );
+            }
+
+        } finally {
+
+            CdCleanupCompoundPathEntry( IrpContext, &CompoundPathEntry );
+            CdCleanupNameIndexBuilder( IrpContext, &Builder );
+        }
+
+    } except( CdNameIndexExceptionFilter( GetExceptionCode() )) {
+
+        IrpContext->ExceptionStatus = STATUS_SUCCESS;
+        NameIndex = NULL;
+    }
+
+    return CdInstallNameIndex( IrpContext, PathTableFcb, NameIndex );
+}
+
+
@@ -104,6 +104,7 @@ Return Value:
     PVOID SystemBuffer;
 
     BOOLEAN ReleaseFile = TRUE;
+    BOOLEAN ReadAheadHit;
 
     CD_IO_CONTEXT LocalIoContext;
 
@@ -314,6 +315,30 @@ Return Value:
                 ReadByteCount = ByteCount;
             }
 
+            //
+            //  For a user file, copy from the read-ahead buffers if they hold
+            //  this range, and keep them filled ahead of sequential reads.
+            //
+
+            if ((TypeOfOpen == UserFileOpen) && !PagingIo) {
+
+                ReadAheadHit = CdCopyFromReadAhead( IrpContext, Fcb, StartingOffset, ByteCount );
+
+                CdStartReadAhead( IrpContext, Fcb, IrpSp->FileObject, StartingOffset, ByteCount );
+
+                if (ReadAheadHit) {
+
+                    Irp->IoStatus.Information = ByteCount;
+
+                    if (SynchronousIo) {
+
+                        IrpSp->FileObject->CurrentByteOffset.QuadPart = ByteRange;
+                    }
+
+                    try_return( Status = STATUS_SUCCESS );
+                }
+            }
+
             //
             //  Initialize the IoContext for the read.
             //  If there is a context pointer, we need to make sure it was
@@ -198,13 +198,16 @@ CdTocSerial (
     );
 
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, CdAddNameIndexEntry)
 #pragma alloc_text(PAGE, CdAllocateFcbTable)
 #pragma alloc_text(PAGE, CdCleanupIrpContext)
+#pragma alloc_text(PAGE, CdCleanupNameIndexBuilder)
 #pragma alloc_text(PAGE, CdCreateCcb)
 #pragma alloc_text(PAGE, CdCreateFcb)
 #pragma alloc_text(PAGE, CdCreateFcbNonpaged)
 #pragma alloc_text(PAGE, CdCreateFileLock)
 #pragma alloc_text(PAGE, CdCreateIrpContext)
+#pragma alloc_text(PAGE, CdCreateNameIndex)
 #pragma alloc_text(PAGE, CdDeallocateFcbTable)
 #pragma alloc_text(PAGE, CdDeleteCcb)
 #pragma alloc_text(PAGE, CdDeleteFcb)
@@ -212,10 +215,12 @@ CdTocSerial (
 #pragma alloc_text(PAGE, CdDeleteFileLock)
 #pragma alloc_text(PAGE, CdDeleteVcb)
 #pragma alloc_text(PAGE, CdFcbTableCompare)
+#pragma alloc_text(PAGE, CdFindNameIndex)
 #pragma alloc_text(PAGE, CdGetNextFcb)
 #pragma alloc_text(PAGE, CdInitializeFcbFromFileContext)
 #pragma alloc_text(PAGE, CdInitializeFcbFromPathEntry)
 #pragma alloc_text(PAGE, CdInitializeStackIrpContext)
+#pragma alloc_text(PAGE, CdInstallNameIndex)
 #pragma alloc_text(PAGE, CdInitializeVcb)
 #pragma alloc_text(PAGE, CdLookupFcbTable)
 #pragma alloc_text(PAGE, CdProcessToc)
@@ -310,6 +315,7 @@ Return Value:
     //
 
     InitializeListHead( &Vcb->DirNotifyList );
+    InitializeListHead( &Vcb->NameIndexList );
     FsRtlNotifyInitializeSync( &Vcb->NotifySync );
     
     //
@@ -929,6 +935,21 @@ Return Value:
     CdFreePool( &Vcb->XASector );
     CdFreePool( &Vcb->SectorCacheBuffer);
 
+    //
+    //  Free the name indexes.  Every Fcb which pointed at one is gone.
+    //
+
+    while (!IsListEmpty( &Vcb->NameIndexList )) {
+
+        PCD_NAME_INDEX NameIndex = CONTAINING_RECORD( RemoveHeadList( &Vcb->NameIndexList ),
+                                                      CD_NAME_INDEX,
+                                                      VcbLinks );
+
+        CdFreePool( &NameIndex );
+    }
+
+    Vcb->NameIndexBytes = 0;
+
     if (Vcb->SectorCacheIrp != NULL) {
 
         IoFreeIrp( Vcb->SectorCacheIrp);
@@ -1394,6 +1415,398 @@ Return Value:
 }
 
 
+BOOLEAN
+CdAddNameIndexEntry (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PCD_NAME_INDEX_BUILDER Builder,
+    _In_ ULONG NameHash,
+    _In_ ULONG ParentOrdinal,
+    _In_ ULONG Ordinal,
+    _In_ ULONG Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine appends an entry to the scratch list used to build a name
+    index.  Entries must be added in on-disk order.  The list grows as
+    needed; we don't raise if we can't get the pool, since the caller can
+    always fall back to a linear scan.
+
+Arguments:
+
+    Builder - Scratch list to add to.  This was zeroed by the caller.
+
+    NameHash - Hash of the upcased name, see CdHashName.
+
+    ParentOrdinal - Parent ordinal for a path table entry, zero for dirents.
+
+    Ordinal - Ordinal of a path table entry, zero for dirents.
+
+    Offset - Offset of the path table entry or initial dirent.
+
+Return Value:
+
+    BOOLEAN - TRUE if the entry was added, FALSE if we couldn't grow the list
+        or the index would be too large.
+
+--*/
+
+{
+    PCD_NAME_INDEX_ENTRY NewEntries;
+    ULONG NewLimit;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (Builder->EntryCount == Builder->EntryLimit) {
+
+        if (Builder->EntryLimit >= CD_NAME_INDEX_MAX_ENTRIES) {
+
+            return FALSE;
+        }
+
+        NewLimit = (Builder->EntryLimit == 0) ? 0x100 : Builder->EntryLimit * 2;
+
+        NewEntries = ExAllocatePoolWithTag( CdPagedPool,
+                                            NewLimit * sizeof( CD_NAME_INDEX_ENTRY ),
+                                            TAG_NAME_INDEX );
+
+        if (NewEntries == NULL) {
+
+            return FALSE;
+        }
+
+        if (Builder->Entries != NULL) {
+
+            RtlCopyMemory( NewEntries,
+                           Builder->Entries,
+                           Builder->EntryCount * sizeof( CD_NAME_INDEX_ENTRY ));
+
+            CdFreePool( &Builder->Entries );
+        }
+
+        Builder->Entries = NewEntries;
+        Builder->EntryLimit = NewLimit;
+    }
+
+    Builder->Entries[ Builder->EntryCount ].Next = 0;
+    Builder->Entries[ Builder->EntryCount ].NameHash = NameHash;
+    Builder->Entries[ Builder->EntryCount ].ParentOrdinal = ParentOrdinal;
+    Builder->Entries[ Builder->EntryCount ].Ordinal = Ordinal;
+    Builder->Entries[ Builder->EntryCount ].Offset = Offset;
+
+    Builder->EntryCount += 1;
+
+    return TRUE;
+}
+
+
+PCD_NAME_INDEX
+CdCreateNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PCD_NAME_INDEX_BUILDER Builder
+    )
+
+/*++
+
+Routine Description:
+
+    This routine turns the scratch list of entries into a hashed name index.
+    The entries and the bucket heads are placed in a single allocation.
+
+Arguments:
+
+    Builder - Scratch list of entries, in on-disk order.  The caller still
+        owns this and should clean it up.
+
+Return Value:
+
+    PCD_NAME_INDEX - The new index, or NULL if we couldn't get the pool.
+
+--*/
+
+{
+    PCD_NAME_INDEX NameIndex;
+    ULONG AllocationSize;
+    ULONG BucketCount;
+    ULONG Bucket;
+    ULONG Entry;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    //
+    //  Size the bucket array at the power of two at or above the entry count.
+    //
+
+    BucketCount = 0x10;
+
+    while (BucketCount < Builder->EntryCount) {
+
+        BucketCount <<= 1;
+    }
+
+    AllocationSize = FIELD_OFFSET( CD_NAME_INDEX, Entries ) +
+                     (Builder->EntryCount * sizeof( CD_NAME_INDEX_ENTRY )) +
+                     (BucketCount * sizeof( ULONG ));
+
+    NameIndex = ExAllocatePoolWithTag( CdPagedPool,
+                                       AllocationSize,
+                                       TAG_NAME_INDEX );
+
+    if (NameIndex == NULL) {
+
+        return NULL;
+    }
+
+    NameIndex->FileId.QuadPart = 0;
+    NameIndex->AllocationSize = AllocationSize;
+    NameIndex->EntryCount = Builder->EntryCount;
+    NameIndex->BucketCount = BucketCount;
+    NameIndex->Buckets = (PULONG) &NameIndex->Entries[ Builder->EntryCount ];
+
+    RtlZeroMemory( NameIndex->Buckets, BucketCount * sizeof( ULONG ));
+
+    if (Builder->EntryCount != 0) {
+
+        RtlCopyMemory( NameIndex->Entries,
+                       Builder->Entries,
+                       Builder->EntryCount * sizeof( CD_NAME_INDEX_ENTRY ));
+    }
+
+    //
+    //  Push the entries onto their buckets from last to first, which leaves
+    //  every chain in on-disk order.
+    //
+
+    for (Entry = NameIndex->EntryCount; Entry != 0; Entry -= 1) {
+
+        Bucket = NameIndex->Entries[ Entry - 1 ].NameHash & (BucketCount - 1);
+
+        NameIndex->Entries[ Entry - 1 ].Next = NameIndex->Buckets[ Bucket ];
+        NameIndex->Buckets[ Bucket ] = Entry;
+    }
+
+    return NameIndex;
+}
+
+
+VOID
+CdCleanupNameIndexBuilder (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PCD_NAME_INDEX_BUILDER Builder
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the scratch list used to build a name index.
+
+Arguments:
+
+    Builder - Scratch list to free.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (Builder->Entries != NULL) {
+
+        CdFreePool( &Builder->Entries );
+    }
+
+    Builder->EntryCount = 0;
+    Builder->EntryLimit = 0;
+}
+
+
+PCD_NAME_INDEX
+CdFindNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks for a name index already built for this directory or
+    path table.  Indexes belong to the Vcb, so one built for an earlier Fcb
+    for the same FileId is found here and attached to this Fcb.
+
+    If the Vcb has used up its name index pool then we remember not to
+    build one for this Fcb.
+
+Arguments:
+
+    Fcb - Directory or path table Fcb.
+
+Return Value:
+
+    PCD_NAME_INDEX - The index now attached to the Fcb, or NULL if the caller
+        should build one.
+
+--*/
+
+{
+    PCD_NAME_INDEX NameIndex = Fcb->NameIndex;
+    PLIST_ENTRY Links;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if ((NameIndex != NULL) || Fcb->NameIndexFailed) {
+
+        return NameIndex;
+    }
+
+    CdLockVcb( IrpContext, Fcb->Vcb );
+
+    for (Links = Fcb->Vcb->NameIndexList.Flink;
+         Links != &Fcb->Vcb->NameIndexList;
+         Links = Links->Flink) {
+
+        if (CONTAINING_RECORD( Links, CD_NAME_INDEX, VcbLinks )->FileId.QuadPart == Fcb->FileId.QuadPart) {
+
+            NameIndex = CONTAINING_RECORD( Links, CD_NAME_INDEX, VcbLinks );
+            break;
+        }
+    }
+
+    if ((NameIndex == NULL) &&
+        (Fcb->Vcb->NameIndexBytes >= CD_NAME_INDEX_VCB_POOL_LIMIT)) {
+
+        Fcb->NameIndexFailed = TRUE;
+    }
+
+    CdUnlockVcb( IrpContext, Fcb->Vcb );
+
+    //
+    //  There is only one index per FileId, so whoever else got here first
+    //  installed the same pointer.
+    //
+
+    if (NameIndex != NULL) {
+
+        InterlockedCompareExchangePointer( &Fcb->NameIndex, NameIndex, NULL );
+    }
+
+    return NameIndex;
+}
+
+
+PCD_NAME_INDEX
+CdInstallNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb,
+    _In_opt_ PCD_NAME_INDEX NameIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a newly built name index to the Vcb and attaches it
+    to a directory or path table Fcb.  Several threads may build an index
+    for the same FileId at once, since the Fcb is only held shared when
+    searched.  The first one in wins and the others free theirs.
+
+    If no index is passed in, or the Vcb has no name index pool left, then
+    we remember not to try again for this Fcb.
+
+Arguments:
+
+    Fcb - Directory or path table Fcb.
+
+    NameIndex - Index to attach, or NULL if building one failed.
+
+Return Value:
+
+    PCD_NAME_INDEX - The index now attached to the Fcb, if any.
+
+--*/
+
+{
+    PCD_NAME_INDEX ExistingIndex = NULL;
+    PLIST_ENTRY Links;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (NameIndex == NULL) {
+
+        Fcb->NameIndexFailed = TRUE;
+        return Fcb->NameIndex;
+    }
+
+    NameIndex->FileId = Fcb->FileId;
+
+    CdLockVcb( IrpContext, Fcb->Vcb );
+
+    for (Links = Fcb->Vcb->NameIndexList.Flink;
+         Links != &Fcb->Vcb->NameIndexList;
+         Links = Links->Flink) {
+
+        if (CONTAINING_RECORD( Links, CD_NAME_INDEX, VcbLinks )->FileId.QuadPart == Fcb->FileId.QuadPart) {
+
+            ExistingIndex = CONTAINING_RECORD( Links, CD_NAME_INDEX, VcbLinks );
+            break;
+        }
+    }
+
+    if (ExistingIndex == NULL) {
+
+        if (NameIndex->AllocationSize <= CD_NAME_INDEX_VCB_POOL_LIMIT - Fcb->Vcb->NameIndexBytes) {
+
+            InsertTailList( &Fcb->Vcb->NameIndexList, &NameIndex->VcbLinks );
+            Fcb->Vcb->NameIndexBytes += NameIndex->AllocationSize;
+            ExistingIndex = NameIndex;
+            NameIndex = NULL;
+
+        } else {
+
+            //
+            //  Close the budget, or every new Fcb for this directory would
+            //  build the index again only to throw it away.
+            //
+
+            Fcb->Vcb->NameIndexBytes = CD_NAME_INDEX_VCB_POOL_LIMIT;
+        }
+    }
+
+    CdUnlockVcb( IrpContext, Fcb->Vcb );
+
+    if (NameIndex != NULL) {
+
+        CdFreePool( &NameIndex );
+    }
+
+    if (ExistingIndex == NULL) {
+
+        Fcb->NameIndexFailed = TRUE;
+        return Fcb->NameIndex;
+    }
+
+    InterlockedCompareExchangePointer( &Fcb->NameIndex, ExistingIndex, NULL );
+
+    return ExistingIndex;
+}
+
+
 PCCB
 CdCreateCcb (
     _In_ PIRP_CONTEXT IrpContext,
@@ -2493,6 +2906,13 @@ Return Value:
             Vcb->PathTableFcb = NULL;
         }
 
+        //
+        //  Any name index belongs to the Vcb and is kept for the next Fcb
+        //  for this FileId.
+        //
+
+        Fcb->NameIndex = NULL;
+
         CdDeallocateFcbIndex( IrpContext, Fcb );
         break;
 
@@ -2503,6 +2923,12 @@ Return Value:
             FsRtlFreeFileLock( Fcb->FileLock );
         }
 
+        if (Fcb->ReadAhead != NULL) {
+
+            CdDeleteReadAhead( IrpContext, Fcb->ReadAhead );
+            Fcb->ReadAhead = NULL;
+        }
+
         FsRtlUninitializeOplock( CdGetFcbOplock(Fcb) );
 
         if (Fcb == Fcb->Vcb->VolumeDasdFcb) {
@@ -0,0 +1,996 @@
+/*++
+
+Copyright (C) Microsoft Corporation, 2026
+
+Module Name:
+
+    idlesim.c
+
+Abstract:
+
+    Trace-driven simulator of the classpnp idle I/O scheduler.
+
+    Replays a trace of normal, low and very low priority requests against a
+    simple disk model (rotational or solid state) and reports the latency of
+    each priority class under:
+
+        single      - the original single idle queue: one FIFO list, one
+                      starvation deadline, CLASS_IDLE_TIMER_TICKS of idle time
+        classes     - weighted round robin idle classes with per-class depth
+                      limits and starvation deadlines (clntirp.c)
+        anticipate  - classes plus anticipatory idling on seek penalty media
+
+    The scheduling decisions mirror ClasspEnqueueIdleRequest,
+    ClasspIdleTimerDpc, ClasspAgeIdleQueues, ClasspSelectIdleQueue and
+    ClasspCompleteIdleRequest, with the tunables at their registry defaults.
+
+    Trace lines are "<arrival us> <N|L|V> <lba> <sectors>", sorted by arrival
+    time; '#' starts a comment.
+
+Environment:
+
+    Host (user mode), C99.
+
+--*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLASS_IDLE_INTERVAL              50          // ms
+#define CLASS_STARVATION_INTERVAL        500         // ms
+#define CLASS_IDLE_TIMER_TICKS           4
+#define CLASS_IDLE_LOW_WEIGHT            4
+#define CLASS_IDLE_VERY_LOW_WEIGHT       1
+#define CLASS_IDLE_ANTICIPATION_INTERVAL 20          // ms
+#define CLASS_IDLE_ACTIVE_MAX            1
+
+#define CLASS_IDLE_CLASS_VERY_LOW        0
+#define CLASS_IDLE_CLASS_LOW             1
+#define CLASS_NUM_IDLE_CLASSES           2
+
+#define PRIO_NORMAL                      2
+#define NUM_PRIOS                        3
+
+#define US_PER_MS                        1000
+
+typedef enum _POLICY {
+    PolicySingle,
+    PolicyClasses,
+    PolicyAnticipate,
+    PolicyCount
+} POLICY;
+
+static const char *PolicyNames[PolicyCount] = { "single", "classes", "anticipate" };
+static const char PrioChars[NUM_PRIOS] = { 'V', 'L', 'N' };
+static const char *PrioNames[NUM_PRIOS] = { "very low", "low", "normal" };
+
+typedef struct _REQUEST {
+    int64_t Arrival;
+    int64_t Completion;
+    uint64_t Lba;
+    uint32_t Sectors;
+    int Prio;
+    int Next;                   // next request in a FIFO, -1 terminates
+} REQUEST;
+
+typedef struct _TRACE {
+    REQUEST *Requests;
+    int Count;
+    int Capacity;
+} TRACE;
+
+typedef struct _FIFO {
+    int Head;
+    int Tail;
+    unsigned Count;
+} FIFO;
+
+typedef struct _IDLE_QUEUE {
+    FIFO List;
+    int ActiveIoCount;
+    unsigned ActiveIoMax;
+    unsigned Weight;
+    unsigned Credits;
+    unsigned StarvationCount;
+    unsigned StarvationTicks;
+} IDLE_QUEUE;
+
+typedef struct _DISK {
+    int Rotational;
+    uint64_t Capacity;          // sectors
+    uint64_t HeadLba;
+    FIFO Queue;
+    int InService;              // request index or -1
+    int64_t BusyUntil;
+} DISK;
+
+typedef struct _SCHED {
+    POLICY Policy;
+    REQUEST *Requests;
+    DISK Disk;
+
+    IDLE_QUEUE Queues[CLASS_NUM_IDLE_CLASSES];
+    unsigned IdleIoCount;
+    int ActiveIoCount;
+    int ActiveIdleIoCount;
+    unsigned IdleActiveIoMax;
+
+    unsigned IdleTimerInterval;     // ms
+    unsigned IdleInterval;          // ms
+    unsigned StarvationCount;       // legacy, ticks
+    unsigned AnticipationTicks;
+
+    int TimerStarted;
+    int64_t NextTick;
+    unsigned IdleTicks;
+    unsigned IdleTimerTicks;
+    int64_t LastIoTime;
+
+    uint64_t Interference;          // normal requests that queued behind idle ones
+} SCHED;
+
+/*
+ * Disk model
+ */
+
+static int64_t
+DiskServiceTime(DISK *Disk, const REQUEST *Request)
+{
+    int64_t transfer;
+    uint64_t distance;
+
+    if (!Disk->Rotational) {
+        transfer = ((int64_t)Request->Sectors * 512 * US_PER_MS) / (400 * 1024);    // ~400MB/s
+        return 80 + transfer;
+    }
+
+    transfer = ((int64_t)Request->Sectors * 512 * US_PER_MS) / (150 * 1024);        // ~150MB/s
+
+    if (Request->Lba == Disk->HeadLba) {
+        return transfer;
+    }
+
+    distance = (Request->Lba > Disk->HeadLba) ? Request->Lba - Disk->HeadLba : Disk->HeadLba - Request->Lba;
+
+    //
+    // Track to track seek plus a square root seek curve, plus half a
+    // revolution of a 7200 rpm disk.
+    //
+    return 1000 + (int64_t)(7000.0 * sqrt((double)distance / (double)Disk->Capacity)) + 4167 + transfer;
+}
+
+static void
+FifoInit(FIFO *Fifo)
+{
+    Fifo->Head = Fifo->Tail = -1;
+    Fifo->Count = 0;
+}
+
+static void
+FifoPush(FIFO *Fifo, REQUEST *Requests, int Index)
+{
+    Requests[Index].Next = -1;
+    if (Fifo->Tail < 0) {
+        Fifo->Head = Index;
+    } else {
+        Requests[Fifo->Tail].Next = Index;
+    }
+    Fifo->Tail = Index;
+    Fifo->Count++;
+}
+
+static int
+FifoPop(FIFO *Fifo, REQUEST *Requests)
+{
+    int index = Fifo->Head;
+
+    if (index >= 0) {
+        Fifo->Head = Requests[index].Next;
+        if (Fifo->Head < 0) {
+            Fifo->Tail = -1;
+        }
+        Fifo->Count--;
+    }
+    return index;
+}
+
+static void
+DiskStartNext(SCHED *Sched, int64_t Now)
+{
+    DISK *disk = &Sched->Disk;
+    REQUEST *request;
+
+    if (disk->InService >= 0 || disk->Queue.Count == 0) {
+        return;
+    }
+
+    disk->InService = FifoPop(&disk->Queue, Sched->Requests);
+    request = &Sched->Requests[disk->InService];
+    disk->BusyUntil = Now + DiskServiceTime(disk, request);
+    disk->HeadLba = request->Lba + request->Sectors;
+}
+
+static void
+DiskSubmit(SCHED *Sched, int Index, int64_t Now)
+{
+    DISK *disk = &Sched->Disk;
+
+    if (Sched->Requests[Index].Prio == PRIO_NORMAL &&
+        disk->InService >= 0 &&
+        Sched->Requests[disk->InService].Prio != PRIO_NORMAL) {
+        Sched->Interference++;
+    }
+
+    FifoPush(&disk->Queue, Sched->Requests, Index);
+    DiskStartNext(Sched, Now);
+}
+
+/*
+ * Scheduler, mirroring clntirp.c
+ */
+
+static unsigned
+IdleTicksRequired(const SCHED *Sched)
+{
+    return CLASS_IDLE_TIMER_TICKS + Sched->AnticipationTicks;
+}
+
+static int64_t
+IdleIntervalRequired(const SCHED *Sched)
+{
+    return (int64_t)Sched->IdleInterval + (int64_t)Sched->AnticipationTicks * Sched->IdleTimerInterval;
+}
+
+static int64_t
+GetIdleTime(const SCHED *Sched, int64_t Now)
+{
+    if (Sched->ActiveIoCount > 0) {
+        return 0;
+    }
+    return (Now - Sched->LastIoTime) / US_PER_MS;
+}
+
+static int
+IdleTicksSufficient(const SCHED *Sched, int64_t Now)
+{
+    if (Sched->ActiveIoCount > 0) {
+        return 0;
+    }
+    if (Sched->IdleTicks > IdleTicksRequired(Sched)) {
+        return 1;
+    }
+    if (Sched->IdleTicks < IdleTicksRequired(Sched)) {
+        return 0;
+    }
+    return GetIdleTime(Sched, Now) >= IdleIntervalRequired(Sched);
+}
+
+static void
+SchedInit(SCHED *Sched, POLICY Policy, REQUEST *Requests, int Rotational, uint64_t Capacity)
+{
+    int i;
+
+    memset(Sched, 0, sizeof(*Sched));
+    Sched->Policy = Policy;
+    Sched->Requests = Requests;
+
+    Sched->Disk.Rotational = Rotational;
+    Sched->Disk.Capacity = Capacity;
+    Sched->Disk.InService = -1;
+    FifoInit(&Sched->Disk.Queue);
+
+    Sched->IdleInterval = CLASS_IDLE_INTERVAL;
+    Sched->IdleTimerInterval = CLASS_IDLE_INTERVAL / CLASS_IDLE_TIMER_TICKS;
+    Sched->StarvationCount = CLASS_STARVATION_INTERVAL / Sched->IdleTimerInterval;
+    Sched->IdleActiveIoMax = CLASS_IDLE_ACTIVE_MAX;
+
+    for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+        IDLE_QUEUE *queue = &Sched->Queues[i];
+
+        FifoInit(&queue->List);
+        if (Policy == PolicySingle || i == CLASS_IDLE_CLASS_LOW) {
+            queue->Weight = CLASS_IDLE_LOW_WEIGHT;
+            queue->ActiveIoMax = Sched->IdleActiveIoMax;
+            queue->StarvationCount = Sched->StarvationCount;
+        } else {
+            queue->Weight = CLASS_IDLE_VERY_LOW_WEIGHT;
+            queue->ActiveIoMax = (Sched->IdleActiveIoMax / 2) ? Sched->IdleActiveIoMax / 2 : 1;
+            queue->StarvationCount = Sched->StarvationCount * 2;
+        }
+        queue->Credits = queue->Weight;
+    }
+
+    //
+    // ClasspUpdateIdleAnticipation
+    //
+    if (Policy == PolicyAnticipate && Rotational) {
+        Sched->AnticipationTicks = (CLASS_IDLE_ANTICIPATION_INTERVAL + Sched->IdleTimerInterval - 1) /
+                                   Sched->IdleTimerInterval;
+    }
+}
+
+static IDLE_QUEUE *
+QueueForRequest(SCHED *Sched, const REQUEST *Request)
+{
+    //
+    // The original scheduler has a single list; keep every request on the
+    // low class queue.
+    //
+    if (Sched->Policy == PolicySingle) {
+        return &Sched->Queues[CLASS_IDLE_CLASS_LOW];
+    }
+    return &Sched->Queues[Request->Prio];
+}
+
+static int
+AgeIdleQueues(SCHED *Sched)
+{
+    int starved = 0;
+    int i;
+
+    for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+        IDLE_QUEUE *queue = &Sched->Queues[i];
+
+        if (queue->List.Count > 0) {
+            if (++queue->StarvationTicks >= queue->StarvationCount) {
+                starved = 1;
+            }
+        } else {
+            queue->StarvationTicks = 0;
+        }
+    }
+    return starved;
+}
+
+static IDLE_QUEUE *
+SelectIdleQueue(SCHED *Sched, int Starved)
+{
+    IDLE_QUEUE *selected = NULL;
+    IDLE_QUEUE *queue;
+    int eligible = 0;
+    int i;
+
+    if (Starved) {
+        for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+            queue = &Sched->Queues[i];
+            if (queue->List.Count > 0 &&
+                (selected == NULL ||
+                 (uint64_t)queue->StarvationTicks * selected->StarvationCount >
+                 (uint64_t)selected->StarvationTicks * queue->StarvationCount)) {
+                selected = queue;
+            }
+        }
+        return selected;
+    }
+
+    for (i = CLASS_NUM_IDLE_CLASSES - 1; i >= 0; i--) {
+        queue = &Sched->Queues[i];
+        if (queue->List.Count > 0 && queue->ActiveIoCount < (int)queue->ActiveIoMax) {
+            eligible = 1;
+            if (queue->Credits > 0) {
+                return queue;
+            }
+        }
+    }
+
+    if (!eligible) {
+        return NULL;
+    }
+
+    for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+        Sched->Queues[i].Credits = Sched->Queues[i].Weight;
+    }
+
+    for (i = CLASS_NUM_IDLE_CLASSES - 1; i >= 0; i--) {
+        queue = &Sched->Queues[i];
+        if (queue->List.Count > 0 && queue->ActiveIoCount < (int)queue->ActiveIoMax) {
+            return queue;
+        }
+    }
+    return NULL;
+}
+
+static void
+ServiceIdleRequest(SCHED *Sched, int Starved, int64_t Now)
+{
+    IDLE_QUEUE *queue = NULL;
+    int index;
+
+    if (Sched->IdleIoCount > 0) {
+        if (Sched->Policy == PolicySingle) {
+            queue = &Sched->Queues[CLASS_IDLE_CLASS_LOW];
+        } else {
+            queue = SelectIdleQueue(Sched, Starved);
+        }
+    }
+
+    if (queue == NULL) {
+        return;
+    }
+
+    index = FifoPop(&queue->List, Sched->Requests);
+    if (queue->Credits > 0) {
+        queue->Credits--;
+    }
+    queue->StarvationTicks = 0;
+    Sched->IdleIoCount--;
+    if (Sched->IdleIoCount == 0) {
+        Sched->TimerStarted = 0;
+    }
+
+    Sched->ActiveIdleIoCount++;
+    queue->ActiveIoCount++;
+    DiskSubmit(Sched, index, Now);
+}
+
+static void
+StartIdleTimer(SCHED *Sched, int64_t IdleInterval, int64_t Now)
+{
+    if (!Sched->TimerStarted) {
+        Sched->TimerStarted = 1;
+        Sched->IdleTimerTicks = 0;
+        Sched->IdleTicks = (unsigned)(IdleInterval / Sched->IdleTimerInterval);
+        Sched->NextTick = Now + (int64_t)Sched->IdleTimerInterval * US_PER_MS;
+    }
+}
+
+static void
+EnqueueIdleRequest(SCHED *Sched, int Index, int64_t Now)
+{
+    IDLE_QUEUE *queue = QueueForRequest(Sched, &Sched->Requests[Index]);
+    int64_t idleInterval = GetIdleTime(Sched, Now);
+    int issue = 1;
+
+    if (idleInterval >= IdleIntervalRequired(Sched)) {
+        idleInterval = (int64_t)Sched->IdleTimerInterval * IdleTicksRequired(Sched);
+    } else {
+        issue = 0;
+    }
+
+    if (Sched->ActiveIdleIoCount >= (int)Sched->IdleActiveIoMax ||
+        queue->ActiveIoCount >= (int)queue->ActiveIoMax) {
+        issue = 0;
+    }
+
+    FifoPush(&queue->List, Sched->Requests, Index);
+    Sched->IdleIoCount++;
+    StartIdleTimer(Sched, idleInterval, Now);
+
+    if (issue) {
+        ServiceIdleRequest(Sched, 0, Now);
+    }
+}
+
+static void
+IdleTimerTick(SCHED *Sched, int64_t Now)
+{
+    int starved = 0;
+
+    if (Sched->Policy != PolicySingle) {
+        starved = AgeIdleQueues(Sched);
+    }
+
+    if (Sched->ActiveIoCount <= 0 && ++Sched->IdleTicks >= IdleTicksRequired(Sched)) {
+        if (Sched->ActiveIdleIoCount < (int)Sched->IdleActiveIoMax) {
+            Sched->IdleTimerTicks = 0;
+            ServiceIdleRequest(Sched, 0, Now);
+        }
+        return;
+    }
+
+    ++Sched->IdleTimerTicks;
+    if (Sched->Policy == PolicySingle) {
+        starved = (Sched->IdleTimerTicks >= Sched->StarvationCount);
+    }
+
+    if (starved) {
+        Sched->IdleTimerTicks = 0;
+        ServiceIdleRequest(Sched, 1, Now);
+    }
+}
+
+static void
+CompleteRequest(SCHED *Sched, int Index, int64_t Now)
+{
+    REQUEST *request = &Sched->Requests[Index];
+
+    request->Completion = Now;
+
+    if (request->Prio == PRIO_NORMAL) {
+        Sched->LastIoTime = Now;
+        Sched->IdleTicks = 0;
+        Sched->ActiveIoCount--;
+        return;
+    }
+
+    Sched->ActiveIdleIoCount--;
+    QueueForRequest(Sched, request)->ActiveIoCount--;
+
+    //
+    // ClasspCompleteIdleRequest
+    //
+    if (Sched->IdleIoCount > 0 &&
+        Sched->ActiveIdleIoCount < (int)Sched->IdleActiveIoMax &&
+        Sched->ActiveIoCount <= 0 &&
+        IdleTicksSufficient(Sched, Now)) {
+        ServiceIdleRequest(Sched, 0, Now);
+    }
+}
+
+/*
+ * Runs the trace to completion. Returns the time the last request completed.
+ */
+static int64_t
+Simulate(SCHED *Sched, int Count)
+{
+    int next = 0;
+    int64_t now = 0;
+
+    for (;;) {
+        int64_t arrival = (next < Count) ? Sched->Requests[next].Arrival : INT64_MAX;
+        int64_t completion = (Sched->Disk.InService >= 0) ? Sched->Disk.BusyUntil : INT64_MAX;
+        int64_t tick = Sched->TimerStarted ? Sched->NextTick : INT64_MAX;
+
+        if (arrival == INT64_MAX && completion == INT64_MAX && tick == INT64_MAX) {
+            break;
+        }
+
+        if (completion <= arrival && completion <= tick) {
+            int index = Sched->Disk.InService;
+
+            now = completion;
+            Sched->Disk.InService = -1;
+            CompleteRequest(Sched, index, now);
+            DiskStartNext(Sched, now);
+
+        } else if (arrival <= tick) {
+            now = arrival;
+            if (Sched->Requests[next].Prio == PRIO_NORMAL) {
+                Sched->ActiveIoCount++;
+                DiskSubmit(Sched, next, now);
+            } else {
+                EnqueueIdleRequest(Sched, next, now);
+            }
+            next++;
+
+        } else {
+            now = tick;
+            Sched->NextTick += (int64_t)Sched->IdleTimerInterval * US_PER_MS;
+            IdleTimerTick(Sched, now);
+        }
+    }
+
+    return now;
+}
+
+/*
+ * Statistics
+ */
+
+typedef struct _STATS {
+    unsigned Count;
+    unsigned Incomplete;
+    double Mean;
+    int64_t P50;
+    int64_t P99;
+    int64_t Max;
+} STATS;
+
+static int
+CompareInt64(const void *A, const void *B)
+{
+    int64_t a = *(const int64_t *)A;
+    int64_t b = *(const int64_t *)B;
+
+    return (a > b) - (a < b);
+}
+
+static void
+ComputeStats(const REQUEST *Requests, int Count, STATS Stats[NUM_PRIOS])
+{
+    int64_t *latencies = malloc(sizeof(int64_t) * (Count ? Count : 1));
+    int prio;
+    int i;
+
+    for (prio = 0; prio < NUM_PRIOS; prio++) {
+        STATS *stats = &Stats[prio];
+        double sum = 0;
+        unsigned n = 0;
+
+        memset(stats, 0, sizeof(*stats));
+        for (i = 0; i < Count; i++) {
+            if (Requests[i].Prio != prio) {
+                continue;
+            }
+            stats->Count++;
+            if (Requests[i].Completion < Requests[i].Arrival) {
+                stats->Incomplete++;
+                continue;
+            }
+            latencies[n] = Requests[i].Completion - Requests[i].Arrival;
+            sum += (double)latencies[n];
+            n++;
+        }
+
+        if (n) {
+            qsort(latencies, n, sizeof(int64_t), CompareInt64);
+            stats->Mean = sum / n;
+            stats->P50 = latencies[n / 2];
+            stats->P99 = latencies[(n * 99) / 100];
+            stats->Max = latencies[n - 1];
+        }
+    }
+
+    free(latencies);
+}
+
+/*
+ * Traces
+ */
+
+static void
+TraceAdd(TRACE *Trace, int64_t Arrival, int Prio, uint64_t Lba, uint32_t Sectors)
+{
+    REQUEST *request;
+
+    if (Trace->Count == Trace->Capacity) {
+        Trace->Capacity = Trace->Capacity ? Trace->Capacity * 2 : 1024;
+        Trace->Requests = realloc(Trace->Requests, sizeof(REQUEST) * Trace->Capacity);
+        if (!Trace->Requests) {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+
+    request = &Trace->Requests[Trace->Count++];
+    memset(request, 0, sizeof(*request));
+    request->Arrival = Arrival;
+    request->Prio = Prio;
+    request->Lba = Lba;
+    request->Sectors = Sectors;
+}
+
+static int
+CompareArrival(const void *A, const void *B)
+{
+    const REQUEST *a = A;
+    const REQUEST *b = B;
+
+    return (a->Arrival > b->Arrival) - (a->Arrival < b->Arrival);
+}
+
+static uint64_t RandomState;
+
+static uint64_t
+Random64(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return RandomState;
+}
+
+static double
+RandomUnit(void)
+{
+    return (double)(Random64() >> 11) / 9007199254740992.0;
+}
+
+static int64_t
+RandomExp(double MeanUs)
+{
+    return (int64_t)(-log(1.0 - RandomUnit()) * MeanUs);
+}
+
+/*
+ * Generates a mixed workload: bursts of random normal priority reads close
+ * to a hot region with think time between them, a steady trickle of low
+ * priority random reads (eg. an indexer), and a backlog of very low priority
+ * sequential transfers (eg. a defragmenter).
+ */
+static void
+GenerateTrace(TRACE *Trace, uint64_t Seed, int64_t DurationUs, uint64_t Capacity)
+{
+    int64_t t;
+    uint64_t lba;
+
+    RandomState = Seed ? Seed : 1;
+
+    for (t = 0; t < DurationUs; ) {
+        int burst = 1 + (int)(Random64() % 16);
+        uint64_t hot = (Random64() % (Capacity / 8)) & ~7ull;
+
+        while (burst-- && t < DurationUs) {
+            TraceAdd(Trace, t, PRIO_NORMAL, (hot + (Random64() % 65536)) & ~7ull, 8 + 8 * (uint32_t)(Random64() % 8));
+            t += RandomExp(3000.0);
+        }
+        t += 10000 + RandomExp(60000.0);
+    }
+
+    for (t = RandomExp(40000.0); t < DurationUs; t += RandomExp(40000.0)) {
+        TraceAdd(Trace, t, CLASS_IDLE_CLASS_LOW, (Random64() % Capacity) & ~7ull, 8 + 8 * (uint32_t)(Random64() % 4));
+    }
+
+    lba = (Random64() % Capacity) & ~7ull;
+    for (t = 0; t < DurationUs; t += RandomExp(25000.0)) {
+        TraceAdd(Trace, t, CLASS_IDLE_CLASS_VERY_LOW, lba, 256);
+        lba = (lba + 256) % Capacity;
+    }
+
+    qsort(Trace->Requests, Trace->Count, sizeof(REQUEST), CompareArrival);
+}
+
+static int
+PrioFromChar(char C)
+{
+    int prio;
+
+    for (prio = 0; prio < NUM_PRIOS; prio++) {
+        if (PrioChars[prio] == C) {
+            return prio;
+        }
+    }
+    return -1;
+}
+
+static int
+ReadTrace(FILE *File, TRACE *Trace)
+{
+    char line[256];
+    unsigned lineNumber = 0;
+
+    while (fgets(line, sizeof(line), File)) {
+        long long arrival;
+        unsigned long long lba;
+        unsigned sectors;
+        char prio;
+
+        lineNumber++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+
+        if (sscanf(line, "%lld %c %llu %u", &arrival, &prio, &lba, &sectors) != 4 ||
+            PrioFromChar(prio) < 0 ||
+            arrival < 0 ||
+            sectors == 0 ||
+            (Trace->Count > 0 && arrival < Trace->Requests[Trace->Count - 1].Arrival)) {
+            fprintf(stderr, "trace line %u: malformed or out of order\n", lineNumber);
+            return 0;
+        }
+
+        TraceAdd(Trace, arrival, PrioFromChar(prio), lba, sectors);
+    }
+
+    return 1;
+}
+
+static void
+WriteTrace(FILE *File, const TRACE *Trace)
+{
+    int i;
+
+    fprintf(File, "# arrival_us prio lba sectors\n");
+    for (i = 0; i < Trace->Count; i++) {
+        const REQUEST *request = &Trace->Requests[i];
+
+        fprintf(File, "%lld %c %llu %u\n",
+                (long long)request->Arrival,
+                PrioChars[request->Prio],
+                (unsigned long long)request->Lba,
+                request->Sectors);
+    }
+}
+
+/*
+ * Runs one policy over a private copy of the trace.
+ */
+typedef struct _RESULT {
+    STATS Stats[NUM_PRIOS];
+    uint64_t Interference;
+    int64_t Makespan;
+} RESULT;
+
+static void
+RunPolicy(const TRACE *Trace, POLICY Policy, int Rotational, uint64_t Capacity, RESULT *Result)
+{
+    REQUEST *requests = malloc(sizeof(REQUEST) * (Trace->Count ? Trace->Count : 1));
+    SCHED sched;
+    int i;
+
+    memcpy(requests, Trace->Requests, sizeof(REQUEST) * Trace->Count);
+    for (i = 0; i < Trace->Count; i++) {
+        requests[i].Completion = -1;
+    }
+
+    SchedInit(&sched, Policy, requests, Rotational, Capacity);
+    Result->Makespan = Simulate(&sched, Trace->Count);
+    Result->Interference = sched.Interference;
+    ComputeStats(requests, Trace->Count, Result->Stats);
+
+    free(requests);
+}
+
+static void
+PrintResults(const TRACE *Trace, int Rotational, uint64_t Capacity)
+{
+    RESULT result;
+    int policy;
+    int prio;
+
+    printf("%s media, %d requests\n", Rotational ? "rotational" : "solid state", Trace->Count);
+    printf("%-11s %-9s %8s %10s %10s %10s %10s\n", "policy", "class", "count", "mean ms", "p50 ms", "p99 ms", "max ms");
+
+    for (policy = 0; policy < PolicyCount; policy++) {
+        RunPolicy(Trace, (POLICY)policy, Rotational, Capacity, &result);
+
+        for (prio = NUM_PRIOS - 1; prio >= 0; prio--) {
+            const STATS *stats = &result.Stats[prio];
+
+            printf("%-11s %-9s %8u %10.2f %10.2f %10.2f %10.2f\n",
+                   PolicyNames[policy],
+                   PrioNames[prio],
+                   stats->Count,
+                   stats->Mean / US_PER_MS,
+                   (double)stats->P50 / US_PER_MS,
+                   (double)stats->P99 / US_PER_MS,
+                   (double)stats->Max / US_PER_MS);
+        }
+        printf("%-11s normal requests queued behind idle I/O: %llu, makespan %.1f s\n",
+               PolicyNames[policy],
+               (unsigned long long)result.Interference,
+               (double)result.Makespan / 1e6);
+    }
+    printf("\n");
+}
+
+/*
+ * Self test: checks invariants of the scheduler model over a generated
+ * trace, and that a trace survives a write/read round trip.
+ */
+#define CHECK(c) \
+    do { if (!(c)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); failures++; } } while (0)
+
+static int
+SelfTest(void)
+{
+    const uint64_t capacity = 1ull << 31;     // 1TB in sectors
+    TRACE trace = { 0 };
+    TRACE reread = { 0 };
+    RESULT results[2][PolicyCount];
+    FILE *file;
+    int failures = 0;
+    int rotational;
+    int policy;
+    int prio;
+    int i;
+
+    GenerateTrace(&trace, 1, 120 * 1000000ll, capacity);
+
+    file = tmpfile();
+    CHECK(file != NULL);
+    if (file) {
+        WriteTrace(file, &trace);
+        rewind(file);
+        CHECK(ReadTrace(file, &reread));
+        fclose(file);
+        CHECK(reread.Count == trace.Count);
+        for (i = 0; i < trace.Count && i < reread.Count; i++) {
+            if (reread.Requests[i].Arrival != trace.Requests[i].Arrival ||
+                reread.Requests[i].Prio != trace.Requests[i].Prio ||
+                reread.Requests[i].Lba != trace.Requests[i].Lba ||
+                reread.Requests[i].Sectors != trace.Requests[i].Sectors) {
+                CHECK(!"trace round trip mismatch");
+                break;
+            }
+        }
+    }
+
+    for (rotational = 0; rotational < 2; rotational++) {
+        for (policy = 0; policy < PolicyCount; policy++) {
+            RunPolicy(&trace, (POLICY)policy, rotational, capacity, &results[rotational][policy]);
+
+            //
+            // Every request must complete: neither class may be starved
+            // indefinitely.
+            //
+            for (prio = 0; prio < NUM_PRIOS; prio++) {
+                CHECK(results[rotational][policy].Stats[prio].Incomplete == 0);
+                CHECK(results[rotational][policy].Stats[prio].Count > 0);
+            }
+        }
+
+        //
+        // With weighted classes, low priority I/O must fare better than very
+        // low priority I/O, which the single queue doesn't distinguish.
+        //
+        CHECK(results[rotational][PolicyClasses].Stats[CLASS_IDLE_CLASS_LOW].Mean <
+              results[rotational][PolicyClasses].Stats[CLASS_IDLE_CLASS_VERY_LOW].Mean);
+        CHECK(results[rotational][PolicyClasses].Stats[CLASS_IDLE_CLASS_LOW].Mean <
+              results[rotational][PolicySingle].Stats[CLASS_IDLE_CLASS_LOW].Mean);
+    }
+
+    //
+    // Anticipation only applies to seek penalty media ...
+    //
+    CHECK(memcmp(&results[0][PolicyClasses], &results[0][PolicyAnticipate], sizeof(RESULT)) == 0);
+
+    //
+    // ... where it must reduce the number of normal requests that find an
+    // idle request in service.
+    //
+    CHECK(results[1][PolicyAnticipate].Interference < results[1][PolicyClasses].Interference);
+
+    free(trace.Requests);
+    free(reread.Requests);
+
+    printf("idlesim self test: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr,
+            "usage: idlesim --selftest\n"
+            "       idlesim --generate <seed> <seconds>      write a trace to stdout\n"
+            "       idlesim [--ssd] [--capacity <sectors>] <trace file | ->\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    uint64_t capacity = 1ull << 31;
+    int rotational = 1;
+    TRACE trace = { 0 };
+    FILE *file;
+    int i;
+
+    if (argc == 2 && strcmp(argv[1], "--selftest") == 0) {
+        return SelfTest();
+    }
+
+    if (argc == 4 && strcmp(argv[1], "--generate") == 0) {
+        GenerateTrace(&trace, strtoull(argv[2], NULL, 0), strtoll(argv[3], NULL, 0) * 1000000ll, capacity);
+        WriteTrace(stdout, &trace);
+        free(trace.Requests);
+        return 0;
+    }
+
+    for (i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--ssd") == 0) {
+            rotational = 0;
+        } else if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc - 1) {
+            capacity = strtoull(argv[++i], NULL, 0);
+        } else {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (i != argc - 1 || capacity == 0) {
+        Usage();
+        return 2;
+    }
+
+    file = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+    if (!file) {
+        perror(argv[i]);
+        return 2;
+    }
+
+    if (!ReadTrace(file, &trace)) {
+        return 2;
+    }
+
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    PrintResults(&trace, rotational, capacity);
+    free(trace.Requests);
+    return 0;
+}
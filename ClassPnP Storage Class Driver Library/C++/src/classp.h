@@ -106,6 +106,9 @@ extern ULONG ClassMaxInterleavePerCriticalIo;
 #define CLASSP_REG_IDLE_INTERVAL_NAME               (L"IdleInterval")
 #define CLASSP_REG_IDLE_ACTIVE_MAX                  (L"IdleOutstandingIoMax")
 #define CLASSP_REG_IDLE_PRIORITY_SUPPORTED          (L"IdlePrioritySupported")
+#define CLASSP_REG_IDLE_LOW_WEIGHT                  (L"IdleLowPriorityWeight")
+#define CLASSP_REG_IDLE_VERY_LOW_WEIGHT             (L"IdleVeryLowPriorityWeight")
+#define CLASSP_REG_IDLE_ANTICIPATION_INTERVAL       (L"IdleAnticipationInterval")
 #define CLASSP_REG_ACCESS_ALIGNMENT_NOT_SUPPORTED   (L"AccessAlignmentQueryNotSupported")
 #define CLASSP_REG_DISBALE_IDLE_POWER_NAME          (L"DisableIdlePowerManagement")
 #define CLASSP_REG_IDLE_TIMEOUT_IN_SECONDS          (L"IdleTimeoutInSeconds")
@@ -607,6 +610,64 @@ typedef struct _TRANSFER_PACKET {
 #define MAX_CLEANUP_TRANSFER_PACKETS_AT_ONCE         8192
 
 
+/*
+ *  Idle requests are scheduled in one of CLASS_NUM_IDLE_CLASSES classes,
+ *  selected by the I/O priority hint of the request. When the disk is idle,
+ *  classes share dispatches in proportion to their Weight (a class gets
+ *  Weight requests per round), each class is limited to ActiveIoMax
+ *  outstanding requests, and a class that has waited StarvationCount timer
+ *  ticks without being serviced gets one request sent regardless of
+ *  disk activity.
+ */
+#define CLASS_IDLE_CLASS_VERY_LOW   0
+#define CLASS_IDLE_CLASS_LOW        1
+#define CLASS_NUM_IDLE_CLASSES      2
+
+typedef struct _CLASS_IDLE_QUEUE {
+
+    //
+    // Queued requests of this class
+    //
+    LIST_ENTRY IrpList;
+
+    //
+    // Number of requests in IrpList
+    //
+    ULONG IoCount;
+
+    //
+    // Number of requests of this class outstanding in the port driver
+    //
+    LONG ActiveIoCount;
+
+    //
+    // Max number of outstanding requests of this class
+    //
+    USHORT ActiveIoMax;
+
+    //
+    // Dispatches granted to this class per scheduling round
+    //
+    USHORT Weight;
+
+    //
+    // Dispatches left in the current scheduling round
+    //
+    USHORT Credits;
+
+    //
+    // Idle timer ticks before a waiting request of this class is forcibly
+    // issued
+    //
+    USHORT StarvationCount;
+
+    //
+    // Idle timer ticks since this class was last serviced
+    //
+    ULONG StarvationTicks;
+
+} CLASS_IDLE_QUEUE, *PCLASS_IDLE_QUEUE;
+
 //
 // !!! WARNING !!!
 // DO NOT use the following structure in code outside of classpnp
@@ -821,9 +882,9 @@ struct _CLASS_PRIVATE_FDO_DATA {
     KSPIN_LOCK IdleListLock;
 
     //
-    // Queue for low priority I/O
+    // Queues for low priority I/O, one per idle scheduling class
     //
-    LIST_ENTRY IdleIrpList;
+    CLASS_IDLE_QUEUE IdleQueues[CLASS_NUM_IDLE_CLASSES];
 
     //
     // Timer for low priority I/O
@@ -898,6 +959,19 @@ struct _CLASS_PRIVATE_FDO_DATA {
     //
     LONG ActiveIdleIoCount;
 
+    //
+    // Additional idle time (ms) to wait after the last non-idle request on
+    // media that incurs a seek penalty, in anticipation of a following
+    // non-idle request close to the previous one.
+    //
+    USHORT IdleAnticipationInterval;
+
+    //
+    // Additional idle timer ticks currently required before issuing idle
+    // requests. Zero unless the media is known to incur a seek penalty.
+    //
+    USHORT IdleAnticipationTicks;
+
     //
     // Support for class drivers to extend
     // the interpret sense information routine
@@ -1096,6 +1170,9 @@ typedef struct _IO_RETRIED_LOG_MESSAGE_CONTEXT {
 #define CLASS_IDLE_INTERVAL         50          // 50 milliseconds
 #define CLASS_STARVATION_INTERVAL   500         // 500 milliseconds
 #define CLASS_IDLE_TIMER_TICKS      4
+#define CLASS_IDLE_LOW_WEIGHT       4
+#define CLASS_IDLE_VERY_LOW_WEIGHT  1
+#define CLASS_IDLE_ANTICIPATION_INTERVAL 20     // 20 milliseconds
 
 
 /*
@@ -1135,6 +1212,16 @@ ClasspIsIdleRequestSupported(
     return ((ioPriority <= IoPriorityLow) && (FdoData->IdlePrioritySupported == TRUE));
 }
 
+__inline
+ULONG
+ClasspGetIdleClass(
+    PIRP Irp
+    )
+{
+    IO_PRIORITY_HINT ioPriority = IoGetIoPriorityHint(Irp);
+    return ((ioPriority <= IoPriorityVeryLow) ? CLASS_IDLE_CLASS_VERY_LOW : CLASS_IDLE_CLASS_LOW);
+}
+
 __inline
 VOID
 ClasspMarkIrpAsIdle(
@@ -2177,6 +2264,12 @@ ClasspCompleteIdleRequest(
     PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
     );
 
+VOID
+ClasspUpdateIdleAnticipation(
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
+    BOOLEAN IncursSeekPenalty
+    );
+
 NTSTATUS
 ClasspPriorityHint(
     PDEVICE_OBJECT DeviceObject,
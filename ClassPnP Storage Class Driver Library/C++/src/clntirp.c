@@ -45,14 +45,46 @@ KDEFERRED_ROUTINE ClasspIdleTimerDpc;
 VOID
 ClasspServiceIdleRequest(
     PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
-    BOOLEAN PostToDpc
+    BOOLEAN PostToDpc,
+    BOOLEAN Starved
     );
 
 PIRP
 ClasspDequeueIdleRequest(
-    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
+    BOOLEAN Starved
+    );
+
+BOOLEAN
+ClasspAgeIdleQueues(
+    IN PCLASS_PRIVATE_FDO_DATA FdoData
     );
 
+PCLASS_IDLE_QUEUE
+ClasspSelectIdleQueue(
+    IN PCLASS_PRIVATE_FDO_DATA FdoData,
+    IN BOOLEAN Starved
+    );
+
+__inline
+ULONG
+ClasspIdleTicksRequired(
+    PCLASS_PRIVATE_FDO_DATA FdoData
+    )
+{
+    return CLASS_IDLE_TIMER_TICKS + FdoData->IdleAnticipationTicks;
+}
+
+__inline
+ULONGLONG
+ClasspIdleIntervalRequired(
+    PCLASS_PRIVATE_FDO_DATA FdoData
+    )
+{
+    return (ULONGLONG)FdoData->IdleInterval +
+           ((ULONGLONG)FdoData->IdleAnticipationTicks * FdoData->IdleTimerInterval);
+}
+
 
 /*++
 
@@ -181,6 +213,11 @@ ClasspInitializeIdleTimer(
     ULONG idleInterval = CLASS_IDLE_INTERVAL;
     ULONG idlePrioritySupported = TRUE;
     ULONG activeIdleIoMax = 1;
+    ULONG lowWeight = CLASS_IDLE_LOW_WEIGHT;
+    ULONG veryLowWeight = CLASS_IDLE_VERY_LOW_WEIGHT;
+    ULONG anticipationInterval = CLASS_IDLE_ANTICIPATION_INTERVAL;
+    PCLASS_IDLE_QUEUE idleQueue;
+    ULONG i;
 
     ClassGetDeviceParameter(FdoExtension,
                             CLASSP_REG_SUBKEY_NAME,
@@ -218,7 +255,6 @@ ClasspInitializeIdleTimer(
     KeInitializeSpinLock(&fdoData->IdleListLock);
     KeInitializeTimer(&fdoData->IdleTimer);
     KeInitializeDpc(&fdoData->IdleDpc, ClasspIdleTimerDpc, FdoExtension);
-    InitializeListHead(&fdoData->IdleIrpList);
     fdoData->IdleTimerStarted = FALSE;
     fdoData->IdleTimerInterval = (USHORT) (idleInterval / CLASS_IDLE_TIMER_TICKS);
     fdoData->StarvationCount = CLASS_STARVATION_INTERVAL / fdoData->IdleTimerInterval;
@@ -246,6 +282,102 @@ ClasspInitializeIdleTimer(
 
     fdoData->IdleActiveIoMax = (USHORT)activeIdleIoMax;
 
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_IDLE_LOW_WEIGHT,
+                            &lowWeight);
+
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_IDLE_VERY_LOW_WEIGHT,
+                            &veryLowWeight);
+
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_IDLE_ANTICIPATION_INTERVAL,
+                            &anticipationInterval);
+
+    //
+    // Set up the idle scheduling classes. Low priority requests get the full
+    // idle depth and the regular starvation deadline; very low priority
+    // requests get at most half the depth and twice the deadline.
+    //
+    for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+        idleQueue = &fdoData->IdleQueues[i];
+
+        InitializeListHead(&idleQueue->IrpList);
+        idleQueue->IoCount = 0;
+        idleQueue->ActiveIoCount = 0;
+        idleQueue->StarvationTicks = 0;
+
+        if (i == CLASS_IDLE_CLASS_LOW) {
+            idleQueue->Weight = (USHORT)min(max(lowWeight, 1), USHORT_MAX);
+            idleQueue->ActiveIoMax = fdoData->IdleActiveIoMax;
+            idleQueue->StarvationCount = fdoData->StarvationCount;
+        } else {
+            idleQueue->Weight = (USHORT)min(max(veryLowWeight, 1), USHORT_MAX);
+            idleQueue->ActiveIoMax = max(fdoData->IdleActiveIoMax / 2, 1);
+            idleQueue->StarvationCount = (USHORT)min(fdoData->StarvationCount * 2, USHORT_MAX);
+        }
+
+        idleQueue->Credits = idleQueue->Weight;
+    }
+
+    //
+    // Anticipatory idling only takes effect once the media is known to incur
+    // a seek penalty, see ClasspUpdateIdleAnticipation.
+    //
+    fdoData->IdleAnticipationInterval = (USHORT)min(anticipationInterval, USHORT_MAX);
+    fdoData->IdleAnticipationTicks = 0;
+
+    return;
+}
+
+/*++
+
+ClasspUpdateIdleAnticipation
+
+Routine Description:
+
+    Enable or disable anticipatory idling for the given device. On media that
+    incurs a seek penalty, non-idle requests tend to arrive close together and
+    close to each other on the media, so issuing an idle request as soon as the
+    disk goes idle is likely to move the head away right before the next
+    non-idle request. For such media, wait an additional
+    IdleAnticipationInterval before idle requests are issued.
+
+Arguments:
+
+    FdoExtension        - Pointer to the device extension
+    IncursSeekPenalty   - TRUE if the media incurs a seek penalty
+
+Return Value:
+
+    None
+
+--*/
+VOID
+ClasspUpdateIdleAnticipation(
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
+    BOOLEAN IncursSeekPenalty
+    )
+{
+    PCLASS_PRIVATE_FDO_DATA fdoData = FdoExtension->PrivateFdoData;
+    USHORT anticipationTicks = 0;
+
+    if (fdoData->IdlePrioritySupported == FALSE) {
+        return;
+    }
+
+    if (IncursSeekPenalty) {
+        anticipationTicks = (USHORT)((fdoData->IdleAnticipationInterval + fdoData->IdleTimerInterval - 1) /
+                                     fdoData->IdleTimerInterval);
+    }
+
+    TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_TIMER, "ClasspUpdateIdleAnticipation: Anticipation ticks %u for disk %p\n", anticipationTicks, FdoExtension));
+
+    fdoData->IdleAnticipationTicks = anticipationTicks;
+
     return;
 }
 
@@ -439,7 +571,7 @@ ClasspIdleTicksSufficient (
     // the last non-idle request, enough idle time has passed.
     //
 
-    if (FdoData->IdleTicks > CLASS_IDLE_TIMER_TICKS) {
+    if (FdoData->IdleTicks > ClasspIdleTicksRequired(FdoData)) {
         return TRUE;
     }
 
@@ -447,7 +579,7 @@ ClasspIdleTicksSufficient (
     // If there have not been enough timer ticks, then there has not been
     // enough idle time.
     //
-    if (FdoData->IdleTicks < CLASS_IDLE_TIMER_TICKS) {
+    if (FdoData->IdleTicks < ClasspIdleTicksRequired(FdoData)) {
         return FALSE;
     }
 
@@ -458,13 +590,13 @@ ClasspIdleTicksSufficient (
     // request can complete at any time in the middle of the timer period (half
     // on average) so on the next timer expiration, IdleTicks will transition
     // 0->1 without its full time having passed since the completion of the last
-    // non-idle request. So when IdleTicks is exactly CLASS_IDLE_TIMER_TICKS,
-    // explicitly check whether an idle request should be issued now or on the
-    // next timer expiration.
+    // non-idle request. So when IdleTicks is exactly the required number of
+    // ticks, explicitly check whether an idle request should be issued now or
+    // on the next timer expiration.
     //
     idleInterval = ClasspGetIdleTime(FdoData);
 
-    if (idleInterval >= FdoData->IdleInterval) {
+    if (idleInterval >= ClasspIdleIntervalRequired(FdoData)) {
         return TRUE;
     }
 
@@ -482,10 +614,9 @@ Routine Description:
     if it goes above 1 (i.e., disk is in idle state) then
     it will service an idle request.
 
-    This function will increment IdleTimerTicks if the IdleTicks
-    does not go above 1 (i.e., disk is not in idle state). When it
-    reaches the starvation idle count (1 second) it will process
-    one idle request.
+    This function will age every idle class with pending requests.
+    If the disk is not in idle state and a class reaches its
+    starvation count, one request of that class is processed.
 
 Arguments:
 
@@ -509,6 +640,7 @@ ClasspIdleTimerDpc(
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = Context;
     PCLASS_PRIVATE_FDO_DATA fdoData;
+    BOOLEAN starved;
 
     UNREFERENCED_PARAMETER(Dpc);
     UNREFERENCED_PARAMETER(SystemArgument1);
@@ -521,8 +653,10 @@ ClasspIdleTimerDpc(
 
     fdoData = fdoExtension->PrivateFdoData;
 
+    starved = ClasspAgeIdleQueues(fdoData);
+
     if ((fdoData->ActiveIoCount <= 0) &&
-        (++fdoData->IdleTicks >= CLASS_IDLE_TIMER_TICKS)) {
+        (++fdoData->IdleTicks >= ClasspIdleTicksRequired(fdoData))) {
 
         //
         // If there are max active idle request, do not issue another one here.
@@ -542,31 +676,170 @@ ClasspIdleTimerDpc(
             // timer counter.
             //
             fdoData->IdleTimerTicks = 0;
-            ClasspServiceIdleRequest(fdoExtension, FALSE);
+            ClasspServiceIdleRequest(fdoExtension, FALSE, FALSE);
         }
         return;
     }
 
     //
-    // If the timer is running then there must be at least one idle priority I/O pending
+    // If the timer is running then there must be at least one idle priority I/O pending.
+    // Send one request of the most starved class once its deadline expired.
     //
-    if (++fdoData->IdleTimerTicks >= fdoData->StarvationCount) {
+    ++fdoData->IdleTimerTicks;
+    if (starved) {
         fdoData->IdleTimerTicks = 0;
         TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_TIMER, "ClasspIdleTimerDpc: Starvation timer. Send one idle request\n"));
-        ClasspServiceIdleRequest(fdoExtension, FALSE);
+        ClasspServiceIdleRequest(fdoExtension, FALSE, TRUE);
     }
     return;
 }
 
 /*++
 
+ClasspAgeIdleQueues
+
+Routine Description:
+
+    Called once per idle timer tick. Increments the starvation tick count of
+    every idle class that has requests waiting.
+
+    Called from the idle timer DPC at DISPATCH_LEVEL. Takes the IdleListLock,
+    which protects the idle queue counters.
+
+Arguments:
+
+    FdoData - Pointer to the private fdo data
+
+Return Value:
+
+    TRUE if at least one class has reached its starvation count.
+
+--*/
+BOOLEAN
+ClasspAgeIdleQueues(
+    IN PCLASS_PRIVATE_FDO_DATA FdoData
+    )
+{
+    PCLASS_IDLE_QUEUE idleQueue;
+    BOOLEAN starved = FALSE;
+    ULONG i;
+
+    KeAcquireSpinLockAtDpcLevel(&FdoData->IdleListLock);
+
+    for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+        idleQueue = &FdoData->IdleQueues[i];
+
+        if (idleQueue->IoCount > 0) {
+            if (++idleQueue->StarvationTicks >= idleQueue->StarvationCount) {
+                starved = TRUE;
+            }
+        } else {
+            idleQueue->StarvationTicks = 0;
+        }
+    }
+
+    KeReleaseSpinLockFromDpcLevel(&FdoData->IdleListLock);
+
+    return starved;
+}
+
+/*++
+
+ClasspSelectIdleQueue
+
+Routine Description:
+
+    Pick the idle class the next idle request should be taken from.
+
+    In the regular case, classes are served in weighted round robin order:
+    each class may issue up to Weight requests per round, subject to its
+    depth limit; once no eligible class has credits left, a new round is
+    started. In the starved case, the class that has waited the longest
+    relative to its starvation count is chosen, ignoring weights and depth
+    limits.
+
+    Caller must hold the IdleListLock.
+
+Arguments:
+
+    FdoData - Pointer to the private fdo data
+    Starved - TRUE if called to service a class whose deadline expired
+
+Return Value:
+
+    Pointer to the selected idle class or NULL if none is eligible.
+
+--*/
+PCLASS_IDLE_QUEUE
+ClasspSelectIdleQueue(
+    IN PCLASS_PRIVATE_FDO_DATA FdoData,
+    IN BOOLEAN Starved
+    )
+{
+    PCLASS_IDLE_QUEUE idleQueue;
+    PCLASS_IDLE_QUEUE selected = NULL;
+    BOOLEAN eligible = FALSE;
+    LONG i;
+
+    if (Starved) {
+        for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+            idleQueue = &FdoData->IdleQueues[i];
+            if ((idleQueue->IoCount > 0) &&
+                ((selected == NULL) ||
+                 ((idleQueue->StarvationTicks * selected->StarvationCount) >
+                  (selected->StarvationTicks * idleQueue->StarvationCount)))) {
+                selected = idleQueue;
+            }
+        }
+        return selected;
+    }
+
+    //
+    // Prefer higher priority classes within a round.
+    //
+    for (i = CLASS_NUM_IDLE_CLASSES - 1; i >= 0; i--) {
+        idleQueue = &FdoData->IdleQueues[i];
+        if ((idleQueue->IoCount > 0) &&
+            (idleQueue->ActiveIoCount < idleQueue->ActiveIoMax)) {
+            eligible = TRUE;
+            if (idleQueue->Credits > 0) {
+                return idleQueue;
+            }
+        }
+    }
+
+    if (!eligible) {
+        return NULL;
+    }
+
+    //
+    // Every eligible class has used up its share, start a new round.
+    //
+    for (i = 0; i < CLASS_NUM_IDLE_CLASSES; i++) {
+        FdoData->IdleQueues[i].Credits = FdoData->IdleQueues[i].Weight;
+    }
+
+    for (i = CLASS_NUM_IDLE_CLASSES - 1; i >= 0; i--) {
+        idleQueue = &FdoData->IdleQueues[i];
+        if ((idleQueue->IoCount > 0) &&
+            (idleQueue->ActiveIoCount < idleQueue->ActiveIoMax)) {
+            selected = idleQueue;
+            break;
+        }
+    }
+
+    return selected;
+}
+
+/*++
+
 ClasspEnqueueIdleRequest
 
 Routine Description:
 
-    This function will insert the idle request into the list.
-    If the inserted reqeust is the first request then it will
-    start the timer.
+    This function will insert the idle request into the list of
+    its idle class. If the inserted reqeust is the first request
+    then it will start the timer.
 
 Arguments:
 
@@ -586,6 +859,7 @@ ClasspEnqueueIdleRequest(
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = DeviceObject->DeviceExtension;
     PCLASS_PRIVATE_FDO_DATA fdoData = fdoExtension->PrivateFdoData;
+    PCLASS_IDLE_QUEUE idleQueue = &fdoData->IdleQueues[ClasspGetIdleClass(Irp)];
     KIRQL oldIrql;
     BOOLEAN issueRequest = TRUE;
     ULONGLONG idleInterval;
@@ -603,8 +877,8 @@ ClasspEnqueueIdleRequest(
     //
     idleInterval = ClasspGetIdleTime(fdoData);
 
-    if (idleInterval >= fdoData->IdleInterval) {
-        idleInterval = fdoData->IdleTimerInterval * CLASS_IDLE_TIMER_TICKS;
+    if (idleInterval >= ClasspIdleIntervalRequired(fdoData)) {
+        idleInterval = fdoData->IdleTimerInterval * ClasspIdleTicksRequired(fdoData);
     } else {
         issueRequest = FALSE;
     }
@@ -613,19 +887,21 @@ ClasspEnqueueIdleRequest(
     // If there are already max active idle requests in the port driver, then
     // queue this idle request.
     //
-    if (fdoData->ActiveIdleIoCount >= fdoData->IdleActiveIoMax) {
+    if ((fdoData->ActiveIdleIoCount >= fdoData->IdleActiveIoMax) ||
+        (idleQueue->ActiveIoCount >= idleQueue->ActiveIoMax)) {
         issueRequest = FALSE;
     }
 
     TracePrint((TRACE_LEVEL_VERBOSE, TRACE_FLAG_TIMER, "ClasspEnqueueIdleRequest: Diff time %I64d\n", idleInterval));
 
     KeAcquireSpinLock(&fdoData->IdleListLock, &oldIrql);
-    if (IsListEmpty(&fdoData->IdleIrpList)) {
-        NT_ASSERT(fdoData->IdleIoCount == 0);
+    if (IsListEmpty(&idleQueue->IrpList)) {
+        NT_ASSERT(idleQueue->IoCount == 0);
     }
-    InsertTailList(&fdoData->IdleIrpList, &Irp->Tail.Overlay.ListEntry);
+    InsertTailList(&idleQueue->IrpList, &Irp->Tail.Overlay.ListEntry);
 
 
+    idleQueue->IoCount++;
     fdoData->IdleIoCount++;
     if (!fdoData->IdleTimerStarted) {
         ClasspStartIdleTimer(fdoData, idleInterval);
@@ -639,7 +915,7 @@ ClasspEnqueueIdleRequest(
     KeReleaseSpinLock(&fdoData->IdleListLock, oldIrql);
 
     if (issueRequest) {
-        ClasspServiceIdleRequest(fdoExtension, FALSE);
+        ClasspServiceIdleRequest(fdoExtension, FALSE, FALSE);
     }
 
     return STATUS_PENDING;
@@ -651,12 +927,14 @@ ClasspDequeueIdleRequest
 
 Routine Description:
 
-    This function will remove the next idle request from the list.
-    If there are no requests in the queue, then it will return NULL.
+    This function will remove the next idle request from the list
+    of the idle class chosen by ClasspSelectIdleQueue. If there are
+    no eligible requests in the queue, then it will return NULL.
 
 Arguments:
 
     FdoExtension         - Pointer to the functional device extension
+    Starved              - TRUE to service the most starved class
 
 Return Value:
 
@@ -665,10 +943,12 @@ Return Value:
 --*/
 PIRP
 ClasspDequeueIdleRequest(
-    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
+    BOOLEAN Starved
     )
 {
     PCLASS_PRIVATE_FDO_DATA fdoData = FdoExtension->PrivateFdoData;
+    PCLASS_IDLE_QUEUE idleQueue = NULL;
     PLIST_ENTRY listEntry = NULL;
     PIRP irp = NULL;
     KIRQL oldIrql;
@@ -676,14 +956,23 @@ ClasspDequeueIdleRequest(
     KeAcquireSpinLock(&fdoData->IdleListLock, &oldIrql);
 
     if (fdoData->IdleIoCount > 0) {
-        listEntry = RemoveHeadList(&fdoData->IdleIrpList);
+        idleQueue = ClasspSelectIdleQueue(fdoData, Starved);
+    }
+
+    if (idleQueue != NULL) {
+        listEntry = RemoveHeadList(&idleQueue->IrpList);
         //
         // Make sure we actaully removed a request from the list
         //
-        NT_ASSERT(listEntry != &fdoData->IdleIrpList);
+        NT_ASSERT(listEntry != &idleQueue->IrpList);
         //
-        // Decrement the idle I/O count.
+        // Charge the class for this dispatch and decrement the idle I/O counts.
         //
+        if (idleQueue->Credits > 0) {
+            idleQueue->Credits--;
+        }
+        idleQueue->StarvationTicks = 0;
+        idleQueue->IoCount--;
         fdoData->IdleIoCount--;
         //
         // Stop the timer on last request
@@ -738,7 +1027,7 @@ ClasspCompleteIdleRequest(
         (fdoData->ActiveIoCount <= 0) &&
         (ClasspIdleTicksSufficient(fdoData))) {
         TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_TIMER, "ClasspCompleteIdleRequest: Service next idle reqeusts\n"));
-        ClasspServiceIdleRequest(FdoExtension, TRUE);
+        ClasspServiceIdleRequest(FdoExtension, TRUE, FALSE);
     }
 
     return;
@@ -758,6 +1047,7 @@ Arguments:
 
     FdoExtension    - Pointer to the device extension
     PostToDpc       - Flag to pass to ServiceTransferRequest to indicate if request must be posted to a DPC
+    Starved         - TRUE to service the most starved class regardless of weights and depth limits
 
 Return Value:
 
@@ -767,12 +1057,13 @@ Return Value:
 VOID
 ClasspServiceIdleRequest(
     PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
-    BOOLEAN PostToDpc
+    BOOLEAN PostToDpc,
+    BOOLEAN Starved
     )
 {
     PIRP irp;
 
-    irp = ClasspDequeueIdleRequest(FdoExtension);
+    irp = ClasspDequeueIdleRequest(FdoExtension, Starved);
     if (irp != NULL) {
         ServiceTransferRequest(FdoExtension->DeviceObject, irp, PostToDpc);
     }
@@ -2252,6 +2252,10 @@ NTSTATUS ClasspDeviceSeekPenaltyProperty(
                 status = IncursSeekPenalty(fdoExtension->FunctionSupportInfo->DeviceCharacteristicsData.MediumRotationRate, &incursSeekPenalty);
             }
 
+            if (NT_SUCCESS(status)) {
+                ClasspUpdateIdleAnticipation(fdoExtension, incursSeekPenalty);
+            }
+
             fdoExtension->FunctionSupportInfo->DeviceCharacteristicsData.CommandStatus = status;
 
             // data is ready in fdoExtension
@@ -2280,6 +2284,11 @@ NTSTATUS ClasspDeviceSeekPenaltyProperty(
             fdoExtension->FunctionSupportInfo->LowerLayerSupport.SeekPenaltyProperty = Supported;
             information = (ULONG)Irp->IoStatus.Information;
 
+            if (NT_SUCCESS(status) &&
+                (information >= RTL_SIZEOF_THROUGH_FIELD(DEVICE_SEEK_PENALTY_DESCRIPTOR, IncursSeekPenalty))) {
+                ClasspUpdateIdleAnticipation(fdoExtension, seekPenalty->IncursSeekPenalty);
+            }
+
 
             goto Exit;
         }
@@ -798,6 +798,7 @@ NTSTATUS SubmitTransferPacket(PTRANSFER_PACKET Pkt)
         idleRequest = ClasspIsIdleRequest(Pkt->OriginalIrp);
         if (idleRequest) {
             InterlockedIncrement(&fdoData->ActiveIdleIoCount);
+            InterlockedIncrement(&fdoData->IdleQueues[ClasspGetIdleClass(Pkt->OriginalIrp)].ActiveIoCount);
         } else {
             InterlockedIncrement(&fdoData->ActiveIoCount);
         }
@@ -832,6 +833,7 @@ NTSTATUS TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PVOID Co
         if (idleRequest) {
             InterlockedDecrement(&fdoData->ActiveIdleIoCount);
             NT_ASSERT(fdoData->ActiveIdleIoCount >= 0);
+            InterlockedDecrement(&fdoData->IdleQueues[ClasspGetIdleClass(pkt->OriginalIrp)].ActiveIoCount);
         } else {
             fdoData->LastIoTime = ClasspGetCurrentTime(NULL);
             fdoData->IdleTicks = 0;
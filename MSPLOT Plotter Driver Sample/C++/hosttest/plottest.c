@@ -0,0 +1,1619 @@
+/*++
+
+Copyright (c) 1990-2003  Microsoft Corporation
+
+
+Module Name:
+
+    plottest.c
+
+
+Abstract:
+
+    Host test and benchmark of the plotter's RTL scan line compression
+    (../plotter/compress.c) and 1bpp bitmap rotation (../plotter/transpos.c),
+    which are built unchanged against the stand-ins in shim/.
+
+    usage: plottest --selftest
+           plottest [--seconds s] [--raster file --width cb]
+
+    The self test checks that:
+
+    - CompressToDelta and CompressToTIFF give byte for byte the output of the
+      byte at a time encoders they replaced (kept below as RefCompressToDelta
+      and RefCompressToTIFF), for random scans and for every short scan of
+      three byte values, and that the output decodes back to the scan.
+
+    - TransPos1BPP gives byte for byte the output of the table driven
+      rotation it replaced (RefTransPos1BPP), for both directions, every
+      DestXStart and any number of source lines, and leaves pSrc the same.
+
+    - Whole bitmaps sent through EnterRTLScans, OutputRTLScans and
+      ExitRTLScans, in row, block and adaptive compression, decode from the
+      RTL stream back to the bitmap.
+
+    Otherwise plottest reports MB/s for the old and new encoders and
+    rotation, over a synthetic 36 inch, 600 dpi halftoned raster or over a
+    raw 1bpp raster read from a file.
+
+
+[Environment:]
+
+    Host (user mode), C99.
+
+
+--*/
+
+#include "precomp.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+static int  g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if (!(X)) {                                                             \
+                                                                            \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+#define TIFF_MIN_REPEATS            3
+#define TIFF_MAX_REPEATS            128
+#define TIFF_MAX_LITERAL            128
+#define DELTA_MAX_ONE_REPLACE       8
+#define DELTA_MAX_1ST_OFFSET        31
+#define ADAPT_METHOD_ZERO           4
+#define ADAPT_METHOD_DUP            5
+#define SIZE_ADAPT_CONTROL          3
+
+static uint32_t g_Seed = 48;
+
+static uint32_t
+Random(
+    VOID
+    )
+{
+    g_Seed ^= g_Seed << 13;
+    g_Seed ^= g_Seed >> 17;
+    g_Seed ^= g_Seed << 5;
+
+    return(g_Seed);
+}
+
+
+
+//
+// The encoders as they were before compress.c compared a word at a time,
+// without the debug output
+//
+
+static LONG
+RefCompressToDelta(
+    LPBYTE  pbSrc,
+    LPBYTE  pbSeedRow,
+    LPBYTE  pbDst,
+    LONG    Size
+    )
+{
+    LPBYTE  pbDstBeg;
+    LPBYTE  pbDstEnd;
+    LPBYTE  pbTmp;
+    LONG    cSrcBytes;
+    LONG    Offset = 0;
+    UINT    cReplace;
+    BOOL    DoReplace;
+
+
+    cSrcBytes = Size;
+    pbDstBeg  = pbDst;
+    pbDstEnd  = pbDst + Size;
+    cReplace  = 0;
+    pbTmp     = pbSrc;
+
+    while (cSrcBytes--) {
+
+        if (*pbSrc != *pbSeedRow) {
+
+            if (++cReplace == 1) {
+
+                Offset = (LONG)(pbSrc - pbTmp);
+                pbTmp  = pbSrc;
+            }
+
+            DoReplace = (BOOL)((cReplace >= DELTA_MAX_ONE_REPLACE) ||
+                               (!cSrcBytes));
+
+        } else {
+
+            DoReplace = (BOOL)cReplace;
+        }
+
+        if (DoReplace) {
+
+            if ((LONG)(pbDstEnd - pbDst) <= (LONG)cReplace) {
+
+                return(-Size);
+            }
+
+            *pbDst = (BYTE)((cReplace - 1) << 5);
+
+            if (Offset < DELTA_MAX_1ST_OFFSET) {
+
+                *pbDst++ |= (BYTE)Offset;
+
+            } else {
+
+                *pbDst++ |= (BYTE)DELTA_MAX_1ST_OFFSET;
+                Offset   -= DELTA_MAX_1ST_OFFSET;
+
+                do {
+
+                    if (pbDst >= pbDstEnd) {
+
+                        return(-Size);
+                    }
+
+                    *pbDst++ = (BYTE)((Offset >= 255) ? 255 : Offset);
+
+                } while ((Offset -= 255) >= 0);
+            }
+
+            if ((pbDstEnd         < pbDst   ) ||
+                (pbDstEnd - pbDst < (LONG_PTR)cReplace)) {
+
+                return(-Size);
+            }
+
+            CopyMemory(pbDst, pbTmp, cReplace);
+
+            pbDst    += cReplace;
+            pbTmp    += cReplace;
+            cReplace  = 0;
+        }
+
+        ++pbSrc;
+        ++pbSeedRow;
+    }
+
+    return((LONG)(pbDst - pbDstBeg));
+}
+
+
+
+static LONG
+RefCompressToTIFF(
+    LPBYTE  pbSrc,
+    LPBYTE  pbDst,
+    LONG    Size
+    )
+{
+    LPBYTE  pbSrcBeg;
+    LPBYTE  pbSrcEnd;
+    LPBYTE  pbDstBeg;
+    LPBYTE  pbDstEnd;
+    LPBYTE  pbLastRepeat;
+    LPBYTE  pbTmp;
+    LONG    RepeatCount;
+    LONG    LiteralCount;
+    LONG    CurSize;
+    BYTE    LastSrc;
+
+
+    pbSrcBeg     = pbSrc;
+    pbSrcEnd     = pbSrc + Size;
+    pbDstBeg     = pbDst;
+    pbDstEnd     = pbDst + Size;
+    pbLastRepeat = pbSrc;
+
+    while (pbSrcBeg < pbSrcEnd) {
+
+        pbTmp   = pbSrcBeg;
+        LastSrc = *pbTmp++;
+
+        while ((pbTmp < pbSrcEnd) &&
+               (*pbTmp == LastSrc)) {
+
+            ++pbTmp;
+        }
+
+        if (((RepeatCount = (LONG)(pbTmp - pbSrcBeg)) >= TIFF_MIN_REPEATS) ||
+            (pbTmp >= pbSrcEnd)) {
+
+            LiteralCount = (LONG)(pbSrcBeg - pbLastRepeat);
+
+            if ((pbTmp >= pbSrcEnd) &&
+                (RepeatCount)       &&
+                (LastSrc == 0)) {
+
+                if (RepeatCount == Size) {
+
+                    return(0);
+                }
+
+                RepeatCount = 0;
+
+            } else if (RepeatCount < TIFF_MIN_REPEATS) {
+
+                LiteralCount += RepeatCount;
+                RepeatCount   = 0;
+            }
+
+            while (LiteralCount) {
+
+                if ((CurSize = LiteralCount) > TIFF_MAX_LITERAL) {
+
+                    CurSize = TIFF_MAX_LITERAL;
+                }
+
+                if ((pbDstEnd - pbDst) <= CurSize) {
+
+                    return(-Size);
+                }
+
+                *pbDst++ = (BYTE)(CurSize - 1);
+
+                CopyMemory(pbDst, pbLastRepeat, CurSize);
+
+                pbDst        += CurSize;
+                pbLastRepeat += CurSize;
+                LiteralCount -= CurSize;
+            }
+
+            while (RepeatCount) {
+
+                if ((CurSize = RepeatCount) > TIFF_MAX_REPEATS) {
+
+                    CurSize = TIFF_MAX_REPEATS;
+                }
+
+                if ((pbDstEnd - pbDst) < 2) {
+
+                    return(-Size);
+                }
+
+                *pbDst++ = (BYTE)(1 - CurSize);
+                *pbDst++ = (BYTE)LastSrc;
+
+                if ((RepeatCount -= CurSize) < TIFF_MIN_REPEATS) {
+
+                    pbTmp       -= RepeatCount;
+                    RepeatCount  = 0;
+                }
+            }
+
+            pbLastRepeat = pbTmp;
+        }
+
+        pbSrcBeg = pbTmp;
+    }
+
+    return((LONG)(pbDst - pbDstBeg));
+}
+
+
+
+//
+// The rotation as it was before transpos.c worked in 8x8 blocks. Each source
+// byte is looked up in a table of its 8 bits spread out one to a byte.
+//
+
+static DWORD    g_TP8x8[256 * 2];
+
+static VOID
+RefBuild8x8TransPosTable(
+    VOID
+    )
+{
+    LPBYTE  pbData = (LPBYTE)g_TP8x8;
+    WORD    Entry;
+    WORD    Bits;
+
+
+    for (Entry = 0; Entry < 256; Entry++) {
+
+        Bits = (WORD)Entry | (WORD)0xff00;
+
+        while (Bits & 0x0100) {
+
+            *pbData++   = (BYTE)(Bits & 0x01);
+            Bits      >>= 1;
+        }
+    }
+}
+
+
+
+static BOOL
+RefTransPos1BPP(
+    PTPINFO pTPInfo
+    )
+{
+    LPBYTE  pSrc;
+    TPINFO  TPInfo;
+    INT     RemainBits;
+    INT     cbNextDest;
+    union {
+        BYTE    b[8];
+        DWORD   dw[2];
+    } TPData;
+
+
+    TPInfo             = *pTPInfo;
+    TPInfo.DestXStart &= 0x07;
+
+    pSrc         = TPInfo.pSrc;
+    RemainBits   = (INT)(7 - TPInfo.DestXStart);
+    cbNextDest   = (INT)((TPInfo.cbDestScan > 0) ? 1 : -1);
+    TPData.dw[0] =
+    TPData.dw[1] = 0;
+
+    while (TPInfo.cySrc--) {
+
+        LPDWORD pdwTmp;
+        LPBYTE  pbTmp;
+
+        pdwTmp        = g_TP8x8 + ((UINT)*pSrc << 1);
+        TPData.dw[0]  = (TPData.dw[0] << 1) | *(pdwTmp + 0);
+        TPData.dw[1]  = (TPData.dw[1] << 1) | *(pdwTmp + 1);
+        pSrc         += TPInfo.cbSrcScan;
+
+        if (!TPInfo.cySrc) {
+
+            if (RemainBits) {
+
+                TPData.dw[0] <<= RemainBits;
+                TPData.dw[1] <<= RemainBits;
+
+                RemainBits     = 0;
+            }
+        }
+
+        if (RemainBits--) {
+
+            ;
+
+        } else {
+
+            *(pbTmp  = TPInfo.pDest     ) = TPData.b[0];
+            *(pbTmp += TPInfo.cbDestScan) = TPData.b[1];
+            *(pbTmp += TPInfo.cbDestScan) = TPData.b[2];
+            *(pbTmp += TPInfo.cbDestScan) = TPData.b[3];
+            *(pbTmp += TPInfo.cbDestScan) = TPData.b[4];
+            *(pbTmp += TPInfo.cbDestScan) = TPData.b[5];
+            *(pbTmp += TPInfo.cbDestScan) = TPData.b[6];
+            *(pbTmp +  TPInfo.cbDestScan) = TPData.b[7];
+
+            RemainBits    = 7;
+            TPData.dw[0]  =
+            TPData.dw[1]  = 0;
+            TPInfo.pDest += cbNextDest;
+        }
+    }
+
+    pTPInfo->pSrc -= cbNextDest;
+
+    return(TRUE);
+}
+
+
+
+//
+// Decoders for the compressed scan lines. Each returns FALSE if the data is
+// malformed or does not fit in the scan line.
+//
+
+static BOOL
+DecodeDelta(
+    LPBYTE  pbRow,
+    LPBYTE  pbData,
+    LONG    cbData,
+    LONG    Size
+    )
+
+/*++
+
+    pbRow holds the seed row on entry and the decoded row on return
+
+--*/
+
+{
+    LPBYTE  pbEnd = pbData + cbData;
+    LONG    Pos = 0;
+
+
+    while (pbData < pbEnd) {
+
+        UINT    cReplace = (UINT)(*pbData >> 5) + 1;
+        LONG    Offset = *pbData++ & DELTA_MAX_1ST_OFFSET;
+
+        if (Offset == DELTA_MAX_1ST_OFFSET) {
+
+            BYTE    bMore;
+
+            do {
+
+                if (pbData >= pbEnd) {
+
+                    return(FALSE);
+                }
+
+                Offset += (bMore = *pbData++);
+
+            } while (bMore == 255);
+        }
+
+        Pos += Offset;
+
+        if ((Pos + (LONG)cReplace > Size) ||
+            ((LONG)cReplace > (LONG)(pbEnd - pbData))) {
+
+            return(FALSE);
+        }
+
+        CopyMemory(pbRow + Pos, pbData, cReplace);
+
+        Pos    += cReplace;
+        pbData += cReplace;
+    }
+
+    return(TRUE);
+}
+
+
+
+static BOOL
+DecodeTIFF(
+    LPBYTE  pbRow,
+    LPBYTE  pbData,
+    LONG    cbData,
+    LONG    Size
+    )
+{
+    LPBYTE  pbEnd = pbData + cbData;
+    LONG    Pos = 0;
+
+
+    ZeroMemory(pbRow, Size);
+
+    while (pbData < pbEnd) {
+
+        INT     Control = (signed char)*pbData++;
+        LONG    Count;
+
+        if (Control >= 0) {
+
+            Count = Control + 1;
+
+            if ((Pos + Count > Size) || (Count > (LONG)(pbEnd - pbData))) {
+
+                return(FALSE);
+            }
+
+            CopyMemory(pbRow + Pos, pbData, Count);
+            pbData += Count;
+
+        } else if (Control > -128) {
+
+            Count = 1 - Control;
+
+            if ((Pos + Count > Size) || (pbData >= pbEnd)) {
+
+                return(FALSE);
+            }
+
+            memset(pbRow + Pos, *pbData++, Count);
+
+        } else {
+
+            Count = 0;
+        }
+
+        Pos += Count;
+    }
+
+    return(TRUE);
+}
+
+
+
+//
+// Output functions used by compress.c. Output goes through the PDEV output
+// buffer, as in output.c, and is flushed to the spool buffer.
+//
+
+static LPBYTE   g_pbSpool;
+static size_t   g_cbSpool;
+static size_t   g_cbSpoolMax;
+
+BOOL
+FlushOutBuffer(
+    PPDEV   pPDev
+    )
+{
+    if (pPDev->cbBufferBytes) {
+
+        if (g_cbSpool + pPDev->cbBufferBytes > g_cbSpoolMax) {
+
+            g_cbSpoolMax = (g_cbSpool + pPDev->cbBufferBytes) * 2;
+            g_pbSpool    = (LPBYTE)realloc(g_pbSpool, g_cbSpoolMax);
+
+            if (!g_pbSpool) {
+
+                printf("out of memory\n");
+                exit(1);
+            }
+        }
+
+        CopyMemory(g_pbSpool + g_cbSpool, pPDev->pOutBuffer, pPDev->cbBufferBytes);
+
+        g_cbSpool            += pPDev->cbBufferBytes;
+        pPDev->cbBufferBytes  = 0;
+    }
+
+    return(TRUE);
+}
+
+
+
+LONG
+OutputBytes(
+    PPDEV   pPDev,
+    LPBYTE  pBuf,
+    LONG    cBuf
+    )
+{
+    LONG    cTotal = cBuf;
+
+
+    while (cBuf > 0) {
+
+        LONG    cSize;
+
+        if (pPDev->cbBufferBytes >= OUTPUT_BUFFER_SIZE) {
+
+            FlushOutBuffer(pPDev);
+        }
+
+        if ((cSize = OUTPUT_BUFFER_SIZE - pPDev->cbBufferBytes) > cBuf) {
+
+            cSize = cBuf;
+        }
+
+        CopyMemory(pPDev->pOutBuffer + pPDev->cbBufferBytes, pBuf, cSize);
+
+        pPDev->cbBufferBytes += cSize;
+        pBuf                 += cSize;
+        cBuf                 -= cSize;
+    }
+
+    return(cTotal);
+}
+
+
+
+LONG
+OutputLONGParams(
+    PPDEV   pPDev,
+    PLONG   pNumbers,
+    UINT    cNumber,
+    BYTE    NumType
+    )
+{
+    LONG    cTotal = 0;
+    CHAR    Buf[16];
+
+
+    while (cNumber--) {
+
+        cTotal += OutputBytes(pPDev,
+                              (LPBYTE)Buf,
+                              (LONG)snprintf(Buf, sizeof(Buf), "%d", (int)*pNumbers++));
+
+        if ((cNumber) && (NumType >= 'a') && (NumType <= 'z')) {
+
+            cTotal += OutputBytes(pPDev, (LPBYTE)",", 1);
+        }
+    }
+
+    return(cTotal);
+}
+
+
+
+LONG
+cdecl
+OutputFormatStr(
+    PPDEV   pPDev,
+    LPCSTR  pszFormat,
+    ...
+    )
+{
+    va_list vaList;
+    LONG    cTotal = 0;
+
+
+    va_start(vaList, pszFormat);
+
+    while (*pszFormat) {
+
+        if ((*pszFormat == '#') && (pszFormat[1])) {
+
+            LONG    Number = va_arg(vaList, LONG);
+
+            cTotal    += OutputLONGParams(pPDev, &Number, 1, (BYTE)pszFormat[1]);
+            pszFormat += 2;
+
+        } else {
+
+            cTotal += OutputBytes(pPDev, (LPBYTE)pszFormat++, 1);
+        }
+    }
+
+    va_end(vaList);
+
+    return(cTotal);
+}
+
+
+
+//
+// Decode an RTL raster stream, as sent by OutputRTLScans, into cy scans of
+// Planes planes of cxBytes each. Returns the number of scans decoded or -1
+// if the stream is malformed.
+//
+
+static LONG
+DecodeRTLScans(
+    LPBYTE  pb,
+    size_t  cb,
+    DWORD   cxBytes,
+    DWORD   Planes,
+    LPBYTE  pbScans,
+    DWORD   cyMax
+    )
+{
+    LPBYTE  pbEnd = pb + cb;
+    LPBYTE  pbSeed[3];
+    DWORD   cy = 0;
+    DWORD   Plane = 0;
+    LONG    Mode = COMPRESS_MODE_ROW;
+    DWORD   i;
+
+
+    for (i = 0; i < 3; i++) {
+
+        pbSeed[i] = (LPBYTE)calloc(1, cxBytes);
+    }
+
+    while (pb < pbEnd) {
+
+        LONG    Number;
+        BYTE    Cmd;
+
+        if ((pbEnd - pb < 3) || (pb[0] != 0x1B) || (pb[1] != '*') || (pb[2] != 'b')) {
+
+            goto Malformed;
+        }
+
+        pb += 3;
+
+        do {
+
+            Number = 0;
+
+            if ((pb >= pbEnd) || (*pb < '0') || (*pb > '9')) {
+
+                goto Malformed;
+            }
+
+            while ((pb < pbEnd) && (*pb >= '0') && (*pb <= '9')) {
+
+                Number = Number * 10 + (*pb++ - '0');
+            }
+
+            if (pb >= pbEnd) {
+
+                goto Malformed;
+            }
+
+            if ((Cmd = *pb++) == 'm') {
+
+                Mode = Number;
+            }
+
+        } while (Cmd == 'm');
+
+        if (((Cmd != 'W') && (Cmd != 'V')) || (Number > (LONG)(pbEnd - pb))) {
+
+            goto Malformed;
+        }
+
+        if (Mode == COMPRESS_MODE_BLOCK) {
+
+            //
+            // The pixel width then every scan uncompressed
+            //
+
+            if ((Number < 4) || ((Number - 4) % (cxBytes * Planes))) {
+
+                goto Malformed;
+            }
+
+            for (i = 4; i < (DWORD)Number; i += cxBytes) {
+
+                if (cy >= cyMax) {
+
+                    goto Malformed;
+                }
+
+                CopyMemory(pbScans + ((size_t)cy * Planes + Plane) * cxBytes, pb + i, cxBytes);
+
+                if (++Plane == Planes) {
+
+                    Plane = 0;
+                    ++cy;
+                }
+            }
+
+        } else if (Mode == COMPRESS_MODE_ADAPT) {
+
+            LPBYTE  pbData = pb;
+            LPBYTE  pbDataEnd = pb + Number;
+
+            //
+            // The seed row starts at zero for each block
+            //
+
+            ZeroMemory(pbSeed[0], cxBytes);
+
+            while (pbData < pbDataEnd) {
+
+                BYTE    Method;
+                LONG    Count;
+
+                if (pbDataEnd - pbData < SIZE_ADAPT_CONTROL) {
+
+                    goto Malformed;
+                }
+
+                Method  = pbData[0];
+                Count   = (pbData[1] << 8) | pbData[2];
+                pbData += SIZE_ADAPT_CONTROL;
+
+                if ((Method == ADAPT_METHOD_ZERO) || (Method == ADAPT_METHOD_DUP)) {
+
+                    if (Method == ADAPT_METHOD_ZERO) {
+
+                        ZeroMemory(pbSeed[0], cxBytes);
+                    }
+
+                    while (Count--) {
+
+                        if (cy >= cyMax) {
+
+                            goto Malformed;
+                        }
+
+                        CopyMemory(pbScans + (size_t)cy++ * cxBytes, pbSeed[0], cxBytes);
+                    }
+
+                    continue;
+                }
+
+                if ((Count > (LONG)(pbDataEnd - pbData)) || (cy >= cyMax)) {
+
+                    goto Malformed;
+                }
+
+                if (Method == COMPRESS_MODE_ROW) {
+
+                    if (Count != (LONG)cxBytes) {
+
+                        goto Malformed;
+                    }
+
+                    CopyMemory(pbSeed[0], pbData, cxBytes);
+
+                } else if (Method == COMPRESS_MODE_TIFF) {
+
+                    if (!DecodeTIFF(pbSeed[0], pbData, Count, cxBytes)) {
+
+                        goto Malformed;
+                    }
+
+                } else if (Method == COMPRESS_MODE_DELTA) {
+
+                    if (!DecodeDelta(pbSeed[0], pbData, Count, cxBytes)) {
+
+                        goto Malformed;
+                    }
+
+                } else {
+
+                    goto Malformed;
+                }
+
+                CopyMemory(pbScans + (size_t)cy++ * cxBytes, pbSeed[0], cxBytes);
+                pbData += Count;
+            }
+
+        } else {
+
+            //
+            // One plane of one scan
+            //
+
+            if (cy >= cyMax) {
+
+                goto Malformed;
+            }
+
+            if (Mode == COMPRESS_MODE_DELTA) {
+
+                if (!DecodeDelta(pbSeed[Plane], pb, Number, cxBytes)) {
+
+                    goto Malformed;
+                }
+
+            } else if ((Mode == COMPRESS_MODE_TIFF) ||
+                       ((Mode == COMPRESS_MODE_ROW) && (Number == 0))) {
+
+                if (!DecodeTIFF(pbSeed[Plane], pb, Number, cxBytes)) {
+
+                    goto Malformed;
+                }
+
+            } else if ((Mode == COMPRESS_MODE_ROW) && (Number == (LONG)cxBytes)) {
+
+                CopyMemory(pbSeed[Plane], pb, cxBytes);
+
+            } else {
+
+                goto Malformed;
+            }
+
+            CopyMemory(pbScans + ((size_t)cy * Planes + Plane) * cxBytes, pbSeed[Plane], cxBytes);
+
+            if ((Cmd == 'W') != (Plane + 1 == Planes)) {
+
+                goto Malformed;
+            }
+
+            if (++Plane == Planes) {
+
+                Plane = 0;
+                ++cy;
+            }
+        }
+
+        pb += Number;
+    }
+
+    for (i = 0; i < 3; i++) {
+
+        free(pbSeed[i]);
+    }
+
+    return((LONG)cy);
+
+Malformed:
+
+    for (i = 0; i < 3; i++) {
+
+        free(pbSeed[i]);
+    }
+
+    return(-1);
+}
+
+
+
+//
+// Fill a scan line with the kind of data a halftoned plot has: runs of
+// white, runs of solid and dither patterns, and noise
+//
+
+static VOID
+MakeScan(
+    LPBYTE  pb,
+    LONG    Size,
+    UINT    Kind
+    )
+{
+    LONG    i = 0;
+
+
+    while (i < Size) {
+
+        LONG    Len = 1 + (LONG)(Random() % ((Kind == 0) ? 6 : 200));
+        UINT    What = Random() % 6;
+        BYTE    b = (What == 0) ? 0x00 :
+                    (What == 1) ? 0xFF :
+                    (What == 2) ? 0xAA : (BYTE)Random();
+
+        if (Kind == 2) {
+
+            b = (What < 3) ? 0x00 : 0xFF;
+        }
+
+        for (; (Len) && (i < Size); Len--, i++) {
+
+            pb[i] = (What == 5) ? (BYTE)Random() : b;
+        }
+    }
+}
+
+
+
+static VOID
+CheckCompression(
+    VOID
+    )
+{
+    static BYTE Src[6000];
+    static BYTE Seed[6000];
+    static BYTE Dst1[6000];
+    static BYTE Dst2[6000];
+    static BYTE Row[6000];
+    UINT        Iteration;
+
+
+    for (Iteration = 0; Iteration < 200000; Iteration++) {
+
+        LONG    Size = 1 + (LONG)(Random() % ((Iteration % 10 == 0) ? 5000 : 80));
+        LONG    cb1;
+        LONG    cb2;
+        UINT    i;
+
+        MakeScan(Src, Size, Random() % 3);
+
+        //
+        // The seed row is the same scan with a few changes, or another scan
+        //
+
+        CopyMemory(Seed, Src, Size);
+
+        for (i = (Random() % 5) * (1 + Random() % 20); i; i--) {
+
+            LONG    Pos = (LONG)(Random() % (UINT)Size);
+
+            Seed[Pos] = (Random() & 1) ? (BYTE)Random() : (BYTE)(Seed[Pos] ^ 1);
+        }
+
+        if (Random() % 5 == 0) {
+
+            MakeScan(Seed, Size, Random() % 3);
+        }
+
+        memset(Dst1, 0xCC, Size);
+        memset(Dst2, 0xCC, Size);
+
+        cb1 = RefCompressToDelta(Src, Seed, Dst1, Size);
+        cb2 = CompressToDelta(Src, Seed, Dst2, Size);
+
+        if ((cb1 != cb2) || ((cb1 > 0) && (memcmp(Dst1, Dst2, cb1)))) {
+
+            printf("CompressToDelta differs: iteration %u, size %d, %d != %d\n",
+                   Iteration, (int)Size, (int)cb2, (int)cb1);
+            g_failures++;
+            return;
+        }
+
+        if (cb2 >= 0) {
+
+            CopyMemory(Row, Seed, Size);
+            CHECK(DecodeDelta(Row, Dst2, cb2, Size) && !memcmp(Row, Src, Size));
+        }
+
+        memset(Dst1, 0xCC, Size);
+        memset(Dst2, 0xCC, Size);
+
+        cb1 = RefCompressToTIFF(Src, Dst1, Size);
+        cb2 = CompressToTIFF(Src, Dst2, Size);
+
+        if ((cb1 != cb2) || ((cb1 > 0) && (memcmp(Dst1, Dst2, cb1)))) {
+
+            printf("CompressToTIFF differs: iteration %u, size %d, %d != %d\n",
+                   Iteration, (int)Size, (int)cb2, (int)cb1);
+            g_failures++;
+            return;
+        }
+
+        if (cb2 >= 0) {
+
+            CHECK(DecodeTIFF(Row, Dst2, cb2, Size) && !memcmp(Row, Src, Size));
+        }
+    }
+}
+
+
+
+static VOID
+CheckShortScans(
+    VOID
+    )
+
+/*++
+
+    Every scan of up to 12 bytes made of 0x00, 0x01 and 0xFF, which covers
+    runs ending on and straddling each word boundary and the end of the scan
+
+--*/
+
+{
+    static const BYTE   Values[] = { 0x00, 0x01, 0xFF };
+    BYTE                Src[12];
+    BYTE                Zero[12];
+    BYTE                Dst1[12];
+    BYTE                Dst2[12];
+    LONG                Size;
+    LONG                cb1;
+    LONG                cb2;
+
+
+    ZeroMemory(Zero, sizeof(Zero));
+
+    for (Size = 1; Size <= (LONG)sizeof(Src); Size++) {
+
+        DWORD   cScans = 1;
+        DWORD   Scan;
+        LONG    i;
+
+        for (i = 0; i < Size; i++) {
+
+            cScans *= 3;
+        }
+
+        for (Scan = 0; Scan < cScans; Scan++) {
+
+            DWORD   Digits = Scan;
+
+            for (i = 0; i < Size; i++, Digits /= 3) {
+
+                Src[i] = Values[Digits % 3];
+            }
+
+            cb1 = RefCompressToTIFF(Src, Dst1, Size);
+            cb2 = CompressToTIFF(Src, Dst2, Size);
+
+            if ((cb1 == cb2) && ((cb1 <= 0) || (!memcmp(Dst1, Dst2, cb1)))) {
+
+                cb1 = RefCompressToDelta(Src, Zero, Dst1, Size);
+                cb2 = CompressToDelta(Src, Zero, Dst2, Size);
+            }
+
+            if ((cb1 != cb2) || ((cb1 > 0) && (memcmp(Dst1, Dst2, cb1)))) {
+
+                printf("short scan differs: size %d, scan %u\n", (int)Size, (UINT)Scan);
+                g_failures++;
+                return;
+            }
+        }
+    }
+}
+
+
+
+static VOID
+CheckRotation(
+    VOID
+    )
+{
+    static BYTE Src[4096];
+    static BYTE Dst1[4096];
+    static BYTE Dst2[4096];
+    PDEV        PDev;
+    UINT        Iteration;
+
+
+    ZeroMemory(&PDev, sizeof(PDev));
+
+    for (Iteration = 0; Iteration < 50000; Iteration++) {
+
+        DWORD   cySrc = 1 + Random() % 60;
+        LONG    cbSrcScan = 1 + (LONG)(Random() % 8);
+        DWORD   DestXStart = Random() % 16;
+        LONG    cbDestScan = (LONG)((cySrc + (DestXStart & 7) + 7) / 8 + Random() % 3);
+        BOOL    Left = (BOOL)(Random() & 1);
+        TPINFO  TP1;
+        TPINFO  TP2;
+        UINT    i;
+        UINT    Reps;
+
+        for (i = 0; i < sizeof(Src); i++) {
+
+            Src[i] = (BYTE)Random();
+        }
+
+        memset(Dst1, 0x5A, sizeof(Dst1));
+        memset(Dst2, 0x5A, sizeof(Dst2));
+
+        //
+        // Rotating left goes up the destination scans from the last one
+        //
+
+        TP1.pPDev      = &PDev;
+        TP1.pSrc       = Src + 8;
+        TP1.pDest      = Dst1 + ((Left) ? 8 * cbDestScan + 8 : 0);
+        TP1.cbSrcScan  = cbSrcScan;
+        TP1.cbDestScan = (Left) ? -cbDestScan : cbDestScan;
+        TP1.cySrc      = cySrc;
+        TP1.DestXStart = DestXStart;
+
+        TP2       = TP1;
+        TP2.pDest = Dst2 + (TP1.pDest - Dst1);
+
+        for (Reps = 1 + Random() % 3; Reps; Reps--) {
+
+            CHECK(RefTransPos1BPP(&TP1));
+            CHECK(TransPos1BPP(&TP2));
+        }
+
+        if ((memcmp(Dst1, Dst2, sizeof(Dst1))) || (TP1.pSrc - Src != TP2.pSrc - Src)) {
+
+            printf("TransPos1BPP differs: iteration %u, cySrc %u, DestXStart %u, %s\n",
+                   Iteration, (UINT)cySrc, (UINT)DestXStart, (Left) ? "left" : "right");
+            g_failures++;
+            return;
+        }
+
+        //
+        // Check the bits against the definition: destination scan n holds bit
+        // (1 << n) of every source scan, the first at bit DestXStart. Each
+        // call rotating right moves pSrc back a byte, to the next column.
+        //
+
+        if (!Left) {
+
+            LPBYTE  pbSrc = TP2.pSrc + 1;
+            DWORD   j;
+            DWORD   n;
+
+            for (j = 0; j < cySrc; j++) {
+
+                BYTE    bSrc = pbSrc[j * cbSrcScan];
+                DWORD   x = (DestXStart & 7) + j;
+
+                for (n = 0; n < 8; n++) {
+
+                    BYTE    bDst = Dst2[n * cbDestScan + x / 8];
+
+                    if (((bDst >> (7 - (x & 7))) & 1) != ((bSrc >> n) & 1)) {
+
+                        printf("TransPos1BPP bit wrong: iteration %u, scan %u, bit %u\n",
+                               Iteration, (UINT)j, (UINT)n);
+                        g_failures++;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+static VOID
+CheckRTLScans(
+    VOID
+    )
+{
+    static const DWORD  Widths[] = { 1, 7, 8, 33, 64, 65, 200, 1000, 8000, 40000 };
+    PDEV                PDev;
+    UINT                w;
+    UINT                Pass;
+    BYTE                OutBuffer[OUTPUT_BUFFER_SIZE];
+
+
+    ZeroMemory(&PDev, sizeof(PDev));
+    PDev.pOutBuffer = OutBuffer;
+
+    for (Pass = 0; Pass < 3; Pass++) {
+
+        BOOL    Mono = (Pass != 2);
+
+        PDev.bRTLMonoEncode5 = (Pass == 1);
+
+        for (w = 0; w < sizeof(Widths) / sizeof(Widths[0]); w++) {
+
+            DWORD       cx = Widths[w];
+            DWORD       cxBytes = (cx + 7) / 8;
+            DWORD       Planes = (Mono) ? 1 : 3;
+            DWORD       cy = (cxBytes > 1000) ? 60 : 300;
+            size_t      cbScan = (size_t)cxBytes * Planes;
+            LPBYTE      pbBitmap = (LPBYTE)malloc(cbScan * cy);
+            LPBYTE      pbDecoded = (LPBYTE)malloc(cbScan * cy);
+            RTLSCANS    RTLScans;
+            DWORD       y;
+            LONG        cyDecoded;
+            BYTE        Mask = (BYTE)~(0xFF >> (cx & 7));
+
+            if (!Mask) {
+
+                Mask = 0xFF;
+            }
+
+            //
+            // Scans repeat, go blank, change a little or change completely
+            //
+
+            for (y = 0; y < cy; y++) {
+
+                LPBYTE  pbScan = pbBitmap + y * cbScan;
+                UINT    What = Random() % 6;
+
+                if ((y) && (What < 2)) {
+
+                    CopyMemory(pbScan, pbScan - cbScan, cbScan);
+
+                } else if (What == 2) {
+
+                    ZeroMemory(pbScan, cbScan);
+
+                } else if ((y) && (What == 3)) {
+
+                    UINT    i;
+
+                    CopyMemory(pbScan, pbScan - cbScan, cbScan);
+
+                    for (i = 1 + Random() % 10; i; i--) {
+
+                        pbScan[Random() % cbScan] = (BYTE)Random();
+                    }
+
+                } else {
+
+                    MakeScan(pbScan, (LONG)cbScan, Random() % 3);
+                }
+            }
+
+            g_cbSpool = 0;
+
+            EnterRTLScans(&PDev, &RTLScans, cx, cy, Mono);
+
+            for (y = 0; y < cy; y++) {
+
+                LPBYTE  pbScan = pbBitmap + y * cbScan;
+
+                OutputRTLScans(&PDev,
+                               pbScan,
+                               (Mono) ? NULL : pbScan + cxBytes,
+                               (Mono) ? NULL : pbScan + 2 * cxBytes,
+                               &RTLScans);
+
+                CHECK(((RTLScans.Flags & RTLSF_MORE_SCAN) != 0) == (y + 1 < cy));
+            }
+
+            ExitRTLScans(&PDev, &RTLScans);
+            FlushOutBuffer(&PDev);
+
+            //
+            // OutputRTLScans masks the bits past cx in the last byte of each
+            // plane in the caller's scans
+            //
+
+            for (y = 0; y < cy * Planes; y++) {
+
+                CHECK((pbBitmap[y * cxBytes + cxBytes - 1] & (BYTE)~Mask) == 0);
+            }
+
+            cyDecoded = DecodeRTLScans(g_pbSpool, g_cbSpool, cxBytes, Planes, pbDecoded, cy);
+
+            if ((cyDecoded != (LONG)cy) || (memcmp(pbBitmap, pbDecoded, cbScan * cy))) {
+
+                printf("RTL scans do not decode: %s%s, cx %u, %d of %u scans\n",
+                       (Mono) ? "mono" : "color",
+                       (PDev.bRTLMonoEncode5) ? " adaptive" : "",
+                       (UINT)cx, (int)cyDecoded, (UINT)cy);
+                g_failures++;
+            }
+
+            free(pbBitmap);
+            free(pbDecoded);
+        }
+    }
+}
+
+
+
+static int
+SelfTest(
+    VOID
+    )
+{
+    CheckCompression();
+    CheckShortScans();
+    CheckRotation();
+    CheckRTLScans();
+
+    printf("plottest self test %s\n", (g_failures) ? "FAILED" : "passed");
+
+    return((g_failures) ? 1 : 0);
+}
+
+
+
+static double
+Now(
+    VOID
+    )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+
+static int
+Benchmark(
+    double  Seconds,
+    LPBYTE  pbRaster,
+    LONG    cbWidth,
+    LONG    cy
+    )
+{
+    LPBYTE  pbZero = (LPBYTE)calloc(1, cbWidth);
+    LPBYTE  pbDst = (LPBYTE)malloc(cbWidth);
+    LPBYTE  pbCol = (LPBYTE)malloc((size_t)((cy + 7) / 8) * 8);
+    UINT    Version;
+    PDEV    PDev;
+
+
+    ZeroMemory(&PDev, sizeof(PDev));
+
+    printf("raster %d x %d bytes\n", (int)cbWidth, (int)cy);
+
+    //
+    // Delta and TIFF of every scan against the one before, as RTLCompression
+    // does for a new scan
+    //
+
+    for (Version = 0; Version < 2; Version++) {
+
+        double  Start = Now();
+        double  Elapsed;
+        double  cbTotal = 0;
+        long    cbOut = 0;
+
+        do {
+
+            LONG    y;
+
+            for (y = 0; y < cy; y++) {
+
+                LPBYTE  pbScan = pbRaster + (size_t)y * cbWidth;
+                LPBYTE  pbSeed = (y) ? pbScan - cbWidth : pbZero;
+
+                LONG    cbDelta;
+                LONG    cbTIFF;
+
+                if (Version) {
+
+                    cbDelta = CompressToDelta(pbScan, pbSeed, pbDst, cbWidth);
+                    cbTIFF  = CompressToTIFF(pbScan, pbDst, cbWidth);
+
+                } else {
+
+                    cbDelta = RefCompressToDelta(pbScan, pbSeed, pbDst, cbWidth);
+                    cbTIFF  = RefCompressToTIFF(pbScan, pbDst, cbWidth);
+                }
+
+                //
+                // The bytes RTLCompression would send for the raster
+                //
+
+                if (cbTotal == 0) {
+
+                    cbDelta = (cbDelta < 0) ? cbWidth : cbDelta;
+                    cbTIFF  = (cbTIFF < 0) ? cbWidth : cbTIFF;
+                    cbOut  += (cbDelta < cbTIFF) ? cbDelta : cbTIFF;
+                }
+            }
+
+            cbTotal += (double)cbWidth * cy;
+            Elapsed  = Now() - Start;
+
+        } while (Elapsed < Seconds);
+
+        printf("%s delta+TIFF   %8.1f MB/s  %ld bytes out\n",
+               (Version) ? "new" : "old", cbTotal / Elapsed / 1e6, cbOut);
+    }
+
+    //
+    // Rotate the raster 90 degrees a byte column at a time, as
+    // Output1bppRotateHTBmp does
+    //
+
+    for (Version = 0; Version < 2; Version++) {
+
+        double  Start = Now();
+        double  Elapsed;
+        double  cbTotal = 0;
+
+        do {
+
+            LONG    x;
+
+            for (x = 0; x < cbWidth; x++) {
+
+                TPINFO  TPInfo;
+
+                TPInfo.pPDev      = &PDev;
+                TPInfo.pSrc       = pbRaster + x;
+                TPInfo.pDest      = pbCol;
+                TPInfo.cbSrcScan  = cbWidth;
+                TPInfo.cbDestScan = (cy + 7) / 8;
+                TPInfo.cySrc      = cy;
+                TPInfo.DestXStart = 0;
+
+                if (Version) {
+
+                    TransPos1BPP(&TPInfo);
+
+                } else {
+
+                    RefTransPos1BPP(&TPInfo);
+                }
+            }
+
+            cbTotal += (double)cbWidth * cy;
+            Elapsed  = Now() - Start;
+
+        } while (Elapsed < Seconds);
+
+        printf("%s rotation     %8.1f MB/s\n", (Version) ? "new" : "old", cbTotal / Elapsed / 1e6);
+    }
+
+    free(pbZero);
+    free(pbDst);
+    free(pbCol);
+
+    return(0);
+}
+
+
+
+static VOID
+MakeRaster(
+    LPBYTE  pbRaster,
+    LONG    cbWidth,
+    LONG    cy
+    )
+
+/*++
+
+    A plot: mostly white, with horizontal lines, dithered fill areas and a
+    little scattered detail on some scans
+
+--*/
+
+{
+    LONG    y;
+
+
+    for (y = 0; y < cy; y++) {
+
+        LPBYTE  pbScan = pbRaster + (size_t)y * cbWidth;
+        LONG    x;
+
+        for (x = 0; x < cbWidth; x++) {
+
+            if ((x > cbWidth / 3) && (x < cbWidth / 2) && (y % 50 < 30)) {
+
+                pbScan[x] = (y & 1) ? 0xAA : 0x55;
+
+            } else if ((y % 200 == 0) || ((x % 300) == 0)) {
+
+                pbScan[x] = 0xFF;
+
+            } else {
+
+                pbScan[x] = 0;
+            }
+        }
+
+        if (y % 7 == 0) {
+
+            for (x = 0; x < 20; x++) {
+
+                pbScan[Random() % (UINT)cbWidth] = (BYTE)Random();
+            }
+        }
+    }
+}
+
+
+
+int
+main(
+    int     argc,
+    char    *argv[]
+    )
+{
+    double  Seconds = 1;
+    LPCSTR  pszRaster = NULL;
+    LONG    cbWidth = 36 * 600 / 8;
+    LONG    cy = 2000;
+    LPBYTE  pbRaster;
+    int     Result;
+    int     i;
+
+
+    RefBuild8x8TransPosTable();
+
+    for (i = 1; i < argc; i++) {
+
+        if (!strcmp(argv[i], "--selftest")) {
+
+            return(SelfTest());
+
+        } else if ((!strcmp(argv[i], "--seconds")) && (i + 1 < argc)) {
+
+            Seconds = atof(argv[++i]);
+
+        } else if ((!strcmp(argv[i], "--raster")) && (i + 1 < argc)) {
+
+            pszRaster = argv[++i];
+
+        } else if ((!strcmp(argv[i], "--width")) && (i + 1 < argc)) {
+
+            cbWidth = atoi(argv[++i]);
+
+        } else {
+
+            printf("usage: plottest --selftest\n"
+                   "       plottest [--seconds s] [--raster file --width cb]\n");
+            return(2);
+        }
+    }
+
+    if (cbWidth <= 0) {
+
+        printf("bad width\n");
+        return(2);
+    }
+
+    if (pszRaster) {
+
+        FILE    *pFile = fopen(pszRaster, "rb");
+        long    cbFile;
+
+        if ((!pFile) ||
+            (fseek(pFile, 0, SEEK_END)) ||
+            ((cbFile = ftell(pFile)) < cbWidth) ||
+            (fseek(pFile, 0, SEEK_SET))) {
+
+            printf("cannot read %s\n", pszRaster);
+            return(1);
+        }
+
+        cy       = (LONG)(cbFile / cbWidth);
+        pbRaster = (LPBYTE)malloc((size_t)cy * cbWidth);
+
+        if ((!pbRaster) || (fread(pbRaster, cbWidth, cy, pFile) != (size_t)cy)) {
+
+            printf("cannot read %s\n", pszRaster);
+            return(1);
+        }
+
+        fclose(pFile);
+
+    } else {
+
+        pbRaster = (LPBYTE)malloc((size_t)cy * cbWidth);
+        MakeRaster(pbRaster, cbWidth, cy);
+    }
+
+    Result = Benchmark(Seconds, pbRaster, cbWidth, cy);
+
+    free(pbRaster);
+
+    return(Result);
+}
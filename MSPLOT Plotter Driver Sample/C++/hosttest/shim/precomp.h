@@ -0,0 +1,112 @@
+/*++
+
+Module Name:
+
+    precomp.h
+
+Abstract:
+
+    Minimal user mode stand-in for the plotter driver's precompiled header,
+    so that compress.c and transpos.c can be built and exercised on a host
+    without the WDK. The PDEV only has the fields those two modules use, and
+    the output functions they call are implemented by the test program.
+
+Environment:
+
+    Host (user mode), C99.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAR
+#define UNALIGNED
+#define cdecl
+#define _In_reads_(x)
+#define _In_reads_bytes_(x)
+#define _Out_writes_bytes_(x)
+#define _Inout_updates_bytes_(x)
+
+typedef void                    VOID, *LPVOID;
+typedef unsigned char           BYTE, *LPBYTE;
+typedef char                    CHAR;
+typedef const char             *LPCSTR;
+typedef unsigned short          WORD;
+typedef int32_t                 LONG, *PLONG;
+typedef uint32_t                DWORD, *LPDWORD;
+typedef int                     INT, BOOL;
+typedef unsigned int            UINT;
+typedef intptr_t                LONG_PTR;
+typedef uintptr_t               ULONG_PTR;
+typedef void                   *HLOCAL;
+
+#define TRUE                    1
+#define FALSE                   0
+
+#define LPTR                    0x0040
+#define LocalAlloc(f, cb)       calloc(1, (cb))
+#define LocalFree(p)            free(p)
+#define CopyMemory(d, s, cb)    memcpy((d), (s), (cb))
+#define ZeroMemory(d, cb)       memset((d), 0, (cb))
+
+#define ABS(x)                  (((x) < 0) ? -(x) : (x))
+
+//
+// Free build debug macros
+//
+
+#define DBG                     0
+#define DEFINE_DBGVAR(x)
+#define PLOTDBG(f, x)
+#define PLOTWARN(x)
+#define PLOTERR(x)
+#define PLOTASSERT(b, s, e, v)
+
+#define OUTPUT_BUFFER_SIZE      (32 * 1024)
+
+typedef struct _PDEV {
+    DWORD   Flags;
+    DWORD   cbBufferBytes;
+    LPBYTE  pOutBuffer;
+    BOOL    bRTLMonoEncode5;
+    } PDEV, *PPDEV;
+
+#define PDEVF_CANCEL_JOB        0x80000000
+#define PLOT_CANCEL_JOB(pPDev)  (pPDev->Flags & PDEVF_CANCEL_JOB)
+#define RTLMONOENCODE_5(pPDev)  (pPDev->bRTLMonoEncode5)
+
+BOOL
+FlushOutBuffer(
+    PPDEV   pPDev
+    );
+
+LONG
+OutputBytes(
+    PPDEV   pPDev,
+    LPBYTE  pBuf,
+    LONG    cBuf
+    );
+
+LONG
+OutputLONGParams(
+    PPDEV   pPDev,
+    PLONG   pNumbers,
+    UINT    cNumber,
+    BYTE    NumType
+    );
+
+LONG
+cdecl
+OutputFormatStr(
+    PPDEV   pPDev,
+    LPCSTR  pszFormat,
+    ...
+    );
+
+#include "compress.h"
+#include "transpos.h"
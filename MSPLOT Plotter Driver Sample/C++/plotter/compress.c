@@ -73,6 +73,19 @@ DEFINE_DBGVAR(0);
 
 #define SIZE_ADAPT_CONTROL          3
 
+//
+// The scan line data is compared a machine word at a time when looking for
+// deltas and runs. SCAN_WORD_ONES has 0x01 in every byte of the word and
+// SCAN_WORD_HIGHS has 0x80 in every byte.
+//
+
+#define SCAN_WORD                   ULONG_PTR
+#define CB_SCAN_WORD                ((LONG)sizeof(SCAN_WORD))
+#define SCAN_WORD_ONES              ((SCAN_WORD)-1 / 0xFF)
+#define SCAN_WORD_HIGHS             (SCAN_WORD_ONES * 0x80)
+#define GET_SCAN_WORD(pb)           (*(SCAN_WORD UNALIGNED *)(pb))
+#define HAS_ZERO_BYTE(w)            (((w) - SCAN_WORD_ONES) & ~(w) & SCAN_WORD_HIGHS)
+
 #define SET_ADAPT_CONTROL(pPDev, m, c)                                      \
 {                                                                           \
     BYTE    bAdaptCtrl[4];                                                  \
@@ -390,6 +403,203 @@ Revision History:
 
 
 
+LONG
+CountSameBytes(
+    _In_reads_bytes_(Size)  LPBYTE  pbSrc,
+    _In_reads_bytes_(Size)  LPBYTE  pbSeedRow,
+                            LONG    Size
+    )
+
+/*++
+
+Routine Description:
+
+    This function counts the bytes at the start of the source which are the
+    same as the seed row. The bytes are compared a word at a time while there
+    is a full word left.
+
+Arguments:
+
+    pbSrc       - Pointer to the source
+
+    pbSeedRow   - Pointer to the seed row
+
+    Size        - Size of the pointers
+
+
+Return Value:
+
+    LONG    - Count of the bytes which are the same, Size if the source is the
+              same as the seed row.
+
+
+Revision History:
+
+
+--*/
+
+{
+    LONG    cSame = 0;
+
+
+    while (((Size - cSame) >= CB_SCAN_WORD) &&
+           (GET_SCAN_WORD(pbSrc + cSame) == GET_SCAN_WORD(pbSeedRow + cSame))) {
+
+        cSame += CB_SCAN_WORD;
+    }
+
+    while ((cSame < Size) && (pbSrc[cSame] == pbSeedRow[cSame])) {
+
+        ++cSame;
+    }
+
+    return(cSame);
+}
+
+
+
+
+LONG
+CountRepeatBytes(
+    _In_reads_bytes_(Size)  LPBYTE  pbSrc,
+                            LONG    Size,
+                            BYTE    bRepeat
+    )
+
+/*++
+
+Routine Description:
+
+    This function counts the bytes at the start of the source which are equal
+    to bRepeat. The bytes are compared a word at a time while there is a full
+    word left.
+
+Arguments:
+
+    pbSrc       - Pointer to the source
+
+    Size        - Size of the source
+
+    bRepeat     - The byte value of the run
+
+
+Return Value:
+
+    LONG    - Count of the bytes equal to bRepeat
+
+
+Revision History:
+
+
+--*/
+
+{
+    SCAN_WORD   wRepeat = SCAN_WORD_ONES * bRepeat;
+    LONG        cRepeat = 0;
+
+
+    while (((Size - cRepeat) >= CB_SCAN_WORD) &&
+           (GET_SCAN_WORD(pbSrc + cRepeat) == wRepeat)) {
+
+        cRepeat += CB_SCAN_WORD;
+    }
+
+    while ((cRepeat < Size) && (pbSrc[cRepeat] == bRepeat)) {
+
+        ++cRepeat;
+    }
+
+    return(cRepeat);
+}
+
+
+
+
+LPBYTE
+SkipTIFFLiterals(
+    _In_reads_(pbSrcEnd - pbSrc)    LPBYTE  pbSrc,
+                                    LPBYTE  pbSrcEnd
+    )
+
+/*++
+
+Routine Description:
+
+    This function skips over the source bytes which CompressToTIFF() would
+    only collect as literal data, i.e. the bytes before the first run of
+    TIFF_MIN_REPEATS equal bytes. Three bytes at a time are compared for each
+    position in a word, so the literal data is skipped a word at a time.
+
+    The returned pointer is always where a run of equal bytes starts, so that
+    CompressToTIFF() breaks the remaining data into the same runs as it
+    would have done from pbSrc.
+
+Arguments:
+
+    pbSrc       - Pointer to the start of a run in the source
+
+    pbSrcEnd    - Pointer to the end of the source
+
+
+Return Value:
+
+    LPBYTE  - Pointer to the first run of TIFF_MIN_REPEATS equal bytes, or to
+              a run near the end of the source if there is no such run in the
+              part of the source which could be compared a word at a time.
+
+
+Revision History:
+
+
+--*/
+
+{
+    LPBYTE      pbCur = pbSrc;
+    SCAN_WORD   wDiff;
+
+
+    //
+    // Each position in the word needs the two bytes that follow it
+    //
+
+    while ((pbSrcEnd - pbCur) >= (CB_SCAN_WORD + TIFF_MIN_REPEATS - 1)) {
+
+        wDiff = (GET_SCAN_WORD(pbCur    ) ^ GET_SCAN_WORD(pbCur + 1)) |
+                (GET_SCAN_WORD(pbCur + 1) ^ GET_SCAN_WORD(pbCur + 2));
+
+        if (HAS_ZERO_BYTE(wDiff)) {
+
+            //
+            // There is a run in this word, find where it starts
+            //
+
+            while ((*pbCur != *(pbCur + 1)) || (*pbCur != *(pbCur + 2))) {
+
+                ++pbCur;
+            }
+
+            return(pbCur);
+        }
+
+        pbCur += CB_SCAN_WORD;
+    }
+
+    //
+    // There is no run of TIFF_MIN_REPEATS before pbCur, so if pbCur is in the
+    // middle of a run then that run started at the byte before.
+    //
+
+    if ((pbCur > pbSrc) && (*(pbCur - 1) == *pbCur)) {
+
+        --pbCur;
+    }
+
+    return(pbCur);
+}
+
+
+
+
 LONG
 CompressToDelta(
     _In_reads_bytes_(Size)  LPBYTE  pbSrc,
@@ -439,6 +649,7 @@ Revision History:
     LPBYTE  pbDstEnd;
     LPBYTE  pbTmp;
     LONG    cSrcBytes;
+    LONG    cSame;
     LONG    Offset = 0;
     UINT    cReplace;
     BOOL    DoReplace;
@@ -458,7 +669,26 @@ Revision History:
     pbTmp     = pbSrc;
 
 
-    while (cSrcBytes--) {
+    while (cSrcBytes > 0) {
+
+        //
+        // If we are not in the middle of a replacement then skip over all
+        // the bytes which are the same as the seed row.
+        //
+
+        if (!cReplace) {
+
+            cSame      = CountSameBytes(pbSrc, pbSeedRow, cSrcBytes);
+            pbSrc     += cSame;
+            pbSeedRow += cSame;
+
+            if (!(cSrcBytes -= cSame)) {
+
+                break;
+            }
+        }
+
+        --cSrcBytes;
 
         //
         // We need to do byte replacement now
@@ -674,14 +904,15 @@ Revision History:
 
     while (pbSrcBeg < pbSrcEnd) {
 
-        pbTmp   = pbSrcBeg;
-        LastSrc = *pbTmp++;
+        //
+        // Runs shorter than TIFF_MIN_REPEATS are sent as literal, so skip
+        // straight to the next run that is long enough.
+        //
 
-        while ((pbTmp < pbSrcEnd) &&
-               (*pbTmp == LastSrc)) {
-
-            ++pbTmp;
-        }
+        pbSrcBeg = SkipTIFFLiterals(pbSrcBeg, pbSrcEnd);
+        pbTmp    = pbSrcBeg;
+        LastSrc  = *pbTmp++;
+        pbTmp   += CountRepeatBytes(pbTmp, (LONG)(pbSrcEnd - pbTmp), LastSrc);
 
         if (((RepeatCount = (LONG)(pbTmp - pbSrcBeg)) >= TIFF_MIN_REPEATS) ||
             (pbTmp >= pbSrcEnd)) {
@@ -1027,10 +1258,15 @@ Revision History:
                                                              ADAPT_METHOD_ZERO;
     }
 
-    if ((Ok = (BOOL)(pRTLScans->cEmptyDup == 0xFFFF))   ||
+    if ((pRTLScans->cEmptyDup == 0xFFFF)   ||
         ((pPDev->cbBufferBytes + Count) > MAX_ADAPT_SIZE)) {
 
-        if (!(Ok = FlushAdaptBuf(pPDev, pRTLScans, Ok))) {
+        //
+        // Empty and duplicate rows still to be sent belong in this block,
+        // they repeat the seed row which is reset once the block is sent.
+        //
+
+        if (!(Ok = FlushAdaptBuf(pPDev, pRTLScans, TRUE))) {
 
             return(FALSE);
         }
@@ -461,12 +461,6 @@ Revision History:
             pPDev->pPenCache = NULL;
         }
 
-        if (pPDev->pTransPosTable) {
-
-            LocalFree((HLOCAL)pPDev->pTransPosTable);
-            pPDev->pTransPosTable = NULL;
-        }
-
         FreeOutBuffer(pPDev);
 
         LocalFree((HLOCAL)pPDev);
@@ -164,6 +164,13 @@ DEFINE_DBGVAR(0);
         pbTempS = (LPBYTE)pbScanSrc;                                        \
         Loop    = RTLScans.cxBytes;                                         \
                                                                             \
+        while (Loop >= sizeof(ULONG_PTR)) {                                 \
+                                                                            \
+            *(ULONG_PTR UNALIGNED *)pbTempS ^= (ULONG_PTR)-1;               \
+            pbTempS                         += sizeof(ULONG_PTR);           \
+            Loop                            -= sizeof(ULONG_PTR);           \
+        }                                                                   \
+                                                                            \
         while (Loop--) {                                                    \
                                                                             \
             *pbTempS++ ^= 0xFF;                                             \
@@ -186,7 +186,6 @@ typedef struct _PDEV {
     POINTL          ptlAnchorCorner;    // current brush origin.
     POINTL          ptlRTLCAP;          // Current RTL CAP
     RECTL           rclCurClip;         // current clipping rectangle
-    LPVOID          pTransPosTable;     // bitmap rotation xlate table
     LPVOID          pvDrvHTData;        // device's halftone info
     LPVOID          pPenCache;          // Pointer to the device pen cache
     LONG            BrightestPen;       // brightest pen for pen plotter
@@ -11,8 +11,8 @@ Module Name:
 Abstract:
 
     This module implements the functions for transposing an 8BPP, 4BPP and
-    1BPP bitmap. There is also a helper function for building a table which
-    speeds some of the rotation logic.
+    1BPP bitmap. There is also a helper function which transposes an 8x8
+    block of 1BPP pixels, the 1BPP rotation is done a block at a time.
 
 Author:
 
@@ -37,7 +37,6 @@ Revision History:
 
 #define DBG_PLOTFILENAME    DbgTransPos
 
-#define DBG_BUILD_TP8x8     0x00000001
 #define DBG_TP_1BPP         0x00000002
 #define DBG_TP_4BPP         0x00000004
 
@@ -45,37 +44,37 @@ DEFINE_DBGVAR(0);
 
 
 
-//
-// Private #defines and data structures for use only in this module.
-//
-
-#define ENTRY_TP8x8         256
-#define SIZE_TP8x8          (sizeof(DWORD) * 2 * ENTRY_TP8x8)
-
-
-
-LPDWORD
-Build8x8TransPosTable(
-    VOID
+VOID
+TransPos8x8(
+    DWORD   dwHi,
+    DWORD   dwLo,
+    LPBYTE  pbCols
     )
 
 /*++
 
 Routine Description:
 
-    This function build the 8x8 transpos table for use later in transposing
-    1bpp.
+    This function transposes an 8x8 block of 1bpp pixels. The 8 source bytes
+    are packed into two DWORDs and the block is transposed with three rounds
+    of masked bit swaps (2x2, 4x4 then 8x8 sub blocks), rather than moving one
+    bit at a time.
 
 Arguments:
 
+    dwHi    - The first 4 source bytes, one byte from each source scan line,
+              the first byte in the top byte. The first byte ends up in the
+              top bit (0x80) of every destination byte.
 
-Return Value:
+    dwLo    - The last 4 source bytes, in the same order.
 
+    pbCols  - Pointer to the 8 transposed bytes. The 1st byte holds the 0x01
+              bit of every source byte and the last byte holds the 0x80 bit.
 
 
-Author:
+Return Value:
 
-    22-Dec-1993 Wed 14:19:50 created  
+    VOID
 
 
 Revision History:
@@ -84,58 +83,46 @@ Revision History:
 --*/
 
 {
-    LPDWORD pdwTP8x8;
+    DWORD   dwTmp;
 
 
     //
-    // We now build the table which will represent the data for doing a
-    // rotation. Basically for each combination of bits in the byte, we
-    // build the equivalent 8 byte rotation for those bits. The 1st byte
-    // of the translated bytes are mapped to the 0x01 bit of the source and
-    // the last byte is mapped to the 0x80 bit.
-
-
-
-    if (pdwTP8x8 = (LPDWORD)LocalAlloc(LPTR, SIZE_TP8x8)) {
-
-        LPBYTE  pbData = (LPBYTE)pdwTP8x8;
-        WORD    Entry;
-        WORD    Bits;
-
-        //
-        // Now start buiding the table, for each entry we expand each bit
-        // in the byte to the rotate byte value.
-        //
-
-        for (Entry = 0; Entry < ENTRY_TP8x8; Entry++) {
-
-            //
-            // For each of bit combinations in the byte, we will examine each
-            // bit from bit 0 to bit 7, and set each of the trasposed bytes to
-            // either 1 (bit set) or 0 (bit clear)
-            //
-
-            Bits = (WORD)Entry | (WORD)0xff00;
+    // Transpose each 2x2 block, then each 4x4 block of 2x2 blocks, then swap
+    // the two off diagonal 4x4 blocks between the two DWORDs
+    //
 
-            while (Bits & 0x0100) {
+    dwTmp = (dwHi ^ (dwHi >> 7)) & 0x00AA00AA;
+    dwHi  = dwHi ^ dwTmp ^ (dwTmp << 7);
+    dwTmp = (dwLo ^ (dwLo >> 7)) & 0x00AA00AA;
+    dwLo  = dwLo ^ dwTmp ^ (dwTmp << 7);
 
-                *pbData++   = (BYTE)(Bits & 0x01);
-                Bits      >>= 1;
-            }
-        }
+    dwTmp = (dwHi ^ (dwHi >> 14)) & 0x0000CCCC;
+    dwHi  = dwHi ^ dwTmp ^ (dwTmp << 14);
+    dwTmp = (dwLo ^ (dwLo >> 14)) & 0x0000CCCC;
+    dwLo  = dwLo ^ dwTmp ^ (dwTmp << 14);
 
-    } else {
+    dwTmp = (dwHi & 0xF0F0F0F0) | ((dwLo >> 4) & 0x0F0F0F0F);
+    dwLo  = ((dwHi << 4) & 0xF0F0F0F0) | (dwLo & 0x0F0F0F0F);
+    dwHi  = dwTmp;
 
-        PLOTERR(("Build8x8TransPosTable: LocalAlloc(SIZE_TP8x8=%ld) failed",
-                                                    SIZE_TP8x8));
-    }
+    //
+    // dwHi now has the 0x80 bits of the source in its top byte down to the
+    // 0x10 bits in its low byte, dwLo has the 0x08 down to the 0x01 bits
+    //
 
-    return(pdwTP8x8);
+    pbCols[7] = (BYTE)(dwHi >> 24);
+    pbCols[6] = (BYTE)(dwHi >> 16);
+    pbCols[5] = (BYTE)(dwHi >>  8);
+    pbCols[4] = (BYTE)(dwHi      );
+    pbCols[3] = (BYTE)(dwLo >> 24);
+    pbCols[2] = (BYTE)(dwLo >> 16);
+    pbCols[1] = (BYTE)(dwLo >>  8);
+    pbCols[0] = (BYTE)(dwLo      );
 }
 
 
 
-
+
 BOOL
 TransPos4BPP(
     PTPINFO pTPInfo
@@ -343,15 +330,14 @@ Revision History:
 --*/
 
 {
-    LPDWORD pdwTP8x8;
     LPBYTE  pSrc;
+    LPBYTE  pbTmp;
     TPINFO  TPInfo;
-    INT     RemainBits;
+    UINT    Slot;
     INT     cbNextDest;
-    union {
-        BYTE    b[8];
-        DWORD   dw[2];
-    } TPData;
+    DWORD   dwHi;
+    DWORD   dwLo;
+    BYTE    bCols[8];
 
 
 
@@ -362,101 +348,93 @@ Revision History:
             (DWORD)(ABS(TPInfo.cbDestScan)) >=
             (DWORD)((TPInfo.cySrc + TPInfo.DestXStart + 7) >> 3),
                                                         TPInfo.cbDestScan);
+
     //
-    // Make sure we have the required transpose translate table. If we don't
-    // get one built.
+    // set up all required parameters. The source is transposed in blocks of
+    // 8 source scan lines. The first block starts at bit DestXStart and the
+    // last block may run out of source lines, unused bits in those blocks are
+    // left as 0
     //
 
-    if (!(pdwTP8x8 = (LPDWORD)pTPInfo->pPDev->pTransPosTable)) {
+    pSrc       = TPInfo.pSrc;
+    Slot       = (UINT)TPInfo.DestXStart;
+    cbNextDest = (INT)((TPInfo.cbDestScan > 0) ? 1 : -1);
 
-        if (!(pdwTP8x8 = Build8x8TransPosTable())) {
+    while (TPInfo.cySrc > 0) {
 
-            PLOTERR(("TransPos1BPP: Build 8x8 transpos table failed"));
-            return(FALSE);
-        }
+        if ((Slot == 0) && (TPInfo.cySrc >= 8)) {
 
-        pTPInfo->pPDev->pTransPosTable = (LPVOID)pdwTP8x8;
-    }
+            //
+            // Full block, read the 8 source bytes straight into place
+            //
 
-    //
-    // set up all required parameters, and start TPData with 0s
-    //
+            dwHi  = (DWORD)*pSrc << 24;    pSrc += TPInfo.cbSrcScan;
+            dwHi |= (DWORD)*pSrc << 16;    pSrc += TPInfo.cbSrcScan;
+            dwHi |= (DWORD)*pSrc <<  8;    pSrc += TPInfo.cbSrcScan;
+            dwHi |= (DWORD)*pSrc;          pSrc += TPInfo.cbSrcScan;
+            dwLo  = (DWORD)*pSrc << 24;    pSrc += TPInfo.cbSrcScan;
+            dwLo |= (DWORD)*pSrc << 16;    pSrc += TPInfo.cbSrcScan;
+            dwLo |= (DWORD)*pSrc <<  8;    pSrc += TPInfo.cbSrcScan;
+            dwLo |= (DWORD)*pSrc;          pSrc += TPInfo.cbSrcScan;
 
-    pSrc         = TPInfo.pSrc;
-    RemainBits   = (INT)(7 - TPInfo.DestXStart);
-    cbNextDest   = (INT)((TPInfo.cbDestScan > 0) ? 1 : -1);
-    TPData.dw[0] =
-    TPData.dw[1] = 0;
+            TPInfo.cySrc -= 8;
 
-    while (TPInfo.cySrc--) {
+        } else {
 
-        LPDWORD pdwTmp;
-        LPBYTE  pbTmp;
+            //
+            // Partial block, shift the source bytes in through dwHi:dwLo
+            // then move them up so the first one is at bit DestXStart
+            //
 
-        //
-        // Translate a byte to 8 bytes with each bit corresponding to each byte
-        // each byte is shifted to the left by 1 before combining with the new
-        // bit.
-        //
+            dwHi = 0;
+            dwLo = 0;
 
-        pdwTmp        = pdwTP8x8 + ((UINT)*pSrc << 1);
-        TPData.dw[0]  = (TPData.dw[0] << 1) | *(pdwTmp + 0);
-        TPData.dw[1]  = (TPData.dw[1] << 1) | *(pdwTmp + 1);
-        pSrc         += TPInfo.cbSrcScan;
+            while ((Slot < 8) && (TPInfo.cySrc > 0)) {
 
-        //
-        // Check to see if we are done with source scan lines. If this is the
-        // case we need to possible shift the transposed scan lines by the
-        // apropriate number based on RemainBits.
-        //
+                dwHi  = (dwHi << 8) | (dwLo >> 24);
+                dwLo  = (dwLo << 8) | (DWORD)*pSrc;
+                pSrc += TPInfo.cbSrcScan;
 
-        if (!TPInfo.cySrc) {
+                ++Slot;
+                --TPInfo.cySrc;
+            }
 
-            //
-            // We are done, check to see if we need to shift the resultant
-            // transposed scan lines.
-            //
+            if (Slot <= 4) {
 
-            if (RemainBits) {
+                dwHi = dwLo << ((4 - Slot) << 3);
+                dwLo = 0;
 
-                TPData.dw[0] <<= RemainBits;
-                TPData.dw[1] <<= RemainBits;
+            } else if (Slot < 8) {
 
-                RemainBits     = 0;
+                dwHi = (dwHi << ((8 - Slot) << 3)) |
+                       (dwLo >> ((Slot - 4) << 3));
+                dwLo = dwLo << ((8 - Slot) << 3);
             }
         }
 
-        if (RemainBits--) {
+        TransPos8x8(dwHi, dwLo, bCols);
 
-            NULL;
-
-        } else {
-
-            //
-            // Save the current result to the output destination scan buffer.
-            // Unwind the processing, to give the compiler a chance to generate
-            // some fast code, rather that relying on a while loop.
-            //
+        //
+        // Save the current result to the output destination scan buffer.
+        // Unwind the processing, to give the compiler a chance to generate
+        // some fast code, rather that relying on a while loop.
+        //
 
-            *(pbTmp  = TPInfo.pDest     ) = TPData.b[0];
-            *(pbTmp += TPInfo.cbDestScan) = TPData.b[1];
-            *(pbTmp += TPInfo.cbDestScan) = TPData.b[2];
-            *(pbTmp += TPInfo.cbDestScan) = TPData.b[3];
-            *(pbTmp += TPInfo.cbDestScan) = TPData.b[4];
-            *(pbTmp += TPInfo.cbDestScan) = TPData.b[5];
-            *(pbTmp += TPInfo.cbDestScan) = TPData.b[6];
-            *(pbTmp +  TPInfo.cbDestScan) = TPData.b[7];
+        *(pbTmp  = TPInfo.pDest     ) = bCols[0];
+        *(pbTmp += TPInfo.cbDestScan) = bCols[1];
+        *(pbTmp += TPInfo.cbDestScan) = bCols[2];
+        *(pbTmp += TPInfo.cbDestScan) = bCols[3];
+        *(pbTmp += TPInfo.cbDestScan) = bCols[4];
+        *(pbTmp += TPInfo.cbDestScan) = bCols[5];
+        *(pbTmp += TPInfo.cbDestScan) = bCols[6];
+        *(pbTmp +  TPInfo.cbDestScan) = bCols[7];
 
-            //
-            // Reset RemainBits back to 7, TPData back to 0 and and advance to
-            // the next destination
-            //
+        //
+        // Start a new block and advance to the next destination
+        //
 
-            RemainBits    = 7;
-            TPData.dw[0]  =
-            TPData.dw[1]  = 0;
-            TPInfo.pDest += cbNextDest;
-        }
+        Slot          = 0;
+        TPInfo.pDest += cbNextDest;
     }
 
 
@@ -33,6 +33,32 @@ Environment:
 #pragma alloc_text(PAGE, FmmSetMetadataOpenTriggerFileObject)
 #pragma alloc_text(PAGE, FmmBeginFileSystemOperation)
 #pragma alloc_text(PAGE, FmmEndFileSystemOperation)
+#pragma alloc_text(PAGE, FmmQueryMetadata)
+#pragma alloc_text(PAGE, FmmSetMetadata)
+#pragma alloc_text(PAGE, FmmDeleteMetadata)
+#pragma alloc_text(PAGE, FmmUpdateFileMetadata)
+#pragma alloc_text(PAGE, FmmDeleteFileMetadata)
+#pragma alloc_text(PAGE, FmmFlushMetadataLog)
+#pragma alloc_text(PAGE, FmmLoadMetadata)
+#pragma alloc_text(PAGE, FmmReadMetadataFile)
+#pragma alloc_text(PAGE, FmmWriteMetadataFile)
+#pragma alloc_text(PAGE, FmmWriteMetadataCheckpoint)
+#pragma alloc_text(PAGE, FmmWriteMetadataSnapshot)
+#pragma alloc_text(PAGE, FmmBuildMetadataSnapshot)
+#pragma alloc_text(PAGE, FmmApplyMetadataRecord)
+#pragma alloc_text(PAGE, FmmLogMetadataRecord)
+#pragma alloc_text(PAGE, FmmDiscardMetadataLog)
+#pragma alloc_text(PAGE, FmmFormatMetadataRecord)
+#pragma alloc_text(PAGE, FmmMetadataChecksum)
+#pragma alloc_text(PAGE, FmmInitializeMetadataStore)
+#pragma alloc_text(PAGE, FmmDeleteMetadataStore)
+#pragma alloc_text(PAGE, FmmResetMetadataStore)
+#pragma alloc_text(PAGE, FmmStartMetadataFlushThread)
+#pragma alloc_text(PAGE, FmmStopMetadataFlushThread)
+#pragma alloc_text(PAGE, FmmMetadataFlushThread)
+#pragma alloc_text(PAGE, FmmCompareMetadataEntries)
+#pragma alloc_text(PAGE, FmmAllocateMetadataEntry)
+#pragma alloc_text(PAGE, FmmFreeMetadataEntry)
 #endif
 
 _Requires_lock_held_(_Global_critical_region_)
@@ -307,10 +333,51 @@ RetryFltCreateFile:
     }
 
     //
-    //  Here the filter may read the metadata contents and initialize
-    //  its in memory data structures with the data from the metadata
-    //  file
+    //  Hand the file object to the metadata store and read the metadata
+    //  contents into it. The contents are only read the first time; when the
+    //  file is reopened (after a volume lock for example) the in memory store
+    //  is already current.
     //
+    //  Mark the beginning of a file system operation
+    //
+
+    FmmBeginFileSystemOperation( InstanceContext );
+
+    FmmAcquireResourceExclusive( &InstanceContext->MetadataStore.FileResource );
+
+    InstanceContext->MetadataStore.FileObject = InstanceContext->MetadataFileObject;
+
+    if (!InstanceContext->MetadataStore.Loaded) {
+
+        status = FmmLoadMetadata( InstanceContext,
+                                  (BOOLEAN) (ioStatus.Information == FILE_CREATED) );
+
+        if (!NT_SUCCESS( status )) {
+
+            DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS | DEBUG_TRACE_ERROR,
+                        ("[Fmm]: Failed to load metadata file %wZ, starting with an empty store (Volume = %p, Status = 0x%x)\n",
+                         &fileName,
+                         InstanceContext->Volume,
+                         status) );
+
+            //
+            //  Unreadable metadata must not keep the filter from attaching.
+            //  Start over with an empty store; the next flush rewrites the
+            //  file from it.
+            //
+
+            FmmResetMetadataStore( &InstanceContext->MetadataStore );
+            status = STATUS_SUCCESS;
+        }
+    }
+
+    FmmReleaseResource( &InstanceContext->MetadataStore.FileResource );
+
+    //
+    //  Mark the end of a file system operation
+    //
+
+    FmmEndFileSystemOperation( InstanceContext );
 
 
 FmmOpenMetadataCleanup:
@@ -402,6 +469,8 @@ Note:
 
 --*/
 {
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+
     PAGED_CODE();
 
     FLT_ASSERT( InstanceContext->MetadataHandle );
@@ -412,19 +481,33 @@ Note:
                  InstanceContext->Volume ) );
 
     //
-    //  Dereference the file object and close the file handle.
+    //  Mark the beginning of a file system operation
     //
 
-    ObDereferenceObject( InstanceContext->MetadataFileObject );
+    FmmBeginFileSystemOperation( InstanceContext );
 
-    InstanceContext->MetadataFileObject = NULL;
+    //
+    //  Take the file away from the metadata store. Acquiring the file
+    //  resource waits for a flush the flush thread may have in progress.
+    //  Write out whatever is still pending in the metadata log first; if
+    //  this fails the store keeps it and writes a snapshot on reopen.
+    //
 
+    FmmAcquireResourceExclusive( &store->FileResource );
+
+    (VOID) FmmFlushMetadataLog( InstanceContext );
+
+    store->FileObject = NULL;
+
+    FmmReleaseResource( &store->FileResource );
 
     //
-    //  Mark the beginning of a file system operation
+    //  Dereference the file object and close the file handle.
     //
 
-    FmmBeginFileSystemOperation( InstanceContext );
+    ObDereferenceObject( InstanceContext->MetadataFileObject );
+
+    InstanceContext->MetadataFileObject = NULL;
 
     FltClose( InstanceContext->MetadataHandle );
 
@@ -960,6 +1043,1838 @@ Note:
 
 
 
+//
+//  Metadata store routines.
+//
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmQueryMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Key,
+    _Out_writes_bytes_to_opt_(BufferLength, *ReturnedLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_ PULONG ReturnedLength
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the metadata record for the specified key.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Key                 - Supplies the key (file id) of the record.
+    Buffer              - Receives the record data.
+    BufferLength        - Supplies the length of Buffer in bytes.
+    ReturnedLength      - Receives the length of the record data. If the
+                          buffer is too small, this is the length needed.
+
+Return Value:
+
+    STATUS_SUCCESS, STATUS_NOT_FOUND or STATUS_BUFFER_TOO_SMALL.
+
+Note:
+
+    Only the store resource is taken, and only shared, so lookups neither
+    wait on each other nor on the metadata file.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    PFMM_METADATA_ENTRY entry;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    *ReturnedLength = 0;
+
+    FmmAcquireResourceShared( &store->Resource );
+
+    entry = RtlLookupElementGenericTableAvl( &store->Table, &Key );
+
+    if (entry == NULL) {
+
+        status = STATUS_NOT_FOUND;
+
+    } else {
+
+        *ReturnedLength = entry->DataLength;
+
+        if (Buffer == NULL || BufferLength < entry->DataLength) {
+
+            status = STATUS_BUFFER_TOO_SMALL;
+
+        } else {
+
+            RtlCopyMemory( Buffer, entry->Data, entry->DataLength );
+            status = STATUS_SUCCESS;
+        }
+    }
+
+    FmmReleaseResource( &store->Resource );
+
+    return status;
+}
+
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmSetMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_(DataLength) PVOID Data,
+    _In_ ULONG DataLength
+    )
+/*++
+
+Routine Description:
+
+    This routine creates or replaces the metadata record for the specified key.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Key                 - Supplies the key (file id) of the record.
+    Data                - Supplies the record data.
+    DataLength          - Supplies the length of the record data.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The update is made to the in memory table and logged; it reaches the
+    metadata file when the flush thread next runs.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    BOOLEAN wakeFlushThread = FALSE;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (DataLength == 0 || DataLength > FMM_METADATA_MAX_DATA_LENGTH) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    FmmAcquireResourceExclusive( &store->Resource );
+
+    status = FmmApplyMetadataRecord( store, Key, Data, DataLength, FALSE );
+
+    if (NT_SUCCESS( status )) {
+
+        FmmLogMetadataRecord( store, Key, Data, DataLength, 0 );
+
+        wakeFlushThread = (BOOLEAN) (store->LogBytes >= FMM_METADATA_FLUSH_THRESHOLD);
+    }
+
+    FmmReleaseResource( &store->Resource );
+
+    if (wakeFlushThread) {
+
+        KeSetEvent( &store->FlushEvent, IO_NO_INCREMENT, FALSE );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmDeleteMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Key
+    )
+/*++
+
+Routine Description:
+
+    This routine deletes the metadata record for the specified key.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Key                 - Supplies the key (file id) of the record.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_NOT_FOUND.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    BOOLEAN wakeFlushThread = FALSE;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    FmmAcquireResourceExclusive( &store->Resource );
+
+    if (RtlLookupElementGenericTableAvl( &store->Table, &Key ) == NULL) {
+
+        status = STATUS_NOT_FOUND;
+
+    } else {
+
+        status = FmmApplyMetadataRecord( store, Key, NULL, 0, TRUE );
+
+        FmmLogMetadataRecord( store, Key, NULL, 0, FMM_METADATA_RECORD_F_DELETE );
+
+        wakeFlushThread = (BOOLEAN) (store->LogBytes >= FMM_METADATA_FLUSH_THRESHOLD);
+    }
+
+    FmmReleaseResource( &store->Resource );
+
+    if (wakeFlushThread) {
+
+        KeSetEvent( &store->FlushEvent, IO_NO_INCREMENT, FALSE );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmUpdateFileMetadata (
+    _In_ PFLT_CALLBACK_DATA Cbd,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Routine Description:
+
+    This routine updates the record of a file that has just been created,
+    overwritten or superseded.
+
+Arguments:
+
+    Cbd                 - Supplies the completed create. Its information is
+                          FILE_CREATED, FILE_OVERWRITTEN or FILE_SUPERSEDED.
+    FltObjects          - Supplies the instance and file object of the file.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    Only the metadata store is used, not the instance context resource, so
+    creates do not wait on each other or on the metadata file.
+
+--*/
+{
+    PFMM_INSTANCE_CONTEXT instanceContext = NULL;
+    FMM_FILE_METADATA fileMetadata;
+    ULONGLONG fileId;
+    ULONG length = 0;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto FmmUpdateFileMetadataCleanup;
+    }
+
+    status = FmmGetFileId( FltObjects, &fileId );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto FmmUpdateFileMetadataCleanup;
+    }
+
+    status = STATUS_NOT_FOUND;
+
+    if (Cbd->IoStatus.Information != FILE_CREATED) {
+
+        status = FmmQueryMetadata( instanceContext,
+                                   fileId,
+                                   &fileMetadata,
+                                   sizeof( fileMetadata ),
+                                   &length );
+    }
+
+    if (NT_SUCCESS( status ) && length == sizeof( fileMetadata )) {
+
+        fileMetadata.OverwriteCount += 1;
+
+    } else {
+
+        //
+        //  A new file, or one we have no (usable) record of.
+        //
+
+        KeQuerySystemTime( &fileMetadata.CreationTime );
+        fileMetadata.CreatorProcessId = FltGetRequestorProcessId( Cbd );
+        fileMetadata.OverwriteCount = 0;
+    }
+
+    status = FmmSetMetadata( instanceContext,
+                             fileId,
+                             &fileMetadata,
+                             sizeof( fileMetadata ) );
+
+FmmUpdateFileMetadataCleanup:
+
+    if (instanceContext != NULL) {
+
+        FltReleaseContext( instanceContext );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmDeleteFileMetadata (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ ULONGLONG FileId
+    )
+/*++
+
+Routine Description:
+
+    This routine deletes the record of a file that has been deleted.
+
+Arguments:
+
+    FltObjects          - Supplies the instance of the file.
+    FileId              - Supplies the file id the file had, which can no
+                          longer be queried once it is gone.
+
+Return Value:
+
+    Returns the status of this operation. STATUS_NOT_FOUND means there was no
+    record to delete.
+
+--*/
+{
+    PFMM_INSTANCE_CONTEXT instanceContext;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    status = FmmDeleteMetadata( instanceContext, FileId );
+
+    FltReleaseContext( instanceContext );
+
+    return status;
+}
+
+
+_Requires_lock_held_(_Global_critical_region_)
+_Requires_lock_held_(InstanceContext->MetadataStore.FileResource)
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmFlushMetadataLog (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine writes the pending metadata log to the metadata file and
+    checkpoints it. If the store needs a snapshot, or the log in the file has
+    grown well past the size of the live records, a snapshot of the table is
+    written instead.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The caller must hold the store file resource exclusive and the store must
+    have a file object. The instance context resource is not needed, and must
+    not be held since the file is written.
+
+    If the log cannot be written, the store is marked as needing a snapshot so
+    that nothing is lost as long as the in memory table survives.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    LIST_ENTRY chunks;
+    PFMM_METADATA_LOG_CHUNK chunk;
+    PLIST_ENTRY entry;
+    PVOID snapshot = NULL;
+    ULONG snapshotLength = 0;
+    BOOLEAN writeSnapshot = FALSE;
+    ULONGLONG logLength;
+    ULONGLONG offset;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    FLT_ASSERT( store->FileObject != NULL );
+
+    InitializeListHead( &chunks );
+
+    //
+    //  Take what is pending while holding the store resource, but do not
+    //  hold it while we write; lookups and updates carry on meanwhile.
+    //
+
+    FmmAcquireResourceExclusive( &store->Resource );
+
+    logLength = store->LogEnd - store->LogStart + store->LogBytes;
+
+    if (store->NeedsSnapshot ||
+        (logLength >= FMM_METADATA_COMPACT_SIZE &&
+         logLength / 4 >= store->LiveBytes)) {
+
+        status = FmmBuildMetadataSnapshot( store, &snapshot, &snapshotLength );
+
+        if (NT_SUCCESS( status )) {
+
+            //
+            //  The snapshot supersedes anything pending.
+            //
+
+            FmmDiscardMetadataLog( store, NULL );
+            store->NeedsSnapshot = FALSE;
+            writeSnapshot = TRUE;
+
+        } else if (store->NeedsSnapshot) {
+
+            FmmReleaseResource( &store->Resource );
+            return status;
+        }
+    }
+
+    if (!writeSnapshot) {
+
+        FmmDiscardMetadataLog( store, &chunks );
+    }
+
+    FmmReleaseResource( &store->Resource );
+
+    if (!writeSnapshot && IsListEmpty( &chunks )) {
+
+        return STATUS_SUCCESS;
+    }
+
+    if (writeSnapshot) {
+
+        status = FmmWriteMetadataSnapshot( InstanceContext,
+                                           snapshot,
+                                           snapshotLength );
+
+    } else {
+
+        //
+        //  Append the chunks back to back after the checkpointed log, then
+        //  checkpoint them.
+        //
+
+        offset = store->LogEnd;
+        status = STATUS_SUCCESS;
+
+        for (entry = chunks.Flink;
+             entry != &chunks && NT_SUCCESS( status );
+             entry = entry->Flink) {
+
+            chunk = CONTAINING_RECORD( entry, FMM_METADATA_LOG_CHUNK, Links );
+
+            status = FmmWriteMetadataFile( InstanceContext,
+                                           offset,
+                                           chunk->Data,
+                                           chunk->Used );
+
+            offset += chunk->Used;
+        }
+
+        if (NT_SUCCESS( status )) {
+
+            status = FmmWriteMetadataCheckpoint( InstanceContext,
+                                                 store->LogStart,
+                                                 offset );
+        }
+    }
+
+    while (!IsListEmpty( &chunks )) {
+
+        entry = RemoveHeadList( &chunks );
+        chunk = CONTAINING_RECORD( entry, FMM_METADATA_LOG_CHUNK, Links );
+        ExFreePoolWithTag( chunk, FMM_METADATA_LOG_TAG );
+    }
+
+    if (snapshot != NULL) {
+
+        ExFreePoolWithTag( snapshot, FMM_METADATA_IO_TAG );
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS | DEBUG_TRACE_ERROR,
+                    ("[Fmm]: Failed to write metadata log (Volume = %p, Snapshot = %X, Status = 0x%x)\n",
+                     InstanceContext->Volume,
+                     writeSnapshot,
+                     status) );
+
+        FmmAcquireResourceExclusive( &store->Resource );
+        store->NeedsSnapshot = TRUE;
+        FmmReleaseResource( &store->Resource );
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+FmmLoadMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ BOOLEAN Created
+    )
+/*++
+
+Routine Description:
+
+    This routine reads the metadata file into the in memory table. The newest
+    valid checkpoint says which records to replay. If there is none (the file
+    is new or was not written by this version) the store starts empty and an
+    empty snapshot will be written by the next flush.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Created             - Supplies if the metadata file was just created.
+
+Return Value:
+
+    Returns the status of this operation. A damaged record ends the replay but
+    is not an error; the next flush rewrites the file from what was replayed.
+
+Note:
+
+    The caller must hold the store file resource exclusive, with the store
+    file object set, and must have put the instance context in transition (it
+    performs file system operations on the metadata file).
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    FMM_METADATA_CHECKPOINT checkpoint;
+    PFMM_METADATA_CHECKPOINT candidate;
+    PFMM_METADATA_RECORD record;
+    PUCHAR buffer = NULL;
+    BOOLEAN found = FALSE;
+    BOOLEAN damaged = FALSE;
+    ULONGLONG offset;
+    ULONG length;
+    ULONG bytesRead;
+    ULONG consumed;
+    ULONG slot;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( &checkpoint, sizeof( checkpoint ) );
+
+    buffer = ExAllocatePoolWithTag( PagedPool,
+                                    FMM_METADATA_IO_SIZE,
+                                    FMM_METADATA_IO_TAG );
+
+    if (buffer == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    //  Pick the newest valid checkpoint.
+    //
+
+    for (slot = 0; slot < 2 && !Created; slot++) {
+
+        status = FmmReadMetadataFile( InstanceContext,
+                                      (ULONGLONG) slot * FMM_METADATA_SLOT_STRIDE,
+                                      buffer,
+                                      sizeof( FMM_METADATA_CHECKPOINT ),
+                                      &bytesRead );
+
+        if (status == STATUS_END_OF_FILE) {
+
+            status = STATUS_SUCCESS;
+            break;
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            goto FmmLoadMetadataCleanup;
+        }
+
+        candidate = (PFMM_METADATA_CHECKPOINT) buffer;
+
+        if (bytesRead == sizeof( FMM_METADATA_CHECKPOINT ) &&
+            candidate->Signature == FMM_METADATA_SIGNATURE &&
+            candidate->Version == FMM_METADATA_VERSION &&
+            candidate->Checksum == FmmMetadataChecksum( candidate,
+                                                        FIELD_OFFSET( FMM_METADATA_CHECKPOINT, Checksum )) &&
+            candidate->LogStart >= FMM_METADATA_LOG_OFFSET &&
+            candidate->LogEnd >= candidate->LogStart &&
+            (!found || candidate->Sequence > checkpoint.Sequence)) {
+
+            RtlCopyMemory( &checkpoint, candidate, sizeof( FMM_METADATA_CHECKPOINT ) );
+            found = TRUE;
+        }
+    }
+
+    if (!found) {
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: No metadata checkpoint, starting with an empty store (Volume = %p, Created = %X)\n",
+                     InstanceContext->Volume,
+                     Created) );
+
+        store->LogStart = FMM_METADATA_LOG_OFFSET;
+        store->LogEnd = FMM_METADATA_LOG_OFFSET;
+        store->Sequence = 0;
+        store->NeedsSnapshot = TRUE;
+        store->Loaded = TRUE;
+
+        goto FmmLoadMetadataCleanup;
+    }
+
+    store->LogStart = checkpoint.LogStart;
+    store->LogEnd = checkpoint.LogEnd;
+    store->Sequence = checkpoint.Sequence;
+
+    //
+    //  Replay the records a window at a time. A record that does not fit in
+    //  what is left of the window is re-read at the start of the next one.
+    //
+
+    offset = checkpoint.LogStart;
+
+    while (offset < checkpoint.LogEnd && !damaged) {
+
+        length = (ULONG) min( FMM_METADATA_IO_SIZE, checkpoint.LogEnd - offset );
+
+        status = FmmReadMetadataFile( InstanceContext,
+                                      offset,
+                                      buffer,
+                                      length,
+                                      &bytesRead );
+
+        if (!NT_SUCCESS( status ) || bytesRead != length) {
+
+            status = STATUS_SUCCESS;
+            damaged = TRUE;
+            break;
+        }
+
+        consumed = 0;
+
+        FmmAcquireResourceExclusive( &store->Resource );
+
+        while (length - consumed >= FIELD_OFFSET( FMM_METADATA_RECORD, Data )) {
+
+            record = (PFMM_METADATA_RECORD) (buffer + consumed);
+
+            if (record->DataLength > FMM_METADATA_MAX_DATA_LENGTH ||
+                record->RecordLength != FMM_METADATA_RECORD_LENGTH( record->DataLength )) {
+
+                damaged = TRUE;
+                break;
+            }
+
+            if (length - consumed < record->RecordLength) {
+
+                break;
+            }
+
+            if (record->Checksum != FmmMetadataChecksum( &record->RecordLength,
+                                                         record->RecordLength - FIELD_OFFSET( FMM_METADATA_RECORD, RecordLength ))) {
+
+                damaged = TRUE;
+                break;
+            }
+
+            status = FmmApplyMetadataRecord( store,
+                                             record->Key,
+                                             record->Data,
+                                             record->DataLength,
+                                             BooleanFlagOn( record->Flags, FMM_METADATA_RECORD_F_DELETE ) );
+
+            if (!NT_SUCCESS( status )) {
+
+                break;
+            }
+
+            consumed += record->RecordLength;
+        }
+
+        FmmReleaseResource( &store->Resource );
+
+        if (!NT_SUCCESS( status )) {
+
+            goto FmmLoadMetadataCleanup;
+        }
+
+        if (consumed == 0) {
+
+            //
+            //  Not even one whole record in a full window; the log is bad.
+            //
+
+            damaged = TRUE;
+        }
+
+        offset += consumed;
+    }
+
+    if (damaged) {
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS | DEBUG_TRACE_ERROR,
+                    ("[Fmm]: Metadata log damaged at offset 0x%I64x, keeping the records before it (Volume = %p)\n",
+                     offset,
+                     InstanceContext->Volume) );
+
+        store->NeedsSnapshot = TRUE;
+    }
+
+    store->Loaded = TRUE;
+
+FmmLoadMetadataCleanup:
+
+    ExFreePoolWithTag( buffer, FMM_METADATA_IO_TAG );
+
+    return status;
+}
+
+
+NTSTATUS
+FmmReadMetadataFile (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Offset,
+    _Out_writes_bytes_to_(Length, *BytesRead) PVOID Buffer,
+    _In_ ULONG Length,
+    _Out_ PULONG BytesRead
+    )
+/*++
+
+Routine Description:
+
+    This routine reads from the metadata file.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Offset              - Supplies the offset to read from.
+    Buffer              - Receives the data.
+    Length              - Supplies the number of bytes to read.
+    BytesRead           - Receives the number of bytes read.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    LARGE_INTEGER byteOffset;
+
+    PAGED_CODE();
+
+    byteOffset.QuadPart = (LONGLONG) Offset;
+
+    return FltReadFile( InstanceContext->Instance,
+                        InstanceContext->MetadataStore.FileObject,
+                        &byteOffset,
+                        Length,
+                        Buffer,
+                        FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
+                        BytesRead,
+                        NULL,
+                        NULL );
+}
+
+
+NTSTATUS
+FmmWriteMetadataFile (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine writes to the metadata file.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Offset              - Supplies the offset to write at.
+    Buffer              - Supplies the data.
+    Length              - Supplies the number of bytes to write.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    LARGE_INTEGER byteOffset;
+    ULONG bytesWritten;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (Length == 0) {
+
+        return STATUS_SUCCESS;
+    }
+
+    byteOffset.QuadPart = (LONGLONG) Offset;
+
+    status = FltWriteFile( InstanceContext->Instance,
+                           InstanceContext->MetadataStore.FileObject,
+                           &byteOffset,
+                           Length,
+                           Buffer,
+                           FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
+                           &bytesWritten,
+                           NULL,
+                           NULL );
+
+    if (NT_SUCCESS( status ) && bytesWritten != Length) {
+
+        status = STATUS_UNEXPECTED_IO_ERROR;
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+FmmWriteMetadataCheckpoint (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG LogStart,
+    _In_ ULONGLONG LogEnd
+    )
+/*++
+
+Routine Description:
+
+    This routine makes the records in the given range durable and then writes
+    a checkpoint pointing at them into the older of the two slots.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    LogStart            - Supplies the offset of the first record to replay.
+    LogEnd              - Supplies the offset just past the last record.
+
+Return Value:
+
+    Returns the status of this operation. On failure the previous checkpoint
+    is still intact.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    FMM_METADATA_CHECKPOINT checkpoint;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    //
+    //  The records must be on disk before anything points at them.
+    //
+
+    status = FltFlushBuffers( InstanceContext->Instance,
+                              InstanceContext->MetadataStore.FileObject );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    RtlZeroMemory( &checkpoint, sizeof( checkpoint ) );
+
+    checkpoint.Signature = FMM_METADATA_SIGNATURE;
+    checkpoint.Version = FMM_METADATA_VERSION;
+    checkpoint.Sequence = store->Sequence + 1;
+    checkpoint.LogStart = LogStart;
+    checkpoint.LogEnd = LogEnd;
+    checkpoint.Checksum = FmmMetadataChecksum( &checkpoint,
+                                               FIELD_OFFSET( FMM_METADATA_CHECKPOINT, Checksum ) );
+
+    status = FmmWriteMetadataFile( InstanceContext,
+                                   (checkpoint.Sequence % 2) * FMM_METADATA_SLOT_STRIDE,
+                                   &checkpoint,
+                                   sizeof( checkpoint ) );
+
+    if (NT_SUCCESS( status )) {
+
+        status = FltFlushBuffers( InstanceContext->Instance,
+                                  InstanceContext->MetadataStore.FileObject );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        store->Sequence = checkpoint.Sequence;
+        store->LogStart = LogStart;
+        store->LogEnd = LogEnd;
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+FmmWriteMetadataSnapshot (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_reads_bytes_opt_(Length) PVOID Snapshot,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine replaces the log in the metadata file with a snapshot of the
+    table and trims the file.
+
+    The snapshot must end up right after the checkpoint slots, but that space
+    may hold records the current checkpoint still needs. In that case the
+    snapshot is first written past both the current log and the target range,
+    and checkpointed there. That frees the target range, and the snapshot is
+    then rewritten there and checkpointed again. A crash at any point leaves a
+    complete log behind one of the checkpoints.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    Snapshot            - Supplies the records of the snapshot.
+    Length              - Supplies the length of the snapshot in bytes.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    FILE_END_OF_FILE_INFORMATION endOfFile;
+    ULONGLONG offset;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (store->LogStart < FMM_METADATA_LOG_OFFSET + (ULONGLONG) Length) {
+
+        offset = max( store->LogEnd, FMM_METADATA_LOG_OFFSET + (ULONGLONG) Length );
+
+        status = FmmWriteMetadataFile( InstanceContext, offset, Snapshot, Length );
+
+        if (NT_SUCCESS( status )) {
+
+            status = FmmWriteMetadataCheckpoint( InstanceContext,
+                                                 offset,
+                                                 offset + Length );
+        }
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+    }
+
+    status = FmmWriteMetadataFile( InstanceContext,
+                                   FMM_METADATA_LOG_OFFSET,
+                                   Snapshot,
+                                   Length );
+
+    if (NT_SUCCESS( status )) {
+
+        status = FmmWriteMetadataCheckpoint( InstanceContext,
+                                             FMM_METADATA_LOG_OFFSET,
+                                             FMM_METADATA_LOG_OFFSET + Length );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        //
+        //  Everything past the snapshot is dead. Failing to trim it only
+        //  wastes space.
+        //
+
+        endOfFile.EndOfFile.QuadPart = FMM_METADATA_LOG_OFFSET + Length;
+
+        (VOID) FltSetInformationFile( InstanceContext->Instance,
+                                      InstanceContext->MetadataStore.FileObject,
+                                      &endOfFile,
+                                      sizeof( endOfFile ),
+                                      FileEndOfFileInformation );
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: Wrote metadata snapshot (Volume = %p, Length = 0x%x)\n",
+                     InstanceContext->Volume,
+                     Length) );
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+FmmBuildMetadataSnapshot (
+    _In_ PFMM_METADATA_STORE Store,
+    _Outptr_result_bytebuffer_maybenull_(*Length) PVOID *Snapshot,
+    _Out_ PULONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine formats every record in the table into a buffer.
+
+Arguments:
+
+    Store               - Supplies the metadata store.
+    Snapshot            - Receives the buffer, or NULL if the table is empty.
+                          Free it with the FMM_METADATA_IO_TAG tag.
+    Length              - Receives the length of the snapshot in bytes.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The caller must hold the store resource.
+
+--*/
+{
+    PFMM_METADATA_ENTRY entry;
+    PUCHAR buffer;
+    PVOID restartKey = NULL;
+    ULONG offset = 0;
+
+    PAGED_CODE();
+
+    *Snapshot = NULL;
+    *Length = 0;
+
+    if (Store->LiveBytes == 0) {
+
+        return STATUS_SUCCESS;
+    }
+
+    buffer = ExAllocatePoolWithTag( PagedPool,
+                                    Store->LiveBytes,
+                                    FMM_METADATA_IO_TAG );
+
+    if (buffer == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (entry = RtlEnumerateGenericTableWithoutSplayingAvl( &Store->Table, &restartKey );
+         entry != NULL;
+         entry = RtlEnumerateGenericTableWithoutSplayingAvl( &Store->Table, &restartKey )) {
+
+        FLT_ASSERT( offset + FMM_METADATA_RECORD_LENGTH( entry->DataLength ) <= Store->LiveBytes );
+
+        FmmFormatMetadataRecord( (PFMM_METADATA_RECORD) (buffer + offset),
+                                 entry->Key,
+                                 entry->Data,
+                                 entry->DataLength,
+                                 0 );
+
+        offset += FMM_METADATA_RECORD_LENGTH( entry->DataLength );
+    }
+
+    FLT_ASSERT( offset == Store->LiveBytes );
+
+    *Snapshot = buffer;
+    *Length = offset;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+FmmApplyMetadataRecord (
+    _Inout_ PFMM_METADATA_STORE Store,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_opt_(DataLength) PVOID Data,
+    _In_ ULONG DataLength,
+    _In_ BOOLEAN Delete
+    )
+/*++
+
+Routine Description:
+
+    This routine applies an update to the in memory table.
+
+Arguments:
+
+    Store               - Supplies the metadata store.
+    Key                 - Supplies the key of the record.
+    Data                - Supplies the new record data.
+    DataLength          - Supplies the length of the new record data.
+    Delete              - Supplies if the record is being deleted.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The caller must hold the store resource exclusive.
+
+--*/
+{
+    FMM_METADATA_ENTRY newEntry;
+    PFMM_METADATA_ENTRY entry;
+    PVOID data;
+
+    PAGED_CODE();
+
+    entry = RtlLookupElementGenericTableAvl( &Store->Table, &Key );
+
+    if (Delete) {
+
+        if (entry != NULL) {
+
+            Store->LiveBytes -= FMM_METADATA_RECORD_LENGTH( entry->DataLength );
+
+            ExFreePoolWithTag( entry->Data, FMM_METADATA_ENTRY_TAG );
+            RtlDeleteElementGenericTableAvl( &Store->Table, &Key );
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    if (entry != NULL && entry->DataLength == DataLength) {
+
+        //
+        //  Same size, update in place.
+        //
+
+        RtlCopyMemory( entry->Data, Data, DataLength );
+        return STATUS_SUCCESS;
+    }
+
+    data = ExAllocatePoolWithTag( PagedPool,
+                                  DataLength,
+                                  FMM_METADATA_ENTRY_TAG );
+
+    if (data == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlCopyMemory( data, Data, DataLength );
+
+    if (entry == NULL) {
+
+        newEntry.Key = Key;
+        newEntry.DataLength = DataLength;
+        newEntry.Data = data;
+
+        entry = RtlInsertElementGenericTableAvl( &Store->Table,
+                                                 &newEntry,
+                                                 sizeof( newEntry ),
+                                                 NULL );
+
+        if (entry == NULL) {
+
+            ExFreePoolWithTag( data, FMM_METADATA_ENTRY_TAG );
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+    } else {
+
+        Store->LiveBytes -= FMM_METADATA_RECORD_LENGTH( entry->DataLength );
+
+        ExFreePoolWithTag( entry->Data, FMM_METADATA_ENTRY_TAG );
+        entry->Data = data;
+        entry->DataLength = DataLength;
+    }
+
+    Store->LiveBytes += FMM_METADATA_RECORD_LENGTH( DataLength );
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+FmmLogMetadataRecord (
+    _Inout_ PFMM_METADATA_STORE Store,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_opt_(DataLength) PVOID Data,
+    _In_ ULONG DataLength,
+    _In_ USHORT Flags
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a record to the pending log.
+
+Arguments:
+
+    Store               - Supplies the metadata store.
+    Key                 - Supplies the key of the record.
+    Data                - Supplies the record data.
+    DataLength          - Supplies the length of the record data.
+    Flags               - Supplies the FMM_METADATA_RECORD_F_XXX flags.
+
+Return Value:
+
+    None. If the record cannot be logged the log is discarded and the store
+    is marked as needing a snapshot; the table already holds the update.
+
+Note:
+
+    The caller must hold the store resource exclusive.
+
+--*/
+{
+    PFMM_METADATA_LOG_CHUNK chunk = NULL;
+    USHORT recordLength = FMM_METADATA_RECORD_LENGTH( DataLength );
+
+    PAGED_CODE();
+
+    //
+    //  A snapshot will capture this update anyway.
+    //
+
+    if (Store->NeedsSnapshot) {
+
+        return;
+    }
+
+    if (Store->LogBytes + recordLength > FMM_METADATA_MAX_LOG_BYTES) {
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: Metadata log full, falling back to a snapshot (Store = %p)\n",
+                     Store) );
+
+        FmmDiscardMetadataLog( Store, NULL );
+        Store->NeedsSnapshot = TRUE;
+        return;
+    }
+
+    if (!IsListEmpty( &Store->LogChunks )) {
+
+        chunk = CONTAINING_RECORD( Store->LogChunks.Blink, FMM_METADATA_LOG_CHUNK, Links );
+
+        if (FMM_METADATA_LOG_CHUNK_SIZE - chunk->Used < recordLength) {
+
+            chunk = NULL;
+        }
+    }
+
+    if (chunk == NULL) {
+
+        chunk = ExAllocatePoolWithTag( PagedPool,
+                                       sizeof( FMM_METADATA_LOG_CHUNK ),
+                                       FMM_METADATA_LOG_TAG );
+
+        if (chunk == NULL) {
+
+            FmmDiscardMetadataLog( Store, NULL );
+            Store->NeedsSnapshot = TRUE;
+            return;
+        }
+
+        chunk->Used = 0;
+        InsertTailList( &Store->LogChunks, &chunk->Links );
+    }
+
+    FmmFormatMetadataRecord( (PFMM_METADATA_RECORD) &chunk->Data[chunk->Used],
+                             Key,
+                             Data,
+                             DataLength,
+                             Flags );
+
+    chunk->Used += recordLength;
+    Store->LogBytes += recordLength;
+}
+
+
+VOID
+FmmDiscardMetadataLog (
+    _Inout_ PFMM_METADATA_STORE Store,
+    _Inout_opt_ PLIST_ENTRY Chunks
+    )
+/*++
+
+Routine Description:
+
+    This routine empties the pending log, either handing the chunks to the
+    caller or freeing them.
+
+Arguments:
+
+    Store               - Supplies the metadata store.
+    Chunks              - Supplies an empty list to receive the chunks, or
+                          NULL to free them.
+
+Return Value:
+
+    None.
+
+Note:
+
+    The caller must hold the store resource exclusive.
+
+--*/
+{
+    PLIST_ENTRY entry;
+
+    PAGED_CODE();
+
+    while (!IsListEmpty( &Store->LogChunks )) {
+
+        entry = RemoveHeadList( &Store->LogChunks );
+
+        if (ARGUMENT_PRESENT( Chunks )) {
+
+            InsertTailList( Chunks, entry );
+
+        } else {
+
+            ExFreePoolWithTag( CONTAINING_RECORD( entry, FMM_METADATA_LOG_CHUNK, Links ),
+                               FMM_METADATA_LOG_TAG );
+        }
+    }
+
+    Store->LogBytes = 0;
+}
+
+
+VOID
+FmmFormatMetadataRecord (
+    _Out_ PFMM_METADATA_RECORD Record,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_opt_(DataLength) PVOID Data,
+    _In_ ULONG DataLength,
+    _In_ USHORT Flags
+    )
+/*++
+
+Routine Description:
+
+    This routine formats a record, including its padding and checksum.
+
+Arguments:
+
+    Record              - Receives the record. It must have room for
+                          FMM_METADATA_RECORD_LENGTH( DataLength ) bytes.
+    Key                 - Supplies the key of the record.
+    Data                - Supplies the record data.
+    DataLength          - Supplies the length of the record data.
+    Flags               - Supplies the FMM_METADATA_RECORD_F_XXX flags.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    USHORT recordLength = FMM_METADATA_RECORD_LENGTH( DataLength );
+
+    PAGED_CODE();
+
+    RtlZeroMemory( Record, recordLength );
+
+    Record->RecordLength = recordLength;
+    Record->Flags = Flags;
+    Record->Key = Key;
+    Record->DataLength = DataLength;
+
+    if (DataLength > 0) {
+
+        RtlCopyMemory( Record->Data, Data, DataLength );
+    }
+
+    Record->Checksum = FmmMetadataChecksum( &Record->RecordLength,
+                                            recordLength - FIELD_OFFSET( FMM_METADATA_RECORD, RecordLength ) );
+}
+
+
+ULONG
+FmmMetadataChecksum (
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine computes the 32 bit FNV-1a hash of a buffer. It is only used
+    to detect torn or stale writes, not tampering.
+
+Arguments:
+
+    Buffer              - Supplies the data.
+    Length              - Supplies the length of the data.
+
+Return Value:
+
+    The checksum.
+
+--*/
+{
+    PUCHAR bytes = Buffer;
+    ULONG hash = 2166136261;
+
+    PAGED_CODE();
+
+    while (Length-- > 0) {
+
+        hash ^= *bytes++;
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+
+VOID
+FmmInitializeMetadataStore (
+    _Out_ PFMM_METADATA_STORE Store
+    )
+/*++
+
+Routine Description:
+
+    This routine initializes an empty metadata store.
+
+Arguments:
+
+    Store               - Supplies the metadata store.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    ExInitializeResourceLite( &Store->Resource );
+    ExInitializeResourceLite( &Store->FileResource );
+    Store->FileObject = NULL;
+
+    RtlInitializeGenericTableAvl( &Store->Table,
+                                  FmmCompareMetadataEntries,
+                                  FmmAllocateMetadataEntry,
+                                  FmmFreeMetadataEntry,
+                                  NULL );
+
+    InitializeListHead( &Store->LogChunks );
+    Store->LogBytes = 0;
+    Store->LiveBytes = 0;
+    Store->Loaded = FALSE;
+    Store->NeedsSnapshot = FALSE;
+
+    Store->LogStart = FMM_METADATA_LOG_OFFSET;
+    Store->LogEnd = FMM_METADATA_LOG_OFFSET;
+    Store->Sequence = 0;
+
+    Store->FlushThread = NULL;
+    KeInitializeEvent( &Store->FlushEvent, SynchronizationEvent, FALSE );
+    KeInitializeEvent( &Store->StopEvent, NotificationEvent, FALSE );
+}
+
+
+VOID
+FmmDeleteMetadataStore (
+    _Inout_ PFMM_METADATA_STORE Store
+    )
+/*++
+
+Routine Description:
+
+    This routine frees everything held by a metadata store.
+
+Arguments:
+
+    Store               - Supplies the metadata store.
+
+Return Value:
+
+    None.
+
+Note:
+
+    The flush thread must have been stopped.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT( Store->FlushThread == NULL );
+    FLT_ASSERT( Store->FileObject == NULL );
+
+    FmmResetMetadataStore( Store );
+
+    ExDeleteResourceLite( &Store->FileResource );
+    ExDeleteResourceLite( &Store->Resource );
+}
+
+
+VOID
+FmmResetMetadataStore (
+    _Inout_ PFMM_METADATA_STORE Store
+    )
+/*++
+
+Routine Description:
+
+    This routine empties the table and the pending log. The store is then
+    considered loaded, and the next flush writes an (empty) snapshot.
+
+Arguments:
+
+    Store               - Supplies the metadata store.
+
+Return Value:
+
+    None.
+
+Note:
+
+    The position of the log in the file is kept, so that the snapshot is not
+    written over records the current checkpoint still points at.
+
+--*/
+{
+    PFMM_METADATA_ENTRY entry;
+
+    PAGED_CODE();
+
+    FmmAcquireResourceExclusive( &Store->Resource );
+
+    while ((entry = RtlGetElementGenericTableAvl( &Store->Table, 0 )) != NULL) {
+
+        ExFreePoolWithTag( entry->Data, FMM_METADATA_ENTRY_TAG );
+        RtlDeleteElementGenericTableAvl( &Store->Table, &entry->Key );
+    }
+
+    FmmDiscardMetadataLog( Store, NULL );
+
+    Store->LiveBytes = 0;
+    Store->NeedsSnapshot = TRUE;
+    Store->Loaded = TRUE;
+
+    FmmReleaseResource( &Store->Resource );
+}
+
+
+NTSTATUS
+FmmStartMetadataFlushThread (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine starts the thread that writes the metadata log for this
+    instance. The thread holds a reference to the instance context.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+
+Return Value:
+
+    Returns the status of this operation.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+    HANDLE threadHandle;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    FLT_ASSERT( store->FlushThread == NULL );
+
+    FltReferenceContext( InstanceContext );
+
+    status = PsCreateSystemThread( &threadHandle,
+                                   THREAD_ALL_ACCESS,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   FmmMetadataFlushThread,
+                                   InstanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        FltReleaseContext( InstanceContext );
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle( threadHandle,
+                                        SYNCHRONIZE,
+                                        *PsThreadType,
+                                        KernelMode,
+                                        &store->FlushThread,
+                                        NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        //
+        //  We cannot wait for the thread, so tell it to go away now.
+        //
+
+        store->FlushThread = NULL;
+        KeSetEvent( &store->StopEvent, IO_NO_INCREMENT, FALSE );
+    }
+
+    ZwClose( threadHandle );
+
+    return status;
+}
+
+
+VOID
+FmmStopMetadataFlushThread (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine stops the flush thread for this instance and waits for it
+    to exit. Whatever is still pending is written when the metadata file is
+    closed.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PFMM_METADATA_STORE store = &InstanceContext->MetadataStore;
+
+    PAGED_CODE();
+
+    if (store->FlushThread == NULL) {
+
+        return;
+    }
+
+    KeSetEvent( &store->StopEvent, IO_NO_INCREMENT, FALSE );
+
+    KeWaitForSingleObject( store->FlushThread,
+                           Executive,
+                           KernelMode,
+                           FALSE,
+                           NULL );
+
+    ObDereferenceObject( store->FlushThread );
+    store->FlushThread = NULL;
+}
+
+
+VOID
+FmmMetadataFlushThread (
+    _In_ PVOID StartContext
+    )
+/*++
+
+Routine Description:
+
+    This is the flush thread for an instance. It writes the metadata log
+    whenever enough of it is pending, and otherwise once a second. After a
+    failed write it backs off; the store has fallen back to a snapshot, and
+    retrying right away would only rebuild and fail to write it again.
+
+Arguments:
+
+    StartContext        - Supplies the (referenced) instance context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PFMM_INSTANCE_CONTEXT instanceContext = StartContext;
+    PFMM_METADATA_STORE store = &instanceContext->MetadataStore;
+    PVOID waitObjects[2];
+    LARGE_INTEGER interval;
+    ULONG failures = 0;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    waitObjects[0] = &store->StopEvent;
+    waitObjects[1] = &store->FlushEvent;
+
+#pragma warning(push)
+#pragma warning(disable:4127) //  Conditional expression is constant
+    while (TRUE) {
+
+#pragma warning(pop)
+
+        //
+        //  While backing off only the stop event is waited on, so a growing
+        //  log does not bring the next attempt forward.
+        //
+
+        interval.QuadPart = FMM_METADATA_FLUSH_INTERVAL * (LONGLONG) (1 << failures);
+
+        status = KeWaitForMultipleObjects( (failures == 0) ? 2 : 1,
+                                           waitObjects,
+                                           WaitAny,
+                                           Executive,
+                                           KernelMode,
+                                           FALSE,
+                                           &interval,
+                                           NULL );
+
+        if (status == STATUS_WAIT_0) {
+
+            break;
+        }
+
+        //
+        //  Only the store file resource is taken. The instance context is
+        //  left alone, so volume locks, dismounts and unlocks are not failed
+        //  because of us; closing the metadata file waits for this flush
+        //  instead. If the metadata file is closed there is nothing to do.
+        //
+
+        FmmAcquireResourceExclusive( &store->FileResource );
+
+        if (store->FileObject != NULL) {
+
+            status = FmmFlushMetadataLog( instanceContext );
+
+            if (NT_SUCCESS( status )) {
+
+                failures = 0;
+
+            } else if (failures < FMM_METADATA_FLUSH_MAX_BACKOFF) {
+
+                failures += 1;
+            }
+        }
+
+        FmmReleaseResource( &store->FileResource );
+    }
+
+    FltReleaseContext( instanceContext );
+
+    PsTerminateSystemThread( STATUS_SUCCESS );
+}
+
+
+RTL_GENERIC_COMPARE_RESULTS
+NTAPI
+FmmCompareMetadataEntries (
+    _In_ PRTL_AVL_TABLE Table,
+    _In_ PVOID FirstStruct,
+    _In_ PVOID SecondStruct
+    )
+/*++
+
+Routine Description:
+
+    Compares two table elements (or keys) by key.
+
+--*/
+{
+    ULONGLONG first = *(PULONGLONG) FirstStruct;
+    ULONGLONG second = *(PULONGLONG) SecondStruct;
+
+    UNREFERENCED_PARAMETER( Table );
+
+    PAGED_CODE();
+
+    if (first < second) {
+
+        return GenericLessThan;
+
+    } else if (first > second) {
+
+        return GenericGreaterThan;
+    }
+
+    return GenericEqual;
+}
+
+
+PVOID
+NTAPI
+FmmAllocateMetadataEntry (
+    _In_ PRTL_AVL_TABLE Table,
+    _In_ CLONG ByteSize
+    )
+/*++
+
+Routine Description:
+
+    Allocates a table element.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( Table );
+
+    PAGED_CODE();
+
+    return ExAllocatePoolWithTag( PagedPool, ByteSize, FMM_METADATA_ENTRY_TAG );
+}
+
+
+VOID
+NTAPI
+FmmFreeMetadataEntry (
+    _In_ PRTL_AVL_TABLE Table,
+    _In_ __drv_freesMem(Mem) _Post_invalid_ PVOID Buffer
+    )
+/*++
+
+Routine Description:
+
+    Frees a table element.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( Table );
+
+    PAGED_CODE();
+
+    ExFreePoolWithTag( Buffer, FMM_METADATA_ENTRY_TAG );
+}
+
+
 #if VERIFY_METADATA_OPENED
 
 NTSTATUS
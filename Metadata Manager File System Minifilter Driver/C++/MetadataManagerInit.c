@@ -114,27 +114,16 @@ FmmInitializeDebugLevel (
 
 
 //
-//  If we need to verify that the metadata file is indeed open whenever
-//  a create suceeds on the volume, then we need to monitor all creates 
-//  not just DASD creates.
-
-//  If that is not the case, then we are better off telling filter manager 
-//  to show us only DASD creates. That way we can avoid the performance 
-//  penalty of being called for all creates when we only have use for DASD
-//  creates.
+//  The metadata store keeps a record for the files on the volume, so we
+//  need to see all creates and cleanups, not just DASD ones. FmmPreCreate
+//  and FmmPreCleanup only ask for a post-op callback for the few that
+//  create, overwrite or may delete a file (or for every create if we need
+//  to verify that the metadata file is indeed open whenever a create
+//  suceeds on the volume), so the others just pass through.
 //
 
-
-#if VERIFY_METADATA_OPENED
-
 #define OPERATION_REGISTRATION_FLAGS_FOR_CREATE (FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO)
 
-#else
-
-#define OPERATION_REGISTRATION_FLAGS_FOR_CREATE (FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO | FLTFL_OPERATION_REGISTRATION_SKIP_NON_DASD_IO)
-
-#endif
-
 
 
 //
@@ -149,7 +138,7 @@ FLT_OPERATION_REGISTRATION Callbacks[] = {
       FmmPostCreate },
 
     { IRP_MJ_CLEANUP,
-      FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO | FLTFL_OPERATION_REGISTRATION_SKIP_NON_DASD_IO,
+      FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO,
       FmmPreCleanup,
       FmmPostCleanup },
 
@@ -433,6 +422,8 @@ FmmContextCleanup (
                     ("[Fmm]: Cleaning up instance context for volume (Context = %p)\n",
                     instanceContext) );
 
+        FmmDeleteMetadataStore( &instanceContext->MetadataStore );
+
         ExDeleteResourceLite( &instanceContext->MetadataResource );
 
         break;
@@ -580,6 +571,7 @@ Return Value:
     instanceContext->FilesystemType = VolumeFilesystemType;
     instanceContext->Volume = FltObjects->Volume;
     ExInitializeResourceLite( &instanceContext->MetadataResource );
+    FmmInitializeMetadataStore( &instanceContext->MetadataStore );
 
 
     //
@@ -635,6 +627,19 @@ Return Value:
         goto FmmInstanceSetupCleanup;
     }
 
+    //
+    //  Start the thread that writes the metadata log. If it cannot be
+    //  started, updates still reach the metadata file when it is closed.
+    //
+
+    if (!NT_SUCCESS( FmmStartMetadataFlushThread( instanceContext ) )) {
+
+        DebugTrace( DEBUG_TRACE_INSTANCES | DEBUG_TRACE_ERROR,
+                    ("[Fmm]: Failed to start metadata flush thread (Volume = %p, Instance = %p)\n",
+                     FltObjects->Volume,
+                     FltObjects->Instance) );
+    }
+
 
 FmmInstanceSetupCleanup:
 
@@ -770,6 +775,9 @@ Return Value:
 
 --*/
 {
+    PFMM_INSTANCE_CONTEXT instanceContext;
+    NTSTATUS status;
+
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( Flags );
 
@@ -779,6 +787,20 @@ Return Value:
                 ("[Fmm]: Instance teardown start started (Instance = %p)\n",
                  FltObjects->Instance) );
 
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (NT_SUCCESS( status )) {
+
+        //
+        //  Stop the metadata flush thread. Anything still pending is written
+        //  when the metadata file is closed at teardown complete.
+        //
+
+        FmmStopMetadataFlushThread( instanceContext );
+
+        FltReleaseContext( instanceContext );
+    }
 
     DebugTrace( DEBUG_TRACE_INSTANCES,
                 ("[Fmm]: Instance teardown start ended (Instance = %p)\n",
@@ -163,6 +163,190 @@ FmmEndFileSystemOperation (
     );
 
 
+_Requires_lock_held_(_Global_critical_region_)
+_Requires_lock_held_(InstanceContext->MetadataStore.FileResource)
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmFlushMetadataLog (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmQueryMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Key,
+    _Out_writes_bytes_to_opt_(BufferLength, *ReturnedLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_ PULONG ReturnedLength
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmSetMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_(DataLength) PVOID Data,
+    _In_ ULONG DataLength
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+FmmDeleteMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Key
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmUpdateFileMetadata (
+    _In_ PFLT_CALLBACK_DATA Cbd,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmDeleteFileMetadata (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ ULONGLONG FileId
+    );
+
+VOID
+FmmInitializeMetadataStore (
+    _Out_ PFMM_METADATA_STORE Store
+    );
+
+VOID
+FmmDeleteMetadataStore (
+    _Inout_ PFMM_METADATA_STORE Store
+    );
+
+VOID
+FmmResetMetadataStore (
+    _Inout_ PFMM_METADATA_STORE Store
+    );
+
+NTSTATUS
+FmmStartMetadataFlushThread (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    );
+
+VOID
+FmmStopMetadataFlushThread (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    );
+
+NTSTATUS
+FmmLoadMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ BOOLEAN Created
+    );
+
+NTSTATUS
+FmmReadMetadataFile (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Offset,
+    _Out_writes_bytes_to_(Length, *BytesRead) PVOID Buffer,
+    _In_ ULONG Length,
+    _Out_ PULONG BytesRead
+    );
+
+NTSTATUS
+FmmWriteMetadataFile (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+NTSTATUS
+FmmWriteMetadataCheckpoint (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_ ULONGLONG LogStart,
+    _In_ ULONGLONG LogEnd
+    );
+
+NTSTATUS
+FmmWriteMetadataSnapshot (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _In_reads_bytes_opt_(Length) PVOID Snapshot,
+    _In_ ULONG Length
+    );
+
+NTSTATUS
+FmmBuildMetadataSnapshot (
+    _In_ PFMM_METADATA_STORE Store,
+    _Outptr_result_bytebuffer_maybenull_(*Length) PVOID *Snapshot,
+    _Out_ PULONG Length
+    );
+
+NTSTATUS
+FmmApplyMetadataRecord (
+    _Inout_ PFMM_METADATA_STORE Store,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_opt_(DataLength) PVOID Data,
+    _In_ ULONG DataLength,
+    _In_ BOOLEAN Delete
+    );
+
+VOID
+FmmLogMetadataRecord (
+    _Inout_ PFMM_METADATA_STORE Store,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_opt_(DataLength) PVOID Data,
+    _In_ ULONG DataLength,
+    _In_ USHORT Flags
+    );
+
+VOID
+FmmDiscardMetadataLog (
+    _Inout_ PFMM_METADATA_STORE Store,
+    _Inout_opt_ PLIST_ENTRY Chunks
+    );
+
+VOID
+FmmFormatMetadataRecord (
+    _Out_ PFMM_METADATA_RECORD Record,
+    _In_ ULONGLONG Key,
+    _In_reads_bytes_opt_(DataLength) PVOID Data,
+    _In_ ULONG DataLength,
+    _In_ USHORT Flags
+    );
+
+ULONG
+FmmMetadataChecksum (
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+KSTART_ROUTINE FmmMetadataFlushThread;
+VOID
+FmmMetadataFlushThread (
+    _In_ PVOID StartContext
+    );
+
+RTL_GENERIC_COMPARE_RESULTS
+NTAPI
+FmmCompareMetadataEntries (
+    _In_ PRTL_AVL_TABLE Table,
+    _In_ PVOID FirstStruct,
+    _In_ PVOID SecondStruct
+    );
+
+PVOID
+NTAPI
+FmmAllocateMetadataEntry (
+    _In_ PRTL_AVL_TABLE Table,
+    _In_ CLONG ByteSize
+    );
+
+VOID
+NTAPI
+FmmFreeMetadataEntry (
+    _In_ PRTL_AVL_TABLE Table,
+    _In_ __drv_freesMem(Mem) _Post_invalid_ PVOID Buffer
+    );
+
 #if VERIFY_METADATA_OPENED
     
 NTSTATUS
@@ -198,6 +382,12 @@ FmmIsImplicitVolumeLock(
     _Out_ PBOOLEAN IsLock
     );
 
+NTSTATUS
+FmmGetFileId (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_ PULONGLONG FileId
+    );
+
 //
 //  Lock primitives
 //
@@ -33,6 +33,10 @@ Environment:
 
 #define FMM_STRING_TAG                        'tSmF'
 #define FMM_INSTANCE_CONTEXT_TAG              'cImF'
+#define FMM_METADATA_ENTRY_TAG                'eMmF'
+#define FMM_METADATA_LOG_TAG                  'lMmF'
+#define FMM_METADATA_IO_TAG                   'iMmF'
+#define FMM_FILE_ID_TAG                       'dFmF'
 
 
 //
@@ -86,6 +90,269 @@ extern FMM_GLOBAL_DATA Globals;
 #define INSTANCE_CONTEXT_F_METADATA_OPENED      0x00000002
 
 
+//
+//  In-memory metadata store.
+//
+//  Metadata is a set of records keyed by file id.  The authoritative copy
+//  lives in an AVL table protected by its own resource, so lookups only
+//  take that resource shared and never touch the metadata file.  Updates
+//  are applied to the table and appended to an in-memory log; a per-volume
+//  thread writes the log to the metadata file in large writes and then
+//  checkpoints it.
+//
+//  The metadata file layout is:
+//
+//      0                               Checkpoint slot 0
+//      FMM_METADATA_SLOT_STRIDE        Checkpoint slot 1
+//      FMM_METADATA_LOG_OFFSET         Records
+//
+//  Records in [LogStart, LogEnd) of the newest valid checkpoint are
+//  replayed in order when the file is opened; later records supersede
+//  earlier ones.  A checkpoint is only written once the records it covers
+//  have been flushed, so a crash loses at most the updates made since the
+//  last checkpoint.  The slots are a sector apart so a torn write can only
+//  damage one of them.
+//
+
+#define FMM_METADATA_SIGNATURE                'dMmF'
+#define FMM_METADATA_VERSION                  1
+
+#define FMM_METADATA_SLOT_STRIDE              4096
+#define FMM_METADATA_LOG_OFFSET               (2 * FMM_METADATA_SLOT_STRIDE)
+
+#define FMM_METADATA_MAX_DATA_LENGTH          1024
+
+//
+//  Pending log bytes which cause the flush thread to be woken early, and
+//  the interval at which it otherwise flushes whatever is pending.
+//
+
+#define FMM_METADATA_FLUSH_THRESHOLD          (256 * 1024)
+#define FMM_METADATA_FLUSH_INTERVAL           (-10 * 1000 * 1000)   // 1 second, relative
+
+//
+//  After a failed flush the interval doubles with each further failure, up
+//  to 2^FMM_METADATA_FLUSH_MAX_BACKOFF times the normal interval, and the
+//  flush event is ignored until the next attempt.
+//
+
+#define FMM_METADATA_FLUSH_MAX_BACKOFF        6
+
+//
+//  If the file cannot be written (it is closed while the volume is locked,
+//  say) the log is allowed to grow to this size before it is discarded in
+//  favour of writing a snapshot of the table once the file is back.
+//
+
+#define FMM_METADATA_MAX_LOG_BYTES            (4 * 1024 * 1024)
+
+//
+//  The log is compacted into a snapshot of the table once it is at least
+//  this big and four times the size of the live records.
+//
+
+#define FMM_METADATA_COMPACT_SIZE             (1024 * 1024)
+
+#define FMM_METADATA_IO_SIZE                  (64 * 1024)
+
+typedef struct _FMM_METADATA_CHECKPOINT {
+
+    ULONG Signature;
+    ULONG Version;
+
+    //
+    //  The slot with the highest sequence number wins.
+    //
+
+    ULONGLONG Sequence;
+
+    //
+    //  Byte range of the records to replay.
+    //
+
+    ULONGLONG LogStart;
+    ULONGLONG LogEnd;
+
+    //
+    //  Checksum of the fields above.
+    //
+
+    ULONG Checksum;
+
+} FMM_METADATA_CHECKPOINT, *PFMM_METADATA_CHECKPOINT;
+
+//
+//  Record flags
+//
+
+#define FMM_METADATA_RECORD_F_DELETE          0x0001
+
+typedef struct _FMM_METADATA_RECORD {
+
+    //
+    //  Checksum of the record from RecordLength to the end of the record.
+    //
+
+    ULONG Checksum;
+
+    //
+    //  Length of the whole record including padding; records are 8 byte
+    //  aligned.
+    //
+
+    USHORT RecordLength;
+
+    USHORT Flags;
+
+    ULONGLONG Key;
+
+    ULONG DataLength;
+
+    UCHAR Data[1];
+
+} FMM_METADATA_RECORD, *PFMM_METADATA_RECORD;
+
+#define FMM_METADATA_RECORD_LENGTH(DataLength)                              \
+    ((USHORT) ROUND_TO_SIZE( FIELD_OFFSET( FMM_METADATA_RECORD, Data ) +    \
+                             (DataLength),                                  \
+                             sizeof( ULONGLONG ) ))
+
+//
+//  Element stored in the table.  The key must be first.
+//
+
+typedef struct _FMM_METADATA_ENTRY {
+
+    ULONGLONG Key;
+
+    ULONG DataLength;
+
+    PVOID Data;
+
+} FMM_METADATA_ENTRY, *PFMM_METADATA_ENTRY;
+
+//
+//  A chunk of the in-memory log.  Records never straddle chunks, so the
+//  chunks can be written back to back.
+//
+
+#define FMM_METADATA_LOG_CHUNK_SIZE           (60 * 1024)
+
+typedef struct _FMM_METADATA_LOG_CHUNK {
+
+    LIST_ENTRY Links;
+
+    ULONG Used;
+
+    UCHAR Data[FMM_METADATA_LOG_CHUNK_SIZE];
+
+} FMM_METADATA_LOG_CHUNK, *PFMM_METADATA_LOG_CHUNK;
+
+typedef struct _FMM_METADATA_STORE {
+
+    //
+    //  Protects the table and the pending log.  Lookups take it shared.
+    //  It is never held across a file system operation.
+    //
+
+    ERESOURCE Resource;
+
+    RTL_AVL_TABLE Table;
+
+    //
+    //  Number of bytes the live records would take in the file.
+    //
+
+    ULONG LiveBytes;
+
+    //
+    //  Pending log chunks, oldest first, and the number of bytes in them.
+    //
+
+    LIST_ENTRY LogChunks;
+    ULONG LogBytes;
+
+    //
+    //  TRUE once the metadata file has been replayed into the table.
+    //
+
+    BOOLEAN Loaded;
+
+    //
+    //  TRUE if the pending log was discarded (or could not be written) and
+    //  the next flush must write a snapshot of the table instead.
+    //
+
+    BOOLEAN NeedsSnapshot;
+
+    //
+    //  Serializes writers of the metadata file: the flush thread, and the
+    //  open and close paths while they have the instance context in
+    //  transition.  The flush thread takes only this resource, never the
+    //  instance context resource, so flushing does not put the instance
+    //  context in transition or hold up volume locks and dismounts for
+    //  longer than a flush already in progress takes.
+    //
+
+    ERESOURCE FileResource;
+
+    //
+    //  The metadata file object the store reads and writes, or NULL while
+    //  the metadata file is closed.  Only changed with FileResource held
+    //  exclusive.
+    //
+
+    PFILE_OBJECT FileObject;
+
+    //
+    //  Position of the log in the metadata file, and the sequence number
+    //  of the last checkpoint.  Only used with FileResource held exclusive.
+    //
+
+    ULONGLONG LogStart;
+    ULONGLONG LogEnd;
+    ULONGLONG Sequence;
+
+    //
+    //  The flush thread, and the events used to wake and stop it.
+    //
+
+    PKTHREAD FlushThread;
+    KEVENT FlushEvent;
+    KEVENT StopEvent;
+
+} FMM_METADATA_STORE, *PFMM_METADATA_STORE;
+
+//
+//  The record this sample keeps for each file, keyed by its file id. It is
+//  written when a file is created, overwritten or superseded, and deleted
+//  once the file is gone after the cleanup of a handle that had it marked
+//  for deletion.
+//
+
+typedef struct _FMM_FILE_METADATA {
+
+    //
+    //  System time the file was first created while we were watching.
+    //
+
+    LARGE_INTEGER CreationTime;
+
+    //
+    //  Process that created it.
+    //
+
+    ULONG CreatorProcessId;
+
+    //
+    //  Number of times it has been overwritten or superseded since.
+    //
+
+    ULONG OverwriteCount;
+
+} FMM_FILE_METADATA, *PFMM_FILE_METADATA;
+
+
 typedef struct _FMM_INSTANCE_CONTEXT {
 
     //
@@ -141,6 +408,12 @@ typedef struct _FMM_INSTANCE_CONTEXT {
 
     PFILE_OBJECT MetadataOpenTriggerFileObject;
 
+    //
+    //  The metadata records for this volume.
+    //
+
+    FMM_METADATA_STORE MetadataStore;
+
 } FMM_INSTANCE_CONTEXT, *PFMM_INSTANCE_CONTEXT;
 
 #define FMM_INSTANCE_CONTEXT_SIZE         sizeof( FMM_INSTANCE_CONTEXT )
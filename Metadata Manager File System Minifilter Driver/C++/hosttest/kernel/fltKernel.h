@@ -0,0 +1,490 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    fltKernel.h
+
+Abstract:
+
+    User mode stand-in for the kernel and FltMgr headers the Metadata
+    Manager filter includes, so that DataStore.c and Support.c, and with
+    them the metadata store, compile unchanged on the host.
+
+    There is one volume, with one instance of the filter on it, and the
+    only file on it that is read or written is the metadata file.  The
+    file is kept in memory twice: the image reads and writes see, and the
+    image that would survive a crash, which FltFlushBuffers brings up to
+    date.  Other files only exist to be asked their file id.
+
+    Resources and events are real, built on pthreads, and so are system
+    threads, since the metadata store flushes from one.  A thread is
+    waited on as the event signalled when it ends.  Handles are the
+    objects themselves, each holding a reference.  There is no IRQL and no
+    critical region; every thread runs at passive level.  The routines
+    declared at the bottom are supplied by host.c.
+
+Environment:
+
+    Host (user mode), C11 with -fms-extensions and -fshort-wchar.
+
+--*/
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define NOTHING
+#define NTAPI
+#define CONST                           const
+#define VOID                            void
+
+//
+//  The metadata store's inline routines are declared once without
+//  FORCEINLINE, so each has a single external definition, as with Msvc.
+//
+
+#define FORCEINLINE                     inline __attribute__(( always_inline ))
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Inout_opt_
+#define _Curr_
+#define _Post_invalid_
+#define _Flt_CompletionContext_Outptr_
+#define _In_reads_bytes_(...)
+#define _In_reads_bytes_opt_(...)
+#define _Out_writes_bytes_to_(...)
+#define _Out_writes_bytes_to_opt_(...)
+#define _Outptr_result_bytebuffer_maybenull_(...)
+#define _IRQL_requires_max_(...)
+#define _Requires_lock_held_(...)
+#define _Requires_lock_not_held_(...)
+#define _Acquires_lock_(...)
+#define _Acquires_exclusive_lock_(...)
+#define _Acquires_shared_lock_(...)
+#define _Releases_lock_(...)
+#define __drv_freesMem(...)
+
+typedef void                    *PVOID, *HANDLE, **PHANDLE;
+typedef char                    CHAR, *PCHAR, KPROCESSOR_MODE;
+typedef unsigned char           UCHAR, *PUCHAR, BOOLEAN, *PBOOLEAN, KIRQL;
+typedef short                   SHORT, CSHORT;
+typedef unsigned short          USHORT, *PUSHORT;
+typedef wchar_t                 WCHAR, *PWCHAR, *PWSTR;
+typedef const WCHAR             *PCWSTR;
+typedef int32_t                 LONG, *PLONG;
+typedef uint32_t                ULONG, *PULONG, CLONG, ACCESS_MASK;
+typedef int64_t                 LONGLONG, *PLONGLONG;
+typedef uint64_t                ULONGLONG, *PULONGLONG;
+typedef uintptr_t               ULONG_PTR, SIZE_T, ERESOURCE_THREAD;
+typedef LONG                    NTSTATUS, *PNTSTATUS;
+typedef ULONG                   FLT_POST_OPERATION_FLAGS;
+typedef ULONG                   FLT_IO_OPERATION_FLAGS;
+typedef PVOID                   PFLT_CONTEXT;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef enum _POOL_TYPE { NonPagedPool, PagedPool } POOL_TYPE;
+typedef enum _MODE { KernelMode, UserMode } MODE;
+typedef enum _KWAIT_REASON { Executive } KWAIT_REASON;
+typedef enum _WAIT_TYPE { WaitAll, WaitAny } WAIT_TYPE;
+typedef enum _EVENT_TYPE { NotificationEvent, SynchronizationEvent } EVENT_TYPE;
+
+typedef enum _FLT_FILESYSTEM_TYPE {
+    FLT_FSTYPE_UNKNOWN,
+    FLT_FSTYPE_RAW,
+    FLT_FSTYPE_NTFS,
+    FLT_FSTYPE_FAT,
+    FLT_FSTYPE_REFS = 27
+} FLT_FILESYSTEM_TYPE;
+
+typedef enum _FILE_INFORMATION_CLASS {
+    FileStandardInformation = 5,
+    FileInternalInformation = 6,
+    FileEndOfFileInformation = 20
+} FILE_INFORMATION_CLASS;
+
+typedef enum _FLT_PREOP_CALLBACK_STATUS {
+    FLT_PREOP_SUCCESS_WITH_CALLBACK,
+    FLT_PREOP_SUCCESS_NO_CALLBACK,
+    FLT_PREOP_PENDING,
+    FLT_PREOP_DISALLOW_FASTIO,
+    FLT_PREOP_COMPLETE,
+    FLT_PREOP_SYNCHRONIZE
+} FLT_PREOP_CALLBACK_STATUS;
+
+typedef enum _FLT_POSTOP_CALLBACK_STATUS {
+    FLT_POSTOP_FINISHED_PROCESSING,
+    FLT_POSTOP_MORE_PROCESSING_REQUIRED
+} FLT_POSTOP_CALLBACK_STATUS;
+
+typedef enum _RTL_GENERIC_COMPARE_RESULTS {
+    GenericLessThan,
+    GenericGreaterThan,
+    GenericEqual
+} RTL_GENERIC_COMPARE_RESULTS;
+
+typedef struct _OBJECT_TYPE *POBJECT_TYPE;
+typedef struct _FLT_FILTER *PFLT_FILTER;
+typedef struct _FLT_VOLUME *PFLT_VOLUME;
+typedef struct _FLT_INSTANCE *PFLT_INSTANCE;
+
+//
+//  A resource records which threads own it, and how often, so that a
+//  thread can acquire it recursively and the ExIsResourceAcquired routines
+//  answer for the calling thread.  The shared owner table only needs to be
+//  as large as the number of threads the host program runs.
+//
+
+#define HOST_RESOURCE_OWNERS            (32)
+
+typedef struct _ERESOURCE {
+    pthread_mutex_t Lock;
+    pthread_cond_t Released;
+    ERESOURCE_THREAD ExclusiveOwner;
+    LONG ExclusiveCount;
+    LONG SharedCount;
+    LONG ExclusiveWaiters;
+    struct {
+        ERESOURCE_THREAD Thread;
+        LONG Count;
+    } SharedOwners[HOST_RESOURCE_OWNERS];
+} ERESOURCE, *PERESOURCE;
+
+//
+//  Events are all guarded by one lock in host.c, so that a thread can wait
+//  for any of several.
+//
+
+typedef struct _KEVENT {
+    LONG State;
+    EVENT_TYPE Type;
+} KEVENT, *PKEVENT;
+
+typedef struct _KTHREAD {
+    KEVENT Exited;
+} KTHREAD, *PKTHREAD;
+
+typedef VOID KSTART_ROUTINE( PVOID StartContext );
+typedef KSTART_ROUTINE *PKSTART_ROUTINE;
+
+typedef struct _IO_STATUS_BLOCK {
+    NTSTATUS Status;
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _FILE_OBJECT {
+    CSHORT Type;
+    CSHORT Size;
+    ULONG Flags;
+    PVOID FsContext;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _OBJECT_ATTRIBUTES {
+    ULONG Length;
+    HANDLE RootDirectory;
+    PUNICODE_STRING ObjectName;
+    ULONG Attributes;
+    PVOID SecurityDescriptor;
+    PVOID SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+typedef struct _FILE_INTERNAL_INFORMATION {
+    LARGE_INTEGER IndexNumber;
+} FILE_INTERNAL_INFORMATION, *PFILE_INTERNAL_INFORMATION;
+
+typedef struct _FILE_END_OF_FILE_INFORMATION {
+    LARGE_INTEGER EndOfFile;
+} FILE_END_OF_FILE_INFORMATION, *PFILE_END_OF_FILE_INFORMATION;
+
+//
+//  The generic table is a sorted array of nodes, each allocated through
+//  the table's allocate routine with the links ahead of the element, as
+//  the Rtl table does.  The array itself is the host's.
+//
+
+typedef struct _RTL_BALANCED_LINKS {
+    struct _RTL_BALANCED_LINKS *Parent;
+    struct _RTL_BALANCED_LINKS *LeftChild;
+    struct _RTL_BALANCED_LINKS *RightChild;
+    CHAR Balance;
+    UCHAR Reserved[3];
+} RTL_BALANCED_LINKS, *PRTL_BALANCED_LINKS;
+
+struct _RTL_AVL_TABLE;
+
+typedef RTL_GENERIC_COMPARE_RESULTS RTL_AVL_COMPARE_ROUTINE( struct _RTL_AVL_TABLE *Table, PVOID FirstStruct, PVOID SecondStruct );
+typedef PVOID RTL_AVL_ALLOCATE_ROUTINE( struct _RTL_AVL_TABLE *Table, CLONG ByteSize );
+typedef VOID RTL_AVL_FREE_ROUTINE( struct _RTL_AVL_TABLE *Table, PVOID Buffer );
+typedef RTL_AVL_COMPARE_ROUTINE *PRTL_AVL_COMPARE_ROUTINE;
+typedef RTL_AVL_ALLOCATE_ROUTINE *PRTL_AVL_ALLOCATE_ROUTINE;
+typedef RTL_AVL_FREE_ROUTINE *PRTL_AVL_FREE_ROUTINE;
+
+typedef struct _RTL_AVL_TABLE {
+    PRTL_BALANCED_LINKS *Nodes;
+    ULONG NumberGenericTableElements;
+    ULONG Capacity;
+    PRTL_AVL_COMPARE_ROUTINE CompareRoutine;
+    PRTL_AVL_ALLOCATE_ROUTINE AllocateRoutine;
+    PRTL_AVL_FREE_ROUTINE FreeRoutine;
+    PVOID TableContext;
+} RTL_AVL_TABLE, *PRTL_AVL_TABLE;
+
+//
+//  FltMgr.
+//
+
+typedef struct _IO_SECURITY_CONTEXT {
+    PVOID SecurityQos;
+    PVOID AccessState;
+    ACCESS_MASK DesiredAccess;
+    ULONG FullCreateOptions;
+} IO_SECURITY_CONTEXT, *PIO_SECURITY_CONTEXT;
+
+typedef union _FLT_PARAMETERS {
+    struct {
+        PIO_SECURITY_CONTEXT SecurityContext;
+        ULONG Options;
+        USHORT FileAttributes;
+        USHORT ShareAccess;
+        ULONG EaLength;
+        PVOID EaBuffer;
+        LARGE_INTEGER AllocationSize;
+    } Create;
+} FLT_PARAMETERS, *PFLT_PARAMETERS;
+
+typedef struct _FLT_IO_PARAMETER_BLOCK {
+    ULONG IrpFlags;
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    UCHAR OperationFlags;
+    UCHAR Reserved;
+    PFILE_OBJECT TargetFileObject;
+    PFLT_INSTANCE TargetInstance;
+    FLT_PARAMETERS Parameters;
+} FLT_IO_PARAMETER_BLOCK, *PFLT_IO_PARAMETER_BLOCK;
+
+typedef struct _FLT_CALLBACK_DATA {
+    ULONG Flags;
+    PVOID Thread;
+    PFLT_IO_PARAMETER_BLOCK Iopb;
+    IO_STATUS_BLOCK IoStatus;
+} FLT_CALLBACK_DATA, *PFLT_CALLBACK_DATA;
+
+typedef struct _FLT_RELATED_OBJECTS {
+    USHORT Size;
+    USHORT TransactionContext;
+    PFLT_FILTER Filter;
+    PFLT_VOLUME Volume;
+    PFLT_INSTANCE Instance;
+    PFILE_OBJECT FileObject;
+} FLT_RELATED_OBJECTS, *PFLT_RELATED_OBJECTS;
+
+typedef const FLT_RELATED_OBJECTS *PCFLT_RELATED_OBJECTS;
+
+#define TRUE                            1
+#define FALSE                           0
+#define PASSIVE_LEVEL                   0
+#define APC_LEVEL                       1
+#define DISPATCH_LEVEL                  2
+
+#define FIELD_OFFSET(Type, Field)       ((LONG)offsetof( Type, Field ))
+#define CONTAINING_RECORD(A, Type, Field) ((Type *)((PCHAR)(A) - offsetof( Type, Field )))
+#define UNREFERENCED_PARAMETER(P)       ((void)(P))
+#define ARGUMENT_PRESENT(P)             ((CHAR *)(P) != (CHAR *)NULL)
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+#define ROUND_TO_SIZE(Length, Alignment) \
+    (((ULONG_PTR)(Length) + ((Alignment) - 1)) & ~(ULONG_PTR)((Alignment) - 1))
+#define FlagOn(F, SF)                   ((F) & (SF))
+#define BooleanFlagOn(F, SF)            ((BOOLEAN)(((F) & (SF)) != 0))
+#define SetFlag(F, SF)                  ((F) |= (SF))
+#define ClearFlag(F, SF)                ((F) &= ~(SF))
+#define PAGED_CODE()
+#define FLT_ASSERT(E)                   HostAssert( (E) ? 1 : 0, #E, __FILE__, __LINE__ )
+
+#ifndef min
+#define min(a, b)                       (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)                       (((a) > (b)) ? (a) : (b))
+#endif
+
+#define RtlZeroMemory(D, L)             memset( (D), 0, (L) )
+#define RtlCopyMemory(D, S, L)          memcpy( (D), (S), (L) )
+
+#define InitializeObjectAttributes(A, N, Attr, R, S) {                      \
+    (A)->Length = sizeof( OBJECT_ATTRIBUTES );                              \
+    (A)->RootDirectory = (R);                                               \
+    (A)->Attributes = (Attr);                                               \
+    (A)->ObjectName = (N);                                                  \
+    (A)->SecurityDescriptor = (S);                                          \
+    (A)->SecurityQualityOfService = NULL;                                   \
+}
+
+#define KeGetCurrentIrql()              PASSIVE_LEVEL
+#define KeEnterCriticalRegion()         ((void)0)
+#define KeLeaveCriticalRegion()         ((void)0)
+#define ExGetCurrentResourceThread()    HostGetCurrentResourceThread()
+
+#define IO_NO_INCREMENT                 0
+#define FO_VOLUME_OPEN                  0x00400000
+
+#define SYNCHRONIZE                     0x00100000
+#define STANDARD_RIGHTS_REQUIRED        0x000F0000
+#define FILE_WRITE_DATA                 0x0002
+#define FILE_APPEND_DATA                0x0004
+#define FILE_ALL_ACCESS                 (STANDARD_RIGHTS_REQUIRED | SYNCHRONIZE | 0x1FF)
+#define THREAD_ALL_ACCESS               (STANDARD_RIGHTS_REQUIRED | SYNCHRONIZE | 0xFFFF)
+#define FILE_SHARE_READ                 0x00000001
+#define FILE_SHARE_WRITE                0x00000002
+#define FILE_SHARE_DELETE               0x00000004
+#define FILE_ATTRIBUTE_HIDDEN           0x00000002
+#define FILE_ATTRIBUTE_SYSTEM           0x00000004
+#define FILE_OPEN                       0x00000001
+#define FILE_OPEN_IF                    0x00000003
+#define FILE_SUPERSEDED                 0x00000000
+#define FILE_OPENED                     0x00000001
+#define FILE_CREATED                    0x00000002
+#define FILE_OVERWRITTEN                0x00000003
+#define OBJ_KERNEL_HANDLE               0x00000200
+
+#define FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET 0x00000002
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_WAIT_0                   ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_HANDLE           ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_END_OF_FILE              ((NTSTATUS)0xC0000011L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_TYPE_MISMATCH     ((NTSTATUS)0xC0000024L)
+#define STATUS_OBJECT_NAME_INVALID      ((NTSTATUS)0xC0000033L)
+#define STATUS_OBJECT_NAME_NOT_FOUND    ((NTSTATUS)0xC0000034L)
+#define STATUS_OBJECT_PATH_NOT_FOUND    ((NTSTATUS)0xC000003AL)
+#define STATUS_FILE_LOCK_CONFLICT       ((NTSTATUS)0xC0000054L)
+#define STATUS_DISK_FULL                ((NTSTATUS)0xC000007FL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_UNEXPECTED_IO_ERROR      ((NTSTATUS)0xC00000E9L)
+#define STATUS_NOT_FOUND                ((NTSTATUS)0xC0000225L)
+
+extern POBJECT_TYPE *IoFileObjectType;
+extern POBJECT_TYPE *PsThreadType;
+
+static inline VOID
+InitializeListHead (
+    PLIST_ENTRY ListHead
+    )
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+static inline BOOLEAN
+IsListEmpty (
+    const LIST_ENTRY *ListHead
+    )
+{
+    return (BOOLEAN)(ListHead->Flink == ListHead);
+}
+
+static inline VOID
+InsertTailList (
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink = ListHead;
+    Entry->Blink = ListHead->Blink;
+    ListHead->Blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+static inline PLIST_ENTRY
+RemoveHeadList (
+    PLIST_ENTRY ListHead
+    )
+{
+    PLIST_ENTRY Entry = ListHead->Flink;
+
+    ListHead->Flink = Entry->Flink;
+    Entry->Flink->Blink = ListHead;
+
+    return Entry;
+}
+
+VOID HostAssert( int Condition, const char *Text, const char *File, int Line );
+ERESOURCE_THREAD HostGetCurrentResourceThread( VOID );
+
+PVOID ExAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+VOID ExFreePoolWithTag( PVOID P, ULONG Tag );
+
+NTSTATUS ExInitializeResourceLite( PERESOURCE Resource );
+NTSTATUS ExDeleteResourceLite( PERESOURCE Resource );
+BOOLEAN ExAcquireResourceExclusiveLite( PERESOURCE Resource, BOOLEAN Wait );
+BOOLEAN ExAcquireResourceSharedLite( PERESOURCE Resource, BOOLEAN Wait );
+VOID ExReleaseResourceLite( PERESOURCE Resource );
+BOOLEAN ExIsResourceAcquiredExclusiveLite( PERESOURCE Resource );
+ULONG ExIsResourceAcquiredSharedLite( PERESOURCE Resource );
+
+VOID KeInitializeEvent( PKEVENT Event, EVENT_TYPE Type, BOOLEAN State );
+LONG KeSetEvent( PKEVENT Event, LONG Increment, BOOLEAN Wait );
+NTSTATUS KeWaitForSingleObject( PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout );
+NTSTATUS KeWaitForMultipleObjects( ULONG Count, PVOID Object[], WAIT_TYPE WaitType, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout, PVOID WaitBlockArray );
+VOID KeQuerySystemTime( PLARGE_INTEGER CurrentTime );
+
+NTSTATUS PsCreateSystemThread( PHANDLE ThreadHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, HANDLE ProcessHandle, PVOID ClientId, PKSTART_ROUTINE StartRoutine, PVOID StartContext );
+NTSTATUS PsTerminateSystemThread( NTSTATUS ExitStatus );
+NTSTATUS ObReferenceObjectByHandle( HANDLE Handle, ACCESS_MASK DesiredAccess, POBJECT_TYPE ObjectType, KPROCESSOR_MODE AccessMode, PVOID *Object, PVOID HandleInformation );
+VOID ObDereferenceObject( PVOID Object );
+NTSTATUS ZwClose( HANDLE Handle );
+
+VOID RtlInitializeGenericTableAvl( PRTL_AVL_TABLE Table, PRTL_AVL_COMPARE_ROUTINE CompareRoutine, PRTL_AVL_ALLOCATE_ROUTINE AllocateRoutine, PRTL_AVL_FREE_ROUTINE FreeRoutine, PVOID TableContext );
+PVOID RtlInsertElementGenericTableAvl( PRTL_AVL_TABLE Table, PVOID Buffer, CLONG BufferSize, PBOOLEAN NewElement );
+PVOID RtlLookupElementGenericTableAvl( PRTL_AVL_TABLE Table, PVOID Buffer );
+BOOLEAN RtlDeleteElementGenericTableAvl( PRTL_AVL_TABLE Table, PVOID Buffer );
+PVOID RtlEnumerateGenericTableWithoutSplayingAvl( PRTL_AVL_TABLE Table, PVOID *RestartKey );
+PVOID RtlGetElementGenericTableAvl( PRTL_AVL_TABLE Table, ULONG I );
+NTSTATUS RtlAppendUnicodeToString( PUNICODE_STRING Destination, PCWSTR Source );
+
+NTSTATUS FltGetVolumeName( PFLT_VOLUME Volume, PUNICODE_STRING VolumeName, PULONG BufferSizeNeeded );
+NTSTATUS FltCreateFile( PFLT_FILTER Filter, PFLT_INSTANCE Instance, PHANDLE FileHandle, ACCESS_MASK DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, PIO_STATUS_BLOCK IoStatusBlock, PLARGE_INTEGER AllocationSize, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PVOID EaBuffer, ULONG EaLength, ULONG Flags );
+NTSTATUS FltCreateSystemVolumeInformationFolder( PFLT_INSTANCE Instance );
+NTSTATUS FltClose( HANDLE FileHandle );
+NTSTATUS FltReadFile( PFLT_INSTANCE InitiatingInstance, PFILE_OBJECT FileObject, PLARGE_INTEGER ByteOffset, ULONG Length, PVOID Buffer, FLT_IO_OPERATION_FLAGS Flags, PULONG BytesRead, PVOID CallbackRoutine, PVOID CallbackContext );
+NTSTATUS FltWriteFile( PFLT_INSTANCE InitiatingInstance, PFILE_OBJECT FileObject, PLARGE_INTEGER ByteOffset, ULONG Length, PVOID Buffer, FLT_IO_OPERATION_FLAGS Flags, PULONG BytesWritten, PVOID CallbackRoutine, PVOID CallbackContext );
+NTSTATUS FltFlushBuffers( PFLT_INSTANCE Instance, PFILE_OBJECT FileObject );
+NTSTATUS FltQueryInformationFile( PFLT_INSTANCE Instance, PFILE_OBJECT FileObject, PVOID FileInformation, ULONG Length, FILE_INFORMATION_CLASS FileInformationClass, PULONG LengthReturned );
+NTSTATUS FltSetInformationFile( PFLT_INSTANCE Instance, PFILE_OBJECT FileObject, PVOID FileInformation, ULONG Length, FILE_INFORMATION_CLASS FileInformationClass );
+NTSTATUS FltGetInstanceContext( PFLT_INSTANCE Instance, PFLT_CONTEXT *Context );
+VOID FltReferenceContext( PFLT_CONTEXT Context );
+VOID FltReleaseContext( PFLT_CONTEXT Context );
+ULONG FltGetRequestorProcessId( PFLT_CALLBACK_DATA CallbackData );
@@ -0,0 +1,1549 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Host.c
+
+Abstract:
+
+    The kernel and FltMgr routines the metadata store reaches in the host
+    program, done in user mode.
+
+    Pool comes from the C library and is counted so that the program can
+    check nothing leaks.  Resources and events are built on pthreads, as in
+    the Cdfs host programs, except that all events share one lock and
+    condition so that a thread can wait for any of several with a timeout.
+    System threads are pthreads which are joined when their object is
+    deleted.  The generic table is a sorted array.
+
+    The volume has a single file that is read and written, the metadata
+    file, under the name the filter builds from the volume name.  Writes
+    and size changes go to its current image; FltFlushBuffers copies that
+    to the image a crash leaves behind.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "host.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#define HOST_VOLUME_NAME                L"\\Device\\HarddiskVolume{5b0e8d2a-3c71-4e96-a4f0-19d7c2b86e41}"
+#define HOST_METADATA_FILE_ID           (0x0001000000000005ULL)
+
+//
+//  Every pool block is preceded by a header recording its size and tag.
+//
+
+typedef struct _HOST_POOL_HEADER {
+
+    SIZE_T NumberOfBytes;
+    ULONG Tag;
+
+} HOST_POOL_HEADER, *PHOST_POOL_HEADER;
+
+//
+//  Objects are preceded by a header with their reference count and type,
+//  and the type knows how to delete them.
+//
+
+struct _OBJECT_TYPE {
+
+    const char *Name;
+    VOID (*DeleteProcedure)( PVOID Object );
+
+};
+
+typedef struct _HOST_OBJECT_HEADER {
+
+    LONG ReferenceCount;
+    POBJECT_TYPE Type;
+
+} HOST_OBJECT_HEADER, *PHOST_OBJECT_HEADER;
+
+typedef struct _HOST_THREAD {
+
+    KTHREAD Thread;
+    pthread_t Id;
+    PKSTART_ROUTINE StartRoutine;
+    PVOID StartContext;
+
+} HOST_THREAD, *PHOST_THREAD;
+
+//
+//  A file's contents.  Only the metadata file has any; the files the
+//  program opens with HostOpenFile just have an id.
+//
+
+typedef struct _HOST_FILE {
+
+    ULONGLONG FileId;
+    PUCHAR Data;
+    ULONGLONG Size;
+
+} HOST_FILE, *PHOST_FILE;
+
+static VOID HostDeleteFileObject( PVOID Object );
+static VOID HostDeleteThread( PVOID Object );
+
+static struct _OBJECT_TYPE HostFileType = { "File", HostDeleteFileObject };
+static struct _OBJECT_TYPE HostThreadType = { "Thread", HostDeleteThread };
+static POBJECT_TYPE HostFileObjectType = &HostFileType;
+static POBJECT_TYPE HostPsThreadType = &HostThreadType;
+
+POBJECT_TYPE *IoFileObjectType = &HostFileObjectType;
+POBJECT_TYPE *PsThreadType = &HostPsThreadType;
+
+PFLT_FILTER HostFilter = (PFLT_FILTER) 0x0f17;
+PFLT_VOLUME HostVolume = (PFLT_VOLUME) 0x0701;
+PFLT_INSTANCE HostInstance = (PFLT_INSTANCE) 0x1457;
+
+static pthread_mutex_t HostLock = PTHREAD_MUTEX_INITIALIZER;
+static HOST_COUNTERS HostCounters;
+
+static pthread_mutex_t HostEventLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t HostEventChanged = PTHREAD_COND_INITIALIZER;
+
+static _Thread_local UCHAR HostResourceThread;
+static _Thread_local PHOST_THREAD HostCurrentThread;
+
+static PFLT_CONTEXT HostInstanceContext;
+
+//
+//  The volume.  HostLock guards it.
+//
+
+static BOOLEAN HostSystemVolumeInformationExists;
+static BOOLEAN HostMetadataFileExists;
+static BOOLEAN HostWritesFail;
+static LONG HostMetadataFileOpens;
+static HOST_FILE HostMetadataFile;
+static PUCHAR HostDurableData;
+static ULONGLONG HostDurableSize;
+
+static VOID
+HostCount (
+    PLONGLONG Counter,
+    LONGLONG Value
+    )
+{
+    pthread_mutex_lock( &HostLock );
+    *Counter += Value;
+    pthread_mutex_unlock( &HostLock );
+}
+
+VOID
+HostAssert (
+    int Condition,
+    const char *Text,
+    const char *File,
+    int Line
+    )
+{
+    if (!Condition) {
+
+        fprintf( stderr, "%s(%d): assertion failed: %s\n", File, Line, Text );
+        abort();
+    }
+}
+
+VOID
+HostGetCounters (
+    PHOST_COUNTERS Counters
+    )
+{
+    pthread_mutex_lock( &HostLock );
+    *Counters = HostCounters;
+    pthread_mutex_unlock( &HostLock );
+}
+
+//
+//  Pool.
+//
+
+PVOID
+ExAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    PHOST_POOL_HEADER header;
+
+    UNREFERENCED_PARAMETER( PoolType );
+
+    header = malloc( sizeof( HOST_POOL_HEADER ) + NumberOfBytes );
+
+    if (header == NULL) {
+
+        return NULL;
+    }
+
+    header->NumberOfBytes = NumberOfBytes;
+    header->Tag = Tag;
+
+    pthread_mutex_lock( &HostLock );
+    HostCounters.PoolBlocks += 1;
+    HostCounters.PoolBytes += (LONGLONG) NumberOfBytes;
+    pthread_mutex_unlock( &HostLock );
+
+    return header + 1;
+}
+
+VOID
+ExFreePoolWithTag (
+    PVOID P,
+    ULONG Tag
+    )
+{
+    PHOST_POOL_HEADER header = (PHOST_POOL_HEADER) P - 1;
+
+    HostAssert( header->Tag == Tag, "header->Tag == Tag", __FILE__, __LINE__ );
+
+    pthread_mutex_lock( &HostLock );
+    HostCounters.PoolBlocks -= 1;
+    HostCounters.PoolBytes -= (LONGLONG) header->NumberOfBytes;
+    pthread_mutex_unlock( &HostLock );
+
+    free( header );
+}
+
+//
+//  Resources.  A thread which owns a resource exclusive may acquire it
+//  again either way; one which owns it shared may acquire it shared again
+//  even with exclusive waiters, as in Ex.
+//
+
+ERESOURCE_THREAD
+HostGetCurrentResourceThread (
+    VOID
+    )
+{
+    return (ERESOURCE_THREAD) &HostResourceThread;
+}
+
+static LONG
+HostFindOwner (
+    PERESOURCE Resource,
+    ERESOURCE_THREAD Thread
+    )
+{
+    LONG index;
+
+    for (index = 0; index < HOST_RESOURCE_OWNERS; index += 1) {
+
+        if (Resource->SharedOwners[index].Thread == Thread) {
+
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+static BOOLEAN
+HostAcquireResource (
+    PERESOURCE Resource,
+    BOOLEAN Exclusive,
+    BOOLEAN Wait
+    )
+{
+    ERESOURCE_THREAD thread = ExGetCurrentResourceThread();
+    BOOLEAN acquired = FALSE;
+    LONG owner;
+
+    pthread_mutex_lock( &Resource->Lock );
+
+    for (;;) {
+
+        if (Resource->ExclusiveOwner == thread) {
+
+            Resource->ExclusiveCount += 1;
+            acquired = TRUE;
+            break;
+        }
+
+        owner = HostFindOwner( Resource, thread );
+
+        if (Exclusive) {
+
+            FLT_ASSERT( owner < 0 );
+
+            if ((Resource->ExclusiveCount == 0) && (Resource->SharedCount == 0)) {
+
+                Resource->ExclusiveOwner = thread;
+                Resource->ExclusiveCount = 1;
+                acquired = TRUE;
+                break;
+            }
+
+        } else if (owner >= 0) {
+
+            Resource->SharedOwners[owner].Count += 1;
+            Resource->SharedCount += 1;
+            acquired = TRUE;
+            break;
+
+        } else if ((Resource->ExclusiveCount == 0) && (Resource->ExclusiveWaiters == 0)) {
+
+            owner = HostFindOwner( Resource, 0 );
+            FLT_ASSERT( owner >= 0 );
+
+            Resource->SharedOwners[owner].Thread = thread;
+            Resource->SharedOwners[owner].Count = 1;
+            Resource->SharedCount += 1;
+            acquired = TRUE;
+            break;
+        }
+
+        if (!Wait) {
+
+            break;
+        }
+
+        if (Exclusive) {
+
+            Resource->ExclusiveWaiters += 1;
+        }
+
+        pthread_cond_wait( &Resource->Released, &Resource->Lock );
+
+        if (Exclusive) {
+
+            Resource->ExclusiveWaiters -= 1;
+        }
+    }
+
+    pthread_mutex_unlock( &Resource->Lock );
+
+    return acquired;
+}
+
+NTSTATUS
+ExInitializeResourceLite (
+    PERESOURCE Resource
+    )
+{
+    RtlZeroMemory( Resource, sizeof( ERESOURCE ));
+    pthread_mutex_init( &Resource->Lock, NULL );
+    pthread_cond_init( &Resource->Released, NULL );
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ExDeleteResourceLite (
+    PERESOURCE Resource
+    )
+{
+    FLT_ASSERT( (Resource->SharedCount == 0) && (Resource->ExclusiveCount == 0) );
+
+    pthread_cond_destroy( &Resource->Released );
+    pthread_mutex_destroy( &Resource->Lock );
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+ExAcquireResourceExclusiveLite (
+    PERESOURCE Resource,
+    BOOLEAN Wait
+    )
+{
+    return HostAcquireResource( Resource, TRUE, Wait );
+}
+
+BOOLEAN
+ExAcquireResourceSharedLite (
+    PERESOURCE Resource,
+    BOOLEAN Wait
+    )
+{
+    return HostAcquireResource( Resource, FALSE, Wait );
+}
+
+VOID
+ExReleaseResourceLite (
+    PERESOURCE Resource
+    )
+{
+    ERESOURCE_THREAD thread = ExGetCurrentResourceThread();
+    LONG owner;
+
+    pthread_mutex_lock( &Resource->Lock );
+
+    if (Resource->ExclusiveOwner == thread) {
+
+        Resource->ExclusiveCount -= 1;
+
+        if (Resource->ExclusiveCount == 0) {
+
+            Resource->ExclusiveOwner = 0;
+        }
+
+    } else {
+
+        owner = HostFindOwner( Resource, thread );
+        FLT_ASSERT( owner >= 0 );
+
+        Resource->SharedOwners[owner].Count -= 1;
+        Resource->SharedCount -= 1;
+
+        if (Resource->SharedOwners[owner].Count == 0) {
+
+            Resource->SharedOwners[owner].Thread = 0;
+        }
+    }
+
+    pthread_cond_broadcast( &Resource->Released );
+    pthread_mutex_unlock( &Resource->Lock );
+}
+
+BOOLEAN
+ExIsResourceAcquiredExclusiveLite (
+    PERESOURCE Resource
+    )
+{
+    BOOLEAN owned;
+
+    pthread_mutex_lock( &Resource->Lock );
+    owned = (BOOLEAN) (Resource->ExclusiveOwner == ExGetCurrentResourceThread());
+    pthread_mutex_unlock( &Resource->Lock );
+
+    return owned;
+}
+
+ULONG
+ExIsResourceAcquiredSharedLite (
+    PERESOURCE Resource
+    )
+{
+    ERESOURCE_THREAD thread = ExGetCurrentResourceThread();
+    ULONG count = 0;
+    LONG owner;
+
+    pthread_mutex_lock( &Resource->Lock );
+
+    if (Resource->ExclusiveOwner == thread) {
+
+        count = Resource->ExclusiveCount;
+
+    } else {
+
+        owner = HostFindOwner( Resource, thread );
+
+        if (owner >= 0) {
+
+            count = Resource->SharedOwners[owner].Count;
+        }
+    }
+
+    pthread_mutex_unlock( &Resource->Lock );
+
+    return count;
+}
+
+//
+//  Events and waits.  Only waits for any one object are supported, and
+//  only relative timeouts.
+//
+
+VOID
+KeInitializeEvent (
+    PKEVENT Event,
+    EVENT_TYPE Type,
+    BOOLEAN State
+    )
+{
+    Event->State = State;
+    Event->Type = Type;
+}
+
+LONG
+KeSetEvent (
+    PKEVENT Event,
+    LONG Increment,
+    BOOLEAN Wait
+    )
+{
+    LONG previousState;
+
+    UNREFERENCED_PARAMETER( Increment );
+    UNREFERENCED_PARAMETER( Wait );
+
+    pthread_mutex_lock( &HostEventLock );
+    previousState = Event->State;
+    Event->State = 1;
+    pthread_cond_broadcast( &HostEventChanged );
+    pthread_mutex_unlock( &HostEventLock );
+
+    return previousState;
+}
+
+NTSTATUS
+KeWaitForMultipleObjects (
+    ULONG Count,
+    PVOID Object[],
+    WAIT_TYPE WaitType,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout,
+    PVOID WaitBlockArray
+    )
+{
+    struct timespec deadline;
+    PKEVENT event;
+    NTSTATUS status = STATUS_TIMEOUT;
+    ULONG index;
+
+    UNREFERENCED_PARAMETER( WaitReason );
+    UNREFERENCED_PARAMETER( WaitMode );
+    UNREFERENCED_PARAMETER( Alertable );
+    UNREFERENCED_PARAMETER( WaitBlockArray );
+
+    FLT_ASSERT( WaitType == WaitAny );
+    FLT_ASSERT( (Timeout == NULL) || (Timeout->QuadPart <= 0) );
+
+    if (Timeout != NULL) {
+
+        clock_gettime( CLOCK_REALTIME, &deadline );
+
+        deadline.tv_sec += (time_t) (-Timeout->QuadPart / 10000000);
+        deadline.tv_nsec += (long) ((-Timeout->QuadPart % 10000000) * 100);
+
+        if (deadline.tv_nsec >= 1000000000) {
+
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock( &HostEventLock );
+
+    for (;;) {
+
+        for (index = 0; index < Count; index += 1) {
+
+            event = Object[index];
+
+            if (event->State != 0) {
+
+                if (event->Type == SynchronizationEvent) {
+
+                    event->State = 0;
+                }
+
+                status = STATUS_WAIT_0 + (NTSTATUS) index;
+                break;
+            }
+        }
+
+        if (index < Count) {
+
+            break;
+        }
+
+        if (Timeout == NULL) {
+
+            pthread_cond_wait( &HostEventChanged, &HostEventLock );
+
+        } else if (pthread_cond_timedwait( &HostEventChanged, &HostEventLock, &deadline ) != 0) {
+
+            status = STATUS_TIMEOUT;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &HostEventLock );
+
+    return status;
+}
+
+NTSTATUS
+KeWaitForSingleObject (
+    PVOID Object,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout
+    )
+{
+    return KeWaitForMultipleObjects( 1, &Object, WaitAny, WaitReason, WaitMode, Alertable, Timeout, NULL );
+}
+
+VOID
+KeQuerySystemTime (
+    PLARGE_INTEGER CurrentTime
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_REALTIME, &now );
+
+    CurrentTime->QuadPart = ((LONGLONG) now.tv_sec + 11644473600LL) * 10000000 + now.tv_nsec / 100;
+}
+
+//
+//  Objects and handles.  A handle is the object it refers to, and holds a
+//  reference to it.
+//
+
+static PVOID
+HostCreateObject (
+    POBJECT_TYPE Type,
+    SIZE_T Size
+    )
+{
+    PHOST_OBJECT_HEADER header;
+
+    header = calloc( 1, sizeof( HOST_OBJECT_HEADER ) + Size );
+    HostAssert( header != NULL, "header != NULL", __FILE__, __LINE__ );
+
+    header->ReferenceCount = 1;
+    header->Type = Type;
+
+    HostCount( &HostCounters.Objects, 1 );
+
+    return header + 1;
+}
+
+NTSTATUS
+ObReferenceObjectByHandle (
+    HANDLE Handle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode,
+    PVOID *Object,
+    PVOID HandleInformation
+    )
+{
+    PHOST_OBJECT_HEADER header = (PHOST_OBJECT_HEADER) Handle - 1;
+
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( AccessMode );
+    UNREFERENCED_PARAMETER( HandleInformation );
+
+    if (Handle == NULL) {
+
+        return STATUS_INVALID_HANDLE;
+    }
+
+    if (header->Type != ObjectType) {
+
+        return STATUS_OBJECT_TYPE_MISMATCH;
+    }
+
+    __atomic_add_fetch( &header->ReferenceCount, 1, __ATOMIC_SEQ_CST );
+    *Object = Handle;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+ObDereferenceObject (
+    PVOID Object
+    )
+{
+    PHOST_OBJECT_HEADER header = (PHOST_OBJECT_HEADER) Object - 1;
+
+    if (__atomic_sub_fetch( &header->ReferenceCount, 1, __ATOMIC_SEQ_CST ) == 0) {
+
+        header->Type->DeleteProcedure( Object );
+        free( header );
+
+        HostCount( &HostCounters.Objects, -1 );
+    }
+}
+
+NTSTATUS
+ZwClose (
+    HANDLE Handle
+    )
+{
+    ObDereferenceObject( Handle );
+
+    return STATUS_SUCCESS;
+}
+
+//
+//  System threads.  A thread's object is only deleted once the thread has
+//  ended, so that the thread never needs a reference to itself.
+//
+
+static void *
+HostThreadStart (
+    void *Parameter
+    )
+{
+    PHOST_THREAD thread = Parameter;
+
+    HostCurrentThread = thread;
+
+    thread->StartRoutine( thread->StartContext );
+
+    PsTerminateSystemThread( STATUS_SUCCESS );
+
+    return NULL;
+}
+
+NTSTATUS
+PsCreateSystemThread (
+    PHANDLE ThreadHandle,
+    ULONG DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    HANDLE ProcessHandle,
+    PVOID ClientId,
+    PKSTART_ROUTINE StartRoutine,
+    PVOID StartContext
+    )
+{
+    PHOST_THREAD thread;
+
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( ObjectAttributes );
+    UNREFERENCED_PARAMETER( ProcessHandle );
+    UNREFERENCED_PARAMETER( ClientId );
+
+    thread = HostCreateObject( HostPsThreadType, sizeof( HOST_THREAD ));
+
+    KeInitializeEvent( &thread->Thread.Exited, NotificationEvent, FALSE );
+    thread->StartRoutine = StartRoutine;
+    thread->StartContext = StartContext;
+
+    if (pthread_create( &thread->Id, NULL, HostThreadStart, thread ) != 0) {
+
+        free( (PHOST_OBJECT_HEADER) thread - 1 );
+        HostCount( &HostCounters.Objects, -1 );
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *ThreadHandle = thread;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+PsTerminateSystemThread (
+    NTSTATUS ExitStatus
+    )
+{
+    UNREFERENCED_PARAMETER( ExitStatus );
+
+    FLT_ASSERT( HostCurrentThread != NULL );
+
+    KeSetEvent( &HostCurrentThread->Thread.Exited, IO_NO_INCREMENT, FALSE );
+
+    pthread_exit( NULL );
+}
+
+static VOID
+HostDeleteThread (
+    PVOID Object
+    )
+{
+    PHOST_THREAD thread = Object;
+
+    pthread_join( thread->Id, NULL );
+}
+
+//
+//  The generic table.
+//
+
+#define HOST_TABLE_HEADER_SIZE          ROUND_TO_SIZE( sizeof( RTL_BALANCED_LINKS ), sizeof( LONGLONG ))
+#define HostTableElement(Node)          ((PVOID) ((PUCHAR) (Node) + HOST_TABLE_HEADER_SIZE))
+
+//
+//  Returns TRUE if the table holds an element equal to Buffer, with its
+//  index, otherwise the index it would be inserted at.
+//
+
+static BOOLEAN
+HostFindTableNode (
+    PRTL_AVL_TABLE Table,
+    PVOID Buffer,
+    PULONG Index
+    )
+{
+    RTL_GENERIC_COMPARE_RESULTS result;
+    ULONG low = 0;
+    ULONG high = Table->NumberGenericTableElements;
+    ULONG middle;
+
+    while (low < high) {
+
+        middle = low + (high - low) / 2;
+        result = Table->CompareRoutine( Table, Buffer, HostTableElement( Table->Nodes[middle] ));
+
+        if (result == GenericEqual) {
+
+            *Index = middle;
+            return TRUE;
+        }
+
+        if (result == GenericLessThan) {
+
+            high = middle;
+
+        } else {
+
+            low = middle + 1;
+        }
+    }
+
+    *Index = low;
+
+    return FALSE;
+}
+
+VOID
+RtlInitializeGenericTableAvl (
+    PRTL_AVL_TABLE Table,
+    PRTL_AVL_COMPARE_ROUTINE CompareRoutine,
+    PRTL_AVL_ALLOCATE_ROUTINE AllocateRoutine,
+    PRTL_AVL_FREE_ROUTINE FreeRoutine,
+    PVOID TableContext
+    )
+{
+    RtlZeroMemory( Table, sizeof( RTL_AVL_TABLE ));
+
+    Table->CompareRoutine = CompareRoutine;
+    Table->AllocateRoutine = AllocateRoutine;
+    Table->FreeRoutine = FreeRoutine;
+    Table->TableContext = TableContext;
+}
+
+PVOID
+RtlInsertElementGenericTableAvl (
+    PRTL_AVL_TABLE Table,
+    PVOID Buffer,
+    CLONG BufferSize,
+    PBOOLEAN NewElement
+    )
+{
+    PRTL_BALANCED_LINKS node;
+    PRTL_BALANCED_LINKS *nodes;
+    ULONG index;
+
+    if (HostFindTableNode( Table, Buffer, &index )) {
+
+        if (NewElement != NULL) {
+
+            *NewElement = FALSE;
+        }
+
+        return HostTableElement( Table->Nodes[index] );
+    }
+
+    if (Table->NumberGenericTableElements == Table->Capacity) {
+
+        nodes = realloc( Table->Nodes, sizeof( PVOID ) * max( 64, 2 * Table->Capacity ));
+
+        if (nodes == NULL) {
+
+            return NULL;
+        }
+
+        Table->Nodes = nodes;
+        Table->Capacity = max( 64, 2 * Table->Capacity );
+    }
+
+    node = Table->AllocateRoutine( Table, (CLONG) HOST_TABLE_HEADER_SIZE + BufferSize );
+
+    if (node == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( node, sizeof( RTL_BALANCED_LINKS ));
+    RtlCopyMemory( HostTableElement( node ), Buffer, BufferSize );
+
+    memmove( &Table->Nodes[index + 1],
+             &Table->Nodes[index],
+             sizeof( PVOID ) * (Table->NumberGenericTableElements - index) );
+
+    Table->Nodes[index] = node;
+    Table->NumberGenericTableElements += 1;
+
+    if (NewElement != NULL) {
+
+        *NewElement = TRUE;
+    }
+
+    return HostTableElement( node );
+}
+
+PVOID
+RtlLookupElementGenericTableAvl (
+    PRTL_AVL_TABLE Table,
+    PVOID Buffer
+    )
+{
+    ULONG index;
+
+    if (HostFindTableNode( Table, Buffer, &index )) {
+
+        return HostTableElement( Table->Nodes[index] );
+    }
+
+    return NULL;
+}
+
+BOOLEAN
+RtlDeleteElementGenericTableAvl (
+    PRTL_AVL_TABLE Table,
+    PVOID Buffer
+    )
+{
+    PRTL_BALANCED_LINKS node;
+    ULONG index;
+
+    if (!HostFindTableNode( Table, Buffer, &index )) {
+
+        return FALSE;
+    }
+
+    node = Table->Nodes[index];
+
+    Table->NumberGenericTableElements -= 1;
+
+    memmove( &Table->Nodes[index],
+             &Table->Nodes[index + 1],
+             sizeof( PVOID ) * (Table->NumberGenericTableElements - index) );
+
+    Table->FreeRoutine( Table, node );
+
+    if (Table->NumberGenericTableElements == 0) {
+
+        free( Table->Nodes );
+        Table->Nodes = NULL;
+        Table->Capacity = 0;
+    }
+
+    return TRUE;
+}
+
+//
+//  *RestartKey is the node last returned, or NULL to start from the
+//  first.
+//
+
+PVOID
+RtlEnumerateGenericTableWithoutSplayingAvl (
+    PRTL_AVL_TABLE Table,
+    PVOID *RestartKey
+    )
+{
+    ULONG index = 0;
+
+    if (*RestartKey != NULL) {
+
+        HostAssert( HostFindTableNode( Table, HostTableElement( *RestartKey ), &index ),
+                    "RestartKey is in the table", __FILE__, __LINE__ );
+
+        index += 1;
+    }
+
+    if (index >= Table->NumberGenericTableElements) {
+
+        return NULL;
+    }
+
+    *RestartKey = Table->Nodes[index];
+
+    return HostTableElement( Table->Nodes[index] );
+}
+
+PVOID
+RtlGetElementGenericTableAvl (
+    PRTL_AVL_TABLE Table,
+    ULONG I
+    )
+{
+    if (I >= Table->NumberGenericTableElements) {
+
+        return NULL;
+    }
+
+    return HostTableElement( Table->Nodes[I] );
+}
+
+NTSTATUS
+RtlAppendUnicodeToString (
+    PUNICODE_STRING Destination,
+    PCWSTR Source
+    )
+{
+    USHORT length = 0;
+
+    while (Source[length] != 0) {
+
+        length += 1;
+    }
+
+    length *= sizeof( WCHAR );
+
+    if (Destination->Length + length > Destination->MaximumLength) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RtlCopyMemory( (PUCHAR) Destination->Buffer + Destination->Length, Source, length );
+    Destination->Length += length;
+
+    if (Destination->Length + sizeof( WCHAR ) <= Destination->MaximumLength) {
+
+        Destination->Buffer[Destination->Length / sizeof( WCHAR )] = 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+//  The volume and its files.
+//
+
+static VOID
+HostSetFileSize (
+    PHOST_FILE File,
+    ULONGLONG Size
+    )
+{
+    PUCHAR data;
+
+    if (Size > File->Size) {
+
+        data = realloc( File->Data, (SIZE_T) Size );
+        HostAssert( data != NULL, "data != NULL", __FILE__, __LINE__ );
+
+        RtlZeroMemory( data + File->Size, (SIZE_T) (Size - File->Size) );
+        File->Data = data;
+    }
+
+    File->Size = Size;
+}
+
+VOID
+HostFormatVolume (
+    VOID
+    )
+{
+    pthread_mutex_lock( &HostLock );
+
+    HostAssert( HostMetadataFileOpens == 0, "HostMetadataFileOpens == 0", __FILE__, __LINE__ );
+
+    HostSystemVolumeInformationExists = FALSE;
+    HostMetadataFileExists = FALSE;
+    HostWritesFail = FALSE;
+
+    free( HostMetadataFile.Data );
+    free( HostDurableData );
+    HostMetadataFile.Data = NULL;
+    HostMetadataFile.Size = 0;
+    HostMetadataFile.FileId = HOST_METADATA_FILE_ID;
+    HostDurableData = NULL;
+    HostDurableSize = 0;
+
+    pthread_mutex_unlock( &HostLock );
+}
+
+VOID
+HostCrashVolume (
+    VOID
+    )
+{
+    pthread_mutex_lock( &HostLock );
+
+    HostAssert( HostMetadataFileOpens == 0, "HostMetadataFileOpens == 0", __FILE__, __LINE__ );
+
+    HostMetadataFile.Size = 0;
+    HostSetFileSize( &HostMetadataFile, HostDurableSize );
+
+    if (HostDurableSize > 0) {
+
+        RtlCopyMemory( HostMetadataFile.Data, HostDurableData, (SIZE_T) HostDurableSize );
+    }
+
+    pthread_mutex_unlock( &HostLock );
+}
+
+VOID
+HostDamageMetadataFile (
+    ULONGLONG Offset,
+    ULONG Length
+    )
+{
+    ULONGLONG offset;
+
+    pthread_mutex_lock( &HostLock );
+
+    for (offset = Offset; offset < Offset + Length; offset += 1) {
+
+        if (offset < HostMetadataFile.Size) {
+
+            HostMetadataFile.Data[offset] ^= 0xff;
+        }
+
+        if (offset < HostDurableSize) {
+
+            HostDurableData[offset] ^= 0xff;
+        }
+    }
+
+    pthread_mutex_unlock( &HostLock );
+}
+
+ULONGLONG
+HostMetadataFileSize (
+    VOID
+    )
+{
+    ULONGLONG size;
+
+    pthread_mutex_lock( &HostLock );
+    size = HostMetadataFile.Size;
+    pthread_mutex_unlock( &HostLock );
+
+    return size;
+}
+
+VOID
+HostFailWrites (
+    BOOLEAN Fail
+    )
+{
+    pthread_mutex_lock( &HostLock );
+    HostWritesFail = Fail;
+    pthread_mutex_unlock( &HostLock );
+}
+
+static PFILE_OBJECT
+HostCreateFileObject (
+    PHOST_FILE File
+    )
+{
+    PFILE_OBJECT fileObject;
+
+    fileObject = HostCreateObject( HostFileObjectType, sizeof( FILE_OBJECT ));
+
+    fileObject->Size = sizeof( FILE_OBJECT );
+    fileObject->FsContext = File;
+
+    return fileObject;
+}
+
+static VOID
+HostDeleteFileObject (
+    PVOID Object
+    )
+{
+    PFILE_OBJECT fileObject = Object;
+
+    if (fileObject->FsContext == &HostMetadataFile) {
+
+        pthread_mutex_lock( &HostLock );
+        HostMetadataFileOpens -= 1;
+        pthread_mutex_unlock( &HostLock );
+
+    } else {
+
+        free( fileObject->FsContext );
+    }
+}
+
+PFILE_OBJECT
+HostOpenFile (
+    ULONGLONG FileId
+    )
+{
+    PHOST_FILE file;
+
+    file = calloc( 1, sizeof( HOST_FILE ));
+    HostAssert( file != NULL, "file != NULL", __FILE__, __LINE__ );
+
+    file->FileId = FileId;
+
+    return HostCreateFileObject( file );
+}
+
+VOID
+HostCloseFile (
+    PFILE_OBJECT FileObject
+    )
+{
+    ObDereferenceObject( FileObject );
+}
+
+NTSTATUS
+FltGetVolumeName (
+    PFLT_VOLUME Volume,
+    PUNICODE_STRING VolumeName,
+    PULONG BufferSizeNeeded
+    )
+{
+    static const WCHAR name[] = HOST_VOLUME_NAME;
+    ULONG length = sizeof( name ) - sizeof( WCHAR );
+
+    FLT_ASSERT( Volume == HostVolume );
+
+    if (BufferSizeNeeded != NULL) {
+
+        *BufferSizeNeeded = length;
+    }
+
+    if (VolumeName->MaximumLength < length) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RtlCopyMemory( VolumeName->Buffer, name, length );
+    VolumeName->Length = (USHORT) length;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FltCreateSystemVolumeInformationFolder (
+    PFLT_INSTANCE Instance
+    )
+{
+    FLT_ASSERT( Instance == HostInstance );
+
+    pthread_mutex_lock( &HostLock );
+    HostSystemVolumeInformationExists = TRUE;
+    pthread_mutex_unlock( &HostLock );
+
+    return STATUS_SUCCESS;
+}
+
+//
+//  Only the metadata file can be opened by name.
+//
+
+NTSTATUS
+FltCreateFile (
+    PFLT_FILTER Filter,
+    PFLT_INSTANCE Instance,
+    PHANDLE FileHandle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    PIO_STATUS_BLOCK IoStatusBlock,
+    PLARGE_INTEGER AllocationSize,
+    ULONG FileAttributes,
+    ULONG ShareAccess,
+    ULONG CreateDisposition,
+    ULONG CreateOptions,
+    PVOID EaBuffer,
+    ULONG EaLength,
+    ULONG Flags
+    )
+{
+    static const WCHAR name[] = HOST_VOLUME_NAME FMM_METADATA_FILE_NAME;
+    PUNICODE_STRING fileName = ObjectAttributes->ObjectName;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( AllocationSize );
+    UNREFERENCED_PARAMETER( FileAttributes );
+    UNREFERENCED_PARAMETER( ShareAccess );
+    UNREFERENCED_PARAMETER( CreateOptions );
+    UNREFERENCED_PARAMETER( EaBuffer );
+    UNREFERENCED_PARAMETER( EaLength );
+    UNREFERENCED_PARAMETER( Flags );
+
+    FLT_ASSERT( (Filter == HostFilter) && (Instance == HostInstance) );
+
+    *FileHandle = NULL;
+
+    if ((fileName->Length != sizeof( name ) - sizeof( WCHAR )) ||
+        (memcmp( fileName->Buffer, name, fileName->Length ) != 0)) {
+
+        return STATUS_OBJECT_NAME_INVALID;
+    }
+
+    pthread_mutex_lock( &HostLock );
+
+    if (!HostSystemVolumeInformationExists) {
+
+        status = STATUS_OBJECT_PATH_NOT_FOUND;
+
+    } else if (HostMetadataFileExists) {
+
+        IoStatusBlock->Information = FILE_OPENED;
+
+    } else if (CreateDisposition == FILE_OPEN_IF) {
+
+        HostMetadataFileExists = TRUE;
+        IoStatusBlock->Information = FILE_CREATED;
+
+    } else {
+
+        status = STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        HostMetadataFileOpens += 1;
+    }
+
+    pthread_mutex_unlock( &HostLock );
+
+    IoStatusBlock->Status = status;
+
+    if (NT_SUCCESS( status )) {
+
+        *FileHandle = HostCreateFileObject( &HostMetadataFile );
+    }
+
+    return status;
+}
+
+NTSTATUS
+FltClose (
+    HANDLE FileHandle
+    )
+{
+    return ZwClose( FileHandle );
+}
+
+NTSTATUS
+FltReadFile (
+    PFLT_INSTANCE InitiatingInstance,
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER ByteOffset,
+    ULONG Length,
+    PVOID Buffer,
+    FLT_IO_OPERATION_FLAGS Flags,
+    PULONG BytesRead,
+    PVOID CallbackRoutine,
+    PVOID CallbackContext
+    )
+{
+    ULONGLONG offset = (ULONGLONG) ByteOffset->QuadPart;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    UNREFERENCED_PARAMETER( Flags );
+
+    FLT_ASSERT( (InitiatingInstance == HostInstance) && (FileObject->FsContext == &HostMetadataFile) );
+    FLT_ASSERT( (CallbackRoutine == NULL) && (CallbackContext == NULL) );
+
+    *BytesRead = 0;
+
+    pthread_mutex_lock( &HostLock );
+
+    if (offset >= HostMetadataFile.Size) {
+
+        status = STATUS_END_OF_FILE;
+
+    } else {
+
+        *BytesRead = (ULONG) min( (ULONGLONG) Length, HostMetadataFile.Size - offset );
+        RtlCopyMemory( Buffer, HostMetadataFile.Data + offset, *BytesRead );
+    }
+
+    pthread_mutex_unlock( &HostLock );
+
+    return status;
+}
+
+NTSTATUS
+FltWriteFile (
+    PFLT_INSTANCE InitiatingInstance,
+    PFILE_OBJECT FileObject,
+    PLARGE_INTEGER ByteOffset,
+    ULONG Length,
+    PVOID Buffer,
+    FLT_IO_OPERATION_FLAGS Flags,
+    PULONG BytesWritten,
+    PVOID CallbackRoutine,
+    PVOID CallbackContext
+    )
+{
+    ULONGLONG offset = (ULONGLONG) ByteOffset->QuadPart;
+
+    UNREFERENCED_PARAMETER( Flags );
+
+    FLT_ASSERT( (InitiatingInstance == HostInstance) && (FileObject->FsContext == &HostMetadataFile) );
+    FLT_ASSERT( (CallbackRoutine == NULL) && (CallbackContext == NULL) );
+
+    *BytesWritten = 0;
+
+    pthread_mutex_lock( &HostLock );
+
+    if (HostWritesFail) {
+
+        pthread_mutex_unlock( &HostLock );
+        return STATUS_DISK_FULL;
+    }
+
+    if (offset + Length > HostMetadataFile.Size) {
+
+        HostSetFileSize( &HostMetadataFile, offset + Length );
+    }
+
+    RtlCopyMemory( HostMetadataFile.Data + offset, Buffer, Length );
+    *BytesWritten = Length;
+
+    HostCounters.Writes += 1;
+    HostCounters.BytesWritten += Length;
+
+    pthread_mutex_unlock( &HostLock );
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FltFlushBuffers (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject
+    )
+{
+    PUCHAR data;
+
+    FLT_ASSERT( (Instance == HostInstance) && (FileObject->FsContext == &HostMetadataFile) );
+
+    pthread_mutex_lock( &HostLock );
+
+    if (HostMetadataFile.Size > 0) {
+
+        data = realloc( HostDurableData, (SIZE_T) HostMetadataFile.Size );
+        HostAssert( data != NULL, "data != NULL", __FILE__, __LINE__ );
+
+        RtlCopyMemory( data, HostMetadataFile.Data, (SIZE_T) HostMetadataFile.Size );
+        HostDurableData = data;
+    }
+
+    HostDurableSize = HostMetadataFile.Size;
+    HostCounters.Flushes += 1;
+
+    pthread_mutex_unlock( &HostLock );
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FltQueryInformationFile (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass,
+    PULONG LengthReturned
+    )
+{
+    PFILE_INTERNAL_INFORMATION internalInformation = FileInformation;
+    PHOST_FILE file = FileObject->FsContext;
+
+    FLT_ASSERT( Instance == HostInstance );
+
+    if ((FileInformationClass != FileInternalInformation) ||
+        (Length < sizeof( FILE_INTERNAL_INFORMATION ))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    internalInformation->IndexNumber.QuadPart = (LONGLONG) file->FileId;
+
+    if (LengthReturned != NULL) {
+
+        *LengthReturned = sizeof( FILE_INTERNAL_INFORMATION );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FltSetInformationFile (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass
+    )
+{
+    PFILE_END_OF_FILE_INFORMATION endOfFile = FileInformation;
+
+    FLT_ASSERT( (Instance == HostInstance) && (FileObject->FsContext == &HostMetadataFile) );
+
+    if ((FileInformationClass != FileEndOfFileInformation) ||
+        (Length < sizeof( FILE_END_OF_FILE_INFORMATION ))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock( &HostLock );
+    HostSetFileSize( &HostMetadataFile, (ULONGLONG) endOfFile->EndOfFile.QuadPart );
+    pthread_mutex_unlock( &HostLock );
+
+    return STATUS_SUCCESS;
+}
+
+//
+//  The instance context.
+//
+
+VOID
+HostSetInstanceContext (
+    PFLT_CONTEXT Context
+    )
+{
+    HostInstanceContext = Context;
+}
+
+NTSTATUS
+FltGetInstanceContext (
+    PFLT_INSTANCE Instance,
+    PFLT_CONTEXT *Context
+    )
+{
+    FLT_ASSERT( Instance == HostInstance );
+
+    *Context = HostInstanceContext;
+
+    if (HostInstanceContext == NULL) {
+
+        return STATUS_NOT_FOUND;
+    }
+
+    HostCount( &HostCounters.ContextReferences, 1 );
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FltReferenceContext (
+    PFLT_CONTEXT Context
+    )
+{
+    FLT_ASSERT( Context == HostInstanceContext );
+
+    HostCount( &HostCounters.ContextReferences, 1 );
+}
+
+VOID
+FltReleaseContext (
+    PFLT_CONTEXT Context
+    )
+{
+    FLT_ASSERT( Context == HostInstanceContext );
+
+    HostCount( &HostCounters.ContextReferences, -1 );
+}
+
+ULONG
+FltGetRequestorProcessId (
+    PFLT_CALLBACK_DATA CallbackData
+    )
+{
+    UNREFERENCED_PARAMETER( CallbackData );
+
+    return (ULONG) getpid();
+}
@@ -0,0 +1,132 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Host.h
+
+Abstract:
+
+    The routines host.c adds for the program built on the Metadata Manager
+    sources: the volume the filter is attached to and its metadata file,
+    crashing the volume and damaging or failing writes to the file, other
+    files to ask the file id of, and the counters the program reports and
+    checks from.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#pragma once
+
+#include "pch.h"
+
+//
+//  The filter, volume and instance FltMgr would hand the filter.
+//
+
+extern PFLT_FILTER HostFilter;
+extern PFLT_VOLUME HostVolume;
+extern PFLT_INSTANCE HostInstance;
+
+//
+//  Counters kept by host.c.
+//
+//      PoolBlocks - Pool allocations not yet freed.
+//      PoolBytes - Bytes in them.
+//      Objects - File and thread objects not yet deleted.
+//      ContextReferences - References to the instance context taken by
+//          FltGetInstanceContext or FltReferenceContext and not released.
+//      Writes - Writes to the metadata file.
+//      BytesWritten - Bytes in them.
+//      Flushes - Flushes of the metadata file.
+//
+
+typedef struct _HOST_COUNTERS {
+
+    LONGLONG PoolBlocks;
+    LONGLONG PoolBytes;
+    LONGLONG Objects;
+    LONGLONG ContextReferences;
+    LONGLONG Writes;
+    LONGLONG BytesWritten;
+    LONGLONG Flushes;
+
+} HOST_COUNTERS, *PHOST_COUNTERS;
+
+//
+//  Empties the volume: it has no System Volume Information folder and no
+//  metadata file.
+//
+
+VOID
+HostFormatVolume (
+    VOID
+    );
+
+//
+//  Loses whatever was written to the metadata file since it was last
+//  flushed, as a power failure would.  The file must not be open.
+//
+
+VOID
+HostCrashVolume (
+    VOID
+    );
+
+//
+//  Inverts Length bytes of the metadata file at Offset, as it would read
+//  after a torn write there.
+//
+
+VOID
+HostDamageMetadataFile (
+    _In_ ULONGLONG Offset,
+    _In_ ULONG Length
+    );
+
+ULONGLONG
+HostMetadataFileSize (
+    VOID
+    );
+
+//
+//  While set, writes to the metadata file fail with STATUS_DISK_FULL.
+//
+
+VOID
+HostFailWrites (
+    _In_ BOOLEAN Fail
+    );
+
+//
+//  Sets the context FltGetInstanceContext returns for HostInstance.
+//
+
+VOID
+HostSetInstanceContext (
+    _In_opt_ PFLT_CONTEXT Context
+    );
+
+//
+//  Opens a file on the volume that only answers FileInternalInformation,
+//  with FileId, and closes it again.
+//
+
+PFILE_OBJECT
+HostOpenFile (
+    _In_ ULONGLONG FileId
+    );
+
+VOID
+HostCloseFile (
+    _In_ PFILE_OBJECT FileObject
+    );
+
+VOID
+HostGetCounters (
+    _Out_ PHOST_COUNTERS Counters
+    );
@@ -0,0 +1,1243 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    MdStore.c
+
+Abstract:
+
+    Host test of the Metadata Manager metadata store: records set, queried
+    and deleted through the in memory table, the log written behind them
+    and replayed when the metadata file is opened again, and the
+    checkpoints that decide how much of it a crash keeps.
+
+    DataStore.c and Support.c are built unchanged against the stand-ins in
+    kernel/.  The volume is attached to and detached from as
+    FmmInstanceSetup and the instance teardown callbacks do, and a volume
+    lock is taken and dropped through FmmReleaseMetadataFileReferences and
+    FmmReacquireMetadataFileReferences.  A crash stops the flush thread and
+    drops the metadata file without flushing anything, then throws away
+    what the volume was never asked to flush.
+
+    The self test checks, after each case, that no pool, object or
+    instance context reference is left behind.  The timed run has threads
+    setting, deleting and querying records of their own with the flush
+    thread running, then detaches and attaches again and checks every
+    record the threads left came back.
+
+    usage: mdstore --selftest
+           mdstore [--seconds s] [--keys n] [--reads pct] [threads...]
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "host.h"
+
+#include <time.h>
+
+#define MAX_THREADS                     16
+#define MAX_RECORD_LENGTH               (16 + 3 * 24)
+
+FMM_GLOBAL_DATA Globals;
+
+static int failures;
+
+#define CHECK(X) {                                                      \
+    if (!(X)) {                                                         \
+        printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #X ); \
+        failures += 1;                                                  \
+    }                                                                   \
+}
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static double
+Now (
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//
+//  The data of version Version of the record for Key.  Versions start at
+//  1; 0 stands for no record.  The length varies with the version so that
+//  records are replaced by ones of other sizes.
+//
+
+static ULONG
+FormatRecord (
+    PUCHAR Buffer,
+    ULONGLONG Key,
+    ULONG Version
+    )
+{
+    ULONG length = 16 + (Version % 4) * 24;
+    ULONG i;
+
+    memcpy( Buffer, &Key, sizeof( Key ));
+    memcpy( Buffer + 8, &Version, sizeof( Version ));
+
+    for (i = 12; i < length; i++) {
+        Buffer[i] = (UCHAR)(Key * 31 + Version + i);
+    }
+
+    return length;
+}
+
+static NTSTATUS
+SetRecord (
+    PFMM_INSTANCE_CONTEXT Context,
+    ULONGLONG Key,
+    ULONG Version
+    )
+{
+    UCHAR buffer[MAX_RECORD_LENGTH];
+    ULONG length = FormatRecord( buffer, Key, Version );
+
+    return FmmSetMetadata( Context, Key, buffer, length );
+}
+
+//
+//  TRUE if the store holds version Version of the record for Key, or no
+//  record if Version is 0.
+//
+
+static BOOLEAN
+HasRecord (
+    PFMM_INSTANCE_CONTEXT Context,
+    ULONGLONG Key,
+    ULONG Version
+    )
+{
+    UCHAR expected[MAX_RECORD_LENGTH];
+    UCHAR buffer[MAX_RECORD_LENGTH];
+    ULONG length;
+    ULONG returned;
+    NTSTATUS status;
+
+    status = FmmQueryMetadata( Context, Key, buffer, sizeof( buffer ), &returned );
+
+    if (Version == 0) {
+        return (BOOLEAN)(status == STATUS_NOT_FOUND);
+    }
+
+    length = FormatRecord( expected, Key, Version );
+
+    return (BOOLEAN)(NT_SUCCESS( status ) &&
+                     (returned == length) &&
+                     (memcmp( buffer, expected, length ) == 0));
+}
+
+//
+//  A model of what the store should hold: the version of each key's
+//  record, 0 if it has none.
+//
+
+typedef struct _MODEL {
+    ULONG Keys;
+    ULONG *Versions;
+} MODEL, *PMODEL;
+
+static void
+InitializeModel (
+    PMODEL Model,
+    ULONG Keys
+    )
+{
+    Model->Keys = Keys;
+    Model->Versions = calloc( Keys, sizeof( ULONG ));
+}
+
+static void
+CopyModel (
+    PMODEL Destination,
+    const MODEL *Source
+    )
+{
+    memcpy( Destination->Versions, Source->Versions, Source->Keys * sizeof( ULONG ));
+}
+
+static void
+SetModelRecord (
+    PFMM_INSTANCE_CONTEXT Context,
+    PMODEL Model,
+    ULONG Key,
+    ULONG Version
+    )
+{
+    if (Version == 0) {
+        (VOID) FmmDeleteMetadata( Context, Key );
+    } else {
+        CHECK( NT_SUCCESS( SetRecord( Context, Key, Version )));
+    }
+
+    Model->Versions[Key] = Version;
+}
+
+//
+//  TRUE if the store holds exactly the records of the model, and its count
+//  of live bytes agrees with them.
+//
+
+static BOOLEAN
+MatchesModel (
+    PFMM_INSTANCE_CONTEXT Context,
+    const MODEL *Model
+    )
+{
+    UCHAR buffer[MAX_RECORD_LENGTH];
+    ULONG records = 0;
+    ULONG liveBytes = 0;
+    ULONG key;
+
+    for (key = 0; key < Model->Keys; key++) {
+
+        if (!HasRecord( Context, key, Model->Versions[key] )) {
+            printf( "key %u: expected version %u\n", key, Model->Versions[key] );
+            return FALSE;
+        }
+
+        if (Model->Versions[key] != 0) {
+            records += 1;
+            liveBytes += FMM_METADATA_RECORD_LENGTH( FormatRecord( buffer, key, Model->Versions[key] ));
+        }
+    }
+
+    return (BOOLEAN)((Context->MetadataStore.Table.NumberGenericTableElements == records) &&
+                     (Context->MetadataStore.LiveBytes == liveBytes));
+}
+
+//
+//  Attaches to the volume as FmmInstanceSetup does, creating the metadata
+//  file if Create is set, and starts the flush thread if Thread is set.
+//
+
+static PFMM_INSTANCE_CONTEXT
+Attach (
+    BOOLEAN Create,
+    BOOLEAN Thread,
+    PNTSTATUS Status
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    NTSTATUS status;
+
+    context = calloc( 1, sizeof( FMM_INSTANCE_CONTEXT ));
+
+    context->Instance = HostInstance;
+    context->FilesystemType = FLT_FSTYPE_NTFS;
+    context->Volume = HostVolume;
+    ExInitializeResourceLite( &context->MetadataResource );
+    FmmInitializeMetadataStore( &context->MetadataStore );
+
+    HostSetInstanceContext( context );
+
+    FmmAcquireResourceExclusive( &context->MetadataResource );
+    status = FmmOpenMetadata( context, Create );
+    FmmReleaseResource( &context->MetadataResource );
+
+    if (Status != NULL) {
+        *Status = status;
+    }
+
+    if (!NT_SUCCESS( status )) {
+
+        FmmDeleteMetadataStore( &context->MetadataStore );
+        ExDeleteResourceLite( &context->MetadataResource );
+        HostSetInstanceContext( NULL );
+        free( context );
+
+        return NULL;
+    }
+
+    if (Thread) {
+        CHECK( NT_SUCCESS( FmmStartMetadataFlushThread( context )));
+    }
+
+    return context;
+}
+
+static void
+DeleteContext (
+    PFMM_INSTANCE_CONTEXT Context
+    )
+{
+    FmmDeleteMetadataStore( &Context->MetadataStore );
+    ExDeleteResourceLite( &Context->MetadataResource );
+    HostSetInstanceContext( NULL );
+    free( Context );
+}
+
+//
+//  Detaches as the instance teardown callbacks do, which writes out
+//  whatever is still pending.
+//
+
+static void
+Detach (
+    PFMM_INSTANCE_CONTEXT Context
+    )
+{
+    FmmStopMetadataFlushThread( Context );
+
+    FmmAcquireResourceExclusive( &Context->MetadataResource );
+
+    if (FlagOn( Context->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED )) {
+        FmmCloseMetadata( Context );
+    }
+
+    FmmReleaseResource( &Context->MetadataResource );
+
+    DeleteContext( Context );
+}
+
+//
+//  Loses power: nothing pending is written, and the volume keeps only what
+//  it was asked to flush.
+//
+
+static void
+Crash (
+    PFMM_INSTANCE_CONTEXT Context
+    )
+{
+    FmmStopMetadataFlushThread( Context );
+
+    if (FlagOn( Context->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED )) {
+
+        Context->MetadataStore.FileObject = NULL;
+        ObDereferenceObject( Context->MetadataFileObject );
+        FltClose( Context->MetadataHandle );
+    }
+
+    DeleteContext( Context );
+    HostCrashVolume();
+}
+
+static NTSTATUS
+Flush (
+    PFMM_INSTANCE_CONTEXT Context
+    )
+{
+    NTSTATUS status;
+
+    FmmAcquireResourceExclusive( &Context->MetadataStore.FileResource );
+    status = FmmFlushMetadataLog( Context );
+    FmmReleaseResource( &Context->MetadataStore.FileResource );
+
+    return status;
+}
+
+static BOOLEAN
+NothingLeft (
+    void
+    )
+{
+    HOST_COUNTERS counters;
+
+    HostGetCounters( &counters );
+
+    if ((counters.PoolBlocks != 0) || (counters.Objects != 0) || (counters.ContextReferences != 0)) {
+        printf( "left behind: %lld pool blocks, %lld objects, %lld context references\n",
+                (long long)counters.PoolBlocks, (long long)counters.Objects,
+                (long long)counters.ContextReferences );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+//  The first attach creates the System Volume Information folder and the
+//  metadata file, and the first detach leaves an empty checkpointed log.
+//  Without Create, a volume with no metadata file is not attached to.
+//
+
+static void
+TestFirstAttach (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    NTSTATUS status;
+
+    HostFormatVolume();
+
+    context = Attach( FALSE, FALSE, &status );
+    CHECK( (context == NULL) && (status == STATUS_OBJECT_PATH_NOT_FOUND) );
+
+    context = Attach( TRUE, FALSE, &status );
+    CHECK( context != NULL );
+
+    if (context == NULL) {
+        return;
+    }
+
+    CHECK( context->MetadataStore.Loaded );
+    CHECK( context->MetadataStore.NeedsSnapshot );
+    CHECK( context->MetadataStore.Table.NumberGenericTableElements == 0 );
+
+    Detach( context );
+
+    CHECK( HostMetadataFileSize() == FMM_METADATA_LOG_OFFSET );
+
+    context = Attach( FALSE, FALSE, &status );
+    CHECK( context != NULL );
+
+    if (context != NULL) {
+        CHECK( !context->MetadataStore.NeedsSnapshot );
+        CHECK( context->MetadataStore.Table.NumberGenericTableElements == 0 );
+        Detach( context );
+    }
+
+    HostFormatVolume();
+    CHECK( NT_SUCCESS( FltCreateSystemVolumeInformationFolder( HostInstance )));
+
+    context = Attach( FALSE, FALSE, &status );
+    CHECK( (context == NULL) && (status == STATUS_OBJECT_NAME_NOT_FOUND) );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  Records set, replaced and deleted come back after detaching and
+//  attaching again, across more than one session of appended log.
+//
+
+static void
+TestReplay (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    UCHAR buffer[FMM_METADATA_MAX_DATA_LENGTH + 1];
+    MODEL model;
+    ULONG returned;
+    ULONG session;
+    ULONG key;
+
+    HostFormatVolume();
+    InitializeModel( &model, 2000 );
+
+    context = Attach( TRUE, FALSE, NULL );
+
+    //
+    //  Argument checks and the answers for a missing record or a short
+    //  buffer.
+    //
+
+    memset( buffer, 0x5a, sizeof( buffer ));
+    CHECK( FmmSetMetadata( context, 1, buffer, 0 ) == STATUS_INVALID_PARAMETER );
+    CHECK( FmmSetMetadata( context, 1, buffer, FMM_METADATA_MAX_DATA_LENGTH + 1 ) == STATUS_INVALID_PARAMETER );
+    CHECK( FmmDeleteMetadata( context, 1 ) == STATUS_NOT_FOUND );
+    CHECK( FmmQueryMetadata( context, 1, buffer, sizeof( buffer ), &returned ) == STATUS_NOT_FOUND );
+    CHECK( returned == 0 );
+
+    CHECK( NT_SUCCESS( FmmSetMetadata( context, 1, buffer, FMM_METADATA_MAX_DATA_LENGTH )));
+    CHECK( FmmQueryMetadata( context, 1, buffer, 16, &returned ) == STATUS_BUFFER_TOO_SMALL );
+    CHECK( returned == FMM_METADATA_MAX_DATA_LENGTH );
+    CHECK( FmmQueryMetadata( context, 1, NULL, 0, &returned ) == STATUS_BUFFER_TOO_SMALL );
+    CHECK( FmmDeleteMetadata( context, 1 ) == STATUS_SUCCESS );
+
+    for (session = 1; session <= 3; session++) {
+
+        for (key = 0; key < model.Keys; key++) {
+
+            if ((key % session) == 0) {
+                SetModelRecord( context, &model, key, session * 10 + key % 7 );
+            } else if ((key % 5) == session) {
+                SetModelRecord( context, &model, key, 0 );
+            }
+        }
+
+        CHECK( MatchesModel( context, &model ));
+
+        Detach( context );
+        context = Attach( FALSE, FALSE, NULL );
+
+        CHECK( !context->MetadataStore.NeedsSnapshot );
+        CHECK( MatchesModel( context, &model ));
+    }
+
+    Detach( context );
+    free( model.Versions );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  A crash keeps what was checkpointed and loses what was not.
+//
+
+static void
+TestCrash (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    MODEL checkpointed;
+    MODEL model;
+    ULONG key;
+
+    HostFormatVolume();
+    InitializeModel( &model, 600 );
+    InitializeModel( &checkpointed, 600 );
+
+    context = Attach( TRUE, FALSE, NULL );
+
+    for (key = 0; key < 500; key++) {
+        SetModelRecord( context, &model, key, 1 );
+    }
+
+    CHECK( NT_SUCCESS( Flush( context )));
+    CopyModel( &checkpointed, &model );
+
+    for (key = 0; key < 100; key++) {
+        SetModelRecord( context, &model, key, 2 );
+    }
+
+    for (key = 400; key < 450; key++) {
+        SetModelRecord( context, &model, key, 0 );
+    }
+
+    for (key = 500; key < 600; key++) {
+        SetModelRecord( context, &model, key, 3 );
+    }
+
+    Crash( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( MatchesModel( context, &checkpointed ));
+
+    //
+    //  Once the same updates are flushed they survive a crash, appended to
+    //  the log rather than written as a snapshot.
+    //
+
+    for (key = 0; key < model.Keys; key++) {
+
+        if (model.Versions[key] != checkpointed.Versions[key]) {
+            SetModelRecord( context, &model, key, model.Versions[key] );
+        }
+    }
+
+    CHECK( NT_SUCCESS( Flush( context )));
+    CHECK( context->MetadataStore.LogStart == FMM_METADATA_LOG_OFFSET );
+    CHECK( context->MetadataStore.LogEnd > FMM_METADATA_LOG_OFFSET + context->MetadataStore.LiveBytes );
+
+    Crash( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    free( model.Versions );
+    free( checkpointed.Versions );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  A torn write of the newest checkpoint falls back to the one before it,
+//  and with both gone the store starts empty.  A damaged record ends the
+//  replay there, and the next flush rewrites the file from what was
+//  replayed.
+//
+
+static void
+TestDamage (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    MODEL older;
+    MODEL model;
+    ULONGLONG newestSlot;
+    ULONGLONG logEnd;
+    ULONG key;
+
+    HostFormatVolume();
+    InitializeModel( &model, 300 );
+    InitializeModel( &older, 300 );
+
+    context = Attach( TRUE, FALSE, NULL );
+
+    for (key = 0; key < 200; key++) {
+        SetModelRecord( context, &model, key, 1 );
+    }
+
+    CHECK( NT_SUCCESS( Flush( context )));
+    CopyModel( &older, &model );
+    logEnd = context->MetadataStore.LogEnd;
+
+    for (key = 100; key < 300; key++) {
+        SetModelRecord( context, &model, key, 2 );
+    }
+
+    CHECK( NT_SUCCESS( Flush( context )));
+    newestSlot = context->MetadataStore.Sequence % 2;
+
+    Crash( context );
+    HostDamageMetadataFile( newestSlot * FMM_METADATA_SLOT_STRIDE + 8, 16 );
+
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( MatchesModel( context, &older ));
+    CHECK( context->MetadataStore.LogEnd == logEnd );
+
+    Crash( context );
+    HostDamageMetadataFile( 0, 8 );
+    HostDamageMetadataFile( FMM_METADATA_SLOT_STRIDE, 8 );
+
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( context->MetadataStore.Table.NumberGenericTableElements == 0 );
+    CHECK( context->MetadataStore.NeedsSnapshot );
+
+    //
+    //  Rebuild, then damage a record in the middle of the second flush's
+    //  log.  Replay keeps the first flush's records and those of the second
+    //  before the damage.
+    //
+
+    for (key = 0; key < 200; key++) {
+        SetModelRecord( context, &model, key, 1 );
+    }
+
+    for (key = 200; key < 300; key++) {
+        SetModelRecord( context, &model, key, 0 );
+    }
+
+    CHECK( NT_SUCCESS( Flush( context )));
+    logEnd = context->MetadataStore.LogEnd;
+
+    for (key = 100; key < 300; key++) {
+        SetModelRecord( context, &model, key, 2 );
+    }
+
+    CHECK( NT_SUCCESS( Flush( context )));
+
+    //
+    //  The second flush logged keys 100 to 299 in order, all with data of
+    //  the same length; damage the data of key 200's record.
+    //
+
+    Detach( context );
+    HostDamageMetadataFile( logEnd + 100 * FMM_METADATA_RECORD_LENGTH( 16 + 2 * 24 ) + 20, 1 );
+
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( context->MetadataStore.NeedsSnapshot );
+    CHECK( HasRecord( context, 0, 1 ));
+    CHECK( HasRecord( context, 99, 1 ));
+    CHECK( HasRecord( context, 100, 2 ));
+    CHECK( HasRecord( context, 199, 2 ));
+    CHECK( HasRecord( context, 200, 0 ));
+    CHECK( HasRecord( context, 299, 0 ));
+
+    for (key = 200; key < 300; key++) {
+        model.Versions[key] = 0;
+    }
+
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( !context->MetadataStore.NeedsSnapshot );
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    free( model.Versions );
+    free( older.Versions );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  Rewriting the same records grows the log until it is compacted into a
+//  snapshot at the start of the file, and the file is trimmed to it.
+//
+
+static void
+TestCompaction (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    ULONGLONG largest = 0;
+    ULONG compactions = 0;
+    ULONG round;
+    ULONG key;
+    MODEL model;
+
+    HostFormatVolume();
+    InitializeModel( &model, 200 );
+
+    context = Attach( TRUE, FALSE, NULL );
+
+    for (round = 1; round <= 300; round++) {
+
+        for (key = 0; key < model.Keys; key++) {
+            SetModelRecord( context, &model, key, round + key );
+        }
+
+        CHECK( NT_SUCCESS( Flush( context )));
+
+        largest = max( largest, HostMetadataFileSize() );
+
+        if (HostMetadataFileSize() == FMM_METADATA_LOG_OFFSET + context->MetadataStore.LiveBytes) {
+            compactions += 1;
+        }
+    }
+
+    //
+    //  The first flush writes a snapshot as the file is new; the rest come
+    //  from compaction.  The log never grows much past the size that
+    //  triggers it.
+    //
+
+    CHECK( compactions >= 3 );
+    CHECK( largest < FMM_METADATA_LOG_OFFSET + FMM_METADATA_COMPACT_SIZE + 2 * model.Keys * MAX_RECORD_LENGTH );
+
+    Crash( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    free( model.Versions );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  While the metadata file cannot be written the updates stay in memory,
+//  and the first flush that works writes a snapshot of all of them.
+//
+
+static void
+TestWriteFailure (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    MODEL model;
+    ULONG key;
+
+    HostFormatVolume();
+    InitializeModel( &model, 300 );
+
+    context = Attach( TRUE, FALSE, NULL );
+
+    for (key = 0; key < 100; key++) {
+        SetModelRecord( context, &model, key, 1 );
+    }
+
+    CHECK( NT_SUCCESS( Flush( context )));
+
+    HostFailWrites( TRUE );
+
+    for (key = 100; key < 200; key++) {
+        SetModelRecord( context, &model, key, 1 );
+    }
+
+    CHECK( Flush( context ) == STATUS_DISK_FULL );
+    CHECK( context->MetadataStore.NeedsSnapshot );
+
+    for (key = 50; key < 300; key++) {
+        SetModelRecord( context, &model, key, (key % 3) ? 2 : 0 );
+    }
+
+    CHECK( Flush( context ) == STATUS_DISK_FULL );
+
+    HostFailWrites( FALSE );
+
+    CHECK( NT_SUCCESS( Flush( context )));
+    CHECK( !context->MetadataStore.NeedsSnapshot );
+
+    Crash( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    free( model.Versions );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  A volume lock closes the metadata file, flushing it.  Updates made
+//  while it is closed are logged, and once the log outgrows its limit it
+//  is dropped for a snapshot, written when the lock is released and the
+//  file reopened.  Reopening does not read the file again.
+//
+
+static void
+TestVolumeLock (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    FLT_IO_PARAMETER_BLOCK iopb;
+    FLT_CALLBACK_DATA cbd;
+    HOST_COUNTERS before;
+    HOST_COUNTERS after;
+    PFILE_OBJECT volumeFileObject;
+    MODEL model;
+    ULONG version;
+    ULONG key;
+
+    HostFormatVolume();
+    InitializeModel( &model, 100 );
+
+    context = Attach( TRUE, TRUE, NULL );
+
+    for (key = 0; key < model.Keys; key++) {
+        SetModelRecord( context, &model, key, 1 );
+    }
+
+    volumeFileObject = HostOpenFile( 0 );
+    volumeFileObject->Flags |= FO_VOLUME_OPEN;
+
+    RtlZeroMemory( &iopb, sizeof( iopb ));
+    RtlZeroMemory( &cbd, sizeof( cbd ));
+    iopb.TargetInstance = HostInstance;
+    iopb.TargetFileObject = volumeFileObject;
+    cbd.Iopb = &iopb;
+
+    CHECK( FmmTargetIsVolumeOpen( &cbd ));
+
+    HostGetCounters( &before );
+    CHECK( NT_SUCCESS( FmmReleaseMetadataFileReferences( &cbd )));
+    HostGetCounters( &after );
+
+    CHECK( !FlagOn( context->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED ));
+    CHECK( context->MetadataStore.FileObject == NULL );
+    CHECK( after.Flushes > before.Flushes );
+
+    for (version = 2; context->MetadataStore.LogBytes > 0 || version == 2; version++) {
+
+        for (key = 0; key < model.Keys; key++) {
+            SetModelRecord( context, &model, key, version );
+        }
+    }
+
+    CHECK( context->MetadataStore.NeedsSnapshot );
+    CHECK( version > FMM_METADATA_MAX_LOG_BYTES / (model.Keys * MAX_RECORD_LENGTH) );
+
+    CHECK( NT_SUCCESS( FmmReacquireMetadataFileReferences( &cbd )));
+    CHECK( FlagOn( context->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED ));
+    CHECK( MatchesModel( context, &model ));
+
+    HostCloseFile( volumeFileObject );
+
+    Detach( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    free( model.Versions );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  The records FmmUpdateFileMetadata keeps for a file as it is created and
+//  overwritten, and FmmDeleteFileMetadata removes once it is gone.
+//
+
+static void
+TestFileMetadata (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    FLT_RELATED_OBJECTS fltObjects;
+    FLT_CALLBACK_DATA cbd;
+    FMM_FILE_METADATA fileMetadata;
+    LARGE_INTEGER before;
+    ULONG returned;
+
+    HostFormatVolume();
+
+    context = Attach( TRUE, FALSE, NULL );
+
+    RtlZeroMemory( &fltObjects, sizeof( fltObjects ));
+    RtlZeroMemory( &cbd, sizeof( cbd ));
+    fltObjects.Instance = HostInstance;
+    fltObjects.FileObject = HostOpenFile( 0x77 );
+
+    KeQuerySystemTime( &before );
+
+    cbd.IoStatus.Information = FILE_CREATED;
+    CHECK( NT_SUCCESS( FmmUpdateFileMetadata( &cbd, &fltObjects )));
+    CHECK( NT_SUCCESS( FmmQueryMetadata( context, 0x77, &fileMetadata, sizeof( fileMetadata ), &returned )));
+    CHECK( returned == sizeof( fileMetadata ));
+    CHECK( fileMetadata.OverwriteCount == 0 );
+    CHECK( fileMetadata.CreationTime.QuadPart >= before.QuadPart );
+    CHECK( fileMetadata.CreatorProcessId == FltGetRequestorProcessId( &cbd ));
+
+    cbd.IoStatus.Information = FILE_OVERWRITTEN;
+    CHECK( NT_SUCCESS( FmmUpdateFileMetadata( &cbd, &fltObjects )));
+    cbd.IoStatus.Information = FILE_SUPERSEDED;
+    CHECK( NT_SUCCESS( FmmUpdateFileMetadata( &cbd, &fltObjects )));
+    CHECK( NT_SUCCESS( FmmQueryMetadata( context, 0x77, &fileMetadata, sizeof( fileMetadata ), &returned )));
+    CHECK( fileMetadata.OverwriteCount == 2 );
+
+    Detach( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( NT_SUCCESS( FmmQueryMetadata( context, 0x77, &fileMetadata, sizeof( fileMetadata ), &returned )));
+    CHECK( fileMetadata.OverwriteCount == 2 );
+
+    CHECK( FmmDeleteFileMetadata( &fltObjects, 0x77 ) == STATUS_SUCCESS );
+    CHECK( FmmDeleteFileMetadata( &fltObjects, 0x77 ) == STATUS_NOT_FOUND );
+
+    HostCloseFile( fltObjects.FileObject );
+
+    Detach( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( context->MetadataStore.Table.NumberGenericTableElements == 0 );
+
+    Detach( context );
+
+    CHECK( NothingLeft() );
+}
+
+//
+//  The flush thread writes and checkpoints the log by itself, so that a
+//  crash after it has run keeps the updates.
+//
+
+static BOOLEAN
+WaitForFlush (
+    LONGLONG Flushes,
+    double Seconds
+    )
+{
+    HOST_COUNTERS counters;
+    struct timespec delay = { 0, 10 * 1000 * 1000 };
+    double deadline = Now() + Seconds;
+
+    do {
+        HostGetCounters( &counters );
+
+        if (counters.Flushes > Flushes) {
+            return TRUE;
+        }
+
+        nanosleep( &delay, NULL );
+
+    } while (Now() < deadline);
+
+    return FALSE;
+}
+
+static void
+TestFlushThread (
+    void
+    )
+{
+    PFMM_INSTANCE_CONTEXT context;
+    HOST_COUNTERS counters;
+    BOOLEAN pending;
+    MODEL model;
+    ULONG key;
+
+    HostFormatVolume();
+    InitializeModel( &model, 10000 );
+
+    context = Attach( TRUE, TRUE, NULL );
+
+    //
+    //  A few updates are written within the flush interval; enough to pass
+    //  the flush threshold wake the thread early.
+    //
+
+    for (key = 0; key < 100; key++) {
+        SetModelRecord( context, &model, key, 1 );
+    }
+
+    HostGetCounters( &counters );
+    CHECK( WaitForFlush( counters.Flushes, 10 ));
+
+    for (key = 0; key < model.Keys; key++) {
+        SetModelRecord( context, &model, key, 3 );
+    }
+
+    HostGetCounters( &counters );
+    CHECK( WaitForFlush( counters.Flushes, 10 ));
+
+    //
+    //  The checkpoint is written after the log it covers, so wait until
+    //  nothing is pending and the last flush has finished.
+    //
+
+    do {
+        FmmAcquireResourceExclusive( &context->MetadataStore.FileResource );
+        FmmAcquireResourceShared( &context->MetadataStore.Resource );
+        pending = (BOOLEAN)(context->MetadataStore.LogBytes != 0);
+        FmmReleaseResource( &context->MetadataStore.Resource );
+        FmmReleaseResource( &context->MetadataStore.FileResource );
+
+        if (pending) {
+            HostGetCounters( &counters );
+            CHECK( WaitForFlush( counters.Flushes, 10 ));
+        }
+
+    } while (pending && (failures == 0));
+
+    Crash( context );
+    context = Attach( FALSE, TRUE, NULL );
+
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    free( model.Versions );
+
+    CHECK( NothingLeft() );
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    TestFirstAttach();
+    TestReplay();
+    TestCrash();
+    TestDamage();
+    TestCompaction();
+    TestWriteFailure();
+    TestVolumeLock();
+    TestFileMetadata();
+    TestFlushThread();
+
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
+
+//
+//  The timed run.  Each thread owns the keys congruent to its index, so it
+//  knows which version of each it left.
+//
+
+typedef struct _WORKER {
+    pthread_t Thread;
+    PFMM_INSTANCE_CONTEXT Context;
+    ULONG Index;
+    ULONG Threads;
+    ULONG ReadPercent;
+    PMODEL Model;
+    volatile int *Stop;
+    uint64_t Queries;
+    uint64_t Updates;
+    uint64_t Mismatches;
+} WORKER, *PWORKER;
+
+static void *
+WorkerThread (
+    void *Parameter
+    )
+{
+    PWORKER worker = Parameter;
+    uint64_t random = 0x9e3779b97f4a7c15ULL * (worker->Index + 1);
+    ULONG slots = worker->Model->Keys / worker->Threads;
+    ULONG key;
+    ULONG version;
+
+    while (!__atomic_load_n( worker->Stop, __ATOMIC_RELAXED )) {
+
+        key = (ULONG)(Random64( &random ) % slots) * worker->Threads + worker->Index;
+
+        if ((Random64( &random ) % 100) < worker->ReadPercent) {
+
+            if (!HasRecord( worker->Context, key, worker->Model->Versions[key] )) {
+                worker->Mismatches += 1;
+            }
+
+            worker->Queries += 1;
+
+        } else {
+
+            version = ((Random64( &random ) % 10) == 0) ? 0 : worker->Model->Versions[key] + 1;
+
+            if (version == 0) {
+                (VOID) FmmDeleteMetadata( worker->Context, key );
+            } else if (!NT_SUCCESS( SetRecord( worker->Context, key, version ))) {
+                worker->Mismatches += 1;
+            }
+
+            worker->Model->Versions[key] = version;
+            worker->Updates += 1;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+Run (
+    ULONG Threads,
+    double Seconds,
+    ULONG Keys,
+    ULONG ReadPercent
+    )
+{
+    WORKER workers[MAX_THREADS];
+    PFMM_INSTANCE_CONTEXT context;
+    HOST_COUNTERS before;
+    HOST_COUNTERS after;
+    volatile int stop = 0;
+    uint64_t queries = 0;
+    uint64_t updates = 0;
+    uint64_t mismatches = 0;
+    struct timespec delay;
+    double start;
+    double elapsed;
+    MODEL model;
+    ULONG i;
+
+    HostFormatVolume();
+    InitializeModel( &model, Keys - Keys % Threads );
+
+    //
+    //  The metadata file is new, so nothing is logged until the flush
+    //  thread has written the first snapshot, a flush interval in.
+    //
+
+    context = Attach( TRUE, TRUE, NULL );
+    HostGetCounters( &before );
+
+    start = Now();
+
+    for (i = 0; i < Threads; i++) {
+        RtlZeroMemory( &workers[i], sizeof( WORKER ));
+        workers[i].Context = context;
+        workers[i].Index = i;
+        workers[i].Threads = Threads;
+        workers[i].ReadPercent = ReadPercent;
+        workers[i].Model = &model;
+        workers[i].Stop = &stop;
+        pthread_create( &workers[i].Thread, NULL, WorkerThread, &workers[i] );
+    }
+
+    delay.tv_sec = (time_t)Seconds;
+    delay.tv_nsec = (long)((Seconds - (double)delay.tv_sec) * 1e9);
+    nanosleep( &delay, NULL );
+
+    __atomic_store_n( &stop, 1, __ATOMIC_RELAXED );
+
+    for (i = 0; i < Threads; i++) {
+        pthread_join( workers[i].Thread, NULL );
+        queries += workers[i].Queries;
+        updates += workers[i].Updates;
+        mismatches += workers[i].Mismatches;
+    }
+
+    elapsed = Now() - start;
+    HostGetCounters( &after );
+
+    printf( "%u thread(s), %u keys, %u%% queries: %.0f queries/s, %.0f updates/s\n",
+            Threads, model.Keys, ReadPercent, (double)queries / elapsed, (double)updates / elapsed );
+    printf( "  %lld flushes, %lld writes of %.1f KB on average, metadata file %.1f MB\n",
+            (long long)(after.Flushes - before.Flushes),
+            (long long)(after.Writes - before.Writes),
+            (after.Writes > before.Writes) ?
+                (double)(after.BytesWritten - before.BytesWritten) / (double)(after.Writes - before.Writes) / 1024 : 0,
+            (double)HostMetadataFileSize() / (1024 * 1024) );
+
+    Detach( context );
+    context = Attach( FALSE, FALSE, NULL );
+
+    CHECK( mismatches == 0 );
+    CHECK( MatchesModel( context, &model ));
+
+    Detach( context );
+    free( model.Versions );
+
+    CHECK( NothingLeft() );
+
+    if (failures != 0) {
+        fprintf( stderr, "the store lost or changed records\n" );
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    ULONG threadCounts[MAX_THREADS];
+    ULONG runs = 0;
+    double seconds = 2;
+    ULONG keys = 20000;
+    ULONG readPercent = 90;
+    int status = 0;
+    ULONG r;
+    int i;
+
+    Globals.Filter = HostFilter;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--seconds" ) == 0) && (i + 1 < argc)) {
+            seconds = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--keys" ) == 0) && (i + 1 < argc)) {
+            keys = (ULONG)atoi( argv[++i] );
+        } else if ((strcmp( argv[i], "--reads" ) == 0) && (i + 1 < argc)) {
+            readPercent = (ULONG)atoi( argv[++i] );
+        } else if ((atoi( argv[i] ) > 0) && (atoi( argv[i] ) <= MAX_THREADS) && (runs < MAX_THREADS)) {
+            threadCounts[runs++] = (ULONG)atoi( argv[i] );
+        } else {
+            fprintf( stderr,
+                     "usage: mdstore --selftest\n"
+                     "       mdstore [--seconds s] [--keys n] [--reads pct] [threads...]\n" );
+            return 2;
+        }
+    }
+
+    if (runs == 0) {
+        threadCounts[runs++] = 1;
+        threadCounts[runs++] = 4;
+    }
+
+    if ((seconds <= 0) || (keys < MAX_THREADS) || (readPercent > 100)) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    for (r = 0; r < runs; r++) {
+        status |= Run( threadCounts[r], seconds, keys, readPercent );
+    }
+
+    return status;
+}
@@ -158,6 +158,16 @@ FmmPreCreate (
 
 #endif
 
+    //
+    //  Opens that may create, overwrite or supersede the file update its
+    //  metadata record in the post-op
+    //
+
+    if (((Cbd->Iopb->Parameters.Create.Options >> 24) & 0xFF) != FILE_OPEN) {
+
+        callbackStatus = FLT_PREOP_SUCCESS_WITH_CALLBACK;
+    }
+
 
     //
     //  Here the filter can do any further processing it may want to do
@@ -336,6 +346,25 @@ FmmPostCreate (
 
 #endif
 
+    //
+    //  Keep the record of files that were created, overwritten or superseded
+    //  up to date. This only takes the metadata store resource, so opens do
+    //  not wait on each other or on the metadata file.
+    //
+    //  Only STATUS_SUCCESS will do: a create that returns STATUS_REPARSE
+    //  has IO_REPARSE in its information, which has the same value as
+    //  FILE_SUPERSEDED, and opened nothing.
+    //
+
+    if (!FlagOn( Flags, FLTFL_POST_OPERATION_DRAINING ) &&
+        (Cbd->IoStatus.Status == STATUS_SUCCESS) &&
+        ((Cbd->IoStatus.Information == FILE_CREATED) ||
+         (Cbd->IoStatus.Information == FILE_OVERWRITTEN) ||
+         (Cbd->IoStatus.Information == FILE_SUPERSEDED))) {
+
+        status = FmmUpdateFileMetadata( Cbd, FltObjects );
+    }
+
     //
     //  Here the filter can do any further processing it may want to do
     //  in the PostCreate Callback
@@ -373,9 +402,10 @@ FmmPreCleanup (
     _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
     )
 {
+    FLT_PREOP_CALLBACK_STATUS callbackStatus;
+    PULONGLONG fileId;
 
     UNREFERENCED_PARAMETER( Cbd );
-    UNREFERENCED_PARAMETER( CompletionContext );
     UNREFERENCED_PARAMETER( FltObjects );
 
     PAGED_CODE();
@@ -385,13 +415,52 @@ FmmPreCleanup (
                  Cbd,
                  FltObjects->FileObject) );
 
+    *CompletionContext = NULL;
+    callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    if (FmmTargetIsVolumeOpen( Cbd )) {
+
+        //
+        //  A volume cleanup may be an unlock, which the post-op checks for
+        //
+
+        callbackStatus = FLT_PREOP_SYNCHRONIZE;
+
+    } else if (FltObjects->FileObject->DeletePending ||
+               FlagOn( FltObjects->FileObject->Flags, FO_DELETE_ON_CLOSE )) {
+
+        //
+        //  A file that may go away with this cleanup has its record deleted
+        //  in the post-op, once the file system says the file is gone. Its
+        //  file id can no longer be queried by then, so get it now and pass
+        //  it on.
+        //
+
+        fileId = ExAllocatePoolWithTag( PagedPool,
+                                        sizeof( ULONGLONG ),
+                                        FMM_FILE_ID_TAG );
+
+        if (fileId != NULL) {
+
+            if (NT_SUCCESS( FmmGetFileId( FltObjects, fileId ) )) {
+
+                *CompletionContext = fileId;
+                callbackStatus = FLT_PREOP_SYNCHRONIZE;
+
+            } else {
+
+                ExFreePoolWithTag( fileId, FMM_FILE_ID_TAG );
+            }
+        }
+    }
+
 
     DebugTrace( DEBUG_TRACE_ALL_IO,
                 ("[Fmm]: FmmPreCleanup -> Exit (Cbd = %p, FileObject = %p)\n",
                  Cbd,
                  FltObjects->FileObject) );
 
-    return FLT_PREOP_SYNCHRONIZE;
+    return callbackStatus;
 }
 
 
@@ -403,11 +472,12 @@ FmmPostCleanup (
     _In_ FLT_POST_OPERATION_FLAGS Flags
     )
 {
+    FILE_STANDARD_INFORMATION standardInformation;
+    PULONGLONG fileId = CompletionContext;
     NTSTATUS status;
 
 
     UNREFERENCED_PARAMETER( FltObjects );
-    UNREFERENCED_PARAMETER( CompletionContext );
     UNREFERENCED_PARAMETER( Flags );
 
     //
@@ -500,6 +570,37 @@ FmmPostCleanup (
         goto FmmPostCleanupCleanup;
     }
 
+    //
+    //  Forget a file that went away with this cleanup. The file system
+    //  fails queries on a deleted file with STATUS_FILE_DELETED. If the
+    //  query succeeds the file is still there, either because other handles
+    //  keep it open or because the delete was undone, and so is its record.
+    //  A missing record is not an error.
+    //
+
+    if (fileId != NULL) {
+
+        if (!FlagOn( Flags, FLTFL_POST_OPERATION_DRAINING ) &&
+            NT_SUCCESS( Cbd->IoStatus.Status )) {
+
+            status = FltQueryInformationFile( FltObjects->Instance,
+                                              FltObjects->FileObject,
+                                              &standardInformation,
+                                              sizeof( standardInformation ),
+                                              FileStandardInformation,
+                                              NULL );
+
+            if (status == STATUS_FILE_DELETED) {
+
+                (VOID) FmmDeleteFileMetadata( FltObjects, *fileId );
+            }
+
+            status = STATUS_SUCCESS;
+        }
+
+        ExFreePoolWithTag( fileId, FMM_FILE_ID_TAG );
+    }
+
 
     //
     //  Here the filter can do any further processing it may want to do
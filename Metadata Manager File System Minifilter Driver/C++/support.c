@@ -32,6 +32,7 @@ Environment:
 #pragma alloc_text(PAGE, FmmFreeUnicodeString)
 #pragma alloc_text(PAGE, FmmTargetIsVolumeOpen)
 #pragma alloc_text(PAGE, FmmIsImplicitVolumeLock)
+#pragma alloc_text(PAGE, FmmGetFileId)
 #endif
 
 //
@@ -242,3 +243,48 @@ FmmIsImplicitVolumeLockCleanup:
     return status;
 }
 
+
+NTSTATUS
+FmmGetFileId (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_ PULONGLONG FileId
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the file id of the target file, which is the key of
+    its record in the metadata store.
+
+Arguments:
+
+    FltObjects          - Supplies the instance and file object of the
+                          target file.
+    FileId              - Returns the file id.
+
+Return Value:
+
+    Status
+
+--*/
+{
+    FILE_INTERNAL_INFORMATION internalInformation;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    status = FltQueryInformationFile( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      &internalInformation,
+                                      sizeof( internalInformation ),
+                                      FileInternalInformation,
+                                      NULL );
+
+    if (NT_SUCCESS( status )) {
+
+        *FileId = (ULONGLONG) internalInformation.IndexNumber.QuadPart;
+    }
+
+    return status;
+}
+
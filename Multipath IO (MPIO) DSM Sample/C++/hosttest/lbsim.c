@@ -0,0 +1,581 @@
+/*++
+
+Copyright (C) Microsoft Corporation, 2026
+
+Module Name:
+
+    lbsim.c
+
+Abstract:
+
+    Simulator of the DSM load balance policies over N paths with injected
+    latency skew.
+
+    A closed loop of outstanding requests is spread over the paths of one
+    multipath group by:
+
+        rr      - round robin over the active/optimized paths
+        lqd     - least queue depth
+        lst     - least service time: (requests in flight + 1) x EWMA of
+                  the service time, as DsmpGetPath/DsmpUpdateServiceTime do
+
+    Each path is modelled as a target port with a fixed number of command
+    slots and exponentially distributed service times around the path's
+    mean, which can be skewed per path and changed part way through a run
+    to model a path that degrades. Paths may also be active/unoptimized,
+    in which case no policy may use them while an A/O path is available.
+
+Environment:
+
+    Host (user mode), C99.
+
+--*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DSM_SERVICE_TIME_EWMA_SHIFT 3
+
+#define MAX_PATHS                   32
+#define PATH_SLOTS                  4
+
+typedef enum _POLICY {
+    PolicyRoundRobin,
+    PolicyLeastQueueDepth,
+    PolicyLeastServiceTime,
+    PolicyCount
+} POLICY;
+
+static const char *PolicyNames[PolicyCount] = { "rr", "lqd", "lst" };
+
+typedef struct _PATH {
+    int Optimized;
+    double MeanUs;              // mean service time before DegradeAt
+    double DegradedMeanUs;      // mean service time from DegradeAt on
+
+    //
+    // DSM state
+    //
+    long RequestsInFlight;
+    long long ServiceTimeAverage;
+
+    //
+    // Target port model
+    //
+    int Busy;
+    int *Waiting;               // FIFO of requests waiting for a slot
+    int WaitHead;
+    int WaitCount;
+
+    uint64_t Completed;
+    uint64_t CompletedLate;     // completed at or after DegradeAt
+} PATH;
+
+typedef struct _REQUEST {
+    int Path;
+    long long Dispatched;       // ns, DSM dispatch time
+} REQUEST;
+
+typedef struct _EVENT {
+    long long Time;
+    int Request;
+} EVENT;
+
+typedef struct _CONFIG {
+    int PathCount;
+    int Outstanding;
+    long long DurationNs;
+    long long DegradeAtNs;
+    PATH Paths[MAX_PATHS];
+} CONFIG;
+
+typedef struct _RESULT {
+    double Iops;
+    double MeanUs;
+    double P99Us;
+    uint64_t Completed[MAX_PATHS];
+    uint64_t CompletedLate[MAX_PATHS];
+} RESULT;
+
+static uint64_t RandomState;
+
+static double
+RandomExp(double Mean)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return -log(1.0 - (double)(RandomState >> 11) / 9007199254740992.0) * Mean;
+}
+
+/*
+ * Completion event heap
+ */
+
+static EVENT *Heap;
+static int HeapCount;
+
+static void
+HeapPush(long long Time, int Request)
+{
+    int i = HeapCount++;
+
+    while (i > 0 && Heap[(i - 1) / 2].Time > Time) {
+        Heap[i] = Heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    Heap[i].Time = Time;
+    Heap[i].Request = Request;
+}
+
+static EVENT
+HeapPop(void)
+{
+    EVENT top = Heap[0];
+    EVENT last = Heap[--HeapCount];
+    int i = 0;
+
+    for (;;) {
+        int child = 2 * i + 1;
+
+        if (child >= HeapCount) {
+            break;
+        }
+        if (child + 1 < HeapCount && Heap[child + 1].Time < Heap[child].Time) {
+            child++;
+        }
+        if (Heap[child].Time >= last.Time) {
+            break;
+        }
+        Heap[i] = Heap[child];
+        i = child;
+    }
+    Heap[i] = last;
+    return top;
+}
+
+/*
+ * Path selection, mirroring DsmpGetPath
+ */
+
+static int
+SelectPath(CONFIG *Config, POLICY Policy, int *RoundRobinNext)
+{
+    unsigned long long leastServiceTime = ~0ull;
+    long leastQueueDepth = 0x7FFFFFFF;
+    int selected = -1;
+    int i;
+
+    switch (Policy) {
+
+        case PolicyRoundRobin:
+            for (i = 0; i < Config->PathCount; i++) {
+                int candidate = (*RoundRobinNext + i) % Config->PathCount;
+
+                if (Config->Paths[candidate].Optimized) {
+                    *RoundRobinNext = candidate + 1;
+                    return candidate;
+                }
+            }
+            break;
+
+        case PolicyLeastQueueDepth:
+            for (i = 0; i < Config->PathCount; i++) {
+                if (Config->Paths[i].Optimized && Config->Paths[i].RequestsInFlight < leastQueueDepth) {
+                    leastQueueDepth = Config->Paths[i].RequestsInFlight;
+                    selected = i;
+                }
+            }
+            break;
+
+        case PolicyLeastServiceTime:
+            for (i = 0; i < Config->PathCount; i++) {
+                PATH *path = &Config->Paths[i];
+                unsigned long long serviceTime;
+
+                if (!path->Optimized) {
+                    continue;
+                }
+
+                serviceTime = (unsigned long long)(path->RequestsInFlight + 1) *
+                              (unsigned long long)path->ServiceTimeAverage;
+
+                if (serviceTime < leastServiceTime) {
+                    leastServiceTime = serviceTime;
+                    selected = i;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return selected;
+}
+
+static void
+UpdateServiceTime(PATH *Path, long long ServiceTime)
+{
+    long long average = Path->ServiceTimeAverage;
+
+    if (average == 0) {
+        average = ServiceTime;
+    } else {
+        average += (ServiceTime - average) >> DSM_SERVICE_TIME_EWMA_SHIFT;
+    }
+
+    Path->ServiceTimeAverage = average > 1 ? average : 1;
+}
+
+/*
+ * Target port model
+ */
+
+static void
+PathStart(CONFIG *Config, PATH *Path, int Request, long long Now)
+{
+    double mean = (Now >= Config->DegradeAtNs) ? Path->DegradedMeanUs : Path->MeanUs;
+
+    Path->Busy++;
+    HeapPush(Now + (long long)(RandomExp(mean) * 1000.0) + 1, Request);
+}
+
+static void
+Dispatch(CONFIG *Config, REQUEST *Requests, int Request, POLICY Policy, int *RoundRobinNext, long long Now)
+{
+    int pathIndex = SelectPath(Config, Policy, RoundRobinNext);
+    PATH *path;
+
+    if (pathIndex < 0) {
+        fprintf(stderr, "no A/O path\n");
+        exit(2);
+    }
+
+    path = &Config->Paths[pathIndex];
+    path->RequestsInFlight++;
+    Requests[Request].Path = pathIndex;
+    Requests[Request].Dispatched = Now;
+
+    if (path->Busy < PATH_SLOTS) {
+        PathStart(Config, path, Request, Now);
+    } else {
+        path->Waiting[(path->WaitHead + path->WaitCount++) % Config->Outstanding] = Request;
+    }
+}
+
+static int
+CompareDouble(const void *A, const void *B)
+{
+    double a = *(const double *)A;
+    double b = *(const double *)B;
+
+    return (a > b) - (a < b);
+}
+
+static void
+Simulate(const CONFIG *Template, POLICY Policy, uint64_t Seed, RESULT *Result)
+{
+    CONFIG config = *Template;
+    REQUEST *requests = calloc(config.Outstanding, sizeof(REQUEST));
+    size_t latencyCapacity = 1 << 20;
+    double *latencies = malloc(sizeof(double) * latencyCapacity);
+    size_t latencyCount = 0;
+    double latencySum = 0;
+    int roundRobinNext = 0;
+    long long now = 0;
+    int i;
+
+    RandomState = Seed ? Seed : 1;
+    Heap = malloc(sizeof(EVENT) * config.Outstanding);
+    HeapCount = 0;
+
+    for (i = 0; i < config.PathCount; i++) {
+        config.Paths[i].Waiting = malloc(sizeof(int) * config.Outstanding);
+    }
+
+    for (i = 0; i < config.Outstanding; i++) {
+        Dispatch(&config, requests, i, Policy, &roundRobinNext, 0);
+    }
+
+    while (HeapCount > 0) {
+        EVENT event = HeapPop();
+        REQUEST *request = &requests[event.Request];
+        PATH *path = &config.Paths[request->Path];
+        long long serviceTime;
+
+        now = event.Time;
+        if (now >= config.DurationNs) {
+            break;
+        }
+
+        //
+        // DsmpRequestComplete
+        //
+        serviceTime = now - request->Dispatched;
+        path->RequestsInFlight--;
+        UpdateServiceTime(path, serviceTime);
+        path->Completed++;
+        if (now >= config.DegradeAtNs) {
+            path->CompletedLate++;
+        }
+
+        if (latencyCount == latencyCapacity) {
+            latencyCapacity *= 2;
+            latencies = realloc(latencies, sizeof(double) * latencyCapacity);
+        }
+        latencies[latencyCount++] = (double)serviceTime / 1000.0;
+        latencySum += (double)serviceTime / 1000.0;
+
+        path->Busy--;
+        if (path->WaitCount > 0) {
+            int next = path->Waiting[path->WaitHead];
+
+            path->WaitHead = (path->WaitHead + 1) % config.Outstanding;
+            path->WaitCount--;
+            PathStart(&config, path, next, now);
+        }
+
+        //
+        // Closed loop: the completed request is immediately replaced.
+        //
+        Dispatch(&config, requests, event.Request, Policy, &roundRobinNext, now);
+    }
+
+    memset(Result, 0, sizeof(*Result));
+    Result->Iops = (double)latencyCount / ((double)config.DurationNs / 1e9);
+    if (latencyCount) {
+        qsort(latencies, latencyCount, sizeof(double), CompareDouble);
+        Result->MeanUs = latencySum / (double)latencyCount;
+        Result->P99Us = latencies[(latencyCount * 99) / 100];
+    }
+    for (i = 0; i < config.PathCount; i++) {
+        Result->Completed[i] = config.Paths[i].Completed;
+        Result->CompletedLate[i] = config.Paths[i].CompletedLate;
+        free(config.Paths[i].Waiting);
+    }
+
+    free(Heap);
+    free(latencies);
+    free(requests);
+}
+
+static void
+InitConfig(CONFIG *Config, int PathCount, int Outstanding, double MeanUs)
+{
+    int i;
+
+    memset(Config, 0, sizeof(*Config));
+    Config->PathCount = PathCount;
+    Config->Outstanding = Outstanding;
+    Config->DurationNs = 2000000000ll;
+    Config->DegradeAtNs = Config->DurationNs;
+
+    for (i = 0; i < PathCount; i++) {
+        Config->Paths[i].Optimized = 1;
+        Config->Paths[i].MeanUs = MeanUs;
+        Config->Paths[i].DegradedMeanUs = MeanUs;
+    }
+}
+
+static void
+PrintRun(const char *Title, const CONFIG *Config)
+{
+    RESULT result;
+    int policy;
+    int i;
+
+    printf("%s\n", Title);
+    printf("  %-4s %10s %10s %10s  %s\n", "lb", "IOPS", "mean us", "p99 us", "share per path (%)");
+
+    for (policy = 0; policy < PolicyCount; policy++) {
+        uint64_t total = 0;
+
+        Simulate(Config, (POLICY)policy, 1, &result);
+
+        for (i = 0; i < Config->PathCount; i++) {
+            total += result.Completed[i];
+        }
+
+        printf("  %-4s %10.0f %10.1f %10.1f ", PolicyNames[policy], result.Iops, result.MeanUs, result.P99Us);
+        for (i = 0; i < Config->PathCount; i++) {
+            printf(" %5.1f", total ? 100.0 * (double)result.Completed[i] / (double)total : 0.0);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Self test over the standard scenarios.
+ */
+#define CHECK(c) \
+    do { if (!(c)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); failures++; } } while (0)
+
+static int
+SelfTest(void)
+{
+    RESULT results[PolicyCount];
+    CONFIG config;
+    int failures = 0;
+    int policy;
+
+    //
+    // Symmetric paths: LST must not cost throughput.
+    //
+    InitConfig(&config, 4, 32, 200.0);
+    for (policy = 0; policy < PolicyCount; policy++) {
+        Simulate(&config, (POLICY)policy, 1, &results[policy]);
+    }
+    CHECK(results[PolicyLeastServiceTime].Iops > 0.95 * results[PolicyRoundRobin].Iops);
+
+    //
+    // One path 4x slower than the others. With deep queues, queue depth
+    // already reflects path speed, so LST must match least queue depth on
+    // throughput and do better on the tail.
+    //
+    config.Paths[0].MeanUs = config.Paths[0].DegradedMeanUs = 800.0;
+    for (policy = 0; policy < PolicyCount; policy++) {
+        Simulate(&config, (POLICY)policy, 1, &results[policy]);
+    }
+    CHECK(results[PolicyLeastServiceTime].Iops > results[PolicyRoundRobin].Iops);
+    CHECK(results[PolicyLeastServiceTime].Iops > 0.98 * results[PolicyLeastQueueDepth].Iops);
+    CHECK(results[PolicyLeastServiceTime].P99Us < results[PolicyLeastQueueDepth].P99Us);
+    CHECK(results[PolicyLeastServiceTime].Completed[0] < results[PolicyLeastServiceTime].Completed[1]);
+
+    //
+    // With shallow queues, least queue depth sees ties and keeps using the
+    // slow path; LST must beat both other policies outright.
+    //
+    config.Outstanding = 4;
+    for (policy = 0; policy < PolicyCount; policy++) {
+        Simulate(&config, (POLICY)policy, 1, &results[policy]);
+    }
+    CHECK(results[PolicyLeastServiceTime].Iops > 1.1 * results[PolicyLeastQueueDepth].Iops);
+    CHECK(results[PolicyLeastServiceTime].Iops > 1.1 * results[PolicyRoundRobin].Iops);
+    CHECK(results[PolicyLeastServiceTime].MeanUs < results[PolicyLeastQueueDepth].MeanUs);
+
+    //
+    // A path that degrades 10x half way through must lose most of its share.
+    //
+    InitConfig(&config, 4, 32, 200.0);
+    config.DegradeAtNs = config.DurationNs / 2;
+    config.Paths[0].DegradedMeanUs = 2000.0;
+    Simulate(&config, PolicyLeastServiceTime, 1, &results[PolicyLeastServiceTime]);
+    CHECK(results[PolicyLeastServiceTime].CompletedLate[0] * 10 < results[PolicyLeastServiceTime].CompletedLate[1]);
+
+    //
+    // A/U paths must never be used while an A/O path is available, even if
+    // they are faster.
+    //
+    InitConfig(&config, 4, 32, 200.0);
+    config.Paths[3].Optimized = 0;
+    config.Paths[3].MeanUs = config.Paths[3].DegradedMeanUs = 20.0;
+    for (policy = 0; policy < PolicyCount; policy++) {
+        Simulate(&config, (POLICY)policy, 1, &results[policy]);
+        CHECK(results[policy].Completed[3] == 0);
+    }
+
+    printf("lbsim self test: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr,
+            "usage: lbsim --selftest\n"
+            "       lbsim [--paths N] [--outstanding N] [--mean us] [--skew path:us]...\n"
+            "             [--degrade path:us] [--unoptimized path]...\n");
+}
+
+static int
+ParsePathValue(const char *Arg, int PathCount, int *Path, double *Value)
+{
+    char *end;
+
+    *Path = (int)strtol(Arg, &end, 0);
+    if (*end != ':' || *Path < 0 || *Path >= PathCount) {
+        return 0;
+    }
+    *Value = strtod(end + 1, &end);
+    return *end == '\0' && *Value > 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    CONFIG config;
+    int pathCount = 4;
+    int outstanding = 32;
+    double mean = 200.0;
+    int path;
+    double value;
+    int i;
+
+    if (argc == 2 && strcmp(argv[1], "--selftest") == 0) {
+        return SelfTest();
+    }
+
+    //
+    // First pass for the group shape, second pass for the per path settings.
+    //
+    for (i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--paths") == 0) {
+            pathCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--outstanding") == 0) {
+            outstanding = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mean") == 0) {
+            mean = atof(argv[++i]);
+        } else {
+            i++;
+        }
+    }
+
+    if (pathCount < 1 || pathCount > MAX_PATHS || outstanding < 1 || mean <= 0) {
+        Usage();
+        return 2;
+    }
+
+    InitConfig(&config, pathCount, outstanding, mean);
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            Usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--skew") == 0) {
+            if (!ParsePathValue(argv[++i], pathCount, &path, &value)) {
+                Usage();
+                return 2;
+            }
+            config.Paths[path].MeanUs = config.Paths[path].DegradedMeanUs = value;
+        } else if (strcmp(argv[i], "--degrade") == 0) {
+            if (!ParsePathValue(argv[++i], pathCount, &path, &value)) {
+                Usage();
+                return 2;
+            }
+            config.Paths[path].DegradedMeanUs = value;
+            config.DegradeAtNs = config.DurationNs / 2;
+        } else if (strcmp(argv[i], "--unoptimized") == 0) {
+            path = atoi(argv[++i]);
+            if (path < 0 || path >= pathCount) {
+                Usage();
+                return 2;
+            }
+            config.Paths[path].Optimized = 0;
+        } else if (strcmp(argv[i], "--paths") == 0 ||
+                   strcmp(argv[i], "--outstanding") == 0 ||
+                   strcmp(argv[i], "--mean") == 0) {
+            i++;
+        } else {
+            Usage();
+            return 2;
+        }
+    }
+
+    PrintRun("simulated 2s run", &config);
+    return 0;
+}
@@ -2535,6 +2535,11 @@ Return Value:
         }
     }
 
+    //
+    // Make sure path selection no longer considers this devInfo.
+    //
+    DsmpRebuildPathSnapshot(Group);
+
     //
     // Remove this devInfo from the TargetPort deviceList
     //
@@ -3077,7 +3082,8 @@ Routine Description:
     This routine will update the target port group and all its appropriate
     devInfos (ones not in remove pending, removed, or invalidated) with the
     new state. The ALUAState will only be updated, NOT the real State.
-    Caller needs to update the real State based on the current LB policy.
+    Caller needs to update the real State based on the current LB policy,
+    and then rebuild the path snapshot of the affected groups.
 
     Note: This should be called with DsmContext Lock held and should only be
     called after a SetTargetPortGroups request was sent down.
@@ -3183,6 +3189,7 @@ DsmpIncrementCounters(
     ULONGLONG lastLba = 0;
     ULONG numBlocks = 0;
     ULONGLONG startLba = 0;
+    PDSM_PATH_COUNTER counter;
 
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_GENERAL,
@@ -3199,7 +3206,9 @@ DsmpIncrementCounters(
         }
     }
 
-    InterlockedIncrement(&FailGroup->NumberOfRequestsInFlight);
+    counter = DsmpGetCounterStripe(FailGroup);
+
+    InterlockedIncrement(&counter->NumberOfRequestsInFlight);
 
     //
     // Update counters that apply to read/write requests
@@ -3208,7 +3217,7 @@ DsmpIncrementCounters(
 
         bytes = SrbGetDataTransferLength(Srb);
 
-        InterlockedExchangeAdd64((LONGLONG volatile*)&FailGroup->OutstandingBytesOfIO, bytes);
+        InterlockedExchangeAdd64(&counter->OutstandingBytesOfIO, bytes);
 
         cdbLength = SrbGetCdbLength(Srb);
 
@@ -3247,6 +3256,7 @@ DsmpDecrementCounters(
     PCDB cdb = NULL;
     BOOLEAN isReadWrite = FALSE;
     BOOLEAN isDeletionEligible = FALSE;
+    PDSM_PATH_COUNTER counter;
 
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_GENERAL,
@@ -3263,6 +3273,8 @@ DsmpDecrementCounters(
         }
     }
 
+    counter = DsmpGetCounterStripe(FailGroup);
+
     //
     // Update counters that apply to read/write requests
     //
@@ -3270,14 +3282,23 @@ DsmpDecrementCounters(
 
         bytes = SrbGetDataTransferLength(Srb);
 
-        InterlockedExchangeAdd64((LONGLONG volatile*)&FailGroup->OutstandingBytesOfIO, -(LONGLONG)bytes);
+        InterlockedExchangeAdd64(&counter->OutstandingBytesOfIO, -(LONGLONG)bytes);
     }
 
-    NT_ASSERT(FailGroup->NumberOfRequestsInFlight > 0);
-    if (InterlockedCompareExchange(&FailGroup->NumberOfRequestsInFlight, 0, 0) > 0) {
+    InterlockedDecrement(&counter->NumberOfRequestsInFlight);
+
+    //
+    // Summing up the stripes is only worth it for a path that is waiting to be
+    // removed. Since more than one completion may find the total at zero, the
+    // one that gets to claim the path is the one that gets to remove it.
+    //
+    if (FailGroup->State == DSM_FG_PENDING_REMOVE) {
+
+        NT_ASSERT(DsmpGetRequestsInFlight(FailGroup) >= 0);
+
+        if (DsmpGetRequestsInFlight(FailGroup) <= 0 &&
+            InterlockedCompareExchange(&FailGroup->RemovalClaimed, 1, 0) == 0) {
 
-        if(InterlockedDecrement(&FailGroup->NumberOfRequestsInFlight) == 0){
-                
             //
             // If the inflight requests on the path is zero, if needed path can be removed.
             //
@@ -3294,6 +3315,546 @@ DsmpDecrementCounters(
 }
 
 
+PDSM_PATH_COUNTER
+DsmpGetCounterStripe(
+    _In_ PDSM_FAILOVER_GROUP FailGroup
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the stripe of the path's in-flight counters that
+    the current processor should update.
+
+Arguments:
+
+    FailGroup - The path whose counters are being updated
+
+Return Value:
+
+    Counter stripe for the current processor
+
+--*/
+{
+    return &FailGroup->Counters[KeGetCurrentProcessorNumberEx(NULL) & (DSM_COUNTER_STRIPES - 1)];
+}
+
+
+LONG
+DsmpGetRequestsInFlight(
+    _In_ PDSM_FAILOVER_GROUP FailGroup
+    )
+/*++
+
+Routine Description:
+
+    This routine sums up the number of requests in flight down the path
+    across all counter stripes. The result is a snapshot and may be
+    slightly stale by the time it is used.
+
+Arguments:
+
+    FailGroup - The path of interest
+
+Return Value:
+
+    Number of requests in flight down the path
+
+--*/
+{
+    LONG requests = 0;
+    ULONG inx;
+
+    for (inx = 0; inx < DSM_COUNTER_STRIPES; inx++) {
+
+        requests += FailGroup->Counters[inx].NumberOfRequestsInFlight;
+    }
+
+    return requests;
+}
+
+
+ULONGLONG
+DsmpGetOutstandingBytes(
+    _In_ PDSM_FAILOVER_GROUP FailGroup
+    )
+/*++
+
+Routine Description:
+
+    This routine sums up the number of bytes of read/write requests in
+    flight down the path across all counter stripes.
+
+Arguments:
+
+    FailGroup - The path of interest
+
+Return Value:
+
+    Outstanding bytes of IO down the path
+
+--*/
+{
+    LONGLONG bytes = 0;
+    ULONG inx;
+
+    for (inx = 0; inx < DSM_COUNTER_STRIPES; inx++) {
+
+        bytes += ReadNoFence64(&FailGroup->Counters[inx].OutstandingBytesOfIO);
+    }
+
+    return (bytes > 0) ? (ULONGLONG)bytes : 0;
+}
+
+
+VOID
+DsmpRebuildPathSnapshot(
+    _In_ PDSM_GROUP_ENTRY Group
+    )
+/*++
+
+Routine Description:
+
+    This routine recomputes the lists of usable active/optimized and
+    active/unoptimized paths of the group used by DsmpGetPath.
+
+    This routine must be called with DSM Context Lock held in Exclusive mode.
+
+Arguments:
+
+    Group - The multi-path group whose path states changed
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDSM_PATH_SNAPSHOT snapshot = &Group->PathSnapshot;
+    PDSM_DEVICE_INFO deviceInfo;
+    ULONG inx;
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_GENERAL,
+                "DsmpRebuildPathSnapshot (Group %p): Entering function.\n",
+                Group));
+
+    //
+    // Make the generation odd so that lock-free readers retry.
+    //
+    InterlockedIncrement(&snapshot->Generation);
+
+    snapshot->OptimizedCount = 0;
+    snapshot->UnoptimizedCount = 0;
+
+    for (inx = 0; inx < DSM_MAX_PATHS; inx++) {
+
+        deviceInfo = Group->DeviceList[inx];
+
+        if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo)) ||
+            !deviceInfo->FailGroup) {
+
+            continue;
+        }
+
+        if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+            snapshot->Optimized[snapshot->OptimizedCount++] = deviceInfo;
+
+        } else if (deviceInfo->State == DSM_DEV_ACTIVE_UNOPTIMIZED) {
+
+            snapshot->Unoptimized[snapshot->UnoptimizedCount++] = deviceInfo;
+        }
+    }
+
+    InterlockedIncrement(&snapshot->Generation);
+
+    TracePrint((TRACE_LEVEL_INFORMATION,
+                TRACE_FLAG_GENERAL,
+                "DsmpRebuildPathSnapshot (Group %p): Generation %d with %u A/O and %u A/U paths.\n",
+                Group,
+                snapshot->Generation,
+                snapshot->OptimizedCount,
+                snapshot->UnoptimizedCount));
+
+    return;
+}
+
+
+VOID
+DsmpCopyPathSnapshot(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _Out_ PDSM_PATH_SNAPSHOT Snapshot
+    )
+/*++
+
+Routine Description:
+
+    This routine takes a consistent copy of the group's path snapshot
+    without relying on the DSM Context Lock.
+
+Arguments:
+
+    Group - The multi-path group
+    Snapshot - Receives the copy
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDSM_PATH_SNAPSHOT snapshot = &Group->PathSnapshot;
+    LONG generation;
+    ULONG optimizedCount;
+    ULONG unoptimizedCount;
+
+    for (;;) {
+
+        generation = ReadAcquire(&snapshot->Generation);
+
+        if (generation & 1) {
+
+            YieldProcessor();
+            continue;
+        }
+
+        optimizedCount = min(snapshot->OptimizedCount, DSM_MAX_PATHS);
+        unoptimizedCount = min(snapshot->UnoptimizedCount, DSM_MAX_PATHS);
+
+        RtlCopyMemory(Snapshot->Optimized, snapshot->Optimized, optimizedCount * sizeof(PDSM_DEVICE_INFO));
+        RtlCopyMemory(Snapshot->Unoptimized, snapshot->Unoptimized, unoptimizedCount * sizeof(PDSM_DEVICE_INFO));
+
+        if (ReadAcquire(&snapshot->Generation) == generation) {
+
+            Snapshot->Generation = generation;
+            Snapshot->OptimizedCount = optimizedCount;
+            Snapshot->UnoptimizedCount = unoptimizedCount;
+            break;
+        }
+    }
+
+    return;
+}
+
+
+VOID
+DsmpGetUsablePaths(
+    _In_ PDSM_IDS DsmList,
+    _In_ PDSM_GROUP_ENTRY Group,
+    _Out_ PDSM_PATH_SNAPSHOT Snapshot
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the usable active/optimized and active/unoptimized
+    paths of the group from its precomputed snapshot. Should none of the
+    snapshot's active/optimized paths still be A/O (eg. a state change that
+    moved the A/O paths hasn't been folded in yet), the paths are looked up
+    the slow way by validating every device in the DSM Ids list.
+
+    Callers must still check the state of each returned path since it may
+    have changed since the snapshot was taken.
+
+Arguments:
+
+    DsmList    - List of DSM Ids sent by MPIO
+    Group      - The multi-path group
+    Snapshot   - Receives the usable paths
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDSM_DEVICE_INFO deviceInfo;
+    ULONG inx;
+
+    DsmpCopyPathSnapshot(Group, Snapshot);
+
+    for (inx = 0; inx < Snapshot->OptimizedCount; inx++) {
+
+        if (Snapshot->Optimized[inx]->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+            return;
+        }
+    }
+
+    Snapshot->OptimizedCount = 0;
+    Snapshot->UnoptimizedCount = 0;
+
+    for (inx = 0; inx < DsmList->Count && inx < DSM_MAX_PATHS; inx++) {
+
+        deviceInfo = DsmList->IdList[inx];
+
+        if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+            continue;
+        }
+
+        if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+            Snapshot->Optimized[Snapshot->OptimizedCount++] = deviceInfo;
+
+        } else if (deviceInfo->State == DSM_DEV_ACTIVE_UNOPTIMIZED) {
+
+            Snapshot->Unoptimized[Snapshot->UnoptimizedCount++] = deviceInfo;
+        }
+    }
+
+    return;
+}
+
+
+VOID
+DsmpUpdateServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ ULONG_PTR DispatchTime
+    )
+/*++
+
+Routine Description:
+
+    This routine folds the service time of a completed request into the
+    exponentially weighted moving average service time of the path that
+    the request was sent down.
+
+    Concurrent completions may race updating the average, in which case
+    one of the samples is lost. This is acceptable since the average only
+    needs to be approximate.
+
+Arguments:
+
+    FailGroup - The path that serviced the request
+    DispatchTime - Interrupt time (possibly truncated to the size of a pointer)
+                   at which the request was sent down the path
+
+Return Value:
+
+    None
+
+--*/
+{
+    LONGLONG serviceTime;
+    LONGLONG average;
+
+    //
+    // Unsigned arithmetic takes care of the interrupt time being truncated.
+    //
+    serviceTime = (LONGLONG)(ULONG_PTR)((ULONG_PTR)KeQueryInterruptTime() - DispatchTime);
+
+    average = InterlockedCompareExchange64(&FailGroup->ServiceTimeAverage, 0, 0);
+
+    if (average == 0) {
+
+        average = serviceTime;
+
+    } else {
+
+        average += (serviceTime - average) >> DSM_SERVICE_TIME_EWMA_SHIFT;
+    }
+
+    //
+    // Never let the average reach zero once samples have been taken, since
+    // zero indicates an unmeasured path.
+    //
+    InterlockedExchange64(&FailGroup->ServiceTimeAverage, max(average, 1));
+
+    return;
+}
+
+
+ULONG
+DsmpGetLatencyBucket(
+    _In_ ULONGLONG Latency
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the latency histogram bucket that a request which
+    took the given time to complete falls in.
+
+    NOTE: The bucket boundaries must be kept in sync with msdsm.mof
+
+Arguments:
+
+    Latency - Completion latency in 100ns units
+
+Return Value:
+
+    Index of the bucket in the latency histogram
+
+--*/
+{
+    //
+    // Upper bounds, in 100ns units, of all but the last bucket:
+    // 500us, 1ms, 2ms, 5ms, 10ms, 50ms and 200ms.
+    //
+    static const ULONGLONG bucketLimits[DSM_STATS_HISTOGRAM_BUCKETS - 1] = {
+        5000, 10000, 20000, 50000, 100000, 500000, 2000000
+    };
+    ULONG bucket;
+
+    for (bucket = 0; bucket < DSM_STATS_HISTOGRAM_BUCKETS - 1; bucket++) {
+
+        if (Latency <= bucketLimits[bucket]) {
+            break;
+        }
+    }
+
+    return bucket;
+}
+
+
+ULONG
+DsmpGetQueueDepthBucket(
+    _In_ LONG QueueDepth
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the queue depth histogram bucket that the given
+    number of outstanding requests falls in. Bucket n holds queue depths up
+    to 2^n, with the last bucket being unbounded.
+
+    NOTE: The bucket boundaries must be kept in sync with msdsm.mof
+
+Arguments:
+
+    QueueDepth - Number of requests outstanding, including the new one
+
+Return Value:
+
+    Index of the bucket in the queue depth histogram
+
+--*/
+{
+    ULONG bucket = 0;
+    ULONG depth;
+
+    if (QueueDepth > 1) {
+
+        depth = (ULONG)(QueueDepth - 1);
+
+        //
+        // ie. ceil(log2(QueueDepth))
+        //
+        while (depth && bucket < DSM_STATS_HISTOGRAM_BUCKETS - 1) {
+            depth >>= 1;
+            bucket++;
+        }
+    }
+
+    return bucket;
+}
+
+
+VOID
+DsmpUpdateLatencyStats(
+    _In_ PDSM_DEVICE_INFO DeviceInfo,
+    _In_ UCHAR OpCode,
+    _In_ ULONG_PTR DispatchTime
+    )
+/*++
+
+Routine Description:
+
+    This routine folds the completion latency of a read or write request into
+    the statistics of the device-path pairing that serviced it.
+
+    This is called in the completion path for every request, so only
+    interlocked updates are used. The maximum latency may miss a sample when
+    two completions race, which is acceptable.
+
+Arguments:
+
+    DeviceInfo - The device-path pairing that serviced the request
+    OpCode - Opcode of the completed request
+    DispatchTime - Interrupt time (possibly truncated to the size of a pointer)
+                   at which the request was sent down the path
+
+Return Value:
+
+    None
+
+--*/
+{
+    LONGLONG latency;
+    LONGLONG currentMax;
+    volatile LONGLONG *total;
+    volatile LONGLONG *maximum;
+    volatile LONG *histogram;
+
+    if (DsmIsReadRequest(OpCode)) {
+
+        total = &DeviceInfo->DeviceStats.TotalReadLatency;
+        maximum = &DeviceInfo->DeviceStats.MaxReadLatency;
+        histogram = DeviceInfo->DeviceStats.ReadLatencyHistogram;
+
+    } else if (DsmIsWriteRequest(OpCode)) {
+
+        total = &DeviceInfo->DeviceStats.TotalWriteLatency;
+        maximum = &DeviceInfo->DeviceStats.MaxWriteLatency;
+        histogram = DeviceInfo->DeviceStats.WriteLatencyHistogram;
+
+    } else {
+
+        return;
+    }
+
+    //
+    // Unsigned arithmetic takes care of the interrupt time being truncated.
+    //
+    latency = (LONGLONG)(ULONG_PTR)((ULONG_PTR)KeQueryInterruptTime() - DispatchTime);
+
+    InterlockedExchangeAdd64(total, latency);
+    InterlockedIncrement(&histogram[DsmpGetLatencyBucket((ULONGLONG)latency)]);
+
+    currentMax = *maximum;
+    if (latency > currentMax) {
+        InterlockedCompareExchange64(maximum, latency, currentMax);
+    }
+
+    return;
+}
+
+
+VOID
+DsmpRecordPathFailure(
+    _In_ PDSM_DEVICE_INFO DeviceInfo
+    )
+/*++
+
+Routine Description:
+
+    This routine records in the statistics of the device-path pairing that
+    the path failed and when it did.
+
+Arguments:
+
+    DeviceInfo - The device-path pairing whose path failed
+
+Return Value:
+
+    None
+
+--*/
+{
+    LARGE_INTEGER currentTime;
+
+    KeQuerySystemTime(&currentTime);
+
+    InterlockedIncrement(&DeviceInfo->DeviceStats.FailoverCount);
+    InterlockedExchange64(&DeviceInfo->DeviceStats.LastFailoverTime.QuadPart, currentTime.QuadPart);
+
+    return;
+}
+
+
 PDSM_FAILOVER_GROUP
 DsmpGetPath(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -3395,6 +3956,20 @@ Return Value:
     //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
     //                                        states after transition) - one with least cumulative outstanding is chosen.
     //
+    // Least-Service-Time:
+    // -------------------
+    //      If symmetric LUA:
+    //          N paths AO,             <- one with least expected completion time, ie. (outstanding IO + 1) times
+    //                                     the average service time of the path, is chosen. Unmeasured paths are
+    //                                     considered to have no service time so that they get sampled.
+    //          Rest of the paths Failed
+    //
+    //      If ALUA:
+    //          N paths AO,             <- one with least expected completion time is chosen
+    //          M paths AU, SB or UA    <- if no AO paths available, the AU path with least expected completion
+    //                                     time is chosen for storage that supports implicit transitions.
+    //          Rest of the paths Failed
+    //
     // Actual implementation of algorithm happens in the following routines: DsmpGetAnyActivePath,
     //          DsmpGetActivePathToBeUsed, flavors of DsmpSetLBForPathXXX.
     //
@@ -3402,6 +3977,7 @@ Return Value:
     PDSM_FAILOVER_GROUP failGroup = NULL;
     PDSM_DEVICE_INFO deviceInfo = DsmList->IdList[0];
     PDSM_GROUP_ENTRY groupEntry;
+    DSM_PATH_SNAPSHOT snapshot;
     ULONG inx = 0;
 
     UNREFERENCED_PARAMETER(DsmContext);
@@ -3579,20 +4155,24 @@ Return Value:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
 
             LONG leastQueueDepth = 0x7FFFFFFF;
+            LONG queueDepth;
 
-            for (inx = 0; inx < DsmList->Count; inx++) {
+            DsmpGetUsablePaths(DsmList, groupEntry, &snapshot);
 
-                deviceInfo = DsmList->IdList[inx];
+            for (inx = 0; inx < snapshot.OptimizedCount; inx++) {
 
-                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+                deviceInfo = snapshot.Optimized[inx];
+
+                if (deviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED) {
 
                     continue;
                 }
 
-                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED &&
-                    deviceInfo->FailGroup->NumberOfRequestsInFlight < leastQueueDepth) {
+                queueDepth = DsmpGetRequestsInFlight(deviceInfo->FailGroup);
 
-                    leastQueueDepth = deviceInfo->FailGroup->NumberOfRequestsInFlight;
+                if (queueDepth < leastQueueDepth) {
+
+                    leastQueueDepth = queueDepth;
                     failGroup = deviceInfo->FailGroup;
                 }
             }
@@ -3639,6 +4219,94 @@ Return Value:
             break;
         }
 
+        case DSM_LB_LEAST_SERVICE_TIME: {
+
+            ULONGLONG leastServiceTime = MAXULONGLONG;
+            ULONGLONG leastUnoptimizedServiceTime = MAXULONGLONG;
+            PDSM_FAILOVER_GROUP unoptimizedGroup = NULL;
+            ULONGLONG serviceTime;
+
+            DsmpGetUsablePaths(DsmList, groupEntry, &snapshot);
+
+            for (inx = 0; inx < snapshot.OptimizedCount; inx++) {
+
+                deviceInfo = snapshot.Optimized[inx];
+
+                if (deviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED) {
+
+                    continue;
+                }
+
+                serviceTime = (ULONGLONG)(max(DsmpGetRequestsInFlight(deviceInfo->FailGroup), 0) + 1) *
+                              (ULONGLONG)deviceInfo->FailGroup->ServiceTimeAverage;
+
+                if (serviceTime < leastServiceTime) {
+
+                    leastServiceTime = serviceTime;
+                    failGroup = deviceInfo->FailGroup;
+                }
+            }
+
+            for (inx = 0; !failGroup && inx < snapshot.UnoptimizedCount; inx++) {
+
+                deviceInfo = snapshot.Unoptimized[inx];
+
+                if (deviceInfo->State != DSM_DEV_ACTIVE_UNOPTIMIZED) {
+
+                    continue;
+                }
+
+                serviceTime = (ULONGLONG)(max(DsmpGetRequestsInFlight(deviceInfo->FailGroup), 0) + 1) *
+                              (ULONGLONG)deviceInfo->FailGroup->ServiceTimeAverage;
+
+                if (serviceTime < leastUnoptimizedServiceTime) {
+
+                    leastUnoptimizedServiceTime = serviceTime;
+                    unoptimizedGroup = deviceInfo->FailGroup;
+                }
+            }
+
+            if (failGroup) {
+
+                TracePrint((TRACE_LEVEL_WARNING,
+                            TRACE_FLAG_RW,
+                            "DsmpGetPath (DsmIds %p): Path to be used for LST is %p (expected time %I64u).\n",
+                            DsmList,
+                            failGroup,
+                            leastServiceTime));
+
+            } else {
+
+                //
+                // It is possible for ALUA storage supporting implicit transitions
+                // that the storage initiated a transition that left no TPG in A/O
+                // state. For such storages, we should return some path instead of
+                // just failing the I/O. Since we have service times for the A/U
+                // paths too, pick the one expected to complete the soonest until
+                // the storage does a transition to make a TPG A/O.
+                //
+                if (!DsmpIsSymmetricAccess((PDSM_DEVICE_INFO)DsmList->IdList[0]) &&
+                    ((PDSM_DEVICE_INFO)DsmList->IdList[0])->ALUASupport != DSM_DEVINFO_ALUA_EXPLICIT) {
+
+                    failGroup = unoptimizedGroup ? unoptimizedGroup : groupEntry->PathToBeUsed;
+
+                    TracePrint((TRACE_LEVEL_WARNING,
+                                TRACE_FLAG_PNP,
+                                "DsmpGetPath (DsmIds %p): Using non-optimized path (FOG %p) for LST.\n",
+                                DsmList,
+                                failGroup));
+                } else {
+
+                    TracePrint((TRACE_LEVEL_ERROR,
+                                TRACE_FLAG_RW,
+                                "DsmpGetPath (DsmIds %p): Failed to find a path for LST.\n",
+                                DsmList));
+                }
+            }
+
+            break;
+        }
+
         case DSM_LB_LEAST_BLOCKS: {
 
             ULONG bytes = 0;
@@ -3699,7 +4367,7 @@ Return Value:
                 //
                 if ((startLba >= lastPathUsed->LastLba) &&
                     ((isRead) ||
-                     (isWrite && lastPathUsed->OutstandingBytesOfIO + bytes <= groupEntry->CacheSizeForLeastBlocks))) {
+                     (isWrite && DsmpGetOutstandingBytes(lastPathUsed) + bytes <= groupEntry->CacheSizeForLeastBlocks))) {
 
                     failGroup = groupEntry->PathToBeUsed;
 
@@ -3717,19 +4385,24 @@ Return Value:
 
             if (!failGroup) {
 
-                for (inx = 0; inx < DsmList->Count; inx++) {
+                ULONGLONG outstandingIO;
+
+                DsmpGetUsablePaths(DsmList, groupEntry, &snapshot);
+
+                for (inx = 0; inx < snapshot.OptimizedCount; inx++) {
 
-                    deviceInfo = DsmList->IdList[inx];
+                    deviceInfo = snapshot.Optimized[inx];
 
-                    if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+                    if (deviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED) {
 
                         continue;
                     }
 
-                    if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED &&
-                        deviceInfo->FailGroup->OutstandingBytesOfIO < leastOutstandingIO) {
+                    outstandingIO = DsmpGetOutstandingBytes(deviceInfo->FailGroup);
 
-                        leastOutstandingIO = deviceInfo->FailGroup->OutstandingBytesOfIO;
+                    if (outstandingIO < leastOutstandingIO) {
+
+                        leastOutstandingIO = outstandingIO;
                         failGroup = deviceInfo->FailGroup;
                     }
                 }
@@ -4373,6 +5046,7 @@ Return Value:
     ULONG dataTransferLength = 0;
     PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(Irp);
     PDSM_FAILOVER_GROUP failGroup = irpStack->Parameters.Others.Argument3;
+    ULONG_PTR dispatchTime = (ULONG_PTR)irpStack->Parameters.Others.Argument4;
 
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_RW,
@@ -4395,6 +5069,16 @@ Return Value:
 
     if (failGroup) {
 
+        //
+        // Only the LST policy makes use of the service time, so don't pay for
+        // the bookkeeping otherwise.
+        //
+        if (deviceInfo &&
+            deviceInfo->Group->LoadBalanceType == DSM_LB_LEAST_SERVICE_TIME) {
+
+            DsmpUpdateServiceTime(failGroup, dispatchTime);
+        }
+
         if (DsmpDecrementCounters(failGroup, Srb)) {
 
             //
@@ -4485,6 +5169,15 @@ Return Value:
                     deviceInfo->DeviceStats.BytesWritten = MAXULONGLONG;
                 }
             }
+
+            //
+            // Requests that weren't sent down via DsmSetCompletion have no
+            // dispatch time, so they can't contribute to the latency stats.
+            //
+            if (failGroup && dispatchTime) {
+
+                DsmpUpdateLatencyStats(deviceInfo, opCode, dispatchTime);
+            }
         }
     }
 
@@ -5042,12 +5735,13 @@ Return Value:
 
     switch (Group->LoadBalanceType) {
 
+        case DSM_LB_LEAST_SERVICE_TIME:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
 
             //
-            // Since we choose the path with the smallest queue or cumulative size in
-            // DsmpGetPath, we just pick any path now
+            // Since we choose the path with the smallest queue, cumulative size or
+            // expected completion time in DsmpGetPath, we just pick any path now
             //
 
             // fall through
@@ -5791,6 +6485,8 @@ Return Value:
         }
     }
 
+    DsmpRebuildPathSnapshot(group);
+
 __Exit_DsmpSetNewDefaultLBPolicy:
 
     TracePrint((TRACE_LEVEL_VERBOSE,
@@ -6057,13 +6753,14 @@ Return Value:
             break;
         }
 
+        case DSM_LB_LEAST_SERVICE_TIME:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_ROUND_ROBIN:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH:
         case DSM_LB_WEIGHTED_PATHS: {
 
             //
-            // In RR, LWP, LB and LQD all paths are active so the new device
+            // In RR, LWP, LB, LQD and LST all paths are active so the new device
             // becomes AO or AU.
             //
             if (NewDeviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED) {
@@ -6118,6 +6815,8 @@ __Exit_DsmpSetLBForPathArrival:
         InterlockedExchangePointer(&(group->PathToBeUsed), NULL);
     }
 
+    DsmpRebuildPathSnapshot(group);
+
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_PNP,
                 "DsmpSetLBForPathArrival (DevInfo %p): Exiting function with status %x\n",
@@ -6385,6 +7084,8 @@ __Exit_DsmpSetLBForPathArrivalALUA:
         }
     }
 
+    DsmpRebuildPathSnapshot(group);
+
     if (lockHeld) {
         ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
     }
@@ -6514,13 +7215,14 @@ Return Value:
             break;
         }
 
+        case DSM_LB_LEAST_SERVICE_TIME:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_ROUND_ROBIN:
         case DSM_LB_WEIGHTED_PATHS:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
 
             //
-            // In RR, LQD, LB and LWP, all paths are active so we don't
+            // In RR, LQD, LB, LST and LWP, all paths are active so we don't
             // need to worry about activating a new path
             //
             TracePrint((TRACE_LEVEL_INFORMATION,
@@ -6562,6 +7264,8 @@ Return Value:
         InterlockedExchangePointer(&(group->PathToBeUsed), NULL);
     }
 
+    DsmpRebuildPathSnapshot(group);
+
     ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
 
     TracePrint((TRACE_LEVEL_VERBOSE,
@@ -6650,7 +7354,7 @@ Return Value:
     }
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_MAX_POLICY) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -6808,6 +7512,8 @@ Return Value:
         }
     }
 
+    DsmpRebuildPathSnapshot(group);
+
     if (lockHeld) {
 
         ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
@@ -6857,6 +7563,8 @@ Return Value:
                 "DsmpSetLBForPathFailing (DevInfo %p): Entering function.\n",
                 FailingDeviceInfo));
 
+    DsmpRecordPathFailure(FailingDeviceInfo);
+
     //
     // We need to do exactly what DsmpSetLBForPathRemoval() does, except
     // that the devInfo may not really go away (may come back before a
@@ -6922,6 +7630,8 @@ Return Value:
                 "DsmpSetLBForPathFailingALUA (DevInfo %p): Entering function.\n",
                 FailingDeviceInfo));
 
+    DsmpRecordPathFailure(FailingDeviceInfo);
+
     if (!(DsmpIsDeviceFailedState(FailingDeviceInfo->State))) {
 
         FailingDeviceInfo->LastKnownGoodState = FailingDeviceInfo->State;
@@ -6940,7 +7650,7 @@ Return Value:
     group = FailingDeviceInfo->Group;
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_MAX_POLICY) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -7226,6 +7936,8 @@ Return Value:
                     group));
     }
 
+    DsmpRebuildPathSnapshot(group);
+
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_RW,
                 "DsmpSetLBForPathFailingALUA (DevInfo %p): Exiting function with status %x.\n",
@@ -7301,7 +8013,7 @@ Return Value:
     group = FailingDeviceInfo->Group;
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_MAX_POLICY) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -8468,6 +9180,8 @@ Return Value:
                     }
                 }
             }
+
+            DsmpRebuildPathSnapshot(group);
         }
 
         failDevInfoListEntry = DsmpFindFailPathDevInfoEntry(context->CompletionContext->DsmContext,
@@ -3507,7 +3507,7 @@ Return Value:
             // Move this over to the stale FOG list if there are inflight requests.
             // Otherwise free the allocation.
             //
-            if (InterlockedCompareExchange(&failGroup->NumberOfRequestsInFlight, 0, 0) > 0) {
+            if (DsmpGetRequestsInFlight(failGroup) > 0) {
 
                 failGroup->State = DSM_FG_PENDING_REMOVE;
                 InsertTailList(&DsmContext->StaleFailGroupList, &failGroup->ListEntry);
@@ -3517,7 +3517,7 @@ Return Value:
                             TRACE_FLAG_PNP,
                             "DsmRemovePath (PathId %p): Outstanding requests %d. Moving FOGroup %p with path %p to stale path list.\n",
                             PathId,
-                            failGroup->NumberOfRequestsInFlight,
+                            DsmpGetRequestsInFlight(failGroup),
                             failGroup,
                             failGroup->PathId));
             } else {
@@ -3639,6 +3639,12 @@ Return Value:
         goto __Exit_DsmLBGetPath;
     }
 
+    //
+    // Although the path snapshot itself can be read without the lock, the
+    // devInfos and FOGs it points to are freed under the lock in Exclusive
+    // mode, so it is still needed in Shared mode to keep them alive while a
+    // path is picked.
+    //
     irql = ExAcquireSpinLockShared(&(dsmContext->DsmContextLock));
 
     deviceInfo = DsmList->IdList[0];
@@ -3786,6 +3792,7 @@ Return Value:
                 }
 
                 irpStack->Parameters.Others.Argument3 = failGroup;
+                irpStack->Parameters.Others.Argument4 = (PVOID)(ULONG_PTR)KeQueryInterruptTime();
 
                 DsmpIncrementCounters(failGroup, Srb);
             }
@@ -4180,18 +4187,24 @@ Return Value:
                 DsmId));
 
     //
-    // Save off the path that was selected to service this request in Argument3.
+    // Save off the path that was selected to service this request in Argument3,
+    // and the time at which it was sent down that path in Argument4.
     //
     irpStack->Parameters.Others.Argument3 = failGroup;
+    irpStack->Parameters.Others.Argument4 = (PVOID)(ULONG_PTR)KeQueryInterruptTime();
 
     DsmpIncrementCounters(failGroup, Srb);
 
     if (!dsmContext->DisableStatsGathering) {
 
+        LONG queueDepth;
+
         //
-        // Indicate one more request on this device down this path.
+        // Indicate one more request on this device down this path, and
+        // sample the resulting queue depth.
         //
-        InterlockedIncrement(&deviceInfo->NumberOfRequestsInProgress);
+        queueDepth = InterlockedIncrement(&deviceInfo->NumberOfRequestsInProgress);
+        InterlockedIncrement(&deviceInfo->DeviceStats.QueueDepthHistogram[DsmpGetQueueDepthBucket(queueDepth)]);
     }
 
     //
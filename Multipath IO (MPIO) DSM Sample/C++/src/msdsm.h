@@ -99,7 +99,37 @@ Notes:
 //
 // Number of LB Policies that are supported by this driver.
 //
-#define DSM_NUMBER_OF_LB_POLICIES 6
+#define DSM_NUMBER_OF_LB_POLICIES 7
+
+//
+// Least Service Time is a policy specific to this DSM. It is exposed through
+// the vendor specific policy value, which immediately follows Least Blocks.
+//
+#define DSM_LB_LEAST_SERVICE_TIME   DSM_LB_VENDOR_SPECIFIC
+
+//
+// Highest load balance policy value supported by this driver.
+//
+#define DSM_LB_MAX_POLICY           DSM_LB_LEAST_SERVICE_TIME
+
+//
+// Weight of a new sample in the per-path service time average, expressed as a
+// shift (ie. new sample contributes 1/8th).
+//
+#define DSM_SERVICE_TIME_EWMA_SHIFT 3
+
+//
+// Number of stripes the per-path in-flight counters are spread over. Each
+// processor updates the stripe selected by its number, so this needs to be a
+// power of 2.
+//
+#define DSM_COUNTER_STRIPES 16
+
+//
+// Number of buckets in the per device-path latency and queue depth histograms.
+// NOTE: This must be kept in sync with msdsm.mof
+//
+#define DSM_STATS_HISTOGRAM_BUCKETS 8
 
 //
 // Size of the buffer passed to read in Persistent Reserve keys.
@@ -613,6 +643,31 @@ typedef struct _DSM_STATS {
     ULONGLONG  BytesRead;
     ULONGLONG  BytesWritten;
 
+    //
+    // Cumulative and worst case completion latencies, in 100ns units.
+    //
+    volatile LONGLONG TotalReadLatency;
+    volatile LONGLONG TotalWriteLatency;
+    volatile LONGLONG MaxReadLatency;
+    volatile LONGLONG MaxWriteLatency;
+
+    //
+    // Completion latency distribution of reads and writes, and distribution
+    // of the number of requests outstanding on the device-path pairing at the
+    // time a request is dispatched. See DsmpGetLatencyBucket() and
+    // DsmpGetQueueDepthBucket() for the bucket boundaries.
+    //
+    volatile LONG ReadLatencyHistogram[DSM_STATS_HISTOGRAM_BUCKETS];
+    volatile LONG WriteLatencyHistogram[DSM_STATS_HISTOGRAM_BUCKETS];
+    volatile LONG QueueDepthHistogram[DSM_STATS_HISTOGRAM_BUCKETS];
+
+    //
+    // Number of times the path failed with a fatal error, and the system
+    // time at which that last happened.
+    //
+    volatile LONG FailoverCount;
+    LARGE_INTEGER LastFailoverTime;
+
 } DSM_STATS, *PDSM_STATS;
 
 
@@ -808,6 +863,30 @@ typedef enum _DSM_DEFAULT_LB_POLICY_TYPE {
 
 typedef ULONG   DSM_LOAD_BALANCE_TYPE, *PDSM_LOAD_BALANCE_TYPE;
 
+//
+// Precomputed list of the usable paths of a multi-path group, split by access
+// state. It is rebuilt (with DsmContextLock held exclusive) whenever paths
+// arrive, go away or change state, so that path selection doesn't need to
+// revalidate every path of the group on each request.
+//
+// Generation is odd while the snapshot is being rebuilt. Readers sample it
+// before and after copying the lists and retry if it changed, so they don't
+// depend on the context lock to get a consistent view.
+//
+typedef struct _DSM_PATH_SNAPSHOT {
+
+    volatile LONG Generation;
+
+    ULONG OptimizedCount;
+
+    ULONG UnoptimizedCount;
+
+    PDSM_DEVICE_INFO Optimized[DSM_MAX_PATHS];
+
+    PDSM_DEVICE_INFO Unoptimized[DSM_MAX_PATHS];
+
+} DSM_PATH_SNAPSHOT, *PDSM_PATH_SNAPSHOT;
+
 
 //
 // Information about multi-path groups: The same device found via multiple paths
@@ -846,6 +925,11 @@ typedef struct _DSM_GROUP_ENTRY {
     //
     PDSM_DEVICE_INFO DeviceList[DSM_MAX_PATHS];
 
+    //
+    // Usable paths of this group, precomputed for DsmpGetPath.
+    //
+    DSM_PATH_SNAPSHOT PathSnapshot;
+
     //
     // Max time to retry failed PR requests
     //
@@ -960,6 +1044,21 @@ typedef struct _DSM_GROUP_ENTRY {
 
 } DSM_GROUP_ENTRY, *PDSM_GROUP_ENTRY;
 
+//
+// Per-processor stripe of a path's in-flight counters. Each stripe sits in its
+// own cache line so that processors issuing I/O down the same path don't
+// contend. A stripe may go negative, since a request may complete on a
+// different processor than the one that issued it; only the sum across all
+// stripes is meaningful.
+//
+typedef struct DECLSPEC_CACHEALIGN _DSM_PATH_COUNTER {
+
+    volatile LONGLONG OutstandingBytesOfIO;
+
+    volatile LONG NumberOfRequestsInFlight;
+
+} DSM_PATH_COUNTER, *PDSM_PATH_COUNTER;
+
 //
 // The collection of devices on one path. These fail-over as a unit.
 // A path is considered an I_T nexus, i.e. Initiator port to Target (controller) port.
@@ -998,14 +1097,23 @@ typedef struct _DSM_FAILOVER_GROUP {
     ULONGLONG LastLba;
 
     //
-    // Cumulative outstanding IO (in terms of size)
+    // Set once a completion has claimed the removal of this pending-remove path.
     //
-    ULONGLONG OutstandingBytesOfIO;
+    volatile LONG RemovalClaimed;
 
     //
-    // Count of inflight IOs. This will be used in LQD load balance policy.
+    // Cumulative outstanding IO (in terms of size) and count of inflight IOs,
+    // striped per processor. Use DsmpGetOutstandingBytes() and
+    // DsmpGetRequestsInFlight() to get the totals. These are used in the LB,
+    // LQD and LST load balance policies.
     //
-    volatile LONG NumberOfRequestsInFlight;
+    DSM_PATH_COUNTER Counters[DSM_COUNTER_STRIPES];
+
+    //
+    // Exponentially weighted moving average of the time (in 100ns units) taken
+    // by requests sent down this path. Used in LST load balance policy.
+    //
+    volatile LONGLONG ServiceTimeAverage;
 
     //
     // Number of devices in this FOG.
@@ -500,6 +500,67 @@ DsmpDecrementCounters(
     _In_ PSCSI_REQUEST_BLOCK Srb
     );
 
+PDSM_PATH_COUNTER
+DsmpGetCounterStripe(
+    _In_ PDSM_FAILOVER_GROUP FailGroup
+    );
+
+LONG
+DsmpGetRequestsInFlight(
+    _In_ PDSM_FAILOVER_GROUP FailGroup
+    );
+
+ULONGLONG
+DsmpGetOutstandingBytes(
+    _In_ PDSM_FAILOVER_GROUP FailGroup
+    );
+
+VOID
+DsmpRebuildPathSnapshot(
+    _In_ PDSM_GROUP_ENTRY Group
+    );
+
+VOID
+DsmpCopyPathSnapshot(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _Out_ PDSM_PATH_SNAPSHOT Snapshot
+    );
+
+VOID
+DsmpGetUsablePaths(
+    _In_ PDSM_IDS DsmList,
+    _In_ PDSM_GROUP_ENTRY Group,
+    _Out_ PDSM_PATH_SNAPSHOT Snapshot
+    );
+
+VOID
+DsmpUpdateServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ ULONG_PTR DispatchTime
+    );
+
+ULONG
+DsmpGetLatencyBucket(
+    _In_ ULONGLONG Latency
+    );
+
+ULONG
+DsmpGetQueueDepthBucket(
+    _In_ LONG QueueDepth
+    );
+
+VOID
+DsmpUpdateLatencyStats(
+    _In_ PDSM_DEVICE_INFO DeviceInfo,
+    _In_ UCHAR OpCode,
+    _In_ ULONG_PTR DispatchTime
+    );
+
+VOID
+DsmpRecordPathFailure(
+    _In_ PDSM_DEVICE_INFO DeviceInfo
+    );
+
 PDSM_FAILOVER_GROUP
 DsmpGetPath(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -1243,6 +1304,15 @@ DsmpQueryDevicePerf(
     _Out_writes_to_(*OutBufferSize, *OutBufferSize) PUCHAR Buffer
     );
 
+NTSTATUS
+DsmpQueryDevicePerfV2(
+    _In_ PDSM_CONTEXT DsmContext,
+    _In_ PDSM_IDS DsmIds,
+    _In_ ULONG InBufferSize,
+    _Inout_ PULONG OutBufferSize,
+    _Out_writes_to_(*OutBufferSize, *OutBufferSize) PUCHAR Buffer
+    );
+
 NTSTATUS
 DsmpClearPerfCounters(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -6669,6 +6669,8 @@ Return Value:
         }
     }
 
+    DsmpRebuildPathSnapshot(Group);
+
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_GENERAL,
                 "DsmpAdjustDeviceStatesALUA (Group %p): Exiting function with status %x\n",
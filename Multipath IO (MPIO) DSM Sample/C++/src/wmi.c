@@ -96,6 +96,7 @@ GUID DSM_QueryLBPolicyV2GUID = DSM_QueryLBPolicy_V2Guid;
 GUID DSM_QuerySupportedLBPoliciesV2GUID = DSM_QuerySupportedLBPolicies_V2Guid;
 GUID MSDSM_DEVICE_PERFGUID = MSDSM_DEVICE_PERFGuid;
 GUID MSDSM_WMI_METHODSGUID = MSDSM_WMI_METHODSGuid;
+GUID MSDSM_DEVICE_PERF_V2GUID = MSDSM_DEVICE_PERF_V2Guid;
 
 //
 // Symbolic names for the Device-centric guid indexes
@@ -108,6 +109,7 @@ GUID MSDSM_WMI_METHODSGUID = MSDSM_WMI_METHODSGuid;
 #define DSM_QuerySupportedLBPoliciesV2GUID_Index    5
 #define MSDSM_DEVICE_PERFGuidIndex                  6
 #define MSDSM_WMI_METHODSGuidIndex                  7
+#define MSDSM_DEVICE_PERF_V2GuidIndex               8
 
 WMIGUIDREGINFO DsmGuidList[] = {
     {
@@ -156,6 +158,12 @@ WMIGUIDREGINFO DsmGuidList[] = {
         &MSDSM_WMI_METHODSGUID,
         1,
         0
+    },
+
+    {
+        &MSDSM_DEVICE_PERF_V2GUID,
+        1,
+        0
     }
 };
 
@@ -495,7 +503,7 @@ Return Value:
                     continue;
                 }
 
-                if (targetPolicyInfo->LoadBalancePolicy >= DSM_LB_VENDOR_SPECIFIC) {
+                if (targetPolicyInfo->LoadBalancePolicy > DSM_LB_MAX_POLICY) {
 
                     errorStatus = STATUS_INVALID_PARAMETER;
 
@@ -571,7 +579,7 @@ Return Value:
             //
             // First ensure that the values make sense.
             //
-            if (loadBalancePolicy >= DSM_LB_VENDOR_SPECIFIC) {
+            if (loadBalancePolicy > DSM_LB_MAX_POLICY) {
 
                 status = STATUS_INVALID_PARAMETER;
                 TracePrint((TRACE_LEVEL_ERROR,
@@ -870,6 +878,19 @@ Return Value:
             break;
         }
 
+        case MSDSM_DEVICE_PERF_V2GuidIndex: {
+
+            *DataLength = BufferAvail;
+
+            status = DsmpQueryDevicePerfV2(DsmContext,
+                                           DsmIds,
+                                           BufferAvail,
+                                           DataLength,
+                                           Buffer);
+
+            break;
+        }
+
         case MSDSM_WMI_METHODSGuidIndex: {
 
             //
@@ -1174,7 +1195,8 @@ Return Value:
             NT_ASSERT(groupEntry->LoadBalanceType != DSM_LB_ROUND_ROBIN &&
                    groupEntry->LoadBalanceType != DSM_LB_WEIGHTED_PATHS &&
                    groupEntry->LoadBalanceType != DSM_LB_DYN_LEAST_QUEUE_DEPTH &&
-                   groupEntry->LoadBalanceType != DSM_LB_LEAST_BLOCKS);
+                   groupEntry->LoadBalanceType != DSM_LB_LEAST_BLOCKS &&
+                   groupEntry->LoadBalanceType != DSM_LB_LEAST_SERVICE_TIME);
         }
 #endif
 
@@ -2021,7 +2043,7 @@ Return Value:
                     devInfo->State = DSM_DEV_ACTIVE_UNOPTIMIZED;
 
                     //
-                    // For LB policy RR, WP, LB and LQD, all paths must be in A/O
+                    // For LB policy RR, WP, LB, LQD and LST, all paths must be in A/O
                     // state. However, this is not possible for ALUA storages.
                     // For these storages, A/U is allowable only if that is the
                     // access state that the TPG is in.
@@ -2029,7 +2051,8 @@ Return Value:
                     if (loadBalancePolicy == DSM_LB_ROUND_ROBIN ||
                         loadBalancePolicy == DSM_LB_WEIGHTED_PATHS ||
                         loadBalancePolicy == DSM_LB_DYN_LEAST_QUEUE_DEPTH ||
-                        loadBalancePolicy == DSM_LB_LEAST_BLOCKS) {
+                        loadBalancePolicy == DSM_LB_LEAST_BLOCKS ||
+                        loadBalancePolicy == DSM_LB_LEAST_SERVICE_TIME) {
 
                         if (devInfo->TargetPortGroup && devInfo->ALUAState != DSM_DEV_ACTIVE_UNOPTIMIZED) {
 
@@ -2065,14 +2088,15 @@ Return Value:
                 }
 
                 //
-                // For RR, LQD, LB and WP, all paths must be in A/O state for non-ALUA
+                // For RR, LQD, LB, LST and WP, all paths must be in A/O state for non-ALUA
                 // storage. For ALUA storage, the only time path states can be in
                 // S/B or U/A is if the TPG itself is in that state.
                 //
                 if (loadBalancePolicy == DSM_LB_ROUND_ROBIN ||
                     loadBalancePolicy == DSM_LB_WEIGHTED_PATHS ||
                     loadBalancePolicy == DSM_LB_DYN_LEAST_QUEUE_DEPTH ||
-                    loadBalancePolicy == DSM_LB_LEAST_BLOCKS) {
+                    loadBalancePolicy == DSM_LB_LEAST_BLOCKS ||
+                    loadBalancePolicy == DSM_LB_LEAST_SERVICE_TIME) {
 
                     if ((!devInfo->TargetPortGroup) ||
                         (devInfo->TargetPortGroup && devInfo->State != devInfo->ALUAState)) {
@@ -2457,6 +2481,8 @@ Return Value:
         }
     }
 
+    DsmpRebuildPathSnapshot(groupEntry);
+
     ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
 
     if (NT_SUCCESS(status) && savedLBSettings) {
@@ -2608,7 +2634,7 @@ Return Value:
     }
 
     if ((supportedLBPolicies->LoadBalancePolicy < DSM_LB_FAILOVER) ||
-        (supportedLBPolicies->LoadBalancePolicy > DSM_LB_LEAST_BLOCKS)) {
+        (supportedLBPolicies->LoadBalancePolicy > DSM_LB_MAX_POLICY)) {
 
         TracePrint((TRACE_LEVEL_ERROR,
                     TRACE_FLAG_WMI,
@@ -3173,6 +3199,166 @@ __Exit_DsmpQueryDevicePerf:
 }
 
 
+NTSTATUS
+DsmpQueryDevicePerfV2(
+    _In_ PDSM_CONTEXT DsmContext,
+    _In_ PDSM_IDS DsmIds,
+    _In_ ULONG InBufferSize,
+    _Inout_ PULONG OutBufferSize,
+    _Out_writes_to_(*OutBufferSize, *OutBufferSize) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the extended perf counters (latency and queue depth
+    distributions, and failure history) for each path for the device that
+    corresponds to the passed in DsmIds.
+
+    The counters are cumulative. The caller is expected to sample them
+    periodically and use the returned timestamp to derive rates (eg. IOPS).
+
+Arguements:
+
+    DsmContext - Global DSM context
+    DsmIds - DSM Ids for the given device
+    InBufferSize - Size of the input buffer
+    OutBufferSize - Size of the output buffer
+    Buffer - Buffer in which the perf counters are returned, if the buffer
+             is big enough
+
+Return Value:
+
+   STATUS_SUCCESS on success
+   Appropriate error code on error.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PDSM_DEVICE_INFO devInfo;
+    ULONG sizeNeeded;
+    PMSDSM_DEVICE_PERF_V2 devicePerf;
+    ULONG i;
+    ULONG bucket;
+    PMSDSM_DEVICEPATH_PERF_V2 pathPerf;
+    PDSM_STATS stats;
+    LARGE_INTEGER currentTime;
+    KIRQL irql;
+
+    UNREFERENCED_PARAMETER(InBufferSize);
+
+    C_ASSERT(RTL_NUMBER_OF_FIELD(MSDSM_DEVICEPATH_PERF_V2, ReadLatencyHistogram) == DSM_STATS_HISTOGRAM_BUCKETS);
+    C_ASSERT(RTL_NUMBER_OF_FIELD(MSDSM_DEVICEPATH_PERF_V2, WriteLatencyHistogram) == DSM_STATS_HISTOGRAM_BUCKETS);
+    C_ASSERT(RTL_NUMBER_OF_FIELD(MSDSM_DEVICEPATH_PERF_V2, QueueDepthHistogram) == DSM_STATS_HISTOGRAM_BUCKETS);
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_WMI,
+                "DsmpQueryDevicePerfV2 (DsmIds %p): Entering function.\n",
+                DsmIds));
+
+    //
+    // At least one device should be given
+    //
+    if (DsmIds->Count == 0) {
+
+        TracePrint((TRACE_LEVEL_ERROR,
+                    TRACE_FLAG_WMI,
+                    "DsmpQueryDevicePerfV2 (DsmIds %p): No DSM Ids given.\n",
+                    DsmIds));
+
+        *OutBufferSize = 0;
+        status = STATUS_INVALID_PARAMETER;
+
+        goto __Exit_DsmpQueryDevicePerfV2;
+    }
+
+    sizeNeeded = AlignOn8Bytes(FIELD_OFFSET(MSDSM_DEVICE_PERF_V2, PerfInfo));
+    sizeNeeded += (DsmIds->Count * sizeof(MSDSM_DEVICEPATH_PERF_V2));
+
+    if (*OutBufferSize < sizeNeeded) {
+
+        TracePrint((TRACE_LEVEL_ERROR,
+                    TRACE_FLAG_WMI,
+                    "DsmpQueryDevicePerfV2 (DsmIds %p): Output buffer too small for QueryDevicePerfV2.\n",
+                    DsmIds));
+
+        *OutBufferSize = sizeNeeded;
+        status = STATUS_BUFFER_TOO_SMALL;
+
+        goto __Exit_DsmpQueryDevicePerfV2;
+    }
+
+    //
+    // Zero out the output buffer first
+    //
+    RtlZeroMemory(Buffer, sizeNeeded);
+
+#if DBG
+    devInfo = DsmIds->IdList[0];
+    DSM_ASSERT(devInfo);
+    DSM_ASSERT(devInfo->DeviceSig == DSM_DEVICE_SIG);
+#endif
+
+    KeQuerySystemTime(&currentTime);
+
+    irql = ExAcquireSpinLockExclusive(&(DsmContext->DsmContextLock));
+
+    devicePerf = (PMSDSM_DEVICE_PERF_V2)Buffer;
+    devicePerf->TimeStamp = (ULONGLONG)currentTime.QuadPart;
+    devicePerf->NumberPaths = DsmIds->Count;
+
+    //
+    // For each path, get the stats info. The completion path updates these
+    // without holding the lock, so the values of a path may not be mutually
+    // consistent, but each one of them is.
+    //
+    for (i = 0; i < DsmIds->Count; i++) {
+
+        pathPerf = &devicePerf->PerfInfo[i];
+        devInfo = DsmIds->IdList[i];
+
+        if (DsmpIsDeviceInitialized(devInfo)) {
+
+            stats = &devInfo->DeviceStats;
+
+            pathPerf->PathId = (ULONGLONG)((ULONG_PTR)((devInfo->FailGroup)->PathId));
+            pathPerf->NumberReads = stats->NumberReads;
+            pathPerf->NumberWrites = stats->NumberWrites;
+            pathPerf->BytesRead = stats->BytesRead;
+            pathPerf->BytesWritten = stats->BytesWritten;
+            pathPerf->TotalReadLatency = (ULONGLONG)InterlockedCompareExchange64(&stats->TotalReadLatency, 0, 0);
+            pathPerf->TotalWriteLatency = (ULONGLONG)InterlockedCompareExchange64(&stats->TotalWriteLatency, 0, 0);
+            pathPerf->MaxReadLatency = (ULONGLONG)InterlockedCompareExchange64(&stats->MaxReadLatency, 0, 0);
+            pathPerf->MaxWriteLatency = (ULONGLONG)InterlockedCompareExchange64(&stats->MaxWriteLatency, 0, 0);
+
+            for (bucket = 0; bucket < DSM_STATS_HISTOGRAM_BUCKETS; bucket++) {
+
+                pathPerf->ReadLatencyHistogram[bucket] = (ULONG)stats->ReadLatencyHistogram[bucket];
+                pathPerf->WriteLatencyHistogram[bucket] = (ULONG)stats->WriteLatencyHistogram[bucket];
+                pathPerf->QueueDepthHistogram[bucket] = (ULONG)stats->QueueDepthHistogram[bucket];
+            }
+
+            pathPerf->FailoverCount = (ULONG)stats->FailoverCount;
+            pathPerf->LastFailoverTime = (ULONGLONG)stats->LastFailoverTime.QuadPart;
+        }
+    }
+
+    ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
+
+    *OutBufferSize = sizeNeeded;
+
+__Exit_DsmpQueryDevicePerfV2:
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_WMI,
+                "DsmpQueryDevicePerfV2 (DsmIds %p): Exiting function with status %x.\n",
+                DsmIds,
+                status));
+
+    return status;
+}
+
+
 NTSTATUS
 DsmpClearPerfCounters(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -3231,10 +3417,7 @@ Return Value:
         DSM_ASSERT(devInfo->DeviceSig == DSM_DEVICE_SIG);
 
         if (devInfo) {
-            (devInfo->DeviceStats).BytesRead = 0;
-            (devInfo->DeviceStats).BytesWritten = 0;
-            (devInfo->DeviceStats).NumberReads = 0;
-            (devInfo->DeviceStats).NumberWrites = 0;
+            RtlZeroMemory(&(devInfo->DeviceStats), sizeof(DSM_STATS));
         }
     }
 
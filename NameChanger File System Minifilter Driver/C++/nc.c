@@ -755,6 +755,14 @@ Logic:
 
     NcInitMapping( &InstanceContext->Mapping );
 
+    Status = NcDirCacheInit( &InstanceContext->DirCache,
+                             FltObjects->Instance );
+
+    if (!NT_SUCCESS( Status )) {
+
+        ReturnValue = Status;
+        goto NcInstanceSetupCleanup;
+    }
     
     Status = NcBuildMapping( UserParentFileObj,
                              RealParentFileObj,
@@ -940,6 +948,13 @@ Return Value:
 
         goto NcInstanceTeardownStartCleanup;
     }
+
+    //
+    //  Stop caching merged directory listings and close the handles held
+    //  by the ones we have.
+    //
+
+    NcDirCachePurge( &InstanceContext->DirCache, TRUE );
     
 NcInstanceTeardownStartCleanup:
 
@@ -19,6 +19,7 @@
 #define NC_FILE_NAME_TAG              'NCfn' // Tag for strings which are allocated for file names in file objects
 #define NC_DIR_QRY_CACHE_TAG          'NCqc' // Tag for buffers which are allocated for directory enumeration cache and injection entries
 #define NC_DIR_QRY_SEARCH_STRING      'NCqs' // Tag for strings which are allocated for directory search strings
+#define NC_DIR_LISTING_TAG            'NCdl' // Tag for cached merged directory listings
 #define NC_SET_LINK_BUFFER_TAG        'NCsl' // Tag for munge buffer in Set Link operations
 #define NC_RENAME_BUFFER_TAG          'NCrn' // Tag for munge buffer in Rename operations
 
@@ -223,6 +224,114 @@ typedef union {
 } NC_PATH_OVERLAP, *PNC_PATH_OVERLAP;
 #pragma warning( pop )
 
+//
+//  Merged directory listing cache defines.
+//
+//  Enumerating the parent of either mapping requires us to merge the
+//  filesystem's entries with the injected user mapping.  The result of that
+//  merge is cached per instance so that handles enumerating the same
+//  directory can share it.  A listing is immutable once built; it is
+//  discarded as soon as a change notification fires on the directory it
+//  describes (or on the real mapping's parent, if it contains an injected
+//  entry.)
+//
+//  The directory handles behind those notifications ignore share access,
+//  so a listing never lives longer than NC_DIR_LISTING_MAX_AGE: a periodic
+//  timer purges expired listings, whether or not anybody is enumerating.
+//
+
+#define NC_DIR_LISTING_MAX_COUNT     8
+#define NC_DIR_LISTING_MAX_SIZE      (4 * 1024 * 1024)
+#define NC_DIR_LISTING_INITIAL_SIZE  (16 * 1024)
+#define NC_DIR_LISTING_QUERY_SIZE    (64 * 1024)
+#define NC_DIR_LISTING_MAX_WATCHES   2
+#define NC_DIR_LISTING_MAX_AGE       (30LL * 1000 * 1000 * 10)   // 30 seconds, in 100ns units
+
+#define NC_DIR_LISTING_NOTIFY_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME |  \
+                                      FILE_NOTIFY_CHANGE_DIR_NAME |   \
+                                      FILE_NOTIFY_CHANGE_ATTRIBUTES | \
+                                      FILE_NOTIFY_CHANGE_SIZE |       \
+                                      FILE_NOTIFY_CHANGE_LAST_WRITE | \
+                                      FILE_NOTIFY_CHANGE_CREATION |   \
+                                      FILE_NOTIFY_CHANGE_EA |         \
+                                      FILE_NOTIFY_CHANGE_SECURITY)
+
+struct _NC_DIR_LISTING;
+
+typedef struct _NC_DIR_LISTING_WATCH {
+
+    // Our own handle to the directory being watched.
+    HANDLE Handle;
+    PFILE_OBJECT FileObject;
+
+    // The change notification we keep pending against it.
+    PFLT_CALLBACK_DATA Request;
+
+    // Signalled once the change notification has completed.
+    KEVENT Completed;
+
+    struct _NC_DIR_LISTING * Listing;
+
+} NC_DIR_LISTING_WATCH, *PNC_DIR_LISTING_WATCH;
+
+typedef struct _NC_DIR_LISTING {
+
+    // Links into the instance's list of listings.
+    LIST_ENTRY Links;
+
+    // One reference for the cache, one for each handle draining the listing.
+    volatile LONG RefCount;
+
+    // Set once any watcher has completed.  A stale listing is never handed
+    // to a new enumeration.
+    volatile LONG Stale;
+
+    // The instance the watchers were issued on.
+    PFLT_INSTANCE Instance;
+
+    // Interrupt time past which the listing is no longer served, and when
+    // it was last handed out.  The least recently used listing is evicted
+    // when the cache is full.
+    ULONGLONG Expires;
+    volatile LONG64 LastUsed;
+
+    // Key: the opened directory name, the upcased search string and the
+    // information class.
+    UNICODE_STRING DirectoryName;
+    UNICODE_STRING SearchString;
+    FILE_INFORMATION_CLASS InformationClass;
+
+    // The merged entries, chained by NextEntryOffset.  The last entry has
+    // a NextEntryOffset of zero.  Buffer is NULL for an empty listing.
+    PVOID Buffer;
+    ULONG Length;
+
+    ULONG WatchCount;
+    NC_DIR_LISTING_WATCH Watch[NC_DIR_LISTING_MAX_WATCHES];
+
+} NC_DIR_LISTING, *PNC_DIR_LISTING;
+
+typedef struct _NC_DIR_CACHE {
+
+    // Taken shared to look a listing up, exclusive to change the list.
+    PERESOURCE Lock;
+
+    // List of NC_DIR_LISTING, in no particular order.
+    LIST_ENTRY Listings;
+    ULONG Count;
+
+    // Set when the instance is being torn down; nothing more is cached.
+    BOOLEAN Disabled;
+
+    // Periodically queues a purge of expired listings.  Started when the
+    // first listing is cached.
+    PFLT_INSTANCE Instance;
+    BOOLEAN ExpiryTimerStarted;
+    KTIMER ExpiryTimer;
+    KDPC ExpiryDpc;
+
+} NC_DIR_CACHE, *PNC_DIR_CACHE;
+
 //
 //  Instance Context Defines
 //
@@ -235,6 +344,9 @@ typedef struct _NC_INSTANCE_CONTEXT {
     // The file system we're attached to
     FLT_FILESYSTEM_TYPE VolumeFilesystemType;
 
+    // Merged listings of the mappings' parent directories.
+    NC_DIR_CACHE DirCache;
+
 } NC_INSTANCE_CONTEXT, *PNC_INSTANCE_CONTEXT;
 
 
@@ -264,6 +376,12 @@ typedef struct _NC_DIR_QRY_CONTEXT {
     // The information class which the user requested.
     FILE_INFORMATION_CLASS InformationClass;
 
+    // If the enumeration is being served from a cached merged listing,
+    // the listing (referenced) and the offset of the next entry to return.
+    // Cache and InjectionEntry are unused in that case.
+    PNC_DIR_LISTING Listing;
+    ULONG ListingOffset;
+
 } NC_DIR_QRY_CONTEXT, *PNC_DIR_QRY_CONTEXT;
 
 //
@@ -857,7 +975,9 @@ NcStreamHandleContextEnumSetup (
     _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
     _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PFLT_FILE_NAME_INFORMATION FileNameInformation,
     _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap,
     _Out_ PBOOLEAN  FirstUsage
     );
 
@@ -866,6 +986,51 @@ NcStreamHandleContextEnumClose (
     _In_ PNC_DIR_QRY_CONTEXT DirContext 
     );
 
+ULONG
+NcCopyDirListingEntries (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _Out_writes_bytes_(UserSize) PVOID UserBuffer,
+    _In_ ULONG UserSize,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ BOOLEAN Single,
+    _Out_ PULONG NumEntriesCopied,
+    _Out_ PULONG LastEntryStart
+    );
+
+NTSTATUS
+NcDirCacheInit (
+    _Out_ PNC_DIR_CACHE Cache,
+    _In_ PFLT_INSTANCE Instance
+    );
+
+VOID
+NcDirCachePurge (
+    _Inout_ PNC_DIR_CACHE Cache,
+    _In_ BOOLEAN Disable
+    );
+
+VOID
+NcDirCacheTeardown (
+    _Inout_ PNC_DIR_CACHE Cache
+    );
+
+PNC_DIR_LISTING
+NcDirCacheReferenceListing (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ PUNICODE_STRING DirectoryName,
+    _In_ PUNICODE_STRING SearchString,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap
+    );
+
+VOID
+NcDirListingRelease (
+    _In_ PNC_DIR_LISTING Listing
+    );
+
 //
 //  The following functions exist in ncdirnotify.c
 //
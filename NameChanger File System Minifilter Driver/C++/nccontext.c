@@ -59,6 +59,8 @@ Return Value:
     FLT_ASSERT( ContextType == FLT_INSTANCE_CONTEXT );
 
     NcTeardownMapping( &InstanceContext->Mapping );
+
+    NcDirCacheTeardown( &InstanceContext->DirCache );
 }
 
 VOID
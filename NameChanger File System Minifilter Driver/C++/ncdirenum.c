@@ -14,6 +14,12 @@ Abstract:
     user.  We must take care to do so having regard for the pattern
     matching and case sensitivity dictated by the caller.
 
+    The merged result of enumerating a mapping's parent is cached on the
+    instance so that repeated enumerations of the same directory, from any
+    handle, only cost a copy.  Cached listings are invalidated by change
+    notifications which we keep pending against the directories they were
+    built from.
+
 Environment:
 
     Kernel mode
@@ -22,9 +28,72 @@ Environment:
 
 #include "nc.h"
 
+NTSTATUS
+NcDirListingBuild (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap,
+    _Inout_ PNC_DIR_LISTING Listing
+    );
+
+NTSTATUS
+NcDirListingArmWatch (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PUNICODE_STRING DirectoryName,
+    _Inout_ PNC_DIR_LISTING Listing
+    );
+
+VOID
+NcDirListingStopWatches (
+    _Inout_ PNC_DIR_LISTING Listing
+    );
+
+VOID
+NcDirListingWatchComplete (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PVOID CompletionContext
+    );
+
+VOID
+NcDirCacheStaleWorker (
+    _In_ PFLT_GENERIC_WORKITEM WorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    );
+
+KDEFERRED_ROUTINE NcDirCacheExpiryDpc;
+
+VOID
+NcDirCacheQueuePurge (
+    _In_ PFLT_INSTANCE Instance
+    );
+
+PNC_DIR_LISTING
+NcDirCacheFindListing (
+    _In_ PNC_DIR_CACHE Cache,
+    _In_ PUNICODE_STRING DirectoryName,
+    _In_ PUNICODE_STRING SearchString,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_ ULONGLONG Now,
+    _Out_opt_ PBOOLEAN SawExpired
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, NcCopyDirListingEntries)
 #pragma alloc_text(PAGE, NcCopyDirEnumEntry)
+#pragma alloc_text(PAGE, NcDirCacheFindListing)
+#pragma alloc_text(PAGE, NcDirCacheInit)
+#pragma alloc_text(PAGE, NcDirCachePurge)
+#pragma alloc_text(PAGE, NcDirCacheReferenceListing)
+#pragma alloc_text(PAGE, NcDirCacheStaleWorker)
+#pragma alloc_text(PAGE, NcDirCacheTeardown)
 #pragma alloc_text(PAGE, NcDirEnumSelectNextEntry)
+#pragma alloc_text(PAGE, NcDirListingArmWatch)
+#pragma alloc_text(PAGE, NcDirListingBuild)
+#pragma alloc_text(PAGE, NcDirListingRelease)
+#pragma alloc_text(PAGE, NcDirListingStopWatches)
 #pragma alloc_text(PAGE, NcEnumerateDirectory)
 #pragma alloc_text(PAGE, NcEnumerateDirectorySetupInjection)
 #pragma alloc_text(PAGE, NcEnumerateDirectoryReset)
@@ -245,7 +314,9 @@ Return Value:
                                              &Offsets,
                                              Data,
                                              FltObjects,
+                                             FileNameInformation,
                                              UserOverlap,
+                                             RealOverlap,
                                              &FirstQuery );
 
     if (!NT_SUCCESS( Status )) {
@@ -269,6 +340,33 @@ Return Value:
     NumEntriesCopied = 0;
     UserBufferOffset = 0;
 
+    if (DirCtx->Listing != NULL) {
+
+        //
+        //  This enumeration is being served from a cached merged listing.
+        //  The merge has already been done, so we just copy entries.
+        //
+
+        try {
+
+            UserBufferOffset = NcCopyDirListingEntries( DirCtx,
+                                                        UserBuffer,
+                                                        BufferSize,
+                                                        &Offsets,
+                                                        Single,
+                                                        &NumEntriesCopied,
+                                                        &LastEntryStart );
+
+        } except (NcExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+            Status = STATUS_INVALID_USER_BUFFER;
+            ReturnValue = FLT_PREOP_COMPLETE;
+            goto NcEnumerateDirectoryCleanup;
+        }
+
+        goto NcEnumerateDirectoryTerminateBuffer;
+    }
+
     do {
 
         //
@@ -360,6 +458,8 @@ Return Value:
     } while (MoreRoom && 
              (Single ? (NumEntriesCopied < 1) : TRUE));
 
+NcEnumerateDirectoryTerminateBuffer:
+
     if (NumEntriesCopied > 0) {
 
         //
@@ -1163,6 +1263,8 @@ Return Value:
     Context->SearchString.Length = 0;
     Context->SearchString.MaximumLength = 0;
     Context->SearchString.Buffer = NULL;
+    Context->Listing = NULL;
+    Context->ListingOffset = 0;
 
     return Status;
 }
@@ -1175,7 +1277,9 @@ NcStreamHandleContextEnumSetup (
     _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
     _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PFLT_FILE_NAME_INFORMATION FileNameInformation,
     _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap,
     _Out_ PBOOLEAN FirstUsage
     )
 /*++
@@ -1197,9 +1301,14 @@ Arguments:
 
     FltObjects - FltObjects structure for this operation.
 
+    FileNameInformation - The opened name of the directory being enumerated.
+
     UserMappingOverlap - The overlap between the user mapping and this file
         object.
 
+    RealMappingOverlap - The overlap between the real mapping and this file
+        object.
+
     FirstUsage - Weather or not this is the first usage of this handle in a
         directory enumeration.
 
@@ -1317,6 +1426,34 @@ Return Value:
             DirContext->InjectionEntry.CurrentOffset = 0;
         }
 
+        if (DirContext->Listing != NULL) {
+
+            NcDirListingRelease( DirContext->Listing );
+            DirContext->Listing = NULL;
+        }
+
+        DirContext->ListingOffset = 0;
+
+        //
+        //  See if a merged listing of this directory is cached (or can be
+        //  built.)  Listings are keyed and merged case insensitively, and
+        //  are built outside of any transaction, so only use them when the
+        //  caller would see the same thing.  If we can't get one, we fall
+        //  back to merging as we go.
+        //
+
+        if (IgnoreCase && FltObjects->Transaction == NULL) {
+
+            DirContext->Listing = NcDirCacheReferenceListing( InstanceContext,
+                                                              FltObjects,
+                                                              Offsets,
+                                                              &FileNameInformation->Name,
+                                                              &DirContext->SearchString,
+                                                              InformationClass,
+                                                              UserMappingOverlap,
+                                                              RealMappingOverlap );
+        }
+
         //
         //  Now that the cache is clear we can set up the injection entry.
         //  The injection entry is the user mapping itself. Thus it only needs
@@ -1324,7 +1461,7 @@ Return Value:
         //  the user mapping.
         //
 
-        if (UserMappingOverlap.Parent) {
+        if (DirContext->Listing == NULL && UserMappingOverlap.Parent) {
 
             Status = NcEnumerateDirectorySetupInjection( DirContext,
                                                          FltObjects,
@@ -1415,6 +1552,1237 @@ Return Value:
 
         DirContext->SearchString.Buffer = NULL;
     }
+
+    if (DirContext->Listing != NULL) {
+
+        NcDirListingRelease( DirContext->Listing );
+        DirContext->Listing = NULL;
+    }
+}
+
+ULONG
+NcCopyDirListingEntries (
+    _Inout_ PNC_DIR_QRY_CONTEXT DirContext,
+    _Out_writes_bytes_(UserSize) PVOID UserBuffer,
+    _In_ ULONG UserSize,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ BOOLEAN Single,
+    _Out_ PULONG NumEntriesCopied,
+    _Out_ PULONG LastEntryStart
+    )
+/*++
+
+Routine Description:
+
+    Copies as many entries as fit from the cached merged listing attached
+    to this handle into the caller's buffer.  This may raise if the caller's
+    buffer is invalid.
+
+Arguments:
+
+    DirContext - Pointer to the directory context.  Its Listing must be set.
+
+    UserBuffer - Pointer to the caller's buffer.
+
+    UserSize - Size of the caller's buffer, in bytes.
+
+    Offsets - Information describing the offsets for this enumeration class.
+
+    Single - TRUE if the caller asked for a single entry.
+
+    NumEntriesCopied - Receives the number of entries copied.
+
+    LastEntryStart - Receives the offset in the caller's buffer of the last
+        entry copied.  Only meaningful if an entry was copied.
+
+Return Value:
+
+    The number of bytes written to the caller's buffer.
+
+--*/
+{
+    PNC_DIR_LISTING Listing = DirContext->Listing;
+    ULONG UserOffset = 0;
+    ULONG ElementSize;
+    PVOID Element;
+    PVOID Dest;
+
+    PAGED_CODE();
+
+    *NumEntriesCopied = 0;
+    *LastEntryStart = 0;
+
+    while (DirContext->ListingOffset < Listing->Length) {
+
+        Element = Add2Ptr( Listing->Buffer, DirContext->ListingOffset );
+        ElementSize = NcGetEntrySize( Element, Offsets );
+
+        if (UserSize - UserOffset < ElementSize) {
+
+            //
+            //  User buffer does not have enough space.
+            //
+
+            break;
+        }
+
+        Dest = Add2Ptr( UserBuffer, UserOffset );
+        RtlCopyMemory( Dest, Element, ElementSize );
+
+        //
+        //  The last entry in the listing has a NextEntryOffset of 0, make
+        //  sure that we report the actual next entry offset.  Our caller
+        //  terminates the buffer.
+        //
+
+        NcSetNextEntryOffset( Dest, Offsets, FALSE );
+
+        *LastEntryStart = UserOffset;
+        UserOffset += ElementSize;
+        DirContext->ListingOffset += ElementSize;
+        *NumEntriesCopied += 1;
+
+        if (Single) {
+
+            break;
+        }
+    }
+
+    return UserOffset;
+}
+
+NTSTATUS
+NcDirCacheInit (
+    _Out_ PNC_DIR_CACHE Cache,
+    _In_ PFLT_INSTANCE Instance
+    )
+/*++
+
+Routine Description:
+
+    Initializes an instance's cache of merged directory listings.
+
+Arguments:
+
+    Cache - Pointer to the cache to initialize.  It must be nonpaged.
+
+    Instance - The instance the cache belongs to.
+
+Return Value:
+
+    The return value is the Status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    InitializeListHead( &Cache->Listings );
+    Cache->Lock = NULL;
+    Cache->Count = 0;
+    Cache->Disabled = FALSE;
+    Cache->Instance = Instance;
+    Cache->ExpiryTimerStarted = FALSE;
+    KeInitializeTimer( &Cache->ExpiryTimer );
+    KeInitializeDpc( &Cache->ExpiryDpc, NcDirCacheExpiryDpc, Cache );
+
+    return NcAllocateEResource( &Cache->Lock );
+}
+
+VOID
+NcDirCacheTeardown (
+    _Inout_ PNC_DIR_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Frees the resources of an instance's listing cache.  Listings must
+    already have been purged, which happens when the instance starts
+    tearing down.
+
+Arguments:
+
+    Cache - Pointer to the cache to tear down.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Cache->Lock != NULL) {
+
+        FLT_ASSERT( IsListEmpty( &Cache->Listings ) );
+        FLT_ASSERT( !Cache->ExpiryTimerStarted );
+
+        NcFreeEResource( Cache->Lock );
+        Cache->Lock = NULL;
+    }
+}
+
+VOID
+NcDirCachePurge (
+    _Inout_ PNC_DIR_CACHE Cache,
+    _In_ BOOLEAN Disable
+    )
+/*++
+
+Routine Description:
+
+    Removes stale and expired listings from the cache, or all of them if
+    the cache is being disabled.  Watchers of removed listings are stopped;
+    handles still draining a removed listing keep their reference to it.
+
+Arguments:
+
+    Cache - Pointer to the cache to purge.
+
+    Disable - If TRUE, every listing is removed and nothing will be cached
+        from here on.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    LIST_ENTRY Removed;
+    PLIST_ENTRY Entry;
+    PLIST_ENTRY Next;
+    PNC_DIR_LISTING Listing;
+    ULONGLONG Now = KeQueryInterruptTime();
+    BOOLEAN StopTimer = FALSE;
+
+    PAGED_CODE();
+
+    InitializeListHead( &Removed );
+
+    FltAcquireResourceExclusive( Cache->Lock );
+
+    if (Disable) {
+
+        Cache->Disabled = TRUE;
+        StopTimer = Cache->ExpiryTimerStarted;
+        Cache->ExpiryTimerStarted = FALSE;
+    }
+
+    for (Entry = Cache->Listings.Flink;
+         Entry != &Cache->Listings;
+         Entry = Next) {
+
+        Next = Entry->Flink;
+        Listing = CONTAINING_RECORD( Entry, NC_DIR_LISTING, Links );
+
+        if (Disable || Listing->Stale || Now >= Listing->Expires) {
+
+            RemoveEntryList( Entry );
+            InsertTailList( &Removed, Entry );
+            Cache->Count -= 1;
+        }
+    }
+
+    FltReleaseResource( Cache->Lock );
+
+    //
+    //  Once the timer is cancelled and its last DPC has run, no more
+    //  purges get queued.  One already queued finds the cache disabled.
+    //
+
+    if (StopTimer) {
+
+        KeCancelTimer( &Cache->ExpiryTimer );
+        KeFlushQueuedDpcs();
+    }
+
+    //
+    //  Stopping a watcher waits for its notification to complete, so do
+    //  it without holding the lock.
+    //
+
+    while (!IsListEmpty( &Removed )) {
+
+        Entry = RemoveHeadList( &Removed );
+        Listing = CONTAINING_RECORD( Entry, NC_DIR_LISTING, Links );
+
+        NcDirListingStopWatches( Listing );
+        NcDirListingRelease( Listing );
+    }
+}
+
+VOID
+NcDirCacheStaleWorker (
+    _In_ PFLT_GENERIC_WORKITEM WorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Queued when a listing goes stale, and periodically while listings are
+    cached, so that the directory handles of stale and expired listings are
+    closed promptly rather than when the directory is next enumerated.
+    Holding them open would otherwise keep a deleted directory around.
+
+Arguments:
+
+    WorkItem - The work item; freed here.
+
+    FltObject - The instance whose cache should be purged.
+
+    Context - Unused.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NTSTATUS Status;
+    PNC_INSTANCE_CONTEXT InstanceContext = NULL;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( Context );
+
+    Status = FltGetInstanceContext( (PFLT_INSTANCE) FltObject,
+                                    &InstanceContext );
+
+    if (NT_SUCCESS( Status )) {
+
+        NcDirCachePurge( &InstanceContext->DirCache, FALSE );
+        FltReleaseContext( InstanceContext );
+    }
+
+    FltFreeGenericWorkItem( WorkItem );
+}
+
+VOID
+NcDirCacheQueuePurge (
+    _In_ PFLT_INSTANCE Instance
+    )
+/*++
+
+Routine Description:
+
+    Queues NcDirCacheStaleWorker to purge an instance's cache.  If we
+    can't, the next lookup or the next expiry period will do it.  This may
+    be called at DPC level.
+
+Arguments:
+
+    Instance - The instance whose cache should be purged.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PFLT_GENERIC_WORKITEM WorkItem;
+    NTSTATUS Status;
+
+    WorkItem = FltAllocateGenericWorkItem();
+
+    if (WorkItem != NULL) {
+
+        Status = FltQueueGenericWorkItem( WorkItem,
+                                          Instance,
+                                          NcDirCacheStaleWorker,
+                                          DelayedWorkQueue,
+                                          NULL );
+
+        if (!NT_SUCCESS( Status )) {
+
+            FltFreeGenericWorkItem( WorkItem );
+        }
+    }
+}
+
+VOID
+NcDirCacheExpiryDpc (
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2
+    )
+/*++
+
+Routine Description:
+
+    Runs every NC_DIR_LISTING_MAX_AGE while listings are cached and queues
+    a purge, so a listing and its directory handles live at most about
+    twice that long even if its directory is never enumerated again.
+
+Arguments:
+
+    Dpc - The cache's expiry DPC.
+
+    DeferredContext - The cache.
+
+    SystemArgument1 - Unused.
+
+    SystemArgument2 - Unused.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PNC_DIR_CACHE Cache = (PNC_DIR_CACHE) DeferredContext;
+
+    UNREFERENCED_PARAMETER( Dpc );
+    UNREFERENCED_PARAMETER( SystemArgument1 );
+    UNREFERENCED_PARAMETER( SystemArgument2 );
+
+    _Analysis_assume_( Cache != NULL );
+
+    //
+    //  An unlocked look is fine; at worst we purge an empty cache, or wait
+    //  another period.
+    //
+
+    if (Cache->Count != 0) {
+
+        NcDirCacheQueuePurge( Cache->Instance );
+    }
+}
+
+PNC_DIR_LISTING
+NcDirCacheFindListing (
+    _In_ PNC_DIR_CACHE Cache,
+    _In_ PUNICODE_STRING DirectoryName,
+    _In_ PUNICODE_STRING SearchString,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_ ULONGLONG Now,
+    _Out_opt_ PBOOLEAN SawExpired
+    )
+/*++
+
+Routine Description:
+
+    Looks for a current listing with the given key.  The cache lock must
+    be held, shared or exclusive.
+
+Arguments:
+
+    Cache - The cache to search.
+
+    DirectoryName - Opened name of the directory.
+
+    SearchString - Upcased search string; may be empty.
+
+    InformationClass - The information class.
+
+    Now - The current interrupt time.
+
+    SawExpired - If present, set to TRUE if a stale or expired listing was
+        passed over, so the caller knows a purge is due.
+
+Return Value:
+
+    The listing, unreferenced, or NULL if there is no current one.
+
+--*/
+{
+    PLIST_ENTRY Entry;
+    PNC_DIR_LISTING Listing;
+
+    PAGED_CODE();
+
+    if (ARGUMENT_PRESENT( SawExpired )) {
+
+        *SawExpired = FALSE;
+    }
+
+    for (Entry = Cache->Listings.Flink;
+         Entry != &Cache->Listings;
+         Entry = Entry->Flink) {
+
+        Listing = CONTAINING_RECORD( Entry, NC_DIR_LISTING, Links );
+
+        if (Listing->Stale || Now >= Listing->Expires) {
+
+            if (ARGUMENT_PRESENT( SawExpired )) {
+
+                *SawExpired = TRUE;
+            }
+
+            continue;
+        }
+
+        if (Listing->InformationClass == InformationClass &&
+            RtlEqualUnicodeString( &Listing->SearchString, SearchString, FALSE ) &&
+            RtlEqualUnicodeString( &Listing->DirectoryName, DirectoryName, TRUE )) {
+
+            return Listing;
+        }
+    }
+
+    return NULL;
+}
+
+PNC_DIR_LISTING
+NcDirCacheReferenceListing (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ PUNICODE_STRING DirectoryName,
+    _In_ PUNICODE_STRING SearchString,
+    _In_ FILE_INFORMATION_CLASS InformationClass,
+    _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap
+    )
+/*++
+
+Routine Description:
+
+    Finds a current merged listing for this directory, search string and
+    information class.  If none is cached, one is built and, if it is still
+    current once built, cached for the next enumeration.
+
+Arguments:
+
+    InstanceContext - Instance Context for this operation.
+
+    FltObjects - FltObjects structure for this operation.
+
+    Offsets - Offsets structure for this information class.
+
+    DirectoryName - Opened name of the directory being enumerated.
+
+    SearchString - Upcased search string for this enumeration; may be
+        empty.
+
+    InformationClass - The information class for this enumeration.
+
+    UserMappingOverlap - The overlap between the user mapping and the
+        directory.
+
+    RealMappingOverlap - The overlap between the real mapping and the
+        directory.
+
+Return Value:
+
+    A referenced listing, which the caller releases with
+    NcDirListingRelease, or NULL if no listing could be obtained.  NULL is
+    not an error; the caller merges the enumeration itself.
+
+--*/
+{
+    NTSTATUS Status;
+    PNC_DIR_CACHE Cache = &InstanceContext->DirCache;
+    PNC_DIR_LISTING Listing = NULL;
+    PNC_DIR_LISTING Existing;
+    PNC_DIR_LISTING Evicted = NULL;
+    PLIST_ENTRY Entry;
+    ULONG ListingSize;
+    ULONGLONG Now = KeQueryInterruptTime();
+    LARGE_INTEGER DueTime;
+    BOOLEAN SawExpired;
+    BOOLEAN Disabled;
+    BOOLEAN Publish;
+
+    PAGED_CODE();
+
+    if (DirectoryName->Length == 0 ||
+        (ULONG) DirectoryName->Length + SearchString->Length > MAXUSHORT) {
+
+        return NULL;
+    }
+
+    //
+    //  Lookups only read the list, so concurrent enumerations share the
+    //  lock.  Stale and expired listings are skipped here and only purged
+    //  once we have come across one.
+    //
+
+    FltAcquireResourceShared( Cache->Lock );
+
+    Listing = NcDirCacheFindListing( Cache,
+                                     DirectoryName,
+                                     SearchString,
+                                     InformationClass,
+                                     Now,
+                                     &SawExpired );
+
+    if (Listing != NULL) {
+
+        InterlockedIncrement( &Listing->RefCount );
+        InterlockedExchange64( &Listing->LastUsed, (LONG64) Now );
+    }
+
+    Disabled = Cache->Disabled;
+
+    FltReleaseResource( Cache->Lock );
+
+    if (SawExpired) {
+
+        NcDirCachePurge( Cache, FALSE );
+    }
+
+    if (Listing != NULL || Disabled) {
+
+        return Listing;
+    }
+
+    //
+    //  Nothing cached; build a new listing.  The header holds events which
+    //  are signalled from completion routines, so it must be nonpaged.
+    //  The key strings are stored after it.
+    //
+
+    ListingSize = sizeof( NC_DIR_LISTING ) +
+                  DirectoryName->Length +
+                  SearchString->Length;
+
+    Listing = ExAllocatePoolWithTag( NonPagedPool,
+                                     ListingSize,
+                                     NC_DIR_LISTING_TAG );
+
+    if (Listing == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( Listing, sizeof( NC_DIR_LISTING ) );
+
+    //
+    //  The caller's reference.
+    //
+
+    Listing->RefCount = 1;
+    Listing->Instance = FltObjects->Instance;
+    Listing->InformationClass = InformationClass;
+    Listing->Expires = Now + NC_DIR_LISTING_MAX_AGE;
+    Listing->LastUsed = (LONG64) Now;
+
+    Listing->DirectoryName.Buffer = Add2Ptr( Listing, sizeof( NC_DIR_LISTING ));
+    Listing->DirectoryName.MaximumLength = DirectoryName->Length;
+    RtlCopyUnicodeString( &Listing->DirectoryName, DirectoryName );
+
+    if (SearchString->Length > 0) {
+
+        Listing->SearchString.Buffer = Add2Ptr( Listing->DirectoryName.Buffer,
+                                                DirectoryName->Length );
+        Listing->SearchString.MaximumLength = SearchString->Length;
+        RtlCopyUnicodeString( &Listing->SearchString, SearchString );
+    }
+
+    Status = NcDirListingBuild( InstanceContext,
+                                FltObjects,
+                                Offsets,
+                                UserMappingOverlap,
+                                RealMappingOverlap,
+                                Listing );
+
+    if (!NT_SUCCESS( Status )) {
+
+        NcDirListingStopWatches( Listing );
+        NcDirListingRelease( Listing );
+        return NULL;
+    }
+
+    //
+    //  Publish the listing, unless the directory changed while we were
+    //  scanning it or another thread got there first.  Either way the
+    //  caller can still drain what we built, just as if it had merged the
+    //  enumeration itself.
+    //
+
+    FltAcquireResourceExclusive( Cache->Lock );
+
+    Now = KeQueryInterruptTime();
+
+    Publish = (BOOLEAN) (!Cache->Disabled &&
+                         !Listing->Stale &&
+                         NcDirCacheFindListing( Cache,
+                                                DirectoryName,
+                                                SearchString,
+                                                InformationClass,
+                                                Now,
+                                                NULL ) == NULL);
+
+    if (Publish) {
+
+        //
+        //  The cache's reference.
+        //
+
+        InterlockedIncrement( &Listing->RefCount );
+        InsertHeadList( &Cache->Listings, &Listing->Links );
+        Cache->Count += 1;
+
+        //
+        //  If the cache is full, evict a stale or expired listing, or else
+        //  the least recently used one.
+        //
+
+        if (Cache->Count > NC_DIR_LISTING_MAX_COUNT) {
+
+            for (Entry = Listing->Links.Flink;
+                 Entry != &Cache->Listings;
+                 Entry = Entry->Flink) {
+
+                Existing = CONTAINING_RECORD( Entry, NC_DIR_LISTING, Links );
+
+                if (Existing->Stale || Now >= Existing->Expires) {
+
+                    Evicted = Existing;
+                    break;
+                }
+
+                if (Evicted == NULL || Existing->LastUsed < Evicted->LastUsed) {
+
+                    Evicted = Existing;
+                }
+            }
+
+            RemoveEntryList( &Evicted->Links );
+            Cache->Count -= 1;
+        }
+
+        //
+        //  Make sure expired listings get purged even if nobody looks.
+        //
+
+        if (!Cache->ExpiryTimerStarted) {
+
+            Cache->ExpiryTimerStarted = TRUE;
+
+            DueTime.QuadPart = -NC_DIR_LISTING_MAX_AGE;
+
+            KeSetTimerEx( &Cache->ExpiryTimer,
+                          DueTime,
+                          (LONG) (NC_DIR_LISTING_MAX_AGE / (10 * 1000)),
+                          &Cache->ExpiryDpc );
+        }
+    }
+
+    FltReleaseResource( Cache->Lock );
+
+    if (!Publish) {
+
+        NcDirListingStopWatches( Listing );
+    }
+
+    if (Evicted != NULL) {
+
+        NcDirListingStopWatches( Evicted );
+        NcDirListingRelease( Evicted );
+    }
+
+    return Listing;
+}
+
+NTSTATUS
+NcDirListingBuild (
+    _In_ PNC_INSTANCE_CONTEXT InstanceContext,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDIRECTORY_CONTROL_OFFSETS Offsets,
+    _In_ NC_PATH_OVERLAP UserMappingOverlap,
+    _In_ NC_PATH_OVERLAP RealMappingOverlap,
+    _Inout_ PNC_DIR_LISTING Listing
+    )
+/*++
+
+Routine Description:
+
+    Fills in a listing by merging the directory's entries with the user
+    mapping, exactly as NcEnumerateDirectory does for a single handle.
+
+    Watchers are armed before the directory is scanned, so any change made
+    during or after the scan marks the listing stale.
+
+Arguments:
+
+    InstanceContext - Instance Context for this operation.
+
+    FltObjects - FltObjects structure for this operation.
+
+    Offsets - Offsets structure for this information class.
+
+    UserMappingOverlap - The overlap between the user mapping and the
+        directory.
+
+    RealMappingOverlap - The overlap between the real mapping and the
+        directory.
+
+    Listing - The listing to fill in.  Its key must be set up.  On failure
+        the caller stops any watchers that were armed.
+
+Return Value:
+
+    Returns STATUS_SUCCESS on success, otherwise an appropriate error code.
+
+--*/
+{
+    NTSTATUS Status;
+    NC_DIR_QRY_CONTEXT MergeContext;
+    PNC_CACHE_ENTRY NextEntry;
+    PUNICODE_STRING RealParentPath = &InstanceContext->Mapping.RealMapping.LongNamePath.ParentPath;
+    PVOID Buffer = NULL;
+    PVOID NewBuffer;
+    ULONG BufferSize = 0;
+    ULONG Length = 0;
+    ULONG LastEntryStart = 0;
+    ULONG ElementSize;
+    BOOLEAN Reset = TRUE;
+    BOOLEAN Copied;
+
+    PAGED_CODE();
+
+    NcStreamHandleContextDirEnumCreate( &MergeContext );
+    MergeContext.SearchString = Listing->SearchString;
+    MergeContext.InformationClass = Listing->InformationClass;
+
+    //
+    //  Watch the directory itself, and if we inject the user mapping, the
+    //  parent of the real mapping whose entry we inject.  The first watch
+    //  handle is also the one we enumerate.
+    //
+
+    Status = NcDirListingArmWatch( FltObjects->Instance,
+                                   &Listing->DirectoryName,
+                                   Listing );
+
+    if (!NT_SUCCESS( Status )) {
+
+        goto NcDirListingBuildCleanup;
+    }
+
+    if (UserMappingOverlap.Parent &&
+        !RtlEqualUnicodeString( RealParentPath, &Listing->DirectoryName, TRUE )) {
+
+        Status = NcDirListingArmWatch( FltObjects->Instance,
+                                       RealParentPath,
+                                       Listing );
+
+        if (!NT_SUCCESS( Status )) {
+
+            goto NcDirListingBuildCleanup;
+        }
+    }
+
+    if (UserMappingOverlap.Parent) {
+
+        Status = NcEnumerateDirectorySetupInjection( &MergeContext,
+                                                     FltObjects,
+                                                     InstanceContext,
+                                                     Offsets,
+                                                     Listing->InformationClass );
+
+        if (!NT_SUCCESS( Status )) {
+
+            goto NcDirListingBuildCleanup;
+        }
+    }
+
+    for (;;) {
+
+        if (MergeContext.Cache.Buffer == NULL) {
+
+            Status = NcPopulateCacheEntry( FltObjects->Instance,
+                                           Listing->Watch[0].FileObject,
+                                           NC_DIR_LISTING_QUERY_SIZE,
+                                           Listing->InformationClass,
+                                           &MergeContext.SearchString,
+                                           Reset,
+                                           &MergeContext.Cache );
+
+            Reset = FALSE;
+
+            if (!NT_SUCCESS( Status )) {
+
+                goto NcDirListingBuildCleanup;
+            }
+        }
+
+        NextEntry = NcDirEnumSelectNextEntry( &MergeContext, Offsets, TRUE );
+
+        if (NextEntry == NULL) {
+
+            break;
+        }
+
+        if (NcSkipName( Offsets,
+                        &MergeContext,
+                        RealMappingOverlap,
+                        &InstanceContext->Mapping,
+                        TRUE )) {
+
+            continue;
+        }
+
+        //
+        //  Make sure the next entry fits, growing the listing if needed.
+        //
+
+        ElementSize = NcGetEntrySize( Add2Ptr( NextEntry->Buffer, NextEntry->CurrentOffset ),
+                                      Offsets );
+
+        if (BufferSize - Length < ElementSize) {
+
+            if (BufferSize >= NC_DIR_LISTING_MAX_SIZE) {
+
+                //
+                //  Too big to be worth caching.
+                //
+
+                Status = STATUS_BUFFER_OVERFLOW;
+                goto NcDirListingBuildCleanup;
+            }
+
+            NewBuffer = ExAllocatePoolWithTag( PagedPool,
+                                               BufferSize == 0 ? NC_DIR_LISTING_INITIAL_SIZE : BufferSize * 2,
+                                               NC_DIR_LISTING_TAG );
+
+            if (NewBuffer == NULL) {
+
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto NcDirListingBuildCleanup;
+            }
+
+            if (Buffer != NULL) {
+
+                RtlCopyMemory( NewBuffer, Buffer, Length );
+                ExFreePoolWithTag( Buffer, NC_DIR_LISTING_TAG );
+            }
+
+            Buffer = NewBuffer;
+            BufferSize = BufferSize == 0 ? NC_DIR_LISTING_INITIAL_SIZE : BufferSize * 2;
+        }
+
+        LastEntryStart = Length;
+        Length = NcCopyDirEnumEntry( Buffer,
+                                     Length,
+                                     BufferSize,
+                                     NextEntry,
+                                     Offsets,
+                                     &Copied );
+
+        FLT_ASSERT( Copied );
+    }
+
+    if (Length > 0) {
+
+        NcSetNextEntryOffset( Add2Ptr( Buffer, LastEntryStart ),
+                              Offsets,
+                              TRUE );
+    }
+
+    Listing->Buffer = Buffer;
+    Listing->Length = Length;
+    Buffer = NULL;
+
+    Status = STATUS_SUCCESS;
+
+NcDirListingBuildCleanup:
+
+    if (Buffer != NULL) {
+
+        ExFreePoolWithTag( Buffer, NC_DIR_LISTING_TAG );
+    }
+
+    //
+    //  The search string belongs to the listing; don't let the close
+    //  routine free it.
+    //
+
+    RtlInitEmptyUnicodeString( &MergeContext.SearchString, NULL, 0 );
+    NcStreamHandleContextEnumClose( &MergeContext );
+
+    return Status;
+}
+
+NTSTATUS
+NcDirListingArmWatch (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PUNICODE_STRING DirectoryName,
+    _Inout_ PNC_DIR_LISTING Listing
+    )
+/*++
+
+Routine Description:
+
+    Opens a directory and keeps a change notification pending against it.
+    When the notification completes, the listing is marked stale.  We don't
+    need to know what changed, so no notification buffer is supplied.
+
+Arguments:
+
+    Instance - Instance to open the directory on.  Our own requests are
+        only seen by filters below us.
+
+    DirectoryName - Full path of the directory to watch.
+
+    Listing - The listing which receives the new watcher.
+
+Return Value:
+
+    Returns STATUS_SUCCESS on success, otherwise an appropriate error code.
+
+--*/
+{
+    NTSTATUS Status;
+    OBJECT_ATTRIBUTES Attributes;
+    IO_STATUS_BLOCK StatusBlock;
+    PNC_DIR_LISTING_WATCH Watch;
+
+    PAGED_CODE();
+
+    FLT_ASSERT( Listing->WatchCount < NC_DIR_LISTING_MAX_WATCHES );
+
+    Watch = &Listing->Watch[Listing->WatchCount];
+
+    Watch->Listing = Listing;
+    Watch->Handle = NULL;
+    Watch->FileObject = NULL;
+    Watch->Request = NULL;
+    KeInitializeEvent( &Watch->Completed, NotificationEvent, FALSE );
+
+    //
+    //  Open case insensitively, since that is how listings are matched.
+    //  Share everything so we never get in the way of the user.
+    //
+
+    InitializeObjectAttributes( &Attributes,
+                                DirectoryName,
+                                OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE,
+                                NULL,
+                                NULL );
+
+    Status = NcCreateFileHelper( NcGlobalData.FilterHandle,                          // Filter
+                                 Instance,                                           // Instance
+                                 &Watch->Handle,                                     // Returned Handle
+                                 &Watch->FileObject,                                 // Returned FileObject
+                                 FILE_LIST_DIRECTORY|FILE_TRAVERSE,                  // Desired Access
+                                 &Attributes,                                        // object attributes
+                                 &StatusBlock,                                       // Returned IOStatusBlock
+                                 0,                                                  // Allocation Size
+                                 FILE_ATTRIBUTE_NORMAL,                              // File Attributes
+                                 FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, // Share Access
+                                 FILE_OPEN,                                          // Create Disposition
+                                 FILE_DIRECTORY_FILE,                                // Create Options
+                                 NULL,                                               // Ea Buffer
+                                 0,                                                  // EA Length
+                                 IO_IGNORE_SHARE_ACCESS_CHECK,                       // Flags
+                                 NULL );                                             // Transaction state
+
+    if (!NT_SUCCESS( Status )) {
+
+        goto NcDirListingArmWatchCleanup;
+    }
+
+    Status = FltAllocateCallbackData( Instance,
+                                      Watch->FileObject,
+                                      &Watch->Request );
+
+    if (!NT_SUCCESS( Status )) {
+
+        goto NcDirListingArmWatchCleanup;
+    }
+
+    Watch->Request->Iopb->MajorFunction = IRP_MJ_DIRECTORY_CONTROL;
+    Watch->Request->Iopb->MinorFunction = IRP_MN_NOTIFY_CHANGE_DIRECTORY;
+    Watch->Request->Iopb->OperationFlags = 0;
+    Watch->Request->Iopb->Parameters.DirectoryControl.NotifyDirectory.Length = 0;
+    Watch->Request->Iopb->Parameters.DirectoryControl.NotifyDirectory.DirectoryBuffer = NULL;
+    Watch->Request->Iopb->Parameters.DirectoryControl.NotifyDirectory.CompletionFilter = NC_DIR_LISTING_NOTIFY_FILTER;
+    Watch->Request->Iopb->Parameters.DirectoryControl.NotifyDirectory.Spare1 = 0;
+    Watch->Request->Iopb->Parameters.DirectoryControl.NotifyDirectory.Spare2 = 0;
+    Watch->Request->Iopb->Parameters.DirectoryControl.NotifyDirectory.MdlAddress = NULL;
+
+    //
+    //  Once the request is sent, whether the file system completes it right
+    //  away or later, Fltmgr calls our completion routine, which marks the
+    //  listing stale and signals the event we wait on when stopping the
+    //  watcher.  If it can't be sent at all, our completion routine is never
+    //  called: signal the event ourselves and give the watcher up, so the
+    //  listing isn't built on a directory nobody is watching.
+    //
+
+    Status = FltPerformAsynchronousIo( Watch->Request,
+                                       NcDirListingWatchComplete,
+                                       Watch );
+
+    if (!NT_SUCCESS( Status )) {
+
+        KeSetEvent( &Watch->Completed, IO_NO_INCREMENT, FALSE );
+        goto NcDirListingArmWatchCleanup;
+    }
+
+    //
+    //  From here on the watcher belongs to the listing.
+    //
+
+    Listing->WatchCount += 1;
+
+    return STATUS_SUCCESS;
+
+NcDirListingArmWatchCleanup:
+
+    if (Watch->Request != NULL) {
+
+        FltFreeCallbackData( Watch->Request );
+        Watch->Request = NULL;
+    }
+
+    if (Watch->Handle != NULL) {
+
+        FltClose( Watch->Handle );
+        Watch->Handle = NULL;
+    }
+
+    if (Watch->FileObject != NULL) {
+
+        ObDereferenceObject( Watch->FileObject );
+        Watch->FileObject = NULL;
+    }
+
+    return Status;
+}
+
+VOID
+NcDirListingWatchComplete (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PVOID CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    Completion routine for a listing's change notification.  Something in
+    the watched directory changed (or the watch is being torn down), so the
+    listing may no longer be served.  This may be called at DPC level.
+
+Arguments:
+
+    Data - The completed change notification.
+
+    CompletionContext - The watcher.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PNC_DIR_LISTING_WATCH Watch = (PNC_DIR_LISTING_WATCH) CompletionContext;
+    PNC_DIR_LISTING Listing = Watch->Listing;
+
+    UNREFERENCED_PARAMETER( Data );
+
+    if (InterlockedExchange( &Listing->Stale, TRUE ) == FALSE) {
+
+        //
+        //  First to notice.  Ask for the cache to be purged so that our
+        //  handles are closed.
+        //
+
+        NcDirCacheQueuePurge( Listing->Instance );
+    }
+
+    //
+    //  This must be last; once it is signalled the listing may be freed.
+    //
+
+    KeSetEvent( &Watch->Completed, IO_NO_INCREMENT, FALSE );
+}
+
+VOID
+NcDirListingStopWatches (
+    _Inout_ PNC_DIR_LISTING Listing
+    )
+/*++
+
+Routine Description:
+
+    Stops and frees a listing's watchers.  Closing our handle completes
+    the pending change notification, which we then wait for.
+
+Arguments:
+
+    Listing - The listing whose watchers should be stopped.  It must not be
+        in the cache.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PNC_DIR_LISTING_WATCH Watch;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    //
+    //  Mark the listing stale first so the completion routines don't ask
+    //  for a purge on our behalf.
+    //
+
+    InterlockedExchange( &Listing->Stale, TRUE );
+
+    for (Index = 0; Index < Listing->WatchCount; Index++) {
+
+        Watch = &Listing->Watch[Index];
+
+        FltClose( Watch->Handle );
+        Watch->Handle = NULL;
+
+        KeWaitForSingleObject( &Watch->Completed,
+                               Executive,
+                               KernelMode,
+                               FALSE,
+                               NULL );
+
+        FltFreeCallbackData( Watch->Request );
+        Watch->Request = NULL;
+
+        ObDereferenceObject( Watch->FileObject );
+        Watch->FileObject = NULL;
+    }
+
+    Listing->WatchCount = 0;
+}
+
+VOID
+NcDirListingRelease (
+    _In_ PNC_DIR_LISTING Listing
+    )
+/*++
+
+Routine Description:
+
+    Drops a reference on a listing, freeing it with the last reference.
+
+Arguments:
+
+    Listing - The listing to release.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (InterlockedDecrement( &Listing->RefCount ) == 0) {
+
+        FLT_ASSERT( Listing->WatchCount == 0 );
+
+        if (Listing->Buffer != NULL) {
+
+            ExFreePoolWithTag( Listing->Buffer, NC_DIR_LISTING_TAG );
+        }
+
+        ExFreePoolWithTag( Listing, NC_DIR_LISTING_TAG );
+    }
 }
 
 
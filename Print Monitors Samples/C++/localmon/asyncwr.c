@@ -0,0 +1,404 @@
+/*++
+
+Copyright (c) 1997-2003  Microsoft Corporation
+All rights reserved
+
+Module Name:
+
+    asyncwr.c
+
+Abstract:
+
+    Coalescing overlapped writer for file ports and for ports that are
+    opened by name (a file or UNC path). Spooler writes are copied into a
+    small ring of large buffers and every full buffer is sent with an
+    overlapped WriteFile, so several device writes are in flight while the
+    spooler thread carries on. WritePort only waits when every buffer is in
+    flight, and then for no longer than the transmission retry timeout.
+    EndDocPort waits for each write in flight just as long, and cancels them
+    and fails the job if the device stops taking data.
+
+--*/
+
+#include "precomp.h"
+
+
+#pragma hdrstop
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_driver_)
+
+#include "asyncwr.h"
+
+#pragma prefast (push)
+#pragma prefast( disable:28159 "Usermode program can not use 'KeQueryTickCount' in ddk library")
+VOID
+AsyncUpdateStats(
+    _Inout_ PLCMINIPORT    pIniPort
+    )
+{
+    PLCM_ASYNC_WRITER   pWriter     = pIniPort->pWriter;
+    DWORD               dwElapsed   = GetTickCount() - pWriter->dwBeginTime;
+    ULONGLONG           cbPerSecond = 0;
+
+
+    if ( dwElapsed )
+        cbPerSecond = (pWriter->cbWritten * 1000) / dwElapsed;
+
+    LcmEnterSplSem();
+
+    pIniPort->WriteStats.cbWritten   = pWriter->cbWritten;
+    pIniPort->WriteStats.cbPerSecond = cbPerSecond > MAXDWORD ?
+                                                MAXDWORD : (DWORD)cbPerSecond;
+    pIniPort->WriteStats.cQueued     = pWriter->cPending;
+
+    if ( pWriter->cPending > pIniPort->WriteStats.cMaxQueued )
+        pIniPort->WriteStats.cMaxQueued = pWriter->cPending;
+
+    LcmLeaveSplSem();
+}
+#pragma prefast (pop)
+
+
+BOOL
+AsyncIssueWrite(
+    _Inout_ PLCM_ASYNC_WRITER  pWriter,
+    _In_    HANDLE             hFile,
+    _Inout_ PASYNC_BUFFER      pBuffer
+    )
+{
+    ULARGE_INTEGER  Offset;
+
+
+    //
+    // The handle is opened for overlapped I/O so there is no file pointer,
+    // every write says where it goes
+    //
+    Offset.QuadPart = pWriter->Offset;
+
+    pBuffer->Overlapped.Internal     = 0;
+    pBuffer->Overlapped.InternalHigh = 0;
+    pBuffer->Overlapped.Offset       = Offset.LowPart;
+    pBuffer->Overlapped.OffsetHigh   = Offset.HighPart;
+
+    ResetEvent(pBuffer->Overlapped.hEvent);
+
+    if ( !WriteFile(hFile, pBuffer->pBuf, pBuffer->cbData, NULL,
+                    &pBuffer->Overlapped) &&
+         GetLastError() != ERROR_IO_PENDING ) {
+
+        pWriter->dwError = GetLastError();
+        return FALSE;
+    }
+
+    //
+    // A write that completed straight away has set the event, it is picked
+    // up like any other
+    //
+    pBuffer->bPending  = TRUE;
+    pWriter->Offset   += pBuffer->cbData;
+    pWriter->cPending += 1;
+
+    return TRUE;
+}
+
+
+DWORD
+AsyncCompleteWrite(
+    _Inout_ PLCM_ASYNC_WRITER  pWriter,
+    _In_    HANDLE             hFile,
+    _Inout_ PASYNC_BUFFER      pBuffer,
+            DWORD              dwTimeout
+    )
+{
+    DWORD   dwRet       = ERROR_SUCCESS;
+    DWORD   cbWritten   = 0;
+
+
+    dwRet = WaitForSingleObject(pBuffer->Overlapped.hEvent, dwTimeout);
+
+    if ( dwRet != WAIT_OBJECT_0 ) {
+
+        //
+        // The write is still in flight, leave the buffer alone
+        //
+        return dwRet == WAIT_TIMEOUT ? ERROR_TIMEOUT : GetLastError();
+    }
+
+    if ( !GetOverlappedResult(hFile, &pBuffer->Overlapped, &cbWritten, FALSE) )
+        dwRet = GetLastError();
+    else if ( cbWritten != pBuffer->cbData )
+        dwRet = ERROR_WRITE_FAULT;
+    else
+        dwRet = ERROR_SUCCESS;
+
+    pWriter->cbWritten += cbWritten;
+    pWriter->cPending  -= 1;
+
+    pBuffer->bPending = FALSE;
+    pBuffer->cbData   = 0;
+
+    if ( dwRet != ERROR_SUCCESS && pWriter->dwError == ERROR_SUCCESS )
+        pWriter->dwError = dwRet;
+
+    return dwRet;
+}
+
+
+VOID
+AsyncFreeWriter(
+    _Inout_ PLCMINIPORT    pIniPort
+    )
+{
+    PLCM_ASYNC_WRITER   pWriter = pIniPort->pWriter;
+    DWORD               i       = 0;
+
+
+    for ( i = 0 ; i < ASYNC_BUFFER_COUNT ; ++i ) {
+
+        SPLASSERT(!pWriter->Buffers[i].bPending);
+
+        if ( pWriter->Buffers[i].Overlapped.hEvent )
+            CloseHandle(pWriter->Buffers[i].Overlapped.hEvent);
+
+        FreeSplMem(pWriter->Buffers[i].pBuf);
+    }
+
+    FreeSplMem(pWriter);
+    pIniPort->pWriter = NULL;
+}
+
+
+#pragma prefast (push)
+#pragma prefast( disable:28159 "Usermode program can not use 'KeQueryTickCount' in ddk library")
+BOOL
+AsyncStartDocPort(
+    _Inout_ PLCMINIPORT    pIniPort
+    )
+{
+    PLCM_ASYNC_WRITER   pWriter = NULL;
+    DWORD               i       = 0;
+
+
+    SPLASSERT(pIniPort->pWriter == NULL);
+
+    pWriter = (PLCM_ASYNC_WRITER)AllocSplMem(sizeof(LCM_ASYNC_WRITER));
+
+    if ( !pWriter )
+        return FALSE;
+
+    pIniPort->pWriter = pWriter;
+
+    for ( i = 0 ; i < ASYNC_BUFFER_COUNT ; ++i ) {
+
+        pWriter->Buffers[i].pBuf = (LPBYTE)AllocSplMem(ASYNC_BUFFER_SIZE);
+        pWriter->Buffers[i].Overlapped.hEvent = CreateEvent(NULL, TRUE,
+                                                            FALSE, NULL);
+
+        if ( !pWriter->Buffers[i].pBuf ||
+             !pWriter->Buffers[i].Overlapped.hEvent ) {
+
+            AsyncFreeWriter(pIniPort);
+            return FALSE;
+        }
+    }
+
+    //
+    // How long a write may wait for the device to take a buffer. This is
+    // the same timeout LPT ports are given in StartDocPort
+    //
+    GetTransmissionRetryTimeoutFromRegistry(&pWriter->dwTimeout);
+
+    pWriter->dwTimeout   *= 1000;
+    pWriter->dwBeginTime  = GetTickCount();
+
+    LcmEnterSplSem();
+    ZeroMemory(&pIniPort->WriteStats, sizeof(pIniPort->WriteStats));
+    LcmLeaveSplSem();
+
+    return TRUE;
+}
+#pragma prefast (pop)
+
+
+BOOL
+AsyncWritePort(
+    _Inout_                  PLCMINIPORT pIniPort,
+    _In_reads_bytes_(cbBuf)  LPBYTE      pBuf,
+                             DWORD       cbBuf,
+    _Out_                    LPDWORD     pcbWritten
+    )
+{
+    PLCM_ASYNC_WRITER   pWriter     = pIniPort->pWriter;
+    PASYNC_BUFFER       pBuffer     = NULL;
+    DWORD               dwError     = ERROR_SUCCESS;
+    DWORD               cbCopy      = 0;
+    DWORD               iOldest     = 0;
+
+
+    *pcbWritten = 0;
+
+    //
+    // Once a write has failed the data it held is gone, so the job can not
+    // carry on
+    //
+    if ( pWriter->dwError ) {
+
+        dwError = pWriter->dwError;
+        goto Done;
+    }
+
+    while ( cbBuf ) {
+
+        pBuffer = &pWriter->Buffers[pWriter->iFill];
+
+        //
+        // Every buffer is in flight, this is the oldest. Wait for it to make
+        // room, this is what holds the spooler back when the device is slow
+        //
+        if ( pBuffer->bPending ) {
+
+            dwError = AsyncCompleteWrite(pWriter, pIniPort->hFile, pBuffer,
+                                         pWriter->dwTimeout);
+
+            if ( dwError != ERROR_SUCCESS )
+                break;
+        }
+
+        cbCopy = ASYNC_BUFFER_SIZE - pBuffer->cbData;
+
+        if ( cbCopy > cbBuf )
+            cbCopy = cbBuf;
+
+        CopyMemory(pBuffer->pBuf + pBuffer->cbData, pBuf, cbCopy);
+
+        pBuffer->cbData += cbCopy;
+        pBuf            += cbCopy;
+        cbBuf           -= cbCopy;
+        *pcbWritten     += cbCopy;
+
+        if ( pBuffer->cbData == ASYNC_BUFFER_SIZE ) {
+
+            if ( !AsyncIssueWrite(pWriter, pIniPort->hFile, pBuffer) ) {
+
+                dwError = pWriter->dwError;
+                break;
+            }
+
+            pWriter->iFill = (pWriter->iFill + 1) % ASYNC_BUFFER_COUNT;
+        }
+    }
+
+    //
+    // Pick up the writes that have already finished, oldest first, so the
+    // statistics and any error are current
+    //
+    while ( pWriter->cPending ) {
+
+        iOldest = (pWriter->iFill + ASYNC_BUFFER_COUNT - pWriter->cPending) %
+                                                            ASYNC_BUFFER_COUNT;
+
+        if ( AsyncCompleteWrite(pWriter, pIniPort->hFile,
+                                &pWriter->Buffers[iOldest], 0) == ERROR_TIMEOUT )
+            break;
+    }
+
+    AsyncUpdateStats(pIniPort);
+
+    //
+    // If the device did not take a buffer in time but some of this data was
+    // copied, tell spooler how much. It calls us again with the rest
+    //
+    if ( dwError == ERROR_TIMEOUT && *pcbWritten )
+        dwError = ERROR_SUCCESS;
+
+Done:
+    if ( dwError != ERROR_SUCCESS ) {
+
+        SetLastError(dwError);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+BOOL
+AsyncEndDocPort(
+    _Inout_ PLCMINIPORT    pIniPort
+    )
+{
+    PLCM_ASYNC_WRITER   pWriter = pIniPort->pWriter;
+    PASYNC_BUFFER       pBuffer = &pWriter->Buffers[pWriter->iFill];
+    DWORD               dwError = ERROR_SUCCESS;
+    DWORD               iOldest = 0;
+    DWORD               i       = 0;
+
+
+    //
+    // Send whatever is left in the buffer being filled
+    //
+    if ( !pWriter->dwError && !pBuffer->bPending && pBuffer->cbData ) {
+
+        if ( AsyncIssueWrite(pWriter, pIniPort->hFile, pBuffer) )
+            pWriter->iFill = (pWriter->iFill + 1) % ASYNC_BUFFER_COUNT;
+    }
+
+    //
+    // Wait for every write, in the order they were issued, so all the data
+    // has reached the device before the handle is flushed and closed. Each
+    // write gets the transmission retry timeout, as in WritePort
+    //
+    while ( pWriter->cPending ) {
+
+        iOldest = (pWriter->iFill + ASYNC_BUFFER_COUNT - pWriter->cPending) %
+                                                            ASYNC_BUFFER_COUNT;
+
+        if ( AsyncCompleteWrite(pWriter, pIniPort->hFile,
+                                &pWriter->Buffers[iOldest],
+                                pWriter->dwTimeout) == ERROR_TIMEOUT )
+            break;
+    }
+
+    //
+    // The device has not finished a write for the whole timeout, so a stalled
+    // UNC or pipe target can not hold EndDocPort and the job. Cancel what is
+    // still in flight and fail the job. The buffers belong to the writes
+    // until they complete, which a cancelled write does promptly
+    //
+    if ( pWriter->cPending ) {
+
+        if ( pWriter->dwError == ERROR_SUCCESS )
+            pWriter->dwError = ERROR_TIMEOUT;
+
+        for ( i = 0 ; i < ASYNC_BUFFER_COUNT ; ++i ) {
+
+            if ( pWriter->Buffers[i].bPending )
+                (VOID)CancelIoEx(pIniPort->hFile,
+                                 &pWriter->Buffers[i].Overlapped);
+        }
+
+        while ( pWriter->cPending ) {
+
+            iOldest = (pWriter->iFill + ASYNC_BUFFER_COUNT - pWriter->cPending) %
+                                                            ASYNC_BUFFER_COUNT;
+
+            (VOID)AsyncCompleteWrite(pWriter, pIniPort->hFile,
+                                     &pWriter->Buffers[iOldest], INFINITE);
+        }
+    }
+
+    AsyncUpdateStats(pIniPort);
+
+    dwError = pWriter->dwError;
+
+    AsyncFreeWriter(pIniPort);
+
+    if ( dwError != ERROR_SUCCESS ) {
+
+        SetLastError(dwError);
+        return FALSE;
+    }
+
+    return TRUE;
+}
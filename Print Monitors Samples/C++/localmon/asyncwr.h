@@ -0,0 +1,58 @@
+/*++
+
+Copyright (c) 1997-2003  Microsoft Corporation
+All rights reserved.
+
+Module Name:
+
+    asyncwr.h
+
+Abstract:
+
+    Definitions used by the coalescing overlapped port writer
+
+--*/
+#ifndef _ASYNCWR_H_
+#define _ASYNCWR_H_
+
+#define     ASYNC_BUFFER_SIZE   (256 * 1024)
+#define     ASYNC_BUFFER_COUNT  4
+
+
+typedef struct _ASYNC_BUFFER  {
+    OVERLAPPED      Overlapped;
+    LPBYTE          pBuf;
+    DWORD           cbData;
+    BOOL            bPending;
+} ASYNC_BUFFER, *PASYNC_BUFFER;
+
+typedef struct _LCM_ASYNC_WRITER  {
+    ULONGLONG       Offset;         // File offset of the next write
+    ULONGLONG       cbWritten;      // Bytes the device has accepted
+    DWORD           iFill;          // Buffer spooler data is copied into
+    DWORD           cPending;       // Writes in flight
+    DWORD           dwError;        // First error from a write, fails the job
+    DWORD           dwTimeout;      // How long WritePort waits for a buffer
+    DWORD           dwBeginTime;
+    ASYNC_BUFFER    Buffers[ASYNC_BUFFER_COUNT];
+} LCM_ASYNC_WRITER;
+
+BOOL
+AsyncStartDocPort(
+    _Inout_ PLCMINIPORT    pIniPort
+    );
+
+BOOL
+AsyncWritePort(
+    _Inout_                  PLCMINIPORT pIniPort,
+    _In_reads_bytes_(cbBuf)  LPBYTE      pBuf,
+                             DWORD       cbBuf,
+    _Out_                    LPDWORD     pcbWritten
+    );
+
+BOOL
+AsyncEndDocPort(
+    _Inout_ PLCMINIPORT    pIniPort
+    );
+
+#endif // _ASYNCWR_H_
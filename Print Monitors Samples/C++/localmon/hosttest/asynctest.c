@@ -0,0 +1,776 @@
+/*++
+
+Copyright (c) 1997-2003  Microsoft Corporation
+All rights reserved
+
+Module Name:
+
+    asynctest.c
+
+Abstract:
+
+    Host test of the coalescing overlapped port writer (../asyncwr.c), which
+    is built unchanged against the stand-ins in shim/. The Win32 calls it
+    makes are implemented here over a simulated device that only takes the
+    data of a write when the write completes, so a buffer that is reused
+    while its write is in flight shows up as corrupt output.
+
+    usage: asynctest [--jobs n]
+
+    The test checks that:
+
+    - Random jobs, written in random sized pieces to a device that completes
+      writes at once, late or only when waited for, reach the device
+      unchanged, in whole ASYNC_BUFFER_SIZE writes but the last, with up to
+      ASYNC_BUFFER_COUNT writes in flight and the statistics matching.
+
+    - WritePort waits the transmission retry timeout for a stalled device,
+      reports what it could copy and then ERROR_TIMEOUT.
+
+    - EndDocPort on a device that stops completing writes neither waits
+      without a timeout nor loses the writes that did complete; it cancels
+      the rest and fails with ERROR_TIMEOUT.
+
+    - A short write fails the rest of the job and EndDocPort.
+
+    Every check also looks for leaked memory and events and an unbalanced
+    spooler section.
+
+Environment:
+
+    Host (user mode), C99.
+
+--*/
+
+#include "precomp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "asyncwr.h"
+
+#define SOURCE_SIZE     (8 * 1024 * 1024)
+#define RETRY_TIMEOUT   45
+#define STATUS_CANCELLED 0xC0000120
+
+static int  g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if ( !(X) ) {                                                           \
+                                                                            \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+//
+// How the simulated device completes writes
+//
+typedef enum _SIM_MODE {
+    SimFast,        // Half the writes complete at once, the rest when waited
+    SimSlow,        // Writes only complete when waited for with a timeout
+    SimStall,       // From write iStallAt on, writes only complete if cancelled
+} SIM_MODE;
+
+typedef struct _SIM_EVENT {
+    BOOL            bSet;
+    BOOL            bInFlight;
+    DWORD           iWrite;
+    LPOVERLAPPED    pOverlapped;
+    LPBYTE          pBuf;
+    DWORD           cbBuf;
+} SIM_EVENT, *PSIM_EVENT;
+
+typedef struct _SIM_DEVICE {
+    SIM_MODE    Mode;
+    DWORD       iStallAt;
+    DWORD       iFailAt;            // This write only takes half its data
+    LPBYTE      pData;
+    ULONGLONG   cbData;
+    DWORD       cWrites;
+    DWORD       cFullWrites;        // Writes of exactly ASYNC_BUFFER_SIZE
+    DWORD       cInFlight;
+    DWORD       cMaxInFlight;
+    DWORD       cCancelled;
+    DWORD       cHangs;             // Waits that would never have returned
+    DWORD       cBadTimeouts;       // Waits with neither 0 nor the timeout
+} SIM_DEVICE, *PSIM_DEVICE;
+
+static SIM_DEVICE   g_Device;
+static DWORD        g_dwLastError;
+static DWORD        g_dwTickCount;
+static int          g_cAllocs;
+static int          g_cEvents;
+static int          g_cSplSem;
+
+static uint32_t     g_Seed = 49;
+
+static uint32_t
+Random(
+    VOID
+    )
+{
+    g_Seed ^= g_Seed << 13;
+    g_Seed ^= g_Seed >> 17;
+    g_Seed ^= g_Seed << 5;
+
+    return g_Seed;
+}
+
+
+VOID
+HostAssert(
+    const char *pszExpr,
+    const char *pszFile,
+    int         Line
+    )
+{
+    printf("%s(%d): assertion failed: %s\n", pszFile, Line, pszExpr);
+    g_failures++;
+}
+
+
+LPVOID
+AllocSplMem(
+    size_t  cbAlloc
+    )
+{
+    LPVOID  pMem = calloc(1, cbAlloc);
+
+
+    if ( pMem )
+        g_cAllocs++;
+
+    return pMem;
+}
+
+
+BOOL
+FreeSplMem(
+    LPVOID  pMem
+    )
+{
+    if ( pMem ) {
+
+        g_cAllocs--;
+        free(pMem);
+    }
+
+    return TRUE;
+}
+
+
+VOID
+LcmEnterSplSem(
+    VOID
+    )
+{
+    CHECK(g_cSplSem == 0);
+    g_cSplSem++;
+}
+
+
+VOID
+LcmLeaveSplSem(
+    VOID
+    )
+{
+    CHECK(g_cSplSem == 1);
+    g_cSplSem--;
+}
+
+
+VOID
+GetTransmissionRetryTimeoutFromRegistry(
+    DWORD  *pdwTimeout
+    )
+{
+    *pdwTimeout = RETRY_TIMEOUT;
+}
+
+
+DWORD
+GetTickCount(
+    VOID
+    )
+{
+    return g_dwTickCount += 7;
+}
+
+
+DWORD
+GetLastError(
+    VOID
+    )
+{
+    return g_dwLastError;
+}
+
+
+VOID
+SetLastError(
+    DWORD   dwError
+    )
+{
+    g_dwLastError = dwError;
+}
+
+
+HANDLE
+CreateEvent(
+    LPVOID  pSecurity,
+    BOOL    bManualReset,
+    BOOL    bInitialState,
+    LPVOID  pName
+    )
+{
+    PSIM_EVENT  pEvent = (PSIM_EVENT)calloc(1, sizeof(SIM_EVENT));
+
+
+    CHECK(bManualReset && !bInitialState && !pSecurity && !pName);
+
+    if ( pEvent )
+        g_cEvents++;
+
+    return pEvent;
+}
+
+
+BOOL
+ResetEvent(
+    HANDLE  hEvent
+    )
+{
+    ((PSIM_EVENT)hEvent)->bSet = FALSE;
+
+    return TRUE;
+}
+
+
+BOOL
+CloseHandle(
+    HANDLE  hObject
+    )
+{
+    PSIM_EVENT  pEvent = (PSIM_EVENT)hObject;
+
+
+    CHECK(!pEvent->bInFlight);
+
+    g_cEvents--;
+    free(pEvent);
+
+    return TRUE;
+}
+
+
+static VOID
+SimComplete(
+    PSIM_EVENT  pEvent,
+    BOOL        bCancelled
+    )
+
+/*++
+
+    The device takes the data of a write, or none of it if the write was
+    cancelled, and signals the write's event
+
+--*/
+
+{
+    PSIM_DEVICE     pDevice = &g_Device;
+    LPOVERLAPPED    pOverlapped = pEvent->pOverlapped;
+    ULONGLONG       Offset;
+    DWORD           cbDone = pEvent->cbBuf;
+
+
+    Offset = ((ULONGLONG)pOverlapped->OffsetHigh << 32) | pOverlapped->Offset;
+
+    if ( bCancelled ) {
+
+        cbDone = 0;
+        pDevice->cCancelled++;
+
+    } else if ( pEvent->iWrite == pDevice->iFailAt ) {
+
+        cbDone /= 2;
+    }
+
+    CHECK(Offset + cbDone <= SOURCE_SIZE);
+
+    if ( Offset + cbDone <= SOURCE_SIZE ) {
+
+        memcpy(pDevice->pData + Offset, pEvent->pBuf, cbDone);
+
+        if ( cbDone && Offset + cbDone > pDevice->cbData )
+            pDevice->cbData = Offset + cbDone;
+    }
+
+    pOverlapped->Internal     = bCancelled ? STATUS_CANCELLED : 0;
+    pOverlapped->InternalHigh = cbDone;
+
+    pEvent->bSet      = TRUE;
+    pEvent->bInFlight = FALSE;
+
+    pDevice->cInFlight--;
+}
+
+
+static BOOL
+SimIsStalled(
+    PSIM_EVENT  pEvent
+    )
+{
+    return (g_Device.Mode == SimStall) && (pEvent->iWrite >= g_Device.iStallAt);
+}
+
+
+BOOL
+WriteFile(
+    HANDLE          hFile,
+    LPVOID          pBuf,
+    DWORD           cbBuf,
+    LPDWORD         pcbWritten,
+    LPOVERLAPPED    pOverlapped
+    )
+{
+    PSIM_DEVICE     pDevice = (PSIM_DEVICE)hFile;
+    PSIM_EVENT      pEvent  = (PSIM_EVENT)pOverlapped->hEvent;
+
+
+    CHECK(pDevice == &g_Device);
+    CHECK(!pEvent->bSet && !pcbWritten);
+
+    //
+    // An OVERLAPPED, and its buffer, belong to the write until it completes
+    //
+    if ( pEvent->bInFlight ) {
+
+        printf("write %u issued again while in flight\n", (unsigned)pEvent->iWrite);
+        exit(1);
+    }
+
+    pEvent->bInFlight   = TRUE;
+    pEvent->iWrite      = pDevice->cWrites++;
+    pEvent->pOverlapped = pOverlapped;
+    pEvent->pBuf        = (LPBYTE)pBuf;
+    pEvent->cbBuf       = cbBuf;
+
+    if ( cbBuf == ASYNC_BUFFER_SIZE )
+        pDevice->cFullWrites++;
+
+    if ( ++pDevice->cInFlight > pDevice->cMaxInFlight )
+        pDevice->cMaxInFlight = pDevice->cInFlight;
+
+    if ( pDevice->Mode == SimFast && (Random() & 1) ) {
+
+        SimComplete(pEvent, FALSE);
+        return TRUE;
+    }
+
+    SetLastError(ERROR_IO_PENDING);
+    return FALSE;
+}
+
+
+DWORD
+WaitForSingleObject(
+    HANDLE  hHandle,
+    DWORD   dwMilliseconds
+    )
+{
+    PSIM_EVENT  pEvent = (PSIM_EVENT)hHandle;
+
+
+    if ( pEvent->bSet )
+        return WAIT_OBJECT_0;
+
+    if ( dwMilliseconds != 0 &&
+         dwMilliseconds != INFINITE &&
+         dwMilliseconds != RETRY_TIMEOUT * 1000 )
+        g_Device.cBadTimeouts++;
+
+    if ( !pEvent->bInFlight || SimIsStalled(pEvent) ) {
+
+        if ( dwMilliseconds != INFINITE )
+            return WAIT_TIMEOUT;
+
+        //
+        // The writer would hang here. Count it, and let the write finish so
+        // the test carries on
+        //
+        g_Device.cHangs++;
+
+        if ( !pEvent->bInFlight ) {
+
+            printf("wait for an event no write will ever set\n");
+            exit(1);
+        }
+    }
+
+    if ( dwMilliseconds == 0 &&
+         (g_Device.Mode != SimFast || (Random() % 3)) )
+        return WAIT_TIMEOUT;
+
+    SimComplete(pEvent, FALSE);
+
+    return WAIT_OBJECT_0;
+}
+
+
+BOOL
+GetOverlappedResult(
+    HANDLE          hFile,
+    LPOVERLAPPED    pOverlapped,
+    LPDWORD         pcbTransferred,
+    BOOL            bWait
+    )
+{
+    PSIM_EVENT  pEvent = (PSIM_EVENT)pOverlapped->hEvent;
+
+
+    CHECK(hFile == &g_Device && pEvent->bSet && !bWait);
+
+    *pcbTransferred = (DWORD)pOverlapped->InternalHigh;
+
+    if ( pOverlapped->Internal == STATUS_CANCELLED ) {
+
+        SetLastError(ERROR_OPERATION_ABORTED);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+BOOL
+CancelIoEx(
+    HANDLE          hFile,
+    LPOVERLAPPED    pOverlapped
+    )
+{
+    PSIM_EVENT  pEvent = (PSIM_EVENT)pOverlapped->hEvent;
+
+
+    CHECK(hFile == &g_Device);
+
+    if ( !pEvent->bInFlight ) {
+
+        SetLastError(ERROR_OPERATION_ABORTED);
+        return FALSE;
+    }
+
+    SimComplete(pEvent, TRUE);
+
+    return TRUE;
+}
+
+
+static VOID
+SimReset(
+    SIM_MODE    Mode,
+    DWORD       iStallAt,
+    DWORD       iFailAt,
+    PLCMINIPORT pIniPort
+    )
+{
+    LPBYTE  pData = g_Device.pData;
+
+
+    ZeroMemory(&g_Device, sizeof(g_Device));
+
+    g_Device.Mode     = Mode;
+    g_Device.iStallAt = iStallAt;
+    g_Device.iFailAt  = iFailAt;
+    g_Device.pData    = pData;
+
+    ZeroMemory(pIniPort, sizeof(*pIniPort));
+
+    pIniPort->hFile = &g_Device;
+}
+
+
+static VOID
+CheckNoLeaks(
+    PLCMINIPORT pIniPort
+    )
+{
+    CHECK(pIniPort->pWriter == NULL);
+    CHECK(g_cAllocs == 0);
+    CHECK(g_cEvents == 0);
+    CHECK(g_cSplSem == 0);
+    CHECK(g_Device.cInFlight == 0);
+    CHECK(g_Device.cHangs == 0);
+    CHECK(g_Device.cBadTimeouts == 0);
+}
+
+
+static VOID
+CheckRoundTrips(
+    LPBYTE  pSource,
+    int     cJobs
+    )
+
+/*++
+
+    Random jobs in random pieces reach the device unchanged and in whole
+    buffers
+
+--*/
+
+{
+    LCMINIPORT  IniPort;
+    int         Job;
+
+
+    for ( Job = 0 ; Job < cJobs ; ++Job ) {
+
+        SIM_MODE    Mode    = (Job % 3 == 0) ? SimSlow : SimFast;
+        DWORD       cbTotal = Random() % SOURCE_SIZE;
+        DWORD       cbDone  = 0;
+        DWORD       cbBuf   = 0;
+        DWORD       cbWritten = 0;
+
+        if ( Job % 5 == 0 )
+            cbTotal %= ASYNC_BUFFER_SIZE * 2;
+
+        SimReset(Mode, 0, MAXDWORD, &IniPort);
+
+        if ( !AsyncStartDocPort(&IniPort) ) {
+
+            CHECK(!"AsyncStartDocPort");
+            return;
+        }
+
+        while ( cbDone < cbTotal && !g_failures ) {
+
+            cbBuf = 1 + Random() % ((Random() & 3) ? 4096 : 600000);
+
+            if ( cbBuf > cbTotal - cbDone )
+                cbBuf = cbTotal - cbDone;
+
+            if ( !AsyncWritePort(&IniPort, pSource + cbDone, cbBuf, &cbWritten) ||
+                 !cbWritten ) {
+
+                printf("job %d: WritePort failed at %u, error %u\n",
+                       Job, (unsigned)cbDone, (unsigned)g_dwLastError);
+                g_failures++;
+                break;
+            }
+
+            cbDone += cbWritten;
+        }
+
+        CHECK(AsyncEndDocPort(&IniPort));
+        CHECK(g_Device.cbData == cbTotal);
+        CHECK(!memcmp(g_Device.pData, pSource, cbTotal));
+        CHECK(g_Device.cFullWrites == cbTotal / ASYNC_BUFFER_SIZE);
+        CHECK(g_Device.cWrites == (cbTotal + ASYNC_BUFFER_SIZE - 1) / ASYNC_BUFFER_SIZE);
+        CHECK(g_Device.cMaxInFlight <= ASYNC_BUFFER_COUNT);
+        CHECK(IniPort.WriteStats.cbWritten == cbTotal);
+        CHECK(IniPort.WriteStats.cQueued == 0);
+        CHECK(IniPort.WriteStats.cMaxQueued <= ASYNC_BUFFER_COUNT);
+
+        //
+        // A device that only finishes a write when asked must have had the
+        // whole ring in flight
+        //
+        if ( Mode == SimSlow && cbTotal > ASYNC_BUFFER_SIZE * ASYNC_BUFFER_COUNT )
+            CHECK(g_Device.cMaxInFlight == ASYNC_BUFFER_COUNT);
+
+        CheckNoLeaks(&IniPort);
+
+        if ( g_failures ) {
+
+            printf("job %d: mode %d, %u bytes\n", Job, (int)Mode, (unsigned)cbTotal);
+            return;
+        }
+    }
+}
+
+
+static VOID
+CheckWritePortTimeout(
+    LPBYTE  pSource
+    )
+
+/*++
+
+    With the device stalled, WritePort fills the ring, then waits the retry
+    timeout and reports a partial write or ERROR_TIMEOUT
+
+--*/
+
+{
+    LCMINIPORT  IniPort;
+    DWORD       cbDone = 0;
+    DWORD       cbWritten = 0;
+    int         cTimeouts = 0;
+    int         i;
+
+
+    SimReset(SimStall, 0, MAXDWORD, &IniPort);
+
+    CHECK(AsyncStartDocPort(&IniPort));
+
+    for ( i = 0 ; i < 40 ; ++i ) {
+
+        if ( AsyncWritePort(&IniPort, pSource + cbDone, 100000, &cbWritten) ) {
+
+            CHECK(cbWritten);
+
+        } else {
+
+            CHECK(g_dwLastError == ERROR_TIMEOUT && cbWritten == 0);
+            cTimeouts++;
+        }
+
+        cbDone += cbWritten;
+    }
+
+    CHECK(cbDone == ASYNC_BUFFER_SIZE * ASYNC_BUFFER_COUNT);
+    CHECK(cTimeouts > 0);
+    CHECK(g_Device.cInFlight == ASYNC_BUFFER_COUNT);
+
+    g_dwLastError = ERROR_SUCCESS;
+
+    CHECK(!AsyncEndDocPort(&IniPort));
+    CHECK(g_dwLastError == ERROR_TIMEOUT);
+    CHECK(g_Device.cCancelled == ASYNC_BUFFER_COUNT);
+    CHECK(g_Device.cbData == 0);
+
+    CheckNoLeaks(&IniPort);
+}
+
+
+static VOID
+CheckEndDocStall(
+    LPBYTE  pSource
+    )
+
+/*++
+
+    The device takes the first two writes and then stops. EndDocPort keeps
+    what was written, cancels the rest and fails the job instead of hanging
+
+--*/
+
+{
+    LCMINIPORT  IniPort;
+    DWORD       cbTotal = ASYNC_BUFFER_SIZE * 3 + ASYNC_BUFFER_SIZE / 2;
+    DWORD       cbWritten = 0;
+
+
+    SimReset(SimStall, 2, MAXDWORD, &IniPort);
+
+    CHECK(AsyncStartDocPort(&IniPort));
+    CHECK(AsyncWritePort(&IniPort, pSource, cbTotal, &cbWritten));
+    CHECK(cbWritten == cbTotal);
+
+    g_dwLastError = ERROR_SUCCESS;
+
+    CHECK(!AsyncEndDocPort(&IniPort));
+    CHECK(g_dwLastError == ERROR_TIMEOUT);
+    CHECK(g_Device.cWrites == 4);
+    CHECK(g_Device.cCancelled == 2);
+    CHECK(g_Device.cbData == ASYNC_BUFFER_SIZE * 2);
+    CHECK(!memcmp(g_Device.pData, pSource, ASYNC_BUFFER_SIZE * 2));
+    CHECK(IniPort.WriteStats.cbWritten == ASYNC_BUFFER_SIZE * 2);
+
+    CheckNoLeaks(&IniPort);
+}
+
+
+static VOID
+CheckWriteFailure(
+    LPBYTE  pSource
+    )
+
+/*++
+
+    The third write is short. WritePort fails from then on, with the same
+    error, and so does EndDocPort
+
+--*/
+
+{
+    LCMINIPORT  IniPort;
+    DWORD       cbWritten = 0;
+    BOOL        bOk = TRUE;
+    int         i;
+
+
+    SimReset(SimSlow, 0, 2, &IniPort);
+
+    CHECK(AsyncStartDocPort(&IniPort));
+
+    for ( i = 0 ; i < 40 && bOk ; ++i )
+        bOk = AsyncWritePort(&IniPort, pSource, 100000, &cbWritten);
+
+    CHECK(!bOk && g_dwLastError == ERROR_WRITE_FAULT);
+    CHECK(!AsyncWritePort(&IniPort, pSource, 100, &cbWritten));
+    CHECK(cbWritten == 0 && g_dwLastError == ERROR_WRITE_FAULT);
+
+    g_dwLastError = ERROR_SUCCESS;
+
+    CHECK(!AsyncEndDocPort(&IniPort));
+    CHECK(g_dwLastError == ERROR_WRITE_FAULT);
+
+    CheckNoLeaks(&IniPort);
+}
+
+
+int
+main(
+    int     argc,
+    char   *argv[]
+    )
+{
+    LPBYTE  pSource;
+    int     cJobs = 200;
+    int     i;
+
+
+    for ( i = 1 ; i < argc ; ++i ) {
+
+        if ( !strcmp(argv[i], "--jobs") && i + 1 < argc ) {
+
+            cJobs = atoi(argv[++i]);
+
+        } else {
+
+            printf("usage: asynctest [--jobs n]\n");
+            return 2;
+        }
+    }
+
+    pSource        = (LPBYTE)malloc(SOURCE_SIZE);
+    g_Device.pData = (LPBYTE)malloc(SOURCE_SIZE);
+
+    if ( !pSource || !g_Device.pData ) {
+
+        printf("out of memory\n");
+        return 1;
+    }
+
+    for ( i = 0 ; i < SOURCE_SIZE ; ++i )
+        pSource[i] = (BYTE)Random();
+
+    CheckRoundTrips(pSource, cJobs);
+    CheckWritePortTimeout(pSource);
+    CheckEndDocStall(pSource);
+    CheckWriteFailure(pSource);
+
+    free(g_Device.pData);
+    free(pSource);
+
+    if ( g_failures ) {
+
+        printf("asynctest FAILED, %d check(s)\n", g_failures);
+        return 1;
+    }
+
+    printf("asynctest passed, %d jobs\n", cJobs);
+    return 0;
+}
@@ -0,0 +1,14 @@
+/*++
+
+Module Name:
+
+    DriverSpecs.h
+
+Abstract:
+
+    Empty stand-in for the WDK header of the same name; the code analysis
+    annotations it declares are defined away in precomp.h.
+
+--*/
+
+#pragma once
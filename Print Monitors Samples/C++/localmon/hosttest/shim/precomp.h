@@ -0,0 +1,113 @@
+/*++
+
+Module Name:
+
+    precomp.h
+
+Abstract:
+
+    Minimal user mode stand-in for the local monitor's precompiled header,
+    so that asyncwr.c can be built and exercised on a host without the WDK.
+    The port structures come from the sample's own spltypes.h; the Win32 and
+    spooler calls asyncwr.c makes are implemented by the test program over a
+    simulated device.
+
+Environment:
+
+    Host (user mode), C99.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_reads_bytes_(x)
+#define _Struct_size_bytes_(x)
+#define _Field_range_(x, y)
+#define _Field_size_opt_(x)
+#define _Analysis_mode_(x)
+
+typedef void                    VOID, *PVOID, *LPVOID, *HANDLE;
+typedef unsigned char           BYTE, *LPBYTE;
+typedef uint16_t                WCHAR, *LPWSTR;
+typedef uint32_t                DWORD, *LPDWORD, ACCESS_MASK;
+typedef int                     BOOL;
+typedef unsigned long long      ULONGLONG;
+typedef uintptr_t               ULONG_PTR;
+typedef struct _MONITORINIT    *PMONITORINIT;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        DWORD   LowPart;
+        DWORD   HighPart;
+    };
+    ULONGLONG   QuadPart;
+} ULARGE_INTEGER;
+
+typedef struct _OVERLAPPED {
+    ULONG_PTR   Internal;
+    ULONG_PTR   InternalHigh;
+    DWORD       Offset;
+    DWORD       OffsetHigh;
+    HANDLE      hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+#define TRUE                    1
+#define FALSE                   0
+#define MAXDWORD                0xFFFFFFFF
+#define INFINITE                0xFFFFFFFF
+
+#define WAIT_OBJECT_0           0
+#define WAIT_TIMEOUT            258
+#define WAIT_FAILED             0xFFFFFFFF
+
+#define ERROR_SUCCESS           0
+#define ERROR_WRITE_FAULT       29
+#define ERROR_OPERATION_ABORTED 995
+#define ERROR_IO_PENDING        997
+#define ERROR_TIMEOUT           1460
+
+#define CopyMemory(d, s, cb)    memcpy((d), (s), (cb))
+#define ZeroMemory(d, cb)       memset((d), 0, (cb))
+
+//
+// Assertions are checked in every build, a failed one fails the test
+//
+
+VOID
+HostAssert(
+    const char *pszExpr,
+    const char *pszFile,
+    int         Line
+    );
+
+#define SPLASSERT(x)            ((x) ? (VOID)0 : HostAssert(#x, __FILE__, __LINE__))
+
+//
+// Spooler and Win32 calls made by asyncwr.c
+//
+
+LPVOID  AllocSplMem(size_t cbAlloc);
+BOOL    FreeSplMem(LPVOID pMem);
+VOID    LcmEnterSplSem(VOID);
+VOID    LcmLeaveSplSem(VOID);
+VOID    GetTransmissionRetryTimeoutFromRegistry(DWORD *pdwTimeout);
+
+DWORD   GetTickCount(VOID);
+DWORD   GetLastError(VOID);
+VOID    SetLastError(DWORD dwError);
+HANDLE  CreateEvent(LPVOID pSecurity, BOOL bManualReset, BOOL bInitialState, LPVOID pName);
+BOOL    ResetEvent(HANDLE hEvent);
+BOOL    CloseHandle(HANDLE hObject);
+DWORD   WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds);
+BOOL    WriteFile(HANDLE hFile, LPVOID pBuf, DWORD cbBuf, LPDWORD pcbWritten, LPOVERLAPPED pOverlapped);
+BOOL    GetOverlappedResult(HANDLE hFile, LPOVERLAPPED pOverlapped, LPDWORD pcbTransferred, BOOL bWait);
+BOOL    CancelIoEx(HANDLE hFile, LPOVERLAPPED pOverlapped);
+
+#include "spltypes.h"
@@ -19,6 +19,7 @@ _Analysis_mode_(_Analysis_code_type_user_driver_)
 
 #include <lmon.h>
 #include "irda.h"
+#include "asyncwr.h"
 
 HANDLE              LcmhMonitor;
 HINSTANCE           LcmhInst;
@@ -275,6 +276,7 @@ LcmStartDocPort(
     PDOC_INFO_1 pDocInfo1       = (PDOC_INFO_1)pDocInfo;
     DWORD       Error           = 0;
     LPWSTR      pAdjustedName   = NULL;
+    BOOL        bAsyncWriter    = FALSE;
 
     UNREFERENCED_PARAMETER(Level);
 
@@ -325,7 +327,8 @@ LcmStartDocPort(
                                          FILE_SHARE_READ | FILE_SHARE_WRITE,
                                          NULL,
                                          OPEN_ALWAYS,
-                                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN |
+                                         FILE_FLAG_OVERLAPPED,
                                          NULL );
 
 
@@ -338,6 +341,7 @@ LcmStartDocPort(
                 if (hFile != INVALID_HANDLE_VALUE)
                 {
                     SetEndOfFile(hFile);
+                    bAsyncWriter = TRUE;
                 }
                 pIniPort->hFile = hFile;
             }
@@ -356,7 +360,9 @@ LcmStartDocPort(
                 if (pAdjustedName)
                 {
                     //
-                    // For non dosdevices CreateFile on the name of the port
+                    // For non dosdevices CreateFile on the name of the port.
+                    // Nothing else does I/O on this handle, so it is opened
+                    // for the async writer
                     //
                     pIniPort->hFile = CreateFile(pAdjustedName,
                                                  GENERIC_WRITE,
@@ -364,12 +370,14 @@ LcmStartDocPort(
                                                  NULL,
                                                  OPEN_ALWAYS,
                                                  FILE_ATTRIBUTE_NORMAL  |
-                                                 FILE_FLAG_SEQUENTIAL_SCAN,
+                                                 FILE_FLAG_SEQUENTIAL_SCAN |
+                                                 FILE_FLAG_OVERLAPPED,
                                                  NULL);
 
                     if ( pIniPort->hFile != INVALID_HANDLE_VALUE )
                     {
                         SetEndOfFile(pIniPort->hFile);
+                        bAsyncWriter = TRUE;
                     }
                     FreeSplMem(pAdjustedName);
 
@@ -420,6 +428,19 @@ LcmStartDocPort(
     {
         goto Fail;
     }
+
+    //
+    // Writes to file ports and ports opened by name are coalesced into
+    // large overlapped writes, see asyncwr.c
+    //
+    if (bAsyncWriter && !AsyncStartDocPort(pIniPort))
+    {
+        Error = GetLastError();
+
+        CloseHandle(pIniPort->hFile);
+        pIniPort->hFile = INVALID_HANDLE_VALUE;
+        goto Fail;
+    }
     return TRUE;
 
 
@@ -495,6 +516,10 @@ LcmWritePort(
         SetLastError(ERROR_INVALID_HANDLE);
         return FALSE;
     }
+    else if ( pIniPort->pWriter )
+    {
+        rc = AsyncWritePort(pIniPort, pBuffer, cbBuf, pcbWritten);
+    }
     else
     {
         rc = WriteFile(pIniPort->hFile, pBuffer, cbBuf, pcbWritten, NULL);
@@ -563,6 +588,7 @@ LcmEndDocPort(
     )
 {
     PLCMINIPORT    pIniPort = (PLCMINIPORT)hPort;
+    DWORD          Error    = ERROR_SUCCESS;
 
 
     if (!(pIniPort->Status & PP_STARTDOC))
@@ -570,6 +596,15 @@ LcmEndDocPort(
         return TRUE;
     }
 
+    //
+    // Wait for the data the async writer still holds to reach the port,
+    // nothing is lost when the handle is closed below
+    //
+    if (pIniPort->pWriter && !AsyncEndDocPort(pIniPort))
+    {
+        Error = GetLastError();
+    }
+
     // The flush here is done to make sure any cached IO's get written
     // before the handle is closed.   This is particularly a problem
     // for Intelligent buffered serial devices
@@ -613,6 +648,12 @@ LcmEndDocPort(
     //
     pIniPort->Status &= ~PP_STARTDOC;
 
+    if (Error != ERROR_SUCCESS)
+    {
+        SetLastError(Error);
+        return FALSE;
+    }
+
     return TRUE;
 }
 
@@ -15,6 +15,7 @@ Module Name:
 
 typedef struct _LCMINIPORT  *PLCMINIPORT;
 typedef struct _INIXCVPORT  *PINIXCVPORT;
+typedef struct _LCM_ASYNC_WRITER    *PLCM_ASYNC_WRITER;
 
 typedef struct _INILOCALMON {
     DWORD signature;
@@ -31,6 +32,17 @@ typedef struct _INIENTRY {
     LPWSTR      pName;
 } INIENTRY, *PINIENTRY;
 
+//
+// Write statistics for the last job on a port that uses the async writer.
+// Returned by the GetPortWriteStatistics xcv call.
+//
+typedef struct _LCM_WRITE_STATS {
+    ULONGLONG   cbWritten;          // Bytes the device has accepted
+    DWORD       cbPerSecond;        // Average since StartDocPort
+    DWORD       cQueued;            // Writes in flight
+    DWORD       cMaxQueued;         // Most writes in flight at once
+} LCM_WRITE_STATS, *PLCM_WRITE_STATS;
+
 // IMPORTANT: the offset to pNext in _LCMINIPORT must be the same as in INIXCVPORT (DeletePortNode)
 typedef _Struct_size_bytes_(cb) struct _LCMINIPORT {       /* ipo */
     DWORD   signature;
@@ -49,6 +61,8 @@ typedef _Struct_size_bytes_(cb) struct _LCMINIPORT {       /* ipo */
     DWORD   JobId;
     PINILOCALMON        pIniLocalMon;
     LPBYTE              pExtra;
+    PLCM_ASYNC_WRITER   pWriter;        // Only while a job is printing
+    LCM_WRITE_STATS     WriteStats;     // Protected by LcmSpoolerSection
 } LCMINIPORT, *PLCMINIPORT;
 
 #define IPO_SIGNATURE   0x5450  /* 'PT' is the signature value */
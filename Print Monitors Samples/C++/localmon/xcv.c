@@ -118,6 +118,17 @@ GetTransmissionRetryTimeout(
     _Inout_                          PINIXCVPORT pIniXcv
 );
 
+_Success_(return == NO_ERROR)
+DWORD
+GetPortWriteStatistics(
+    _In_reads_bytes_(cbInputData)    PBYTE       pInputData,
+    _In_                             DWORD       cbInputData,
+    _Out_writes_bytes_(cbOutputData) PBYTE       pOutputData,
+    _In_                             DWORD       cbOutputData,
+    _Out_                            PDWORD      pcbOutputNeeded,
+    _Inout_                          PINIXCVPORT pIniXcv
+);
+
 
 typedef struct {
     PWSTR   pszMethod;
@@ -139,6 +150,7 @@ XCV_METHOD  gpLcmXcvMethod[] = {
                             {L"PortExists", DoPortExists},
                             {L"PortIsValid", DoPortIsValid},
                             {L"GetTransmissionRetryTimeout", GetTransmissionRetryTimeout},
+                            {L"GetPortWriteStatistics", GetPortWriteStatistics},
                             {L"SetDefaultCommConfig", DoSetDefaultCommConfig},
                             {L"GetDefaultCommConfig", DoGetDefaultCommConfig},
                             {NULL, NULL}
@@ -503,6 +515,49 @@ GetTransmissionRetryTimeout(
     return ERROR_SUCCESS;
 }
 
+//
+// Returns the LCM_WRITE_STATS of the port named in pInputData. Only ports
+// that use the async writer (file ports and ports opened by name) have any.
+//
+_Success_(return == NO_ERROR)
+DWORD
+GetPortWriteStatistics(
+    _In_reads_bytes_(cbInputData)    PBYTE       pInputData,
+    _In_                             DWORD       cbInputData,
+    _Out_writes_bytes_(cbOutputData) PBYTE       pOutputData,
+    _In_                             DWORD       cbOutputData,
+    _Out_                            PDWORD      pcbOutputNeeded,
+    _Inout_                          PINIXCVPORT pIniXcv
+)
+{
+    DWORD       dwRet       = ERROR_SUCCESS;
+    PLCMINIPORT pIniPort    = NULL;
+
+    UNREFERENCED_PARAMETER(cbInputData);
+
+
+    *pcbOutputNeeded = sizeof(LCM_WRITE_STATS);
+
+    if (cbOutputData < sizeof(LCM_WRITE_STATS))
+        return ERROR_INSUFFICIENT_BUFFER;
+
+    if (!pInputData)
+        return ERROR_INVALID_PARAMETER;
+
+    LcmEnterSplSem();
+
+    pIniPort = FindPort(pIniXcv->pIniLocalMon, pInputData);
+
+    if (pIniPort)
+        CopyMemory(pOutputData, &pIniPort->WriteStats, sizeof(LCM_WRITE_STATS));
+    else
+        dwRet = ERROR_UNKNOWN_PORT;
+
+    LcmLeaveSplSem();
+
+    return dwRet;
+}
+
 _Success_(return == NO_ERROR)
 DWORD
 GetMonitorUI(
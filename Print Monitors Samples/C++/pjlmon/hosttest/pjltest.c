@@ -0,0 +1,1411 @@
+/*++
+
+Copyright (c) 1990-2003  Microsoft Corporation
+All rights reserved
+
+Module Name:
+
+    pjltest.c
+
+Abstract:
+
+    Host test and benchmark of the PJL reply parser (../parsepjl.c) and of
+    how the language monitor reads and interprets replies (../pjlmon.c,
+    ../util.c), which are built unchanged against the stand-ins in shim/.
+    The Win32 and spooler calls they make are implemented here; the port
+    monitor below is a simulated printer that sends scripted replies in
+    pieces and logs what is passed to SetPort.
+
+    usage: pjltest --selftest
+           pjltest [--seconds s]
+
+    The self test checks that:
+
+    - GetPJLTokens gives the same status, tokens, stopping point and input
+      with the keyword hashes as when every list is searched in order, for
+      random replies, mutated and truncated replies and random runs of
+      keywords, with room for all or only some of the tokens.
+
+    - Replies read by ReadCommand, split at random points into the reads
+      the printer returns, leave the same port status and SetPort calls as
+      when each reply is processed whole.
+
+    - A read that ends with an incomplete command, including just "@",
+      "@P" or "@PJ", is kept until the rest arrives, and dropped once the
+      printer has nothing more to send; ReadCommand does not keep polling.
+
+    - ProcessPJLString, which skips repeated status replies, leaves the same
+      port status and SetPort calls as interpreting every reply, with
+      SetPort failing at random and the status being cleared in between.
+
+    Every check also looks for leaked memory and events and an unbalanced
+    monitor section.
+
+    Otherwise pjltest reports how fast replies are parsed with the keyword
+    hashes and when the lists are searched in order.
+
+Environment:
+
+    Host (user mode), C11.
+
+--*/
+
+#include "precomp.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+extern KeywordHashType *pKeywordHashes[];
+extern CRITICAL_SECTION pjlMonSection;
+
+BOOL    ReadCommand(_In_ HANDLE hPort);
+DWORD   ProcessPJLString(_In_ PINIPORT, _In_ LPSTR, _Out_ DWORD *);
+VOID    InterpreteTokens(_In_ PINIPORT pIniPort, _In_ PTOKENPAIR tokenPairs, DWORD nTokenParsed);
+BOOL    IsPrinterStatusUnchanged(_In_ PINIPORT pIniPort, _In_ PTOKENPAIR tokenPairs, DWORD nTokenParsed);
+VOID    ClearPrinterStatusAndIniJobs(_In_ PINIPORT pIniPort);
+PINIPORT CreatePortEntry(_In_ LPTSTR pszPortName);
+VOID    DeletePortEntry(_In_ PINIPORT pIniPort);
+VOID    EnterSplSem(VOID);
+VOID    LeaveSplSem(VOID);
+BOOL    WINAPI DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpRes);
+
+#define NTOKEN          20
+#define CBREPLIES       4096
+#define MAX_READS       512
+#define MAX_LOG         4096
+
+static int  g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if ( !(X) ) {                                                           \
+                                                                            \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+//
+// What the simulated printer sends: pData in reads that end at each of
+// ibEnd[], then zero byte reads
+//
+typedef struct _SIM_PRINTER {
+    LPCSTR  pData;
+    DWORD   cbData;
+    DWORD   ib;
+    DWORD   ibEnd[MAX_READS];
+    DWORD   cEnds;
+    DWORD   iEnd;
+    DWORD   cZeroReads;         // Zero byte reads since the last data
+} SIM_PRINTER, *PSIM_PRINTER;
+
+//
+// The SetPort calls made for one port, as "status/severity;" pairs
+//
+typedef struct _SIM_LOG {
+    char    sz[MAX_LOG];
+    size_t  cb;
+} SIM_LOG, *PSIM_LOG;
+
+typedef struct _SIM_EVENT {
+    BOOL    bManualReset;
+    BOOL    bSet;
+} SIM_EVENT, *PSIM_EVENT;
+
+static SIM_PRINTER  g_Printer;
+static SIM_LOG      g_Log[2];           // Ports "A" and "B"
+static BOOL         g_bFailSetPort;
+static DWORD        g_dwLastError;
+static ULONGLONG    g_TickCount;
+static DWORD        g_cSleeps;
+static int          g_cAllocs;
+static int          g_cEvents;
+
+static uint32_t     g_Seed = 50;
+
+static uint32_t
+Random(
+    VOID
+    )
+{
+    g_Seed ^= g_Seed << 13;
+    g_Seed ^= g_Seed >> 17;
+    g_Seed ^= g_Seed << 5;
+
+    return g_Seed;
+}
+
+
+//
+// Win32 and spooler stand-ins
+//
+
+DWORD
+GetLastError(
+    VOID
+    )
+{
+    return g_dwLastError;
+}
+
+
+VOID
+SetLastError(
+    DWORD   dwError
+    )
+{
+    g_dwLastError = dwError;
+}
+
+
+HANDLE
+CreateEvent(
+    LPVOID  pSecurity,
+    BOOL    bManualReset,
+    BOOL    bInitialState,
+    LPCTSTR pszName
+    )
+{
+    PSIM_EVENT  pEvent = calloc(1, sizeof(*pEvent));
+
+    if ( pEvent ) {
+
+        pEvent->bManualReset = bManualReset;
+        pEvent->bSet         = bInitialState;
+        g_cEvents++;
+    }
+
+    return pEvent;
+}
+
+
+BOOL
+SetEvent(
+    HANDLE  hEvent
+    )
+{
+    ((PSIM_EVENT)hEvent)->bSet = TRUE;
+    return TRUE;
+}
+
+
+BOOL
+ResetEvent(
+    HANDLE  hEvent
+    )
+{
+    ((PSIM_EVENT)hEvent)->bSet = FALSE;
+    return TRUE;
+}
+
+
+DWORD
+WaitForSingleObject(
+    HANDLE  hHandle,
+    DWORD   dwMilliseconds
+    )
+{
+    PSIM_EVENT  pEvent = hHandle;
+
+    //
+    // Nothing else runs, so an event that is not set would never be
+    //
+    CHECK(pEvent->bSet);
+
+    if ( !pEvent->bManualReset )
+        pEvent->bSet = FALSE;
+
+    return WAIT_OBJECT_0;
+}
+
+
+BOOL
+CloseHandle(
+    HANDLE  hObject
+    )
+{
+    free(hObject);
+    g_cEvents--;
+    return TRUE;
+}
+
+
+VOID
+Sleep(
+    DWORD   dwMilliseconds
+    )
+{
+    g_TickCount += dwMilliseconds;
+    g_cSleeps++;
+}
+
+
+ULONGLONG
+GetTickCount64(
+    VOID
+    )
+{
+    return ++g_TickCount;
+}
+
+
+HANDLE
+CreateThread(
+    LPVOID                  pSecurity,
+    size_t                  cbStack,
+    LPTHREAD_START_ROUTINE  pfnStart,
+    LPVOID                  pParameter,
+    DWORD                   dwFlags,
+    LPDWORD                 pdwThreadId
+    )
+{
+    SetLastError(ERROR_BUSY);
+    return NULL;
+}
+
+
+BOOL
+SetThreadPriority(
+    HANDLE  hThread,
+    int     Priority
+    )
+{
+    return TRUE;
+}
+
+
+VOID
+InitializeCriticalSection(
+    CRITICAL_SECTION   *pSection
+    )
+{
+    memset(pSection, 0, sizeof(*pSection));
+}
+
+
+VOID
+DeleteCriticalSection(
+    CRITICAL_SECTION   *pSection
+    )
+{
+    CHECK(!pSection->RecursionCount);
+}
+
+
+VOID
+EnterCriticalSection(
+    CRITICAL_SECTION   *pSection
+    )
+{
+    pSection->OwningThread = UIntToPtr(GetCurrentThreadId());
+    pSection->RecursionCount++;
+}
+
+
+VOID
+LeaveCriticalSection(
+    CRITICAL_SECTION   *pSection
+    )
+{
+    CHECK(pSection->RecursionCount > 0);
+
+    if ( --pSection->RecursionCount == 0 )
+        pSection->OwningThread = NULL;
+}
+
+
+DWORD
+GetCurrentThreadId(
+    VOID
+    )
+{
+    return 1;
+}
+
+
+BOOL
+DisableThreadLibraryCalls(
+    HANDLE  hModule
+    )
+{
+    return TRUE;
+}
+
+
+VOID
+OutputDebugStringA(
+    LPCSTR  pszOutput
+    )
+{
+}
+
+
+BOOL
+IsDBCSLeadByte(
+    BYTE    c
+    )
+{
+    return FALSE;
+}
+
+
+HANDLE
+GlobalAlloc(
+    UINT    uFlags,
+    size_t  cbAlloc
+    )
+{
+    LPVOID  pMem = malloc(cbAlloc ? cbAlloc : 1);
+
+    if ( pMem )
+        g_cAllocs++;
+
+    return pMem;
+}
+
+
+HANDLE
+GlobalFree(
+    HANDLE  hMem
+    )
+{
+    if ( hMem ) {
+
+        free(hMem);
+        g_cAllocs--;
+    }
+
+    return NULL;
+}
+
+
+int
+lstrlen(
+    LPCTSTR psz
+    )
+{
+    int cch = 0;
+
+    while ( psz[cch] )
+        cch++;
+
+    return cch;
+}
+
+
+int
+lstrcmpi(
+    LPCTSTR psz1,
+    LPCTSTR psz2
+    )
+{
+    for ( ; *psz1 && *psz1 == *psz2; psz1++, psz2++ )
+        ;
+
+    return (int)*psz1 - (int)*psz2;
+}
+
+
+HRESULT
+StringCbCopy(
+    LPTSTR  pszDest,
+    size_t  cbDest,
+    LPCTSTR pszSrc
+    )
+{
+    size_t  cch = 0;
+
+    while ( pszSrc[cch] && (cch + 1) * sizeof(TCHAR) < cbDest ) {
+
+        pszDest[cch] = pszSrc[cch];
+        cch++;
+    }
+
+    pszDest[cch] = 0;
+    return pszSrc[cch] ? -1 : 0;
+}
+
+
+HRESULT
+StringCchPrintfA(
+    LPSTR   pszDest,
+    size_t  cchDest,
+    LPCSTR  pszFormat,
+    ...
+    )
+{
+    va_list args;
+    int     cch;
+
+    va_start(args, pszFormat);
+    cch = vsnprintf(pszDest, cchDest, pszFormat, args);
+    va_end(args);
+
+    return cch >= 0 && (size_t)cch < cchDest ? 0 : -1;
+}
+
+
+BOOL
+OpenPrinter(
+    LPTSTR  pszPrinterName,
+    LPHANDLE phPrinter,
+    LPVOID  pDefault
+    )
+{
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+}
+
+
+BOOL
+ClosePrinter(
+    HANDLE  hPrinter
+    )
+{
+    return TRUE;
+}
+
+
+BOOL
+SetJob(
+    HANDLE  hPrinter,
+    DWORD   JobId,
+    DWORD   Level,
+    LPBYTE  pJob,
+    DWORD   Command
+    )
+{
+    return TRUE;
+}
+
+
+BOOL
+SetPort(
+    LPTSTR  pszName,
+    LPTSTR  pszPortName,
+    DWORD   Level,
+    LPBYTE  pPortInfo
+    )
+{
+    PORT_INFO_3 *pPortInfo3 = (PORT_INFO_3 *)pPortInfo;
+    PSIM_LOG    pLog = &g_Log[pszPortName[0] == u'B'];
+    int         cb;
+
+    CHECK(Level == 3 && !pPortInfo3->pszStatus);
+
+    cb = snprintf(pLog->sz + pLog->cb, sizeof(pLog->sz) - pLog->cb,
+                  "%u/%u%s;", pPortInfo3->dwStatus, pPortInfo3->dwSeverity,
+                  g_bFailSetPort ? "F" : "");
+
+    if ( cb > 0 && pLog->cb + cb < sizeof(pLog->sz) )
+        pLog->cb += cb;
+
+    if ( g_bFailSetPort ) {
+
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+DWORD
+GetPrinterData(
+    HANDLE  hPrinter,
+    LPTSTR  pszValueName,
+    LPDWORD pType,
+    LPBYTE  pData,
+    DWORD   cbData,
+    LPDWORD pcbNeeded
+    )
+{
+    return ERROR_INVALID_PARAMETER;
+}
+
+
+LONG
+RegCreateKeyEx(
+    HKEY    hKey,
+    LPCTSTR pszSubKey,
+    DWORD   Reserved,
+    LPTSTR  pszClass,
+    DWORD   dwOptions,
+    ACCESS_MASK samDesired,
+    LPVOID  pSecurity,
+    HKEY   *phkResult,
+    LPDWORD pdwDisposition
+    )
+{
+    return ERROR_INVALID_PARAMETER;
+}
+
+
+LONG
+RegQueryValueEx(
+    HKEY    hKey,
+    LPCTSTR pszValueName,
+    LPDWORD pReserved,
+    LPDWORD pType,
+    LPBYTE  pData,
+    LPDWORD pcbData
+    )
+{
+    return ERROR_INVALID_PARAMETER;
+}
+
+
+LONG
+RegSetValueEx(
+    HKEY    hKey,
+    LPCTSTR pszValueName,
+    DWORD   Reserved,
+    DWORD   dwType,
+    const BYTE *pData,
+    DWORD   cbData
+    )
+{
+    return ERROR_INVALID_PARAMETER;
+}
+
+
+LONG
+RegCloseKey(
+    HKEY    hKey
+    )
+{
+    return ERROR_SUCCESS;
+}
+
+
+//
+// The port monitor the language monitor reads from
+//
+
+BOOL
+WINAPI
+SimReadPort(
+    HANDLE  hPort,
+    LPBYTE  pBuffer,
+    DWORD   cbBuf,
+    LPDWORD pcbRead
+    )
+{
+    PSIM_PRINTER    pPrinter = &g_Printer;
+    DWORD           cb;
+
+    if ( pPrinter->ib >= pPrinter->cbData ) {
+
+        //
+        // A second zero byte read in one ReadCommand means it is polling
+        // a printer that has nothing more to send; fail it rather than
+        // let it spin
+        //
+        if ( ++pPrinter->cZeroReads > 1 ) {
+
+            SetLastError(ERROR_BUSY);
+            return FALSE;
+        }
+
+        *pcbRead = 0;
+        return TRUE;
+    }
+
+    while ( pPrinter->iEnd < pPrinter->cEnds &&
+            pPrinter->ibEnd[pPrinter->iEnd] <= pPrinter->ib )
+        pPrinter->iEnd++;
+
+    cb = (pPrinter->iEnd < pPrinter->cEnds ? pPrinter->ibEnd[pPrinter->iEnd] :
+                                             pPrinter->cbData) - pPrinter->ib;
+    cb = min(cb, cbBuf);
+
+    memcpy(pBuffer, pPrinter->pData + pPrinter->ib, cb);
+    pPrinter->ib += cb;
+    pPrinter->cZeroReads = 0;
+
+    *pcbRead = cb;
+    return TRUE;
+}
+
+
+static VOID
+SimStartReplies(
+    LPCSTR  pData,
+    DWORD   cbData
+    )
+{
+    memset(&g_Printer, 0, sizeof(g_Printer));
+    g_Printer.pData  = pData;
+    g_Printer.cbData = cbData;
+}
+
+
+static VOID
+SimAddReadEnd(
+    DWORD   ib
+    )
+{
+    if ( g_Printer.cEnds < MAX_READS &&
+         (!g_Printer.cEnds || g_Printer.ibEnd[g_Printer.cEnds - 1] < ib) )
+        g_Printer.ibEnd[g_Printer.cEnds++] = ib;
+}
+
+
+static PINIPORT
+SimCreatePort(
+    LPTSTR  pszPortName
+    )
+{
+    PINIPORT    pIniPort;
+
+    EnterSplSem();
+    pIniPort = CreatePortEntry(pszPortName);
+    LeaveSplSem();
+
+    if ( pIniPort ) {
+
+        pIniPort->hPort           = pIniPort;
+        pIniPort->fn.pfnReadPort  = SimReadPort;
+        g_Log[pszPortName[0] == u'B'].cb = 0;
+    }
+
+    return pIniPort;
+}
+
+
+static VOID
+SimDeletePort(
+    PINIPORT    pIniPort
+    )
+{
+    EnterSplSem();
+    DeletePortEntry(pIniPort);
+    LeaveSplSem();
+}
+
+
+static BOOL
+IsSamePortState(
+    PINIPORT    pIniPort1,
+    PINIPORT    pIniPort2
+    )
+{
+    return pIniPort1->PrinterStatus == pIniPort2->PrinterStatus &&
+           (pIniPort1->status & PP_PRINTER_OFFLINE) ==
+                (pIniPort2->status & PP_PRINTER_OFFLINE) &&
+           pIniPort1->dwAvailableMemory == pIniPort2->dwAvailableMemory &&
+           pIniPort1->dwInstalledMemory == pIniPort2->dwInstalledMemory &&
+           g_Log[0].cb == g_Log[1].cb &&
+           !memcmp(g_Log[0].sz, g_Log[1].sz, g_Log[0].cb);
+}
+
+
+//
+// Replies
+//
+
+static const DWORD  s_Codes[] = {
+    10001, 10002, 10003, 10006, 10023, 11002, 11101, 11104, 11999, 12000,
+    30016, 35078, 40000, 40010, 40019, 40021, 40022, 40079, 41101, 41105,
+    41999, 42000,
+};
+
+static const char  *s_Displays[] = {
+    "READY", "PAPER OUT", "TONER LOW", "OFFLINE", "",
+};
+
+static const char  *s_PaperSizes[] = {
+    "LETTER", "LEGAL", "A4", "EXECUTIVE", "COM10", "MONARCH", "C5", "DL",
+    "B5", "LEDGER",
+};
+
+static DWORD
+RandomCode(
+    VOID
+    )
+{
+    DWORD   cCodes;
+
+    if ( Random() % 2 )
+        return s_Codes[Random() % COUNTOF(s_Codes)];
+
+    for ( cCodes = 0; PJLToStatus[cCodes].pjl; cCodes++ )
+        ;
+
+    return PJLToStatus[Random() % cCodes].pjl;
+}
+
+
+static DWORD
+MakeStatusReply(
+    LPSTR   psz,
+    size_t  cb
+    )
+{
+    static const char  *s_Headers[] = {
+        "@PJL USTATUS DEVICE\r\n", "@PJL USTATUS TIMED\r\n",
+        "@PJL INFO STATUS\r\n",
+    };
+    uint32_t    r = Random();
+    int         cch;
+
+    //
+    // INFO STATUS always has all three, USTATUS any of DISPLAY and ONLINE
+    //
+    if ( r % 3 == 2 )
+        r |= 0x30;
+
+    cch = snprintf(psz, cb, "%sCODE=%u\r\n", s_Headers[r % 3], RandomCode());
+
+    if ( r & 0x10 )
+        cch += snprintf(psz + cch, cb - cch, "DISPLAY=\"%s\"\r\n",
+                        s_Displays[(r >> 8) % COUNTOF(s_Displays)]);
+
+    if ( r & 0x20 )
+        cch += snprintf(psz + cch, cb - cch, "ONLINE=%s\r\n",
+                        r & 0x40 ? "TRUE" : "FALSE");
+
+    cch += snprintf(psz + cch, cb - cch, "\f");
+
+    return (DWORD)cch;
+}
+
+
+static DWORD
+MakeReply(
+    LPSTR   psz,
+    size_t  cb
+    )
+{
+    uint32_t    r = Random();
+
+    switch ( r % 8 ) {
+
+    case 0:
+        return (DWORD)snprintf(psz, cb, "@PJL INFO MEMORY\r\nTOTAL=%u\r\nLARGEST=%u\r\n\f",
+                               (r >> 4) % 100000, (r >> 12) % 50000);
+
+    case 1:
+        return (DWORD)snprintf(psz, cb, "@PJL INFO CONFIG\r\nMEMORY%s%u\r\n\f",
+                               r & 0x10 ? "=" : " = ", (r >> 8) % 65536);
+
+    case 2:
+        return (DWORD)snprintf(psz, cb, "@PJL USTATUS JOB\r\nEND\r\nNAME=\"MSJOB %u\"\r\n\f",
+                               (r >> 4) % 1000);
+
+    case 3:
+        return (DWORD)snprintf(psz, cb, "@PJL ECHO MSSYNC %u\r\n\f", r >> 4);
+
+    case 4:
+        return (DWORD)snprintf(psz, cb, "@PJL INQUIRE INTRAY%uSIZE\r\n%s\r\n\f",
+                               1 + (r >> 4) % 4,
+                               s_PaperSizes[(r >> 8) % COUNTOF(s_PaperSizes)]);
+
+    default:
+        return MakeStatusReply(psz, cb);
+    }
+}
+
+
+//
+// A reply that may well not parse: real replies with bytes changed, cut
+// short or run together, or runs of keywords from any list
+//
+static DWORD
+MakeFuzzInput(
+    LPSTR   psz,
+    DWORD   cb
+    )
+{
+    static const char  *s_Pieces[] = {
+        "@PJL ", "@PJL", "@", "\r\n", "\r", "\n", "\f", " ", "=", "\"",
+        "0", "42", "10001", "4294967296", "MSJOB ",
+    };
+    DWORD       cch = 0, i, c;
+    uint32_t    r = Random();
+
+    if ( r % 3 ) {
+
+        for ( c = 1 + (r >> 2) % 3; c && cch + 200 < cb; c-- )
+            cch += MakeReply(psz + cch, cb - cch);
+
+        for ( c = (r >> 4) % 5; c && cch; c-- ) {
+
+            DWORD   ib = Random() % cch;
+
+            switch ( Random() % 4 ) {
+
+            case 0:
+                memmove(psz + ib, psz + ib + 1, cch - ib);
+                cch--;
+                break;
+
+            case 1:
+                if ( cch + 1 < cb ) {
+
+                    memmove(psz + ib + 1, psz + ib, cch - ib);
+                    psz[ib] = "@\r\n\f= \"0"[Random() % 8];
+                    cch++;
+                }
+                break;
+
+            default:
+                psz[ib] = (char)(1 + Random() % 255);
+                break;
+            }
+        }
+
+        if ( r & 0x100 )
+            cch = Random() % (cch + 1);
+
+    } else {
+
+        for ( c = 1 + (r >> 2) % 24; c; c-- ) {
+
+            LPCSTR      pszPiece;
+            size_t      cchPiece;
+
+            if ( Random() % 2 ) {
+
+                KeywordHashType *pHash;
+                DWORD            cHashes, cKeywords;
+
+                for ( cHashes = 0; pKeywordHashes[cHashes]; cHashes++ )
+                    ;
+
+                pHash = pKeywordHashes[Random() % cHashes];
+
+                for ( cKeywords = 0; pHash->pListOfKeywords[cKeywords].lpsz; cKeywords++ )
+                    ;
+
+                pszPiece = pHash->pListOfKeywords[Random() % cKeywords].lpsz;
+            } else {
+
+                pszPiece = s_Pieces[Random() % COUNTOF(s_Pieces)];
+            }
+
+            cchPiece = strlen(pszPiece);
+            if ( cch + cchPiece >= cb )
+                break;
+
+            memcpy(psz + cch, pszPiece, cchPiece);
+            cch += (DWORD)cchPiece;
+        }
+    }
+
+    //
+    // The monitor's buffers never hold a NUL before the end
+    //
+    for ( i = 0; i < cch; i++ )
+        if ( !psz[i] )
+            psz[i] = '@';
+
+    psz[cch] = '\0';
+    return cch;
+}
+
+
+//
+// Parse input with the keyword hashes, or as if none could be built
+//
+
+static DWORD    s_Seeds[64];
+
+static VOID
+UseKeywordHashes(
+    BOOL    bUse
+    )
+{
+    DWORD   i;
+
+    for ( i = 0; pKeywordHashes[i]; i++ ) {
+
+        if ( !bUse ) {
+
+            s_Seeds[i] = pKeywordHashes[i]->dwSeed;
+            pKeywordHashes[i]->dwSeed = 0;
+        } else {
+
+            pKeywordHashes[i]->dwSeed = s_Seeds[i];
+        }
+    }
+}
+
+
+typedef struct _PARSE_RESULT {
+    DWORD       status[32];
+    DWORD       cTokens[32];
+    TOKENPAIR   Tokens[32][NTOKEN];
+    DWORD       ibEnd[32];
+    DWORD       cCommands;
+} PARSE_RESULT, *PPARSE_RESULT;
+
+static VOID
+ParseAll(
+    LPSTR           pszIn,
+    DWORD           nTokenInBuffer,
+    PPARSE_RESULT   pResult
+    )
+{
+    LPSTR   psz = pszIn, pszRet;
+    DWORD   i, j;
+
+    memset(pResult, 0, sizeof(*pResult));
+
+    //
+    // Walk the input the way ProcessPJLString does
+    //
+    for ( i = 0; *psz && i < COUNTOF(pResult->status); i++, psz = pszRet ) {
+
+        pszRet = psz;
+        pResult->status[i] = GetPJLTokens(psz, nTokenInBuffer, pResult->Tokens[i],
+                                          &pResult->cTokens[i], &pszRet);
+        pResult->ibEnd[i] = (DWORD)(pszRet - pszIn);
+        pResult->cCommands = i + 1;
+
+        //
+        // DISPLAY values point into the input
+        //
+        for ( j = 0; j < pResult->cTokens[i] && j < nTokenInBuffer; j++ ) {
+
+            if ( pResult->Tokens[i][j].value >= (UINT_PTR)pszIn &&
+                 pResult->Tokens[i][j].value <= (UINT_PTR)pszRet )
+                pResult->Tokens[i][j].value -= (UINT_PTR)pszIn;
+        }
+
+        if ( pResult->status[i] == STATUS_END_OF_STRING || pszRet <= psz )
+            break;
+    }
+}
+
+
+static BOOL
+IsSameParse(
+    PPARSE_RESULT   pResult1,
+    PPARSE_RESULT   pResult2
+    )
+{
+    DWORD   i;
+
+    if ( pResult1->cCommands != pResult2->cCommands )
+        return FALSE;
+
+    for ( i = 0; i < pResult1->cCommands; i++ ) {
+
+        if ( pResult1->status[i]  != pResult2->status[i]  ||
+             pResult1->cTokens[i] != pResult2->cTokens[i] ||
+             pResult1->ibEnd[i]   != pResult2->ibEnd[i]   ||
+             memcmp(pResult1->Tokens[i], pResult2->Tokens[i],
+                    min(pResult1->cTokens[i], NTOKEN) * sizeof(TOKENPAIR)) )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+CheckHashedParse(
+    DWORD   cInputs
+    )
+{
+    static PARSE_RESULT s_Hashed, s_InOrder;
+    char        szInput[CBREPLIES], szHashed[CBREPLIES], szInOrder[CBREPLIES];
+    DWORD       i, cch, nTokenInBuffer, cOK = 0;
+    int         cFailures = g_failures;
+
+    for ( i = 0; i < cInputs && g_failures == cFailures; i++ ) {
+
+        cch = MakeFuzzInput(szInput, sizeof(szInput) / 2);
+        nTokenInBuffer = Random() % 4 ? NTOKEN : 1 + Random() % 4;
+
+        memcpy(szHashed, szInput, cch + 1);
+        memcpy(szInOrder, szInput, cch + 1);
+
+        ParseAll(szHashed, nTokenInBuffer, &s_Hashed);
+
+        UseKeywordHashes(FALSE);
+        ParseAll(szInOrder, nTokenInBuffer, &s_InOrder);
+        UseKeywordHashes(TRUE);
+
+        CHECK(IsSameParse(&s_Hashed, &s_InOrder));
+        CHECK(!memcmp(szHashed, szInOrder, cch + 1));
+
+        if ( g_failures != cFailures )
+            printf("input: \"%s\"\n", szInput);
+
+        cOK += s_Hashed.status[0] == STATUS_REACHED_END_OF_COMMAND_OK;
+    }
+
+    //
+    // The inputs must not all be rejected at the first byte
+    //
+    CHECK(cOK > cInputs / 4);
+}
+
+
+static VOID
+CheckSplitReads(
+    DWORD   cRuns
+    )
+{
+    char        szReplies[CBREPLIES], szWhole[CBREPLIES];
+    DWORD       ibReply[64], cReplies, cch, cbProcessed, i, iRun, cCalls;
+    PINIPORT    pIniPortA, pIniPortB;
+
+    pIniPortA = SimCreatePort(u"A");
+    pIniPortB = SimCreatePort(u"B");
+    CHECK(pIniPortA && pIniPortB);
+    if ( !pIniPortA || !pIniPortB )
+        return;
+
+    for ( iRun = 0; iRun < cRuns; iRun++ ) {
+
+        int cFailures = g_failures;
+
+        for ( cReplies = 0, cch = 0;
+              cReplies < COUNTOF(ibReply) - 1 && cch + 200 < sizeof(szReplies);
+              cReplies++ ) {
+
+            ibReply[cReplies] = cch;
+            cch += Random() % 3 ? MakeStatusReply(szReplies + cch, sizeof(szReplies) - cch) :
+                                  MakeReply(szReplies + cch, sizeof(szReplies) - cch);
+        }
+        ibReply[cReplies] = cch;
+
+        //
+        // Port B gets each reply whole
+        //
+        for ( i = 0; i < cReplies; i++ ) {
+
+            DWORD cb = ibReply[i + 1] - ibReply[i];
+
+            memcpy(szWhole, szReplies + ibReply[i], cb);
+            szWhole[cb] = '\0';
+
+            CHECK(ProcessPJLString(pIniPortB, szWhole, &cbProcessed) ==
+                  STATUS_REACHED_END_OF_COMMAND_OK);
+            CHECK(cbProcessed == cb);
+        }
+
+        //
+        // Port A reads them in random pieces, some as short as one byte,
+        // from a printer that sends them without a pause
+        //
+        SimStartReplies(szReplies, cch);
+
+        for ( i = 1; i < cch; i += 1 + (Random() % 4 ? Random() % 256 : Random() % 4) )
+            SimAddReadEnd(i);
+
+        for ( cCalls = 0; g_Printer.ib < cch && cCalls < cch; cCalls++ ) {
+
+            g_Printer.cZeroReads = 0;
+            CHECK(ReadCommand(pIniPortA));
+        }
+
+        CHECK(g_Printer.ib == cch);
+        CHECK(IsSamePortState(pIniPortA, pIniPortB));
+        CHECK(((PSIM_EVENT)pIniPortA->DoneReading)->bSet);
+
+        if ( g_failures != cFailures ) {
+
+            printf("A: %.*s\nB: %.*s\n", (int)g_Log[0].cb, g_Log[0].sz,
+                   (int)g_Log[1].cb, g_Log[1].sz);
+            break;
+        }
+
+        g_Log[0].cb = g_Log[1].cb = 0;
+    }
+
+    SimDeletePort(pIniPortA);
+    SimDeletePort(pIniPortB);
+}
+
+
+static VOID
+CheckHeldTail(
+    VOID
+    )
+{
+    static const char   s_szFirst[] = "@PJL USTATUS DEVICE\r\nCODE=10001\r\nONLINE=TRUE\r\n\f";
+    static const char   s_szNext[]  = "@PJL USTATUS DEVICE\r\nCODE=40021\r\nONLINE=FALSE\r\n\f";
+    static const char   s_szLast[]  = "@PJL INFO STATUS\r\nCODE=10003\r\nDISPLAY=\"WARMING UP\"\r\nONLINE=TRUE\r\n\f";
+    static const DWORD  s_cchTails[] = { 1, 2, 3, 4, 16, 33 };
+    char        szReplies[CBREPLIES], szWhole[CBREPLIES];
+    DWORD       i, cch, cchTail, cbProcessed;
+    PINIPORT    pIniPortA, pIniPortB;
+
+    for ( i = 0; i < COUNTOF(s_cchTails); i++ ) {
+
+        pIniPortA = SimCreatePort(u"A");
+        pIniPortB = SimCreatePort(u"B");
+        CHECK(pIniPortA && pIniPortB);
+        if ( !pIniPortA || !pIniPortB )
+            return;
+
+        //
+        // A reply and the start of the next one, "@", "@P", "@PJ" and on,
+        // then nothing: the start is dropped after one idle read
+        //
+        cchTail = s_cchTails[i];
+        cch = snprintf(szReplies, sizeof(szReplies), "%s%.*s",
+                       s_szFirst, (int)cchTail, s_szNext);
+
+        SimStartReplies(szReplies, cch);
+        g_cSleeps = 0;
+
+        CHECK(ReadCommand(pIniPortA));
+        CHECK(g_Printer.ib == cch);
+        CHECK(g_Printer.cZeroReads == 1);
+        CHECK(g_cSleeps < 3);
+
+        strcpy(szWhole, s_szFirst);
+        CHECK(ProcessPJLString(pIniPortB, szWhole, &cbProcessed) ==
+              STATUS_REACHED_END_OF_COMMAND_OK);
+        CHECK(IsSamePortState(pIniPortA, pIniPortB));
+
+        //
+        // The rest of the dropped command, when it turns up late, is not
+        // taken for a command of its own, and the reply after it is read
+        //
+        cch = snprintf(szReplies, sizeof(szReplies), "%s%s",
+                       s_szNext + cchTail, s_szLast);
+
+        SimStartReplies(szReplies, cch);
+
+        CHECK(ReadCommand(pIniPortA));
+        CHECK(g_Printer.ib == cch);
+
+        strcpy(szWhole, s_szLast);
+        CHECK(ProcessPJLString(pIniPortB, szWhole, &cbProcessed) ==
+              STATUS_REACHED_END_OF_COMMAND_OK);
+        CHECK(IsSamePortState(pIniPortA, pIniPortB));
+
+        //
+        // A start the printer finishes in its next read is kept
+        //
+        cch = snprintf(szReplies, sizeof(szReplies), "%s%s", s_szFirst, s_szNext);
+
+        SimStartReplies(szReplies, cch);
+        SimAddReadEnd((DWORD)strlen(s_szFirst) + cchTail);
+
+        CHECK(ReadCommand(pIniPortA));
+        CHECK(g_Printer.ib == cch);
+
+        strcpy(szWhole, szReplies);
+        CHECK(ProcessPJLString(pIniPortB, szWhole, &cbProcessed) ==
+              STATUS_REACHED_END_OF_COMMAND_OK);
+        CHECK(IsSamePortState(pIniPortA, pIniPortB));
+        CHECK(pIniPortA->status & PP_PRINTER_OFFLINE);
+
+        SimDeletePort(pIniPortA);
+        SimDeletePort(pIniPortB);
+    }
+}
+
+
+static VOID
+CheckRepeatedStatus(
+    DWORD   cRuns
+    )
+{
+    char        szReply[CBREPLIES], szLast[CBREPLIES], szCopy[CBREPLIES];
+    TOKENPAIR   tokenPairs[NTOKEN];
+    DWORD       iRun, iStep, cTokens, cbProcessed, cSkipped = 0, cSteps = 0;
+    LPSTR       pszRet;
+    PINIPORT    pIniPortA, pIniPortB;
+
+    pIniPortA = SimCreatePort(u"A");
+    pIniPortB = SimCreatePort(u"B");
+    CHECK(pIniPortA && pIniPortB);
+    if ( !pIniPortA || !pIniPortB )
+        return;
+
+    for ( iRun = 0; iRun < cRuns; iRun++ ) {
+
+        int cFailures = g_failures;
+
+        MakeStatusReply(szLast, sizeof(szLast));
+
+        for ( iStep = 0; iStep < 64; iStep++, cSteps++ ) {
+
+            uint32_t r = Random();
+
+            //
+            // Mostly the same status again, as printers send it
+            //
+            if ( r % 4 == 0 )
+                MakeStatusReply(szLast, sizeof(szLast));
+            else if ( r % 16 == 1 )
+                MakeReply(szLast, sizeof(szLast));
+
+            strcpy(szReply, szLast);
+
+            g_bFailSetPort = (r >> 8) % 8 == 0;
+
+            if ( (r >> 12) % 16 == 0 ) {
+
+                ClearPrinterStatusAndIniJobs(pIniPortA);
+                ClearPrinterStatusAndIniJobs(pIniPortB);
+            }
+
+            //
+            // Port A interprets every reply, port B skips repeats
+            //
+            strcpy(szCopy, szReply);
+            CHECK(GetPJLTokens(szCopy, NTOKEN, tokenPairs, &cTokens, &pszRet) ==
+                  STATUS_REACHED_END_OF_COMMAND_OK);
+            InterpreteTokens(pIniPortA, tokenPairs, cTokens);
+
+            strcpy(szCopy, szReply);
+            GetPJLTokens(szCopy, NTOKEN, tokenPairs, &cTokens, &pszRet);
+            cSkipped += IsPrinterStatusUnchanged(pIniPortB, tokenPairs, cTokens);
+
+            CHECK(ProcessPJLString(pIniPortB, szReply, &cbProcessed) ==
+                  STATUS_REACHED_END_OF_COMMAND_OK);
+
+            CHECK(IsSamePortState(pIniPortA, pIniPortB));
+
+            if ( g_failures != cFailures ) {
+
+                printf("reply: \"%s\"\nA: %.*s\nB: %.*s\n", szReply,
+                       (int)g_Log[0].cb, g_Log[0].sz, (int)g_Log[1].cb, g_Log[1].sz);
+                break;
+            }
+
+            g_Log[0].cb = g_Log[1].cb = 0;
+        }
+
+        if ( g_failures != cFailures )
+            break;
+    }
+
+    g_bFailSetPort = FALSE;
+
+    //
+    // Most of the replies are repeats, so most should have been skipped
+    //
+    CHECK(cSkipped > cSteps / 3);
+
+    SimDeletePort(pIniPortA);
+    SimDeletePort(pIniPortB);
+}
+
+
+static int
+SelfTest(
+    VOID
+    )
+{
+    CheckHashedParse(200000);
+    CheckSplitReads(2000);
+    CheckHeldTail();
+    CheckRepeatedStatus(2000);
+
+    CHECK(!g_cAllocs && !g_cEvents);
+    CHECK(!pjlMonSection.RecursionCount);
+
+    printf("%s: %d failures\n", g_failures ? "FAILED" : "passed", g_failures);
+
+    return g_failures ? 1 : 0;
+}
+
+
+static double
+Now(
+    VOID
+    )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int
+Benchmark(
+    double  Seconds
+    )
+{
+    static char szReplies[64][256];
+    char        szCopy[256];
+    TOKENPAIR   tokenPairs[NTOKEN];
+    DWORD       i, cTokens;
+    LPSTR       pszRet;
+    int         Pass;
+
+    for ( i = 0; i < COUNTOF(szReplies); i++ )
+        MakeReply(szReplies[i], sizeof(szReplies[i]));
+
+    printf("%-10s %12s\n", "keywords", "replies/s");
+
+    for ( Pass = 0; Pass < 2; Pass++ ) {
+
+        double      Start = Now(), Elapsed;
+        ULONGLONG   cReplies = 0;
+
+        if ( Pass == 1 )
+            UseKeywordHashes(FALSE);
+
+        do {
+
+            for ( i = 0; i < COUNTOF(szReplies); i++ ) {
+
+                strcpy(szCopy, szReplies[i]);
+                GetPJLTokens(szCopy, NTOKEN, tokenPairs, &cTokens, &pszRet);
+            }
+
+            cReplies += COUNTOF(szReplies);
+            Elapsed   = Now() - Start;
+
+        } while ( Elapsed < Seconds );
+
+        printf("%-10s %12.0f\n", Pass == 0 ? "hashed" : "in order",
+               cReplies / Elapsed);
+
+        if ( Pass == 1 )
+            UseKeywordHashes(TRUE);
+    }
+
+    return 0;
+}
+
+
+int
+main(
+    int     argc,
+    char  **argv
+    )
+{
+    double  Seconds = 1;
+    BOOL    bSelfTest = FALSE;
+    int     i;
+
+    for ( i = 1; i < argc; i++ ) {
+
+        if ( !strcmp(argv[i], "--selftest") ) {
+
+            bSelfTest = TRUE;
+        } else if ( !strcmp(argv[i], "--seconds") && i + 1 < argc ) {
+
+            Seconds = atof(argv[++i]);
+        } else {
+
+            printf("usage: pjltest --selftest\n"
+                   "       pjltest [--seconds s]\n");
+            return 2;
+        }
+    }
+
+    DllMain(NULL, DLL_PROCESS_ATTACH, NULL);
+
+    i = bSelfTest ? SelfTest() : Benchmark(Seconds);
+
+    DllMain(NULL, DLL_PROCESS_DETACH, NULL);
+
+    return i;
+}
@@ -0,0 +1,16 @@
+/*++
+
+Module Name:
+
+    ntddpar.h
+
+Abstract:
+
+    Stand-in for the WDK parallel port header; only the IOCTL code the
+    monitor names is defined.
+
+--*/
+
+#pragma once
+
+#define IOCTL_PAR_QUERY_DEVICE_ID   0x160000
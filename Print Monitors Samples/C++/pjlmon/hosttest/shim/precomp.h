@@ -0,0 +1,219 @@
+/*++
+
+Module Name:
+
+    precomp.h
+
+Abstract:
+
+    Minimal user mode stand-in for the language monitor's precompiled
+    header, so that parsepjl.c and pjlmon.c can be built and exercised on a
+    host without the WDK. The monitor's own spltypes.h, local.h and
+    parsepjl.h are used; the Win32 and spooler calls the monitor makes are
+    implemented by the test program. The monitor is built for UNICODE, as
+    it is for Windows, so TEXT() strings are C11 u"" literals.
+
+Environment:
+
+    Host (user mode), C11.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <uchar.h>
+
+#define _WIN32_WINNT            0x0601
+
+#define FAR
+#define IN
+#define OUT
+#define WINAPI
+#define __int64                 long long
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Outptr_result_maybenull_
+#define _Inout_
+#define _In_reads_(x)
+#define _In_reads_bytes_(x)
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Field_size_(x)
+#define _Success_(x)
+#define _Acquires_lock_(x)
+#define _Releases_lock_(x)
+#define _Analysis_assume_(x)
+
+typedef void                    VOID, *PVOID, *LPVOID, *HANDLE, **PHANDLE, **LPHANDLE, *HWND;
+typedef unsigned char           BYTE, *LPBYTE;
+typedef char                    CHAR, *LPSTR;
+typedef const char             *LPCSTR;
+typedef uint16_t                WORD;
+typedef char16_t                WCHAR, *LPWSTR, TCHAR, *LPTSTR;
+typedef const char16_t         *LPCTSTR;
+typedef uint32_t                DWORD, *LPDWORD, ULONG, ACCESS_MASK;
+typedef int32_t                 LONG, HRESULT;
+typedef int                     BOOL, INT;
+typedef unsigned int            UINT;
+typedef intptr_t                INT_PTR;
+typedef uintptr_t               UINT_PTR;
+typedef unsigned long long      ULONGLONG;
+
+#define TRUE                    1
+#define FALSE                   0
+#define INFINITE                0xFFFFFFFF
+#define WAIT_OBJECT_0           0
+#define TEXT(s)                 u ## s
+#define DWORD_MAX               0xFFFFFFFF
+
+#define ERROR_SUCCESS           0
+#define NO_ERROR                0
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_BUSY              170
+#define ERROR_INVALID_LEVEL     124
+#define ERROR_INVALID_PRINT_MONITOR 3007
+
+#define DLL_PROCESS_DETACH      0
+#define DLL_PROCESS_ATTACH      1
+#define THREAD_PRIORITY_LOWEST  (-2)
+
+#define min(a, b)               (((a) < (b)) ? (a) : (b))
+#define CopyMemory(d, s, cb)    memcpy((d), (s), (cb))
+#define ZeroMemory(d, cb)       memset((d), 0, (cb))
+#define UNREFERENCED_PARAMETER(p) ((VOID)(p))
+
+#define DMPAPER_LETTER          1
+#define DMPAPER_LEGAL           5
+#define DMPAPER_EXECUTIVE       7
+#define DMPAPER_A4              9
+#define DMPAPER_ENV_10          20
+#define DMPAPER_ENV_DL          27
+#define DMPAPER_ENV_C5          28
+#define DMPAPER_ENV_B5          34
+#define DMPAPER_ENV_MONARCH     37
+
+#define PORT_STATUS_TYPE_ERROR          1
+#define PORT_STATUS_TYPE_WARNING        2
+#define PORT_STATUS_TYPE_INFO           3
+
+#define PORT_STATUS_OFFLINE             1
+#define PORT_STATUS_PAPER_JAM           2
+#define PORT_STATUS_PAPER_OUT           3
+#define PORT_STATUS_OUTPUT_BIN_FULL     4
+#define PORT_STATUS_PAPER_PROBLEM       5
+#define PORT_STATUS_NO_TONER            6
+#define PORT_STATUS_DOOR_OPEN           7
+#define PORT_STATUS_USER_INTERVENTION   8
+#define PORT_STATUS_OUT_OF_MEMORY       9
+#define PORT_STATUS_TONER_LOW           10
+#define PORT_STATUS_WARMING_UP          11
+#define PORT_STATUS_POWER_SAVE          12
+
+typedef struct _CRITICAL_SECTION {
+    PVOID       DebugInfo;
+    LONG        LockCount;
+    LONG        RecursionCount;
+    HANDLE      OwningThread;
+    HANDLE      LockSemaphore;
+    UINT_PTR    SpinCount;
+} CRITICAL_SECTION;
+
+typedef struct _HKEY           *HKEY;
+
+#define HKEY_LOCAL_MACHINE      ((HKEY)(UINT_PTR)0x80000002)
+#define KEY_READ                0x20019
+#define KEY_WRITE               0x20006
+#define REG_BINARY              3
+
+#define GMEM_FIXED              0
+#define JOB_CONTROL_LAST_PAGE_EJECTED 7
+
+#define UIntToPtr(u)            ((PVOID)(UINT_PTR)(u))
+#define wcslen(psz)             lstrlen(psz)
+
+typedef struct _COMMTIMEOUTS {
+    DWORD   ReadIntervalTimeout;
+    DWORD   ReadTotalTimeoutMultiplier;
+    DWORD   ReadTotalTimeoutConstant;
+    DWORD   WriteTotalTimeoutMultiplier;
+    DWORD   WriteTotalTimeoutConstant;
+} COMMTIMEOUTS, *LPCOMMTIMEOUTS;
+
+typedef struct _PORT_INFO_3 {
+    DWORD   dwStatus;
+    LPTSTR  pszStatus;
+    DWORD   dwSeverity;
+} PORT_INFO_3;
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID lpParameter);
+
+typedef struct _MONITOR {
+    BOOL (WINAPI *pfnEnumPorts)(LPTSTR pName, DWORD Level, LPBYTE pPorts, DWORD cbBuf, LPDWORD pcbNeeded, LPDWORD pcReturned);
+    BOOL (WINAPI *pfnOpenPort)(LPTSTR pName, PHANDLE pHandle);
+    BOOL (WINAPI *pfnOpenPortEx)(LPTSTR pPortName, LPTSTR pPrinterName, PHANDLE pHandle, struct _MONITOR *pMonitor);
+    BOOL (WINAPI *pfnStartDocPort)(HANDLE hPort, LPTSTR pPrinterName, DWORD JobId, DWORD Level, LPBYTE pDocInfo);
+    BOOL (WINAPI *pfnWritePort)(HANDLE hPort, LPBYTE pBuffer, DWORD cbBuf, LPDWORD pcbWritten);
+    BOOL (WINAPI *pfnReadPort)(HANDLE hPort, LPBYTE pBuffer, DWORD cbBuffer, LPDWORD pcbRead);
+    BOOL (WINAPI *pfnEndDocPort)(HANDLE hPort);
+    BOOL (WINAPI *pfnClosePort)(HANDLE hPort);
+    BOOL (WINAPI *pfnAddPort)(LPTSTR pName, HWND hWnd, LPTSTR pMonitorName);
+    BOOL (WINAPI *pfnAddPortEx)(LPTSTR pName, DWORD Level, LPBYTE lpBuffer, LPTSTR lpMonitorName);
+    BOOL (WINAPI *pfnConfigurePort)(LPTSTR pName, HWND hWnd, LPTSTR pPortName);
+    BOOL (WINAPI *pfnDeletePort)(LPTSTR pName, HWND hWnd, LPTSTR pPortName);
+    BOOL (WINAPI *pfnGetPrinterDataFromPort)(HANDLE hPort, DWORD ControlID, LPTSTR pValueName, LPTSTR lpInBuffer, DWORD cbInBuffer, LPTSTR lpOutBuffer, DWORD cbOutBuffer, LPDWORD lpcbReturned);
+    BOOL (WINAPI *pfnSetPortTimeOuts)(HANDLE hPort, LPCOMMTIMEOUTS lpCTO, DWORD reserved);
+} MONITOR, *LPMONITOR;
+
+typedef struct _MONITOREX {
+    DWORD   dwMonitorSize;
+    MONITOR Monitor;
+} MONITOREX, *LPMONITOREX;
+
+//
+// Win32 and spooler calls made by the monitor
+//
+
+DWORD       GetLastError(VOID);
+VOID        SetLastError(DWORD dwError);
+BOOL        SetEvent(HANDLE hEvent);
+BOOL        ResetEvent(HANDLE hEvent);
+DWORD       WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds);
+BOOL        CloseHandle(HANDLE hObject);
+VOID        Sleep(DWORD dwMilliseconds);
+ULONGLONG   GetTickCount64(VOID);
+HANDLE      CreateThread(LPVOID pSecurity, size_t cbStack, LPTHREAD_START_ROUTINE pfnStart, LPVOID pParameter, DWORD dwFlags, LPDWORD pThreadId);
+BOOL        SetThreadPriority(HANDLE hThread, int nPriority);
+VOID        InitializeCriticalSection(CRITICAL_SECTION *pSection);
+VOID        DeleteCriticalSection(CRITICAL_SECTION *pSection);
+VOID        EnterCriticalSection(CRITICAL_SECTION *pSection);
+VOID        LeaveCriticalSection(CRITICAL_SECTION *pSection);
+DWORD       GetCurrentThreadId(VOID);
+HANDLE      CreateEvent(LPVOID pSecurity, BOOL bManualReset, BOOL bInitialState, LPCTSTR pName);
+BOOL        DisableThreadLibraryCalls(HANDLE hModule);
+VOID        OutputDebugStringA(LPCSTR pszString);
+BOOL        IsDBCSLeadByte(BYTE TestChar);
+HANDLE      GlobalAlloc(UINT uFlags, size_t cbBytes);
+HANDLE      GlobalFree(HANDLE hMem);
+int         lstrlen(LPCTSTR psz);
+int         lstrcmpi(LPCTSTR psz1, LPCTSTR psz2);
+HRESULT     StringCbCopy(LPTSTR pszDest, size_t cbDest, LPCTSTR pszSrc);
+HRESULT     StringCchPrintfA(LPSTR pszDest, size_t cchDest, LPCSTR pszFormat, ...);
+BOOL        OpenPrinter(LPTSTR pPrinterName, PHANDLE phPrinter, LPVOID pDefault);
+BOOL        ClosePrinter(HANDLE hPrinter);
+BOOL        SetJob(HANDLE hPrinter, DWORD JobId, DWORD Level, LPBYTE pJob, DWORD Command);
+BOOL        SetPort(LPTSTR pName, LPTSTR pPortName, DWORD dwLevel, LPBYTE pPortInfo);
+DWORD       GetPrinterData(HANDLE hPrinter, LPTSTR pValueName, LPDWORD pType, LPBYTE pData, DWORD nSize, LPDWORD pcbNeeded);
+LONG        RegCreateKeyEx(HKEY hKey, LPCTSTR pSubKey, DWORD Reserved, LPTSTR pClass, DWORD dwOptions, DWORD samDesired, LPVOID pSecurity, HKEY *phResult, LPDWORD pdwDisposition);
+LONG        RegQueryValueEx(HKEY hKey, LPCTSTR pValueName, LPDWORD pReserved, LPDWORD pType, LPBYTE pData, LPDWORD pcbData);
+LONG        RegSetValueEx(HKEY hKey, LPCTSTR pValueName, DWORD Reserved, DWORD dwType, const BYTE *pData, DWORD cbData);
+LONG        RegCloseKey(HKEY hKey);
+
+#include "spltypes.h"
+#include "local.h"
+#include "parsepjl.h"
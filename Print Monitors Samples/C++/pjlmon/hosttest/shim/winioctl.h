@@ -0,0 +1,13 @@
+/*++
+
+Module Name:
+
+    winioctl.h
+
+Abstract:
+
+    Empty stand-in for the Windows header of the same name.
+
+--*/
+
+#pragma once
@@ -104,6 +104,9 @@ BOOL AdvancePointerPastString
    (_In_ ParseVarsType *pParseVars, _In_ LPSTR pString);
 BOOL SkipOverSpaces(_In_ ParseVarsType *pParseVars);
 int LookForKeyword(_In_ ParseVarsType *pParseVars);
+int LookForKeywordInOrder(_In_ ParseVarsType *pParseVars);
+DWORD HashKeywordChar(DWORD dwSeed, BYTE c);
+void BuildKeywordHash(_Inout_ KeywordHashType *pHash);
 BOOL ExpectString(_In_ ParseVarsType *pParseVars, _In_ LPSTR pString);
 BOOL SkipPastFF(_In_ ParseVarsType *pParseVars);
 void ExpectFinalFF(_In_ ParseVarsType *pParseVars);
@@ -130,14 +133,28 @@ to the notFoundAction is called.
 The tokenBaseValue element is a number to which the index in the
 keyword's list of strings will added to calculate the token number
 corresponding to the indexed string.
+
+The pKeywordHash element points to the perfect hash of the keywords
+that LookForKeyword() uses instead of trying each keyword in turn.
 */
 
+KeywordHashType readBackCommandHash = { readBackCommandKeywords };
+KeywordHashType infoCatagoryHash    = { infoCatagoryKeywords };
+KeywordHashType infoConfigHash      = { infoConfigKeywords };
+KeywordHashType inquireVariableHash = { inquireVariableKeywords };
+KeywordHashType echoHash            = { echoKeywords };
+KeywordHashType traySizeHash        = { traySizeKeywords };
+KeywordHashType ustatusHash         = { ustatusKeywords };
+KeywordHashType ustatusJobHash      = { ustatusJobKeywords };
+KeywordHashType ustatusDeviceHash   = { ustatusDeviceKeywords };
+
 ListType readBackCommandList =
    {
    ERROR_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    TOKEN_BASE_NOT_USED,
-   readBackCommandKeywords /* INFO, ECHO, INQUIRE ... */
+   readBackCommandKeywords, /* INFO, ECHO, INQUIRE ... */
+   &readBackCommandHash
    };
 
 ListType infoCatagoryList =
@@ -145,7 +162,8 @@ ListType infoCatagoryList =
    ERROR_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    TOKEN_BASE_NOT_USED,
-   infoCatagoryKeywords  /* MEMORY STATUS CONFIG ... */
+   infoCatagoryKeywords,  /* MEMORY STATUS CONFIG ... */
+   &infoCatagoryHash
    };
 
 
@@ -154,7 +172,8 @@ ListType infoConfigList =
    OK_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_CFLF_AND_INDENTED_LINES,
    PJL_TOKEN_INFO_CONFIG_BASE,
-   infoConfigKeywords  /* MEMORY= ... */
+   infoConfigKeywords,  /* MEMORY= ... */
+   &infoConfigHash
    };
 
 ListType inquireVariableList =
@@ -162,7 +181,8 @@ ListType inquireVariableList =
    ERROR_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    PJL_TOKEN_INQUIRE_BASE,
-   inquireVariableKeywords /* INTRAY1SIZE ...*/
+   inquireVariableKeywords, /* INTRAY1SIZE ...*/
+   &inquireVariableHash
    };
 
 
@@ -171,7 +191,8 @@ ListType echoList =
    OK_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    TOKEN_BASE_NOT_USED,
-   echoKeywords /* MSSYNC ...*/
+   echoKeywords, /* MSSYNC ...*/
+   &echoHash
    };
 
 
@@ -180,7 +201,8 @@ ListType traySizeList =
    ERROR_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    TOKEN_BASE_NOT_USED,
-   traySizeKeywords /* LEGAL, C5 ...*/
+   traySizeKeywords, /* LEGAL, C5 ...*/
+   &traySizeHash
    };
 
 ListType ustatusList =
@@ -188,7 +210,8 @@ ListType ustatusList =
    OK_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    PJL_TOKEN_USTATUS_JOB_BASE,
-   ustatusKeywords  /* JOB ... */
+   ustatusKeywords,  /* JOB ... */
+   &ustatusHash
    };
 
 
@@ -197,7 +220,8 @@ ListType ustatusJobList =
    OK_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    PJL_TOKEN_USTATUS_JOB_BASE,
-   ustatusJobKeywords  /* END ... */
+   ustatusJobKeywords,  /* END ... */
+   &ustatusJobHash
    };
 
 ListType ustatusDeviceList =
@@ -205,7 +229,8 @@ ListType ustatusDeviceList =
    OK_IF_FF_FOUND,
    ACTION_IF_NOT_FOUND_SKIP_PAST_FF,
    PJL_TOKEN_USTATUS_DEVICE_BASE,
-   ustatusDeviceKeywords  /* END ... */
+   ustatusDeviceKeywords,  /* END ... */
+   &ustatusDeviceHash
    };
 
 
@@ -283,6 +308,8 @@ KeywordType FALSEandTRUEKeywords[] =
       NULL
    };
 
+KeywordHashType FALSEandTRUEHash = { FALSEandTRUEKeywords };
+
 /* strings that can follow @PJL INQUIRE */
 KeywordType inquireVariableKeywords[] =
    {
@@ -309,6 +336,22 @@ KeywordType traySizeKeywords[] =
       NULL
    };
 
+/* Every keyword hash, built once by InitPJLKeywordHashes() */
+KeywordHashType *pKeywordHashes[] =
+   {
+   &readBackCommandHash,
+   &infoCatagoryHash,
+   &infoConfigHash,
+   &inquireVariableHash,
+   &echoHash,
+   &traySizeHash,
+   &ustatusHash,
+   &ustatusJobHash,
+   &ustatusDeviceHash,
+   &FALSEandTRUEHash,
+   NULL
+   };
+
 void (*pfnNotFoundActions[])(ParseVarsType *pParseVars) =
    {
    ActionNotFoundSkipPastFF,
@@ -483,6 +526,7 @@ DWORD GetPJLTokens(
             }
          /* Look for keyword in current keywords */
          parseVars.pCurrentKeywords = parseVars.pCurrentList->pListOfKeywords;
+         parseVars.pCurrentHash = parseVars.pCurrentList->pKeywordHash;
          keywordIndex = LookForKeyword(&parseVars);
          if ( keywordIndex!=-1 )
             {
@@ -525,6 +569,75 @@ DWORD GetPJLTokens(
 /*
 int LookForKeyword(ParseVarsType *pParseVars)
 
+This function uses the perfect hash of the current keyword list to find
+the keyword that matches the characters in the input stream pointed to
+by pParseVars->pInPJL_Local.  The hashed input character selects the
+only keyword that can match, which is then compared in full.
+
+If the list has no hash, LookForKeywordInOrder() is used instead.
+
+The return value and the state left in pParseVars are the same as for
+LookForKeywordInOrder().
+*/
+int LookForKeyword(_In_ ParseVarsType *pParseVars)
+{
+LPSTR   pInStart = pParseVars->pInPJL_Local;
+LPSTR   pIn;
+DWORD   dwIndex;
+DWORD   cb;
+BYTE    c, slot;
+KeywordType *pKeywords = pParseVars->pCurrentKeywords;
+KeywordHashType *pHash = pParseVars->pCurrentHash;
+LPSTR   pKeywordString;
+
+if ( (pHash==NULL)||(pHash->dwSeed==0)||(pHash->pListOfKeywords!=pKeywords) )
+   {
+   return(LookForKeywordInOrder(pParseVars));
+   }
+
+/* Every keyword is longer than dwOffset, so shorter input matches none */
+for ( cb=0; cb<pHash->dwOffset; cb++ )
+   {
+   if ( pInStart[cb]==0 )
+      {
+      return(-1);
+      }
+   }
+
+slot = pHash->slot[HashKeywordChar(pHash->dwSeed, (BYTE)pInStart[cb])];
+if ( slot==0 )
+   {
+   return(-1);
+   }
+
+dwIndex = slot-1;
+pKeywordString = pKeywords[dwIndex].lpsz;
+pIn = pInStart;
+while ( (c=*pKeywordString++)!=0 )
+   {
+   if ( c!=*pIn++ )
+      {
+      break;
+      }
+   }
+
+DBG_MSG(DBG_TRACE, ("LookForKeyword found %d\n", (c==0)?(int)dwIndex:-1));
+
+if ( c!=0 )
+   {
+   return(-1);
+   }
+
+pParseVars->pInPJL_Local = pIn;
+pParseVars->dwFoundIndex = dwIndex;
+
+return((int)dwIndex);
+}
+
+
+/*
+int LookForKeywordInOrder(ParseVarsType *pParseVars)
+
 This function looks through the current keyword list in search of a
 keyword that matches the characters in the input stream pointed to
 by pParseVars->pInPJL_Local.
@@ -538,7 +651,7 @@ If no match is found:
         The return value is -1.
         pParseVars->pInPJL_Local is unchanged.
 */
-int LookForKeyword(_In_ ParseVarsType *pParseVars)
+int LookForKeywordInOrder(_In_ ParseVarsType *pParseVars)
 {
 LPSTR   pInStart = pParseVars->pInPJL_Local;
 LPSTR   pIn;
@@ -966,6 +1079,7 @@ void GetCodeAndOnlineFF(_In_ ParseVarsType *pParseVars, ParamType param)
       }
    StoreToken(pParseVars, TOKEN_INFO_STATUS_ONLINE);
    pParseVars->pCurrentKeywords = FALSEandTRUEKeywords;
+   pParseVars->pCurrentHash = &FALSEandTRUEHash;
    if ( (value=LookForKeyword(pParseVars))==-1 )
       {
       /* Not TRUE or FALSE */
@@ -1162,6 +1276,7 @@ void GetTokenFromIndexValueFromBooleanEOL
    StoreToken(pParseVars,
       pParseVars->pCurrentList->tokenBaseValue+pParseVars->dwFoundIndex);
    pParseVars->pCurrentKeywords = FALSEandTRUEKeywords;
+   pParseVars->pCurrentHash = &FALSEandTRUEHash;
 
    if ( (value=LookForKeyword(pParseVars))==-1 )
       {
@@ -1205,3 +1320,161 @@ void GetTokenFromIndexValueFromStringEOL
    return;
 }
 
+
+/*
+DWORD HashKeywordChar(DWORD dwSeed, BYTE c)
+
+This function hashes a character into a slot of a keyword hash table.
+The seed is the one the table was built with.
+*/
+DWORD HashKeywordChar(DWORD dwSeed, BYTE c)
+{
+   return( ((c * dwSeed) >> 3) & (KEYWORD_HASH_SLOTS-1) );
+}
+
+
+/*
+void BuildKeywordHash(KeywordHashType *pHash)
+
+This function builds the perfect hash of a keyword list.
+
+The character hashed is the first one at which every keyword is
+different (and that every keyword is longer than).  Seeds are then tried
+until each keyword lands in a slot of its own.
+
+If no hash can be built pHash->dwSeed is left as 0, and the list is
+searched in order.
+*/
+void BuildKeywordHash(_Inout_ KeywordHashType *pHash)
+{
+   KeywordType *pKeywords = pHash->pListOfKeywords;
+   DWORD nKeywords, i, j;
+   DWORD dwOffset, cbShortest = (DWORD)-1, cb;
+   DWORD dwSeed, dwSlot;
+   BOOL  bDistinct = FALSE;
+
+   pHash->dwSeed = 0;
+
+   for ( nKeywords=0; pKeywords[nKeywords].lpsz!=NULL; nKeywords++ )
+      {
+      cb = (DWORD)strlen(pKeywords[nKeywords].lpsz);
+      if ( cb<cbShortest )
+         {
+         cbShortest = cb;
+         }
+      }
+
+   if ( (nKeywords==0)||(nKeywords>KEYWORD_HASH_SLOTS/2) )
+      {
+      return;
+      }
+
+   /* Find the first character that keeps the keywords apart */
+   for ( dwOffset=0; !bDistinct && dwOffset<cbShortest; dwOffset++ )
+      {
+      bDistinct = TRUE;
+      for ( i=0; bDistinct && i<nKeywords; i++ )
+         {
+         for ( j=i+1; bDistinct && j<nKeywords; j++ )
+            {
+            if ( pKeywords[i].lpsz[dwOffset]==pKeywords[j].lpsz[dwOffset] )
+               {
+               bDistinct = FALSE;
+               }
+            }
+         }
+      }
+
+   if ( !bDistinct )
+      {
+      DBG_MSG(DBG_TRACE, ("BuildKeywordHash keywords not distinct\n"));
+      return;
+      }
+
+   /* dwOffset is one past the character that was found */
+   dwOffset--;
+
+   /* Find a seed that gives every keyword a slot of its own */
+   for ( dwSeed=1; dwSeed<=255; dwSeed++ )
+      {
+      ZeroMemory(pHash->slot, sizeof(pHash->slot));
+
+      for ( i=0; i<nKeywords; i++ )
+         {
+         dwSlot = HashKeywordChar(dwSeed, (BYTE)pKeywords[i].lpsz[dwOffset]);
+         if ( pHash->slot[dwSlot]!=0 )
+            {
+            break;
+            }
+         pHash->slot[dwSlot] = (BYTE)(i+1);
+         }
+
+      if ( i==nKeywords )
+         {
+         pHash->dwOffset = dwOffset;
+         pHash->dwSeed = dwSeed;
+         return;
+         }
+      }
+
+   DBG_MSG(DBG_WARN, ("BuildKeywordHash no seed found\n"));
+   return;
+}
+
+
+/* InitPJLKeywordHashes
+This function builds the hash of every keyword list.  It must be called
+once before GetPJLTokens() is first used.
+*/
+void InitPJLKeywordHashes(void)
+{
+   DWORD i;
+
+   for ( i=0; pKeywordHashes[i]!=NULL; i++ )
+      {
+      BuildKeywordHash(pKeywordHashes[i]);
+      }
+   return;
+}
+
+
+/* IsPJLCommandComplete
+This function tells the caller whether GetPJLTokens() has enough input to
+finish with the command at the start of lpInPJL.
+
+The parser never looks past the first <FF>, so once there is one the
+command can be parsed.  Without a <FF> the input is only worth parsing
+if it has no '@PJL', in which case GetPJLTokens() discards it.  Input
+that ends with the start of an '@PJL' is kept too, or the command it
+begins would be lost.
+
+The return value is FALSE if the command is still arriving; the caller
+should wait for more input rather than parse it again, and drop what it
+kept once the printer has no more to send.
+*/
+BOOL IsPJLCommandComplete(_In_ LPSTR lpInPJL)
+{
+   LPSTR lpEnd;
+   DWORD cb;
+
+   if ( strchr(lpInPJL, FF)!=NULL )
+      {
+      return(TRUE);
+      }
+
+   if ( strstr(lpInPJL, "@PJL")!=NULL )
+      {
+      return(FALSE);
+      }
+
+   lpEnd = lpInPJL + strlen(lpInPJL);
+   for ( cb = 1; cb < 4 && cb <= (DWORD)(lpEnd - lpInPJL); cb++ )
+      {
+      if ( strncmp(lpEnd - cb, "@PJL", cb)==0 )
+         {
+         return(FALSE);
+         }
+      }
+
+   return(TRUE);
+}
@@ -15,6 +15,9 @@ Abstract:
 
 #define MAX_POSSIBLE_LISTS_IN_BRANCH 2
 
+/* Number of slots in a keyword hash table, must be a power of 2 */
+#define KEYWORD_HASH_SLOTS 32
+
 /* Note: new actions must be added at end, and new functions at the
 end of the function pointer array defined later in this file */
 enum ParseActionsEnumTag
@@ -121,12 +124,28 @@ typedef struct KeywordTypeTag
    ParamType param;
    } KeywordType;
 
+/* Perfect hash of the keywords in one keyword list, built by
+   InitPJLKeywordHashes().  Only the character at dwOffset is hashed;
+   every keyword is longer than that and has a different character
+   there, so it has a slot of its own and a lookup needs one full string
+   compare.  A dwSeed of 0 means no hash could be built and the list is
+   searched in order.
+*/
+typedef struct KeywordHashTag
+   {
+   KeywordType *pListOfKeywords;
+   DWORD dwSeed;
+   DWORD dwOffset;
+   BYTE  slot[KEYWORD_HASH_SLOTS];  /* keyword index+1, 0 if empty */
+   } KeywordHashType;
+
 typedef struct ListTypeTag
    {
    BOOL  bFormFeedOK;
    DWORD dwNotFoundAction;
    DWORD tokenBaseValue;
    KeywordType *pListOfKeywords;
+   KeywordHashType *pKeywordHash;
    } ListType;
 
 typedef struct parseVarsTag
@@ -140,6 +159,7 @@ typedef struct parseVarsTag
    DWORD        status;
    ListType     *pCurrentList;
    KeywordType  *pCurrentKeywords;
+   KeywordHashType *pCurrentHash;
    ListType     *arrayOfLists[MAX_POSSIBLE_LISTS_IN_BRANCH+1];
    } ParseVarsType;
 
@@ -148,6 +168,10 @@ typedef struct parseVarsTag
 extern DWORD GetPJLTokens(_In_ LPSTR lpInPJL, DWORD nTokenInBuffer,
    _Out_writes_(nTokenInBuffer) TokenPairType *pToken, _Out_ DWORD *pnTokenParsed, _Out_ LPSTR *plpInPJL);
 
+extern void InitPJLKeywordHashes(void);
+
+extern BOOL IsPJLCommandComplete(_In_ LPSTR lpInPJL);
+
 typedef struct
     {
     DWORD   pjl;
@@ -42,6 +42,8 @@ Revision History:
 DWORD   ProcessPJLString(_In_ PINIPORT, _In_ LPSTR, _Out_ DWORD *);
 VOID    ProcessParserError(DWORD);
 VOID    InterpreteTokens(_In_ PINIPORT pIniPort, _In_ PTOKENPAIR tokenPairs, DWORD nTokenParsed);
+BOOL    IsPrinterStatusUnchanged(_In_ PINIPORT pIniPort, _In_ PTOKENPAIR tokenPairs, DWORD nTokenParsed);
+VOID    RememberPrinterStatus(_In_ PINIPORT pIniPort, _In_ PTOKENPAIR tokenPairs, DWORD nTokenParsed);
 BOOL    IsPJL(_In_ PINIPORT pIniPort);
 BOOL    WriteCommand(_In_ HANDLE hPort, _In_ LPSTR cmd);
 BOOL    ReadCommand(_In_ HANDLE hPort);
@@ -83,6 +85,7 @@ Return Value:
 
         InitializeCriticalSection(&pjlMonSection);
         bPjlMonSection = TRUE;
+        InitPJLKeywordHashes();
         DisableThreadLibraryCalls(hModule);
         break;
 
@@ -1004,7 +1007,20 @@ Return Value:
             }
         } else {
 
-            SPLASSERT(!cbPrevious);
+            //
+            // The printer has nothing more to send, so the start of a command
+            // held back in string will not be finished by this read. Drop it
+            // rather than keep polling for the rest
+            //
+            if ( cbPrevious ) {
+
+                DBG_MSG(DBG_WARN,
+                        ("ReadCommand dropping %d bytes of an incomplete command\n",
+                         cbPrevious));
+                cbPrevious = 0;
+            }
+
+            break;
         }
 
         if ( status != STATUS_END_OF_STRING && cbRead != cbToRead )
@@ -1316,13 +1332,29 @@ Return Value:
             !mystrncmp(pInString, "PCL\015\012INFO MEMORY", 16) )
             pIniPort->status |= PP_IS_PJL;
 
+        //
+        // If the rest of the command has not been read yet, wait for it
+        // rather than parse the start of the command on every read
+        //
+        if ( !IsPJLCommandComplete(pInString) ) {
+
+            status = STATUS_END_OF_STRING;
+            break;
+        }
+
         status = GetPJLTokens(pInString, NTOKEN, tokenPairs,
                               &nTokenParsedRet, &lpRet);
 
         if (status == STATUS_REACHED_END_OF_COMMAND_OK) {
 
             pIniPort->status |= PP_IS_PJL;
-            InterpreteTokens(pIniPort, tokenPairs, nTokenParsedRet);
+
+            //
+            // Printers repeat the same unsolicited status over and over,
+            // only act on it when something has changed
+            //
+            if ( !IsPrinterStatusUnchanged(pIniPort, tokenPairs, nTokenParsedRet) )
+                InterpreteTokens(pIniPort, tokenPairs, nTokenParsedRet);
         } else {
 
             ProcessParserError(status);
@@ -1552,9 +1584,154 @@ Return Value:
                    ("pjlmon: SetPort failed %d (LE: %d)\n",
                     pIniPort->PrinterStatus, GetLastError()));
 
-            pIniPort->PrinterStatus = OldStatus;
+            //
+            // Forget the reply so the next one tries SetPort again
+            //
+            pIniPort->PrinterStatus     = OldStatus;
+            pIniPort->cLastStatusTokens = 0;
+            return;
+        }
+    }
+
+    RememberPrinterStatus(pIniPort, tokenPairs, nTokenParsed);
+}
+
+
+BOOL
+GetStatusTokens(
+    _In_    PTOKENPAIR tokenPairs,
+            DWORD nTokenParsed,
+    _Out_writes_(MAX_STATUS_TOKENS) UINT_PTR StatusTokens[MAX_STATUS_TOKENS][2],
+    _Out_   DWORD *pcStatusTokens
+)
+/*++
+
+Routine Description:
+    Pick out the tokens of a reply that InterpreteTokens uses to set the
+    printer status (CODE and ONLINE). DISPLAY is skipped as it is not used.
+
+Arguments:
+    tokenPairs      : List of token pairs
+    nTokenParsed    : Number of token pairs
+    StatusTokens    : On return the status tokens and values, in order
+    pcStatusTokens  : On return the number of status tokens
+
+Return Value:
+    TRUE if the reply holds nothing but status tokens, else FALSE
+
+--*/
+{
+    DWORD   i;
+
+    *pcStatusTokens = 0;
+
+    for (i = 0; i < nTokenParsed; i++) {
+
+        switch(tokenPairs[i].token) {
+
+        case TOKEN_USTATUS_DEVICE_DISPLAY:
+            break;
+
+        case TOKEN_INFO_STATUS_CODE:
+        case TOKEN_USTATUS_DEVICE_CODE:
+        case TOKEN_INFO_STATUS_ONLINE:
+        case TOKEN_USTATUS_DEVICE_ONLINE:
+
+            if ( *pcStatusTokens >= MAX_STATUS_TOKENS )
+                return FALSE;
+
+            StatusTokens[*pcStatusTokens][0] = tokenPairs[i].token;
+            StatusTokens[*pcStatusTokens][1] = tokenPairs[i].value;
+            ++*pcStatusTokens;
+            break;
+
+        default:
+            return FALSE;
         }
     }
+
+    return TRUE;
+}
+
+
+BOOL
+IsPrinterStatusUnchanged(
+    _In_    PINIPORT pIniPort,
+    _In_    PTOKENPAIR tokenPairs,
+            DWORD nTokenParsed
+)
+/*++
+
+Routine Description:
+    Check if a reply would leave the printer status as it is. That is the
+    case when the reply holds nothing but status tokens, they are the same
+    as in the last status reply InterpreteTokens handled, and the status
+    it set then has not been changed since. InterpreteTokens would compute
+    the same status again and not call SetPort, so it can be skipped.
+
+Arguments:
+    pIniPort        : Ini port
+    tokenPairs      : List of token pairs
+    nTokenParsed    : Number of token pairs
+
+Return Value:
+    TRUE if the reply does not need to be interpreted
+
+--*/
+{
+    UINT_PTR    StatusTokens[MAX_STATUS_TOKENS][2];
+    DWORD       cStatusTokens;
+
+    if ( !GetStatusTokens(tokenPairs, nTokenParsed,
+                          StatusTokens, &cStatusTokens) )
+        return FALSE;
+
+    return pIniPort->cLastStatusTokens == cStatusTokens + 1       &&
+           pIniPort->LastPrinterStatus == pIniPort->PrinterStatus  &&
+           pIniPort->LastStatusFlags   ==
+                            (pIniPort->status & PP_PRINTER_OFFLINE) &&
+           !memcmp(pIniPort->LastStatusTokens, StatusTokens,
+                   cStatusTokens * sizeof(StatusTokens[0]));
+}
+
+
+VOID
+RememberPrinterStatus(
+    _In_    PINIPORT pIniPort,
+    _In_    PTOKENPAIR tokenPairs,
+            DWORD nTokenParsed
+)
+/*++
+
+Routine Description:
+    Remember a status reply InterpreteTokens has just handled, and the
+    printer status it left, for IsPrinterStatusUnchanged
+
+Arguments:
+    pIniPort        : Ini port
+    tokenPairs      : List of token pairs
+    nTokenParsed    : Number of token pairs
+
+Return Value:
+    None
+
+--*/
+{
+    DWORD   cStatusTokens;
+
+    if ( !GetStatusTokens(tokenPairs, nTokenParsed,
+                          pIniPort->LastStatusTokens, &cStatusTokens) ) {
+
+        pIniPort->cLastStatusTokens = 0;
+        return;
+    }
+
+    //
+    // Stored one higher so that 0 means nothing is remembered
+    //
+    pIniPort->cLastStatusTokens = cStatusTokens + 1;
+    pIniPort->LastPrinterStatus = pIniPort->PrinterStatus;
+    pIniPort->LastStatusFlags   = pIniPort->status & PP_PRINTER_OFFLINE;
 }
 
 
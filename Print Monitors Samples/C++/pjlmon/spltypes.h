@@ -24,6 +24,8 @@ typedef struct _INIJOB {
     __int64 nTimeoutCount;
 } INIJOB, FAR *PINIJOB;
 
+#define MAX_STATUS_TOKENS   4
+
 typedef struct _INIPORT {       /* ipo */
     DWORD   signature;
     struct  _INIPORT FAR *pNext;
@@ -45,6 +47,15 @@ typedef struct _INIPORT {       /* ipo */
     DWORD   dwAvailableMemory;
     DWORD   dwInstalledMemory;
 
+    //
+    // The last status-only reply that was interpreted, and the printer
+    // status it left behind. See IsPrinterStatusUnchanged
+    //
+    DWORD   cLastStatusTokens;
+    UINT_PTR LastStatusTokens[MAX_STATUS_TOKENS][2];
+    DWORD   LastPrinterStatus;
+    DWORD   LastStatusFlags;
+
     MONITOR fn;
 
 } INIPORT, FAR *PINIPORT;
@@ -0,0 +1,21 @@
+/*++
+
+Module Name:
+
+    ntdddisk.h
+
+Abstract:
+
+    Host stand-in, see ntddk.h.
+
+--*/
+
+#pragma once
+
+typedef struct _DISK_GEOMETRY {
+    LARGE_INTEGER Cylinders;
+    int MediaType;
+    ULONG TracksPerCylinder;
+    ULONG SectorsPerTrack;
+    ULONG BytesPerSector;
+} DISK_GEOMETRY;
@@ -0,0 +1,193 @@
+/*++
+
+Module Name:
+
+    ntddk.h
+
+Abstract:
+
+    Minimal user mode stand-in for the kernel definitions used by the
+    Ramdisk sparse store (store.c), so that it can be built and exercised
+    on a host without the WDK. EX_SPIN_LOCK is implemented as a reader/writer
+    spin lock with the same shared/exclusive semantics as the kernel one.
+
+Environment:
+
+    Host (user mode), C11.
+
+--*/
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YieldProcessor()        _mm_pause()
+#else
+#define YieldProcessor()        ((void)0)
+#endif
+
+#define IN
+#define OUT
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Out_writes_bytes_(x)
+#define _In_reads_bytes_(x)
+#define DECLSPEC_CACHEALIGN     __attribute__((aligned(64)))
+#define PAGED_CODE()
+#define KdPrint(x)
+
+#ifndef min
+#define min(a, b)               (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)               (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef void                    VOID;
+typedef void                   *PVOID;
+typedef unsigned char           UCHAR, *PUCHAR, BOOLEAN;
+typedef char                    CCHAR;
+typedef unsigned short          USHORT;
+typedef uint16_t                WCHAR, *PWSTR;
+typedef int32_t                 LONG;
+typedef uint32_t                ULONG;
+typedef int64_t                 LONGLONG;
+typedef uint64_t                ULONGLONG;
+typedef LONG                    NTSTATUS;
+typedef UCHAR                   KIRQL;
+
+typedef union _LARGE_INTEGER {
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+} UNICODE_STRING;
+
+#define TRUE                            1
+#define FALSE                           0
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+
+typedef NTSTATUS DRIVER_INITIALIZE(PVOID DriverObject, PVOID RegistryPath);
+
+//
+// Pool. The test harness can make allocations fail to exercise the
+// STATUS_INSUFFICIENT_RESOURCES paths.
+//
+#define NonPagedPool                    0
+
+extern atomic_long HostPoolFailAfter;
+extern atomic_long HostPoolOutstanding;
+
+static inline PVOID
+ExAllocatePoolWithTag(int PoolType, size_t Size, ULONG Tag)
+{
+    PVOID p;
+
+    (void)PoolType;
+    (void)Tag;
+
+    if (atomic_load(&HostPoolFailAfter) >= 0 &&
+        atomic_fetch_sub(&HostPoolFailAfter, 1) <= 0) {
+        return NULL;
+    }
+
+    p = malloc(Size);
+    if (p) {
+        atomic_fetch_add(&HostPoolOutstanding, 1);
+    }
+    return p;
+}
+
+static inline VOID
+ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    (void)Tag;
+    atomic_fetch_sub(&HostPoolOutstanding, 1);
+    free(P);
+}
+
+#define RtlZeroMemory(d, n)     memset((d), 0, (n))
+#define RtlCopyMemory(d, s, n)  memcpy((d), (s), (n))
+
+static inline PVOID
+InterlockedCompareExchangePointer(PVOID volatile *Destination, PVOID Exchange, PVOID Comparand)
+{
+    __atomic_compare_exchange_n((PVOID *)Destination, &Comparand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+
+static inline PVOID
+InterlockedExchangePointer(PVOID volatile *Target, PVOID Value)
+{
+    return __atomic_exchange_n((PVOID *)Target, Value, __ATOMIC_SEQ_CST);
+}
+
+#define ReadPointerAcquire(p)   __atomic_load_n((PVOID *)(p), __ATOMIC_ACQUIRE)
+#define ReadPointerNoFence(p)   __atomic_load_n((PVOID *)(p), __ATOMIC_RELAXED)
+
+#define InterlockedIncrement(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+
+//
+// EX_SPIN_LOCK: the low bits count shared owners, the top bit marks an
+// exclusive owner.
+//
+typedef volatile LONG EX_SPIN_LOCK, *PEX_SPIN_LOCK;
+
+#define EX_SPIN_LOCK_EXCLUSIVE  ((LONG)0x80000000)
+
+static inline KIRQL
+ExAcquireSpinLockShared(PEX_SPIN_LOCK Lock)
+{
+    for (;;) {
+        LONG value = __atomic_load_n(Lock, __ATOMIC_RELAXED);
+
+        if (!(value & EX_SPIN_LOCK_EXCLUSIVE) &&
+            __atomic_compare_exchange_n(Lock, &value, value + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+        YieldProcessor();
+    }
+}
+
+static inline VOID
+ExReleaseSpinLockShared(PEX_SPIN_LOCK Lock, KIRQL OldIrql)
+{
+    (void)OldIrql;
+    __atomic_sub_fetch(Lock, 1, __ATOMIC_RELEASE);
+}
+
+static inline KIRQL
+ExAcquireSpinLockExclusive(PEX_SPIN_LOCK Lock)
+{
+    for (;;) {
+        LONG value = 0;
+
+        if (__atomic_compare_exchange_n(Lock, &value, EX_SPIN_LOCK_EXCLUSIVE, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+        YieldProcessor();
+    }
+}
+
+static inline VOID
+ExReleaseSpinLockExclusive(PEX_SPIN_LOCK Lock, KIRQL OldIrql)
+{
+    (void)OldIrql;
+    __atomic_store_n(Lock, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,13 @@
+/*++
+
+Module Name:
+
+    ntstrsafe.h
+
+Abstract:
+
+    Host stand-in, see ntddk.h.
+
+--*/
+
+#pragma once
@@ -0,0 +1,24 @@
+/*++
+
+Module Name:
+
+    wdf.h
+
+Abstract:
+
+    Host stand-in, see ntddk.h. Only the types named by ramdisk.h are
+    declared; none of the framework is available.
+
+--*/
+
+#pragma once
+
+#define KMDF_VERSION_MINOR 5
+
+typedef struct WDFDRIVER__ *WDFDRIVER;
+typedef struct WDFDEVICE_INIT *PWDFDEVICE_INIT;
+typedef struct WDFOBJECT__ *WDFOBJECT;
+typedef struct WDFQUEUE__ *WDFQUEUE;
+typedef struct WDFREQUEST__ *WDFREQUEST;
+
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(type, name)
@@ -0,0 +1,409 @@
+/*++
+
+Module Name:
+
+    storetest.c
+
+Abstract:
+
+    Host tests for the Ramdisk sparse store (../src/store.c):
+
+        - random reads, writes and discards checked against a flat
+          reference image, for disk sizes that are and aren't a multiple
+          of the chunk size, including the allocated chunk accounting;
+        - allocation failures reported as STATUS_INSUFFICIENT_RESOURCES
+          without corrupting the store;
+        - concurrent writers, readers and discarders on shared chunks,
+          checking that reads never return anything but zeros or data
+          written to that sector (no freed or misdirected memory). Run it
+          under -DSTORE_SANITIZE=address or thread to check the locking.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "ramdisk.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+atomic_long HostPoolFailAfter = -1;
+atomic_long HostPoolOutstanding = 0;
+
+static int Failures;
+
+#define CHECK(c) \
+    do { if (!(c)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); Failures++; } } while (0)
+
+static uint64_t
+Random64(uint64_t *State)
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static LONG
+CountChunks(const unsigned char *Allocated, ULONGLONG ChunkCount)
+{
+    LONG count = 0;
+    ULONGLONG i;
+
+    for (i = 0; i < ChunkCount; i++) {
+        count += Allocated[i];
+    }
+    return count;
+}
+
+/*
+ * Random operations against a flat reference image. Allocated[] tracks
+ * which chunks the store is expected to hold: a write allocates every chunk
+ * it touches, a discard frees the chunks it covers entirely.
+ */
+static void
+TestAgainstReference(ULONGLONG DiskLength, unsigned Operations, uint64_t Seed)
+{
+    RAMDISK_STORE store;
+    ULONGLONG chunkCount = (DiskLength + RAMDISK_CHUNK_SIZE - 1) >> RAMDISK_CHUNK_SHIFT;
+    unsigned char *reference = calloc(1, DiskLength);
+    unsigned char *allocated = calloc(1, chunkCount);
+    unsigned char *buffer = malloc(4 * RAMDISK_CHUNK_SIZE);
+    uint64_t state = Seed;
+    unsigned op;
+
+    CHECK(RamDiskStoreInitialize(&store, DiskLength) == STATUS_SUCCESS);
+    CHECK(store.ChunkCount == chunkCount);
+
+    for (op = 0; op < Operations; op++) {
+        ULONGLONG offset = Random64(&state) % DiskLength;
+        size_t length = 1 + (size_t)(Random64(&state) % (4 * RAMDISK_CHUNK_SIZE));
+        unsigned kind = (unsigned)(Random64(&state) % 10);
+        ULONGLONG first;
+        ULONGLONG last;
+        ULONGLONG chunk;
+        size_t i;
+
+        //
+        // Bias a third of the operations to be chunk aligned, and some to
+        // run up to the end of the disk.
+        //
+        if (kind >= 7) {
+            offset &= ~(ULONGLONG)(RAMDISK_CHUNK_SIZE - 1);
+        }
+        if (op % 17 == 0) {
+            length = (size_t)(DiskLength - offset);
+            if (length > 4 * RAMDISK_CHUNK_SIZE) {
+                offset = DiskLength - 4 * RAMDISK_CHUNK_SIZE;
+                length = 4 * RAMDISK_CHUNK_SIZE;
+            }
+        }
+        if (offset + length > DiskLength) {
+            length = (size_t)(DiskLength - offset);
+        }
+
+        first = offset >> RAMDISK_CHUNK_SHIFT;
+        last = (offset + length - 1) >> RAMDISK_CHUNK_SHIFT;
+
+        switch (kind % 3) {
+
+            case 0:
+                for (i = 0; i < length; i++) {
+                    buffer[i] = (unsigned char)Random64(&state);
+                }
+                CHECK(RamDiskStoreWrite(&store, offset, buffer, length) == STATUS_SUCCESS);
+                memcpy(reference + offset, buffer, length);
+                for (chunk = first; chunk <= last; chunk++) {
+                    allocated[chunk] = 1;
+                }
+                break;
+
+            case 1:
+                memset(buffer, 0xCC, length);
+                RamDiskStoreRead(&store, offset, buffer, length);
+                CHECK(memcmp(buffer, reference + offset, length) == 0);
+                break;
+
+            case 2:
+                RamDiskStoreDiscard(&store, offset, length);
+                memset(reference + offset, 0, length);
+                for (chunk = first; chunk <= last; chunk++) {
+                    ULONGLONG chunkStart = chunk << RAMDISK_CHUNK_SHIFT;
+                    ULONGLONG chunkEnd = min(chunkStart + RAMDISK_CHUNK_SIZE, DiskLength);
+
+                    if (offset <= chunkStart && offset + length >= chunkEnd) {
+                        allocated[chunk] = 0;
+                    }
+                }
+                break;
+        }
+
+        CHECK(store.AllocatedChunks == CountChunks(allocated, chunkCount));
+        if (Failures) {
+            fprintf(stderr, "  disk %llu, operation %u, kind %u, offset %llu, length %zu\n",
+                    (unsigned long long)DiskLength, op, kind % 3, (unsigned long long)offset, length);
+            break;
+        }
+    }
+
+    //
+    // Whole disk comparison, then discard everything: nothing may stay
+    // allocated.
+    //
+    for (ULONGLONG offset = 0; offset < DiskLength && !Failures; offset += RAMDISK_CHUNK_SIZE) {
+        size_t length = (size_t)min((ULONGLONG)RAMDISK_CHUNK_SIZE, DiskLength - offset);
+
+        RamDiskStoreRead(&store, offset, buffer, length);
+        CHECK(memcmp(buffer, reference + offset, length) == 0);
+    }
+
+    RamDiskStoreDiscard(&store, 0, DiskLength);
+    CHECK(store.AllocatedChunks == 0);
+
+    RamDiskStoreCleanup(&store);
+    CHECK(atomic_load(&HostPoolOutstanding) == 0);
+
+    free(buffer);
+    free(allocated);
+    free(reference);
+}
+
+static void
+TestAllocationFailure(void)
+{
+    RAMDISK_STORE store;
+    const ULONGLONG diskLength = 64ull * RAMDISK_CHUNK_SIZE * RAMDISK_NODE_ENTRIES;
+    unsigned char *buffer = malloc(3 * RAMDISK_CHUNK_SIZE);
+    unsigned char *check = malloc(3 * RAMDISK_CHUNK_SIZE);
+    long failAfter;
+
+    memset(buffer, 0x5A, 3 * RAMDISK_CHUNK_SIZE);
+
+    for (failAfter = 0; failAfter < 6; failAfter++) {
+        NTSTATUS status;
+        size_t i;
+
+        CHECK(RamDiskStoreInitialize(&store, diskLength) == STATUS_SUCCESS);
+
+        //
+        // Straddle three chunks under two different interior nodes, so that
+        // nodes and chunks are allocated along the way.
+        //
+        atomic_store(&HostPoolFailAfter, failAfter);
+        status = RamDiskStoreWrite(&store,
+                                   (ULONGLONG)RAMDISK_NODE_ENTRIES * RAMDISK_CHUNK_SIZE - RAMDISK_CHUNK_SIZE - 512,
+                                   buffer,
+                                   3 * RAMDISK_CHUNK_SIZE);
+        atomic_store(&HostPoolFailAfter, -1);
+
+        CHECK(status == STATUS_SUCCESS || status == STATUS_INSUFFICIENT_RESOURCES);
+
+        //
+        // Whatever was written must be a prefix of the request, the rest
+        // must still read as zeros.
+        //
+        RamDiskStoreRead(&store,
+                         (ULONGLONG)RAMDISK_NODE_ENTRIES * RAMDISK_CHUNK_SIZE - RAMDISK_CHUNK_SIZE - 512,
+                         check,
+                         3 * RAMDISK_CHUNK_SIZE);
+        for (i = 0; i < 3 * RAMDISK_CHUNK_SIZE && check[i] == 0x5A; i++) {
+        }
+        for (; i < 3 * RAMDISK_CHUNK_SIZE && check[i] == 0; i++) {
+        }
+        CHECK(i == 3 * RAMDISK_CHUNK_SIZE);
+        CHECK(status != STATUS_SUCCESS || memcmp(check, buffer, 3 * RAMDISK_CHUNK_SIZE) == 0);
+
+        RamDiskStoreCleanup(&store);
+        CHECK(atomic_load(&HostPoolOutstanding) == 0);
+    }
+
+    free(check);
+    free(buffer);
+}
+
+/*
+ * Concurrency: each sector is owned by one writer, which fills it with
+ * (id, sequence) pairs. Readers and writers of a sector only hold its
+ * chunk lock shared, so a read racing a write or partial discard may see
+ * a mix of old and new data, like on a real disk; but every pair must be
+ * either zero or written by the owner. A discarder keeps freeing and
+ * zeroing chunks.
+ */
+#define STRESS_CHUNKS       8
+#define STRESS_SECTORS      (STRESS_CHUNKS * RAMDISK_CHUNK_SIZE / 512)
+#define STRESS_WRITERS      3
+#define STRESS_READERS      2
+
+typedef struct _STRESS {
+    RAMDISK_STORE Store;
+    atomic_int Stop;
+    atomic_long Invalid;
+} STRESS;
+
+typedef struct _STRESS_THREAD {
+    STRESS *Stress;
+    unsigned Id;
+} STRESS_THREAD;
+
+static void
+FillSector(uint32_t *Sector, uint32_t Id, uint32_t Sequence)
+{
+    unsigned i;
+
+    for (i = 0; i < 512 / sizeof(uint32_t); i += 2) {
+        Sector[i] = Id;
+        Sector[i + 1] = Sequence;
+    }
+}
+
+static int
+SectorValid(const uint32_t *Sector, ULONGLONG Index)
+{
+    uint32_t owner = (uint32_t)(Index % STRESS_WRITERS) + 1;
+    unsigned i;
+
+    for (i = 0; i < 512 / sizeof(uint32_t); i += 2) {
+        if (!((Sector[i] == 0 && Sector[i + 1] == 0) ||
+              (Sector[i] == owner && Sector[i + 1] != 0))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *
+StressWriter(void *Context)
+{
+    STRESS_THREAD *thread = Context;
+    uint64_t state = 0x9E3779B97F4A7C15ull * (thread->Id + 1);
+    uint32_t sector[128];
+    uint32_t sequence = 0;
+
+    while (!atomic_load(&thread->Stress->Stop)) {
+        ULONGLONG index = (Random64(&state) % (STRESS_SECTORS / STRESS_WRITERS)) * STRESS_WRITERS + thread->Id;
+
+        FillSector(sector, thread->Id + 1, ++sequence);
+        if (RamDiskStoreWrite(&thread->Stress->Store, index * 512, sector, 512) != STATUS_SUCCESS) {
+            atomic_fetch_add(&thread->Stress->Invalid, 1);
+        }
+    }
+    return NULL;
+}
+
+static void *
+StressReader(void *Context)
+{
+    STRESS_THREAD *thread = Context;
+    uint32_t *buffer = malloc(RAMDISK_CHUNK_SIZE * 2);
+    uint64_t state = 0xD1B54A32D192ED03ull * (thread->Id + 1);
+
+    while (!atomic_load(&thread->Stress->Stop)) {
+        ULONGLONG first = (Random64(&state) % (STRESS_CHUNKS - 1)) * (RAMDISK_CHUNK_SIZE / 512) +
+                          RAMDISK_CHUNK_SIZE / 1024;
+        unsigned i;
+
+        //
+        // Read across a chunk boundary.
+        //
+        RamDiskStoreRead(&thread->Stress->Store, first * 512, buffer, RAMDISK_CHUNK_SIZE);
+
+        for (i = 0; i < RAMDISK_CHUNK_SIZE / 512; i++) {
+            if (!SectorValid(buffer + i * 128, first + i)) {
+                atomic_fetch_add(&thread->Stress->Invalid, 1);
+            }
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+static void *
+StressDiscarder(void *Context)
+{
+    STRESS_THREAD *thread = Context;
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+
+    while (!atomic_load(&thread->Stress->Stop)) {
+        ULONGLONG chunk = Random64(&state) % STRESS_CHUNKS;
+
+        if (Random64(&state) & 1) {
+            RamDiskStoreDiscard(&thread->Stress->Store, chunk * RAMDISK_CHUNK_SIZE, RAMDISK_CHUNK_SIZE);
+        } else {
+            RamDiskStoreDiscard(&thread->Stress->Store, chunk * RAMDISK_CHUNK_SIZE + 4096, 8192);
+        }
+    }
+    return NULL;
+}
+
+static void
+TestConcurrency(unsigned Milliseconds)
+{
+    static STRESS stress;
+    STRESS_THREAD threads[STRESS_WRITERS + STRESS_READERS + 1];
+    pthread_t handles[STRESS_WRITERS + STRESS_READERS + 1];
+    struct timespec delay;
+    unsigned i;
+
+    memset(&stress, 0, sizeof(stress));
+    CHECK(RamDiskStoreInitialize(&stress.Store, (ULONGLONG)STRESS_CHUNKS * RAMDISK_CHUNK_SIZE) == STATUS_SUCCESS);
+
+    for (i = 0; i < STRESS_WRITERS + STRESS_READERS + 1; i++) {
+        threads[i].Stress = &stress;
+        threads[i].Id = i;
+        pthread_create(&handles[i],
+                       NULL,
+                       i < STRESS_WRITERS ? StressWriter :
+                       i < STRESS_WRITERS + STRESS_READERS ? StressReader : StressDiscarder,
+                       &threads[i]);
+    }
+
+    delay.tv_sec = Milliseconds / 1000;
+    delay.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+    nanosleep(&delay, NULL);
+    atomic_store(&stress.Stop, 1);
+
+    for (i = 0; i < STRESS_WRITERS + STRESS_READERS + 1; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    CHECK(atomic_load(&stress.Invalid) == 0);
+    CHECK(stress.Store.AllocatedChunks >= 0 && stress.Store.AllocatedChunks <= STRESS_CHUNKS);
+
+    //
+    // Once quiesced, the whole disk must still only hold valid sectors.
+    //
+    for (i = 0; i < STRESS_SECTORS; i++) {
+        uint32_t sector[128];
+
+        RamDiskStoreRead(&stress.Store, (ULONGLONG)i * 512, sector, 512);
+        CHECK(SectorValid(sector, i));
+    }
+
+    RamDiskStoreCleanup(&stress.Store);
+    CHECK(atomic_load(&HostPoolOutstanding) == 0);
+}
+
+int
+main(void)
+{
+    RAMDISK_STORE store;
+
+    CHECK(RamDiskStoreInitialize(&store, 0) == STATUS_INVALID_PARAMETER);
+
+    //
+    // Depth 0 (a single chunk), partial last chunk, and a two level tree
+    // with a partial last chunk.
+    //
+    TestAgainstReference(RAMDISK_CHUNK_SIZE, 2000, 1);
+    TestAgainstReference(5 * RAMDISK_CHUNK_SIZE + 12345, 5000, 2);
+    TestAgainstReference((ULONGLONG)RAMDISK_NODE_ENTRIES * RAMDISK_CHUNK_SIZE + 3 * RAMDISK_CHUNK_SIZE + 512, 20000, 3);
+
+    TestAllocationFailure();
+    TestConcurrency(1000);
+
+    printf("store tests: %s\n", Failures ? "FAILED" : "passed");
+    return Failures ? 1 : 0;
+}
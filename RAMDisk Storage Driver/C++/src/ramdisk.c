@@ -14,6 +14,10 @@ Abstract:
     find the device in the disk manager and format the media to use
     as FAT or NTFS volume.
 
+    The disk image is kept in a sparse store (see store.c) so that only
+    the parts of the disk that have been written to use memory, and
+    requests are dispatched in parallel.
+
 Environment:
 
     Kernel mode only.
@@ -102,7 +106,7 @@ Return Value:
     NTSTATUS               Status = STATUS_INVALID_PARAMETER;
     WDF_REQUEST_PARAMETERS Parameters;
     LARGE_INTEGER          ByteOffset;
-    WDFMEMORY              hMemory;
+    PVOID                  buffer;
 
     _Analysis_assume_(Length > 0);
 
@@ -113,13 +117,13 @@ Return Value:
 
     if (RamDiskCheckParameters(devExt, ByteOffset, Length)) {
 
-        Status = WdfRequestRetrieveOutputMemory(Request, &hMemory);
+        Status = WdfRequestRetrieveOutputBuffer(Request, Length, &buffer, NULL);
         if(NT_SUCCESS(Status)){
 
-            Status = WdfMemoryCopyFromBuffer(hMemory,   // Destination
-                                             0,         // Offset into the destination
-                                             devExt->DiskImage + ByteOffset.LowPart, // source
-                                             Length);
+            RamDiskStoreRead(&devExt->Store,
+                             (ULONGLONG)ByteOffset.QuadPart,
+                             buffer,
+                             Length);
         }
     }
 
@@ -162,7 +166,7 @@ Return Value:
     NTSTATUS               Status = STATUS_INVALID_PARAMETER;
     WDF_REQUEST_PARAMETERS Parameters;
     LARGE_INTEGER          ByteOffset;
-    WDFMEMORY              hMemory;
+    PVOID                  buffer;
 
     _Analysis_assume_(Length > 0);
 
@@ -173,13 +177,13 @@ Return Value:
 
     if (RamDiskCheckParameters(devExt, ByteOffset, Length)) {
 
-        Status = WdfRequestRetrieveInputMemory(Request, &hMemory);
+        Status = WdfRequestRetrieveInputBuffer(Request, Length, &buffer, NULL);
         if(NT_SUCCESS(Status)){
 
-            Status = WdfMemoryCopyToBuffer(hMemory, // Source
-                                    0,              // offset in Source memory where the copy has to start
-                                    devExt->DiskImage + ByteOffset.LowPart, // destination
-                                    Length);
+            Status = RamDiskStoreWrite(&devExt->Store,
+                                       (ULONGLONG)ByteOffset.QuadPart,
+                                       buffer,
+                                       Length);
         }
 
     }
@@ -229,27 +233,31 @@ Return Value:
     PDEVICE_EXTENSION devExt = QueueGetExtension(Queue)->DeviceExtension;
 
     UNREFERENCED_PARAMETER(OutputBufferLength);
-    UNREFERENCED_PARAMETER(InputBufferLength);
 
     switch (IoControlCode) {
     case IOCTL_DISK_GET_PARTITION_INFO: {
 
             PPARTITION_INFORMATION outputBuffer;
-            PBOOT_SECTOR bootSector = (PBOOT_SECTOR) devExt->DiskImage;
+            CCHAR fatType;
 
             information = sizeof(PARTITION_INFORMATION);
 
             Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(PARTITION_INFORMATION), &outputBuffer, &bufSize);
             if(NT_SUCCESS(Status) ) {
 
+                RamDiskStoreRead(&devExt->Store,
+                                 FIELD_OFFSET(BOOT_SECTOR, bsFileSystemType) + 4,
+                                 &fatType,
+                                 sizeof(fatType));
+
                 outputBuffer->PartitionType =
-                    (bootSector->bsFileSystemType[4] == '6') ? PARTITION_FAT_16 : PARTITION_FAT_12;
+                    (fatType == '6') ? PARTITION_FAT_16 : PARTITION_FAT_12;
 
                 outputBuffer->BootIndicator       = FALSE;
                 outputBuffer->RecognizedPartition = TRUE;
                 outputBuffer->RewritePartition    = FALSE;
                 outputBuffer->StartingOffset.QuadPart = 0;
-                outputBuffer->PartitionLength.QuadPart = devExt->DiskRegInfo.DiskSize;
+                outputBuffer->PartitionLength.QuadPart = devExt->DiskLength;
                 outputBuffer->HiddenSectors       = (ULONG) (1L);
                 outputBuffer->PartitionNumber     = (ULONG) (-1L);
 
@@ -277,6 +285,68 @@ Return Value:
         }
         break;
 
+    case IOCTL_DISK_GET_LENGTH_INFO:  {
+
+            PGET_LENGTH_INFORMATION outputBuffer;
+
+            information = sizeof(GET_LENGTH_INFORMATION);
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(GET_LENGTH_INFORMATION), &outputBuffer, &bufSize);
+            if(NT_SUCCESS(Status) ) {
+
+                outputBuffer->Length.QuadPart = devExt->DiskLength;
+                Status = STATUS_SUCCESS;
+            }
+        }
+        break;
+
+    case IOCTL_STORAGE_QUERY_PROPERTY:  {
+
+            PSTORAGE_PROPERTY_QUERY query;
+            PDEVICE_TRIM_DESCRIPTOR outputBuffer;
+
+            //
+            // The only property we report is that discards are supported,
+            // so that file systems send us the ranges they free.
+            //
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(STORAGE_PROPERTY_QUERY), &query, &bufSize);
+            if(!NT_SUCCESS(Status) ) {
+                break;
+            }
+
+            if (query->PropertyId != StorageDeviceTrimProperty) {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
+
+            if (query->QueryType == PropertyExistsQuery) {
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            if (query->QueryType != PropertyStandardQuery) {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
+
+            information = sizeof(DEVICE_TRIM_DESCRIPTOR);
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(DEVICE_TRIM_DESCRIPTOR), &outputBuffer, &bufSize);
+            if(NT_SUCCESS(Status) ) {
+
+                outputBuffer->Version     = sizeof(DEVICE_TRIM_DESCRIPTOR);
+                outputBuffer->Size        = sizeof(DEVICE_TRIM_DESCRIPTOR);
+                outputBuffer->TrimEnabled = TRUE;
+                Status = STATUS_SUCCESS;
+            }
+        }
+        break;
+
+    case IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES:
+
+        Status = RamDiskDiscard(devExt, Request, InputBufferLength);
+        break;
+
     case IOCTL_DISK_CHECK_VERIFY:
     case IOCTL_DISK_IS_WRITABLE:
 
@@ -303,9 +373,7 @@ Routine Description:
    EvtDeviceAdd, except those things that are automatically cleaned
    up by the Framework.
 
-   In the case of this sample, everything is automatically handled.  In a
-   driver derived from this sample, it's quite likely that this function could
-   be deleted.
+   In the case of this sample, only the sparse store has to be freed.
 
 Arguments:
 
@@ -321,9 +389,7 @@ Return Value:
 
     PAGED_CODE();
 
-    if(pDeviceExtension->DiskImage) {
-        ExFreePool(pDeviceExtension->DiskImage);
-    }
+    RamDiskStoreCleanup(&pDeviceExtension->Store);
 }
 
 NTSTATUS
@@ -403,9 +469,12 @@ Return Value:
     // configure-fowarded using WdfDeviceConfigureRequestDispatching to goto
     // other queues get dispatched here.
     //
+    // Requests are dispatched in parallel; the sparse store does its own
+    // locking on a per chunk basis.
+    //
     WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE (
         &ioQueueConfig,
-        WdfIoQueueDispatchSequential
+        WdfIoQueueDispatchParallel
         );
 
     ioQueueConfig.EvtIoDeviceControl = RamDiskEvtIoDeviceControl;
@@ -479,16 +548,21 @@ Return Value:
         &pDeviceExtension->DiskRegInfo
         );
 
+    if (pDeviceExtension->DiskRegInfo.DiskSizeInMB != 0) {
+        pDeviceExtension->DiskLength =
+            (ULONGLONG)pDeviceExtension->DiskRegInfo.DiskSizeInMB * 1024 * 1024;
+    } else {
+        pDeviceExtension->DiskLength = pDeviceExtension->DiskRegInfo.DiskSize;
+    }
+
     //
-    // Allocate memory for the disk image.
+    // Set up the (initially empty) store for the disk image. Memory is only
+    // allocated as the disk gets written to.
     //
-    pDeviceExtension->DiskImage = ExAllocatePoolWithTag(
-        NonPagedPool,
-        pDeviceExtension->DiskRegInfo.DiskSize,
-        RAMDISK_TAG
-        );
+    status = RamDiskStoreInitialize(&pDeviceExtension->Store,
+                                    pDeviceExtension->DiskLength);
 
-    if (pDeviceExtension->DiskImage) {
+    if (NT_SUCCESS(status)) {
 
         UNICODE_STRING deviceName;
         UNICODE_STRING win32Name;
@@ -546,7 +620,7 @@ Return Value:
 
 {
 
-    RTL_QUERY_REGISTRY_TABLE rtlQueryRegTbl[5 + 1];  // Need 1 for NULL
+    RTL_QUERY_REGISTRY_TABLE rtlQueryRegTbl[6 + 1];  // Need 1 for NULL
     NTSTATUS                 Status;
     DISK_INFO                defDiskRegInfo;
 
@@ -557,6 +631,7 @@ Return Value:
     // Set the default values
 
     defDiskRegInfo.DiskSize          = DEFAULT_DISK_SIZE;
+    defDiskRegInfo.DiskSizeInMB      = DEFAULT_DISK_SIZE_IN_MB;
     defDiskRegInfo.RootDirEntries    = DEFAULT_ROOT_DIR_ENTRIES;
     defDiskRegInfo.SectorsPerCluster = DEFAULT_SECTORS_PER_CLUSTER;
 
@@ -607,6 +682,13 @@ Return Value:
     rtlQueryRegTbl[4].DefaultData   = defDiskRegInfo.DriveLetter.Buffer;
     rtlQueryRegTbl[4].DefaultLength = 0;
 
+    rtlQueryRegTbl[5].Flags         = RTL_QUERY_REGISTRY_DIRECT;
+    rtlQueryRegTbl[5].Name          = L"DiskSizeInMB";
+    rtlQueryRegTbl[5].EntryContext  = &DiskRegInfo->DiskSizeInMB;
+    rtlQueryRegTbl[5].DefaultType   = REG_DWORD;
+    rtlQueryRegTbl[5].DefaultData   = &defDiskRegInfo.DiskSizeInMB;
+    rtlQueryRegTbl[5].DefaultLength = sizeof(ULONG);
+
 
     Status = RtlQueryRegistryValues(
                  RTL_REGISTRY_ABSOLUTE | RTL_REGISTRY_OPTIONAL,
@@ -619,12 +701,14 @@ Return Value:
     if (NT_SUCCESS(Status) == FALSE) {
 
         DiskRegInfo->DiskSize          = defDiskRegInfo.DiskSize;
+        DiskRegInfo->DiskSizeInMB      = defDiskRegInfo.DiskSizeInMB;
         DiskRegInfo->RootDirEntries    = defDiskRegInfo.RootDirEntries;
         DiskRegInfo->SectorsPerCluster = defDiskRegInfo.SectorsPerCluster;
         RtlCopyUnicodeString(&DiskRegInfo->DriveLetter, &defDiskRegInfo.DriveLetter);
     }
 
     KdPrint(("DiskSize          = 0x%lx\n", DiskRegInfo->DiskSize));
+    KdPrint(("DiskSizeInMB      = 0x%lx\n", DiskRegInfo->DiskSizeInMB));
     KdPrint(("RootDirEntries    = 0x%lx\n", DiskRegInfo->RootDirEntries));
     KdPrint(("SectorsPerCluster = 0x%lx\n", DiskRegInfo->SectorsPerCluster));
     KdPrint(("DriveLetter       = %wZ\n",   &(DiskRegInfo->DriveLetter)));
@@ -643,6 +727,9 @@ Routine Description:
 
     This routine formats the new disk.
 
+    Only disks small enough for the FAT12/FAT16 layout built here get
+    formatted. Larger disks are left blank, to be formatted (eg. as NTFS)
+    by the user.
 
 Arguments:
 
@@ -656,20 +743,18 @@ Return Value:
 --*/
 {
 
-    PBOOT_SECTOR bootSector = (PBOOT_SECTOR) devExt->DiskImage;
-    PUCHAR       firstFatSector;
+    PBOOT_SECTOR bootSector;
+    UCHAR        firstFatBytes[4];  // Start of the first FAT sector
     ULONG        rootDirEntries;
     ULONG        sectorsPerCluster;
     USHORT       fatType;        // Type FAT 12 or 16
     USHORT       fatEntries;     // Number of cluster entries in FAT
     USHORT       fatSectorCnt;   // Number of sectors for FAT
-    PDIR_ENTRY   rootDir;        // Pointer to first entry in root dir
+    DIR_ENTRY    rootDir;        // First entry in root dir
+    NTSTATUS     status;
 
     PAGED_CODE();
     ASSERT(sizeof(BOOT_SECTOR) == 512);
-    ASSERT(devExt->DiskImage != NULL);
-
-    RtlZeroMemory(devExt->DiskImage, devExt->DiskRegInfo.DiskSize);
 
     devExt->DiskGeometry.BytesPerSector = 512;
     devExt->DiskGeometry.SectorsPerTrack = 32;     // Using Ramdisk value
@@ -679,7 +764,7 @@ Return Value:
     // Calculate number of cylinders.
     //
 
-    devExt->DiskGeometry.Cylinders.QuadPart = devExt->DiskRegInfo.DiskSize / 512 / 32 / 2;
+    devExt->DiskGeometry.Cylinders.QuadPart = devExt->DiskLength / 512 / 32 / 2;
 
     //
     // Our media type is RAMDISK_MEDIA_TYPE
@@ -693,6 +778,19 @@ Return Value:
         devExt->DiskGeometry.SectorsPerTrack, devExt->DiskGeometry.BytesPerSector
         ));
 
+    if (devExt->DiskLength / devExt->DiskGeometry.BytesPerSector > MAXUSHORT) {
+
+        KdPrint(("Disk too large for FAT12/FAT16, leaving it unformatted\n"));
+        return STATUS_SUCCESS;
+    }
+
+    bootSector = ExAllocatePoolWithTag(PagedPool, sizeof(BOOT_SECTOR), RAMDISK_TAG);
+    if (bootSector == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(bootSector, sizeof(BOOT_SECTOR));
+
     rootDirEntries = devExt->DiskRegInfo.RootDirEntries;
     sectorsPerCluster = devExt->DiskRegInfo.SectorsPerCluster;
 
@@ -739,7 +837,7 @@ Return Value:
     bootSector->bsFATs        = 1;
     bootSector->bsRootDirEnts = (USHORT)rootDirEntries;
 
-    bootSector->bsSectors     = (USHORT)(devExt->DiskRegInfo.DiskSize /
+    bootSector->bsSectors     = (USHORT)(devExt->DiskLength /
                                          devExt->DiskGeometry.BytesPerSector);
     bootSector->bsMedia       = (UCHAR)devExt->DiskGeometry.MediaType;
     bootSector->bsSecPerClus  = (UCHAR)sectorsPerCluster;
@@ -811,48 +909,72 @@ Return Value:
     bootSector->bsSig2[0] = 0x55;
     bootSector->bsSig2[1] = 0xAA;
 
+    status = RamDiskStoreWrite(&devExt->Store, 0, bootSector, sizeof(BOOT_SECTOR));
+
+    if (!NT_SUCCESS(status)) {
+        ExFreePoolWithTag(bootSector, RAMDISK_TAG);
+        return status;
+    }
+
     //
     // The FAT is located immediately following the boot sector.
     //
 
-    firstFatSector    = (PUCHAR)(bootSector + 1);
-    firstFatSector[0] = (UCHAR)devExt->DiskGeometry.MediaType;
-    firstFatSector[1] = 0xFF;
-    firstFatSector[2] = 0xFF;
+    RtlZeroMemory(firstFatBytes, sizeof(firstFatBytes));
+    firstFatBytes[0] = (UCHAR)devExt->DiskGeometry.MediaType;
+    firstFatBytes[1] = 0xFF;
+    firstFatBytes[2] = 0xFF;
 
     if (fatType == 16) {
-        firstFatSector[3] = 0xFF;
+        firstFatBytes[3] = 0xFF;
+    }
+
+    status = RamDiskStoreWrite(&devExt->Store,
+                               sizeof(BOOT_SECTOR),
+                               firstFatBytes,
+                               sizeof(firstFatBytes));
+
+    if (!NT_SUCCESS(status)) {
+        ExFreePoolWithTag(bootSector, RAMDISK_TAG);
+        return status;
     }
 
     //
     // The Root Directory follows the FAT
     //
-    rootDir = (PDIR_ENTRY)(bootSector + 1 + fatSectorCnt);
+    RtlZeroMemory(&rootDir, sizeof(rootDir));
 
     //
     // Set device name to "MS-RAMDR"
-    // NOTE: Fill all 8 characters, eg. sizeof(rootDir->deName);
+    // NOTE: Fill all 8 characters, eg. sizeof(rootDir.deName);
     //
-    rootDir->deName[0] = 'M';
-    rootDir->deName[1] = 'S';
-    rootDir->deName[2] = '-';
-    rootDir->deName[3] = 'R';
-    rootDir->deName[4] = 'A';
-    rootDir->deName[5] = 'M';
-    rootDir->deName[6] = 'D';
-    rootDir->deName[7] = 'R';
+    rootDir.deName[0] = 'M';
+    rootDir.deName[1] = 'S';
+    rootDir.deName[2] = '-';
+    rootDir.deName[3] = 'R';
+    rootDir.deName[4] = 'A';
+    rootDir.deName[5] = 'M';
+    rootDir.deName[6] = 'D';
+    rootDir.deName[7] = 'R';
 
     //
     // Set device extension name to "IVE"
-    // NOTE: Fill all 3 characters, eg. sizeof(rootDir->deExtension);
+    // NOTE: Fill all 3 characters, eg. sizeof(rootDir.deExtension);
     //
-    rootDir->deExtension[0] = 'I';
-    rootDir->deExtension[1] = 'V';
-    rootDir->deExtension[2] = 'E';
+    rootDir.deExtension[0] = 'I';
+    rootDir.deExtension[1] = 'V';
+    rootDir.deExtension[2] = 'E';
 
-    rootDir->deAttributes = DIR_ATTR_VOLUME;
+    rootDir.deAttributes = DIR_ATTR_VOLUME;
 
-    return STATUS_SUCCESS;
+    status = RamDiskStoreWrite(&devExt->Store,
+                               (ULONGLONG)(1 + fatSectorCnt) * sizeof(BOOT_SECTOR),
+                               &rootDir,
+                               sizeof(rootDir));
+
+    ExFreePoolWithTag(bootSector, RAMDISK_TAG);
+
+    return status;
 }
 
 BOOLEAN
@@ -872,9 +994,9 @@ RamDiskCheckParameters(
     // file system.
     //
 
-    if( devExt->DiskRegInfo.DiskSize < Length ||
+    if( devExt->DiskLength < Length ||
         ByteOffset.QuadPart < 0 || // QuadPart is signed so check for negative values
-        ((ULONGLONG)ByteOffset.QuadPart > (devExt->DiskRegInfo.DiskSize - Length)) ||
+        ((ULONGLONG)ByteOffset.QuadPart > (devExt->DiskLength - Length)) ||
             (Length & (devExt->DiskGeometry.BytesPerSector - 1))) {
 
         //
@@ -895,3 +1017,97 @@ RamDiskCheckParameters(
     return TRUE;
 }
 
+NTSTATUS
+RamDiskDiscard(
+    IN PDEVICE_EXTENSION devExt,
+    IN WDFREQUEST Request,
+    IN size_t InputBufferLength
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES. The only
+    action supported is Trim, which hands the memory backing the given ranges
+    back to the system. Discarded ranges read as zeros afterwards.
+
+Arguments:
+
+    devExt - Device extension of the ramdisk
+
+    Request - Handle to the framework request object.
+
+    InputBufferLength - length of the request's input buffer
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+
+{
+    PDEVICE_MANAGE_DATA_SET_ATTRIBUTES dsmAttributes;
+    PDEVICE_DATA_SET_RANGE             ranges;
+    ULONG                              rangeCount;
+    ULONG                              i;
+    size_t                             bufSize;
+    NTSTATUS                           Status;
+
+    Status = WdfRequestRetrieveInputBuffer(Request,
+                                           sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES),
+                                           &dsmAttributes,
+                                           &bufSize);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    if (dsmAttributes->Action != DeviceDsmAction_Trim) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    if (dsmAttributes->Flags & DEVICE_DSM_FLAG_ENTIRE_DATA_SET_RANGE) {
+
+        RamDiskStoreDiscard(&devExt->Store, 0, devExt->DiskLength);
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Make sure the ranges lie within the input buffer.
+    //
+    if (dsmAttributes->DataSetRangesOffset < sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES) ||
+        dsmAttributes->DataSetRangesOffset > InputBufferLength ||
+        dsmAttributes->DataSetRangesLength > InputBufferLength - dsmAttributes->DataSetRangesOffset ||
+        (dsmAttributes->DataSetRangesOffset & (TYPE_ALIGNMENT(DEVICE_DATA_SET_RANGE) - 1)) != 0) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ranges = (PDEVICE_DATA_SET_RANGE)((PUCHAR)dsmAttributes + dsmAttributes->DataSetRangesOffset);
+    rangeCount = dsmAttributes->DataSetRangesLength / sizeof(DEVICE_DATA_SET_RANGE);
+
+    for (i = 0; i < rangeCount; i++) {
+
+        if (ranges[i].StartingOffset < 0 ||
+            ranges[i].LengthInBytes > devExt->DiskLength ||
+            (ULONGLONG)ranges[i].StartingOffset > devExt->DiskLength - ranges[i].LengthInBytes) {
+
+            KdPrint((
+                "Error invalid discard range\n"
+                "StartingOffset: %I64x\n"
+                "LengthInBytes: %I64x\n",
+                ranges[i].StartingOffset,
+                ranges[i].LengthInBytes
+             ));
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        RamDiskStoreDiscard(&devExt->Store,
+                            (ULONGLONG)ranges[i].StartingOffset,
+                            ranges[i].LengthInBytes);
+    }
+
+    return STATUS_SUCCESS;
+}
+
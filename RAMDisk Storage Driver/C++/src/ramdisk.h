@@ -45,19 +45,53 @@ Environment:
 #define DIR_ENTRIES_PER_SECTOR          16
 
 #define DEFAULT_DISK_SIZE               (1024*1024)     // 1 MB
+#define DEFAULT_DISK_SIZE_IN_MB         0               // Use DiskSize
 #define DEFAULT_ROOT_DIR_ENTRIES        512
 #define DEFAULT_SECTORS_PER_CLUSTER     2
 #define DEFAULT_DRIVE_LETTER            L"Z:"
 
+//
+// The disk image is kept in a sparse store of fixed size chunks which are
+// only allocated when first written to, and read as zeros until then. The
+// chunks are found through a radix tree whose nodes each map
+// RAMDISK_NODE_ENTRIES children.
+//
+#define RAMDISK_CHUNK_SHIFT             16              // 64 KB chunks
+#define RAMDISK_CHUNK_SIZE              (1 << RAMDISK_CHUNK_SHIFT)
+#define RAMDISK_NODE_SHIFT              9
+#define RAMDISK_NODE_ENTRIES            (1 << RAMDISK_NODE_SHIFT)
+
+//
+// Number of locks the chunks are hashed over. Reads and writes hold the lock
+// of a chunk shared while copying to or from it, discarding a chunk holds it
+// exclusive. Needs to be a power of 2.
+//
+#define RAMDISK_CHUNK_LOCKS             64
+
+typedef struct DECLSPEC_CACHEALIGN _RAMDISK_CHUNK_LOCK {
+    EX_SPIN_LOCK    Lock;
+} RAMDISK_CHUNK_LOCK, *PRAMDISK_CHUNK_LOCK;
+
+typedef struct _RAMDISK_STORE {
+    PVOID           Root;               // Top node of the tree, or the chunk if Depth is 0
+    ULONG           Depth;              // Number of node levels above the chunks
+    ULONGLONG       DiskLength;         // Size of the disk in bytes
+    ULONGLONG       ChunkCount;         // Number of chunks spanned by the disk
+    volatile LONG   AllocatedChunks;    // Number of chunks currently allocated
+    RAMDISK_CHUNK_LOCK ChunkLocks[RAMDISK_CHUNK_LOCKS];
+} RAMDISK_STORE, *PRAMDISK_STORE;
+
 typedef struct _DISK_INFO {
     ULONG   DiskSize;           // Ramdisk size in bytes
+    ULONG   DiskSizeInMB;       // Ramdisk size in MB, overrides DiskSize if non-zero
     ULONG   RootDirEntries;     // No. of root directory entries
     ULONG   SectorsPerCluster;  // Sectors per cluster
     UNICODE_STRING DriveLetter; // Drive letter to be used
 } DISK_INFO, *PDISK_INFO;
 
 typedef struct _DEVICE_EXTENSION {
-    PUCHAR              DiskImage;                  // Pointer to beginning of disk image
+    RAMDISK_STORE       Store;                      // Sparse disk image
+    ULONGLONG           DiskLength;                 // Ramdisk size in bytes
     DISK_GEOMETRY       DiskGeometry;               // Drive parameters built by Ramdisk
     DISK_INFO           DiskRegInfo;                // Disk parameters from the registry
     UNICODE_STRING      SymbolicLink;               // Dos symbolic name; Drive letter
@@ -192,5 +226,50 @@ RamDiskCheckParameters(
     IN size_t Length
     );
 
+NTSTATUS
+RamDiskDiscard(
+    IN PDEVICE_EXTENSION devExt,
+    IN WDFREQUEST Request,
+    IN size_t InputBufferLength
+    );
+
+//
+// Sparse store routines (store.c)
+//
+
+NTSTATUS
+RamDiskStoreInitialize(
+    OUT PRAMDISK_STORE Store,
+    IN ULONGLONG DiskLength
+    );
+
+VOID
+RamDiskStoreCleanup(
+    IN PRAMDISK_STORE Store
+    );
+
+VOID
+RamDiskStoreRead(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    IN size_t Length
+    );
+
+NTSTATUS
+RamDiskStoreWrite(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    IN size_t Length
+    );
+
+VOID
+RamDiskStoreDiscard(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Offset,
+    IN ULONGLONG Length
+    );
+
 #endif    // _RAMDISK_H_
 
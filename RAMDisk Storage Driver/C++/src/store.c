@@ -0,0 +1,490 @@
+/*++
+
+Copyright (c) Microsoft Corporation, All Rights Reserved
+
+Module Name:
+
+    store.c
+
+Abstract:
+
+    This file implements the sparse backing store of the Ramdisk sample
+    driver. Instead of one contiguous allocation, the disk image is made up
+    of fixed size chunks that are allocated from nonpaged pool the first time
+    they are written to. Chunks that have never been written, or that have
+    been discarded, read as zeros.
+
+    The chunks are found through a radix tree. Interior nodes are arrays of
+    RAMDISK_NODE_ENTRIES pointers, and are installed with interlocked
+    compare-exchange and read with acquire semantics, so lookups never need a
+    lock. Nodes are only freed when the device goes away.
+
+    A chunk's lock (hashed from its index) is held shared while data is
+    copied to or from it, which lets any number of requests proceed in
+    parallel. Discarding a chunk takes the lock exclusive before unlinking
+    and freeing it.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+#include "ramdisk.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, RamDiskStoreInitialize)
+#pragma alloc_text(PAGE, RamDiskStoreCleanup)
+#endif
+
+static
+PVOID *
+RamDiskStoreGetChunkSlot(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG ChunkIndex,
+    IN BOOLEAN Allocate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the radix tree down to the slot that points to the
+    given chunk, optionally allocating the interior nodes along the way.
+
+Arguments:
+
+    Store - The sparse store
+
+    ChunkIndex - Index of the chunk to look up
+
+    Allocate - TRUE if missing interior nodes should be allocated
+
+Return Value:
+
+    Pointer to the slot holding the chunk pointer, or NULL if an interior
+    node is missing (and Allocate is FALSE, or the allocation failed).
+
+--*/
+
+{
+    PVOID  *slot = &Store->Root;
+    PVOID   node;
+    PVOID   newNode;
+    ULONG   level;
+
+    for (level = Store->Depth; level > 0; level--) {
+
+        node = ReadPointerAcquire(slot);
+
+        if (node == NULL) {
+
+            if (!Allocate) {
+                return NULL;
+            }
+
+            newNode = ExAllocatePoolWithTag(NonPagedPool,
+                                            RAMDISK_NODE_ENTRIES * sizeof(PVOID),
+                                            RAMDISK_TAG);
+            if (newNode == NULL) {
+                return NULL;
+            }
+
+            RtlZeroMemory(newNode, RAMDISK_NODE_ENTRIES * sizeof(PVOID));
+
+            //
+            // Someone else may have installed the node in the meantime, in
+            // which case theirs is used.
+            //
+            node = InterlockedCompareExchangePointer(slot, newNode, NULL);
+            if (node == NULL) {
+                node = newNode;
+            } else {
+                ExFreePoolWithTag(newNode, RAMDISK_TAG);
+            }
+        }
+
+        slot = &((PVOID *)node)[(ChunkIndex >> ((level - 1) * RAMDISK_NODE_SHIFT)) &
+                                (RAMDISK_NODE_ENTRIES - 1)];
+    }
+
+    return slot;
+}
+
+static
+VOID
+RamDiskStoreFreeNode(
+    IN PVOID Node,
+    IN ULONG Level
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a subtree of the radix tree, including the chunks.
+
+Arguments:
+
+    Node - The node (or chunk, if Level is 0) to free
+
+    Level - Number of node levels from Node down to the chunks
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    ULONG i;
+
+    if (Level > 0) {
+
+        for (i = 0; i < RAMDISK_NODE_ENTRIES; i++) {
+
+            if (((PVOID *)Node)[i] != NULL) {
+                RamDiskStoreFreeNode(((PVOID *)Node)[i], Level - 1);
+            }
+        }
+    }
+
+    ExFreePoolWithTag(Node, RAMDISK_TAG);
+}
+
+NTSTATUS
+RamDiskStoreInitialize(
+    OUT PRAMDISK_STORE Store,
+    IN ULONGLONG DiskLength
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty sparse store for a disk of the given
+    size. No memory is allocated until the disk is written to.
+
+Arguments:
+
+    Store - The sparse store to initialize
+
+    DiskLength - Size of the disk in bytes
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_PARAMETER for an empty disk.
+
+--*/
+
+{
+    ULONGLONG span = 1;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Store, sizeof(RAMDISK_STORE));
+
+    if (DiskLength == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Store->DiskLength = DiskLength;
+    Store->ChunkCount = (DiskLength + RAMDISK_CHUNK_SIZE - 1) >> RAMDISK_CHUNK_SHIFT;
+
+    //
+    // Use just enough levels to map every chunk.
+    //
+    while (span < Store->ChunkCount) {
+        span <<= RAMDISK_NODE_SHIFT;
+        Store->Depth++;
+    }
+
+    KdPrint(("Store: %I64u chunks, depth %lu\n", Store->ChunkCount, Store->Depth));
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+RamDiskStoreCleanup(
+    IN PRAMDISK_STORE Store
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees all the memory held by the sparse store. There must
+    not be any I/O in progress.
+
+Arguments:
+
+    Store - The sparse store
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PAGED_CODE();
+
+    if (Store->Root != NULL) {
+        RamDiskStoreFreeNode(Store->Root, Store->Depth);
+        Store->Root = NULL;
+    }
+
+    Store->AllocatedChunks = 0;
+}
+
+VOID
+RamDiskStoreRead(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    IN size_t Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data out of the sparse store. Ranges that have no
+    chunk allocated are returned as zeros.
+
+Arguments:
+
+    Store - The sparse store
+
+    Offset - Byte offset on the disk to read from
+
+    Buffer - Buffer to copy the data to
+
+    Length - Number of bytes to read. The caller has checked that the range
+             lies within the disk.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PUCHAR      buffer = Buffer;
+    ULONGLONG   chunkIndex;
+    ULONG       chunkOffset;
+    ULONG       copyLength;
+    PVOID      *slot;
+    PUCHAR      chunk;
+    PEX_SPIN_LOCK lock;
+    KIRQL       oldIrql;
+
+    while (Length > 0) {
+
+        chunkIndex = Offset >> RAMDISK_CHUNK_SHIFT;
+        chunkOffset = (ULONG)(Offset & (RAMDISK_CHUNK_SIZE - 1));
+        copyLength = (ULONG)min(Length, (size_t)(RAMDISK_CHUNK_SIZE - chunkOffset));
+
+        slot = RamDiskStoreGetChunkSlot(Store, chunkIndex, FALSE);
+
+        if (slot == NULL) {
+
+            RtlZeroMemory(buffer, copyLength);
+
+        } else {
+
+            lock = &Store->ChunkLocks[chunkIndex & (RAMDISK_CHUNK_LOCKS - 1)].Lock;
+            oldIrql = ExAcquireSpinLockShared(lock);
+
+            chunk = ReadPointerAcquire(slot);
+            if (chunk == NULL) {
+                RtlZeroMemory(buffer, copyLength);
+            } else {
+                RtlCopyMemory(buffer, chunk + chunkOffset, copyLength);
+            }
+
+            ExReleaseSpinLockShared(lock, oldIrql);
+        }
+
+        buffer += copyLength;
+        Offset += copyLength;
+        Length -= copyLength;
+    }
+}
+
+NTSTATUS
+RamDiskStoreWrite(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    IN size_t Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data into the sparse store, allocating the chunks
+    that are written to for the first time.
+
+Arguments:
+
+    Store - The sparse store
+
+    Offset - Byte offset on the disk to write to
+
+    Buffer - Buffer holding the data to write
+
+    Length - Number of bytes to write. The caller has checked that the range
+             lies within the disk.
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INSUFFICIENT_RESOURCES if a chunk could not be
+    allocated. In the latter case part of the data may have been written.
+
+--*/
+
+{
+    PUCHAR      buffer = Buffer;
+    ULONGLONG   chunkIndex;
+    ULONG       chunkOffset;
+    ULONG       copyLength;
+    PVOID      *slot;
+    PUCHAR      chunk;
+    PUCHAR      newChunk;
+    PEX_SPIN_LOCK lock;
+    KIRQL       oldIrql;
+
+    while (Length > 0) {
+
+        chunkIndex = Offset >> RAMDISK_CHUNK_SHIFT;
+        chunkOffset = (ULONG)(Offset & (RAMDISK_CHUNK_SIZE - 1));
+        copyLength = (ULONG)min(Length, (size_t)(RAMDISK_CHUNK_SIZE - chunkOffset));
+
+        slot = RamDiskStoreGetChunkSlot(Store, chunkIndex, TRUE);
+        if (slot == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        lock = &Store->ChunkLocks[chunkIndex & (RAMDISK_CHUNK_LOCKS - 1)].Lock;
+        oldIrql = ExAcquireSpinLockShared(lock);
+
+        chunk = ReadPointerAcquire(slot);
+
+        if (chunk == NULL) {
+
+            newChunk = ExAllocatePoolWithTag(NonPagedPool, RAMDISK_CHUNK_SIZE, RAMDISK_TAG);
+            if (newChunk == NULL) {
+                ExReleaseSpinLockShared(lock, oldIrql);
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            RtlZeroMemory(newChunk, RAMDISK_CHUNK_SIZE);
+
+            //
+            // A concurrent writer to the same chunk may have beaten us to it.
+            //
+            chunk = InterlockedCompareExchangePointer(slot, newChunk, NULL);
+            if (chunk == NULL) {
+                chunk = newChunk;
+                InterlockedIncrement(&Store->AllocatedChunks);
+            } else {
+                ExFreePoolWithTag(newChunk, RAMDISK_TAG);
+            }
+        }
+
+        RtlCopyMemory(chunk + chunkOffset, buffer, copyLength);
+
+        ExReleaseSpinLockShared(lock, oldIrql);
+
+        buffer += copyLength;
+        Offset += copyLength;
+        Length -= copyLength;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+RamDiskStoreDiscard(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Offset,
+    IN ULONGLONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards a range of the disk. Chunks entirely covered by
+    the range are freed, the covered part of the others is zeroed so that
+    the whole range reads as zeros afterwards.
+
+Arguments:
+
+    Store - The sparse store
+
+    Offset - Byte offset on the disk of the range to discard
+
+    Length - Number of bytes to discard. The caller has checked that the
+             range lies within the disk.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    ULONGLONG   chunkIndex;
+    ULONG       chunkOffset;
+    ULONG       discardLength;
+    PVOID      *slot;
+    PUCHAR      chunk;
+    PEX_SPIN_LOCK lock;
+    KIRQL       oldIrql;
+
+    while (Length > 0) {
+
+        chunkIndex = Offset >> RAMDISK_CHUNK_SHIFT;
+        chunkOffset = (ULONG)(Offset & (RAMDISK_CHUNK_SIZE - 1));
+        discardLength = (ULONG)min(Length, (ULONGLONG)(RAMDISK_CHUNK_SIZE - chunkOffset));
+
+        slot = RamDiskStoreGetChunkSlot(Store, chunkIndex, FALSE);
+
+        if (slot != NULL && ReadPointerNoFence(slot) != NULL) {
+
+            lock = &Store->ChunkLocks[chunkIndex & (RAMDISK_CHUNK_LOCKS - 1)].Lock;
+
+            //
+            // The last chunk may extend past the end of the disk, so it is
+            // entirely covered if the range runs up to the end of the disk.
+            //
+            if (discardLength == RAMDISK_CHUNK_SIZE ||
+                (chunkOffset == 0 && Offset + discardLength == Store->DiskLength)) {
+
+                oldIrql = ExAcquireSpinLockExclusive(lock);
+                chunk = InterlockedExchangePointer(slot, NULL);
+                ExReleaseSpinLockExclusive(lock, oldIrql);
+
+                if (chunk != NULL) {
+                    ExFreePoolWithTag(chunk, RAMDISK_TAG);
+                    InterlockedDecrement(&Store->AllocatedChunks);
+                }
+
+            } else {
+
+                oldIrql = ExAcquireSpinLockShared(lock);
+                chunk = ReadPointerAcquire(slot);
+                if (chunk != NULL) {
+                    RtlZeroMemory(chunk + chunkOffset, discardLength);
+                }
+                ExReleaseSpinLockShared(lock, oldIrql);
+            }
+        }
+
+        Offset += discardLength;
+        Length -= discardLength;
+    }
+}
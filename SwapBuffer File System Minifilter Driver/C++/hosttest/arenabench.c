@@ -0,0 +1,745 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    ArenaBench.c
+
+Abstract:
+
+    Host benchmark of the SwapBuffers swap buffer arena against allocating
+    every swap buffer from pool.  Threads stand in for processors issuing
+    I/O: each keeps a queue of operations in flight, allocating a swap
+    buffer when an operation starts and freeing it when it completes, some
+    of them on another processor as a completion DPC would.
+
+    SwapBuffers.c is built unchanged against the stand-ins in kernel/, and
+    the threads call its SwapAllocateBuffer and SwapFreeBuffer for a volume
+    context with an arena, or without one for pool.  Each thread names the
+    processor it stands in for, so it owns that processor's cache, as the
+    driver only touches a cache from its own processor at DISPATCH_LEVEL.
+    An operation completing elsewhere is handed to the thread for that
+    processor, which frees the buffer into its own cache.  The trim timer
+    never fires on the host; SwapTrimArena is called directly to end a
+    period.  The MDL each operation gets is not modelled, since both paths
+    allocate one.
+
+    usage: arenabench --selftest
+           arenabench [--seconds s] [--depth n] [--remote pct] [--size bytes]
+                      [--iops n] [threads...]
+
+    Without --size, swap buffer sizes are 4K, 16K, 64K and 256K in the
+    ratio 50:20:25:5.  --iops paces a run at that many operations per
+    second across all threads and reports the CPU time per operation.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "host.h"
+
+#include <pthread.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define MAX_THREADS                     64
+#define MAX_DEPTH                       256
+
+static int failures;
+
+#define CHECK(X) {                                                      \
+    if (!(X)) {                                                         \
+        printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #X ); \
+        failures += 1;                                                  \
+    }                                                                   \
+}
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static double
+Now (
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double
+CpuSeconds (
+    void
+    )
+{
+    struct rusage usage;
+
+    getrusage( RUSAGE_SELF, &usage );
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6 +
+           (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
+//
+//  Arena buffers of each size class handed out and not yet given back, and
+//  the most there were at once, counted when CountHeld is set.
+//
+
+static int CountHeld;
+static LONG HeldBuffers[SWAP_ARENA_CLASSES];
+static LONG PeakHeldBuffers[SWAP_ARENA_CLASSES];
+
+static void
+CountHeldBuffer (
+    PSWAP_ARENA_BUFFER ArenaBuffer,
+    LONG Count
+    )
+{
+    LONG held;
+    LONG peak;
+
+    if (!CountHeld || (ArenaBuffer == NULL)) {
+        return;
+    }
+
+    held = __atomic_add_fetch( &HeldBuffers[ArenaBuffer->SizeClass], Count, __ATOMIC_RELAXED );
+    peak = __atomic_load_n( &PeakHeldBuffers[ArenaBuffer->SizeClass], __ATOMIC_RELAXED );
+
+    while (held > peak) {
+        if (__atomic_compare_exchange_n( &PeakHeldBuffers[ArenaBuffer->SizeClass], &peak, held,
+                                         0, __ATOMIC_RELAXED, __ATOMIC_RELAXED )) {
+            break;
+        }
+    }
+}
+
+static LONGLONG
+SwapBufferBlocks (
+    void
+    )
+{
+    HOST_COUNTERS counters;
+
+    HostGetCounters( &counters );
+    return counters.SwapBufferBlocks;
+}
+
+static double
+SwapBufferMegabytes (
+    void
+    )
+{
+    HOST_COUNTERS counters;
+
+    HostGetCounters( &counters );
+    return (double)counters.SwapBufferBytes / (1024 * 1024);
+}
+
+//
+//  A volume context with an arena for Processors processors.
+//
+
+static int
+CreateArena (
+    PVOLUME_CONTEXT VolCtx,
+    uint32_t Processors
+    )
+{
+    memset( VolCtx, 0, sizeof(*VolCtx) );
+    VolCtx->SectorSize = MIN_SECTOR_SIZE;
+
+    HostSetProcessorCount( Processors );
+    return NT_SUCCESS( SwapCreateArena( &VolCtx->Arena ) );
+}
+
+static void
+TrimArena (
+    PVOLUME_CONTEXT VolCtx
+    )
+{
+    SwapTrimArena( NULL, VolCtx->Arena, NULL, NULL );
+}
+
+//
+//  The workload.
+//
+
+typedef struct _OPERATION {
+    uint8_t *Buffer;
+    PSWAP_ARENA_BUFFER ArenaBuffer;
+    uint32_t Length;
+    uint32_t Tag;
+} OPERATION;
+
+//
+//  Completions handed to another processor and not yet picked up.  With
+//  more threads than host processors a thread can be off the processor for
+//  a whole time slice, so keep this small; when it is full the operation
+//  completes where it is.
+//
+
+#define MAILBOX_SIZE                    64
+
+typedef struct _WORKER {
+    PVOLUME_CONTEXT VolCtx;
+    struct _WORKER *Workers;
+    uint32_t Cpu;
+    uint32_t ProcessorCount;
+    uint32_t Depth;
+    uint32_t RemotePercent;
+    uint32_t FixedSize;
+    double Rate;
+    double Start;
+    volatile int *Stop;
+    unsigned long long Operations;
+    unsigned long long Failures;
+    unsigned long long Corrupt;
+
+    //
+    //  Operations completed for us on other processors, whose buffers we
+    //  still have to free.
+    //
+
+    pthread_mutex_t MailboxLock;
+    uint32_t MailboxCount;
+    OPERATION Mailbox[MAILBOX_SIZE];
+} WORKER;
+
+static uint32_t
+PickLength (
+    WORKER *Worker,
+    uint64_t *State
+    )
+{
+    uint32_t pick;
+
+    if (Worker->FixedSize != 0) {
+        return Worker->FixedSize;
+    }
+
+    pick = (uint32_t)(Random64( State ) % 100);
+
+    if (pick < 50) {
+        return 0x1000;
+    } else if (pick < 70) {
+        return 0x4000;
+    } else if (pick < 95) {
+        return 0x10000;
+    }
+    return 0x40000;
+}
+
+static void
+FreeOperation (
+    WORKER *Worker,
+    OPERATION *Operation
+    )
+{
+    uint32_t page;
+
+    //
+    //  Nobody else may have written our buffer while we had it.
+    //
+
+    for (page = 0; page < Operation->Length; page += PAGE_SIZE) {
+        if (*(uint32_t *)(Operation->Buffer + page) != Operation->Tag) {
+            Worker->Corrupt += 1;
+            break;
+        }
+    }
+
+    CountHeldBuffer( Operation->ArenaBuffer, -1 );
+    SwapFreeBuffer( NULL, Worker->VolCtx, Operation->Buffer, Operation->ArenaBuffer, TRUE );
+    Operation->Buffer = NULL;
+}
+
+static void
+DrainMailbox (
+    WORKER *Worker
+    )
+{
+    OPERATION operations[MAILBOX_SIZE];
+    uint32_t count;
+    uint32_t i;
+
+    if (__atomic_load_n( &Worker->MailboxCount, __ATOMIC_RELAXED ) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock( &Worker->MailboxLock );
+    count = Worker->MailboxCount;
+    memcpy( operations, Worker->Mailbox, count * sizeof(OPERATION) );
+    __atomic_store_n( &Worker->MailboxCount, 0, __ATOMIC_RELAXED );
+    pthread_mutex_unlock( &Worker->MailboxLock );
+
+    for (i = 0; i < count; i++) {
+        FreeOperation( Worker, &operations[i] );
+    }
+}
+
+static void
+Complete (
+    WORKER *Worker,
+    OPERATION *Operation,
+    uint64_t *State
+    )
+{
+    WORKER *target;
+
+    if (Operation->Buffer == NULL) {
+        return;
+    }
+
+    if ((Worker->ProcessorCount > 1) &&
+        ((Random64( State ) % 100) < Worker->RemotePercent)) {
+
+        target = &Worker->Workers[(Worker->Cpu + 1 + Random64( State ) % (Worker->ProcessorCount - 1)) %
+                                  Worker->ProcessorCount];
+
+        pthread_mutex_lock( &target->MailboxLock );
+
+        if (target->MailboxCount < MAILBOX_SIZE) {
+            target->Mailbox[target->MailboxCount] = *Operation;
+            __atomic_store_n( &target->MailboxCount, target->MailboxCount + 1, __ATOMIC_RELAXED );
+            Operation->Buffer = NULL;
+        }
+
+        pthread_mutex_unlock( &target->MailboxLock );
+
+        if (Operation->Buffer == NULL) {
+            return;
+        }
+    }
+
+    FreeOperation( Worker, Operation );
+}
+
+static void *
+WorkerThread (
+    void *Context
+    )
+{
+    WORKER *worker = Context;
+    OPERATION operations[MAX_DEPTH];
+    uint64_t state = 0x9E3779B97F4A7C15ull * (worker->Cpu + 1);
+    unsigned long long count = 0;
+    struct timespec due;
+    double dueTime;
+    uint32_t slot;
+    uint32_t page;
+
+    HostSetCurrentProcessor( worker->Cpu );
+    memset( operations, 0, sizeof(operations) );
+
+    while (!__atomic_load_n( worker->Stop, __ATOMIC_RELAXED )) {
+
+        //
+        //  Pace ourselves if asked to, and pick up the buffers other
+        //  processors completed for us, every few operations.
+        //
+
+        if ((count & 15) == 0) {
+
+            if (worker->Rate > 0) {
+
+                dueTime = worker->Start + (double)count / worker->Rate;
+                due.tv_sec = (time_t)dueTime;
+                due.tv_nsec = (long)((dueTime - (double)due.tv_sec) * 1e9);
+                clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL );
+            }
+
+            DrainMailbox( worker );
+        }
+
+        slot = (uint32_t)(count % worker->Depth);
+
+        Complete( worker, &operations[slot], &state );
+
+        operations[slot].Length = PickLength( worker, &state );
+        operations[slot].Tag = (uint32_t)Random64( &state );
+        operations[slot].Buffer = SwapAllocateBuffer( NULL,
+                                                      worker->VolCtx,
+                                                      operations[slot].Length,
+                                                      TRUE,
+                                                      &operations[slot].ArenaBuffer );
+        CountHeldBuffer( operations[slot].ArenaBuffer, 1 );
+
+        if (operations[slot].Buffer == NULL) {
+            worker->Failures += 1;
+        } else {
+            for (page = 0; page < operations[slot].Length; page += PAGE_SIZE) {
+                *(uint32_t *)(operations[slot].Buffer + page) = operations[slot].Tag;
+            }
+        }
+
+        count += 1;
+    }
+
+    for (slot = 0; slot < worker->Depth; slot++) {
+        if (operations[slot].Buffer != NULL) {
+            FreeOperation( worker, &operations[slot] );
+        }
+    }
+
+    worker->Operations = count;
+    return NULL;
+}
+
+typedef struct _RUN_RESULT {
+    double OpsPerSecond;
+    double CpuMicroseconds;
+    unsigned long long Operations;
+    unsigned long long Failures;
+    unsigned long long Corrupt;
+} RUN_RESULT;
+
+static void
+Run (
+    PVOLUME_CONTEXT VolCtx,
+    uint32_t Threads,
+    uint32_t Depth,
+    uint32_t RemotePercent,
+    uint32_t FixedSize,
+    double Iops,
+    double Seconds,
+    RUN_RESULT *Result
+    )
+{
+    static WORKER workers[MAX_THREADS];
+    pthread_t handles[MAX_THREADS];
+    volatile int stop = 0;
+    struct timespec delay;
+    double start;
+    double cpuStart;
+    double elapsed;
+    uint32_t i;
+
+    memset( Result, 0, sizeof(*Result) );
+
+    start = Now();
+    cpuStart = CpuSeconds();
+
+    for (i = 0; i < Threads; i++) {
+
+        workers[i].VolCtx = VolCtx;
+        workers[i].Workers = workers;
+        workers[i].Cpu = i;
+        workers[i].ProcessorCount = Threads;
+        workers[i].Depth = Depth;
+        workers[i].RemotePercent = RemotePercent;
+        workers[i].FixedSize = FixedSize;
+        workers[i].Rate = Iops / Threads;
+        workers[i].Start = start;
+        workers[i].Stop = &stop;
+        workers[i].Operations = 0;
+        workers[i].Failures = 0;
+        workers[i].Corrupt = 0;
+        workers[i].MailboxCount = 0;
+        pthread_mutex_init( &workers[i].MailboxLock, NULL );
+    }
+
+    for (i = 0; i < Threads; i++) {
+        pthread_create( &handles[i], NULL, WorkerThread, &workers[i] );
+    }
+
+    delay.tv_sec = (time_t)Seconds;
+    delay.tv_nsec = (long)((Seconds - (double)delay.tv_sec) * 1e9);
+    nanosleep( &delay, NULL );
+    __atomic_store_n( &stop, 1, __ATOMIC_RELAXED );
+
+    for (i = 0; i < Threads; i++) {
+        pthread_join( handles[i], NULL );
+    }
+
+    for (i = 0; i < Threads; i++) {
+        DrainMailbox( &workers[i] );
+        pthread_mutex_destroy( &workers[i].MailboxLock );
+        Result->Operations += workers[i].Operations;
+        Result->Failures += workers[i].Failures;
+        Result->Corrupt += workers[i].Corrupt;
+    }
+
+    elapsed = Now() - start;
+
+    Result->OpsPerSecond = (double)Result->Operations / elapsed;
+    Result->CpuMicroseconds = (CpuSeconds() - cpuStart) * 1e6 / (double)(Result->Operations ? Result->Operations : 1);
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    VOLUME_CONTEXT volCtx;
+    PSWAP_ARENA arena;
+    PSWAP_ARENA_BUFFER arenaBufs[SWAP_ARENA_CLASSES + 1];
+    void *buffers[SWAP_ARENA_CLASSES + 1];
+    static const uint32_t lengths[SWAP_ARENA_CLASSES + 1] = {
+        1, PAGE_SIZE + 1, 3 * PAGE_SIZE, 8 * PAGE_SIZE, 9 * PAGE_SIZE, 32 * PAGE_SIZE, 64 * PAGE_SIZE, 64 * PAGE_SIZE + 1
+    };
+    RUN_RESULT result;
+    LONGLONG arenaBuffers;
+    LONGLONG classBuffers;
+    uint32_t cpu;
+    int period;
+    uint32_t i;
+
+    CHECK( CreateArena( &volCtx, 4 ) );
+    arena = volCtx.Arena;
+
+    //
+    //  Lengths map to the smallest class that holds them, page aligned, and
+    //  anything over 64 pages comes from pool.
+    //
+
+    for (i = 0; i < SWAP_ARENA_CLASSES + 1; i++) {
+        buffers[i] = SwapAllocateBuffer( NULL, &volCtx, lengths[i], TRUE, &arenaBufs[i] );
+        CHECK( buffers[i] != NULL );
+        CHECK( ((uintptr_t)buffers[i] & (PAGE_SIZE - 1)) == 0 );
+    }
+
+    CHECK( arenaBufs[0]->SizeClass == 0 );
+    CHECK( arenaBufs[1]->SizeClass == 1 );
+    CHECK( arenaBufs[2]->SizeClass == 2 );
+    CHECK( arenaBufs[3]->SizeClass == 3 );
+    CHECK( arenaBufs[4]->SizeClass == 4 );
+    CHECK( arenaBufs[5]->SizeClass == 5 );
+    CHECK( arenaBufs[6]->SizeClass == 6 );
+    CHECK( arenaBufs[7] == NULL );
+    CHECK( SwapBufferBlocks() == SWAP_ARENA_CLASSES + 1 );
+
+    HostSetCurrentProcessor( 1 );
+
+    for (i = 0; i < SWAP_ARENA_CLASSES + 1; i++) {
+        SwapFreeBuffer( NULL, &volCtx, buffers[i], arenaBufs[i], TRUE );
+    }
+
+    CHECK( SwapBufferBlocks() == SWAP_ARENA_CLASSES );
+
+    //
+    //  A freed buffer is handed out again, from the cache of the processor
+    //  that freed it, without growing the arena.
+    //
+
+    buffers[0] = SwapAllocateBuffer( NULL, &volCtx, PAGE_SIZE, TRUE, &arenaBufs[0] );
+    CHECK( arenaBufs[0] != NULL );
+    CHECK( arena->CpuCaches[1].Count[0] == 0 );
+    CHECK( SwapBufferBlocks() == SWAP_ARENA_CLASSES );
+    SwapFreeBuffer( NULL, &volCtx, buffers[0], arenaBufs[0], TRUE );
+
+    HostSetCurrentProcessor( 0 );
+
+    //
+    //  Under load from four processors with buffers completing on other
+    //  processors, no buffer is handed out twice.  The arena only grows
+    //  when the depot for a size class is empty, so it never holds more
+    //  buffers of a class than were ever handed out at once, plus what the
+    //  caches hold, plus one for each processor caught between a cache and
+    //  the depot.  Buffers of one class sitting in its depot don't stop
+    //  another class growing, so the bound holds for each class, not for
+    //  the arena as a whole.
+    //
+
+    CountHeld = 1;
+    Run( &volCtx, 4, 16, 30, 0, 0, 0.2, &result );
+    CountHeld = 0;
+
+    arenaBuffers = 0;
+
+    for (i = 0; i < SWAP_ARENA_CLASSES; i++) {
+
+        classBuffers = ExQueryDepthSList( &arena->Classes[i].Depot );
+
+        for (cpu = 0; cpu < 4; cpu++) {
+            classBuffers += arena->CpuCaches[cpu].Count[i];
+        }
+
+        CHECK( HeldBuffers[i] == 0 );
+        CHECK( classBuffers <= PeakHeldBuffers[i] + 4 * (SWAP_ARENA_CPU_CACHE_DEPTH + 1) );
+        arenaBuffers += classBuffers;
+    }
+
+    printf( "stress: %.0f ops/s, %lld arena buffers, %.1f MB\n",
+            result.OpsPerSecond, (long long)arenaBuffers, SwapBufferMegabytes() );
+    CHECK( result.Operations > 1000 );
+    CHECK( result.Failures == 0 );
+    CHECK( result.Corrupt == 0 );
+    CHECK( arenaBuffers == SwapBufferBlocks() );
+
+    //
+    //  Once idle, trimming hands the caches to the depots on the first
+    //  period and frees everything over the next few.
+    //
+
+    for (period = 0; (period < 16) && (SwapBufferBlocks() != 0); period++) {
+        TrimArena( &volCtx );
+    }
+
+    printf( "trim: %lld arena buffers left after %d periods\n", (long long)SwapBufferBlocks(), period );
+    CHECK( SwapBufferBlocks() == 0 );
+
+    //
+    //  While busy, trimming leaves the working set alone.
+    //
+
+    Run( &volCtx, 2, 8, 0, PAGE_SIZE, 0, 0.05, &result );
+    arenaBuffers = SwapBufferBlocks();
+    TrimArena( &volCtx );
+    CHECK( SwapBufferBlocks() == arenaBuffers );
+
+    SwapDeleteArena( arena );
+    CHECK( SwapBufferBlocks() == 0 );
+
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    uint32_t threadCounts[MAX_THREADS];
+    uint32_t threadCountCount = 0;
+    uint32_t depth = 32;
+    uint32_t remotePercent = 25;
+    uint32_t fixedSize = 0;
+    double iops = 65536;
+    double seconds = 1.0;
+    VOLUME_CONTEXT poolCtx;
+    VOLUME_CONTEXT arenaCtx;
+    RUN_RESULT pool;
+    RUN_RESULT arenaResult;
+    int corrupt = 0;
+    int period;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--seconds" ) == 0) && (i + 1 < argc)) {
+            seconds = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--depth" ) == 0) && (i + 1 < argc)) {
+            depth = (uint32_t)atoi( argv[++i] );
+        } else if ((strcmp( argv[i], "--remote" ) == 0) && (i + 1 < argc)) {
+            remotePercent = (uint32_t)atoi( argv[++i] );
+        } else if ((strcmp( argv[i], "--size" ) == 0) && (i + 1 < argc)) {
+            fixedSize = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--iops" ) == 0) && (i + 1 < argc)) {
+            iops = atof( argv[++i] );
+        } else if ((atoi( argv[i] ) > 0) && (atoi( argv[i] ) <= MAX_THREADS) && (threadCountCount < MAX_THREADS)) {
+            threadCounts[threadCountCount++] = (uint32_t)atoi( argv[i] );
+        } else {
+            fprintf( stderr,
+                     "usage: arenabench --selftest\n"
+                     "       arenabench [--seconds s] [--depth n] [--remote pct] [--size bytes]\n"
+                     "                  [--iops n] [threads...]\n" );
+            return 2;
+        }
+    }
+
+    if (threadCountCount == 0) {
+        threadCounts[threadCountCount++] = 1;
+        threadCounts[threadCountCount++] = 2;
+        threadCounts[threadCountCount++] = 4;
+        threadCounts[threadCountCount++] = 8;
+    }
+
+    if ((seconds <= 0) || (depth == 0) || (depth > MAX_DEPTH) || (remotePercent > 100) || (iops < 0)) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    memset( &poolCtx, 0, sizeof(poolCtx) );
+    poolCtx.SectorSize = MIN_SECTOR_SIZE;
+
+    printf( "%u operations in flight per thread, %u%% completing on another thread, %s, %.1fs per run\n",
+            depth, remotePercent, fixedSize ? "fixed size" : "4K/16K/64K/256K at 50:20:25:5", seconds );
+    printf( "unpaced:\n" );
+    printf( "%8s %14s %14s %9s %12s\n", "threads", "pool ops/s", "arena ops/s", "speedup", "arena MB" );
+
+    for (i = 0; i < (int)threadCountCount; i++) {
+
+        Run( &poolCtx, threadCounts[i], depth, remotePercent, fixedSize, 0, seconds, &pool );
+
+        if (!CreateArena( &arenaCtx, threadCounts[i] )) {
+            return 1;
+        }
+
+        Run( &arenaCtx, threadCounts[i], depth, remotePercent, fixedSize, 0, seconds, &arenaResult );
+
+        printf( "%8u %14.0f %14.0f %8.2fx %12.1f\n",
+                threadCounts[i],
+                pool.OpsPerSecond,
+                arenaResult.OpsPerSecond,
+                arenaResult.OpsPerSecond / pool.OpsPerSecond,
+                SwapBufferMegabytes() );
+
+        corrupt |= (pool.Corrupt != 0) || (arenaResult.Corrupt != 0);
+        SwapDeleteArena( arenaCtx.Arena );
+    }
+
+    if (iops > 0) {
+
+        printf( "paced at %.0f operations/s:\n", iops );
+        printf( "%8s %14s %14s %14s %14s %12s\n",
+                "threads", "pool ops/s", "pool us/op", "arena ops/s", "arena us/op", "arena MB" );
+
+        for (i = 0; i < (int)threadCountCount; i++) {
+
+            Run( &poolCtx, threadCounts[i], depth, remotePercent, fixedSize, iops, seconds, &pool );
+
+            if (!CreateArena( &arenaCtx, threadCounts[i] )) {
+                return 1;
+            }
+
+            Run( &arenaCtx, threadCounts[i], depth, remotePercent, fixedSize, iops, seconds, &arenaResult );
+
+            printf( "%8u %14.0f %14.2f %14.0f %14.2f %12.1f\n",
+                    threadCounts[i],
+                    pool.OpsPerSecond,
+                    pool.CpuMicroseconds,
+                    arenaResult.OpsPerSecond,
+                    arenaResult.CpuMicroseconds,
+                    SwapBufferMegabytes() );
+
+            corrupt |= (pool.Corrupt != 0) || (arenaResult.Corrupt != 0);
+
+            //
+            //  Show the arena giving its memory back once the load stops.
+            //
+
+            if (i == (int)threadCountCount - 1) {
+
+                printf( "idle trim periods:" );
+                for (period = 0; (period < 16) && (SwapBufferBlocks() != 0); period++) {
+                    TrimArena( &arenaCtx );
+                    printf( " %.1f", SwapBufferMegabytes() );
+                }
+                printf( " MB\n" );
+            }
+
+            SwapDeleteArena( arenaCtx.Arena );
+        }
+    }
+
+    if (corrupt) {
+        fprintf( stderr, "a buffer was handed out twice\n" );
+        return 1;
+    }
+
+    return 0;
+}
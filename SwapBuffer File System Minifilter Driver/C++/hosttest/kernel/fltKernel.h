@@ -0,0 +1,513 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    fltKernel.h
+
+Abstract:
+
+    User mode stand-in for the kernel and FltMgr headers SwapBuffers.c and
+    SwapTransform.c include, so that the filter, and with it the swap
+    buffer arena and the transforms, compiles unchanged on the host.
+
+    The FltMgr structures only have the fields the filter touches, and
+    kernel objects it never looks inside are opaque blobs.  A spin lock is
+    a real spin lock, and an interlocked SLIST is a list under one, with
+    its depth kept alongside.  There is no IRQL: each host thread stands in
+    for one processor, which it names with HostSetCurrentProcessor, so
+    raising to DISPATCH_LEVEL to stay on a processor is a no-op.  Timers
+    never fire, a program calls the DPC routine itself.  Structured
+    exception handling is reduced to straight line code: a try body is a
+    block with its own local label at the end, which leave jumps to from
+    anywhere in the body, and an except block is never entered, as nothing
+    on the host raises.  The
+    routines declared at the bottom are supplied by host.c, or by unused.c
+    for those the host programs never reach.
+
+Environment:
+
+    Host (user mode), C11 with -fms-extensions and -fshort-wchar.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+//  The filter picks its SSE2 paths by the Msvc target macro.  With
+//  HOST_NO_AMD64 they are left out, as for any other architecture.
+//
+
+#if defined(__x86_64__) && !defined(_M_AMD64) && !defined(HOST_NO_AMD64)
+#define _M_AMD64                        100
+#endif
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define UNALIGNED
+#define CONST                           const
+#define VOID                            void
+#define DECLSPEC_CACHEALIGN             __attribute__(( aligned( 64 ) ))
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Outptr_
+#define _Flt_CompletionContext_Outptr_
+#define _In_reads_bytes_(...)
+#define _Out_writes_(...)
+#define _Out_writes_bytes_(...)
+#define _Analysis_assume_(...)
+
+typedef void                    *PVOID, *HANDLE;
+typedef char                    CHAR, *PCHAR, CCHAR, KPROCESSOR_MODE;
+typedef const char              *PCSTR;
+typedef unsigned char           UCHAR, *PUCHAR, BOOLEAN, *PBOOLEAN;
+typedef short                   SHORT, CSHORT;
+typedef unsigned short          USHORT, *PUSHORT;
+typedef wchar_t                 WCHAR, *PWCHAR, *PWSTR;
+typedef const WCHAR             *PCWSTR;
+typedef int32_t                 LONG, *PLONG;
+typedef uint32_t                ULONG, *PULONG, ACCESS_MASK, DEVICE_TYPE;
+typedef int64_t                 LONGLONG, *PLONGLONG;
+typedef uint64_t                ULONGLONG, *PULONGLONG;
+typedef uintptr_t               ULONG_PTR, SIZE_T;
+typedef LONG                    NTSTATUS, *PNTSTATUS;
+typedef UCHAR                   KIRQL, *PKIRQL;
+typedef USHORT                  FLT_CONTEXT_TYPE;
+typedef ULONG                   FLT_INSTANCE_SETUP_FLAGS;
+typedef ULONG                   FLT_INSTANCE_QUERY_TEARDOWN_FLAGS;
+typedef ULONG                   FLT_FILTER_UNLOAD_FLAGS;
+typedef ULONG                   FLT_POST_OPERATION_FLAGS;
+typedef ULONG                   FLT_CALLBACK_DATA_FLAGS;
+typedef PVOID                   PFLT_CONTEXT;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef enum _POOL_TYPE { NonPagedPool, PagedPool, NonPagedPoolNx = 512 } POOL_TYPE;
+typedef enum _MODE { KernelMode, UserMode } MODE;
+typedef enum _KWAIT_REASON { Executive } KWAIT_REASON;
+typedef enum _EVENT_TYPE { NotificationEvent, SynchronizationEvent } EVENT_TYPE;
+typedef enum _WORK_QUEUE_TYPE { CriticalWorkQueue, DelayedWorkQueue } WORK_QUEUE_TYPE;
+typedef enum _MM_PAGE_PRIORITY { LowPagePriority, NormalPagePriority = 16, HighPagePriority = 32 } MM_PAGE_PRIORITY;
+typedef enum _KEY_VALUE_INFORMATION_CLASS { KeyValuePartialInformation = 2 } KEY_VALUE_INFORMATION_CLASS;
+typedef enum _FLT_FILESYSTEM_TYPE { FLT_FSTYPE_UNKNOWN } FLT_FILESYSTEM_TYPE;
+typedef enum _DRIVER_RUNTIME_INIT_FLAGS { DrvRtPoolNxOptIn = 1 } DRIVER_RUNTIME_INIT_FLAGS;
+
+typedef enum _FLT_PREOP_CALLBACK_STATUS {
+    FLT_PREOP_SUCCESS_WITH_CALLBACK,
+    FLT_PREOP_SUCCESS_NO_CALLBACK,
+    FLT_PREOP_PENDING,
+    FLT_PREOP_DISALLOW_FASTIO,
+    FLT_PREOP_COMPLETE,
+    FLT_PREOP_SYNCHRONIZE
+} FLT_PREOP_CALLBACK_STATUS;
+
+typedef enum _FLT_POSTOP_CALLBACK_STATUS {
+    FLT_POSTOP_FINISHED_PROCESSING,
+    FLT_POSTOP_MORE_PROCESSING_REQUIRED
+} FLT_POSTOP_CALLBACK_STATUS;
+
+#define HOST_OPAQUE(Name, Words)                                            \
+    typedef struct _##Name { ULONG_PTR Opaque[Words]; } Name, *P##Name
+
+HOST_OPAQUE( DRIVER_OBJECT, 8 );
+HOST_OPAQUE( DEVICE_OBJECT, 8 );
+HOST_OPAQUE( KTIMER, 8 );
+HOST_OPAQUE( KEVENT, 4 );
+HOST_OPAQUE( NPAGED_LOOKASIDE_LIST, 16 );
+HOST_OPAQUE( PROCESSOR_NUMBER, 1 );
+
+typedef struct _FLT_FILTER *PFLT_FILTER;
+typedef struct _FLT_VOLUME *PFLT_VOLUME;
+typedef struct _FLT_INSTANCE *PFLT_INSTANCE;
+typedef struct _FLT_GENERIC_WORKITEM *PFLT_GENERIC_WORKITEM;
+
+//
+//  A spin lock is a word which is set while it is held.
+//
+
+typedef volatile LONG KSPIN_LOCK, *PKSPIN_LOCK;
+
+typedef struct _SLIST_ENTRY {
+    struct _SLIST_ENTRY *Next;
+} SLIST_ENTRY, *PSLIST_ENTRY;
+
+typedef struct _SLIST_HEADER {
+    KSPIN_LOCK Lock;
+    USHORT Depth;
+    PSLIST_ENTRY First;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+//
+//  An Mdl just records the virtual range it describes; nothing is ever
+//  really locked or mapped.
+//
+
+typedef struct _MDL {
+    struct _MDL *Next;
+    PVOID StartVa;
+    ULONG ByteCount;
+} MDL, *PMDL;
+
+typedef struct _IO_STATUS_BLOCK {
+    NTSTATUS Status;
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _FILE_OBJECT {
+    CSHORT Type;
+    CSHORT Size;
+    PDEVICE_OBJECT DeviceObject;
+    PVOID FsContext;
+    PVOID FsContext2;
+    ULONG Flags;
+    UNICODE_STRING FileName;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+struct _KDPC;
+
+typedef VOID KDEFERRED_ROUTINE( struct _KDPC *Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2 );
+typedef KDEFERRED_ROUTINE *PKDEFERRED_ROUTINE;
+
+typedef struct _KDPC {
+    PKDEFERRED_ROUTINE DeferredRoutine;
+    PVOID DeferredContext;
+} KDPC, *PKDPC;
+
+typedef NTSTATUS DRIVER_INITIALIZE( PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath );
+
+typedef struct _OBJECT_ATTRIBUTES {
+    ULONG Length;
+    HANDLE RootDirectory;
+    PUNICODE_STRING ObjectName;
+    ULONG Attributes;
+    PVOID SecurityDescriptor;
+    PVOID SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION {
+    ULONG TitleIndex;
+    ULONG Type;
+    ULONG DataLength;
+    UCHAR Data[1];
+} KEY_VALUE_PARTIAL_INFORMATION, *PKEY_VALUE_PARTIAL_INFORMATION;
+
+//
+//  FltMgr.
+//
+
+typedef union _FLT_PARAMETERS {
+    struct {
+        ULONG Length;
+        ULONG Key;
+        LARGE_INTEGER ByteOffset;
+        PVOID ReadBuffer;
+        PMDL MdlAddress;
+    } Read;
+    struct {
+        ULONG Length;
+        ULONG Key;
+        LARGE_INTEGER ByteOffset;
+        PVOID WriteBuffer;
+        PMDL MdlAddress;
+    } Write;
+    union {
+        struct {
+            ULONG Length;
+            PUNICODE_STRING FileName;
+            ULONG FileInformationClass;
+            ULONG FileIndex;
+            PVOID DirectoryBuffer;
+            PMDL MdlAddress;
+        } QueryDirectory;
+    } DirectoryControl;
+} FLT_PARAMETERS, *PFLT_PARAMETERS;
+
+typedef struct _FLT_IO_PARAMETER_BLOCK {
+    ULONG IrpFlags;
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    UCHAR OperationFlags;
+    UCHAR Reserved;
+    PFILE_OBJECT TargetFileObject;
+    PFLT_INSTANCE TargetInstance;
+    FLT_PARAMETERS Parameters;
+} FLT_IO_PARAMETER_BLOCK, *PFLT_IO_PARAMETER_BLOCK;
+
+typedef struct _FLT_CALLBACK_DATA {
+    FLT_CALLBACK_DATA_FLAGS Flags;
+    PVOID Thread;
+    PFLT_IO_PARAMETER_BLOCK Iopb;
+    IO_STATUS_BLOCK IoStatus;
+} FLT_CALLBACK_DATA, *PFLT_CALLBACK_DATA;
+
+typedef struct _FLT_RELATED_OBJECTS {
+    USHORT Size;
+    USHORT TransactionContext;
+    PFLT_FILTER Filter;
+    PFLT_VOLUME Volume;
+    PFLT_INSTANCE Instance;
+    PFILE_OBJECT FileObject;
+} FLT_RELATED_OBJECTS, *PFLT_RELATED_OBJECTS;
+
+typedef const FLT_RELATED_OBJECTS *PCFLT_RELATED_OBJECTS;
+
+typedef struct _FLT_VOLUME_PROPERTIES {
+    DEVICE_TYPE DeviceType;
+    ULONG DeviceCharacteristics;
+    ULONG DeviceObjectFlags;
+    ULONG AlignmentRequirement;
+    USHORT SectorSize;
+    USHORT Flags;
+    UNICODE_STRING FileSystemDriverName;
+    UNICODE_STRING FileSystemDeviceName;
+    UNICODE_STRING RealDeviceName;
+} FLT_VOLUME_PROPERTIES, *PFLT_VOLUME_PROPERTIES;
+
+typedef FLT_PREOP_CALLBACK_STATUS (*PFLT_PRE_OPERATION_CALLBACK)( PFLT_CALLBACK_DATA Data, PCFLT_RELATED_OBJECTS FltObjects, PVOID *CompletionContext );
+typedef FLT_POSTOP_CALLBACK_STATUS (*PFLT_POST_OPERATION_CALLBACK)( PFLT_CALLBACK_DATA Data, PCFLT_RELATED_OBJECTS FltObjects, PVOID CompletionContext, FLT_POST_OPERATION_FLAGS Flags );
+typedef VOID (*PFLT_CONTEXT_CLEANUP_CALLBACK)( PFLT_CONTEXT Context, FLT_CONTEXT_TYPE ContextType );
+typedef NTSTATUS (*PFLT_FILTER_UNLOAD_CALLBACK)( FLT_FILTER_UNLOAD_FLAGS Flags );
+typedef NTSTATUS (*PFLT_INSTANCE_SETUP_CALLBACK)( PCFLT_RELATED_OBJECTS FltObjects, FLT_INSTANCE_SETUP_FLAGS Flags, DEVICE_TYPE VolumeDeviceType, FLT_FILESYSTEM_TYPE VolumeFilesystemType );
+typedef NTSTATUS (*PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK)( PCFLT_RELATED_OBJECTS FltObjects, FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags );
+typedef VOID FLT_GENERIC_WORKITEM_ROUTINE( PFLT_GENERIC_WORKITEM FltWorkItem, PVOID FltObject, PVOID Context );
+typedef FLT_GENERIC_WORKITEM_ROUTINE *PFLT_GENERIC_WORKITEM_ROUTINE;
+
+typedef struct _FLT_OPERATION_REGISTRATION {
+    UCHAR MajorFunction;
+    ULONG Flags;
+    PFLT_PRE_OPERATION_CALLBACK PreOperation;
+    PFLT_POST_OPERATION_CALLBACK PostOperation;
+    PVOID Reserved1;
+} FLT_OPERATION_REGISTRATION;
+
+typedef struct _FLT_CONTEXT_REGISTRATION {
+    FLT_CONTEXT_TYPE ContextType;
+    USHORT Flags;
+    PFLT_CONTEXT_CLEANUP_CALLBACK ContextCleanupCallback;
+    SIZE_T Size;
+    ULONG PoolTag;
+    PVOID ContextAllocateCallback;
+    PVOID ContextFreeCallback;
+    PVOID Reserved1;
+} FLT_CONTEXT_REGISTRATION;
+
+typedef struct _FLT_REGISTRATION {
+    USHORT Size;
+    USHORT Version;
+    ULONG Flags;
+    const FLT_CONTEXT_REGISTRATION *ContextRegistration;
+    const FLT_OPERATION_REGISTRATION *OperationRegistration;
+    PFLT_FILTER_UNLOAD_CALLBACK FilterUnloadCallback;
+    PFLT_INSTANCE_SETUP_CALLBACK InstanceSetupCallback;
+    PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK InstanceQueryTeardownCallback;
+    PVOID InstanceTeardownStartCallback;
+    PVOID InstanceTeardownCompleteCallback;
+    PVOID GenerateFileNameCallback;
+    PVOID NormalizeNameComponentCallback;
+    PVOID NormalizeContextCleanupCallback;
+} FLT_REGISTRATION;
+
+#define TRUE                            1
+#define FALSE                           0
+#define PAGE_SIZE                       0x1000
+#define ANYSIZE_ARRAY                   1
+#define PASSIVE_LEVEL                   0
+#define DISPATCH_LEVEL                  2
+#define ALL_PROCESSOR_GROUPS            0xffff
+
+#define FIELD_OFFSET(Type, Field)       ((LONG)offsetof( Type, Field ))
+#define CONTAINING_RECORD(A, Type, Field) ((Type *)((PCHAR)(A) - offsetof( Type, Field )))
+#define UNREFERENCED_PARAMETER(P)       ((void)(P))
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+#define ROUND_TO_SIZE(Length, Alignment) \
+    (((ULONG_PTR)(Length) + ((Alignment) - 1)) & ~(ULONG_PTR)((Alignment) - 1))
+#define FlagOn(F, SF)                   ((F) & (SF))
+#define PAGED_CODE()
+#define FLT_ASSERT(E)                   HostAssert( (E) ? 1 : 0, #E, __FILE__, __LINE__ )
+
+#ifndef min
+#define min(a, b)                       (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)                       (((a) > (b)) ? (a) : (b))
+#endif
+
+#define RtlZeroMemory(D, L)             memset( (D), 0, (L) )
+#define RtlCopyMemory(D, S, L)          memcpy( (D), (S), (L) )
+#define RtlSecureZeroMemory(D, L)       HostSecureZeroMemory( (D), (L) )
+
+#define try                             { __label__ HostLeave;
+#define finally                         HostLeave: ; }
+#define except(Filter)                  HostLeave: ; } if (0)
+#define leave                           goto HostLeave
+#define EXCEPTION_EXECUTE_HANDLER       1
+#define GetExceptionCode()              STATUS_SUCCESS
+
+#define InitializeObjectAttributes(A, N, Attr, R, S) {                      \
+    (A)->Length = sizeof( OBJECT_ATTRIBUTES );                              \
+    (A)->RootDirectory = (R);                                               \
+    (A)->Attributes = (Attr);                                               \
+    (A)->ObjectName = (N);                                                  \
+    (A)->SecurityDescriptor = (S);                                          \
+    (A)->SecurityQualityOfService = NULL;                                   \
+}
+
+#define KeRaiseIrql(NewIrql, OldIrql)   (*(OldIrql) = PASSIVE_LEVEL)
+#define KeLowerIrql(NewIrql)            ((void)(NewIrql))
+
+#define IRP_MJ_CREATE                   0x00
+#define IRP_MJ_READ                     0x03
+#define IRP_MJ_WRITE                    0x04
+#define IRP_MJ_DIRECTORY_CONTROL        0x0c
+#define IRP_MJ_OPERATION_END            ((UCHAR)0x80)
+#define IRP_NOCACHE                     0x00000001
+#define IRP_PAGING_IO                   0x00000002
+#define IO_NO_INCREMENT                 0
+#define SL_OPEN_PAGING_FILE             0x02
+#define FO_VOLUME_OPEN                  0x00400000
+
+#define FLTFL_CALLBACK_DATA_IRP_OPERATION     0x00000001
+#define FLTFL_CALLBACK_DATA_FAST_IO_OPERATION 0x00000002
+#define FLTFL_CALLBACK_DATA_SYSTEM_BUFFER     0x00000080
+#define FLTFL_POST_OPERATION_DRAINING   0x00000001
+#define FLT_VOLUME_CONTEXT              0x0001
+#define FLT_STREAM_CONTEXT              0x0004
+#define FLT_CONTEXT_END                 0xffff
+#define FLT_REGISTRATION_VERSION        0x0202
+#define FLT_SET_CONTEXT_KEEP_IF_EXISTS  2
+
+#define KEY_READ                        0x00020019
+#define OBJ_CASE_INSENSITIVE            0x00000040
+#define OBJ_KERNEL_HANDLE               0x00000200
+#define REG_BINARY                      3
+#define REG_DWORD                       4
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_REPARSE                  ((NTSTATUS)0x00000104L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_FLT_DO_NOT_ATTACH        ((NTSTATUS)0xC01C000FL)
+#define STATUS_FLT_CONTEXT_ALREADY_DEFINED ((NTSTATUS)0xC01C0002L)
+
+static inline ULONG
+_rotl (
+    ULONG Value,
+    int Shift
+    )
+{
+    return (Value << Shift) | (Value >> (32 - Shift));
+}
+
+static inline LONG
+InterlockedIncrement (
+    LONG volatile *Addend
+    )
+{
+    return __atomic_add_fetch( Addend, 1, __ATOMIC_SEQ_CST );
+}
+
+static inline LONG
+InterlockedDecrement (
+    LONG volatile *Addend
+    )
+{
+    return __atomic_sub_fetch( Addend, 1, __ATOMIC_SEQ_CST );
+}
+
+VOID HostAssert( int Condition, const char *Text, const char *File, int Line );
+VOID HostSecureZeroMemory( PVOID Destination, SIZE_T Length );
+
+PVOID ExAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+VOID ExFreePoolWithTag( PVOID P, ULONG Tag );
+VOID ExFreePool( PVOID P );
+VOID ExInitializeDriverRuntime( ULONG RuntimeFlags );
+VOID ExInitializeNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside, PVOID Allocate, PVOID Free, ULONG Flags, SIZE_T Size, ULONG Tag, USHORT Depth );
+VOID ExDeleteNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside );
+PVOID ExAllocateFromNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside );
+VOID ExFreeToNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside, PVOID Entry );
+
+VOID InitializeSListHead( PSLIST_HEADER SListHead );
+PSLIST_ENTRY InterlockedPushEntrySList( PSLIST_HEADER ListHead, PSLIST_ENTRY ListEntry );
+PSLIST_ENTRY InterlockedPopEntrySList( PSLIST_HEADER ListHead );
+USHORT ExQueryDepthSList( PSLIST_HEADER SListHead );
+
+VOID KeInitializeSpinLock( PKSPIN_LOCK SpinLock );
+VOID KeAcquireSpinLockAtDpcLevel( PKSPIN_LOCK SpinLock );
+VOID KeReleaseSpinLockFromDpcLevel( PKSPIN_LOCK SpinLock );
+ULONG KeGetCurrentProcessorNumberEx( PPROCESSOR_NUMBER ProcNumber );
+ULONG KeQueryMaximumProcessorCountEx( USHORT GroupNumber );
+ULONG KeQueryActiveProcessorCountEx( USHORT GroupNumber );
+VOID KeInitializeDpc( PKDPC Dpc, PKDEFERRED_ROUTINE DeferredRoutine, PVOID DeferredContext );
+VOID KeInitializeTimer( PKTIMER Timer );
+BOOLEAN KeSetCoalescableTimer( PKTIMER Timer, LARGE_INTEGER DueTime, ULONG Period, ULONG TolerableDelay, PKDPC Dpc );
+BOOLEAN KeCancelTimer( PKTIMER Timer );
+VOID KeFlushQueuedDpcs( VOID );
+VOID KeInitializeEvent( PKEVENT Event, EVENT_TYPE Type, BOOLEAN State );
+LONG KeSetEvent( PKEVENT Event, LONG Increment, BOOLEAN Wait );
+NTSTATUS KeWaitForSingleObject( PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout );
+
+PMDL IoAllocateMdl( PVOID VirtualAddress, ULONG Length, BOOLEAN SecondaryBuffer, BOOLEAN ChargeQuota, PVOID Irp );
+VOID IoBuildPartialMdl( PMDL SourceMdl, PMDL TargetMdl, PVOID VirtualAddress, ULONG Length );
+VOID IoFreeMdl( PMDL Mdl );
+VOID MmBuildMdlForNonPagedPool( PMDL Mdl );
+PVOID MmGetSystemAddressForMdlSafe( PMDL Mdl, ULONG Priority );
+VOID ObDereferenceObject( PVOID Object );
+BOOLEAN FsRtlIsPagingFile( PFILE_OBJECT FileObject );
+
+ULONG DbgPrint( PCSTR Format, ... );
+VOID RtlInitUnicodeString( PUNICODE_STRING DestinationString, PCWSTR SourceString );
+VOID RtlCopyUnicodeString( PUNICODE_STRING DestinationString, const UNICODE_STRING *SourceString );
+NTSTATUS RtlAppendUnicodeToString( PUNICODE_STRING Destination, PCWSTR Source );
+NTSTATUS RtlVolumeDeviceToDosName( PVOID VolumeDeviceObject, PUNICODE_STRING DosName );
+NTSTATUS ZwOpenKey( HANDLE *KeyHandle, ACCESS_MASK DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes );
+NTSTATUS ZwQueryValueKey( HANDLE KeyHandle, PUNICODE_STRING ValueName, KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass, PVOID KeyValueInformation, ULONG Length, PULONG ResultLength );
+NTSTATUS ZwClose( HANDLE Handle );
+
+NTSTATUS FltRegisterFilter( PDRIVER_OBJECT Driver, const FLT_REGISTRATION *Registration, PFLT_FILTER *RetFilter );
+NTSTATUS FltStartFiltering( PFLT_FILTER Filter );
+VOID FltUnregisterFilter( PFLT_FILTER Filter );
+NTSTATUS FltAllocateContext( PFLT_FILTER Filter, FLT_CONTEXT_TYPE ContextType, SIZE_T ContextSize, POOL_TYPE PoolType, PFLT_CONTEXT *ReturnedContext );
+VOID FltReleaseContext( PFLT_CONTEXT Context );
+NTSTATUS FltGetVolumeContext( PFLT_FILTER Filter, PFLT_VOLUME Volume, PFLT_CONTEXT *Context );
+NTSTATUS FltSetVolumeContext( PFLT_VOLUME Volume, ULONG Operation, PFLT_CONTEXT NewContext, PFLT_CONTEXT *OldContext );
+NTSTATUS FltGetStreamContext( PFLT_INSTANCE Instance, PFILE_OBJECT FileObject, PFLT_CONTEXT *Context );
+NTSTATUS FltSetStreamContext( PFLT_INSTANCE Instance, PFILE_OBJECT FileObject, ULONG Operation, PFLT_CONTEXT NewContext, PFLT_CONTEXT *OldContext );
+BOOLEAN FltSupportsStreamContexts( PFILE_OBJECT FileObject );
+NTSTATUS FltGetVolumeProperties( PFLT_VOLUME Volume, PFLT_VOLUME_PROPERTIES VolumeProperties, ULONG VolumePropertiesLength, PULONG LengthReturned );
+NTSTATUS FltGetDiskDeviceObject( PFLT_VOLUME Volume, PDEVICE_OBJECT *DiskDeviceObject );
+NTSTATUS FltIsDirectory( PFILE_OBJECT FileObject, PFLT_INSTANCE Instance, PBOOLEAN IsDirectory );
+VOID FltCancelFileOpen( PFLT_INSTANCE Instance, PFILE_OBJECT FileObject );
+BOOLEAN FltIsOperationSynchronous( PFLT_CALLBACK_DATA CallbackData );
+VOID FltSetCallbackDataDirty( PFLT_CALLBACK_DATA Data );
+NTSTATUS FltLockUserBuffer( PFLT_CALLBACK_DATA CallbackData );
+BOOLEAN FltDoCompletionProcessingWhenSafe( PFLT_CALLBACK_DATA Data, PCFLT_RELATED_OBJECTS FltObjects, PVOID CompletionContext, FLT_POST_OPERATION_FLAGS Flags, PFLT_POST_OPERATION_CALLBACK SafePostCallback, FLT_POSTOP_CALLBACK_STATUS *RetPostOperationStatus );
+PVOID FltAllocatePoolAlignedWithTag( PFLT_INSTANCE Instance, POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+VOID FltFreePoolAlignedWithTag( PFLT_INSTANCE Instance, PVOID Buffer, ULONG Tag );
+PFLT_GENERIC_WORKITEM FltAllocateGenericWorkItem( VOID );
+NTSTATUS FltQueueGenericWorkItem( PFLT_GENERIC_WORKITEM FltWorkItem, PVOID FltObject, PFLT_GENERIC_WORKITEM_ROUTINE WorkItemRoutine, WORK_QUEUE_TYPE QueueType, PVOID Context );
+VOID FltFreeGenericWorkItem( PFLT_GENERIC_WORKITEM FltWorkItem );
@@ -0,0 +1,498 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Host.c
+
+Abstract:
+
+    The kernel routines the SwapBuffers arena reaches in the host programs,
+    done in user mode.
+
+    Pool comes from the C library, page aligned from a page up as in the
+    kernel, and is counted so that the programs can check nothing leaks and
+    see how much the arena holds.  The counts are kept per processor, so
+    that counting doesn't make the threads contend where the kernel's pool
+    wouldn't, and summed when they are read.  Mdls only record the range
+    they describe.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "host.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HostPause()                     _mm_pause()
+#else
+#define HostPause()                     ((void)0)
+#endif
+
+#define HOST_MAX_PROCESSORS             (64)
+
+//
+//  Every pool block is preceded by a header recording where the allocation
+//  starts, its size and its tag.  Blocks of a page or more are page
+//  aligned, smaller ones cache line aligned.
+//
+
+typedef struct _HOST_POOL_HEADER {
+
+    PVOID Base;
+    SIZE_T NumberOfBytes;
+    ULONG Tag;
+
+} HOST_POOL_HEADER, *PHOST_POOL_HEADER;
+
+typedef struct DECLSPEC_CACHEALIGN _HOST_PROCESSOR_COUNTERS {
+
+    HOST_COUNTERS Counters;
+
+} HOST_PROCESSOR_COUNTERS;
+
+static HOST_PROCESSOR_COUNTERS HostProcessorCounters[HOST_MAX_PROCESSORS];
+static ULONG HostProcessorCount = 1;
+
+static _Thread_local ULONG HostCurrentProcessor;
+
+static VOID
+HostCount (
+    PLONGLONG Counter,
+    LONGLONG Value
+    )
+{
+    __atomic_fetch_add( Counter, Value, __ATOMIC_RELAXED );
+}
+
+VOID
+HostAssert (
+    int Condition,
+    const char *Text,
+    const char *File,
+    int Line
+    )
+{
+    if (!Condition) {
+
+        fprintf( stderr, "%s(%d): assertion failed: %s\n", File, Line, Text );
+        abort();
+    }
+}
+
+VOID
+HostSecureZeroMemory (
+    PVOID Destination,
+    SIZE_T Length
+    )
+{
+    volatile UCHAR *bytes = Destination;
+
+    while (Length-- > 0) {
+
+        *bytes++ = 0;
+    }
+}
+
+VOID
+HostSetProcessorCount (
+    ULONG ProcessorCount
+    )
+{
+    HostAssert( (ProcessorCount > 0) && (ProcessorCount <= HOST_MAX_PROCESSORS),
+                "ProcessorCount <= HOST_MAX_PROCESSORS", __FILE__, __LINE__ );
+
+    HostProcessorCount = ProcessorCount;
+}
+
+VOID
+HostSetCurrentProcessor (
+    ULONG Processor
+    )
+{
+    HostAssert( Processor < HOST_MAX_PROCESSORS, "Processor < HOST_MAX_PROCESSORS", __FILE__, __LINE__ );
+
+    HostCurrentProcessor = Processor;
+}
+
+VOID
+HostGetCounters (
+    PHOST_COUNTERS Counters
+    )
+{
+    PHOST_COUNTERS counters;
+    ULONG i;
+
+    RtlZeroMemory( Counters, sizeof( HOST_COUNTERS ));
+
+    for (i = 0; i < HOST_MAX_PROCESSORS; i++) {
+
+        counters = &HostProcessorCounters[i].Counters;
+
+        Counters->PoolBlocks += __atomic_load_n( &counters->PoolBlocks, __ATOMIC_RELAXED );
+        Counters->PoolBytes += __atomic_load_n( &counters->PoolBytes, __ATOMIC_RELAXED );
+        Counters->SwapBufferBlocks += __atomic_load_n( &counters->SwapBufferBlocks, __ATOMIC_RELAXED );
+        Counters->SwapBufferBytes += __atomic_load_n( &counters->SwapBufferBytes, __ATOMIC_RELAXED );
+    }
+}
+
+//
+//  Pool.
+//
+
+PVOID
+ExAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    PHOST_COUNTERS counters = &HostProcessorCounters[HostCurrentProcessor].Counters;
+    PHOST_POOL_HEADER header;
+    SIZE_T alignment = (NumberOfBytes >= PAGE_SIZE) ? PAGE_SIZE : 64;
+    PVOID base;
+
+    UNREFERENCED_PARAMETER( PoolType );
+
+    if (posix_memalign( &base, alignment, alignment + NumberOfBytes ) != 0) {
+
+        return NULL;
+    }
+
+    header = (PHOST_POOL_HEADER)((PUCHAR) base + alignment) - 1;
+    header->Base = base;
+    header->NumberOfBytes = NumberOfBytes;
+    header->Tag = Tag;
+
+    HostCount( &counters->PoolBlocks, 1 );
+    HostCount( &counters->PoolBytes, (LONGLONG) NumberOfBytes );
+
+    if (Tag == BUFFER_SWAP_TAG) {
+
+        HostCount( &counters->SwapBufferBlocks, 1 );
+        HostCount( &counters->SwapBufferBytes, (LONGLONG) NumberOfBytes );
+    }
+
+    return header + 1;
+}
+
+VOID
+ExFreePoolWithTag (
+    PVOID P,
+    ULONG Tag
+    )
+{
+    PHOST_COUNTERS counters = &HostProcessorCounters[HostCurrentProcessor].Counters;
+    PHOST_POOL_HEADER header = (PHOST_POOL_HEADER) P - 1;
+
+    HostAssert( (Tag == 0) || (header->Tag == Tag), "header->Tag == Tag", __FILE__, __LINE__ );
+
+    HostCount( &counters->PoolBlocks, -1 );
+    HostCount( &counters->PoolBytes, -(LONGLONG) header->NumberOfBytes );
+
+    if (header->Tag == BUFFER_SWAP_TAG) {
+
+        HostCount( &counters->SwapBufferBlocks, -1 );
+        HostCount( &counters->SwapBufferBytes, -(LONGLONG) header->NumberOfBytes );
+    }
+
+    free( header->Base );
+}
+
+VOID
+ExFreePool (
+    PVOID P
+    )
+{
+    ExFreePoolWithTag( P, 0 );
+}
+
+//
+//  Pool allocations of a page or more are already page aligned, which is
+//  as aligned as any device the programs pretend to have needs.
+//
+
+PVOID
+FltAllocatePoolAlignedWithTag (
+    PFLT_INSTANCE Instance,
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+
+    return ExAllocatePoolWithTag( PoolType, max( NumberOfBytes, PAGE_SIZE ), Tag );
+}
+
+VOID
+FltFreePoolAlignedWithTag (
+    PFLT_INSTANCE Instance,
+    PVOID Buffer,
+    ULONG Tag
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+
+    ExFreePoolWithTag( Buffer, Tag );
+}
+
+//
+//  Spin locks and interlocked SLISTs.
+//
+
+VOID
+KeInitializeSpinLock (
+    PKSPIN_LOCK SpinLock
+    )
+{
+    *SpinLock = 0;
+}
+
+VOID
+KeAcquireSpinLockAtDpcLevel (
+    PKSPIN_LOCK SpinLock
+    )
+{
+    while (__atomic_exchange_n( SpinLock, 1, __ATOMIC_ACQUIRE ) != 0) {
+
+        while (__atomic_load_n( SpinLock, __ATOMIC_RELAXED ) != 0) {
+
+            HostPause();
+        }
+    }
+}
+
+VOID
+KeReleaseSpinLockFromDpcLevel (
+    PKSPIN_LOCK SpinLock
+    )
+{
+    __atomic_store_n( SpinLock, 0, __ATOMIC_RELEASE );
+}
+
+VOID
+InitializeSListHead (
+    PSLIST_HEADER SListHead
+    )
+{
+    KeInitializeSpinLock( &SListHead->Lock );
+    SListHead->Depth = 0;
+    SListHead->First = NULL;
+}
+
+PSLIST_ENTRY
+InterlockedPushEntrySList (
+    PSLIST_HEADER ListHead,
+    PSLIST_ENTRY ListEntry
+    )
+{
+    PSLIST_ENTRY first;
+
+    KeAcquireSpinLockAtDpcLevel( &ListHead->Lock );
+
+    first = ListHead->First;
+    ListEntry->Next = first;
+    ListHead->First = ListEntry;
+    __atomic_store_n( &ListHead->Depth, ListHead->Depth + 1, __ATOMIC_RELAXED );
+
+    KeReleaseSpinLockFromDpcLevel( &ListHead->Lock );
+
+    return first;
+}
+
+PSLIST_ENTRY
+InterlockedPopEntrySList (
+    PSLIST_HEADER ListHead
+    )
+{
+    PSLIST_ENTRY entry;
+
+    KeAcquireSpinLockAtDpcLevel( &ListHead->Lock );
+
+    entry = ListHead->First;
+
+    if (entry != NULL) {
+
+        ListHead->First = entry->Next;
+        __atomic_store_n( &ListHead->Depth, ListHead->Depth - 1, __ATOMIC_RELAXED );
+    }
+
+    KeReleaseSpinLockFromDpcLevel( &ListHead->Lock );
+
+    return entry;
+}
+
+USHORT
+ExQueryDepthSList (
+    PSLIST_HEADER SListHead
+    )
+{
+    return __atomic_load_n( &SListHead->Depth, __ATOMIC_RELAXED );
+}
+
+//
+//  Processors, DPCs and timers.  A timer never fires, the programs call
+//  the DPC routine themselves when they want a period to end.
+//
+
+ULONG
+KeGetCurrentProcessorNumberEx (
+    PPROCESSOR_NUMBER ProcNumber
+    )
+{
+    UNREFERENCED_PARAMETER( ProcNumber );
+
+    return HostCurrentProcessor;
+}
+
+ULONG
+KeQueryMaximumProcessorCountEx (
+    USHORT GroupNumber
+    )
+{
+    UNREFERENCED_PARAMETER( GroupNumber );
+
+    return HostProcessorCount;
+}
+
+ULONG
+KeQueryActiveProcessorCountEx (
+    USHORT GroupNumber
+    )
+{
+    UNREFERENCED_PARAMETER( GroupNumber );
+
+    return HostProcessorCount;
+}
+
+VOID
+KeInitializeDpc (
+    PKDPC Dpc,
+    PKDEFERRED_ROUTINE DeferredRoutine,
+    PVOID DeferredContext
+    )
+{
+    Dpc->DeferredRoutine = DeferredRoutine;
+    Dpc->DeferredContext = DeferredContext;
+}
+
+VOID
+KeInitializeTimer (
+    PKTIMER Timer
+    )
+{
+    RtlZeroMemory( Timer, sizeof( KTIMER ));
+}
+
+BOOLEAN
+KeSetCoalescableTimer (
+    PKTIMER Timer,
+    LARGE_INTEGER DueTime,
+    ULONG Period,
+    ULONG TolerableDelay,
+    PKDPC Dpc
+    )
+{
+    UNREFERENCED_PARAMETER( Timer );
+    UNREFERENCED_PARAMETER( DueTime );
+    UNREFERENCED_PARAMETER( Period );
+    UNREFERENCED_PARAMETER( TolerableDelay );
+    UNREFERENCED_PARAMETER( Dpc );
+
+    return FALSE;
+}
+
+BOOLEAN
+KeCancelTimer (
+    PKTIMER Timer
+    )
+{
+    UNREFERENCED_PARAMETER( Timer );
+
+    return FALSE;
+}
+
+VOID
+KeFlushQueuedDpcs (
+    VOID
+    )
+{
+}
+
+//
+//  Mdls.
+//
+
+PMDL
+IoAllocateMdl (
+    PVOID VirtualAddress,
+    ULONG Length,
+    BOOLEAN SecondaryBuffer,
+    BOOLEAN ChargeQuota,
+    PVOID Irp
+    )
+{
+    PMDL mdl;
+
+    UNREFERENCED_PARAMETER( SecondaryBuffer );
+    UNREFERENCED_PARAMETER( ChargeQuota );
+    UNREFERENCED_PARAMETER( Irp );
+
+    mdl = ExAllocatePoolWithTag( NonPagedPool, sizeof( MDL ), 'ldMH' );
+
+    if (mdl != NULL) {
+
+        mdl->Next = NULL;
+        mdl->StartVa = VirtualAddress;
+        mdl->ByteCount = Length;
+    }
+
+    return mdl;
+}
+
+VOID
+IoBuildPartialMdl (
+    PMDL SourceMdl,
+    PMDL TargetMdl,
+    PVOID VirtualAddress,
+    ULONG Length
+    )
+{
+    FLT_ASSERT((PUCHAR) VirtualAddress >= (PUCHAR) SourceMdl->StartVa);
+    FLT_ASSERT((PUCHAR) VirtualAddress + Length <= (PUCHAR) SourceMdl->StartVa + SourceMdl->ByteCount);
+
+    TargetMdl->StartVa = VirtualAddress;
+    TargetMdl->ByteCount = Length;
+}
+
+VOID
+IoFreeMdl (
+    PMDL Mdl
+    )
+{
+    ExFreePoolWithTag( Mdl, 'ldMH' );
+}
+
+VOID
+MmBuildMdlForNonPagedPool (
+    PMDL Mdl
+    )
+{
+    UNREFERENCED_PARAMETER( Mdl );
+}
+
+PVOID
+MmGetSystemAddressForMdlSafe (
+    PMDL Mdl,
+    ULONG Priority
+    )
+{
+    UNREFERENCED_PARAMETER( Priority );
+
+    return Mdl->StartVa;
+}
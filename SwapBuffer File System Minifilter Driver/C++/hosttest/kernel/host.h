@@ -0,0 +1,60 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Host.h
+
+Abstract:
+
+    The routines host.c adds for the programs built on the SwapBuffers
+    sources:
+    naming the processor a thread stands in for, setting how many there
+    are, and the counters the programs report from.
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#pragma once
+
+#include <fltKernel.h>
+#include "swapBuffers.h"
+
+//
+//  Counters kept by host.c.
+//
+//      PoolBlocks - Pool allocations not yet freed.
+//      PoolBytes - Bytes in them.
+//      SwapBufferBlocks - Those tagged BUFFER_SWAP_TAG, the swap buffers
+//          themselves, whether held by an arena or allocated for a single
+//          operation.
+//      SwapBufferBytes - Bytes in them.
+//
+
+typedef struct _HOST_COUNTERS {
+
+    LONGLONG PoolBlocks;
+    LONGLONG PoolBytes;
+    LONGLONG SwapBufferBlocks;
+    LONGLONG SwapBufferBytes;
+
+} HOST_COUNTERS, *PHOST_COUNTERS;
+
+VOID
+HostSetProcessorCount (
+    _In_ ULONG ProcessorCount
+    );
+
+VOID
+HostSetCurrentProcessor (
+    _In_ ULONG Processor
+    );
+
+VOID
+HostGetCounters (
+    _Out_ PHOST_COUNTERS Counters
+    );
@@ -0,0 +1,528 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Unused.c
+
+Abstract:
+
+    The routines SwapBuffers.c refers to but which the host programs never
+    reach: registering with FltMgr, contexts, the registry, the operation
+    callbacks' dealings with FltMgr and the split transform's work items
+    and events.  Each one ends the program if it is called.
+
+Environment:
+
+    Host (user mode), C11.
+
+--*/
+
+#include "host.h"
+
+static VOID
+NotReached (
+    const char *Routine
+    )
+{
+    fprintf( stderr, "%s: not supported on the host\n", Routine );
+    abort();
+}
+
+#define NOT_REACHED() NotReached( __func__ )
+
+VOID
+ExInitializeDriverRuntime (
+    ULONG RuntimeFlags
+    )
+{
+    UNREFERENCED_PARAMETER( RuntimeFlags );
+    NOT_REACHED();
+}
+
+VOID
+ExInitializeNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside,
+    PVOID Allocate,
+    PVOID Free,
+    ULONG Flags,
+    SIZE_T Size,
+    ULONG Tag,
+    USHORT Depth
+    )
+{
+    UNREFERENCED_PARAMETER( Lookaside );
+    UNREFERENCED_PARAMETER( Allocate );
+    UNREFERENCED_PARAMETER( Free );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Size );
+    UNREFERENCED_PARAMETER( Tag );
+    UNREFERENCED_PARAMETER( Depth );
+    NOT_REACHED();
+}
+
+VOID
+ExDeleteNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside
+    )
+{
+    UNREFERENCED_PARAMETER( Lookaside );
+    NOT_REACHED();
+}
+
+PVOID
+ExAllocateFromNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside
+    )
+{
+    UNREFERENCED_PARAMETER( Lookaside );
+    NOT_REACHED();
+    return NULL;
+}
+
+VOID
+ExFreeToNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside,
+    PVOID Entry
+    )
+{
+    UNREFERENCED_PARAMETER( Lookaside );
+    UNREFERENCED_PARAMETER( Entry );
+    NOT_REACHED();
+}
+
+VOID
+KeInitializeEvent (
+    PKEVENT Event,
+    EVENT_TYPE Type,
+    BOOLEAN State
+    )
+{
+    UNREFERENCED_PARAMETER( Event );
+    UNREFERENCED_PARAMETER( Type );
+    UNREFERENCED_PARAMETER( State );
+    NOT_REACHED();
+}
+
+LONG
+KeSetEvent (
+    PKEVENT Event,
+    LONG Increment,
+    BOOLEAN Wait
+    )
+{
+    UNREFERENCED_PARAMETER( Event );
+    UNREFERENCED_PARAMETER( Increment );
+    UNREFERENCED_PARAMETER( Wait );
+    NOT_REACHED();
+    return 0;
+}
+
+NTSTATUS
+KeWaitForSingleObject (
+    PVOID Object,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout
+    )
+{
+    UNREFERENCED_PARAMETER( Object );
+    UNREFERENCED_PARAMETER( WaitReason );
+    UNREFERENCED_PARAMETER( WaitMode );
+    UNREFERENCED_PARAMETER( Alertable );
+    UNREFERENCED_PARAMETER( Timeout );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+VOID
+ObDereferenceObject (
+    PVOID Object
+    )
+{
+    UNREFERENCED_PARAMETER( Object );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FsRtlIsPagingFile (
+    PFILE_OBJECT FileObject
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    NOT_REACHED();
+    return FALSE;
+}
+
+ULONG
+DbgPrint (
+    PCSTR Format,
+    ...
+    )
+{
+    UNREFERENCED_PARAMETER( Format );
+    NOT_REACHED();
+    return 0;
+}
+
+VOID
+RtlInitUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCWSTR SourceString
+    )
+{
+    UNREFERENCED_PARAMETER( DestinationString );
+    UNREFERENCED_PARAMETER( SourceString );
+    NOT_REACHED();
+}
+
+VOID
+RtlCopyUnicodeString (
+    PUNICODE_STRING DestinationString,
+    const UNICODE_STRING *SourceString
+    )
+{
+    UNREFERENCED_PARAMETER( DestinationString );
+    UNREFERENCED_PARAMETER( SourceString );
+    NOT_REACHED();
+}
+
+NTSTATUS
+RtlAppendUnicodeToString (
+    PUNICODE_STRING Destination,
+    PCWSTR Source
+    )
+{
+    UNREFERENCED_PARAMETER( Destination );
+    UNREFERENCED_PARAMETER( Source );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+RtlVolumeDeviceToDosName (
+    PVOID VolumeDeviceObject,
+    PUNICODE_STRING DosName
+    )
+{
+    UNREFERENCED_PARAMETER( VolumeDeviceObject );
+    UNREFERENCED_PARAMETER( DosName );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+ZwOpenKey (
+    HANDLE *KeyHandle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes
+    )
+{
+    UNREFERENCED_PARAMETER( KeyHandle );
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( ObjectAttributes );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+ZwQueryValueKey (
+    HANDLE KeyHandle,
+    PUNICODE_STRING ValueName,
+    KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+    PVOID KeyValueInformation,
+    ULONG Length,
+    PULONG ResultLength
+    )
+{
+    UNREFERENCED_PARAMETER( KeyHandle );
+    UNREFERENCED_PARAMETER( ValueName );
+    UNREFERENCED_PARAMETER( KeyValueInformationClass );
+    UNREFERENCED_PARAMETER( KeyValueInformation );
+    UNREFERENCED_PARAMETER( Length );
+    UNREFERENCED_PARAMETER( ResultLength );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+ZwClose (
+    HANDLE Handle
+    )
+{
+    UNREFERENCED_PARAMETER( Handle );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+FltRegisterFilter (
+    PDRIVER_OBJECT Driver,
+    const FLT_REGISTRATION *Registration,
+    PFLT_FILTER *RetFilter
+    )
+{
+    UNREFERENCED_PARAMETER( Driver );
+    UNREFERENCED_PARAMETER( Registration );
+    UNREFERENCED_PARAMETER( RetFilter );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+FltStartFiltering (
+    PFLT_FILTER Filter
+    )
+{
+    UNREFERENCED_PARAMETER( Filter );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+VOID
+FltUnregisterFilter (
+    PFLT_FILTER Filter
+    )
+{
+    UNREFERENCED_PARAMETER( Filter );
+    NOT_REACHED();
+}
+
+NTSTATUS
+FltAllocateContext (
+    PFLT_FILTER Filter,
+    FLT_CONTEXT_TYPE ContextType,
+    SIZE_T ContextSize,
+    POOL_TYPE PoolType,
+    PFLT_CONTEXT *ReturnedContext
+    )
+{
+    UNREFERENCED_PARAMETER( Filter );
+    UNREFERENCED_PARAMETER( ContextType );
+    UNREFERENCED_PARAMETER( ContextSize );
+    UNREFERENCED_PARAMETER( PoolType );
+    UNREFERENCED_PARAMETER( ReturnedContext );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+VOID
+FltReleaseContext (
+    PFLT_CONTEXT Context
+    )
+{
+    UNREFERENCED_PARAMETER( Context );
+    NOT_REACHED();
+}
+
+NTSTATUS
+FltGetVolumeContext (
+    PFLT_FILTER Filter,
+    PFLT_VOLUME Volume,
+    PFLT_CONTEXT *Context
+    )
+{
+    UNREFERENCED_PARAMETER( Filter );
+    UNREFERENCED_PARAMETER( Volume );
+    UNREFERENCED_PARAMETER( Context );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+FltSetVolumeContext (
+    PFLT_VOLUME Volume,
+    ULONG Operation,
+    PFLT_CONTEXT NewContext,
+    PFLT_CONTEXT *OldContext
+    )
+{
+    UNREFERENCED_PARAMETER( Volume );
+    UNREFERENCED_PARAMETER( Operation );
+    UNREFERENCED_PARAMETER( NewContext );
+    UNREFERENCED_PARAMETER( OldContext );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+FltGetStreamContext (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    PFLT_CONTEXT *Context
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( Context );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+FltSetStreamContext (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject,
+    ULONG Operation,
+    PFLT_CONTEXT NewContext,
+    PFLT_CONTEXT *OldContext
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( Operation );
+    UNREFERENCED_PARAMETER( NewContext );
+    UNREFERENCED_PARAMETER( OldContext );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+BOOLEAN
+FltSupportsStreamContexts (
+    PFILE_OBJECT FileObject
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    NOT_REACHED();
+    return FALSE;
+}
+
+NTSTATUS
+FltGetVolumeProperties (
+    PFLT_VOLUME Volume,
+    PFLT_VOLUME_PROPERTIES VolumeProperties,
+    ULONG VolumePropertiesLength,
+    PULONG LengthReturned
+    )
+{
+    UNREFERENCED_PARAMETER( Volume );
+    UNREFERENCED_PARAMETER( VolumeProperties );
+    UNREFERENCED_PARAMETER( VolumePropertiesLength );
+    UNREFERENCED_PARAMETER( LengthReturned );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+FltGetDiskDeviceObject (
+    PFLT_VOLUME Volume,
+    PDEVICE_OBJECT *DiskDeviceObject
+    )
+{
+    UNREFERENCED_PARAMETER( Volume );
+    UNREFERENCED_PARAMETER( DiskDeviceObject );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+FltIsDirectory (
+    PFILE_OBJECT FileObject,
+    PFLT_INSTANCE Instance,
+    PBOOLEAN IsDirectory
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( Instance );
+    UNREFERENCED_PARAMETER( IsDirectory );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+VOID
+FltCancelFileOpen (
+    PFLT_INSTANCE Instance,
+    PFILE_OBJECT FileObject
+    )
+{
+    UNREFERENCED_PARAMETER( Instance );
+    UNREFERENCED_PARAMETER( FileObject );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FltIsOperationSynchronous (
+    PFLT_CALLBACK_DATA CallbackData
+    )
+{
+    UNREFERENCED_PARAMETER( CallbackData );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+FltSetCallbackDataDirty (
+    PFLT_CALLBACK_DATA Data
+    )
+{
+    UNREFERENCED_PARAMETER( Data );
+    NOT_REACHED();
+}
+
+NTSTATUS
+FltLockUserBuffer (
+    PFLT_CALLBACK_DATA CallbackData
+    )
+{
+    UNREFERENCED_PARAMETER( CallbackData );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+BOOLEAN
+FltDoCompletionProcessingWhenSafe (
+    PFLT_CALLBACK_DATA Data,
+    PCFLT_RELATED_OBJECTS FltObjects,
+    PVOID CompletionContext,
+    FLT_POST_OPERATION_FLAGS Flags,
+    PFLT_POST_OPERATION_CALLBACK SafePostCallback,
+    FLT_POSTOP_CALLBACK_STATUS *RetPostOperationStatus
+    )
+{
+    UNREFERENCED_PARAMETER( Data );
+    UNREFERENCED_PARAMETER( FltObjects );
+    UNREFERENCED_PARAMETER( CompletionContext );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( SafePostCallback );
+    UNREFERENCED_PARAMETER( RetPostOperationStatus );
+    NOT_REACHED();
+    return FALSE;
+}
+
+PFLT_GENERIC_WORKITEM
+FltAllocateGenericWorkItem (
+    VOID
+    )
+{
+    NOT_REACHED();
+    return NULL;
+}
+
+NTSTATUS
+FltQueueGenericWorkItem (
+    PFLT_GENERIC_WORKITEM FltWorkItem,
+    PVOID FltObject,
+    PFLT_GENERIC_WORKITEM_ROUTINE WorkItemRoutine,
+    WORK_QUEUE_TYPE QueueType,
+    PVOID Context
+    )
+{
+    UNREFERENCED_PARAMETER( FltWorkItem );
+    UNREFERENCED_PARAMETER( FltObject );
+    UNREFERENCED_PARAMETER( WorkItemRoutine );
+    UNREFERENCED_PARAMETER( QueueType );
+    UNREFERENCED_PARAMETER( Context );
+    NOT_REACHED();
+    return STATUS_UNSUCCESSFUL;
+}
+
+VOID
+FltFreeGenericWorkItem (
+    PFLT_GENERIC_WORKITEM FltWorkItem
+    )
+{
+    UNREFERENCED_PARAMETER( FltWorkItem );
+    NOT_REACHED();
+}
@@ -0,0 +1,432 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    XformBench.c
+
+Abstract:
+
+    Host benchmark of the SwapBuffers transforms, in GB/s for each transform
+    and number of threads.  Each thread stands in for a processor doing
+    non-cached writes: it copies the users data into its swap buffer and
+    encodes it there, as SwapPreWriteBuffers does.  The "copy" column is the
+    swap alone, without a transform.
+
+    SwapTransform.c is built unchanged against the stand-ins in kernel/,
+    twice: once as for x64, and once as for any other architecture, with
+    its routines renamed to end in Scalar.  The self test checks the SSE2
+    and the 8 byte XOR transforms agree.  The chunks SwapCarveTransform
+    carves a run into are transformed one after the other here; each
+    thread already stands in for a processor.
+
+    usage: xformbench --selftest
+           xformbench [--seconds s] [--size bytes] [--sector bytes] [threads...]
+
+Environment:
+
+    Host (user mode), C11 with pthreads.
+
+--*/
+
+#include "host.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define MAX_THREADS                     64
+
+static int failures;
+
+#define CHECK(X) {                                                      \
+    if (!(X)) {                                                         \
+        printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #X ); \
+        failures += 1;                                                  \
+    }                                                                   \
+}
+
+//
+//  The XOR transform as built for anything but x64.
+//
+
+SWAP_TRANSFORM_ROUTINE SwapXorTransformScalar;
+
+typedef struct _WORKER {
+    PSWAP_TRANSFORM_ROUTINE Routine;
+    PUCHAR Key;
+    uint32_t Size;
+    uint32_t SectorSize;
+    uint32_t Id;
+    volatile int *Stop;
+    uint64_t Bytes;
+} WORKER;
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static double
+Now (
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//
+//  Transforms a run as SwapTransformBuffer does, for the given number of
+//  processors.
+//
+
+static void
+TransformRun (
+    PSWAP_TRANSFORM_ROUTINE Routine,
+    PUCHAR Key,
+    uint64_t ByteOffset,
+    uint32_t SectorSize,
+    uint8_t *Source,
+    uint8_t *Destination,
+    uint32_t Length,
+    uint32_t ProcessorCount
+    )
+{
+    SWAP_TRANSFORM_CHUNK chunks[SWAP_TRANSFORM_MAX_CHUNKS];
+    uint32_t chunkCount;
+    uint32_t i;
+
+    chunkCount = SwapCarveTransform( Routine, Key, ByteOffset, SectorSize, Source, Destination,
+                                     Length, ProcessorCount, chunks );
+
+    for (i = 0; i < chunkCount; i++) {
+
+        chunks[i].Routine( chunks[i].Key,
+                           chunks[i].FirstSector,
+                           chunks[i].SectorSize,
+                           chunks[i].Source,
+                           chunks[i].Destination,
+                           chunks[i].Length );
+    }
+}
+
+static void *
+Worker (
+    void *Context
+    )
+{
+    WORKER *worker = Context;
+    uint8_t *user = malloc( worker->Size );
+    uint8_t *swapped = aligned_alloc( 4096, ROUND_TO_SIZE( worker->Size, 4096 ));
+    uint64_t state = 0x9E3779B97F4A7C15ull * (worker->Id + 1);
+    uint64_t sector = 0;
+    uint64_t bytes = 0;
+    uint32_t i;
+
+    if ((user == NULL) || (swapped == NULL)) {
+        fprintf( stderr, "out of memory\n" );
+        exit( 1 );
+    }
+
+    for (i = 0; i < worker->Size; i++) {
+        user[i] = (uint8_t)Random64( &state );
+    }
+
+    while (!__atomic_load_n( worker->Stop, __ATOMIC_RELAXED )) {
+
+        memcpy( swapped, user, worker->Size );
+
+        if (worker->Routine != NULL) {
+            worker->Routine( worker->Key, sector, worker->SectorSize, swapped, swapped, worker->Size );
+        }
+
+        sector += worker->Size / worker->SectorSize;
+        bytes += worker->Size;
+    }
+
+    worker->Bytes = bytes;
+    free( user );
+    free( swapped );
+    return NULL;
+}
+
+static double
+Run (
+    PSWAP_TRANSFORM_ROUTINE Routine,
+    PUCHAR Key,
+    uint32_t Threads,
+    uint32_t Size,
+    uint32_t SectorSize,
+    double Seconds
+    )
+{
+    WORKER workers[MAX_THREADS];
+    pthread_t handles[MAX_THREADS];
+    volatile int stop = 0;
+    struct timespec delay;
+    uint64_t total = 0;
+    double start;
+    double elapsed;
+    uint32_t i;
+
+    for (i = 0; i < Threads; i++) {
+        workers[i].Routine = Routine;
+        workers[i].Key = Key;
+        workers[i].Size = Size;
+        workers[i].SectorSize = SectorSize;
+        workers[i].Id = i;
+        workers[i].Stop = &stop;
+        workers[i].Bytes = 0;
+    }
+
+    start = Now();
+    for (i = 0; i < Threads; i++) {
+        pthread_create( &handles[i], NULL, Worker, &workers[i] );
+    }
+
+    delay.tv_sec = (time_t)Seconds;
+    delay.tv_nsec = (long)((Seconds - (double)delay.tv_sec) * 1e9);
+    nanosleep( &delay, NULL );
+    __atomic_store_n( &stop, 1, __ATOMIC_RELAXED );
+
+    for (i = 0; i < Threads; i++) {
+        pthread_join( handles[i], NULL );
+        total += workers[i].Bytes;
+    }
+    elapsed = Now() - start;
+
+    return (double)total / elapsed / 1e9;
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    //
+    //  RFC 7539 appendix A.1, test vectors 1 and 2: the key stream for an
+    //  all zero key and nonce, block counters 0 and 1.  That is the first
+    //  two blocks of sector 0.
+    //
+
+    static const uint8_t keyStream[128] = {
+        0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90, 0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+        0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a, 0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+        0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d, 0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+        0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c, 0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86,
+        0x9f, 0x07, 0xe7, 0xbe, 0x55, 0x51, 0x38, 0x7a, 0x98, 0xba, 0x97, 0x7c, 0x73, 0x2d, 0x08, 0x0d,
+        0xcb, 0x0f, 0x29, 0xa0, 0x48, 0xe3, 0x65, 0x69, 0x12, 0xc6, 0x53, 0x3e, 0x32, 0xee, 0x7a, 0xed,
+        0x29, 0xb7, 0x21, 0x76, 0x9c, 0xe6, 0x4e, 0x43, 0xd5, 0x71, 0x33, 0xb0, 0x74, 0xd8, 0x39, 0xd5,
+        0x31, 0xed, 0x1f, 0x28, 0x51, 0x0a, 0xfb, 0x45, 0xac, 0xe1, 0x0a, 0x1f, 0x4b, 0x79, 0x4d, 0x6f
+    };
+    static PSWAP_TRANSFORM_ROUTINE const routines[] = {
+        SwapXorTransformScalar, SwapXorTransform, SwapChaCha20Transform
+    };
+    static const uint32_t lengths[] = {
+        0x1000, SWAP_TRANSFORM_SPLIT_THRESHOLD, SWAP_TRANSFORM_SPLIT_THRESHOLD + 0x200,
+        0x100000 + 3 * 0x200, 0x100000
+    };
+    const uint32_t size = 0x100000 + 0x1000;
+    SWAP_TRANSFORM_CHUNK chunks[SWAP_TRANSFORM_MAX_CHUNKS];
+    UCHAR zeroKey[SWAP_TRANSFORM_KEY_SIZE] = { 0 };
+    UCHAR key[SWAP_TRANSFORM_KEY_SIZE];
+    uint8_t *plain = malloc( size );
+    uint8_t *whole = malloc( size );
+    uint8_t *split = malloc( size );
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    uint32_t chunkCount;
+    uint32_t covered;
+    uint32_t offset;
+    uint32_t r;
+    uint32_t l;
+    uint32_t i;
+
+    if ((plain == NULL) || (whole == NULL) || (split == NULL)) {
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+
+    for (i = 0; i < size; i++) {
+        plain[i] = (uint8_t)Random64( &state );
+    }
+    for (i = 0; i < SWAP_TRANSFORM_KEY_SIZE; i++) {
+        key[i] = (uint8_t)Random64( &state );
+    }
+
+    memset( whole, 0, 512 );
+    SwapChaCha20Transform( zeroKey, 0, 512, whole, whole, 512 );
+    CHECK( memcmp( whole, keyStream, sizeof( keyStream )) == 0 );
+
+    //
+    //  The 8 byte XOR transform matches the SSE2 one.
+    //
+
+    SwapXorTransformScalar( key, 12345, 512, plain, whole, 0x10000 );
+    SwapXorTransform( key, 12345, 512, plain, split, 0x10000 );
+    CHECK( memcmp( whole, split, 0x10000 ) == 0 );
+
+    for (r = 0; r < sizeof( routines ) / sizeof( routines[0] ); r++) {
+
+        //
+        //  Each transform is its own inverse, in place or not, and tweaks
+        //  each sector with its number, so equal sectors encode differently.
+        //
+
+        memcpy( whole, plain, 1024 );
+        memcpy( whole + 512, plain, 512 );
+        routines[r]( key, 7, 512, whole, split, 1024 );
+        CHECK( memcmp( split, split + 512, 512 ) != 0 );
+        CHECK( memcmp( split, whole, 512 ) != 0 );
+        routines[r]( key, 7, 512, split, split, 1024 );
+        CHECK( memcmp( split, whole, 1024 ) == 0 );
+
+        //
+        //  A run can start at any sector: transforming part of it on its
+        //  own gives the same data as transforming all of it.
+        //
+
+        routines[r]( key, 100, 4096, plain, whole, 0x10000 );
+        routines[r]( key, 103, 4096, plain + 3 * 4096, split, 4096 );
+        CHECK( memcmp( split, whole + 3 * 4096, 4096 ) == 0 );
+
+        //
+        //  Split runs match the whole run, for any number of processors.
+        //
+
+        for (l = 0; l < sizeof( lengths ) / sizeof( lengths[0] ); l++) {
+
+            routines[r]( key, 0x1000 / 512, 512, plain, whole, lengths[l] );
+
+            for (i = 1; i <= SWAP_TRANSFORM_MAX_CHUNKS + 1; i++) {
+
+                memset( split, 0, size );
+                TransformRun( routines[r], key, 0x1000, 512, plain, split, lengths[l], i );
+                CHECK( memcmp( split, whole, lengths[l] ) == 0 );
+                CHECK( split[lengths[l]] == 0 );
+            }
+        }
+    }
+
+    //
+    //  Chunks cover the run exactly, at least SWAP_TRANSFORM_CHUNK_SIZE
+    //  bytes and a whole number of sectors each, and a run carved for one
+    //  processor, as paging I/O is, is never split.
+    //
+
+    for (l = 0; l < sizeof( lengths ) / sizeof( lengths[0] ); l++) {
+
+        for (i = 1; i <= SWAP_TRANSFORM_MAX_CHUNKS + 1; i++) {
+
+            chunkCount = SwapCarveTransform( SwapXorTransform, key, 0, 512, plain, split,
+                                             lengths[l], i, chunks );
+            CHECK( chunkCount <= SWAP_TRANSFORM_MAX_CHUNKS );
+            CHECK( (chunkCount == 1) || (lengths[l] > SWAP_TRANSFORM_SPLIT_THRESHOLD) );
+
+            for (r = 0, covered = 0; r < chunkCount; r++) {
+                offset = (uint32_t)(chunks[r].Source - plain);
+                CHECK( (chunks[r].Length == 0) || (offset == covered) );
+                CHECK( chunks[r].Destination - split == offset );
+                CHECK( (chunks[r].Routine == SwapXorTransform) && (chunks[r].Key == key) );
+                CHECK( (chunks[r].Length % 512) == 0 );
+                CHECK( (chunkCount == 1) || (chunks[0].Length >= SWAP_TRANSFORM_CHUNK_SIZE) );
+                CHECK( chunks[r].FirstSector == offset / 512 );
+                covered += chunks[r].Length;
+            }
+            CHECK( covered == lengths[l] );
+        }
+
+        CHECK( SwapCarveTransform( SwapXorTransform, key, 0, 512, plain, split,
+                                   lengths[l], 1, chunks ) == 1 );
+    }
+
+    free( plain );
+    free( whole );
+    free( split );
+
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    uint32_t threadCounts[MAX_THREADS];
+    uint32_t threadCountCount = 0;
+    uint32_t size = 0x10000;
+    uint32_t sectorSize = 512;
+    double seconds = 1.0;
+    UCHAR key[SWAP_TRANSFORM_KEY_SIZE];
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    double copy;
+    double xor;
+    double chacha;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--seconds" ) == 0) && (i + 1 < argc)) {
+            seconds = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--size" ) == 0) && (i + 1 < argc)) {
+            size = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--sector" ) == 0) && (i + 1 < argc)) {
+            sectorSize = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((atoi( argv[i] ) > 0) && (atoi( argv[i] ) <= MAX_THREADS) && (threadCountCount < MAX_THREADS)) {
+            threadCounts[threadCountCount++] = (uint32_t)atoi( argv[i] );
+        } else {
+            fprintf( stderr,
+                     "usage: xformbench --selftest\n"
+                     "       xformbench [--seconds s] [--size bytes] [--sector bytes] [threads...]\n" );
+            return 2;
+        }
+    }
+
+    if (threadCountCount == 0) {
+        threadCounts[threadCountCount++] = 1;
+        threadCounts[threadCountCount++] = 2;
+        threadCounts[threadCountCount++] = 4;
+        threadCounts[threadCountCount++] = 8;
+    }
+
+    //
+    //  Sectors are a multiple of 64 bytes, and non-cached I/O is a whole
+    //  number of them.
+    //
+
+    if ((seconds <= 0) || (sectorSize == 0) || ((sectorSize % 64) != 0) ||
+        (size == 0) || ((size % sectorSize) != 0)) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    for (i = 0; i < SWAP_TRANSFORM_KEY_SIZE; i++) {
+        key[i] = (uint8_t)Random64( &state );
+    }
+
+    printf( "%u byte writes, %u byte sectors, %.1fs per run\n", size, sectorSize, seconds );
+    printf( "%8s %12s %12s %14s\n", "threads", "copy GB/s", "xor GB/s", "chacha20 GB/s" );
+
+    for (i = 0; i < (int)threadCountCount; i++) {
+
+        copy = Run( NULL, key, threadCounts[i], size, sectorSize, seconds );
+        xor = Run( SwapXorTransform, key, threadCounts[i], size, sectorSize, seconds );
+        chacha = Run( SwapChaCha20Transform, key, threadCounts[i], size, sectorSize, seconds );
+
+        printf( "%8u %12.2f %12.2f %14.2f\n", threadCounts[i], copy, xor, chacha );
+    }
+
+    return 0;
+}
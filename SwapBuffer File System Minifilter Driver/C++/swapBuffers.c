@@ -19,6 +19,10 @@ Abstract:
     By default this filter attaches to all volumes it is notified about.  It
     does support having multiple instances on a given volume.
 
+    Optionally the data of non-cached reads and writes can be run through a
+    transform on its way between the users buffer and ours, as a filter
+    doing at rest encryption would.
+
 Environment:
 
     Kernel mode
@@ -28,75 +32,13 @@ Environment:
 #include <fltKernel.h>
 #include <dontuse.h>
 #include <suppress.h>
+#include "swapBuffers.h"
 
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
 
 PFLT_FILTER gFilterHandle;
 
-/*************************************************************************
-    Pool Tags
-*************************************************************************/
-
-#define BUFFER_SWAP_TAG     'bdBS'
-#define CONTEXT_TAG         'xcBS'
-#define NAME_TAG            'mnBS'
-#define PRE_2_POST_TAG      'ppBS'
-
-/*************************************************************************
-    Local structures
-*************************************************************************/
-
-//
-//  This is a volume context, one of these are attached to each volume
-//  we monitor.  This is used to get a "DOS" name for debug display.
-//
-
-typedef struct _VOLUME_CONTEXT {
-
-    //
-    //  Holds the name to display
-    //
-
-    UNICODE_STRING Name;
-
-    //
-    //  Holds the sector size for this volume.
-    //
-
-    ULONG SectorSize;
-
-} VOLUME_CONTEXT, *PVOLUME_CONTEXT;
-
-#define MIN_SECTOR_SIZE 0x200
-
-
-//
-//  This is a context structure that is used to pass state from our
-//  pre-operation callback to our post-operation callback.
-//
-
-typedef struct _PRE_2_POST_CONTEXT {
-
-    //
-    //  Pointer to our volume context structure.  We always get the context
-    //  in the preOperation path because you can not safely get it at DPC
-    //  level.  We then release it in the postOperation path.  It is safe
-    //  to release contexts at DPC level.
-    //
-
-    PVOLUME_CONTEXT VolCtx;
-
-    //
-    //  Since the post-operation parameters always receive the "original"
-    //  parameters passed to the operation, we need to pass our new destination
-    //  buffer to our post operation routine so we can free it.
-    //
-
-    PVOID SwappedBuffer;
-
-} PRE_2_POST_CONTEXT, *PPRE_2_POST_CONTEXT;
-
 //
 //  This is a lookAside list used to allocate our pre-2-post structure.
 //
@@ -139,6 +81,14 @@ FilterUnload (
     _In_ FLT_FILTER_UNLOAD_FLAGS Flags
     );
 
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostCreate (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_opt_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 SwapPreReadBuffers(
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -205,6 +155,28 @@ ReadDriverParameters (
     _In_ PUNICODE_STRING RegistryPath
     );
 
+NTSTATUS
+SwapShouldTransform (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PLARGE_INTEGER ByteOffset,
+    _Out_ PBOOLEAN Transform
+    );
+
+VOID
+SwapTransformBuffer (
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ BOOLEAN Encode,
+    _In_ LONGLONG ByteOffset,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ ULONG Length,
+    _In_ BOOLEAN AllowSplit
+    );
+
+FLT_GENERIC_WORKITEM_ROUTINE SwapTransformWorker;
+
 //
 //  Assign text sections for each routine.
 //
@@ -216,6 +188,8 @@ ReadDriverParameters (
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(INIT, ReadDriverParameters)
 #pragma alloc_text(PAGE, FilterUnload)
+#pragma alloc_text(PAGE, SwapCreateArena)
+#pragma alloc_text(PAGE, SwapDeleteArena)
 #endif
 
 //
@@ -223,6 +197,11 @@ ReadDriverParameters (
 //
 
 CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
+    { IRP_MJ_CREATE,
+      0,
+      NULL,
+      SwapPostCreate },
+
     { IRP_MJ_READ,
       0,
       SwapPreReadBuffers,
@@ -243,8 +222,8 @@ CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
 
 //
 //  Context definitions we currently care about.  Note that the system will
-//  create a lookAside list for the volume context because an explicit size
-//  of the context is specified.
+//  create a lookAside list for the volume and stream contexts because an
+//  explicit size of the context is specified.
 //
 
 CONST FLT_CONTEXT_REGISTRATION ContextNotifications[] = {
@@ -255,6 +234,12 @@ CONST FLT_CONTEXT_REGISTRATION ContextNotifications[] = {
        sizeof(VOLUME_CONTEXT),
        CONTEXT_TAG },
 
+     { FLT_STREAM_CONTEXT,
+       0,
+       NULL,
+       sizeof(STREAM_CONTEXT),
+       STREAM_CONTEXT_TAG },
+
      { FLT_CONTEXT_END }
 };
 
@@ -307,6 +292,30 @@ ULONG LoggingFlags = 0;             // all disabled by default
         DbgPrint _string  :                                         \
         ((int)0))
 
+/*************************************************************************
+    Transforms
+*************************************************************************/
+
+//
+//  The transforms we know about, indexed by the "Transform" registry value.
+//  Both of ours happen to be their own inverse.
+//
+
+CONST SWAP_TRANSFORM Transforms[SWAP_TRANSFORM_MAX + 1] = {
+
+    { "None",       NULL,                   NULL },
+    { "Xor",        SwapXorTransform,       SwapXorTransform },
+    { "ChaCha20",   SwapChaCha20Transform,  SwapChaCha20Transform }
+};
+
+//
+//  Transform and key read from the registry.  Each volume picks these up
+//  when we attach to it.
+//
+
+ULONG TransformType = SWAP_TRANSFORM_NONE;
+UCHAR TransformKey[SWAP_TRANSFORM_KEY_SIZE];
+
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -385,6 +394,20 @@ Return Value:
             leave;
         }
 
+        ctx->Arena = NULL;
+
+        //
+        //  Pick up the transform for this volume.
+        //
+
+        ctx->Transform = (TransformType != SWAP_TRANSFORM_NONE) ?
+                            &Transforms[TransformType] :
+                            NULL;
+
+        RtlCopyMemory( ctx->TransformKey,
+                       TransformKey,
+                       SWAP_TRANSFORM_KEY_SIZE );
+
         //
         //  Always get the volume properties, so I can get a sector size
         //
@@ -409,6 +432,24 @@ Return Value:
 
         ctx->SectorSize = max(volProp->SectorSize,MIN_SECTOR_SIZE);
 
+        //
+        //  Arena buffers are only page aligned, so only use an arena if that
+        //  is good enough for this volume.  Without one we simply allocate
+        //  from pool for each operation.
+        //
+
+        if (ctx->SectorSize <= PAGE_SIZE) {
+
+            status = SwapCreateArena( &ctx->Arena );
+
+            if (!NT_SUCCESS(status)) {
+
+                LOG_PRINT( LOGFL_ERRORS,
+                           ("SwapBuffers!InstanceSetup:                  Error creating buffer arena, status=%x\n",
+                            status) );
+            }
+        }
+
         //
         //  Init the buffer field (which may be allocated later).
         //
@@ -519,10 +560,11 @@ Return Value:
         //
 
         LOG_PRINT( LOGFL_VOLCTX,
-                   ("SwapBuffers!InstanceSetup:                  Real SectSize=0x%04x, Used SectSize=0x%04x, Name=\"%wZ\"\n",
+                   ("SwapBuffers!InstanceSetup:                  Real SectSize=0x%04x, Used SectSize=0x%04x, Name=\"%wZ\", Transform=%s\n",
                     volProp->SectorSize,
                     ctx->SectorSize,
-                    &ctx->Name) );
+                    &ctx->Name,
+                    Transforms[TransformType].Name) );
 
         //
         //  It is OK for the context to already be defined.
@@ -599,6 +641,14 @@ Return Value:
         ExFreePool(ctx->Name.Buffer);
         ctx->Name.Buffer = NULL;
     }
+
+    if (ctx->Arena != NULL) {
+
+        SwapDeleteArena( ctx->Arena );
+        ctx->Arena = NULL;
+    }
+
+    RtlSecureZeroMemory( ctx->TransformKey, SWAP_TRANSFORM_KEY_SIZE );
 }
 
 
@@ -650,131 +700,1209 @@ DriverEntry (
 
 Routine Description:
 
-    This is the initialization routine.  This registers with FltMgr and
-    initializes all global data structures.
+    This is the initialization routine.  This registers with FltMgr and
+    initializes all global data structures.
+
+Arguments:
+
+    DriverObject - Pointer to driver object created by the system to
+        represent this driver.
+
+    RegistryPath - Unicode string identifying where the parameters for this
+        driver are located in the registry.
+
+Return Value:
+
+    Status of the operation
+
+--*/
+{
+    NTSTATUS status;
+
+    //
+    //  Default to NonPagedPoolNx for non paged pool allocations where supported.
+    //
+    
+    ExInitializeDriverRuntime( DrvRtPoolNxOptIn );
+
+    //
+    //  Get debug trace flags and the transform to apply
+    //
+
+    ReadDriverParameters( RegistryPath );
+
+    //
+    //  Init lookaside list used to allocate our context structure used to
+    //  pass information from out preOperation callback to our postOperation
+    //  callback.
+    //
+
+    ExInitializeNPagedLookasideList( &Pre2PostContextList,
+                                     NULL,
+                                     NULL,
+                                     0,
+                                     sizeof(PRE_2_POST_CONTEXT),
+                                     PRE_2_POST_TAG,
+                                     0 );
+
+    //
+    //  Register with FltMgr
+    //
+
+    status = FltRegisterFilter( DriverObject,
+                                &FilterRegistration,
+                                &gFilterHandle );
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
+    //
+    //  Start filtering i/o
+    //
+
+    status = FltStartFiltering( gFilterHandle );
+
+    if (! NT_SUCCESS( status )) {
+
+        FltUnregisterFilter( gFilterHandle );
+        goto SwapDriverEntryExit;
+    }
+
+SwapDriverEntryExit:
+
+    if(! NT_SUCCESS( status )) {
+
+        ExDeleteNPagedLookasideList( &Pre2PostContextList );
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+FilterUnload (
+    _In_ FLT_FILTER_UNLOAD_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    Called when this mini-filter is about to be unloaded.  We unregister
+    from the FltMgr and then return it is OK to unload
+
+Arguments:
+
+    Flags - Indicating if this is a mandatory unload.
+
+Return Value:
+
+    Returns the final status of this operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( Flags );
+
+    //
+    //  Unregister from FLT mgr
+    //
+
+    FltUnregisterFilter( gFilterHandle );
+
+    //
+    //  Delete lookaside list
+    //
+
+    ExDeleteNPagedLookasideList( &Pre2PostContextList );
+
+    return STATUS_SUCCESS;
+}
+
+
+/*************************************************************************
+    Buffer arena routines.
+*************************************************************************/
+
+NTSTATUS
+SwapCreateArena (
+    _Outptr_ PSWAP_ARENA *Arena
+    )
+/*++
+
+Routine Description:
+
+    This routine creates an empty buffer arena for a volume and starts its
+    trim timer.  Buffers are only created as operations need them.
+
+Arguments:
+
+    Arena - Receives the new arena.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    PSWAP_ARENA arena;
+    ULONG processorCount;
+    ULONG i;
+    LARGE_INTEGER dueTime;
+
+    PAGED_CODE();
+
+    *Arena = NULL;
+
+    processorCount = KeQueryMaximumProcessorCountEx( ALL_PROCESSOR_GROUPS );
+
+    arena = ExAllocatePoolWithTag( NonPagedPool,
+                                   FIELD_OFFSET( SWAP_ARENA, CpuCaches ) +
+                                        processorCount * sizeof( SWAP_ARENA_CPU_CACHE ),
+                                   ARENA_TAG );
+
+    if (arena == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( arena,
+                   FIELD_OFFSET( SWAP_ARENA, CpuCaches ) +
+                        processorCount * sizeof( SWAP_ARENA_CPU_CACHE ) );
+
+    arena->ProcessorCount = processorCount;
+
+    for (i = 0; i < SWAP_ARENA_CLASSES; i++) {
+
+        InitializeSListHead( &arena->Classes[i].Depot );
+    }
+
+    for (i = 0; i < processorCount; i++) {
+
+        KeInitializeSpinLock( &arena->CpuCaches[i].Lock );
+    }
+
+    //
+    //  The trim timer doesn't need to be punctual, let the system coalesce
+    //  it with other timers.
+    //
+
+    KeInitializeDpc( &arena->TrimDpc, SwapTrimArena, arena );
+    KeInitializeTimer( &arena->TrimTimer );
+
+    dueTime.QuadPart = -10000LL * SWAP_ARENA_TRIM_PERIOD;
+
+    KeSetCoalescableTimer( &arena->TrimTimer,
+                           dueTime,
+                           SWAP_ARENA_TRIM_PERIOD,
+                           SWAP_ARENA_TRIM_PERIOD / 10,
+                           &arena->TrimDpc );
+
+    *Arena = arena;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+SwapDeleteArena (
+    _In_ PSWAP_ARENA Arena
+    )
+/*++
+
+Routine Description:
+
+    This routine stops the trim timer and frees an arena along with all
+    of its buffers.  It is called when the volume context goes away, at
+    which point every operation has given its buffer back.
+
+Arguments:
+
+    Arena - The arena to delete.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSWAP_ARENA_CPU_CACHE cache;
+    PSLIST_ENTRY entry;
+    ULONG cpu;
+    ULONG sizeClass;
+
+    PAGED_CODE();
+
+    //
+    //  Make sure the trim DPC isn't running, or about to run, before we
+    //  tear the arena down underneath it.
+    //
+
+    KeCancelTimer( &Arena->TrimTimer );
+    KeFlushQueuedDpcs();
+
+    for (cpu = 0; cpu < Arena->ProcessorCount; cpu++) {
+
+        cache = &Arena->CpuCaches[cpu];
+
+        for (sizeClass = 0; sizeClass < SWAP_ARENA_CLASSES; sizeClass++) {
+
+            while (cache->Count[sizeClass] > 0) {
+
+                cache->Count[sizeClass] -= 1;
+                SwapDeleteArenaBuffer( cache->Buffers[sizeClass][cache->Count[sizeClass]] );
+            }
+        }
+    }
+
+    for (sizeClass = 0; sizeClass < SWAP_ARENA_CLASSES; sizeClass++) {
+
+        while ((entry = InterlockedPopEntrySList( &Arena->Classes[sizeClass].Depot )) != NULL) {
+
+            SwapDeleteArenaBuffer( CONTAINING_RECORD( entry, SWAP_ARENA_BUFFER, ListEntry ));
+        }
+    }
+
+    ExFreePoolWithTag( Arena, ARENA_TAG );
+}
+
+
+PSWAP_ARENA_BUFFER
+SwapCreateArenaBuffer (
+    _In_ ULONG SizeClass
+    )
+/*++
+
+Routine Description:
+
+    This routine grows an arena by one buffer of the given size class and
+    builds the MDL describing it.
+
+Arguments:
+
+    SizeClass - Size class of the buffer, it is PAGE_SIZE << SizeClass
+        bytes long.
+
+Return Value:
+
+    The new arena buffer, or NULL if we are out of memory.
+
+--*/
+{
+    PSWAP_ARENA_BUFFER arenaBuf;
+    ULONG length = PAGE_SIZE << SizeClass;
+
+    arenaBuf = ExAllocatePoolWithTag( NonPagedPool,
+                                      sizeof( SWAP_ARENA_BUFFER ),
+                                      ARENA_TAG );
+
+    if (arenaBuf == NULL) {
+
+        return NULL;
+    }
+
+    arenaBuf->SizeClass = SizeClass;
+
+    //
+    //  Pool allocations of a page or more are always page aligned.
+    //
+
+    arenaBuf->Buffer = ExAllocatePoolWithTag( NonPagedPool,
+                                              length,
+                                              BUFFER_SWAP_TAG );
+
+    if (arenaBuf->Buffer == NULL) {
+
+        ExFreePoolWithTag( arenaBuf, ARENA_TAG );
+        return NULL;
+    }
+
+    arenaBuf->Mdl = IoAllocateMdl( arenaBuf->Buffer,
+                                   length,
+                                   FALSE,
+                                   FALSE,
+                                   NULL );
+
+    if (arenaBuf->Mdl == NULL) {
+
+        ExFreePoolWithTag( arenaBuf->Buffer, BUFFER_SWAP_TAG );
+        ExFreePoolWithTag( arenaBuf, ARENA_TAG );
+        return NULL;
+    }
+
+    MmBuildMdlForNonPagedPool( arenaBuf->Mdl );
+
+    return arenaBuf;
+}
+
+
+VOID
+SwapDeleteArenaBuffer (
+    _In_ PSWAP_ARENA_BUFFER ArenaBuffer
+    )
+/*++
+
+Routine Description:
+
+    This routine frees an arena buffer along with its MDL.
+
+Arguments:
+
+    ArenaBuffer - The buffer to free.
+
+Return Value:
+
+    None
+
+--*/
+{
+    IoFreeMdl( ArenaBuffer->Mdl );
+    ExFreePoolWithTag( ArenaBuffer->Buffer, BUFFER_SWAP_TAG );
+    ExFreePoolWithTag( ArenaBuffer, ARENA_TAG );
+}
+
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ ULONG Length,
+    _In_ BOOLEAN Aligned,
+    _Out_ PSWAP_ARENA_BUFFER *ArenaBuffer
+    )
+/*++
+
+Routine Description:
+
+    This routine gets a nonPaged buffer to swap to.  It comes from the
+    volume's arena when there is one and the length fits a size class,
+    otherwise it is allocated from pool.
+
+Arguments:
+
+    Instance - Our instance on the volume.
+
+    VolCtx - Our volume context.
+
+    Length - Number of bytes needed.
+
+    Aligned - If the buffer has to meet the alignment requirement of the
+        device.  This only matters when the buffer comes from pool.
+
+    ArenaBuffer - Receives the arena buffer backing the returned buffer, or
+        NULL if it came from pool.  This must be passed to SwapFreeBuffer.
+
+Return Value:
+
+    The buffer, or NULL if we are out of memory.
+
+--*/
+{
+    PSWAP_ARENA arena = VolCtx->Arena;
+    PSWAP_ARENA_CLASS arenaClass;
+    PSWAP_ARENA_CPU_CACHE cache;
+    PSWAP_ARENA_BUFFER arenaBuf = NULL;
+    PSLIST_ENTRY entry;
+    ULONG sizeClass = 0;
+    LONG depth;
+    KIRQL oldIrql;
+
+    *ArenaBuffer = NULL;
+
+    while ((sizeClass < SWAP_ARENA_CLASSES) &&
+           (Length > ((ULONG) PAGE_SIZE << sizeClass))) {
+
+        sizeClass += 1;
+    }
+
+    if ((arena == NULL) || (sizeClass == SWAP_ARENA_CLASSES)) {
+
+        if (Aligned) {
+
+            return FltAllocatePoolAlignedWithTag( Instance,
+                                                  NonPagedPool,
+                                                  (SIZE_T) Length,
+                                                  BUFFER_SWAP_TAG );
+        }
+
+        return ExAllocatePoolWithTag( NonPagedPool,
+                                      Length,
+                                      BUFFER_SWAP_TAG );
+    }
+
+    //
+    //  Try the cache of the processor we are running on first.  We have
+    //  to stay on this processor while we use it.
+    //
+
+    KeRaiseIrql( DISPATCH_LEVEL, &oldIrql );
+
+    cache = &arena->CpuCaches[KeGetCurrentProcessorNumberEx( NULL )];
+
+    KeAcquireSpinLockAtDpcLevel( &cache->Lock );
+
+    cache->Active = TRUE;
+
+    if (cache->Count[sizeClass] > 0) {
+
+        cache->Count[sizeClass] -= 1;
+        arenaBuf = cache->Buffers[sizeClass][cache->Count[sizeClass]];
+    }
+
+    KeReleaseSpinLockFromDpcLevel( &cache->Lock );
+    KeLowerIrql( oldIrql );
+
+    if (arenaBuf == NULL) {
+
+        arenaClass = &arena->Classes[sizeClass];
+
+        entry = InterlockedPopEntrySList( &arenaClass->Depot );
+
+        if (entry != NULL) {
+
+            arenaBuf = CONTAINING_RECORD( entry, SWAP_ARENA_BUFFER, ListEntry );
+
+            depth = ExQueryDepthSList( &arenaClass->Depot );
+
+            if (depth < arenaClass->LowWater) {
+
+                arenaClass->LowWater = depth;
+            }
+
+        } else {
+
+            //
+            //  The depot ran dry, so nothing in it sat idle this period.
+            //  Grow the arena.
+            //
+
+            arenaClass->LowWater = 0;
+
+            arenaBuf = SwapCreateArenaBuffer( sizeClass );
+
+            if (arenaBuf == NULL) {
+
+                return NULL;
+            }
+        }
+    }
+
+    *ArenaBuffer = arenaBuf;
+
+    return arenaBuf->Buffer;
+}
+
+
+PMDL
+SwapAllocateMdl (
+    _In_ PVOID Buffer,
+    _In_ ULONG Length,
+    _In_opt_ PSWAP_ARENA_BUFFER ArenaBuffer
+    )
+/*++
+
+Routine Description:
+
+    This routine builds the MDL we swap in along with a buffer from
+    SwapAllocateBuffer.  FltMgr frees this MDL when the operation completes,
+    so we can't hand down the arena buffer's own MDL.  We do copy the pages
+    out of it though rather than building the MDL from scratch.
+
+Arguments:
+
+    Buffer - The buffer to describe.
+
+    Length - Number of bytes of the buffer to describe.
+
+    ArenaBuffer - The arena buffer backing Buffer, if any.
+
+Return Value:
+
+    The MDL, or NULL if we are out of memory.
+
+--*/
+{
+    PMDL mdl;
+
+    mdl = IoAllocateMdl( Buffer,
+                         Length,
+                         FALSE,
+                         FALSE,
+                         NULL );
+
+    if (mdl == NULL) {
+
+        return NULL;
+    }
+
+    if (ArenaBuffer != NULL) {
+
+        FLT_ASSERT(ArenaBuffer->Buffer == Buffer);
+
+        IoBuildPartialMdl( ArenaBuffer->Mdl,
+                           mdl,
+                           Buffer,
+                           Length );
+
+    } else {
+
+        MmBuildMdlForNonPagedPool( mdl );
+    }
+
+    return mdl;
+}
+
+
+VOID
+SwapFreeBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PVOID Buffer,
+    _In_opt_ PSWAP_ARENA_BUFFER ArenaBuffer,
+    _In_ BOOLEAN Aligned
+    )
+/*++
+
+Routine Description:
+
+    This routine gives back a buffer from SwapAllocateBuffer.  This may be
+    called at DPC level.
+
+Arguments:
+
+    Instance - Our instance on the volume.
+
+    VolCtx - Our volume context.
+
+    Buffer - The buffer to free.
+
+    ArenaBuffer - The arena buffer returned along with Buffer.
+
+    Aligned - The value passed to SwapAllocateBuffer.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSWAP_ARENA arena = VolCtx->Arena;
+    PSWAP_ARENA_CPU_CACHE cache;
+    ULONG sizeClass;
+    KIRQL oldIrql;
+
+    if (ArenaBuffer == NULL) {
+
+        if (Aligned) {
+
+            FltFreePoolAlignedWithTag( Instance,
+                                       Buffer,
+                                       BUFFER_SWAP_TAG );
+
+        } else {
+
+            ExFreePool( Buffer );
+        }
+
+        return;
+    }
+
+    FLT_ASSERT(ArenaBuffer->Buffer == Buffer);
+
+    sizeClass = ArenaBuffer->SizeClass;
+
+    //
+    //  Put the buffer in the cache of this processor if there is room,
+    //  otherwise in the depot.
+    //
+
+    KeRaiseIrql( DISPATCH_LEVEL, &oldIrql );
+
+    cache = &arena->CpuCaches[KeGetCurrentProcessorNumberEx( NULL )];
+
+    KeAcquireSpinLockAtDpcLevel( &cache->Lock );
+
+    cache->Active = TRUE;
+
+    if (cache->Count[sizeClass] < SWAP_ARENA_CPU_CACHE_DEPTH) {
+
+        cache->Buffers[sizeClass][cache->Count[sizeClass]] = ArenaBuffer;
+        cache->Count[sizeClass] += 1;
+        ArenaBuffer = NULL;
+    }
+
+    KeReleaseSpinLockFromDpcLevel( &cache->Lock );
+    KeLowerIrql( oldIrql );
+
+    if (ArenaBuffer != NULL) {
+
+        InterlockedPushEntrySList( &arena->Classes[sizeClass].Depot,
+                                   &ArenaBuffer->ListEntry );
+    }
+}
+
+
+VOID
+SwapTrimArena (
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2
+    )
+/*++
+
+Routine Description:
+
+    This is the trim timer DPC.  The caches of processors that didn't use
+    the arena during the last period are moved to the depot.  Then any
+    buffers that stayed in a depot for the whole period are freed, a batch
+    at a time, so an arena shrinks back once the load goes away.
+
+Arguments:
+
+    Dpc - Unused.
+
+    DeferredContext - The arena to trim.
+
+    SystemArgument1 - Unused.
+
+    SystemArgument2 - Unused.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSWAP_ARENA arena = DeferredContext;
+    PSWAP_ARENA_CPU_CACHE cache;
+    PSWAP_ARENA_CLASS arenaClass;
+    PSLIST_ENTRY entry;
+    ULONG cpu;
+    ULONG sizeClass;
+    LONG trim;
+
+    UNREFERENCED_PARAMETER( Dpc );
+    UNREFERENCED_PARAMETER( SystemArgument1 );
+    UNREFERENCED_PARAMETER( SystemArgument2 );
+
+    _Analysis_assume_(arena != NULL);
+
+    for (cpu = 0; cpu < arena->ProcessorCount; cpu++) {
+
+        cache = &arena->CpuCaches[cpu];
+
+        KeAcquireSpinLockAtDpcLevel( &cache->Lock );
+
+        if (!cache->Active) {
+
+            for (sizeClass = 0; sizeClass < SWAP_ARENA_CLASSES; sizeClass++) {
+
+                while (cache->Count[sizeClass] > 0) {
+
+                    cache->Count[sizeClass] -= 1;
+                    InterlockedPushEntrySList( &arena->Classes[sizeClass].Depot,
+                                               &cache->Buffers[sizeClass][cache->Count[sizeClass]]->ListEntry );
+                }
+            }
+        }
+
+        cache->Active = FALSE;
+
+        KeReleaseSpinLockFromDpcLevel( &cache->Lock );
+    }
+
+    for (sizeClass = 0; sizeClass < SWAP_ARENA_CLASSES; sizeClass++) {
+
+        arenaClass = &arena->Classes[sizeClass];
+
+        trim = min( arenaClass->LowWater, SWAP_ARENA_TRIM_BATCH );
+
+        while (trim-- > 0) {
+
+            entry = InterlockedPopEntrySList( &arenaClass->Depot );
+
+            if (entry == NULL) {
+
+                break;
+            }
+
+            SwapDeleteArenaBuffer( CONTAINING_RECORD( entry, SWAP_ARENA_BUFFER, ListEntry ));
+        }
+
+        arenaClass->LowWater = ExQueryDepthSList( &arenaClass->Depot );
+    }
+}
+
+
+/*************************************************************************
+    Transform routines.
+*************************************************************************/
+
+NTSTATUS
+SwapShouldTransform (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PLARGE_INTEGER ByteOffset,
+    _Out_ PBOOLEAN Transform
+    )
+/*++
+
+Routine Description:
+
+    This routine decides if the data of a read or write gets transformed.
+    That is the case for non-cached I/O to a stream which was marked to be
+    transformed when it was opened.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData of the read or write.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    VolCtx - Our volume context.
+
+    ByteOffset - The file offset of the operation.
+
+    Transform - Receives TRUE if the data has to be transformed.
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_PARAMETER if the data of a transformed
+    stream is not at a sector aligned offset.  We can't transform it, and
+    passing it on in the clear would corrupt the stream.
+
+--*/
+{
+    PSTREAM_CONTEXT streamCtx;
+    NTSTATUS status;
+
+    *Transform = FALSE;
+
+    if ((VolCtx->Transform == NULL) ||
+        !FlagOn(Data->Iopb->IrpFlags,IRP_NOCACHE)) {
+
+        return STATUS_SUCCESS;
+    }
+
+    //
+    //  A stream without a context was never opened through us, or was
+    //  opened before we attached.  Its data was never transformed.
+    //
+
+    status = FltGetStreamContext( FltObjects->Instance,
+                                  FltObjects->FileObject,
+                                  &streamCtx );
+
+    if (!NT_SUCCESS(status)) {
+
+        return STATUS_SUCCESS;
+    }
+
+    *Transform = streamCtx->Transform;
+
+    FltReleaseContext( streamCtx );
+
+    //
+    //  Non-cached I/O is always sector aligned, but don't assume so.  This
+    //  also catches writes to end of file, whose offset we don't know yet.
+    //
+
+    if (*Transform &&
+        ((ByteOffset->QuadPart < 0) ||
+         ((ByteOffset->QuadPart % VolCtx->SectorSize) != 0))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+SwapTransformBuffer (
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ BOOLEAN Encode,
+    _In_ LONGLONG ByteOffset,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ ULONG Length,
+    _In_ BOOLEAN AllowSplit
+    )
+/*++
+
+Routine Description:
+
+    This routine runs the volume's transform over a sector aligned run of
+    data.  Large runs are split into chunks which are handed to worker
+    threads, while this thread does the first chunk itself and then waits
+    for the rest.
+
+    We never split paging I/O.  The worker threads could themselves be
+    waiting on the very page this I/O is trying to free up.
+
+Arguments:
+
+    VolCtx - Our volume context.
+
+    Encode - TRUE to encode the data, FALSE to decode it.
+
+    ByteOffset - File offset the data lives at.
+
+    Source - The data to transform.
+
+    Destination - Receives the transformed data, may be Source.
+
+    Length - Number of bytes to transform, a multiple of the sector size.
+
+    AllowSplit - If we are at an IRQL where we may wait and the work may be
+        split across threads.
+
+Return Value:
+
+    None
+
+--*/
+{
+    SWAP_TRANSFORM_CHUNK chunks[SWAP_TRANSFORM_MAX_CHUNKS];
+    PSWAP_TRANSFORM_ROUTINE routine;
+    volatile LONG outstanding = 1;
+    KEVENT done;
+    ULONG sectorSize = VolCtx->SectorSize;
+    ULONG chunkCount;
+    ULONG i;
+    NTSTATUS status;
+
+    FLT_ASSERT(VolCtx->Transform != NULL);
+    FLT_ASSERT((Length % sectorSize) == 0);
+
+    routine = Encode ? VolCtx->Transform->Encode : VolCtx->Transform->Decode;
+
+    chunkCount = SwapCarveTransform( routine,
+                                     VolCtx->TransformKey,
+                                     ByteOffset,
+                                     sectorSize,
+                                     Source,
+                                     Destination,
+                                     Length,
+                                     AllowSplit ?
+                                        KeQueryActiveProcessorCountEx( ALL_PROCESSOR_GROUPS ) :
+                                        1,
+                                     chunks );
+
+    if (chunkCount > 1) {
+
+        KeInitializeEvent( &done, NotificationEvent, FALSE );
+    }
+
+    for (i = 0; i < chunkCount; i++) {
+
+        chunks[i].Outstanding = &outstanding;
+        chunks[i].Done = &done;
+    }
+
+    //
+    //  Hand all but the first chunk to worker threads.  If we can't, we
+    //  just do the chunk ourselves.
+    //
+
+    for (i = 1; i < chunkCount; i++) {
+
+        if (chunks[i].Length == 0) {
+
+            continue;
+        }
+
+        chunks[i].WorkItem = FltAllocateGenericWorkItem();
+
+        if (chunks[i].WorkItem != NULL) {
+
+            InterlockedIncrement( &outstanding );
+
+            status = FltQueueGenericWorkItem( chunks[i].WorkItem,
+                                              gFilterHandle,
+                                              SwapTransformWorker,
+                                              DelayedWorkQueue,
+                                              &chunks[i] );
+
+            if (NT_SUCCESS(status)) {
+
+                continue;
+            }
+
+            InterlockedDecrement( &outstanding );
+            FltFreeGenericWorkItem( chunks[i].WorkItem );
+            chunks[i].WorkItem = NULL;
+        }
+
+        routine( chunks[i].Key,
+                 chunks[i].FirstSector,
+                 sectorSize,
+                 chunks[i].Source,
+                 chunks[i].Destination,
+                 chunks[i].Length );
+    }
+
+    routine( chunks[0].Key,
+             chunks[0].FirstSector,
+             sectorSize,
+             chunks[0].Source,
+             chunks[0].Destination,
+             chunks[0].Length );
+
+    //
+    //  Wait for the workers to finish.  The chunks live on our stack.
+    //
+
+    if (InterlockedDecrement( &outstanding ) != 0) {
+
+        KeWaitForSingleObject( &done,
+                               Executive,
+                               KernelMode,
+                               FALSE,
+                               NULL );
+    }
+}
+
+
+VOID
+SwapTransformWorker (
+    _In_ PFLT_GENERIC_WORKITEM FltWorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    This worker transforms one chunk of a split transform.
+
+Arguments:
+
+    FltWorkItem - Our work item.
+
+    FltObject - Our filter.
+
+    Context - The chunk to transform.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSWAP_TRANSFORM_CHUNK chunk = Context;
+    PKEVENT done;
+
+    UNREFERENCED_PARAMETER( FltObject );
+
+    _Analysis_assume_(chunk != NULL);
+
+    chunk->Routine( chunk->Key,
+                    chunk->FirstSector,
+                    chunk->SectorSize,
+                    chunk->Source,
+                    chunk->Destination,
+                    chunk->Length );
+
+    FltFreeGenericWorkItem( FltWorkItem );
+
+    //
+    //  Once the count drops the chunk may be gone, so grab the event first.
+    //
+
+    done = chunk->Done;
+
+    if (InterlockedDecrement( chunk->Outstanding ) == 0) {
+
+        KeSetEvent( done, IO_NO_INCREMENT, FALSE );
+    }
+}
+
+
+/*************************************************************************
+    MiniFilter callback routines.
+*************************************************************************/
+
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostCreate (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_opt_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This routine decides whether a stream gets transformed the first time
+    it is opened on a volume with a transform, and records the decision in
+    a stream context.  It holds for as long as the stream exists in memory,
+    and is made the same way again after that, so every non-cached read and
+    write of the stream is treated alike.
+
+    Data streams of files opened by name are transformed.  Directories,
+    volume opens and the paging file are not.
+
+    If we can't record that a stream is transformed we fail the open.
+    Letting it go ahead would have its data go to disk in the clear.
 
 Arguments:
 
-    DriverObject - Pointer to driver object created by the system to
-        represent this driver.
+    Data - Pointer to the filter callbackData that is passed to us.
 
-    RegistryPath - Unicode string identifying where the parameters for this
-        driver are located in the registry.
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - Not used.
+
+    Flags - Denotes whether the completion is successful or is being drained.
 
 Return Value:
 
-    Status of the operation
+    FLT_POSTOP_FINISHED_PROCESSING - This is always returned.
 
 --*/
 {
+    PFILE_OBJECT fileObject = FltObjects->FileObject;
+    PVOLUME_CONTEXT volCtx = NULL;
+    PSTREAM_CONTEXT streamCtx = NULL;
+    BOOLEAN isDirectory;
+    BOOLEAN transform;
     NTSTATUS status;
 
-    //
-    //  Default to NonPagedPoolNx for non paged pool allocations where supported.
-    //
-    
-    ExInitializeDriverRuntime( DrvRtPoolNxOptIn );
+    UNREFERENCED_PARAMETER( CompletionContext );
 
-    //
-    //  Get debug trace flags
-    //
+    if (!NT_SUCCESS(Data->IoStatus.Status) ||
+        (Data->IoStatus.Status == STATUS_REPARSE) ||
+        FlagOn(Flags,FLTFL_POST_OPERATION_DRAINING)) {
 
-    ReadDriverParameters( RegistryPath );
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
 
-    //
-    //  Init lookaside list used to allocate our context structure used to
-    //  pass information from out preOperation callback to our postOperation
-    //  callback.
-    //
+    try {
 
-    ExInitializeNPagedLookasideList( &Pre2PostContextList,
-                                     NULL,
-                                     NULL,
-                                     0,
-                                     sizeof(PRE_2_POST_CONTEXT),
-                                     PRE_2_POST_TAG,
-                                     0 );
+        status = FltGetVolumeContext( FltObjects->Filter,
+                                      FltObjects->Volume,
+                                      &volCtx );
 
-    //
-    //  Register with FltMgr
-    //
+        if (!NT_SUCCESS(status) ||
+            (volCtx->Transform == NULL)) {
 
-    status = FltRegisterFilter( DriverObject,
-                                &FilterRegistration,
-                                &gFilterHandle );
+            leave;
+        }
 
-    if (! NT_SUCCESS( status )) {
+        //
+        //  A file system which can't keep a context for this stream can't
+        //  have it transformed either.  That never changes for a stream.
+        //
 
-        goto SwapDriverEntryExit;
-    }
+        if (FlagOn(fileObject->Flags,FO_VOLUME_OPEN) ||
+            !FltSupportsStreamContexts( fileObject )) {
 
-    //
-    //  Start filtering i/o
-    //
+            leave;
+        }
 
-    status = FltStartFiltering( gFilterHandle );
+        //
+        //  If the stream already has a context it was decided on when it was
+        //  first opened.
+        //
 
-    if (! NT_SUCCESS( status )) {
+        status = FltGetStreamContext( FltObjects->Instance,
+                                      fileObject,
+                                      &streamCtx );
 
-        FltUnregisterFilter( gFilterHandle );
-        goto SwapDriverEntryExit;
-    }
+        if (NT_SUCCESS(status)) {
 
-SwapDriverEntryExit:
+            leave;
+        }
 
-    if(! NT_SUCCESS( status )) {
+        streamCtx = NULL;
 
-        ExDeleteNPagedLookasideList( &Pre2PostContextList );
-    }
+        status = FltIsDirectory( fileObject,
+                                 FltObjects->Instance,
+                                 &isDirectory );
 
-    return status;
-}
+        if (!NT_SUCCESS(status)) {
 
+            isDirectory = FALSE;
+        }
 
-NTSTATUS
-FilterUnload (
-    _In_ FLT_FILTER_UNLOAD_FLAGS Flags
-    )
-/*++
+        transform = (BOOLEAN)(!isDirectory &&
+                              !FlagOn(Data->Iopb->OperationFlags,SL_OPEN_PAGING_FILE) &&
+                              !FsRtlIsPagingFile( fileObject ));
 
-Routine Description:
+        status = FltAllocateContext( FltObjects->Filter,
+                                     FLT_STREAM_CONTEXT,
+                                     sizeof(STREAM_CONTEXT),
+                                     NonPagedPool,
+                                     &streamCtx );
 
-    Called when this mini-filter is about to be unloaded.  We unregister
-    from the FltMgr and then return it is OK to unload
+        if (NT_SUCCESS(status)) {
 
-Arguments:
+            streamCtx->Transform = transform;
 
-    Flags - Indicating if this is a mandatory unload.
+            //
+            //  If somebody else opened the stream at the same time and got
+            //  there first, theirs is the same decision.
+            //
 
-Return Value:
+            status = FltSetStreamContext( FltObjects->Instance,
+                                          fileObject,
+                                          FLT_SET_CONTEXT_KEEP_IF_EXISTS,
+                                          streamCtx,
+                                          NULL );
 
-    Returns the final status of this operation.
+            if (status == STATUS_FLT_CONTEXT_ALREADY_DEFINED) {
 
---*/
-{
-    PAGED_CODE();
+                status = STATUS_SUCCESS;
+            }
 
-    UNREFERENCED_PARAMETER( Flags );
+        } else {
 
-    //
-    //  Unregister from FLT mgr
-    //
+            streamCtx = NULL;
+        }
 
-    FltUnregisterFilter( gFilterHandle );
+        //
+        //  A stream left without a context isn't transformed, which is fine
+        //  if it wasn't going to be.
+        //
 
-    //
-    //  Delete lookaside list
-    //
+        if (!NT_SUCCESS(status) && transform) {
 
-    ExDeleteNPagedLookasideList( &Pre2PostContextList );
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPostCreate:                 %wZ Failed to set stream context, status=%x\n",
+                        &volCtx->Name,
+                        status) );
 
-    return STATUS_SUCCESS;
-}
+            FltCancelFileOpen( FltObjects->Instance, fileObject );
 
+            Data->IoStatus.Status = status;
+            Data->IoStatus.Information = 0;
+        }
+
+    } finally {
+
+        if (streamCtx != NULL) {
+
+            FltReleaseContext( streamCtx );
+        }
+
+        if (volCtx != NULL) {
+
+            FltReleaseContext( volCtx );
+        }
+    }
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
 
-/*************************************************************************
-    MiniFilter callback routines.
-*************************************************************************/
 
 FLT_PREOP_CALLBACK_STATUS
 SwapPreReadBuffers(
@@ -804,7 +1932,9 @@ Arguments:
 Return Value:
 
     FLT_PREOP_SUCCESS_WITH_CALLBACK - we want a postOpeation callback
+    FLT_PREOP_SYNCHRONIZE - we want a postOperation callback in this thread
     FLT_PREOP_SUCCESS_NO_CALLBACK - we don't want a postOperation callback
+    FLT_PREOP_COMPLETE - we failed the operation
 
 --*/
 {
@@ -812,10 +1942,12 @@ Return Value:
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
+    PSWAP_ARENA_BUFFER arenaBuf = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
     NTSTATUS status;
     ULONG readLen = iopb->Parameters.Read.Length;
+    BOOLEAN transform = FALSE;
 
     try {
 
@@ -859,6 +1991,29 @@ Return Value:
             readLen = (ULONG)ROUND_TO_SIZE(readLen,volCtx->SectorSize);
         }
 
+        //
+        //  See if the data we read has to be decoded.
+        //
+
+        status = SwapShouldTransform( Data,
+                                      FltObjects,
+                                      volCtx,
+                                      &iopb->Parameters.Read.ByteOffset,
+                                      &transform );
+
+        if (!NT_SUCCESS(status)) {
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPreReadBuffers:             %wZ Unaligned read of a transformed stream, status=%x\n",
+                        &volCtx->Name,
+                        status) );
+
+            Data->IoStatus.Status = status;
+            Data->IoStatus.Information = 0;
+            retValue = FLT_PREOP_COMPLETE;
+            leave;
+        }
+
         //
         //  Allocate aligned nonPaged memory for the buffer we are swapping
         //  to. This is really only necessary for noncached IO but we always
@@ -866,10 +2021,11 @@ Return Value:
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance, 
-                                                NonPagedPool,
-                                                (SIZE_T) readLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     volCtx,
+                                     readLen,
+                                     TRUE,
+                                     &arenaBuf );
         if (newBuf == NULL) {
 
             LOG_PRINT( LOGFL_ERRORS,
@@ -893,11 +2049,9 @@ Return Value:
             //  the MDL allocation then we won't swap buffer for this operation
             //
 
-            newMdl = IoAllocateMdl( newBuf,
-                                    readLen,
-                                    FALSE,
-                                    FALSE,
-                                    NULL );
+            newMdl = SwapAllocateMdl( newBuf,
+                                      readLen,
+                                      arenaBuf );
 
             if (newMdl == NULL) {
 
@@ -907,12 +2061,6 @@ Return Value:
 
                 leave;
             }
-
-            //
-            //  setup the MDL for the non-paged pool we just allocated
-            //
-
-            MmBuildMdlForNonPagedPool( newMdl );
         }
 
         //
@@ -959,15 +2107,30 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->ArenaBuffer = arenaBuf;
+        p2pCtx->Transformed = transform;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
 
         //
-        //  Return we want a post-operation callback
+        //  Return we want a post-operation callback.  A synchronous paging
+        //  read that has to be decoded may complete at DPC level, and its
+        //  completion can't be posted to a safe IRQL.  Its thread waits for
+        //  it anyway, so have it wait here and get our post-operation
+        //  callback in this thread, where the decode can be done.
         //
 
-        retValue = FLT_PREOP_SUCCESS_WITH_CALLBACK;
+        if (transform &&
+            FlagOn(iopb->IrpFlags,IRP_PAGING_IO) &&
+            FltIsOperationSynchronous( Data )) {
+
+            retValue = FLT_PREOP_SYNCHRONIZE;
+
+        } else {
+
+            retValue = FLT_PREOP_SUCCESS_WITH_CALLBACK;
+        }
 
     } finally {
 
@@ -975,13 +2138,16 @@ Return Value:
         //  If we don't want a post-operation callback, then cleanup state.
         //
 
-        if (retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) {
+        if ((retValue != FLT_PREOP_SUCCESS_WITH_CALLBACK) &&
+            (retValue != FLT_PREOP_SYNCHRONIZE)) {
 
             if (newBuf != NULL) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
+                SwapFreeBuffer( FltObjects->Instance,
+                                volCtx,
+                                newBuf,
+                                arenaBuf,
+                                TRUE );
             }
 
             if (newMdl != NULL) {
@@ -1065,6 +2231,40 @@ Return Value:
             leave;
         }
 
+        //
+        //  Data that has to be decoded is decoded, and copied back, at a
+        //  safe IRQL.  Decoding holds up everything else on the processor
+        //  at DPC level, and can't be spread over other threads there.
+        //
+
+        if (p2pCtx->Transformed) {
+
+            if (FltDoCompletionProcessingWhenSafe( Data,
+                                                   FltObjects,
+                                                   CompletionContext,
+                                                   Flags,
+                                                   SwapPostReadBuffersWhenSafe,
+                                                   &retValue )) {
+
+                cleanupAllocatedBuffer = FALSE;
+                leave;
+            }
+
+            //
+            //  Only an asynchronous paging read can't be posted.  It has a
+            //  MDL, so this is the one case where we decode, and copy the
+            //  data back, right here.
+            //
+
+            SwapTransformBuffer( p2pCtx->VolCtx,
+                                 FALSE,
+                                 iopb->Parameters.Read.ByteOffset.QuadPart,
+                                 p2pCtx->SwappedBuffer,
+                                 p2pCtx->SwappedBuffer,
+                                 (ULONG)ROUND_TO_SIZE(Data->IoStatus.Information,p2pCtx->VolCtx->SectorSize),
+                                 FALSE );
+        }
+
         //
         //  We need to copy the read data back into the users buffer.  Note
         //  that the parameters passed in are for the users original buffers
@@ -1210,9 +2410,11 @@ Return Value:
                         p2pCtx->SwappedBuffer,
                         Data->IoStatus.Information) );
 
-            FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                       p2pCtx->SwappedBuffer,
-                                       BUFFER_SWAP_TAG );
+            SwapFreeBuffer( FltObjects->Instance,
+                            p2pCtx->VolCtx,
+                            p2pCtx->SwappedBuffer,
+                            p2pCtx->ArenaBuffer,
+                            TRUE );
 
             FltReleaseContext( p2pCtx->VolCtx );
 
@@ -1236,8 +2438,9 @@ SwapPostReadBuffersWhenSafe (
 
 Routine Description:
 
-    We had an arbitrary users buffer without a MDL so we needed to get
-    to a safe IRQL so we could lock it and then copy the data.
+    We had an arbitrary users buffer without a MDL, or data to decode, so
+    we needed to get to a safe IRQL so we could decode the data, lock the
+    users buffer and then copy the data.
 
 Arguments:
 
@@ -1267,8 +2470,26 @@ Return Value:
     FLT_ASSERT(Data->IoStatus.Information != 0);
 
     //
-    //  This is some sort of user buffer without a MDL, lock the user buffer
-    //  so we can access it.  This will create a MDL for it.
+    //  Decode the data in our buffer before it goes anywhere.  The file
+    //  system read whole sectors, so decode all of the sectors the data
+    //  landed in.
+    //
+
+    if (p2pCtx->Transformed) {
+
+        SwapTransformBuffer( p2pCtx->VolCtx,
+                             FALSE,
+                             iopb->Parameters.Read.ByteOffset.QuadPart,
+                             p2pCtx->SwappedBuffer,
+                             p2pCtx->SwappedBuffer,
+                             (ULONG)ROUND_TO_SIZE(Data->IoStatus.Information,p2pCtx->VolCtx->SectorSize),
+                             !FlagOn(iopb->IrpFlags,IRP_PAGING_IO) );
+    }
+
+    //
+    //  If this is some sort of user buffer without a MDL, lock the user
+    //  buffer so we can access it.  This will create a MDL for it.  If
+    //  there already is a MDL this does nothing.
     //
 
     status = FltLockUserBuffer( Data );
@@ -1335,9 +2556,11 @@ Return Value:
                 p2pCtx->SwappedBuffer,
                 Data->IoStatus.Information) );
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->VolCtx,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->ArenaBuffer,
+                    TRUE );
 
     FltReleaseContext( p2pCtx->VolCtx );
 
@@ -1389,6 +2612,7 @@ Return Value:
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
+    PSWAP_ARENA_BUFFER arenaBuf = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
     NTSTATUS status;
@@ -1428,9 +2652,11 @@ Return Value:
         //  operation.
         //
 
-        newBuf = ExAllocatePoolWithTag( NonPagedPool,
-                                        iopb->Parameters.DirectoryControl.QueryDirectory.Length,
-                                        BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     volCtx,
+                                     iopb->Parameters.DirectoryControl.QueryDirectory.Length,
+                                     FALSE,
+                                     &arenaBuf );
 
         if (newBuf == NULL) {
 
@@ -1460,11 +2686,9 @@ Return Value:
         //  the MDL allocation then we won't swap buffer for this operation
         //
 
-        newMdl = IoAllocateMdl( newBuf,
-                                iopb->Parameters.DirectoryControl.QueryDirectory.Length,
-                                FALSE,
-                                FALSE,
-                                NULL );
+        newMdl = SwapAllocateMdl( newBuf,
+                                  iopb->Parameters.DirectoryControl.QueryDirectory.Length,
+                                  arenaBuf );
 
         if (newMdl == NULL) {
 
@@ -1475,12 +2699,6 @@ Return Value:
            leave;
         }
 
-        //
-        //  setup the MDL for the non-paged pool we just allocated
-        //
-
-        MmBuildMdlForNonPagedPool( newMdl );
-
         //
         //  We are ready to swap buffers, get a pre2Post context structure.
         //  We need it to pass the volume context and the allocate memory
@@ -1524,6 +2742,8 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->ArenaBuffer = arenaBuf;
+        p2pCtx->Transformed = FALSE;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
@@ -1544,7 +2764,11 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                ExFreePool( newBuf );
+                SwapFreeBuffer( FltObjects->Instance,
+                                volCtx,
+                                newBuf,
+                                arenaBuf,
+                                FALSE );
             }
 
             if (newMdl != NULL) {
@@ -1772,7 +2996,11 @@ Return Value:
                         p2pCtx->SwappedBuffer,
                         Data->IoStatus.Information) );
 
-            ExFreePool( p2pCtx->SwappedBuffer );
+            SwapFreeBuffer( FltObjects->Instance,
+                            p2pCtx->VolCtx,
+                            p2pCtx->SwappedBuffer,
+                            p2pCtx->ArenaBuffer,
+                            FALSE );
             FltReleaseContext( p2pCtx->VolCtx );
 
             ExFreeToNPagedLookasideList( &Pre2PostContextList,
@@ -1897,7 +3125,11 @@ Return Value:
                 p2pCtx->SwappedBuffer,
                 Data->IoStatus.Information) );
 
-    ExFreePool( p2pCtx->SwappedBuffer );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->VolCtx,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->ArenaBuffer,
+                    FALSE );
     FltReleaseContext( p2pCtx->VolCtx );
 
     ExFreeToNPagedLookasideList( &Pre2PostContextList,
@@ -1943,11 +3175,13 @@ Return Value:
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
+    PSWAP_ARENA_BUFFER arenaBuf = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
     PVOID origBuf;
     NTSTATUS status;
     ULONG writeLen = iopb->Parameters.Write.Length;
+    BOOLEAN transform = FALSE;
 
     try {
 
@@ -1991,6 +3225,29 @@ Return Value:
             writeLen = (ULONG)ROUND_TO_SIZE(writeLen,volCtx->SectorSize);
         }
 
+        //
+        //  See if the data we write has to be encoded.
+        //
+
+        status = SwapShouldTransform( Data,
+                                      FltObjects,
+                                      volCtx,
+                                      &iopb->Parameters.Write.ByteOffset,
+                                      &transform );
+
+        if (!NT_SUCCESS(status)) {
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPreWriteBuffers:            %wZ Unaligned write to a transformed stream, status=%x\n",
+                        &volCtx->Name,
+                        status) );
+
+            Data->IoStatus.Status = status;
+            Data->IoStatus.Information = 0;
+            retValue = FLT_PREOP_COMPLETE;
+            leave;
+        }
+
         //
         //  Allocate aligned nonPaged memory for the buffer we are swapping
         //  to. This is really only necessary for noncached IO but we always
@@ -1998,10 +3255,11 @@ Return Value:
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance, 
-                                                NonPagedPool,
-                                                (SIZE_T) writeLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     volCtx,
+                                     writeLen,
+                                     TRUE,
+                                     &arenaBuf );
 
         if (newBuf == NULL) {
 
@@ -2027,11 +3285,9 @@ Return Value:
             //  the MDL allocation then we won't swap buffer for this operation
             //
 
-            newMdl = IoAllocateMdl( newBuf,
-                                    writeLen,
-                                    FALSE,
-                                    FALSE,
-                                    NULL );
+            newMdl = SwapAllocateMdl( newBuf,
+                                      writeLen,
+                                      arenaBuf );
 
             if (newMdl == NULL) {
 
@@ -2041,12 +3297,6 @@ Return Value:
 
                 leave;
             }
-
-            //
-            //  setup the MDL for the non-paged pool we just allocated
-            //
-
-            MmBuildMdlForNonPagedPool( newMdl );
         }
 
         //
@@ -2122,6 +3372,22 @@ Return Value:
             leave;
         }
 
+        //
+        //  Encode the data in our buffer.  It is nonPaged so this can be
+        //  done from any thread, unlike the copy above.
+        //
+
+        if (transform) {
+
+            SwapTransformBuffer( volCtx,
+                                 TRUE,
+                                 iopb->Parameters.Write.ByteOffset.QuadPart,
+                                 newBuf,
+                                 newBuf,
+                                 writeLen,
+                                 !FlagOn(iopb->IrpFlags,IRP_PAGING_IO) );
+        }
+
         //
         //  We are ready to swap buffers, get a pre2Post context structure.
         //  We need it to pass the volume context and the allocate memory
@@ -2161,6 +3427,8 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->ArenaBuffer = arenaBuf;
+        p2pCtx->Transformed = transform;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
@@ -2182,9 +3450,11 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
+                SwapFreeBuffer( FltObjects->Instance,
+                                volCtx,
+                                newBuf,
+                                arenaBuf,
+                                TRUE );
 
             }
 
@@ -2238,9 +3508,11 @@ Return Value:
     //  Free allocate POOL and volume context
     //
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->VolCtx,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->ArenaBuffer,
+                    TRUE );
 
     FltReleaseContext( p2pCtx->VolCtx );
 
@@ -2278,33 +3550,34 @@ Return Value:
     NTSTATUS status;
     ULONG resultLength;
     UNICODE_STRING valueName;
-    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( LONG )];
+    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + SWAP_TRANSFORM_KEY_SIZE];
+    PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
 
     //
-    //  If this value is not zero then somebody has already explicitly set it
-    //  so don't override those settings.
+    //  Open the desired registry key
     //
 
-    if (0 == LoggingFlags) {
+    InitializeObjectAttributes( &attributes,
+                                RegistryPath,
+                                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                NULL,
+                                NULL );
 
-        //
-        //  Open the desired registry key
-        //
+    status = ZwOpenKey( &driverRegKey,
+                        KEY_READ,
+                        &attributes );
 
-        InitializeObjectAttributes( &attributes,
-                                    RegistryPath,
-                                    OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
-                                    NULL,
-                                    NULL );
+    if (!NT_SUCCESS( status )) {
 
-        status = ZwOpenKey( &driverRegKey,
-                            KEY_READ,
-                            &attributes );
+        return;
+    }
 
-        if (!NT_SUCCESS( status )) {
+    //
+    //  If this value is not zero then somebody has already explicitly set it
+    //  so don't override those settings.
+    //
 
-            return;
-        }
+    if (0 == LoggingFlags) {
 
         //
         // Read the given value from the registry.
@@ -2323,12 +3596,52 @@ Return Value:
 
             LoggingFlags = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
         }
+    }
 
-        //
-        //  Close the registry entry
-        //
+    //
+    //  Read the transform to apply and its key.  A transform we don't know
+    //  about leaves the data alone.  A missing key is all zeroes.
+    //
+
+    RtlInitUnicodeString( &valueName, L"Transform" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status ) &&
+        (value->Type == REG_DWORD) &&
+        (*((PULONG) &value->Data) <= SWAP_TRANSFORM_MAX)) {
+
+        TransformType = *((PULONG) &value->Data);
+    }
 
-        ZwClose(driverRegKey);
+    RtlInitUnicodeString( &valueName, L"TransformKey" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status ) &&
+        (value->Type == REG_BINARY)) {
+
+        RtlCopyMemory( TransformKey,
+                       value->Data,
+                       min( value->DataLength, SWAP_TRANSFORM_KEY_SIZE ));
     }
+
+    RtlSecureZeroMemory( buffer, sizeof(buffer) );
+
+    //
+    //  Close the registry entry
+    //
+
+    ZwClose(driverRegKey);
 }
 
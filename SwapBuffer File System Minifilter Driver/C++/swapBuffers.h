@@ -0,0 +1,393 @@
+/*++
+
+Copyright (c) 1999 - 2002  Microsoft Corporation
+
+Module Name:
+
+    SwapBuffers.h
+
+Abstract:
+
+    Structures, constants and prototypes shared by SwapBuffers.c, the
+    filter and its swap buffer arena, and SwapTransform.c, the transforms
+    it runs the data of non-cached I/O through.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#ifndef __SWAPBUFFERS_H__
+#define __SWAPBUFFERS_H__
+
+/*************************************************************************
+    Pool Tags
+*************************************************************************/
+
+#define BUFFER_SWAP_TAG     'bdBS'
+#define CONTEXT_TAG         'xcBS'
+#define NAME_TAG            'mnBS'
+#define PRE_2_POST_TAG      'ppBS'
+#define ARENA_TAG           'raBS'
+#define STREAM_CONTEXT_TAG  'csBS'
+
+/*************************************************************************
+    Local structures
+*************************************************************************/
+
+//
+//  Swap buffers are handed out from a per-volume arena instead of being
+//  allocated from pool on every operation.  Arena buffers come in power of
+//  two size classes starting at a page, so they are page aligned and thus
+//  sector aligned on any volume whose sector size is no larger than a page.
+//  Each one carries a MDL describing it which is built once, when the
+//  buffer is created.
+//
+//  A freed buffer goes to a small cache for the current processor, or to
+//  the shared depot for its size class when that cache is full.  The arena
+//  grows whenever both are empty.  A periodic timer gives back buffers
+//  that sat in the depot, or in the cache of an idle processor, for a
+//  whole trim period.  Requests larger than the biggest size class still
+//  go straight to pool.
+//
+
+#define SWAP_ARENA_CLASSES              7       // PAGE_SIZE to 64 * PAGE_SIZE
+#define SWAP_ARENA_CPU_CACHE_DEPTH      4
+#define SWAP_ARENA_TRIM_PERIOD          5000    // milliseconds
+#define SWAP_ARENA_TRIM_BATCH           32
+
+typedef struct _SWAP_ARENA_BUFFER {
+
+    //
+    //  Links the buffer into the depot for its size class.
+    //
+
+    SLIST_ENTRY ListEntry;
+
+    PVOID Buffer;
+
+    //
+    //  Describes the whole buffer.  The MDL for an operation is built as a
+    //  partial MDL of this one.
+    //
+
+    PMDL Mdl;
+
+    ULONG SizeClass;
+
+} SWAP_ARENA_BUFFER, *PSWAP_ARENA_BUFFER;
+
+typedef struct DECLSPEC_CACHEALIGN _SWAP_ARENA_CPU_CACHE {
+
+    //
+    //  Only ever taken by the processor owning the cache, except when the
+    //  trim timer drains an idle one.
+    //
+
+    KSPIN_LOCK Lock;
+
+    //
+    //  Set on every use and cleared by the trim timer.
+    //
+
+    BOOLEAN Active;
+
+    ULONG Count[SWAP_ARENA_CLASSES];
+
+    PSWAP_ARENA_BUFFER Buffers[SWAP_ARENA_CLASSES][SWAP_ARENA_CPU_CACHE_DEPTH];
+
+} SWAP_ARENA_CPU_CACHE, *PSWAP_ARENA_CPU_CACHE;
+
+typedef struct _SWAP_ARENA_CLASS {
+
+    SLIST_HEADER Depot;
+
+    //
+    //  Lowest depth of the depot since the last trim.  That many buffers
+    //  went unused for the whole period.
+    //
+
+    volatile LONG LowWater;
+
+} SWAP_ARENA_CLASS, *PSWAP_ARENA_CLASS;
+
+typedef struct _SWAP_ARENA {
+
+    SWAP_ARENA_CLASS Classes[SWAP_ARENA_CLASSES];
+
+    KTIMER TrimTimer;
+
+    KDPC TrimDpc;
+
+    ULONG ProcessorCount;
+
+    //
+    //  One cache per processor, indexed by processor number.
+    //
+
+    SWAP_ARENA_CPU_CACHE CpuCaches[ANYSIZE_ARRAY];
+
+} SWAP_ARENA, *PSWAP_ARENA;
+
+//
+//  A transform is applied to the data as it moves between the users buffer
+//  and our swapped buffer: encoded on the way to the disk and decoded on
+//  the way back.  It works on whole sectors and each sector is tweaked
+//  with its number on the volume file, so a transform must be able to
+//  handle a run of sectors starting anywhere.  The source and destination
+//  may be the same buffer.
+//
+//  Only non-cached I/O is transformed, so data in the cache stays in the
+//  clear and is transformed exactly once on its way to and from the disk.
+//
+//  Whether a stream is transformed at all is decided once, when it is
+//  first opened, and kept in its stream context.  Every non-cached read and
+//  write of the stream, whichever file object it comes in on, follows that
+//  decision.  Deciding on each I/O from the file object it arrives on
+//  doesn't work: the file systems and the cache manager issue paging I/O
+//  for user files on stream file objects which have no name.
+//
+
+#define SWAP_TRANSFORM_KEY_SIZE         32
+
+typedef
+VOID
+SWAP_TRANSFORM_ROUTINE (
+    _In_reads_bytes_(SWAP_TRANSFORM_KEY_SIZE) PUCHAR Key,
+    _In_ ULONGLONG FirstSector,
+    _In_ ULONG SectorSize,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ ULONG Length
+    );
+
+typedef SWAP_TRANSFORM_ROUTINE *PSWAP_TRANSFORM_ROUTINE;
+
+typedef struct _SWAP_TRANSFORM {
+
+    PCSTR Name;
+
+    PSWAP_TRANSFORM_ROUTINE Encode;
+
+    PSWAP_TRANSFORM_ROUTINE Decode;
+
+} SWAP_TRANSFORM, *PSWAP_TRANSFORM;
+
+typedef const SWAP_TRANSFORM *PCSWAP_TRANSFORM;
+
+//
+//  Values of the "Transform" registry value.
+//
+
+#define SWAP_TRANSFORM_NONE             0
+#define SWAP_TRANSFORM_XOR              1
+#define SWAP_TRANSFORM_CHACHA20         2
+#define SWAP_TRANSFORM_MAX              SWAP_TRANSFORM_CHACHA20
+
+//
+//  Transforms of more than SWAP_TRANSFORM_SPLIT_THRESHOLD bytes are split
+//  in chunks of at least SWAP_TRANSFORM_CHUNK_SIZE bytes which are run on
+//  worker threads in parallel.
+//
+
+#define SWAP_TRANSFORM_SPLIT_THRESHOLD  0x40000
+#define SWAP_TRANSFORM_CHUNK_SIZE       0x20000
+#define SWAP_TRANSFORM_MAX_CHUNKS       8
+
+typedef struct _SWAP_TRANSFORM_CHUNK {
+
+    PFLT_GENERIC_WORKITEM WorkItem;
+
+    PSWAP_TRANSFORM_ROUTINE Routine;
+
+    PUCHAR Key;
+
+    ULONGLONG FirstSector;
+
+    ULONG SectorSize;
+
+    PUCHAR Source;
+
+    PUCHAR Destination;
+
+    ULONG Length;
+
+    //
+    //  Shared by all the chunks of a transform, the last one to finish
+    //  sets the event.
+    //
+
+    volatile LONG *Outstanding;
+
+    PKEVENT Done;
+
+} SWAP_TRANSFORM_CHUNK, *PSWAP_TRANSFORM_CHUNK;
+
+//
+//  This is a volume context, one of these are attached to each volume
+//  we monitor.  This is used to get a "DOS" name for debug display.
+//
+
+typedef struct _VOLUME_CONTEXT {
+
+    //
+    //  Holds the name to display
+    //
+
+    UNICODE_STRING Name;
+
+    //
+    //  Holds the sector size for this volume.
+    //
+
+    ULONG SectorSize;
+
+    //
+    //  Arena swap buffers are allocated from, NULL if this volume's sectors
+    //  are larger than a page.
+    //
+
+    PSWAP_ARENA Arena;
+
+    //
+    //  Transform applied to non-cached I/O on this volume and its key.
+    //  NULL if the data is just copied.
+    //
+
+    PCSWAP_TRANSFORM Transform;
+
+    UCHAR TransformKey[SWAP_TRANSFORM_KEY_SIZE];
+
+} VOLUME_CONTEXT, *PVOLUME_CONTEXT;
+
+//
+//  This is a stream context, one of these is attached to each stream opened
+//  on a volume with a transform.
+//
+
+typedef struct _STREAM_CONTEXT {
+
+    //
+    //  Set if non-cached I/O to this stream is transformed.
+    //
+
+    BOOLEAN Transform;
+
+} STREAM_CONTEXT, *PSTREAM_CONTEXT;
+
+#define MIN_SECTOR_SIZE 0x200
+
+
+//
+//  This is a context structure that is used to pass state from our
+//  pre-operation callback to our post-operation callback.
+//
+
+typedef struct _PRE_2_POST_CONTEXT {
+
+    //
+    //  Pointer to our volume context structure.  We always get the context
+    //  in the preOperation path because you can not safely get it at DPC
+    //  level.  We then release it in the postOperation path.  It is safe
+    //  to release contexts at DPC level.
+    //
+
+    PVOLUME_CONTEXT VolCtx;
+
+    //
+    //  Since the post-operation parameters always receive the "original"
+    //  parameters passed to the operation, we need to pass our new destination
+    //  buffer to our post operation routine so we can free it.
+    //
+
+    PVOID SwappedBuffer;
+
+    //
+    //  The arena buffer backing SwappedBuffer, NULL if it came from pool.
+    //
+
+    PSWAP_ARENA_BUFFER ArenaBuffer;
+
+    //
+    //  Set if the swapped buffer holds transformed data which has to be
+    //  decoded before it is copied back.
+    //
+
+    BOOLEAN Transformed;
+
+} PRE_2_POST_CONTEXT, *PPRE_2_POST_CONTEXT;
+
+/*************************************************************************
+    Buffer arena routines
+*************************************************************************/
+
+NTSTATUS
+SwapCreateArena (
+    _Outptr_ PSWAP_ARENA *Arena
+    );
+
+VOID
+SwapDeleteArena (
+    _In_ PSWAP_ARENA Arena
+    );
+
+PSWAP_ARENA_BUFFER
+SwapCreateArenaBuffer (
+    _In_ ULONG SizeClass
+    );
+
+VOID
+SwapDeleteArenaBuffer (
+    _In_ PSWAP_ARENA_BUFFER ArenaBuffer
+    );
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ ULONG Length,
+    _In_ BOOLEAN Aligned,
+    _Out_ PSWAP_ARENA_BUFFER *ArenaBuffer
+    );
+
+PMDL
+SwapAllocateMdl (
+    _In_ PVOID Buffer,
+    _In_ ULONG Length,
+    _In_opt_ PSWAP_ARENA_BUFFER ArenaBuffer
+    );
+
+VOID
+SwapFreeBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PVOID Buffer,
+    _In_opt_ PSWAP_ARENA_BUFFER ArenaBuffer,
+    _In_ BOOLEAN Aligned
+    );
+
+KDEFERRED_ROUTINE SwapTrimArena;
+
+/*************************************************************************
+    Transform routines, in SwapTransform.c
+*************************************************************************/
+
+ULONG
+SwapCarveTransform (
+    _In_ PSWAP_TRANSFORM_ROUTINE Routine,
+    _In_reads_bytes_(SWAP_TRANSFORM_KEY_SIZE) PUCHAR Key,
+    _In_ LONGLONG ByteOffset,
+    _In_ ULONG SectorSize,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ ULONG Length,
+    _In_ ULONG ProcessorCount,
+    _Out_writes_(SWAP_TRANSFORM_MAX_CHUNKS) PSWAP_TRANSFORM_CHUNK Chunks
+    );
+
+SWAP_TRANSFORM_ROUTINE SwapXorTransform;
+
+SWAP_TRANSFORM_ROUTINE SwapChaCha20Transform;
+
+#endif // __SWAPBUFFERS_H__
@@ -0,0 +1,333 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    SwapTransform.c
+
+Abstract:
+
+    The transforms the SwapBuffers filter can run the data of non-cached
+    reads and writes through, and the way SwapTransformBuffer carves a
+    large run up so that it can be transformed on several processors at
+    once.
+
+    Nothing in here calls into FltMgr or waits, so the routines can be
+    built and measured on their own.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include <fltKernel.h>
+#include <dontuse.h>
+#include <suppress.h>
+#include "swapBuffers.h"
+
+#if defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+
+
+ULONG
+SwapCarveTransform (
+    _In_ PSWAP_TRANSFORM_ROUTINE Routine,
+    _In_reads_bytes_(SWAP_TRANSFORM_KEY_SIZE) PUCHAR Key,
+    _In_ LONGLONG ByteOffset,
+    _In_ ULONG SectorSize,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ ULONG Length,
+    _In_ ULONG ProcessorCount,
+    _Out_writes_(SWAP_TRANSFORM_MAX_CHUNKS) PSWAP_TRANSFORM_CHUNK Chunks
+    )
+/*++
+
+Routine Description:
+
+    This routine carves a sector aligned run of data up into the chunks it
+    is transformed in.  A run of more than SWAP_TRANSFORM_SPLIT_THRESHOLD
+    bytes gets a chunk for each processor, up to SWAP_TRANSFORM_MAX_CHUNKS,
+    as long as each gets at least SWAP_TRANSFORM_CHUNK_SIZE bytes.  Anything
+    else is transformed as one chunk.
+
+    The chunks are left without a work item, and the caller fills in how
+    they report back.
+
+Arguments:
+
+    Routine - The transform to run over the chunks.
+
+    Key - The transform key.
+
+    ByteOffset - File offset the data lives at.
+
+    SectorSize - Size of a sector.
+
+    Source - The data to transform.
+
+    Destination - Receives the transformed data, may be Source.
+
+    Length - Number of bytes to transform, a multiple of SectorSize.
+
+    ProcessorCount - Number of processors the run may be split across, one
+        if it must not be split.
+
+    Chunks - Receives the chunks.
+
+Return Value:
+
+    The number of chunks.
+
+--*/
+{
+    ULONG chunkCount = 1;
+    ULONG chunkLength = Length;
+    ULONG offset;
+    ULONG i;
+
+    FLT_ASSERT((Length % SectorSize) == 0);
+
+    if ((ProcessorCount > 1) && (Length > SWAP_TRANSFORM_SPLIT_THRESHOLD)) {
+
+        chunkCount = min( Length / SWAP_TRANSFORM_CHUNK_SIZE, ProcessorCount );
+
+        chunkCount = min( chunkCount, SWAP_TRANSFORM_MAX_CHUNKS );
+
+        if (chunkCount > 1) {
+
+            chunkLength = (ULONG)ROUND_TO_SIZE(Length / chunkCount,SectorSize);
+
+        } else {
+
+            chunkCount = 1;
+        }
+    }
+
+    //
+    //  Rounding the chunks up to a sector may leave the last ones short,
+    //  or even empty.
+    //
+
+    for (i = 0, offset = 0; i < chunkCount; i++, offset += chunkLength) {
+
+        Chunks[i].WorkItem = NULL;
+        Chunks[i].Routine = Routine;
+        Chunks[i].Key = Key;
+        Chunks[i].FirstSector = (ULONGLONG)(ByteOffset + offset) / SectorSize;
+        Chunks[i].SectorSize = SectorSize;
+        Chunks[i].Source = Source + offset;
+        Chunks[i].Destination = Destination + offset;
+        Chunks[i].Length = (offset < Length) ? min( chunkLength, Length - offset ) : 0;
+        Chunks[i].Outstanding = NULL;
+        Chunks[i].Done = NULL;
+    }
+
+    return chunkCount;
+}
+
+
+VOID
+SwapXorTransform (
+    _In_reads_bytes_(SWAP_TRANSFORM_KEY_SIZE) PUCHAR Key,
+    _In_ ULONGLONG FirstSector,
+    _In_ ULONG SectorSize,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    This transform XORs every 16 bytes of a sector with the first 16
+    bytes of the key, the low 8 bytes of which are first XORed with the
+    sector number.  It obscures the data rather than protecting it, but
+    it is about as cheap as a transform gets, which makes it useful to
+    measure the cost of the transform plumbing itself.  On x64 it is done
+    with SSE2, 64 bytes at a time.
+
+Arguments:
+
+    Key - The transform key.
+
+    FirstSector - Number of the first sector in the run.
+
+    SectorSize - Size of a sector, a multiple of 64 bytes.
+
+    Source - The data to transform.
+
+    Destination - Receives the transformed data, may be Source.
+
+    Length - Number of bytes to transform, a multiple of SectorSize.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONGLONG sector = FirstSector;
+    ULONG offset;
+    ULONG i;
+
+#if defined(_M_AMD64)
+
+    __m128i key = _mm_loadu_si128( (__m128i *) Key );
+    __m128i pad;
+
+    for (offset = 0; offset < Length; offset += SectorSize, sector++) {
+
+        pad = _mm_xor_si128( key, _mm_cvtsi64_si128( (LONGLONG) sector ));
+
+        for (i = offset; i < offset + SectorSize; i += 64) {
+
+            _mm_storeu_si128( (__m128i *) (Destination + i),
+                              _mm_xor_si128( _mm_loadu_si128( (__m128i *) (Source + i) ), pad ));
+            _mm_storeu_si128( (__m128i *) (Destination + i + 16),
+                              _mm_xor_si128( _mm_loadu_si128( (__m128i *) (Source + i + 16) ), pad ));
+            _mm_storeu_si128( (__m128i *) (Destination + i + 32),
+                              _mm_xor_si128( _mm_loadu_si128( (__m128i *) (Source + i + 32) ), pad ));
+            _mm_storeu_si128( (__m128i *) (Destination + i + 48),
+                              _mm_xor_si128( _mm_loadu_si128( (__m128i *) (Source + i + 48) ), pad ));
+        }
+    }
+
+#else
+
+    //
+    //  Using the vector registers would mean saving the floating point
+    //  state on this architecture, so just do 8 bytes at a time.
+    //
+
+    ULONGLONG pad0;
+    ULONGLONG pad1 = *(ULONGLONG UNALIGNED *) (Key + 8);
+
+    for (offset = 0; offset < Length; offset += SectorSize, sector++) {
+
+        pad0 = *(ULONGLONG UNALIGNED *) Key ^ sector;
+
+        for (i = offset; i < offset + SectorSize; i += 16) {
+
+            *(ULONGLONG UNALIGNED *) (Destination + i) =
+                *(ULONGLONG UNALIGNED *) (Source + i) ^ pad0;
+            *(ULONGLONG UNALIGNED *) (Destination + i + 8) =
+                *(ULONGLONG UNALIGNED *) (Source + i + 8) ^ pad1;
+        }
+    }
+
+#endif
+}
+
+
+//
+//  One ChaCha20 quarter round.
+//
+
+#define CHACHA_QUARTER_ROUND( _a, _b, _c, _d )                      \
+    _a += _b; _d ^= _a; _d = _rotl( _d, 16 );                       \
+    _c += _d; _b ^= _c; _b = _rotl( _b, 12 );                       \
+    _a += _b; _d ^= _a; _d = _rotl( _d, 8 );                        \
+    _c += _d; _b ^= _c; _b = _rotl( _b, 7 );
+
+VOID
+SwapChaCha20Transform (
+    _In_reads_bytes_(SWAP_TRANSFORM_KEY_SIZE) PUCHAR Key,
+    _In_ ULONGLONG FirstSector,
+    _In_ ULONG SectorSize,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    This transform XORs each sector with a ChaCha20 (RFC 7539) key stream,
+    using the sector number as the nonce and counting blocks from zero
+    within the sector.
+
+    This is a reference for what a real cipher costs in this path, not
+    an at rest encryption scheme.  A stream cipher keyed per sector hands
+    out the same key stream every time a sector is rewritten and does
+    nothing to detect tampering.
+
+Arguments:
+
+    Key - The 256 bit ChaCha20 key.
+
+    FirstSector - Number of the first sector in the run.
+
+    SectorSize - Size of a sector, a multiple of 64 bytes.
+
+    Source - The data to transform.
+
+    Destination - Receives the transformed data, may be Source.
+
+    Length - Number of bytes to transform, a multiple of SectorSize.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG state[16];
+    ULONG x[16];
+    ULONGLONG sector = FirstSector;
+    ULONG offset;
+    ULONG block;
+    ULONG round;
+    ULONG i;
+
+    //
+    //  "expand 32-byte k", followed by the key.
+    //
+
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+
+    RtlCopyMemory( &state[4], Key, SWAP_TRANSFORM_KEY_SIZE );
+
+    for (offset = 0; offset < Length; offset += SectorSize, sector++) {
+
+        state[12] = 0;
+        state[13] = 0;
+        state[14] = (ULONG) sector;
+        state[15] = (ULONG) (sector >> 32);
+
+        for (block = offset; block < offset + SectorSize; block += 64) {
+
+            RtlCopyMemory( x, state, sizeof( x ));
+
+            for (round = 0; round < 10; round++) {
+
+                CHACHA_QUARTER_ROUND( x[0], x[4], x[8], x[12] );
+                CHACHA_QUARTER_ROUND( x[1], x[5], x[9], x[13] );
+                CHACHA_QUARTER_ROUND( x[2], x[6], x[10], x[14] );
+                CHACHA_QUARTER_ROUND( x[3], x[7], x[11], x[15] );
+
+                CHACHA_QUARTER_ROUND( x[0], x[5], x[10], x[15] );
+                CHACHA_QUARTER_ROUND( x[1], x[6], x[11], x[12] );
+                CHACHA_QUARTER_ROUND( x[2], x[7], x[8], x[13] );
+                CHACHA_QUARTER_ROUND( x[3], x[4], x[9], x[14] );
+            }
+
+            for (i = 0; i < 16; i++) {
+
+                ((ULONG UNALIGNED *) (Destination + block))[i] =
+                    ((ULONG UNALIGNED *) (Source + block))[i] ^ (x[i] + state[i]);
+            }
+
+            state[12] += 1;
+        }
+    }
+
+    RtlSecureZeroMemory( state, sizeof( state ));
+    RtlSecureZeroMemory( x, sizeof( x ));
+}
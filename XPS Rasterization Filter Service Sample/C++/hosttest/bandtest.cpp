@@ -0,0 +1,348 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+//
+// File Name:
+//
+//    bandtest.cpp
+//
+// Abstract:
+//
+//    Host test and benchmark of the band pipeline. ../src/BandPipeline.cpp
+//    is built unchanged against the stand-ins in shim/precomp.h, with a
+//    fake TIFF handler whose encode step burns a set amount of CPU.
+//
+//    usage: bandtest --selftest
+//           bandtest [--bands n] [--raster-us us] [--encode-us us] [processors...]
+//
+//    The self test checks, for 1 to 8 processors in both apartments, that
+//    bands are written in submission order, every band bitmap is released,
+//    no more bands are encoded at once than there are encode threads, and
+//    that a failed encode, a failed COM initialization or a failed thread
+//    creation fails the page with the bands before it written and without
+//    hanging.
+//
+//    The benchmark times pages of bands in the multi-threaded apartment
+//    for each processor count and reports bands per second against
+//    encoding every band on the rasterizing thread (1 processor).
+//
+// Environment:
+//
+//    Host (user mode), C++11 with pthreads.
+//
+
+#include "precomp.h"
+#include "BandPipeline.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace xpsrasfilter;
+
+HostConfig g_host;
+
+static int g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if (!(X))                                                               \
+    {                                                                       \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+struct PageResult
+{
+    HRESULT             hr;
+    std::vector<int>    written;
+    int                 maxInEncode;
+    int                 unreleased;
+    BandTimings         timings;
+};
+
+//
+// Rasterize and submit numBands bands to a new pipeline, as
+// RasterizePage does, and flush it
+//
+static PageResult
+RunPage(
+    int         numBands,
+    int         failBand,
+    ULONGLONG   rasterNs,
+    ULONGLONG   encodeNs,
+    ULONGLONG   encodeJitterNs
+    )
+{
+    TiffStreamBitmapHandler handler;
+    std::vector<HostBitmap> bitmaps(numBands);
+    PageResult result;
+
+    handler.failBand = failBand;
+    handler.encodeNs = encodeNs;
+    handler.encodeJitterNs = encodeJitterNs;
+
+    //
+    // The pipeline holds a reference to a band from when
+    // it is submitted until it is written or discarded
+    //
+    for (int i = 0; i < numBands; i++)
+    {
+        bitmaps[i].band = i;
+        bitmaps[i].refs = 0;
+    }
+
+    memset(&result.timings, 0, sizeof(result.timings));
+    result.hr = S_OK;
+
+    try
+    {
+        BandPipeline_t pPipeline = BandPipeline::CreateBandPipeline(&handler, &result.timings);
+
+        for (int i = 0; i < numBands; i++)
+        {
+            HostSpin(rasterNs);
+
+            pPipeline->SubmitBand(IWICBitmap_t(&bitmaps[i]));
+        }
+
+        pPipeline->Flush();
+    }
+    catch (hr_error const &e)
+    {
+        result.hr = e.hr;
+    }
+
+    result.written = handler.written;
+    result.maxInEncode = handler.maxInEncode;
+    result.unreleased = 0;
+
+    for (int i = 0; i < numBands; i++)
+    {
+        result.unreleased += bitmaps[i].refs;
+    }
+
+    return result;
+}
+
+static BOOL
+WrittenInOrder(
+    const std::vector<int> &written,
+    int                     count
+    )
+{
+    if (static_cast<int>(written.size()) != count)
+    {
+        return FALSE;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (written[i] != i)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static int
+SelfTest()
+{
+    uint32_t seed = 1;
+
+    for (DWORD cpus = 1; cpus <= 8; cpus++)
+    {
+        for (int mta = 0; mta < 2; mta++)
+        {
+            g_host.numberOfProcessors = cpus;
+            g_host.apartmentIsMTA = (mta != 0);
+
+            int encodeThreads = (mta && cpus > 1) ?
+                                    min(static_cast<int>(cpus) - 1,
+                                        static_cast<int>(BandPipeline::ms_maxEncodeThreads)) :
+                                    1;
+
+            for (int iteration = 0; iteration < 20; iteration++)
+            {
+                seed = seed * 1103515245 + 12345;
+
+                int numBands = (seed >> 8) % 40;
+                ULONGLONG jitterNs = (iteration % 2) ? 300000 : 0;
+
+                PageResult result = RunPage(numBands, -1, 0, 0, jitterNs);
+
+                CHECK(result.hr == S_OK);
+                CHECK(WrittenInOrder(result.written, numBands));
+                CHECK(result.unreleased == 0);
+                CHECK(result.timings.numBands == static_cast<ULONGLONG>(numBands));
+                CHECK(result.maxInEncode <= encodeThreads);
+
+                if (numBands > 0)
+                {
+                    seed = seed * 1103515245 + 12345;
+
+                    int failBand = (seed >> 8) % numBands;
+
+                    result = RunPage(numBands, failBand, 0, 0, 200000);
+
+                    CHECK(result.hr == E_FAIL);
+                    CHECK(WrittenInOrder(result.written, failBand));
+                    CHECK(result.unreleased == 0);
+                }
+            }
+        }
+    }
+
+    g_host.numberOfProcessors = 4;
+    g_host.apartmentIsMTA = true;
+
+    //
+    // Every encode thread fails to initialize COM
+    //
+    {
+        g_host.failCoInitCount = 3;
+
+        PageResult result = RunPage(10, -1, 0, 0, 0);
+
+        CHECK(result.hr == E_FAIL);
+        CHECK(result.unreleased == 0);
+
+        g_host.failCoInitCount = 0;
+    }
+
+    //
+    // One of them does; the page may or may not get through
+    // before it is noticed, but it must not hang
+    //
+    {
+        g_host.failCoInitCount = 1;
+
+        PageResult result = RunPage(10, -1, 0, 0, 0);
+
+        CHECK(result.hr == E_FAIL || result.hr == S_OK);
+        CHECK(result.unreleased == 0);
+
+        g_host.failCoInitCount = 0;
+    }
+
+    //
+    // The second encode thread can't be created
+    //
+    {
+        g_host.failCreateThreadAt = 2;
+
+        PageResult result = RunPage(5, -1, 0, 0, 0);
+
+        CHECK(result.hr == E_FAIL);
+        CHECK(result.written.empty());
+
+        g_host.failCreateThreadAt = 0;
+    }
+
+    printf("bandtest self test %s\n", g_failures ? "FAILED" : "passed");
+
+    return g_failures ? 1 : 0;
+}
+
+static void
+Usage()
+{
+    printf("usage: bandtest --selftest\n"
+           "       bandtest [--bands n] [--raster-us us] [--encode-us us] [processors...]\n");
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    int numBands = 200;
+    double rasterUs = 2000;
+    double encodeUs = 3000;
+    std::vector<DWORD> cpuCounts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--selftest") == 0)
+        {
+            return SelfTest();
+        }
+        else if (strcmp(argv[i], "--bands") == 0 && i + 1 < argc)
+        {
+            numBands = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--raster-us") == 0 && i + 1 < argc)
+        {
+            rasterUs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--encode-us") == 0 && i + 1 < argc)
+        {
+            encodeUs = atof(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && atoi(argv[i]) > 0)
+        {
+            cpuCounts.push_back(static_cast<DWORD>(atoi(argv[i])));
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (cpuCounts.empty())
+    {
+        cpuCounts.push_back(1);
+        cpuCounts.push_back(2);
+        cpuCounts.push_back(4);
+        cpuCounts.push_back(8);
+    }
+
+    printf("%d bands, %.0f us to rasterize and %.0f us to encode each\n",
+           numBands, rasterUs, encodeUs);
+    printf("%10s %12s %12s %12s %12s\n",
+           "processors", "bands/s", "speedup", "encode ms", "wait ms");
+
+    g_host.apartmentIsMTA = true;
+
+    double serialSeconds = 0;
+
+    for (size_t i = 0; i < cpuCounts.size(); i++)
+    {
+        g_host.numberOfProcessors = cpuCounts[i];
+
+        ULONGLONG start = QueryTicks();
+        PageResult result = RunPage(numBands,
+                                    -1,
+                                    static_cast<ULONGLONG>(rasterUs * 1000),
+                                    static_cast<ULONGLONG>(encodeUs * 1000),
+                                    0);
+        double seconds = (QueryTicks() - start) / 1e9;
+
+        if (FAILED(result.hr) || !WrittenInOrder(result.written, numBands))
+        {
+            printf("pipeline failed with %d processors\n", static_cast<int>(cpuCounts[i]));
+            return 1;
+        }
+
+        if (serialSeconds == 0)
+        {
+            serialSeconds = seconds;
+        }
+
+        printf("%10d %12.1f %11.2fx %12.1f %12.1f\n",
+               static_cast<int>(cpuCounts[i]),
+               numBands / seconds,
+               serialSeconds / seconds,
+               result.timings.encodeTicks / 1e6,
+               result.timings.waitTicks / 1e6);
+    }
+
+    return 0;
+}
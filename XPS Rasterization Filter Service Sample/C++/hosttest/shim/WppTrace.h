@@ -0,0 +1,3 @@
+//
+// Host stand-in; see precomp.h
+//
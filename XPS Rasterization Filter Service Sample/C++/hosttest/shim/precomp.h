@@ -0,0 +1,393 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+//
+// File Name:
+//
+//    precomp.h
+//
+// Abstract:
+//
+//    Host stand-ins for the parts of Win32, COM and the filter that
+//    ../../src/BandPipeline.cpp uses, so that it can be built and
+//    exercised with pthreads. The other headers in this directory are
+//    empty; everything lives here.
+//
+//    The TIFF handler and encoder are fakes that bandtest.cpp controls:
+//    encoding takes a configurable amount of CPU time and can be made to
+//    fail on a given band, and writing records the band number.
+//
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <vector>
+
+typedef unsigned long       ULONG;
+typedef unsigned long long  ULONGLONG;
+typedef int                 BOOL;
+typedef int32_t             HRESULT;
+typedef unsigned long       DWORD;
+typedef void                *LPVOID;
+typedef void                *HANDLE;
+
+#define TRUE            1
+#define FALSE           0
+#define S_OK            ((HRESULT)0)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+#define FAILED(hr)      ((HRESULT)(hr) < 0)
+#define SUCCEEDED(hr)   ((HRESULT)(hr) >= 0)
+#define WINAPI
+#define INFINITE        0xFFFFFFFF
+#define _In_
+#define _Inout_
+
+//
+// windows.h defines min as a macro; std::min would odr-use the
+// BandPipeline constants, which have no out-of-class definition
+//
+#define min(a, b)       (((a) < (b)) ? (a) : (b))
+
+//
+// Knobs for bandtest.cpp
+//
+struct HostConfig
+{
+    bool                apartmentIsMTA;
+    DWORD               numberOfProcessors;
+    int                 failCreateThreadAt;     // fail the Nth CreateThread, 0 for never
+    std::atomic<int>    failCoInitCount;        // fail this many SafeCoInit
+};
+
+extern HostConfig g_host;
+
+//
+// Synchronization
+//
+struct CRITICAL_SECTION { pthread_mutex_t mutex; };
+struct CONDITION_VARIABLE { pthread_cond_t cond; };
+
+inline void InitializeCriticalSection(CRITICAL_SECTION *p) { pthread_mutex_init(&p->mutex, NULL); }
+inline void DeleteCriticalSection(CRITICAL_SECTION *p) { pthread_mutex_destroy(&p->mutex); }
+inline void EnterCriticalSection(CRITICAL_SECTION *p) { pthread_mutex_lock(&p->mutex); }
+inline void LeaveCriticalSection(CRITICAL_SECTION *p) { pthread_mutex_unlock(&p->mutex); }
+
+inline void InitializeConditionVariable(CONDITION_VARIABLE *c) { pthread_cond_init(&c->cond, NULL); }
+inline void WakeConditionVariable(CONDITION_VARIABLE *c) { pthread_cond_signal(&c->cond); }
+inline void WakeAllConditionVariable(CONDITION_VARIABLE *c) { pthread_cond_broadcast(&c->cond); }
+
+inline BOOL
+SleepConditionVariableCS(CONDITION_VARIABLE *c, CRITICAL_SECTION *p, DWORD)
+{
+    pthread_cond_wait(&c->cond, &p->mutex);
+    return TRUE;
+}
+
+//
+// Threads. A HANDLE is a heap allocated pthread_t.
+//
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+
+struct HostThreadStart
+{
+    LPTHREAD_START_ROUTINE  pfn;
+    LPVOID                  pParameter;
+};
+
+inline void*
+HostThreadTrampoline(void *p)
+{
+    HostThreadStart start = *static_cast<HostThreadStart *>(p);
+
+    delete static_cast<HostThreadStart *>(p);
+    start.pfn(start.pParameter);
+
+    return NULL;
+}
+
+inline HANDLE
+CreateThread(void *, size_t, LPTHREAD_START_ROUTINE pfn, LPVOID pParameter, DWORD, DWORD *)
+{
+    if (g_host.failCreateThreadAt != 0 &&
+        --g_host.failCreateThreadAt == 0)
+    {
+        return NULL;
+    }
+
+    pthread_t *pThread = new pthread_t;
+    HostThreadStart *pStart = new HostThreadStart;
+
+    pStart->pfn = pfn;
+    pStart->pParameter = pParameter;
+
+    if (pthread_create(pThread, NULL, HostThreadTrampoline, pStart) != 0)
+    {
+        delete pStart;
+        delete pThread;
+        return NULL;
+    }
+
+    return pThread;
+}
+
+inline DWORD WaitForSingleObject(HANDLE h, DWORD) { pthread_join(*static_cast<pthread_t *>(h), NULL); return 0; }
+inline BOOL CloseHandle(HANDLE h) { delete static_cast<pthread_t *>(h); return TRUE; }
+
+//
+// COM and system information
+//
+enum APTTYPE { APTTYPE_STA = 0, APTTYPE_MTA = 1 };
+typedef int APTTYPEQUALIFIER;
+
+inline HRESULT
+CoGetApartmentType(APTTYPE *pAptType, APTTYPEQUALIFIER *pAptQualifier)
+{
+    *pAptType = g_host.apartmentIsMTA ? APTTYPE_MTA : APTTYPE_STA;
+    *pAptQualifier = 0;
+    return S_OK;
+}
+
+struct SYSTEM_INFO { DWORD dwNumberOfProcessors; };
+
+inline void GetSystemInfo(SYSTEM_INFO *pInfo) { pInfo->dwNumberOfProcessors = g_host.numberOfProcessors; }
+
+//
+// Tracing and exceptions (WppTrace.h, Exception.h)
+//
+#define DoTraceMessage(...)                         ((void)0)
+#define WPP_LOG_ON_FAILED_HRESULT_WITH_TEXT(...)    ((void)0)
+
+namespace xpsrasfilter
+{
+
+struct hr_error
+{
+    HRESULT hr;
+};
+
+inline void ThrowHRException(HRESULT hr) { hr_error e = { hr }; throw e; }
+
+class SafeCoInit
+{
+public:
+    SafeCoInit()
+    {
+        if (g_host.failCoInitCount.fetch_sub(1) > 0)
+        {
+            ThrowHRException(E_FAIL);
+        }
+    }
+};
+
+} // namespace xpsrasfilter
+
+#define THROW_ON_FAILED_HRESULT(func_)                                  \
+{                                                                       \
+    HRESULT hr_ = func_;                                                \
+    if (FAILED(hr_)) { xpsrasfilter::ThrowHRException(hr_); }           \
+}
+
+#define THROW_LAST_ERROR()  THROW_ON_FAILED_HRESULT(E_FAIL)
+
+#define CATCH_VARIOUS(hr_)                  \
+    catch(std::bad_alloc const& )           \
+    {                                       \
+        hr_ = E_OUTOFMEMORY;                \
+    }                                       \
+    catch(xpsrasfilter::hr_error const& e)  \
+    {                                       \
+        hr_ = e.hr;                         \
+    }                                       \
+    catch(...)                              \
+    {                                       \
+        hr_ = E_FAIL;                       \
+    }
+
+//
+// filtertypes.h, BitmapHandler.h and TiffEncoder.h
+//
+inline ULONGLONG
+QueryTicks()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (ULONGLONG)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//
+// Burn CPU for the given number of nanoseconds
+//
+inline void
+HostSpin(ULONGLONG ns)
+{
+    ULONGLONG start = QueryTicks();
+
+    while (QueryTicks() - start < ns)
+    {
+    }
+}
+
+namespace xpsrasfilter
+{
+
+class BandPipeline;
+
+struct BandTimings
+{
+    ULONGLONG   numBands;
+    ULONGLONG   rasterizeTicks;
+    ULONGLONG   encodeTicks;
+    ULONGLONG   writeTicks;
+    ULONGLONG   waitTicks;
+};
+
+//
+// A "bitmap" is a band number and a reference count the test checks
+// to see that every band was released. IWICBitmap_t holds a reference
+// the way CComPtr<IWICBitmap> does.
+//
+struct HostBitmap
+{
+    int                 band;
+    std::atomic<int>    refs;
+};
+
+class IWICBitmap_t
+{
+public:
+    IWICBitmap_t() : p(NULL) {}
+    IWICBitmap_t(HostBitmap *pBitmap) : p(pBitmap) { AddRef(); }
+    IWICBitmap_t(const IWICBitmap_t &other) : p(other.p) { AddRef(); }
+    ~IWICBitmap_t() { Release(); }
+
+    IWICBitmap_t&
+    operator=(
+        const IWICBitmap_t &other
+        )
+    {
+        IWICBitmap_t copy(other);
+        HostBitmap *pOld = p;
+
+        p = copy.p;
+        copy.p = pOld;
+
+        return *this;
+    }
+
+    void
+    Release()
+    {
+        if (p != NULL)
+        {
+            p->refs--;
+            p = NULL;
+        }
+    }
+
+    HostBitmap *p;
+
+private:
+    void
+    AddRef()
+    {
+        if (p != NULL)
+        {
+            p->refs++;
+        }
+    }
+};
+
+struct TiffBandEncoder
+{
+    int band;
+};
+
+typedef std::auto_ptr<BandPipeline>     BandPipeline_t;
+typedef std::auto_ptr<TiffBandEncoder>  TiffBandEncoder_t;
+
+class TiffStreamBitmapHandler
+{
+public:
+    TiffStreamBitmapHandler() :
+        failBand(-1),
+        encodeNs(0),
+        writeNs(0),
+        encodeJitterNs(0),
+        inEncode(0),
+        maxInEncode(0)
+    {
+    }
+
+    TiffBandEncoder_t
+    CreateBandEncoder()
+    {
+        return TiffBandEncoder_t(new TiffBandEncoder());
+    }
+
+    void
+    EncodeBitmap(
+        const IWICBitmap_t  &bitmap,
+        TiffBandEncoder     &encoder
+        )
+    {
+        int inFlight = ++inEncode;
+        int seen = maxInEncode.load();
+
+        while (seen < inFlight &&
+               !maxInEncode.compare_exchange_weak(seen, inFlight))
+        {
+        }
+
+        ULONGLONG ns = encodeNs;
+
+        if (encodeJitterNs != 0)
+        {
+            static thread_local uint32_t seed = 1;
+
+            seed = seed * 1103515245 + 12345;
+            ns += (seed >> 8) % encodeJitterNs;
+        }
+
+        HostSpin(ns);
+
+        inEncode--;
+
+        if (bitmap.p->band == failBand)
+        {
+            ThrowHRException(E_FAIL);
+        }
+
+        encoder.band = bitmap.p->band;
+    }
+
+    void
+    WriteTiff(
+        const TiffBandEncoder &encoder
+        )
+    {
+        HostSpin(writeNs);
+        written.push_back(encoder.band);
+    }
+
+    int                 failBand;
+    ULONGLONG           encodeNs;
+    ULONGLONG           writeNs;
+    ULONGLONG           encodeJitterNs;
+    std::atomic<int>    inEncode;
+    std::atomic<int>    maxInEncode;
+    std::vector<int>    written;
+};
+
+} // namespace xpsrasfilter
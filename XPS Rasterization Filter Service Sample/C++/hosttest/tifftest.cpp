@@ -0,0 +1,754 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+//
+// File Name:
+//
+//    tifftest.cpp
+//
+// Abstract:
+//
+//    Host test and benchmark of the band TIFF encoder in
+//    ../src/TiffEncoder.cpp, which is built unchanged.
+//
+//    usage: tifftest --selftest
+//           tifftest [--seconds s] [--width pixels] [--height rows]
+//
+//    The self test encodes bands of several sizes, pixel layouts and
+//    kinds of content with each compression, a few bands per encoder
+//    and the rows handed over a few at a time, as the filter does. It
+//    reads each TIFF back with the small independent reader below and
+//    checks the tags and that the strips decode to the source pixels.
+//    The LZW decoder is strict: a strip must start with Clear, end with
+//    EndOfInformation, and never use a code before it is defined.
+//
+//    The benchmark reports MB/s of source raster encoded on one thread,
+//    for each compression and for mostly white, text-like and noisy
+//    content.
+//
+// Environment:
+//
+//    Host (user mode), C++11.
+//
+
+#include "TiffEncoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdexcept>
+
+using namespace xpsrasfilter;
+
+static int g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if (!(X))                                                               \
+    {                                                                       \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+//
+// Collects an encoded TIFF in memory
+//
+class MemoryOutput : public TiffOutput
+{
+public:
+    void
+    Write(
+        const uint8_t   *pData,
+        size_t          cbData
+        )
+    {
+        bytes.insert(bytes.end(), pData, pData + cbData);
+    }
+
+    std::vector<uint8_t> bytes;
+};
+
+//
+// Discards an encoded TIFF, for the benchmark
+//
+class NullOutput : public TiffOutput
+{
+public:
+    NullOutput() : cbWritten(0) {}
+
+    void
+    Write(
+        const uint8_t   *,
+        size_t          cbData
+        )
+    {
+        cbWritten += cbData;
+    }
+
+    uint64_t cbWritten;
+};
+
+//
+// Minimal reader for the baseline TIFFs the encoder writes. Throws
+// std::runtime_error on anything malformed.
+//
+class TiffReader
+{
+public:
+    explicit
+    TiffReader(
+        const std::vector<uint8_t> &file
+        ) : m_file(file)
+    {
+        Require(file.size() >= 8 && file[0] == 'I' && file[1] == 'I' && Short(2) == 42, "header");
+
+        uint32_t ifd = Long(4);
+        uint32_t numEntries = Short(ifd);
+
+        memset(m_tags, 0, sizeof(m_tags));
+
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            uint32_t entry = ifd + 2 + 12 * i;
+            uint16_t tag = Short(entry);
+
+            Require(i == 0 || tag > Short(entry - 12), "tag order");
+
+            Entry e;
+
+            e.type = Short(entry + 2);
+            e.count = Long(entry + 4);
+            e.offset = (TypeSize(e.type) * e.count <= 4) ? entry + 8 : Long(entry + 8);
+            e.present = true;
+
+            Require(e.offset + TypeSize(e.type) * e.count <= file.size(), "tag data");
+
+            if (tag < 512)
+            {
+                m_tags[tag] = e;
+            }
+        }
+
+        Require(Long(ifd + 2 + 12 * numEntries) == 0, "single IFD");
+    }
+
+    uint32_t
+    Value(
+        uint16_t    tag,
+        uint32_t    index = 0
+        ) const
+    {
+        const Entry &e = m_tags[tag];
+
+        Require(e.present && index < e.count, "missing tag");
+
+        switch (e.type)
+        {
+            case 3: return Short(e.offset + 2 * index);
+            case 4: return Long(e.offset + 4 * index);
+            case 5: return Long(e.offset + 8 * index) / Long(e.offset + 8 * index + 4);
+        }
+
+        throw std::runtime_error("tag type");
+    }
+
+    uint32_t
+    Count(
+        uint16_t tag
+        ) const
+    {
+        return m_tags[tag].present ? m_tags[tag].count : 0;
+    }
+
+    //
+    // Decode every strip and return the pixels, row after row
+    //
+    std::vector<uint8_t>
+    DecodePixels() const
+    {
+        uint32_t width = Value(256);
+        uint32_t height = Value(257);
+        uint32_t samples = Value(277);
+        uint32_t rowsPerStrip = Value(278);
+        uint32_t compression = Value(259);
+        uint32_t numStrips = Count(273);
+        size_t rowSize = static_cast<size_t>(width) * samples;
+
+        Require(numStrips == Count(279) &&
+                numStrips == (height + rowsPerStrip - 1) / rowsPerStrip, "strip count");
+
+        std::vector<uint8_t> pixels;
+        uint32_t expectOffset = 0;
+
+        for (uint32_t i = 0; i < numStrips; i++)
+        {
+            uint32_t offset = Value(273, i);
+            uint32_t count = Value(279, i);
+            uint32_t rows = (i + 1 < numStrips) ? rowsPerStrip : height - i * rowsPerStrip;
+            size_t cbStrip = rows * rowSize;
+
+            Require(i == 0 || offset == expectOffset, "strips back to back");
+            Require(static_cast<size_t>(offset) + count <= m_file.size(), "strip bounds");
+
+            expectOffset = offset + count;
+
+            const uint8_t *p = &m_file[0] + offset;
+            size_t before = pixels.size();
+
+            switch (compression)
+            {
+                case TIFF_COMPRESSION_NONE:
+                    pixels.insert(pixels.end(), p, p + count);
+                    break;
+
+                case TIFF_COMPRESSION_LZW:
+                    LzwDecode(p, count, pixels);
+                    break;
+
+                case TIFF_COMPRESSION_PACKBITS:
+                    PackBitsDecode(p, count, pixels);
+                    break;
+
+                default:
+                    throw std::runtime_error("compression");
+            }
+
+            Require(pixels.size() - before == cbStrip, "strip size");
+        }
+
+        Require(expectOffset == m_file.size(), "trailing bytes");
+
+        return pixels;
+    }
+
+private:
+
+    struct Entry
+    {
+        uint16_t    type;
+        uint32_t    count;
+        uint32_t    offset;
+        bool        present;
+    };
+
+    static void
+    Require(
+        bool        condition,
+        const char  *pWhat
+        )
+    {
+        if (!condition)
+        {
+            throw std::runtime_error(pWhat);
+        }
+    }
+
+    static uint32_t
+    TypeSize(
+        uint16_t type
+        )
+    {
+        return (type == 3) ? 2 : (type == 4) ? 4 : (type == 5) ? 8 : 1;
+    }
+
+    uint32_t
+    Short(
+        size_t offset
+        ) const
+    {
+        Require(offset + 2 <= m_file.size(), "short");
+        return m_file[offset] | (m_file[offset + 1] << 8);
+    }
+
+    uint32_t
+    Long(
+        size_t offset
+        ) const
+    {
+        Require(offset + 4 <= m_file.size(), "long");
+        return m_file[offset] | (m_file[offset + 1] << 8) |
+               (m_file[offset + 2] << 16) | (static_cast<uint32_t>(m_file[offset + 3]) << 24);
+    }
+
+    //
+    // TIFF LZW: MSB-first codes, 9 to 12 bits, with the code width
+    // going up one code early
+    //
+    static void
+    LzwDecode(
+        const uint8_t           *p,
+        size_t                  cb,
+        std::vector<uint8_t>    &out
+        )
+    {
+        std::vector<std::vector<uint8_t> > table;
+        std::vector<uint8_t> previous;
+        size_t bitPos = 0;
+        uint32_t codeBits = 9;
+        bool first = true;
+
+        for (;;)
+        {
+            Require(bitPos + codeBits <= cb * 8, "LZW ran out before EndOfInformation");
+
+            uint32_t code = 0;
+
+            for (uint32_t i = 0; i < codeBits; i++, bitPos++)
+            {
+                code = (code << 1) | ((p[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+            }
+
+            Require(!first || code == 256, "LZW strip does not start with Clear");
+            first = false;
+
+            if (code == 256)
+            {
+                table.clear();
+
+                for (uint32_t i = 0; i < 258; i++)
+                {
+                    table.push_back(std::vector<uint8_t>(1, static_cast<uint8_t>(i)));
+                }
+
+                codeBits = 9;
+                previous.clear();
+                continue;
+            }
+
+            if (code == 257)
+            {
+                break;
+            }
+
+            std::vector<uint8_t> entry;
+
+            if (code < table.size())
+            {
+                Require(code >= 258 || code < 256, "LZW control code");
+                entry = table[code];
+            }
+            else
+            {
+                Require(code == table.size() && !previous.empty(), "LZW code not yet defined");
+                entry = previous;
+                entry.push_back(previous[0]);
+            }
+
+            out.insert(out.end(), entry.begin(), entry.end());
+
+            if (!previous.empty())
+            {
+                Require(table.size() < 4096, "LZW table overflow");
+
+                previous.push_back(entry[0]);
+                table.push_back(previous);
+            }
+
+            previous = entry;
+
+            if (table.size() + 1 >= (1u << codeBits) && codeBits < 12)
+            {
+                codeBits++;
+            }
+        }
+
+        Require((bitPos + 7) / 8 == cb, "LZW bytes after EndOfInformation");
+    }
+
+    static void
+    PackBitsDecode(
+        const uint8_t           *p,
+        size_t                  cb,
+        std::vector<uint8_t>    &out
+        )
+    {
+        size_t i = 0;
+
+        while (i < cb)
+        {
+            int n = static_cast<int8_t>(p[i++]);
+
+            if (n >= 0)
+            {
+                Require(i + n + 1 <= cb, "PackBits literal");
+                out.insert(out.end(), p + i, p + i + n + 1);
+                i += n + 1;
+            }
+            else if (n != -128)
+            {
+                Require(i < cb, "PackBits run");
+                out.insert(out.end(), 1 - n, p[i]);
+                i++;
+            }
+        }
+    }
+
+    const std::vector<uint8_t>  &m_file;
+    Entry                       m_tags[512];
+};
+
+//
+// Content of a test or benchmark band
+//
+enum Content
+{
+    CONTENT_WHITE,          // blank paper
+    CONTENT_TEXT,           // mostly white with short dark runs
+    CONTENT_STRIPES,        // repeating short patterns
+    CONTENT_NOISE           // random bytes; does not compress
+};
+
+static const char *g_contentNames[] = { "white", "text", "stripes", "noise" };
+
+static uint32_t
+NextRandom(
+    uint32_t &seed
+    )
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void
+FillBand(
+    std::vector<uint8_t>    &band,
+    size_t                  stride,
+    uint32_t                width,
+    uint32_t                height,
+    uint32_t                bytesPerPixel,
+    Content                 content,
+    uint32_t                seed
+    )
+{
+    band.assign(stride * height, 0xCD);     // padding past each row
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint8_t *pRow = &band[y * stride];
+        uint32_t cbRow = width * bytesPerPixel;
+
+        for (uint32_t i = 0; i < cbRow; i++)
+        {
+            switch (content)
+            {
+                case CONTENT_WHITE:
+                    pRow[i] = 0xFF;
+                    break;
+
+                case CONTENT_TEXT:
+                    pRow[i] = (NextRandom(seed) % 97 < 3 || ((i / bytesPerPixel + y) % 61) < 2) ? 0x10 : 0xFF;
+                    break;
+
+                case CONTENT_STRIPES:
+                    pRow[i] = static_cast<uint8_t>(((i / 7) % 3) * 0x60 + y);
+                    break;
+
+                case CONTENT_NOISE:
+                    pRow[i] = static_cast<uint8_t>(NextRandom(seed));
+                    break;
+            }
+        }
+    }
+}
+
+//
+// The pixels the TIFF should hold: RGB(A) with B and R swapped back,
+// and the fourth byte of BGRX32 dropped
+//
+static std::vector<uint8_t>
+ExpectedPixels(
+    const std::vector<uint8_t>  &band,
+    size_t                      stride,
+    uint32_t                    width,
+    uint32_t                    height,
+    TiffSourceLayout            layout
+    )
+{
+    uint32_t bytesPerPixel = (layout == TIFF_SOURCE_BGR24) ? 3 : 4;
+    uint32_t samples = (layout == TIFF_SOURCE_BGR24 || layout == TIFF_SOURCE_BGRX32) ? 3 : 4;
+    std::vector<uint8_t> pixels;
+
+    pixels.reserve(static_cast<size_t>(width) * height * samples);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const uint8_t *p = &band[y * stride + x * bytesPerPixel];
+
+            pixels.push_back(p[2]);
+            pixels.push_back(p[1]);
+            pixels.push_back(p[0]);
+
+            if (samples == 4)
+            {
+                pixels.push_back(p[3]);
+            }
+        }
+    }
+
+    return pixels;
+}
+
+static void
+CheckBand(
+    TiffBandEncoder     &encoder,
+    TiffCompression     compression,
+    TiffSourceLayout    layout,
+    uint32_t            width,
+    uint32_t            height,
+    Content             content,
+    uint32_t            seed
+    )
+{
+    uint32_t bytesPerPixel = (layout == TIFF_SOURCE_BGR24) ? 3 : 4;
+    size_t stride = width * bytesPerPixel + (seed % 8);
+    std::vector<uint8_t> band;
+
+    FillBand(band, stride, width, height, bytesPerPixel, content, seed);
+
+    encoder.BeginBand(width, height, layout, 600, 300);
+
+    //
+    // Hand the rows over a few at a time
+    //
+    for (uint32_t row = 0; row < height; )
+    {
+        uint32_t numRows = (1 + seed % 7 < height - row) ? 1 + seed % 7 : height - row;
+
+        encoder.EncodeRows(&band[row * stride], stride, numRows);
+        row += numRows;
+    }
+
+    encoder.EndBand();
+
+    MemoryOutput output;
+
+    encoder.WriteTiff(output);
+
+    CHECK(output.bytes.size() == encoder.GetTiffSize());
+
+    try
+    {
+        TiffReader reader(output.bytes);
+        uint32_t samples = (layout == TIFF_SOURCE_BGR24 || layout == TIFF_SOURCE_BGRX32) ? 3 : 4;
+
+        CHECK(reader.Value(256) == width);
+        CHECK(reader.Value(257) == height);
+        CHECK(reader.Value(259) == static_cast<uint32_t>(compression));
+        CHECK(reader.Value(262) == 2);
+        CHECK(reader.Value(277) == samples);
+        CHECK(reader.Count(258) == samples);
+
+        for (uint32_t i = 0; i < samples; i++)
+        {
+            CHECK(reader.Value(258, i) == 8);
+        }
+
+        CHECK(reader.Value(282) == 600);
+        CHECK(reader.Value(283) == 300);
+        CHECK(reader.Value(284) == 1);
+        CHECK(reader.Value(296) == 2);
+
+        if (samples == 4)
+        {
+            CHECK(reader.Value(338) == ((layout == TIFF_SOURCE_PBGRA32) ? 1u : 2u));
+        }
+        else
+        {
+            CHECK(reader.Count(338) == 0);
+        }
+
+        CHECK(reader.Value(278) * width * samples <= TiffBandEncoder::ms_targetStripSize ||
+              reader.Value(278) == 1);
+
+        std::vector<uint8_t> decoded = reader.DecodePixels();
+
+        if (decoded != ExpectedPixels(band, stride, width, height, layout))
+        {
+            printf("pixels differ: compression %d layout %d %ux%u %s\n",
+                   compression, layout, width, height, g_contentNames[content]);
+            g_failures++;
+        }
+
+        if (content == CONTENT_WHITE && compression != TIFF_COMPRESSION_NONE && width * height > 1000)
+        {
+            CHECK(output.bytes.size() * 10 < decoded.size());
+        }
+    }
+    catch (std::runtime_error const &e)
+    {
+        printf("bad TIFF (%s): compression %d layout %d %ux%u %s\n",
+               e.what(), compression, layout, width, height, g_contentNames[content]);
+        g_failures++;
+    }
+}
+
+static int
+SelfTest()
+{
+    static const TiffCompression compressions[] =
+    {
+        TIFF_COMPRESSION_NONE, TIFF_COMPRESSION_LZW, TIFF_COMPRESSION_PACKBITS
+    };
+
+    static const uint32_t sizes[][2] =
+    {
+        { 1, 1 }, { 1, 300 }, { 2, 3 }, { 17, 5 }, { 127, 9 }, { 128, 2 }, { 129, 33 },
+        { 1000, 1 }, { 300, 100 }, { 5101, 40 }, { 40000, 1 }
+    };
+
+    uint32_t seed = 12345;
+
+    for (size_t c = 0; c < sizeof(compressions) / sizeof(compressions[0]); c++)
+    {
+        //
+        // One encoder per compression, reused for every band
+        // as the bitmap handler does
+        //
+        TiffBandEncoder encoder(compressions[c]);
+
+        for (int layout = TIFF_SOURCE_BGR24; layout <= TIFF_SOURCE_PBGRA32; layout++)
+        {
+            for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            {
+                for (int content = CONTENT_WHITE; content <= CONTENT_NOISE; content++)
+                {
+                    CheckBand(encoder,
+                              compressions[c],
+                              static_cast<TiffSourceLayout>(layout),
+                              sizes[s][0],
+                              sizes[s][1],
+                              static_cast<Content>(content),
+                              NextRandom(seed));
+                }
+            }
+        }
+    }
+
+    printf("tifftest self test %s\n", g_failures ? "FAILED" : "passed");
+
+    return g_failures ? 1 : 0;
+}
+
+static double
+Now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void
+Usage()
+{
+    printf("usage: tifftest --selftest\n"
+           "       tifftest [--seconds s] [--width pixels] [--height rows]\n");
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    double seconds = 1;
+    uint32_t width = 5100;          // 8.5 inches at 600 dpi
+    uint32_t height = 64;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--selftest") == 0)
+        {
+            return SelfTest();
+        }
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+        {
+            seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+        {
+            width = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+        {
+            height = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (width == 0 || height == 0)
+    {
+        Usage();
+        return 2;
+    }
+
+    static const struct
+    {
+        TiffCompression compression;
+        const char      *pName;
+    }
+    compressions[] =
+    {
+        { TIFF_COMPRESSION_NONE,     "none" },
+        { TIFF_COMPRESSION_LZW,      "LZW" },
+        { TIFF_COMPRESSION_PACKBITS, "PackBits" }
+    };
+
+    size_t stride = width * 4;
+
+    printf("%u x %u BGRA32 bands, one thread\n", width, height);
+    printf("%-10s %-8s %10s %10s\n", "", "", "MB/s", "ratio");
+
+    for (size_t c = 0; c < sizeof(compressions) / sizeof(compressions[0]); c++)
+    {
+        TiffBandEncoder encoder(compressions[c].compression);
+
+        for (int content = CONTENT_WHITE; content <= CONTENT_NOISE; content++)
+        {
+            std::vector<uint8_t> band;
+
+            FillBand(band, stride, width, height, 4, static_cast<Content>(content), 1);
+
+            NullOutput output;
+            uint64_t numBands = 0;
+            double start = Now();
+            double elapsed;
+
+            do
+            {
+                encoder.BeginBand(width, height, TIFF_SOURCE_BGRA32, 600, 600);
+                encoder.EncodeRows(&band[0], stride, height);
+                encoder.EndBand();
+                encoder.WriteTiff(output);
+
+                numBands++;
+                elapsed = Now() - start;
+            }
+            while (elapsed < seconds);
+
+            double cbRaster = static_cast<double>(numBands) * stride * height;
+
+            printf("%-10s %-8s %10.1f %10.2f\n",
+                   compressions[c].pName,
+                   g_contentNames[content],
+                   cbRaster / elapsed / 1e6,
+                   cbRaster / output.cbWritten);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,562 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+//
+// File Name:
+//
+//    BandPipeline.cpp
+//
+// Abstract:
+//
+//    Class that overlaps rasterization of a band with TIFF encoding of
+//    the bands before it. Rasterized bands are queued to a pool of
+//    encode threads and written to the output stream in order.
+//
+
+#include "precomp.h"
+#include "WppTrace.h"
+#include "Exception.h"
+#include "filtertypes.h"
+#include "BitmapHandler.h"
+#include "BandPipeline.h"
+#include "TiffEncoder.h"
+
+#include "BandPipeline.tmh"
+
+namespace xpsrasfilter
+{
+
+//
+//Routine Name:
+//
+//    BandPipeline::CreateBandPipeline
+//
+//Routine Description:
+//
+//    Static factory method that creates an instance of
+//    BandPipeline, with one encode thread per processor
+//    beyond the first (which is left to the rasterizer).
+//
+//Arguments:
+//
+//    pBitmapHandler  - Encodes and writes the bands
+//    pTimings        - Accumulates the encode, write and wait times
+//
+//Return Value:
+//
+//    BandPipeline_t (smart ptr)
+//    The new BandPipeline.
+//
+BandPipeline_t
+BandPipeline::CreateBandPipeline(
+    TiffStreamBitmapHandler *pBitmapHandler,
+    BandTimings             *pTimings
+    )
+{
+    ULONG numEncodeThreads = 0;
+    ULONG numSlots = 1;
+
+    //
+    // Band bitmaps are handed to the encode threads without marshaling,
+    // which is only valid if this thread is in the multi-threaded
+    // apartment. If it is not (see SafeCoInit), encode on this thread.
+    //
+    APTTYPE             aptType;
+    APTTYPEQUALIFIER    aptQualifier;
+
+    if (SUCCEEDED(::CoGetApartmentType(&aptType, &aptQualifier)) &&
+        aptType == APTTYPE_MTA)
+    {
+        SYSTEM_INFO systemInfo;
+        ::GetSystemInfo(&systemInfo);
+
+        if (systemInfo.dwNumberOfProcessors > 1)
+        {
+            numEncodeThreads = min(systemInfo.dwNumberOfProcessors - 1, ms_maxEncodeThreads);
+
+            //
+            // One band per encode thread, plus room for encoded
+            // bands that are waiting on an earlier one to be written
+            //
+            numSlots = min(numEncodeThreads + 2, ms_maxBandsInFlight);
+        }
+    }
+
+    DoTraceMessage(
+        XPSRASFILTER_TRACE_INFO,
+        L"Band pipeline uses %u encode threads and %u bands in flight",
+        numEncodeThreads,
+        numSlots
+        );
+
+    BandPipeline_t pPipeline(
+                        new BandPipeline(
+                                pBitmapHandler,
+                                pTimings
+                                )
+                        );
+
+    pPipeline->Initialize(numEncodeThreads, numSlots);
+
+    return pPipeline;
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::BandPipeline
+//
+//Routine Description:
+//
+//    Construct an empty band pipeline. Slots and encode
+//    threads are added by Initialize.
+//
+//Arguments:
+//
+//    pBitmapHandler  - Encodes and writes the bands
+//    pTimings        - Accumulates the encode, write and wait times
+//
+BandPipeline::BandPipeline(
+    TiffStreamBitmapHandler *pBitmapHandler,
+    BandTimings             *pTimings
+    ) : m_pBitmapHandler(pBitmapHandler),
+        m_pTimings(pTimings),
+        m_nextSubmit(0),
+        m_nextEncode(0),
+        m_nextWrite(0),
+        m_shutdown(FALSE),
+        m_hrEncodeThreads(S_OK)
+{
+    ::InitializeCriticalSection(&m_lock);
+    ::InitializeConditionVariable(&m_bandSubmitted);
+    ::InitializeConditionVariable(&m_bandEncoded);
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::~BandPipeline
+//
+//Routine Description:
+//
+//    Stop the encode threads and free the slots. Bands
+//    that have not been written are discarded; call
+//    Flush first to write them.
+//
+//Arguments:
+//
+//    None
+//
+BandPipeline::~BandPipeline()
+{
+    ::EnterCriticalSection(&m_lock);
+
+    m_shutdown = TRUE;
+    ::WakeAllConditionVariable(&m_bandSubmitted);
+
+    ::LeaveCriticalSection(&m_lock);
+
+    //
+    // An encode thread finishes the band it is working on before
+    // it notices the shutdown
+    //
+    for (size_t i = 0; i < m_encodeThreads.size(); i++)
+    {
+        ::WaitForSingleObject(m_encodeThreads[i], INFINITE);
+        ::CloseHandle(m_encodeThreads[i]);
+    }
+
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        delete m_slots[i];
+    }
+
+    ::DeleteCriticalSection(&m_lock);
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::Initialize
+//
+//Routine Description:
+//
+//    Allocate the slots and start the encode threads.
+//
+//Arguments:
+//
+//    numEncodeThreads    - Number of encode threads; 0 to
+//                          encode on the submitting thread
+//    numSlots            - Number of bands that may be in flight
+//
+void
+BandPipeline::Initialize(
+    ULONG numEncodeThreads,
+    ULONG numSlots
+    )
+{
+    m_slots.reserve(numSlots);
+
+    for (ULONG i = 0; i < numSlots; i++)
+    {
+        std::auto_ptr<BandJob> pJob(new BandJob());
+
+        pJob->pEncoder = m_pBitmapHandler->CreateBandEncoder();
+        pJob->hr = S_OK;
+        pJob->isEncoded = FALSE;
+
+        m_slots.push_back(pJob.release());
+    }
+
+    m_encodeThreads.reserve(numEncodeThreads);
+
+    for (ULONG i = 0; i < numEncodeThreads; i++)
+    {
+        HANDLE hThread = ::CreateThread(
+                                NULL,
+                                0,
+                                EncodeThreadProc,
+                                this,
+                                0,
+                                NULL
+                                );
+
+        if (hThread == NULL)
+        {
+            THROW_LAST_ERROR();
+        }
+
+        m_encodeThreads.push_back(hThread);
+    }
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::SubmitBand
+//
+//Routine Description:
+//
+//    Queue a rasterized band for encoding. Bands that have
+//    finished encoding are written first; if every slot is
+//    in use, this waits for the oldest band to be encoded
+//    and writes it.
+//
+//    Without encode threads, the band is encoded and
+//    written before this returns.
+//
+//Arguments:
+//
+//    bitmap    - bitmap of a single band
+//
+void
+BandPipeline::SubmitBand(
+    const IWICBitmap_t &bitmap
+    )
+{
+    //
+    // Write out whatever is ready, in order
+    //
+    BOOL wroteBand = TRUE;
+
+    while (wroteBand)
+    {
+        wroteBand = WriteNextBand(FALSE);
+    }
+
+    //
+    // m_nextSubmit and m_nextWrite only change on this thread,
+    // so they can be read without the lock
+    //
+    if (m_nextSubmit - m_nextWrite == m_slots.size())
+    {
+        WriteNextBand(TRUE);
+    }
+
+    BandJob *pJob = GetSlot(m_nextSubmit);
+
+    pJob->bitmap = bitmap;
+
+    if (m_encodeThreads.empty())
+    {
+        ULONGLONG startTicks = QueryTicks();
+
+        EncodeBand(pJob);
+
+        m_pTimings->encodeTicks += QueryTicks() - startTicks;
+
+        pJob->isEncoded = TRUE;
+        m_nextEncode++;
+        m_nextSubmit++;
+
+        WriteNextBand(FALSE);
+
+        return;
+    }
+
+    ::EnterCriticalSection(&m_lock);
+
+    m_nextSubmit++;
+    ::WakeConditionVariable(&m_bandSubmitted);
+
+    ::LeaveCriticalSection(&m_lock);
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::Flush
+//
+//Routine Description:
+//
+//    Wait for every band in flight to be encoded and
+//    write them all, in order.
+//
+//Arguments:
+//
+//    None
+//
+void
+BandPipeline::Flush()
+{
+    while (m_nextWrite < m_nextSubmit)
+    {
+        WriteNextBand(TRUE);
+    }
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::WriteNextBand
+//
+//Routine Description:
+//
+//    Write the oldest band in flight to the output
+//    stream and free its slot, if it has been encoded.
+//    Throws if the band failed to encode.
+//
+//Arguments:
+//
+//    waitForEncode   - Wait for the band to finish encoding
+//
+//Return Value:
+//
+//    BOOL
+//    TRUE    - A band was written
+//    FALSE   - No band was in flight, or the oldest one was
+//              still being encoded and waitForEncode was FALSE
+//
+BOOL
+BandPipeline::WriteNextBand(
+    BOOL waitForEncode
+    )
+{
+    BandJob *pJob = NULL;
+    HRESULT hr = S_OK;
+
+    ::EnterCriticalSection(&m_lock);
+
+    if (m_nextWrite < m_nextSubmit)
+    {
+        pJob = GetSlot(m_nextWrite);
+
+        if (!pJob->isEncoded &&
+            waitForEncode)
+        {
+            ULONGLONG startTicks = QueryTicks();
+
+            while (!pJob->isEncoded &&
+                   SUCCEEDED(m_hrEncodeThreads))
+            {
+                ::SleepConditionVariableCS(&m_bandEncoded, &m_lock, INFINITE);
+            }
+
+            m_pTimings->waitTicks += QueryTicks() - startTicks;
+        }
+
+        if (!pJob->isEncoded)
+        {
+            hr = m_hrEncodeThreads;
+            pJob = NULL;
+        }
+    }
+
+    ::LeaveCriticalSection(&m_lock);
+
+    THROW_ON_FAILED_HRESULT(hr);
+
+    if (pJob == NULL)
+    {
+        return FALSE;
+    }
+
+    THROW_ON_FAILED_HRESULT(pJob->hr);
+
+    {
+        ULONGLONG startTicks = QueryTicks();
+
+        m_pBitmapHandler->WriteTiff(*pJob->pEncoder);
+
+        m_pTimings->writeTicks += QueryTicks() - startTicks;
+        m_pTimings->numBands++;
+    }
+
+    pJob->bitmap.Release();
+
+    ::EnterCriticalSection(&m_lock);
+
+    pJob->isEncoded = FALSE;
+    m_nextWrite++;
+
+    ::LeaveCriticalSection(&m_lock);
+
+    return TRUE;
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::EncodeBand
+//
+//Routine Description:
+//
+//    Encode the band in a slot with the slot's TIFF
+//    encoder. This is an exception boundary; the result
+//    is left in the slot for the writer to act on.
+//
+//Arguments:
+//
+//    pJob  - slot holding the band
+//
+void
+BandPipeline::EncodeBand(
+    _Inout_ BandJob *pJob
+    )
+{
+    HRESULT hr = S_OK;
+
+    try
+    {
+        m_pBitmapHandler->EncodeBitmap(
+                            pJob->bitmap,
+                            *pJob->pEncoder
+                            );
+    }
+    CATCH_VARIOUS(hr);
+
+    pJob->hr = hr;
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::EncodeThreadProc
+//
+//Routine Description:
+//
+//    Encode thread entry point. Initializes COM for the
+//    thread and runs the encode loop.
+//
+//Arguments:
+//
+//    pParameter  - the BandPipeline
+//
+//Return Value:
+//
+//    DWORD
+//    0
+//
+DWORD WINAPI
+BandPipeline::EncodeThreadProc(
+    _In_ LPVOID pParameter
+    )
+{
+    BandPipeline *pPipeline = static_cast<BandPipeline *>(pParameter);
+    HRESULT hr = S_OK;
+
+    try
+    {
+        //
+        // COM is initialized for the lifetime of this thread
+        //
+        SafeCoInit coInit;
+
+        pPipeline->EncodeThread();
+    }
+    CATCH_VARIOUS(hr);
+
+    if (FAILED(hr))
+    {
+        WPP_LOG_ON_FAILED_HRESULT_WITH_TEXT(
+            hr,
+            L"Band encode thread failed to initialize."
+            );
+
+        //
+        // Fail the writer rather than leave it waiting
+        // on bands this thread will never encode
+        //
+        ::EnterCriticalSection(&pPipeline->m_lock);
+
+        pPipeline->m_hrEncodeThreads = hr;
+        ::WakeAllConditionVariable(&pPipeline->m_bandEncoded);
+
+        ::LeaveCriticalSection(&pPipeline->m_lock);
+    }
+
+    return 0;
+}
+
+//
+//Routine Name:
+//
+//    BandPipeline::EncodeThread
+//
+//Routine Description:
+//
+//    Encode loop. Takes bands in submission order and
+//    encodes them until the pipeline is shut down.
+//
+//Arguments:
+//
+//    None
+//
+void
+BandPipeline::EncodeThread()
+{
+    ::EnterCriticalSection(&m_lock);
+
+    while (!m_shutdown)
+    {
+        if (m_nextEncode == m_nextSubmit)
+        {
+            ::SleepConditionVariableCS(&m_bandSubmitted, &m_lock, INFINITE);
+            continue;
+        }
+
+        BandJob *pJob = GetSlot(m_nextEncode++);
+
+        ::LeaveCriticalSection(&m_lock);
+
+        ULONGLONG startTicks = QueryTicks();
+
+        EncodeBand(pJob);
+
+        ULONGLONG encodeTicks = QueryTicks() - startTicks;
+
+        ::EnterCriticalSection(&m_lock);
+
+        pJob->isEncoded = TRUE;
+        m_pTimings->encodeTicks += encodeTicks;
+
+        ::WakeAllConditionVariable(&m_bandEncoded);
+    }
+
+    ::LeaveCriticalSection(&m_lock);
+}
+
+} // namespace xpsrasfilter
@@ -0,0 +1,149 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+//
+// File Name:
+//
+//    BandPipeline.h
+//
+// Abstract:
+//
+//    Class that overlaps rasterization of a band with TIFF encoding of
+//    the bands before it. Rasterized bands are queued to a pool of
+//    encode threads and written to the output stream in order.
+//
+
+#pragma once
+
+namespace xpsrasfilter
+{
+
+class BandPipeline
+{
+public:
+
+    static
+    BandPipeline_t
+    CreateBandPipeline(
+        TiffStreamBitmapHandler *pBitmapHandler,
+        BandTimings             *pTimings
+        );
+
+    ~BandPipeline();
+
+    void
+    SubmitBand(
+        const IWICBitmap_t &bitmap
+        );
+
+    void
+    Flush();
+
+    //
+    // Upper bound on the number of encode threads
+    //
+    const static ULONG ms_maxEncodeThreads = 4;
+
+    //
+    // Upper bound on the number of bands that have been rasterized
+    // but not yet written. Each one holds a band bitmap of up to
+    // RasterizationInterface::ms_targetBandSize bytes.
+    //
+    const static ULONG ms_maxBandsInFlight = 6;
+
+private:
+
+    //
+    // A band on its way through the pipeline
+    //
+    struct BandJob
+    {
+        IWICBitmap_t        bitmap;         // rasterized band; released once written
+        TiffBandEncoder_t   pEncoder;       // holds the encoded TIFF
+        HRESULT             hr;             // result of encoding
+        BOOL                isEncoded;
+    };
+
+    //
+    // Constructor is private; use CreateBandPipeline
+    // to create instances
+    //
+    BandPipeline(
+        TiffStreamBitmapHandler *pBitmapHandler,
+        BandTimings             *pTimings
+        );
+
+    //
+    // prevent copy semantics
+    //
+    BandPipeline(const BandPipeline&);
+    BandPipeline& operator=(const BandPipeline&);
+
+    void
+    Initialize(
+        ULONG numEncodeThreads,
+        ULONG numSlots
+        );
+
+    BOOL
+    WriteNextBand(
+        BOOL waitForEncode
+        );
+
+    void
+    EncodeBand(
+        _Inout_ BandJob *pJob
+        );
+
+    static
+    DWORD WINAPI
+    EncodeThreadProc(
+        _In_ LPVOID pParameter
+        );
+
+    void
+    EncodeThread();
+
+    BandJob*
+    GetSlot(
+        ULONGLONG band
+        )
+    {
+        return m_slots[static_cast<size_t>(band % m_slots.size())];
+    }
+
+    //
+    // Internal data members
+    //
+    TiffStreamBitmapHandler *m_pBitmapHandler;
+    BandTimings             *m_pTimings;
+
+    //
+    // Ring of band slots. Band N uses slot N % m_slots.size(). Bands
+    // [m_nextWrite, m_nextSubmit) are in flight; of those, bands from
+    // m_nextEncode on have not been picked up by an encode thread yet.
+    //
+    std::vector<BandJob *>  m_slots;
+    ULONGLONG               m_nextSubmit;
+    ULONGLONG               m_nextEncode;
+    ULONGLONG               m_nextWrite;
+
+    std::vector<HANDLE>     m_encodeThreads;
+    BOOL                    m_shutdown;
+    HRESULT                 m_hrEncodeThreads;  // an encode thread failed to initialize
+
+    //
+    // Protects the counters above, m_shutdown, m_hrEncodeThreads, the
+    // isEncoded field of the slots and m_pTimings->encodeTicks. The
+    // other fields of a slot belong to the encode thread that picked
+    // it up until isEncoded is set, and to the writer after that.
+    //
+    CRITICAL_SECTION        m_lock;
+    CONDITION_VARIABLE      m_bandSubmitted;
+    CONDITION_VARIABLE      m_bandEncoded;
+};
+
+} // namespace xpsrasfilter
@@ -25,12 +25,109 @@
 #include "OMConvertor.h"
 #include "rasinterface.h"
 #include "BitmapHandler.h"
+#include "TiffEncoder.h"
 
 #include "BitmapHandler.tmh"
 
 namespace xpsrasfilter
 {
 
+//
+// Adapts the filter output stream to the TIFF encoder
+//
+class PrintWriteStreamOutput : public TiffOutput
+{
+public:
+
+    PrintWriteStreamOutput(
+        const IPrintWriteStream_t &pWriter
+        ) : m_pWriter(pWriter)
+    {
+    }
+
+    void
+    Write(
+        const uint8_t   *pData,
+        size_t          cbData
+        )
+    {
+        while (cbData > 0)
+        {
+            ULONG toWrite = static_cast<ULONG>(min(cbData, static_cast<size_t>(ULONG_MAX)));
+            ULONG written;
+
+            THROW_ON_FAILED_HRESULT(
+                m_pWriter->WriteBytes(
+                                const_cast<BYTE *>(pData),
+                                toWrite,
+                                &written
+                                )
+                );
+
+            pData += toWrite;
+            cbData -= toWrite;
+        }
+    }
+
+private:
+
+    PrintWriteStreamOutput& operator=(const PrintWriteStreamOutput&);
+
+    const IPrintWriteStream_t &m_pWriter;
+};
+
+//
+//Routine Name:
+//
+//    GetSourceLayout
+//
+//Routine Description:
+//
+//    Map a WIC pixel format to a layout the TIFF
+//    encoder can read directly.
+//
+//Arguments:
+//
+//    format  - WIC pixel format
+//    pLayout - receives the layout
+//
+//Return Value:
+//
+//    BOOL
+//    TRUE    - The encoder can read the format
+//    FALSE   - The bitmap must be converted first
+//
+static
+BOOL
+GetSourceLayout(
+    const WICPixelFormatGUID    &format,
+    _Out_ TiffSourceLayout      *pLayout
+    )
+{
+    if (IsEqualGUID(format, GUID_WICPixelFormat32bppPBGRA))
+    {
+        *pLayout = TIFF_SOURCE_PBGRA32;
+    }
+    else if (IsEqualGUID(format, GUID_WICPixelFormat32bppBGRA))
+    {
+        *pLayout = TIFF_SOURCE_BGRA32;
+    }
+    else if (IsEqualGUID(format, GUID_WICPixelFormat32bppBGR))
+    {
+        *pLayout = TIFF_SOURCE_BGRX32;
+    }
+    else if (IsEqualGUID(format, GUID_WICPixelFormat24bppBGR))
+    {
+        *pLayout = TIFF_SOURCE_BGR24;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 //
 //Routine Name:
 //
@@ -113,183 +210,195 @@ TiffStreamBitmapHandler::TiffStreamBitmapHandler(
 //
 //Routine Name:
 //
-//    TiffStreamBitmapHandler::ProcessBitmap
+//    TiffStreamBitmapHandler::CreateBandEncoder
 //
 //Routine Description:
 //
-//    Encode the bitmap as a TIFF and stream out of the filter.
+//    Create a TIFF encoder for EncodeBitmap. An encoder
+//    keeps its buffers from band to band, so each encoding
+//    thread should create one and reuse it.
 //
 //Arguments:
 //
-//    bitmap    - bitmap of a single band, to stream
+//    None
 //
-void
-TiffStreamBitmapHandler::ProcessBitmap(
-    const IWICBitmap_t &bitmap
-    )
+//Return Value:
+//
+//    TiffBandEncoder_t (smart ptr)
+//    The new encoder, set up for LZW compression.
+//
+TiffBandEncoder_t
+TiffStreamBitmapHandler::CreateBandEncoder()
 {
+    TiffBandEncoder_t toReturn(
+                        new TiffBandEncoder(TIFF_COMPRESSION_LZW)
+                        );
 
-    //
-    // Create an empty HGLOBAL to hold the encode cache
-    //
-    SafeHGlobal_t pHG(
-                    new SafeHGlobal(GMEM_SHARE | GMEM_MOVEABLE, 0)
-                    );
-
-    //
-    // Create a stream to the encode buffer so that WIC can
-    // encode the TIFF in-memory
-    //
-    IStream_t pIStream;
+    return toReturn;
+}
 
+//
+//Routine Name:
+//
+//    TiffStreamBitmapHandler::EncodeBitmap
+//
+//Routine Description:
+//
+//    Encode the bitmap as a TIFF with the given encoder.
+//
+//    Bitmaps in a BGR(A) format are encoded straight from
+//    the bitmap memory; others are first converted to
+//    32bppPBGRA a few rows at a time.
+//
+//    This only uses the WIC factory, which is free-threaded,
+//    so it may be called on several threads at once as long
+//    as each has its own encoder.
+//
+//Arguments:
+//
+//    bitmap    - bitmap of a single band, to encode
+//    encoder   - encoder to hold the encoded TIFF until
+//                it is written with WriteTiff
+//
+void
+TiffStreamBitmapHandler::EncodeBitmap(
+    const IWICBitmap_t  &bitmap,
+    TiffBandEncoder     &encoder
+    )
+{
+    UINT bitmapWidth, bitmapHeight;
     THROW_ON_FAILED_HRESULT(
-        ::CreateStreamOnHGlobal(
-            *pHG,
-            FALSE, // Do NOT Free the HGLOBAL on Release of the stream
-            &pIStream
-            )
+        bitmap->GetSize(&bitmapWidth, &bitmapHeight)
         );
 
-    //
-    // Create a WIC TIFF Encoder on the stream
-    //
-    IWICBitmapEncoder_t pWICEncoder;
+    DOUBLE xDPI, yDPI;
     THROW_ON_FAILED_HRESULT(
-        m_pWICFactory->CreateEncoder(GUID_ContainerFormatTiff, NULL, &pWICEncoder)
+        bitmap->GetResolution(&xDPI, &yDPI)
         );
+
+    WICPixelFormatGUID format;
     THROW_ON_FAILED_HRESULT(
-        pWICEncoder->Initialize(pIStream, WICBitmapEncoderNoCache)
+        bitmap->GetPixelFormat(&format)
         );
 
-    //
-    // Create a new frame for the band and configure it
-    //
-    IWICBitmapFrameEncode_t pWICFrame;
-    IPropertyBag2_t pFramePropertyBag;
+    WICRect rect = {0, 0, 0, 0};
+    rect.Width = bitmapWidth;
+    rect.Height = bitmapHeight;
 
-    THROW_ON_FAILED_HRESULT(
-        pWICEncoder->CreateNewFrame(&pWICFrame, &pFramePropertyBag)
-        );
+    TiffSourceLayout layout;
 
+    if (GetSourceLayout(format, &layout))
     {
         //
-        // Write the compression method to the frame's property bag
+        // Encode directly from the bitmap memory
         //
-        PROPBAG2 option = { 0 };
-        option.pstrName = L"TiffCompressionMethod";
-        
-        VARIANT varValue;    
-        VariantInit(&varValue);
-        varValue.vt = VT_UI1;
-        varValue.bVal = WICTiffCompressionLZW;      
+        IWICBitmapLock_t pLock;
+        THROW_ON_FAILED_HRESULT(
+            bitmap->Lock(&rect, WICBitmapLockRead, &pLock)
+            );
 
+        UINT stride;
         THROW_ON_FAILED_HRESULT(
-            pFramePropertyBag->Write(
-                1, // number of properties being set
-                &option, 
-                &varValue
-                )
+            pLock->GetStride(&stride)
             );
-    }
 
-    THROW_ON_FAILED_HRESULT(
-        pWICFrame->Initialize(pFramePropertyBag)
-        );
+        UINT cbBuffer;
+        BYTE *pBuffer = NULL;
+        THROW_ON_FAILED_HRESULT(
+            pLock->GetDataPointer(&cbBuffer, &pBuffer)
+            );
 
-    //
-    // Set the frame's size
-    //
-    UINT bitmapWidth, bitmapHeight;
-    THROW_ON_FAILED_HRESULT(
-        bitmap->GetSize(&bitmapWidth, &bitmapHeight)
-        );
-    THROW_ON_FAILED_HRESULT(
-        pWICFrame->SetSize(bitmapWidth, bitmapHeight)
-        );
+        encoder.BeginBand(bitmapWidth, bitmapHeight, layout, xDPI, yDPI);
+        encoder.EncodeRows(pBuffer, stride, bitmapHeight);
+        encoder.EndBand();
 
-    //
-    // Set the frame's resolution
-    //
-    DOUBLE xDPI, yDPI;
-    THROW_ON_FAILED_HRESULT(
-        bitmap->GetResolution(&xDPI, &yDPI)
-        );
-    THROW_ON_FAILED_HRESULT(
-        pWICFrame->SetResolution(xDPI, yDPI)
-        );
+        return;
+    }
 
     //
-    // Set the frame's pixel format
+    // Convert the bitmap to 32bppPBGRA and encode it in
+    // chunks of rows, to bound the size of the copy
     //
-    WICPixelFormatGUID format;
+    IWICFormatConverter_t pConverter;
     THROW_ON_FAILED_HRESULT(
-        bitmap->GetPixelFormat(&format)
+        m_pWICFactory->CreateFormatConverter(&pConverter)
         );
     THROW_ON_FAILED_HRESULT(
-        pWICFrame->SetPixelFormat(&format)
+        pConverter->Initialize(
+            bitmap,
+            GUID_WICPixelFormat32bppPBGRA,
+            WICBitmapDitherTypeNone,
+            NULL,
+            0.0,
+            WICBitmapPaletteTypeCustom
+            )
         );
 
-    //
-    // Write the bitmap data to the frame
-    //
-    WICRect rect = {0, 0, 0, 0};
-    rect.Width = bitmapWidth;
-    rect.Height = bitmapHeight;
+    UINT stride;
     THROW_ON_FAILED_HRESULT(
-        pWICFrame->WriteSource(bitmap, &rect)
+        UIntMult(bitmapWidth, 4, &stride)
         );
 
-    //
-    // Commit the frame and encoder
-    //
-    THROW_ON_FAILED_HRESULT(
-        pWICFrame->Commit()
-        );
-    THROW_ON_FAILED_HRESULT(
-        pWICEncoder->Commit()
-        );
+    UINT rowsPerChunk = max(TiffBandEncoder::ms_targetStripSize / max(stride, 1u), 1u);
+    rowsPerChunk = min(rowsPerChunk, bitmapHeight);
 
-    //
-    // Get the size of the TIFF from the stream position
-    //
-    ULARGE_INTEGER tiffSize;
-    LARGE_INTEGER zero;
-    zero.QuadPart = 0;
+    std::vector<BYTE> chunk(static_cast<size_t>(stride) * rowsPerChunk);
 
-    THROW_ON_FAILED_HRESULT(
-        pIStream->Seek(zero, SEEK_CUR, &tiffSize)
-        );
+    encoder.BeginBand(bitmapWidth, bitmapHeight, TIFF_SOURCE_PBGRA32, xDPI, yDPI);
 
-    ULONG cb;
-    
-    THROW_ON_FAILED_HRESULT(
-        ::ULongLongToULong(tiffSize.QuadPart, &cb)
-        );
+    for (UINT row = 0; row < bitmapHeight; row += rowsPerChunk)
+    {
+        rect.Y = row;
+        rect.Height = min(rowsPerChunk, bitmapHeight - row);
+
+        THROW_ON_FAILED_HRESULT(
+            pConverter->CopyPixels(
+                &rect,
+                stride,
+                static_cast<UINT>(chunk.size()),
+                &chunk[0]
+                )
+            );
+
+        encoder.EncodeRows(&chunk[0], stride, rect.Height);
+    }
+
+    encoder.EndBand();
+}
 
+//
+//Routine Name:
+//
+//    TiffStreamBitmapHandler::WriteTiff
+//
+//Routine Description:
+//
+//    Stream an encoded TIFF out of the filter. Bands must be
+//    written in order, from one thread at a time.
+//
+//Arguments:
+//
+//    encoder   - encoder holding the encoded TIFF
+//
+void
+TiffStreamBitmapHandler::WriteTiff(
+    const TiffBandEncoder &encoder
+    )
+{
     //
     // Update the list of Tiff locations so that it can be written to
     // the end of the Tiff stream.
     //
     m_tiffStarts.push_back(m_nextTiffStart);
-    m_nextTiffStart += tiffSize.QuadPart;
+    m_nextTiffStart += encoder.GetTiffSize();
     m_numTiffs++;
 
-    {
-        //
-        // Get a pointer to the HGLOBAL memory
-        //
-        HGlobalLock_t lock = pHG->Lock();
-        BYTE *pCache = lock->GetAddress();
-
-        //
-        // Write the encoded Tiff to the output stream
-        //
-        ULONG written;
+    //
+    // Write the encoded Tiff to the output stream
+    //
+    PrintWriteStreamOutput output(m_pWriter);
 
-        THROW_ON_FAILED_HRESULT(
-            m_pWriter->WriteBytes(pCache, cb, &written)
-            );
-    }
+    encoder.WriteTiff(output);
 }
 
 //
@@ -31,9 +31,18 @@ public:
         const IPrintWriteStream_t &pStream
         );
 
+    TiffBandEncoder_t
+    CreateBandEncoder();
+
+    void
+    EncodeBitmap(
+        const IWICBitmap_t  &bitmap,
+        TiffBandEncoder     &encoder
+        );
+
     void
-    ProcessBitmap(
-        const IWICBitmap_t &bitmap
+    WriteTiff(
+        const TiffBandEncoder &encoder
         );
 
     void
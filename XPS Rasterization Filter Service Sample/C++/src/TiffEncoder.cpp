@@ -0,0 +1,1098 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+//
+// File Name:
+//
+//    TiffEncoder.cpp
+//
+// Abstract:
+//
+//    Self-contained encoder that writes a band of BGR(A) pixels as a
+//    single-image, strip-organized RGB(A) TIFF, compressed with LZW or
+//    PackBits. It depends only on the C++ standard library so that it
+//    can be built and exercised outside of the filter; it does not use
+//    the filter's precompiled header or tracing.
+//
+//    The encoded TIFF is laid out as
+//
+//       +--------------------------+
+//       | Header (8 bytes)         |
+//       +--------------------------+
+//       | IFD                      |
+//       +--------------------------+
+//       | Tag data (bits per       |
+//       | sample, strip offsets,   |
+//       | strip byte counts,       |
+//       | resolution)              |
+//       +--------------------------+
+//       | Strip 1                  |
+//       +--------------------------+
+//       |   ...                    |
+//       +--------------------------+
+//       | Strip N                  |
+//       +--------------------------+
+//
+//    The IFD must hold the strip offsets, which are only known once
+//    every strip is compressed, so strips are compressed into a buffer
+//    that is reused from band to band, and the header is put in front
+//    of them when the TIFF is written.
+//
+
+#include "TiffEncoder.h"
+
+#include <string.h>
+#include <stdexcept>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define TIFF_ENCODER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace xpsrasfilter
+{
+
+//
+// TIFF LZW code assignments
+//
+const uint32_t LZW_CODE_CLEAR   = 256;
+const uint32_t LZW_CODE_EOI     = 257;
+const uint32_t LZW_CODE_FIRST   = 258;
+const uint32_t LZW_CODE_LIMIT   = 4094;     // table is reset when the next code reaches this
+const uint32_t LZW_MIN_BITS     = 9;
+
+//
+// TIFF tags and field types written by the encoder
+//
+const uint16_t TIFF_TAG_IMAGE_WIDTH         = 256;
+const uint16_t TIFF_TAG_IMAGE_LENGTH        = 257;
+const uint16_t TIFF_TAG_BITS_PER_SAMPLE     = 258;
+const uint16_t TIFF_TAG_COMPRESSION         = 259;
+const uint16_t TIFF_TAG_PHOTOMETRIC         = 262;
+const uint16_t TIFF_TAG_STRIP_OFFSETS       = 273;
+const uint16_t TIFF_TAG_SAMPLES_PER_PIXEL   = 277;
+const uint16_t TIFF_TAG_ROWS_PER_STRIP      = 278;
+const uint16_t TIFF_TAG_STRIP_BYTE_COUNTS   = 279;
+const uint16_t TIFF_TAG_X_RESOLUTION        = 282;
+const uint16_t TIFF_TAG_Y_RESOLUTION        = 283;
+const uint16_t TIFF_TAG_PLANAR_CONFIG       = 284;
+const uint16_t TIFF_TAG_RESOLUTION_UNIT     = 296;
+const uint16_t TIFF_TAG_EXTRA_SAMPLES       = 338;
+
+const uint16_t TIFF_TYPE_SHORT              = 3;
+const uint16_t TIFF_TYPE_LONG               = 4;
+const uint16_t TIFF_TYPE_RATIONAL           = 5;
+
+const uint16_t TIFF_PHOTOMETRIC_RGB         = 2;
+const uint16_t TIFF_PLANAR_CONTIG           = 1;
+const uint16_t TIFF_RESUNIT_INCH            = 2;
+const uint16_t TIFF_EXTRA_ASSOCIATED_ALPHA  = 1;
+const uint16_t TIFF_EXTRA_UNASSOCIATED_ALPHA = 2;
+
+const size_t   TIFF_HEADER_SIZE             = 8;
+const size_t   TIFF_IFD_ENTRY_SIZE          = 12;
+
+//
+// Longest run or literal in a PackBits code
+//
+const size_t   PACKBITS_MAX_RUN             = 128;
+
+//
+//Routine Name:
+//
+//    CountTrailingZeros
+//
+//Routine Description:
+//
+//    Index of the lowest set bit of a non-zero mask.
+//
+static inline
+uint32_t
+CountTrailingZeros(
+    uint32_t mask
+    )
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+//
+//Routine Name:
+//
+//    PackBitsRunLength
+//
+//Routine Description:
+//
+//    Number of bytes, up to cbMax, equal to the first one.
+//
+static
+size_t
+PackBitsRunLength(
+    const uint8_t   *pData,
+    size_t          cbMax
+    )
+{
+    size_t run = 1;
+
+#if defined(TIFF_ENCODER_SSE2)
+    __m128i first = _mm_set1_epi8(static_cast<char>(pData[0]));
+
+    while (run + 16 <= cbMax)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pData + run));
+        uint32_t mismatch = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, first))) & 0xFFFF;
+
+        if (mismatch != 0)
+        {
+            return run + CountTrailingZeros(mismatch);
+        }
+
+        run += 16;
+    }
+#endif
+
+    while (run < cbMax &&
+           pData[run] == pData[0])
+    {
+        run++;
+    }
+
+    return run;
+}
+
+//
+//Routine Name:
+//
+//    PackBitsLiteralLength
+//
+//Routine Description:
+//
+//    Number of bytes, up to cbMax, before the first run of
+//    three equal bytes (which is better sent as a repeat).
+//    cbAvailable is the number of bytes that may be read.
+//
+static
+size_t
+PackBitsLiteralLength(
+    const uint8_t   *pData,
+    size_t          cbMax,
+    size_t          cbAvailable
+    )
+{
+    size_t length = 1;
+
+#if defined(TIFF_ENCODER_SSE2)
+    //
+    // Compare each byte with the two after it, 16 positions at a time
+    //
+    while (length < cbMax &&
+           length + 18 <= cbAvailable)
+    {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pData + length));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pData + length + 1));
+        __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pData + length + 2));
+        uint32_t triples = static_cast<uint32_t>(
+                                _mm_movemask_epi8(
+                                    _mm_and_si128(
+                                        _mm_cmpeq_epi8(b0, b1),
+                                        _mm_cmpeq_epi8(b1, b2)
+                                        )
+                                    )
+                                );
+
+        if (triples != 0)
+        {
+            length += CountTrailingZeros(triples);
+            return (length < cbMax) ? length : cbMax;
+        }
+
+        length += 16;
+    }
+
+    if (length >= cbMax)
+    {
+        return cbMax;
+    }
+#endif
+
+    while (length < cbMax &&
+           !(length + 2 < cbAvailable &&
+             pData[length] == pData[length + 1] &&
+             pData[length] == pData[length + 2]))
+    {
+        length++;
+    }
+
+    return length;
+}
+
+//
+//Routine Name:
+//
+//    PackBitsEncodeRow
+//
+//Routine Description:
+//
+//    PackBits-compress one row. Rows are compressed separately,
+//    as TIFF requires. pOut must have room for
+//    cbRow + (cbRow + 127) / 128 bytes.
+//
+static
+uint8_t*
+PackBitsEncodeRow(
+    const uint8_t   *pRow,
+    size_t          cbRow,
+    uint8_t         *pOut
+    )
+{
+    size_t i = 0;
+
+    while (i < cbRow)
+    {
+        size_t cbLeft = cbRow - i;
+        size_t cbMax = (cbLeft < PACKBITS_MAX_RUN) ? cbLeft : PACKBITS_MAX_RUN;
+        size_t run = PackBitsRunLength(pRow + i, cbMax);
+
+        if (run >= 3)
+        {
+            *pOut++ = static_cast<uint8_t>(1 - static_cast<int>(run));
+            *pOut++ = pRow[i];
+        }
+        else
+        {
+            run = PackBitsLiteralLength(pRow + i, cbMax, cbLeft);
+
+            *pOut++ = static_cast<uint8_t>(run - 1);
+            memcpy(pOut, pRow + i, run);
+            pOut += run;
+        }
+
+        i += run;
+    }
+
+    return pOut;
+}
+
+//
+//Routine Name:
+//
+//    PutShort, PutLong
+//
+//Routine Description:
+//
+//    Store little-endian values into the TIFF header.
+//
+static inline
+void
+PutShort(
+    uint8_t     *p,
+    uint16_t    value
+    )
+{
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static inline
+void
+PutLong(
+    uint8_t     *p,
+    uint32_t    value
+    )
+{
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+    p[2] = static_cast<uint8_t>(value >> 16);
+    p[3] = static_cast<uint8_t>(value >> 24);
+}
+
+//
+//Routine Name:
+//
+//    PutEntry
+//
+//Routine Description:
+//
+//    Store an IFD entry. valueOrOffset is the value itself if
+//    it fits in 4 bytes (left justified, for SHORTs), otherwise
+//    the offset of the value.
+//
+static
+void
+PutEntry(
+    uint8_t     *p,
+    uint16_t    tag,
+    uint16_t    type,
+    uint32_t    count,
+    uint32_t    valueOrOffset
+    )
+{
+    PutShort(p, tag);
+    PutShort(p + 2, type);
+    PutLong(p + 4, count);
+
+    if (type == TIFF_TYPE_SHORT &&
+        count == 1)
+    {
+        PutShort(p + 8, static_cast<uint16_t>(valueOrOffset));
+        PutShort(p + 10, 0);
+    }
+    else
+    {
+        PutLong(p + 8, valueOrOffset);
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::TiffBandEncoder
+//
+//Routine Description:
+//
+//    Construct an encoder. It may be used for any number
+//    of bands, one at a time.
+//
+//Arguments:
+//
+//    compression - compression scheme for the strips
+//
+TiffBandEncoder::TiffBandEncoder(
+    TiffCompression compression
+    ) : m_compression(compression),
+        m_layout(TIFF_SOURCE_PBGRA32),
+        m_width(0),
+        m_height(0),
+        m_samplesPerPixel(0),
+        m_rowSize(0),
+        m_xResolution(0),
+        m_yResolution(0),
+        m_rowsPerStrip(0),
+        m_rowsInStrip(0),
+        m_rowsEncoded(0),
+        m_stripStart(0),
+        m_cbStrips(0),
+        m_lzwGeneration(0),
+        m_lzwPrefix(-1),
+        m_lzwNextCode(LZW_CODE_FIRST),
+        m_lzwCodeBits(LZW_MIN_BITS),
+        m_lzwBitBuffer(0),
+        m_lzwBitCount(0)
+{
+    if (m_compression == TIFF_COMPRESSION_LZW)
+    {
+        LzwEntry empty = { 0, 0, 0 };
+
+        m_lzwTable.assign(static_cast<size_t>(1) << ms_lzwTableBits, empty);
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::BeginBand
+//
+//Routine Description:
+//
+//    Start encoding a new band, discarding the previous one.
+//
+//Arguments:
+//
+//    width   - width of the band in pixels
+//    height  - height of the band in rows
+//    layout  - layout of the source pixels
+//    xDPI    - horizontal resolution
+//    yDPI    - vertical resolution
+//
+void
+TiffBandEncoder::BeginBand(
+    uint32_t            width,
+    uint32_t            height,
+    TiffSourceLayout    layout,
+    double              xDPI,
+    double              yDPI
+    )
+{
+    m_samplesPerPixel = (layout == TIFF_SOURCE_BGRA32 ||
+                         layout == TIFF_SOURCE_PBGRA32) ? 4 : 3;
+
+    if (width == 0 ||
+        height == 0 ||
+        width > UINT32_MAX / 4 ||
+        xDPI <= 0 ||
+        yDPI <= 0)
+    {
+        throw std::invalid_argument("TiffBandEncoder::BeginBand");
+    }
+
+    m_layout = layout;
+    m_width = width;
+    m_height = height;
+    m_rowSize = width * m_samplesPerPixel;
+    m_xResolution = static_cast<uint32_t>(xDPI * 100 + 0.5);
+    m_yResolution = static_cast<uint32_t>(yDPI * 100 + 0.5);
+
+    m_rowsPerStrip = ms_targetStripSize / m_rowSize;
+
+    if (m_rowsPerStrip == 0)
+    {
+        m_rowsPerStrip = 1;
+    }
+    else if (m_rowsPerStrip > height)
+    {
+        m_rowsPerStrip = height;
+    }
+
+    m_rowsInStrip = 0;
+    m_rowsEncoded = 0;
+    m_cbStrips = 0;
+    m_stripByteCounts.clear();
+    m_header.clear();
+
+    if (m_row.size() < m_rowSize)
+    {
+        m_row.resize(m_rowSize);
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::EncodeRows
+//
+//Routine Description:
+//
+//    Convert and compress the next rows of the band.
+//
+//Arguments:
+//
+//    pRows   - first source row
+//    stride  - bytes from one source row to the next
+//    numRows - number of rows
+//
+void
+TiffBandEncoder::EncodeRows(
+    const uint8_t   *pRows,
+    size_t          stride,
+    uint32_t        numRows
+    )
+{
+    if (numRows > m_height - m_rowsEncoded)
+    {
+        throw std::invalid_argument("TiffBandEncoder::EncodeRows");
+    }
+
+    for (uint32_t row = 0; row < numRows; row++)
+    {
+        if (m_rowsInStrip == 0)
+        {
+            BeginStrip();
+        }
+
+        ConvertRow(pRows + row * stride);
+
+        switch (m_compression)
+        {
+            case TIFF_COMPRESSION_LZW:
+            {
+                uint8_t *pOut = ReserveStripBytes(m_rowSize * 2 + 16);
+
+                LzwEncode(&m_row[0], m_rowSize, pOut);
+
+                m_cbStrips = pOut - &m_strips[0];
+
+                break;
+            }
+
+            case TIFF_COMPRESSION_PACKBITS:
+            {
+                uint8_t *pOut = ReserveStripBytes(m_rowSize + (m_rowSize + 127) / 128);
+
+                pOut = PackBitsEncodeRow(&m_row[0], m_rowSize, pOut);
+
+                m_cbStrips = pOut - &m_strips[0];
+
+                break;
+            }
+
+            default:
+            {
+                uint8_t *pOut = ReserveStripBytes(m_rowSize);
+
+                memcpy(pOut, &m_row[0], m_rowSize);
+
+                m_cbStrips += m_rowSize;
+
+                break;
+            }
+        }
+
+        m_rowsEncoded++;
+
+        if (++m_rowsInStrip == m_rowsPerStrip ||
+            m_rowsEncoded == m_height)
+        {
+            EndStrip();
+        }
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::EndBand
+//
+//Routine Description:
+//
+//    Finish the band and build the TIFF header. All rows
+//    of the band must have been encoded.
+//
+void
+TiffBandEncoder::EndBand()
+{
+    if (m_rowsEncoded != m_height)
+    {
+        throw std::logic_error("TiffBandEncoder::EndBand");
+    }
+
+    BuildHeader();
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::GetTiffSize
+//
+//Routine Description:
+//
+//    Size of the encoded TIFF, once EndBand has been called.
+//
+uint64_t
+TiffBandEncoder::GetTiffSize() const
+{
+    return static_cast<uint64_t>(m_header.size()) + m_cbStrips;
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::WriteTiff
+//
+//Routine Description:
+//
+//    Write the encoded TIFF: the header, then the strips
+//    straight from the strip buffer.
+//
+//Arguments:
+//
+//    output  - destination
+//
+void
+TiffBandEncoder::WriteTiff(
+    TiffOutput &output
+    ) const
+{
+    output.Write(&m_header[0], m_header.size());
+
+    if (m_cbStrips > 0)
+    {
+        output.Write(&m_strips[0], m_cbStrips);
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::ConvertRow
+//
+//Routine Description:
+//
+//    Convert a source row to RGB(A) in m_row.
+//
+void
+TiffBandEncoder::ConvertRow(
+    const uint8_t *pSource
+    )
+{
+    uint8_t *pDest = &m_row[0];
+
+    switch (m_layout)
+    {
+        case TIFF_SOURCE_BGR24:
+
+            for (uint32_t x = 0; x < m_width; x++, pSource += 3, pDest += 3)
+            {
+                pDest[0] = pSource[2];
+                pDest[1] = pSource[1];
+                pDest[2] = pSource[0];
+            }
+
+            break;
+
+        case TIFF_SOURCE_BGRX32:
+
+            for (uint32_t x = 0; x < m_width; x++, pSource += 4, pDest += 3)
+            {
+                pDest[0] = pSource[2];
+                pDest[1] = pSource[1];
+                pDest[2] = pSource[0];
+            }
+
+            break;
+
+        default:
+
+            //
+            // Swap B and R in each 32 bit pixel
+            //
+            for (uint32_t x = 0; x < m_width; x++, pSource += 4, pDest += 4)
+            {
+                pDest[0] = pSource[2];
+                pDest[1] = pSource[1];
+                pDest[2] = pSource[0];
+                pDest[3] = pSource[3];
+            }
+
+            break;
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::BeginStrip, EndStrip
+//
+//Routine Description:
+//
+//    Start and finish a strip. Each strip is compressed
+//    on its own, as TIFF requires.
+//
+void
+TiffBandEncoder::BeginStrip()
+{
+    m_stripStart = m_cbStrips;
+
+    if (m_compression == TIFF_COMPRESSION_LZW)
+    {
+        uint8_t *pOut = ReserveStripBytes(4);
+
+        LzwBegin(pOut);
+
+        m_cbStrips = pOut - &m_strips[0];
+    }
+}
+
+void
+TiffBandEncoder::EndStrip()
+{
+    if (m_compression == TIFF_COMPRESSION_LZW)
+    {
+        uint8_t *pOut = ReserveStripBytes(16);
+
+        LzwEnd(pOut);
+
+        m_cbStrips = pOut - &m_strips[0];
+    }
+
+    size_t cbStrip = m_cbStrips - m_stripStart;
+
+    if (m_cbStrips > UINT32_MAX)
+    {
+        throw std::length_error("TiffBandEncoder::EndStrip");
+    }
+
+    m_stripByteCounts.push_back(static_cast<uint32_t>(cbStrip));
+    m_rowsInStrip = 0;
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::ReserveStripBytes
+//
+//Routine Description:
+//
+//    Make room for cbNeeded more bytes in the strip buffer.
+//
+//Return Value:
+//
+//    Pointer to the first free byte of the strip buffer.
+//
+uint8_t*
+TiffBandEncoder::ReserveStripBytes(
+    size_t cbNeeded
+    )
+{
+    if (m_strips.size() - m_cbStrips < cbNeeded)
+    {
+        size_t cbNew = m_strips.size() * 2;
+
+        if (cbNew < m_cbStrips + cbNeeded)
+        {
+            cbNew = m_cbStrips + cbNeeded;
+        }
+
+        m_strips.resize(cbNew);
+    }
+
+    return &m_strips[0] + m_cbStrips;
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::LzwBegin
+//
+//Routine Description:
+//
+//    Start an LZW-compressed strip: reset the string table
+//    and emit a clear code.
+//
+void
+TiffBandEncoder::LzwBegin(
+    uint8_t *&pOut
+    )
+{
+    LzwResetTable();
+
+    m_lzwPrefix = -1;
+    m_lzwBitBuffer = 0;
+    m_lzwBitCount = 0;
+
+    LzwPutCode(LZW_CODE_CLEAR, pOut);
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::LzwEncode
+//
+//Routine Description:
+//
+//    LZW-compress bytes into the current strip. pOut must have
+//    room for 2 bytes per input byte, plus a few.
+//
+//    Code widths follow the TIFF ("early change") convention: the
+//    width grows as soon as the next code to be assigned no longer
+//    fits, one code before the decoder needs it.
+//
+void
+TiffBandEncoder::LzwEncode(
+    const uint8_t   *pData,
+    size_t          cbData,
+    uint8_t         *&pOut
+    )
+{
+    const uint32_t mask = (1u << ms_lzwTableBits) - 1;
+    LzwEntry *pTable = &m_lzwTable[0];
+    size_t i = 0;
+
+    if (cbData == 0)
+    {
+        return;
+    }
+
+    if (m_lzwPrefix < 0)
+    {
+        m_lzwPrefix = pData[0];
+        i = 1;
+    }
+
+    uint32_t prefix = static_cast<uint32_t>(m_lzwPrefix);
+
+    for (; i < cbData; i++)
+    {
+        uint32_t key = (prefix << 8) | pData[i];
+        uint32_t slot = (key * 2654435761u) >> (32 - ms_lzwTableBits);
+
+        for (;;)
+        {
+            LzwEntry *pEntry = pTable + slot;
+
+            if (pEntry->generation != m_lzwGeneration)
+            {
+                //
+                // New string: emit its prefix and give it a code
+                //
+                LzwPutCode(prefix, pOut);
+
+                pEntry->key = key;
+                pEntry->code = static_cast<uint16_t>(m_lzwNextCode);
+                pEntry->generation = m_lzwGeneration;
+
+                m_lzwNextCode++;
+
+                if (m_lzwNextCode == LZW_CODE_LIMIT)
+                {
+                    LzwPutCode(LZW_CODE_CLEAR, pOut);
+                    LzwResetTable();
+                }
+                else if (m_lzwNextCode > (1u << m_lzwCodeBits) - 1)
+                {
+                    m_lzwCodeBits++;
+                }
+
+                prefix = pData[i];
+                break;
+            }
+
+            if (pEntry->key == key)
+            {
+                prefix = pEntry->code;
+                break;
+            }
+
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    m_lzwPrefix = static_cast<int32_t>(prefix);
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::LzwEnd
+//
+//Routine Description:
+//
+//    Finish an LZW-compressed strip: emit the pending string
+//    and an end-of-information code, and pad to a byte.
+//
+void
+TiffBandEncoder::LzwEnd(
+    uint8_t *&pOut
+    )
+{
+    if (m_lzwPrefix >= 0)
+    {
+        LzwPutCode(static_cast<uint32_t>(m_lzwPrefix), pOut);
+
+        //
+        // The decoder adds a table entry for this code too, and
+        // may widen its codes before reading the EOI
+        //
+        m_lzwNextCode++;
+
+        if (m_lzwNextCode == LZW_CODE_LIMIT)
+        {
+            LzwPutCode(LZW_CODE_CLEAR, pOut);
+            m_lzwCodeBits = LZW_MIN_BITS;
+        }
+        else if (m_lzwNextCode > (1u << m_lzwCodeBits) - 1)
+        {
+            m_lzwCodeBits++;
+        }
+
+        m_lzwPrefix = -1;
+    }
+
+    LzwPutCode(LZW_CODE_EOI, pOut);
+
+    if (m_lzwBitCount > 0)
+    {
+        *pOut++ = static_cast<uint8_t>(m_lzwBitBuffer << (8 - m_lzwBitCount));
+        m_lzwBitCount = 0;
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::LzwPutCode
+//
+//Routine Description:
+//
+//    Append a code of the current width, most significant
+//    bit first.
+//
+inline
+void
+TiffBandEncoder::LzwPutCode(
+    uint32_t    code,
+    uint8_t     *&pOut
+    )
+{
+    m_lzwBitBuffer = (m_lzwBitBuffer << m_lzwCodeBits) | code;
+    m_lzwBitCount += m_lzwCodeBits;
+
+    while (m_lzwBitCount >= 8)
+    {
+        m_lzwBitCount -= 8;
+        *pOut++ = static_cast<uint8_t>(m_lzwBitBuffer >> m_lzwBitCount);
+    }
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::LzwResetTable
+//
+//Routine Description:
+//
+//    Empty the string table and go back to 9 bit codes.
+//
+void
+TiffBandEncoder::LzwResetTable()
+{
+    m_lzwGeneration++;
+
+    if (m_lzwGeneration == 0)
+    {
+        //
+        // The generation wrapped; really clear the table once
+        //
+        LzwEntry empty = { 0, 0, 0 };
+
+        m_lzwTable.assign(m_lzwTable.size(), empty);
+        m_lzwGeneration = 1;
+    }
+
+    m_lzwNextCode = LZW_CODE_FIRST;
+    m_lzwCodeBits = LZW_MIN_BITS;
+}
+
+//
+//Routine Name:
+//
+//    TiffBandEncoder::BuildHeader
+//
+//Routine Description:
+//
+//    Build the TIFF header, IFD and tag data that go in
+//    front of the strips.
+//
+void
+TiffBandEncoder::BuildHeader()
+{
+    const uint32_t numStrips = static_cast<uint32_t>(m_stripByteCounts.size());
+    const uint32_t numEntries = (m_samplesPerPixel == 4) ? 14 : 13;
+
+    //
+    // Tag data that does not fit in its IFD entry
+    //
+    const size_t ifdOffset          = TIFF_HEADER_SIZE;
+    const size_t bitsPerSampleOffset = ifdOffset + 2 + numEntries * TIFF_IFD_ENTRY_SIZE + 4;
+    const size_t stripOffsetsOffset = bitsPerSampleOffset + 2 * m_samplesPerPixel;
+    const size_t byteCountsOffset   = stripOffsetsOffset + ((numStrips > 1) ? 4 * numStrips : 0);
+    const size_t xResolutionOffset  = byteCountsOffset + ((numStrips > 1) ? 4 * numStrips : 0);
+    const size_t yResolutionOffset  = xResolutionOffset + 8;
+    const size_t headerSize         = yResolutionOffset + 8;
+
+    if (headerSize + m_cbStrips > UINT32_MAX)
+    {
+        throw std::length_error("TiffBandEncoder::BuildHeader");
+    }
+
+    m_header.assign(headerSize, 0);
+
+    uint8_t *p = &m_header[0];
+
+    //
+    // Little-endian header
+    //
+    p[0] = 'I';
+    p[1] = 'I';
+    PutShort(p + 2, 42);
+    PutLong(p + 4, static_cast<uint32_t>(ifdOffset));
+
+    //
+    // IFD entries, in ascending tag order
+    //
+    uint8_t *pEntry = p + ifdOffset + 2;
+
+    PutShort(p + ifdOffset, static_cast<uint16_t>(numEntries));
+
+    PutEntry(pEntry, TIFF_TAG_IMAGE_WIDTH, TIFF_TYPE_LONG, 1, m_width);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_IMAGE_LENGTH, TIFF_TYPE_LONG, 1, m_height);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_BITS_PER_SAMPLE, TIFF_TYPE_SHORT, m_samplesPerPixel, static_cast<uint32_t>(bitsPerSampleOffset));
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_COMPRESSION, TIFF_TYPE_SHORT, 1, static_cast<uint32_t>(m_compression));
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_PHOTOMETRIC, TIFF_TYPE_SHORT, 1, TIFF_PHOTOMETRIC_RGB);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_STRIP_OFFSETS, TIFF_TYPE_LONG, numStrips,
+             (numStrips > 1) ? static_cast<uint32_t>(stripOffsetsOffset) : static_cast<uint32_t>(headerSize));
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_SAMPLES_PER_PIXEL, TIFF_TYPE_SHORT, 1, m_samplesPerPixel);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_ROWS_PER_STRIP, TIFF_TYPE_LONG, 1, m_rowsPerStrip);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_STRIP_BYTE_COUNTS, TIFF_TYPE_LONG, numStrips,
+             (numStrips > 1) ? static_cast<uint32_t>(byteCountsOffset) : m_stripByteCounts[0]);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_X_RESOLUTION, TIFF_TYPE_RATIONAL, 1, static_cast<uint32_t>(xResolutionOffset));
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_Y_RESOLUTION, TIFF_TYPE_RATIONAL, 1, static_cast<uint32_t>(yResolutionOffset));
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_PLANAR_CONFIG, TIFF_TYPE_SHORT, 1, TIFF_PLANAR_CONTIG);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    PutEntry(pEntry, TIFF_TAG_RESOLUTION_UNIT, TIFF_TYPE_SHORT, 1, TIFF_RESUNIT_INCH);
+    pEntry += TIFF_IFD_ENTRY_SIZE;
+
+    if (m_samplesPerPixel == 4)
+    {
+        PutEntry(pEntry, TIFF_TAG_EXTRA_SAMPLES, TIFF_TYPE_SHORT, 1,
+                 (m_layout == TIFF_SOURCE_PBGRA32) ? TIFF_EXTRA_ASSOCIATED_ALPHA : TIFF_EXTRA_UNASSOCIATED_ALPHA);
+        pEntry += TIFF_IFD_ENTRY_SIZE;
+    }
+
+    //
+    // No further IFDs
+    //
+    PutLong(pEntry, 0);
+
+    //
+    // Tag data
+    //
+    for (uint32_t i = 0; i < m_samplesPerPixel; i++)
+    {
+        PutShort(p + bitsPerSampleOffset + 2 * i, 8);
+    }
+
+    if (numStrips > 1)
+    {
+        uint32_t stripOffset = static_cast<uint32_t>(headerSize);
+
+        for (uint32_t i = 0; i < numStrips; i++)
+        {
+            PutLong(p + stripOffsetsOffset + 4 * i, stripOffset);
+            PutLong(p + byteCountsOffset + 4 * i, m_stripByteCounts[i]);
+
+            stripOffset += m_stripByteCounts[i];
+        }
+    }
+
+    PutLong(p + xResolutionOffset, m_xResolution);
+    PutLong(p + xResolutionOffset + 4, 100);
+    PutLong(p + yResolutionOffset, m_yResolution);
+    PutLong(p + yResolutionOffset + 4, 100);
+}
+
+} // namespace xpsrasfilter
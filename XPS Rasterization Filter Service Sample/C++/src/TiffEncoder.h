@@ -0,0 +1,214 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+//
+// File Name:
+//
+//    TiffEncoder.h
+//
+// Abstract:
+//
+//    Self-contained encoder that writes a band of BGR(A) pixels as a
+//    single-image, strip-organized RGB(A) TIFF, compressed with LZW or
+//    PackBits. It depends only on the C++ standard library so that it
+//    can be built and exercised outside of the filter.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace xpsrasfilter
+{
+
+//
+// Supported TIFF compression schemes (values of the Compression tag)
+//
+enum TiffCompression
+{
+    TIFF_COMPRESSION_NONE       = 1,
+    TIFF_COMPRESSION_LZW        = 5,
+    TIFF_COMPRESSION_PACKBITS   = 32773
+};
+
+//
+// Supported source pixel layouts. All are stored as RGB(A) in the TIFF.
+//
+enum TiffSourceLayout
+{
+    TIFF_SOURCE_BGR24,          // 3 bytes per pixel
+    TIFF_SOURCE_BGRX32,         // 4 bytes per pixel, 4th byte ignored
+    TIFF_SOURCE_BGRA32,         // 4 bytes per pixel, straight alpha
+    TIFF_SOURCE_PBGRA32         // 4 bytes per pixel, premultiplied alpha
+};
+
+//
+// Destination for an encoded TIFF
+//
+class TiffOutput
+{
+public:
+    virtual
+    ~TiffOutput() {}
+
+    virtual
+    void
+    Write(
+        const uint8_t   *pData,
+        size_t          cbData
+        ) = 0;
+};
+
+class TiffBandEncoder
+{
+public:
+
+    explicit
+    TiffBandEncoder(
+        TiffCompression compression
+        );
+
+    void
+    BeginBand(
+        uint32_t            width,
+        uint32_t            height,
+        TiffSourceLayout    layout,
+        double              xDPI,
+        double              yDPI
+        );
+
+    void
+    EncodeRows(
+        const uint8_t   *pRows,
+        size_t          stride,
+        uint32_t        numRows
+        );
+
+    void
+    EndBand();
+
+    uint64_t
+    GetTiffSize() const;
+
+    void
+    WriteTiff(
+        TiffOutput &output
+        ) const;
+
+    //
+    // Target size of a strip before compression
+    //
+    const static uint32_t ms_targetStripSize = 64 * 1024;
+
+private:
+
+    //
+    // prevent copy semantics
+    //
+    TiffBandEncoder(const TiffBandEncoder&);
+    TiffBandEncoder& operator=(const TiffBandEncoder&);
+
+    void
+    ConvertRow(
+        const uint8_t *pSource
+        );
+
+    void
+    BeginStrip();
+
+    void
+    EndStrip();
+
+    uint8_t*
+    ReserveStripBytes(
+        size_t cbNeeded
+        );
+
+    void
+    LzwBegin(
+        uint8_t *&pOut
+        );
+
+    void
+    LzwEncode(
+        const uint8_t       *pData,
+        size_t              cbData,
+        uint8_t             *&pOut
+        );
+
+    void
+    LzwEnd(
+        uint8_t *&pOut
+        );
+
+    void
+    LzwPutCode(
+        uint32_t            code,
+        uint8_t             *&pOut
+        );
+
+    void
+    LzwResetTable();
+
+    void
+    BuildHeader();
+
+    //
+    // Band format
+    //
+    TiffCompression     m_compression;
+    TiffSourceLayout    m_layout;
+    uint32_t            m_width;
+    uint32_t            m_height;
+    uint32_t            m_samplesPerPixel;
+    uint32_t            m_rowSize;          // bytes per converted (RGB(A)) row
+    uint32_t            m_xResolution;      // in 1/100 dpi
+    uint32_t            m_yResolution;
+
+    //
+    // Encode progress
+    //
+    uint32_t            m_rowsPerStrip;
+    uint32_t            m_rowsInStrip;
+    uint32_t            m_rowsEncoded;
+    size_t              m_stripStart;       // offset of the current strip in m_strips
+
+    //
+    // Buffers. These keep their capacity from band to band, so after
+    // the first few bands encoding does not allocate.
+    //
+    std::vector<uint8_t>    m_row;              // current row, converted to RGB(A)
+    std::vector<uint8_t>    m_strips;           // compressed strips, back to back
+    size_t                  m_cbStrips;         // bytes of m_strips in use
+    std::vector<uint32_t>   m_stripByteCounts;
+    std::vector<uint8_t>    m_header;           // TIFF header, IFD and tag data
+
+    //
+    // LZW state. Strings are looked up by (prefix code, next byte) in
+    // an open-addressed hash table; resetting the table bumps the
+    // generation instead of clearing it.
+    //
+    struct LzwEntry
+    {
+        uint32_t    key;            // (prefix code << 8) | byte
+        uint16_t    code;
+        uint16_t    generation;
+    };
+
+    const static uint32_t ms_lzwTableBits = 14;
+
+    std::vector<LzwEntry>   m_lzwTable;
+    uint16_t                m_lzwGeneration;
+    int32_t                 m_lzwPrefix;        // code of the current string, or -1
+    uint32_t                m_lzwNextCode;
+    uint32_t                m_lzwCodeBits;
+    uint32_t                m_lzwBitBuffer;
+    uint32_t                m_lzwBitCount;
+};
+
+} // namespace xpsrasfilter
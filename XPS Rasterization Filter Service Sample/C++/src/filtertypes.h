@@ -79,6 +79,8 @@ typedef CComPtr<IWICBitmap>                                 IWICBitmap_t;
 typedef CComPtr<IWICStream>                                 IWICStream_t;
 typedef CComPtr<IWICBitmapEncoder>                          IWICBitmapEncoder_t;
 typedef CComPtr<IWICBitmapFrameEncode>                      IWICBitmapFrameEncode_t;
+typedef CComPtr<IWICBitmapLock>                             IWICBitmapLock_t;
+typedef CComPtr<IWICFormatConverter>                        IWICFormatConverter_t;
 
 //
 // Xps Rasterization Service types
@@ -131,12 +133,38 @@ struct ParametersFromFixedPage
     XPS_RECT    contentBoxRect;     // in XPS units
 };
 
+//
+// Time spent in each stage of band processing, in performance
+// counter ticks, accumulated over the whole job.
+//
+struct BandTimings
+{
+    ULONGLONG   numBands;
+    ULONGLONG   rasterizeTicks;     // rasterizing bands
+    ULONGLONG   encodeTicks;        // encoding bands, summed over all encode threads
+    ULONGLONG   writeTicks;         // writing encoded bands to the output stream
+    ULONGLONG   waitTicks;          // rasterizing thread waiting on encode threads
+};
+
+inline
+ULONGLONG
+QueryTicks()
+{
+    LARGE_INTEGER ticks;
+
+    ::QueryPerformanceCounter(&ticks);
+
+    return ticks.QuadPart;
+}
+
 //
 // Forward Declarations
 //
 class RasterizationInterface;
 class PrintTicketHandler;
 class TiffStreamBitmapHandler;
+class BandPipeline;
+class TiffBandEncoder;
 class FilterLiveness;
 
 } // namespace xpsrasfilter
@@ -491,6 +519,8 @@ private:
 typedef std::auto_ptr<xpsrasfilter::RasterizationInterface>     RasterizationInterface_t;
 typedef std::auto_ptr<xpsrasfilter::PrintTicketHandler>         PrintTicketHandler_t;
 typedef std::auto_ptr<xpsrasfilter::TiffStreamBitmapHandler>    TiffStreamBitmapHandler_t;
+typedef std::auto_ptr<xpsrasfilter::BandPipeline>               BandPipeline_t;
+typedef std::auto_ptr<xpsrasfilter::TiffBandEncoder>            TiffBandEncoder_t;
 typedef std::auto_ptr<SafeHGlobal>                              SafeHGlobal_t;
 typedef std::auto_ptr<SafeHPTProvider>                          SafeHPTProvider_t;
 typedef CComPtr<xpsrasfilter::FilterLiveness>                   FilterLiveness_t;
@@ -25,6 +25,7 @@
 #include "OMConvertor.h"
 #include "rasinterface.h"
 #include "BitmapHandler.h"
+#include "BandPipeline.h"
 
 #include "rasinterface.tmh"
 
@@ -107,7 +108,8 @@ RasterizationInterface::CreateRasterizationInterface(
 //
 //    Construct the Rasterization Interface with the
 //    IXpsRasterizationFactory interface and bitmap
-//    handler.
+//    handler, and start the band pipeline that feeds
+//    the bitmap handler.
 //
 //Arguments:
 //
@@ -120,6 +122,12 @@ RasterizationInterface::RasterizationInterface(
         ) : m_pXPSRasFactory(pRasFactory), 
             m_pBitmapHandler(pBitmapHandler)
 {
+    ::ZeroMemory(&m_timings, sizeof(m_timings));
+
+    m_pBandPipeline = BandPipeline::CreateBandPipeline(
+                                        m_pBitmapHandler.get(),
+                                        &m_timings
+                                        );
 }
 
 //
@@ -139,9 +147,66 @@ RasterizationInterface::RasterizationInterface(
 void
 RasterizationInterface::FinishRasterization()
 {
+    //
+    // Write the bands that are still in the pipeline
+    //
+    m_pBandPipeline->Flush();
+
+    TraceBandTimings();
+
     m_pBitmapHandler->WriteFooter();
 }
 
+//
+//Routine Name:
+//
+//    RasterizationInterface::TraceBandTimings
+//
+//Routine Description:
+//
+//    Trace how long each stage of band processing took
+//    over the whole job, for tuning the band size and
+//    the number of encode threads.
+//
+//    Encode time is summed over all encode threads, so
+//    it can exceed the elapsed time. Wait time is the
+//    time the rasterizing thread spent waiting for the
+//    encode threads; if it is large, the encode threads
+//    are the bottleneck.
+//
+//Arguments:
+//
+//    None
+//
+void
+RasterizationInterface::TraceBandTimings()
+{
+    LARGE_INTEGER frequency;
+
+    if (!::QueryPerformanceFrequency(&frequency) ||
+        frequency.QuadPart == 0)
+    {
+        return;
+    }
+
+    ULONGLONG ticksPerMs = static_cast<ULONGLONG>(frequency.QuadPart / 1000);
+
+    if (ticksPerMs == 0)
+    {
+        ticksPerMs = 1;
+    }
+
+    DoTraceMessage(
+        XPSRASFILTER_TRACE_INFO,
+        L"Band timings: %I64u bands, rasterize %I64u ms, encode %I64u ms, write %I64u ms, wait %I64u ms",
+        m_timings.numBands,
+        m_timings.rasterizeTicks / ticksPerMs,
+        m_timings.encodeTicks / ticksPerMs,
+        m_timings.writeTicks / ticksPerMs,
+        m_timings.waitTicks / ticksPerMs
+        );
+}
+
 
 //
 //Routine Name:
@@ -232,6 +297,8 @@ RasterizationInterface::RasterizePage(
         // Rasterize this band
         //
         {
+            ULONGLONG startTicks = QueryTicks();
+
             HRESULT hr = rasterizer->RasterizeRect(
                             rastParams.originX,
                             bandOriginY + rastParams.originY,
@@ -241,6 +308,8 @@ RasterizationInterface::RasterizePage(
                             &bitmap
                             );
 
+            m_timings.rasterizeTicks += QueryTicks() - startTicks;
+
             //
             // Do not throw if we have cancelled rasterization
             //
@@ -268,9 +337,10 @@ RasterizationInterface::RasterizePage(
             );
 
         //
-        // Encode the raster data as TIFF and stream out
+        // Queue the band to be encoded as TIFF and streamed out.
+        // The next band is rasterized while this one is encoded.
         //
-        m_pBitmapHandler->ProcessBitmap(bitmap);
+        m_pBandPipeline->SubmitBand(bitmap);
     }
 }
 
@@ -68,6 +68,9 @@ private:
     RasterizationInterface(const RasterizationInterface&);
     RasterizationInterface& operator=(const RasterizationInterface&);
 
+    void
+    TraceBandTimings();
+
     //
     // Internal data members
     //
@@ -81,6 +84,18 @@ private:
     // Bitmap Handler
     //
     TiffStreamBitmapHandler_t m_pBitmapHandler;
+
+    //
+    // Per-stage times for all bands so far
+    //
+    BandTimings m_timings;
+
+    //
+    // Encodes bands in the background and writes them to the
+    // bitmap handler in order. Declared after the bitmap handler
+    // and timings so that it is destroyed before them.
+    //
+    BandPipeline_t m_pBandPipeline;
 };
 
 //
@@ -22,6 +22,7 @@
 #include "OMConvertor.h"
 #include "rasinterface.h"
 #include "BitmapHandler.h"
+#include "BandPipeline.h"
 #include "PThandler.h"
 #include "xpsrasfilter.h"
 
@@ -0,0 +1,668 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   lutest.cpp
+
+Abstract:
+
+   Host test and benchmark of the color filter look-up tables. The color
+   filter's colorlut.cpp is built unchanged against the stand-ins in shim/.
+   TranslateBitmapBits is implemented here by transforms with a known result,
+   so that tables can be checked against converting each pixel directly.
+
+   usage: lutest --selftest
+          lutest [--seconds s]
+
+   For every pair of formats the tables handle, and for a transform that is
+   linear in each channel and one that is not, the self test checks that
+   grid nodes convert exactly, that other colors are within 1 (linear) or 3
+   (non-linear) levels of the direct conversion, and that scanline strides
+   are honored. It also checks the table cache: tables are reused by key,
+   the least recently used one is dropped when the cache is full, failures
+   are not cached, and unsupported formats are refused.
+
+   Without --selftest, it reports millions of pixels per second converted by
+   the table for each source format.
+
+Environment:
+
+   Host (user mode), C++11.
+
+--*/
+
+#include "precomp.h"
+#include "debug.h"
+#include "globals.h"
+#include "xdstring.h"
+#include "colorlut.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+static int g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if (!(X))                                                               \
+    {                                                                       \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+/*
+A transform that TranslateBitmapBits below applies. Channels are taken in
+memory order; for 4 channel sources the black channel is kept apart.
+*/
+enum TransformKind
+{
+    TRANSFORM_LINEAR,       // linear in each channel, so the table is exact up to rounding
+    TRANSFORM_GAMMA,        // mixes channels and applies a 2.2 power
+    TRANSFORM_FAIL          // TranslateBitmapBits fails
+};
+
+struct HostTransform
+{
+    TransformKind kind;
+
+    ULONG         cCalls;
+};
+
+struct FormatInfo
+{
+    BMFORMAT    bmFormat;
+    const char* pszName;
+    UINT        cChannels;
+    UINT        cbPixel;
+    BOOL        bWord;
+    UINT        cBlack;
+};
+
+static CONST FormatInfo g_formats[] = {
+    {BM_RGBTRIPLETS, "RGBTRIPLETS", 3, 3, FALSE, 0},
+    {BM_BGRTRIPLETS, "BGRTRIPLETS", 3, 3, FALSE, 0},
+    {BM_xRGBQUADS,   "xRGBQUADS",   3, 4, FALSE, 0},
+    {BM_xBGRQUADS,   "xBGRQUADS",   3, 4, FALSE, 0},
+    {BM_CMYKQUADS,   "CMYKQUADS",   4, 4, FALSE, 3},
+    {BM_KYMCQUADS,   "KYMCQUADS",   4, 4, FALSE, 0},
+    {BM_16b_RGB,     "16b_RGB",     3, 6, TRUE,  0}
+};
+
+static CONST FormatInfo*
+FindFormat(
+    BMFORMAT bmFormat
+    )
+{
+    for (UINT cFormat = 0; cFormat < ARRAYSIZE(g_formats); cFormat++)
+    {
+        if (g_formats[cFormat].bmFormat == bmFormat)
+        {
+            return &g_formats[cFormat];
+        }
+    }
+
+    return NULL;
+}
+
+static double
+ReadChannel(
+    CONST FormatInfo* pFormat,
+    CONST BYTE*       pPixel,
+    UINT              cChan
+    )
+{
+    if (pFormat->bWord)
+    {
+        WORD wValue;
+
+        memcpy(&wValue, pPixel + 2 * cChan, sizeof(wValue));
+
+        return wValue / 65535.0;
+    }
+
+    return pPixel[cChan] / 255.0;
+}
+
+static VOID
+WriteChannel(
+    CONST FormatInfo* pFormat,
+    BYTE*             pPixel,
+    UINT              cChan,
+    double            fValue
+    )
+{
+    fValue = fValue < 0 ? 0 : (fValue > 1 ? 1 : fValue);
+
+    if (pFormat->bWord)
+    {
+        WORD wValue = static_cast<WORD>(fValue * 65535.0 + 0.5);
+
+        memcpy(pPixel + 2 * cChan, &wValue, sizeof(wValue));
+    }
+    else
+    {
+        pPixel[cChan] = static_cast<BYTE>(fValue * 255.0 + 0.5);
+    }
+}
+
+/*
+Applies a HostTransform to one pixel. Channels other than black are c[0..2]
+in memory order.
+*/
+static VOID
+TransformPixel(
+    TransformKind     kind,
+    CONST FormatInfo* pSrc,
+    CONST BYTE*       pSrcPixel,
+    CONST FormatInfo* pDst,
+    BYTE*             pDstPixel
+    )
+{
+    double rgColor[3] = {0, 0, 0};
+    double fBlack = 0;
+    UINT   cColor = 0;
+
+    for (UINT cChan = 0; cChan < pSrc->cChannels; cChan++)
+    {
+        if (pSrc->cChannels == 4 && cChan == pSrc->cBlack)
+        {
+            fBlack = ReadChannel(pSrc, pSrcPixel, cChan);
+        }
+        else
+        {
+            rgColor[cColor++] = ReadChannel(pSrc, pSrcPixel, cChan);
+        }
+    }
+
+    //
+    // Take a 4 channel source to additive values, scaled by the black
+    // channel, and a 3 channel source to subtractive values for a 4
+    // channel destination
+    //
+    double rgOut[4];
+
+    for (UINT cChan = 0; cChan < 3; cChan++)
+    {
+        double fValue = rgColor[cChan];
+
+        if (kind == TRANSFORM_GAMMA)
+        {
+            fValue = pow(0.7 * rgColor[cChan] + 0.3 * rgColor[(cChan + 1) % 3], 2.2);
+        }
+
+        if (pSrc->cChannels == 4 && pDst->cChannels == 3)
+        {
+            fValue = (1 - fValue) * (1 - fBlack);
+        }
+        else if (pSrc->cChannels == 3 && pDst->cChannels == 4)
+        {
+            fValue = 1 - fValue;
+        }
+
+        rgOut[cChan] = fValue;
+    }
+
+    rgOut[3] = (pSrc->cChannels == 4) ? fBlack : 0;
+
+    //
+    // A 4 channel destination has black where its format puts it
+    //
+    for (UINT cChan = 0, cColorOut = 0; cChan < pDst->cChannels; cChan++)
+    {
+        if (pDst->cChannels == 4 && cChan == pDst->cBlack)
+        {
+            WriteChannel(pDst, pDstPixel, cChan, rgOut[3]);
+        }
+        else
+        {
+            WriteChannel(pDst, pDstPixel, cChan, rgOut[cColorOut++]);
+        }
+    }
+}
+
+BOOL
+TranslateBitmapBits(
+    HTRANSFORM      hColorTransform,
+    PVOID           pSrcBits,
+    BMFORMAT        bmInput,
+    DWORD           dwWidth,
+    DWORD           dwHeight,
+    DWORD           dwInputStride,
+    PVOID           pDestBits,
+    BMFORMAT        bmOutput,
+    DWORD           dwOutputStride,
+    PBMCALLBACKFN   ,
+    LPARAM
+    )
+{
+    HostTransform*    pTransform = static_cast<HostTransform*>(hColorTransform);
+    CONST FormatInfo* pSrc = FindFormat(bmInput);
+    CONST FormatInfo* pDst = FindFormat(bmOutput);
+
+    pTransform->cCalls++;
+
+    if (pTransform->kind == TRANSFORM_FAIL ||
+        pSrc == NULL ||
+        pDst == NULL)
+    {
+        return FALSE;
+    }
+
+    if (dwInputStride == 0)
+    {
+        dwInputStride = dwWidth * pSrc->cbPixel;
+    }
+
+    if (dwOutputStride == 0)
+    {
+        dwOutputStride = dwWidth * pDst->cbPixel;
+    }
+
+    for (DWORD y = 0; y < dwHeight; y++)
+    {
+        for (DWORD x = 0; x < dwWidth; x++)
+        {
+            TransformPixel(pTransform->kind,
+                           pSrc,
+                           static_cast<CONST BYTE*>(pSrcBits) + y * dwInputStride + x * pSrc->cbPixel,
+                           pDst,
+                           static_cast<BYTE*>(pDestBits) + y * dwOutputStride + x * pDst->cbPixel);
+        }
+    }
+
+    return TRUE;
+}
+
+static uint32_t
+NextRandom(
+    uint32_t* pSeed
+    )
+{
+    *pSeed ^= *pSeed << 13;
+    *pSeed ^= *pSeed >> 17;
+    *pSeed ^= *pSeed << 5;
+    return *pSeed;
+}
+
+/*
+Largest difference between two pixels of a format, in levels of that format
+*/
+static UINT
+PixelDifference(
+    CONST FormatInfo* pFormat,
+    CONST BYTE*       pA,
+    CONST BYTE*       pB
+    )
+{
+    UINT cMax = 0;
+
+    for (UINT cChan = 0; cChan < pFormat->cChannels; cChan++)
+    {
+        INT iA;
+        INT iB;
+
+        if (pFormat->bWord)
+        {
+            WORD wA;
+            WORD wB;
+
+            memcpy(&wA, pA + 2 * cChan, sizeof(wA));
+            memcpy(&wB, pB + 2 * cChan, sizeof(wB));
+
+            iA = wA;
+            iB = wB;
+        }
+        else
+        {
+            iA = pA[cChan];
+            iB = pB[cChan];
+        }
+
+        UINT cDiff = static_cast<UINT>(iA > iB ? iA - iB : iB - iA);
+
+        if (cDiff > cMax)
+        {
+            cMax = cDiff;
+        }
+    }
+
+    return cMax;
+}
+
+/*
+Converts a block of pixels with a table built for the pair of formats, and
+directly, and checks the table against the direct conversion
+*/
+static VOID
+CheckFormats(
+    TransformKind     kind,
+    CONST FormatInfo* pSrc,
+    CONST FormatInfo* pDst,
+    uint32_t*         pSeed
+    )
+{
+    HostTransform transform = {kind, 0};
+    CColorLUT     lut;
+
+    HRESULT hr = lut.Initialize(&transform, pSrc->bmFormat, pDst->bmFormat);
+
+    CHECK(hr == S_OK);
+    CHECK(transform.cCalls == 1);
+
+    if (hr != S_OK)
+    {
+        return;
+    }
+
+    //
+    // Grid nodes, then random colors, then colors along the grey axis.
+    // Rows are padded to a DWORD boundary and beyond, as bitmap scanlines
+    // are, and the padding must survive.
+    //
+    CONST UINT cGridPoints = pSrc->cChannels == 4 ? 16 : 18;
+    CONST UINT cMaxValue   = pSrc->bWord ? 0xFFFF : 0xFF;
+    CONST UINT cWidth      = 257;
+    CONST UINT cHeight     = 24;
+    CONST UINT cbSrcStride = ((cWidth * pSrc->cbPixel + 3) & ~3u) + 4;
+    CONST UINT cbDstStride = ((cWidth * pDst->cbPixel + 3) & ~3u) + 8;
+
+    vector<BYTE> src(cbSrcStride * cHeight, 0);
+    vector<BYTE> dst(cbDstStride * cHeight, 0xA5);
+    vector<BYTE> ref(cbDstStride * cHeight, 0xA5);
+
+    for (UINT y = 0; y < cHeight; y++)
+    {
+        for (UINT x = 0; x < cWidth; x++)
+        {
+            BYTE* pPixel = &src[y * cbSrcStride + x * pSrc->cbPixel];
+
+            for (UINT cChan = 0; cChan < pSrc->cbPixel / (pSrc->bWord ? 2 : 1); cChan++)
+            {
+                UINT cValue;
+
+                if (y < cHeight / 2)
+                {
+                    cValue = (NextRandom(pSeed) % cGridPoints) * (cMaxValue / (cGridPoints - 1));
+                }
+                else if (y < cHeight - 2)
+                {
+                    cValue = NextRandom(pSeed) % (cMaxValue + 1);
+                }
+                else
+                {
+                    cValue = (x * cMaxValue) / (cWidth - 1);
+                }
+
+                if (pSrc->bWord)
+                {
+                    WORD wValue = static_cast<WORD>(cValue);
+
+                    memcpy(pPixel + 2 * cChan, &wValue, sizeof(wValue));
+                }
+                else
+                {
+                    pPixel[cChan] = static_cast<BYTE>(cValue);
+                }
+            }
+        }
+    }
+
+    CHECK(lut.Apply(&src[0], cbSrcStride, &dst[0], cbDstStride, cWidth, cHeight) == S_OK);
+
+    TranslateBitmapBits(&transform, &src[0], pSrc->bmFormat, cWidth, cHeight, cbSrcStride,
+                        &ref[0], pDst->bmFormat, cbDstStride, NULL, 0);
+
+    UINT cMaxNodeDiff = 0;
+    UINT cMaxDiff     = 0;
+
+    for (UINT y = 0; y < cHeight; y++)
+    {
+        for (UINT x = 0; x < cWidth; x++)
+        {
+            UINT cDiff = PixelDifference(pDst,
+                                         &dst[y * cbDstStride + x * pDst->cbPixel],
+                                         &ref[y * cbDstStride + x * pDst->cbPixel]);
+
+            if (y < cHeight / 2 && cDiff > cMaxNodeDiff)
+            {
+                cMaxNodeDiff = cDiff;
+            }
+
+            if (cDiff > cMaxDiff)
+            {
+                cMaxDiff = cDiff;
+            }
+        }
+
+        for (UINT cb = cWidth * pDst->cbPixel; cb < cbDstStride; cb++)
+        {
+            CHECK(dst[y * cbDstStride + cb] == 0xA5);
+        }
+    }
+
+    //
+    // Levels of difference allowed, scaled for 16 bit destinations
+    //
+    UINT cScale     = pDst->bWord ? 257 : 1;
+    UINT cTolerance = (kind == TRANSFORM_LINEAR ? 1 : 3) * cScale;
+
+    if (cMaxNodeDiff > 1 || cMaxDiff > cTolerance)
+    {
+        printf("%s to %s (%s): nodes off by %u, colors off by %u (allowed %u)\n",
+               pSrc->pszName,
+               pDst->pszName,
+               kind == TRANSFORM_LINEAR ? "linear" : "gamma",
+               cMaxNodeDiff,
+               cMaxDiff,
+               cTolerance);
+        g_failures++;
+    }
+
+    //
+    // Scanlines that overlap are refused
+    //
+    CHECK(lut.Apply(&src[0], 1, &dst[0], cbDstStride, cWidth, 2) == E_INVALIDARG);
+}
+
+static VOID
+CheckCache(
+    VOID
+    )
+{
+    HostTransform  transform = {TRANSFORM_LINEAR, 0};
+    CColorLUTCache cache;
+    CColorLUT*     pLUT = NULL;
+    CColorLUT*     pFirst = NULL;
+
+    //
+    // Unsupported formats are refused without touching the transform
+    //
+    CHECK(cache.GetLUT(L"a", &transform, BM_RGBTRIPLETS, BM_xRGBQUADS, &pLUT) == S_FALSE);
+    CHECK(pLUT == NULL);
+    CHECK(cache.GetLUT(L"a", &transform, BM_x555RGB, BM_RGBTRIPLETS, &pLUT) == S_FALSE);
+    CHECK(transform.cCalls == 0);
+
+    //
+    // A table is built once per key and pair of formats
+    //
+    CHECK(cache.GetLUT(L"a", &transform, BM_RGBTRIPLETS, BM_CMYKQUADS, &pFirst) == S_OK);
+    CHECK(pFirst != NULL);
+    CHECK(cache.GetLUT(L"a", &transform, BM_RGBTRIPLETS, BM_CMYKQUADS, &pLUT) == S_OK);
+    CHECK(pLUT == pFirst);
+    CHECK(transform.cCalls == 1);
+
+    CHECK(cache.GetLUT(L"a", &transform, BM_BGRTRIPLETS, BM_CMYKQUADS, &pLUT) == S_OK);
+    CHECK(pLUT != pFirst);
+    CHECK(cache.GetLUT(L"b", &transform, BM_RGBTRIPLETS, BM_CMYKQUADS, &pLUT) == S_OK);
+    CHECK(pLUT != pFirst);
+    CHECK(transform.cCalls == 3);
+
+    //
+    // Fill the cache with "a" most recently used; the next new table
+    // drops the least recently used one ("a", BGR) and keeps "a", RGB
+    //
+    CHECK(cache.GetLUT(L"a", &transform, BM_RGBTRIPLETS, BM_CMYKQUADS, &pLUT) == S_OK);
+
+    for (UINT cKey = 0; cKey < 6; cKey++)
+    {
+        CStringXDW cstrKey;
+        cstrKey.Format(L"k%u", cKey);
+
+        CHECK(cache.GetLUT(cstrKey, &transform, BM_RGBTRIPLETS, BM_CMYKQUADS, &pLUT) == S_OK);
+    }
+
+    CHECK(transform.cCalls == 9);
+    CHECK(cache.GetLUT(L"a", &transform, BM_RGBTRIPLETS, BM_CMYKQUADS, &pLUT) == S_OK);
+    CHECK(pLUT == pFirst);
+    CHECK(transform.cCalls == 9);
+    CHECK(cache.GetLUT(L"a", &transform, BM_BGRTRIPLETS, BM_CMYKQUADS, &pLUT) == S_OK);
+    CHECK(transform.cCalls == 10);
+
+    //
+    // A table that cannot be built is not cached
+    //
+    HostTransform failing = {TRANSFORM_FAIL, 0};
+
+    pLUT = pFirst;
+    CHECK(FAILED(cache.GetLUT(L"f", &failing, BM_RGBTRIPLETS, BM_RGBTRIPLETS, &pLUT)));
+    CHECK(pLUT == NULL);
+    CHECK(FAILED(cache.GetLUT(L"f", &failing, BM_RGBTRIPLETS, BM_RGBTRIPLETS, &pLUT)));
+    CHECK(failing.cCalls == 2);
+}
+
+static int
+SelfTest(
+    VOID
+    )
+{
+    uint32_t seed = 2005;
+
+    for (UINT cKind = TRANSFORM_LINEAR; cKind <= TRANSFORM_GAMMA; cKind++)
+    {
+        for (UINT cSrc = 0; cSrc < ARRAYSIZE(g_formats); cSrc++)
+        {
+            for (UINT cDst = 0; cDst < ARRAYSIZE(g_formats); cDst++)
+            {
+                BOOL bSupported = CColorLUT::IsFormatSupported(g_formats[cSrc].bmFormat,
+                                                               g_formats[cDst].bmFormat);
+
+                //
+                // xRGB formats carry an unused byte, so they are only a source
+                //
+                CHECK(bSupported == (g_formats[cDst].bmFormat != BM_xRGBQUADS &&
+                                     g_formats[cDst].bmFormat != BM_xBGRQUADS));
+
+                if (bSupported)
+                {
+                    CheckFormats(static_cast<TransformKind>(cKind), &g_formats[cSrc], &g_formats[cDst], &seed);
+                }
+            }
+        }
+    }
+
+    CheckCache();
+
+    printf("lutest self test %s\n", g_failures ? "FAILED" : "passed");
+
+    return g_failures ? 1 : 0;
+}
+
+static double
+Now(
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    double seconds = 1;
+
+    for (int iArg = 1; iArg < argc; iArg++)
+    {
+        if (strcmp(argv[iArg], "--selftest") == 0)
+        {
+            return SelfTest();
+        }
+        else if (strcmp(argv[iArg], "--seconds") == 0 && iArg + 1 < argc)
+        {
+            seconds = atof(argv[++iArg]);
+        }
+        else
+        {
+            printf("usage: lutest --selftest\n"
+                   "       lutest [--seconds s]\n");
+            return 2;
+        }
+    }
+
+    //
+    // A band of a page at 600 dpi
+    //
+    CONST UINT cWidth  = 5100;
+    CONST UINT cHeight = 16;
+
+    printf("%-12s %-12s %10s\n", "source", "destination", "Mpixel/s");
+
+    for (UINT cSrc = 0; cSrc < ARRAYSIZE(g_formats); cSrc++)
+    {
+        CONST FormatInfo* pSrc = &g_formats[cSrc];
+        CONST FormatInfo* pDst = FindFormat(pSrc->cChannels == 4 ? BM_RGBTRIPLETS : BM_CMYKQUADS);
+
+        HostTransform transform = {TRANSFORM_GAMMA, 0};
+        CColorLUT     lut;
+
+        if (FAILED(lut.Initialize(&transform, pSrc->bmFormat, pDst->bmFormat)))
+        {
+            printf("failed to build the table for %s\n", pSrc->pszName);
+            return 1;
+        }
+
+        vector<BYTE> src(cWidth * cHeight * pSrc->cbPixel);
+        vector<BYTE> dst(cWidth * cHeight * pDst->cbPixel);
+        uint32_t     seed = 1;
+
+        for (size_t cb = 0; cb < src.size(); cb++)
+        {
+            src[cb] = static_cast<BYTE>(NextRandom(&seed));
+        }
+
+        ULONGLONG cPixels = 0;
+        double    start = Now();
+        double    elapsed;
+
+        do
+        {
+            lut.Apply(&src[0], cWidth * pSrc->cbPixel, &dst[0], cWidth * pDst->cbPixel, cWidth, cHeight);
+
+            cPixels += cWidth * cHeight;
+            elapsed = Now() - start;
+        }
+        while (elapsed < seconds);
+
+        printf("%-12s %-12s %10.1f\n", pSrc->pszName, pDst->pszName, cPixels / elapsed / 1e6);
+    }
+
+    return 0;
+}
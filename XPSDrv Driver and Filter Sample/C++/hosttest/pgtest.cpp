@@ -0,0 +1,1635 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pgtest.cpp
+
+Abstract:
+
+   Host test and benchmark of the page store the booklet filter holds pages
+   in, and of the booklet page order. The common filter library's pgstore.cpp
+   is built unchanged against the stand-ins in shim/. The Win32 file and
+   mapping routines it uses are implemented here over POSIX files and mmap,
+   and hold views to the rules Windows has: they start on the allocation
+   granularity, end within the mapping, and a file with a view mapped cannot
+   be truncated.
+
+   usage: pgtest --selftest
+          pgtest [--seconds s] [page KB...]
+
+   The self test checks the booklet order for every even page count up to
+   512 against the loop the booklet filter used to have. It stores pages of
+   sizes either side of the granularity, read in pieces of many sizes, and
+   checks that each is sent back in booklet order with its name, mark-up,
+   resources and PrintTicket, through a writer that takes a little at a time.
+   It checks that a page that fails to be read or spilled part way is not
+   kept and does not move the pages after it, that the mapping is made again
+   when the file grows, that Clear releases everything the pages held and
+   the file is used again, and that no files, mappings or views are left.
+
+   Without --selftest, it stores and sends 64 page booklets for each page
+   size and reports MB/s of mark-up in each direction.
+
+Environment:
+
+   Host (user mode), C++11.
+
+--*/
+
+#include "precomp.h"
+#include "debug.h"
+#include "globals.h"
+#include "xdexcept.h"
+#include "pgstore.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static int g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if (!(X))                                                               \
+    {                                                                       \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+/*
+Files and mappings. Handles are HostHandles; a mapping has its own file
+descriptor and is the size the file was when it was made.
+*/
+#define CB_HOST_GRANULARITY 0x10000
+
+struct HostHandle
+{
+    BOOL      bMapping;
+
+    int       fd;
+
+    UINT      fileId;
+
+    string    path;
+
+    BOOL      bDeleteOnClose;
+
+    ULONGLONG cbMapping;
+};
+
+struct HostView
+{
+    SIZE_T cbView;
+
+    UINT   fileId;
+};
+
+static LONG                g_cFiles;
+static LONG                g_cMappings;
+static LONG                g_cMappingsMade;
+static LONG                g_cBadViews;
+static UINT                g_nextFileId = 1;
+static map<PVOID, HostView> g_views;
+static string              g_lastTempFile;
+
+//
+// Failures to inject: writes take at most g_cbWriteLimit bytes and then fail
+// if g_bWriteFails is set, and CreateFile fails if g_bCreateFails is set
+//
+static DWORD               g_cbWriteLimit = 0xFFFFFFFF;
+static BOOL                g_bWriteFails;
+static BOOL                g_bCreateFails;
+
+VOID
+GetSystemInfo(
+    SYSTEM_INFO* pSystemInfo
+    )
+{
+    pSystemInfo->dwPageSize = static_cast<DWORD>(sysconf(_SC_PAGESIZE));
+    pSystemInfo->dwAllocationGranularity = CB_HOST_GRANULARITY;
+}
+
+DWORD
+GetTempPath(
+    DWORD  cchBuffer,
+    TCHAR* pszBuffer
+    )
+{
+    CONST char* pszTemp = getenv("TMPDIR");
+    int         cch = snprintf(pszBuffer, cchBuffer, "%s/", pszTemp != NULL ? pszTemp : "/tmp");
+
+    return cch > 0 && static_cast<DWORD>(cch) < cchBuffer ? static_cast<DWORD>(cch) : 0;
+}
+
+UINT
+GetTempFileName(
+    CONST TCHAR* pszPathName,
+    CONST TCHAR* pszPrefix,
+    UINT         uUnique,
+    TCHAR*       pszTempFileName
+    )
+{
+    int fd = -1;
+
+    CHECK(uUnique == 0);
+
+    if (snprintf(pszTempFileName, MAX_PATH, "%s%.3sXXXXXX", pszPathName, pszPrefix) >= MAX_PATH ||
+        (fd = mkstemp(pszTempFileName)) < 0)
+    {
+        return 0;
+    }
+
+    close(fd);
+    g_lastTempFile = pszTempFileName;
+    return 1;
+}
+
+HANDLE
+CreateFile(
+    CONST TCHAR*          pszFileName,
+    DWORD                 dwDesiredAccess,
+    DWORD                 dwShareMode,
+    LPSECURITY_ATTRIBUTES pSecurityAttributes,
+    DWORD                 dwCreationDisposition,
+    DWORD                 dwFlagsAndAttributes,
+    HANDLE                hTemplateFile
+    )
+{
+    UNREFERENCED_PARAMETER(dwShareMode);
+    UNREFERENCED_PARAMETER(pSecurityAttributes);
+    UNREFERENCED_PARAMETER(hTemplateFile);
+
+    CHECK(dwDesiredAccess == (GENERIC_READ | GENERIC_WRITE));
+    CHECK(dwCreationDisposition == CREATE_ALWAYS);
+
+    int fd = g_bCreateFails ? -1 : open(pszFileName, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+    if (fd < 0)
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    HostHandle* pHandle = new HostHandle;
+
+    pHandle->bMapping = FALSE;
+    pHandle->fd = fd;
+    pHandle->fileId = g_nextFileId++;
+    pHandle->path = pszFileName;
+    pHandle->bDeleteOnClose = (dwFlagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE) != 0;
+    pHandle->cbMapping = 0;
+
+    g_cFiles++;
+    return pHandle;
+}
+
+BOOL
+DeleteFile(
+    CONST TCHAR* pszFileName
+    )
+{
+    return unlink(pszFileName) == 0;
+}
+
+BOOL
+WriteFile(
+    HANDLE       hFile,
+    CONST VOID*  pBuffer,
+    DWORD        cbToWrite,
+    DWORD*       pcbWritten,
+    LPOVERLAPPED pOverlapped
+    )
+{
+    HostHandle* pHandle = static_cast<HostHandle*>(hFile);
+    CONST BYTE* pData = static_cast<CONST BYTE*>(pBuffer);
+    DWORD       cbLimit = min(cbToWrite, g_cbWriteLimit);
+
+    CHECK(pOverlapped == NULL);
+
+    *pcbWritten = 0;
+
+    while (*pcbWritten < cbLimit)
+    {
+        ssize_t cb = write(pHandle->fd, pData + *pcbWritten, cbLimit - *pcbWritten);
+
+        if (cb <= 0)
+        {
+            return FALSE;
+        }
+
+        *pcbWritten += static_cast<DWORD>(cb);
+    }
+
+    return !g_bWriteFails;
+}
+
+BOOL
+SetFilePointerEx(
+    HANDLE         hFile,
+    LARGE_INTEGER  liDistanceToMove,
+    LARGE_INTEGER* pliNewFilePointer,
+    DWORD          dwMoveMethod
+    )
+{
+    HostHandle* pHandle = static_cast<HostHandle*>(hFile);
+
+    CHECK(dwMoveMethod == FILE_BEGIN);
+
+    off_t offset = lseek(pHandle->fd, static_cast<off_t>(liDistanceToMove.QuadPart), SEEK_SET);
+
+    if (pliNewFilePointer != NULL)
+    {
+        pliNewFilePointer->QuadPart = offset;
+    }
+
+    return offset >= 0;
+}
+
+BOOL
+SetEndOfFile(
+    HANDLE hFile
+    )
+{
+    HostHandle* pHandle = static_cast<HostHandle*>(hFile);
+
+    //
+    // Windows refuses to cut short a file with a view mapped
+    //
+    for (map<PVOID, HostView>::const_iterator iterView = g_views.begin(); iterView != g_views.end(); iterView++)
+    {
+        if (iterView->second.fileId == pHandle->fileId)
+        {
+            return FALSE;
+        }
+    }
+
+    return ftruncate(pHandle->fd, lseek(pHandle->fd, 0, SEEK_CUR)) == 0;
+}
+
+HANDLE
+CreateFileMapping(
+    HANDLE                hFile,
+    LPSECURITY_ATTRIBUTES pAttributes,
+    DWORD                 flProtect,
+    DWORD                 dwMaximumSizeHigh,
+    DWORD                 dwMaximumSizeLow,
+    CONST TCHAR*          pszName
+    )
+{
+    HostHandle* pFile = static_cast<HostHandle*>(hFile);
+    struct stat st;
+
+    CHECK(pAttributes == NULL && pszName == NULL);
+    CHECK(flProtect == PAGE_READONLY);
+    CHECK(dwMaximumSizeHigh == 0 && dwMaximumSizeLow == 0);
+
+    //
+    // An empty file cannot be mapped
+    //
+    if (pFile == NULL || pFile->bMapping || fstat(pFile->fd, &st) != 0 || st.st_size == 0)
+    {
+        return NULL;
+    }
+
+    HostHandle* pHandle = new HostHandle;
+
+    pHandle->bMapping = TRUE;
+    pHandle->fd = dup(pFile->fd);
+    pHandle->fileId = pFile->fileId;
+    pHandle->bDeleteOnClose = FALSE;
+    pHandle->cbMapping = st.st_size;
+
+    g_cMappings++;
+    g_cMappingsMade++;
+    return pHandle;
+}
+
+PVOID
+MapViewOfFile(
+    HANDLE hFileMappingObject,
+    DWORD  dwDesiredAccess,
+    DWORD  dwFileOffsetHigh,
+    DWORD  dwFileOffsetLow,
+    SIZE_T cbToMap
+    )
+{
+    HostHandle* pHandle = static_cast<HostHandle*>(hFileMappingObject);
+    ULONGLONG   offset = (static_cast<ULONGLONG>(dwFileOffsetHigh) << 32) | dwFileOffsetLow;
+
+    if (pHandle == NULL ||
+        !pHandle->bMapping ||
+        dwDesiredAccess != FILE_MAP_READ ||
+        offset % CB_HOST_GRANULARITY != 0 ||
+        cbToMap == 0 ||
+        offset + cbToMap > pHandle->cbMapping)
+    {
+        g_cBadViews++;
+        return NULL;
+    }
+
+    PVOID pView = mmap(NULL, cbToMap, PROT_READ, MAP_SHARED, pHandle->fd, static_cast<off_t>(offset));
+
+    if (pView == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    HostView view = {cbToMap, pHandle->fileId};
+
+    g_views[pView] = view;
+    return pView;
+}
+
+BOOL
+UnmapViewOfFile(
+    CONST VOID* pBaseAddress
+    )
+{
+    map<PVOID, HostView>::iterator iterView = g_views.find(const_cast<PVOID>(pBaseAddress));
+
+    if (iterView == g_views.end())
+    {
+        g_cBadViews++;
+        return FALSE;
+    }
+
+    munmap(iterView->first, iterView->second.cbView);
+    g_views.erase(iterView);
+    return TRUE;
+}
+
+BOOL
+CloseHandle(
+    HANDLE hObject
+    )
+{
+    HostHandle* pHandle = static_cast<HostHandle*>(hObject);
+
+    close(pHandle->fd);
+
+    if (pHandle->bMapping)
+    {
+        g_cMappings--;
+    }
+    else
+    {
+        if (pHandle->bDeleteOnClose)
+        {
+            unlink(pHandle->path.c_str());
+        }
+
+        g_cFiles--;
+    }
+
+    delete pHandle;
+    return TRUE;
+}
+
+static uint32_t
+NextRandom(
+    uint32_t* pSeed
+    )
+{
+    *pSeed ^= *pSeed << 13;
+    *pSeed ^= *pSeed >> 17;
+    *pSeed ^= *pSeed << 5;
+    return *pSeed;
+}
+
+static double
+Now(
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static ULONG
+RefCount(
+    IUnknown* pUnk
+    )
+{
+    pUnk->AddRef();
+    return pUnk->Release();
+}
+
+static BOOL
+FileExists(
+    CONST string& path
+    )
+{
+    struct stat st;
+
+    return stat(path.c_str(), &st) == 0;
+}
+
+/*
+A print read stream over a page's mark-up that returns at most cbMaxRead
+bytes a read. The end of the data is reported with the last of it, or with
+a read that returns nothing when bLateEOF is set. Reads fail once cbFailAt
+bytes have been read.
+*/
+class CHostReadStream : public CUnknown<IPrintReadStream>
+{
+public:
+    CHostReadStream(
+        CONST vector<BYTE>& data,
+        ULONG               cbMaxRead,
+        BOOL                bLateEOF,
+        size_t              cbFailAt
+        ) :
+        CUnknown<IPrintReadStream>(__uuidof(IPrintReadStream)),
+        m_data(data),
+        m_cbMaxRead(cbMaxRead),
+        m_bLateEOF(bLateEOF),
+        m_cbFailAt(cbFailAt),
+        m_cbPosition(0)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    Seek(
+        LONGLONG   dlibMove,
+        DWORD      dwOrigin,
+        ULONGLONG* plibNewPosition
+        )
+    {
+        UNREFERENCED_PARAMETER(dlibMove);
+        UNREFERENCED_PARAMETER(dwOrigin);
+        UNREFERENCED_PARAMETER(plibNewPosition);
+
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    ReadBytes(
+        VOID*  pvBuffer,
+        ULONG  cbRequested,
+        ULONG* pcbRead,
+        BOOL*  pbEndOfFile
+        )
+    {
+        if (m_cbPosition >= m_cbFailAt)
+        {
+            return E_FAIL;
+        }
+
+        size_t cbRead = min(static_cast<size_t>(min(cbRequested, m_cbMaxRead)), m_data.size() - m_cbPosition);
+
+        cbRead = min(cbRead, m_cbFailAt - m_cbPosition);
+
+        if (cbRead > 0)
+        {
+            memcpy(pvBuffer, &m_data[m_cbPosition], cbRead);
+        }
+
+        m_cbPosition += cbRead;
+
+        *pcbRead = static_cast<ULONG>(cbRead);
+        *pbEndOfFile = m_bLateEOF ? cbRead == 0 : m_cbPosition == m_data.size();
+        return S_OK;
+    }
+
+private:
+    CONST vector<BYTE>& m_data;
+
+    ULONG               m_cbMaxRead;
+
+    BOOL                m_bLateEOF;
+
+    size_t              m_cbFailAt;
+
+    size_t              m_cbPosition;
+};
+
+/*
+Page parts
+*/
+class CHostResource : public CUnknown<IUnknown>
+{
+public:
+    CHostResource(
+        LPCWSTR pszURI
+        ) :
+        CUnknown<IUnknown>(__uuidof(IUnknown)),
+        m_uri(pszURI)
+    {
+    }
+
+    wstring m_uri;
+};
+
+class CHostPrintTicket : public CUnknown<IPartPrintTicket>
+{
+public:
+    CHostPrintTicket(
+        LPCWSTR pszURI
+        ) :
+        CUnknown<IPartPrintTicket>(__uuidof(IPartPrintTicket)),
+        m_uri(pszURI)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    GetUri(
+        BSTR* uri
+        )
+    {
+        *uri = SysAllocString(m_uri.c_str());
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    GetStream(
+        IPrintReadStream** ppStream
+        )
+    {
+        UNREFERENCED_PARAMETER(ppStream);
+
+        return E_NOTIMPL;
+    }
+
+private:
+    wstring m_uri;
+};
+
+/*
+Iterates over a page's resources, failing on the iFailAt'th
+*/
+class CHostPartIterator : public CUnknown<IXpsPartIterator>
+{
+public:
+    CHostPartIterator(
+        CONST vector<CComPtr<IUnknown> >& parts,
+        UINT                              iFailAt
+        ) :
+        CUnknown<IXpsPartIterator>(__uuidof(IXpsPartIterator)),
+        m_parts(parts),
+        m_iFailAt(iFailAt),
+        m_iCurrent(0)
+    {
+    }
+
+    VOID STDMETHODCALLTYPE
+    Reset()
+    {
+        m_iCurrent = 0;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    Current(
+        BSTR*      pUri,
+        IUnknown** ppXpsPart
+        )
+    {
+        if (m_iCurrent == m_iFailAt)
+        {
+            return E_FAIL;
+        }
+
+        *pUri = SysAllocString(static_cast<CHostResource*>(static_cast<IUnknown*>(m_parts[m_iCurrent]))->m_uri.c_str());
+        *ppXpsPart = m_parts[m_iCurrent];
+        (*ppXpsPart)->AddRef();
+        return S_OK;
+    }
+
+    BOOL STDMETHODCALLTYPE
+    IsDone()
+    {
+        return m_iCurrent >= m_parts.size();
+    }
+
+    VOID STDMETHODCALLTYPE
+    Next()
+    {
+        m_iCurrent++;
+    }
+
+private:
+    vector<CComPtr<IUnknown> > m_parts;
+
+    UINT                       m_iFailAt;
+
+    UINT                       m_iCurrent;
+};
+
+/*
+A fixed page, either made by a test to be stored or made by the consumer for
+the store to send
+*/
+class CHostFixedPage : public CUnknown<IFixedPage>
+{
+public:
+    CHostFixedPage(
+        LPCWSTR pszURI
+        ) :
+        CUnknown<IFixedPage>(__uuidof(IFixedPage)),
+        m_uri(pszURI),
+        m_cbMaxRead(0xFFFFFFFF),
+        m_bLateEOF(FALSE),
+        m_cbFailAt(SIZE_MAX),
+        m_iFailResource(UINT_MAX),
+        m_bClosed(FALSE)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    GetUri(
+        BSTR* uri
+        )
+    {
+        *uri = SysAllocString(m_uri.c_str());
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    GetStream(
+        IPrintReadStream** ppStream
+        )
+    {
+        *ppStream = new CHostReadStream(m_markup, m_cbMaxRead, m_bLateEOF, m_cbFailAt);
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    GetPrintTicket(
+        IPartPrintTicket** ppPrintTicket
+        )
+    {
+        *ppPrintTicket = m_pPrintTicket;
+
+        if (m_pPrintTicket == NULL)
+        {
+            return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+
+        m_pPrintTicket->AddRef();
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    SetPrintTicket(
+        IPartPrintTicket* pPrintTicket
+        )
+    {
+        m_pPrintTicket = pPrintTicket;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    SetPagePart(
+        IUnknown* pUnk
+        )
+    {
+        m_resources.push_back(CComPtr<IUnknown>(pUnk));
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    GetXpsPartIterator(
+        IXpsPartIterator** pXpsPartIt
+        )
+    {
+        *pXpsPartIt = new CHostPartIterator(m_resources, m_iFailResource);
+        return S_OK;
+    }
+
+    wstring                    m_uri;
+
+    vector<BYTE>               m_markup;
+
+    ULONG                      m_cbMaxRead;
+
+    BOOL                       m_bLateEOF;
+
+    size_t                     m_cbFailAt;
+
+    UINT                       m_iFailResource;
+
+    CComPtr<IPartPrintTicket>  m_pPrintTicket;
+
+    vector<CComPtr<IUnknown> > m_resources;
+
+    BOOL                       m_bClosed;
+};
+
+/*
+The write stream for a new page, taking at most cbMaxWrite bytes a write.
+Unless bKeep is set what is written is only copied out and counted, as a
+writer passing it on would.
+*/
+class CHostWriteStream : public CUnknown<IPrintWriteStream>
+{
+public:
+    CHostWriteStream(
+        CHostFixedPage* pPage,
+        ULONG           cbMaxWrite,
+        BOOL            bKeep
+        ) :
+        CUnknown<IPrintWriteStream>(__uuidof(IPrintWriteStream)),
+        m_pPage(pPage),
+        m_cbMaxWrite(cbMaxWrite),
+        m_bKeep(bKeep),
+        m_cbWritten(0)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    WriteBytes(
+        CONST VOID* pvBuffer,
+        ULONG       cbBuffer,
+        ULONG*      pcbWritten
+        )
+    {
+        CONST BYTE* pData = static_cast<CONST BYTE*>(pvBuffer);
+        ULONG       cbWritten = min(cbBuffer, m_cbMaxWrite);
+
+        if (m_bKeep)
+        {
+            m_pPage->m_markup.insert(m_pPage->m_markup.end(), pData, pData + cbWritten);
+        }
+        else
+        {
+            static BYTE rgbScratch[CB_COPY_BUFFER];
+
+            for (ULONG cb = 0; cb < cbWritten; cb += CB_COPY_BUFFER)
+            {
+                memcpy(rgbScratch, pData + cb, min(cbWritten - cb, static_cast<ULONG>(CB_COPY_BUFFER)));
+            }
+        }
+
+        m_cbWritten += cbWritten;
+
+        *pcbWritten = cbWritten;
+        return S_OK;
+    }
+
+    VOID STDMETHODCALLTYPE
+    Close()
+    {
+        m_pPage->m_bClosed = TRUE;
+    }
+
+private:
+    CComPtr<CHostFixedPage> m_pPage;
+
+    ULONG                   m_cbMaxWrite;
+
+    BOOL                    m_bKeep;
+
+public:
+    ULONGLONG               m_cbWritten;
+};
+
+/*
+Keeps the pages sent to it, or only counts them and their mark-up unless
+bKeep is set
+*/
+class CHostConsumer : public CUnknown<IXpsDocumentConsumer>
+{
+public:
+    CHostConsumer(
+        ULONG cbMaxWrite,
+        BOOL  bKeep
+        ) :
+        CUnknown<IXpsDocumentConsumer>(__uuidof(IXpsDocumentConsumer)),
+        m_cbMaxWrite(cbMaxWrite),
+        m_bKeep(bKeep),
+        m_hrNewPart(S_OK),
+        m_cPagesSent(0)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    SendFixedPage(
+        IFixedPage* pFixedPage
+        )
+    {
+        if (m_bKeep)
+        {
+            m_sent.push_back(CComPtr<CHostFixedPage>(static_cast<CHostFixedPage*>(pFixedPage)));
+        }
+
+        m_cPagesSent++;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    GetNewEmptyPart(
+        LPCWSTR             uri,
+        REFIID              riid,
+        PVOID*              ppNewObject,
+        IPrintWriteStream** ppWriteStream
+        )
+    {
+        if (FAILED(m_hrNewPart))
+        {
+            return m_hrNewPart;
+        }
+
+        if (!(riid == __uuidof(IFixedPage)))
+        {
+            return E_NOINTERFACE;
+        }
+
+        CHostFixedPage* pPage = new CHostFixedPage(uri);
+
+        *ppWriteStream = new CHostWriteStream(pPage, m_cbMaxWrite, m_bKeep);
+        *ppNewObject = static_cast<IFixedPage*>(pPage);
+        return S_OK;
+    }
+
+    ULONG                            m_cbMaxWrite;
+
+    BOOL                             m_bKeep;
+
+    HRESULT                          m_hrNewPart;
+
+    vector<CComPtr<CHostFixedPage> > m_sent;
+
+    UINT                             m_cPagesSent;
+};
+
+/*
+What a stored page should come back as
+*/
+struct ExpectedPage
+{
+    wstring                    uri;
+
+    vector<BYTE>               markup;
+
+    CComPtr<IPartPrintTicket>  pPrintTicket;
+
+    vector<CComPtr<IUnknown> > resources;
+};
+
+static CHostFixedPage*
+MakePage(
+    UINT                                iPage,
+    size_t                              cbMarkup,
+    uint32_t*                           pSeed,
+    CONST vector<CComPtr<IUnknown> >&   resourcePool,
+    ExpectedPage*                       pExpected
+    )
+{
+    WCHAR szURI[64];
+
+    swprintf(szURI, ARRAYSIZE(szURI), L"/Documents/1/Pages/%u.fpage", iPage + 1);
+
+    CHostFixedPage* pPage = new CHostFixedPage(szURI);
+
+    pPage->m_markup.resize(cbMarkup);
+
+    for (size_t cb = 0; cb < cbMarkup; cb++)
+    {
+        pPage->m_markup[cb] = static_cast<BYTE>(NextRandom(pSeed));
+    }
+
+    //
+    // Every other page has a PrintTicket, and each has up to three of the
+    // shared resources
+    //
+    if (iPage % 2 == 0)
+    {
+        swprintf(szURI, ARRAYSIZE(szURI), L"/Documents/1/Metadata/Page%u_PT.xml", iPage + 1);
+
+        CHostPrintTicket* pPrintTicket = new CHostPrintTicket(szURI);
+
+        pPage->m_pPrintTicket = pPrintTicket;
+        pPrintTicket->Release();
+    }
+
+    if (!resourcePool.empty())
+    {
+        for (UINT iRes = 0; iRes < iPage % 4; iRes++)
+        {
+            pPage->m_resources.push_back(resourcePool[(iPage + iRes) % resourcePool.size()]);
+        }
+    }
+
+    if (pExpected != NULL)
+    {
+        pExpected->uri = pPage->m_uri;
+        pExpected->markup = pPage->m_markup;
+        pExpected->pPrintTicket = pPage->m_pPrintTicket;
+        pExpected->resources = pPage->m_resources;
+    }
+
+    return pPage;
+}
+
+static BOOL
+PageMatches(
+    CHostFixedPage*      pSent,
+    CONST ExpectedPage&  expected
+    )
+{
+    return pSent->m_bClosed &&
+           pSent->m_uri == expected.uri &&
+           pSent->m_markup == expected.markup &&
+           pSent->m_pPrintTicket == expected.pPrintTicket &&
+           pSent->m_resources.size() == expected.resources.size() &&
+           equal(pSent->m_resources.begin(), pSent->m_resources.end(), expected.resources.begin());
+}
+
+static BOOL
+StreamMatches(
+    CPageStore*         pStore,
+    UINT                iPage,
+    CONST vector<BYTE>& markup,
+    ULONG               cbChunk
+    )
+{
+    CComPtr<ISequentialStream> pStream(NULL);
+    vector<BYTE>               data;
+    BYTE                       buffer[5000];
+    ULONG                      cbRead = 0;
+
+    if (pStore->GetPageStream(iPage, &pStream) != S_OK)
+    {
+        return FALSE;
+    }
+
+    while (pStream->Read(buffer, min(cbChunk, static_cast<ULONG>(sizeof(buffer))), &cbRead) == S_OK &&
+           cbRead > 0)
+    {
+        data.insert(data.end(), buffer, buffer + cbRead);
+    }
+
+    return data == markup &&
+           pStream->Read(buffer, sizeof(buffer), &cbRead) == S_OK && cbRead == 0 &&
+           pStream->Write(buffer, 1, &cbRead) == E_NOTIMPL;
+}
+
+static VOID
+TestBookletOrder(
+    VOID
+    )
+{
+    vector<UINT> order;
+
+    for (UINT cPages = 0; cPages <= 512; cPages += 2)
+    {
+        //
+        // The loop the booklet filter had before the page store
+        //
+        map<size_t, UINT> reorderedPages;
+        size_t            newIndex = 0;
+        size_t            pageIndex = 0;
+
+        for (pageIndex = 0; pageIndex < cPages/2; pageIndex++)
+        {
+            reorderedPages[newIndex] = static_cast<UINT>(pageIndex);
+            newIndex += 2;
+        }
+
+        newIndex = cPages - 1;
+        for (pageIndex = cPages/2; pageIndex < cPages; pageIndex++)
+        {
+            reorderedPages[newIndex] = static_cast<UINT>(pageIndex);
+            newIndex -= 2;
+        }
+
+        CHECK(GetBookletPageOrder(cPages, &order) == S_OK);
+        CHECK(order.size() == cPages);
+
+        vector<BOOL> seen(cPages, FALSE);
+        BOOL         bMatches = reorderedPages.size() == cPages;
+
+        for (UINT i = 0; i < order.size() && bMatches; i++)
+        {
+            bMatches = order[i] < cPages && !seen[order[i]] && order[i] == reorderedPages[i];
+
+            if (bMatches)
+            {
+                seen[order[i]] = TRUE;
+            }
+        }
+
+        CHECK(bMatches);
+
+        //
+        // Each side of a sheet pairs a page from the front half with one from
+        // the back
+        //
+        for (UINT i = 0; i < cPages / 2; i++)
+        {
+            CHECK(order[2 * i] == i && order[2 * i + 1] == cPages - 1 - i);
+        }
+    }
+
+    static CONST UINT rgEight[] = {0, 7, 1, 6, 2, 5, 3, 4};
+
+    CHECK(GetBookletPageOrder(8, &order) == S_OK);
+    CHECK(order == vector<UINT>(rgEight, rgEight + ARRAYSIZE(rgEight)));
+
+    CHECK(GetBookletPageOrder(1, &order) == E_INVALIDARG);
+    CHECK(GetBookletPageOrder(3, &order) == E_INVALIDARG);
+    CHECK(GetBookletPageOrder(511, &order) == E_INVALIDARG);
+    CHECK(GetBookletPageOrder(8, NULL) == E_POINTER);
+}
+
+static VOID
+TestStoreAndSend(
+    VOID
+    )
+{
+    static CONST size_t rgcbPages[] = {0, 1, 2, 100, 4095, 4096, 65535, 65536, 65537, 200 * 1024, 0, 131072, 3};
+    static CONST ULONG  rgcbReads[] = {0xFFFFFFFF, 1, 7, 4096, 65536, 65537, 1000};
+
+    uint32_t                   seed = 0x1234;
+    vector<CComPtr<IUnknown> > resourcePool;
+    vector<ExpectedPage>       expected;
+    vector<UINT>               order;
+
+    for (UINT iRes = 0; iRes < 5; iRes++)
+    {
+        WCHAR szURI[64];
+
+        swprintf(szURI, ARRAYSIZE(szURI), L"/Resources/Image%u.png", iRes);
+
+        CHostResource* pResource = new CHostResource(szURI);
+
+        resourcePool.push_back(CComPtr<IUnknown>(pResource));
+        pResource->Release();
+    }
+
+    {
+        CPageStore store;
+        UINT       cPages = 0;
+
+        //
+        // The named sizes, then random ones, read in pieces of every size
+        // with the end reported either way
+        //
+        for (UINT iPage = 0; iPage < 40; iPage++)
+        {
+            size_t cbPage = iPage < ARRAYSIZE(rgcbPages) ? rgcbPages[iPage] : NextRandom(&seed) % (300 * 1024);
+            ULONG  cbRead = rgcbReads[iPage % ARRAYSIZE(rgcbReads)];
+
+            if (cbRead == 1 && cbPage > 5000)
+            {
+                cbRead = 3;
+            }
+
+            expected.push_back(ExpectedPage());
+
+            CHostFixedPage* pPage = MakePage(iPage, cbPage, &seed, resourcePool, &expected.back());
+
+            pPage->m_cbMaxRead = cbRead;
+            pPage->m_bLateEOF = (iPage / 3) % 2;
+
+            CHECK(store.AddPage(pPage) == S_OK);
+            CHECK(pPage->Release() == 0);
+        }
+
+        cPages = store.GetPageCount();
+        CHECK(cPages == expected.size());
+        CHECK(g_cFiles == 1);
+
+        //
+        // Send them in booklet order through a writer that takes 1000 bytes
+        // at a time. All the pages were stored first so one mapping does.
+        //
+        LONG cMappingsMade = g_cMappingsMade;
+
+        CHostConsumer* pConsumer = new CHostConsumer(1000, TRUE);
+
+        CHECK(GetBookletPageOrder(cPages, &order) == S_OK);
+
+        for (UINT i = 0; i < cPages; i++)
+        {
+            CHECK(store.SendPage(order[i], pConsumer) == S_OK);
+        }
+
+        CHECK(pConsumer->m_sent.size() == cPages);
+
+        for (UINT i = 0; i < pConsumer->m_sent.size(); i++)
+        {
+            CHECK(PageMatches(pConsumer->m_sent[i], expected[order[i]]));
+        }
+
+        CHECK(g_cMappingsMade == cMappingsMade + 1);
+        CHECK(g_views.empty());
+
+        //
+        // Sent again, a page goes out the same
+        //
+        CHECK(store.SendPage(cPages - 1, pConsumer) == S_OK);
+        CHECK(PageMatches(pConsumer->m_sent.back(), expected[cPages - 1]));
+
+        pConsumer->Release();
+
+        //
+        // The mark-up read back through a stream, in pieces of several sizes
+        //
+        for (UINT iPage = 0; iPage < cPages; iPage++)
+        {
+            CHECK(StreamMatches(&store, iPage, expected[iPage].markup, iPage % 2 ? 4999 : 1));
+        }
+
+        CHECK(g_views.empty());
+
+        //
+        // Pages that are not there
+        //
+        CComPtr<ISequentialStream> pStream(NULL);
+        CHostFixedPage*            pDst = new CHostFixedPage(L"/Documents/1/Pages/x.fpage");
+
+        pConsumer = new CHostConsumer(1000, TRUE);
+
+        CHECK(store.SendPage(cPages, pConsumer) == E_INVALIDARG);
+        CHECK(store.GetPageStream(cPages, &pStream) == E_INVALIDARG && pStream == NULL);
+        CHECK(store.CopyPageResources(cPages, pDst) == E_INVALIDARG);
+        CHECK(store.SendPage(0, NULL) == E_POINTER);
+        CHECK(store.GetPageStream(0, NULL) == E_POINTER);
+        CHECK(store.AddPage(NULL) == E_POINTER);
+        CHECK(store.GetPageCount() == cPages);
+        CHECK(pConsumer->m_sent.empty());
+
+        CHECK(store.CopyPageResources(3, pDst) == S_OK);
+        CHECK(pDst->m_resources.size() == expected[3].resources.size());
+
+        pDst->Release();
+        pConsumer->Release();
+    }
+
+    //
+    // Nothing is left of the store and all it held is released
+    //
+    CHECK(g_cFiles == 0 && g_cMappings == 0 && g_views.empty());
+    CHECK(!FileExists(g_lastTempFile));
+
+    for (UINT i = 0; i < expected.size(); i++)
+    {
+        CHECK(expected[i].pPrintTicket == NULL || RefCount(expected[i].pPrintTicket) == 1);
+    }
+
+    expected.clear();
+
+    for (UINT iRes = 0; iRes < resourcePool.size(); iRes++)
+    {
+        CHECK(RefCount(resourcePool[iRes]) == 1);
+    }
+}
+
+static VOID
+TestRemap(
+    VOID
+    )
+{
+    uint32_t                   seed = 0x5678;
+    vector<CComPtr<IUnknown> > noResources;
+    ExpectedPage               expected[3];
+    CComPtr<ISequentialStream> pStream(NULL);
+    LONG                       cMappingsMade = g_cMappingsMade;
+
+    {
+        CPageStore      store;
+        CHostConsumer*  pConsumer = new CHostConsumer(0xFFFFFFFF, TRUE);
+        CHostFixedPage* pPage = MakePage(0, 100, &seed, noResources, &expected[0]);
+
+        CHECK(store.AddPage(pPage) == S_OK);
+        pPage->Release();
+
+        CHECK(store.SendPage(0, pConsumer) == S_OK);
+        CHECK(g_cMappingsMade == cMappingsMade + 1);
+
+        //
+        // The second page crosses the granularity and the third starts past
+        // it, so neither is in the first mapping
+        //
+        pPage = MakePage(1, 70000, &seed, noResources, &expected[1]);
+        CHECK(store.AddPage(pPage) == S_OK);
+        pPage->Release();
+
+        pPage = MakePage(2, 5000, &seed, noResources, &expected[2]);
+        CHECK(store.AddPage(pPage) == S_OK);
+        pPage->Release();
+
+        CHECK(store.GetPageStream(1, &pStream) == S_OK);
+
+        CHECK(store.SendPage(2, pConsumer) == S_OK);
+        CHECK(store.SendPage(0, pConsumer) == S_OK);
+        CHECK(store.SendPage(1, pConsumer) == S_OK);
+        CHECK(g_cMappingsMade == cMappingsMade + 2);
+
+        CHECK(pConsumer->m_sent.size() == 4 &&
+              PageMatches(pConsumer->m_sent[0], expected[0]) &&
+              PageMatches(pConsumer->m_sent[1], expected[2]) &&
+              PageMatches(pConsumer->m_sent[2], expected[0]) &&
+              PageMatches(pConsumer->m_sent[3], expected[1]));
+
+        pConsumer->Release();
+        CHECK(g_views.size() == 1);
+    }
+
+    //
+    // The stream's view outlives the store and its file
+    //
+    CHECK(g_cFiles == 0 && g_cMappings == 0 && g_views.size() == 1);
+
+    vector<BYTE> data(expected[1].markup.size() + 1);
+    ULONG        cbRead = 0;
+
+    CHECK(pStream->Read(&data[0], static_cast<ULONG>(data.size()), &cbRead) == S_OK);
+    CHECK(cbRead == expected[1].markup.size());
+    CHECK(memcmp(&data[0], &expected[1].markup[0], cbRead) == 0);
+
+    pStream.Attach(NULL);
+    CHECK(g_views.empty());
+}
+
+static VOID
+TestFailures(
+    VOID
+    )
+{
+    uint32_t                   seed = 0x9abc;
+    vector<CComPtr<IUnknown> > resourcePool;
+    vector<ExpectedPage>       expected;
+    ExpectedPage               failed;
+
+    resourcePool.push_back(CComPtr<IUnknown>(new CHostResource(L"/Resources/Font.odttf")));
+    resourcePool.back()->Release();
+    resourcePool.push_back(CComPtr<IUnknown>(new CHostResource(L"/Resources/Image.jpg")));
+    resourcePool.back()->Release();
+
+    {
+        CPageStore      store;
+        CHostFixedPage* pPage = NULL;
+
+        expected.push_back(ExpectedPage());
+        pPage = MakePage(0, 30000, &seed, resourcePool, &expected.back());
+        CHECK(store.AddPage(pPage) == S_OK);
+        pPage->Release();
+
+        //
+        // A read that fails part way through the page
+        //
+        pPage = MakePage(3, 150000, &seed, resourcePool, &failed);
+        pPage->m_cbMaxRead = 7000;
+        pPage->m_cbFailAt = 100000;
+        CHECK(FAILED(store.AddPage(pPage)));
+        pPage->Release();
+        CHECK(store.GetPageCount() == 1);
+
+        //
+        // A resource that cannot be retrieved
+        //
+        pPage = MakePage(3, 2000, &seed, resourcePool, &failed);
+        pPage->m_iFailResource = 1;
+        CHECK(FAILED(store.AddPage(pPage)));
+        pPage->Release();
+        CHECK(store.GetPageCount() == 1);
+
+        expected.push_back(ExpectedPage());
+        pPage = MakePage(1, 20000, &seed, resourcePool, &expected.back());
+        CHECK(store.AddPage(pPage) == S_OK);
+        pPage->Release();
+
+        //
+        // Writes that stop short, with and without an error
+        //
+        for (UINT iFails = 0; iFails < 2; iFails++)
+        {
+            g_cbWriteLimit = 1000;
+            g_bWriteFails = iFails;
+
+            pPage = MakePage(3, 5000, &seed, resourcePool, &failed);
+            CHECK(FAILED(store.AddPage(pPage)));
+            pPage->Release();
+
+            g_cbWriteLimit = 0xFFFFFFFF;
+            g_bWriteFails = FALSE;
+
+            CHECK(store.GetPageCount() == expected.size());
+
+            expected.push_back(ExpectedPage());
+            pPage = MakePage(static_cast<UINT>(expected.size()) - 1, 70000, &seed, resourcePool, &expected.back());
+            CHECK(store.AddPage(pPage) == S_OK);
+            pPage->Release();
+        }
+
+        //
+        // The failed pages hold nothing and the pages after them are intact
+        //
+        failed = ExpectedPage();
+
+        CHostConsumer* pConsumer = new CHostConsumer(0xFFFFFFFF, TRUE);
+
+        CHECK(store.GetPageCount() == expected.size());
+
+        for (UINT iPage = 0; iPage < store.GetPageCount(); iPage++)
+        {
+            CHECK(store.SendPage(iPage, pConsumer) == S_OK);
+            CHECK(StreamMatches(&store, iPage, expected[iPage].markup, 4096));
+        }
+
+        CHECK(pConsumer->m_sent.size() == expected.size());
+
+        for (UINT i = 0; i < pConsumer->m_sent.size(); i++)
+        {
+            CHECK(PageMatches(pConsumer->m_sent[i], expected[i]));
+        }
+
+        pConsumer->m_sent.clear();
+
+        //
+        // A writer that gives no part, or takes nothing, fails the send
+        // without leaving the view mapped
+        //
+        pConsumer->m_hrNewPart = E_OUTOFMEMORY;
+        CHECK(store.SendPage(0, pConsumer) == E_OUTOFMEMORY);
+
+        pConsumer->m_hrNewPart = S_OK;
+        pConsumer->m_cbMaxWrite = 0;
+        CHECK(store.SendPage(0, pConsumer) == E_FAIL);
+
+        CHECK(pConsumer->m_sent.empty());
+        CHECK(g_views.empty());
+
+        pConsumer->Release();
+    }
+
+    CHECK(g_cFiles == 0 && g_cMappings == 0 && g_views.empty());
+
+    expected.clear();
+
+    for (UINT iRes = 0; iRes < resourcePool.size(); iRes++)
+    {
+        CHECK(RefCount(resourcePool[iRes]) == 1);
+    }
+
+    //
+    // A spill file that cannot be created is not left behind, and the next
+    // page tries again
+    //
+    {
+        CPageStore      store;
+        CHostFixedPage* pPage = MakePage(0, 10, &seed, resourcePool, NULL);
+
+        g_bCreateFails = TRUE;
+        CHECK(FAILED(store.AddPage(pPage)));
+        g_bCreateFails = FALSE;
+
+        CHECK(!FileExists(g_lastTempFile));
+        CHECK(store.GetPageCount() == 0 && g_cFiles == 0);
+
+        CHECK(store.AddPage(pPage) == S_OK);
+        CHECK(store.GetPageCount() == 1 && g_cFiles == 1);
+
+        pPage->Release();
+    }
+
+    CHECK(g_cFiles == 0);
+}
+
+static VOID
+TestClear(
+    VOID
+    )
+{
+    uint32_t                   seed = 0xdef0;
+    vector<CComPtr<IUnknown> > resourcePool;
+    vector<ExpectedPage>       expected;
+    CComPtr<ISequentialStream> pStream(NULL);
+    string                     firstFile;
+
+    resourcePool.push_back(CComPtr<IUnknown>(new CHostResource(L"/Resources/Image.tif")));
+    resourcePool.back()->Release();
+
+    {
+        CPageStore      store;
+        CHostConsumer*  pConsumer = new CHostConsumer(5000, TRUE);
+        CHostFixedPage* pPage = NULL;
+
+        for (UINT iPage = 0; iPage < 6; iPage++)
+        {
+            expected.push_back(ExpectedPage());
+            pPage = MakePage(iPage, 40000, &seed, resourcePool, &expected.back());
+            CHECK(store.AddPage(pPage) == S_OK);
+            pPage->Release();
+        }
+
+        CHECK(RefCount(resourcePool[0]) > 1);
+
+        CHECK(store.SendPage(5, pConsumer) == S_OK);
+        pConsumer->m_sent.clear();
+
+        //
+        // Clear lets go of the pages' parts and cuts the file back for the
+        // next pages
+        //
+        firstFile = g_lastTempFile;
+        expected.clear();
+
+        store.Clear();
+
+        CHECK(store.GetPageCount() == 0);
+        CHECK(store.SendPage(0, pConsumer) == E_INVALIDARG);
+        CHECK(store.GetPageStream(0, &pStream) == E_INVALIDARG);
+        CHECK(RefCount(resourcePool[0]) == 1);
+        CHECK(g_cFiles == 1 && g_cMappings == 0);
+
+        struct stat st;
+
+        CHECK(stat(firstFile.c_str(), &st) == 0 && st.st_size == 0);
+
+        for (UINT iPage = 0; iPage < 4; iPage++)
+        {
+            expected.push_back(ExpectedPage());
+            pPage = MakePage(iPage, 1000 + 30000 * iPage, &seed, resourcePool, &expected.back());
+            CHECK(store.AddPage(pPage) == S_OK);
+            pPage->Release();
+        }
+
+        CHECK(g_lastTempFile == firstFile);
+
+        for (UINT iPage = 0; iPage < 4; iPage++)
+        {
+            CHECK(store.SendPage(iPage, pConsumer) == S_OK);
+            CHECK(pConsumer->m_sent.size() == iPage + 1 && PageMatches(pConsumer->m_sent[iPage], expected[iPage]));
+        }
+
+        //
+        // With a page's view still mapped the file cannot be cut back, so it
+        // is closed and the next page goes in a new one. The stream still
+        // reads the page from the old file.
+        //
+        CHECK(store.GetPageStream(3, &pStream) == S_OK);
+
+        store.Clear();
+
+        CHECK(g_cFiles == 0 && !FileExists(firstFile));
+
+        ExpectedPage next;
+
+        pPage = MakePage(0, 500, &seed, resourcePool, &next);
+        CHECK(store.AddPage(pPage) == S_OK);
+        pPage->Release();
+
+        CHECK(g_cFiles == 1 && g_lastTempFile != firstFile);
+        CHECK(StreamMatches(&store, 0, next.markup, 4096));
+
+        vector<BYTE> data(expected[3].markup.size());
+        ULONG        cbRead = 0;
+
+        CHECK(pStream->Read(&data[0], static_cast<ULONG>(data.size()), &cbRead) == S_OK);
+        CHECK(data == expected[3].markup);
+
+        pStream.Attach(NULL);
+        pConsumer->Release();
+    }
+
+    CHECK(g_cFiles == 0 && g_cMappings == 0 && g_views.empty());
+    CHECK(!FileExists(g_lastTempFile));
+
+    expected.clear();
+    CHECK(RefCount(resourcePool[0]) == 1);
+}
+
+static int
+SelfTest(
+    VOID
+    )
+{
+    TestBookletOrder();
+    TestStoreAndSend();
+    TestRemap();
+    TestFailures();
+    TestClear();
+
+    CHECK(g_cFiles == 0 && g_cMappings == 0 && g_views.empty());
+    CHECK(g_cBadViews == 0);
+
+    printf("%s\n", g_failures == 0 ? "passed" : "FAILED");
+    return g_failures == 0 ? 0 : 1;
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    double seconds = 1;
+    UINT   rgcbPage[16];
+    UINT   cRuns = 0;
+
+    for (int iArg = 1; iArg < argc; iArg++)
+    {
+        if (strcmp(argv[iArg], "--selftest") == 0)
+        {
+            return SelfTest();
+        }
+        else if (strcmp(argv[iArg], "--seconds") == 0 && iArg + 1 < argc)
+        {
+            seconds = atof(argv[++iArg]);
+        }
+        else if (atoi(argv[iArg]) > 0 && atoi(argv[iArg]) <= 16384 && cRuns < ARRAYSIZE(rgcbPage))
+        {
+            rgcbPage[cRuns++] = atoi(argv[iArg]) * 1024;
+        }
+        else
+        {
+            printf("usage: pgtest --selftest\n"
+                   "       pgtest [--seconds s] [page KB...]\n");
+            return 2;
+        }
+    }
+
+    if (cRuns == 0)
+    {
+        rgcbPage[cRuns++] = 16 * 1024;
+        rgcbPage[cRuns++] = 256 * 1024;
+    }
+
+    //
+    // Each round stores a booklet of 64 pages, sends them in booklet order to
+    // a writer that takes everything at once, and clears the store
+    //
+    CONST UINT   cPages = 64;
+    vector<UINT> order;
+
+    GetBookletPageOrder(cPages, &order);
+
+    printf("%8s %8s %12s %12s\n", "page KB", "rounds", "store MB/s", "send MB/s");
+
+    for (UINT iRun = 0; iRun < cRuns; iRun++)
+    {
+        uint32_t                   seed = iRun + 1;
+        vector<CComPtr<IUnknown> > noResources;
+        vector<CHostFixedPage*>    pages;
+        CPageStore                 store;
+        CHostConsumer*             pConsumer = new CHostConsumer(0xFFFFFFFF, FALSE);
+        double                     storeSeconds = 0;
+        double                     sendSeconds = 0;
+        UINT                       cRounds = 0;
+        BOOL                       bFailed = FALSE;
+
+        for (UINT iPage = 0; iPage < cPages; iPage++)
+        {
+            pages.push_back(MakePage(iPage, rgcbPage[iRun], &seed, noResources, NULL));
+        }
+
+        while (!bFailed && (cRounds == 0 || storeSeconds + sendSeconds < seconds))
+        {
+            double start = Now();
+
+            for (UINT iPage = 0; iPage < cPages && !bFailed; iPage++)
+            {
+                bFailed = FAILED(store.AddPage(pages[iPage]));
+            }
+
+            double stored = Now();
+
+            for (UINT i = 0; i < cPages && !bFailed; i++)
+            {
+                bFailed = FAILED(store.SendPage(order[i], pConsumer));
+            }
+
+            sendSeconds += Now() - stored;
+            storeSeconds += stored - start;
+
+            store.Clear();
+            cRounds++;
+        }
+
+        for (UINT iPage = 0; iPage < cPages; iPage++)
+        {
+            pages[iPage]->Release();
+        }
+
+        pConsumer->Release();
+
+        if (bFailed)
+        {
+            printf("storing or sending a page failed\n");
+            return 1;
+        }
+
+        double mb = static_cast<double>(cRounds) * cPages * rgcbPage[iRun] / (1024 * 1024);
+
+        printf("%8u %8u %12.0f %12.0f\n", rgcbPage[iRun] / 1024, cRounds, mb / storeSeconds, mb / sendSeconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,966 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pktest.cpp
+
+Abstract:
+
+   Host test and benchmark of the container filter's PK writer. The filter's
+   pkdeflate.cpp and pkwriter.cpp need only the standard library and are built
+   unchanged. zlib is the reference: it inflates everything the writer
+   produces and supplies the reference CRC-32.
+
+   usage: pktest --selftest
+          pktest --write file
+          pktest [--seconds s] [threads...]
+
+   The self test checks that:
+   - deflate output inflates to the input for many kinds of data, whole or
+     split into chunks that each use the preceding 32KB as a dictionary, and
+     that the concatenated chunks form exactly one deflate stream;
+   - PKCrc32 matches zlib and PKCrc32Combine matches the CRC of the
+     concatenation;
+   - archives read back with the independent reader below: every local and
+     central header agrees, every record inflates to what was added, images
+     and incompressible data are stored, and the archive is byte for byte
+     the same whatever the number of threads;
+   - records copied with CopyRecord, found through CPKRecordIndex, read back
+     unchanged, and more than 65535 records produce a valid Zip64 archive.
+
+   --write writes an archive of the same kind of records to a file, so that
+   an external unzip can test it. Otherwise pktest reports MB/s compressed
+   for each number of threads, against zlib level 6 on one thread.
+
+Environment:
+
+   Host (user mode), C++11 with zlib.
+
+--*/
+
+#include "pkwriter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+static int g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if (!(X))                                                               \
+    {                                                                       \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+typedef std::vector<uint8_t> Bytes;
+
+class MemoryOutput : public IPKOutput
+{
+public:
+    void
+    Write(
+        const uint8_t* pData,
+        size_t         cbData
+        )
+    {
+        bytes.insert(bytes.end(), pData, pData + cbData);
+    }
+
+    Bytes bytes;
+};
+
+class MemoryInput : public IPKInput
+{
+public:
+    explicit
+    MemoryInput(
+        const Bytes& bytes
+        ) : m_bytes(bytes)
+    {
+    }
+
+    uint64_t
+    GetSize()
+    {
+        return m_bytes.size();
+    }
+
+    void
+    Read(
+        uint64_t offset,
+        uint8_t* pData,
+        size_t   cbData
+        )
+    {
+        if (offset > m_bytes.size() || cbData > m_bytes.size() - offset)
+        {
+            throw std::runtime_error("read past the end");
+        }
+
+        memcpy(pData, &m_bytes[0] + offset, cbData);
+    }
+
+private:
+    const Bytes& m_bytes;
+};
+
+static uint32_t
+NextRandom(
+    uint32_t* pSeed
+    )
+{
+    *pSeed ^= *pSeed << 13;
+    *pSeed ^= *pSeed >> 17;
+    *pSeed ^= *pSeed << 5;
+    return *pSeed;
+}
+
+//
+// Kinds of record content
+//
+enum Content
+{
+    CONTENT_TEXT,           // markup-like text
+    CONTENT_RANDOM,         // does not compress
+    CONTENT_ZEROS,          // long runs and maximum length matches
+    CONTENT_MIXED,          // text with random stretches and far repeats
+    CONTENT_JPEG,           // starts with a JPEG signature
+    CONTENT_PNG             // starts with a PNG signature
+};
+
+static Bytes
+MakeContent(
+    Content  content,
+    size_t   cbData,
+    uint32_t seed
+    )
+{
+    Bytes data;
+
+    data.reserve(cbData);
+
+    while (data.size() < cbData)
+    {
+        switch (content)
+        {
+            case CONTENT_TEXT:
+            case CONTENT_JPEG:
+            case CONTENT_PNG:
+            {
+                char element[96];
+
+                snprintf(element, sizeof(element), "<Path Data=\"M %u,%u L %u,%u\" Fill=\"#FF%04X\" />\r\n",
+                         NextRandom(&seed) % 800, NextRandom(&seed) % 1100,
+                         NextRandom(&seed) % 800, NextRandom(&seed) % 1100,
+                         NextRandom(&seed) % 16);
+                data.insert(data.end(), element, element + strlen(element));
+                break;
+            }
+
+            case CONTENT_RANDOM:
+                data.push_back(static_cast<uint8_t>(NextRandom(&seed)));
+                break;
+
+            case CONTENT_ZEROS:
+                data.push_back(0);
+                break;
+
+            case CONTENT_MIXED:
+            {
+                uint32_t kind = NextRandom(&seed) % 4;
+                size_t   cbRun = 1 + NextRandom(&seed) % 3000;
+
+                if (kind == 0 && data.size() > 40000)
+                {
+                    //
+                    // Repeat something from up to the window size back
+                    //
+                    size_t distance = 1 + NextRandom(&seed) % 32768;
+                    size_t start = data.size() - distance;
+
+                    for (size_t i = 0; i < cbRun; i++)
+                    {
+                        data.push_back(data[start + i]);
+                    }
+                }
+                else if (kind == 1)
+                {
+                    for (size_t i = 0; i < cbRun; i++)
+                    {
+                        data.push_back(static_cast<uint8_t>(NextRandom(&seed)));
+                    }
+                }
+                else
+                {
+                    data.insert(data.end(), cbRun, static_cast<uint8_t>('a' + kind));
+                }
+
+                break;
+            }
+        }
+    }
+
+    data.resize(cbData);
+
+    static const uint8_t s_jpeg[] = { 0xFF, 0xD8, 0xFF, 0xE0 };
+    static const uint8_t s_png[]  = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+    if (content == CONTENT_JPEG && cbData >= sizeof(s_jpeg))
+    {
+        memcpy(&data[0], s_jpeg, sizeof(s_jpeg));
+    }
+    else if (content == CONTENT_PNG && cbData >= sizeof(s_png))
+    {
+        memcpy(&data[0], s_png, sizeof(s_png));
+    }
+
+    return data;
+}
+
+//
+// Inflate raw deflate data with zlib. The data must hold exactly one
+// complete deflate stream.
+//
+static bool
+Inflate(
+    const uint8_t* pData,
+    size_t         cbData,
+    size_t         cbExpected,
+    Bytes*         pOut
+    )
+{
+    z_stream stream;
+
+    memset(&stream, 0, sizeof(stream));
+
+    if (inflateInit2(&stream, -15) != Z_OK)
+    {
+        return false;
+    }
+
+    pOut->assign(cbExpected + 1, 0);
+
+    uint8_t empty = 0;
+
+    stream.next_in   = const_cast<uint8_t*>(cbData ? pData : &empty);
+    stream.avail_in  = static_cast<uInt>(cbData);
+    stream.next_out  = &(*pOut)[0];
+    stream.avail_out = static_cast<uInt>(pOut->size());
+
+    int status = inflate(&stream, Z_FINISH);
+
+    bool bComplete = (status == Z_STREAM_END && stream.avail_in == 0);
+
+    pOut->resize(stream.total_out);
+    inflateEnd(&stream);
+
+    return bComplete;
+}
+
+static uint32_t
+ReferenceCrc(
+    const Bytes& data
+    )
+{
+    return static_cast<uint32_t>(crc32(0, data.empty() ? Z_NULL : &data[0], static_cast<uInt>(data.size())));
+}
+
+//
+// Compress data in chunks the way the writer does, and check the result
+//
+static void
+CheckDeflate(
+    const Bytes& data,
+    size_t       cbChunk,
+    const char*  pszWhat
+    )
+{
+    Bytes    stream;
+    uint32_t crc = 0;
+    size_t   offset = 0;
+
+    do
+    {
+        size_t cbData = std::min(cbChunk, data.size() - offset);
+        size_t cbDict = std::min(offset, static_cast<size_t>(CPKDeflater::ms_cbWindow));
+        bool   bFinal = (offset + cbData == data.size());
+
+        CPKDeflater deflater;
+        Bytes       out;
+
+        deflater.Compress(data.empty() ? NULL : &data[0] + offset, cbDict, cbData, bFinal, &out);
+
+        stream.insert(stream.end(), out.begin(), out.end());
+
+        uint32_t crcChunk = PKCrc32(0, data.empty() ? NULL : &data[offset], cbData);
+
+        crc = (offset == 0) ? crcChunk : PKCrc32Combine(crc, crcChunk, cbData);
+        offset += cbData;
+    }
+    while (offset < data.size());
+
+    Bytes inflated;
+
+    if (!Inflate(stream.empty() ? NULL : &stream[0], stream.size(), data.size(), &inflated) ||
+        inflated != data)
+    {
+        printf("deflate round trip failed: %s, %zu bytes in %zu byte chunks\n", pszWhat, data.size(), cbChunk);
+        g_failures++;
+    }
+
+    CHECK(crc == ReferenceCrc(data));
+}
+
+//
+// A record as read back from an archive
+//
+struct ReadRecord
+{
+    std::string name;
+    uint16_t    method;
+    uint32_t    crc;
+    uint64_t    cbCompressed;
+    Bytes       data;
+};
+
+static uint32_t
+U16(
+    const Bytes& archive,
+    uint64_t     offset
+    )
+{
+    if (offset + 2 > archive.size())
+    {
+        throw std::runtime_error("truncated");
+    }
+
+    return archive[offset] | (archive[offset + 1] << 8);
+}
+
+static uint32_t
+U32(
+    const Bytes& archive,
+    uint64_t     offset
+    )
+{
+    return U16(archive, offset) | (U16(archive, offset + 2) << 16);
+}
+
+static uint64_t
+U64(
+    const Bytes& archive,
+    uint64_t     offset
+    )
+{
+    return U32(archive, offset) | (static_cast<uint64_t>(U32(archive, offset + 4)) << 32);
+}
+
+//
+// Read an archive back, independently of CPKRecordIndex. Throws
+// std::runtime_error if anything is inconsistent.
+//
+static std::vector<ReadRecord>
+ReadArchive(
+    const Bytes& archive
+    )
+{
+    if (archive.size() < 22)
+    {
+        throw std::runtime_error("too short");
+    }
+
+    //
+    // The writer adds no comment, so the end of central directory
+    // record is the last 22 bytes
+    //
+    uint64_t eocd = archive.size() - 22;
+
+    if (U32(archive, eocd) != 0x06054B50 || U16(archive, eocd + 20) != 0)
+    {
+        throw std::runtime_error("end of central directory");
+    }
+
+    uint64_t cRecords = U16(archive, eocd + 10);
+    uint64_t cbCD     = U32(archive, eocd + 12);
+    uint64_t offsetCD = U32(archive, eocd + 16);
+
+    if (cRecords == 0xFFFF || cbCD == 0xFFFFFFFF || offsetCD == 0xFFFFFFFF)
+    {
+        uint64_t locator = eocd - 20;
+
+        if (U32(archive, locator) != 0x07064B50)
+        {
+            throw std::runtime_error("Zip64 locator");
+        }
+
+        uint64_t zip64 = U64(archive, locator + 8);
+
+        if (U32(archive, zip64) != 0x06064B50 || zip64 + 56 != locator)
+        {
+            throw std::runtime_error("Zip64 end of central directory");
+        }
+
+        cRecords = U64(archive, zip64 + 32);
+        cbCD     = U64(archive, zip64 + 40);
+        offsetCD = U64(archive, zip64 + 48);
+
+        if (offsetCD + cbCD != zip64)
+        {
+            throw std::runtime_error("central directory position");
+        }
+    }
+    else if (offsetCD + cbCD != eocd)
+    {
+        throw std::runtime_error("central directory position");
+    }
+
+    std::vector<ReadRecord> records;
+    uint64_t central = offsetCD;
+    uint64_t expectLocal = 0;
+
+    for (uint64_t index = 0; index < cRecords; index++)
+    {
+        if (U32(archive, central) != 0x02014B50)
+        {
+            throw std::runtime_error("central header");
+        }
+
+        ReadRecord record;
+
+        uint32_t flags   = U16(archive, central + 8);
+        uint64_t cbUncompressed;
+        uint64_t offset;
+        uint32_t cbName  = U16(archive, central + 28);
+        uint32_t cbExtra = U16(archive, central + 30);
+
+        record.method       = static_cast<uint16_t>(U16(archive, central + 10));
+        record.crc          = U32(archive, central + 16);
+        record.cbCompressed = U32(archive, central + 20);
+        cbUncompressed      = U32(archive, central + 24);
+        offset              = U32(archive, central + 42);
+
+        if (central + 46 + cbName > archive.size())
+        {
+            throw std::runtime_error("central header name");
+        }
+
+        record.name.assign(archive.begin() + central + 46, archive.begin() + central + 46 + cbName);
+
+        //
+        // Zip64 extra field values, in the order the specification gives
+        //
+        for (uint64_t extra = central + 46 + cbName; extra < central + 46 + cbName + cbExtra; )
+        {
+            uint32_t id = U16(archive, extra);
+            uint32_t cb = U16(archive, extra + 2);
+            uint64_t value = extra + 4;
+
+            if (id == 0x0001)
+            {
+                if (cbUncompressed == 0xFFFFFFFF)      { cbUncompressed = U64(archive, value);      value += 8; }
+                if (record.cbCompressed == 0xFFFFFFFF) { record.cbCompressed = U64(archive, value); value += 8; }
+                if (offset == 0xFFFFFFFF)              { offset = U64(archive, value);              value += 8; }
+
+                if (value > extra + 4 + cb)
+                {
+                    throw std::runtime_error("Zip64 extra field");
+                }
+            }
+
+            extra += 4 + cb;
+        }
+
+        //
+        // Records are written back to back with nothing in between
+        //
+        if (offset != expectLocal ||
+            U32(archive, offset) != 0x04034B50 ||
+            U16(archive, offset + 6) != flags ||
+            U16(archive, offset + 8) != record.method ||
+            U32(archive, offset + 14) != record.crc ||
+            U16(archive, offset + 26) != cbName ||
+            memcmp(&archive[offset + 30], record.name.data(), cbName) != 0)
+        {
+            throw std::runtime_error("local header does not match");
+        }
+
+        if ((flags & 0x0008) != 0)
+        {
+            throw std::runtime_error("unexpected data descriptor");
+        }
+
+        uint64_t dataOffset = offset + 30 + cbName + U16(archive, offset + 28);
+
+        if (dataOffset + record.cbCompressed > offsetCD)
+        {
+            throw std::runtime_error("record data");
+        }
+
+        const uint8_t* pData = &archive[0] + dataOffset;
+
+        if (record.method == 0)
+        {
+            if (record.cbCompressed != cbUncompressed)
+            {
+                throw std::runtime_error("stored sizes");
+            }
+
+            record.data.assign(pData, pData + record.cbCompressed);
+        }
+        else if (record.method == 8)
+        {
+            if (!Inflate(pData, static_cast<size_t>(record.cbCompressed), static_cast<size_t>(cbUncompressed), &record.data))
+            {
+                throw std::runtime_error("inflate");
+            }
+        }
+        else
+        {
+            throw std::runtime_error("method");
+        }
+
+        if (record.data.size() != cbUncompressed ||
+            ReferenceCrc(record.data) != record.crc)
+        {
+            throw std::runtime_error("record size or CRC");
+        }
+
+        records.push_back(record);
+
+        expectLocal = dataOffset + record.cbCompressed;
+        central += 46 + cbName + cbExtra + U16(archive, central + 32);
+    }
+
+    if (expectLocal != offsetCD || central != offsetCD + cbCD)
+    {
+        throw std::runtime_error("archive layout");
+    }
+
+    return records;
+}
+
+struct TestRecord
+{
+    const char* pszName;
+    Content     content;
+    size_t      cbData;
+    EPKMethod   method;
+    uint16_t    expectMethod;
+};
+
+static const TestRecord g_records[] = {
+    {"Documents/1/Pages/1.fpage",     CONTENT_TEXT,   300000,  PKMethodDeflated, 8},
+    {"Documents/1/Pages/2.fpage",     CONTENT_MIXED,  900000,  PKMethodDeflated, 8},
+    {"Resources/noise.bin",           CONTENT_RANDOM, 700000,  PKMethodDeflated, 0},
+    {"Resources/Images/photo.jpg",    CONTENT_JPEG,   200000,  PKMethodDeflated, 0},
+    {"Resources/Images/icon.png",     CONTENT_PNG,    5000,    PKMethodDeflated, 0},
+    {"Resources/empty",               CONTENT_TEXT,   0,       PKMethodDeflated, 0},
+    {"Resources/one",                 CONTENT_ZEROS,  1,       PKMethodDeflated, 0},
+    {"Resources/zeros.bin",           CONTENT_ZEROS,  3000000, PKMethodDeflated, 8},
+    {"Resources/stored.xml",          CONTENT_TEXT,   1000,    PKMethodStored,   0},
+    {"[Content_Types].xml",           CONTENT_TEXT,   131072,  PKMethodDeflated, 8}
+};
+
+static Bytes
+WriteTestArchive(
+    uint32_t cThreads
+    )
+{
+    MemoryOutput output;
+
+    {
+        CPKStreamWriter writer(&output, cThreads, 0x6000, 0x5953);
+
+        for (size_t index = 0; index < sizeof(g_records) / sizeof(g_records[0]); index++)
+        {
+            Bytes data = MakeContent(g_records[index].content, g_records[index].cbData, static_cast<uint32_t>(index + 1));
+
+            writer.AddRecord(g_records[index].pszName,
+                             data.empty() ? NULL : &data[0],
+                             data.size(),
+                             g_records[index].method);
+        }
+
+        writer.Close();
+    }
+
+    return output.bytes;
+}
+
+static void
+CheckArchive(
+    const Bytes& archive
+    )
+{
+    try
+    {
+        std::vector<ReadRecord> records = ReadArchive(archive);
+
+        CHECK(records.size() == sizeof(g_records) / sizeof(g_records[0]));
+
+        for (size_t index = 0; index < records.size(); index++)
+        {
+            const TestRecord& expect = g_records[index];
+
+            CHECK(records[index].name == expect.pszName);
+            CHECK(records[index].method == expect.expectMethod);
+            CHECK(records[index].data == MakeContent(expect.content, expect.cbData, static_cast<uint32_t>(index + 1)));
+        }
+    }
+    catch (std::runtime_error const& e)
+    {
+        printf("archive does not read back: %s\n", e.what());
+        g_failures++;
+    }
+}
+
+static int
+SelfTest()
+{
+    uint32_t seed = 45;
+
+    //
+    // CRCs against zlib, and combining them
+    //
+    for (int iteration = 0; iteration < 200; iteration++)
+    {
+        Bytes  data = MakeContent(CONTENT_RANDOM, NextRandom(&seed) % 5000, NextRandom(&seed));
+        size_t split = data.empty() ? 0 : NextRandom(&seed) % (data.size() + 1);
+
+        uint32_t crcFirst  = PKCrc32(0, data.empty() ? NULL : &data[0], split);
+        uint32_t crcSecond = PKCrc32(0, data.empty() ? NULL : &data[0] + split, data.size() - split);
+
+        CHECK(PKCrc32(0, data.empty() ? NULL : &data[0], data.size()) == ReferenceCrc(data));
+        CHECK(PKCrc32Combine(crcFirst, crcSecond, data.size() - split) == ReferenceCrc(data));
+        CHECK(PKCrc32(crcFirst, data.empty() ? NULL : &data[0] + split, data.size() - split) == ReferenceCrc(data));
+    }
+
+    //
+    // Deflate, whole and in chunks
+    //
+    static const struct
+    {
+        Content     content;
+        const char* pszName;
+    }
+    contents[] =
+    {
+        { CONTENT_TEXT,   "text" },
+        { CONTENT_RANDOM, "random" },
+        { CONTENT_ZEROS,  "zeros" },
+        { CONTENT_MIXED,  "mixed" }
+    };
+
+    static const size_t sizes[] = { 0, 1, 2, 3, 257, 258, 259, 4096, 32768, 32769, 100000, 1000000 };
+    static const size_t chunks[] = { 1000, 32768, CPKStreamWriter::ms_cbChunk, 1 << 30 };
+
+    for (size_t c = 0; c < sizeof(contents) / sizeof(contents[0]); c++)
+    {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            Bytes data = MakeContent(contents[c].content, sizes[s], NextRandom(&seed));
+
+            for (size_t k = 0; k < sizeof(chunks) / sizeof(chunks[0]); k++)
+            {
+                if (chunks[k] < 4096 && sizes[s] > 100000)
+                {
+                    continue;
+                }
+
+                CheckDeflate(data, chunks[k], contents[c].pszName);
+            }
+        }
+    }
+
+    //
+    // Archives, with the same output for any number of threads
+    //
+    Bytes single = WriteTestArchive(1);
+
+    CheckArchive(single);
+
+    for (uint32_t cThreads = 0; cThreads <= 4; cThreads += 2)
+    {
+        Bytes archive = WriteTestArchive(cThreads);
+
+        CHECK(archive == single);
+    }
+
+    //
+    // Copy records from one archive to another through the record index
+    //
+    {
+        CPKRecordIndex index;
+        MemoryInput    input(single);
+        MemoryOutput   output;
+
+        CHECK(index.Load(&input));
+        CHECK(index.Find("Resources/missing") == NULL);
+
+        {
+            CPKStreamWriter writer(&output, 2, 0, 0);
+
+            static const char* s_copies[] = {
+                "Resources/zeros.bin", "Documents/1/Pages/2.fpage", "Resources/empty", "Resources/Images/icon.png"
+            };
+
+            for (size_t copy = 0; copy < sizeof(s_copies) / sizeof(s_copies[0]); copy++)
+            {
+                const PKRecord* pRecord = index.Find(s_copies[copy]);
+
+                CHECK(pRecord != NULL);
+
+                if (pRecord != NULL)
+                {
+                    writer.CopyRecord(*pRecord, &input);
+                }
+            }
+
+            Bytes text = MakeContent(CONTENT_TEXT, 5000, 7);
+
+            writer.AddRecord("added.xml", &text[0], text.size(), PKMethodDeflated);
+            writer.Close();
+        }
+
+        try
+        {
+            std::vector<ReadRecord> source = ReadArchive(single);
+            std::vector<ReadRecord> copied = ReadArchive(output.bytes);
+
+            CHECK(copied.size() == 5);
+
+            for (size_t copy = 0; copy + 1 < copied.size(); copy++)
+            {
+                for (size_t s = 0; s < source.size(); s++)
+                {
+                    if (source[s].name == copied[copy].name)
+                    {
+                        CHECK(copied[copy].method == source[s].method);
+                        CHECK(copied[copy].cbCompressed == source[s].cbCompressed);
+                        CHECK(copied[copy].data == source[s].data);
+                    }
+                }
+            }
+        }
+        catch (std::runtime_error const& e)
+        {
+            printf("copied archive does not read back: %s\n", e.what());
+            g_failures++;
+        }
+    }
+
+    //
+    // More records than the 16 bit count holds
+    //
+    {
+        MemoryOutput output;
+
+        {
+            CPKStreamWriter writer(&output, 1, 0, 0);
+
+            for (uint32_t record = 0; record < 70000; record++)
+            {
+                char    name[32];
+                uint8_t value = static_cast<uint8_t>(record);
+
+                snprintf(name, sizeof(name), "r/%u", record);
+                writer.AddRecord(name, &value, 1, PKMethodDeflated);
+            }
+
+            writer.Close();
+        }
+
+        try
+        {
+            std::vector<ReadRecord> records = ReadArchive(output.bytes);
+
+            CHECK(records.size() == 70000);
+            CHECK(records.size() == 70000 && records[69999].data.size() == 1 && records[69999].data[0] == static_cast<uint8_t>(69999));
+        }
+        catch (std::runtime_error const& e)
+        {
+            printf("Zip64 archive does not read back: %s\n", e.what());
+            g_failures++;
+        }
+
+        CPKRecordIndex index;
+        MemoryInput    input(output.bytes);
+
+        CHECK(index.Load(&input));
+        CHECK(index.Find("r/69999") != NULL);
+    }
+
+    printf("pktest self test %s\n", g_failures ? "FAILED" : "passed");
+
+    return g_failures ? 1 : 0;
+}
+
+static double
+Now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void
+Usage()
+{
+    printf("usage: pktest --selftest\n"
+           "       pktest --write file\n"
+           "       pktest [--seconds s] [threads...]\n");
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    double                seconds = 1;
+    std::vector<uint32_t> threadCounts;
+
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--selftest") == 0)
+        {
+            return SelfTest();
+        }
+        else if (strcmp(argv[arg], "--write") == 0 && arg + 1 < argc)
+        {
+            Bytes archive = WriteTestArchive(4);
+            FILE* pFile = fopen(argv[++arg], "wb");
+
+            if (pFile == NULL ||
+                fwrite(&archive[0], 1, archive.size(), pFile) != archive.size() ||
+                fclose(pFile) != 0)
+            {
+                printf("cannot write %s\n", argv[arg]);
+                return 1;
+            }
+
+            return 0;
+        }
+        else if (strcmp(argv[arg], "--seconds") == 0 && arg + 1 < argc)
+        {
+            seconds = atof(argv[++arg]);
+        }
+        else if (argv[arg][0] != '-' && atoi(argv[arg]) > 0)
+        {
+            threadCounts.push_back(static_cast<uint32_t>(atoi(argv[arg])));
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (threadCounts.empty())
+    {
+        threadCounts.push_back(1);
+        threadCounts.push_back(2);
+        threadCounts.push_back(4);
+    }
+
+    //
+    // A large page of markup, as the container filter rewrites
+    //
+    Bytes  data = MakeContent(CONTENT_TEXT, 16 * 1024 * 1024, 1);
+    double start;
+    double elapsed;
+
+    {
+        Bytes    out(compressBound(static_cast<uLong>(data.size())));
+        uint64_t cbIn = 0;
+        uLongf   cbOut = 0;
+
+        start = Now();
+
+        do
+        {
+            cbOut = static_cast<uLongf>(out.size());
+            compress2(&out[0], &cbOut, &data[0], static_cast<uLong>(data.size()), 6);
+
+            cbIn += data.size();
+            elapsed = Now() - start;
+        }
+        while (elapsed < seconds);
+
+        printf("%-16s %10.1f MB/s  ratio %.3f\n", "zlib level 6", cbIn / elapsed / 1e6,
+               static_cast<double>(data.size()) / cbOut);
+    }
+
+    for (size_t t = 0; t < threadCounts.size(); t++)
+    {
+        uint64_t        cbIn = 0;
+        uint64_t        cbOut = 0;
+
+        //
+        // Count the output rather than keep it
+        //
+        class CountOutput : public IPKOutput
+        {
+        public:
+            CountOutput() : cb(0) {}
+
+            void
+            Write(
+                const uint8_t*,
+                size_t         cbData
+                )
+            {
+                cb += cbData;
+            }
+
+            uint64_t cb;
+        }
+        output;
+
+        {
+            CPKStreamWriter timed(&output, threadCounts[t], 0, 0);
+
+            start = Now();
+
+            do
+            {
+                timed.AddRecord("page.fpage", &data[0], data.size(), PKMethodDeflated);
+
+                cbIn += data.size();
+                elapsed = Now() - start;
+            }
+            while (elapsed < seconds);
+
+            cbOut = output.cb;
+            timed.Close();
+        }
+
+        char label[32];
+
+        snprintf(label, sizeof(label), "pk %u thread%s", threadCounts[t], threadCounts[t] == 1 ? "" : "s");
+
+        printf("%-16s %10.1f MB/s  ratio %.3f\n", label, cbIn / elapsed / 1e6,
+               static_cast<double>(cbIn) / cbOut);
+    }
+
+    return 0;
+}
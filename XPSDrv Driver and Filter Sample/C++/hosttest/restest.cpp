@@ -0,0 +1,1275 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   restest.cpp
+
+Abstract:
+
+   Host test and benchmark of the resource content store that holds the color
+   filter's converted images. The common filter library's resstore.cpp is
+   built unchanged against the stand-ins in shim/. The CryptoAPI hashing it
+   uses is implemented here with a plain SHA-256.
+
+   usage: restest --selftest
+          restest [--seconds s] [threads...]
+
+   The self test checks that content keys are the SHA-256 of what was hashed,
+   whether it came as buffers, strings or a stream read in pieces. It checks
+   the store against a model of it: images are found by key, an image added
+   again does not replace the first, images over 8MB are refused, and the
+   least recently used images are dropped to keep the store within 32MB,
+   including with several threads adding and finding images at once. It also
+   checks that the write stream passes everything on and keeps a copy only
+   while the image is small enough to store.
+
+   Without --selftest, threads find images with most requests going to a
+   few of them, adding those not found, and it reports lookups per second and
+   how many were found.
+
+Environment:
+
+   Host (user mode), C++11 with pthreads.
+
+--*/
+
+#include "precomp.h"
+#include "debug.h"
+#include "globals.h"
+#include "xdexcept.h"
+#include "resstore.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <list>
+
+static int g_failures;
+
+#define CHECK(X)                                                            \
+{                                                                           \
+    if (!(X))                                                               \
+    {                                                                       \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #X);       \
+        g_failures++;                                                       \
+    }                                                                       \
+}
+
+/*
+SHA-256, for the CryptoAPI stand-ins
+*/
+struct HostHash
+{
+    uint32_t  state[8];
+
+    BYTE      block[64];
+
+    ULONG     cbBlock;
+
+    ULONGLONG cbTotal;
+
+    BOOL      bFinished;
+
+    BYTE      rgbHash[32];
+};
+
+static LONG g_cHashes;
+
+static CONST uint32_t g_sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t
+RotateRight(
+    uint32_t x,
+    UINT     n
+    )
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static VOID
+Sha256Block(
+    HostHash*   pHash,
+    CONST BYTE* pBlock
+    )
+{
+    uint32_t w[64];
+
+    for (UINT i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t(pBlock[4 * i]) << 24) | (uint32_t(pBlock[4 * i + 1]) << 16) |
+               (uint32_t(pBlock[4 * i + 2]) << 8) | uint32_t(pBlock[4 * i + 3]);
+    }
+
+    for (UINT i = 16; i < 64; i++)
+    {
+        uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = pHash->state[0], b = pHash->state[1], c = pHash->state[2], d = pHash->state[3];
+    uint32_t e = pHash->state[4], f = pHash->state[5], g = pHash->state[6], h = pHash->state[7];
+
+    for (UINT i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25)) +
+                      ((e & f) ^ (~e & g)) + g_sha256K[i] + w[i];
+        uint32_t t2 = (RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    pHash->state[0] += a;
+    pHash->state[1] += b;
+    pHash->state[2] += c;
+    pHash->state[3] += d;
+    pHash->state[4] += e;
+    pHash->state[5] += f;
+    pHash->state[6] += g;
+    pHash->state[7] += h;
+}
+
+static VOID
+Sha256Update(
+    HostHash*   pHash,
+    CONST BYTE* pData,
+    size_t      cbData
+    )
+{
+    pHash->cbTotal += cbData;
+
+    while (cbData > 0)
+    {
+        size_t cbCopy = min(cbData, static_cast<size_t>(64 - pHash->cbBlock));
+
+        memcpy(pHash->block + pHash->cbBlock, pData, cbCopy);
+
+        pHash->cbBlock += static_cast<ULONG>(cbCopy);
+        pData += cbCopy;
+        cbData -= cbCopy;
+
+        if (pHash->cbBlock == 64)
+        {
+            Sha256Block(pHash, pHash->block);
+            pHash->cbBlock = 0;
+        }
+    }
+}
+
+static VOID
+Sha256Finish(
+    HostHash* pHash
+    )
+{
+    ULONGLONG cBits = pHash->cbTotal * 8;
+    BYTE      pad[72] = {0x80};
+    size_t    cbPad = (pHash->cbBlock < 56 ? 56 : 120) - pHash->cbBlock;
+
+    for (UINT i = 0; i < 8; i++)
+    {
+        pad[cbPad + i] = static_cast<BYTE>(cBits >> (56 - 8 * i));
+    }
+
+    Sha256Update(pHash, pad, cbPad + 8);
+
+    for (UINT i = 0; i < 32; i++)
+    {
+        pHash->rgbHash[i] = static_cast<BYTE>(pHash->state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+
+    pHash->bFinished = TRUE;
+}
+
+BOOL
+CryptAcquireContext(
+    HCRYPTPROV* phProv,
+    LPCWSTR     szContainer,
+    LPCWSTR     szProvider,
+    DWORD       dwProvType,
+    DWORD       dwFlags
+    )
+{
+    if (szContainer != NULL ||
+        szProvider != NULL ||
+        dwProvType != PROV_RSA_AES ||
+        dwFlags != CRYPT_VERIFYCONTEXT)
+    {
+        return FALSE;
+    }
+
+    *phProv = 1;
+    return TRUE;
+}
+
+BOOL
+CryptReleaseContext(
+    HCRYPTPROV hProv,
+    DWORD      dwFlags
+    )
+{
+    return hProv == 1 && dwFlags == 0;
+}
+
+BOOL
+CryptCreateHash(
+    HCRYPTPROV  hProv,
+    ALG_ID      Algid,
+    HCRYPTKEY   hKey,
+    DWORD       dwFlags,
+    HCRYPTHASH* phHash
+    )
+{
+    static CONST uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    if (hProv != 1 || Algid != CALG_SHA_256 || hKey != 0 || dwFlags != 0)
+    {
+        return FALSE;
+    }
+
+    HostHash* pHash = new HostHash();
+
+    memcpy(pHash->state, initial, sizeof(initial));
+
+    InterlockedIncrement(&g_cHashes);
+
+    *phHash = reinterpret_cast<HCRYPTHASH>(pHash);
+    return TRUE;
+}
+
+BOOL
+CryptDestroyHash(
+    HCRYPTHASH hHash
+    )
+{
+    delete reinterpret_cast<HostHash*>(hHash);
+
+    InterlockedDecrement(&g_cHashes);
+    return TRUE;
+}
+
+BOOL
+CryptHashData(
+    HCRYPTHASH  hHash,
+    CONST BYTE* pbData,
+    DWORD       dwDataLen,
+    DWORD       dwFlags
+    )
+{
+    HostHash* pHash = reinterpret_cast<HostHash*>(hHash);
+
+    if (pHash->bFinished || dwFlags != 0)
+    {
+        return FALSE;
+    }
+
+    Sha256Update(pHash, pbData, dwDataLen);
+    return TRUE;
+}
+
+BOOL
+CryptGetHashParam(
+    HCRYPTHASH hHash,
+    DWORD      dwParam,
+    BYTE*      pbData,
+    DWORD*     pdwDataLen,
+    DWORD      dwFlags
+    )
+{
+    HostHash* pHash = reinterpret_cast<HostHash*>(hHash);
+
+    if (dwParam != HP_HASHVAL || dwFlags != 0 || *pdwDataLen < sizeof(pHash->rgbHash))
+    {
+        return FALSE;
+    }
+
+    if (!pHash->bFinished)
+    {
+        Sha256Finish(pHash);
+    }
+
+    memcpy(pbData, pHash->rgbHash, sizeof(pHash->rgbHash));
+    *pdwDataLen = sizeof(pHash->rgbHash);
+    return TRUE;
+}
+
+static uint32_t
+NextRandom(
+    uint32_t* pSeed
+    )
+{
+    *pSeed ^= *pSeed << 13;
+    *pSeed ^= *pSeed >> 17;
+    *pSeed ^= *pSeed << 5;
+    return *pSeed;
+}
+
+static double
+Now(
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static BOOL
+KeyMatches(
+    CONST ResContentKey& key,
+    CONST char*          pszHex
+    )
+{
+    char szHex[2 * sizeof(key.rgbHash) + 1];
+
+    for (UINT i = 0; i < sizeof(key.rgbHash); i++)
+    {
+        snprintf(szHex + 2 * i, 3, "%02x", key.rgbHash[i]);
+    }
+
+    return strcmp(szHex, pszHex) == 0;
+}
+
+static BOOL
+SameKey(
+    CONST ResContentKey& lhs,
+    CONST ResContentKey& rhs
+    )
+{
+    return memcmp(lhs.rgbHash, rhs.rgbHash, sizeof(lhs.rgbHash)) == 0;
+}
+
+static ResContentKey
+HashOf(
+    CONST BYTE* pData,
+    ULONG       cbData
+    )
+{
+    CContentHash  hash;
+    ResContentKey key = {{0}};
+
+    CHECK(hash.HashData(pData, cbData) == S_OK);
+    CHECK(hash.GetKey(&key) == S_OK);
+
+    return key;
+}
+
+/*
+A print read stream over a buffer that returns at most cbMaxRead bytes a
+read, and reports the end of the data with the last of it
+*/
+class CHostReadStream : public CUnknown<IPrintReadStream>
+{
+public:
+    CHostReadStream(
+        CONST vector<BYTE>& data,
+        ULONG               cbMaxRead
+        ) :
+        CUnknown<IPrintReadStream>(__uuidof(IPrintReadStream)),
+        m_data(data),
+        m_cbMaxRead(cbMaxRead),
+        m_cbPosition(0)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    Seek(
+        LONGLONG   dlibMove,
+        DWORD      dwOrigin,
+        ULONGLONG* plibNewPosition
+        )
+    {
+        UNREFERENCED_PARAMETER(dlibMove);
+        UNREFERENCED_PARAMETER(dwOrigin);
+        UNREFERENCED_PARAMETER(plibNewPosition);
+
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    ReadBytes(
+        VOID*  pvBuffer,
+        ULONG  cbRequested,
+        ULONG* pcbRead,
+        BOOL*  pbEndOfFile
+        )
+    {
+        size_t cbRead = min(static_cast<size_t>(min(cbRequested, m_cbMaxRead)), m_data.size() - m_cbPosition);
+
+        if (cbRead > 0)
+        {
+            memcpy(pvBuffer, &m_data[m_cbPosition], cbRead);
+        }
+
+        m_cbPosition += cbRead;
+
+        *pcbRead = static_cast<ULONG>(cbRead);
+        *pbEndOfFile = m_cbPosition == m_data.size();
+        return S_OK;
+    }
+
+private:
+    CONST vector<BYTE>& m_data;
+
+    ULONG               m_cbMaxRead;
+
+    size_t              m_cbPosition;
+};
+
+/*
+A print write stream that keeps what is written to it, taking at most
+cbMaxWrite bytes a write
+*/
+class CHostWriteStream : public CUnknown<IPrintWriteStream>
+{
+public:
+    CHostWriteStream(
+        ULONG cbMaxWrite
+        ) :
+        CUnknown<IPrintWriteStream>(__uuidof(IPrintWriteStream)),
+        m_cbMaxWrite(cbMaxWrite)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    WriteBytes(
+        CONST VOID* pvBuffer,
+        ULONG       cbBuffer,
+        ULONG*      pcbWritten
+        )
+    {
+        CONST BYTE* pData = static_cast<CONST BYTE*>(pvBuffer);
+        ULONG       cbWritten = min(cbBuffer, m_cbMaxWrite);
+
+        m_data.insert(m_data.end(), pData, pData + cbWritten);
+
+        *pcbWritten = cbWritten;
+        return S_OK;
+    }
+
+    VOID STDMETHODCALLTYPE
+    Close()
+    {
+    }
+
+    vector<BYTE> m_data;
+
+private:
+    ULONG        m_cbMaxWrite;
+};
+
+static VOID
+TestContentHash(
+    VOID
+    )
+{
+    ResContentKey key = {{0}};
+
+    //
+    // FIPS 180-2 examples
+    //
+    {
+        CContentHash hash;
+
+        CHECK(hash.GetKey(&key) == S_OK);
+        CHECK(KeyMatches(key, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+    }
+
+    {
+        CContentHash hash;
+
+        CHECK(hash.HashData(reinterpret_cast<CONST BYTE*>("a"), 1) == S_OK);
+        CHECK(hash.HashData(reinterpret_cast<CONST BYTE*>("bc"), 2) == S_OK);
+        CHECK(hash.GetKey(&key) == S_OK);
+        CHECK(KeyMatches(key, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+    }
+
+    vector<BYTE> million(1000000, 'a');
+
+    CHECK(KeyMatches(HashOf(&million[0], static_cast<ULONG>(million.size())),
+                     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+
+    //
+    // Streams hash to the same key as their content, however the reads split
+    // it up
+    //
+    static CONST ULONG cbSizes[] = {0, 1, 63, 64, CB_COPY_BUFFER, 3 * CB_COPY_BUFFER + 7};
+    static CONST ULONG cbReads[] = {1000, CB_COPY_BUFFER};
+    uint32_t seed = 7;
+
+    for (UINT iSize = 0; iSize < ARRAYSIZE(cbSizes); iSize++)
+    {
+        vector<BYTE> data(cbSizes[iSize]);
+
+        for (size_t cb = 0; cb < data.size(); cb++)
+        {
+            data[cb] = static_cast<BYTE>(NextRandom(&seed));
+        }
+
+        ResContentKey expected = HashOf(data.empty() ? million.data() : data.data(), cbSizes[iSize]);
+
+        for (UINT iRead = 0; iRead < ARRAYSIZE(cbReads); iRead++)
+        {
+            CHostReadStream* pStream = new CHostReadStream(data, cbReads[iRead]);
+            CContentHash     hash;
+
+            CHECK(hash.HashStream(pStream) == S_OK);
+            CHECK(hash.GetKey(&key) == S_OK);
+            CHECK(SameKey(key, expected));
+
+            pStream->Release();
+        }
+    }
+
+    //
+    // Strings are hashed with their terminator, so that one run of strings
+    // cannot hash the same as another split differently. NULL hashes as the
+    // empty string.
+    //
+    ResContentKey keyAB = {{0}};
+    ResContentKey keyA_B = {{0}};
+    ResContentKey keyNull = {{0}};
+    ResContentKey keyEmpty = {{0}};
+
+    {
+        CContentHash hash;
+
+        CHECK(hash.HashString(L"ab") == S_OK);
+        CHECK(hash.HashString(L"c") == S_OK);
+        CHECK(hash.GetKey(&keyAB) == S_OK);
+    }
+
+    {
+        CContentHash hash;
+
+        CHECK(hash.HashString(L"a") == S_OK);
+        CHECK(hash.HashString(L"bc") == S_OK);
+        CHECK(hash.GetKey(&keyA_B) == S_OK);
+    }
+
+    {
+        CContentHash hash;
+
+        CHECK(hash.HashString(NULL) == S_OK);
+        CHECK(hash.GetKey(&keyNull) == S_OK);
+    }
+
+    {
+        CContentHash hash;
+
+        CHECK(hash.HashString(L"") == S_OK);
+        CHECK(hash.GetKey(&keyEmpty) == S_OK);
+    }
+
+    static CONST WCHAR szABC[] = L"ab\0c";
+
+    CHECK(SameKey(keyAB, HashOf(reinterpret_cast<CONST BYTE*>(szABC), sizeof(szABC))));
+    CHECK(!SameKey(keyAB, keyA_B));
+    CHECK(SameKey(keyNull, keyEmpty));
+    CHECK(!KeyMatches(keyEmpty, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+
+    {
+        CContentHash hash;
+
+        CHECK(hash.HashData(NULL, 0) == E_POINTER);
+        CHECK(hash.HashStream(NULL) == E_POINTER);
+        CHECK(hash.GetKey(NULL) == E_POINTER);
+    }
+
+    CHECK(g_cHashes == 0);
+}
+
+/*
+Images for the store tests. Image n is cbImage bytes: the image number,
+then bytes that follow from it.
+*/
+static ResContentKey
+ImageKey(
+    UINT iImage
+    )
+{
+    ResContentKey key = {{0}};
+
+    //
+    // Keys that differ only in their last byte as well as their first
+    //
+    key.rgbHash[0] = static_cast<BYTE>(iImage >> 8);
+    key.rgbHash[31] = static_cast<BYTE>(iImage);
+
+    return key;
+}
+
+static VOID
+MakeImage(
+    UINT          iImage,
+    size_t        cbImage,
+    vector<BYTE>* pData
+    )
+{
+    pData->assign(cbImage, static_cast<BYTE>(iImage * 37 + 11));
+
+    memcpy(&(*pData)[0], &iImage, min(cbImage, sizeof(iImage)));
+
+    if (cbImage > sizeof(iImage))
+    {
+        (*pData)[cbImage - 1] = static_cast<BYTE>(iImage);
+    }
+}
+
+static BOOL
+IsImage(
+    UINT                iImage,
+    size_t              cbImage,
+    CONST vector<BYTE>& data
+    )
+{
+    if (data.size() != cbImage)
+    {
+        return FALSE;
+    }
+
+    vector<BYTE> expected;
+
+    MakeImage(iImage, cbImage, &expected);
+
+    return data == expected;
+}
+
+/*
+What the store should hold: the images in it, from the least to the most
+recently used
+*/
+struct ModelImage
+{
+    UINT   iImage;
+
+    size_t cbImage;
+};
+
+class CStoreModel
+{
+public:
+    CStoreModel() :
+        m_cbImages(0)
+    {
+    }
+
+    BOOL
+    Find(
+        UINT    iImage,
+        size_t* pcbImage
+        )
+    {
+        for (list<ModelImage>::iterator iter = m_images.begin(); iter != m_images.end(); iter++)
+        {
+            if (iter->iImage == iImage)
+            {
+                *pcbImage = iter->cbImage;
+
+                m_images.splice(m_images.end(), m_images, iter);
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+
+    VOID
+    Add(
+        UINT   iImage,
+        size_t cbImage
+        )
+    {
+        if (cbImage > CResourceContentStore::ms_cbMaxEntry)
+        {
+            return;
+        }
+
+        for (list<ModelImage>::iterator iter = m_images.begin(); iter != m_images.end(); iter++)
+        {
+            if (iter->iImage == iImage)
+            {
+                //
+                // The first image added is kept, and adding does not count
+                // as a use
+                //
+                return;
+            }
+        }
+
+        while (!m_images.empty() &&
+               m_cbImages + cbImage > CResourceContentStore::ms_cbMaxStore)
+        {
+            m_cbImages -= m_images.front().cbImage;
+            m_images.pop_front();
+        }
+
+        ModelImage image = {iImage, cbImage};
+
+        m_images.push_back(image);
+        m_cbImages += cbImage;
+    }
+
+    size_t
+    Size() CONST
+    {
+        return m_cbImages;
+    }
+
+private:
+    list<ModelImage> m_images;
+
+    size_t           m_cbImages;
+};
+
+static VOID
+TestStore(
+    VOID
+    )
+{
+    CONST size_t cbMaxEntry = CResourceContentStore::ms_cbMaxEntry;
+    CONST size_t cbMaxStore = CResourceContentStore::ms_cbMaxStore;
+
+    CHECK(cbMaxStore == 32 * 1024 * 1024);
+    CHECK(cbMaxEntry == 8 * 1024 * 1024);
+
+    CResourceContentStore store;
+    vector<BYTE>          data;
+
+    //
+    // Not found, found, and not replaced
+    //
+    data.assign(5, 0xEE);
+    CHECK(store.GetContent(ImageKey(1), &data) == S_FALSE);
+    CHECK(data.empty());
+
+    MakeImage(1, 1000, &data);
+    CHECK(store.AddContent(ImageKey(1), &data) == S_OK);
+    CHECK(data.empty());
+
+    CHECK(store.GetContent(ImageKey(1), &data) == S_OK);
+    CHECK(IsImage(1, 1000, data));
+    CHECK(store.GetContent(ImageKey(1 + 256), &data) == S_FALSE);
+
+    MakeImage(2, 500, &data);
+    CHECK(store.AddContent(ImageKey(1), &data) == S_OK);
+    CHECK(IsImage(2, 500, data));
+    CHECK(store.GetContent(ImageKey(1), &data) == S_OK);
+    CHECK(IsImage(1, 1000, data));
+
+    data.clear();
+    CHECK(store.AddContent(ImageKey(3), &data) == S_OK);
+    data.assign(5, 0xEE);
+    CHECK(store.GetContent(ImageKey(3), &data) == S_OK);
+    CHECK(data.empty());
+
+    CHECK(store.GetContent(ImageKey(1), NULL) == E_POINTER);
+    CHECK(store.AddContent(ImageKey(4), NULL) == E_POINTER);
+
+    //
+    // The largest image is stored, and anything larger is refused and left
+    // with the caller
+    //
+    MakeImage(5, cbMaxEntry + 1, &data);
+    CHECK(store.AddContent(ImageKey(5), &data) == S_FALSE);
+    CHECK(IsImage(5, cbMaxEntry + 1, data));
+    CHECK(store.GetContent(ImageKey(5), &data) == S_FALSE);
+
+    MakeImage(5, cbMaxEntry, &data);
+    CHECK(store.AddContent(ImageKey(5), &data) == S_OK);
+    CHECK(store.GetContent(ImageKey(5), &data) == S_OK);
+    CHECK(IsImage(5, cbMaxEntry, data));
+
+    //
+    // Three more images fill the store to exactly 32MB. Finding each in turn,
+    // then image 1 again, leaves image 3 the least recently used, then 5,
+    // then 10. Adding one byte more drops image 3, which is empty and so
+    // does not make room, and then image 5. The next 8MB drops image 10.
+    // Lookups that find nothing do not count as uses.
+    //
+    MakeImage(10, cbMaxEntry, &data);
+    CHECK(store.AddContent(ImageKey(10), &data) == S_OK);
+    MakeImage(11, cbMaxEntry, &data);
+    CHECK(store.AddContent(ImageKey(11), &data) == S_OK);
+    MakeImage(12, cbMaxEntry - 1000, &data);
+    CHECK(store.AddContent(ImageKey(12), &data) == S_OK);
+
+    static CONST UINT rgStored[] = {1, 3, 5, 10, 11, 12, 1};
+
+    for (UINT i = 0; i < ARRAYSIZE(rgStored); i++)
+    {
+        CHECK(store.GetContent(ImageKey(rgStored[i]), &data) == S_OK);
+    }
+
+    MakeImage(13, 1, &data);
+    CHECK(store.AddContent(ImageKey(13), &data) == S_OK);
+
+    CHECK(store.GetContent(ImageKey(3), &data) == S_FALSE);
+    CHECK(store.GetContent(ImageKey(5), &data) == S_FALSE);
+
+    MakeImage(14, cbMaxEntry, &data);
+    CHECK(store.AddContent(ImageKey(14), &data) == S_OK);
+
+    CHECK(store.GetContent(ImageKey(10), &data) == S_FALSE);
+
+    static CONST UINT   rgLeft[] = {11, 12, 1, 13, 14};
+    static CONST size_t rgcbLeft[] = {cbMaxEntry, cbMaxEntry - 1000, 1000, 1, cbMaxEntry};
+
+    for (UINT i = 0; i < ARRAYSIZE(rgLeft); i++)
+    {
+        CHECK(store.GetContent(ImageKey(rgLeft[i]), &data) == S_OK);
+        CHECK(IsImage(rgLeft[i], rgcbLeft[i], data));
+    }
+}
+
+/*
+Random finds and adds against the model. Most images are small, some are
+the largest stored, and a few are too large.
+*/
+static size_t
+RandomImageSize(
+    UINT iImage
+    )
+{
+    uint32_t seed = iImage * 2654435761u + 1;
+
+    NextRandom(&seed);
+
+    switch (NextRandom(&seed) % 16)
+    {
+    case 0:
+        return CResourceContentStore::ms_cbMaxEntry;
+
+    case 1:
+        return CResourceContentStore::ms_cbMaxEntry + 1 + NextRandom(&seed) % 4096;
+
+    case 2:
+    case 3:
+        return NextRandom(&seed) % (4 * 1024 * 1024);
+
+    default:
+        return NextRandom(&seed) % (256 * 1024);
+    }
+}
+
+static VOID
+TestStoreModel(
+    VOID
+    )
+{
+    CResourceContentStore store;
+    CStoreModel           model;
+    vector<BYTE>          data;
+    uint32_t              seed = 3;
+    UINT                  cFound = 0;
+
+    for (UINT cOps = 0; cOps < 3000 && g_failures == 0; cOps++)
+    {
+        UINT   iImage = NextRandom(&seed) % 200;
+        size_t cbImage = RandomImageSize(iImage);
+        size_t cbModel = 0;
+        BOOL   bFound = model.Find(iImage, &cbModel);
+
+        if (NextRandom(&seed) % 2 == 0)
+        {
+            CHECK(store.GetContent(ImageKey(iImage), &data) == (bFound ? S_OK : S_FALSE));
+            CHECK(!bFound || IsImage(iImage, cbImage, data));
+
+            cFound += bFound;
+        }
+        else
+        {
+            //
+            // A find then an add, as the resource cache does, so the model's
+            // find is right
+            //
+            if (store.GetContent(ImageKey(iImage), &data) == S_FALSE)
+            {
+                CHECK(!bFound);
+
+                MakeImage(iImage, cbImage, &data);
+                CHECK(store.AddContent(ImageKey(iImage), &data) ==
+                      (cbImage > CResourceContentStore::ms_cbMaxEntry ? S_FALSE : S_OK));
+
+                model.Add(iImage, cbImage);
+            }
+            else
+            {
+                CHECK(bFound);
+            }
+        }
+
+        CHECK(model.Size() <= CResourceContentStore::ms_cbMaxStore);
+    }
+
+    //
+    // Some were found, and the store was full for most of the run
+    //
+    CHECK(cFound > 100);
+    CHECK(model.Size() > CResourceContentStore::ms_cbMaxStore / 2);
+}
+
+struct StoreThread
+{
+    pthread_t              thread;
+
+    CResourceContentStore* pStore;
+
+    uint32_t               seed;
+
+    double                 seconds;
+
+    UINT                   cImages;
+
+    UINT                   cHot;
+
+    size_t                 cbImage;
+
+    ULONGLONG              cLookups;
+
+    ULONGLONG              cFound;
+
+    ULONGLONG              cBad;
+};
+
+static VOID*
+StoreThreadProc(
+    VOID* pv
+    )
+{
+    StoreThread* pThread = static_cast<StoreThread*>(pv);
+    vector<BYTE> data;
+    double       end = Now() + pThread->seconds;
+
+    do
+    {
+        for (UINT cOps = 0; cOps < 64; cOps++)
+        {
+            //
+            // Three lookups in four are for one of the hot images
+            //
+            UINT iImage = NextRandom(&pThread->seed) % 4 != 0 ?
+                          NextRandom(&pThread->seed) % pThread->cHot :
+                          NextRandom(&pThread->seed) % pThread->cImages;
+
+            size_t cbImage = pThread->cbImage ? pThread->cbImage : RandomImageSize(iImage);
+
+            HRESULT hr = pThread->pStore->GetContent(ImageKey(iImage), &data);
+
+            if (hr == S_OK)
+            {
+                pThread->cBad += !IsImage(iImage, cbImage, data);
+                pThread->cFound++;
+            }
+            else
+            {
+                MakeImage(iImage, cbImage, &data);
+
+                pThread->cBad += FAILED(pThread->pStore->AddContent(ImageKey(iImage), &data));
+            }
+
+            pThread->cLookups++;
+        }
+    }
+    while (Now() < end);
+
+    return NULL;
+}
+
+static VOID
+RunStoreThreads(
+    CResourceContentStore* pStore,
+    StoreThread*           pThreads,
+    UINT                   cThreads
+    )
+{
+    for (UINT i = 0; i < cThreads; i++)
+    {
+        pthread_create(&pThreads[i].thread, NULL, StoreThreadProc, &pThreads[i]);
+    }
+
+    for (UINT i = 0; i < cThreads; i++)
+    {
+        pthread_join(pThreads[i].thread, NULL);
+    }
+}
+
+static VOID
+TestStoreThreads(
+    VOID
+    )
+{
+    CResourceContentStore store;
+    StoreThread           threads[4];
+    vector<BYTE>          data;
+
+    for (UINT i = 0; i < ARRAYSIZE(threads); i++)
+    {
+        StoreThread thread = {0, &store, i + 1, 0.3, 200, 20, 0, 0, 0, 0};
+
+        threads[i] = thread;
+    }
+
+    RunStoreThreads(&store, threads, ARRAYSIZE(threads));
+
+    for (UINT i = 0; i < ARRAYSIZE(threads); i++)
+    {
+        CHECK(threads[i].cBad == 0);
+        CHECK(threads[i].cFound > 0);
+    }
+
+    //
+    // What is left is all intact and within the budget
+    //
+    size_t cbStored = 0;
+
+    for (UINT iImage = 0; iImage < 200; iImage++)
+    {
+        if (store.GetContent(ImageKey(iImage), &data) == S_OK)
+        {
+            CHECK(IsImage(iImage, RandomImageSize(iImage), data));
+
+            cbStored += data.size();
+        }
+    }
+
+    CHECK(cbStored > 0);
+    CHECK(cbStored <= CResourceContentStore::ms_cbMaxStore);
+}
+
+static VOID
+TestWriteStream(
+    VOID
+    )
+{
+    CONST size_t cbMaxEntry = CResourceContentStore::ms_cbMaxEntry;
+
+    vector<BYTE> image;
+    uint32_t     seed = 5;
+    ULONG        cbWritten = 0;
+
+    image.resize(cbMaxEntry + 3 * CB_COPY_BUFFER);
+
+    for (size_t cb = 0; cb < image.size(); cb++)
+    {
+        image[cb] = static_cast<BYTE>(NextRandom(&seed));
+    }
+
+    //
+    // Everything written is passed on and kept, and the part stream is held
+    // while the write stream is
+    //
+    {
+        CHostWriteStream*       pPart = new CHostWriteStream(0xFFFFFFFF);
+        CResContentWriteStream* pWrite = new CResContentWriteStream(pPart);
+
+        CHECK(pPart->AddRef() == 3);
+        CHECK(pPart->Release() == 2);
+
+        CHECK(pWrite->WriteBytes(&image[0], 100, &cbWritten) == S_OK && cbWritten == 100);
+        CHECK(pWrite->WriteBytes(&image[100], 0, &cbWritten) == S_OK && cbWritten == 0);
+        CHECK(pWrite->WriteBytes(&image[100], CB_COPY_BUFFER, &cbWritten) == S_OK);
+
+        pWrite->Close();
+
+        CHECK(pWrite->GetContent() != NULL);
+        CHECK(pWrite->GetContent()->size() == 100 + CB_COPY_BUFFER);
+        CHECK(memcmp(&(*pWrite->GetContent())[0], &image[0], 100 + CB_COPY_BUFFER) == 0);
+        CHECK(pPart->m_data == *pWrite->GetContent());
+
+        CHECK(pWrite->Release() == 0);
+        CHECK(pPart->Release() == 0);
+    }
+
+    //
+    // Only what the part stream took is kept
+    //
+    {
+        CHostWriteStream*       pPart = new CHostWriteStream(1000);
+        CResContentWriteStream* pWrite = new CResContentWriteStream(pPart);
+
+        for (size_t cb = 0; cb < 5000; cb += cbWritten)
+        {
+            CHECK(pWrite->WriteBytes(&image[cb], 5000 - static_cast<ULONG>(cb), &cbWritten) == S_OK);
+            CHECK(cbWritten == 1000);
+        }
+
+        CHECK(pWrite->GetContent() != NULL);
+        CHECK(pWrite->GetContent()->size() == 5000);
+        CHECK(pPart->m_data == *pWrite->GetContent());
+
+        pWrite->Release();
+        pPart->Release();
+    }
+
+    //
+    // Exactly the largest stored image is kept; a byte more and the copy is
+    // dropped, but the part stream still gets everything
+    //
+    for (UINT cbExtra = 0; cbExtra < 2; cbExtra++)
+    {
+        CHostWriteStream*       pPart = new CHostWriteStream(0xFFFFFFFF);
+        CResContentWriteStream* pWrite = new CResContentWriteStream(pPart);
+        size_t                  cbImage = cbMaxEntry + cbExtra;
+        size_t                  cb = 0;
+
+        while (cb < cbImage)
+        {
+            ULONG cbChunk = static_cast<ULONG>(min(cbImage - cb, static_cast<size_t>(CB_COPY_BUFFER - 1)));
+
+            CHECK(pWrite->WriteBytes(&image[cb], cbChunk, &cbWritten) == S_OK);
+            cb += cbWritten;
+        }
+
+        CHECK(pWrite->WriteBytes(&image[cb], 0, &cbWritten) == S_OK);
+
+        CHECK(pPart->m_data.size() == cbImage);
+        CHECK(memcmp(&pPart->m_data[0], &image[0], cbImage) == 0);
+
+        if (cbExtra == 0)
+        {
+            CHECK(pWrite->GetContent() != NULL && *pWrite->GetContent() == pPart->m_data);
+        }
+        else
+        {
+            CHECK(pWrite->GetContent() == NULL);
+
+            //
+            // and it is not taken up again
+            //
+            CHECK(pWrite->WriteBytes(&image[0], 1, &cbWritten) == S_OK);
+            CHECK(pWrite->GetContent() == NULL);
+        }
+
+        pWrite->Release();
+        pPart->Release();
+    }
+}
+
+static int
+SelfTest(
+    VOID
+    )
+{
+    TestContentHash();
+    TestStore();
+    TestStoreModel();
+    TestStoreThreads();
+    TestWriteStream();
+
+    printf("%s\n", g_failures == 0 ? "passed" : "FAILED");
+    return g_failures == 0 ? 0 : 1;
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    double seconds = 1;
+    UINT   rgThreads[16];
+    UINT   cRuns = 0;
+
+    for (int iArg = 1; iArg < argc; iArg++)
+    {
+        if (strcmp(argv[iArg], "--selftest") == 0)
+        {
+            return SelfTest();
+        }
+        else if (strcmp(argv[iArg], "--seconds") == 0 && iArg + 1 < argc)
+        {
+            seconds = atof(argv[++iArg]);
+        }
+        else if (atoi(argv[iArg]) > 0 && atoi(argv[iArg]) <= 64 && cRuns < ARRAYSIZE(rgThreads))
+        {
+            rgThreads[cRuns++] = atoi(argv[iArg]);
+        }
+        else
+        {
+            printf("usage: restest --selftest\n"
+                   "       restest [--seconds s] [threads...]\n");
+            return 2;
+        }
+    }
+
+    if (cRuns == 0)
+    {
+        rgThreads[cRuns++] = 1;
+        rgThreads[cRuns++] = 4;
+    }
+
+    //
+    // 256 images of 512KB, 128MB in all against the 32MB budget, with three
+    // lookups in four going to 32 of them, 16MB
+    //
+    printf("%8s %12s %8s\n", "threads", "lookups/s", "found");
+
+    for (UINT iRun = 0; iRun < cRuns; iRun++)
+    {
+        CResourceContentStore store;
+        StoreThread           threads[64];
+        ULONGLONG             cLookups = 0;
+        ULONGLONG             cFound = 0;
+        ULONGLONG             cBad = 0;
+
+        for (UINT i = 0; i < rgThreads[iRun]; i++)
+        {
+            StoreThread thread = {0, &store, i + 1, seconds, 256, 32, 512 * 1024, 0, 0, 0};
+
+            threads[i] = thread;
+        }
+
+        double start = Now();
+
+        RunStoreThreads(&store, threads, rgThreads[iRun]);
+
+        double elapsed = Now() - start;
+
+        for (UINT i = 0; i < rgThreads[iRun]; i++)
+        {
+            cLookups += threads[i].cLookups;
+            cFound += threads[i].cFound;
+            cBad += threads[i].cBad;
+        }
+
+        if (cBad != 0)
+        {
+            printf("%llu lookups returned the wrong image or failed\n", static_cast<unsigned long long>(cBad));
+            return 1;
+        }
+
+        printf("%8u %12.0f %7.1f%%\n", rgThreads[iRun], cLookups / elapsed, 100.0 * cFound / cLookups);
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   debug.h
+
+Abstract:
+
+   Host stand-in for the sample debug header: the free build definitions.
+
+--*/
+
+#pragma once
+
+#define ERR(msg)
+#define ERR_ON_HR(hr)
+#define ERR_ON_HR_EXC(hr, hrExcept)
+#define RIP(msg)
+#define DBG_ONLY(p)
@@ -0,0 +1,27 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   globals.h
+
+Abstract:
+
+   Host stand-in for the sample globals header.
+
+--*/
+
+#pragma once
+
+#define CB_COPY_BUFFER   0x10000
+
+#define CHECK_POINTER(p, hr) ((p) == NULL ? hr : S_OK)
+#define CHECK_HANDLE(h, hr) ((h) == NULL ? hr : S_OK)
@@ -0,0 +1,710 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   precomp.h
+
+Abstract:
+
+   Host stand-ins for the Win32, COM, ATL and ICM definitions that the filter
+   sources built by the host tests use. TranslateBitmapBits, the file and
+   mapping routines and the CryptoAPI routines in wincrypt.h are implemented
+   by the tests that need them. The other headers in this directory stand in
+   for the sample or SDK headers of the same name.
+
+--*/
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <climits>
+#include <new>
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+//
+// colorlut.cpp uses SSE2 when built for x86 or x64. Build with
+// XDHOST_NO_SSE2 defined to test the portable path.
+//
+#if (defined(__x86_64__) || defined(__SSE2__)) && !defined(XDHOST_NO_SSE2)
+#define _M_X64 1
+#endif
+
+#define CONST               const
+#define VOID                void
+#define TRUE                1
+#define FALSE               0
+
+typedef int                 BOOL;
+typedef int                 INT;
+typedef unsigned int        UINT;
+typedef uint8_t             BYTE;
+typedef BYTE                *PBYTE;
+typedef uint16_t            WORD;
+typedef WORD                *PWORD;
+typedef uint32_t            DWORD;
+typedef uint32_t            ULONG;
+typedef int32_t             LONG;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef size_t              SIZE_T;
+typedef float               FLOAT;
+typedef FLOAT               *PFLOAT;
+typedef void                *PVOID;
+typedef intptr_t            LPARAM;
+typedef int32_t             HRESULT;
+typedef wchar_t             WCHAR;
+typedef const WCHAR         *LPCWSTR;
+typedef WCHAR               *LPWSTR;
+typedef WCHAR               *BSTR;
+typedef void                *HANDLE;
+typedef PVOID               LPSECURITY_ATTRIBUTES;
+typedef PVOID               LPOVERLAPPED;
+
+//
+// ULONG is 32 bits, as on Windows
+//
+#undef  ULONG_MAX
+#define ULONG_MAX           0xFFFFFFFFUL
+
+#define MAX_PATH            260
+
+#define S_OK                ((HRESULT)0)
+#define S_FALSE             ((HRESULT)1)
+#define E_FAIL              ((HRESULT)0x80004005)
+#define E_NOTIMPL           ((HRESULT)0x80004001)
+#define E_NOINTERFACE       ((HRESULT)0x80004002)
+#define E_POINTER           ((HRESULT)0x80004003)
+#define E_INVALIDARG        ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY       ((HRESULT)0x8007000E)
+#define E_PENDING           ((HRESULT)0x8000000A)
+#define SUCCEEDED(hr)       ((HRESULT)(hr) >= 0)
+#define FAILED(hr)          ((HRESULT)(hr) < 0)
+
+#define ERROR_FILE_TOO_LARGE    223
+#define ERROR_NOT_FOUND         1168
+#define HRESULT_FROM_WIN32(x)   ((HRESULT)(x) <= 0 ? (HRESULT)(x) : (HRESULT)(((x) & 0x0000FFFF) | (7 << 16) | 0x80000000))
+
+#define ZeroMemory(p, cb)   memset((p), 0, (cb))
+#define CopyMemory(d, s, cb) memcpy((d), (s), (cb))
+#define ARRAYSIZE(a)        (sizeof(a) / sizeof((a)[0]))
+
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+
+#define _In_
+#define _In_opt_
+#define _In_opt_z_
+#define _Out_
+#define _Outptr_
+#define _Outptr_result_maybenull_
+#define _Inout_
+#define _Out_opt_
+#define _In_reads_bytes_(x)
+#define _Out_writes_bytes_(x)
+
+//
+// ICM
+//
+enum BMFORMAT
+{
+    BM_x555RGB      = 0x0000,
+    BM_RGBTRIPLETS  = 0x0002,
+    BM_BGRTRIPLETS  = 0x0004,
+    BM_xRGBQUADS    = 0x0008,
+    BM_16b_RGB      = 0x000A,
+    BM_xBGRQUADS    = 0x0010,
+    BM_CMYKQUADS    = 0x0020,
+    BM_KYMCQUADS    = 0x0305,
+    BM_NAMED_INDEX  = 0x0405
+};
+
+typedef void *HTRANSFORM;
+typedef BOOL (*PBMCALLBACKFN)(ULONG, ULONG, LPARAM);
+
+BOOL
+TranslateBitmapBits(
+    HTRANSFORM      hColorTransform,
+    PVOID           pSrcBits,
+    BMFORMAT        bmInput,
+    DWORD           dwWidth,
+    DWORD           dwHeight,
+    DWORD           dwInputStride,
+    PVOID           pDestBits,
+    BMFORMAT        bmOutput,
+    DWORD           dwOutputStride,
+    PBMCALLBACKFN   pfnCallBack,
+    LPARAM          ulCallbackData
+    );
+
+inline HRESULT
+GetLastErrorAsHResult()
+{
+    return E_FAIL;
+}
+
+//
+// Critical sections
+//
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+inline VOID
+InitializeCriticalSection(
+    CRITICAL_SECTION* pcs
+    )
+{
+    pthread_mutex_init(pcs, NULL);
+}
+
+inline VOID
+DeleteCriticalSection(
+    CRITICAL_SECTION* pcs
+    )
+{
+    pthread_mutex_destroy(pcs);
+}
+
+inline VOID
+EnterCriticalSection(
+    CRITICAL_SECTION* pcs
+    )
+{
+    pthread_mutex_lock(pcs);
+}
+
+inline VOID
+LeaveCriticalSection(
+    CRITICAL_SECTION* pcs
+    )
+{
+    pthread_mutex_unlock(pcs);
+}
+
+inline LONG
+InterlockedIncrement(
+    LONG* pl
+    )
+{
+    return __atomic_add_fetch(pl, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG
+InterlockedDecrement(
+    LONG* pl
+    )
+{
+    return __atomic_sub_fetch(pl, 1, __ATOMIC_SEQ_CST);
+}
+
+//
+// Files and mappings. The spill file names are narrow, as in a build without
+// UNICODE.
+//
+typedef char                TCHAR;
+
+#define TEXT(s)             s
+
+#define INVALID_HANDLE_VALUE    ((HANDLE)(intptr_t)-1)
+
+#define GENERIC_READ                0x80000000
+#define GENERIC_WRITE               0x40000000
+#define CREATE_ALWAYS               2
+#define FILE_ATTRIBUTE_TEMPORARY    0x00000100
+#define FILE_FLAG_DELETE_ON_CLOSE   0x04000000
+#define FILE_BEGIN                  0
+#define PAGE_READONLY               0x02
+#define FILE_MAP_READ               0x0004
+
+union LARGE_INTEGER
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG  HighPart;
+    } u;
+
+    LONGLONG QuadPart;
+};
+
+struct SYSTEM_INFO
+{
+    DWORD dwPageSize;
+    DWORD dwAllocationGranularity;
+};
+
+VOID
+GetSystemInfo(
+    SYSTEM_INFO* pSystemInfo
+    );
+
+DWORD
+GetTempPath(
+    DWORD  cchBuffer,
+    TCHAR* pszBuffer
+    );
+
+UINT
+GetTempFileName(
+    CONST TCHAR* pszPathName,
+    CONST TCHAR* pszPrefix,
+    UINT         uUnique,
+    TCHAR*       pszTempFileName
+    );
+
+HANDLE
+CreateFile(
+    CONST TCHAR*          pszFileName,
+    DWORD                 dwDesiredAccess,
+    DWORD                 dwShareMode,
+    LPSECURITY_ATTRIBUTES pSecurityAttributes,
+    DWORD                 dwCreationDisposition,
+    DWORD                 dwFlagsAndAttributes,
+    HANDLE                hTemplateFile
+    );
+
+BOOL
+DeleteFile(
+    CONST TCHAR* pszFileName
+    );
+
+BOOL
+WriteFile(
+    HANDLE       hFile,
+    CONST VOID*  pBuffer,
+    DWORD        cbToWrite,
+    DWORD*       pcbWritten,
+    LPOVERLAPPED pOverlapped
+    );
+
+BOOL
+SetFilePointerEx(
+    HANDLE         hFile,
+    LARGE_INTEGER  liDistanceToMove,
+    LARGE_INTEGER* pliNewFilePointer,
+    DWORD          dwMoveMethod
+    );
+
+BOOL
+SetEndOfFile(
+    HANDLE hFile
+    );
+
+HANDLE
+CreateFileMapping(
+    HANDLE                hFile,
+    LPSECURITY_ATTRIBUTES pAttributes,
+    DWORD                 flProtect,
+    DWORD                 dwMaximumSizeHigh,
+    DWORD                 dwMaximumSizeLow,
+    CONST TCHAR*          pszName
+    );
+
+PVOID
+MapViewOfFile(
+    HANDLE hFileMappingObject,
+    DWORD  dwDesiredAccess,
+    DWORD  dwFileOffsetHigh,
+    DWORD  dwFileOffsetLow,
+    SIZE_T cbToMap
+    );
+
+BOOL
+UnmapViewOfFile(
+    CONST VOID* pBaseAddress
+    );
+
+BOOL
+CloseHandle(
+    HANDLE hObject
+    );
+
+//
+// COM. Interface ids are named IID_<interface>, and __uuidof finds them by
+// that name.
+//
+#define STDMETHODCALLTYPE
+
+struct GUID
+{
+    DWORD Data1;
+    WORD  Data2;
+    WORD  Data3;
+    BYTE  Data4[8];
+};
+
+typedef GUID        IID;
+typedef CONST IID&  REFIID;
+
+inline bool
+operator==(
+    REFIID lhs,
+    REFIID rhs
+    )
+{
+    return memcmp(&lhs, &rhs, sizeof(IID)) == 0;
+}
+
+#define __uuidof(i)         IID_##i
+
+class IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE
+    QueryInterface(
+        REFIID riid,
+        PVOID* ppv
+        ) = 0;
+
+    virtual ULONG STDMETHODCALLTYPE
+    AddRef() = 0;
+
+    virtual ULONG STDMETHODCALLTYPE
+    Release() = 0;
+};
+
+//
+// Print pipeline streams
+//
+class IPrintReadStream : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE
+    Seek(
+        LONGLONG   dlibMove,
+        DWORD      dwOrigin,
+        ULONGLONG* plibNewPosition
+        ) = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    ReadBytes(
+        VOID*  pvBuffer,
+        ULONG  cbRequested,
+        ULONG* pcbRead,
+        BOOL*  pbEndOfFile
+        ) = 0;
+};
+
+class IPrintWriteStream : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE
+    WriteBytes(
+        CONST VOID* pvBuffer,
+        ULONG       cbBuffer,
+        ULONG*      pcbWritten
+        ) = 0;
+
+    virtual VOID STDMETHODCALLTYPE
+    Close() = 0;
+};
+
+class ISequentialStream : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE
+    Read(
+        void*  pv,
+        ULONG  cb,
+        ULONG* pcbRead
+        ) = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    Write(
+        CONST void* pv,
+        ULONG       cb,
+        ULONG*      pcbWritten
+        ) = 0;
+};
+
+//
+// XPS print pipeline object model, cut down to the members the host tests
+// use
+//
+class IPartBase : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE
+    GetUri(
+        BSTR* uri
+        ) = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    GetStream(
+        IPrintReadStream** ppStream
+        ) = 0;
+};
+
+class IPartPrintTicket : public IPartBase
+{
+};
+
+class IXpsPartIterator : public IUnknown
+{
+public:
+    virtual VOID STDMETHODCALLTYPE
+    Reset() = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    Current(
+        BSTR*      pUri,
+        IUnknown** ppXpsPart
+        ) = 0;
+
+    virtual BOOL STDMETHODCALLTYPE
+    IsDone() = 0;
+
+    virtual VOID STDMETHODCALLTYPE
+    Next() = 0;
+};
+
+class IFixedPage : public IPartBase
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE
+    GetPrintTicket(
+        IPartPrintTicket** ppPrintTicket
+        ) = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    SetPrintTicket(
+        IPartPrintTicket* pPrintTicket
+        ) = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    SetPagePart(
+        IUnknown* pUnk
+        ) = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    GetXpsPartIterator(
+        IXpsPartIterator** pXpsPartIt
+        ) = 0;
+};
+
+class IXpsDocumentConsumer : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE
+    SendFixedPage(
+        IFixedPage* pFixedPage
+        ) = 0;
+
+    virtual HRESULT STDMETHODCALLTYPE
+    GetNewEmptyPart(
+        LPCWSTR             uri,
+        REFIID              riid,
+        PVOID*              ppNewObject,
+        IPrintWriteStream** ppWriteStream
+        ) = 0;
+};
+
+static CONST IID IID_IUnknown             = {0x00000000, 0x0000, 0x0000, {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+static CONST IID IID_ISequentialStream    = {0x0c733a30, 0x2a1c, 0x11ce, {0xad, 0xe5, 0x00, 0xaa, 0x00, 0x44, 0x77, 0x3d}};
+static CONST IID IID_IPrintReadStream     = {0x4d47a67c, 0x66cc, 0x4430, {0x85, 0x0e, 0xda, 0xf4, 0x66, 0xfe, 0x5b, 0xc4}};
+static CONST IID IID_IPrintWriteStream    = {0x65bb7f1b, 0x371e, 0x4571, {0x8a, 0xc7, 0x91, 0x2f, 0x51, 0x0c, 0x1a, 0x38}};
+static CONST IID IID_IPartPrintTicket     = {0x4a0f50f6, 0xf9a2, 0x41f0, {0x99, 0xe7, 0x5a, 0xe9, 0x55, 0xbe, 0x8e, 0x9e}};
+static CONST IID IID_IXpsPartIterator     = {0x0021d3cd, 0xaf6f, 0x42ab, {0x99, 0x99, 0x14, 0xbc, 0x82, 0xa6, 0x2d, 0x2e}};
+static CONST IID IID_IFixedPage           = {0x3d9f6448, 0x7e95, 0x4cb5, {0x94, 0xfb, 0x01, 0x80, 0xc2, 0x88, 0x3a, 0x57}};
+static CONST IID IID_IXpsDocumentConsumer = {0x4368d8a2, 0x4181, 0x4a9f, {0xb2, 0x95, 0x3d, 0x9a, 0x38, 0xbb, 0x9b, 0xa0}};
+
+//
+// OLE strings
+//
+inline BSTR
+SysAllocString(
+    LPCWSTR psz
+    )
+{
+    BSTR bstr = NULL;
+
+    if (psz != NULL)
+    {
+        bstr = new WCHAR[wcslen(psz) + 1];
+        wcscpy(bstr, psz);
+    }
+
+    return bstr;
+}
+
+inline VOID
+SysFreeString(
+    BSTR bstr
+    )
+{
+    delete[] bstr;
+}
+
+//
+// ATL
+//
+template <class _T>
+class CComPtr
+{
+public:
+    CComPtr(
+        _T* p = NULL
+        ) :
+        m_p(p)
+    {
+        if (m_p != NULL)
+        {
+            m_p->AddRef();
+        }
+    }
+
+    CComPtr(
+        CONST CComPtr& p
+        ) :
+        m_p(p.m_p)
+    {
+        if (m_p != NULL)
+        {
+            m_p->AddRef();
+        }
+    }
+
+    ~CComPtr()
+    {
+        if (m_p != NULL)
+        {
+            m_p->Release();
+        }
+    }
+
+    CComPtr&
+    operator=(
+        _T* p
+        )
+    {
+        if (p != NULL)
+        {
+            p->AddRef();
+        }
+
+        if (m_p != NULL)
+        {
+            m_p->Release();
+        }
+
+        m_p = p;
+        return *this;
+    }
+
+    CComPtr&
+    operator=(
+        CONST CComPtr& p
+        )
+    {
+        return *this = p.m_p;
+    }
+
+    VOID
+    Attach(
+        _T* p
+        )
+    {
+        if (m_p != NULL)
+        {
+            m_p->Release();
+        }
+
+        m_p = p;
+    }
+
+    operator _T*() CONST
+    {
+        return m_p;
+    }
+
+    _T*
+    operator->() CONST
+    {
+        return m_p;
+    }
+
+    _T**
+    operator&()
+    {
+        return &m_p;
+    }
+
+private:
+    _T* m_p;
+};
+
+class CComBSTR
+{
+public:
+    CComBSTR() :
+        m_str(NULL)
+    {
+    }
+
+    CComBSTR(
+        LPCWSTR psz
+        ) :
+        m_str(SysAllocString(psz))
+    {
+    }
+
+    CComBSTR(
+        CONST CComBSTR& src
+        ) :
+        m_str(SysAllocString(src.m_str))
+    {
+    }
+
+    ~CComBSTR()
+    {
+        SysFreeString(m_str);
+    }
+
+    CComBSTR&
+    operator=(
+        CONST CComBSTR& src
+        )
+    {
+        if (this != &src)
+        {
+            SysFreeString(m_str);
+            m_str = SysAllocString(src.m_str);
+        }
+
+        return *this;
+    }
+
+    operator BSTR() CONST
+    {
+        return m_str;
+    }
+
+    BSTR*
+    operator&()
+    {
+        return &m_str;
+    }
+
+    BSTR m_str;
+};
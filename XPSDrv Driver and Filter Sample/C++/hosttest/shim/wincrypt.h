@@ -0,0 +1,79 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   wincrypt.h
+
+Abstract:
+
+   Host stand-in for the CryptoAPI hashing the filter sources use. The
+   routines are implemented by the test that needs them.
+
+--*/
+
+#pragma once
+
+typedef uintptr_t HCRYPTPROV;
+typedef uintptr_t HCRYPTHASH;
+typedef uintptr_t HCRYPTKEY;
+typedef DWORD     ALG_ID;
+
+#define PROV_RSA_AES            24
+#define CRYPT_VERIFYCONTEXT     0xF0000000
+#define CALG_SHA_256            0x0000800c
+#define HP_HASHVAL              0x0002
+
+BOOL
+CryptAcquireContext(
+    HCRYPTPROV* phProv,
+    LPCWSTR     szContainer,
+    LPCWSTR     szProvider,
+    DWORD       dwProvType,
+    DWORD       dwFlags
+    );
+
+BOOL
+CryptReleaseContext(
+    HCRYPTPROV hProv,
+    DWORD      dwFlags
+    );
+
+BOOL
+CryptCreateHash(
+    HCRYPTPROV  hProv,
+    ALG_ID      Algid,
+    HCRYPTKEY   hKey,
+    DWORD       dwFlags,
+    HCRYPTHASH* phHash
+    );
+
+BOOL
+CryptDestroyHash(
+    HCRYPTHASH hHash
+    );
+
+BOOL
+CryptHashData(
+    HCRYPTHASH  hHash,
+    CONST BYTE* pbData,
+    DWORD       dwDataLen,
+    DWORD       dwFlags
+    );
+
+BOOL
+CryptGetHashParam(
+    HCRYPTHASH hHash,
+    DWORD      dwParam,
+    BYTE*      pbData,
+    DWORD*     pdwDataLen,
+    DWORD      dwFlags
+    );
@@ -0,0 +1,41 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   xdexcept.h
+
+Abstract:
+
+   Host stand-in for the sample exception class.
+
+--*/
+
+#pragma once
+
+class CXDException
+{
+public:
+    CXDException(
+        _In_ HRESULT hr
+        ) :
+        m_hr(hr)
+    {
+    }
+
+    operator HRESULT() const
+    {
+        return m_hr;
+    }
+
+private:
+    HRESULT m_hr;
+};
@@ -0,0 +1,121 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   xdstring.h
+
+Abstract:
+
+   Host stand-in for CStringXDW, covering the members the host tests use.
+
+--*/
+
+#pragma once
+
+#include "xdexcept.h"
+
+class CStringXDW
+{
+public:
+    CStringXDW()
+    {
+    }
+
+    CStringXDW(
+        _In_ LPCWSTR sz
+        ) :
+        m_str(sz)
+    {
+    }
+
+    VOID
+    Format(
+        _In_ LPCWSTR szFormat,
+        ...
+        )
+    {
+        WCHAR   szBuffer[1024];
+        va_list args;
+
+        va_start(args, szFormat);
+        int cch = vswprintf(szBuffer, ARRAYSIZE(szBuffer), szFormat, args);
+        va_end(args);
+
+        if (cch < 0)
+        {
+            throw CXDException(E_FAIL);
+        }
+
+        m_str.assign(szBuffer, cch);
+    }
+
+    VOID
+    Append(
+        _In_ LPCWSTR sz
+        )
+    {
+        m_str.append(sz);
+    }
+
+    VOID
+    Append(
+        _In_ CONST CStringXDW& str
+        )
+    {
+        m_str.append(str.m_str);
+    }
+
+    VOID
+    Empty()
+    {
+        m_str.clear();
+    }
+
+    VOID
+    MakeLower()
+    {
+        for (size_t cch = 0; cch < m_str.size(); cch++)
+        {
+            m_str[cch] = static_cast<WCHAR>(towlower(m_str[cch]));
+        }
+    }
+
+    INT
+    GetLength() CONST
+    {
+        return static_cast<INT>(m_str.size());
+    }
+
+    operator LPCWSTR() CONST
+    {
+        return m_str.c_str();
+    }
+
+    bool
+    operator==(
+        _In_ CONST CStringXDW& rhs
+        ) CONST
+    {
+        return m_str == rhs.m_str;
+    }
+
+    bool
+    operator!=(
+        _In_ CONST CStringXDW& rhs
+        ) CONST
+    {
+        return m_str != rhs.m_str;
+    }
+
+private:
+    wstring m_str;
+};
@@ -18,7 +18,8 @@ Abstract:
    Booklet filter implementation. This class derives from the Xps filter
    class and implements the necessary part handlers to support booklet
    printing. The booklet filter is responsible for re-ordering pages and re-uses
-   the NUp filter to provide 2-up and offset support.
+   the NUp filter to provide 2-up and offset support. Pages waiting to be
+   re-ordered are held in a page store that spills their mark-up to disk.
 
 --*/
 
@@ -259,17 +260,9 @@ CBookletFilter::ProcessPart(
         if (m_bookScope != CBkPTProperties::None)
         {
             //
-            // Cache pages for reordering
+            // Store pages for reordering
             //
-            try
-            {
-                m_cacheFP.push_back(pFP);
-            }
-            catch (exception& DBG_ONLY(e))
-            {
-                ERR(e.what());
-                hr = E_FAIL;
-            }
+            hr = m_pageStore.AddPage(pFP);
         }
         else
         {
@@ -321,7 +314,7 @@ Routine Name:
 
 Routine Description:
 
-    Method to send the cached collection of pages in the correct order back
+    Method to send the stored collection of pages in the correct order back
 
 Arguments:
 
@@ -346,7 +339,7 @@ CBookletFilter::FlushCache(
         hr = E_PENDING;
     }
 
-    size_t cPages = m_cacheFP.size();
+    UINT cPages = m_pageStore.GetPageCount();
 
     if (SUCCEEDED(hr) &&
         cPages > 0 &&
@@ -357,66 +350,31 @@ CBookletFilter::FlushCache(
         //
         CComPtr<IFixedPage> pNewFP(NULL);
         if (cPages%2 == 1 &&
-            SUCCEEDED(hr = CreatePadPage(&pNewFP)))
+            SUCCEEDED(hr = CreatePadPage(&pNewFP)) &&
+            SUCCEEDED(hr = m_pageStore.AddPage(pNewFP)))
         {
-            //
-            // We successfully created our pad page; add it to the cache
-            //
-            try
-            {
-                m_cacheFP.push_back(pNewFP);
-            }
-            catch (exception& DBG_ONLY(e))
-            {
-                ERR(e.what());
-                hr = E_FAIL;
-            }
-
             cPages++;
         }
 
-        if (SUCCEEDED(hr))
-        {
-            try
-            {
-                //
-                // Re-order pages in the cache
-                //
-                map<size_t, IFixedPage*>  reorderedPages;
-                size_t newIndex = 0;
-                size_t pageIndex = 0;
-                for (pageIndex = 0; pageIndex < cPages/2; pageIndex++)
-                {
-                    reorderedPages[newIndex] = m_cacheFP[pageIndex];
-                    newIndex += 2;
-                }
-
-                newIndex = cPages - 1;
-                for (pageIndex = cPages/2; pageIndex < cPages; pageIndex++)
-                {
-                    reorderedPages[newIndex] = m_cacheFP[pageIndex];
-                    newIndex -= 2;
-                }
-
-                //
-                // Write out reordered pages
-                //
-                for (pageIndex = 0; pageIndex < cPages && SUCCEEDED(hr); pageIndex++)
-                {
-                    hr = m_pXDWriter->SendFixedPage(reorderedPages[pageIndex]);
-                }
+        //
+        // Write out the stored pages in booklet order. Each page is
+        // re-created from the store as it is sent.
+        //
+        vector<UINT> pageOrder;
 
-                //
-                // Clean out the cache
-                //
-                m_cacheFP.clear();
-            }
-            catch (exception& DBG_ONLY(e))
+        if (SUCCEEDED(hr) &&
+            SUCCEEDED(hr = GetBookletPageOrder(cPages, &pageOrder)))
+        {
+            for (UINT pageIndex = 0; pageIndex < cPages && SUCCEEDED(hr); pageIndex++)
             {
-                ERR(e.what());
-                hr = E_FAIL;
+                hr = m_pageStore.SendPage(pageOrder[pageIndex], m_pXDWriter);
             }
         }
+
+        //
+        // Clean out the store
+        //
+        m_pageStore.Clear();
     }
 
     ERR_ON_HR(hr);
@@ -490,24 +448,13 @@ CBookletFilter::CreatePadPage(
                 // element and discards all other content.
                 //
                 CBkSaxHandler bkSaxHndlr(pWriter);
-                CComPtr<IPrintReadStream> pReader(NULL);
-
-                IFixedPage* pFP = NULL;
-
-                pFP = m_cacheFP[0];
+                CComPtr<ISequentialStream> pPageStream(NULL);
 
                 if (SUCCEEDED(hr) &&
                     SUCCEEDED(hr = pSaxRdr->putContentHandler(&bkSaxHndlr)) &&
-                    SUCCEEDED(hr = pFP->GetStream(&pReader)))
+                    SUCCEEDED(hr = m_pageStore.GetPageStream(0, &pPageStream)))
                 {
-                    CComPtr<ISequentialStream> pReadStreamToSeq(NULL);
-
-                    pReadStreamToSeq.Attach(new(std::nothrow) pfp::PrintReadStreamToSeqStream(pReader));
-
-                    if (SUCCEEDED(hr = CHECK_POINTER(pReadStreamToSeq, E_OUTOFMEMORY)))
-                    {
-                        hr = pSaxRdr->parse(CComVariant(static_cast<ISequentialStream*>(pReadStreamToSeq)));
-                    }
+                    hr = pSaxRdr->parse(CComVariant(static_cast<ISequentialStream*>(pPageStream)));
                 }
 
                 pWriter->Close();
@@ -18,7 +18,11 @@ Abstract:
    Booklet filter class definition. This class derives from the Xps filter
    class and implements the necessary part handlers to support booklet
    printing. The booklet filter is responsible for re-ordering pages and re-uses
-   the NUp filter to provide 2-up and offset support.
+   the NUp filter to provide 2-up and offset support. Pages waiting to be
+   re-ordered are held in a page store that spills their mark-up to disk.
+
+   The NUp filter re-orders booklet pages itself while applying 2-up, so the
+   booklet filter is only needed in pipelines that do not include it.
 
 --*/
 
@@ -26,6 +30,7 @@ Abstract:
 
 #include "xdrchflt.h"
 #include "bkprps.h"
+#include "pgstore.h"
 
 class CBookletFilter : public CXDXpsFilter
 {
@@ -71,7 +76,7 @@ private:
         );
 
 private:
-    vector<CComPtr<IFixedPage> >   m_cacheFP;
+    CPageStore                     m_pageStore;
 
     BOOL                           m_bSendAllDocs;
 
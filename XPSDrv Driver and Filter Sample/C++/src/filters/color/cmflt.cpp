@@ -182,7 +182,7 @@ CColorManageFilter::ProcessPart(
                         //
                         // Create a profile manager which handles working with the selected profile
                         //
-                        CProfileManager profManager(varName.bstrVal, cmProfData, cmIntData, pFP);
+                        CProfileManager profManager(varName.bstrVal, cmProfData, cmIntData, pFP, &m_lutCache);
 
                         //
                         // Create two color converter objects which coordinate color transforms for
@@ -24,6 +24,7 @@ Abstract:
 
 #include "xdrchflt.h"
 #include "ptmanage.h"
+#include "colorlut.h"
 
 typedef map<CStringXDW, BOOL> ResDeleteMap;
 
@@ -47,5 +48,11 @@ private:
     // color profiles in the container
     //
     CFileResourceCache m_resCache;
+
+    //
+    // Create a color look-up table cache so that tables built for bitmaps on
+    // one page can be re-used on the following pages
+    //
+    CColorLUTCache     m_lutCache;
 };
 
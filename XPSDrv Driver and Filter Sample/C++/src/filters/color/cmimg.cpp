@@ -385,34 +385,148 @@ CColorManagedImage::WriteData(
                     }
                 }
 
-                //
-                // Set the content type of the image part
-                //
-                CComQIPtr<IPartImage> pImage = pResource;
-                if (SUCCEEDED(hr) &&
-                    SUCCEEDED(hr = CHECK_POINTER(pImage, E_NOINTERFACE)))
+                if (SUCCEEDED(hr))
                 {
-                    hr = pImage->SetImageContent(CComBSTR(L"image/vnd.ms-photo"));
+                    hr = SetPartProperties(pResource);
                 }
+            }
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
+        }
+    }
 
-                //
-                // If all is well mark the replaced bitmap and profile for deletion
-                //
-                if (SUCCEEDED(hr))
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorManagedImage::GetContentKey
+
+Routine Description:
+
+    Method to obtain a key identifying the content the converted image is
+    generated from. This is a hash of the source bitmap data, any profile
+    associated with the bitmap in the mark-up and the conversion settings
+    of the profile manager. Images with the same key convert to the same data,
+    so the conversion can be skipped when the key has been seen before.
+
+Arguments:
+
+    pKey - Pointer to the content key that receives the hash
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorManagedImage::GetContentKey(
+    _Out_ ResContentKey* pKey
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pKey, E_POINTER)))
+    {
+        try
+        {
+            CContentHash contentHash;
+            CStringXDW   cstrConversion;
+
+            CComPtr<IUnknown>         pRead(NULL);
+            CComPtr<IPartImage>       pImagePart(NULL);
+            CComPtr<IPrintReadStream> pImageStream(NULL);
+
+            if (SUCCEEDED(hr = m_pProfManager->GetConversionKey(&cstrConversion)) &&
+                SUCCEEDED(hr = contentHash.HashString(cstrConversion)) &&
+                SUCCEEDED(hr = m_pFixedPage->GetPagePart(m_bstrBitmapURI, &pRead)) &&
+                SUCCEEDED(hr = pRead.QueryInterface(&pImagePart)) &&
+                SUCCEEDED(hr = pImagePart->GetStream(&pImageStream)) &&
+                SUCCEEDED(hr = contentHash.HashStream(pImageStream)))
+            {
+                if (m_bstrSrcProfileURI.Length() > 0)
                 {
-                    (*m_pResDel)[m_bstrBitmapURI.m_str] = TRUE;
+                    CComPtr<IUnknown>          pProfileRead(NULL);
+                    CComPtr<IPartColorProfile> pProfilePart(NULL);
+                    CComPtr<IPrintReadStream>  pProfileStream(NULL);
 
-                    if (m_bstrSrcProfileURI.Length() > 0)
+                    if (SUCCEEDED(hr = m_pFixedPage->GetPagePart(m_bstrSrcProfileURI, &pProfileRead)) &&
+                        SUCCEEDED(hr = pProfileRead.QueryInterface(&pProfilePart)) &&
+                        SUCCEEDED(hr = pProfilePart->GetStream(&pProfileStream)))
                     {
-                        (*m_pResDel)[m_bstrSrcProfileURI.m_str] = TRUE;
+                        hr = contentHash.HashStream(pProfileStream);
                     }
                 }
+
+                if (SUCCEEDED(hr))
+                {
+                    hr = contentHash.GetKey(pKey);
+                }
             }
         }
         catch (CXDException& e)
         {
             hr = e;
         }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorManagedImage::WriteCachedData
+
+Routine Description:
+
+    Method to write a previously converted image to the resource stream in
+    place of converting the source bitmap again
+
+Arguments:
+
+    pResource - Pointer to the image part being written
+    pStream   - Pointer to the image part stream
+    pData     - Pointer to the converted image data
+    cbData    - Count of bytes of converted image data
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorManagedImage::WriteCachedData(
+    _In_                     IPartBase*         pResource,
+    _In_                     IPrintWriteStream* pStream,
+    _In_reads_bytes_(cbData) CONST BYTE*        pData,
+    _In_                     ULONG              cbData
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = IResWriter::WriteCachedData(pResource, pStream, pData, cbData)))
+    {
+        try
+        {
+            hr = SetPartProperties(pResource);
+        }
         catch (exception& DBG_ONLY(e))
         {
             ERR(e.what());
@@ -744,6 +858,61 @@ CColorManagedImage::SetSrcProfile(
 }
 
 
+/*++
+
+Routine Name:
+
+    CColorManagedImage::SetPartProperties
+
+Routine Description:
+
+    Method to set the content type of the converted image part and mark the
+    replaced bitmap and profile for deletion from the page
+
+Arguments:
+
+    pResource - Pointer to the converted image part
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorManagedImage::SetPartProperties(
+    _In_ IPartBase* pResource
+    )
+{
+    HRESULT hr = S_OK;
+
+    //
+    // Set the content type of the image part
+    //
+    CComQIPtr<IPartImage> pImage = pResource;
+    if (SUCCEEDED(hr = CHECK_POINTER(pImage, E_NOINTERFACE)))
+    {
+        hr = pImage->SetImageContent(CComBSTR(L"image/vnd.ms-photo"));
+    }
+
+    //
+    // If all is well mark the replaced bitmap and profile for deletion
+    //
+    if (SUCCEEDED(hr))
+    {
+        (*m_pResDel)[m_bstrBitmapURI.m_str] = TRUE;
+
+        if (m_bstrSrcProfileURI.Length() > 0)
+        {
+            (*m_pResDel)[m_bstrSrcProfileURI.m_str] = TRUE;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
 /*++
 
 Routine Name:
@@ -753,7 +922,9 @@ Routine Name:
 Routine Description:
 
     Given source and destination scanline iterators, this method applies the
-    requiresite color transform
+    requiresite color transform. Where the scanline formats allow it the
+    transform is applied through a cached color look-up table rather than
+    through TranslateBitmapBits
 
 Arguments:
 
@@ -785,6 +956,8 @@ CColorManagedImage::TransformScanLines(
             //
             HTRANSFORM hTransform = NULL;
             BOOL       bCanUseWCS = FALSE;
+            CColorLUT* pLUT = NULL;
+            BOOL       bCheckedLUT = FALSE;
 
             if (SUCCEEDED(hr = m_pProfManager->GetColorTransform(&hTransform, &bCanUseWCS)))
             {
@@ -813,20 +986,50 @@ CColorManagedImage::TransformScanLines(
                     if (SUCCEEDED(hr = pSrcScans->GetScanBuffer(&pSrcData, &bmSrcFormat, &cSrcWidth, &cSrcHeight, &cbSrcStride)) &&
                         SUCCEEDED(hr = pDstScans->GetScanBuffer(&pDstData, &bmDstFormat, &cDstWidth, &cDstHeight, &cbDstStride)))
                     {
+                        //
+                        // ...look for a look-up table for the scanline formats the first time through...
+                        //
+                        if (!bCheckedLUT)
+                        {
+                            bCheckedLUT = TRUE;
+
+                            //
+                            // Failing to build a table is not fatal; fall back to TranslateBitmapBits
+                            //
+                            if (FAILED(m_pProfManager->GetColorLUT(bmSrcFormat, bmDstFormat, &pLUT)))
+                            {
+                                pLUT = NULL;
+                            }
+                        }
+
                         //
                         // ...translate the scanline data...
                         //
-                        if (TranslateBitmapBits(hTransform,
-                                                pSrcData,
-                                                bmSrcFormat,
-                                                cSrcWidth,
-                                                cSrcHeight,
-                                                cbSrcStride,
-                                                pDstData,
-                                                bmDstFormat,
-                                                cbDstStride,
-                                                NULL,
-                                                0))
+                        if (pLUT != NULL)
+                        {
+                            if (SUCCEEDED(hr = pLUT->Apply(pSrcData,
+                                                           cbSrcStride,
+                                                           pDstData,
+                                                           cbDstStride,
+                                                           cSrcWidth,
+                                                           cSrcHeight)))
+                            {
+                                hr = pDstScans->Commit(*pSrcScans);
+                                (*pSrcScans)++;
+                                (*pDstScans)++;
+                            }
+                        }
+                        else if (TranslateBitmapBits(hTransform,
+                                                     pSrcData,
+                                                     bmSrcFormat,
+                                                     cSrcWidth,
+                                                     cSrcHeight,
+                                                     cbSrcStride,
+                                                     pDstData,
+                                                     bmDstFormat,
+                                                     cbDstStride,
+                                                     NULL,
+                                                     0))
                         {
                             //
                             // ...and commit the data to the destination bitmap before incrementing to the next scanline.
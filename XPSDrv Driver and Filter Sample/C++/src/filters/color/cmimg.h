@@ -57,7 +57,25 @@ public:
         _Outptr_ BSTR* pbstrResURI
         );
 
+    HRESULT
+    GetContentKey(
+        _Out_ ResContentKey* pKey
+        );
+
+    HRESULT
+    WriteCachedData(
+        _In_                     IPartBase*         pResource,
+        _In_                     IPrintWriteStream* pStream,
+        _In_reads_bytes_(cbData) CONST BYTE*        pData,
+        _In_                     ULONG              cbData
+        );
+
 private:
+    HRESULT
+    SetPartProperties(
+        _In_ IPartBase* pResource
+        );
+
     HRESULT
     SetSrcProfile(
         _In_ CBmpConverter* pScanIter
@@ -0,0 +1,919 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   colorlut.cpp
+
+Abstract:
+
+   Color look-up table class implementations. The CColorLUT class samples a
+   color transform over a regular grid of source colors once, and then converts
+   bitmap data by tetrahedral interpolation in that grid instead of calling
+   TranslateBitmapBits. The CColorLUTCache class keeps the tables across pages.
+
+   Only formats whose channels are plain 8 or 16 bit integers are handled; the
+   caller is expected to use TranslateBitmapBits for anything else. Channels
+   are handled in their order in memory, and the table is built with the same
+   BMFORMATs that it is applied to, so the table does not depend on the
+   channel order of the formats.
+
+--*/
+
+#include "precomp.h"
+#include "debug.h"
+#include "globals.h"
+#include "xdstring.h"
+#include "xdexcept.h"
+#include "colorlut.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define COLORLUT_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+Description of a pixel format that the color look-up tables handle
+*/
+struct LUTPixelFormat
+{
+    BMFORMAT m_bmFormat;
+    UINT     m_cChannels;
+    UINT     m_cbPixel;
+    BOOL     m_bWord;
+    BOOL     m_bCanBeDst;
+    UINT     m_cBlackChannel;
+};
+
+/*
+Look-up table of the pixel formats that the color look-up tables handle. The
+xRGB formats carry a fourth byte that the transform ignores, so they are only
+handled as a source.
+*/
+static CONST LUTPixelFormat g_lutLUTPixelFormats[] = {
+    {BM_RGBTRIPLETS, 3, 3, FALSE, TRUE,  0},
+    {BM_BGRTRIPLETS, 3, 3, FALSE, TRUE,  0},
+    {BM_xRGBQUADS,   3, 4, FALSE, FALSE, 0},
+    {BM_xBGRQUADS,   3, 4, FALSE, FALSE, 0},
+    {BM_CMYKQUADS,   4, 4, FALSE, TRUE,  3},
+    {BM_KYMCQUADS,   4, 4, FALSE, TRUE,  0},
+    {BM_16b_RGB,     3, 6, TRUE,  TRUE,  0}
+};
+
+/*++
+
+Routine Name:
+
+    FindLUTPixelFormat
+
+Routine Description:
+
+    Finds the description of a BMFORMAT handled by the color look-up tables
+
+Arguments:
+
+    bmFormat - The BMFORMAT to look up
+
+Return Value:
+
+    CONST LUTPixelFormat*
+    Pointer to the description - On success
+    NULL                       - If the format is not handled
+
+--*/
+static CONST LUTPixelFormat*
+FindLUTPixelFormat(
+    _In_ CONST BMFORMAT& bmFormat
+    )
+{
+    for (UINT cFormat = 0; cFormat < ARRAYSIZE(g_lutLUTPixelFormats); cFormat++)
+    {
+        if (g_lutLUTPixelFormats[cFormat].m_bmFormat == bmFormat)
+        {
+            return &g_lutLUTPixelFormats[cFormat];
+        }
+    }
+
+    return NULL;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::CColorLUT
+
+Routine Description:
+
+    CColorLUT constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CColorLUT::CColorLUT() :
+    m_bmSrcFormat(BM_RGBTRIPLETS),
+    m_bmDstFormat(BM_RGBTRIPLETS),
+    m_cSrcChannels(0),
+    m_cbSrcPixel(0),
+    m_bSrcWord(FALSE),
+    m_cDstChannels(0),
+    m_cbDstPixel(0),
+    m_bDstWord(FALSE),
+    m_cGridPoints(0),
+    m_pNodes(NULL),
+    m_cNodes(0)
+{
+    ZeroMemory(m_rgDimChannel, sizeof(m_rgDimChannel));
+    ZeroMemory(m_rgDimStride, sizeof(m_rgDimStride));
+    ZeroMemory(m_rgCell8, sizeof(m_rgCell8));
+    ZeroMemory(m_rgFrac8, sizeof(m_rgFrac8));
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::~CColorLUT
+
+Routine Description:
+
+    CColorLUT destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CColorLUT::~CColorLUT()
+{
+    FreeLUT();
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::IsFormatSupported
+
+Routine Description:
+
+    Reports whether a conversion between two BMFORMATs can be handled with
+    a color look-up table
+
+Arguments:
+
+    bmSrcFormat - The source BMFORMAT
+    bmDstFormat - The destination BMFORMAT
+
+Return Value:
+
+    BOOL
+    TRUE  - If a look-up table can be used
+    FALSE - Otherwise
+
+--*/
+BOOL
+CColorLUT::IsFormatSupported(
+    _In_ CONST BMFORMAT& bmSrcFormat,
+    _In_ CONST BMFORMAT& bmDstFormat
+    )
+{
+    CONST LUTPixelFormat* pSrcFormat = FindLUTPixelFormat(bmSrcFormat);
+    CONST LUTPixelFormat* pDstFormat = FindLUTPixelFormat(bmDstFormat);
+
+    return pSrcFormat != NULL &&
+           pDstFormat != NULL &&
+           pDstFormat->m_bCanBeDst;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::Initialize
+
+Routine Description:
+
+    Builds the look-up table by passing every grid node through the color
+    transform in a single call to TranslateBitmapBits
+
+Arguments:
+
+    hTransform  - Handle to the color transform to sample
+    bmSrcFormat - The source BMFORMAT the table will be applied to
+    bmDstFormat - The destination BMFORMAT the table will be applied to
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorLUT::Initialize(
+    _In_ HTRANSFORM      hTransform,
+    _In_ CONST BMFORMAT& bmSrcFormat,
+    _In_ CONST BMFORMAT& bmDstFormat
+    )
+{
+    HRESULT hr = S_OK;
+
+    CONST LUTPixelFormat* pSrcFormat = FindLUTPixelFormat(bmSrcFormat);
+    CONST LUTPixelFormat* pDstFormat = FindLUTPixelFormat(bmDstFormat);
+
+    PBYTE pSrcGrid = NULL;
+    PBYTE pDstGrid = NULL;
+
+    FreeLUT();
+
+    if (SUCCEEDED(hr = CHECK_HANDLE(hTransform, E_INVALIDARG)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pSrcFormat, E_INVALIDARG)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pDstFormat, E_INVALIDARG)))
+    {
+        if (!pDstFormat->m_bCanBeDst)
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_bmSrcFormat  = bmSrcFormat;
+        m_cSrcChannels = pSrcFormat->m_cChannels;
+        m_cbSrcPixel   = pSrcFormat->m_cbPixel;
+        m_bSrcWord     = pSrcFormat->m_bWord;
+
+        m_bmDstFormat  = bmDstFormat;
+        m_cDstChannels = pDstFormat->m_cChannels;
+        m_cbDstPixel   = pDstFormat->m_cbPixel;
+        m_bDstWord     = pDstFormat->m_bWord;
+
+        m_cGridPoints = m_cSrcChannels == 4 ? ms_cGridPoints4D : ms_cGridPoints3D;
+
+        //
+        // For 4 channel sources the black channel is the outermost dimension
+        // and is interpolated linearly; the remaining channels follow in order
+        //
+        UINT cDim = 0;
+
+        if (m_cSrcChannels == 4)
+        {
+            m_rgDimChannel[cDim++] = pSrcFormat->m_cBlackChannel;
+        }
+
+        for (UINT cChan = 0; cChan < m_cSrcChannels; cChan++)
+        {
+            if (m_cSrcChannels != 4 ||
+                cChan != pSrcFormat->m_cBlackChannel)
+            {
+                m_rgDimChannel[cDim++] = cChan;
+            }
+        }
+
+        m_rgDimStride[m_cSrcChannels - 1] = 1;
+
+        for (UINT cDimStride = m_cSrcChannels - 1; cDimStride > 0; cDimStride--)
+        {
+            m_rgDimStride[cDimStride - 1] = m_rgDimStride[cDimStride] * m_cGridPoints;
+        }
+
+        m_cNodes = m_rgDimStride[0] * m_cGridPoints;
+
+        //
+        // Set up the grid cell look-up for 8 bit sources
+        //
+        for (UINT cValue = 0; cValue < 256; cValue++)
+        {
+            UINT cPos = cValue * (m_cGridPoints - 1);
+
+            m_rgCell8[cValue] = cPos / 255;
+            m_rgFrac8[cValue] = static_cast<FLOAT>(cPos % 255) / 255.0f;
+
+            if (m_rgCell8[cValue] == m_cGridPoints - 1)
+            {
+                m_rgCell8[cValue]--;
+                m_rgFrac8[cValue] = 1.0f;
+            }
+        }
+
+        m_pNodes   = new(std::nothrow) FLOAT[m_cNodes * 4];
+        pSrcGrid   = new(std::nothrow) BYTE[m_cNodes * m_cbSrcPixel];
+        pDstGrid   = new(std::nothrow) BYTE[m_cNodes * m_cbDstPixel];
+
+        if (SUCCEEDED(hr = CHECK_POINTER(m_pNodes, E_OUTOFMEMORY)) &&
+            SUCCEEDED(hr = CHECK_POINTER(pSrcGrid, E_OUTOFMEMORY)) &&
+            SUCCEEDED(hr = CHECK_POINTER(pDstGrid, E_OUTOFMEMORY)))
+        {
+            ZeroMemory(pSrcGrid, m_cNodes * m_cbSrcPixel);
+
+            //
+            // Write the source color for each grid node. The grid spacing
+            // divides the channel maximum so every node is exact.
+            //
+            UINT cMaxValue = m_bSrcWord ? 0xFFFF : 0xFF;
+            UINT cStep     = cMaxValue / (m_cGridPoints - 1);
+
+            for (UINT cNode = 0; cNode < m_cNodes; cNode++)
+            {
+                PBYTE pPixel = pSrcGrid + cNode * m_cbSrcPixel;
+                UINT  cRemainder = cNode;
+
+                for (UINT cDimNode = m_cSrcChannels; cDimNode > 0; cDimNode--)
+                {
+                    UINT cValue = (cRemainder % m_cGridPoints) * cStep;
+                    UINT cChan  = m_rgDimChannel[cDimNode - 1];
+
+                    cRemainder /= m_cGridPoints;
+
+                    if (m_bSrcWord)
+                    {
+                        reinterpret_cast<PWORD>(pPixel)[cChan] = static_cast<WORD>(cValue);
+                    }
+                    else
+                    {
+                        pPixel[cChan] = static_cast<BYTE>(cValue);
+                    }
+                }
+            }
+
+            if (TranslateBitmapBits(hTransform,
+                                    pSrcGrid,
+                                    m_bmSrcFormat,
+                                    m_cNodes,
+                                    1,
+                                    0,
+                                    pDstGrid,
+                                    m_bmDstFormat,
+                                    0,
+                                    NULL,
+                                    0))
+            {
+                //
+                // Store the transformed nodes as floats, padded to four channels
+                //
+                for (UINT cNode = 0; cNode < m_cNodes; cNode++)
+                {
+                    PBYTE  pPixel = pDstGrid + cNode * m_cbDstPixel;
+                    PFLOAT pNode  = m_pNodes + cNode * 4;
+
+                    for (UINT cChan = 0; cChan < 4; cChan++)
+                    {
+                        if (cChan >= m_cDstChannels)
+                        {
+                            pNode[cChan] = 0.0f;
+                        }
+                        else if (m_bDstWord)
+                        {
+                            pNode[cChan] = static_cast<FLOAT>(reinterpret_cast<PWORD>(pPixel)[cChan]);
+                        }
+                        else
+                        {
+                            pNode[cChan] = static_cast<FLOAT>(pPixel[cChan]);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                hr = GetLastErrorAsHResult();
+            }
+        }
+    }
+
+    if (pSrcGrid != NULL)
+    {
+        delete[] pSrcGrid;
+        pSrcGrid = NULL;
+    }
+
+    if (pDstGrid != NULL)
+    {
+        delete[] pDstGrid;
+        pDstGrid = NULL;
+    }
+
+    if (FAILED(hr))
+    {
+        FreeLUT();
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::Apply
+
+Routine Description:
+
+    Converts a block of scanlines from the source to the destination format
+    using the look-up table
+
+Arguments:
+
+    pSrcData    - Pointer to the first source scanline
+    cbSrcStride - Byte offset between source scanlines
+    pDstData    - Pointer to the first destination scanline
+    cbDstStride - Byte offset between destination scanlines
+    cWidth      - Count of pixels in each scanline
+    cHeight     - Count of scanlines
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorLUT::Apply(
+    _In_reads_bytes_(cbSrcStride * cHeight)  PBYTE pSrcData,
+    _In_                                     UINT  cbSrcStride,
+    _Out_writes_bytes_(cbDstStride * cHeight) PBYTE pDstData,
+    _In_                                     UINT  cbDstStride,
+    _In_                                     UINT  cWidth,
+    _In_                                     UINT  cHeight
+    ) CONST
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pSrcData, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pDstData, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(m_pNodes, E_PENDING)))
+    {
+        if (cHeight > 1 &&
+            (static_cast<ULONGLONG>(cWidth) * m_cbSrcPixel > cbSrcStride ||
+             static_cast<ULONGLONG>(cWidth) * m_cbDstPixel > cbDstStride))
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        for (UINT cLine = 0;
+             cLine < cHeight;
+             cLine++, pSrcData += cbSrcStride, pDstData += cbDstStride)
+        {
+            ApplyScanline(pSrcData, pDstData, cWidth);
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::FreeLUT
+
+Routine Description:
+
+    Frees the look-up table
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CColorLUT::FreeLUT(
+    VOID
+    )
+{
+    if (m_pNodes != NULL)
+    {
+        delete[] m_pNodes;
+        m_pNodes = NULL;
+    }
+
+    m_cNodes = 0;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::ApplyScanline
+
+Routine Description:
+
+    Converts one scanline with the look-up table.
+
+    The source color is located in a grid cell, and the cell is split into
+    six tetrahedra by ordering the positions within the cell along each
+    dimension. The result is the weighted sum of the four corners of the
+    tetrahedron containing the color, computed for all destination channels
+    at once. For 4 channel sources this is done in the two neighbouring
+    planes of the black channel and the results are blended linearly.
+
+Arguments:
+
+    pSrc   - Pointer to the source scanline
+    pDst   - Pointer to the destination scanline
+    cWidth - Count of pixels in the scanline
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CColorLUT::ApplyScanline(
+    _In_reads_bytes_(cWidth * m_cbSrcPixel)  PBYTE pSrc,
+    _Out_writes_bytes_(cWidth * m_cbDstPixel) PBYTE pDst,
+    _In_                                     UINT  cWidth
+    ) CONST
+{
+    CONST UINT cDims   = m_cSrcChannels;
+    CONST UINT cTetra  = cDims - 3;
+    CONST UINT cMaxPos = m_cGridPoints - 1;
+
+    for (UINT cPix = 0;
+         cPix < cWidth;
+         cPix++, pSrc += m_cbSrcPixel, pDst += m_cbDstPixel)
+    {
+        UINT  cNode = 0;
+        FLOAT rgFrac[4];
+
+        //
+        // Locate the grid cell and the position within it
+        //
+        for (UINT cDim = 0; cDim < cDims; cDim++)
+        {
+            UINT cChan = m_rgDimChannel[cDim];
+            UINT cCell = 0;
+
+            if (m_bSrcWord)
+            {
+                UINT cPos = reinterpret_cast<PWORD>(pSrc)[cChan] * cMaxPos;
+
+                cCell = cPos / 0xFFFF;
+                rgFrac[cDim] = static_cast<FLOAT>(cPos % 0xFFFF) / 65535.0f;
+
+                if (cCell == cMaxPos)
+                {
+                    cCell--;
+                    rgFrac[cDim] = 1.0f;
+                }
+            }
+            else
+            {
+                cCell = m_rgCell8[pSrc[cChan]];
+                rgFrac[cDim] = m_rgFrac8[pSrc[cChan]];
+            }
+
+            cNode += cCell * m_rgDimStride[cDim];
+        }
+
+        //
+        // Order the tetrahedral dimensions by descending position in the cell
+        //
+        FLOAT fA = rgFrac[cTetra];
+        FLOAT fB = rgFrac[cTetra + 1];
+        FLOAT fC = rgFrac[cTetra + 2];
+        UINT  cStrideA = m_rgDimStride[cTetra];
+        UINT  cStrideB = m_rgDimStride[cTetra + 1];
+        UINT  cStrideC = m_rgDimStride[cTetra + 2];
+
+        if (fA < fB)
+        {
+            swap(fA, fB);
+            swap(cStrideA, cStrideB);
+        }
+
+        if (fB < fC)
+        {
+            swap(fB, fC);
+            swap(cStrideB, cStrideC);
+
+            if (fA < fB)
+            {
+                swap(fA, fB);
+                swap(cStrideA, cStrideB);
+            }
+        }
+
+        CONST FLOAT* p0 = m_pNodes + cNode * 4;
+        CONST FLOAT* p1 = p0 + cStrideA * 4;
+        CONST FLOAT* p2 = p1 + cStrideB * 4;
+        CONST FLOAT* p3 = p2 + cStrideC * 4;
+
+        INT rgResult[4];
+
+#ifdef COLORLUT_SSE2
+        __m128 vA = _mm_set1_ps(fA);
+        __m128 vB = _mm_set1_ps(fB);
+        __m128 vC = _mm_set1_ps(fC);
+
+        __m128 v0 = _mm_loadu_ps(p0);
+        __m128 v1 = _mm_loadu_ps(p1);
+        __m128 v2 = _mm_loadu_ps(p2);
+        __m128 v3 = _mm_loadu_ps(p3);
+
+        __m128 vResult = _mm_add_ps(
+                            _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), vA)),
+                            _mm_add_ps(_mm_mul_ps(_mm_sub_ps(v2, v1), vB),
+                                       _mm_mul_ps(_mm_sub_ps(v3, v2), vC)));
+
+        if (cTetra > 0)
+        {
+            CONST UINT cPlane = m_rgDimStride[0] * 4;
+
+            v0 = _mm_loadu_ps(p0 + cPlane);
+            v1 = _mm_loadu_ps(p1 + cPlane);
+            v2 = _mm_loadu_ps(p2 + cPlane);
+            v3 = _mm_loadu_ps(p3 + cPlane);
+
+            __m128 vNext = _mm_add_ps(
+                                _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), vA)),
+                                _mm_add_ps(_mm_mul_ps(_mm_sub_ps(v2, v1), vB),
+                                           _mm_mul_ps(_mm_sub_ps(v3, v2), vC)));
+
+            vResult = _mm_add_ps(vResult,
+                                 _mm_mul_ps(_mm_sub_ps(vNext, vResult), _mm_set1_ps(rgFrac[0])));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgResult), _mm_cvtps_epi32(vResult));
+#else
+        for (UINT cChan = 0; cChan < 4; cChan++)
+        {
+            FLOAT fResult = p0[cChan] +
+                            (p1[cChan] - p0[cChan]) * fA +
+                            (p2[cChan] - p1[cChan]) * fB +
+                            (p3[cChan] - p2[cChan]) * fC;
+
+            if (cTetra > 0)
+            {
+                CONST UINT cPlane = m_rgDimStride[0] * 4;
+
+                FLOAT fNext = p0[cPlane + cChan] +
+                              (p1[cPlane + cChan] - p0[cPlane + cChan]) * fA +
+                              (p2[cPlane + cChan] - p1[cPlane + cChan]) * fB +
+                              (p3[cPlane + cChan] - p2[cPlane + cChan]) * fC;
+
+                fResult += (fNext - fResult) * rgFrac[0];
+            }
+
+            rgResult[cChan] = static_cast<INT>(fResult + 0.5f);
+        }
+#endif
+
+        //
+        // The result is a weighted average of nodes in the destination range,
+        // so it only needs clamping against rounding at the ends of the range
+        //
+        for (UINT cChan = 0; cChan < m_cDstChannels; cChan++)
+        {
+            INT iValue = rgResult[cChan] < 0 ? 0 : rgResult[cChan];
+
+            if (m_bDstWord)
+            {
+                reinterpret_cast<PWORD>(pDst)[cChan] = static_cast<WORD>(iValue > 0xFFFF ? 0xFFFF : iValue);
+            }
+            else
+            {
+                pDst[cChan] = static_cast<BYTE>(iValue > 0xFF ? 0xFF : iValue);
+            }
+        }
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUTCache::CColorLUTCache
+
+Routine Description:
+
+    CColorLUTCache constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CColorLUTCache::CColorLUTCache()
+{
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUTCache::~CColorLUTCache
+
+Routine Description:
+
+    CColorLUTCache destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CColorLUTCache::~CColorLUTCache()
+{
+    FreeLUTs();
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUTCache::GetLUT
+
+Routine Description:
+
+    Retrieves the look-up table for a transform and pair of pixel formats,
+    building it if it is not already in the cache. The table remains owned
+    by the cache and stays valid until the next call to GetLUT.
+
+Arguments:
+
+    cstrTransformKey - Key identifying the profiles and options used to create the transform
+    hTransform       - Handle to the transform, used if the table has to be built
+    bmSrcFormat      - The source BMFORMAT
+    bmDstFormat      - The destination BMFORMAT
+    ppLUT            - Pointer to a pointer that receives the look-up table
+
+Return Value:
+
+    HRESULT
+    S_OK    - On success
+    S_FALSE - If the formats cannot be handled with a look-up table
+    E_*     - On error
+
+--*/
+HRESULT
+CColorLUTCache::GetLUT(
+    _In_        CONST CStringXDW& cstrTransformKey,
+    _In_        HTRANSFORM        hTransform,
+    _In_        CONST BMFORMAT&   bmSrcFormat,
+    _In_        CONST BMFORMAT&   bmDstFormat,
+    _Outptr_    CColorLUT**       ppLUT
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(ppLUT, E_POINTER)))
+    {
+        *ppLUT = NULL;
+
+        if (!CColorLUT::IsFormatSupported(bmSrcFormat, bmDstFormat))
+        {
+            hr = S_FALSE;
+        }
+    }
+
+    if (hr == S_OK)
+    {
+        CColorLUT* pLUT = NULL;
+
+        try
+        {
+            CStringXDW cstrKey;
+            cstrKey.Format(L"%x|%x|", bmSrcFormat, bmDstFormat);
+            cstrKey.Append(cstrTransformKey);
+
+            //
+            // Look for the table, moving it to the most recently used end
+            //
+            for (deque<LUTEntry>::iterator iterLUT = m_luts.begin();
+                 iterLUT != m_luts.end();
+                 iterLUT++)
+            {
+                if (iterLUT->cstrKey == cstrKey)
+                {
+                    LUTEntry entry = *iterLUT;
+
+                    m_luts.erase(iterLUT);
+                    m_luts.push_back(entry);
+
+                    *ppLUT = entry.pLUT;
+                    break;
+                }
+            }
+
+            if (*ppLUT == NULL)
+            {
+                pLUT = new(std::nothrow) CColorLUT();
+
+                if (SUCCEEDED(hr = CHECK_POINTER(pLUT, E_OUTOFMEMORY)) &&
+                    SUCCEEDED(hr = pLUT->Initialize(hTransform, bmSrcFormat, bmDstFormat)))
+                {
+                    if (m_luts.size() >= ms_cMaxLUTs)
+                    {
+                        delete m_luts.front().pLUT;
+                        m_luts.pop_front();
+                    }
+
+                    LUTEntry entry;
+                    entry.cstrKey = cstrKey;
+                    entry.pLUT    = pLUT;
+
+                    m_luts.push_back(entry);
+
+                    *ppLUT = pLUT;
+                    pLUT = NULL;
+                }
+            }
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
+        }
+
+        if (pLUT != NULL)
+        {
+            delete pLUT;
+            pLUT = NULL;
+        }
+
+        if (FAILED(hr))
+        {
+            *ppLUT = NULL;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUTCache::FreeLUTs
+
+Routine Description:
+
+    Frees all look-up tables held by the cache
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CColorLUTCache::FreeLUTs(
+    VOID
+    )
+{
+    for (deque<LUTEntry>::iterator iterLUT = m_luts.begin();
+         iterLUT != m_luts.end();
+         iterLUT++)
+    {
+        delete iterLUT->pLUT;
+        iterLUT->pLUT = NULL;
+    }
+
+    m_luts.clear();
+}
+
@@ -0,0 +1,167 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   colorlut.h
+
+Abstract:
+
+   Color look-up table class definitions. The CColorLUT class samples a color
+   transform over a regular grid of source colors once, and then converts
+   bitmap data by tetrahedral interpolation in that grid instead of calling
+   TranslateBitmapBits. The CColorLUTCache class keeps the tables across pages
+   so that a table is only built once per source profile, destination profile,
+   intent and pixel format combination.
+
+--*/
+
+#pragma once
+
+#include "xdstring.h"
+
+class CColorLUT
+{
+public:
+    CColorLUT();
+
+    ~CColorLUT();
+
+    static BOOL
+    IsFormatSupported(
+        _In_ CONST BMFORMAT& bmSrcFormat,
+        _In_ CONST BMFORMAT& bmDstFormat
+        );
+
+    HRESULT
+    Initialize(
+        _In_ HTRANSFORM      hTransform,
+        _In_ CONST BMFORMAT& bmSrcFormat,
+        _In_ CONST BMFORMAT& bmDstFormat
+        );
+
+    HRESULT
+    Apply(
+        _In_reads_bytes_(cbSrcStride * cHeight)  PBYTE pSrcData,
+        _In_                                     UINT  cbSrcStride,
+        _Out_writes_bytes_(cbDstStride * cHeight) PBYTE pDstData,
+        _In_                                     UINT  cbDstStride,
+        _In_                                     UINT  cWidth,
+        _In_                                     UINT  cHeight
+        ) CONST;
+
+private:
+    VOID
+    FreeLUT(
+        VOID
+        );
+
+    VOID
+    ApplyScanline(
+        _In_reads_bytes_(cWidth * m_cbSrcPixel)  PBYTE pSrc,
+        _Out_writes_bytes_(cWidth * m_cbDstPixel) PBYTE pDst,
+        _In_                                     UINT  cWidth
+        ) CONST;
+
+private:
+    //
+    // Grid points along each source channel. The grid spacing divides both
+    // 255 and 65535, so grid nodes fall exactly on 8 and 16 bit values. 4
+    // channel sources use a coarser grid to keep the table small; they are
+    // interpolated tetrahedrally in three channels and linearly in the
+    // fourth (the black channel).
+    //
+    static CONST UINT ms_cGridPoints3D = 18;
+
+    static CONST UINT ms_cGridPoints4D = 16;
+
+    BMFORMAT m_bmSrcFormat;
+
+    BMFORMAT m_bmDstFormat;
+
+    UINT     m_cSrcChannels;
+
+    UINT     m_cbSrcPixel;
+
+    BOOL     m_bSrcWord;
+
+    UINT     m_cDstChannels;
+
+    UINT     m_cbDstPixel;
+
+    BOOL     m_bDstWord;
+
+    UINT     m_cGridPoints;
+
+    //
+    // Source channel used for each grid dimension, outermost first, and the
+    // distance between neighbouring grid nodes along that dimension
+    //
+    UINT     m_rgDimChannel[4];
+
+    UINT     m_rgDimStride[4];
+
+    //
+    // Grid nodes. Each node holds the destination channels as four floats
+    // (padded for 3 channel destinations) in the destination data range.
+    //
+    PFLOAT   m_pNodes;
+
+    UINT     m_cNodes;
+
+    //
+    // Grid cell and position within the cell for each 8 bit source value
+    //
+    UINT     m_rgCell8[256];
+
+    FLOAT    m_rgFrac8[256];
+};
+
+class CColorLUTCache
+{
+public:
+    CColorLUTCache();
+
+    ~CColorLUTCache();
+
+    HRESULT
+    GetLUT(
+        _In_        CONST CStringXDW& cstrTransformKey,
+        _In_        HTRANSFORM        hTransform,
+        _In_        CONST BMFORMAT&   bmSrcFormat,
+        _In_        CONST BMFORMAT&   bmDstFormat,
+        _Outptr_    CColorLUT**       ppLUT
+        );
+
+private:
+    VOID
+    FreeLUTs(
+        VOID
+        );
+
+private:
+    //
+    // Maximum number of tables kept. The cache is short, so it is searched
+    // linearly; it is kept in least recently used order and the least
+    // recently used table is discarded when it is full.
+    //
+    static CONST size_t ms_cMaxLUTs = 8;
+
+    struct LUTEntry
+    {
+        CStringXDW cstrKey;
+
+        CColorLUT* pLUT;
+    };
+
+    deque<LUTEntry> m_luts;
+};
+
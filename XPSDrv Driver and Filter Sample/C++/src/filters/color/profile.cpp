@@ -26,6 +26,7 @@ Abstract:
 #include "debug.h"
 #include "globals.h"
 #include "xdstring.h"
+#include "resstore.h"
 #include "profile.h"
 #include "wcsapiconv.h"
 
@@ -176,7 +177,8 @@ CProfile::SetProfile(
                             cbProfileData
                             };
 
-                        if (SUCCEEDED(hr = OpenProfile(&profile, &m_hProfile)))
+                        if (SUCCEEDED(hr = OpenProfile(&profile, &m_hProfile)) &&
+                            SUCCEEDED(hr = SetContentKey(pProfileData, cbProfileData)))
                         {
                             m_cstrProfileKey = cstrKey;
                         }
@@ -247,7 +249,8 @@ CProfile::SetProfile(
                     profileFileName.GetLength() * sizeof(WCHAR)
                     };
 
-                if (SUCCEEDED(hr = OpenProfile(&profile, &m_hProfile)))
+                if (SUCCEEDED(hr = OpenProfile(&profile, &m_hProfile)) &&
+                    SUCCEEDED(hr = SetContentKey(szFileName)))
                 {
                     m_cstrProfileKey = cstrKey;
                 }
@@ -314,7 +317,8 @@ CProfile::SetProfile(
                     cbBuffer
                     };
 
-                if (SUCCEEDED(hr = OpenProfile(&profile, &m_hProfile)))
+                if (SUCCEEDED(hr = OpenProfile(&profile, &m_hProfile)) &&
+                    SUCCEEDED(hr = SetContentKey(pBuffer, cbBuffer)))
                 {
                     m_cstrProfileKey = cstrKey;
                 }
@@ -472,6 +476,53 @@ CProfile::GetProfileKey(
 
 /*++
 
+Routine Name:
+
+    CProfile::GetContentKey
+
+Routine Description:
+
+    Retrieves a key identifying the data of the current profile and the options used
+    to create the profile. Unlike the profile key this does not depend on the name the
+    profile was loaded by, so it can be used to cache against across documents
+
+Arguments:
+
+    pcstrContentKey - Pointer to a CStringXDW object that recieves the key
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CProfile::GetContentKey(
+    _Out_ CStringXDW* pcstrContentKey
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pcstrContentKey, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_HANDLE(m_hProfile, E_PENDING)))
+    {
+        try
+        {
+            *pcstrContentKey = m_cstrContentKey;
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
 Routine Name:
 
     CProfile::operator==
@@ -569,6 +620,7 @@ CProfile::FreeProfile(
     try
     {
         m_cstrProfileKey.Empty();
+        m_cstrContentKey.Empty();
     }
     catch (CXDException&)
     {
@@ -707,3 +759,129 @@ CProfile::CreateProfileKey(
     return hr;
 }
 
+/*++
+
+Routine Name:
+
+    CProfile::SetContentKey
+
+Routine Description:
+
+    Sets the content key for a profile loaded from memory to a SHA-256 hash of the
+    profile data followed by the options used to create the profile
+
+Arguments:
+
+    pBuffer  - Buffer containing the profile data
+    cbBuffer - Size of the buffer
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CProfile::SetContentKey(
+    _In_reads_bytes_(cbBuffer) CONST BYTE* pBuffer,
+    _In_                       UINT        cbBuffer
+    )
+{
+    HRESULT hr = S_OK;
+
+    CContentHash  hash;
+    ResContentKey key;
+
+    if (SUCCEEDED(hr = hash.HashData(pBuffer, cbBuffer)) &&
+        SUCCEEDED(hr = hash.GetKey(&key)))
+    {
+        try
+        {
+            static CONST WCHAR szDigits[] = L"0123456789abcdef";
+
+            WCHAR szHash[2 * sizeof(key.rgbHash) + 1];
+
+            for (UINT cbIndex = 0; cbIndex < sizeof(key.rgbHash); cbIndex++)
+            {
+                szHash[2 * cbIndex]     = szDigits[key.rgbHash[cbIndex] >> 4];
+                szHash[2 * cbIndex + 1] = szDigits[key.rgbHash[cbIndex] & 0xF];
+            }
+
+            szHash[2 * sizeof(key.rgbHash)] = L'\0';
+
+            m_cstrContentKey.Format(L"%x%x%x%x|", m_dwDesiredAccess, m_dwShareMode, m_dwCreationMode, m_dwWCSFlags);
+            m_cstrContentKey.Append(szHash);
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CProfile::SetContentKey
+
+Routine Description:
+
+    Sets the content key for a profile loaded from a file to the file name and the
+    time the file was last written, followed by the options used to create the
+    profile. Profiles named without a path are found in the color directory and
+    are identified by name alone.
+
+Arguments:
+
+    szFileName - File name of the profile
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CProfile::SetContentKey(
+    _In_ LPCWSTR szFileName
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(szFileName, E_POINTER)))
+    {
+        WIN32_FILE_ATTRIBUTE_DATA fileData = {0};
+
+        if (!GetFileAttributesEx(szFileName, GetFileExInfoStandard, &fileData))
+        {
+            ZeroMemory(&fileData, sizeof(fileData));
+        }
+
+        try
+        {
+            m_cstrContentKey.Format(L"%x%x%x%x|%08x%08x|",
+                                    m_dwDesiredAccess,
+                                    m_dwShareMode,
+                                    m_dwCreationMode,
+                                    m_dwWCSFlags,
+                                    fileData.ftLastWriteTime.dwHighDateTime,
+                                    fileData.ftLastWriteTime.dwLowDateTime);
+            m_cstrContentKey.Append(szFileName);
+            m_cstrContentKey.MakeLower();
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
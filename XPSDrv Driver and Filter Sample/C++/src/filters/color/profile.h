@@ -64,6 +64,11 @@ public:
         _Out_ CStringXDW* pcstrProfileURI
         );
 
+    HRESULT
+    GetContentKey(
+        _Out_ CStringXDW* pcstrContentKey
+        );
+
     BOOL
     operator==(
         _In_ CONST CStringXDW& cstrProfileKey
@@ -99,6 +104,17 @@ private:
         _Out_    CStringXDW* pcstrKey
         );
 
+    HRESULT
+    SetContentKey(
+        _In_reads_bytes_(cbBuffer) CONST BYTE* pBuffer,
+        _In_                       UINT        cbBuffer
+        );
+
+    HRESULT
+    SetContentKey(
+        _In_ LPCWSTR szFileName
+        );
+
 private:
     HPROFILE   m_hProfile;
 
@@ -120,5 +136,14 @@ private:
     // Note: Do not cache against the handle as handles can be re-used
     //
     CStringXDW m_cstrProfileKey;
+
+    //
+    // The profile key is only unique within a page: a relative URI or a bitmap
+    // URI can name a different profile in another document. The content key
+    // identifies the profile data itself (a hash of the profile bytes, or the
+    // file name and the time the file was last written) so that it can be used
+    // to cache against for the lifetime of the filter.
+    //
+    CStringXDW m_cstrContentKey;
 };
 
@@ -57,6 +57,8 @@ Arguments:
     pszDeviceName - Pointer to a string containing the device name
     cmProfData    - Structure containing color profile settings from the PrintTicket
     cmIntData     - Structure containing color intents settings from the PrintTicket
+    pFP           - Pointer to the fixed page being processed
+    pLUTCache     - Pointer to the color look-up table cache for the filter
 
 Return Value:
 
@@ -68,12 +70,14 @@ CProfileManager::CProfileManager(
     _In_ LPCWSTR                               pszDeviceName,
     _In_ PageSourceColorProfileData cmProfData,
     _In_ PageICMRenderingIntentData            cmIntData,
-    _In_ IFixedPage*                           pFP
+    _In_ IFixedPage*                           pFP,
+    _In_ CColorLUTCache*                       pLUTCache
     ) :
     m_strDeviceName(pszDeviceName),
     m_cmProfData(cmProfData),
     m_cmIntData(cmIntData),
-    m_pFixedPage(pFP)
+    m_pFixedPage(pFP),
+    m_pLUTCache(pLUTCache)
 {
     HRESULT hr = S_OK;
 
@@ -247,6 +251,158 @@ CProfileManager::GetColorTransform(
 
 /*++
 
+Routine Name:
+
+    CProfileManager::GetColorLUT
+
+Routine Description:
+
+    Method which supplies a color look-up table for the transform supplied by
+    GetColorTransform and the given pair of bitmap formats. Tables are held in
+    the filter's look-up table cache so they are only built once for each
+    combination of profiles, intent and formats across the pages of a job.
+
+Arguments:
+
+    bmSrcFormat - The BMFORMAT of the source bitmap data
+    bmDstFormat - The BMFORMAT of the destination bitmap data
+    ppLUT       - Pointer to a pointer that receives the look-up table. This is set
+                  to NULL when a look-up table cannot be used.
+
+Return Value:
+
+    HRESULT
+    S_OK    - On success
+    S_FALSE - If a look-up table cannot be used for the formats
+    E_*     - On error
+
+--*/
+HRESULT
+CProfileManager::GetColorLUT(
+    _In_                      CONST BMFORMAT& bmSrcFormat,
+    _In_                      CONST BMFORMAT& bmDstFormat,
+    _Outptr_result_maybenull_ CColorLUT**     ppLUT
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(ppLUT, E_POINTER)))
+    {
+        *ppLUT = NULL;
+
+        if (m_pLUTCache == NULL ||
+            !CColorLUT::IsFormatSupported(bmSrcFormat, bmDstFormat))
+        {
+            hr = S_FALSE;
+        }
+    }
+
+    if (hr == S_OK)
+    {
+        HTRANSFORM hTransform = NULL;
+        BOOL       bUseWCS = FALSE;
+        CStringXDW cstrSrcKey;
+        CStringXDW cstrDstKey;
+
+        if (SUCCEEDED(hr = GetColorTransform(&hTransform, &bUseWCS)) &&
+            SUCCEEDED(hr = m_srcProfile.GetContentKey(&cstrSrcKey)) &&
+            SUCCEEDED(hr = m_dstProfile.GetContentKey(&cstrDstKey)))
+        {
+            try
+            {
+                //
+                // The transform is identified by the intent, the color system and
+                // the content keys of the source and destination profiles. The cache
+                // outlives the document, so the profile keys, which are URIs that
+                // only identify a profile within a page, cannot be used
+                //
+                CStringXDW cstrTransformKey;
+                cstrTransformKey.Format(L"%x|%x|", m_cmIntData.cmOption, bUseWCS);
+                cstrTransformKey.Append(cstrSrcKey);
+                cstrTransformKey.Append(L"|");
+                cstrTransformKey.Append(cstrDstKey);
+
+                hr = m_pLUTCache->GetLUT(cstrTransformKey, hTransform, bmSrcFormat, bmDstFormat, ppLUT);
+            }
+            catch (CXDException& e)
+            {
+                hr = e;
+            }
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CProfileManager::GetConversionKey
+
+Routine Description:
+
+    Method which supplies a string identifying the conversion applied to
+    resources independently of the source content. This is the intent, the
+    destination profile option and the destination profile file and time it
+    was last written, so that output stored by the resource content store is
+    not reused after the profile settings or the profile itself change.
+
+Arguments:
+
+    pcstrKey - Pointer to a string that receives the conversion key
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CProfileManager::GetConversionKey(
+    _Out_ CStringXDW* pcstrKey
+    )
+{
+    HRESULT hr = S_OK;
+
+    CComBSTR bstrProfile;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pcstrKey, E_POINTER)) &&
+        SUCCEEDED(hr = GetDstProfileName(&bstrProfile)))
+    {
+        WIN32_FILE_ATTRIBUTE_DATA fileData = {0};
+
+        if (!GetFileAttributesEx(bstrProfile, GetFileExInfoStandard, &fileData))
+        {
+            hr = GetLastErrorAsHResult();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            try
+            {
+                pcstrKey->Format(L"%x|%x|%08x%08x|",
+                                 m_cmIntData.cmOption,
+                                 m_cmProfData.cmProfile,
+                                 fileData.ftLastWriteTime.dwHighDateTime,
+                                 fileData.ftLastWriteTime.dwLowDateTime);
+                pcstrKey->Append(bstrProfile);
+            }
+            catch (CXDException& e)
+            {
+                hr = e;
+            }
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
 Routine Name:
 
     CProfileManager::GetDstProfileType
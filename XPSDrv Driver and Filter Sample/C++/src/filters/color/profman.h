@@ -26,6 +26,7 @@ Abstract:
 #include "cmintentsdata.h"
 #include "rescache.h"
 #include "transform.h"
+#include "colorlut.h"
 
 class CProfileManager : public IResWriter
 {
@@ -34,7 +35,8 @@ public:
         _In_ LPCWSTR                                                                                 pszDeviceName,
         _In_ XDPrintSchema::PageSourceColorProfile::PageSourceColorProfileData cmProfData,
         _In_ XDPrintSchema::PageICMRenderingIntent::PageICMRenderingIntentData                       cmIntData,
-        _In_ IFixedPage*                                                                             pFP
+        _In_ IFixedPage*                                                                             pFP,
+        _In_ CColorLUTCache*                                                                         pLUTCache
         );
 
     virtual ~CProfileManager();
@@ -45,6 +47,18 @@ public:
         _Out_ BOOL*       pbUseWCS
         );
 
+    HRESULT
+    GetColorLUT(
+        _In_                      CONST BMFORMAT& bmSrcFormat,
+        _In_                      CONST BMFORMAT& bmDstFormat,
+        _Outptr_result_maybenull_ CColorLUT**     ppLUT
+        );
+
+    HRESULT
+    GetConversionKey(
+        _Out_ CStringXDW* pcstrKey
+        );
+
     HRESULT
     GetDstProfileType(
         _Out_ XDPrintSchema::PageSourceColorProfile::EProfileOption* pType
@@ -122,5 +136,7 @@ private:
     CTransform                       m_colorTrans;
 
     CComPtr<IFixedPage>              m_pFixedPage;
+
+    CColorLUTCache*                  m_pLUTCache;
 };
 
@@ -0,0 +1,957 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pgstore.cpp
+
+Abstract:
+
+   Page store implementation. Page mark-up is appended to a temporary file
+   that is deleted when the store is destroyed. Pages are indexed by the
+   order they were added in and their mark-up is read back through a view of
+   the file mapped for the lifetime of the returned stream. The temporary
+   file attribute keeps the data in the file cache while memory allows.
+
+--*/
+
+#include "precomp.h"
+#include "debug.h"
+#include "globals.h"
+#include "xdexcept.h"
+#include "pgstore.h"
+
+static CONST TCHAR szSpillFilePrefix[] = TEXT("xdp");
+
+/*++
+
+Routine Name:
+
+    GetBookletPageOrder
+
+Routine Description:
+
+    This routine calculates the order pages are sent in for booklet printing.
+    The first half of the pages fill the even positions from the start and
+    the second half fill the odd positions back from the end, so that pages
+    laid out two to a sheet and folded read in order.
+
+Arguments:
+
+    cPages - The number of pages in the booklet, which must be even
+    pOrder - Pointer to a vector that receives the index of the page sent in
+             each position
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+GetBookletPageOrder(
+    _In_  UINT          cPages,
+    _Out_ vector<UINT>* pOrder
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pOrder, E_POINTER)))
+    {
+        if (cPages % 2 == 0)
+        {
+            try
+            {
+                pOrder->assign(cPages, 0);
+
+                UINT pageIndex = 0;
+
+                for (pageIndex = 0; pageIndex < cPages/2; pageIndex++)
+                {
+                    (*pOrder)[pageIndex * 2] = pageIndex;
+                }
+
+                for (pageIndex = cPages/2; pageIndex < cPages; pageIndex++)
+                {
+                    (*pOrder)[cPages - 1 - (pageIndex - cPages/2) * 2] = pageIndex;
+                }
+            }
+            catch (exception& DBG_ONLY(e))
+            {
+                ERR(e.what());
+                hr = E_FAIL;
+            }
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::CPageStore
+
+Routine Description:
+
+    CPageStore class constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPageStore::CPageStore() :
+    m_hFile(INVALID_HANDLE_VALUE),
+    m_hMapping(NULL),
+    m_cbFile(0),
+    m_cbMapping(0),
+    m_cbGranularity(0)
+{
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+
+    m_cbGranularity = systemInfo.dwAllocationGranularity;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::~CPageStore
+
+Routine Description:
+
+    CPageStore class destructor. Closing the spill file deletes it.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPageStore::~CPageStore()
+{
+    m_pages.clear();
+
+    CloseMapping();
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::AddPage
+
+Routine Description:
+
+    This routine stores a fixed page. The mark-up is copied to the spill file
+    and references are kept to the page resources and PrintTicket so the page
+    can be released by the caller.
+
+Arguments:
+
+    pFP - Pointer to the fixed page to store
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CPageStore::AddPage(
+    _In_ IFixedPage* pFP
+    )
+{
+    HRESULT hr = S_OK;
+
+    CComPtr<IPrintReadStream> pReader(NULL);
+    CComPtr<IXpsPartIterator> pXpsPartIt(NULL);
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pFP, E_POINTER)) &&
+        SUCCEEDED(hr = OpenSpillFile()) &&
+        SUCCEEDED(hr = pFP->GetStream(&pReader)) &&
+        SUCCEEDED(hr = pFP->GetXpsPartIterator(&pXpsPartIt)))
+    {
+        try
+        {
+            StoredPage page;
+
+            page.offset = m_cbFile;
+            page.cbMarkup = 0;
+
+            if (SUCCEEDED(hr = pFP->GetUri(&page.bstrURI)) &&
+                FAILED(hr = pFP->GetPrintTicket(&page.pPrintTicket)))
+            {
+                //
+                // Pages do not need a PrintTicket
+                //
+                if (hr == HRESULT_FROM_WIN32(ERROR_NOT_FOUND))
+                {
+                    page.pPrintTicket = NULL;
+                    hr = S_OK;
+                }
+            }
+
+            //
+            // Keep references to the page resources
+            //
+            pXpsPartIt->Reset();
+            while (SUCCEEDED(hr) &&
+                   !pXpsPartIt->IsDone())
+            {
+                CComBSTR bstrPartURI;
+                CComPtr<IUnknown> pXPSPart(NULL);
+
+                if (SUCCEEDED(hr = pXpsPartIt->Current(&bstrPartURI, &pXPSPart)))
+                {
+                    page.resources.push_back(pXPSPart);
+
+                    pXpsPartIt->Next();
+                }
+            }
+
+            //
+            // Spill the mark-up
+            //
+            PBYTE pBuff = NULL;
+
+            if (SUCCEEDED(hr))
+            {
+                pBuff = new(std::nothrow) BYTE[CB_COPY_BUFFER];
+
+                hr = CHECK_POINTER(pBuff, E_OUTOFMEMORY);
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                BOOL  bEOF = FALSE;
+                ULONG cbRead = 0;
+
+                while (SUCCEEDED(hr) &&
+                       !bEOF &&
+                       SUCCEEDED(hr = pReader->ReadBytes(pBuff, CB_COPY_BUFFER, &cbRead, &bEOF)) &&
+                       cbRead > 0)
+                {
+                    if (page.cbMarkup > ULONG_MAX - cbRead)
+                    {
+                        hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+                    }
+                    else if (SUCCEEDED(hr = WriteSpillFile(pBuff, cbRead)))
+                    {
+                        page.cbMarkup += cbRead;
+                    }
+                }
+            }
+
+            if (pBuff != NULL)
+            {
+                delete[] pBuff;
+                pBuff = NULL;
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                m_pages.push_back(page);
+            }
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::GetPageCount
+
+Routine Description:
+
+    This routine retrieves the number of pages in the store
+
+Arguments:
+
+    None
+
+Return Value:
+
+    The number of stored pages
+
+--*/
+UINT
+CPageStore::GetPageCount(
+    VOID
+    ) CONST
+{
+    return static_cast<UINT>(m_pages.size());
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::GetPageStream
+
+Routine Description:
+
+    This routine retrieves a read stream for the mark-up of a stored page
+
+Arguments:
+
+    iPage    - Index of the page in the order the pages were added
+    ppStream - Pointer to an ISequentialStream pointer that receives the stream
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CPageStore::GetPageStream(
+    _In_     UINT                iPage,
+    _Outptr_ ISequentialStream** ppStream
+    )
+{
+    HRESULT hr = S_OK;
+
+    PVOID pView = NULL;
+    PBYTE pMarkup = NULL;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(ppStream, E_POINTER)))
+    {
+        *ppStream = NULL;
+
+        if (SUCCEEDED(hr = MapPage(iPage, &pView, &pMarkup)))
+        {
+            *ppStream = new(std::nothrow) CPageMarkupStream(pView, pMarkup, m_pages[iPage].cbMarkup);
+
+            if (FAILED(hr = CHECK_POINTER(*ppStream, E_OUTOFMEMORY)) &&
+                pView != NULL)
+            {
+                UnmapViewOfFile(pView);
+            }
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::CopyPageResources
+
+Routine Description:
+
+    This routine adds the resources of a stored page to a destination page
+
+Arguments:
+
+    iPage  - Index of the stored page
+    pFPDst - Pointer to the destination page
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CPageStore::CopyPageResources(
+    _In_    UINT        iPage,
+    _Inout_ IFixedPage* pFPDst
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pFPDst, E_POINTER)))
+    {
+        if (iPage < m_pages.size())
+        {
+            vector<CComPtr<IUnknown> >::const_iterator iterRes = m_pages[iPage].resources.begin();
+
+            for (;
+                 iterRes != m_pages[iPage].resources.end() && SUCCEEDED(hr);
+                 iterRes++)
+            {
+                hr = pFPDst->SetPagePart(*iterRes);
+            }
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::SendPage
+
+Routine Description:
+
+    This routine re-creates a stored page from its spilled mark-up, resources
+    and PrintTicket and sends it to the writer under its original name
+
+Arguments:
+
+    iPage   - Index of the stored page
+    pWriter - Pointer to the writer the page is sent to
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CPageStore::SendPage(
+    _In_ UINT                  iPage,
+    _In_ IXpsDocumentConsumer* pWriter
+    )
+{
+    HRESULT hr = S_OK;
+
+    CComPtr<IFixedPage>        pNewFP(NULL);
+    CComPtr<IPrintWriteStream> pPageWriter(NULL);
+
+    PVOID pView = NULL;
+    PBYTE pMarkup = NULL;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pWriter, E_POINTER)) &&
+        SUCCEEDED(hr = MapPage(iPage, &pView, &pMarkup)) &&
+        SUCCEEDED(hr = pWriter->GetNewEmptyPart(m_pages[iPage].bstrURI,
+                                                IID_IFixedPage,
+                                                reinterpret_cast<PVOID*>(&pNewFP),
+                                                &pPageWriter)))
+    {
+        ULONG cbRemaining = m_pages[iPage].cbMarkup;
+
+        while (SUCCEEDED(hr) &&
+               cbRemaining > 0)
+        {
+            ULONG cbWritten = 0;
+
+            if (SUCCEEDED(hr = pPageWriter->WriteBytes(pMarkup, cbRemaining, &cbWritten)))
+            {
+                if (cbWritten == 0)
+                {
+                    hr = E_FAIL;
+                }
+
+                pMarkup += cbWritten;
+                cbRemaining -= cbWritten;
+            }
+        }
+
+        pPageWriter->Close();
+
+        if (SUCCEEDED(hr) &&
+            SUCCEEDED(hr = CopyPageResources(iPage, pNewFP)) &&
+            m_pages[iPage].pPrintTicket != NULL)
+        {
+            hr = pNewFP->SetPrintTicket(m_pages[iPage].pPrintTicket);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pWriter->SendFixedPage(pNewFP);
+        }
+    }
+
+    if (pView != NULL)
+    {
+        UnmapViewOfFile(pView);
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::Clear
+
+Routine Description:
+
+    This routine releases all stored pages and truncates the spill file so
+    it can be reused
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CPageStore::Clear(
+    VOID
+    )
+{
+    m_pages.clear();
+
+    CloseMapping();
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER liStart = {0};
+
+        if (!SetFilePointerEx(m_hFile, liStart, NULL, FILE_BEGIN) ||
+            !SetEndOfFile(m_hFile))
+        {
+            //
+            // The file cannot be reused; a new one is created for the next page
+            //
+            CloseHandle(m_hFile);
+            m_hFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    m_cbFile = 0;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::OpenSpillFile
+
+Routine Description:
+
+    This routine creates the temporary spill file if it is not already open.
+    The file is deleted when its handle is closed.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CPageStore::OpenSpillFile(
+    VOID
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        TCHAR szTempPath[MAX_PATH];
+        TCHAR szTempFile[MAX_PATH];
+
+        if (GetTempPath(MAX_PATH, szTempPath) == 0 ||
+            GetTempFileName(szTempPath, szSpillFilePrefix, 0, szTempFile) == 0)
+        {
+            hr = GetLastErrorAsHResult();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            m_hFile = CreateFile(szTempFile,
+                                 GENERIC_READ | GENERIC_WRITE,
+                                 0,
+                                 NULL,
+                                 CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                                 NULL);
+
+            if (m_hFile == INVALID_HANDLE_VALUE)
+            {
+                hr = GetLastErrorAsHResult();
+
+                DeleteFile(szTempFile);
+            }
+        }
+
+        m_cbFile = 0;
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::WriteSpillFile
+
+Routine Description:
+
+    This routine appends data to the spill file. Whatever is written counts
+    towards the file size even if the write fails part way, so that the next
+    page starts where the file pointer is.
+
+Arguments:
+
+    pData  - Pointer to the data to append
+    cbData - Count of bytes to append
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CPageStore::WriteSpillFile(
+    _In_reads_bytes_(cbData) CONST BYTE* pData,
+    _In_                     ULONG       cbData
+    )
+{
+    HRESULT hr = S_OK;
+
+    DWORD cbWritten = 0;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pData, E_POINTER)))
+    {
+        BOOL bWritten = WriteFile(m_hFile, pData, cbData, &cbWritten, NULL);
+
+        m_cbFile += cbWritten;
+
+        if (!bWritten)
+        {
+            hr = GetLastErrorAsHResult();
+        }
+        else if (cbWritten != cbData)
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::MapPage
+
+Routine Description:
+
+    This routine maps a view of the spill file containing the mark-up of a
+    stored page. The file mapping is re-created when the file has grown since
+    it was last mapped. The view starts on an allocation granularity boundary
+    so the mark-up starts part way into the view.
+
+Arguments:
+
+    iPage    - Index of the stored page
+    ppView   - Pointer that receives the view to pass to UnmapViewOfFile, NULL
+               when the page has no mark-up
+    ppMarkup - Pointer that receives the start of the page mark-up
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CPageStore::MapPage(
+    _In_     UINT   iPage,
+    _Outptr_ PVOID* ppView,
+    _Outptr_ PBYTE* ppMarkup
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(ppView, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(ppMarkup, E_POINTER)))
+    {
+        *ppView = NULL;
+        *ppMarkup = NULL;
+
+        if (iPage >= m_pages.size())
+        {
+            hr = E_INVALIDARG;
+        }
+        else if (m_pages[iPage].cbMarkup > 0)
+        {
+            if (m_hMapping == NULL ||
+                m_cbMapping < m_cbFile)
+            {
+                CloseMapping();
+
+                m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+                if (m_hMapping != NULL)
+                {
+                    m_cbMapping = m_cbFile;
+                }
+                else
+                {
+                    hr = GetLastErrorAsHResult();
+                }
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                ULONGLONG viewOffset = m_pages[iPage].offset - m_pages[iPage].offset % m_cbGranularity;
+                SIZE_T    cbSkip = static_cast<SIZE_T>(m_pages[iPage].offset - viewOffset);
+
+                *ppView = MapViewOfFile(m_hMapping,
+                                        FILE_MAP_READ,
+                                        static_cast<DWORD>(viewOffset >> 32),
+                                        static_cast<DWORD>(viewOffset),
+                                        cbSkip + m_pages[iPage].cbMarkup);
+
+                if (*ppView != NULL)
+                {
+                    *ppMarkup = reinterpret_cast<PBYTE>(*ppView) + cbSkip;
+                }
+                else
+                {
+                    hr = GetLastErrorAsHResult();
+                }
+            }
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageStore::CloseMapping
+
+Routine Description:
+
+    This routine closes the file mapping. Views that are still mapped remain
+    valid until they are unmapped.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CPageStore::CloseMapping(
+    VOID
+    )
+{
+    if (m_hMapping != NULL)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+
+    m_cbMapping = 0;
+}
+
+/*++
+
+Routine Name:
+
+    CPageMarkupStream::CPageMarkupStream
+
+Routine Description:
+
+    CPageMarkupStream class constructor
+
+Arguments:
+
+    pView    - The mapped view the stream owns, NULL if there is no mark-up
+    pMarkup  - Pointer to the start of the mark-up within the view
+    cbMarkup - Size of the mark-up
+
+Return Value:
+
+    None
+
+--*/
+CPageMarkupStream::CPageMarkupStream(
+    _In_opt_                    PVOID       pView,
+    _In_reads_bytes_(cbMarkup)  CONST BYTE* pMarkup,
+    _In_                        ULONG       cbMarkup
+    ) :
+    CUnknown<ISequentialStream>(IID_ISequentialStream),
+    m_pView(pView),
+    m_pMarkup(pMarkup),
+    m_cbMarkup(cbMarkup),
+    m_cbRead(0)
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPageMarkupStream::~CPageMarkupStream
+
+Routine Description:
+
+    CPageMarkupStream class destructor. Unmaps the view.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPageMarkupStream::~CPageMarkupStream()
+{
+    if (m_pView != NULL)
+    {
+        UnmapViewOfFile(m_pView);
+        m_pView = NULL;
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPageMarkupStream::Read
+
+Routine Description:
+
+    This routine implements the ISequentialStream::Read method, copying the
+    next section of the mapped mark-up
+
+Arguments:
+
+    pv      - Buffer that receives the data
+    cb      - Size of the buffer
+    pcbRead - Pointer to a ULONG that receives the count of bytes copied
+
+Return Value:
+
+    HRESULT
+    S_OK - On success, with a count of zero at the end of the mark-up
+    E_*  - On error
+
+--*/
+HRESULT STDMETHODCALLTYPE
+CPageMarkupStream::Read(
+    _Out_writes_bytes_(cb) void*  pv,
+    _In_                   ULONG  cb,
+    _Out_                  ULONG* pcbRead
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pv, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pcbRead, E_POINTER)))
+    {
+        *pcbRead = min(cb, m_cbMarkup - m_cbRead);
+
+        if (*pcbRead > 0)
+        {
+            CopyMemory(pv, m_pMarkup + m_cbRead, *pcbRead);
+            m_cbRead += *pcbRead;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPageMarkupStream::Write
+
+Routine Description:
+
+    This routine implements the ISequentialStream::Write method. The stream is
+    read only.
+
+Arguments:
+
+    Unused
+
+Return Value:
+
+    HRESULT
+    E_NOTIMPL - Always
+
+--*/
+HRESULT STDMETHODCALLTYPE
+CPageMarkupStream::Write(
+    _In_reads_bytes_(cb) CONST void*,
+    _In_ ULONG cb,
+    _Out_opt_ ULONG*
+    )
+{
+    UNREFERENCED_PARAMETER(cb);
+    return E_NOTIMPL;
+}
+
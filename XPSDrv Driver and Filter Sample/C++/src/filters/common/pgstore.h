@@ -0,0 +1,173 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pgstore.h
+
+Abstract:
+
+   Page store definition. Filters that need to send pages in a different
+   order to the one they are received in (booklet printing for example) use
+   the page store to hold the pages until they are required. The FixedPage
+   mark-up is spilled to a temporary file and read back through a mapped
+   view, so the memory held for each stored page is limited to its index
+   entry and references to its resources and PrintTicket.
+
+--*/
+
+#pragma once
+
+#include "cunknown.h"
+
+//
+// Booklet page order. Given the number of pages in the booklet (which must be
+// even) this retrieves the index of the page that is sent in each position.
+//
+HRESULT
+GetBookletPageOrder(
+    _In_  UINT          cPages,
+    _Out_ vector<UINT>* pOrder
+    );
+
+class CPageStore
+{
+public:
+    CPageStore();
+
+    virtual ~CPageStore();
+
+    HRESULT
+    AddPage(
+        _In_ IFixedPage* pFP
+        );
+
+    UINT
+    GetPageCount(
+        VOID
+        ) CONST;
+
+    HRESULT
+    GetPageStream(
+        _In_     UINT                iPage,
+        _Outptr_ ISequentialStream** ppStream
+        );
+
+    HRESULT
+    CopyPageResources(
+        _In_    UINT        iPage,
+        _Inout_ IFixedPage* pFPDst
+        );
+
+    HRESULT
+    SendPage(
+        _In_ UINT                  iPage,
+        _In_ IXpsDocumentConsumer* pWriter
+        );
+
+    VOID
+    Clear(
+        VOID
+        );
+
+private:
+    HRESULT
+    OpenSpillFile(
+        VOID
+        );
+
+    HRESULT
+    WriteSpillFile(
+        _In_reads_bytes_(cbData) CONST BYTE* pData,
+        _In_                     ULONG       cbData
+        );
+
+    HRESULT
+    MapPage(
+        _In_     UINT   iPage,
+        _Outptr_ PVOID* ppView,
+        _Outptr_ PBYTE* ppMarkup
+        );
+
+    VOID
+    CloseMapping(
+        VOID
+        );
+
+private:
+    struct StoredPage
+    {
+        CComBSTR                    bstrURI;
+
+        ULONGLONG                   offset;
+
+        ULONG                       cbMarkup;
+
+        CComPtr<IPartPrintTicket>   pPrintTicket;
+
+        vector<CComPtr<IUnknown> >  resources;
+    };
+
+    vector<StoredPage> m_pages;
+
+    HANDLE             m_hFile;
+
+    HANDLE             m_hMapping;
+
+    ULONGLONG          m_cbFile;
+
+    ULONGLONG          m_cbMapping;
+
+    DWORD              m_cbGranularity;
+};
+
+//
+// Read stream over the mapped mark-up of a stored page. The stream owns the
+// mapped view and unmaps it when released.
+//
+class CPageMarkupStream : public CUnknown<ISequentialStream>
+{
+public:
+    CPageMarkupStream(
+        _In_opt_                    PVOID       pView,
+        _In_reads_bytes_(cbMarkup)  CONST BYTE* pMarkup,
+        _In_                        ULONG       cbMarkup
+        );
+
+    virtual ~CPageMarkupStream();
+
+    //
+    // ISequentialStream members
+    //
+    HRESULT STDMETHODCALLTYPE
+    Read(
+        _Out_writes_bytes_(cb) void*  pv,
+        _In_                   ULONG  cb,
+        _Out_                  ULONG* pcbRead
+        );
+
+    HRESULT STDMETHODCALLTYPE
+    Write(
+        _In_reads_bytes_(cb) CONST void*,
+        _In_ ULONG cb,
+        _Out_opt_ ULONG*
+        );
+
+private:
+    PVOID       m_pView;
+
+    CONST BYTE* m_pMarkup;
+
+    ULONG       m_cbMarkup;
+
+    ULONG       m_cbRead;
+};
+
@@ -26,6 +26,12 @@ Abstract:
    care of writing the resource via the IResWriter::WriteData method if it has
    not already been written.
 
+   Where the resource writer can identify the content a resource is generated
+   from, as the color filter's color managed images do, resources with the
+   same content share a single part within the job, and data written for that
+   content on an earlier page or job is taken from the resource content store
+   rather than converted again.
+
 --*/
 
 #include "precomp.h"
@@ -128,12 +134,51 @@ CFileResourceCache::WriteResource(
         if (SUCCEEDED(hr = pResWriter->GetKeyName(&bstrKeyName)) &&
             SUCCEEDED(hr = pResWriter->GetResURI(&bstrURI)))
         {
+            //
+            // Writers that cannot identify their content return E_NOTIMPL
+            // from GetContentKey. Any failure to hash the content just means
+            // the resource is written without sharing.
+            //
+            ResContentKey contentKey = {0};
+            BOOL bContentKey = FALSE;
+
             if (!Cached(bstrKeyName))
+            {
+                bContentKey = SUCCEEDED(pResWriter->GetContentKey(&contentKey));
+            }
+
+            try
+            {
+                ResContentMap::const_iterator iterContent = m_contentMap.end();
+
+                if (bContentKey)
+                {
+                    iterContent = m_contentMap.find(contentKey);
+                }
+
+                if (iterContent != m_contentMap.end())
+                {
+                    //
+                    // A resource with the same content has already been written
+                    // in this job - reference that part rather than adding another
+                    //
+                    m_resMap[CComBSTR(bstrKeyName)] = m_resMap[iterContent->second];
+                    bContentKey = FALSE;
+                }
+            }
+            catch (exception& DBG_ONLY(e))
+            {
+                ERR(e.what());
+                hr = E_FAIL;
+            }
+
+            if (SUCCEEDED(hr) &&
+                !Cached(bstrKeyName))
             {
                 //
                 // The resource is not cached:
                 //    1. Create the resource part
-                //    2. Write data to part
+                //    2. Write data to part, from the content store if possible
                 //    3. Cache URI and new part against the resource name
                 //
                 CComPtr<_T> pRes(NULL);
@@ -144,7 +189,45 @@ CFileResourceCache::WriteResource(
                                                                  reinterpret_cast<VOID**>(&pRes),
                                                                  &pWrite)))
                 {
-                    hr = pResWriter->WriteData(pRes, pWrite);
+                    try
+                    {
+                        vector<BYTE> content;
+
+                        if (bContentKey &&
+                            g_resContentStore.GetContent(contentKey, &content) == S_OK)
+                        {
+                            hr = pResWriter->WriteCachedData(pRes,
+                                                             pWrite,
+                                                             content.empty() ? NULL : &content[0],
+                                                             static_cast<ULONG>(content.size()));
+                        }
+                        else if (bContentKey)
+                        {
+                            //
+                            // Keep a copy of the data as it is written so it can be
+                            // reused the next time this content is seen
+                            //
+                            CResContentWriteStream* pContentWrite = new(std::nothrow) CResContentWriteStream(pWrite);
+                            CComPtr<IPrintWriteStream> pContentWriteRef(NULL);
+
+                            pContentWriteRef.Attach(pContentWrite);
+
+                            if (SUCCEEDED(hr = CHECK_POINTER(pContentWrite, E_OUTOFMEMORY)) &&
+                                SUCCEEDED(hr = pResWriter->WriteData(pRes, pContentWriteRef)) &&
+                                pContentWrite->GetContent() != NULL)
+                            {
+                                g_resContentStore.AddContent(contentKey, pContentWrite->GetContent());
+                            }
+                        }
+                        else
+                        {
+                            hr = pResWriter->WriteData(pRes, pWrite);
+                        }
+                    }
+                    catch (CXDException& e)
+                    {
+                        hr = e;
+                    }
 
                     pWrite->Close();
 
@@ -156,6 +239,11 @@ CFileResourceCache::WriteResource(
                         {
                             m_resMap[CComBSTR(bstrKeyName)].first = bstrURI;
                             m_resMap[CComBSTR(bstrKeyName)].second = pPartBase;
+
+                            if (bContentKey)
+                            {
+                                m_contentMap[contentKey] = bstrKeyName;
+                            }
                         }
                     }
                     catch (exception& DBG_ONLY(e))
@@ -190,6 +278,93 @@ CFileResourceCache::WriteResource(
 
 /*++
 
+Routine Name:
+
+    IResWriter::GetContentKey
+
+Routine Description:
+
+    Default implementation for resource writers that cannot identify the
+    content a resource is generated from
+
+Arguments:
+
+    pKey - Pointer to the content key (unused)
+
+Return Value:
+
+    HRESULT
+    E_NOTIMPL - Always
+
+--*/
+HRESULT
+IResWriter::GetContentKey(
+    _Out_ ResContentKey* pKey
+    )
+{
+    UNREFERENCED_PARAMETER(pKey);
+
+    return E_NOTIMPL;
+}
+
+/*++
+
+Routine Name:
+
+    IResWriter::WriteCachedData
+
+Routine Description:
+
+    This routine writes data previously generated for the resource content to
+    the resource stream. Writers that set part properties in WriteData override
+    this to set the same properties and call on to this implementation.
+
+Arguments:
+
+    pResource - The resource part being written
+    pWriter   - The resource part stream
+    pData     - The stored resource data
+    cbData    - Count of bytes of stored data
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+IResWriter::WriteCachedData(
+    _In_                     IPartBase*         pResource,
+    _In_                     IPrintWriteStream* pWriter,
+    _In_reads_bytes_(cbData) CONST BYTE*        pData,
+    _In_                     ULONG              cbData
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pResource, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pWriter, E_POINTER)) &&
+        cbData > 0 &&
+        SUCCEEDED(hr = CHECK_POINTER(pData, E_POINTER)))
+    {
+        ULONG cbWritten = 0;
+
+        if (SUCCEEDED(hr = pWriter->WriteBytes(pData, cbData, &cbWritten)) &&
+            cbWritten != cbData)
+        {
+            RIP("Failed to write all cached resource data.\n");
+
+            hr = E_FAIL;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
 Routine Name:
 
     CFileResourceCache::GetURI
@@ -26,10 +26,19 @@ Abstract:
    the resource cache and it will take care of writing the resource via the
    IResWriter::WriteData method if it has not already been written.
 
+   Resource writers may also identify a resource by the content it is
+   generated from; the color filter does this for its color managed images.
+   The cache then shares one part between resources with the same content,
+   and writes data kept in the resource content store from an earlier page
+   or job instead of converting the image again. Other writers keep the name
+   keyed behavior.
+
 --*/
 
 #pragma once
 
+#include "resstore.h"
+
 //
 // The resource cache needs to map a unique name against the URI used
 // and the part that was added. This allows us to retrieve the URI to
@@ -39,6 +48,12 @@ Abstract:
 typedef pair<CComBSTR, CComPtr<IPartBase> > URIPartPair;
 typedef map<CComBSTR ,URIPartPair> ResCache;
 
+//
+// Map from a content key to the name of the resource first written with
+// that content
+//
+typedef map<ResContentKey, CComBSTR> ResContentMap;
+
 class IResWriter
 {
 public:
@@ -62,6 +77,24 @@ public:
         _Outptr_ BSTR* pbstrResURI
         ) = 0;
 
+    //
+    // Writers that can identify the content a resource is generated from
+    // implement GetContentKey. WriteCachedData is then called in place of
+    // WriteData with the data previously written for the same content; it
+    // must set the same part properties that WriteData does.
+    //
+    virtual HRESULT
+    GetContentKey(
+        _Out_ ResContentKey* pKey
+        );
+
+    virtual HRESULT
+    WriteCachedData(
+        _In_                     IPartBase*         pResource,
+        _In_                     IPrintWriteStream* pWriter,
+        _In_reads_bytes_(cbData) CONST BYTE*        pData,
+        _In_                     ULONG              cbData
+        );
 };
 
 class CFileResourceCache
@@ -92,7 +125,9 @@ protected:
         );
 
 private:
-    ResCache m_resMap;
+    ResCache      m_resMap;
+
+    ResContentMap m_contentMap;
 };
 
 //
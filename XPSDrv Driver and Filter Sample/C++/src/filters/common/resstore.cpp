@@ -0,0 +1,738 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   resstore.cpp
+
+Abstract:
+
+   Resource content store implementation. The color filter identifies its
+   color managed images by a SHA-256 hash of the source image and the
+   conversion applied to it. The store keeps the converted data for recently
+   used content keys, discarding the least recently used data when the
+   memory budget is exceeded, so that images repeated across pages and jobs
+   are only converted once.
+
+--*/
+
+#include "precomp.h"
+#include "debug.h"
+#include "globals.h"
+#include "xdexcept.h"
+#include "resstore.h"
+
+CResourceContentStore g_resContentStore;
+
+/*++
+
+Routine Name:
+
+    CContentHash::CContentHash
+
+Routine Description:
+
+    CContentHash class constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CContentHash::CContentHash() :
+    m_hProv(NULL),
+    m_hHash(NULL)
+{
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::~CContentHash
+
+Routine Description:
+
+    CContentHash class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CContentHash::~CContentHash()
+{
+    if (m_hHash != NULL)
+    {
+        CryptDestroyHash(m_hHash);
+        m_hHash = NULL;
+    }
+
+    if (m_hProv != NULL)
+    {
+        CryptReleaseContext(m_hProv, 0);
+        m_hProv = NULL;
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::HashData
+
+Routine Description:
+
+    This routine adds a buffer to the hash
+
+Arguments:
+
+    pData  - Pointer to the data to hash
+    cbData - Count of bytes of data
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::HashData(
+    _In_reads_bytes_(cbData) CONST BYTE* pData,
+    _In_                     ULONG       cbData
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pData, E_POINTER)) &&
+        SUCCEEDED(hr = Begin()))
+    {
+        if (!CryptHashData(m_hHash, pData, cbData, 0))
+        {
+            hr = GetLastErrorAsHResult();
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::HashString
+
+Routine Description:
+
+    This routine adds a string to the hash. The terminating null is included
+    so that consecutive strings cannot run into each other.
+
+Arguments:
+
+    szData - The string to hash. NULL is treated as an empty string.
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::HashString(
+    _In_opt_z_ LPCWSTR szData
+    )
+{
+    if (szData == NULL)
+    {
+        szData = L"";
+    }
+
+    return HashData(reinterpret_cast<CONST BYTE*>(szData),
+                    static_cast<ULONG>((wcslen(szData) + 1) * sizeof(WCHAR)));
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::HashStream
+
+Routine Description:
+
+    This routine adds the remaining content of a print read stream to the hash
+
+Arguments:
+
+    pStream - The stream to hash
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::HashStream(
+    _In_ IPrintReadStream* pStream
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pStream, E_POINTER)) &&
+        SUCCEEDED(hr = Begin()))
+    {
+        PBYTE pBuff = new(std::nothrow) BYTE[CB_COPY_BUFFER];
+
+        if (SUCCEEDED(hr = CHECK_POINTER(pBuff, E_OUTOFMEMORY)))
+        {
+            BOOL  bEOF = FALSE;
+            ULONG cbRead = 0;
+
+            while (SUCCEEDED(hr) &&
+                   !bEOF &&
+                   SUCCEEDED(hr = pStream->ReadBytes(pBuff, CB_COPY_BUFFER, &cbRead, &bEOF)))
+            {
+                if (cbRead > 0 &&
+                    !CryptHashData(m_hHash, pBuff, cbRead, 0))
+                {
+                    hr = GetLastErrorAsHResult();
+                }
+                else if (cbRead == 0)
+                {
+                    break;
+                }
+            }
+
+            delete[] pBuff;
+            pBuff = NULL;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::GetKey
+
+Routine Description:
+
+    This routine completes the hash and retrieves it as a content key
+
+Arguments:
+
+    pKey - Pointer to the content key that receives the hash
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::GetKey(
+    _Out_ ResContentKey* pKey
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pKey, E_POINTER)) &&
+        SUCCEEDED(hr = Begin()))
+    {
+        DWORD cbHash = sizeof(pKey->rgbHash);
+
+        if (!CryptGetHashParam(m_hHash, HP_HASHVAL, pKey->rgbHash, &cbHash, 0))
+        {
+            hr = GetLastErrorAsHResult();
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::Begin
+
+Routine Description:
+
+    This routine creates the SHA-256 hash object if it has not already been created
+
+Arguments:
+
+    None
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::Begin(
+    VOID
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (m_hProv == NULL &&
+        !CryptAcquireContext(&m_hProv, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT))
+    {
+        m_hProv = NULL;
+        hr = GetLastErrorAsHResult();
+    }
+
+    if (SUCCEEDED(hr) &&
+        m_hHash == NULL &&
+        !CryptCreateHash(m_hProv, CALG_SHA_256, 0, 0, &m_hHash))
+    {
+        m_hHash = NULL;
+        hr = GetLastErrorAsHResult();
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CResourceContentStore::CResourceContentStore
+
+Routine Description:
+
+    CResourceContentStore class constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CResourceContentStore::CResourceContentStore() :
+    m_cbContent(0),
+    m_useCount(0)
+{
+    InitializeCriticalSection(&m_csStore);
+}
+
+/*++
+
+Routine Name:
+
+    CResourceContentStore::~CResourceContentStore
+
+Routine Description:
+
+    CResourceContentStore class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CResourceContentStore::~CResourceContentStore()
+{
+    DeleteCriticalSection(&m_csStore);
+}
+
+/*++
+
+Routine Name:
+
+    CResourceContentStore::GetContent
+
+Routine Description:
+
+    This routine retrieves a copy of the data stored against a content key
+
+Arguments:
+
+    key   - The content key
+    pData - Pointer to a vector that receives the stored data
+
+Return Value:
+
+    HRESULT
+    S_OK    - On success
+    S_FALSE - No data is stored for the content key
+    E_*     - On error
+
+--*/
+HRESULT
+CResourceContentStore::GetContent(
+    _In_  CONST ResContentKey& key,
+    _Out_ vector<BYTE>*        pData
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pData, E_POINTER)))
+    {
+        EnterCriticalSection(&m_csStore);
+
+        try
+        {
+            ContentMap::iterator iterContent = m_content.find(key);
+
+            if (iterContent != m_content.end())
+            {
+                iterContent->second.lastUse = ++m_useCount;
+
+                pData->assign(iterContent->second.data.begin(), iterContent->second.data.end());
+            }
+            else
+            {
+                pData->clear();
+                hr = S_FALSE;
+            }
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
+        }
+
+        LeaveCriticalSection(&m_csStore);
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CResourceContentStore::AddContent
+
+Routine Description:
+
+    This routine stores the data generated for a content key, discarding the
+    least recently used data to stay within the memory budget. The store takes
+    the data from the vector passed in, which is left empty.
+
+Arguments:
+
+    key   - The content key
+    pData - Pointer to the data to store
+
+Return Value:
+
+    HRESULT
+    S_OK    - On success
+    S_FALSE - The data is too large to store
+    E_*     - On error
+
+--*/
+HRESULT
+CResourceContentStore::AddContent(
+    _In_    CONST ResContentKey& key,
+    _Inout_ vector<BYTE>*        pData
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pData, E_POINTER)))
+    {
+        if (pData->size() > ms_cbMaxEntry)
+        {
+            hr = S_FALSE;
+        }
+    }
+
+    if (hr == S_OK)
+    {
+        EnterCriticalSection(&m_csStore);
+
+        try
+        {
+            if (m_content.find(key) == m_content.end())
+            {
+                Trim(pData->size());
+
+                ContentEntry& entry = m_content[key];
+
+                entry.data.swap(*pData);
+                entry.lastUse = ++m_useCount;
+
+                m_cbContent += entry.data.size();
+            }
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
+        }
+
+        LeaveCriticalSection(&m_csStore);
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CResourceContentStore::Trim
+
+Routine Description:
+
+    This routine discards the least recently used data until the requested
+    number of bytes can be added without exceeding the memory budget. The
+    caller must hold the store lock.
+
+Arguments:
+
+    cbRequired - The number of bytes about to be added
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CResourceContentStore::Trim(
+    _In_ size_t cbRequired
+    )
+{
+    while (!m_content.empty() &&
+           m_cbContent + cbRequired > ms_cbMaxStore)
+    {
+        //
+        // The store holds a small number of large entries, so a linear search
+        // for the oldest is cheap compared to generating any of them
+        //
+        ContentMap::iterator iterOldest = m_content.begin();
+        ContentMap::iterator iterContent = m_content.begin();
+
+        for (; iterContent != m_content.end(); iterContent++)
+        {
+            if (iterContent->second.lastUse < iterOldest->second.lastUse)
+            {
+                iterOldest = iterContent;
+            }
+        }
+
+        m_cbContent -= iterOldest->second.data.size();
+        m_content.erase(iterOldest);
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CResContentWriteStream::CResContentWriteStream
+
+Routine Description:
+
+    CResContentWriteStream class constructor
+
+Arguments:
+
+    pWriter - The part stream to pass data on to
+
+Return Value:
+
+    None
+
+--*/
+CResContentWriteStream::CResContentWriteStream(
+    _In_ IPrintWriteStream* pWriter
+    ) :
+    CUnknown<IPrintWriteStream>(__uuidof(IPrintWriteStream)),
+    m_pWriter(pWriter),
+    m_bOverflow(FALSE)
+{
+    HRESULT hr = S_OK;
+
+    if (FAILED(hr = CHECK_POINTER(m_pWriter, E_POINTER)))
+    {
+        throw CXDException(hr);
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CResContentWriteStream::~CResContentWriteStream
+
+Routine Description:
+
+    CResContentWriteStream class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CResContentWriteStream::~CResContentWriteStream()
+{
+}
+
+/*++
+
+Routine Name:
+
+    CResContentWriteStream::WriteBytes
+
+Routine Description:
+
+    Implements IPrintWriteStream::WriteBytes by writing to the part stream and
+    appending the data to the stored copy
+
+Arguments:
+
+    pvBuffer   - Pointer to the data to write
+    cbBuffer   - Count of bytes to write
+    pcbWritten - Pointer to a ULONG that receives the count of bytes written
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT STDMETHODCALLTYPE
+CResContentWriteStream::WriteBytes(
+    _In_reads_bytes_(cbBuffer) CONST VOID* pvBuffer,
+    _In_                       ULONG       cbBuffer,
+    _Out_                      ULONG*      pcbWritten
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = m_pWriter->WriteBytes(pvBuffer, cbBuffer, pcbWritten)) &&
+        !m_bOverflow)
+    {
+        if (m_content.size() + *pcbWritten > CResourceContentStore::ms_cbMaxEntry)
+        {
+            //
+            // Too large to store - stop keeping a copy
+            //
+            vector<BYTE>().swap(m_content);
+            m_bOverflow = TRUE;
+        }
+        else
+        {
+            try
+            {
+                CONST BYTE* pData = reinterpret_cast<CONST BYTE*>(pvBuffer);
+
+                m_content.insert(m_content.end(), pData, pData + *pcbWritten);
+            }
+            catch (exception& DBG_ONLY(e))
+            {
+                ERR(e.what());
+
+                vector<BYTE>().swap(m_content);
+                m_bOverflow = TRUE;
+            }
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CResContentWriteStream::Close
+
+Routine Description:
+
+    Implements IPrintWriteStream::Close. The part stream is closed by the
+    resource cache once the resource is written, so this does nothing.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+VOID STDMETHODCALLTYPE
+CResContentWriteStream::Close(
+    VOID
+    )
+{
+}
+
+/*++
+
+Routine Name:
+
+    CResContentWriteStream::GetContent
+
+Routine Description:
+
+    This routine retrieves the copy of the data written to the stream
+
+Arguments:
+
+    None
+
+Return Value:
+
+    vector<BYTE>*
+    Pointer to the written data
+    NULL if the data was too large to keep
+
+--*/
+vector<BYTE>*
+CResContentWriteStream::GetContent(
+    VOID
+    )
+{
+    return m_bOverflow ? NULL : &m_content;
+}
+
@@ -0,0 +1,191 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   resstore.h
+
+Abstract:
+
+   Resource content store definitions. The color filter identifies each
+   color managed image by a SHA-256 hash of the source bitmap, any profile
+   it names and the conversion settings (the content key). The resource
+   content store keeps the converted image data for recently seen content
+   keys, up to a memory budget, so that an image that is seen again on a
+   later page or in a later job is written from the stored data rather than
+   being converted and encoded again.
+
+   Each filter DLL has its own store, and only resources whose writer
+   supplies a content key are stored, so in practice this is a cache of the
+   color filter's converted images. It is safe to use from several filter
+   instances at once.
+
+--*/
+
+#pragma once
+
+#include <wincrypt.h>
+#include "cunknown.h"
+
+//
+// SHA-256 hash identifying the content a resource is generated from - for
+// the color filter, the source image and the conversion applied to it
+//
+struct ResContentKey
+{
+    BYTE rgbHash[32];
+
+    bool
+    operator<(
+        _In_ CONST ResContentKey& rhs
+        ) CONST
+    {
+        return memcmp(rgbHash, rhs.rgbHash, sizeof(rgbHash)) < 0;
+    }
+};
+
+class CContentHash
+{
+public:
+    CContentHash();
+
+    ~CContentHash();
+
+    HRESULT
+    HashData(
+        _In_reads_bytes_(cbData) CONST BYTE* pData,
+        _In_                     ULONG       cbData
+        );
+
+    HRESULT
+    HashString(
+        _In_opt_z_ LPCWSTR szData
+        );
+
+    HRESULT
+    HashStream(
+        _In_ IPrintReadStream* pStream
+        );
+
+    HRESULT
+    GetKey(
+        _Out_ ResContentKey* pKey
+        );
+
+private:
+    HRESULT
+    Begin(
+        VOID
+        );
+
+private:
+    HCRYPTPROV m_hProv;
+
+    HCRYPTHASH m_hHash;
+};
+
+class CResourceContentStore
+{
+public:
+    CResourceContentStore();
+
+    ~CResourceContentStore();
+
+    HRESULT
+    GetContent(
+        _In_  CONST ResContentKey& key,
+        _Out_ vector<BYTE>*        pData
+        );
+
+    HRESULT
+    AddContent(
+        _In_    CONST ResContentKey& key,
+        _Inout_ vector<BYTE>*        pData
+        );
+
+    //
+    // Total size of the stored data, and the largest single image that is
+    // stored. Larger images are always converted again.
+    //
+    static CONST size_t ms_cbMaxStore = 32 * 1024 * 1024;
+
+    static CONST size_t ms_cbMaxEntry = 8 * 1024 * 1024;
+
+private:
+    VOID
+    Trim(
+        _In_ size_t cbRequired
+        );
+
+private:
+    struct ContentEntry
+    {
+        vector<BYTE> data;
+
+        ULONGLONG    lastUse;
+    };
+
+    typedef map<ResContentKey, ContentEntry> ContentMap;
+
+    ContentMap       m_content;
+
+    size_t           m_cbContent;
+
+    ULONGLONG        m_useCount;
+
+    CRITICAL_SECTION m_csStore;
+};
+
+//
+// The store for this filter DLL. Only the color filter writes resources with
+// a content key, so only its store holds any data.
+//
+extern CResourceContentStore g_resContentStore;
+
+//
+// Write stream that passes data on to the part stream and keeps a copy of it
+// for the resource content store. Once more than the largest storable
+// resource has been written the copy is discarded.
+//
+class CResContentWriteStream : public CUnknown<IPrintWriteStream>
+{
+public:
+    CResContentWriteStream(
+        _In_ IPrintWriteStream* pWriter
+        );
+
+    virtual ~CResContentWriteStream();
+
+    HRESULT STDMETHODCALLTYPE
+    WriteBytes(
+        _In_reads_bytes_(cbBuffer) CONST VOID* pvBuffer,
+        _In_                       ULONG       cbBuffer,
+        _Out_                      ULONG*      pcbWritten
+        );
+
+    VOID STDMETHODCALLTYPE
+    Close(
+        VOID
+        );
+
+    vector<BYTE>*
+    GetContent(
+        VOID
+        );
+
+private:
+    CComPtr<IPrintWriteStream> m_pWriter;
+
+    vector<BYTE>               m_content;
+
+    BOOL                       m_bOverflow;
+};
+
@@ -0,0 +1,1437 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pkdeflate.cpp
+
+Abstract:
+
+   Implementation of the PK deflate compressor and CRC-32 helpers. Matches are
+   found with hash chains and lazy evaluation (equivalent to the default zlib
+   level) and each block is written with whichever of dynamic Huffman codes,
+   the fixed codes or stored data is smallest.
+
+--*/
+
+#include "pkdeflate.h"
+
+#include <string.h>
+#include <algorithm>
+
+//
+// Shortest match, and the match length above which no lazy match is tried,
+// above which fewer chain entries are searched and at which the search stops
+//
+static const size_t   s_minMatch   = 3;
+static const size_t   s_maxMatch   = 258;
+static const size_t   s_maxLazy    = 16;
+static const size_t   s_goodLength = 8;
+static const size_t   s_niceLength = 128;
+static const uint32_t s_maxChain   = 128;
+
+//
+// Three byte matches further away than this cost more than the literals
+//
+static const size_t   s_tooFar     = 4096;
+
+static const uint16_t s_lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t s_lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t s_distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+
+static const uint8_t s_distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+//
+// Order in which the code length code lengths are sent
+//
+static const uint8_t s_clOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+//
+// CRC-32 tables for slicing by four bytes. These are filled in when the
+// module is loaded, before any compression can take place.
+//
+class CPKCrcTables
+{
+public:
+    CPKCrcTables()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t crc = n;
+
+            for (uint32_t bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+            }
+
+            table[0][n] = crc;
+        }
+
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            for (uint32_t slice = 1; slice < 4; slice++)
+            {
+                table[slice][n] = (table[slice - 1][n] >> 8) ^ table[0][table[slice - 1][n] & 0xFF];
+            }
+        }
+    }
+
+    uint32_t table[4][256];
+};
+
+static CPKCrcTables s_crcTables;
+
+/*++
+
+Routine Name:
+
+    LengthSymbol
+
+Routine Description:
+
+    This routine returns the index of the length code (0 to 28) for a match length
+
+Arguments:
+
+    length - The match length
+
+Return Value:
+
+    The length code index
+
+--*/
+static inline uint32_t
+LengthSymbol(
+    size_t length
+    )
+{
+    return static_cast<uint32_t>(std::upper_bound(s_lengthBase, s_lengthBase + 29, length) - s_lengthBase) - 1;
+}
+
+/*++
+
+Routine Name:
+
+    DistanceSymbol
+
+Routine Description:
+
+    This routine returns the distance code for a match distance
+
+Arguments:
+
+    distance - The match distance
+
+Return Value:
+
+    The distance code
+
+--*/
+static inline uint32_t
+DistanceSymbol(
+    size_t distance
+    )
+{
+    return static_cast<uint32_t>(std::upper_bound(s_distBase, s_distBase + 30, distance) - s_distBase) - 1;
+}
+
+/*++
+
+Routine Name:
+
+    BuildLengths
+
+Routine Description:
+
+    This routine computes Huffman code lengths for a set of symbol frequencies,
+    limited to a maximum code length. Unused symbols get a length of zero.
+
+Arguments:
+
+    pFreq    - Symbol frequencies
+    cSymbols - Number of symbols
+    maxBits  - Maximum code length
+    pLengths - Receives the code lengths
+
+Return Value:
+
+    None
+
+--*/
+static void
+BuildLengths(
+    const uint32_t* pFreq,
+    size_t          cSymbols,
+    uint32_t        maxBits,
+    uint8_t*        pLengths
+    )
+{
+    std::vector<std::pair<uint32_t, uint16_t> > used;
+
+    memset(pLengths, 0, cSymbols);
+
+    for (size_t sym = 0; sym < cSymbols; sym++)
+    {
+        if (pFreq[sym] > 0)
+        {
+            used.push_back(std::make_pair(pFreq[sym], static_cast<uint16_t>(sym)));
+        }
+    }
+
+    if (used.size() == 1)
+    {
+        //
+        // Pair a lone symbol with an unused one so the code is complete
+        //
+        pLengths[used[0].second] = 1;
+        pLengths[(used[0].second == 0) ? 1 : 0] = 1;
+    }
+
+    if (used.size() <= 1)
+    {
+        return;
+    }
+
+    std::sort(used.begin(), used.end());
+
+    //
+    // Build the tree with two queues: the sorted leaves and the internal
+    // nodes, which are created in order of increasing weight. Nodes are
+    // numbered leaves first, so every parent has a higher index than its
+    // children.
+    //
+    size_t cLeaves = used.size();
+    size_t cNodes = 2 * cLeaves - 1;
+
+    std::vector<uint64_t> weight(cNodes);
+    std::vector<uint32_t> parent(cNodes);
+    std::vector<uint32_t> depth(cNodes);
+
+    for (size_t leaf = 0; leaf < cLeaves; leaf++)
+    {
+        weight[leaf] = used[leaf].first;
+    }
+
+    size_t nextLeaf = 0;
+    size_t nextNode = cLeaves;
+
+    for (size_t node = cLeaves; node < cNodes; node++)
+    {
+        size_t child[2];
+
+        for (size_t pick = 0; pick < 2; pick++)
+        {
+            if (nextLeaf < cLeaves &&
+                (nextNode >= node || weight[nextLeaf] <= weight[nextNode]))
+            {
+                child[pick] = nextLeaf++;
+            }
+            else
+            {
+                child[pick] = nextNode++;
+            }
+        }
+
+        weight[node] = weight[child[0]] + weight[child[1]];
+        parent[child[0]] = static_cast<uint32_t>(node);
+        parent[child[1]] = static_cast<uint32_t>(node);
+    }
+
+    depth[cNodes - 1] = 0;
+
+    for (size_t node = cNodes - 1; node-- > 0;)
+    {
+        depth[node] = depth[parent[node]] + 1;
+    }
+
+    //
+    // Count the codes of each length, then move codes that are too long up
+    // to the maximum length and lengthen shorter codes until the lengths
+    // describe a complete code again
+    //
+    uint32_t numCodes[33] = {0};
+
+    for (size_t leaf = 0; leaf < cLeaves; leaf++)
+    {
+        numCodes[std::min<uint32_t>(depth[leaf], 32)]++;
+    }
+
+    for (uint32_t bits = maxBits + 1; bits <= 32; bits++)
+    {
+        numCodes[maxBits] += numCodes[bits];
+        numCodes[bits] = 0;
+    }
+
+    uint32_t total = 0;
+
+    for (uint32_t bits = maxBits; bits > 0; bits--)
+    {
+        total += numCodes[bits] << (maxBits - bits);
+    }
+
+    while (total != (1u << maxBits))
+    {
+        numCodes[maxBits]--;
+
+        for (uint32_t bits = maxBits - 1; bits > 0; bits--)
+        {
+            if (numCodes[bits] != 0)
+            {
+                numCodes[bits]--;
+                numCodes[bits + 1] += 2;
+                break;
+            }
+        }
+
+        total--;
+    }
+
+    //
+    // The least frequent symbols get the longest codes
+    //
+    size_t leaf = 0;
+
+    for (uint32_t bits = maxBits; bits > 0; bits--)
+    {
+        for (uint32_t count = numCodes[bits]; count > 0; count--)
+        {
+            pLengths[used[leaf++].second] = static_cast<uint8_t>(bits);
+        }
+    }
+}
+
+/*++
+
+Routine Name:
+
+    BuildCodes
+
+Routine Description:
+
+    This routine assigns canonical Huffman codes for a set of code lengths. The
+    codes are bit reversed, ready to be written least significant bit first.
+
+Arguments:
+
+    pLengths - The code lengths
+    cSymbols - Number of symbols
+    pCodes   - Receives the codes
+
+Return Value:
+
+    None
+
+--*/
+static void
+BuildCodes(
+    const uint8_t* pLengths,
+    size_t         cSymbols,
+    uint16_t*      pCodes
+    )
+{
+    uint32_t count[16] = {0};
+    uint32_t next[16] = {0};
+
+    for (size_t sym = 0; sym < cSymbols; sym++)
+    {
+        count[pLengths[sym]]++;
+    }
+
+    count[0] = 0;
+
+    uint32_t code = 0;
+
+    for (uint32_t bits = 1; bits < 16; bits++)
+    {
+        code = (code + count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+
+    for (size_t sym = 0; sym < cSymbols; sym++)
+    {
+        uint32_t bits = pLengths[sym];
+
+        if (bits != 0)
+        {
+            uint32_t value = next[bits]++;
+            uint32_t reversed = 0;
+
+            for (uint32_t bit = 0; bit < bits; bit++)
+            {
+                reversed = (reversed << 1) | ((value >> bit) & 1);
+            }
+
+            pCodes[sym] = static_cast<uint16_t>(reversed);
+        }
+        else
+        {
+            pCodes[sym] = 0;
+        }
+    }
+}
+
+/*++
+
+Routine Name:
+
+    PKCrc32
+
+Routine Description:
+
+    This routine updates a CRC-32 with the contents of a buffer
+
+Arguments:
+
+    crc    - The CRC of the preceding data (0 for none)
+    pData  - The data
+    cbData - Count of bytes of data
+
+Return Value:
+
+    The updated CRC
+
+--*/
+uint32_t
+PKCrc32(
+    uint32_t       crc,
+    const uint8_t* pData,
+    size_t         cbData
+    )
+{
+    const uint32_t (*table)[256] = s_crcTables.table;
+
+    crc = ~crc;
+
+    while (cbData >= 4)
+    {
+        crc ^= static_cast<uint32_t>(pData[0]) |
+               (static_cast<uint32_t>(pData[1]) << 8) |
+               (static_cast<uint32_t>(pData[2]) << 16) |
+               (static_cast<uint32_t>(pData[3]) << 24);
+
+        crc = table[3][crc & 0xFF] ^
+              table[2][(crc >> 8) & 0xFF] ^
+              table[1][(crc >> 16) & 0xFF] ^
+              table[0][crc >> 24];
+
+        pData  += 4;
+        cbData -= 4;
+    }
+
+    while (cbData-- > 0)
+    {
+        crc = table[0][(crc ^ *pData++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+static uint32_t
+Gf2MatrixTimes(
+    const uint32_t* pMatrix,
+    uint32_t        vector
+    )
+{
+    uint32_t sum = 0;
+
+    while (vector != 0)
+    {
+        if (vector & 1)
+        {
+            sum ^= *pMatrix;
+        }
+
+        vector >>= 1;
+        pMatrix++;
+    }
+
+    return sum;
+}
+
+static void
+Gf2MatrixSquare(
+    uint32_t*       pSquare,
+    const uint32_t* pMatrix
+    )
+{
+    for (uint32_t n = 0; n < 32; n++)
+    {
+        pSquare[n] = Gf2MatrixTimes(pMatrix, pMatrix[n]);
+    }
+}
+
+/*++
+
+Routine Name:
+
+    PKCrc32Combine
+
+Routine Description:
+
+    This routine computes the CRC-32 of two concatenated buffers from the CRC
+    of each, by applying the CRC of cbSecond zero bytes to the first CRC
+
+Arguments:
+
+    crcFirst  - The CRC of the first buffer
+    crcSecond - The CRC of the second buffer
+    cbSecond  - The length of the second buffer
+
+Return Value:
+
+    The CRC of the concatenated buffers
+
+--*/
+uint32_t
+PKCrc32Combine(
+    uint32_t crcFirst,
+    uint32_t crcSecond,
+    uint64_t cbSecond
+    )
+{
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    if (cbSecond == 0)
+    {
+        return crcFirst;
+    }
+
+    //
+    // Operator for one zero bit in odd, then two and four in even and odd
+    //
+    odd[0] = 0xEDB88320;
+
+    uint32_t row = 1;
+
+    for (uint32_t n = 1; n < 32; n++)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    Gf2MatrixSquare(even, odd);
+    Gf2MatrixSquare(odd, even);
+
+    //
+    // Apply one zero byte, then two, four and so on for each set bit of the length
+    //
+    do
+    {
+        Gf2MatrixSquare(even, odd);
+
+        if (cbSecond & 1)
+        {
+            crcFirst = Gf2MatrixTimes(even, crcFirst);
+        }
+
+        cbSecond >>= 1;
+
+        if (cbSecond == 0)
+        {
+            break;
+        }
+
+        Gf2MatrixSquare(odd, even);
+
+        if (cbSecond & 1)
+        {
+            crcFirst = Gf2MatrixTimes(odd, crcFirst);
+        }
+
+        cbSecond >>= 1;
+    }
+    while (cbSecond != 0);
+
+    return crcFirst ^ crcSecond;
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::CPKDeflater
+
+Routine Description:
+
+    CPKDeflater class constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPKDeflater::CPKDeflater() :
+    m_pWindow(NULL),
+    m_blockStart(0),
+    m_head(static_cast<size_t>(1) << ms_hashBits),
+    m_prev(ms_cbWindow),
+    m_pOut(NULL),
+    m_bitBuffer(0),
+    m_bitCount(0)
+{
+    m_symbols.reserve(ms_maxBlockSymbols);
+    m_distances.reserve(ms_maxBlockSymbols);
+
+    memset(m_litFreq, 0, sizeof(m_litFreq));
+    memset(m_distFreq, 0, sizeof(m_distFreq));
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::~CPKDeflater
+
+Routine Description:
+
+    CPKDeflater class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPKDeflater::~CPKDeflater()
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::Compress
+
+Routine Description:
+
+    This routine compresses a chunk of data and appends the deflate data to
+    the output. Up to ms_cbWindow bytes immediately preceding the chunk may be
+    used as a dictionary. A non-final chunk is ended with an empty stored block
+    so the output finishes on a byte boundary and the next chunk's output can
+    simply be appended to it.
+
+Arguments:
+
+    pData  - Pointer to the chunk. The cbDict bytes before this are the dictionary.
+    cbDict - Count of bytes of dictionary
+    cbData - Count of bytes in the chunk
+    bFinal - True if this is the last chunk of the stream
+    pOut   - Vector the deflate data is appended to
+
+Return Value:
+
+    None
+    Throws std::bad_alloc when out of memory
+
+--*/
+void
+CPKDeflater::Compress(
+    const uint8_t*        pData,
+    size_t                cbDict,
+    size_t                cbData,
+    bool                  bFinal,
+    std::vector<uint8_t>* pOut
+    )
+{
+    cbDict = std::min(cbDict, static_cast<size_t>(ms_cbWindow));
+
+    m_pWindow    = pData - cbDict;
+    m_blockStart = cbDict;
+    m_pOut       = pOut;
+    m_bitBuffer  = 0;
+    m_bitCount   = 0;
+
+    m_symbols.clear();
+    m_distances.clear();
+    memset(m_litFreq, 0, sizeof(m_litFreq));
+    memset(m_distFreq, 0, sizeof(m_distFreq));
+
+    std::fill(m_head.begin(), m_head.end(), 0);
+
+    size_t total = cbDict + cbData;
+
+    for (size_t pos = 0; pos < cbDict && pos + s_minMatch <= total; pos++)
+    {
+        InsertHash(pos);
+    }
+
+    //
+    // Lazy matching: a match found at one position is only used if the next
+    // position does not have a longer one
+    //
+    size_t pos = cbDict;
+    size_t covered = cbDict;
+    size_t prevLength = 0;
+    size_t prevDistance = 0;
+    bool   bPending = false;
+
+    while (pos < total)
+    {
+        size_t avail = total - pos;
+        size_t length = 0;
+        size_t distance = 0;
+
+        if (avail >= s_minMatch)
+        {
+            if (prevLength < s_maxLazy)
+            {
+                length = FindMatch(pos, avail, prevLength, &distance);
+            }
+
+            InsertHash(pos);
+        }
+
+        if (bPending &&
+            prevLength >= s_minMatch &&
+            length <= prevLength)
+        {
+            //
+            // The match at the previous position is the better one
+            //
+            AddMatch(prevLength, prevDistance);
+
+            size_t end = pos - 1 + prevLength;
+
+            for (size_t hashPos = pos + 1; hashPos < end; hashPos++)
+            {
+                if (hashPos + s_minMatch <= total)
+                {
+                    InsertHash(hashPos);
+                }
+            }
+
+            covered = end;
+            pos = end;
+            prevLength = 0;
+            bPending = false;
+        }
+        else
+        {
+            if (bPending)
+            {
+                AddLiteral(m_pWindow[pos - 1]);
+                covered = pos;
+            }
+
+            prevLength = length;
+            prevDistance = distance;
+            bPending = true;
+            pos++;
+        }
+
+        if (m_symbols.size() >= ms_maxBlockSymbols)
+        {
+            FlushBlock(covered, false);
+        }
+    }
+
+    if (bPending)
+    {
+        AddLiteral(m_pWindow[pos - 1]);
+        covered = pos;
+    }
+
+    FlushBlock(covered, bFinal);
+
+    if (!bFinal)
+    {
+        WriteStoredBlocks(NULL, 0, false);
+    }
+
+    AlignToByte();
+
+    m_pOut = NULL;
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::InsertHash
+
+Routine Description:
+
+    This routine adds a position to the hash chains
+
+Arguments:
+
+    pos - The window position. There must be at least three bytes from pos.
+
+Return Value:
+
+    None
+
+--*/
+inline void
+CPKDeflater::InsertHash(
+    size_t pos
+    )
+{
+    const uint8_t* p = m_pWindow + pos;
+
+    uint32_t value = static_cast<uint32_t>(p[0]) |
+                     (static_cast<uint32_t>(p[1]) << 8) |
+                     (static_cast<uint32_t>(p[2]) << 16);
+
+    uint32_t hash = (value * 2654435761u) >> (32 - ms_hashBits);
+
+    m_prev[pos & (ms_cbWindow - 1)] = m_head[hash];
+    m_head[hash] = static_cast<uint32_t>(pos + 1);
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::FindMatch
+
+Routine Description:
+
+    This routine searches the hash chain for the longest match at a position
+    that is longer than the match at the previous position
+
+Arguments:
+
+    pos          - The window position. It must not yet be in the hash chains.
+    cbAvail      - Count of bytes available from pos
+    cbPrevLength - Length of the match at the previous position
+    pDistance    - Receives the distance of the match
+
+Return Value:
+
+    The match length, or zero if there is no better match
+
+--*/
+size_t
+CPKDeflater::FindMatch(
+    size_t  pos,
+    size_t  cbAvail,
+    size_t  cbPrevLength,
+    size_t* pDistance
+    )
+{
+    size_t maxLength = std::min(cbAvail, s_maxMatch);
+    size_t bestLength = std::max(cbPrevLength, s_minMatch - 1);
+    size_t bestDistance = 0;
+
+    if (bestLength >= maxLength)
+    {
+        return 0;
+    }
+
+    uint32_t chain = (cbPrevLength >= s_goodLength) ? s_maxChain / 4 : s_maxChain;
+
+    const uint8_t* pCur = m_pWindow + pos;
+
+    uint32_t value = static_cast<uint32_t>(pCur[0]) |
+                     (static_cast<uint32_t>(pCur[1]) << 8) |
+                     (static_cast<uint32_t>(pCur[2]) << 16);
+
+    uint32_t candidate = m_head[(value * 2654435761u) >> (32 - ms_hashBits)];
+
+    while (candidate != 0 &&
+           chain-- > 0)
+    {
+        size_t candPos = candidate - 1;
+        size_t distance = pos - candPos;
+
+        if (distance > ms_cbWindow)
+        {
+            break;
+        }
+
+        const uint8_t* pCand = m_pWindow + candPos;
+
+        if (pCand[bestLength] == pCur[bestLength] &&
+            pCand[0] == pCur[0] &&
+            pCand[1] == pCur[1])
+        {
+            size_t length = 2;
+
+            while (length < maxLength &&
+                   pCand[length] == pCur[length])
+            {
+                length++;
+            }
+
+            if (length > bestLength)
+            {
+                bestLength = length;
+                bestDistance = distance;
+
+                if (length >= maxLength ||
+                    length >= s_niceLength)
+                {
+                    break;
+                }
+            }
+        }
+
+        //
+        // Chain entries only ever point backwards; anything else is a slot
+        // that has been reused for a newer position
+        //
+        uint32_t next = m_prev[candPos & (ms_cbWindow - 1)];
+
+        if (next >= candidate)
+        {
+            break;
+        }
+
+        candidate = next;
+    }
+
+    if (bestDistance == 0 ||
+        (bestLength == s_minMatch && bestDistance > s_tooFar))
+    {
+        return 0;
+    }
+
+    *pDistance = bestDistance;
+    return bestLength;
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::AddLiteral
+
+Routine Description:
+
+    This routine adds a literal to the current block
+
+Arguments:
+
+    literal - The literal byte
+
+Return Value:
+
+    None
+
+--*/
+inline void
+CPKDeflater::AddLiteral(
+    uint8_t literal
+    )
+{
+    m_symbols.push_back(literal);
+    m_distances.push_back(0);
+    m_litFreq[literal]++;
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::AddMatch
+
+Routine Description:
+
+    This routine adds a match to the current block
+
+Arguments:
+
+    length   - The match length
+    distance - The match distance
+
+Return Value:
+
+    None
+
+--*/
+inline void
+CPKDeflater::AddMatch(
+    size_t length,
+    size_t distance
+    )
+{
+    m_symbols.push_back(static_cast<uint16_t>(length));
+    m_distances.push_back(static_cast<uint16_t>(distance));
+    m_litFreq[257 + LengthSymbol(length)]++;
+    m_distFreq[DistanceSymbol(distance)]++;
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::FlushBlock
+
+Routine Description:
+
+    This routine writes the symbols collected for the current block, using
+    dynamic Huffman codes, the fixed codes or stored data, whichever is
+    smallest, and starts a new block
+
+Arguments:
+
+    blockEnd - The window position the block's symbols end at
+    bFinal   - True if this is the last block of the stream
+
+Return Value:
+
+    None
+
+--*/
+void
+CPKDeflater::FlushBlock(
+    size_t blockEnd,
+    bool   bFinal
+    )
+{
+    uint8_t  litLengths[286];
+    uint8_t  distLengths[30];
+    uint16_t litCodes[288];
+    uint16_t distCodes[30];
+
+    m_litFreq[256]++;
+
+    BuildLengths(m_litFreq, 286, 15, litLengths);
+    BuildLengths(m_distFreq, 30, 15, distLengths);
+
+    //
+    // A distance code must be present even when there are no matches
+    //
+    uint32_t cLit = 286;
+    uint32_t cDist = 30;
+
+    while (cLit > 257 && litLengths[cLit - 1] == 0)
+    {
+        cLit--;
+    }
+
+    while (cDist > 1 && distLengths[cDist - 1] == 0)
+    {
+        cDist--;
+    }
+
+    if (cDist == 1 && distLengths[0] == 0)
+    {
+        distLengths[0] = 1;
+    }
+
+    //
+    // Run length encode the code lengths with the code length alphabet
+    //
+    uint8_t  allLengths[286 + 30];
+    uint8_t  clSymbols[286 + 30];
+    uint8_t  clExtra[286 + 30];
+    uint32_t cClSymbols = 0;
+    uint32_t clFreq[19] = {0};
+
+    memcpy(allLengths, litLengths, cLit);
+    memcpy(allLengths + cLit, distLengths, cDist);
+
+    uint32_t cAll = cLit + cDist;
+
+    for (uint32_t index = 0; index < cAll;)
+    {
+        uint8_t  length = allLengths[index];
+        uint32_t run = 1;
+
+        while (index + run < cAll &&
+               allLengths[index + run] == length)
+        {
+            run++;
+        }
+
+        index += run;
+
+        if (length == 0)
+        {
+            while (run >= 11)
+            {
+                uint32_t repeat = std::min<uint32_t>(run, 138);
+
+                clSymbols[cClSymbols] = 18;
+                clExtra[cClSymbols++] = static_cast<uint8_t>(repeat - 11);
+                run -= repeat;
+            }
+
+            if (run >= 3)
+            {
+                clSymbols[cClSymbols] = 17;
+                clExtra[cClSymbols++] = static_cast<uint8_t>(run - 3);
+                run = 0;
+            }
+        }
+        else
+        {
+            clSymbols[cClSymbols] = length;
+            clExtra[cClSymbols++] = 0;
+            run--;
+
+            while (run >= 3)
+            {
+                uint32_t repeat = std::min<uint32_t>(run, 6);
+
+                clSymbols[cClSymbols] = 16;
+                clExtra[cClSymbols++] = static_cast<uint8_t>(repeat - 3);
+                run -= repeat;
+            }
+        }
+
+        while (run-- > 0)
+        {
+            clSymbols[cClSymbols] = length;
+            clExtra[cClSymbols++] = 0;
+        }
+    }
+
+    for (uint32_t sym = 0; sym < cClSymbols; sym++)
+    {
+        clFreq[clSymbols[sym]]++;
+    }
+
+    uint8_t  clLengths[19];
+    uint16_t clCodes[19];
+
+    BuildLengths(clFreq, 19, 7, clLengths);
+
+    uint32_t cClLengths = 19;
+
+    while (cClLengths > 4 && clLengths[s_clOrder[cClLengths - 1]] == 0)
+    {
+        cClLengths--;
+    }
+
+    //
+    // Size of the block each way
+    //
+    uint64_t extraBits = 0;
+    uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * cClLengths;
+    uint64_t fixedBits = 3;
+
+    for (uint32_t sym = 0; sym < 19; sym++)
+    {
+        dynamicBits += static_cast<uint64_t>(clFreq[sym]) * clLengths[sym];
+    }
+
+    dynamicBits += 2 * clFreq[16] + 3 * clFreq[17] + 7 * clFreq[18];
+
+    for (uint32_t sym = 0; sym < 286; sym++)
+    {
+        uint32_t fixedLength = (sym < 144) ? 8 : (sym < 256) ? 9 : (sym < 280) ? 7 : 8;
+
+        dynamicBits += static_cast<uint64_t>(m_litFreq[sym]) * litLengths[sym];
+        fixedBits += static_cast<uint64_t>(m_litFreq[sym]) * fixedLength;
+
+        if (sym >= 257)
+        {
+            extraBits += static_cast<uint64_t>(m_litFreq[sym]) * s_lengthExtra[sym - 257];
+        }
+    }
+
+    for (uint32_t sym = 0; sym < 30; sym++)
+    {
+        dynamicBits += static_cast<uint64_t>(m_distFreq[sym]) * distLengths[sym];
+        fixedBits += static_cast<uint64_t>(m_distFreq[sym]) * 5;
+        extraBits += static_cast<uint64_t>(m_distFreq[sym]) * s_distExtra[sym];
+    }
+
+    dynamicBits += extraBits;
+    fixedBits += extraBits;
+
+    size_t   cbBlock = blockEnd - m_blockStart;
+    uint64_t storedBits = (static_cast<uint64_t>(cbBlock / 65535) + 1) * (3 + 7 + 32) + 8 * static_cast<uint64_t>(cbBlock);
+
+    if (storedBits < dynamicBits &&
+        storedBits < fixedBits)
+    {
+        WriteStoredBlocks(m_pWindow + m_blockStart, cbBlock, bFinal);
+    }
+    else if (fixedBits <= dynamicBits)
+    {
+        uint8_t fixedLitLengths[288];
+        uint8_t fixedDistLengths[30];
+
+        memset(fixedLitLengths, 8, 144);
+        memset(fixedLitLengths + 144, 9, 112);
+        memset(fixedLitLengths + 256, 7, 24);
+        memset(fixedLitLengths + 280, 8, 8);
+        memset(fixedDistLengths, 5, 30);
+
+        BuildCodes(fixedLitLengths, 288, litCodes);
+        BuildCodes(fixedDistLengths, 30, distCodes);
+
+        PutBits(bFinal ? 1 : 0, 1);
+        PutBits(1, 2);
+
+        WriteSymbols(fixedLitLengths, litCodes, fixedDistLengths, distCodes);
+    }
+    else
+    {
+        BuildCodes(litLengths, 286, litCodes);
+        BuildCodes(distLengths, 30, distCodes);
+        BuildCodes(clLengths, 19, clCodes);
+
+        PutBits(bFinal ? 1 : 0, 1);
+        PutBits(2, 2);
+        PutBits(cLit - 257, 5);
+        PutBits(cDist - 1, 5);
+        PutBits(cClLengths - 4, 4);
+
+        for (uint32_t index = 0; index < cClLengths; index++)
+        {
+            PutBits(clLengths[s_clOrder[index]], 3);
+        }
+
+        for (uint32_t index = 0; index < cClSymbols; index++)
+        {
+            uint8_t sym = clSymbols[index];
+
+            PutBits(clCodes[sym], clLengths[sym]);
+
+            if (sym == 16)
+            {
+                PutBits(clExtra[index], 2);
+            }
+            else if (sym == 17)
+            {
+                PutBits(clExtra[index], 3);
+            }
+            else if (sym == 18)
+            {
+                PutBits(clExtra[index], 7);
+            }
+        }
+
+        WriteSymbols(litLengths, litCodes, distLengths, distCodes);
+    }
+
+    m_symbols.clear();
+    m_distances.clear();
+    memset(m_litFreq, 0, sizeof(m_litFreq));
+    memset(m_distFreq, 0, sizeof(m_distFreq));
+
+    m_blockStart = blockEnd;
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::WriteStoredBlocks
+
+Routine Description:
+
+    This routine writes data as one or more stored blocks. An empty stored
+    block is written when there is no data.
+
+Arguments:
+
+    pData  - The data
+    cbData - Count of bytes of data
+    bFinal - True if the last of the blocks ends the stream
+
+Return Value:
+
+    None
+
+--*/
+void
+CPKDeflater::WriteStoredBlocks(
+    const uint8_t* pData,
+    size_t         cbData,
+    bool           bFinal
+    )
+{
+    do
+    {
+        size_t cbBlock = std::min<size_t>(cbData, 65535);
+
+        PutBits((bFinal && cbBlock == cbData) ? 1 : 0, 1);
+        PutBits(0, 2);
+        AlignToByte();
+
+        uint8_t header[4] = {
+            static_cast<uint8_t>(cbBlock),
+            static_cast<uint8_t>(cbBlock >> 8),
+            static_cast<uint8_t>(~cbBlock),
+            static_cast<uint8_t>(~cbBlock >> 8)
+        };
+
+        m_pOut->insert(m_pOut->end(), header, header + 4);
+
+        if (cbBlock > 0)
+        {
+            m_pOut->insert(m_pOut->end(), pData, pData + cbBlock);
+        }
+
+        pData  += cbBlock;
+        cbData -= cbBlock;
+    }
+    while (cbData > 0);
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::WriteSymbols
+
+Routine Description:
+
+    This routine writes the symbols of the current block followed by the end
+    of block code
+
+Arguments:
+
+    pLitLengths  - Literal/length code lengths
+    pLitCodes    - Literal/length codes
+    pDistLengths - Distance code lengths
+    pDistCodes   - Distance codes
+
+Return Value:
+
+    None
+
+--*/
+void
+CPKDeflater::WriteSymbols(
+    const uint8_t*  pLitLengths,
+    const uint16_t* pLitCodes,
+    const uint8_t*  pDistLengths,
+    const uint16_t* pDistCodes
+    )
+{
+    size_t cSymbols = m_symbols.size();
+
+    for (size_t index = 0; index < cSymbols; index++)
+    {
+        uint32_t distance = m_distances[index];
+
+        if (distance == 0)
+        {
+            uint32_t literal = m_symbols[index];
+
+            PutBits(pLitCodes[literal], pLitLengths[literal]);
+        }
+        else
+        {
+            uint32_t length = m_symbols[index];
+            uint32_t lengthSym = LengthSymbol(length);
+            uint32_t distSym = DistanceSymbol(distance);
+
+            PutBits(pLitCodes[257 + lengthSym], pLitLengths[257 + lengthSym]);
+            PutBits(length - s_lengthBase[lengthSym], s_lengthExtra[lengthSym]);
+            PutBits(pDistCodes[distSym], pDistLengths[distSym]);
+            PutBits(distance - s_distBase[distSym], s_distExtra[distSym]);
+        }
+    }
+
+    PutBits(pLitCodes[256], pLitLengths[256]);
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::PutBits
+
+Routine Description:
+
+    This routine writes bits to the output, least significant bit first
+
+Arguments:
+
+    bits  - The bits to write
+    cBits - Count of bits to write (at most 16)
+
+Return Value:
+
+    None
+
+--*/
+inline void
+CPKDeflater::PutBits(
+    uint32_t bits,
+    uint32_t cBits
+    )
+{
+    m_bitBuffer |= static_cast<uint64_t>(bits) << m_bitCount;
+    m_bitCount += cBits;
+
+    if (m_bitCount >= 32)
+    {
+        uint8_t bytes[4] = {
+            static_cast<uint8_t>(m_bitBuffer),
+            static_cast<uint8_t>(m_bitBuffer >> 8),
+            static_cast<uint8_t>(m_bitBuffer >> 16),
+            static_cast<uint8_t>(m_bitBuffer >> 24)
+        };
+
+        m_pOut->insert(m_pOut->end(), bytes, bytes + 4);
+
+        m_bitBuffer >>= 32;
+        m_bitCount -= 32;
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPKDeflater::AlignToByte
+
+Routine Description:
+
+    This routine writes any buffered bits, padding with zero bits to a byte boundary
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+void
+CPKDeflater::AlignToByte()
+{
+    while (m_bitCount > 0)
+    {
+        m_pOut->push_back(static_cast<uint8_t>(m_bitBuffer));
+
+        m_bitBuffer >>= 8;
+        m_bitCount = (m_bitCount > 8) ? m_bitCount - 8 : 0;
+    }
+
+    m_bitBuffer = 0;
+}
+
@@ -0,0 +1,172 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pkdeflate.h
+
+Abstract:
+
+   Definition of the PK deflate compressor and CRC-32 helpers. The compressor
+   produces raw deflate data (RFC 1951) for one chunk of a larger buffer at a
+   time. Each chunk may use the 32KB of data preceding it as a dictionary and
+   non-final chunks end on a byte boundary, so chunks of the same buffer can
+   be compressed independently (for example on separate threads) and the
+   results concatenated into a single deflate stream. The code depends only on
+   the C++ standard library so that it can be built and tested outside of the
+   filter.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//
+// CRC-32 (as used by PK archives) of a buffer, continuing from a previous CRC
+//
+uint32_t
+PKCrc32(
+    uint32_t       crc,
+    const uint8_t* pData,
+    size_t         cbData
+    );
+
+//
+// CRC-32 of the concatenation of two buffers given the CRC of each and the
+// length of the second
+//
+uint32_t
+PKCrc32Combine(
+    uint32_t crcFirst,
+    uint32_t crcSecond,
+    uint64_t cbSecond
+    );
+
+class CPKDeflater
+{
+public:
+    CPKDeflater();
+
+    ~CPKDeflater();
+
+    void
+    Compress(
+        const uint8_t*        pData,
+        size_t                cbDict,
+        size_t                cbData,
+        bool                  bFinal,
+        std::vector<uint8_t>* pOut
+        );
+
+    //
+    // The largest distance a match may reach back, which is also the amount of
+    // preceding data that is useful as a dictionary
+    //
+    static const size_t ms_cbWindow = 32768;
+
+private:
+    //
+    // prevent copy semantics
+    //
+    CPKDeflater(const CPKDeflater&);
+    CPKDeflater& operator=(const CPKDeflater&);
+
+    void
+    InsertHash(
+        size_t pos
+        );
+
+    size_t
+    FindMatch(
+        size_t  pos,
+        size_t  cbAvail,
+        size_t  cbPrevLength,
+        size_t* pDistance
+        );
+
+    void
+    AddLiteral(
+        uint8_t literal
+        );
+
+    void
+    AddMatch(
+        size_t length,
+        size_t distance
+        );
+
+    void
+    FlushBlock(
+        size_t blockEnd,
+        bool   bFinal
+        );
+
+    void
+    WriteStoredBlocks(
+        const uint8_t* pData,
+        size_t         cbData,
+        bool           bFinal
+        );
+
+    void
+    WriteSymbols(
+        const uint8_t*  pLitLengths,
+        const uint16_t* pLitCodes,
+        const uint8_t*  pDistLengths,
+        const uint16_t* pDistCodes
+        );
+
+    void
+    PutBits(
+        uint32_t bits,
+        uint32_t cBits
+        );
+
+    void
+    AlignToByte();
+
+    //
+    // Input window. Positions are relative to m_pWindow, which is the start of
+    // the dictionary.
+    //
+    const uint8_t*          m_pWindow;
+    size_t                  m_blockStart;
+
+    //
+    // Hash chains. m_head holds the most recent position (plus one) with each
+    // hash; m_prev links each position to the previous one with the same hash.
+    //
+    static const uint32_t   ms_hashBits = 15;
+
+    std::vector<uint32_t>   m_head;
+    std::vector<uint32_t>   m_prev;
+
+    //
+    // Symbols of the current block. A distance of zero marks a literal.
+    //
+    static const size_t     ms_maxBlockSymbols = 16384;
+
+    std::vector<uint16_t>   m_symbols;
+    std::vector<uint16_t>   m_distances;
+    uint32_t                m_litFreq[286];
+    uint32_t                m_distFreq[30];
+
+    //
+    // Output
+    //
+    std::vector<uint8_t>*   m_pOut;
+    uint64_t                m_bitBuffer;
+    uint32_t                m_bitCount;
+};
+
@@ -0,0 +1,1120 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pkwriter.cpp
+
+Abstract:
+
+   Implementation of the PK stream writer and PK record index. Records are
+   written as soon as they are added: a local header, then the record data.
+   Deflated records are split into chunks that are compressed in parallel,
+   each using the preceding 32KB as a dictionary, and the chunk outputs are
+   written back to back as a single deflate stream. Zip64 extensions are used
+   only when offsets, sizes or the record count need them.
+
+--*/
+
+#include "pkwriter.h"
+
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+static const uint32_t s_sigLocalHeader   = 0x04034B50;
+static const uint32_t s_sigCentralHeader = 0x02014B50;
+static const uint32_t s_sigEndOfCD       = 0x06054B50;
+static const uint32_t s_sigZip64EndOfCD  = 0x06064B50;
+static const uint32_t s_sigZip64Locator  = 0x07064B50;
+
+static const uint16_t s_zip64ExtraId     = 0x0001;
+static const uint16_t s_flagDescriptor   = 0x0008;
+
+static const uint16_t s_versionDefault   = 20;
+static const uint16_t s_versionZip64     = 45;
+
+static const uint32_t s_max16            = 0xFFFF;
+static const uint32_t s_max32            = 0xFFFFFFFF;
+
+static const size_t   s_cbLocalHeader    = 30;
+static const size_t   s_cbCentralHeader  = 46;
+static const size_t   s_cbEndOfCD        = 22;
+static const size_t   s_cbZip64EndOfCD   = 56;
+static const size_t   s_cbZip64Locator   = 20;
+
+static const size_t   s_cbCopyBuffer     = 1024 * 1024;
+
+static void
+PutU16(
+    std::vector<uint8_t>* pOut,
+    uint32_t              value
+    )
+{
+    pOut->push_back(static_cast<uint8_t>(value));
+    pOut->push_back(static_cast<uint8_t>(value >> 8));
+}
+
+static void
+PutU32(
+    std::vector<uint8_t>* pOut,
+    uint32_t              value
+    )
+{
+    PutU16(pOut, value & 0xFFFF);
+    PutU16(pOut, value >> 16);
+}
+
+static void
+PutU64(
+    std::vector<uint8_t>* pOut,
+    uint64_t              value
+    )
+{
+    PutU32(pOut, static_cast<uint32_t>(value));
+    PutU32(pOut, static_cast<uint32_t>(value >> 32));
+}
+
+static uint16_t
+GetU16(
+    const uint8_t* p
+    )
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t
+GetU32(
+    const uint8_t* p
+    )
+{
+    return static_cast<uint32_t>(GetU16(p)) | (static_cast<uint32_t>(GetU16(p + 2)) << 16);
+}
+
+static uint64_t
+GetU64(
+    const uint8_t* p
+    )
+{
+    return static_cast<uint64_t>(GetU32(p)) | (static_cast<uint64_t>(GetU32(p + 4)) << 32);
+}
+
+/*++
+
+Routine Name:
+
+    CPKRecordIndex::CPKRecordIndex
+
+Routine Description:
+
+    CPKRecordIndex class constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPKRecordIndex::CPKRecordIndex()
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPKRecordIndex::~CPKRecordIndex
+
+Routine Description:
+
+    CPKRecordIndex class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPKRecordIndex::~CPKRecordIndex()
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPKRecordIndex::Load
+
+Routine Description:
+
+    This routine reads the central directory of an archive and indexes the
+    records by name
+
+Arguments:
+
+    pInput - The archive
+
+Return Value:
+
+    true  - The archive was indexed
+    false - The archive does not have a central directory that can be read
+    Throws if the input cannot be read
+
+--*/
+bool
+CPKRecordIndex::Load(
+    IPKInput* pInput
+    )
+{
+    m_records.clear();
+
+    uint64_t cbArchive = pInput->GetSize();
+
+    if (cbArchive < s_cbEndOfCD)
+    {
+        return false;
+    }
+
+    //
+    // The end of central directory record is at the end of the archive,
+    // followed by a comment of up to 64KB
+    //
+    size_t   cbTail = static_cast<size_t>(std::min<uint64_t>(cbArchive, s_cbEndOfCD + s_max16));
+    uint64_t tailOffset = cbArchive - cbTail;
+
+    std::vector<uint8_t> tail(cbTail);
+    pInput->Read(tailOffset, &tail[0], cbTail);
+
+    size_t eocd = cbTail - s_cbEndOfCD + 1;
+
+    do
+    {
+        eocd--;
+    }
+    while (eocd > 0 &&
+           GetU32(&tail[eocd]) != s_sigEndOfCD);
+
+    if (GetU32(&tail[eocd]) != s_sigEndOfCD)
+    {
+        return false;
+    }
+
+    uint64_t cRecords = GetU16(&tail[eocd + 10]);
+    uint64_t cbCD     = GetU32(&tail[eocd + 12]);
+    uint64_t offsetCD = GetU32(&tail[eocd + 16]);
+
+    if (cRecords == s_max16 ||
+        cbCD == s_max32 ||
+        offsetCD == s_max32)
+    {
+        //
+        // Zip64 archive - the real values are in the zip64 end of central directory
+        //
+        uint8_t locator[s_cbZip64Locator];
+        uint8_t zip64EndOfCD[s_cbZip64EndOfCD];
+
+        if (tailOffset + eocd < s_cbZip64Locator)
+        {
+            return false;
+        }
+
+        pInput->Read(tailOffset + eocd - s_cbZip64Locator, locator, s_cbZip64Locator);
+
+        if (GetU32(locator) != s_sigZip64Locator)
+        {
+            return false;
+        }
+
+        uint64_t offsetZip64EndOfCD = GetU64(locator + 8);
+
+        if (offsetZip64EndOfCD + s_cbZip64EndOfCD > cbArchive)
+        {
+            return false;
+        }
+
+        pInput->Read(offsetZip64EndOfCD, zip64EndOfCD, s_cbZip64EndOfCD);
+
+        if (GetU32(zip64EndOfCD) != s_sigZip64EndOfCD)
+        {
+            return false;
+        }
+
+        cRecords = GetU64(zip64EndOfCD + 32);
+        cbCD     = GetU64(zip64EndOfCD + 40);
+        offsetCD = GetU64(zip64EndOfCD + 48);
+    }
+
+    if (offsetCD + cbCD > cbArchive ||
+        cbCD > SIZE_MAX)
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> directory(static_cast<size_t>(cbCD) + 1);
+    pInput->Read(offsetCD, &directory[0], static_cast<size_t>(cbCD));
+
+    size_t pos = 0;
+
+    for (uint64_t index = 0; index < cRecords; index++)
+    {
+        if (pos + s_cbCentralHeader > cbCD ||
+            GetU32(&directory[pos]) != s_sigCentralHeader)
+        {
+            m_records.clear();
+            return false;
+        }
+
+        const uint8_t* pHeader = &directory[pos];
+
+        size_t cbName    = GetU16(pHeader + 28);
+        size_t cbExtra   = GetU16(pHeader + 30);
+        size_t cbComment = GetU16(pHeader + 32);
+
+        if (pos + s_cbCentralHeader + cbName + cbExtra + cbComment > cbCD)
+        {
+            m_records.clear();
+            return false;
+        }
+
+        PKRecord record;
+
+        record.flags          = GetU16(pHeader + 8);
+        record.method         = GetU16(pHeader + 10);
+        record.time           = GetU16(pHeader + 12);
+        record.date           = GetU16(pHeader + 14);
+        record.crc            = GetU32(pHeader + 16);
+        record.cbCompressed   = GetU32(pHeader + 20);
+        record.cbUncompressed = GetU32(pHeader + 24);
+        record.offset         = GetU32(pHeader + 42);
+        record.name.assign(reinterpret_cast<const char*>(pHeader + s_cbCentralHeader), cbName);
+
+        //
+        // Values that do not fit are in the zip64 extra field, in a fixed order
+        //
+        const uint8_t* pExtra = pHeader + s_cbCentralHeader + cbName;
+        const uint8_t* pExtraEnd = pExtra + cbExtra;
+
+        while (pExtra + 4 <= pExtraEnd)
+        {
+            uint16_t id = GetU16(pExtra);
+            size_t   cbField = GetU16(pExtra + 2);
+            const uint8_t* pField = pExtra + 4;
+
+            if (pField + cbField > pExtraEnd)
+            {
+                break;
+            }
+
+            if (id == s_zip64ExtraId)
+            {
+                const uint8_t* pFieldEnd = pField + cbField;
+
+                if (record.cbUncompressed == s_max32 && pField + 8 <= pFieldEnd)
+                {
+                    record.cbUncompressed = GetU64(pField);
+                    pField += 8;
+                }
+
+                if (record.cbCompressed == s_max32 && pField + 8 <= pFieldEnd)
+                {
+                    record.cbCompressed = GetU64(pField);
+                    pField += 8;
+                }
+
+                if (record.offset == s_max32 && pField + 8 <= pFieldEnd)
+                {
+                    record.offset = GetU64(pField);
+                }
+            }
+
+            pExtra += 4 + cbField;
+        }
+
+        m_records[record.name] = record;
+
+        pos += s_cbCentralHeader + cbName + cbExtra + cbComment;
+    }
+
+    return true;
+}
+
+/*++
+
+Routine Name:
+
+    CPKRecordIndex::Find
+
+Routine Description:
+
+    This routine finds a record by name
+
+Arguments:
+
+    name - The record name
+
+Return Value:
+
+    Pointer to the record, or NULL if there is no record with the name
+
+--*/
+const PKRecord*
+CPKRecordIndex::Find(
+    const std::string& name
+    ) const
+{
+    std::map<std::string, PKRecord>::const_iterator iterRecord = m_records.find(name);
+
+    return (iterRecord != m_records.end()) ? &iterRecord->second : NULL;
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::CPKStreamWriter
+
+Routine Description:
+
+    CPKStreamWriter class constructor. Starts the worker threads.
+
+Arguments:
+
+    pOutput  - The output the archive is written to
+    cThreads - The number of threads to compress with, including the thread
+               adding records
+    time     - MS-DOS time stamp for new records
+    date     - MS-DOS date stamp for new records
+
+Return Value:
+
+    None
+
+--*/
+CPKStreamWriter::CPKStreamWriter(
+    IPKOutput* pOutput,
+    uint32_t   cThreads,
+    uint16_t   time,
+    uint16_t   date
+    ) :
+    m_pOutput(pOutput),
+    m_offset(0),
+    m_time(time),
+    m_date(date),
+    m_bClosed(false),
+    m_cOutstanding(0),
+    m_bShutdown(false),
+    m_bJobFailed(false),
+    m_bJobOutOfMemory(false)
+{
+    try
+    {
+        for (uint32_t thread = 1; thread < cThreads; thread++)
+        {
+            m_workers.push_back(std::thread(&CPKStreamWriter::WorkerLoop, this));
+        }
+    }
+    catch (...)
+    {
+        //
+        // Carry on with the threads that did start
+        //
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::~CPKStreamWriter
+
+Routine Description:
+
+    CPKStreamWriter class destructor. Stops the worker threads. The archive
+    must have been closed for the output to be a valid archive.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPKStreamWriter::~CPKStreamWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_bShutdown = true;
+    }
+
+    m_workReady.notify_all();
+
+    for (size_t thread = 0; thread < m_workers.size(); thread++)
+    {
+        m_workers[thread].join();
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::AddRecord
+
+Routine Description:
+
+    This routine compresses a record and writes it to the output. Data that is
+    already compressed, or that deflate does not make smaller, is stored.
+
+Arguments:
+
+    name   - The record name
+    pData  - The record data
+    cbData - Count of bytes of data
+    method - The requested compression method
+
+Return Value:
+
+    None
+    Throws on failure
+
+--*/
+void
+CPKStreamWriter::AddRecord(
+    const std::string& name,
+    const uint8_t*     pData,
+    size_t             cbData,
+    EPKMethod          method
+    )
+{
+    PKRecord record;
+
+    record.name           = name;
+    record.flags          = 0;
+    record.method         = PKMethodStored;
+    record.time           = m_time;
+    record.date           = m_date;
+    record.crc            = 0;
+    record.cbCompressed   = cbData;
+    record.cbUncompressed = cbData;
+    record.offset         = m_offset;
+
+    std::vector<DeflateJob> jobs;
+
+    if (method == PKMethodDeflated &&
+        !IsCompressedContent(pData, cbData))
+    {
+        Deflate(pData, cbData, &jobs);
+
+        uint64_t cbCompressed = 0;
+
+        for (size_t job = 0; job < jobs.size(); job++)
+        {
+            record.crc = (job == 0) ? jobs[job].crc : PKCrc32Combine(record.crc, jobs[job].crc, jobs[job].cbData);
+            cbCompressed += jobs[job].out.size();
+        }
+
+        if (cbCompressed < cbData)
+        {
+            record.method = PKMethodDeflated;
+            record.cbCompressed = cbCompressed;
+        }
+    }
+    else
+    {
+        record.crc = PKCrc32(0, pData, cbData);
+    }
+
+    WriteLocalHeader(record);
+
+    if (record.method == PKMethodDeflated)
+    {
+        for (size_t job = 0; job < jobs.size(); job++)
+        {
+            if (!jobs[job].out.empty())
+            {
+                Write(&jobs[job].out[0], jobs[job].out.size());
+            }
+
+            std::vector<uint8_t>().swap(jobs[job].out);
+        }
+    }
+    else if (cbData > 0)
+    {
+        Write(pData, cbData);
+    }
+
+    m_records.push_back(record);
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::CopyRecord
+
+Routine Description:
+
+    This routine copies a record from another archive without decompressing it
+
+Arguments:
+
+    record - The record, as described by the source archive's central directory
+    pInput - The source archive
+
+Return Value:
+
+    None
+    Throws on failure
+
+--*/
+void
+CPKStreamWriter::CopyRecord(
+    const PKRecord& record,
+    IPKInput*       pInput
+    )
+{
+    uint8_t header[s_cbLocalHeader];
+
+    pInput->Read(record.offset, header, s_cbLocalHeader);
+
+    if (GetU32(header) != s_sigLocalHeader)
+    {
+        throw std::runtime_error("PK record has no local header");
+    }
+
+    uint64_t dataOffset = record.offset + s_cbLocalHeader + GetU16(header + 26) + GetU16(header + 28);
+
+    //
+    // The sizes and CRC are known so any data descriptor is not needed
+    //
+    PKRecord copy = record;
+
+    copy.flags  = static_cast<uint16_t>(record.flags & ~s_flagDescriptor);
+    copy.offset = m_offset;
+
+    WriteLocalHeader(copy);
+
+    std::vector<uint8_t> buffer(static_cast<size_t>(std::min<uint64_t>(record.cbCompressed, s_cbCopyBuffer)));
+    uint64_t cbRemaining = record.cbCompressed;
+
+    while (cbRemaining > 0)
+    {
+        size_t cbRead = static_cast<size_t>(std::min<uint64_t>(cbRemaining, buffer.size()));
+
+        pInput->Read(dataOffset, &buffer[0], cbRead);
+        Write(&buffer[0], cbRead);
+
+        dataOffset  += cbRead;
+        cbRemaining -= cbRead;
+    }
+
+    m_records.push_back(copy);
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::Close
+
+Routine Description:
+
+    This routine writes the central directory, completing the archive
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+    Throws on failure
+
+--*/
+void
+CPKStreamWriter::Close()
+{
+    if (m_bClosed)
+    {
+        return;
+    }
+
+    uint64_t offsetCD = m_offset;
+
+    std::vector<uint8_t> header;
+
+    for (size_t index = 0; index < m_records.size(); index++)
+    {
+        const PKRecord& record = m_records[index];
+
+        std::vector<uint8_t> extra;
+
+        if (record.cbUncompressed >= s_max32)
+        {
+            PutU64(&extra, record.cbUncompressed);
+        }
+
+        if (record.cbCompressed >= s_max32)
+        {
+            PutU64(&extra, record.cbCompressed);
+        }
+
+        if (record.offset >= s_max32)
+        {
+            PutU64(&extra, record.offset);
+        }
+
+        uint16_t version = extra.empty() ? s_versionDefault : s_versionZip64;
+
+        header.clear();
+
+        PutU32(&header, s_sigCentralHeader);
+        PutU16(&header, version);
+        PutU16(&header, version);
+        PutU16(&header, record.flags);
+        PutU16(&header, record.method);
+        PutU16(&header, record.time);
+        PutU16(&header, record.date);
+        PutU32(&header, record.crc);
+        PutU32(&header, static_cast<uint32_t>(std::min<uint64_t>(record.cbCompressed, s_max32)));
+        PutU32(&header, static_cast<uint32_t>(std::min<uint64_t>(record.cbUncompressed, s_max32)));
+        PutU16(&header, static_cast<uint32_t>(record.name.size()));
+        PutU16(&header, static_cast<uint32_t>(extra.empty() ? 0 : extra.size() + 4));
+        PutU16(&header, 0);
+        PutU16(&header, 0);
+        PutU16(&header, 0);
+        PutU32(&header, 0);
+        PutU32(&header, static_cast<uint32_t>(std::min<uint64_t>(record.offset, s_max32)));
+
+        header.insert(header.end(), record.name.begin(), record.name.end());
+
+        if (!extra.empty())
+        {
+            PutU16(&header, s_zip64ExtraId);
+            PutU16(&header, static_cast<uint32_t>(extra.size()));
+            header.insert(header.end(), extra.begin(), extra.end());
+        }
+
+        Write(&header[0], header.size());
+    }
+
+    uint64_t cbCD = m_offset - offsetCD;
+    uint64_t cRecords = m_records.size();
+
+    header.clear();
+
+    if (cRecords >= s_max16 ||
+        cbCD >= s_max32 ||
+        offsetCD >= s_max32)
+    {
+        uint64_t offsetZip64EndOfCD = m_offset;
+
+        PutU32(&header, s_sigZip64EndOfCD);
+        PutU64(&header, s_cbZip64EndOfCD - 12);
+        PutU16(&header, s_versionZip64);
+        PutU16(&header, s_versionZip64);
+        PutU32(&header, 0);
+        PutU32(&header, 0);
+        PutU64(&header, cRecords);
+        PutU64(&header, cRecords);
+        PutU64(&header, cbCD);
+        PutU64(&header, offsetCD);
+
+        PutU32(&header, s_sigZip64Locator);
+        PutU32(&header, 0);
+        PutU64(&header, offsetZip64EndOfCD);
+        PutU32(&header, 1);
+    }
+
+    PutU32(&header, s_sigEndOfCD);
+    PutU16(&header, 0);
+    PutU16(&header, 0);
+    PutU16(&header, static_cast<uint32_t>(std::min<uint64_t>(cRecords, s_max16)));
+    PutU16(&header, static_cast<uint32_t>(std::min<uint64_t>(cRecords, s_max16)));
+    PutU32(&header, static_cast<uint32_t>(std::min<uint64_t>(cbCD, s_max32)));
+    PutU32(&header, static_cast<uint32_t>(std::min<uint64_t>(offsetCD, s_max32)));
+    PutU16(&header, 0);
+
+    Write(&header[0], header.size());
+
+    m_bClosed = true;
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::IsCompressedContent
+
+Routine Description:
+
+    This routine identifies data in a format that is already compressed, which
+    deflate cannot usefully compress further
+
+Arguments:
+
+    pData  - The data
+    cbData - Count of bytes of data
+
+Return Value:
+
+    true if the data is a JPEG, PNG, JPEG XR or GIF image
+
+--*/
+bool
+CPKStreamWriter::IsCompressedContent(
+    const uint8_t* pData,
+    size_t         cbData
+    )
+{
+    static const uint8_t s_jpeg[] = { 0xFF, 0xD8, 0xFF };
+    static const uint8_t s_png[]  = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    static const uint8_t s_jxr[]  = { 'I', 'I', 0xBC };
+    static const uint8_t s_gif[]  = { 'G', 'I', 'F', '8' };
+
+    return (cbData >= sizeof(s_jpeg) && memcmp(pData, s_jpeg, sizeof(s_jpeg)) == 0) ||
+           (cbData >= sizeof(s_png)  && memcmp(pData, s_png,  sizeof(s_png))  == 0) ||
+           (cbData >= sizeof(s_jxr)  && memcmp(pData, s_jxr,  sizeof(s_jxr))  == 0) ||
+           (cbData >= sizeof(s_gif)  && memcmp(pData, s_gif,  sizeof(s_gif))  == 0);
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::Deflate
+
+Routine Description:
+
+    This routine splits data into chunks and deflates them, on the worker
+    threads when there is more than one chunk. The chunk outputs form a single
+    deflate stream when written in order.
+
+Arguments:
+
+    pData  - The data
+    cbData - Count of bytes of data
+    pJobs  - Receives a job per chunk with its CRC and deflate output
+
+Return Value:
+
+    None
+    Throws on failure
+
+--*/
+void
+CPKStreamWriter::Deflate(
+    const uint8_t*           pData,
+    size_t                   cbData,
+    std::vector<DeflateJob>* pJobs
+    )
+{
+    size_t cChunks = (cbData == 0) ? 1 : (cbData + ms_cbChunk - 1) / ms_cbChunk;
+
+    pJobs->resize(cChunks);
+
+    for (size_t chunk = 0; chunk < cChunks; chunk++)
+    {
+        DeflateJob& job = (*pJobs)[chunk];
+        size_t start = chunk * ms_cbChunk;
+
+        job.pData  = pData + start;
+        job.cbDict = std::min(start, static_cast<size_t>(CPKDeflater::ms_cbWindow));
+        job.cbData = std::min(static_cast<size_t>(ms_cbChunk), cbData - start);
+        job.bFinal = (chunk == cChunks - 1);
+        job.crc    = 0;
+    }
+
+    m_bJobFailed = false;
+    m_bJobOutOfMemory = false;
+
+    if (cChunks == 1 ||
+        m_workers.empty())
+    {
+        for (size_t chunk = 0; chunk < cChunks; chunk++)
+        {
+            RunJob(&(*pJobs)[chunk], &m_deflater);
+        }
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            for (size_t chunk = 0; chunk < cChunks; chunk++)
+            {
+                m_queue.push_back(&(*pJobs)[chunk]);
+            }
+
+            m_cOutstanding = cChunks;
+        }
+
+        m_workReady.notify_all();
+
+        //
+        // Compress chunks on this thread too until the queue is empty, then
+        // wait for the workers to finish theirs
+        //
+        for (;;)
+        {
+            DeflateJob* pJob = NULL;
+
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+
+                if (!m_queue.empty())
+                {
+                    pJob = m_queue.front();
+                    m_queue.pop_front();
+                }
+            }
+
+            if (pJob == NULL)
+            {
+                break;
+            }
+
+            RunJob(pJob, &m_deflater);
+
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_cOutstanding--;
+        }
+
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        while (m_cOutstanding > 0)
+        {
+            m_workDone.wait(lock);
+        }
+    }
+
+    if (m_bJobOutOfMemory)
+    {
+        throw std::bad_alloc();
+    }
+
+    if (m_bJobFailed)
+    {
+        throw std::runtime_error("PK deflate failed");
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::RunJob
+
+Routine Description:
+
+    This routine computes the CRC of a chunk and deflates it. Failures are
+    recorded for the adding thread to report.
+
+Arguments:
+
+    pJob      - The chunk
+    pDeflater - The compressor to use
+
+Return Value:
+
+    None
+
+--*/
+void
+CPKStreamWriter::RunJob(
+    DeflateJob*  pJob,
+    CPKDeflater* pDeflater
+    )
+{
+    try
+    {
+        pJob->crc = PKCrc32(0, pJob->pData, pJob->cbData);
+        pJob->out.reserve(pJob->cbData / 2 + 64);
+
+        pDeflater->Compress(pJob->pData, pJob->cbDict, pJob->cbData, pJob->bFinal, &pJob->out);
+    }
+    catch (std::bad_alloc&)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        m_bJobFailed = true;
+        m_bJobOutOfMemory = true;
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        m_bJobFailed = true;
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::WorkerLoop
+
+Routine Description:
+
+    Worker thread routine. Compresses queued chunks until the writer is
+    destroyed.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+void
+CPKStreamWriter::WorkerLoop()
+{
+    try
+    {
+        CPKDeflater deflater;
+
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        for (;;)
+        {
+            while (!m_bShutdown &&
+                   m_queue.empty())
+            {
+                m_workReady.wait(lock);
+            }
+
+            if (m_bShutdown)
+            {
+                break;
+            }
+
+            DeflateJob* pJob = m_queue.front();
+            m_queue.pop_front();
+
+            lock.unlock();
+
+            RunJob(pJob, &deflater);
+
+            lock.lock();
+
+            if (--m_cOutstanding == 0)
+            {
+                m_workDone.notify_all();
+            }
+        }
+    }
+    catch (...)
+    {
+        //
+        // The worker could not start; the adding thread compresses any
+        // chunks this thread would have taken
+        //
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::WriteLocalHeader
+
+Routine Description:
+
+    This routine writes the local header for a record
+
+Arguments:
+
+    record - The record
+
+Return Value:
+
+    None
+    Throws on failure
+
+--*/
+void
+CPKStreamWriter::WriteLocalHeader(
+    const PKRecord& record
+    )
+{
+    bool bZip64 = (record.cbCompressed >= s_max32 || record.cbUncompressed >= s_max32);
+
+    std::vector<uint8_t> header;
+
+    header.reserve(s_cbLocalHeader + record.name.size() + 20);
+
+    PutU32(&header, s_sigLocalHeader);
+    PutU16(&header, bZip64 ? s_versionZip64 : s_versionDefault);
+    PutU16(&header, record.flags);
+    PutU16(&header, record.method);
+    PutU16(&header, record.time);
+    PutU16(&header, record.date);
+    PutU32(&header, record.crc);
+    PutU32(&header, bZip64 ? s_max32 : static_cast<uint32_t>(record.cbCompressed));
+    PutU32(&header, bZip64 ? s_max32 : static_cast<uint32_t>(record.cbUncompressed));
+    PutU16(&header, static_cast<uint32_t>(record.name.size()));
+    PutU16(&header, bZip64 ? 20 : 0);
+
+    header.insert(header.end(), record.name.begin(), record.name.end());
+
+    if (bZip64)
+    {
+        PutU16(&header, s_zip64ExtraId);
+        PutU16(&header, 16);
+        PutU64(&header, record.cbUncompressed);
+        PutU64(&header, record.cbCompressed);
+    }
+
+    Write(&header[0], header.size());
+}
+
+/*++
+
+Routine Name:
+
+    CPKStreamWriter::Write
+
+Routine Description:
+
+    This routine writes to the output and tracks the archive offset
+
+Arguments:
+
+    pData  - The data
+    cbData - Count of bytes of data
+
+Return Value:
+
+    None
+    Throws on failure
+
+--*/
+void
+CPKStreamWriter::Write(
+    const uint8_t* pData,
+    size_t         cbData
+    )
+{
+    m_pOutput->Write(pData, cbData);
+    m_offset += cbData;
+}
+
@@ -0,0 +1,232 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   pkwriter.h
+
+Abstract:
+
+   Definition of the PK stream writer and PK record index. The stream writer
+   writes a PK (ZIP) archive to an output as records are added, keeping only
+   the central directory until the archive is closed. Large records are
+   deflated in independent chunks on a pool of worker threads. Data that is
+   already compressed (JPEG and PNG images) is stored rather than deflated
+   again, and records from an existing archive can be copied without being
+   decompressed, using the record index to locate them. The code depends only
+   on the C++ standard library so that it can be built and tested outside of
+   the filter.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pkdeflate.h"
+
+//
+// Destination for the archive. Write throws on failure.
+//
+class IPKOutput
+{
+public:
+    virtual
+    ~IPKOutput() {}
+
+    virtual void
+    Write(
+        const uint8_t* pData,
+        size_t         cbData
+        ) = 0;
+};
+
+//
+// Random access source archive. Read throws on failure.
+//
+class IPKInput
+{
+public:
+    virtual
+    ~IPKInput() {}
+
+    virtual uint64_t
+    GetSize() = 0;
+
+    virtual void
+    Read(
+        uint64_t offset,
+        uint8_t* pData,
+        size_t   cbData
+        ) = 0;
+};
+
+//
+// Compression methods
+//
+enum EPKMethod
+{
+    PKMethodStored   = 0,
+    PKMethodDeflated = 8
+};
+
+//
+// Description of a record, as held in the central directory
+//
+struct PKRecord
+{
+    std::string name;
+    uint16_t    flags;
+    uint16_t    method;
+    uint16_t    time;
+    uint16_t    date;
+    uint32_t    crc;
+    uint64_t    cbCompressed;
+    uint64_t    cbUncompressed;
+    uint64_t    offset;
+};
+
+class CPKRecordIndex
+{
+public:
+    CPKRecordIndex();
+
+    ~CPKRecordIndex();
+
+    bool
+    Load(
+        IPKInput* pInput
+        );
+
+    const PKRecord*
+    Find(
+        const std::string& name
+        ) const;
+
+private:
+    std::map<std::string, PKRecord> m_records;
+};
+
+class CPKStreamWriter
+{
+public:
+    CPKStreamWriter(
+        IPKOutput* pOutput,
+        uint32_t   cThreads,
+        uint16_t   time,
+        uint16_t   date
+        );
+
+    ~CPKStreamWriter();
+
+    void
+    AddRecord(
+        const std::string& name,
+        const uint8_t*     pData,
+        size_t             cbData,
+        EPKMethod          method
+        );
+
+    void
+    CopyRecord(
+        const PKRecord& record,
+        IPKInput*       pInput
+        );
+
+    void
+    Close();
+
+    static bool
+    IsCompressedContent(
+        const uint8_t* pData,
+        size_t         cbData
+        );
+
+    //
+    // Size of the chunks a record is split into for parallel compression
+    //
+    static const size_t ms_cbChunk = 128 * 1024;
+
+private:
+    //
+    // prevent copy semantics
+    //
+    CPKStreamWriter(const CPKStreamWriter&);
+    CPKStreamWriter& operator=(const CPKStreamWriter&);
+
+    struct DeflateJob
+    {
+        const uint8_t*       pData;
+        size_t               cbDict;
+        size_t               cbData;
+        bool                 bFinal;
+        uint32_t             crc;
+        std::vector<uint8_t> out;
+    };
+
+    void
+    Deflate(
+        const uint8_t*           pData,
+        size_t                   cbData,
+        std::vector<DeflateJob>* pJobs
+        );
+
+    void
+    RunJob(
+        DeflateJob*  pJob,
+        CPKDeflater* pDeflater
+        );
+
+    void
+    WorkerLoop();
+
+    void
+    WriteLocalHeader(
+        const PKRecord& record
+        );
+
+    void
+    Write(
+        const uint8_t* pData,
+        size_t         cbData
+        );
+
+    IPKOutput*                  m_pOutput;
+    uint64_t                    m_offset;
+    uint16_t                    m_time;
+    uint16_t                    m_date;
+    bool                        m_bClosed;
+    std::vector<PKRecord>       m_records;
+    CPKDeflater                 m_deflater;
+
+    //
+    // Worker threads. Jobs are queued under m_lock; the adding thread
+    // compresses chunks too while it waits for the workers to finish.
+    //
+    std::vector<std::thread>    m_workers;
+    std::mutex                  m_lock;
+    std::condition_variable     m_workReady;
+    std::condition_variable     m_workDone;
+    std::deque<DeflateJob*>     m_queue;
+    size_t                      m_cOutstanding;
+    bool                        m_bShutdown;
+    bool                        m_bJobFailed;
+    bool                        m_bJobOutOfMemory;
+};
+
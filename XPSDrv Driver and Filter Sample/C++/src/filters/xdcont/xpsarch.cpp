@@ -34,6 +34,11 @@ typedef HRESULT (*GetClassObject)(REFCLSID, REFIID, LPVOID FAR*);
 static PCSTR szPartNameFormatString = "%s/[%i].piece";
 static PCSTR szLastPartNameFormatString = "%s/[%i].last.piece";
 
+//
+// Most threads the PK stream writer compresses on, including the sending thread
+//
+static CONST DWORD cMaxCompressionThreads = 8;
+
 //
 // GUIDs for the archive handler
 //
@@ -67,7 +72,11 @@ CXPSArchive::CXPSArchive(
     ) :
     m_pWriteStream(pWriteStream),
     m_pPkArchive(NULL),
-    m_hPkArch(NULL)
+    m_hPkArch(NULL),
+    m_pkInput(pReadStream),
+    m_pkOutput(pWriteStream),
+    m_bRecordIndex(FALSE),
+    m_pPkWriter(NULL)
 {
     HRESULT hr = S_OK;
 
@@ -142,13 +151,13 @@ CXPSArchive::CXPSArchive(
     }
 
     //
-    // Initialise the IO streams
+    // Initialise the IO streams. The PK archive handler only reads; the
+    // output container is written by the PK stream writer.
     //
     if (SUCCEEDED(hr) &&
         SUCCEEDED(hr = CHECK_POINTER(pReadStream, E_POINTER)) &&
         SUCCEEDED(hr = CHECK_POINTER(m_pWriteStream, E_POINTER)) &&
-        SUCCEEDED(hr = m_pPkArchive->SetReadStream(pReadStream)) &&
-        SUCCEEDED(hr = m_pPkArchive->SetWriteStream(m_pWriteStream)))
+        SUCCEEDED(hr = m_pPkArchive->SetReadStream(pReadStream)))
     {
         //
         // We can now process the read stream to create the file index
@@ -156,6 +165,63 @@ CXPSArchive::CXPSArchive(
         hr = m_pPkArchive->ProcessReadStream();
     }
 
+    if (SUCCEEDED(hr))
+    {
+        //
+        // Index the raw PK records so unchanged parts can be copied without
+        // being decompressed. If the central directory cannot be read parts
+        // are decompressed and compressed again instead.
+        //
+        try
+        {
+            m_bRecordIndex = m_recordIndex.Load(&m_pkInput) ? TRUE : FALSE;
+        }
+        catch (CXDException&)
+        {
+            ERR("Failed to index the PK records\n");
+            m_bRecordIndex = FALSE;
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            m_bRecordIndex = FALSE;
+        }
+
+        //
+        // Stamp new records with the current local time
+        //
+        SYSTEMTIME systemTime;
+        FILETIME   fileTime;
+        WORD       dosDate = 0;
+        WORD       dosTime = 0;
+
+        GetLocalTime(&systemTime);
+
+        if (!SystemTimeToFileTime(&systemTime, &fileTime) ||
+            !FileTimeToDosDateTime(&fileTime, &dosDate, &dosTime))
+        {
+            dosDate = 0;
+            dosTime = 0;
+        }
+
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+
+        DWORD cThreads = min(systemInfo.dwNumberOfProcessors, cMaxCompressionThreads);
+
+        try
+        {
+            m_pPkWriter = new(std::nothrow) CPKStreamWriter(&m_pkOutput, cThreads, dosTime, dosDate);
+
+            hr = CHECK_POINTER(m_pPkWriter, E_OUTOFMEMORY);
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
     if (FAILED(hr))
     {
         throw CXDException(hr);
@@ -183,6 +249,28 @@ Return Value:
 --*/
 CXPSArchive::~CXPSArchive()
 {
+    if (m_pPkWriter != NULL)
+    {
+        //
+        // Write the central directory to complete the container
+        //
+        try
+        {
+            m_pPkWriter->Close();
+        }
+        catch (CXDException&)
+        {
+            ERR("Failed to complete the PK archive\n");
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+        }
+
+        delete m_pPkWriter;
+        m_pPkWriter = NULL;
+    }
+
     if (m_pPkArchive != NULL)
     {
         m_pPkArchive->Close();
@@ -391,8 +479,8 @@ Routine Name:
 
 Routine Description:
 
-    This routine sends the current initialised file by requesting the
-    PK archive handler send the original constituent PK records
+    This routine sends the current initialised file by copying the original
+    constituent PK records to the output
 
 Arguments:
 
@@ -415,14 +503,14 @@ CXPSArchive::SendCurrentFile(
     XPSPartStack* pPartStack = NULL;
     PSTR  pName = NULL;
 
-    if (SUCCEEDED(hr = CHECK_POINTER(m_pPkArchive, E_NOINTERFACE)) &&
+    if (SUCCEEDED(hr = CHECK_POINTER(m_pPkWriter, E_PENDING)) &&
         SUCCEEDED(hr = m_XpsFile.GetFileParts(&pPartStack)) &&
         SUCCEEDED(hr = m_XpsFile.GetFileName(&pName)))
     {
         try
         {
             //
-            // Send all file parts on to the PK archive
+            // Send all file parts on to the output
             //
             if (!m_sentList[pName])
             {
@@ -432,7 +520,7 @@ CXPSArchive::SendCurrentFile(
                      iterParts != pPartStack->end() && SUCCEEDED(hr);
                      iterParts++)
                 {
-                    hr = m_pPkArchive->SendFile(iterParts->first);
+                    hr = SendPart(iterParts->first);
                 }
 
                 if (SUCCEEDED(hr))
@@ -461,7 +549,7 @@ Routine Name:
 Routine Description:
 
     This routine sends a file defined by it's name and constituent data. The
-    routine passes the name and buffer to the PK archive handler to compress
+    routine passes the name and buffer to the PK stream writer to compress
     and add to the archive.
 
 Arguments:
@@ -488,7 +576,7 @@ CXPSArchive::SendFile(
 {
     HRESULT hr = S_OK;
 
-    if (SUCCEEDED(hr = CHECK_POINTER(m_pPkArchive, E_NOINTERFACE)) &&
+    if (SUCCEEDED(hr = CHECK_POINTER(m_pPkWriter, E_PENDING)) &&
         SUCCEEDED(hr = CHECK_POINTER(szFileName, E_POINTER)) &&
         SUCCEEDED(hr = CHECK_POINTER(pBuffer, E_POINTER)))
     {
@@ -498,16 +586,22 @@ CXPSArchive::SendFile(
             try
             {
                 //
-                // Get the PK archive to compress and send the file on
+                // Get the PK stream writer to compress and send the file on
                 //
                 if (!m_sentList[szFileName])
                 {
-                    if (SUCCEEDED(hr = m_pPkArchive->SendFile(szFileName, pBuffer, cbBuffer, eCompType)))
-                    {
-                        m_sentList[szFileName] = TRUE;
-                    }
+                    m_pPkWriter->AddRecord(szFileName,
+                                           reinterpret_cast<CONST uint8_t*>(pBuffer),
+                                           cbBuffer,
+                                           eCompType == CompDeflated ? PKMethodDeflated : PKMethodStored);
+
+                    m_sentList[szFileName] = TRUE;
                 }
             }
+            catch (CXDException& e)
+            {
+                hr = e;
+            }
             catch (exception& DBG_ONLY(e))
             {
                 ERR(e.what());
@@ -637,3 +731,380 @@ CXPSArchive::AddFile(
     ERR_ON_HR_EXC(hr, E_ELEMENT_NOT_FOUND);
     return hr;
 }
+
+/*++
+
+Routine Name:
+
+    CXPSArchive::SendPart
+
+Routine Description:
+
+    This routine sends one PK record of the current file. The record is copied
+    from the input container without being decompressed when it can be found
+    in the record index; otherwise it is decompressed and sent to the PK
+    stream writer to be compressed again.
+
+Arguments:
+
+    pFile - The PK record to send
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CXPSArchive::SendPart(
+    _In_ CONST IPKFile* pFile
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(m_pPkArchive, E_NOINTERFACE)) &&
+        SUCCEEDED(hr = CHECK_POINTER(m_pPkWriter, E_PENDING)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pFile, E_POINTER)))
+    {
+        try
+        {
+            //
+            // The PK archive handler indexes records by name; build the reverse
+            // index the first time a record is sent
+            //
+            if (m_fileNames.empty())
+            {
+                NameIndex* pNameIndex = NULL;
+
+                if (SUCCEEDED(hr = m_pPkArchive->GetNameIndex(&pNameIndex)))
+                {
+                    NameIndex::const_iterator iterNameIndex = pNameIndex->begin();
+
+                    for (;
+                         iterNameIndex != pNameIndex->end();
+                         iterNameIndex++)
+                    {
+                        m_fileNames[iterNameIndex->second] = std::string(iterNameIndex->first);
+                    }
+                }
+            }
+
+            FileNameIndex::const_iterator iterFileName = m_fileNames.find(pFile);
+
+            if (SUCCEEDED(hr) &&
+                iterFileName == m_fileNames.end())
+            {
+                hr = E_ELEMENT_NOT_FOUND;
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                CONST PKRecord* pRecord = m_bRecordIndex ? m_recordIndex.Find(iterFileName->second) : NULL;
+
+                if (pRecord != NULL)
+                {
+                    m_pPkWriter->CopyRecord(*pRecord, &m_pkInput);
+                }
+                else
+                {
+                    ECompressionType eCompType = CompNone;
+                    ULONG cbDecompressed = 0;
+
+                    if (SUCCEEDED(hr = pFile->GetCompressionMethod(&eCompType)) &&
+                        SUCCEEDED(hr = pFile->GetDecompressedSize(&cbDecompressed)))
+                    {
+                        vector<uint8_t> decompressed(cbDecompressed + 1);
+
+                        if (SUCCEEDED(hr = pFile->DecompressTo(&decompressed[0], cbDecompressed)))
+                        {
+                            m_pPkWriter->AddRecord(iterFileName->second,
+                                                   &decompressed[0],
+                                                   cbDecompressed,
+                                                   eCompType == CompNone ? PKMethodStored : PKMethodDeflated);
+                        }
+                    }
+                }
+            }
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CPKPrintWriteOutput::CPKPrintWriteOutput
+
+Routine Description:
+
+    CPKPrintWriteOutput class constructor
+
+Arguments:
+
+    pWriteStream - Pointer to the print write stream
+
+Return Value:
+
+    None
+
+--*/
+CPKPrintWriteOutput::CPKPrintWriteOutput(
+    _In_ IPrintWriteStream* pWriteStream
+    ) :
+    m_pWriteStream(pWriteStream)
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPKPrintWriteOutput::~CPKPrintWriteOutput
+
+Routine Description:
+
+    CPKPrintWriteOutput class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPKPrintWriteOutput::~CPKPrintWriteOutput()
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPKPrintWriteOutput::Write
+
+Routine Description:
+
+    This routine writes PK archive data to the print write stream
+
+Arguments:
+
+    pData  - The data to write
+    cbData - Count of bytes to write
+
+Return Value:
+
+    None
+    Throws CXDException(HRESULT) on an error
+
+--*/
+void
+CPKPrintWriteOutput::Write(
+    _In_reads_bytes_(cbData) const uint8_t* pData,
+    _In_                     size_t         cbData
+    )
+{
+    HRESULT hr = CHECK_POINTER(m_pWriteStream, E_PENDING);
+
+    while (SUCCEEDED(hr) &&
+           cbData > 0)
+    {
+        ULONG cbWritten = 0;
+        ULONG cbRequested = static_cast<ULONG>(min(cbData, static_cast<size_t>(ULONG_MAX)));
+
+        if (SUCCEEDED(hr = m_pWriteStream->WriteBytes(pData, cbRequested, &cbWritten)))
+        {
+            if (cbWritten == 0)
+            {
+                hr = E_FAIL;
+            }
+
+            pData  += cbWritten;
+            cbData -= cbWritten;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        throw CXDException(hr);
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CPKPrintReadInput::CPKPrintReadInput
+
+Routine Description:
+
+    CPKPrintReadInput class constructor
+
+Arguments:
+
+    pReadStream - Pointer to the print read stream
+
+Return Value:
+
+    None
+
+--*/
+CPKPrintReadInput::CPKPrintReadInput(
+    _In_ IPrintReadStream* pReadStream
+    ) :
+    m_pReadStream(pReadStream)
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPKPrintReadInput::~CPKPrintReadInput
+
+Routine Description:
+
+    CPKPrintReadInput class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CPKPrintReadInput::~CPKPrintReadInput()
+{
+}
+
+/*++
+
+Routine Name:
+
+    CPKPrintReadInput::GetSize
+
+Routine Description:
+
+    This routine retrieves the size of the print read stream
+
+Arguments:
+
+    None
+
+Return Value:
+
+    The size of the stream in bytes
+    Throws CXDException(HRESULT) on an error
+
+--*/
+uint64_t
+CPKPrintReadInput::GetSize()
+{
+    HRESULT hr = S_OK;
+
+    ULONGLONG cbSize = 0;
+    ULONGLONG position = 0;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(m_pReadStream, E_PENDING)) &&
+        SUCCEEDED(hr = m_pReadStream->Seek(0, STREAM_SEEK_CUR, &position)) &&
+        SUCCEEDED(hr = m_pReadStream->Seek(0, STREAM_SEEK_END, &cbSize)))
+    {
+        hr = m_pReadStream->Seek(static_cast<LONGLONG>(position), STREAM_SEEK_SET, NULL);
+    }
+
+    if (FAILED(hr))
+    {
+        throw CXDException(hr);
+    }
+
+    return cbSize;
+}
+
+/*++
+
+Routine Name:
+
+    CPKPrintReadInput::Read
+
+Routine Description:
+
+    This routine reads data from the print read stream at the requested offset
+
+Arguments:
+
+    offset - Offset from the start of the stream to read from
+    pData  - Buffer that receives the data
+    cbData - Count of bytes to read
+
+Return Value:
+
+    None
+    Throws CXDException(HRESULT) on an error
+
+--*/
+void
+CPKPrintReadInput::Read(
+    _In_                       uint64_t offset,
+    _Out_writes_bytes_(cbData) uint8_t* pData,
+    _In_                       size_t   cbData
+    )
+{
+    HRESULT hr = S_OK;
+
+    ULONGLONG position = 0;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(m_pReadStream, E_PENDING)) &&
+        SUCCEEDED(hr = m_pReadStream->Seek(0, STREAM_SEEK_CUR, &position)) &&
+        SUCCEEDED(hr = m_pReadStream->Seek(static_cast<LONGLONG>(offset), STREAM_SEEK_SET, NULL)))
+    {
+        while (SUCCEEDED(hr) &&
+               cbData > 0)
+        {
+            ULONG cbRead = 0;
+            BOOL  bEOF = FALSE;
+            ULONG cbRequested = static_cast<ULONG>(min(cbData, static_cast<size_t>(ULONG_MAX)));
+
+            if (SUCCEEDED(hr = m_pReadStream->ReadBytes(pData, cbRequested, &cbRead, &bEOF)))
+            {
+                if (cbRead == 0)
+                {
+                    hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+                }
+
+                pData  += cbRead;
+                cbData -= cbRead;
+            }
+        }
+
+        //
+        // Restore the position for the PK archive handler
+        //
+        HRESULT hrSeek = m_pReadStream->Seek(static_cast<LONGLONG>(position), STREAM_SEEK_SET, NULL);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = hrSeek;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        throw CXDException(hr);
+    }
+}
@@ -20,12 +20,70 @@ Abstract:
    XPS document. This allows clients to manipulate files using the parts full name
    instead of having to worry about the semantics of interleaved parts.
 
+   The PK archive handler is used to index and read the input container. The
+   output container is written by the PK stream writer: parts that are passed
+   on unchanged are copied as raw PK records and new parts are compressed in
+   parallel as they are sent.
+
 --*/
 
 #pragma once
 
 #include "ipkarch.h"
 #include "xpsfiler.h"
+#include "pkwriter.h"
+
+typedef map<CONST IPKFile*, std::string> FileNameIndex;
+
+//
+// Adapts the print write stream to the PK stream writer output
+//
+class CPKPrintWriteOutput : public IPKOutput
+{
+public:
+    CPKPrintWriteOutput(
+        _In_ IPrintWriteStream* pWriteStream
+        );
+
+    virtual ~CPKPrintWriteOutput();
+
+    virtual void
+    Write(
+        _In_reads_bytes_(cbData) const uint8_t* pData,
+        _In_                     size_t         cbData
+        );
+
+private:
+    CComPtr<IPrintWriteStream> m_pWriteStream;
+};
+
+//
+// Adapts the print read stream to the PK record index and PK stream writer
+// input. The stream is shared with the PK archive handler so the stream
+// position is restored after each access.
+//
+class CPKPrintReadInput : public IPKInput
+{
+public:
+    CPKPrintReadInput(
+        _In_ IPrintReadStream* pReadStream
+        );
+
+    virtual ~CPKPrintReadInput();
+
+    virtual uint64_t
+    GetSize();
+
+    virtual void
+    Read(
+        _In_                       uint64_t offset,
+        _Out_writes_bytes_(cbData) uint8_t* pData,
+        _In_                       size_t   cbData
+        );
+
+private:
+    CComPtr<IPrintReadStream> m_pReadStream;
+};
 
 class CXPSArchive
 {
@@ -77,6 +135,11 @@ private:
         _In_z_ PCSTR szFileName
         );
 
+    HRESULT
+    SendPart(
+        _In_ CONST IPKFile* pFile
+        );
+
 private:
     HMODULE                    m_hPkArch;
 
@@ -87,5 +150,17 @@ private:
     SentList                   m_sentList;
 
     CComPtr<IPrintWriteStream> m_pWriteStream;
+
+    CPKPrintReadInput          m_pkInput;
+
+    CPKPrintWriteOutput        m_pkOutput;
+
+    CPKRecordIndex             m_recordIndex;
+
+    BOOL                       m_bRecordIndex;
+
+    FileNameIndex              m_fileNames;
+
+    CPKStreamWriter*           m_pPkWriter;
 };
 
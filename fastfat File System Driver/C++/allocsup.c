@@ -35,6 +35,13 @@ Abstract:
 
 #define FAT_PREFETCH_PAGE_COUNT          0x100
 
+//
+//  Define the prefetch page count used while walking a single file's chain
+//  of clusters.  This is smaller since a chain is only locally sequential.
+//
+
+#define FAT_CHAIN_PREFETCH_PAGE_COUNT    0x10
+
 //
 //  Local support routine prototypes
 //
@@ -252,6 +259,31 @@ FatLogOf(
 
 #define FatWindowOfCluster(C)           (((C) - 2) / MAX_CLUSTER_BITMAP_SIZE)
 
+//
+//  BOOLEAN
+//  FatDeferFatWrites (
+//      IN PIRP_CONTEXT IrpContext,
+//      IN PVCB Vcb
+//      );
+//
+//  On deferred flush media an extending write sets
+//  IRP_CONTEXT_FLAG_DISABLE_WRITE_THROUGH (see FatCommonWrite), so the FAT
+//  pages it repins are simply unpinned at the end of the request and left to
+//  the lazy writer, with nothing to make them reach the disk before the
+//  dirents that are later written through to point at the new clusters.
+//  We hand those pages to the FAT journal instead, which writes them once per
+//  flush interval and is always pushed out ahead of any write through.  See
+//  FatFlushFatJournal.
+//
+//  Any request that will write its repinned Bcbs through keeps repinning the
+//  FAT, so that a failed write is still purged by FatUnpinRepinnedBcbs.
+//
+
+#define FatDeferFatWrites(IRPCONTEXT,VCB) (                                \
+    FlagOn((VCB)->VcbState, VCB_STATE_FLAG_DEFERRED_FLUSH) &&              \
+    FlagOn((IRPCONTEXT)->Flags, IRP_CONTEXT_FLAG_DISABLE_WRITE_THROUGH)    \
+)
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FatAddFileAllocation)
 #pragma alloc_text(PAGE, FatAllocateDiskSpace)
@@ -633,6 +665,12 @@ Routine Description:
     mcb field of the fcb/dcb or it is stored on in the fat table and
     needs to be retrieved and decoded, and updated in the mcb.
 
+    When we do have to go to the fat, we walk the chain from the end of
+    the mcb only as far as the run holding the Vbo.  Once the chain moves
+    on to the next page of the fat we prefetch a small window of pages
+    ahead of it, so that a long walk is not one synchronous page read per
+    fat page.
+
 Arguments:
 
     FcbOrDcb - Supplies the Fcb/Dcb of the file/directory being queried
@@ -670,6 +708,12 @@ Arguments:
     ULONG BytesPerCluster;
     ULARGE_INTEGER BytesOnVolume;
 
+    ULONG FatPage;
+    ULONG FatPages;
+    ULONG LastFatPage = MAXULONG;
+    ULONG PrefetchStart = 0;
+    ULONG PrefetchEnd = 0;
+
     FAT_ENUMERATION_CONTEXT Context;
 
     PAGED_CODE();
@@ -802,6 +846,8 @@ Arguments:
 
     *Allocated = FALSE;
 
+    FatPages = (FatReservedBytes(&Vcb->Bpb) + FatBytesPerFat(&Vcb->Bpb) + (PAGE_SIZE - 1)) / PAGE_SIZE;
+
     try {
 
         FatEntry = (FAT_ENTRY)FatGetIndexFromLbo( Vcb, CurrentLbo );
@@ -824,6 +870,47 @@ Arguments:
 
         while ( !LastCluster ) {
 
+            //
+            //  If the chain has moved on from the fat page it was on to the
+            //  next one, and out of the pages we last prefetched, prefetch
+            //  the window of pages from here on.  A chain that stays on one
+            //  page, as a small file's does, or hops about the volume would
+            //  read the whole window for one entry, so it is left to read
+            //  page by page.  The 12 bit fat is read whole by
+            //  FatLookupFatEntry.
+            //
+
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+            if ((Vcb->AllocationSupport.FatIndexBitSize != 12) &&
+                (IrpContext->OriginatingIrp != NULL)) {
+
+                FatPage = (FatReservedBytes(&Vcb->Bpb) +
+                           FatEntry * (Vcb->AllocationSupport.FatIndexBitSize >> 3)) / PAGE_SIZE;
+
+                if (((FatPage < PrefetchStart) || (FatPage >= PrefetchEnd)) &&
+                    (LastFatPage != MAXULONG) &&
+                    (FatPage == LastFatPage + 1) &&
+                    (FatPage < FatPages)) {
+
+                    PrefetchStart = FatPage;
+                    PrefetchEnd = FatMin( FatPage + FAT_CHAIN_PREFETCH_PAGE_COUNT, FatPages );
+
+                    FatPrefetchPages( IrpContext,
+                                      Vcb->VirtualVolumeFile,
+                                      PrefetchStart,
+                                      PrefetchEnd - PrefetchStart );
+                }
+
+                LastFatPage = FatPage;
+            }
+#else
+            UNREFERENCED_PARAMETER( FatPage );
+            UNREFERENCED_PARAMETER( FatPages );
+            UNREFERENCED_PARAMETER( LastFatPage );
+            UNREFERENCED_PARAMETER( PrefetchStart );
+            UNREFERENCED_PARAMETER( PrefetchEnd );
+#endif
+
             //
             //  Get the next fat entry, and update our Current variables.
             //
@@ -3564,6 +3651,7 @@ Arguments:
     BOOLEAN RegularOperation = TRUE;
     BOOLEAN CleaningOperation = FALSE;
     BOOLEAN ReleaseMutex = FALSE;
+    BOOLEAN DeferFlush = FALSE;
 
     PAGED_CODE();
 
@@ -3633,6 +3721,17 @@ Arguments:
 
         NT_ASSERT( !(FatEntry & ~FAT32_ENTRY_MASK) );
         FatVerifyIndexIsValid(IrpContext, Vcb, FatIndex);
+
+        //
+        //  If this request is not going to write through the pages it
+        //  repins, give the FAT page to the journal instead.
+        //
+
+        if (FatDeferFatWrites( IrpContext, Vcb )) {
+
+            RegularOperation = FALSE;
+            DeferFlush = TRUE;
+        }
     }
 
     //
@@ -3883,6 +3982,16 @@ Arguments:
             FatUnpinBcb(IrpContext, Bcb);
         }
 
+        //
+        //  If we dirtied a FAT page without repinning it, make sure the
+        //  journal will push it out.
+        //
+
+        if (DeferFlush) {
+
+            FatDeferFatFlush( Vcb );
+        }
+
         DebugTrace(-1, Dbg, "FatSetFatEntry -> (VOID)\n", 0);
     }
 
@@ -3946,6 +4055,7 @@ Return Value:
     PVOID PinnedFat;
 
     BOOLEAN ReleaseMutex = FALSE;
+    BOOLEAN Reversible = TRUE;
 
     ULONG SavedStartingFatIndex = StartingFatIndex;
 
@@ -3980,6 +4090,17 @@ Return Value:
 
     SectorSize = 1 << Vcb->AllocationSupport.LogOfBytesPerSector;
 
+    //
+    //  If this request is not going to write through the pages it repins,
+    //  give the FAT pages to the journal instead.  Otherwise they stay
+    //  reversible, so a failed write through is purged as before.
+    //
+
+    if (FatDeferFatWrites( IrpContext, Vcb )) {
+
+        Reversible = FALSE;
+    }
+
     //
     //  Case on 12 or 16 bit fats.
     //
@@ -4012,7 +4133,7 @@ Return Value:
                                        FatBytesPerFat( &Vcb->Bpb ),
                                        &SavedBcbs[0][0],
                                        &PinnedFat,
-                                       TRUE,
+                                       Reversible,
                                        FALSE );
 
             //
@@ -4112,7 +4233,7 @@ Return Value:
                                                    PAGE_SIZE,
                                                    &SavedBcbs[Page][0],
                                                    (PVOID *)&SavedBcbs[Page][1],
-                                                   TRUE,
+                                                   Reversible,
                                                    FALSE );
 
                         if (Page == 0) {
@@ -4259,7 +4380,7 @@ Return Value:
                                                PAGE_SIZE,
                                                &SavedBcbs[Page][0],
                                                (PVOID *)&SavedBcbs[Page][1],
-                                               TRUE,
+                                               Reversible,
                                                FALSE );
 
                     if (Page == 0) {
@@ -4398,6 +4519,16 @@ Return Value:
             }
         }
 
+        //
+        //  If we dirtied FAT pages without repinning them, make sure the
+        //  journal will push them out.
+        //
+
+        if (!Reversible) {
+
+            FatDeferFatFlush( Vcb );
+        }
+
         DebugTrace(-1, Dbg, "FatSetFatRun -> (VOID)\n", 0);
     }
 
@@ -4850,9 +4981,9 @@ Return Value:
 
                 if (FatIndexBitSize == 32) {
 
-#pragma warning( suppress: 4213 )
-                    FatEntry = *((PULONG)FatBuffer)++;
+                    FatEntry = *((PULONG)FatBuffer);
                     FatEntry = FatEntry & FAT32_ENTRY_MASK;
+                    FatBuffer += sizeof(ULONG) / sizeof(USHORT);
 
                 } else {
 
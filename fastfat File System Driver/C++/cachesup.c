@@ -1477,6 +1477,28 @@ Return Value:
                                     (FlagOn(IrpContext->Flags, IRP_CONTEXT_FLAG_WRITE_THROUGH) ||
                                      FlagOn(IrpContext->Vcb->VcbState, VCB_STATE_FLAG_DEFERRED_FLUSH)));
 
+    //
+    //  FAT pages dirtied on deferred flush media are batched up by the FAT
+    //  journal rather than repinned.  If we are about to write anything
+    //  through, push the journal out first so that the FAT still reaches
+    //  the disk ahead of the structures which depend on it.
+    //
+
+    if (WriteThroughToDisk &&
+        (Repinned->Bcb[0] != NULL) &&
+        (IrpContext->Vcb->FatJournalPending != 0)) {
+
+        NTSTATUS Status;
+
+        Status = FatFlushFatJournal( IrpContext, IrpContext->Vcb );
+
+        if (!NT_SUCCESS(Status)) {
+
+            RaiseIosb.Status = Status;
+            RaiseIosb.Information = 0;
+        }
+    }
+
     while (Repinned != NULL) {
 
         //
@@ -966,7 +966,7 @@ Return Value:
                 if (NT_SUCCESS(Status)) {
 
                     NextFcb = FatFindFcb( IrpContext,
-                                          &Fcb->Specific.Dcb.RootOemNode,
+                                          &Fcb->Specific.Dcb.OemNames,
                                           (PSTRING)&OemFinalName,
                                           &FileNameOpenedDos );
 
@@ -984,11 +984,11 @@ Return Value:
                 //
                 //  If we didn't find anything searching the Oem space, we
                 //  have to try the Unicode space.  To save cycles in the
-                //  common case that this tree is empty, we do a quick check
+                //  common case that this table is empty, we do a quick check
                 //  here.
                 //
 
-                if ((NextFcb == NULL) && Fcb->Specific.Dcb.RootUnicodeNode) {
+                if ((NextFcb == NULL) && (Fcb->Specific.Dcb.UnicodeNames.EntryCount != 0)) {
 
                     //
                     // First downcase, then upcase the string, because this
@@ -1006,7 +1006,7 @@ Return Value:
                     NT_ASSERT( NT_SUCCESS( Status ));
 
                     NextFcb = FatFindFcb( IrpContext,
-                                          &Fcb->Specific.Dcb.RootUnicodeNode,
+                                          &Fcb->Specific.Dcb.UnicodeNames,
                                           (PSTRING)&UpcasedFinalName,
                                           &FileNameOpenedDos );
                 }
@@ -4886,6 +4886,13 @@ Return Value:
             ShortDirent = SecondPageDirent + (DirentsNeeded - DirentsInFirstPage) - 1;
         }
 
+        FatInsertDirentIndex( IrpContext,
+                              ParentDcb,
+                              DirentByteOffset,
+                              ShortDirentByteOffset,
+                              ShortDirent,
+                              CreateLfn ? UnicodeName : NULL );
+
         //
         //  Create a new dcb for the directory.
         //
@@ -5663,6 +5670,13 @@ Return Value:
             ShortDirent = SecondPageDirent + (DirentsNeeded - DirentsInFirstPage) - 1;
         }
 
+        FatInsertDirentIndex( IrpContext,
+                              ParentDcb,
+                              DirentByteOffset,
+                              ShortDirentByteOffset,
+                              ShortDirent,
+                              CreateLfn ? RealUnicodeName : NULL );
+
         //
         //  Create a new Fcb for the file.  Once the Fcb is created we
         //  will not need to unwind dirent because delete dirent will
@@ -170,21 +170,94 @@ FatDefragDirectory (
     IN ULONG DirentsNeeded
     );
 
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatScanForDirent (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom,
+    IN VBO OffsetToStopSearchAt,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+PDIRENT_INDEX
+FatGetDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    );
+
+ULONG
+FatHashOemDirentName (
+    IN PUCHAR Name
+    );
+
+ULONG
+FatHashUnicodeDirentName (
+    IN PUNICODE_STRING Name
+    );
+
+BOOLEAN
+FatAddDirentIndexEntry (
+    IN PDIRENT_INDEX Index,
+    IN ULONG NameHash,
+    IN VBO LfnOffset,
+    IN VBO DirentOffset
+    );
+
+VOID
+FatDeleteDirentIndexEntry (
+    IN PDIRENT_INDEX Index,
+    IN ULONG NameHash,
+    IN VBO DirentOffset
+    );
+
+VOID
+FatFreeDirentIndex (
+    IN PDIRENT_INDEX Index
+    );
+
+//
+//  The dirent index is only worth building for directories of at least this
+//  many bytes (2048 dirents), and only while the indexes of all volumes use
+//  less than FAT_DIRENT_INDEX_POOL_LIMIT bytes of pool.  A lookup that hashes
+//  to more than FAT_DIRENT_INDEX_MAX_CANDIDATES entries just scans.
+//
+
+#define FAT_DIRENT_INDEX_MIN_SIZE        (0x10000)
+#define FAT_DIRENT_INDEX_POOL_LIMIT      (8 * 1024 * 1024)
+#define FAT_DIRENT_INDEX_MAX_CANDIDATES  (8)
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FatAddDirentIndexEntry)
 #pragma alloc_text(PAGE, FatComputeLfnChecksum)
 #pragma alloc_text(PAGE, FatConstructDirent)
 #pragma alloc_text(PAGE, FatConstructLabelDirent)
 #pragma alloc_text(PAGE, FatCreateNewDirent)
 #pragma alloc_text(PAGE, FatDefragDirectory)
 #pragma alloc_text(PAGE, FatDeleteDirent)
+#pragma alloc_text(PAGE, FatDeleteDirentIndexEntry)
+#pragma alloc_text(PAGE, FatDiscardDirentIndex)
+#pragma alloc_text(PAGE, FatFreeDirentIndex)
 #pragma alloc_text(PAGE, FatGetDirentFromFcbOrDcb)
+#pragma alloc_text(PAGE, FatGetDirentIndex)
+#pragma alloc_text(PAGE, FatHashOemDirentName)
+#pragma alloc_text(PAGE, FatHashUnicodeDirentName)
 #pragma alloc_text(PAGE, FatInitializeDirectoryDirent)
+#pragma alloc_text(PAGE, FatInsertDirentIndex)
 #pragma alloc_text(PAGE, FatIsDirectoryEmpty)
 #pragma alloc_text(PAGE, FatLfnDirentExists)
 #pragma alloc_text(PAGE, FatLocateDirent)
 #pragma alloc_text(PAGE, FatLocateSimpleOemDirent)
 #pragma alloc_text(PAGE, FatLocateVolumeLabel)
+#pragma alloc_text(PAGE, FatRemoveDirentIndex)
 #pragma alloc_text(PAGE, FatRescanDirectory)
+#pragma alloc_text(PAGE, FatScanForDirent)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirent)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirentNoRaise)
 #pragma alloc_text(PAGE, FatTunnelFcbOrDcb)
@@ -817,6 +890,7 @@ Return Value:
     NTSTATUS DontCare;
     ULONG Offset;
     ULONG DirentsToDelete;
+    FAT8DOT3 ShortName;
 
     PAGED_CODE();
 
@@ -900,9 +974,25 @@ Return Value:
             }
 
             NT_ASSERT( (Dirent->FirstClusterOfFile == 0) || !DeleteEa );
+
+            if (Offset == FcbOrDcb->DirentOffsetWithinDirectory) {
+
+                RtlCopyMemory( ShortName, Dirent->FileName, sizeof(FAT8DOT3) );
+            }
+
             Dirent->FileName[0] = FAT_DIRENT_DELETED;
         }
 
+        //
+        //  Drop the names from the parent's dirent index.
+        //
+
+        FatRemoveDirentIndex( IrpContext,
+                              FcbOrDcb->ParentDcb,
+                              FcbOrDcb->DirentOffsetWithinDirectory,
+                              ShortName,
+                              &FcbOrDcb->ExactCaseLongName );
+
         //
         //  Back Dirent off by one to point back to the short dirent.
         //
@@ -1079,6 +1169,10 @@ Routine Description:
 
     This routine locates on the disk an undeleted dirent matching a given name.
 
+    For a large directory, a lookup by constant name is answered from the
+    dirent index (see FatGetDirentIndex) and only the dirents it points at
+    are examined.
+
 Arguments:
 
     ParentDirectory - Supplies the DCB for the directory to search
@@ -1113,6 +1207,187 @@ Return Value:
 
 --*/
 
+{
+    PDIRENT_INDEX Index = NULL;
+    PDIRENT_INDEX_ENTRY Entry;
+
+    ULONG NameHash[2];
+    ULONG HashCount = 0;
+
+    DIRENT_INDEX_ENTRY Candidates[FAT_DIRENT_INDEX_MAX_CANDIDATES];
+    ULONG CandidateCount = 0;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    //
+    //  A search for a constant name from the start of a large directory can
+    //  be answered from the dirent index, which gives us the few places the
+    //  name can possibly be.  The index may only be used while we hold the
+    //  Vcb, since that is what keeps the dirents from changing beneath it.
+    //
+
+    if ((OffsetToStartSearchFrom == 0) &&
+        !Ccb->ContainsWildCards &&
+        !FlagOn( Ccb->Flags, CCB_FLAG_MATCH_ALL | CCB_FLAG_MATCH_VOLUME_ID ) &&
+        ExIsResourceAcquiredSharedLite( &ParentDirectory->Vcb->Resource )) {
+
+        Index = FatGetDirentIndex( IrpContext, ParentDirectory );
+    }
+
+    if (Index != NULL) {
+
+        if (!FlagOn( Ccb->Flags, CCB_FLAG_SKIP_SHORT_NAME_COMPARE )) {
+
+            NameHash[HashCount] = FatHashOemDirentName( Ccb->OemQueryTemplate.Constant );
+            HashCount += 1;
+        }
+
+        if (FatData.ChicagoMode && ARGUMENT_PRESENT(LongFileName)) {
+
+            NameHash[HashCount] = FatHashUnicodeDirentName( &Ccb->UnicodeQueryTemplate );
+            HashCount += 1;
+        }
+
+        //
+        //  Collect the candidate dirents, sorted by offset so that we return
+        //  the same (first) match a scan of the directory would.
+        //
+
+        for (i = 0; (i < HashCount) && (Index != NULL); i += 1) {
+
+            for (Entry = Index->Buckets[NameHash[i] & (Index->BucketCount - 1)];
+                 Entry != NULL;
+                 Entry = Entry->Next) {
+
+                if (Entry->NameHash != NameHash[i]) {
+
+                    continue;
+                }
+
+                for (j = CandidateCount;
+                     (j > 0) && (Candidates[j - 1].DirentOffset > Entry->DirentOffset);
+                     j -= 1) {
+                }
+
+                if ((j > 0) && (Candidates[j - 1].DirentOffset == Entry->DirentOffset)) {
+
+                    continue;
+                }
+
+                if (CandidateCount == FAT_DIRENT_INDEX_MAX_CANDIDATES) {
+
+                    //
+                    //  Too many collisions, fall back to scanning.
+                    //
+
+                    Index = NULL;
+                    break;
+                }
+
+                RtlMoveMemory( &Candidates[j + 1],
+                               &Candidates[j],
+                               (CandidateCount - j) * sizeof(DIRENT_INDEX_ENTRY) );
+
+                Candidates[j] = *Entry;
+                CandidateCount += 1;
+            }
+        }
+    }
+
+    if (Index == NULL) {
+
+        FatScanForDirent( IrpContext,
+                          ParentDirectory,
+                          Ccb,
+                          OffsetToStartSearchFrom,
+                          MAXULONG,
+                          Dirent,
+                          Bcb,
+                          ByteOffset,
+                          FileNameDos,
+                          LongFileName );
+        return;
+    }
+
+    //
+    //  Verify each candidate against the disk.  Since every live name is in
+    //  the index, if none of them match the name is not in the directory.
+    //
+
+    FatUnpinBcb( IrpContext, *Bcb );
+
+    *Dirent = NULL;
+    *ByteOffset = 0;
+
+    if (ARGUMENT_PRESENT(LongFileName)) {
+
+        LongFileName->Length = 0;
+    }
+
+    if (FileNameDos) {
+
+        *FileNameDos = FALSE;
+    }
+
+    for (i = 0; i < CandidateCount; i += 1) {
+
+        FatScanForDirent( IrpContext,
+                          ParentDirectory,
+                          Ccb,
+                          Candidates[i].LfnOffset,
+                          Candidates[i].DirentOffset,
+                          Dirent,
+                          Bcb,
+                          ByteOffset,
+                          FileNameDos,
+                          LongFileName );
+
+        if (*Dirent != NULL) {
+
+            break;
+        }
+    }
+
+    return;
+}
+
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatScanForDirent (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom,
+    IN VBO OffsetToStopSearchAt,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the directory looking for an undeleted dirent matching
+    a given name.  It is the worker for FatLocateDirent.
+
+Arguments:
+
+    OffsetToStopSearchAt - Supplies the VBO of the last dirent which may be
+        returned.  The search ends without a match past this point.
+
+    All other arguments are as for FatLocateDirent.
+
+Return Value:
+
+    None.
+
+--*/
+
 {
     NTSTATUS Status = STATUS_SUCCESS;
 
@@ -1134,7 +1409,7 @@ Return Value:
 
     PAGED_CODE();
 
-    DebugTrace(+1, Dbg, "FatLocateDirent\n", 0);
+    DebugTrace(+1, Dbg, "FatScanForDirent\n", 0);
 
     DebugTrace( 0, Dbg, "  ParentDirectory         = %08lx\n", ParentDirectory);
     DebugTrace( 0, Dbg, "  OffsetToStartSearchFrom = %08lx\n", OffsetToStartSearchFrom);
@@ -1233,6 +1508,20 @@ Return Value:
 
             BOOLEAN FoundValidLfn;
 
+            //
+            //  If we have passed the end of the range we were asked to
+            //  search, the entry is not here.
+            //
+
+            if (*ByteOffset > OffsetToStopSearchAt) {
+
+                FatUnpinBcb( IrpContext, *Bcb );
+
+                *Dirent = NULL;
+                *ByteOffset = 0;
+                break;
+            }
+
             //
             //  Try to read in the dirent
             //
@@ -1654,9 +1943,9 @@ GetNextDirent:
         FatFreeStringBuffer( &UpcasedLfn);
     }
 
-    DebugTrace(-1, Dbg, "FatLocateDirent -> (VOID)\n", 0);
+    DebugTrace(-1, Dbg, "FatScanForDirent -> (VOID)\n", 0);
 
-    TimerStop(Dbg,"FatLocateDirent");
+    TimerStop(Dbg,"FatScanForDirent");
 
     return;
 }
@@ -3538,6 +3827,12 @@ Return Value:
             *Char = FAT_DIRENT_DELETED;
         }
 
+        //
+        //  Every dirent is about to move, so the dirent index is useless.
+        //
+
+        FatDiscardDirentIndex( Dcb );
+
         //
         //  Now, for the permanent step.  Copy the two pool buffer back to the
         //  real Dcb directory, and flush the Dcb directory
@@ -3712,3 +4007,667 @@ Return Value:
 
 
 
+
+
+//
+//  Dirent index support routines
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+PDIRENT_INDEX
+FatGetDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the dirent index for a directory, building it if
+    the directory is large enough to deserve one.  The index is built by a
+    single scan of the directory, and holds an entry for the short name and
+    (if any) the long name of every dirent.
+
+    If the index cannot be built, because we cannot wait, are short of pool,
+    or have already given the indexes all the pool they may have, we return
+    NULL and the caller just scans the directory.
+
+Arguments:
+
+    Dcb - Supplies the directory.  The caller must hold the Vcb.
+
+Return Value:
+
+    PDIRENT_INDEX - The index, or NULL if there is none.
+
+--*/
+
+{
+    PDIRENT_INDEX Index;
+    ULONG DirentCount;
+    ULONG BucketCount;
+    ULONG IndexSize;
+
+    CCB LocalCcb;
+    PDIRENT Dirent;
+    PBCB Bcb = NULL;
+    VBO ByteOffset = 0;
+    VBO Offset = 0;
+    VBO LfnOffset;
+    ULONG LfnDirents;
+
+    UNICODE_STRING Lfn;
+    WCHAR LfnBuffer[32];
+
+    PAGED_CODE();
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index != NULL) {
+
+        return Index;
+    }
+
+    //
+    //  Note that we never index the fixed root directory of a FAT12/16 volume.
+    //  It is small anyway, and it is where the Ea file is created, which is
+    //  done without holding the Vcb exclusive.
+    //
+
+    if (!FlagOn( IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT ) ||
+        ((NodeType( Dcb ) == FAT_NTC_ROOT_DCB) && !FatIsFat32( Dcb->Vcb )) ||
+        (Dcb->Header.AllocationSize.QuadPart == FCB_LOOKUP_ALLOCATIONSIZE_HINT) ||
+        (Dcb->Header.AllocationSize.LowPart < FAT_DIRENT_INDEX_MIN_SIZE) ||
+        (FatData.DirentIndexPoolUsage >= FAT_DIRENT_INDEX_POOL_LIMIT)) {
+
+        return NULL;
+    }
+
+    //
+    //  Size the table for about two dirents per bucket.
+    //
+
+    DirentCount = Dcb->Header.AllocationSize.LowPart / sizeof(DIRENT);
+
+    for (BucketCount = 256; BucketCount < DirentCount / 2; BucketCount <<= 1) {
+    }
+
+    IndexSize = FIELD_OFFSET( DIRENT_INDEX, Buckets ) + BucketCount * sizeof(PDIRENT_INDEX_ENTRY);
+
+    Index = ExAllocatePoolWithTag( PagedPool, IndexSize, TAG_DIRENT_INDEX );
+
+    if (Index == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( Index, IndexSize );
+
+    Index->EntryLimit = DirentCount * 2;
+    Index->PoolCharge = IndexSize;
+    Index->BucketCount = BucketCount;
+
+    InterlockedExchangeAdd( &FatData.DirentIndexPoolUsage, (LONG)IndexSize );
+
+    DebugTrace(+1, Dbg, "FatGetDirentIndex, building for Dcb %08lx\n", Dcb);
+
+    //
+    //  Now walk every dirent in the directory.
+    //
+
+    LocalCcb.Flags = CCB_FLAG_MATCH_ALL;
+    LocalCcb.ContainsWildCards = FALSE;
+
+    Lfn.Length = 0;
+    Lfn.MaximumLength = sizeof( LfnBuffer );
+    Lfn.Buffer = LfnBuffer;
+
+    try {
+
+        while (TRUE) {
+
+            FatScanForDirent( IrpContext,
+                              Dcb,
+                              &LocalCcb,
+                              Offset,
+                              MAXULONG,
+                              &Dirent,
+                              &Bcb,
+                              &ByteOffset,
+                              NULL,
+                              &Lfn );
+
+            if (Dirent == NULL) {
+
+                break;
+            }
+
+            //
+            //  We don't get told where the Lfn run started, so work it out
+            //  from its length.  We allow one more dirent than strictly
+            //  needed since a run can end in an entry holding only the
+            //  terminator; starting the verification scan a little early
+            //  is harmless.
+            //
+
+            LfnOffset = ByteOffset;
+
+            if (Lfn.Length != 0) {
+
+                LfnDirents = (Lfn.Length / sizeof(WCHAR) + 12) / 13 + 1;
+
+                LfnOffset = (ByteOffset > LfnDirents * sizeof(DIRENT)) ?
+                            ByteOffset - LfnDirents * sizeof(DIRENT) : 0;
+            }
+
+            if (!FatAddDirentIndexEntry( Index,
+                                         FatHashOemDirentName( Dirent->FileName ),
+                                         LfnOffset,
+                                         ByteOffset ) ||
+                ((Lfn.Length != 0) &&
+                 !FatAddDirentIndexEntry( Index,
+                                          FatHashUnicodeDirentName( &Lfn ),
+                                          LfnOffset,
+                                          ByteOffset ))) {
+
+                FatFreeDirentIndex( Index );
+                Index = NULL;
+                break;
+            }
+
+            Offset = ByteOffset + sizeof(DIRENT);
+        }
+
+    } finally {
+
+        FatUnpinBcb( IrpContext, Bcb );
+
+        FatFreeStringBuffer( &Lfn );
+
+        if (AbnormalTermination() && (Index != NULL)) {
+
+            FatFreeDirentIndex( Index );
+            Index = NULL;
+        }
+    }
+
+    //
+    //  Install the index, unless another thread holding the Vcb shared beat
+    //  us to it.
+    //
+
+    if (Index != NULL) {
+
+        if (InterlockedCompareExchangePointer( (PVOID *)&Dcb->Specific.Dcb.DirentIndex,
+                                               Index,
+                                               NULL ) != NULL) {
+
+            FatFreeDirentIndex( Index );
+        }
+
+        Index = Dcb->Specific.Dcb.DirentIndex;
+    }
+
+    DebugTrace(-1, Dbg, "FatGetDirentIndex -> %08lx\n", Index);
+
+    return Index;
+}
+
+
+VOID
+FatInsertDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO LfnOffset,
+    IN VBO DirentOffset,
+    IN PDIRENT Dirent,
+    IN PUNICODE_STRING Lfn OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds the names of a newly written dirent to the dirent index
+    of its directory, if the directory has one.  If we cannot add them, the
+    index is thrown away.
+
+Arguments:
+
+    Dcb - Supplies the directory.  The caller must hold the Vcb exclusive.
+
+    LfnOffset - Supplies the offset of the first dirent in the Lfn run, or of
+        the short dirent if there is no Lfn.
+
+    DirentOffset - Supplies the offset of the short dirent.
+
+    Dirent - Supplies the short dirent, with its name filled in.
+
+    Lfn - Supplies the long name written with the dirent, if any.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDIRENT_INDEX Index;
+
+    PAGED_CODE();
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index == NULL) {
+
+        return;
+    }
+
+    NT_ASSERT( FatVcbAcquiredExclusive( IrpContext, Dcb->Vcb ) );
+
+    if (!FatAddDirentIndexEntry( Index,
+                                 FatHashOemDirentName( Dirent->FileName ),
+                                 LfnOffset,
+                                 DirentOffset ) ||
+        (ARGUMENT_PRESENT( Lfn ) &&
+         (Lfn->Length != 0) &&
+         !FatAddDirentIndexEntry( Index,
+                                  FatHashUnicodeDirentName( Lfn ),
+                                  LfnOffset,
+                                  DirentOffset ))) {
+
+        FatDiscardDirentIndex( Dcb );
+    }
+}
+
+
+VOID
+FatRemoveDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO DirentOffset,
+    IN PUCHAR ShortName,
+    IN PUNICODE_STRING Lfn OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the names of a dirent being deleted from the dirent
+    index of its directory, if the directory has one.  Any entry we miss is
+    simply left behind as a stale hint.
+
+Arguments:
+
+    Dcb - Supplies the directory.  The caller must hold the Vcb exclusive.
+
+    DirentOffset - Supplies the offset of the short dirent.
+
+    ShortName - Supplies the 11 byte name from the short dirent.
+
+    Lfn - Supplies the long name of the dirent, if any.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDIRENT_INDEX Index;
+
+    PAGED_CODE();
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index == NULL) {
+
+        return;
+    }
+
+    NT_ASSERT( FatVcbAcquiredExclusive( IrpContext, Dcb->Vcb ) );
+
+    FatDeleteDirentIndexEntry( Index,
+                               FatHashOemDirentName( ShortName ),
+                               DirentOffset );
+
+    if (ARGUMENT_PRESENT( Lfn ) && (Lfn->Length != 0)) {
+
+        FatDeleteDirentIndexEntry( Index,
+                                   FatHashUnicodeDirentName( Lfn ),
+                                   DirentOffset );
+    }
+}
+
+
+VOID
+FatDiscardDirentIndex (
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine throws away the dirent index of a directory, if it has one.
+    It will be rebuilt by the next lookup that can use it.  This is called
+    whenever the dirents may have changed in a way the index cannot follow,
+    and when the Dcb is deleted.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDIRENT_INDEX Index;
+
+    PAGED_CODE();
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index != NULL) {
+
+        Dcb->Specific.Dcb.DirentIndex = NULL;
+
+        FatFreeDirentIndex( Index );
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+ULONG
+FatHashOemDirentName (
+    IN PUCHAR Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hashes the 11 byte name of a short dirent, exactly as it
+    appears on the disk.
+
+Arguments:
+
+    Name - Supplies the name.
+
+Return Value:
+
+    ULONG - The hash.
+
+--*/
+
+{
+    ULONG Hash = 2166136261;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < sizeof(FAT8DOT3); i += 1) {
+
+        Hash = (Hash ^ Name[i]) * 16777619;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Local support routine
+//
+
+ULONG
+FatHashUnicodeDirentName (
+    IN PUNICODE_STRING Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hashes a long name.  The name is upcased as it is hashed so
+    that all the case variants of a name hash alike.
+
+Arguments:
+
+    Name - Supplies the name.
+
+Return Value:
+
+    ULONG - The hash.
+
+--*/
+
+{
+    ULONG Hash = 2166136261;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < Name->Length / sizeof(WCHAR); i += 1) {
+
+        Hash = (Hash ^ RtlUpcaseUnicodeChar( Name->Buffer[i] )) * 16777619;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+FatAddDirentIndexEntry (
+    IN PDIRENT_INDEX Index,
+    IN ULONG NameHash,
+    IN VBO LfnOffset,
+    IN VBO DirentOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds an entry to a dirent index.
+
+Arguments:
+
+    Index - Supplies the index.
+
+    NameHash - Supplies the hash of the name.
+
+    LfnOffset - Supplies the offset of the first dirent of the Lfn run.
+
+    DirentOffset - Supplies the offset of the short dirent.
+
+Return Value:
+
+    BOOLEAN - FALSE if the entry could not be added, in which case the index
+        must be discarded.
+
+--*/
+
+{
+    PDIRENT_INDEX_ENTRY Entry;
+    PDIRENT_INDEX_BLOCK Block;
+    PDIRENT_INDEX_ENTRY *Bucket;
+
+    PAGED_CODE();
+
+    //
+    //  Once there are more entries than there can possibly be live names, the
+    //  index is mostly stale hints.  Give up on it and let it be rebuilt.
+    //
+
+    if (Index->EntryCount >= Index->EntryLimit) {
+
+        return FALSE;
+    }
+
+    Entry = Index->FreeEntries;
+
+    if (Entry != NULL) {
+
+        Index->FreeEntries = Entry->Next;
+
+    } else {
+
+        if ((Index->Blocks == NULL) ||
+            (Index->BlockEntriesUsed == DIRENT_INDEX_BLOCK_ENTRIES)) {
+
+            if (FatData.DirentIndexPoolUsage >= FAT_DIRENT_INDEX_POOL_LIMIT) {
+
+                return FALSE;
+            }
+
+            Block = ExAllocatePoolWithTag( PagedPool,
+                                           sizeof(DIRENT_INDEX_BLOCK),
+                                           TAG_DIRENT_INDEX );
+
+            if (Block == NULL) {
+
+                return FALSE;
+            }
+
+            InterlockedExchangeAdd( &FatData.DirentIndexPoolUsage, (LONG)sizeof(DIRENT_INDEX_BLOCK) );
+            Index->PoolCharge += sizeof(DIRENT_INDEX_BLOCK);
+
+            Block->Next = Index->Blocks;
+            Index->Blocks = Block;
+            Index->BlockEntriesUsed = 0;
+        }
+
+        Entry = &Index->Blocks->Entries[Index->BlockEntriesUsed];
+        Index->BlockEntriesUsed += 1;
+    }
+
+    Entry->NameHash = NameHash;
+    Entry->LfnOffset = LfnOffset;
+    Entry->DirentOffset = DirentOffset;
+
+    Bucket = &Index->Buckets[NameHash & (Index->BucketCount - 1)];
+
+    Entry->Next = *Bucket;
+    *Bucket = Entry;
+
+    Index->EntryCount += 1;
+
+    return TRUE;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+FatDeleteDirentIndexEntry (
+    IN PDIRENT_INDEX Index,
+    IN ULONG NameHash,
+    IN VBO DirentOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the entry for a name from a dirent index, if it is
+    there.
+
+Arguments:
+
+    Index - Supplies the index.
+
+    NameHash - Supplies the hash of the name.
+
+    DirentOffset - Supplies the offset of the short dirent.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDIRENT_INDEX_ENTRY Entry;
+    PDIRENT_INDEX_ENTRY *Link;
+
+    PAGED_CODE();
+
+    for (Link = &Index->Buckets[NameHash & (Index->BucketCount - 1)];
+         *Link != NULL;
+         Link = &(*Link)->Next) {
+
+        Entry = *Link;
+
+        if ((Entry->NameHash == NameHash) &&
+            (Entry->DirentOffset == DirentOffset)) {
+
+            *Link = Entry->Next;
+
+            Entry->Next = Index->FreeEntries;
+            Index->FreeEntries = Entry;
+
+            Index->EntryCount -= 1;
+            break;
+        }
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+FatFreeDirentIndex (
+    IN PDIRENT_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a dirent index and returns its pool charge.
+
+Arguments:
+
+    Index - Supplies the index.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDIRENT_INDEX_BLOCK Block;
+
+    PAGED_CODE();
+
+    while (Index->Blocks != NULL) {
+
+        Block = Index->Blocks;
+        Index->Blocks = Block->Next;
+
+        ExFreePool( Block );
+    }
+
+    InterlockedExchangeAdd( &FatData.DirentIndexPoolUsage, -(LONG)Index->PoolCharge );
+
+    ExFreePool( Index );
+}
@@ -696,6 +696,30 @@ FatLocateVolumeLabel (
     OUT PVBO ByteOffset
     );
 
+VOID
+FatInsertDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO LfnOffset,
+    IN VBO DirentOffset,
+    IN PDIRENT Dirent,
+    IN PUNICODE_STRING Lfn OPTIONAL
+    );
+
+VOID
+FatRemoveDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO DirentOffset,
+    IN PUCHAR ShortName,
+    IN PUNICODE_STRING Lfn OPTIONAL
+    );
+
+VOID
+FatDiscardDirentIndex (
+    IN PDCB Dcb
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatGetDirentFromFcbOrDcb (
@@ -1751,10 +1775,20 @@ FatAllocateCloseContext(
 //  Implemented in SplaySup.c
 //
 
+VOID
+FatInitializeNameTable (
+    IN PFAT_NAME_TABLE Table
+    );
+
+VOID
+FatUninitializeNameTable (
+    IN PFAT_NAME_TABLE Table
+    );
+
 VOID
 FatInsertName (
     IN PIRP_CONTEXT IrpContext,
-    IN PRTL_SPLAY_LINKS *RootNode,
+    IN PFAT_NAME_TABLE Table,
     IN PFILE_NAME_NODE Name
     );
 
@@ -1767,7 +1801,7 @@ FatRemoveNames (
 PFCB
 FatFindFcb (
     IN PIRP_CONTEXT IrpContext,
-    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PFAT_NAME_TABLE Table,
     IN PSTRING Name,
     OUT PBOOLEAN FileNameDos OPTIONAL
     );
@@ -2430,6 +2464,27 @@ FatFlushFat (
     IN PVCB Vcb
     );
 
+NTSTATUS
+FatFlushFatJournal (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb
+    );
+
+VOID
+FatDeferFatFlush (
+    IN PVCB Vcb
+    );
+
+KDEFERRED_ROUTINE FatFlushFatDpc;
+
+VOID
+FatFlushFatDpc (
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 NTSTATUS
 FatFlushVolume (
@@ -155,6 +155,13 @@ typedef struct _FAT_DATA {
     CACHE_MANAGER_CALLBACKS CacheManagerCallbacks;
     CACHE_MANAGER_CALLBACKS CacheManagerNoOpCallbacks;
 
+    //
+    //  The amount of pool currently used by directory name indexes.  No new
+    //  index is built once this exceeds FAT_DIRENT_INDEX_POOL_LIMIT.
+    //
+
+    volatile LONG DirentIndexPoolUsage;
+
 
 } FAT_DATA;
 typedef FAT_DATA *PFAT_DATA;
@@ -475,6 +482,16 @@ typedef struct _VCB {
 
     LARGE_INTEGER LastFatMarkVolumeDirtyCall;
 
+    //
+    //  The following are used to batch FAT updates on deferred flush media.
+    //  FatJournalPending is set while dirty FAT pages are waiting for the
+    //  journal timer, see FatFlushFatJournal.
+    //
+
+    KDPC FatJournalDpc;
+    KTIMER FatJournalTimer;
+    volatile LONG FatJournalPending;
+
     //
     //  The following fields holds a pointer to a struct which is used to
     //  hold performance counters.
@@ -680,14 +697,40 @@ typedef struct _FILE_NAME_NODE {
     BOOLEAN FileNameDos;
 
     //
-    //  And the links.  Our parent Dcb has a pointer to the root entry.
+    //  The hash of the (upcased) name, computed when the node is inserted,
+    //  and the link to the next node in the same bucket of our parent Dcb's
+    //  name table.
     //
 
-    RTL_SPLAY_LINKS Links;
+    ULONG NameHash;
+
+    struct _FILE_NAME_NODE *HashNext;
 
 } FILE_NAME_NODE;
 typedef FILE_NAME_NODE *PFILE_NAME_NODE;
 
+//
+//  This is the structure used to find the Fcbs opened under a Dcb by name.
+//  It starts out using the buckets embedded in it and moves to a pool
+//  allocated array as the directory fills.  The bucket count is always a
+//  power of two.
+//
+
+#define FAT_NAME_TABLE_INLINE_BUCKETS    (4)
+
+typedef struct _FAT_NAME_TABLE {
+
+    ULONG EntryCount;
+
+    ULONG BucketCount;
+
+    PFILE_NAME_NODE *Buckets;
+
+    PFILE_NAME_NODE InlineBuckets[FAT_NAME_TABLE_INLINE_BUCKETS];
+
+} FAT_NAME_TABLE;
+typedef FAT_NAME_TABLE *PFAT_NAME_TABLE;
+
 //
 //  This structure contains fields which must be in non-paged pool.
 //
@@ -729,6 +772,82 @@ typedef struct _NON_PAGED_FCB {
 
 typedef NON_PAGED_FCB *PNON_PAGED_FCB;
 
+//
+//  The dirent index is an in-memory hash of the names (short and long) of
+//  the dirents in a large directory, giving the location of each dirent so
+//  that a lookup by name does not have to scan the whole directory.  It is
+//  built lazily by FatLocateDirent and maintained as dirents are created and
+//  deleted.  Entries are only ever hints: every hit is verified against the
+//  dirents on disk, so an entry left over from a rename is harmless.  A name
+//  that is on disk but missing from the index is not, so any path that
+//  cannot keep the index exact simply discards it.
+//
+
+typedef struct _DIRENT_INDEX_ENTRY {
+
+    struct _DIRENT_INDEX_ENTRY *Next;
+
+    ULONG NameHash;
+
+    //
+    //  The offset of the first dirent in the LFN run (or of the short dirent
+    //  itself if there is no LFN), and the offset of the short dirent.
+    //
+
+    VBO LfnOffset;
+    VBO DirentOffset;
+
+} DIRENT_INDEX_ENTRY;
+typedef DIRENT_INDEX_ENTRY *PDIRENT_INDEX_ENTRY;
+
+#define DIRENT_INDEX_BLOCK_ENTRIES       (126)
+
+typedef struct _DIRENT_INDEX_BLOCK {
+
+    struct _DIRENT_INDEX_BLOCK *Next;
+
+    DIRENT_INDEX_ENTRY Entries[DIRENT_INDEX_BLOCK_ENTRIES];
+
+} DIRENT_INDEX_BLOCK;
+typedef DIRENT_INDEX_BLOCK *PDIRENT_INDEX_BLOCK;
+
+typedef struct _DIRENT_INDEX {
+
+    //
+    //  The number of entries, and the number of dirents in the directory
+    //  at the time the index was built.  Each name takes at least one dirent
+    //  so once the entries outnumber twice the dirents we know the index is
+    //  mostly stale, and throw it away to be rebuilt.
+    //
+
+    ULONG EntryCount;
+    ULONG EntryLimit;
+
+    //
+    //  The pool charged against FatData.DirentIndexPoolUsage for this index.
+    //
+
+    ULONG PoolCharge;
+
+    //
+    //  Entries are carved out of blocks, with deleted entries kept on a
+    //  free list.
+    //
+
+    PDIRENT_INDEX_BLOCK Blocks;
+    ULONG BlockEntriesUsed;
+    PDIRENT_INDEX_ENTRY FreeEntries;
+
+    //
+    //  The hash table itself.  BucketCount is a power of two.
+    //
+
+    ULONG BucketCount;
+    PDIRENT_INDEX_ENTRY Buckets[1];
+
+} DIRENT_INDEX;
+typedef DIRENT_INDEX *PDIRENT_INDEX;
+
 //
 //  The Fcb/Dcb record corresponds to every open file and directory, and to
 //  every directory on an opened path.  They are ordered in two queues, one
@@ -959,7 +1078,9 @@ typedef struct _FCB {
 
             //
             //  The following two entries links together all the Fcbs
-            //  opened under this Dcb sorted in a splay tree by name.
+            //  opened under this Dcb, hashed by name.  These used to be
+            //  splay trees, and the discussion below is in those terms; the
+            //  same reasoning applies to the two name tables.
             //
             //  I'd like to go into why we have (and must have) two separate
             //  splay trees within the current fastfat architecture.  I will
@@ -1010,8 +1131,16 @@ typedef struct _FCB {
             //  We may think about changing this someday.
             //
 
-            PRTL_SPLAY_LINKS RootOemNode;
-            PRTL_SPLAY_LINKS RootUnicodeNode;
+            FAT_NAME_TABLE OemNames;
+            FAT_NAME_TABLE UnicodeNames;
+
+            //
+            //  The name index for large directories, or NULL if it has not
+            //  been built.  It may only be changed with the Vcb held
+            //  exclusive, or installed with the Vcb held shared.
+            //
+
+            PDIRENT_INDEX DirentIndex;
 
             //
             //  The following field keeps track of free dirents, i.e.,
@@ -3639,6 +3639,13 @@ Return Value:
                               (DirentsRequired - DirentsInFirstPage) - 1;
             }
 
+            FatInsertDirentIndex( IrpContext,
+                                  TargetDcb,
+                                  NewOffset,
+                                  ShortDirentOffset,
+                                  ShortDirent,
+                                  CreateLfn ? &NewName : NULL );
+
             Dirent = *ShortDirent;
 
         } finally {
@@ -31,7 +31,11 @@ Abstract:
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FatCommonFlushBuffers)
 #pragma alloc_text(PAGE, FatFlushDirectory)
+#pragma alloc_text(PAGE, FatDeferFatFlush)
+#pragma alloc_text(PAGE, FatDeferredFlushFat)
 #pragma alloc_text(PAGE, FatFlushFat)
+#pragma alloc_text(PAGE, FatFlushFatJournal)
+#pragma alloc_text(PAGE, FatFlushFatRange)
 #pragma alloc_text(PAGE, FatFlushFile)
 #pragma alloc_text(PAGE, FatFlushVolume)
 #pragma alloc_text(PAGE, FatFsdFlushBuffers)
@@ -40,10 +44,32 @@ Abstract:
 #pragma alloc_text(PAGE, FatHijackIrpAndFlushDevice)
 #endif
 
+//
+//  The FAT journal holds batched FAT updates on deferred flush media for this
+//  long before pushing them to disk.  Expressed in 100ns units, relative.
+//
+
+#define FAT_JOURNAL_FLUSH_DELAY          (-1 * 1000 * 1000 * 10)
+
 //
 //  Local procedure prototypes
 //
 
+NTSTATUS
+FatFlushFatRange (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb,
+    IN VBO StartingVbo,
+    IN ULONG ByteCount
+    );
+
+WORKER_THREAD_ROUTINE FatDeferredFlushFat;
+
+VOID
+FatDeferredFlushFat (
+    _In_ PVOID Parameter
+    );
+
 IO_COMPLETION_ROUTINE FatFlushCompletionRoutine;
 
 NTSTATUS
@@ -751,11 +777,7 @@ Return Value:
 --*/
 
 {
-    PBCB Bcb;
-    PVOID DontCare;
-    IO_STATUS_BLOCK Iosb;
-    LARGE_INTEGER Offset;
-
+    NTSTATUS Status;
     NTSTATUS ReturnStatus = STATUS_SUCCESS;
 
     PAGED_CODE();
@@ -769,6 +791,13 @@ Return Value:
         return STATUS_SUCCESS;
     }
 
+    //
+    //  We are about to push out every dirty FAT page, so whatever the
+    //  journal was holding is covered.
+    //
+
+    InterlockedExchange( &Vcb->FatJournalPending, 0 );
+
     //
     //  Make sure the Vcb is OK.
     //
@@ -813,78 +842,556 @@ Return Value:
 
         ULONG NumberOfPages;
         ULONG Page;
+        VBO Offset;
 
         NumberOfPages = ( FatReservedBytes(&Vcb->Bpb) +
                           FatBytesPerFat(&Vcb->Bpb) +
                           (PAGE_SIZE - 1) ) / PAGE_SIZE;
 
 
-        for ( Page = 0, Offset.QuadPart = 0;
+        for ( Page = 0, Offset = 0;
               Page < NumberOfPages;
-              Page++, Offset.LowPart += PAGE_SIZE ) {
+              Page++, Offset += PAGE_SIZE ) {
 
-            try {
+            Status = FatFlushFatRange( IrpContext, Vcb, Offset, PAGE_SIZE );
 
-                if (CcPinRead( Vcb->VirtualVolumeFile,
-                               &Offset,
-                               PAGE_SIZE,
-                               PIN_WAIT | PIN_IF_BCB,
-                               &Bcb,
-                               &DontCare )) {
-                    
-                    CcSetDirtyPinnedData( Bcb, NULL );
-                    CcRepinBcb( Bcb );
-                    CcUnpinData( Bcb );
-                    CcUnpinRepinnedBcb( Bcb, TRUE, &Iosb );
+            if (!NT_SUCCESS(Status)) {
 
-                    if (!NT_SUCCESS(Iosb.Status)) {
+                ReturnStatus = Status;
+            }
+        }
 
-                        ReturnStatus = Iosb.Status;
-                    }
-                }
+    } else {
+
+        //
+        //  We read in the entire fat in the 12 bit case.
+        //
+
+        ReturnStatus = FatFlushFatRange( IrpContext,
+                                         Vcb,
+                                         FatReservedBytes( &Vcb->Bpb ),
+                                         FatBytesPerFat( &Vcb->Bpb ));
+    }
+
+    return ReturnStatus;
+}
+
+
+NTSTATUS
+FatFlushFatRange (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb,
+    IN VBO StartingVbo,
+    IN ULONG ByteCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes through a single range of the FAT if, and only if,
+    the cache manager still has a Bcb for it.  The range is pinned, repinned
+    and then unpinned write through, which is the only way we have to
+    correctly synchronize with other modifiers of the same page.
+
+Arguments:
+
+    Vcb - Supplies the Vcb whose FAT is being flushed
+
+    StartingVbo - Supplies the offset of the range in the volume file
+
+    ByteCount - Supplies the length of the range
+
+Return Value:
+
+    NTSTATUS - The status of the write, or STATUS_SUCCESS if the range was
+        not dirty.
+
+--*/
+
+{
+    PBCB Bcb;
+    PVOID DontCare;
+    IO_STATUS_BLOCK Iosb;
+    LARGE_INTEGER Offset;
+
+    NTSTATUS ReturnStatus = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    Offset.QuadPart = StartingVbo;
+
+    try {
+
+        if (CcPinRead( Vcb->VirtualVolumeFile,
+                       &Offset,
+                       ByteCount,
+                       PIN_WAIT | PIN_IF_BCB,
+                       &Bcb,
+                       &DontCare )) {
+            
+            CcSetDirtyPinnedData( Bcb, NULL );
+            CcRepinBcb( Bcb );
+            CcUnpinData( Bcb );
+            CcUnpinRepinnedBcb( Bcb, TRUE, &Iosb );
+
+            if (!NT_SUCCESS(Iosb.Status)) {
+
+                ReturnStatus = Iosb.Status;
+            }
+        }
+
+    } except(FatExceptionFilter(IrpContext, GetExceptionInformation())) {
+
+        ReturnStatus = IrpContext->ExceptionStatus;
+    }
+
+    return ReturnStatus;
+}
+
+
+NTSTATUS
+FatFlushFatJournal (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    On deferred flush media FatSetFatEntry and FatSetFatRun leave FAT pages
+    dirty in the cache instead of writing them through at the end of every
+    request.  The set of dirty sectors is already tracked, sorted by offset,
+    in the Vcb's DirtyFatMcb, so that is our journal: this routine walks it
+    in ascending order and writes each dirty page through exactly once.  The
+    write path mirrors each page into every FAT with a single multiple
+    async write.
+
+    This must run before any directory Bcbs are written through so that
+    allocation always reaches the disk ahead of the dirents referencing it.
 
-            } except(FatExceptionFilter(IrpContext, GetExceptionInformation())) {
+Arguments:
+
+    Vcb - Supplies the Vcb whose batched FAT updates are to be flushed
 
-                ReturnStatus = IrpContext->ExceptionStatus;
-                continue;
+Return Value:
+
+    NTSTATUS - The first failing status, or STATUS_SUCCESS.
+
+--*/
+
+{
+    NTSTATUS Status;
+    NTSTATUS ReturnStatus = STATUS_SUCCESS;
+
+    VBO NextVbo;
+    VBO Vbo;
+    LBO Lbo;
+    ULONG ByteCount;
+    ULONG Index;
+    BOOLEAN Found;
+
+    PAGED_CODE();
+
+    //
+    //  Claim the pending updates.  Anything dirtied after this point will
+    //  rearm the journal.
+    //
+
+    if (InterlockedExchange( &Vcb->FatJournalPending, 0 ) == 0) {
+
+        return STATUS_SUCCESS;
+    }
+
+    if (FlagOn(Vcb->VcbState, VCB_STATE_FLAG_WRITE_PROTECTED) ||
+        (Vcb->VcbCondition != VcbGood)) {
+
+        return STATUS_SUCCESS;
+    }
+
+    DebugTrace(+1, Dbg, "FatFlushFatJournal, Vcb = %08lx\n", Vcb);
+
+    //
+    //  In the 12 bit case the whole FAT is described by one Bcb.
+    //
+
+    if (Vcb->AllocationSupport.FatIndexBitSize == 12) {
+
+        ReturnStatus = FatFlushFatRange( IrpContext,
+                                         Vcb,
+                                         FatReservedBytes( &Vcb->Bpb ),
+                                         FatBytesPerFat( &Vcb->Bpb ));
+
+        DebugTrace(-1, Dbg, "FatFlushFatJournal -> %08lx\n", ReturnStatus);
+
+        return ReturnStatus;
+    }
+
+    //
+    //  Find the first dirty run extending beyond what we have already
+    //  written, and write through the page it starts in.  The write path
+    //  removes the sectors it writes from the Mcb, so the run indices shift
+    //  beneath us and we rescan from the front each time; the number of
+    //  runs is small.
+    //
+
+    NextVbo = 0;
+
+    while (TRUE) {
+
+        Found = FALSE;
+
+        for (Index = 0;
+             FatGetNextMcbEntry( Vcb, &Vcb->DirtyFatMcb, Index, &Vbo, &Lbo, &ByteCount );
+             Index += 1) {
+
+            //
+            //  Holes come back with a zero Lbo.
+            //
+
+            if ((Lbo != 0) && (Vbo + ByteCount > NextVbo)) {
+
+                Found = TRUE;
+                break;
             }
         }
 
+        if (!Found) {
+
+            break;
+        }
+
+        if (Vbo < NextVbo) {
+
+            Vbo = NextVbo;
+        }
+
+        Vbo &= ~(PAGE_SIZE - 1);
+
+        Status = FatFlushFatRange( IrpContext, Vcb, Vbo, PAGE_SIZE );
+
+        if (!NT_SUCCESS(Status)) {
+
+            ReturnStatus = Status;
+        }
+
+        NextVbo = Vbo + PAGE_SIZE;
+    }
+
+    DebugTrace(-1, Dbg, "FatFlushFatJournal -> %08lx\n", ReturnStatus);
+
+    return ReturnStatus;
+}
+
+
+VOID
+FatDeferFatFlush (
+    IN PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called after FAT pages have been dirtied without being
+    repinned.  It makes sure the FAT journal timer is running, so that the
+    updates reach the disk within FAT_JOURNAL_FLUSH_DELAY even if nothing
+    else flushes them first.
+
+Arguments:
+
+    Vcb - Supplies the Vcb whose FAT was modified
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    LARGE_INTEGER FlushDelay;
+
+    PAGED_CODE();
+
+    //
+    //  Only the caller that moves the journal from idle to pending arms the
+    //  timer, so a burst of updates is written out once.
+    //
+
+    if (InterlockedCompareExchange( &Vcb->FatJournalPending, 1, 0 ) == 0) {
+
+        FlushDelay.QuadPart = FAT_JOURNAL_FLUSH_DELAY;
+
+        KeSetTimer( &Vcb->FatJournalTimer,
+                    FlushDelay,
+                    &Vcb->FatJournalDpc );
+    }
+}
+
+
+VOID
+FatFlushFatDpc (
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is dispatched when the FAT journal delay for a volume has
+    elapsed, and exqueues a worker thread to write the batched FAT pages.
+
+Arguments:
+
+    DefferedContext - Contains the Vcb to process.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PVCB Vcb;
+    PCLEAN_AND_DIRTY_VOLUME_PACKET Packet;
+
+    UNREFERENCED_PARAMETER( SystemArgument1 );
+    UNREFERENCED_PARAMETER( SystemArgument2 );
+    UNREFERENCED_PARAMETER( Dpc );
+
+    Vcb = (PVCB)DeferredContext;
+
+    //
+    //  Someone may have flushed the journal already.
+    //
+
+    if (Vcb->FatJournalPending == 0) {
+
+        return;
+    }
+
+    Packet = ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(CLEAN_AND_DIRTY_VOLUME_PACKET), ' taF');
+
+    if ( Packet ) {
+
+        Packet->Vcb = Vcb;
+        Packet->Irp = NULL;
+
+        ExInitializeWorkItem( &Packet->Item, &FatDeferredFlushFat, Packet );
+
+#pragma prefast( suppress:28159, "prefast indicates this is an obsolete API, but it is ok for fastfat to keep using it" )
+        ExQueueWorkItem( &Packet->Item, DelayedWorkQueue );
+
     } else {
 
         //
-        //  We read in the entire fat in the 12 bit case.
+        //  If we couldn't get pool, try again later.
         //
 
-        Offset.QuadPart = FatReservedBytes( &Vcb->Bpb );
+        LARGE_INTEGER FlushDelay;
 
-        try {
+        FlushDelay.QuadPart = FAT_JOURNAL_FLUSH_DELAY;
+
+        KeSetTimer( &Vcb->FatJournalTimer,
+                    FlushDelay,
+                    &Vcb->FatJournalDpc );
+    }
+
+    return;
+}
 
-            if (CcPinRead( Vcb->VirtualVolumeFile,
-                           &Offset,
-                           FatBytesPerFat( &Vcb->Bpb ),
-                           PIN_WAIT | PIN_IF_BCB,
-                           &Bcb,
-                           &DontCare )) {
-                
-                CcSetDirtyPinnedData( Bcb, NULL );
-                CcRepinBcb( Bcb );
-                CcUnpinData( Bcb );
-                CcUnpinRepinnedBcb( Bcb, TRUE, &Iosb );
 
-                if (!NT_SUCCESS(Iosb.Status)) {
+VOID
+FatDeferredFlushFat (
+    _In_ PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This is the routine that performs the actual FatFlushFatJournal call.
+    It assures that the target volume still exists as there is a race
+    condition between queueing the ExWorker item and volumes going away.
+
+    There is no request to hand a failure back to, so a failed write is
+    dealt with here the way FatProcessException deals with one for a
+    request: the volume is marked dirty for chkdsk, and the user is told
+    that the data was lost.
+
+Arguments:
+
+    Parameter - Points to a packet that was allocated from pool
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PCLEAN_AND_DIRTY_VOLUME_PACKET Packet;
+    PLIST_ENTRY Links;
+    PVCB Vcb;
+    IRP_CONTEXT IrpContext;
+    NTSTATUS Status = STATUS_SUCCESS;
+    BOOLEAN VcbExists = FALSE;
+    BOOLEAN Rearm = FALSE;
+
+    PAGED_CODE();
 
-                    ReturnStatus = Iosb.Status;
+    DebugTrace(+1, Dbg, "FatDeferredFlushFat\n", 0);
+
+    Packet = (PCLEAN_AND_DIRTY_VOLUME_PACKET)Parameter;
+
+    Vcb = Packet->Vcb;
+
+    //
+    //  Make us appear as a top level FSP request so that we will
+    //  receive any errors from the operation.
+    //
+
+    IoSetTopLevelIrp( (PIRP)FSRTL_FSP_TOP_LEVEL_IRP );
+
+    //
+    //  Dummy up and Irp Context so we can call our worker routines
+    //
+
+    RtlZeroMemory( &IrpContext, sizeof(IRP_CONTEXT));
+
+    SetFlag(IrpContext.Flags, IRP_CONTEXT_FLAG_WAIT);
+
+    //
+    //  Acquire shared access to the global lock and make sure this volume
+    //  still exists.
+    //
+
+#pragma prefast( push )
+#pragma prefast( disable: 28193, "this will always wait" )
+    FatAcquireSharedGlobal( &IrpContext );
+#pragma prefast( pop )
+
+    for (Links = FatData.VcbQueue.Flink;
+         Links != &FatData.VcbQueue;
+         Links = Links->Flink) {
+
+        PVCB ExistingVcb;
+
+        ExistingVcb = CONTAINING_RECORD(Links, VCB, VcbLinks);
+
+        if ( Vcb == ExistingVcb ) {
+
+            VcbExists = TRUE;
+            break;
+        }
+    }
+
+    if ( VcbExists &&
+         (Vcb->VcbCondition == VcbGood) &&
+         !FlagOn(Vcb->VcbState, VCB_STATE_FLAG_SHUTDOWN) ) {
+
+        //
+        //  Don't tie up a worker behind a long exclusive holder of the
+        //  volume; just come back later.
+        //
+
+        ClearFlag(IrpContext.Flags, IRP_CONTEXT_FLAG_WAIT);
+
+        if (FatAcquireSharedVcb( &IrpContext, Vcb )) {
+
+            SetFlag(IrpContext.Flags, IRP_CONTEXT_FLAG_WAIT);
+
+            try {
+
+                Status = FatFlushFatJournal( &IrpContext, Vcb );
+
+            } except( FsRtlIsNtstatusExpected(GetExceptionCode()) ?
+                      EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH ) {
+
+                  Status = GetExceptionCode();
+            }
+
+            FatReleaseVcb( &IrpContext, Vcb );
+
+        } else {
+
+            Rearm = TRUE;
+        }
+
+        if (!NT_SUCCESS(Status)) {
+
+            DebugTrace(0, Dbg, "FatDeferredFlushFat, flush failed %08lx\n", Status);
+
+            //
+            //  Mark the volume permanently dirty, asking for a surface test
+            //  unless the device has simply gone away.
+            //
+
+            SetFlag( Vcb->VcbState, VCB_STATE_FLAG_MOUNTED_DIRTY );
+
+            FatAcquireExclusiveVcbNoOpCheck( &IrpContext, Vcb );
+
+            try {
+
+                if (Vcb->VcbCondition == VcbGood) {
+
+                    FatMarkVolume( &IrpContext,
+                                   Vcb,
+                                   FsRtlIsTotalDeviceFailure( Status ) ?
+                                   VolumeDirty : VolumeDirtyWithSurfaceTest );
                 }
+
+            } except( FsRtlIsNtstatusExpected(GetExceptionCode()) ?
+                      EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH ) {
+
+                  NOTHING;
             }
 
-        } except(FatExceptionFilter(IrpContext, GetExceptionInformation())) {
+            FatReleaseVcb( &IrpContext, Vcb );
 
-            ReturnStatus = IrpContext->ExceptionStatus;
+            IoRaiseInformationalHardError( STATUS_LOST_WRITEBEHIND_DATA, NULL, NULL );
         }
+
+    } else if (VcbExists) {
+
+        //
+        //  The volume is going away or has to be verified, and the dirty
+        //  FAT pages go with it like any other dirty metadata.  Drop the
+        //  pending state so that the journal is armed again by the next
+        //  update should the volume come back.
+        //
+
+        InterlockedExchange( &Vcb->FatJournalPending, 0 );
     }
 
-    return ReturnStatus;
+    if (Rearm) {
+
+        LARGE_INTEGER FlushDelay;
+
+        FlushDelay.QuadPart = FAT_JOURNAL_FLUSH_DELAY;
+
+        KeSetTimer( &Vcb->FatJournalTimer,
+                    FlushDelay,
+                    &Vcb->FatJournalDpc );
+    }
+
+    FatReleaseGlobal( &IrpContext );
+
+    IoSetTopLevelIrp( NULL );
+
+    //
+    //  and finally free the packet.
+    //
+
+    ExFreePool( Packet );
+
+    DebugTrace(-1, Dbg, "FatDeferredFlushFat -> VOID\n", 0);
+
+    return;
 }
 
 
@@ -930,6 +1437,18 @@ Return Value:
         return STATUS_SUCCESS;
     }
 
+    //
+    //  Push out any batched FAT updates first, so that allocation reaches
+    //  the disk ahead of the dirents that reference it.
+    //
+
+    Status = FatFlushFatJournal( IrpContext, Vcb );
+
+    if (!NT_SUCCESS(Status)) {
+
+        ReturnStatus = Status;
+    }
+
     //
     //  Flush all the files and directories.
     //
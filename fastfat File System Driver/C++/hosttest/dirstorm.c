@@ -0,0 +1,1636 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    DirStorm.c
+
+Abstract:
+
+    Host harness for the Fat dirent index.  Replays create/open/delete storms
+    against a Fat directory stream and checks every index guided lookup
+    against a full scan of the directory, then reports how many directory
+    pages each approach had to map.
+
+    The lookup, scan and index routines are the driver's own: ../dirsup.c is
+    built unchanged against the kernel stand-ins in kernel/, and the storms
+    call FatLocateDirent, FatScanForDirent, FatInsertDirentIndex and
+    FatRemoveDirentIndex.  This program supplies what they call: the
+    directory stream, through FatReadDirectoryFile, the pool, the resources
+    and the Unicode routines.
+
+    The directory stream is laid out exactly as on disk: 32 byte dirents,
+    Lfn runs with ordinals and checksums, deleted dirents reused first fit,
+    and the directory grown a cluster at a time.  Creates and deletes write
+    the dirents themselves, as FatCreateNewDirent and FatDeleteDirent would.
+
+    usage: dirstorm --selftest
+           dirstorm [--files n] [--opens n] [--churn pct] [--seed n]
+                    [--load dir.bin] [--save dir.bin]
+
+    --load replays opens of every name in a raw directory stream, such as
+    the clusters of a directory copied off a real volume.
+
+Environment:
+
+    Host (user mode), C11 with -fms-extensions.
+
+--*/
+
+#include "FatProcs.h"
+
+#include <time.h>
+
+//
+//  Limits from DirSup.c, which the storms are sized around.
+//
+
+#define FAT_DIRENT_INDEX_MIN_SIZE        (0x10000)
+#define FAT_DIRENT_INDEX_POOL_LIMIT      (8 * 1024 * 1024)
+#define FAT_DIRENT_INDEX_MAX_CANDIDATES  (8)
+
+#define DIRENT_SIZE                      (32)
+#define CLUSTER_SIZE                     (4096)
+#define MAX_DIRECTORY_SIZE               (0x200000)
+
+#define NO_OFFSET                        (0xffffffffu)
+
+_Static_assert( sizeof(DIRENT) == DIRENT_SIZE, "DIRENT is not 32 bytes" );
+_Static_assert( sizeof(LFN_DIRENT) == DIRENT_SIZE, "LFN_DIRENT is not 32 bytes" );
+
+//
+//  FatComputeLfnChecksum and FatScanForDirent are local to DirSup.c, but
+//  not static.
+//
+
+UCHAR
+FatComputeLfnChecksum (
+    PDIRENT Dirent
+    );
+
+VOID
+FatScanForDirent (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom,
+    IN VBO OffsetToStopSearchAt,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL
+    );
+
+//
+//  A directory and what it has cost us.  The Dcb is what the driver code
+//  sees; FatReadDirectoryFile maps it back to the directory.
+//
+
+typedef struct _DIRECTORY {
+    FCB Dcb;
+    VCB Vcb;
+    ERESOURCE DcbResource;
+    uint8_t *Data;
+    uint32_t Allocation;
+    int UseIndex;
+
+    uint64_t PagesRead;
+    uint64_t Lookups;
+    uint64_t IndexBuilds;
+    uint64_t IndexDiscards;
+} DIRECTORY;
+
+//
+//  A lookup, with the Ccb Create would build for the name.
+//
+
+typedef struct _QUERY {
+    CCB Ccb;
+    WCHAR Unicode[MAX_LFN_CHARACTERS];
+} QUERY;
+
+//
+//  The reference model of what is in the directory.
+//
+
+typedef struct _FILE_ENTRY {
+    char Name[MAX_LFN_CHARACTERS + 1];
+    char ShortName[13];
+    VBO LfnOffset;
+    VBO DirentOffset;
+} FILE_ENTRY;
+
+typedef struct _STORM {
+    DIRECTORY Directory;
+    FILE_ENTRY *Files;
+    uint32_t FileCount;
+    uint32_t FileMax;
+    uint64_t Random;
+    int Verify;
+    uint64_t Mismatches;
+} STORM;
+
+FAT_DATA FatData;
+
+static IRP_CONTEXT IrpContext;
+static long PoolOutstanding;
+static uint32_t PoolFailPercent;
+static uint64_t PoolRandom = 1;
+static long PinCount;
+static uint8_t *StackBase;
+static const char *SavePath;
+
+static int Failures;
+
+#define CHECK(Condition)                                                    \
+    do {                                                                    \
+        if (!(Condition)) {                                                 \
+            fprintf( stderr, "%s:%d: check failed: %s\n",                   \
+                     __FILE__, __LINE__, #Condition );                      \
+            Failures += 1;                                                  \
+        }                                                                   \
+    } while (0)
+
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static double
+Now (
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//
+//  RtlUpcaseUnicodeChar, for the characters the storms use.
+//
+
+static uint16_t
+UpcaseChar (
+    uint16_t Char
+    )
+{
+    if ((Char >= 'a') && (Char <= 'z')) {
+        return Char - ('a' - 'A');
+    }
+    if ((Char >= 0xe0) && (Char <= 0xfe) && (Char != 0xf7)) {
+        return Char - 0x20;
+    }
+    if (Char == 0xff) {
+        return 0x178;
+    }
+    return Char;
+}
+
+
+//
+//  The kernel and Fat routines the dirent code calls.  Nothing raised is
+//  ever caught on the host, so a raise or a bug check ends the run.
+//
+
+VOID
+HostAssert (
+    int Condition,
+    const char *Text,
+    const char *File,
+    int Line
+    )
+{
+    if (!Condition) {
+        fprintf( stderr, "%s:%d: assertion failed: %s\n", File, Line, Text );
+        abort();
+    }
+}
+
+VOID
+ExRaiseStatus (
+    NTSTATUS Status
+    )
+{
+    fprintf( stderr, "raised status %08x\n", (unsigned)Status );
+    abort();
+}
+
+VOID
+KeBugCheckEx (
+    ULONG BugCheckCode,
+    ULONG_PTR P1,
+    ULONG_PTR P2,
+    ULONG_PTR P3,
+    ULONG_PTR P4
+    )
+{
+    fprintf( stderr, "bug check %x (%lx, %lx, %lx, %lx)\n", (unsigned)BugCheckCode,
+             (unsigned long)P1, (unsigned long)P2, (unsigned long)P3, (unsigned long)P4 );
+    abort();
+}
+
+VOID
+FatPopUpFileCorrupt (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Fcb );
+}
+
+//
+//  Pool.  A share of the allocations can be made to fail, which the index
+//  code must survive by falling back to scanning.
+//
+
+static PVOID
+AllocatePool (
+    SIZE_T NumberOfBytes
+    )
+{
+    PVOID P = malloc( NumberOfBytes );
+
+    if (P != NULL) {
+        PoolOutstanding += 1;
+    }
+    return P;
+}
+
+PVOID
+ExAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    UNREFERENCED_PARAMETER( PoolType );
+    UNREFERENCED_PARAMETER( Tag );
+
+    if ((PoolFailPercent != 0) && ((Random64( &PoolRandom ) % 100) < PoolFailPercent)) {
+        return NULL;
+    }
+    return AllocatePool( NumberOfBytes );
+}
+
+VOID
+ExFreePool (
+    PVOID P
+    )
+{
+    PoolOutstanding -= 1;
+    free( P );
+}
+
+//
+//  As in StrucSup.c, except that these never fail: the driver raises if
+//  it cannot get a name buffer.  A buffer on the stack is not freed.
+//
+
+VOID
+FatFreeStringBuffer (
+    _Inout_ PVOID String
+    )
+{
+    PSTRING LocalString = String;
+    uint8_t Here;
+
+    if (LocalString->Buffer != NULL) {
+
+        if (((uint8_t *)LocalString->Buffer < &Here) ||
+            ((uint8_t *)LocalString->Buffer > StackBase)) {
+
+            ExFreePool( LocalString->Buffer );
+        }
+
+        LocalString->Buffer = NULL;
+    }
+
+    LocalString->MaximumLength = LocalString->Length = 0;
+}
+
+VOID
+FatEnsureStringBufferEnough (
+    _Inout_ PVOID String,
+    _In_ USHORT DesiredBufferSize
+    )
+{
+    PSTRING LocalString = String;
+
+    if (LocalString->MaximumLength < DesiredBufferSize) {
+
+        FatFreeStringBuffer( LocalString );
+
+        LocalString->Buffer = AllocatePool( DesiredBufferSize );
+        NT_ASSERT( LocalString->Buffer );
+
+        LocalString->MaximumLength = DesiredBufferSize;
+    }
+}
+
+//
+//  A resource only counts its owners.  As in the kernel, a shared check
+//  is also satisfied by an exclusive owner.
+//
+
+ULONG
+ExIsResourceAcquiredSharedLite (
+    PERESOURCE Resource
+    )
+{
+    return (ULONG)(Resource->SharedCount + Resource->ExclusiveCount);
+}
+
+BOOLEAN
+ExIsResourceAcquiredExclusiveLite (
+    PERESOURCE Resource
+    )
+{
+    return Resource->ExclusiveCount != 0;
+}
+
+//
+//  The cache: a read maps a page of the directory stream, and counts it.
+//
+
+VOID
+FatReadDirectoryFile (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO StartingVbo,
+    IN ULONG ByteCount,
+    IN BOOLEAN Pin,
+    OUT PBCB *Bcb,
+    OUT PVOID *Buffer,
+    OUT PNTSTATUS Status
+    )
+{
+    DIRECTORY *Directory = CONTAINING_RECORD( Dcb, DIRECTORY, Dcb );
+
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Pin );
+
+    NT_ASSERT( StartingVbo + ByteCount <= Directory->Allocation );
+
+    Directory->PagesRead += 1;
+    PinCount += 1;
+
+    *Bcb = Directory;
+    *Buffer = Directory->Data + StartingVbo;
+    *Status = STATUS_SUCCESS;
+}
+
+VOID
+CcUnpinData (
+    PVOID Bcb
+    )
+{
+    UNREFERENCED_PARAMETER( Bcb );
+
+    NT_ASSERT( PinCount > 0 );
+    PinCount -= 1;
+}
+
+//
+//  RtlUpcaseUnicodeChar, for the characters the storms use.
+//
+
+WCHAR
+RtlUpcaseUnicodeChar (
+    WCHAR SourceCharacter
+    )
+{
+    return UpcaseChar( SourceCharacter );
+}
+
+NTSTATUS
+RtlUpcaseUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCUNICODE_STRING SourceString,
+    BOOLEAN AllocateDestinationString
+    )
+{
+    USHORT i;
+
+    NT_ASSERT( !AllocateDestinationString );
+
+    if (DestinationString->MaximumLength < SourceString->Length) {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    for (i = 0; i < SourceString->Length / sizeof(WCHAR); i++) {
+        DestinationString->Buffer[i] = UpcaseChar( SourceString->Buffer[i] );
+    }
+    DestinationString->Length = SourceString->Length;
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+FsRtlAreNamesEqual (
+    PCUNICODE_STRING ConstantNameA,
+    PCUNICODE_STRING ConstantNameB,
+    BOOLEAN IgnoreCase,
+    PCWSTR UpcaseTable
+    )
+{
+    USHORT i;
+
+    UNREFERENCED_PARAMETER( UpcaseTable );
+
+    if (ConstantNameA->Length != ConstantNameB->Length) {
+        return FALSE;
+    }
+
+    for (i = 0; i < ConstantNameA->Length / sizeof(WCHAR); i++) {
+
+        WCHAR A = ConstantNameA->Buffer[i];
+        WCHAR B = ConstantNameB->Buffer[i];
+
+        if (IgnoreCase) {
+            A = UpcaseChar( A );
+            B = UpcaseChar( B );
+        }
+        if (A != B) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+//
+//  Name helpers.
+//
+
+static int
+IsShortNameChar (
+    char c
+    )
+{
+    return ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) ||
+           (strchr( "$%'-_@~`!(){}^#&", c ) != NULL);
+}
+
+//
+//  Converts a name to its on disk 8.3 form if it is a valid short name,
+//  returning whether it needs no Lfn (it is 8.3 and all one case).
+//
+
+static int
+NameTo8dot3 (
+    const char *Name,
+    uint8_t *Oem,
+    int *NeedsLfn
+    )
+{
+    const char *Dot = strrchr( Name, '.' );
+    size_t BaseLength = Dot ? (size_t)(Dot - Name) : strlen( Name );
+    size_t ExtLength = Dot ? strlen( Dot + 1 ) : 0;
+    int Lower = 0, Upper = 0;
+    size_t i;
+
+    memset( Oem, ' ', 11 );
+    *NeedsLfn = 1;
+
+    if ((BaseLength == 0) || (BaseLength > 8) || (ExtLength > 3) || (Dot && (ExtLength == 0))) {
+        return 0;
+    }
+
+    for (i = 0; Name[i]; i++) {
+        char c = Name[i];
+
+        if (&Name[i] == Dot) {
+            continue;
+        }
+        if ((c >= 'a') && (c <= 'z')) {
+            Lower = 1;
+            c = (char)(c - ('a' - 'A'));
+        } else if ((c >= 'A') && (c <= 'Z')) {
+            Upper = 1;
+        }
+        if (!IsShortNameChar( c )) {
+            return 0;
+        }
+        if (&Name[i] < (Dot ? Dot : Name + BaseLength)) {
+            Oem[i] = (uint8_t)c;
+        } else {
+            Oem[8 + (&Name[i] - Dot - 1)] = (uint8_t)c;
+        }
+    }
+
+    *NeedsLfn = Lower && Upper;
+    return 1;
+}
+
+
+//
+//  Builds the Ccb Create uses to look a name up: the 8.3 form if the name
+//  has one, and the upcased long name.
+//
+
+static void
+BuildQuery (
+    const char *Name,
+    QUERY *Query
+    )
+{
+    int NeedsLfn;
+    uint32_t i;
+
+    memset( &Query->Ccb, 0, sizeof(Query->Ccb) );
+
+    if (!NameTo8dot3( Name, Query->Ccb.OemQueryTemplate.Constant, &NeedsLfn )) {
+        Query->Ccb.Flags = CCB_FLAG_SKIP_SHORT_NAME_COMPARE;
+    }
+
+    for (i = 0; Name[i] && (i < MAX_LFN_CHARACTERS); i++) {
+        Query->Unicode[i] = UpcaseChar( (uint8_t)Name[i] );
+    }
+
+    Query->Ccb.UnicodeQueryTemplate.Buffer = Query->Unicode;
+    Query->Ccb.UnicodeQueryTemplate.Length = (USHORT)(i * sizeof(WCHAR));
+    Query->Ccb.UnicodeQueryTemplate.MaximumLength = (USHORT)sizeof(Query->Unicode);
+    Query->Ccb.ContainsWildCards = FALSE;
+}
+
+static void
+MakeUnicodeName (
+    const char *Name,
+    WCHAR *Buffer,
+    UNICODE_STRING *String
+    )
+{
+    uint32_t i;
+
+    for (i = 0; Name[i] && (i < MAX_LFN_CHARACTERS); i++) {
+        Buffer[i] = (uint8_t)Name[i];
+    }
+
+    String->Buffer = Buffer;
+    String->Length = (USHORT)(i * sizeof(WCHAR));
+    String->MaximumLength = (USHORT)(MAX_LFN_CHARACTERS * sizeof(WCHAR));
+}
+
+//
+//  FatScanForDirent from the start of the directory, as the reference the
+//  index is checked against.  Returns the offset of the match and the long
+//  name the scan found with it.
+//
+
+static VBO
+ScanDirectory (
+    DIRECTORY *Directory,
+    PCCB Ccb,
+    VBO OffsetToStartSearchFrom,
+    UNICODE_STRING *Lfn
+    )
+{
+    PDIRENT Dirent;
+    PBCB Bcb = NULL;
+    VBO ByteOffset = 0;
+
+    FatScanForDirent( &IrpContext,
+                      &Directory->Dcb,
+                      Ccb,
+                      OffsetToStartSearchFrom,
+                      MAXULONG,
+                      &Dirent,
+                      &Bcb,
+                      &ByteOffset,
+                      NULL,
+                      Lfn );
+
+    FatUnpinBcb( &IrpContext, Bcb );
+
+    return (Dirent != NULL) ? ByteOffset : NO_OFFSET;
+}
+
+//
+//  The storm: a reference model of the directory, and the operations that
+//  change it the way Create and Delete do.
+//
+
+static VBO
+StormLocate (
+    STORM *Storm,
+    const char *Name
+    )
+{
+    DIRECTORY *Directory = &Storm->Directory;
+    PDIRENT_INDEX Index = Directory->Dcb.Specific.Dcb.DirentIndex;
+    QUERY Query;
+    PDIRENT Dirent;
+    PBCB Bcb = NULL;
+    VBO ByteOffset = 0;
+    BOOLEAN FileNameDos;
+    WCHAR LfnBuffer[MAX_LFN_CHARACTERS];
+    UNICODE_STRING Lfn;
+    VBO Offset;
+
+    Lfn.Length = 0;
+    Lfn.MaximumLength = sizeof(LfnBuffer);
+    Lfn.Buffer = LfnBuffer;
+
+    BuildQuery( Name, &Query );
+
+    FatLocateDirent( &IrpContext,
+                     &Directory->Dcb,
+                     &Query.Ccb,
+                     0,
+                     &Dirent,
+                     &Bcb,
+                     &ByteOffset,
+                     &FileNameDos,
+                     &Lfn );
+
+    Offset = (Dirent != NULL) ? ByteOffset : NO_OFFSET;
+
+    FatUnpinBcb( &IrpContext, Bcb );
+
+    Directory->Lookups += 1;
+
+    if ((Index == NULL) && (Directory->Dcb.Specific.Dcb.DirentIndex != NULL)) {
+        Directory->IndexBuilds += 1;
+    }
+
+    if (Storm->Verify && Directory->UseIndex) {
+
+        uint64_t Read = Directory->PagesRead;
+        VBO Expected;
+
+        BuildQuery( Name, &Query );
+        Expected = ScanDirectory( Directory, &Query.Ccb, 0, &Lfn );
+
+        Directory->PagesRead = Read;
+
+        if (Offset != Expected) {
+            fprintf( stderr, "MISMATCH: \"%s\" index %#x scan %#x\n", Name, Offset, Expected );
+            Storm->Mismatches += 1;
+        }
+    }
+
+    FatFreeStringBuffer( &Lfn );
+    CHECK( PinCount == 0 );
+
+    return Offset;
+}
+
+static void
+FormatShortName (
+    const uint8_t *Oem,
+    char *ShortName
+    )
+{
+    int i, n = 0;
+
+    for (i = 0; (i < 8) && (Oem[i] != ' '); i++) {
+        ShortName[n++] = (char)Oem[i];
+    }
+    if (Oem[8] != ' ') {
+        ShortName[n++] = '.';
+        for (i = 8; (i < 11) && (Oem[i] != ' '); i++) {
+            ShortName[n++] = (char)Oem[i];
+        }
+    }
+    ShortName[n] = 0;
+}
+
+//
+//  Generates a short name for a long one, probing for collisions with
+//  lookups, the way FatSelectNames does: a few numeric tails on the name
+//  itself, then a hashed basis.
+//
+
+static void
+SelectShortName (
+    STORM *Storm,
+    const char *Name,
+    uint8_t *Oem
+    )
+{
+    const char *Dot = strrchr( Name, '.' );
+    char Basis[9] = { 0 };
+    char Ext[4] = { 0 };
+    uint32_t Hash = 2166136261u;
+    int BasisLength = 0, ExtLength = 0;
+    int Tail;
+    const char *p;
+
+    for (p = Name; *p && (p != Dot) && (BasisLength < 6); p++) {
+        char c = (char)UpcaseChar( (uint8_t)*p );
+        if (IsShortNameChar( c ) && (c != '~')) {
+            Basis[BasisLength++] = c;
+        }
+    }
+    for (p = Dot ? Dot + 1 : ""; *p && (ExtLength < 3); p++) {
+        char c = (char)UpcaseChar( (uint8_t)*p );
+        if (IsShortNameChar( c )) {
+            Ext[ExtLength++] = c;
+        }
+    }
+    if (BasisLength == 0) {
+        Basis[BasisLength++] = '_';
+    }
+    for (p = Name; *p; p++) {
+        Hash = (Hash ^ (uint8_t)*p) * 16777619u;
+    }
+
+    for (Tail = 1; ; Tail++) {
+
+        char Candidate[16];
+        int NeedsLfn;
+
+        if (Tail <= 4) {
+            snprintf( Candidate, sizeof(Candidate), "%s~%d", Basis, Tail );
+        } else {
+            snprintf( Candidate, sizeof(Candidate), "%.2s%04X~%d",
+                      Basis, (Hash + (uint32_t)(Tail - 5) / 9) & 0xffff, (Tail - 5) % 9 + 1 );
+        }
+        if (ExtLength) {
+            strcat( Candidate, "." );
+            strcat( Candidate, Ext );
+        }
+
+        NameTo8dot3( Candidate, Oem, &NeedsLfn );
+
+        if (StormLocate( Storm, Candidate ) == NO_OFFSET) {
+            return;
+        }
+    }
+}
+
+//
+//  Finds room for a run of dirents, first fit over deleted and never used
+//  dirents, growing the directory by a cluster if there is none.
+//
+
+static VBO
+AllocateDirents (
+    DIRECTORY *Directory,
+    uint32_t Count
+    )
+{
+    VBO Offset;
+    VBO RunStart = 0;
+    uint32_t Run = 0;
+
+    for (Offset = 0; Offset < Directory->Allocation; Offset += DIRENT_SIZE) {
+
+        uint8_t First = Directory->Data[Offset];
+
+        if ((First == FAT_DIRENT_DELETED) || (First == FAT_DIRENT_NEVER_USED)) {
+
+            if (Run == 0) {
+                RunStart = Offset;
+            }
+            if (++Run == Count) {
+                return RunStart;
+            }
+
+        } else {
+
+            Run = 0;
+        }
+    }
+
+    //
+    //  Extend whatever free run the directory ends with.
+    //
+
+    if (Run == 0) {
+        RunStart = Directory->Allocation;
+    }
+
+    while (Run < Count) {
+
+        if (Directory->Allocation + CLUSTER_SIZE > MAX_DIRECTORY_SIZE) {
+            return NO_OFFSET;
+        }
+        memset( Directory->Data + Directory->Allocation, 0, CLUSTER_SIZE );
+        Directory->Allocation += CLUSTER_SIZE;
+        Directory->Dcb.Header.AllocationSize.QuadPart = Directory->Allocation;
+        Run += CLUSTER_SIZE / DIRENT_SIZE;
+    }
+
+    return RunStart;
+}
+
+static void
+WriteLfnDirent (
+    uint8_t *Dirent,
+    uint8_t Ordinal,
+    uint8_t Checksum,
+    const char *Name,
+    uint32_t Length
+    )
+{
+    static const int CharOffsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    uint32_t First = ((Ordinal & ~FAT_LAST_LONG_ENTRY) - 1) * 13u;
+    int i;
+
+    memset( Dirent, 0, DIRENT_SIZE );
+    Dirent[0] = Ordinal;
+    Dirent[11] = FAT_DIRENT_ATTR_LFN;
+    Dirent[13] = Checksum;
+
+    for (i = 0; i < 13; i++) {
+
+        uint16_t Char;
+
+        if (First + i < Length) {
+            Char = (uint8_t)Name[First + i];
+        } else if (First + i == Length) {
+            Char = 0;
+        } else {
+            Char = 0xffff;
+        }
+        Dirent[CharOffsets[i]] = (uint8_t)Char;
+        Dirent[CharOffsets[i] + 1] = (uint8_t)(Char >> 8);
+    }
+}
+
+static int
+StormCreate (
+    STORM *Storm,
+    const char *Name
+    )
+{
+    DIRECTORY *Directory = &Storm->Directory;
+    PDIRENT_INDEX Index;
+    FILE_ENTRY *File;
+    DIRENT *Dirent;
+    uint8_t Oem[11];
+    uint32_t Length = (uint32_t)strlen( Name );
+    uint32_t LfnDirents = 0;
+    uint8_t Checksum;
+    int NeedsLfn = 1;
+    VBO Offset;
+    uint32_t i;
+    WCHAR UnicodeBuffer[MAX_LFN_CHARACTERS];
+    UNICODE_STRING Unicode;
+
+    //
+    //  Create first looks the name up, as an open-if would.
+    //
+
+    if (StormLocate( Storm, Name ) != NO_OFFSET) {
+        return 0;
+    }
+
+    if (!NameTo8dot3( Name, Oem, &NeedsLfn ) || NeedsLfn) {
+        SelectShortName( Storm, Name, Oem );
+        LfnDirents = (Length + 12) / 13;
+    }
+
+    Offset = AllocateDirents( Directory, LfnDirents + 1 );
+
+    if ((Offset == NO_OFFSET) || (Storm->FileCount == Storm->FileMax)) {
+        return 0;
+    }
+
+    Dirent = (DIRENT *)(Directory->Data + Offset + LfnDirents * DIRENT_SIZE);
+
+    memset( Dirent, 0, DIRENT_SIZE );
+    memcpy( Dirent->FileName, Oem, 11 );
+    Dirent->Attributes = FAT_DIRENT_ATTR_ARCHIVE;
+
+    Checksum = FatComputeLfnChecksum( Dirent );
+
+    for (i = 0; i < LfnDirents; i++) {
+        WriteLfnDirent( Directory->Data + Offset + i * DIRENT_SIZE,
+                        (uint8_t)((LfnDirents - i) | (i == 0 ? FAT_LAST_LONG_ENTRY : 0)),
+                        Checksum,
+                        Name,
+                        Length );
+    }
+
+    File = &Storm->Files[Storm->FileCount++];
+    snprintf( File->Name, sizeof(File->Name), "%s", Name );
+    FormatShortName( Oem, File->ShortName );
+    File->LfnOffset = Offset;
+    File->DirentOffset = Offset + LfnDirents * DIRENT_SIZE;
+
+    MakeUnicodeName( Name, UnicodeBuffer, &Unicode );
+
+    Index = Directory->Dcb.Specific.Dcb.DirentIndex;
+
+    FatInsertDirentIndex( &IrpContext,
+                          &Directory->Dcb,
+                          File->LfnOffset,
+                          File->DirentOffset,
+                          Dirent,
+                          (LfnDirents != 0) ? &Unicode : NULL );
+
+    if ((Index != NULL) && (Directory->Dcb.Specific.Dcb.DirentIndex == NULL)) {
+        Directory->IndexDiscards += 1;
+    }
+
+    return 1;
+}
+
+//
+//  Deletes a file the way FatDeleteDirent does: marks its dirents deleted
+//  and drops its names from the index.  A file opened by its short name has
+//  no long name in its Fcb, so its Lfn entry is left behind as a stale hint.
+//
+
+static void
+StormDelete (
+    STORM *Storm,
+    uint32_t FileIndex,
+    int OpenedByShortName
+    )
+{
+    DIRECTORY *Directory = &Storm->Directory;
+    FILE_ENTRY *File = &Storm->Files[FileIndex];
+    uint8_t ShortName[11];
+    VBO Offset;
+    WCHAR UnicodeBuffer[MAX_LFN_CHARACTERS];
+    UNICODE_STRING Unicode;
+
+    memcpy( ShortName, Directory->Data + File->DirentOffset, 11 );
+
+    for (Offset = File->LfnOffset; Offset <= File->DirentOffset; Offset += DIRENT_SIZE) {
+        Directory->Data[Offset] = FAT_DIRENT_DELETED;
+    }
+
+    MakeUnicodeName( File->Name, UnicodeBuffer, &Unicode );
+
+    if (OpenedByShortName || (File->LfnOffset == File->DirentOffset)) {
+        Unicode.Length = 0;
+    }
+
+    FatRemoveDirentIndex( &IrpContext,
+                          &Directory->Dcb,
+                          File->DirentOffset,
+                          ShortName,
+                          &Unicode );
+
+    Storm->Files[FileIndex] = Storm->Files[--Storm->FileCount];
+}
+
+static void
+MakeName (
+    STORM *Storm,
+    uint32_t Serial,
+    char *Name,
+    size_t Size
+    )
+{
+    switch (Random64( &Storm->Random ) % 8) {
+    case 0:
+        snprintf( Name, Size, "%08X.TMP", Serial );
+        break;
+    case 1:
+        snprintf( Name, Size, "IMG_%05u.JPG", Serial );
+        break;
+    case 2:
+        snprintf( Name, Size, "Report %u (final draft, reviewed by the whole team).docx", Serial );
+        break;
+    case 3:
+        snprintf( Name, Size, "log.%u.txt", Serial );
+        break;
+    case 4:
+
+        //
+        //  Exactly 13 and 26 characters, so the Lfn has no terminator.
+        //
+
+        snprintf( Name, Size, (Serial & 1) ? "n%012u" : "nn%024u", Serial );
+        break;
+    case 5:
+        snprintf( Name, Size, "\xe9t\xe9_%u.txt", Serial );
+        break;
+    case 6:
+        snprintf( Name, Size, "Mx%u.c", Serial );
+        break;
+    default:
+        snprintf( Name, Size, "file_%06u.dat", Serial );
+        break;
+    }
+}
+
+static void
+RandomizeCase (
+    STORM *Storm,
+    char *Name
+    )
+{
+    for (; *Name; Name++) {
+
+        uint8_t c = (uint8_t)*Name;
+
+        if ((Random64( &Storm->Random ) & 1) == 0) {
+            continue;
+        }
+        if ((c >= 'a') && (c <= 'z')) {
+            *Name = (char)(c - 0x20);
+        } else if ((c >= 'A') && (c <= 'Z')) {
+            *Name = (char)(c + 0x20);
+        } else if ((c >= 0xc0) && (c <= 0xfe) && (c != 0xd7) && (c != 0xf7)) {
+            *Name = (char)(c ^ 0x20);
+        }
+    }
+}
+
+//
+//  Sets up an empty directory.  The index is only used while the Vcb is
+//  held, so a storm without it holds just the directory.
+//
+
+static int
+StormInitialize (
+    STORM *Storm,
+    uint32_t FileMax,
+    uint64_t Seed,
+    int UseIndex,
+    int Verify
+    )
+{
+    DIRECTORY *Directory = &Storm->Directory;
+
+    memset( Storm, 0, sizeof(*Storm) );
+
+    Directory->Dcb.Header.NodeTypeCode = FAT_NTC_DCB;
+    Directory->Dcb.Header.NodeByteSize = sizeof(DCB);
+    Directory->Dcb.Header.Resource = &Directory->DcbResource;
+    Directory->Dcb.Vcb = &Directory->Vcb;
+    Directory->DcbResource.SharedCount = 1;
+
+    if (UseIndex) {
+        Directory->Vcb.Resource.ExclusiveCount = 1;
+    }
+
+    Directory->Data = calloc( 1, MAX_DIRECTORY_SIZE );
+    Directory->Allocation = CLUSTER_SIZE;
+    Directory->Dcb.Header.AllocationSize.QuadPart = CLUSTER_SIZE;
+    Directory->UseIndex = UseIndex;
+    Storm->Files = calloc( FileMax, sizeof(FILE_ENTRY) );
+    Storm->FileMax = FileMax;
+    Storm->Random = Seed * 0x9E3779B97F4A7C15ull + 1;
+    Storm->Verify = Verify;
+
+    return (Directory->Data != NULL) && (Storm->Files != NULL);
+}
+
+static void
+StormCleanup (
+    STORM *Storm
+    )
+{
+    FatDiscardDirentIndex( &Storm->Directory.Dcb );
+    free( Storm->Directory.Data );
+    free( Storm->Files );
+}
+
+//
+//  Rebuilds the reference model from the directory itself, as for a
+//  directory loaded from a volume.
+//
+
+static void
+StormLoadModel (
+    STORM *Storm
+    )
+{
+    DIRECTORY *Directory = &Storm->Directory;
+    CCB MatchAll;
+    WCHAR LfnBuffer[MAX_LFN_CHARACTERS];
+    UNICODE_STRING Lfn;
+    VBO Offset = 0;
+    uint64_t Read = Directory->PagesRead;
+
+    memset( &MatchAll, 0, sizeof(MatchAll) );
+    MatchAll.Flags = CCB_FLAG_MATCH_ALL;
+
+    Lfn.Length = 0;
+    Lfn.MaximumLength = sizeof(LfnBuffer);
+    Lfn.Buffer = LfnBuffer;
+
+    Storm->FileCount = 0;
+
+    while (Storm->FileCount < Storm->FileMax) {
+
+        VBO ByteOffset = ScanDirectory( Directory, &MatchAll, Offset, &Lfn );
+        uint32_t LfnLength = Lfn.Length / sizeof(WCHAR);
+        FILE_ENTRY *File;
+        uint32_t i;
+
+        if (ByteOffset == NO_OFFSET) {
+            break;
+        }
+
+        File = &Storm->Files[Storm->FileCount++];
+        FormatShortName( Directory->Data + ByteOffset, File->ShortName );
+        File->DirentOffset = ByteOffset;
+        File->LfnOffset = ByteOffset - ((LfnLength + 12) / 13) * DIRENT_SIZE;
+
+        for (i = 0; (i < LfnLength) && (Lfn.Buffer[i] < 0x100); i++) {
+            File->Name[i] = (char)Lfn.Buffer[i];
+        }
+        File->Name[i] = 0;
+
+        if ((LfnLength == 0) || (i != LfnLength)) {
+            strcpy( File->Name, File->ShortName );
+        }
+
+        Offset = ByteOffset + DIRENT_SIZE;
+    }
+
+    FatFreeStringBuffer( &Lfn );
+    Directory->PagesRead = Read;
+}
+
+//
+//  Opens every file in the model by each of its names, checking that it is
+//  found where it is.
+//
+
+static int
+StormOpenAll (
+    STORM *Storm
+    )
+{
+    uint32_t i;
+    int Failures = 0;
+
+    for (i = 0; i < Storm->FileCount; i++) {
+
+        FILE_ENTRY *File = &Storm->Files[i];
+
+        if ((StormLocate( Storm, File->Name ) != File->DirentOffset) ||
+            (StormLocate( Storm, File->ShortName ) != File->DirentOffset)) {
+
+            fprintf( stderr, "open of \"%s\" (%s) failed\n", File->Name, File->ShortName );
+            Failures += 1;
+        }
+    }
+
+    return Failures;
+}
+
+typedef struct _STORM_RESULT {
+    double Seconds;
+    uint64_t Lookups;
+    uint64_t PagesRead;
+    uint64_t IndexBuilds;
+    uint64_t IndexDiscards;
+    uint64_t Mismatches;
+    uint64_t OpenFailures;
+    uint32_t Allocation;
+    uint32_t LiveFiles;
+} STORM_RESULT;
+
+//
+//  Creates Files files, deleting a random one after a create ChurnPercent of
+//  the time, then does Opens opens: mostly by long name in any case, some by
+//  short name and some of names that aren't there.
+//
+
+static int
+RunStorm (
+    uint32_t Files,
+    uint32_t Opens,
+    uint32_t ChurnPercent,
+    uint64_t Seed,
+    int UseIndex,
+    int Verify,
+    STORM_RESULT *Result
+    )
+{
+    STORM Storm;
+    char Name[MAX_LFN_CHARACTERS + 1];
+    double Start;
+    uint32_t i;
+
+    if (!StormInitialize( &Storm, Files + 1, Seed, UseIndex, Verify )) {
+        fprintf( stderr, "out of memory\n" );
+        return 0;
+    }
+
+    memset( Result, 0, sizeof(*Result) );
+    Start = Now();
+
+    for (i = 0; i < Files; i++) {
+
+        MakeName( &Storm, i, Name, sizeof(Name) );
+
+        if (!StormCreate( &Storm, Name )) {
+            fprintf( stderr, "create of \"%s\" failed\n", Name );
+            Result->OpenFailures += 1;
+            break;
+        }
+
+        if ((Storm.FileCount > 1) && ((Random64( &Storm.Random ) % 100) < ChurnPercent)) {
+            StormDelete( &Storm,
+                         (uint32_t)(Random64( &Storm.Random ) % Storm.FileCount),
+                         (int)(Random64( &Storm.Random ) & 1) );
+        }
+    }
+
+    for (i = 0; (i < Opens) && (Storm.FileCount != 0); i++) {
+
+        uint64_t Choice = Random64( &Storm.Random ) % 10;
+        FILE_ENTRY *File = &Storm.Files[Random64( &Storm.Random ) % Storm.FileCount];
+        VBO Expected = File->DirentOffset;
+
+        if (Choice == 0) {
+            snprintf( Name, sizeof(Name), "%s", File->ShortName );
+        } else if (Choice == 1) {
+            snprintf( Name, sizeof(Name), "missing %u.bin", i );
+            Expected = NO_OFFSET;
+        } else {
+            snprintf( Name, sizeof(Name), "%s", File->Name );
+            RandomizeCase( &Storm, Name );
+        }
+
+        if (StormLocate( &Storm, Name ) != Expected) {
+            fprintf( stderr, "open of \"%s\" failed\n", Name );
+            Result->OpenFailures += 1;
+        }
+    }
+
+    Result->Seconds = Now() - Start;
+    Result->Lookups = Storm.Directory.Lookups;
+    Result->PagesRead = Storm.Directory.PagesRead;
+    Result->IndexBuilds = Storm.Directory.IndexBuilds;
+    Result->IndexDiscards = Storm.Directory.IndexDiscards;
+    Result->Mismatches = Storm.Mismatches;
+    Result->Allocation = Storm.Directory.Allocation;
+    Result->LiveFiles = Storm.FileCount;
+
+    //
+    //  Finally reload the model from the directory and open everything once
+    //  more by both names.
+    //
+
+    if (Verify) {
+        StormLoadModel( &Storm );
+        Result->OpenFailures += (uint64_t)StormOpenAll( &Storm );
+        Result->Mismatches = Storm.Mismatches;
+    }
+
+    if (UseIndex && (SavePath != NULL)) {
+
+        FILE *File = fopen( SavePath, "wb" );
+
+        if ((File == NULL) ||
+            (fwrite( Storm.Directory.Data, 1, Storm.Directory.Allocation, File ) != Storm.Directory.Allocation)) {
+            perror( SavePath );
+        }
+        if (File != NULL) {
+            fclose( File );
+        }
+    }
+
+    StormCleanup( &Storm );
+    return 1;
+}
+
+static void
+PrintResult (
+    const char *Label,
+    const STORM_RESULT *Result
+    )
+{
+    printf( "%-8s %8llu lookups %8.2f pages/lookup %8.3fs  builds %llu discards %llu\n",
+            Label,
+            (unsigned long long)Result->Lookups,
+            Result->Lookups ? (double)Result->PagesRead / (double)Result->Lookups : 0.0,
+            Result->Seconds,
+            (unsigned long long)Result->IndexBuilds,
+            (unsigned long long)Result->IndexDiscards );
+}
+
+//
+//  Piles entries for one long name into the index.  Each incarnation of the
+//  name is deleted by its short name, which leaves its long name behind as
+//  a stale hint, and its dirents are taken by another file so that the next
+//  one lands elsewhere.  Up to FAT_DIRENT_INDEX_MAX_CANDIDATES entries are
+//  each checked against the disk; one more and the lookup scans instead.
+//
+
+static void
+CollisionTest (
+    void
+    )
+{
+    static const char Collider[] = "Collision test name.txt";
+    STORM Storm;
+    char Name[64];
+    uint64_t Pages;
+    VBO Offset;
+    uint32_t i;
+
+    CHECK( StormInitialize( &Storm, 4000, 6, 1, 1 ) );
+
+    for (i = 0; i < 3000; i++) {
+        snprintf( Name, sizeof(Name), "file_%06u.dat", i );
+        CHECK( StormCreate( &Storm, Name ) );
+    }
+
+    CHECK( StormLocate( &Storm, "file_000000.dat" ) == Storm.Files[0].DirentOffset );
+    CHECK( Storm.Directory.Dcb.Specific.Dcb.DirentIndex != NULL );
+
+    for (i = 0; i < FAT_DIRENT_INDEX_MAX_CANDIDATES; i++) {
+
+        CHECK( StormCreate( &Storm, Collider ) );
+        StormDelete( &Storm, Storm.FileCount - 1, 1 );
+
+        snprintf( Name, sizeof(Name), "Collision fill %04u.txt", i );
+        CHECK( strlen( Name ) == strlen( Collider ) );
+        CHECK( StormCreate( &Storm, Name ) );
+    }
+
+    //
+    //  The name is gone, and each of its stale entries is checked and
+    //  rejected.
+    //
+
+    Pages = Storm.Directory.PagesRead;
+    CHECK( StormLocate( &Storm, Collider ) == NO_OFFSET );
+    CHECK( Storm.Directory.PagesRead - Pages >= FAT_DIRENT_INDEX_MAX_CANDIDATES );
+    CHECK( Storm.Directory.PagesRead - Pages <= 2 * FAT_DIRENT_INDEX_MAX_CANDIDATES );
+
+    //
+    //  With the name created once more there are too many candidates, and
+    //  the lookup has to read the directory up to the name.
+    //
+
+    CHECK( StormCreate( &Storm, Collider ) );
+    Offset = Storm.Files[Storm.FileCount - 1].DirentOffset;
+    CHECK( Offset / PAGE_SIZE > 2 * FAT_DIRENT_INDEX_MAX_CANDIDATES );
+
+    Pages = Storm.Directory.PagesRead;
+    CHECK( StormLocate( &Storm, "COLLISION TEST NAME.TXT" ) == Offset );
+    CHECK( Storm.Directory.PagesRead - Pages > Offset / PAGE_SIZE );
+
+    printf( "collide  %u candidates checked, %llu pages scanned past them\n",
+            FAT_DIRENT_INDEX_MAX_CANDIDATES,
+            (unsigned long long)(Storm.Directory.PagesRead - Pages) );
+
+    //
+    //  A name deleted by its long name leaves nothing behind to check.
+    //
+
+    CHECK( StormCreate( &Storm, "Deleted long name.txt" ) );
+    StormDelete( &Storm, Storm.FileCount - 1, 0 );
+
+    Pages = Storm.Directory.PagesRead;
+    CHECK( StormLocate( &Storm, "Deleted long name.txt" ) == NO_OFFSET );
+    CHECK( Storm.Directory.PagesRead == Pages );
+
+    //
+    //  A directory written elsewhere may hold a short name twice.  The
+    //  lookup has to return the first, as a scan would.
+    //
+
+    Offset = AllocateDirents( &Storm.Directory, 1 );
+    CHECK( Offset != NO_OFFSET );
+    CHECK( Offset > Storm.Files[0].DirentOffset );
+    memcpy( Storm.Directory.Data + Offset,
+            Storm.Directory.Data + Storm.Files[0].DirentOffset,
+            DIRENT_SIZE );
+    FatInsertDirentIndex( &IrpContext,
+                          &Storm.Directory.Dcb,
+                          Offset,
+                          Offset,
+                          (PDIRENT)(Storm.Directory.Data + Offset),
+                          NULL );
+
+    CHECK( StormLocate( &Storm, Storm.Files[0].ShortName ) == Storm.Files[0].DirentOffset );
+
+    CHECK( Storm.Directory.Dcb.Specific.Dcb.DirentIndex != NULL );
+    CHECK( Storm.Mismatches == 0 );
+    CHECK( StormOpenAll( &Storm ) == 0 );
+    CHECK( Storm.Mismatches == 0 );
+
+    StormCleanup( &Storm );
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    STORM_RESULT Scan, Indexed;
+
+    //
+    //  A directory too small to be indexed.
+    //
+
+    CHECK( RunStorm( 300, 2000, 10, 1, 1, 1, &Indexed ) );
+    PrintResult( "small", &Indexed );
+    CHECK( Indexed.IndexBuilds == 0 );
+    CHECK( Indexed.Allocation < FAT_DIRENT_INDEX_MIN_SIZE );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.OpenFailures == 0 );
+
+    //
+    //  A create storm into a large directory with some deletes.  Every index
+    //  guided lookup must agree with a scan, and cost far less.
+    //
+
+    CHECK( RunStorm( 4000, 10000, 20, 2, 0, 0, &Scan ) );
+    PrintResult( "scan", &Scan );
+    CHECK( RunStorm( 4000, 10000, 20, 2, 1, 1, &Indexed ) );
+    PrintResult( "indexed", &Indexed );
+    CHECK( Indexed.IndexBuilds >= 1 );
+    CHECK( Indexed.Allocation >= FAT_DIRENT_INDEX_MIN_SIZE );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.OpenFailures == 0 );
+    CHECK( Scan.IndexBuilds == 0 );
+    CHECK( Scan.OpenFailures == 0 );
+    CHECK( Indexed.PagesRead * 5 < Scan.PagesRead );
+
+    //
+    //  Heavy churn leaves stale Lfn hints behind until the entry limit has
+    //  the index rebuilt.
+    //
+
+    CHECK( RunStorm( 12000, 5000, 90, 3, 1, 1, &Indexed ) );
+    PrintResult( "churn", &Indexed );
+    CHECK( Indexed.IndexDiscards >= 1 );
+    CHECK( Indexed.IndexBuilds >= 2 );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.OpenFailures == 0 );
+
+    //
+    //  Many entries for one name: lookups have to sift the candidates, and
+    //  scan when there are too many.
+    //
+
+    CollisionTest();
+
+    //
+    //  Other directories' indexes have nearly used up the pool the indexes
+    //  may have: builds and inserts fail and lookups scan instead.
+    //
+
+    FatData.DirentIndexPoolUsage = FAT_DIRENT_INDEX_POOL_LIMIT - 32 * 1024;
+    CHECK( RunStorm( 4000, 5000, 20, 5, 1, 1, &Indexed ) );
+    CHECK( FatData.DirentIndexPoolUsage == FAT_DIRENT_INDEX_POOL_LIMIT - 32 * 1024 );
+    FatData.DirentIndexPoolUsage = 0;
+    PrintResult( "limit", &Indexed );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.OpenFailures == 0 );
+
+    //
+    //  Pool allocations fail at random.
+    //
+
+    PoolFailPercent = 5;
+    CHECK( RunStorm( 4000, 5000, 20, 7, 1, 1, &Indexed ) );
+    PoolFailPercent = 0;
+    PrintResult( "nopool", &Indexed );
+    CHECK( Indexed.Mismatches == 0 );
+    CHECK( Indexed.OpenFailures == 0 );
+
+    CHECK( FatData.DirentIndexPoolUsage == 0 );
+    CHECK( PoolOutstanding == 0 );
+    CHECK( PinCount == 0 );
+
+    printf( "%s\n", Failures ? "FAILED" : "passed" );
+    return Failures ? 1 : 0;
+}
+
+static int
+ReplayLoaded (
+    const char *Path
+    )
+{
+    STORM Storm;
+    FILE *File;
+    size_t Length;
+    double Start;
+    int OpenFailures;
+    STORM_RESULT Result[2];
+    int UseIndex;
+
+    for (UseIndex = 0; UseIndex < 2; UseIndex++) {
+
+        if (!StormInitialize( &Storm, MAX_DIRECTORY_SIZE / DIRENT_SIZE, 1, UseIndex, 0 )) {
+            return 1;
+        }
+
+        File = fopen( Path, "rb" );
+        if (File == NULL) {
+            perror( Path );
+            return 1;
+        }
+        Length = fread( Storm.Directory.Data, 1, MAX_DIRECTORY_SIZE, File );
+        fclose( File );
+
+        Storm.Directory.Allocation = (uint32_t)(Length & ~(size_t)(PAGE_SIZE - 1));
+        Storm.Directory.Dcb.Header.AllocationSize.QuadPart = Storm.Directory.Allocation;
+        StormLoadModel( &Storm );
+
+        Start = Now();
+        OpenFailures = StormOpenAll( &Storm );
+
+        memset( &Result[UseIndex], 0, sizeof(Result[UseIndex]) );
+        Result[UseIndex].Seconds = Now() - Start;
+        Result[UseIndex].Lookups = Storm.Directory.Lookups;
+        Result[UseIndex].PagesRead = Storm.Directory.PagesRead;
+        Result[UseIndex].IndexBuilds = Storm.Directory.IndexBuilds;
+        Result[UseIndex].OpenFailures = (uint64_t)OpenFailures;
+
+        //
+        //  Then check the index against a scan, outside of the timing.
+        //
+
+        if (UseIndex) {
+            Storm.Verify = 1;
+            StormOpenAll( &Storm );
+            Result[UseIndex].Mismatches = Storm.Mismatches;
+        }
+
+        printf( "%u files in %u bytes of directory\n", Storm.FileCount, Storm.Directory.Allocation );
+        StormCleanup( &Storm );
+    }
+
+    PrintResult( "scan", &Result[0] );
+    PrintResult( "indexed", &Result[1] );
+
+    return (Result[0].OpenFailures || Result[1].OpenFailures || Result[1].Mismatches) ? 1 : 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    uint32_t Files = 10000;
+    uint32_t Opens = 50000;
+    uint32_t Churn = 10;
+    uint64_t Seed = 1;
+    STORM_RESULT Scan, Indexed;
+    uint8_t Base;
+    int i;
+
+    StackBase = &Base;
+    FatData.ChicagoMode = TRUE;
+    IrpContext.Flags = IRP_CONTEXT_FLAG_WAIT;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--files" ) == 0) && (i + 1 < argc)) {
+            Files = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--opens" ) == 0) && (i + 1 < argc)) {
+            Opens = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--churn" ) == 0) && (i + 1 < argc)) {
+            Churn = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--seed" ) == 0) && (i + 1 < argc)) {
+            Seed = strtoull( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--load" ) == 0) && (i + 1 < argc)) {
+            return ReplayLoaded( argv[++i] );
+        } else if ((strcmp( argv[i], "--save" ) == 0) && (i + 1 < argc)) {
+            SavePath = argv[++i];
+        } else {
+            fprintf( stderr,
+                     "usage: dirstorm --selftest\n"
+                     "       dirstorm [--files n] [--opens n] [--churn pct] [--seed n]\n"
+                     "                [--load dir.bin] [--save dir.bin]\n" );
+            return 2;
+        }
+    }
+
+    if (Churn > 100) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    printf( "%u creates, %u%% churn, %u opens, seed %llu\n",
+            Files, Churn, Opens, (unsigned long long)Seed );
+
+    if (!RunStorm( Files, Opens, Churn, Seed, 0, 0, &Scan ) ||
+        !RunStorm( Files, Opens, Churn, Seed, 1, 0, &Indexed )) {
+        return 1;
+    }
+
+    PrintResult( "scan", &Scan );
+    PrintResult( "indexed", &Indexed );
+    printf( "%u files in %u bytes of directory, %.1fx fewer pages mapped, %.2fx faster\n",
+            Indexed.LiveFiles,
+            Indexed.Allocation,
+            (double)Scan.PagesRead / (double)(Indexed.PagesRead ? Indexed.PagesRead : 1),
+            Scan.Seconds / Indexed.Seconds );
+
+    return (Scan.OpenFailures || Indexed.OpenFailures) ? 1 : 0;
+}
@@ -0,0 +1,1106 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    FatChain.c
+
+Abstract:
+
+    Host harness for the cluster chain walk in FatLookupFileAllocation.
+    Builds a Fat32 or Fat16 volume with one file laid out contiguously,
+    aged (short runs a little apart, as a well used volume leaves them) or
+    scattered over the volume, then looks up its allocation on a cold cache
+    and counts the reads of Fat pages the walk waits for, with and without
+    the windowed prefetch of FAT_CHAIN_PREFETCH_PAGE_COUNT pages.
+
+    The walk is the driver's own: ../allocsup.c is built unchanged against
+    the kernel stand-ins in kernel/.  This program supplies what the walk
+    calls: the volume file, through FatReadVolumeFile and FatPrefetchPages,
+    and the Mcb routines.  The volume file keeps track of which Fat pages
+    are resident.  A pin of a page that isn't is one synchronous read; a
+    prefetch reads the pages it asks for that aren't, in one request.
+
+    usage: fatchain --selftest
+           fatchain [--clusters n] [--file-mb n] [--fat16] [--seed n]
+                    [--latency-us n] [--page-us n]
+
+    The time reported is a model, not a measurement: each request costs
+    --latency-us and each page it reads --page-us more.
+
+Environment:
+
+    Host (user mode), C11 with -fms-extensions.
+
+--*/
+
+#include "FatProcs.h"
+
+#include <setjmp.h>
+
+#define SECTOR_SIZE                      (512)
+#define RESERVED_SECTORS                 (32)
+#define CLUSTER_SHIFT                    (12)
+#define CLUSTER_SIZE                     (1 << CLUSTER_SHIFT)
+
+#define FAT32_LAST_CLUSTER               (0x0fffffff)
+#define FAT16_LAST_CLUSTER               (0xffff)
+
+//
+//  The layouts a file's clusters can have.
+//
+
+typedef enum _LAYOUT {
+    LayoutContiguous,
+    LayoutAged,
+    LayoutScattered,
+    LayoutCount
+} LAYOUT;
+
+static const char *LayoutNames[LayoutCount] = { "contig", "aged", "scatter" };
+
+//
+//  A volume with one file on it, and what reading its Fat has cost.
+//
+
+typedef struct _VOLUME {
+    VCB Vcb;
+    FCB Fcb;
+    FILE_OBJECT VolumeFile;
+
+    uint8_t *Image;
+    uint32_t ImageSize;
+    uint32_t FatPages;
+    uint8_t *Resident;
+    uint8_t *Used;
+
+    uint32_t *Chain;
+    uint32_t ChainLength;
+
+    int Prefetch;
+    uint64_t SyncReads;
+    uint64_t PrefetchCalls;
+    uint64_t PrefetchRequests;
+    uint64_t PagesRead;
+} VOLUME;
+
+//
+//  A file's Mcb, a sorted array of runs in bytes.  The LARGE_MCB in the Fcb
+//  points to it.
+//
+
+typedef struct _HOST_RUN {
+    VBO Vbo;
+    LBO Lbo;
+    ULONG ByteCount;
+} HOST_RUN;
+
+typedef struct _HOST_MCB {
+    HOST_RUN *Runs;
+    ULONG RunCount;
+    ULONG RunMax;
+} HOST_MCB;
+
+typedef struct _WALK_RESULT {
+    uint64_t SyncReads;
+    uint64_t PrefetchRequests;
+    uint64_t PagesRead;
+    uint32_t Runs;
+} WALK_RESULT;
+
+FAT_DATA FatData;
+
+static IRP_CONTEXT IrpContext;
+static IRP OriginatingIrp;
+static VOLUME *CurrentVolume;
+static long PinCount;
+static uint32_t LatencyUs = 100;
+static uint32_t PageUs = 10;
+
+static jmp_buf *RaiseTarget;
+static NTSTATUS RaisedStatus;
+
+static int Failures;
+
+#define CHECK(Condition)                                                    \
+    do {                                                                    \
+        if (!(Condition)) {                                                 \
+            fprintf( stderr, "%s:%d: check failed: %s\n",                   \
+                     __FILE__, __LINE__, #Condition );                      \
+            Failures += 1;                                                  \
+        }                                                                   \
+    } while (0)
+
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+
+//
+//  The kernel and Fat routines the allocation code calls.  A raise ends the
+//  run unless a test is waiting for it, and then it unwinds straight there:
+//  nothing in the walk's finally clause runs, so the test drops the pin the
+//  walk was holding.
+//
+
+VOID
+HostAssert (
+    int Condition,
+    const char *Text,
+    const char *File,
+    int Line
+    )
+{
+    if (!Condition) {
+        fprintf( stderr, "%s:%d: assertion failed: %s\n", File, Line, Text );
+        abort();
+    }
+}
+
+VOID
+ExRaiseStatus (
+    NTSTATUS Status
+    )
+{
+    if (RaiseTarget != NULL) {
+        RaisedStatus = Status;
+        longjmp( *RaiseTarget, 1 );
+    }
+
+    fprintf( stderr, "raised status %08x\n", (unsigned)Status );
+    abort();
+}
+
+VOID
+KeBugCheckEx (
+    ULONG BugCheckCode,
+    ULONG_PTR P1,
+    ULONG_PTR P2,
+    ULONG_PTR P3,
+    ULONG_PTR P4
+    )
+{
+    fprintf( stderr, "bug check %x (%lx, %lx, %lx, %lx)\n", (unsigned)BugCheckCode,
+             (unsigned long)P1, (unsigned long)P2, (unsigned long)P3, (unsigned long)P4 );
+    abort();
+}
+
+VOID
+FatPopUpFileCorrupt (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Fcb );
+}
+
+VOID
+ExFreePool (
+    PVOID P
+    )
+{
+    free( P );
+}
+
+//
+//  DirSup.c's, which this program doesn't build.
+//
+
+VOID
+FatGetDirentFromFcbOrDcb (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB FcbOrDcb,
+    IN BOOLEAN ReturnOnFailure,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( FcbOrDcb );
+    UNREFERENCED_PARAMETER( ReturnOnFailure );
+    UNREFERENCED_PARAMETER( Dirent );
+    UNREFERENCED_PARAMETER( Bcb );
+    fprintf( stderr, "FatGetDirentFromFcbOrDcb: not supported on the host\n" );
+    abort();
+}
+
+//
+//  The volume file.  Only the reserved sectors and the first Fat are
+//  backed, which is all the walk reads.
+//
+
+VOID
+FatReadVolumeFile (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb,
+    IN VBO StartingVbo,
+    IN ULONG ByteCount,
+    OUT PBCB *Bcb,
+    OUT PVOID *Buffer
+    )
+{
+    VOLUME *Volume = CurrentVolume;
+    uint32_t Page;
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    HostAssert( Vcb == &Volume->Vcb, "Vcb == &Volume->Vcb", __FILE__, __LINE__ );
+    HostAssert( (uint64_t)StartingVbo + ByteCount <= Volume->ImageSize,
+                "read within the Fat", __FILE__, __LINE__ );
+
+    for (Page = StartingVbo / PAGE_SIZE;
+         Page < (StartingVbo + ByteCount + PAGE_SIZE - 1) / PAGE_SIZE;
+         Page += 1) {
+
+        if (!Volume->Resident[Page]) {
+            Volume->Resident[Page] = 1;
+            Volume->SyncReads += 1;
+            Volume->PagesRead += 1;
+        }
+    }
+
+    PinCount += 1;
+    *Bcb = Volume;
+    *Buffer = Volume->Image + StartingVbo;
+}
+
+VOID
+CcUnpinData (
+    PVOID Bcb
+    )
+{
+    HostAssert( Bcb == CurrentVolume, "Bcb == CurrentVolume", __FILE__, __LINE__ );
+    PinCount -= 1;
+}
+
+NTSTATUS
+FatPrefetchPages (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFILE_OBJECT FileObject,
+    IN ULONG StartingPage,
+    IN ULONG PageCount
+    )
+{
+    VOLUME *Volume = CurrentVolume;
+    int Reading = 0;
+    uint32_t Page;
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    HostAssert( FileObject == &Volume->VolumeFile, "FileObject is the volume file", __FILE__, __LINE__ );
+    HostAssert( (uint64_t)StartingPage + PageCount <= Volume->FatPages,
+                "prefetch within the Fat", __FILE__, __LINE__ );
+
+    Volume->PrefetchCalls += 1;
+
+    if (!Volume->Prefetch) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    //  Each run of pages that aren't resident is one read.
+    //
+
+    for (Page = StartingPage; Page < StartingPage + PageCount; Page += 1) {
+
+        if (!Volume->Resident[Page]) {
+            if (!Reading) {
+                Volume->PrefetchRequests += 1;
+            }
+            Volume->Resident[Page] = 1;
+            Volume->PagesRead += 1;
+            Reading = 1;
+        } else {
+            Reading = 0;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+//  The Mcb routines, in the bytes the Fat code deals in rather than the
+//  sectors of FsCtrl.c's.
+//
+
+static HOST_MCB *
+HostMcb (
+    PLARGE_MCB Mcb
+    )
+{
+    return (HOST_MCB *)Mcb->Opaque[0];
+}
+
+BOOLEAN
+FatAddMcbEntry (
+    IN PVCB Vcb,
+    IN PLARGE_MCB Mcb,
+    IN VBO Vbo,
+    IN LBO Lbo,
+    IN ULONG SectorCount
+    )
+{
+    HOST_MCB *HostMcb_ = HostMcb( Mcb );
+    HOST_RUN *Last;
+
+    UNREFERENCED_PARAMETER( Vcb );
+
+    NT_ASSERT( SectorCount != 0 );
+
+    if (HostMcb_->RunCount != 0) {
+
+        Last = &HostMcb_->Runs[HostMcb_->RunCount - 1];
+
+        //
+        //  The walk only ever adds past the end.
+        //
+
+        NT_ASSERT( Vbo == Last->Vbo + Last->ByteCount );
+
+        if (Lbo == Last->Lbo + Last->ByteCount) {
+            Last->ByteCount += SectorCount;
+            return TRUE;
+        }
+    }
+
+    if (HostMcb_->RunCount == HostMcb_->RunMax) {
+
+        HostMcb_->RunMax = HostMcb_->RunMax ? HostMcb_->RunMax * 2 : 64;
+        HostMcb_->Runs = realloc( HostMcb_->Runs, HostMcb_->RunMax * sizeof(HOST_RUN) );
+
+        if (HostMcb_->Runs == NULL) {
+            fprintf( stderr, "out of memory\n" );
+            abort();
+        }
+    }
+
+    HostMcb_->Runs[HostMcb_->RunCount].Vbo = Vbo;
+    HostMcb_->Runs[HostMcb_->RunCount].Lbo = Lbo;
+    HostMcb_->Runs[HostMcb_->RunCount].ByteCount = SectorCount;
+    HostMcb_->RunCount += 1;
+
+    return TRUE;
+}
+
+BOOLEAN
+FatLookupMcbEntry (
+    IN PVCB Vcb,
+    IN PLARGE_MCB Mcb,
+    IN VBO Vbo,
+    OUT PLBO Lbo,
+    OUT PULONG SectorCount OPTIONAL,
+    OUT PULONG Index OPTIONAL
+    )
+{
+    HOST_MCB *HostMcb_ = HostMcb( Mcb );
+    ULONG Low = 0;
+    ULONG High = HostMcb_->RunCount;
+
+    UNREFERENCED_PARAMETER( Vcb );
+
+    while (Low < High) {
+
+        ULONG Middle = (Low + High) / 2;
+        HOST_RUN *Run = &HostMcb_->Runs[Middle];
+
+        if (Vbo < Run->Vbo) {
+            High = Middle;
+        } else if (Vbo - Run->Vbo >= Run->ByteCount) {
+            Low = Middle + 1;
+        } else {
+
+            *Lbo = Run->Lbo + (Vbo - Run->Vbo);
+
+            if (ARGUMENT_PRESENT( SectorCount )) {
+                *SectorCount = Run->ByteCount - (Vbo - Run->Vbo);
+            }
+            if (ARGUMENT_PRESENT( Index )) {
+                *Index = Middle;
+            }
+            return TRUE;
+        }
+    }
+
+    *Lbo = 0;
+
+    if (ARGUMENT_PRESENT( SectorCount )) {
+        *SectorCount = 0;
+    }
+
+    return FALSE;
+}
+
+BOOLEAN
+FatLookupLastMcbEntry (
+    IN PVCB Vcb,
+    IN PLARGE_MCB Mcb,
+    OUT PVBO Vbo,
+    OUT PLBO Lbo,
+    OUT PULONG Index
+    )
+{
+    HOST_MCB *HostMcb_ = HostMcb( Mcb );
+    HOST_RUN *Last;
+
+    UNREFERENCED_PARAMETER( Vcb );
+
+    if (HostMcb_->RunCount == 0) {
+        return FALSE;
+    }
+
+    Last = &HostMcb_->Runs[HostMcb_->RunCount - 1];
+
+    *Vbo = Last->Vbo + Last->ByteCount - 1;
+    *Lbo = Last->Lbo + Last->ByteCount - 1;
+
+    if (Index != NULL) {
+        *Index = HostMcb_->RunCount - 1;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+FatGetNextMcbEntry (
+    IN PVCB Vcb,
+    IN PLARGE_MCB Mcb,
+    IN ULONG RunIndex,
+    OUT PVBO Vbo,
+    OUT PLBO Lbo,
+    OUT PULONG SectorCount
+    )
+{
+    HOST_MCB *HostMcb_ = HostMcb( Mcb );
+
+    UNREFERENCED_PARAMETER( Vcb );
+
+    if (RunIndex >= HostMcb_->RunCount) {
+        return FALSE;
+    }
+
+    *Vbo = HostMcb_->Runs[RunIndex].Vbo;
+    *Lbo = HostMcb_->Runs[RunIndex].Lbo;
+    *SectorCount = HostMcb_->Runs[RunIndex].ByteCount;
+
+    return TRUE;
+}
+
+VOID
+FatRemoveMcbEntry (
+    IN PVCB Vcb,
+    IN PLARGE_MCB Mcb,
+    IN VBO Vbo,
+    IN ULONG SectorCount
+    )
+{
+    UNREFERENCED_PARAMETER( Vcb );
+    UNREFERENCED_PARAMETER( Mcb );
+    UNREFERENCED_PARAMETER( Vbo );
+    UNREFERENCED_PARAMETER( SectorCount );
+    fprintf( stderr, "FatRemoveMcbEntry: not supported on the host\n" );
+    abort();
+}
+
+static void
+ResetMcb (
+    VOLUME *Volume
+    )
+{
+    HostMcb( &Volume->Fcb.Mcb )->RunCount = 0;
+}
+
+
+//
+//  Volumes.
+//
+
+static void
+SetFatEntry (
+    VOLUME *Volume,
+    uint32_t Index,
+    uint32_t Entry
+    )
+{
+    uint8_t *Fat = Volume->Image + FatReservedBytes( &Volume->Vcb.Bpb );
+
+    if (Volume->Vcb.AllocationSupport.FatIndexBitSize == 32) {
+        ((uint32_t *)Fat)[Index] = Entry;
+    } else {
+        ((uint16_t *)Fat)[Index] = (uint16_t)Entry;
+    }
+}
+
+static uint32_t
+ClusterCount (
+    VOLUME *Volume
+    )
+{
+    return Volume->Vcb.AllocationSupport.NumberOfClusters;
+}
+
+//
+//  Takes the first free cluster at or after Cluster, wrapping around.
+//
+
+static uint32_t
+TakeCluster (
+    VOLUME *Volume,
+    uint32_t Cluster
+    )
+{
+    uint32_t Clusters = ClusterCount( Volume );
+
+    Cluster = 2 + (Cluster - 2) % Clusters;
+
+    while (Volume->Used[Cluster - 2]) {
+        Cluster = (Cluster - 2 + 1) % Clusters + 2;
+    }
+
+    Volume->Used[Cluster - 2] = 1;
+    return Cluster;
+}
+
+static void
+LayOutFile (
+    VOLUME *Volume,
+    LAYOUT Layout,
+    uint32_t Length,
+    uint64_t *Random
+    )
+{
+    uint32_t Clusters = ClusterCount( Volume );
+    uint32_t Last = FAT32_LAST_CLUSTER;
+    uint32_t Next;
+    uint32_t Run = 0;
+    uint32_t i;
+
+    memset( Volume->Used, 0, Clusters );
+
+    if (Volume->Vcb.AllocationSupport.FatIndexBitSize == 16) {
+        Last = FAT16_LAST_CLUSTER;
+    }
+
+    Next = 2 + (uint32_t)(Random64( Random ) % Clusters);
+
+    for (i = 0; i < Length; i++) {
+
+        switch (Layout) {
+
+        case LayoutContiguous:
+            break;
+
+        case LayoutAged:
+
+            //
+            //  Runs of 1 to 31 clusters, each up to 512 clusters past the
+            //  last.
+            //
+
+            if (Run == 0) {
+                Run = 1 + (uint32_t)(Random64( Random ) % 31);
+                Next += (uint32_t)(Random64( Random ) % 512);
+            }
+            Run -= 1;
+            break;
+
+        default:
+            Next = 2 + (uint32_t)(Random64( Random ) % Clusters);
+            break;
+        }
+
+        Volume->Chain[i] = TakeCluster( Volume, Next );
+        Next = Volume->Chain[i] + 1;
+    }
+
+    for (i = 0; i + 1 < Length; i++) {
+        SetFatEntry( Volume, Volume->Chain[i], Volume->Chain[i + 1] );
+    }
+    SetFatEntry( Volume, Volume->Chain[Length - 1], Last );
+
+    Volume->ChainLength = Length;
+}
+
+//
+//  Sets up a Fat32 volume, or a Fat16 one, of Clusters 4k clusters, and an
+//  Fcb for the one file on it.
+//
+
+static int
+VolumeInitialize (
+    VOLUME *Volume,
+    uint32_t Clusters,
+    int Fat16
+    )
+{
+    PBIOS_PARAMETER_BLOCK Bpb = &Volume->Vcb.Bpb;
+    uint32_t FatBytes;
+
+    memset( Volume, 0, sizeof(*Volume) );
+
+    //
+    //  Fat16 entries from 0xfff0 up are reserved.
+    //
+
+    if (Fat16) {
+        Clusters = (Clusters < 0xfff0 - 2) ? Clusters : 0xfff0 - 2;
+        FatBytes = (Clusters + 2) * sizeof(USHORT);
+    } else {
+        FatBytes = (Clusters + 2) * sizeof(ULONG);
+    }
+    FatBytes = (FatBytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    Bpb->BytesPerSector = SECTOR_SIZE;
+    Bpb->SectorsPerCluster = CLUSTER_SIZE / SECTOR_SIZE;
+    Bpb->ReservedSectors = RESERVED_SECTORS;
+    Bpb->Fats = 2;
+
+    if (Fat16) {
+        Bpb->SectorsPerFat = (USHORT)(FatBytes / SECTOR_SIZE);
+    } else {
+        Bpb->SectorsPerFat = 0;
+        Bpb->LargeSectorsPerFat = FatBytes / SECTOR_SIZE;
+    }
+
+    NT_ASSERT( !IsBpbFat32( Bpb ) == !!Fat16 );
+    NT_ASSERT( FatBytesPerFat( Bpb ) == FatBytes );
+
+    Volume->Vcb.VolumeFileHeader.NodeTypeCode = FAT_NTC_VCB;
+    Volume->Vcb.AllocationSupport.FatIndexBitSize = Fat16 ? 16 : 32;
+    Volume->Vcb.AllocationSupport.LogOfBytesPerSector = 9;
+    Volume->Vcb.AllocationSupport.LogOfBytesPerCluster = CLUSTER_SHIFT;
+    Volume->Vcb.AllocationSupport.NumberOfClusters = Clusters;
+    Volume->Vcb.AllocationSupport.FileAreaLbo = FatReservedBytes( Bpb ) + 2 * FatBytes;
+    Volume->Vcb.VirtualVolumeFile = &Volume->VolumeFile;
+
+    Volume->ImageSize = FatReservedBytes( Bpb ) + FatBytes;
+    Volume->FatPages = Volume->ImageSize / PAGE_SIZE;
+    Volume->Image = calloc( Volume->ImageSize, 1 );
+    Volume->Resident = calloc( Volume->FatPages, 1 );
+    Volume->Used = calloc( Clusters, 1 );
+    Volume->Chain = calloc( Clusters, sizeof(uint32_t) );
+
+    Volume->Fcb.Header.NodeTypeCode = FAT_NTC_FCB;
+    Volume->Fcb.Vcb = &Volume->Vcb;
+    Volume->Fcb.Mcb.Opaque[0] = (ULONG_PTR)calloc( 1, sizeof(HOST_MCB) );
+
+    CurrentVolume = Volume;
+
+    return (Volume->Image != NULL) && (Volume->Resident != NULL) &&
+           (Volume->Used != NULL) && (Volume->Chain != NULL) &&
+           (Volume->Fcb.Mcb.Opaque[0] != 0);
+}
+
+static void
+VolumeCleanup (
+    VOLUME *Volume
+    )
+{
+    HOST_MCB *Mcb = HostMcb( &Volume->Fcb.Mcb );
+
+    if (Mcb != NULL) {
+        free( Mcb->Runs );
+        free( Mcb );
+    }
+    free( Volume->Image );
+    free( Volume->Resident );
+    free( Volume->Used );
+    free( Volume->Chain );
+    CurrentVolume = NULL;
+}
+
+static LBO
+ClusterLbo (
+    VOLUME *Volume,
+    uint32_t Cluster
+    )
+{
+    return FatGetLboFromIndex( &Volume->Vcb, Cluster );
+}
+
+//
+//  Opens the file on a cold cache: throws away its Mcb and the resident Fat
+//  pages and has FatLookupFileAllocationSize walk the whole chain, as
+//  Create does.
+//
+
+static void
+OpenFile (
+    VOLUME *Volume,
+    int Prefetch,
+    WALK_RESULT *Result
+    )
+{
+    ResetMcb( Volume );
+    memset( Volume->Resident, 0, Volume->FatPages );
+
+    Volume->Prefetch = Prefetch;
+    Volume->SyncReads = 0;
+    Volume->PrefetchCalls = 0;
+    Volume->PrefetchRequests = 0;
+    Volume->PagesRead = 0;
+
+    Volume->Fcb.FirstClusterOfFile = Volume->Chain[0];
+    Volume->Fcb.Header.AllocationSize.QuadPart = MAXULONG;
+    Volume->Fcb.Header.FileSize.QuadPart = (LONGLONG)Volume->ChainLength << CLUSTER_SHIFT;
+
+    FatLookupFileAllocationSize( &IrpContext, &Volume->Fcb );
+
+    Result->SyncReads = Volume->SyncReads;
+    Result->PrefetchRequests = Volume->PrefetchRequests;
+    Result->PagesRead = Volume->PagesRead;
+    Result->Runs = HostMcb( &Volume->Fcb.Mcb )->RunCount;
+}
+
+//
+//  Checks the Mcb against the chain as far as the Mcb goes.
+//
+
+static void
+CheckMcb (
+    VOLUME *Volume
+    )
+{
+    HOST_MCB *Mcb = HostMcb( &Volume->Fcb.Mcb );
+    uint32_t Cluster = 0;
+    ULONG i;
+
+    for (i = 0; i < Mcb->RunCount; i++) {
+
+        HOST_RUN *Run = &Mcb->Runs[i];
+        uint32_t j;
+
+        CHECK( Run->Vbo == Cluster << CLUSTER_SHIFT );
+        CHECK( (Run->ByteCount & (CLUSTER_SIZE - 1)) == 0 );
+
+        for (j = 0; j < Run->ByteCount >> CLUSTER_SHIFT; j++, Cluster++) {
+            if ((Cluster >= Volume->ChainLength) ||
+                (Run->Lbo + ((LBO)j << CLUSTER_SHIFT) != ClusterLbo( Volume, Volume->Chain[Cluster] ))) {
+                CHECK( !"Mcb run matches the chain" );
+                return;
+            }
+        }
+
+        //
+        //  Runs are maximal.
+        //
+
+        if ((i + 1 < Mcb->RunCount) && (Cluster < Volume->ChainLength)) {
+            CHECK( Volume->Chain[Cluster] != Volume->Chain[Cluster - 1] + 1 );
+        }
+    }
+}
+
+static void
+CheckLookups (
+    VOLUME *Volume,
+    uint64_t *Random,
+    uint32_t Count
+    )
+{
+    uint32_t i;
+
+    for (i = 0; i < Count; i++) {
+
+        VBO Vbo = (VBO)(Random64( Random ) % ((uint64_t)Volume->ChainLength << CLUSTER_SHIFT));
+        uint32_t Cluster = Vbo >> CLUSTER_SHIFT;
+        uint32_t RunEnd = Cluster + 1;
+        LBO Lbo;
+        ULONG ByteCount;
+        BOOLEAN Allocated, EndOnMax;
+
+        while ((RunEnd < Volume->ChainLength) &&
+               (Volume->Chain[RunEnd] == Volume->Chain[RunEnd - 1] + 1)) {
+            RunEnd += 1;
+        }
+
+        FatLookupFileAllocation( &IrpContext, &Volume->Fcb, Vbo, &Lbo, &ByteCount, &Allocated, &EndOnMax, NULL );
+
+        CHECK( Allocated );
+        CHECK( !EndOnMax );
+        CHECK( Lbo == ClusterLbo( Volume, Volume->Chain[Cluster] ) + (Vbo & (CLUSTER_SIZE - 1)) );
+        CHECK( ByteCount == ((RunEnd << CLUSTER_SHIFT) - Vbo) );
+    }
+}
+
+//
+//  Looks up one Vbo with nothing in the Mcb: the walk has to stop at the end
+//  of the run holding it.
+//
+
+static void
+CheckPartialWalk (
+    VOLUME *Volume,
+    VBO Vbo
+    )
+{
+    HOST_MCB *Mcb = HostMcb( &Volume->Fcb.Mcb );
+    uint32_t RunEnd = (Vbo >> CLUSTER_SHIFT) + 1;
+    LBO Lbo;
+    ULONG ByteCount;
+    BOOLEAN Allocated, EndOnMax;
+
+    while ((RunEnd < Volume->ChainLength) &&
+           (Volume->Chain[RunEnd] == Volume->Chain[RunEnd - 1] + 1)) {
+        RunEnd += 1;
+    }
+
+    ResetMcb( Volume );
+    Volume->Fcb.Header.AllocationSize.QuadPart = (LONGLONG)Volume->ChainLength << CLUSTER_SHIFT;
+
+    FatLookupFileAllocation( &IrpContext, &Volume->Fcb, Vbo, &Lbo, &ByteCount, &Allocated, &EndOnMax, NULL );
+
+    CHECK( Allocated );
+    CHECK( Lbo == ClusterLbo( Volume, Volume->Chain[Vbo >> CLUSTER_SHIFT] ) + (Vbo & (CLUSTER_SIZE - 1)) );
+    CHECK( Mcb->RunCount != 0 );
+    CHECK( Mcb->Runs[Mcb->RunCount - 1].Vbo + Mcb->Runs[Mcb->RunCount - 1].ByteCount == RunEnd << CLUSTER_SHIFT );
+    CheckMcb( Volume );
+}
+
+//
+//  Corrupts the chain and expects the walk to raise, having read nothing
+//  outside the Fat on the way.
+//
+
+static void
+CheckCorruptChain (
+    VOLUME *Volume,
+    uint32_t Entry
+    )
+{
+    jmp_buf Target;
+
+    ResetMcb( Volume );
+    SetFatEntry( Volume, Volume->Chain[Volume->ChainLength / 2], Entry );
+
+    Volume->Fcb.Header.AllocationSize.QuadPart = MAXULONG;
+    RaisedStatus = STATUS_SUCCESS;
+    RaiseTarget = &Target;
+
+    if (setjmp( Target ) == 0) {
+        FatLookupFileAllocationSize( &IrpContext, &Volume->Fcb );
+    }
+
+    RaiseTarget = NULL;
+    CHECK( RaisedStatus == STATUS_FILE_CORRUPT_ERROR );
+
+    //
+    //  The finally clause that would have unpinned the page never ran.
+    //
+
+    CHECK( PinCount == 1 );
+    PinCount = 0;
+
+    SetFatEntry( Volume, Volume->Chain[Volume->ChainLength / 2], Volume->Chain[Volume->ChainLength / 2 + 1] );
+}
+
+static double
+ModelMs (
+    uint64_t Requests,
+    uint64_t Pages
+    )
+{
+    return ((double)Requests * LatencyUs + (double)Pages * PageUs) / 1000.0;
+}
+
+static void
+PrintResult (
+    const char *Label,
+    const WALK_RESULT *Off,
+    const WALK_RESULT *On
+    )
+{
+    printf( "%-9s %7u runs  off: %6llu reads %6llu pages %9.1fms"
+            "   on: %6llu reads %6llu pages %9.1fms\n",
+            Label,
+            On->Runs,
+            (unsigned long long)(Off->SyncReads + Off->PrefetchRequests),
+            (unsigned long long)Off->PagesRead,
+            ModelMs( Off->SyncReads + Off->PrefetchRequests, Off->PagesRead ),
+            (unsigned long long)(On->SyncReads + On->PrefetchRequests),
+            (unsigned long long)On->PagesRead,
+            ModelMs( On->SyncReads + On->PrefetchRequests, On->PagesRead ) );
+}
+
+//
+//  Lays out a file, opens it cold with and without the prefetch, and checks
+//  the Mcb the walk built.
+//
+
+static void
+MeasureLayout (
+    VOLUME *Volume,
+    LAYOUT Layout,
+    uint32_t Length,
+    uint64_t Seed,
+    WALK_RESULT *Off,
+    WALK_RESULT *On
+    )
+{
+    uint64_t Random = Seed;
+
+    memset( Volume->Image + FatReservedBytes( &Volume->Vcb.Bpb ), 0,
+            Volume->ImageSize - FatReservedBytes( &Volume->Vcb.Bpb ) );
+
+    LayOutFile( Volume, Layout, Length, &Random );
+
+    OpenFile( Volume, 0, Off );
+    OpenFile( Volume, 1, On );
+
+    CHECK( Volume->Fcb.Header.AllocationSize.QuadPart == (LONGLONG)Length << CLUSTER_SHIFT );
+    CHECK( On->Runs == Off->Runs );
+    CHECK( PinCount == 0 );
+    CheckMcb( Volume );
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    static const struct {
+        LAYOUT Layout;
+        uint32_t Length;
+        int Fat16;
+    } Cases[] = {
+        { LayoutContiguous, 1, 0 },
+        { LayoutContiguous, 262144, 0 },
+        { LayoutAged, 262144, 0 },
+        { LayoutScattered, 262144, 0 },
+        { LayoutScattered, 64, 0 },
+        { LayoutAged, 16384, 1 },
+    };
+    VOLUME Volume;
+    WALK_RESULT Off, On;
+    uint64_t Random = 11;
+    char Label[32];
+    uint32_t i;
+
+    for (i = 0; i < sizeof(Cases) / sizeof(Cases[0]); i++) {
+
+        if (!VolumeInitialize( &Volume, 2 * 1024 * 1024, Cases[i].Fat16 )) {
+            fprintf( stderr, "out of memory\n" );
+            return 1;
+        }
+
+        MeasureLayout( &Volume, Cases[i].Layout, Cases[i].Length, i + 1, &Off, &On );
+        snprintf( Label, sizeof(Label), "%s%s", LayoutNames[Cases[i].Layout], Cases[i].Fat16 ? "16" : "" );
+        PrintResult( Label, &Off, &On );
+
+        //
+        //  Every prefetch replaces at least the synchronous read of the page
+        //  the walk goes on to, a walk that stays on one page costs what it
+        //  did, and no walk costs noticeably more.
+        //
+
+        CHECK( On.SyncReads + On.PrefetchRequests <= Off.SyncReads );
+        if (Off.SyncReads == 1) {
+            CHECK( On.SyncReads + On.PrefetchRequests == 1 );
+            CHECK( On.PagesRead == 1 );
+        }
+        CHECK( ModelMs( On.SyncReads + On.PrefetchRequests, On.PagesRead ) <=
+               ModelMs( Off.SyncReads, Off.PagesRead ) * 1.05 );
+
+        //
+        //  A long walk forward through the Fat reads its pages in batches.
+        //
+
+        if ((Cases[i].Layout != LayoutScattered) && (Off.SyncReads >= 16)) {
+            CHECK( (On.SyncReads + On.PrefetchRequests) * 8 <= Off.SyncReads );
+        }
+
+        CheckLookups( &Volume, &Random, 2000 );
+        CheckPartialWalk( &Volume, (Volume.ChainLength / 3) << CLUSTER_SHIFT );
+        CheckPartialWalk( &Volume, (Volume.ChainLength - 1) << CLUSTER_SHIFT );
+
+        if (Volume.ChainLength > 2) {
+            CheckCorruptChain( &Volume, FAT_CLUSTER_AVAILABLE );
+            CheckCorruptChain( &Volume, Volume.Chain[0] );
+        }
+
+        VolumeCleanup( &Volume );
+    }
+
+    CHECK( PinCount == 0 );
+
+    printf( "%s\n", Failures ? "FAILED" : "passed" );
+    return Failures ? 1 : 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    uint32_t Clusters = 8 * 1024 * 1024;
+    uint32_t FileMb = 1024;
+    uint64_t Seed = 1;
+    int Fat16 = 0;
+    VOLUME Volume;
+    WALK_RESULT Off, On;
+    LAYOUT Layout;
+    int i;
+
+    IrpContext.Flags = IRP_CONTEXT_FLAG_WAIT;
+    IrpContext.OriginatingIrp = &OriginatingIrp;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--clusters" ) == 0) && (i + 1 < argc)) {
+            Clusters = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--file-mb" ) == 0) && (i + 1 < argc)) {
+            FileMb = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if (strcmp( argv[i], "--fat16" ) == 0) {
+            Fat16 = 1;
+        } else if ((strcmp( argv[i], "--seed" ) == 0) && (i + 1 < argc)) {
+            Seed = strtoull( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--latency-us" ) == 0) && (i + 1 < argc)) {
+            LatencyUs = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--page-us" ) == 0) && (i + 1 < argc)) {
+            PageUs = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else {
+            fprintf( stderr,
+                     "usage: fatchain --selftest\n"
+                     "       fatchain [--clusters n] [--file-mb n] [--fat16] [--seed n]\n"
+                     "                [--latency-us n] [--page-us n]\n" );
+            return 2;
+        }
+    }
+
+    if (!VolumeInitialize( &Volume, Clusters, Fat16 )) {
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+
+    if ((FileMb == 0) ||
+        ((uint64_t)FileMb << (20 - CLUSTER_SHIFT) > ClusterCount( &Volume ) / 2) ||
+        (FileMb >= 4096)) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    printf( "%u MB file on a %u cluster Fat%u volume (%u Fat pages), cold cache,\n"
+            "%u us per read and %u us per page\n",
+            FileMb, ClusterCount( &Volume ), Fat16 ? 16 : 32, Volume.FatPages, LatencyUs, PageUs );
+
+    for (Layout = LayoutContiguous; Layout < LayoutCount; Layout++) {
+        MeasureLayout( &Volume, Layout, FileMb << (20 - CLUSTER_SHIFT), Seed, &Off, &On );
+        PrintResult( LayoutNames[Layout], &Off, &On );
+    }
+
+    VolumeCleanup( &Volume );
+
+    return Failures ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+//
+//  The Fat sources include their headers in mixed case; the files are
+//  lower case.
+//
+
+#pragma once
+
+#include "fatdata.h"
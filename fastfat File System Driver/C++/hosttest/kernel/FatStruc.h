@@ -0,0 +1,16 @@
+//
+//  The Fat sources include their headers in mixed case; the files are
+//  lower case.
+//
+//  FatStruc.h declares a CLOSE_CONTEXT member of enum _TYPE_OF_OPEN before
+//  FatProcs.h defines it, which C compilers other than the driver's reject.
+//  Give the member an int sized enum of its own instead.
+//
+
+#pragma once
+
+enum _HOST_TYPE_OF_OPEN { HostTypeOfOpenLimit = 0x7fffffff };
+
+#define _TYPE_OF_OPEN _HOST_TYPE_OF_OPEN
+#include "fatstruc.h"
+#undef _TYPE_OF_OPEN
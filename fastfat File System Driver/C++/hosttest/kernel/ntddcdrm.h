@@ -0,0 +1,5 @@
+//
+//  Stand-in for <ntddcdrm.h>: nothing in it is used by the sources built here.
+//
+
+#pragma once
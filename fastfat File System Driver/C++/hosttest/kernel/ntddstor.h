@@ -0,0 +1,5 @@
+//
+//  Stand-in for <ntddstor.h>: nothing in it is used by the sources built here.
+//
+
+#pragma once
@@ -0,0 +1,364 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    ntifs.h
+
+Abstract:
+
+    User mode stand-in for the kernel headers the Fat sources include, so
+    that the driver's own FatProcs.h, FatStruc.h and friends, and with them
+    ../../dirsup.c, compile unchanged on the host.
+
+    Kernel objects the Fat structures embed but the code built here never
+    looks inside are opaque blobs.  Structured exception handling is reduced
+    to straight line code: nothing raised is ever caught, a raise ends the
+    program, so try bodies run into their finally blocks and except blocks
+    are never entered.  A try body is a do/while (0) that leave breaks out
+    of, which is only right for a leave outside any loop in the body; the
+    routines the test programs run never leave from inside a loop.  The
+    routines declared at the bottom are supplied by the test program, or by
+    unused.c for those it never reaches.
+
+Environment:
+
+    Host (user mode), C11 with -fms-extensions.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define UNALIGNED
+#define NOTHING
+
+#define NTDDI_WIN8                      0x06020000
+#define NTDDI_VERSION                   NTDDI_WIN8
+#define CONST                           const
+#define VOID                            void
+#define __inline                        inline
+#define __volatile                      volatile
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Outptr_
+#define _Out_writes_bytes_(x)
+#define _When_(c, a)
+#define _Success_(c)
+#define _Function_class_(x)
+#define _Requires_lock_held_(x)
+#define _Acquires_shared_lock_(x)
+#define _Acquires_exclusive_lock_(x)
+#define _Analysis_assume_(x)
+
+typedef void                    *PVOID;
+typedef char                    CHAR, *PCHAR, CCHAR, KPROCESSOR_MODE;
+typedef unsigned char           UCHAR, *PUCHAR, BOOLEAN, *PBOOLEAN;
+typedef short                   SHORT, CSHORT;
+typedef unsigned short          USHORT, *PUSHORT;
+typedef uint16_t                WCHAR, *PWCHAR, *PWSTR;
+typedef const WCHAR             *PCWSTR;
+typedef int32_t                 LONG, *PLONG;
+typedef uint32_t                ULONG, *PULONG, ULONG32, CLONG, LOGICAL, ACCESS_MASK, *PACCESS_MASK;
+typedef int64_t                 LONGLONG, *PLONGLONG;
+typedef uint64_t                ULONGLONG, *PULONGLONG;
+typedef uintptr_t               ULONG_PTR, SIZE_T, KSPIN_LOCK, ERESOURCE_THREAD;
+typedef LONG                    NTSTATUS, *PNTSTATUS;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        ULONG HighPart;
+    };
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+typedef struct _STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PCHAR Buffer;
+} STRING, *PSTRING, OEM_STRING, *POEM_STRING;
+
+typedef union _SLIST_HEADER {
+    ULONGLONG Alignment[2];
+} SLIST_HEADER;
+
+typedef enum _POOL_TYPE { NonPagedPool, PagedPool, NonPagedPoolNx = 512 } POOL_TYPE;
+typedef enum _LOCK_OPERATION { IoReadAccess, IoWriteAccess, IoModifyAccess } LOCK_OPERATION;
+
+#define HOST_OPAQUE(Name, Words)                                            \
+    typedef struct _##Name { ULONG_PTR Opaque[Words]; } Name, *P##Name
+
+HOST_OPAQUE( DRIVER_OBJECT, 8 );
+HOST_OPAQUE( DEVICE_OBJECT, 40 );
+HOST_OPAQUE( EPROCESS, 1 );
+HOST_OPAQUE( KTHREAD, 1 );
+HOST_OPAQUE( IRP, 32 );
+HOST_OPAQUE( IO_STACK_LOCATION, 16 );
+HOST_OPAQUE( IO_WORKITEM, 1 );
+HOST_OPAQUE( KDPC, 8 );
+HOST_OPAQUE( KTIMER, 8 );
+HOST_OPAQUE( KEVENT, 4 );
+HOST_OPAQUE( FAST_MUTEX, 8 );
+HOST_OPAQUE( WORK_QUEUE_ITEM, 4 );
+HOST_OPAQUE( NPAGED_LOOKASIDE_LIST, 32 );
+HOST_OPAQUE( CACHE_MANAGER_CALLBACKS, 4 );
+HOST_OPAQUE( FAST_IO_DISPATCH, 32 );
+HOST_OPAQUE( FS_FILTER_CALLBACK_DATA, 8 );
+HOST_OPAQUE( VPB, 16 );
+HOST_OPAQUE( MDL, 8 );
+HOST_OPAQUE( SECTION_OBJECT_POINTERS, 3 );
+HOST_OPAQUE( SHARE_ACCESS, 8 );
+HOST_OPAQUE( FILE_LOCK, 16 );
+HOST_OPAQUE( OPLOCK, 1 );
+HOST_OPAQUE( LARGE_MCB, 8 );
+HOST_OPAQUE( TUNNEL, 8 );
+HOST_OPAQUE( NOTIFY_SYNC, 1 );
+HOST_OPAQUE( FILESYSTEM_STATISTICS, 16 );
+HOST_OPAQUE( FAT_STATISTICS, 16 );
+HOST_OPAQUE( IO_STATUS_BLOCK, 2 );
+HOST_OPAQUE( EXCEPTION_POINTERS, 2 );
+HOST_OPAQUE( ACCESS_STATE, 32 );
+HOST_OPAQUE( FILE_FULL_EA_INFORMATION, 2 );
+HOST_OPAQUE( FILE_BASIC_INFORMATION, 5 );
+HOST_OPAQUE( FILE_STANDARD_INFORMATION, 4 );
+HOST_OPAQUE( FILE_NETWORK_OPEN_INFORMATION, 7 );
+
+typedef PVOID PBCB;
+
+typedef struct _RTL_BITMAP {
+    ULONG SizeOfBitMap;
+    PULONG Buffer;
+} RTL_BITMAP, *PRTL_BITMAP;
+
+//
+//  A resource just counts its owners, which is all the assertions and the
+//  ExIsResourceAcquired routines look at.
+//
+
+typedef struct _ERESOURCE {
+    LONG SharedCount;
+    LONG ExclusiveCount;
+} ERESOURCE, *PERESOURCE;
+
+typedef struct _FSRTL_COMMON_FCB_HEADER {
+    CSHORT NodeTypeCode;
+    CSHORT NodeByteSize;
+    UCHAR Flags;
+    UCHAR IsFastIoPossible;
+    UCHAR Flags2;
+    UCHAR Reserved;
+    PERESOURCE Resource;
+    PERESOURCE PagingIoResource;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} FSRTL_COMMON_FCB_HEADER;
+
+typedef struct _FSRTL_ADVANCED_FCB_HEADER {
+    FSRTL_COMMON_FCB_HEADER;
+    PFAST_MUTEX FastMutex;
+    LIST_ENTRY FilterContexts;
+    PVOID PushLock;
+    PVOID *FileContextSupportPointer;
+    OPLOCK Oplock;
+} FSRTL_ADVANCED_FCB_HEADER;
+
+typedef struct _FILE_OBJECT {
+    CSHORT Type;
+    CSHORT Size;
+    PDEVICE_OBJECT DeviceObject;
+    PVPB Vpb;
+    PVOID FsContext;
+    PVOID FsContext2;
+    PSECTION_OBJECT_POINTERS SectionObjectPointer;
+    PVOID PrivateCacheMap;
+    ULONG Flags;
+    UNICODE_STRING FileName;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _CC_FILE_SIZES {
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} CC_FILE_SIZES, *PCC_FILE_SIZES;
+
+typedef VOID KDEFERRED_ROUTINE( PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2 );
+typedef VOID WORKER_THREAD_ROUTINE( PVOID Parameter );
+
+#define TRUE                            1
+#define FALSE                           0
+#define MAXULONG                        0xffffffffu
+#define PAGE_SIZE                       0x1000
+
+#define FIELD_OFFSET(Type, Field)       ((LONG)offsetof( Type, Field ))
+#define CONTAINING_RECORD(A, Type, Field) ((Type *)((PCHAR)(A) - offsetof( Type, Field )))
+#define ARGUMENT_PRESENT(A)             ((A) != NULL)
+#define UNREFERENCED_PARAMETER(P)       ((void)(P))
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+
+//
+//  Sources whose assertions name locals declared only #if DBG are built
+//  with HOST_FREE_BUILD, which compiles NT_ASSERT out as a free build does.
+//
+
+#ifdef HOST_FREE_BUILD
+#define NT_ASSERT(E)                    ((void)0)
+#else
+#define NT_ASSERT(E)                    HostAssert( (E) ? 1 : 0, #E, __FILE__, __LINE__ )
+#endif
+#define PAGED_CODE()
+#define INLINE                          static inline
+
+#define ALIGN_DOWN_BY(Length, Alignment) ((ULONG_PTR)(Length) & ~((ULONG_PTR)(Alignment) - 1))
+#define ALIGN_UP_BY(Length, Alignment)  ALIGN_DOWN_BY( (ULONG_PTR)(Length) + (Alignment) - 1, (Alignment) )
+#define UInt32x32To64(A, B)             ((ULONGLONG)(ULONG)(A) * (ULONGLONG)(ULONG)(B))
+
+#define FlagOn(F, SF)                   ((F) & (SF))
+#define BooleanFlagOn(F, SF)            ((BOOLEAN)(((F) & (SF)) != 0))
+#define SetFlag(F, SF)                  ((F) |= (SF))
+#define ClearFlag(F, SF)                ((F) &= ~(SF))
+
+#define RtlZeroMemory(D, L)             memset( (D), 0, (L) )
+#define RtlFillMemory(D, L, F)          memset( (D), (F), (L) )
+#define RtlCopyMemory(D, S, L)          memcpy( (D), (S), (L) )
+#define RtlMoveMemory(D, S, L)          memmove( (D), (S), (L) )
+
+#define try                             do
+#define finally                         while (0);
+#define except(Filter)                  while (0); if (0)
+#define leave                           break
+#define AbnormalTermination()           FALSE
+#define GetExceptionCode()              STATUS_SUCCESS
+#define GetExceptionInformation()       NULL
+#define EXCEPTION_EXECUTE_HANDLER       1
+#define EXCEPTION_CONTINUE_SEARCH       0
+
+#define FAT_FILE_SYSTEM                 0x00000023
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_END_OF_FILE              ((NTSTATUS)0xC0000011L)
+#define STATUS_DISK_FULL                ((NTSTATUS)0xC000007FL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_FILE_CORRUPT_ERROR       ((NTSTATUS)0xC0000102L)
+#define STATUS_UNEXPECTED_IO_ERROR      ((NTSTATUS)0xC00000E9L)
+#define STATUS_CANNOT_MAKE              ((NTSTATUS)0xC00002EAL)
+
+#define FO_FILE_MODIFIED                0x00001000
+#define FO_FILE_SIZE_CHANGED            0x00002000
+#define FO_FILE_FAST_IO_READ            0x00080000
+#define OPLOCK_FLAG_PARENT_OBJECT       0x00000008
+
+#define FILE_ATTRIBUTE_ARCHIVE          0x00000020
+#define FILE_NOTIFY_CHANGE_ATTRIBUTES   0x00000004
+#define FILE_NOTIFY_CHANGE_SIZE         0x00000008
+#define FILE_NOTIFY_CHANGE_LAST_WRITE   0x00000010
+#define FILE_NOTIFY_CHANGE_LAST_ACCESS  0x00000020
+#define FILE_ACTION_MODIFIED            0x00000003
+
+static inline LONG
+InterlockedExchangeAdd (
+    LONG volatile *Addend,
+    LONG Value
+    )
+{
+    return __atomic_fetch_add( Addend, Value, __ATOMIC_SEQ_CST );
+}
+
+static inline PVOID
+InterlockedCompareExchangePointer (
+    PVOID volatile *Destination,
+    PVOID Exchange,
+    PVOID Comparand
+    )
+{
+    __atomic_compare_exchange_n( Destination, &Comparand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+    return Comparand;
+}
+
+VOID HostAssert( int Condition, const char *Text, const char *File, int Line );
+
+PVOID ExAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+PVOID FsRtlAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+VOID ExFreePool( PVOID P );
+BOOLEAN ExAcquireResourceExclusiveLite( PERESOURCE Resource, BOOLEAN Wait );
+VOID ExReleaseResourceLite( PERESOURCE Resource );
+BOOLEAN ExIsResourceAcquiredExclusiveLite( PERESOURCE Resource );
+ULONG ExIsResourceAcquiredSharedLite( PERESOURCE Resource );
+BOOLEAN ExAcquireResourceSharedLite( PERESOURCE Resource, BOOLEAN Wait );
+VOID ExAcquireFastMutexUnsafe( PFAST_MUTEX FastMutex );
+VOID ExReleaseFastMutexUnsafe( PFAST_MUTEX FastMutex );
+VOID ExRaiseStatus( NTSTATUS Status );
+VOID ExLocalTimeToSystemTime( PLARGE_INTEGER LocalTime, PLARGE_INTEGER SystemTime );
+VOID ExSystemTimeToLocalTime( PLARGE_INTEGER SystemTime, PLARGE_INTEGER LocalTime );
+VOID KeQuerySystemTime( PLARGE_INTEGER CurrentTime );
+VOID KeBugCheckEx( ULONG BugCheckCode, ULONG_PTR P1, ULONG_PTR P2, ULONG_PTR P3, ULONG_PTR P4 );
+VOID CcUnpinData( PVOID Bcb );
+VOID CcRepinBcb( PVOID Bcb );
+VOID CcUnpinRepinnedBcb( PVOID Bcb, BOOLEAN WriteThrough, PIO_STATUS_BLOCK IoStatus );
+BOOLEAN CcIsFileCached( PFILE_OBJECT FileObject );
+VOID CcSetFileSizes( PFILE_OBJECT FileObject, PCC_FILE_SIZES FileSizes );
+
+WCHAR RtlUpcaseUnicodeChar( WCHAR SourceCharacter );
+NTSTATUS RtlUpcaseUnicodeString( PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlDowncaseUnicodeString( PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlOemStringToCountedUnicodeString( PUNICODE_STRING DestinationString, const STRING *SourceString, BOOLEAN AllocateDestinationString );
+BOOLEAN RtlAreBitsClear( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG Length );
+BOOLEAN RtlAreBitsSet( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG Length );
+VOID RtlClearBits( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG NumberToClear );
+VOID RtlSetBits( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG NumberToSet );
+ULONG RtlFindClearBits( PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex );
+ULONG RtlFindLongestRunClear( PRTL_BITMAP BitMapHeader, PULONG StartingIndex );
+BOOLEAN RtlCheckBit( PRTL_BITMAP BitMapHeader, ULONG BitPosition );
+VOID RtlInitializeBitMap( PRTL_BITMAP BitMapHeader, PULONG BitMapBuffer, ULONG SizeOfBitMap );
+
+BOOLEAN FsRtlAreNamesEqual( PCUNICODE_STRING ConstantNameA, PCUNICODE_STRING ConstantNameB, BOOLEAN IgnoreCase, PCWSTR UpcaseTable );
+BOOLEAN FsRtlIsNameInExpression( PUNICODE_STRING Expression, PUNICODE_STRING Name, BOOLEAN IgnoreCase, PWCHAR UpcaseTable );
+NTSTATUS FsRtlNormalizeNtstatus( NTSTATUS Exception, NTSTATUS GenericException );
+BOOLEAN FsRtlIsAnsiCharacterLegalHpfs( UCHAR Character, BOOLEAN WildOk );
+BOOLEAN FsRtlIsNtstatusExpected( NTSTATUS Exception );
+VOID FsRtlInitializeLargeMcb( PLARGE_MCB Mcb, POOL_TYPE PoolType );
+VOID FsRtlUninitializeLargeMcb( PLARGE_MCB Mcb );
+BOOLEAN FsRtlAddLargeMcbEntry( PLARGE_MCB Mcb, LONGLONG Vbn, LONGLONG Lbn, LONGLONG SectorCount );
+BOOLEAN FsRtlGetNextLargeMcbEntry( PLARGE_MCB Mcb, ULONG RunIndex, PLONGLONG Vbn, PLONGLONG Lbn, PLONGLONG SectorCount );
+ULONG FsRtlNumberOfRunsInLargeMcb( PLARGE_MCB Mcb );
+VOID FsRtlTruncateLargeMcb( PLARGE_MCB Mcb, LONGLONG Vbn );
+VOID FsRtlAddToTunnelCache( PTUNNEL Cache, ULONGLONG DirectoryKey, PUNICODE_STRING ShortName, PUNICODE_STRING LongName, BOOLEAN KeyByShortName, ULONG DataLength, PVOID Data );
+VOID FsRtlDeleteKeyFromTunnelCache( PTUNNEL Cache, ULONGLONG DirectoryKey );
+NTSTATUS FsRtlCheckOplockEx( POPLOCK Oplock, PIRP Irp, ULONG Flags, PVOID Context, PVOID CompletionRoutine, PVOID PostIrpRoutine );
+VOID FsRtlNotifyFullReportChange( PNOTIFY_SYNC NotifySync, PLIST_ENTRY NotifyList, PSTRING FullTargetName, USHORT TargetNameOffset, PSTRING StreamName, PSTRING NormalizedParentName, ULONG FilterMatch, ULONG Action, PVOID TargetContext );
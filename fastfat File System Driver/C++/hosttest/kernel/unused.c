@@ -0,0 +1,717 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    Unused.c
+
+Abstract:
+
+    The kernel, cache manager and Fat routines that ../../dirsup.c and
+    ../../allocsup.c refer to but which the host programs never reach: the
+    dirent writing, Ea, tunnel, time and notification paths, and the free
+    cluster bitmap and Fat writing.  Each one ends the program if it is
+    called.
+
+Environment:
+
+    Host (user mode), C11.
+
+--*/
+
+#include "FatProcs.h"
+
+LARGE_INTEGER FatMaxLarge = { .LowPart = MAXULONG, .HighPart = 0x7fffffff };
+LARGE_INTEGER FatOneDay = { .QuadPart = 0xc92a69c000 };
+
+static VOID
+NotReached (
+    const char *Routine
+    )
+{
+    fprintf( stderr, "%s: not supported on the host\n", Routine );
+    abort();
+}
+
+#define NOT_REACHED() NotReached( __func__ )
+
+BOOLEAN
+ExAcquireResourceExclusiveLite (
+    PERESOURCE Resource,
+    BOOLEAN Wait
+    )
+{
+    UNREFERENCED_PARAMETER( Resource );
+    UNREFERENCED_PARAMETER( Wait );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+ExReleaseResourceLite (
+    PERESOURCE Resource
+    )
+{
+    UNREFERENCED_PARAMETER( Resource );
+    NOT_REACHED();
+}
+
+BOOLEAN
+ExAcquireResourceSharedLite (
+    PERESOURCE Resource,
+    BOOLEAN Wait
+    )
+{
+    UNREFERENCED_PARAMETER( Resource );
+    UNREFERENCED_PARAMETER( Wait );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+ExAcquireFastMutexUnsafe (
+    PFAST_MUTEX FastMutex
+    )
+{
+    UNREFERENCED_PARAMETER( FastMutex );
+    NOT_REACHED();
+}
+
+VOID
+ExReleaseFastMutexUnsafe (
+    PFAST_MUTEX FastMutex
+    )
+{
+    UNREFERENCED_PARAMETER( FastMutex );
+    NOT_REACHED();
+}
+
+VOID
+ExLocalTimeToSystemTime (
+    PLARGE_INTEGER LocalTime,
+    PLARGE_INTEGER SystemTime
+    )
+{
+    UNREFERENCED_PARAMETER( LocalTime );
+    UNREFERENCED_PARAMETER( SystemTime );
+    NOT_REACHED();
+}
+
+VOID
+ExSystemTimeToLocalTime (
+    PLARGE_INTEGER SystemTime,
+    PLARGE_INTEGER LocalTime
+    )
+{
+    UNREFERENCED_PARAMETER( SystemTime );
+    UNREFERENCED_PARAMETER( LocalTime );
+    NOT_REACHED();
+}
+
+VOID
+KeQuerySystemTime (
+    PLARGE_INTEGER CurrentTime
+    )
+{
+    UNREFERENCED_PARAMETER( CurrentTime );
+    NOT_REACHED();
+}
+
+VOID
+CcRepinBcb (
+    PVOID Bcb
+    )
+{
+    UNREFERENCED_PARAMETER( Bcb );
+    NOT_REACHED();
+}
+
+VOID
+CcUnpinRepinnedBcb (
+    PVOID Bcb,
+    BOOLEAN WriteThrough,
+    PIO_STATUS_BLOCK IoStatus
+    )
+{
+    UNREFERENCED_PARAMETER( Bcb );
+    UNREFERENCED_PARAMETER( WriteThrough );
+    UNREFERENCED_PARAMETER( IoStatus );
+    NOT_REACHED();
+}
+
+BOOLEAN
+CcIsFileCached (
+    PFILE_OBJECT FileObject
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+CcSetFileSizes (
+    PFILE_OBJECT FileObject,
+    PCC_FILE_SIZES FileSizes
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( FileSizes );
+    NOT_REACHED();
+}
+
+PVOID
+FsRtlAllocatePoolWithTag (
+    POOL_TYPE PoolType,
+    SIZE_T NumberOfBytes,
+    ULONG Tag
+    )
+{
+    UNREFERENCED_PARAMETER( PoolType );
+    UNREFERENCED_PARAMETER( NumberOfBytes );
+    UNREFERENCED_PARAMETER( Tag );
+    NOT_REACHED();
+    return NULL;
+}
+
+NTSTATUS
+RtlDowncaseUnicodeString (
+    PUNICODE_STRING DestinationString,
+    PCUNICODE_STRING SourceString,
+    BOOLEAN AllocateDestinationString
+    )
+{
+    UNREFERENCED_PARAMETER( DestinationString );
+    UNREFERENCED_PARAMETER( SourceString );
+    UNREFERENCED_PARAMETER( AllocateDestinationString );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlOemStringToCountedUnicodeString (
+    PUNICODE_STRING DestinationString,
+    const STRING *SourceString,
+    BOOLEAN AllocateDestinationString
+    )
+{
+    UNREFERENCED_PARAMETER( DestinationString );
+    UNREFERENCED_PARAMETER( SourceString );
+    UNREFERENCED_PARAMETER( AllocateDestinationString );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+RtlAreBitsClear (
+    PRTL_BITMAP BitMapHeader,
+    ULONG StartingIndex,
+    ULONG Length
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( StartingIndex );
+    UNREFERENCED_PARAMETER( Length );
+    NOT_REACHED();
+    return FALSE;
+}
+
+BOOLEAN
+RtlAreBitsSet (
+    PRTL_BITMAP BitMapHeader,
+    ULONG StartingIndex,
+    ULONG Length
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( StartingIndex );
+    UNREFERENCED_PARAMETER( Length );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+RtlClearBits (
+    PRTL_BITMAP BitMapHeader,
+    ULONG StartingIndex,
+    ULONG NumberToClear
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( StartingIndex );
+    UNREFERENCED_PARAMETER( NumberToClear );
+    NOT_REACHED();
+}
+
+VOID
+RtlSetBits (
+    PRTL_BITMAP BitMapHeader,
+    ULONG StartingIndex,
+    ULONG NumberToSet
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( StartingIndex );
+    UNREFERENCED_PARAMETER( NumberToSet );
+    NOT_REACHED();
+}
+
+ULONG
+RtlFindClearBits (
+    PRTL_BITMAP BitMapHeader,
+    ULONG NumberToFind,
+    ULONG HintIndex
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( NumberToFind );
+    UNREFERENCED_PARAMETER( HintIndex );
+    NOT_REACHED();
+    return MAXULONG;
+}
+
+ULONG
+RtlFindLongestRunClear (
+    PRTL_BITMAP BitMapHeader,
+    PULONG StartingIndex
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( StartingIndex );
+    NOT_REACHED();
+    return 0;
+}
+
+BOOLEAN
+RtlCheckBit (
+    PRTL_BITMAP BitMapHeader,
+    ULONG BitPosition
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( BitPosition );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+RtlInitializeBitMap (
+    PRTL_BITMAP BitMapHeader,
+    PULONG BitMapBuffer,
+    ULONG SizeOfBitMap
+    )
+{
+    UNREFERENCED_PARAMETER( BitMapHeader );
+    UNREFERENCED_PARAMETER( BitMapBuffer );
+    UNREFERENCED_PARAMETER( SizeOfBitMap );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FsRtlIsNameInExpression (
+    PUNICODE_STRING Expression,
+    PUNICODE_STRING Name,
+    BOOLEAN IgnoreCase,
+    PWCHAR UpcaseTable
+    )
+{
+    UNREFERENCED_PARAMETER( Expression );
+    UNREFERENCED_PARAMETER( Name );
+    UNREFERENCED_PARAMETER( IgnoreCase );
+    UNREFERENCED_PARAMETER( UpcaseTable );
+    NOT_REACHED();
+    return FALSE;
+}
+
+NTSTATUS
+FsRtlNormalizeNtstatus (
+    NTSTATUS Exception,
+    NTSTATUS GenericException
+    )
+{
+    UNREFERENCED_PARAMETER( Exception );
+    UNREFERENCED_PARAMETER( GenericException );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+VOID
+FsRtlInitializeLargeMcb (
+    PLARGE_MCB Mcb,
+    POOL_TYPE PoolType
+    )
+{
+    UNREFERENCED_PARAMETER( Mcb );
+    UNREFERENCED_PARAMETER( PoolType );
+    NOT_REACHED();
+}
+
+VOID
+FsRtlUninitializeLargeMcb (
+    PLARGE_MCB Mcb
+    )
+{
+    UNREFERENCED_PARAMETER( Mcb );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FsRtlAddLargeMcbEntry (
+    PLARGE_MCB Mcb,
+    LONGLONG Vbn,
+    LONGLONG Lbn,
+    LONGLONG SectorCount
+    )
+{
+    UNREFERENCED_PARAMETER( Mcb );
+    UNREFERENCED_PARAMETER( Vbn );
+    UNREFERENCED_PARAMETER( Lbn );
+    UNREFERENCED_PARAMETER( SectorCount );
+    NOT_REACHED();
+    return FALSE;
+}
+
+BOOLEAN
+FsRtlGetNextLargeMcbEntry (
+    PLARGE_MCB Mcb,
+    ULONG RunIndex,
+    PLONGLONG Vbn,
+    PLONGLONG Lbn,
+    PLONGLONG SectorCount
+    )
+{
+    UNREFERENCED_PARAMETER( Mcb );
+    UNREFERENCED_PARAMETER( RunIndex );
+    UNREFERENCED_PARAMETER( Vbn );
+    UNREFERENCED_PARAMETER( Lbn );
+    UNREFERENCED_PARAMETER( SectorCount );
+    NOT_REACHED();
+    return FALSE;
+}
+
+ULONG
+FsRtlNumberOfRunsInLargeMcb (
+    PLARGE_MCB Mcb
+    )
+{
+    UNREFERENCED_PARAMETER( Mcb );
+    NOT_REACHED();
+    return 0;
+}
+
+VOID
+FsRtlTruncateLargeMcb (
+    PLARGE_MCB Mcb,
+    LONGLONG Vbn
+    )
+{
+    UNREFERENCED_PARAMETER( Mcb );
+    UNREFERENCED_PARAMETER( Vbn );
+    NOT_REACHED();
+}
+
+VOID
+FsRtlAddToTunnelCache (
+    PTUNNEL Cache,
+    ULONGLONG DirectoryKey,
+    PUNICODE_STRING ShortName,
+    PUNICODE_STRING LongName,
+    BOOLEAN KeyByShortName,
+    ULONG DataLength,
+    PVOID Data
+    )
+{
+    UNREFERENCED_PARAMETER( Cache );
+    UNREFERENCED_PARAMETER( DirectoryKey );
+    UNREFERENCED_PARAMETER( ShortName );
+    UNREFERENCED_PARAMETER( LongName );
+    UNREFERENCED_PARAMETER( KeyByShortName );
+    UNREFERENCED_PARAMETER( DataLength );
+    UNREFERENCED_PARAMETER( Data );
+    NOT_REACHED();
+}
+
+VOID
+FsRtlDeleteKeyFromTunnelCache (
+    PTUNNEL Cache,
+    ULONGLONG DirectoryKey
+    )
+{
+    UNREFERENCED_PARAMETER( Cache );
+    UNREFERENCED_PARAMETER( DirectoryKey );
+    NOT_REACHED();
+}
+
+NTSTATUS
+FsRtlCheckOplockEx (
+    POPLOCK Oplock,
+    PIRP Irp,
+    ULONG Flags,
+    PVOID Context,
+    PVOID CompletionRoutine,
+    PVOID PostIrpRoutine
+    )
+{
+    UNREFERENCED_PARAMETER( Oplock );
+    UNREFERENCED_PARAMETER( Irp );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( CompletionRoutine );
+    UNREFERENCED_PARAMETER( PostIrpRoutine );
+    NOT_REACHED();
+    return STATUS_SUCCESS;
+}
+
+VOID
+FsRtlNotifyFullReportChange (
+    PNOTIFY_SYNC NotifySync,
+    PLIST_ENTRY NotifyList,
+    PSTRING FullTargetName,
+    USHORT TargetNameOffset,
+    PSTRING StreamName,
+    PSTRING NormalizedParentName,
+    ULONG FilterMatch,
+    ULONG Action,
+    PVOID TargetContext
+    )
+{
+    UNREFERENCED_PARAMETER( NotifySync );
+    UNREFERENCED_PARAMETER( NotifyList );
+    UNREFERENCED_PARAMETER( FullTargetName );
+    UNREFERENCED_PARAMETER( TargetNameOffset );
+    UNREFERENCED_PARAMETER( StreamName );
+    UNREFERENCED_PARAMETER( NormalizedParentName );
+    UNREFERENCED_PARAMETER( FilterMatch );
+    UNREFERENCED_PARAMETER( Action );
+    UNREFERENCED_PARAMETER( TargetContext );
+    NOT_REACHED();
+}
+
+VOID
+Fat8dot3ToString (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PDIRENT Dirent,
+    _In_ BOOLEAN RestoreCase,
+    _Out_ POEM_STRING OutputString
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Dirent );
+    UNREFERENCED_PARAMETER( RestoreCase );
+    UNREFERENCED_PARAMETER( OutputString );
+    NOT_REACHED();
+}
+
+VOID
+FatDeferFatFlush (
+    IN PVCB Vcb
+    )
+{
+    UNREFERENCED_PARAMETER( Vcb );
+    NOT_REACHED();
+}
+
+VOID
+FatDeleteEa (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb,
+    IN USHORT EaHandle,
+    IN POEM_STRING FileName
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Vcb );
+    UNREFERENCED_PARAMETER( EaHandle );
+    UNREFERENCED_PARAMETER( FileName );
+    NOT_REACHED();
+}
+
+FAT_TIME_STAMP
+FatGetCurrentFatTime (
+    _In_ PIRP_CONTEXT IrpContext
+    )
+{
+    FAT_TIME_STAMP TimeStamp = { 0 };
+
+    UNREFERENCED_PARAMETER( IrpContext );
+    NOT_REACHED();
+    return TimeStamp;
+}
+
+VOID
+FatInitializeCacheMap (
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PCC_FILE_SIZES FileSizes,
+    _In_ BOOLEAN PinAccess,
+    _In_ PCACHE_MANAGER_CALLBACKS Callbacks,
+    _In_ PVOID LazyWriteContext
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( FileSizes );
+    UNREFERENCED_PARAMETER( PinAccess );
+    UNREFERENCED_PARAMETER( Callbacks );
+    UNREFERENCED_PARAMETER( LazyWriteContext );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FatIsNameInExpression (
+    IN PIRP_CONTEXT IrpContext,
+    IN OEM_STRING Expression,
+    IN OEM_STRING Name
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Expression );
+    UNREFERENCED_PARAMETER( Name );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+FatMarkFcbCondition (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb,
+    IN FCB_CONDITION FcbCondition,
+    IN BOOLEAN Recursive
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Fcb );
+    UNREFERENCED_PARAMETER( FcbCondition );
+    UNREFERENCED_PARAMETER( Recursive );
+    NOT_REACHED();
+}
+
+BOOLEAN
+FatNtTimeToFatTime (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PLARGE_INTEGER NtTime,
+    _In_ BOOLEAN Rounding,
+    _Out_ PFAT_TIME_STAMP FatTime,
+    _Out_opt_ PUCHAR TenMsecs
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( NtTime );
+    UNREFERENCED_PARAMETER( Rounding );
+    UNREFERENCED_PARAMETER( FatTime );
+    UNREFERENCED_PARAMETER( TenMsecs );
+    NOT_REACHED();
+    return FALSE;
+}
+
+VOID
+FatPinMappedData (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO StartingVbo,
+    IN ULONG ByteCount,
+    OUT PBCB *Bcb
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Dcb );
+    UNREFERENCED_PARAMETER( StartingVbo );
+    UNREFERENCED_PARAMETER( ByteCount );
+    UNREFERENCED_PARAMETER( Bcb );
+    NOT_REACHED();
+}
+
+VOID
+FatPrepareWriteVolumeFile (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb,
+    IN VBO StartingVbo,
+    IN ULONG ByteCount,
+    OUT PBCB *Bcb,
+    OUT PVOID *Buffer,
+    IN BOOLEAN Reversible,
+    IN BOOLEAN Zero
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Vcb );
+    UNREFERENCED_PARAMETER( StartingVbo );
+    UNREFERENCED_PARAMETER( ByteCount );
+    UNREFERENCED_PARAMETER( Bcb );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( Reversible );
+    UNREFERENCED_PARAMETER( Zero );
+    NOT_REACHED();
+}
+
+VOID
+FatPrepareWriteDirectoryFile (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO StartingVbo,
+    IN ULONG ByteCount,
+    OUT PBCB *Bcb,
+    OUT PVOID *Buffer,
+    IN BOOLEAN Zero,
+    IN BOOLEAN Reversible,
+    OUT PNTSTATUS Status
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Dcb );
+    UNREFERENCED_PARAMETER( StartingVbo );
+    UNREFERENCED_PARAMETER( ByteCount );
+    UNREFERENCED_PARAMETER( Bcb );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( Zero );
+    UNREFERENCED_PARAMETER( Reversible );
+    UNREFERENCED_PARAMETER( Status );
+    NOT_REACHED();
+}
+
+VOID
+FatSetDirtyBcb (
+    IN PIRP_CONTEXT IrpContext,
+    IN PBCB Bcb,
+    IN PVCB Vcb OPTIONAL,
+    IN BOOLEAN Reversible
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Bcb );
+    UNREFERENCED_PARAMETER( Vcb );
+    UNREFERENCED_PARAMETER( Reversible );
+    NOT_REACHED();
+}
+
+VOID
+FatSetFullFileNameInFcb (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Fcb );
+    NOT_REACHED();
+}
+
+VOID
+FatStringTo8dot3 (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ OEM_STRING InputString,
+    _Out_writes_bytes_(11) PFAT8DOT3 Output8dot3
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( InputString );
+    UNREFERENCED_PARAMETER( Output8dot3 );
+    NOT_REACHED();
+}
+
+VOID
+FatUnpinRepinnedBcbs (
+    IN PIRP_CONTEXT IrpContext
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    NOT_REACHED();
+}
@@ -0,0 +1,1074 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    NameBench.c
+
+Abstract:
+
+    Host test and benchmark for the Fcb name tables in SplaySup.c, which is
+    compiled here unchanged against the stand-ins in shim\FatProcs.h.
+
+    The benchmark replays parallel opens of existing files in one hot
+    directory the way FatCommonCreate looks a component up: upcase to Oem
+    and search the Oem names, then fall back to the Unicode names.  It runs
+    each open against
+
+        splay  - the splay trees the tables replaced, mirrored here from the
+                 previous SplaySup.c.  A hit splays the tree, so every lookup
+                 is a write and has to hold the Dcb exclusive.
+
+        hash   - the name tables, with lookups holding the Dcb exclusive, as
+                 create still does today (the Vcb is acquired exclusive).
+
+        shared - the name tables with lookups holding the Dcb shared, which
+                 they now allow since FatFindFcb no longer writes.
+
+    usage: namebench --selftest
+           namebench [--files n] [--seconds s] [--miss pct] [threads...]
+
+Environment:
+
+    Host (user mode), C99 with pthreads.
+
+--*/
+
+#include "FatProcs.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_THREADS                      (64)
+
+static int Failures;
+
+#define CHECK(X) {                                                      \
+    if (!(X)) {                                                         \
+        printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #X ); \
+        Failures += 1;                                                  \
+    }                                                                   \
+}
+
+//
+//  Kernel stand-ins.  Allocations are counted, and can be made to fail, so
+//  the tests can see the tables grow, fail to grow and give all their pool
+//  back.
+//
+
+static long PoolOutstanding;
+static long StringsOutstanding;
+static int PoolFail;
+static int BugChecks;
+static jmp_buf BugCheckJump;
+
+void *
+HostAllocatePool (
+    size_t Size
+    )
+{
+    void *P;
+
+    if (PoolFail) {
+        return NULL;
+    }
+
+    P = malloc( Size );
+    if (P != NULL) {
+        PoolOutstanding += 1;
+    }
+    return P;
+}
+
+void
+HostFreePool (
+    void *P
+    )
+{
+    PoolOutstanding -= 1;
+    free( P );
+}
+
+void
+HostBugCheck (
+    ULONG_PTR A,
+    ULONG_PTR B,
+    ULONG_PTR C
+    )
+{
+    (void)A; (void)B; (void)C;
+
+    BugChecks += 1;
+    longjmp( BugCheckJump, 1 );
+}
+
+void
+HostMarkFcbCondition (
+    PFCB Fcb,
+    FCB_CONDITION Condition
+    )
+{
+    Fcb->FcbCondition = Condition;
+}
+
+void
+HostFreeString (
+    void *Buffer
+    )
+{
+    StringsOutstanding -= 1;
+    free( Buffer );
+}
+
+static uint64_t
+Random64 (
+    uint64_t *State
+    )
+{
+    *State ^= *State << 13;
+    *State ^= *State >> 7;
+    *State ^= *State << 17;
+    return *State;
+}
+
+static double
+Now (
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//
+//  The splay trees the name tables replaced: RtlSplay, the name compare
+//  from the previous SplaySup.c, and its FatInsertName/FatFindFcb.
+//
+
+typedef struct _SPLAY_NAME {
+    struct _SPLAY_NAME *Parent;
+    struct _SPLAY_NAME *Left;
+    struct _SPLAY_NAME *Right;
+    STRING Name;
+    PFCB Fcb;
+    BOOLEAN FileNameDos;
+} SPLAY_NAME;
+
+static int
+SplayCompareNames (
+    const STRING *NameA,
+    const STRING *NameB
+    )
+{
+    ULONG MinLength;
+    ULONG i;
+
+    if (*(const UCHAR *)NameA->Buffer != *(const UCHAR *)NameB->Buffer) {
+        return (*(const UCHAR *)NameA->Buffer < *(const UCHAR *)NameB->Buffer) ? -1 : 1;
+    }
+
+    MinLength = (NameA->Length < NameB->Length) ? NameA->Length : NameB->Length;
+
+    i = 0;
+    while ((i < MinLength) && (NameA->Buffer[i] == NameB->Buffer[i])) {
+        i += 1;
+    }
+
+    if (i < MinLength) {
+        return (NameA->Buffer[i] < NameB->Buffer[i]) ? -1 : 1;
+    }
+
+    if (NameA->Length != NameB->Length) {
+        return (NameA->Length < NameB->Length) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static void
+SplayRotate (
+    SPLAY_NAME *Node
+    )
+{
+    SPLAY_NAME *Parent = Node->Parent;
+    SPLAY_NAME *Grandparent = Parent->Parent;
+
+    if (Parent->Left == Node) {
+        Parent->Left = Node->Right;
+        if (Node->Right != NULL) {
+            Node->Right->Parent = Parent;
+        }
+        Node->Right = Parent;
+    } else {
+        Parent->Right = Node->Left;
+        if (Node->Left != NULL) {
+            Node->Left->Parent = Parent;
+        }
+        Node->Left = Parent;
+    }
+
+    Parent->Parent = Node;
+    Node->Parent = Grandparent;
+
+    if (Grandparent != NULL) {
+        if (Grandparent->Left == Parent) {
+            Grandparent->Left = Node;
+        } else {
+            Grandparent->Right = Node;
+        }
+    }
+}
+
+static SPLAY_NAME *
+SplaySplay (
+    SPLAY_NAME *Node
+    )
+{
+    while (Node->Parent != NULL) {
+
+        SPLAY_NAME *Parent = Node->Parent;
+
+        if (Parent->Parent == NULL) {
+            SplayRotate( Node );
+        } else if ((Parent->Left == Node) == (Parent->Parent->Left == Parent)) {
+            SplayRotate( Parent );
+            SplayRotate( Node );
+        } else {
+            SplayRotate( Node );
+            SplayRotate( Node );
+        }
+    }
+
+    return Node;
+}
+
+static void
+SplayInsertName (
+    SPLAY_NAME **Root,
+    SPLAY_NAME *Name
+    )
+{
+    SPLAY_NAME *Node = *Root;
+
+    Name->Parent = Name->Left = Name->Right = NULL;
+
+    if (Node == NULL) {
+        *Root = Name;
+        return;
+    }
+
+    while (1) {
+
+        int Comparison = SplayCompareNames( &Node->Name, &Name->Name );
+
+        assert( Comparison != 0 );
+
+        if (Comparison > 0) {
+            if (Node->Left == NULL) {
+                Node->Left = Name;
+                break;
+            }
+            Node = Node->Left;
+        } else {
+            if (Node->Right == NULL) {
+                Node->Right = Name;
+                break;
+            }
+            Node = Node->Right;
+        }
+    }
+
+    Name->Parent = Node;
+}
+
+static PFCB
+SplayFindFcb (
+    SPLAY_NAME **Root,
+    const STRING *Name,
+    BOOLEAN *FileNameDos
+    )
+{
+    SPLAY_NAME *Node = *Root;
+
+    while (Node != NULL) {
+
+        int Comparison = SplayCompareNames( &Node->Name, Name );
+
+        if (Comparison > 0) {
+            Node = Node->Left;
+        } else if (Comparison < 0) {
+            Node = Node->Right;
+        } else {
+            *Root = SplaySplay( Node );
+            *FileNameDos = Node->FileNameDos;
+            return Node->Fcb;
+        }
+    }
+
+    return NULL;
+}
+
+//
+//  A directory of open files.  A third of the files only have a short name,
+//  half have a long name that fits in the Oem code page and the rest have a
+//  long name that does not, so it lives in the Unicode names.
+//
+
+typedef struct _OPEN_QUERY {
+    STRING Oem;             // no Buffer if the name is not Oem expressible
+    STRING Unicode;
+    PFCB Expected;
+    BOOLEAN ExpectedDos;
+} OPEN_QUERY;
+
+typedef struct _HOT_DIRECTORY {
+    DCB Dcb;
+    FCB *Fcbs;
+    uint32_t FileCount;
+
+    SPLAY_NAME *SplayNames;
+    SPLAY_NAME *SplayOemRoot;
+    SPLAY_NAME *SplayUnicodeRoot;
+
+    OPEN_QUERY *Queries;
+    uint32_t QueryCount;
+
+    pthread_mutex_t ExclusiveLock;
+    pthread_rwlock_t SharedLock;
+} HOT_DIRECTORY;
+
+static char *
+CopyOem (
+    const char *Text,
+    USHORT *Length
+    )
+{
+    size_t Bytes = strlen( Text );
+
+    *Length = (USHORT)Bytes;
+    return memcpy( malloc( Bytes ), Text, Bytes );
+}
+
+//
+//  The upcased Unicode form of an upcased name.  If Unmappable is set the
+//  first character is replaced by one outside the Oem code page.
+//
+
+static char *
+CopyUnicode (
+    const char *Text,
+    int Unmappable,
+    USHORT *Length
+    )
+{
+    size_t Count = strlen( Text );
+    WCHAR *Wide = malloc( Count * sizeof(WCHAR) );
+    size_t i;
+
+    for (i = 0; i < Count; i += 1) {
+        Wide[i] = (WCHAR)(UCHAR)Text[i];
+    }
+    if (Unmappable) {
+        Wide[0] = 0x0394;
+    }
+
+    *Length = (USHORT)(Count * sizeof(WCHAR));
+    return (char *)Wide;
+}
+
+static void
+FormatShortName (
+    uint32_t Index,
+    int HasLongName,
+    char *Buffer,
+    size_t Size
+    )
+{
+    if (HasLongName) {
+        snprintf( Buffer, Size, "R%05X~1.DOC", Index & 0xfffff );
+    } else {
+        snprintf( Buffer, Size, "F%07u.DAT", Index );
+    }
+}
+
+static void
+InitializeNameNode (
+    PFILE_NAME_NODE Node,
+    PFCB Fcb,
+    char *Buffer,
+    USHORT Length,
+    BOOLEAN FileNameDos
+    )
+{
+    memset( Node, 0, sizeof(*Node) );
+    Node->Fcb = Fcb;
+    Node->Name.Oem.Buffer = Buffer;
+    Node->Name.Oem.Length = Node->Name.Oem.MaximumLength = Length;
+    Node->FileNameDos = FileNameDos;
+}
+
+//
+//  Builds the names of one Fcb the way FatConstructNamesInFcb does and
+//  enters them in the tables, and in the splay trees if asked.
+//
+
+static void
+OpenFcb (
+    HOT_DIRECTORY *Dir,
+    PFCB Fcb,
+    uint32_t Index,
+    int Splay
+    )
+{
+    IRP_CONTEXT IrpContext = { 0 };
+    char Text[64];
+    USHORT Length;
+    char *Buffer;
+    int Kind = Index % 6;
+
+    memset( Fcb, 0, sizeof(*Fcb) );
+    Fcb->ParentDcb = &Dir->Dcb;
+    Fcb->FcbCondition = FcbGood;
+    Fcb->FcbState = FCB_STATE_NAMES_IN_SPLAY_TREE;
+
+    FormatShortName( Index, Kind >= 2, Text, sizeof(Text) );
+    Buffer = CopyOem( Text, &Length );
+    InitializeNameNode( &Fcb->ShortName, Fcb, Buffer, Length, TRUE );
+    FatInsertName( &IrpContext, &Dir->Dcb.Specific.Dcb.OemNames, &Fcb->ShortName );
+
+    if ((Kind >= 2) && (Kind < 5)) {
+
+        snprintf( Text, sizeof(Text), "QUARTERLY REPORT %u.DOCX", Index );
+        Buffer = CopyOem( Text, &Length );
+        StringsOutstanding += 1;
+        InitializeNameNode( &Fcb->LongName.Oem, Fcb, Buffer, Length, FALSE );
+        FatInsertName( &IrpContext, &Dir->Dcb.Specific.Dcb.OemNames, &Fcb->LongName.Oem );
+        Fcb->FcbState |= FCB_STATE_HAS_OEM_LONG_NAME;
+
+    } else if (Kind == 5) {
+
+        snprintf( Text, sizeof(Text), "? PROJECT NOTES %u.TXT", Index );
+        Buffer = CopyUnicode( Text, TRUE, &Length );
+        StringsOutstanding += 1;
+        InitializeNameNode( &Fcb->LongName.Unicode, Fcb, Buffer, Length, FALSE );
+        FatInsertName( &IrpContext, &Dir->Dcb.Specific.Dcb.UnicodeNames, &Fcb->LongName.Unicode );
+        Fcb->FcbState |= FCB_STATE_HAS_UNICODE_LONG_NAME;
+    }
+
+    if (Splay) {
+
+        SPLAY_NAME *Name = &Dir->SplayNames[Index * 2];
+
+        Name->Name = Fcb->ShortName.Name.Oem;
+        Name->Fcb = Fcb;
+        Name->FileNameDos = TRUE;
+        SplayInsertName( &Dir->SplayOemRoot, Name );
+
+        if (Kind >= 2) {
+
+            Name += 1;
+            Name->Name = Fcb->LongName.Oem.Name.Oem;
+            Name->Fcb = Fcb;
+            Name->FileNameDos = FALSE;
+            SplayInsertName( (Kind == 5) ? &Dir->SplayUnicodeRoot : &Dir->SplayOemRoot, Name );
+        }
+    }
+}
+
+static void
+CloseFcb (
+    PFCB Fcb
+    )
+{
+    IRP_CONTEXT IrpContext = { 0 };
+
+    FatRemoveNames( &IrpContext, Fcb );
+    free( Fcb->ShortName.Name.Oem.Buffer );
+    Fcb->ShortName.Name.Oem.Buffer = NULL;
+}
+
+//
+//  The opens the benchmark replays: every file by the name a user would
+//  type, long names also by their short name, and some names that are not
+//  open at all.
+//
+
+static void
+BuildQueries (
+    HOT_DIRECTORY *Dir,
+    uint32_t MissPercent,
+    uint64_t Seed
+    )
+{
+    uint64_t State = Seed;
+    uint32_t i;
+
+    Dir->QueryCount = Dir->FileCount * 2;
+    Dir->Queries = calloc( Dir->QueryCount, sizeof(OPEN_QUERY) );
+
+    for (i = 0; i < Dir->QueryCount; i += 1) {
+
+        OPEN_QUERY *Query = &Dir->Queries[i];
+        uint32_t Index = (uint32_t)(Random64( &State ) % Dir->FileCount);
+        PFCB Fcb = &Dir->Fcbs[Index];
+        char Text[64];
+
+        if ((Random64( &State ) % 100) < MissPercent) {
+
+            snprintf( Text, sizeof(Text), "NEW FILE %u.TMP", i );
+            Query->Oem.Buffer = CopyOem( Text, &Query->Oem.Length );
+            Query->Unicode.Buffer = CopyUnicode( Text, FALSE, &Query->Unicode.Length );
+            continue;
+        }
+
+        Query->Expected = Fcb;
+
+        if (FlagOn( Fcb->FcbState, FCB_STATE_HAS_UNICODE_LONG_NAME ) &&
+            ((Random64( &State ) % 4) != 0)) {
+
+            snprintf( Text, sizeof(Text), "? PROJECT NOTES %u.TXT", (uint32_t)(Fcb - Dir->Fcbs) );
+            Query->Unicode.Buffer = CopyUnicode( Text, TRUE, &Query->Unicode.Length );
+            Query->ExpectedDos = FALSE;
+            continue;
+        }
+
+        if (FlagOn( Fcb->FcbState, FCB_STATE_HAS_OEM_LONG_NAME ) &&
+            ((Random64( &State ) % 4) != 0)) {
+
+            snprintf( Text, sizeof(Text), "QUARTERLY REPORT %u.DOCX", (uint32_t)(Fcb - Dir->Fcbs) );
+            Query->ExpectedDos = FALSE;
+
+        } else {
+
+            memcpy( Text, Fcb->ShortName.Name.Oem.Buffer, Fcb->ShortName.Name.Oem.Length );
+            Text[Fcb->ShortName.Name.Oem.Length] = '\0';
+            Query->ExpectedDos = TRUE;
+        }
+
+        Query->Oem.Buffer = CopyOem( Text, &Query->Oem.Length );
+        Query->Unicode.Buffer = CopyUnicode( Text, FALSE, &Query->Unicode.Length );
+    }
+}
+
+static int
+InitializeDirectory (
+    HOT_DIRECTORY *Dir,
+    uint32_t Files,
+    uint32_t MissPercent,
+    int Splay
+    )
+{
+    uint64_t State = 0x2545F4914F6CDD1Dull;
+    uint32_t *Order;
+    uint32_t i;
+
+    memset( Dir, 0, sizeof(*Dir) );
+    FatInitializeNameTable( &Dir->Dcb.Specific.Dcb.OemNames );
+    FatInitializeNameTable( &Dir->Dcb.Specific.Dcb.UnicodeNames );
+
+    Dir->FileCount = Files;
+    Dir->Fcbs = calloc( Files, sizeof(FCB) );
+    Dir->SplayNames = Splay ? calloc( (size_t)Files * 2, sizeof(SPLAY_NAME) ) : NULL;
+
+    if ((Dir->Fcbs == NULL) || (Splay && (Dir->SplayNames == NULL))) {
+        return 0;
+    }
+
+    //
+    //  Files are opened in a random order, as they would be by a busy
+    //  server, rather than in name order, which would leave the splay trees
+    //  as lists.
+    //
+
+    Order = malloc( Files * sizeof(uint32_t) );
+    for (i = 0; i < Files; i += 1) {
+        Order[i] = i;
+    }
+    for (i = Files - 1; i > 0; i -= 1) {
+        uint32_t j = (uint32_t)(Random64( &State ) % (i + 1));
+        uint32_t t = Order[i];
+        Order[i] = Order[j];
+        Order[j] = t;
+    }
+    for (i = 0; i < Files; i += 1) {
+        OpenFcb( Dir, &Dir->Fcbs[Order[i]], Order[i], Splay );
+    }
+    free( Order );
+
+    BuildQueries( Dir, MissPercent, 0x9E3779B97F4A7C15ull ^ Files );
+
+    pthread_mutex_init( &Dir->ExclusiveLock, NULL );
+    pthread_rwlock_init( &Dir->SharedLock, NULL );
+    return 1;
+}
+
+static void
+CleanupDirectory (
+    HOT_DIRECTORY *Dir
+    )
+{
+    uint32_t i;
+
+    for (i = 0; i < Dir->QueryCount; i += 1) {
+        free( Dir->Queries[i].Oem.Buffer );
+        free( Dir->Queries[i].Unicode.Buffer );
+    }
+
+    for (i = 0; i < Dir->FileCount; i += 1) {
+        CloseFcb( &Dir->Fcbs[i] );
+    }
+
+    FatUninitializeNameTable( &Dir->Dcb.Specific.Dcb.OemNames );
+    FatUninitializeNameTable( &Dir->Dcb.Specific.Dcb.UnicodeNames );
+
+    pthread_mutex_destroy( &Dir->ExclusiveLock );
+    pthread_rwlock_destroy( &Dir->SharedLock );
+
+    free( Dir->Queries );
+    free( Dir->SplayNames );
+    free( Dir->Fcbs );
+}
+
+//
+//  One open of an existing file, as far as the name lookup in
+//  FatCommonCreate goes.
+//
+
+typedef enum _LOOKUP_MODE {
+    LookupSplay,
+    LookupHash,
+    LookupShared
+} LOOKUP_MODE;
+
+static PFCB
+OpenByName (
+    HOT_DIRECTORY *Dir,
+    LOOKUP_MODE Mode,
+    const OPEN_QUERY *Query,
+    BOOLEAN *FileNameDos
+    )
+{
+    IRP_CONTEXT IrpContext = { 0 };
+    PFCB Fcb = NULL;
+
+    if (Mode == LookupSplay) {
+
+        pthread_mutex_lock( &Dir->ExclusiveLock );
+
+        if (Query->Oem.Buffer != NULL) {
+            Fcb = SplayFindFcb( &Dir->SplayOemRoot, &Query->Oem, FileNameDos );
+        }
+        if ((Fcb == NULL) && (Dir->SplayUnicodeRoot != NULL)) {
+            Fcb = SplayFindFcb( &Dir->SplayUnicodeRoot, &Query->Unicode, FileNameDos );
+        }
+
+        pthread_mutex_unlock( &Dir->ExclusiveLock );
+        return Fcb;
+    }
+
+    if (Mode == LookupShared) {
+        pthread_rwlock_rdlock( &Dir->SharedLock );
+    } else {
+        pthread_mutex_lock( &Dir->ExclusiveLock );
+    }
+
+    if (Query->Oem.Buffer != NULL) {
+        Fcb = FatFindFcb( &IrpContext,
+                          &Dir->Dcb.Specific.Dcb.OemNames,
+                          (PSTRING)&Query->Oem,
+                          FileNameDos );
+    }
+    if ((Fcb == NULL) && (Dir->Dcb.Specific.Dcb.UnicodeNames.EntryCount != 0)) {
+        Fcb = FatFindFcb( &IrpContext,
+                          &Dir->Dcb.Specific.Dcb.UnicodeNames,
+                          (PSTRING)&Query->Unicode,
+                          FileNameDos );
+    }
+
+    if (Mode == LookupShared) {
+        pthread_rwlock_unlock( &Dir->SharedLock );
+    } else {
+        pthread_mutex_unlock( &Dir->ExclusiveLock );
+    }
+
+    return Fcb;
+}
+
+typedef struct _WORKER {
+    HOT_DIRECTORY *Dir;
+    LOOKUP_MODE Mode;
+    unsigned Id;
+    atomic_int *Stop;
+    unsigned long long Opens;
+    unsigned long long Mismatches;
+} WORKER;
+
+static void *
+Worker (
+    void *Context
+    )
+{
+    WORKER *Worker = Context;
+    HOT_DIRECTORY *Dir = Worker->Dir;
+    uint64_t State = 0x9E3779B97F4A7C15ull * (Worker->Id + 1);
+    unsigned long long Opens = 0;
+    unsigned long long Mismatches = 0;
+
+    while (!atomic_load_explicit( Worker->Stop, memory_order_relaxed )) {
+
+        unsigned Batch;
+
+        for (Batch = 0; Batch < 256; Batch += 1) {
+
+            const OPEN_QUERY *Query = &Dir->Queries[Random64( &State ) % Dir->QueryCount];
+            BOOLEAN FileNameDos = FALSE;
+            PFCB Fcb = OpenByName( Dir, Worker->Mode, Query, &FileNameDos );
+
+            if ((Fcb != Query->Expected) ||
+                ((Fcb != NULL) && (FileNameDos != Query->ExpectedDos))) {
+
+                Mismatches += 1;
+            }
+        }
+
+        Opens += Batch;
+    }
+
+    Worker->Opens = Opens;
+    Worker->Mismatches = Mismatches;
+    return NULL;
+}
+
+static double
+Run (
+    HOT_DIRECTORY *Dir,
+    LOOKUP_MODE Mode,
+    unsigned Threads,
+    double Seconds,
+    unsigned long long *Mismatches
+    )
+{
+    WORKER Workers[MAX_THREADS];
+    pthread_t Handles[MAX_THREADS];
+    atomic_int Stop = 0;
+    struct timespec Delay;
+    unsigned long long Total = 0;
+    double Start;
+    double Elapsed;
+    unsigned i;
+
+    for (i = 0; i < Threads; i += 1) {
+        Workers[i].Dir = Dir;
+        Workers[i].Mode = Mode;
+        Workers[i].Id = i;
+        Workers[i].Stop = &Stop;
+        Workers[i].Opens = 0;
+        Workers[i].Mismatches = 0;
+    }
+
+    Start = Now();
+    for (i = 0; i < Threads; i += 1) {
+        pthread_create( &Handles[i], NULL, Worker, &Workers[i] );
+    }
+
+    Delay.tv_sec = (time_t)Seconds;
+    Delay.tv_nsec = (long)((Seconds - (double)Delay.tv_sec) * 1e9);
+    nanosleep( &Delay, NULL );
+    atomic_store( &Stop, 1 );
+
+    for (i = 0; i < Threads; i += 1) {
+        pthread_join( Handles[i], NULL );
+        Total += Workers[i].Opens;
+        *Mismatches += Workers[i].Mismatches;
+    }
+    Elapsed = Now() - Start;
+
+    return (double)Total / Elapsed;
+}
+
+//
+//  Checks every query of a directory against the expected Fcb, through the
+//  tables and, if they were built, the splay trees.
+//
+
+static void
+CheckAllQueries (
+    HOT_DIRECTORY *Dir,
+    int Splay
+    )
+{
+    unsigned long long Wrong[3] = { 0, 0, 0 };
+    uint32_t i;
+    int Mode;
+
+    for (i = 0; i < Dir->QueryCount; i += 1) {
+
+        const OPEN_QUERY *Query = &Dir->Queries[i];
+
+        for (Mode = Splay ? LookupSplay : LookupHash; Mode <= LookupShared; Mode += 1) {
+
+            BOOLEAN FileNameDos = 2;
+            PFCB Fcb = OpenByName( Dir, (LOOKUP_MODE)Mode, Query, &FileNameDos );
+
+            if ((Fcb != Query->Expected) ||
+                ((Fcb != NULL) && (FileNameDos != Query->ExpectedDos)) ||
+                ((Fcb == NULL) && (FileNameDos != 2))) {
+
+                Wrong[Mode] += 1;
+            }
+        }
+    }
+
+    CHECK( Wrong[LookupSplay] == 0 );
+    CHECK( Wrong[LookupHash] == 0 );
+    CHECK( Wrong[LookupShared] == 0 );
+}
+
+static int
+SelfTest (
+    void
+    )
+{
+    IRP_CONTEXT IrpContext = { 0 };
+    HOT_DIRECTORY Dir;
+    PFAT_NAME_TABLE Oem = &Dir.Dcb.Specific.Dcb.OemNames;
+    PFAT_NAME_TABLE Unicode = &Dir.Dcb.Specific.Dcb.UnicodeNames;
+    unsigned long long Mismatches = 0;
+    FCB Stale;
+    FCB Twin;
+    char *Buffer;
+    USHORT Length;
+    uint32_t LongNames;
+    uint32_t OddLongNames;
+    uint32_t i;
+
+    //
+    //  A small directory stays in the buckets embedded in the Dcb.
+    //
+
+    CHECK( InitializeDirectory( &Dir, 5, 10, 1 ) );
+    CHECK( Oem->BucketCount == FAT_NAME_TABLE_INLINE_BUCKETS );
+    CHECK( Oem->Buckets == &Oem->InlineBuckets[0] );
+    CHECK( PoolOutstanding == 0 );
+    CheckAllQueries( &Dir, 1 );
+    CleanupDirectory( &Dir );
+
+    //
+    //  A large one grows its bucket arrays as it fills.  Every open must find the same Fcb, by the same kind
+    //  of name, as the splay trees did.
+    //
+
+    CHECK( InitializeDirectory( &Dir, 20000, 10, 1 ) );
+    printf( "20000 files: %u Oem names in %u buckets, %u Unicode names in %u buckets\n",
+            Oem->EntryCount, Oem->BucketCount, Unicode->EntryCount, Unicode->BucketCount );
+
+    for (i = 0, LongNames = 0, OddLongNames = 0; i < Dir.FileCount; i += 1) {
+        if (i % 6 >= 2) {
+            LongNames += 1;
+            OddLongNames += i % 2;
+        }
+    }
+
+    CHECK( Oem->EntryCount + Unicode->EntryCount == Dir.FileCount + LongNames );
+    CHECK( StringsOutstanding == (long)LongNames );
+    CHECK( Oem->BucketCount == 0x4000 );
+    CHECK( Unicode->BucketCount == 0x1000 );
+    CHECK( PoolOutstanding == 2 );
+    CheckAllQueries( &Dir, 1 );
+
+    //
+    //  Threads opening concurrently under the shared lock all see the same
+    //  answers (run this under -fsanitize=thread to check for writes).
+    //
+
+    Run( &Dir, LookupShared, 4, 0.2, &Mismatches );
+    CHECK( Mismatches == 0 );
+
+    //
+    //  Close every other file.  The closed names are gone, the rest are
+    //  still found and the long name strings were freed.
+    //
+
+    for (i = 0; i < Dir.FileCount; i += 2) {
+        FatRemoveNames( &IrpContext, &Dir.Fcbs[i] );
+    }
+    CHECK( Oem->EntryCount + Unicode->EntryCount == Dir.FileCount / 2 + OddLongNames );
+    CHECK( StringsOutstanding == (long)OddLongNames );
+
+    for (i = 0; i < Dir.QueryCount; i += 1) {
+
+        OPEN_QUERY *Query = &Dir.Queries[i];
+
+        if ((Query->Expected != NULL) && ((Query->Expected - Dir.Fcbs) % 2 == 0)) {
+            Query->Expected = NULL;
+        }
+    }
+    CheckAllQueries( &Dir, 0 );
+
+    //
+    //  A name already held by an Fcb that is no longer good is taken over:
+    //  the old Fcb is marked bad and loses all its names.
+    //
+
+    memset( &Stale, 0, sizeof(Stale) );
+    Stale.ParentDcb = &Dir.Dcb;
+    Stale.FcbCondition = FcbGood;
+    Stale.FcbState = FCB_STATE_NAMES_IN_SPLAY_TREE | FCB_STATE_HAS_OEM_LONG_NAME;
+    Buffer = CopyOem( "STALE.TXT", &Length );
+    InitializeNameNode( &Stale.ShortName, &Stale, Buffer, Length, TRUE );
+    FatInsertName( &IrpContext, Oem, &Stale.ShortName );
+    Buffer = CopyOem( "STALE LONG NAME.TXT", &Length );
+    StringsOutstanding += 1;
+    InitializeNameNode( &Stale.LongName.Oem, &Stale, Buffer, Length, FALSE );
+    FatInsertName( &IrpContext, Oem, &Stale.LongName.Oem );
+
+    memset( &Twin, 0, sizeof(Twin) );
+    Twin.ParentDcb = &Dir.Dcb;
+    Twin.FcbCondition = FcbGood;
+    Twin.FcbState = FCB_STATE_NAMES_IN_SPLAY_TREE;
+    Buffer = CopyOem( "STALE.TXT", &Length );
+    InitializeNameNode( &Twin.ShortName, &Twin, Buffer, Length, TRUE );
+    FatInsertName( &IrpContext, Oem, &Twin.ShortName );
+
+    CHECK( Stale.FcbCondition == FcbBad );
+    CHECK( !FlagOn( Stale.FcbState, FCB_STATE_NAMES_IN_SPLAY_TREE ) );
+    CHECK( FatFindFcb( &IrpContext, Oem, &Twin.ShortName.Name.Oem, NULL ) == &Twin );
+    {
+        STRING LongName = { 19, 19, "STALE LONG NAME.TXT" };
+        CHECK( FatFindFcb( &IrpContext, Oem, &LongName, NULL ) == NULL );
+    }
+
+    //
+    //  Inserting a name held by an Fcb whose state reads FcbGood is a
+    //  corruption and bugchecks.
+    //
+
+    free( Stale.ShortName.Name.Oem.Buffer );
+
+    Twin.FcbState = FcbGood;
+    Buffer = CopyOem( "STALE.TXT", &Length );
+    InitializeNameNode( &Stale.ShortName, &Stale, Buffer, Length, TRUE );
+    if (setjmp( BugCheckJump ) == 0) {
+        FatInsertName( &IrpContext, Oem, &Stale.ShortName );
+    }
+    CHECK( BugChecks == 1 );
+    Twin.FcbState = FCB_STATE_NAMES_IN_SPLAY_TREE;
+    free( Buffer );
+
+    FatRemoveNames( &IrpContext, &Twin );
+    free( Twin.ShortName.Name.Oem.Buffer );
+
+    //
+    //  Closing the rest empties the tables and gives back all their pool.
+    //
+
+    CleanupDirectory( &Dir );
+    CHECK( PoolOutstanding == 0 );
+    CHECK( StringsOutstanding == 0 );
+
+    //
+    //  Without pool the tables never leave the embedded buckets, and still
+    //  work with long chains.
+    //
+
+    PoolFail = 1;
+    CHECK( InitializeDirectory( &Dir, 3000, 10, 0 ) );
+    CHECK( Oem->BucketCount == FAT_NAME_TABLE_INLINE_BUCKETS );
+    CheckAllQueries( &Dir, 0 );
+    CleanupDirectory( &Dir );
+    PoolFail = 0;
+
+    CHECK( PoolOutstanding == 0 );
+    CHECK( StringsOutstanding == 0 );
+
+    printf( "%s\n", Failures ? "FAILED" : "passed" );
+    return Failures ? 1 : 0;
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    unsigned ThreadCounts[MAX_THREADS];
+    unsigned ThreadCountCount = 0;
+    uint32_t Files = 10000;
+    uint32_t MissPercent = 10;
+    double Seconds = 1.0;
+    unsigned long long Mismatches = 0;
+    HOT_DIRECTORY Dir;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp( argv[i], "--selftest" ) == 0) {
+            return SelfTest();
+        } else if ((strcmp( argv[i], "--files" ) == 0) && (i + 1 < argc)) {
+            Files = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((strcmp( argv[i], "--seconds" ) == 0) && (i + 1 < argc)) {
+            Seconds = atof( argv[++i] );
+        } else if ((strcmp( argv[i], "--miss" ) == 0) && (i + 1 < argc)) {
+            MissPercent = (uint32_t)strtoul( argv[++i], NULL, 0 );
+        } else if ((atoi( argv[i] ) > 0) && (atoi( argv[i] ) <= MAX_THREADS) &&
+                   (ThreadCountCount < MAX_THREADS)) {
+            ThreadCounts[ThreadCountCount++] = (unsigned)atoi( argv[i] );
+        } else {
+            fprintf( stderr,
+                     "usage: namebench --selftest\n"
+                     "       namebench [--files n] [--seconds s] [--miss pct] [threads...]\n" );
+            return 2;
+        }
+    }
+
+    if (ThreadCountCount == 0) {
+        ThreadCounts[ThreadCountCount++] = 1;
+        ThreadCounts[ThreadCountCount++] = 2;
+        ThreadCounts[ThreadCountCount++] = 4;
+        ThreadCounts[ThreadCountCount++] = 8;
+    }
+
+    if ((Files == 0) || (Seconds <= 0) || (MissPercent > 100)) {
+        fprintf( stderr, "invalid parameters\n" );
+        return 2;
+    }
+
+    if (!InitializeDirectory( &Dir, Files, MissPercent, 1 )) {
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+
+    printf( "%u open files in one directory, %u%% opens of names not open, %.1fs per run\n",
+            Files, MissPercent, Seconds );
+    printf( "%8s %14s %14s %14s %9s\n",
+            "threads", "splay opens/s", "hash opens/s", "shared opens/s", "speedup" );
+
+    for (i = 0; i < (int)ThreadCountCount; i++) {
+
+        double Rate[3];
+        int Mode;
+
+        for (Mode = LookupSplay; Mode <= LookupShared; Mode += 1) {
+            Rate[Mode] = Run( &Dir, (LOOKUP_MODE)Mode, ThreadCounts[i], Seconds, &Mismatches );
+        }
+
+        printf( "%8u %14.0f %14.0f %14.0f %8.2fx\n",
+                ThreadCounts[i], Rate[LookupSplay], Rate[LookupHash], Rate[LookupShared],
+                Rate[LookupShared] / Rate[LookupSplay] );
+    }
+
+    CleanupDirectory( &Dir );
+
+    if (Mismatches != 0) {
+        printf( "%llu opens found the wrong Fcb\n", Mismatches );
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    FatProcs.h
+
+Abstract:
+
+    Minimal stand-in for the driver's FatProcs.h, so that ../../splaysup.c
+    compiles unchanged on the host.  Only what the name tables touch is
+    declared here; the structures mirror fatstruc.h field for field.  The
+    pool, condition and string routines are supplied by the test program.
+
+Environment:
+
+    Host (user mode), C99.
+
+--*/
+
+#ifndef _FATPROCS_HOST_
+#define _FATPROCS_HOST_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define VOID void
+
+typedef uint8_t UCHAR;
+typedef uint8_t BOOLEAN;
+typedef char CHAR;
+typedef uint16_t USHORT;
+typedef uint16_t WCHAR;
+typedef uint32_t ULONG;
+typedef uintptr_t ULONG_PTR;
+typedef BOOLEAN *PBOOLEAN;
+
+#define TRUE  1
+#define FALSE 0
+
+typedef struct _STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    CHAR *Buffer;
+} STRING, *PSTRING, OEM_STRING, *POEM_STRING;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    WCHAR *Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef struct _IRP_CONTEXT {
+    ULONG Flags;
+} IRP_CONTEXT, *PIRP_CONTEXT;
+
+//
+//  fatstruc.h
+//
+
+typedef struct _FILE_NAME_NODE {
+
+    struct _FCB *Fcb;
+
+    union {
+
+        OEM_STRING Oem;
+
+        UNICODE_STRING Unicode;
+
+    } Name;
+
+    BOOLEAN FileNameDos;
+
+    ULONG NameHash;
+
+    struct _FILE_NAME_NODE *HashNext;
+
+} FILE_NAME_NODE;
+typedef FILE_NAME_NODE *PFILE_NAME_NODE;
+
+#define FAT_NAME_TABLE_INLINE_BUCKETS    (4)
+
+typedef struct _FAT_NAME_TABLE {
+
+    ULONG EntryCount;
+
+    ULONG BucketCount;
+
+    PFILE_NAME_NODE *Buckets;
+
+    PFILE_NAME_NODE InlineBuckets[FAT_NAME_TABLE_INLINE_BUCKETS];
+
+} FAT_NAME_TABLE;
+typedef FAT_NAME_TABLE *PFAT_NAME_TABLE;
+
+typedef enum _FCB_CONDITION {
+    FcbGood = 1,
+    FcbBad,
+    FcbNeedsToBeVerified
+} FCB_CONDITION;
+
+typedef struct _FCB {
+
+    struct _FCB *ParentDcb;
+
+    ULONG FcbState;
+
+    FCB_CONDITION FcbCondition;
+
+    FILE_NAME_NODE ShortName;
+
+    union {
+
+        FILE_NAME_NODE Oem;
+
+        FILE_NAME_NODE Unicode;
+
+    } LongName;
+
+    union {
+
+        struct {
+
+            FAT_NAME_TABLE OemNames;
+
+            FAT_NAME_TABLE UnicodeNames;
+
+        } Dcb;
+
+    } Specific;
+
+} FCB, *PFCB, DCB, *PDCB;
+
+#define FCB_STATE_NAMES_IN_SPLAY_TREE    (0x00000100)
+#define FCB_STATE_HAS_OEM_LONG_NAME      (0x00000200)
+#define FCB_STATE_HAS_UNICODE_LONG_NAME  (0x00000400)
+
+//
+//  nodetype.h, fatdata.h
+//
+
+#define FAT_BUG_CHECK_SPLAYSUP           (0x001b0000)
+#define DEBUG_TRACE_SPLAYSUP             (0x08000000)
+#define TAG_NAME_TABLE                   'htaF'
+
+//
+//  Kernel and FsRtl stand-ins, implemented by the test program.
+//
+
+typedef enum _POOL_TYPE {
+    NonPagedPool,
+    PagedPool
+} POOL_TYPE;
+
+void *HostAllocatePool(size_t Size);
+void HostFreePool(void *P);
+void HostBugCheck(ULONG_PTR A, ULONG_PTR B, ULONG_PTR C);
+void HostMarkFcbCondition(PFCB Fcb, FCB_CONDITION Condition);
+void HostFreeString(void *Buffer);
+
+#define PAGED_CODE()
+#define UNREFERENCED_PARAMETER(P)        ((void)(P))
+#define NT_ASSERT(X)                     assert(X)
+
+#define FlagOn(F,SF)                     ((F) & (SF))
+#define ClearFlag(F,SF)                  ((F) &= ~(SF))
+
+#define RtlZeroMemory(D,L)               memset((D), 0, (L))
+#define RtlEqualMemory(D,S,L)            (memcmp((D), (S), (L)) == 0)
+#define RtlFreeOemString(S)              HostFreeString((S)->Buffer)
+#define RtlFreeUnicodeString(S)          HostFreeString((S)->Buffer)
+
+#define ExAllocatePoolWithTag(T,S,G)     HostAllocatePool(S)
+#define ExFreePool(P)                    HostFreePool(P)
+
+#define FatBugCheck(A,B,C)               HostBugCheck((A), (B), (C))
+#define FatMarkFcbCondition(I,F,C,R)     HostMarkFcbCondition((F), (C))
+
+//
+//  splaysup.c
+//
+
+VOID
+FatInitializeNameTable (
+    IN PFAT_NAME_TABLE Table
+    );
+
+VOID
+FatUninitializeNameTable (
+    IN PFAT_NAME_TABLE Table
+    );
+
+VOID
+FatInsertName (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFAT_NAME_TABLE Table,
+    IN PFILE_NAME_NODE Name
+    );
+
+VOID
+FatRemoveNames (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    );
+
+PFCB
+FatFindFcb (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFAT_NAME_TABLE Table,
+    IN PSTRING Name,
+    OUT PBOOLEAN FileNameDos OPTIONAL
+    );
+
+#endif // _FATPROCS_HOST_
@@ -156,6 +156,8 @@ typedef CSHORT NODE_BYTE_SIZE;
 #define TAG_BCB                         'btaF'
 #define TAG_DIRENT                      'DtaF'
 #define TAG_DIRENT_BITMAP               'TtaF'
+#define TAG_DIRENT_INDEX                'HtaF'
+#define TAG_NAME_TABLE                  'htaF'
 #define TAG_EA_DATA                     'dtaF'
 #define TAG_EA_SET_HEADER               'etaF'
 #define TAG_EVENT                       'ttaF'
@@ -8,7 +8,14 @@ Module Name:
 
 Abstract:
 
-    This module implements the Fat Name lookup Suport routines
+    This module implements the Fat Name lookup Suport routines.
+
+    The Fcbs opened under a Dcb are found by name through two hash tables
+    in the Dcb, one for Oem names and one for Unicode names.  Names are
+    always upcased before they are inserted or looked up, so comparisons
+    here are exact and the hash of each name is computed once, when it is
+    inserted, and kept in its FILE_NAME_NODE.  Lookups never modify the
+    table.
 
 
 --*/
@@ -27,46 +34,134 @@ Abstract:
 
 #define Dbg                              (DEBUG_TRACE_SPLAYSUP)
 
+//
+//  A name table is grown once it averages more than this many names per
+//  bucket.  A Fat directory holds at most 64K dirents, so with 64K buckets
+//  even a directory full of open files with long names stays within the
+//  load factor.  The bucket array is only that large (512K on 64 bit) when
+//  that many names are open, each with an Fcb several times larger.
+//
+
+#define FAT_NAME_TABLE_LOAD_FACTOR       (2)
+#define FAT_NAME_TABLE_MAX_BUCKETS       (0x10000)
+
 //
 //  Local procedures and types used only in this package
 //
 
-typedef enum _COMPARISON {
-    IsLessThan,
-    IsGreaterThan,
-    IsEqual
-} COMPARISON;
+ULONG
+FatHashName (
+    IN PSTRING Name
+    );
+
+VOID
+FatGrowNameTable (
+    IN PFAT_NAME_TABLE Table
+    );
 
-COMPARISON
-FatCompareNames (
-    IN PSTRING NameA,
-    IN PSTRING NameB
+VOID
+FatRemoveName (
+    IN PFAT_NAME_TABLE Table,
+    IN PFILE_NAME_NODE Name
     );
 
 //
 //  Do a macro here to check for a common case.
 //
 
-#define CompareNames(NAMEA,NAMEB) (                        \
-    *(PUCHAR)(NAMEA)->Buffer != *(PUCHAR)(NAMEB)->Buffer ? \
-    *(PUCHAR)(NAMEA)->Buffer < *(PUCHAR)(NAMEB)->Buffer ?  \
-    IsLessThan : IsGreaterThan :                           \
-    FatCompareNames((PSTRING)(NAMEA), (PSTRING)(NAMEB))    \
+#define AreNamesEqual(NODE,NAME,HASH) (                                 \
+    ((NODE)->NameHash == (HASH)) &&                                     \
+    ((NODE)->Name.Oem.Length == (NAME)->Length) &&                      \
+    RtlEqualMemory( (NODE)->Name.Oem.Buffer, (NAME)->Buffer, (NAME)->Length ) \
 )
 
 
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FatFindFcb)
+#pragma alloc_text(PAGE, FatGrowNameTable)
+#pragma alloc_text(PAGE, FatHashName)
+#pragma alloc_text(PAGE, FatInitializeNameTable)
 #pragma alloc_text(PAGE, FatInsertName)
+#pragma alloc_text(PAGE, FatRemoveName)
 #pragma alloc_text(PAGE, FatRemoveNames)
-#pragma alloc_text(PAGE, FatFindFcb)
-#pragma alloc_text(PAGE, FatCompareNames)
+#pragma alloc_text(PAGE, FatUninitializeNameTable)
 #endif
 
-
+
+VOID
+FatInitializeNameTable (
+    IN PFAT_NAME_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty name table, using the buckets
+    embedded in the table itself.
+
+Arguments:
+
+    Table - Supplies the table to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    RtlZeroMemory( Table, sizeof(FAT_NAME_TABLE) );
+
+    Table->BucketCount = FAT_NAME_TABLE_INLINE_BUCKETS;
+    Table->Buckets = &Table->InlineBuckets[0];
+}
+
+
+VOID
+FatUninitializeNameTable (
+    IN PFAT_NAME_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees any bucket array allocated for a name table.  The
+    table must be empty.
+
+Arguments:
+
+    Table - Supplies the table to tear down.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    NT_ASSERT( Table->EntryCount == 0 );
+
+    if ((Table->Buckets != NULL) &&
+        (Table->Buckets != &Table->InlineBuckets[0])) {
+
+        ExFreePool( Table->Buckets );
+    }
+
+    Table->Buckets = NULL;
+    Table->BucketCount = 0;
+}
+
+
 VOID
 FatInsertName (
     IN PIRP_CONTEXT IrpContext,
-    IN PRTL_SPLAY_LINKS *RootNode,
+    IN PFAT_NAME_TABLE Table,
     IN PFILE_NAME_NODE Name
     )
 
@@ -74,14 +169,13 @@ FatInsertName (
 
 Routine Description:
 
-    This routine will insert a name in the splay tree pointed to
-    by RootNode.
+    This routine will insert a name in the name table.
 
-    The name must not already exist in the splay tree.
+    The name must not already exist in the table.
 
 Arguments:
 
-    RootNode - Supplies a pointer to the table.
+    Table - Supplies a pointer to the table.
 
     Name - Contains the New name to enter.
 
@@ -92,42 +186,29 @@ Return Value:
 --*/
 
 {
-    COMPARISON Comparison;
     PFILE_NAME_NODE Node;
+    PFILE_NAME_NODE *Bucket;
 
     PAGED_CODE();
 
-    RtlInitializeSplayLinks(&Name->Links);
-
-Restart:
-
     //
-    //  If we are the first entry in the tree, just become the root.
+    //  Note that Oem here doesn't mean anything.
     //
 
-    if (*RootNode == NULL) {
-
-        *RootNode = &Name->Links;
-
-        return;
-    }
+    Name->NameHash = FatHashName( &Name->Name.Oem );
+    Name->HashNext = NULL;
 
-    Node = CONTAINING_RECORD( *RootNode, FILE_NAME_NODE, Links );
+Restart:
 
-    while (TRUE) {
+    Bucket = &Table->Buckets[ Name->NameHash & (Table->BucketCount - 1) ];
 
-        //
-        //  Compare the prefix in the tree with the prefix we want
-        //  to insert.  Note that Oem here doesn't mean anything.
-        //
-
-        Comparison = CompareNames(&Node->Name.Oem, &Name->Name.Oem);
+    for (Node = *Bucket; Node != NULL; Node = Node->HashNext) {
 
         //
         //  We should never find the name in the table already.
         //
 
-        if (Comparison == IsEqual) {
+        if (AreNamesEqual( Node, &Name->Name.Oem, Name->NameHash )) {
 
             //
             //  Almost. If the removable media was taken to another machine and
@@ -144,101 +225,39 @@ Restart:
             //  The old one is gone.  Only if the old one is in normal state
             //  do we really have a problem.
             //
-            
+
             if (Node->Fcb->FcbState == FcbGood) {
 
-#pragma prefast( suppress:28159, "things are seriously wrong if we get here" )                
-                FatBugCheck( (ULONG_PTR)*RootNode, (ULONG_PTR)Name, (ULONG_PTR)Node );
+#pragma prefast( suppress:28159, "things are seriously wrong if we get here" )
+                FatBugCheck( (ULONG_PTR)Table, (ULONG_PTR)Name, (ULONG_PTR)Node );
             }
 
             //
-            //  Note, once we zap the prefix links we need to restart our walk
-            //  of the tree. Note that we aren't properly synchronized to
+            //  Note, once we zap the names we need to restart our walk of
+            //  the bucket.  Note that we aren't properly synchronized to
             //  recursively mark bad.
             //
-            
+
             FatMarkFcbCondition( IrpContext, Node->Fcb, FcbBad, FALSE );
             FatRemoveNames( IrpContext, Node->Fcb );
 
             goto Restart;
         }
+    }
 
-        //
-        //  If the tree prefix is greater than the new prefix then
-        //  we go down the left subtree
-        //
-
-        if (Comparison == IsGreaterThan) {
-
-            //
-            //  We want to go down the left subtree, first check to see
-            //  if we have a left subtree
-            //
-
-            if (RtlLeftChild(&Node->Links) == NULL) {
-
-                //
-                //  there isn't a left child so we insert ourselves as the
-                //  new left child
-                //
-
-                RtlInsertAsLeftChild(&Node->Links, &Name->Links);
-
-                //
-                //  and exit the while loop
-                //
-
-                break;
-
-            } else {
-
-                //
-                //  there is a left child so simply go down that path, and
-                //  go back to the top of the loop
-                //
-
-                Node = CONTAINING_RECORD( RtlLeftChild(&Node->Links),
-                                          FILE_NAME_NODE,
-                                          Links );
-            }
-
-        } else {
-
-            //
-            //  The tree prefix is either less than or a proper prefix
-            //  of the new string.  We treat both cases a less than when
-            //  we do insert.  So we want to go down the right subtree,
-            //  first check to see if we have a right subtree
-            //
-
-            if (RtlRightChild(&Node->Links) == NULL) {
-
-                //
-                //  These isn't a right child so we insert ourselves as the
-                //  new right child
-                //
-
-                RtlInsertAsRightChild(&Node->Links, &Name->Links);
-
-                //
-                //  and exit the while loop
-                //
+    //
+    //  Push the new name on the front of its bucket, and grow the table if
+    //  the chains are getting long.
+    //
 
-                break;
+    Name->HashNext = *Bucket;
+    *Bucket = Name;
 
-            } else {
+    Table->EntryCount += 1;
 
-                //
-                //  there is a right child so simply go down that path, and
-                //  go back to the top of the loop
-                //
+    if (Table->EntryCount > Table->BucketCount * FAT_NAME_TABLE_LOAD_FACTOR) {
 
-                Node = CONTAINING_RECORD( RtlRightChild(&Node->Links),
-                                          FILE_NAME_NODE,
-                                          Links );
-            }
-
-        }
+        FatGrowNameTable( Table );
     }
 
     return;
@@ -255,7 +274,7 @@ FatRemoveNames (
 Routine Description:
 
     This routine will remove the short name and any long names associated
-    with the files from their repsective splay tree.
+    with the files from their repsective name tables.
 
 Arguments:
 
@@ -269,11 +288,10 @@ Return Value:
 
 {
     PDCB Parent;
-    PRTL_SPLAY_LINKS NewRoot;
 
     PAGED_CODE();
     UNREFERENCED_PARAMETER( IrpContext );
-    
+
     Parent = Fcb->ParentDcb;
 
     //
@@ -291,9 +309,7 @@ Return Value:
         //  Delete the node short name.
         //
 
-        NewRoot = RtlDelete(&Fcb->ShortName.Links);
-
-        Parent->Specific.Dcb.RootOemNode = NewRoot;
+        FatRemoveName( &Parent->Specific.Dcb.OemNames, &Fcb->ShortName );
 
         //
         //  Now check for the presence of long name and delete it.
@@ -301,9 +317,7 @@ Return Value:
 
         if (FlagOn( Fcb->FcbState, FCB_STATE_HAS_OEM_LONG_NAME )) {
 
-            NewRoot = RtlDelete(&Fcb->LongName.Oem.Links);
-
-            Parent->Specific.Dcb.RootOemNode = NewRoot;
+            FatRemoveName( &Parent->Specific.Dcb.OemNames, &Fcb->LongName.Oem );
 
             RtlFreeOemString( &Fcb->LongName.Oem.Name.Oem );
 
@@ -312,9 +326,7 @@ Return Value:
 
         if (FlagOn( Fcb->FcbState, FCB_STATE_HAS_UNICODE_LONG_NAME )) {
 
-            NewRoot = RtlDelete(&Fcb->LongName.Unicode.Links);
-
-            Parent->Specific.Dcb.RootUnicodeNode = NewRoot;
+            FatRemoveName( &Parent->Specific.Dcb.UnicodeNames, &Fcb->LongName.Unicode );
 
             RtlFreeUnicodeString( &Fcb->LongName.Unicode.Name.Unicode );
 
@@ -327,11 +339,11 @@ Return Value:
     return;
 }
 
-
+
 PFCB
 FatFindFcb (
     IN PIRP_CONTEXT IrpContext,
-    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PFAT_NAME_TABLE Table,
     IN PSTRING Name,
     OUT PBOOLEAN FileNameDos OPTIONAL
     )
@@ -340,17 +352,16 @@ FatFindFcb (
 
 Routine Description:
 
-    This routine searches either the Oem or Unicode splay tree looking
-    for an Fcb with the specified name.  In the case the Fcb is found,
-    rebalance the tree.
+    This routine searches either the Oem or Unicode name table looking
+    for an Fcb with the specified name.  The table is not modified.
 
 Arguments:
 
-    RootNode - Supplies the parent to search.
+    Table - Supplies the table to search.
 
-    Name - If present, search the Oem tree.
+    Name - Supplies the upcased name to look for.
 
-    UnicodeName - If present, search the Unicode tree.
+    FileNameDos - Receives whether the name found was the short name.
 
 Return Value:
 
@@ -359,64 +370,24 @@ Return Value:
 --*/
 
 {
-    COMPARISON Comparison;
     PFILE_NAME_NODE Node;
-    PRTL_SPLAY_LINKS Links;
+    ULONG NameHash;
 
     PAGED_CODE();
     UNREFERENCED_PARAMETER( IrpContext );
-    
-    Links = *RootNode;
-
-    while (Links != NULL) {
-
-        Node = CONTAINING_RECORD(Links, FILE_NAME_NODE, Links);
-
-        //
-        //  Compare the prefix in the tree with the full name
-        //
-
-        Comparison = CompareNames(&Node->Name.Oem, Name);
-
-        //
-        //  See if they don't match
-        //
-
-        if (Comparison == IsGreaterThan) {
-
-            //
-            //  The prefix is greater than the full name
-            //  so we go down the left child
-            //
 
-            Links = RtlLeftChild(Links);
+    if (Table->EntryCount == 0) {
 
-            //
-            //  And continue searching down this tree
-            //
-
-        } else if (Comparison == IsLessThan) {
-
-            //
-            //  The prefix is less than the full name
-            //  so we go down the right child
-            //
-
-            Links = RtlRightChild(Links);
-
-            //
-            //  And continue searching down this tree
-            //
+        return NULL;
+    }
 
-        } else {
+    NameHash = FatHashName( Name );
 
-            //
-            //  We found it.
-            //
-            //  Splay the tree and save the new root.
-            //
+    for (Node = Table->Buckets[ NameHash & (Table->BucketCount - 1) ];
+         Node != NULL;
+         Node = Node->HashNext) {
 
-            *RootNode = RtlSplay(Links);
+        if (AreNamesEqual( Node, Name, NameHash )) {
 
             //
             //  Tell the caller what kind of name we hit
@@ -438,77 +409,179 @@ Return Value:
     return NULL;
 }
 
-
+
 //
 //  Local support routine
 //
 
-COMPARISON
-FatCompareNames (
-    IN PSTRING NameA,
-    IN PSTRING NameB
+ULONG
+FatHashName (
+    IN PSTRING Name
     )
 
 /*++
 
 Routine Description:
 
-    This function compares two names as fast as possible.  Note that since
-    this comparison is case sensitive, I neither know nor case if the names
-    are UNICODE or OEM.  All that is important is that the result is
-    deterministic.
+    This function hashes a name for the name tables.  Since names are upcased
+    before they get here, I neither know nor care if they are UNICODE or OEM;
+    all that is important is that equal names hash equally.
 
 Arguments:
 
-    NameA & NameB - The names to compare.
+    Name - The name to hash.
 
 Return Value:
 
-    COMPARISON - returns
+    ULONG - The FNV-1a hash of the bytes of the name.
+
+--*/
+
+{
+    ULONG Hash = 0x811c9dc5;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < Name->Length; i += 1) {
+
+        Hash ^= (UCHAR)Name->Buffer[i];
+        Hash *= 0x01000193;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+FatGrowNameTable (
+    IN PFAT_NAME_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves a name table into a larger bucket array.  If we can't
+    get the pool, the table simply keeps working with longer chains.
+
+Arguments:
 
-        IsLessThan    if NameA < NameB lexicalgraphically,
-        IsGreaterThan if NameA > NameB lexicalgraphically,
-        IsEqual       if NameA is equal to NameB
+    Table - Supplies the table to grow.
+
+Return Value:
+
+    None.
 
 --*/
 
 {
+    PFILE_NAME_NODE *NewBuckets;
+    PFILE_NAME_NODE Node;
+    PFILE_NAME_NODE Next;
+    ULONG NewBucketCount;
     ULONG i;
-    ULONG MinLength;
 
     PAGED_CODE();
 
-    //
-    //  Figure out the minimum of the two lengths
-    //
+    if (Table->BucketCount >= FAT_NAME_TABLE_MAX_BUCKETS) {
+
+        return;
+    }
+
+    NewBucketCount = Table->BucketCount * 4;
+
+    NewBuckets = ExAllocatePoolWithTag( PagedPool,
+                                        NewBucketCount * sizeof(PFILE_NAME_NODE),
+                                        TAG_NAME_TABLE );
+
+    if (NewBuckets == NULL) {
+
+        return;
+    }
 
-    MinLength = NameA->Length < NameB->Length ? NameA->Length :
-                                                NameB->Length;
+    RtlZeroMemory( NewBuckets, NewBucketCount * sizeof(PFILE_NAME_NODE) );
 
     //
-    //  Loop through looking at all of the characters in both strings
-    //  testing for equalilty, less than, and greater than
+    //  Rehash every node using the hash it already carries.
     //
 
-    i = (ULONG)RtlCompareMemory( NameA->Buffer, NameB->Buffer, MinLength );
+    for (i = 0; i < Table->BucketCount; i += 1) {
 
+        for (Node = Table->Buckets[i]; Node != NULL; Node = Next) {
 
-    if (i < MinLength) {
+            Next = Node->HashNext;
 
-        return NameA->Buffer[i] < NameB->Buffer[i] ? IsLessThan :
-                                                     IsGreaterThan;
+            Node->HashNext = NewBuckets[ Node->NameHash & (NewBucketCount - 1) ];
+            NewBuckets[ Node->NameHash & (NewBucketCount - 1) ] = Node;
+        }
     }
 
-    if (NameA->Length < NameB->Length) {
+    if (Table->Buckets != &Table->InlineBuckets[0]) {
 
-        return IsLessThan;
+        ExFreePool( Table->Buckets );
     }
 
-    if (NameA->Length > NameB->Length) {
+    Table->Buckets = NewBuckets;
+    Table->BucketCount = NewBucketCount;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+FatRemoveName (
+    IN PFAT_NAME_TABLE Table,
+    IN PFILE_NAME_NODE Name
+    )
 
-        return IsGreaterThan;
+/*++
+
+Routine Description:
+
+    This routine unlinks a single name from its bucket in the name table.
+
+Arguments:
+
+    Table - Supplies the table containing the name.
+
+    Name - Supplies the name to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFILE_NAME_NODE *Link;
+
+    PAGED_CODE();
+
+    for (Link = &Table->Buckets[ Name->NameHash & (Table->BucketCount - 1) ];
+         *Link != NULL;
+         Link = &(*Link)->HashNext) {
+
+        if (*Link == Name) {
+
+            *Link = Name->HashNext;
+            Name->HashNext = NULL;
+
+            Table->EntryCount -= 1;
+
+            return;
+        }
     }
 
-    return IsEqual;
-}
+    //
+    //  The name was not in the table it claimed to be in.
+    //
 
+    NT_ASSERT( FALSE );
+}
@@ -519,6 +519,14 @@ Return Value:
 
         KeInitializeDpc( &Vcb->CleanVolumeDpc, FatCleanVolumeDpc, Vcb );
 
+        //
+        //  Initialize the FAT journal Timer and DPC.
+        //
+
+        KeInitializeTimer( &Vcb->FatJournalTimer );
+
+        KeInitializeDpc( &Vcb->FatJournalDpc, FatFlushFatDpc, Vcb );
+
         //
         //  Initialize the performance counters.
         //
@@ -885,6 +893,15 @@ Return Value:
 
     (VOID)KeRemoveQueueDpc( &Vcb->CleanVolumeDpc );
 
+    //
+    //  Cancel the FAT journal Timer and Dpc.  A worker already queued from
+    //  the Dpc will find the Vcb gone from the global queue.
+    //
+
+    (VOID)KeCancelTimer( &Vcb->FatJournalTimer );
+
+    (VOID)KeRemoveQueueDpc( &Vcb->FatJournalDpc );
+
     //
     //  Free the performance counters memory
     //
@@ -1131,6 +1148,13 @@ Return Value:
         Dcb->Specific.Dcb.UnusedDirentVbo = 0xffffffff;
         Dcb->Specific.Dcb.DeletedDirentHint = 0xffffffff;
 
+        //
+        //  Setup the name tables for the Fcbs we will open below us.
+        //
+
+        FatInitializeNameTable( &Dcb->Specific.Dcb.OemNames );
+        FatInitializeNameTable( &Dcb->Specific.Dcb.UnicodeNames );
+
         //
         //  Setup the free dirent bitmap buffer.
         //
@@ -1801,6 +1825,13 @@ Return Value:
 
         InitializeListHead( &Dcb->Specific.Dcb.ParentDcbQueue );
 
+        //
+        //  Setup the name tables for the Fcbs we will open below us.
+        //
+
+        FatInitializeNameTable( &Dcb->Specific.Dcb.OemNames );
+        FatInitializeNameTable( &Dcb->Specific.Dcb.UnicodeNames );
+
         //
         //  Setup the free dirent bitmap buffer.  Since we don't know the
         //  size of the directory, leave it zero for now.
@@ -1952,6 +1983,19 @@ Return Value:
             ExFreePool(Fcb->Specific.Dcb.FreeDirentBitmap.Buffer);
         }
 
+        //
+        //  Free the dirent index, if we built one.
+        //
+
+        FatDiscardDirentIndex( Fcb );
+
+        //
+        //  Free the name table buckets, if we grew them.
+        //
+
+        FatUninitializeNameTable( &Fcb->Specific.Dcb.OemNames );
+        FatUninitializeNameTable( &Fcb->Specific.Dcb.UnicodeNames );
+
 #if (NTDDI_VERSION >= NTDDI_WIN8)
         //
         //  Uninitialize the oplock.
@@ -3159,7 +3203,7 @@ Return Value:
 
             if (FatAreNamesEqual(IrpContext, *ShortName, *LongOemName) ||
                 (FatFindFcb( IrpContext,
-                             &Fcb->ParentDcb->Specific.Dcb.RootOemNode,
+                             &Fcb->ParentDcb->Specific.Dcb.OemNames,
                              LongOemName,
                              NULL) != NULL)) {
 
@@ -3307,7 +3351,7 @@ Return Value:
 
             if (FatAreNamesEqual(IrpContext, *ShortName, OemA) ||
                 (FatFindFcb( IrpContext,
-                             &Fcb->ParentDcb->Specific.Dcb.RootOemNode,
+                             &Fcb->ParentDcb->Specific.Dcb.OemNames,
                              &OemA,
                              NULL) != NULL)) {
 
@@ -3360,7 +3404,7 @@ Return Value:
             //
 
             FatInsertName( IrpContext,
-                           &Fcb->ParentDcb->Specific.Dcb.RootOemNode,
+                           &Fcb->ParentDcb->Specific.Dcb.OemNames,
                            &Fcb->ShortName );
 
             Fcb->ShortName.Fcb = Fcb;
@@ -3368,7 +3412,7 @@ Return Value:
             if (FlagOn(Fcb->FcbState, FCB_STATE_HAS_OEM_LONG_NAME)) {
 
                 FatInsertName( IrpContext,
-                               &Fcb->ParentDcb->Specific.Dcb.RootOemNode,
+                               &Fcb->ParentDcb->Specific.Dcb.OemNames,
                                &Fcb->LongName.Oem );
 
                 Fcb->LongName.Oem.Fcb = Fcb;
@@ -3377,7 +3421,7 @@ Return Value:
             if (FlagOn(Fcb->FcbState, FCB_STATE_HAS_UNICODE_LONG_NAME)) {
 
                 FatInsertName( IrpContext,
-                               &Fcb->ParentDcb->Specific.Dcb.RootUnicodeNode,
+                               &Fcb->ParentDcb->Specific.Dcb.UnicodeNames,
                                &Fcb->LongName.Unicode );
 
                 Fcb->LongName.Unicode.Fcb = Fcb;
@@ -1525,6 +1525,12 @@ Return Value:
 
         Fcb->Specific.Dcb.UnusedDirentVbo = 0xffffffff;
         Fcb->Specific.Dcb.DeletedDirentHint = 0xffffffff;
+
+        //
+        //  And throw away the dirent index, the directory may have changed.
+        //
+
+        FatDiscardDirentIndex( Fcb );
     }
 }
 